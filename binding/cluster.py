@@ -0,0 +1,179 @@
+# Copyright (C) 2017 Srivats P.
+#
+# This file is part of "Ostinato"
+#
+# This is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>
+"""
+This module lets multiple drones be used together as one traffic
+generator. Requests are fanned out to all the drones of a `DroneCluster`
+in parallel, statistics are aggregated across the drones and transmit
+is started on all of them at the same (wall clock) time.
+"""
+
+import threading
+import time
+from core import ost_pb, DroneProxy
+from rpc import RpcError
+from __init__ import __log__
+
+class DroneCluster(object):
+    """
+    DroneCluster acts as a proxy to a set of Drone instances. Each method
+    takes a list of requests (or port ids) - one for each drone in the
+    order the drones were specified - and returns a list of responses in
+    the same order
+    """
+
+    def __init__(self, drones):
+        """
+        Create a DroneCluster object for the specified drones - each item
+        is a DroneProxy, a host name or a (host name, port number) tuple
+        """
+        self.drones = []
+        for drone in drones:
+            if isinstance(drone, DroneProxy):
+                self.drones.append(drone)
+            elif isinstance(drone, tuple):
+                self.drones.append(DroneProxy(*drone))
+            else:
+                self.drones.append(DroneProxy(drone))
+
+    def connect(self):
+        """
+        Connect to all the Drone instances
+        """
+        self._fanOut(lambda drone, arg: drone.connect(),
+                     [None] * len(self.drones))
+
+    def disconnect(self):
+        """
+        Disconnect from all the Drone instances
+        """
+        self._fanOut(lambda drone, arg: drone.disconnect(),
+                     [None] * len(self.drones))
+
+    def callRpcMethod(self, method_name, requests):
+        """
+        Invoke the RPC method on all the drones in parallel - requests[i] is
+        the request for the i-th drone; a single request is sent to all.
+        Raises RpcError if the method failed on any of the drones
+        """
+        if not isinstance(requests, (list, tuple)):
+            requests = [requests] * len(self.drones)
+        return self._fanOut(
+                lambda drone, request:
+                    drone.callRpcMethod(method_name, request),
+                requests)
+
+    def startTransmit(self, port_ids, lead_time=0.5):
+        """
+        Start transmit on the ports (port_ids[i] is a list of port ids or
+        a PortIdList for the i-th drone) of all the drones at the same
+        time - lead_time secs from now. The drones' clocks need to be
+        synchronized (using PTP or NTP) for aligned starts.
+        Returns the start time (nsecs since the epoch)
+        """
+        start_time = int((time.time() + lead_time) * 1e9)
+
+        requests = []
+        for ids in port_ids:
+            request = ost_pb.SyncStartRequest()
+            request.port_id_list.CopyFrom(self._portIdList(ids))
+            request.start_time = start_time
+            requests.append(request)
+
+        def start(drone, request):
+            try:
+                drone.startTransmitSync(request)
+            except RpcError as e:
+                if not str(e).startswith('invalid RPC method'):
+                    raise
+                __log__.warning('%s: synchronized start not supported - '
+                        'starting now' % drone.hostName())
+                drone.startTransmit(request.port_id_list)
+
+        self._fanOut(start, requests)
+        return start_time
+
+    def stopTransmit(self, port_ids):
+        """
+        Stop transmit on the ports of all the drones
+        """
+        return self.callRpcMethod('stopTransmit',
+                [self._portIdList(ids) for ids in port_ids])
+
+    def clearStats(self, port_ids):
+        """
+        Clear the statistics of the ports of all the drones
+        """
+        return self.callRpcMethod('clearStats',
+                [self._portIdList(ids) for ids in port_ids])
+
+    def getStats(self, port_ids):
+        """
+        Returns the PortStatsList of each drone and a PortStats with the
+        sum of all their counters and rates (port_id is 0)
+        """
+        stats_lists = self.callRpcMethod('getStats',
+                [self._portIdList(ids) for ids in port_ids])
+
+        total = ost_pb.PortStats()
+        total.port_id.id = 0
+        for stats_list in stats_lists:
+            for stats in stats_list.port_stats:
+                for field, value in stats.ListFields():
+                    if field.cpp_type in (field.CPPTYPE_UINT64,
+                                          field.CPPTYPE_UINT32):
+                        setattr(total, field.name,
+                                getattr(total, field.name) + value)
+        return stats_lists, total
+
+    def _portIdList(self, ids):
+        if isinstance(ids, ost_pb.PortIdList):
+            return ids
+        port_id_list = ost_pb.PortIdList()
+        for id in ids:
+            port_id_list.port_id.add().id = id
+        return port_id_list
+
+    def _fanOut(self, fn, args):
+        """
+        Calls fn(drone, args[i]) for each drone in a thread of its own and
+        returns the results - raises RpcError if any of the calls failed
+        """
+        if len(args) != len(self.drones):
+            raise ValueError('expected %d items, got %d' %
+                    (len(self.drones), len(args)))
+
+        results = [None] * len(self.drones)
+        errors = [None] * len(self.drones)
+
+        def run(i):
+            try:
+                results[i] = fn(self.drones[i], args[i])
+            except Exception as e:
+                errors[i] = e
+
+        threads = [threading.Thread(target=run, args=(i,))
+                        for i in range(len(self.drones))]
+        for t in threads:
+            t.start()
+        for t in threads:
+            t.join()
+
+        failed = ['%s: %s' % (self.drones[i].hostName(), errors[i])
+                        for i in range(len(self.drones)) if errors[i]]
+        if failed:
+            raise RpcError('; '.join(failed))
+        return results
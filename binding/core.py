@@ -21,6 +21,8 @@ All drone configuration is done by creating an instance of the
 """
 
 import os
+import struct
+import zlib
 from rpc import OstinatoRpcChannel, OstinatoRpcController, RpcError
 import protocols.protocol_pb2 as ost_pb
 import protocols.emulproto_pb2 as emul
@@ -35,7 +37,8 @@ class DroneProxy(object):
     def __init__(self, host_name, port_number=7878):
         """
         Create a DroneProxy object as a proxy to the Drone instance
-        running at the specified host and port
+        running at the specified host and port - or, for a host_name of
+        'local:<name>', at its local socket <name> on this host
         """
         self.host = host_name
         self.port = port_number
@@ -71,10 +74,14 @@ class DroneProxy(object):
         ver = ost_pb.VersionInfo()
         ver.client_name = 'python-ostinato'
         ver.version = __version__
+        ver.rpc_compression = True
+        ver.rpc_pipelining = True
         compat = self.checkVersion(ver)
         if compat.result == ost_pb.VersionCompatibility.kIncompatible:
             raise RpcError('incompatible version %s (%s)' % 
                     (ver.version, compat.notes))
+        self.channel.compression = compat.rpc_compression
+        self.channel.pipelining = compat.rpc_pipelining
 
     def disconnect(self):
         """
@@ -88,6 +95,124 @@ class DroneProxy(object):
                     self.stub, controller, request, None)
         return controller.response
 
+    def callRpcMethodAsync(self, method_name, request=None):
+        """
+        Send the RPC request without waiting for its reply - returns a
+        RpcFuture whose result() is the response. Many RPCs can be
+        outstanding at a time if the drone supports pipelining
+        """
+        method = self.stub.GetDescriptor().FindMethodByName(method_name)
+        return self.channel.CallMethodAsync(method,
+                request if request is not None else self.void,
+                self.stub.GetResponseClass(method))
+
+    def callRpcMethods(self, calls):
+        """
+        Invoke many RPCs - calls is a list of (method name, request) tuples.
+        The RPCs are pipelined i.e. all are sent before waiting for any
+        reply; returns the responses in the same order as calls
+        """
+        futures = [self.callRpcMethodAsync(method_name, request)
+                        for method_name, request in calls]
+        return [future.result() for future in futures]
+
+    def applyStreams(self, port_id, streams, replace=True, batch_size=1000):
+        """
+        Configure the specified streams (a list of ost_pb.Stream with the
+        stream ids set) on the port with the least round trips - replacing
+        all existing streams of the port, if replace is True
+        """
+        deltas = []
+        if replace:
+            delta = ost_pb.PortConfigDelta()
+            delta.port_id.id = port_id
+            delta.deleted_stream_id.extend(
+                    self.getStreamIdList(delta.port_id).stream_id)
+            deltas.append(delta)
+        for i in range(0, len(streams), batch_size):
+            if not deltas or len(deltas[-1].new_stream):
+                delta = ost_pb.PortConfigDelta()
+                delta.port_id.id = port_id
+                deltas.append(delta)
+            deltas[-1].new_stream.extend(streams[i:i+batch_size])
+        return self.callRpcMethods([('applyPortConfig', delta)
+                                        for delta in deltas])
+
+    def uploadFrames(self, port_id, frame_set_id, frames, gaps=None,
+                     packets_per_sec=0, compress=True, chunk_size=1048576):
+        """
+        Upload frames (a list of byte strings, without the CRC) as the
+        frame set of the port for its streams with this frame_set_id -
+        sent with gaps (nsecs from each frame to the next) or, if not
+        given, at packets_per_sec. The chunks are pipelined
+        """
+        if gaps is None:
+            gaps = [0] * len(frames)
+        data = b''.join([struct.pack('>IH', gap, len(frame)) + frame
+                            for frame, gap in zip(frames, gaps)])
+        # No frames (not even compressed) deletes the set
+        compress = compress and bool(data)
+        if compress:
+            data = struct.pack('>I', len(data)) + zlib.compress(data)
+
+        chunks = []
+        for offset in range(0, max(len(data), 1), chunk_size):
+            chunk = ost_pb.FrameSetChunk()
+            chunk.port_id.id = port_id
+            chunk.frame_set_id = frame_set_id
+            chunk.offset = offset
+            chunk.data = data[offset:offset+chunk_size]
+            chunk.is_compressed = compress
+            chunk.packets_per_sec = packets_per_sec
+            chunks.append(chunk)
+        chunks[-1].is_last = True
+        return self.callRpcMethods([('uploadFrameSet', chunk)
+                                        for chunk in chunks])
+
+    def pollStats(self, port_ids, stream_stats=False):
+        """
+        Get the stats of many ports in one go - returns a dict of port id to
+        ost_pb.PortStats and, if stream_stats is True, also the
+        ost_pb.StreamStatsList of the ports (fetched in the same round trip)
+        """
+        port_id_list = ost_pb.PortIdList()
+        for port_id in port_ids:
+            port_id_list.port_id.add().id = port_id
+        calls = [('getStats', port_id_list)]
+        if stream_stats:
+            calls.append(('getStreamStats', port_id_list))
+        responses = self.callRpcMethods(calls)
+
+        stats = dict((s.port_id.id, s) for s in responses[0].port_stats)
+        if stream_stats:
+            return stats, responses[1]
+        return stats
+
+    def statsHistory(self, port_id, start_time=0):
+        """
+        Get the recent stats of a port kept by the drone (see
+        getStatsHistory) - returns a list of (time, ost_pb.PortStats)
+        tuples, oldest first, each with all the stats of its time
+        """
+        request = ost_pb.StatsHistoryRequest()
+        request.port_id.id = port_id
+        request.start_time = start_time
+        history = self.getStatsHistory(request)
+
+        # Samples are delta encoded - a repeated field is sent in full
+        # if it has changed
+        samples = []
+        stats = ost_pb.PortStats()
+        for sample in history.sample:
+            for field, value in sample.port_stats.ListFields():
+                if field.label == field.LABEL_REPEATED:
+                    stats.ClearField(field.name)
+            stats.MergeFrom(sample.port_stats)
+            full = ost_pb.PortStats()
+            full.CopyFrom(stats)
+            samples.append((sample.time, full))
+        return samples
+
     def saveCaptureBuffer(self, buffer, file_name):
         """
         Save the capture buffer in a PCAP file
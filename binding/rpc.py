@@ -19,9 +19,13 @@ from google.protobuf.message import EncodeError, DecodeError
 from google.protobuf.service import RpcChannel
 from google.protobuf.service import RpcController
 import logging
+import os
 import socket
 import struct
 import sys
+import tempfile
+import threading
+import zlib
 
 class PeerClosedConnError(Exception):
     def __init__(self, msg):
@@ -48,16 +52,95 @@ class OstinatoRpcController(RpcController):
     def __init__(self):
         super(OstinatoRpcController, self).__init__()
 
+class RpcFuture(object):
+    """
+    Reply of an RPC sent by OstinatoRpcChannel.CallMethodAsync() -
+    result() waits for the reply (receiving the replies of any RPCs sent
+    before it on the way)
+    """
+    def __init__(self, channel, method, response_class):
+        self.channel = channel
+        self.method = method
+        self.response_class = response_class
+        self._done = False
+        self._response = None
+        self._exception = None
+
+    def done(self):
+        """
+        Returns True if the reply has been received
+        """
+        return self._done
+
+    def result(self):
+        """
+        Waits for and returns the response of the RPC; raises the error
+        (if any) of the RPC
+        """
+        while not self._done:
+            self.channel._receiveReply(self)
+        if self._exception:
+            raise self._exception
+        return self._response
+
+    def _complete(self, response=None, exception=None):
+        self._response = response
+        self._exception = exception
+        self._done = True
+
 class OstinatoRpcChannel(RpcChannel):
+    # see rpc/pbrpccommon.h
+    MSG_HDR_SIZE = 8
+    MSG_HDR_PIPELINED_SIZE = 12
+    MSG_TYPE_REQUEST = 1
+    MSG_TYPE_RESPONSE = 2
+    MSG_TYPE_BLOB = 3
+    MSG_TYPE_ERROR = 4
+    MSG_TYPE_NOTIFY = 5
+    MSG_TYPE_MASK = 0x7fff
+    MSG_FLAG_COMPRESSED = 0x8000
+    COMPRESS_THRESHOLD = 64*1024
+
+    RECV_SIZE = 64*1024
+
     def __init__(self):
         self.log = logging.getLogger(__name__)
         self.log.debug('opening socket')
+        # set once negotiated by checkVersion
+        self.compression = False
+        self.pipelining = False
+        self.lock = threading.RLock()
+        self._reset()
+
+    def _reset(self):
+        self._rxbuf = bytearray()
+        self._rxoff = 0
+        self._next_request_id = 1
+        self._outstanding = {}  # request id => RpcFuture
+
+    LOCAL_PREFIX = 'local:' # see rpc/pbrpcchannel.h
 
     def connect(self, host, port):
-        self.peer = '%s:%d' % (host, port)
-        self.log.debug('connecting to %s', self.peer)
+        """
+        host of 'local:<name>' connects to the AF_UNIX socket name (see
+        Drone's RpcServer/LocalSocket setting) instead of TCP port - a name
+        without a path is in the temp dir, as Qt puts it
+        """
+        self._reset()
         try:
+            if host.startswith(self.LOCAL_PREFIX):
+                path = host[len(self.LOCAL_PREFIX):]
+                if not os.path.isabs(path):
+                    path = os.path.join(tempfile.gettempdir(), path)
+                self.peer = path
+                self.log.debug('connecting to %s', self.peer)
+                self.sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+                self.sock.connect(path)
+                return
+            self.peer = '%s:%d' % (host, port)
+            self.log.debug('connecting to %s', self.peer)
             self.sock = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+            self.sock.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
             self.sock.connect((host, port))
         except socket.error as e:
             error = 'ERROR: Unable to connect to Drone %s (%s)' % (
@@ -70,68 +153,14 @@ class OstinatoRpcChannel(RpcChannel):
         self.sock.close()
 
     def CallMethod(self, method, controller, request, response_class, done):
-        MSG_HDR_SIZE = 8
-        MSG_TYPE_REQUEST = 1
-        MSG_TYPE_RESPONSE = 2
-        MSG_TYPE_BLOB = 3
-        MSG_TYPE_ERROR = 4
-
         error = ''
         try:
-            self.log.info('invoking RPC %s(%s): %s', method.name, 
-                    type(request).__name__, response_class.__name__)
-            if not request.IsInitialized():
-                raise RpcError('missing required fields in request')
-            self.log.debug('serializing request arg %s', request)
-            req = request.SerializeToString()
-            hdr = struct.pack('>HHI', MSG_TYPE_REQUEST, method.index, len(req))
-            self.log.debug('req.hdr = %r', hdr)
-            self.sock.sendall(hdr + req)
-
-            # receive and parse header
-            self.log.debug('receiving response hdr')
-            hdr = ''
-            while len(hdr) < MSG_HDR_SIZE:
-                chunk = self.sock.recv(MSG_HDR_SIZE - len(hdr))
-                if chunk == '':
-                    raise PeerClosedConnError('connection closed by peer')
-                hdr = hdr + chunk
-
-            (msg_type, method_index, resp_len) = struct.unpack('>HHI', hdr)
-            self.log.debug('resp hdr: type = %d, method = %d, len = %d',
-                    msg_type, method_index, resp_len)
-
-            # receive and parse the actual response message
-            self.log.debug('receiving response data')
-            resp = ''
-            while len(resp) < resp_len:
-                chunk = self.sock.recv(resp_len - len(resp))
-                if chunk == '':
-                    raise PeerClosedConnError('connection closed by peer')
-                resp = resp + chunk
-
-            # verify response method is same as the one requested
-            if method_index != method.index:
-                raise RpcMismatchError('RPC mismatch', 
-                        expected = method.index, received = method_index)
-
-            if msg_type == MSG_TYPE_RESPONSE:
-                    response = response_class()
-                    response.ParseFromString(resp)
-                    self.log.debug('parsed response %s', response)
-            elif msg_type == MSG_TYPE_BLOB:
-                response = resp
-            elif msg_type == MSG_TYPE_ERROR:
-                raise RpcError(unicode(resp, 'utf-8'))
-            else:
-                raise RpcError('unknown RPC msg type %d' % msg_type)
-
-            controller.response = response
-
+            controller.response = self.CallMethodAsync(
+                    method, request, response_class).result()
         except socket.error as e:
             error = 'ERROR: RPC %s() to Drone %s failed (%s)' % (
                     method.name, self.peer, e)
-            self.log.exception(error+e)
+            self.log.exception(error)
             raise
         except PeerClosedConnError as e:
             error = 'ERROR: Drone %s closed connection receiving reply ' \
@@ -148,7 +177,7 @@ class OstinatoRpcChannel(RpcChannel):
         except DecodeError as e:
             error = 'ERROR: Failed to parse %s response for RPC %s() ' \
                   'from Drone %s (%s)' % (
-                    type(response).__name__, method.name, self.peer, e)
+                    response_class.__name__, method.name, self.peer, e)
             self.log.exception(error)
             raise
         except RpcMismatchError as e:
@@ -165,5 +194,153 @@ class OstinatoRpcChannel(RpcChannel):
             if error:
                 print(error)
 
+    def CallMethodAsync(self, method, request, response_class):
+        """
+        Sends the RPC request and returns a RpcFuture for its reply without
+        waiting for it. With pipelining, many RPCs may be outstanding at a
+        time; otherwise the reply of the previous RPC is received first
+        """
+        with self.lock:
+            self.log.info('invoking RPC %s(%s): %s', method.name,
+                    type(request).__name__, response_class.__name__)
+            if not request.IsInitialized():
+                raise RpcError('missing required fields in request')
+            if self.log.isEnabledFor(logging.DEBUG):
+                self.log.debug('serializing request arg %s', request)
+
+            # Without pipelining, drone takes only one RPC at a time
+            if not self.pipelining:
+                while self._outstanding:
+                    self._receiveReply()
+
+            req = request.SerializeToString()
+            msg_type = self.MSG_TYPE_REQUEST
+            if self.compression and len(req) >= self.COMPRESS_THRESHOLD:
+                # same format as qCompress()
+                compressed = struct.pack('>I', len(req)) + zlib.compress(req, 1)
+                if len(compressed) < len(req):
+                    req = compressed
+                    msg_type |= self.MSG_FLAG_COMPRESSED
+
+            future = RpcFuture(self, method, response_class)
+            request_id = self._next_request_id
+            self._next_request_id = (self._next_request_id + 1) & 0xffffffff \
+                                        or 1 # 0 is for notifications
+            if self.pipelining:
+                hdr = struct.pack('>HHII', msg_type, method.index, len(req),
+                                  request_id)
+            else:
+                hdr = struct.pack('>HHI', msg_type, method.index, len(req))
+            self.sock.sendall(hdr + req)
+            self._outstanding[request_id] = future
+
+            return future
+
+    def _read(self, size):
+        """
+        Returns the next size bytes received - replies that arrived
+        together are received with one recv()
+        """
+        avail = len(self._rxbuf) - self._rxoff
+
+        # Large msgs (e.g. capture buffers) are received in place
+        if size - avail > self.RECV_SIZE:
+            data = bytearray(size)
+            view = memoryview(data)
+            view[:avail] = self._rxbuf[self._rxoff:]
+            self._rxbuf = bytearray()
+            self._rxoff = 0
+            while avail < size:
+                n = self.sock.recv_into(view[avail:], size - avail)
+                if n == 0:
+                    raise PeerClosedConnError('connection closed by peer')
+                avail += n
+            return bytes(data)
+
+        while avail < size:
+            if self._rxoff:
+                del self._rxbuf[:self._rxoff]
+                self._rxoff = 0
+            chunk = self.sock.recv(self.RECV_SIZE)
+            if not chunk:
+                raise PeerClosedConnError('connection closed by peer')
+            self._rxbuf += chunk
+            avail = len(self._rxbuf)
+
+        data = bytes(self._rxbuf[self._rxoff:self._rxoff+size])
+        self._rxoff += size
+        return data
+
+    def _receiveReply(self, waiting=None):
+        """
+        Receives the next reply and completes its RpcFuture; notifications
+        are skipped. If the connection fails, all outstanding RPCs fail
+        """
+        with self.lock:
+            # May have been received by another thread meanwhile
+            if waiting and waiting.done():
+                return
+            try:
+                self._receiveMsg()
+            except (socket.error, PeerClosedConnError) as e:
+                for future in self._outstanding.values():
+                    future._complete(exception=e)
+                self._outstanding.clear()
+
+    def _receiveMsg(self):
+        hdr_size = self.MSG_HDR_PIPELINED_SIZE if self.pipelining \
+                        else self.MSG_HDR_SIZE
+
+        self.log.debug('receiving response hdr')
+        hdr = self._read(hdr_size)
+        if self.pipelining:
+            (msg_type, method_index, resp_len, request_id) = \
+                    struct.unpack('>HHII', hdr)
+        else:
+            (msg_type, method_index, resp_len) = struct.unpack('>HHI', hdr)
+            request_id = None
+        self.log.debug('resp hdr: type = %d, method = %d, len = %d',
+                msg_type, method_index, resp_len)
+
+        self.log.debug('receiving response data')
+        resp = self._read(resp_len)
+
+        if msg_type & self.MSG_FLAG_COMPRESSED:
+            resp = zlib.decompress(resp[4:])
+        msg_type &= self.MSG_TYPE_MASK
+
+        if msg_type == self.MSG_TYPE_NOTIFY:
+            self.log.debug('skipping notification %d', method_index)
+            return
+
+        if request_id is None:
+            # the only one outstanding
+            request_id = next(iter(self._outstanding), None)
+        future = self._outstanding.pop(request_id, None)
+        if not future:
+            raise RpcError('reply for unknown request %s' % request_id)
+
+        # verify response method is same as the one requested
+        if method_index != future.method.index:
+            future._complete(exception=RpcMismatchError('RPC mismatch',
+                    expected = future.method.index, received = method_index))
+            return
+
+        try:
+            if msg_type == self.MSG_TYPE_RESPONSE:
+                response = future.response_class()
+                response.ParseFromString(resp)
+                if self.log.isEnabledFor(logging.DEBUG):
+                    self.log.debug('parsed response %s', response)
+            elif msg_type == self.MSG_TYPE_BLOB:
+                response = resp
+            elif msg_type == self.MSG_TYPE_ERROR:
+                raise RpcError(resp.decode('utf-8'))
+            else:
+                raise RpcError('unknown RPC msg type %d' % msg_type)
+        except (DecodeError, RpcError) as e:
+            future._complete(exception=e)
+            return
 
+        future._complete(response)
 
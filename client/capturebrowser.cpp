@@ -0,0 +1,109 @@
+/*
+Copyright (C) 2017 Srivats P.
+
+This file is part of "Ostinato"
+
+This is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+#include "capturebrowser.h"
+
+#include "capturemodel.h"
+#include "portgroup.h"
+
+#include <QHeaderView>
+
+CaptureBrowser::CaptureBrowser(PortGroup *portGroup, quint32 portId,
+        QWidget *parent)
+    : QWidget(parent, Qt::Window)
+{
+    portGroup_ = portGroup;
+    portId_ = portId;
+
+    setupUi(this);
+    setAttribute(Qt::WA_DeleteOnClose);
+
+    if (int(portId) < portGroup->numPorts())
+        setWindowTitle(QString("Capture - %1")
+                .arg(portGroup->mPorts.at(portId)->userAlias()));
+
+    teHexDump->setFont(QFont("Courier"));
+
+    model_ = new CaptureModel(portGroup, portId, this);
+    tvPackets->setModel(model_);
+    tvPackets->verticalHeader()->hide();
+    tvPackets->horizontalHeader()->setStretchLastSection(true);
+
+    connect(tvPackets->selectionModel(),
+            SIGNAL(currentRowChanged(const QModelIndex&, const QModelIndex&)),
+            SLOT(updateHexDump()));
+    // The selected packet may be fetched only after it is selected
+    connect(model_, SIGNAL(dataChanged(const QModelIndex&, const QModelIndex&)),
+            SLOT(updateHexDump()));
+    connect(model_, SIGNAL(modelReset()), SLOT(updateHexDump()));
+
+    // Port (and its capture) is gone with its portgroup
+    connect(portGroup, SIGNAL(destroyed()), SLOT(close()));
+}
+
+void CaptureBrowser::on_pbRefresh_clicked()
+{
+    model_->refresh();
+}
+
+void CaptureBrowser::on_pbWireshark_clicked()
+{
+    QList<uint> portList;
+
+    portList.append(portId_);
+    portGroup_->viewCapture(&portList);
+}
+
+void CaptureBrowser::updateHexDump()
+{
+    QModelIndex current = tvPackets->selectionModel()->currentIndex();
+    QByteArray data;
+    int length;
+    QString dump;
+
+    if (!current.isValid() || !model_->packetData(current.row(), data,
+                                                  length)) {
+        teHexDump->clear();
+        return;
+    }
+
+    // offset, 16 bytes in hex and as ascii per line
+    for (int i = 0; i < data.size(); i += 16) {
+        QString ascii;
+
+        dump.append(QString("%1 ").arg(i, 4, 16, QChar('0')));
+        for (int j = i; j < i + 16; j++) {
+            if (j < data.size()) {
+                uchar c = uchar(data.at(j));
+
+                dump.append(QString(" %1").arg(c, 2, 16, QChar('0')));
+                ascii.append(((c >= 0x20) && (c < 0x7f)) ?
+                        QChar(c) : QChar('.'));
+            }
+            else
+                dump.append("   ");
+        }
+        dump.append("  ").append(ascii).append('\n');
+    }
+
+    if (data.size() < length)
+        dump.append(QString("(%1 of %2 bytes)").arg(data.size()).arg(length));
+
+    teHexDump->setPlainText(dump);
+}
@@ -0,0 +1,53 @@
+/*
+Copyright (C) 2017 Srivats P.
+
+This file is part of "Ostinato"
+
+This is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+#ifndef _CAPTURE_BROWSER_H
+#define _CAPTURE_BROWSER_H
+
+#include "ui_capturebrowser.h"
+
+#include <QWidget>
+
+class CaptureModel;
+class PortGroup;
+
+/*!
+  Window listing the packets captured on a port - the packets are
+  fetched from drone only as they are scrolled to, so even a large
+  capture can be browsed without downloading all of it
+*/
+class CaptureBrowser : public QWidget, public Ui::CaptureBrowser
+{
+    Q_OBJECT
+public:
+    CaptureBrowser(PortGroup *portGroup, quint32 portId,
+                   QWidget *parent = 0);
+
+private slots:
+    void on_pbRefresh_clicked();
+    void on_pbWireshark_clicked();
+    void updateHexDump();
+
+private:
+    PortGroup *portGroup_;
+    quint32 portId_;
+    CaptureModel *model_;
+};
+
+#endif
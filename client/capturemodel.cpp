@@ -0,0 +1,430 @@
+/*
+Copyright (C) 2017 Srivats P.
+
+This file is part of "Ostinato"
+
+This is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+#include "capturemodel.h"
+
+#include "portgroup.h"
+
+#include <QHostAddress>
+#include <QtEndian>
+#include <limits.h>
+#include <string.h>
+
+enum {
+    kNumber,
+    kTime,
+    kLength,
+    kSummary,
+    kFieldCount
+};
+
+static QStringList columns_ = QStringList()
+    << "No."
+    << "Time"
+    << "Length"
+    << "Summary";
+
+// pcap file and record header sizes
+static const int kFileHdrSize = 24;
+static const int kRecordHdrSize = 16;
+
+static QString macString(const uchar *mac)
+{
+    return QString("%1:%2:%3:%4:%5:%6")
+        .arg(mac[0], 2, 16, QChar('0'))
+        .arg(mac[1], 2, 16, QChar('0'))
+        .arg(mac[2], 2, 16, QChar('0'))
+        .arg(mac[3], 2, 16, QChar('0'))
+        .arg(mac[4], 2, 16, QChar('0'))
+        .arg(mac[5], 2, 16, QChar('0'));
+}
+
+// One line summary of a frame - from its Ethernet, VLAN, ARP, IPv4/v6 and
+// TCP/UDP/ICMP headers, as much as are present in the (truncated) frame
+static QString packetSummary(const QByteArray &frame)
+{
+    const uchar *p = (const uchar*) frame.constData();
+    int len = frame.size();
+    int pos = 12;
+    quint16 type;
+    quint8 l4Proto;
+    QString vlans, src, dst;
+
+    if (len < 14)
+        return QString("Ethernet (truncated)");
+
+    type = qFromBigEndian<quint16>(p + pos);
+    while (((type == 0x8100) || (type == 0x88a8) || (type == 0x9100))
+            && ((pos + 6) <= len)) {
+        vlans += QString("VLAN %1 ")
+                    .arg(qFromBigEndian<quint16>(p + pos + 2) & 0x0fff);
+        pos += 4;
+        type = qFromBigEndian<quint16>(p + pos);
+    }
+    pos += 2;
+
+    switch (type)
+    {
+    case 0x0806: // ARP (Ethernet/IPv4 only)
+        if ((pos + 28) > len)
+            break;
+        if (qFromBigEndian<quint16>(p + pos + 6) == 1)
+            return vlans + QString("ARP Who has %1? Tell %2")
+                .arg(QHostAddress(qFromBigEndian<quint32>(p + pos + 24))
+                        .toString())
+                .arg(QHostAddress(qFromBigEndian<quint32>(p + pos + 14))
+                        .toString());
+        return vlans + QString("ARP %1 is at %2")
+            .arg(QHostAddress(qFromBigEndian<quint32>(p + pos + 14))
+                    .toString())
+            .arg(macString(p + pos + 8));
+
+    case 0x0800: // IPv4
+    {
+        int hdrLen;
+
+        if ((pos + 20) > len)
+            break;
+        hdrLen = (p[pos] & 0x0f) * 4;
+        l4Proto = p[pos + 9];
+        src = QHostAddress(qFromBigEndian<quint32>(p + pos + 12)).toString();
+        dst = QHostAddress(qFromBigEndian<quint32>(p + pos + 16)).toString();
+        pos += hdrLen;
+        goto _l4;
+    }
+
+    case 0x86dd: // IPv6 (without extension headers)
+        if ((pos + 40) > len)
+            break;
+        l4Proto = p[pos + 6];
+        src = QHostAddress((quint8*) p + pos + 8).toString();
+        dst = QHostAddress((quint8*) p + pos + 24).toString();
+        pos += 40;
+        goto _l4;
+
+    default:
+        break;
+    }
+
+    return vlans + QString("%1 > %2 Type 0x%3")
+        .arg(macString(p + 6))
+        .arg(macString(p))
+        .arg(type, 4, 16, QChar('0'));
+
+_l4:
+    switch (l4Proto)
+    {
+    case 6:  // TCP
+    case 17: // UDP
+        if ((pos + 4) > len)
+            break;
+        return vlans + QString("%1 %2:%3 > %4:%5")
+            .arg(l4Proto == 6 ? "TCP" : "UDP")
+            .arg(src).arg(qFromBigEndian<quint16>(p + pos))
+            .arg(dst).arg(qFromBigEndian<quint16>(p + pos + 2));
+    case 1:  // ICMP
+    case 58: // ICMPv6
+        if ((pos + 2) > len)
+            break;
+        return vlans + QString("%1 %2 > %3 Type %4 Code %5")
+            .arg(l4Proto == 1 ? "ICMP" : "ICMPv6")
+            .arg(src).arg(dst).arg(p[pos]).arg(p[pos + 1]);
+    default:
+        break;
+    }
+
+    return vlans + QString("%1 %2 > %3 Protocol %4")
+        .arg(type == 0x0800 ? "IPv4" : "IPv6")
+        .arg(src).arg(dst).arg(l4Proto);
+}
+
+CaptureModel::CaptureModel(PortGroup *portGroup, quint32 portId,
+        QObject *parent)
+    : QAbstractTableModel(parent)
+{
+    portGroup_ = portGroup;
+    portId_ = portId;
+
+    connect(portGroup_,
+            SIGNAL(capturePacketsReceived(quint32, quint64,
+                    const OstProto::CaptureChunk*)),
+            this,
+            SLOT(when_capturePacketsReceived(quint32, quint64,
+                    const OstProto::CaptureChunk*)));
+
+    refresh();
+}
+
+int CaptureModel::rowCount(const QModelIndex &parent) const
+{
+    if (parent.isValid())
+        return 0;
+
+    return count_;
+}
+
+int CaptureModel::columnCount(const QModelIndex &parent) const
+{
+    if (parent.isValid())
+        return 0;
+
+    return kFieldCount;
+}
+
+QVariant CaptureModel::headerData(
+        int section,
+        Qt::Orientation orientation,
+        int role) const
+{
+    if (role != Qt::DisplayRole)
+        return QVariant();
+
+    switch (orientation) {
+        case Qt::Horizontal:
+            return columns_[section];
+        case Qt::Vertical:
+            return QString("%1").arg(section + 1);
+        default:
+            Q_ASSERT(false); // Unreachable
+    }
+
+    return QVariant();
+}
+
+QVariant CaptureModel::data(const QModelIndex &index, int role) const
+{
+    const Packet *pkt;
+
+    if (!index.isValid() || (index.row() >= count_))
+        return QVariant();
+
+    if (role == Qt::TextAlignmentRole) {
+        if (index.column() == kSummary)
+            return int(Qt::AlignLeft | Qt::AlignVCenter);
+        return int(Qt::AlignRight | Qt::AlignVCenter);
+    }
+
+    if (role != Qt::DisplayRole)
+        return QVariant();
+
+    if (index.column() == kNumber)
+        return index.row() + 1;
+
+    // Not fetched yet - will be updated once fetched
+    pkt = packet(index.row());
+    if (!pkt)
+        return QString("...");
+
+    switch (index.column()) {
+        case kTime:
+            return QString("%1").arg((pkt->nsec - firstNsec_)/1e9, 0, 'f', 6);
+        case kLength:
+            return pkt->length;
+        case kSummary:
+            return packetSummary(pkt->data);
+        default:
+            Q_ASSERT(false); // Unreachable
+    }
+
+    return QVariant();
+}
+
+/*!
+  Returns the (upto kSnapLen bytes of) data and captured length of the
+  packet at row - returns false if the packet is not fetched yet
+*/
+bool CaptureModel::packetData(int row, QByteArray &data, int &length) const
+{
+    const Packet *pkt = packet(row);
+
+    if (!pkt)
+        return false;
+
+    data = pkt->data;
+    length = pkt->length;
+    return true;
+}
+
+//! Re-reads the capture - also takes a fresh snapshot of a ring capture
+void CaptureModel::refresh()
+{
+    pages_.clear();
+    pageLru_.clear();
+    pendingPages_.clear();
+    count_ = 0;
+    hasFileHeader_ = false;
+    isSwapped_ = false;
+    isNsec_ = false;
+    firstNsec_ = 0;
+    reset();
+
+    // Page 0 with the file header
+    pendingPages_.insert(0);
+    portGroup_->getCapturePackets(portId_, 0,
+            kFileHdrSize + kPagePackets*(kRecordHdrSize + kSnapLen),
+            kSnapLen, true);
+}
+
+void CaptureModel::when_capturePacketsReceived(quint32 portId,
+        quint64 packetIndex, const OstProto::CaptureChunk *chunk)
+{
+    int page = int(packetIndex / kPagePackets);
+    int offset = 0;
+    int count;
+    QByteArray records;
+    QVector<Packet> packets;
+
+    if (portId != portId_)
+        return;
+
+    // Not asked for (or asked for before a refresh)
+    if (!pendingPages_.contains(page))
+        return;
+
+    if (!chunk) {
+        pendingPages_.remove(page);
+        return;
+    }
+
+    records = QByteArray(chunk->data().data(), int(chunk->data().size()));
+
+    if (!hasFileHeader_)
+    {
+        quint32 magic;
+
+        // No capture data (yet)
+        if (records.size() < kFileHdrSize) {
+            pendingPages_.remove(page);
+            return;
+        }
+
+        memcpy(&magic, records.constData(), sizeof(magic));
+        switch (magic)
+        {
+            case 0xa1b2c3d4: isSwapped_ = false; isNsec_ = false; break;
+            case 0xa1b23c4d: isSwapped_ = false; isNsec_ = true; break;
+            case 0xd4c3b2a1: isSwapped_ = true; isNsec_ = false; break;
+            case 0x4d3cb2a1: isSwapped_ = true; isNsec_ = true; break;
+            default:
+                // A page fetched before the refresh - wait for the header
+                return;
+        }
+        hasFileHeader_ = true;
+        offset = kFileHdrSize;
+    }
+
+    parseRecords(records, offset, packets);
+    if ((packetIndex == 0) && packets.size())
+        firstNsec_ = packets.at(0).nsec;
+
+    pendingPages_.remove(page);
+    pages_.insert(page, packets);
+    pageLru_.removeAll(page);
+    pageLru_.append(page);
+    while (pages_.size() > kMaxPages)
+        pages_.remove(pageLru_.takeFirst());
+
+    // The capture may have grown since the last fetch
+    count = int(qMin(chunk->packet_count(), quint64(INT_MAX)));
+    if (count > count_) {
+        beginInsertRows(QModelIndex(), count_, count - 1);
+        count_ = count;
+        endInsertRows();
+    }
+
+    if (packets.size())
+        emit dataChanged(index(page*kPagePackets, 0),
+                index(page*kPagePackets + packets.size() - 1,
+                      kFieldCount - 1));
+}
+
+const CaptureModel::Packet* CaptureModel::packet(int row) const
+{
+    int page = row / kPagePackets;
+    int i = row % kPagePackets;
+    QHash<int, QVector<Packet> >::const_iterator iter;
+
+    // Fetch the adjacent pages before they are scrolled to
+    fetchPage(page - 1);
+    fetchPage(page + 1);
+
+    iter = pages_.constFind(page);
+    if (iter == pages_.constEnd()) {
+        fetchPage(page);
+        return NULL;
+    }
+
+    // Page was fetched while its packets were still being captured
+    if (i >= iter->size()) {
+        pages_.remove(page);
+        pageLru_.removeAll(page);
+        fetchPage(page);
+        return NULL;
+    }
+
+    if (pageLru_.last() != page) {
+        pageLru_.removeAll(page);
+        pageLru_.append(page);
+    }
+
+    return &iter->at(i);
+}
+
+void CaptureModel::fetchPage(int page) const
+{
+    if ((page < 0) || (page*kPagePackets >= count_) || !hasFileHeader_)
+        return;
+
+    if (pages_.contains(page) || pendingPages_.contains(page))
+        return;
+
+    pendingPages_.insert(page);
+    portGroup_->getCapturePackets(portId_, quint64(page)*kPagePackets,
+            kPagePackets*(kRecordHdrSize + kSnapLen), kSnapLen);
+}
+
+//! Appends the (upto kPagePackets) records from offset in records
+void CaptureModel::parseRecords(const QByteArray &records, int offset,
+        QVector<Packet> &packets) const
+{
+    packets.reserve(kPagePackets);
+    while (((offset + kRecordHdrSize) <= records.size())
+            && (packets.size() < kPagePackets))
+    {
+        quint32 hdr[4];
+        Packet pkt;
+
+        memcpy(hdr, records.constData() + offset, sizeof(hdr));
+        if (isSwapped_) {
+            for (int i = 0; i < 4; i++)
+                hdr[i] = qbswap(hdr[i]);
+        }
+
+        if ((offset + kRecordHdrSize + int(hdr[2])) > records.size())
+            break;
+
+        pkt.nsec = quint64(hdr[0])*1000000000ULL
+                    + (isNsec_ ? hdr[1] : quint64(hdr[1])*1000);
+        pkt.length = hdr[3];
+        pkt.data = records.mid(offset + kRecordHdrSize, hdr[2]);
+        packets.append(pkt);
+
+        offset += kRecordHdrSize + hdr[2];
+    }
+}
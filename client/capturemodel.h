@@ -0,0 +1,94 @@
+/*
+Copyright (C) 2017 Srivats P.
+
+This file is part of "Ostinato"
+
+This is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+#ifndef _CAPTURE_MODEL_H
+#define _CAPTURE_MODEL_H
+
+#include <QAbstractTableModel>
+#include <QByteArray>
+#include <QHash>
+#include <QList>
+#include <QSet>
+#include <QVector>
+
+class PortGroup;
+namespace OstProto {
+    class CaptureChunk;
+}
+
+/*!
+  Packets of a port's capture, one per row - fetched from drone a page
+  (of kPagePackets packets) at a time, as and when the rows are viewed
+
+  Only the first kSnapLen bytes of each packet are fetched and only the
+  last kMaxPages pages viewed are kept; the pages adjacent to a viewed
+  page are prefetched
+*/
+class CaptureModel: public QAbstractTableModel
+{
+    Q_OBJECT
+public:
+    CaptureModel(PortGroup *portGroup, quint32 portId, QObject *parent = 0);
+
+    int rowCount(const QModelIndex &parent = QModelIndex()) const;
+    int columnCount(const QModelIndex &parent = QModelIndex()) const;
+
+    QVariant headerData(int section, Qt::Orientation orientation,
+            int role = Qt::DisplayRole) const;
+    QVariant data(const QModelIndex &index, int role) const;
+
+    bool packetData(int row, QByteArray &data, int &length) const;
+
+public slots:
+    void refresh();
+
+private slots:
+    void when_capturePacketsReceived(quint32 portId, quint64 packetIndex,
+                                     const OstProto::CaptureChunk *chunk);
+
+private:
+    struct Packet {
+        quint64 nsec;   // since the epoch
+        quint32 length; // as captured (data may be shorter)
+        QByteArray data;
+    };
+
+    static const int kPagePackets = 256;
+    static const int kSnapLen = 256;
+    static const int kMaxPages = 64;
+
+    const Packet* packet(int row) const;
+    void fetchPage(int page) const;
+    void parseRecords(const QByteArray &records, int offset,
+                      QVector<Packet> &packets) const;
+
+    PortGroup *portGroup_;
+    quint32 portId_;
+    int count_;             // rows the view knows of
+    bool hasFileHeader_;
+    bool isSwapped_;
+    bool isNsec_;
+    quint64 firstNsec_;
+
+    mutable QHash<int, QVector<Packet> > pages_;
+    mutable QList<int> pageLru_;        // most recently used last
+    mutable QSet<int> pendingPages_;
+};
+
+#endif
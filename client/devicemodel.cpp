@@ -57,6 +57,7 @@ DeviceModel::DeviceModel(QObject *parent)
     : QAbstractTableModel(parent)
 {
     port_ = NULL;
+    numDevices_ = 0;
     arpStatusModel_ = new ArpStatusModel(this);
     ndpStatusModel_ = new NdpStatusModel(this);
 }
@@ -66,7 +67,7 @@ int DeviceModel::rowCount(const QModelIndex &parent) const
     if (!port_ || parent.isValid())
         return 0;
 
-    return port_->numDevices();
+    return numDevices_;
 }
 
 int DeviceModel::columnCount(const QModelIndex &parent) const
@@ -107,7 +108,7 @@ QVariant DeviceModel::data(const QModelIndex &index, int role) const
     int devIdx = index.row();
     int field = index.column();
 
-    Q_ASSERT(devIdx < port_->numDevices());
+    Q_ASSERT(devIdx < numDevices_);
     Q_ASSERT(field < kFieldCount);
 
     const OstEmul::Device *dev = port_->deviceByIndex(devIdx);
@@ -244,8 +245,11 @@ QVariant DeviceModel::data(const QModelIndex &index, int role) const
 void DeviceModel::setPort(Port *port)
 {
     port_ = port;
-    if (port_)
+    numDevices_ = port_ ? port_->numDevices() : 0;
+    if (port_) {
         connect(port_, SIGNAL(deviceInfoChanged()), SLOT(updateDeviceList()));
+        connect(port_, SIGNAL(deviceInfoGrown()), SLOT(appendDeviceList()));
+    }
     reset();
 }
 
@@ -266,11 +270,41 @@ QAbstractItemModel* DeviceModel::detailModel(const QModelIndex &index)
     }
 }
 
+bool DeviceModel::canFetchMore(const QModelIndex &parent) const
+{
+    if (!port_ || parent.isValid())
+        return false;
+
+    return port_->canFetchMoreDevices();
+}
+
+void DeviceModel::fetchMore(const QModelIndex &parent)
+{
+    if (!port_ || parent.isValid())
+        return;
+
+    port_->fetchMoreDevices();
+}
+
 void DeviceModel::updateDeviceList()
 {
+    numDevices_ = port_ ? port_->numDevices() : 0;
     reset();
 }
 
+// A page of devices fetched after the first is added to the end
+void DeviceModel::appendDeviceList()
+{
+    Port *port = qobject_cast<Port*>(sender());
+
+    if (!port_ || (port != port_) || (port_->numDevices() <= numDevices_))
+        return;
+
+    beginInsertRows(QModelIndex(), numDevices_, port_->numDevices() - 1);
+    numDevices_ = port_->numDevices();
+    endInsertRows();
+}
+
 // Style roles for drillable fields
 QVariant DeviceModel::drillableStyle(int role) const
 {
@@ -39,16 +39,21 @@ public:
             int role = Qt::DisplayRole) const;
     QVariant data(const QModelIndex &index, int role) const;
 
+    bool canFetchMore(const QModelIndex &parent) const;
+    void fetchMore(const QModelIndex &parent);
+
     void setPort(Port *port);
     QAbstractItemModel* detailModel(const QModelIndex &index);
 
 public slots:
     void updateDeviceList();
+    void appendDeviceList();
 
 private:
     QVariant drillableStyle(int role) const;
 
     Port *port_;
+    int numDevices_; // rows the view knows of
     ArpStatusModel *arpStatusModel_;
     NdpStatusModel *ndpStatusModel_;
 };
@@ -19,8 +19,6 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 
 #include "dumpview.h"
 
-//! \todo Enable Scrollbars
-
 DumpView::DumpView(QWidget *parent)
     : QAbstractItemView(parent)
 {
@@ -36,6 +34,10 @@ DumpView::DumpView(QWidget *parent)
 
     mSelectedRow = mSelectedCol = -1;
 
+    mIsDataDirty = mIsSelectionDirty = true;
+    mSelOfs = -1;
+    mSelSize = 0;
+
     // calculate width for offset column and the whitespace that follows it
     // 0010   00 00 00 00 00 00 00 00 00   00 00 00 00 00 00 00 00   ........ ........
     mOffsetPaneTopRect = QRect(0, 0, w*4, h);
@@ -152,31 +154,86 @@ QRegion DumpView::visualRegionForSelection(
     return QRegion(rect());
 }
 
+void DumpView::setModel(QAbstractItemModel *model)
+{
+    if (this->model())
+        disconnect(this->model(), SIGNAL(layoutChanged()),
+                this, SLOT(invalidateDump()));
+
+    QAbstractItemView::setModel(model);
+
+    // Not all changes to a model's data are emitted as dataChanged()
+    if (model)
+        connect(model, SIGNAL(layoutChanged()), SLOT(invalidateDump()));
+    invalidateDump();
+}
+
+void DumpView::reset()
+{
+    QAbstractItemView::reset();
+    invalidateDump();
+}
+
 //protected slots:
 void DumpView::dataChanged(const QModelIndex &/*topLeft*/, 
         const QModelIndex &/*bottomRight*/)
 {
-    // FIXME(HI)
-    update();
+    invalidateDump();
 }
 
 void DumpView::selectionChanged(const QItemSelection &/*selected*/, 
         const QItemSelection &/*deselected*/)
 {
-    // FIXME(HI)
-    update();
+    mIsSelectionDirty = true;
+    viewport()->update();
+}
+
+void DumpView::rowsInserted(const QModelIndex &parent, int start, int end)
+{
+    QAbstractItemView::rowsInserted(parent, start, end);
+    invalidateDump();
 }
 
-void DumpView::populateDump(QByteArray &dump, int &selOfs, int &selSize, 
-        QModelIndex parent)
+void DumpView::rowsAboutToBeRemoved(const QModelIndex &parent,
+        int start, int end)
+{
+    QAbstractItemView::rowsAboutToBeRemoved(parent, start, end);
+    invalidateDump();
+}
+
+void DumpView::invalidateDump()
+{
+    mIsDataDirty = mIsSelectionDirty = true;
+    viewport()->update();
+}
+
+void DumpView::updateGeometries()
+{
+    int height, width;
+
+    updateDump();
+
+    height = mLines.size() * mLineHeight;
+    width = mAsciiPaneTopRect.right() + mCharWidth;
+
+    verticalScrollBar()->setSingleStep(mLineHeight);
+    verticalScrollBar()->setPageStep(viewport()->height());
+    verticalScrollBar()->setRange(0, qMax(0, height - viewport()->height()));
+
+    horizontalScrollBar()->setSingleStep(mCharWidth);
+    horizontalScrollBar()->setPageStep(viewport()->width());
+    horizontalScrollBar()->setRange(0, qMax(0, width - viewport()->width()));
+
+    QAbstractItemView::updateGeometries();
+}
+
+void DumpView::populateDump(QByteArray &dump, QModelIndex parent)
 {
     // FIXME: Use new enum instead of Qt::UserRole
     //! \todo (low): generalize this for any model not just our pkt model
 
     Q_ASSERT(!parent.isValid());
 
-    qDebug("!!!! %d $$$$", dump.size());
-
     for(int i = 0; i < model()->rowCount(parent); i++)
     {
         QModelIndex index = model()->index(i, 0, parent);
@@ -184,10 +241,14 @@ void DumpView::populateDump(QByteArray &dump, int &selOfs, int &selSize,
         Q_ASSERT(index.isValid());
 
         // Assumption: protocol data is in bytes (not bits)
-        qDebug("%d: %d bytes", i, model()->data(index, Qt::UserRole).toByteArray().size());
         dump.append(model()->data(index, Qt::UserRole).toByteArray());
-
     }
+}
+
+void DumpView::findSelection(int &selOfs, int &selSize)
+{
+    selOfs = -1;
+    selSize = 0;
 
     if (selectionModel()->selectedIndexes().size())
     {
@@ -240,80 +301,108 @@ void DumpView::populateDump(QByteArray &dump, int &selOfs, int &selSize,
     }
 }
 
-// TODO(LOW): rewrite this function - it's a mess!
-void DumpView::paintEvent(QPaintEvent* /*event*/)
+/*!
+  Rebuilds whatever of the cached dump is out of date - the text of the
+  lines if the data has changed, the selected byte range if the selection
+  has changed
+*/
+void DumpView::updateDump()
 {
-    QStylePainter    painter(viewport());
-    QRect            offsetRect = mOffsetPaneTopRect;
-    QRect            dumpRect = mDumpPaneTopRect;
-    QRect            asciiRect = mAsciiPaneTopRect;
-    QPalette        pal = palette();
-    static QByteArray        data;
-    //QByteArray        ba;
-    int                selOfs = -1, selSize;
-    int                curSelOfs, curSelSize;
+    if (mIsDataDirty)
+    {
+        mData.clear();
+        if (model())
+            populateDump(mData);
 
-    qDebug("dumpview::paintEvent");
+        mLines.resize((mData.size() + 15)/16);
+        for (int i = 0; i < mData.size(); i += 16)
+        {
+            DumpLine &line = mLines[i/16];
+            QString dumpStr, asciiStr;
 
-    // FIXME(LOW): unable to set the self widget's font in constructor
-    painter.setFont(QFont("Courier"));
+            // display the offset, dump and ascii panes 8 + 8 bytes on a line
+            for (int j = i; (j < (i+16)) && (j < mData.size()); j++)
+            {
+                unsigned char c = mData.at(j);
 
-    // set a white background
-    painter.fillRect(rect(), QBrush(QColor(Qt::white))); 
+                // extra space after 8 bytes
+                if (((j+8) % 16) == 0)
+                {
+                    dumpStr.append(" ");
+                    asciiStr.append(" ");
+                }
 
-    if (model())
-    {
-        data.clear();
-        populateDump(data, selOfs, selSize);
+                dumpStr.append(QString("%1").arg((uint)c, 2, 16, QChar('0')).
+                    toUpper()).append(" ");
+
+                if (isPrintable(c))
+                    asciiStr.append(QChar(c));
+                else
+                    asciiStr.append(QChar('.'));
+            }
+
+            line.offset.setTextFormat(Qt::PlainText);
+            line.offset.setText(QString("%1").arg(i, 4, 16, QChar('0')));
+            line.dump.setTextFormat(Qt::PlainText);
+            line.dump.setText(dumpStr);
+            line.ascii.setTextFormat(Qt::PlainText);
+            line.ascii.setText(asciiStr);
+        }
+
+        mIsDataDirty = false;
+        updateGeometries();
     }
 
-    // display the offset, dump and ascii panes 8 + 8 bytes on a line
-    for (int i = 0; i < data.size(); i+=16)
+    if (mIsSelectionDirty)
     {
-        QString    dumpStr, asciiStr;    
+        if (model() && selectionModel())
+            findSelection(mSelOfs, mSelSize);
+        else
+            mSelOfs = -1;
+        mIsSelectionDirty = false;
+    }
+}
 
-        //ba = data.mid(i, 16);
+void DumpView::paintEvent(QPaintEvent* event)
+{
+    QStylePainter    painter(viewport());
+    QPalette        pal = palette();
+    int                firstLine, lastLine;
 
-        // display offset
-        painter.drawItemText(offsetRect, Qt::AlignLeft | Qt::AlignTop, pal,
-            true, QString("%1").arg(i, 4, 16, QChar('0')), QPalette::WindowText);
-        // construct the dumpStr and asciiStr
-        for (int j = i; (j < (i+16)) && (j < data.size()); j++)
-        {
-            unsigned char c = data.at(j);
+    updateDump();
 
-            // extra space after 8 bytes
-            if (((j+8) % 16) == 0)
-            {
-                dumpStr.append(" ");
-                asciiStr.append(" ");
-            }
+    // FIXME(LOW): unable to set the self widget's font in constructor
+    painter.setFont(QFont("Courier"));
 
-            dumpStr.append(QString("%1").arg((uint)c, 2, 16, QChar('0')).
-                toUpper()).append(" ");
+    // set a white background
+    painter.fillRect(event->rect(), QBrush(QColor(Qt::white))); 
 
-            if (isPrintable(c))
-                asciiStr.append(QChar(c));
-            else
-                asciiStr.append(QChar('.'));
-        }
+    // Only the lines in view (of the area to be painted) are painted
+    firstLine = (event->rect().top() + verticalOffset()) / mLineHeight;
+    lastLine = qMin((event->rect().bottom() + verticalOffset()) / mLineHeight,
+                    mLines.size() - 1);
 
-        // display dump
-        painter.drawItemText(dumpRect, Qt::AlignLeft | Qt::AlignTop, pal,
-            true, dumpStr, QPalette::WindowText);
+    painter.translate(-horizontalOffset(), -verticalOffset());
+    for (int n = firstLine; n <= lastLine; n++)
+    {
+        const DumpLine &line = mLines.at(n);
+        int i = n*16;
+        int y = n*mLineHeight;
+        int curSelOfs = 0, curSelSize = 0;
 
-        // display ascii
-        painter.drawItemText(asciiRect, Qt::AlignLeft | Qt::AlignTop, pal,
-            true, asciiStr, QPalette::WindowText);
+        painter.setPen(pal.color(QPalette::WindowText));
+        painter.drawStaticText(mOffsetPaneTopRect.left(), y, line.offset);
+        painter.drawStaticText(mDumpPaneTopRect.left(), y, line.dump);
+        painter.drawStaticText(mAsciiPaneTopRect.left(), y, line.ascii);
 
         // if no selection, skip selection painting
-        if (selOfs < 0)
-            goto _next;
+        if (mSelOfs < 0)
+            continue;
 
         // Check overlap between current row and selection
         {
-            QRect r1(i, 0, qMin(16, data.size()-i), 8);
-            QRect s1(selOfs, 0, selSize, 8);
+            QRect r1(i, 0, qMin(16, mData.size()-i), 8);
+            QRect s1(mSelOfs, 0, mSelSize, 8);
             if (r1.intersects(s1))
             {
                 QRect t = r1.intersected(s1);
@@ -321,88 +410,54 @@ void DumpView::paintEvent(QPaintEvent* /*event*/)
                 curSelOfs = t.x();
                 curSelSize = t.width();
             }
-            else
-                curSelSize = 0;
-
         }
 
         // overpaint selection on current row (if any)
         if (curSelSize > 0)
         {
             QRect r;
-            QString selectedAsciiStr, selectedDumpStr;
-
-            qDebug("dumpview::paintEvent - Highlighted (%d, %d)", 
-                    curSelOfs, curSelSize);
+            int first = curSelOfs - i;
+            int last = first + curSelSize - 1;
 
-            // construct the dumpStr and asciiStr
-            for (int k = curSelOfs; (k < (curSelOfs + curSelSize)); k++)
-            {
-                unsigned char c = data.at(k);
-
-                // extra space after 8 bytes
-                if (((k+8) % 16) == 0)
-                {
-                    // Avoid adding space at the start for fields starting
-                    // at second column 8 byte boundary
-                    if (k!=curSelOfs)
-                    {
-                        selectedDumpStr.append(" ");
-                        selectedAsciiStr.append(" ");
-                    }
-                }
-
-                selectedDumpStr.append(QString("%1").arg((uint)c, 2, 16, 
-                            QChar('0')).toUpper()).append(" ");
-
-                if (isPrintable(c))
-                    selectedAsciiStr.append(QChar(c));
-                else
-                    selectedAsciiStr.append(QChar('.'));
-            }
+            painter.setPen(pal.color(QPalette::HighlightedText));
 
             // display dump
-            r = dumpRect;
-            if ((curSelOfs - i) < 8)
-                r.translate(mCharWidth*(curSelOfs-i)*3, 0);
+            r = mDumpPaneTopRect.translated(0, y);
+            if (first < 8)
+                r.translate(mCharWidth*first*3, 0);
             else
-                r.translate(mCharWidth*((curSelOfs-i)*3+1), 0);
+                r.translate(mCharWidth*(first*3+1), 0);
 
             // adjust width taking care of selection stretching between
             // the two 8byte columns
-            if (( (curSelOfs-i) < 8 ) && ( (curSelOfs-i+curSelSize) > 8 ))
+            if ((first < 8) && ((first + curSelSize) > 8))
                 r.setWidth((curSelSize * 3 + 1) * mCharWidth);
             else
                 r.setWidth((curSelSize * 3) * mCharWidth);
 
             painter.fillRect(r, pal.highlight());
-            painter.drawItemText(r, Qt::AlignLeft | Qt::AlignTop, pal,
-                true, selectedDumpStr, QPalette::HighlightedText);
+            painter.drawText(r, Qt::AlignLeft | Qt::AlignTop,
+                    line.dump.text().mid(dumpPos(first),
+                        dumpPos(last) + 2 - dumpPos(first)));
 
             // display ascii
-            r = asciiRect;
-            if ((curSelOfs - i) < 8)
-                r.translate(mCharWidth*(curSelOfs-i)*1, 0);
+            r = mAsciiPaneTopRect.translated(0, y);
+            if (first < 8)
+                r.translate(mCharWidth*first, 0);
             else
-                r.translate(mCharWidth*((curSelOfs-i)*1+1), 0);
+                r.translate(mCharWidth*(first+1), 0);
 
             // adjust width taking care of selection stretching between
             // the two 8byte columns
-            if (( (curSelOfs-i) < 8 ) && ( (curSelOfs-i+curSelSize) > 8 ))
-                r.setWidth((curSelSize * 1 + 1) * mCharWidth);
+            if ((first < 8) && ((first + curSelSize) > 8))
+                r.setWidth((curSelSize + 1) * mCharWidth);
             else
-                r.setWidth((curSelSize * 1) * mCharWidth);
+                r.setWidth(curSelSize * mCharWidth);
 
             painter.fillRect(r, pal.highlight());
-            painter.drawItemText(r, Qt::AlignLeft | Qt::AlignTop, pal,
-                true, selectedAsciiStr, QPalette::HighlightedText);
+            painter.drawText(r, Qt::AlignLeft | Qt::AlignTop,
+                    line.ascii.text().mid(asciiPos(first),
+                        asciiPos(last) + 1 - asciiPos(first)));
         }
-
-_next:    
-        // move the rects down
-        offsetRect.translate(0, mLineHeight);
-        dumpRect.translate(0, mLineHeight);
-        asciiRect.translate(0, mLineHeight);
-    }    
+    }
 }
-
@@ -20,8 +20,15 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 #include <QtGui> // FIXME: High
 
 
+/*
+  The dump is kept as text - a line of 16 bytes at a time, with its glyphs
+  laid out once (QStaticText) - and rebuilt only when the model's data
+  changes; the selection's byte range is found again only when the
+  selection changes. Only the lines in view are painted
+*/
 class DumpView: public QAbstractItemView
 {
+    Q_OBJECT
 public:    
     DumpView(QWidget *parent=0);
 
@@ -29,6 +36,9 @@ public:
     void scrollTo( const QModelIndex &index, ScrollHint hint = EnsureVisible );
     QRect visualRect( const QModelIndex &index ) const;
 
+    void setModel(QAbstractItemModel *model);
+    void reset();
+
 protected:
     int horizontalOffset() const;
     bool isIndexHidden( const QModelIndex &index ) const;
@@ -42,20 +52,44 @@ protected slots:
             const QModelIndex &bottomRight );
     void selectionChanged( const QItemSelection &selected,
     const QItemSelection &deselected );
+    void rowsInserted(const QModelIndex &parent, int start, int end);
+    void rowsAboutToBeRemoved(const QModelIndex &parent, int start, int end);
+    void updateGeometries();
     void paintEvent(QPaintEvent *event);
 
+private slots:
+    void invalidateDump();
+
 private:
-    void populateDump(QByteArray &dump, int &selOfs, int &selSize, 
-            QModelIndex parent = QModelIndex());
+    void populateDump(QByteArray &dump, QModelIndex parent = QModelIndex());
+    void findSelection(int &selOfs, int &selSize);
+    void updateDump();
     bool inline isPrintable(char c) 
         {if ((c >= 32) && (c <= 126)) return true; else return false; }
 
+    // Position of a line's col'th byte in its dump and ascii text
+    static int dumpPos(int col) { return col*3 + (col >= 8 ? 1 : 0); }
+    static int asciiPos(int col) { return col + (col >= 8 ? 1 : 0); }
+
 private:
+    struct DumpLine {
+        QStaticText offset;
+        QStaticText dump;
+        QStaticText ascii;
+    };
+
     QRect        mOffsetPaneTopRect;
     QRect        mDumpPaneTopRect;
     QRect        mAsciiPaneTopRect;
     int            mSelectedRow, mSelectedCol;
     int            mLineHeight;
     int            mCharWidth;
+
+    // Cached - see updateDump()
+    bool            mIsDataDirty;
+    bool            mIsSelectionDirty;
+    QByteArray        mData;
+    QVector<DumpLine>    mLines;
+    int            mSelOfs, mSelSize;    // mSelOfs < 0 => no selection
 };
 
@@ -82,6 +82,7 @@ int main(int argc, char* argv[])
 
     delete mainWindow;
     delete appSettings;
+    delete OstProtocolWidgetFactory;
     delete OstProtocolManager;
     google::protobuf::ShutdownProtobufLibrary();
 
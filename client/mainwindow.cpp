@@ -296,7 +296,9 @@ void MainWindow::on_actionPreferences_triggered()
 {
     Preferences *preferences = new Preferences();
 
-    preferences->exec();
+    if (preferences->exec() == QDialog::Accepted)
+        pgl->setStatsInterval(appSettings->value(kStatsIntervalKey,
+                    kStatsIntervalDefaultValue).toInt());
 
     delete preferences;
 }
@@ -454,6 +456,10 @@ bool MainWindow::openSession(QString fileName, QString &error)
     for (int i = 0; i < 10; i++)
         qApp->processEvents();
 
+    // an incomplete session read before the cancel is not applied
+    if (progress.wasCanceled())
+        goto _user_opt_cancel;
+
     // XXX: user can't cancel operation from here on!
     progress.close();
 
@@ -30,10 +30,13 @@ win32 {
         "../rpc/libpbrpc.a"
 }
 LIBS += -lprotobuf
+LIBS += -lz
 LIBS += -L"../extra/qhexedit2/$(OBJECTS_DIR)/" -lqhexedit2
 RESOURCES += ostinato.qrc 
 HEADERS += \
     arpstatusmodel.h \
+    capturebrowser.h \
+    capturemodel.h \
     devicegroupdialog.h \
     devicegroupmodel.h \
     devicemodel.h \
@@ -55,6 +58,7 @@ HEADERS += \
     portswindow.h \
     preferences.h \
     settings.h \
+    statshistory.h \
     streamconfigdialog.h \
     streamlistdelegate.h \
     streammodel.h \
@@ -62,6 +66,7 @@ HEADERS += \
 
 FORMS += \
     about.ui \
+    capturebrowser.ui \
     devicegroupdialog.ui \
     deviceswidget.ui \
     mainwindow.ui \
@@ -75,6 +80,8 @@ FORMS += \
 
 SOURCES += \
     arpstatusmodel.cpp \
+    capturebrowser.cpp \
+    capturemodel.cpp \
     devicegroupdialog.cpp \
     devicegroupmodel.cpp \
     devicemodel.cpp \
@@ -97,6 +104,7 @@ SOURCES += \
     portstatswindow.cpp \
     portswindow.cpp \
     preferences.cpp \
+    statshistory.cpp \
     streamconfigdialog.cpp \
     streamlistdelegate.cpp \
     streammodel.cpp \
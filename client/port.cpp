@@ -23,10 +23,12 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 #include "streamfileformat.h"
 
 #include <QApplication>
+#include <QDateTime>
 #include <QMainWindow>
 #include <QProgressDialog>
 #include <QVariant>
 #include <google/protobuf/descriptor.h>
+#include <string.h>
 #include <vector>
 
 extern QMainWindow *mainWindow;
@@ -55,9 +57,13 @@ Port::Port(quint32 id, quint32 portGroupId)
     mPortId = id;
     d.mutable_port_id()->set_id(id);
     stats.mutable_port_id()->set_id(id);
+    memset(&statsSnapshot_, 0, sizeof(statsSnapshot_));
+    changedStats_ = 0;
     mPortGroupId = portGroupId;
     capFile_ = NULL;
     dirty_ = false;
+    totalDevices_ = 0;
+    isFetchingDevices_ = false;
 }
 
 Port::~Port()
@@ -80,6 +86,9 @@ void Port::updatePortConfig(OstProto::Port *port)
             && port->transmit_mode() != d.transmit_mode())
         recalc = true;
 
+    // Drone sends the whole estimate (or none, if it has none) - not
+    // changes to merge
+    d.clear_transmit_estimate();
     d.MergeFrom(*port);
 
     // Setup a user-friendly alias for Win32 ports
@@ -88,6 +97,8 @@ void Port::updatePortConfig(OstProto::Port *port)
 
     if (recalc)
         recalculateAverageRates();
+    else if (port->has_transmit_estimate())
+        emit portRateChanged(mPortGroupId, mPortId);
 }
 
 void Port::updateStreamOrdinalsFromIndex()
@@ -98,7 +109,7 @@ void Port::updateStreamOrdinalsFromIndex()
 
 void Port::reorderStreamsByOrdinals()
 {
-    qSort(mStreams.begin(), mStreams.end(), StreamBase::StreamLessThan);
+    qSort(mStreams.begin(), mStreams.end(), LazyStream::ordinalLessThan);
 }
 
 void Port::setDirty(bool dirty)
@@ -108,6 +119,10 @@ void Port::setDirty(bool dirty)
 
     dirty_ = dirty;
     emit localConfigChanged(mPortGroupId, mPortId, dirty_);
+
+    // Rates shown switch between the local and drone computed ones
+    if (d.has_transmit_estimate())
+        emit portRateChanged(mPortGroupId, mPortId);
 }
 
 void Port::recalculateAverageRates()
@@ -116,7 +131,7 @@ void Port::recalculateAverageRates()
     double bps = 0;
     int n = 0;
 
-    foreach (Stream* s, mStreams)
+    foreach (LazyStream* s, mStreams)
     {
         if (!s->isEnabled())
             continue;
@@ -143,6 +158,10 @@ void Port::recalculateAverageRates()
             avgPacketsPerSec_ = pps;
             avgBitsPerSec_ = bps;
             break;
+        case OstProto::kPcapReplayTransmit:
+            // streams are not sent - rate is that of the capture file
+            avgPacketsPerSec_ = avgBitsPerSec_ = 0;
+            break;
         default:
             Q_ASSERT(false); // Unreachable!!
         }
@@ -168,7 +187,7 @@ void Port::setAveragePacketRate(double packetsPerSec)
     qDebug("@%s: packetsPerSec = %g", __FUNCTION__, packetsPerSec);
     qDebug("@%s: avgPps = %g avgBps = %g numActive = %d", __FUNCTION__,
             avgPacketsPerSec_, avgBitsPerSec_, numActiveStreams_);
-    foreach (Stream* s, mStreams)
+    foreach (LazyStream* s, mStreams)
     {
         if (!s->isEnabled())
             continue;
@@ -183,6 +202,9 @@ void Port::setAveragePacketRate(double packetsPerSec)
                 ((s->averagePacketRate()/avgPacketsPerSec_) * 
                  (packetsPerSec - avgPacketsPerSec_));
             break;
+        case OstProto::kPcapReplayTransmit:
+            rate = s->averagePacketRate();
+            break;
         default:
             Q_ASSERT(false); // Unreachable!!
         }
@@ -215,6 +237,10 @@ void Port::setAveragePacketRate(double packetsPerSec)
             avgPacketsPerSec_ = pps;
             avgBitsPerSec_ = bps;
             break;
+        case OstProto::kPcapReplayTransmit:
+            // streams are not sent - rate is that of the capture file
+            avgPacketsPerSec_ = avgBitsPerSec_ = 0;
+            break;
         default:
             Q_ASSERT(false); // Unreachable!!
         }
@@ -240,7 +266,7 @@ void Port::setAverageBitRate(double bitsPerSec)
     qDebug("@%s: bitsPerSec = %g", __FUNCTION__, bitsPerSec);
     qDebug("@%s: avgPps = %g avgBps = %g numActive = %d", __FUNCTION__,
             avgPacketsPerSec_, avgBitsPerSec_, numActiveStreams_);
-    foreach (Stream* s, mStreams)
+    foreach (LazyStream* s, mStreams)
     {
         if (!s->isEnabled())
             continue;
@@ -257,6 +283,9 @@ void Port::setAverageBitRate(double bitsPerSec)
                         * ((bitsPerSec - avgBitsPerSec_)
                             / ((s->frameLenAvg()+kEthOverhead)*8)));
             break;
+        case OstProto::kPcapReplayTransmit:
+            rate = s->averagePacketRate();
+            break;
         default:
             Q_ASSERT(false); // Unreachable!!
         }
@@ -289,6 +318,10 @@ void Port::setAverageBitRate(double bitsPerSec)
             avgPacketsPerSec_ = pps;
             avgBitsPerSec_ = bps;
             break;
+        case OstProto::kPcapReplayTransmit:
+            // streams are not sent - rate is that of the capture file
+            avgPacketsPerSec_ = avgBitsPerSec_ = 0;
+            break;
         default:
             Q_ASSERT(false); // Unreachable!!
         }
@@ -305,14 +338,12 @@ void Port::setAverageBitRate(double bitsPerSec)
 
 bool Port::newStreamAt(int index, OstProto::Stream const *stream)
 {
-    Stream    *s = new Stream;
+    LazyStream *s;
 
     if (index > mStreams.size())
         return false;
 
-    if (stream)
-        s->protoDataCopyFrom(*stream);
-
+    s = stream ? new LazyStream(*stream) : new LazyStream;
     s->setId(newStreamId());
     mStreams.insert(index, s);
     updateStreamOrdinalsFromIndex();
@@ -335,11 +366,48 @@ bool Port::deleteStreamAt(int index)
     return true;
 }
 
+/*!
+  Deletes the streams at indices - same as deleteStreamAt() for each, but
+  the ordinals and rates are updated just once
+*/
+void Port::deleteStreams(QList<int> indices)
+{
+    // Highest first so that the lower indices remain valid
+    qSort(indices.begin(), indices.end(), qGreater<int>());
+    for (int i = 0; i < indices.size(); i++) {
+        if ((i > 0) && (indices.at(i) == indices.at(i-1)))
+            continue;
+        if (indices.at(i) < mStreams.size())
+            delete mStreams.takeAt(indices.at(i));
+    }
+
+    updateStreamOrdinalsFromIndex();
+    recalculateAverageRates();
+    setDirty(true);
+}
+
+/*!
+  Enables/disables the streams at indices - without materializing them
+  (see LazyStream)
+*/
+void Port::setStreamsEnabled(const QList<int> &indices, bool enabled)
+{
+    foreach (int index, indices) {
+        if (index < mStreams.size())
+            mStreams[index]->setEnabled(enabled);
+    }
+
+    recalculateAverageRates();
+    setDirty(true);
+}
+
 bool Port::insertStream(uint streamId)
 {
-    Stream    *s = new Stream;
+    OstProto::Stream stream;
+    LazyStream *s;
 
-    s->setId(streamId);
+    stream.mutable_stream_id()->set_id(streamId);
+    s = new LazyStream(stream);
 
     // FIXME(MED): If a stream with id already exists, what do we do?
     mStreams.append(s);
@@ -352,26 +420,37 @@ bool Port::insertStream(uint streamId)
     return true;
 }
 
-bool Port::updateStream(uint streamId, OstProto::Stream *stream)
+/*!
+ * Updates the streams with their config received from server - the
+ * streams are only serialized, not parsed, until they are edited
+ */
+bool Port::updateStreams(const OstProto::StreamConfigList &streamConfigList)
 {
-    int i, streamIndex;
+    QHash<quint32, LazyStream*> streamById;
+    bool ret = true;
 
-    for (i = 0; i < mStreams.size(); i++)
-    {
-        if (streamId == mStreams[i]->id())
-            goto _found;
-    }
+    streamById.reserve(mStreams.size());
+    foreach (LazyStream *s, mStreams)
+        streamById.insert(s->id(), s);
 
-    qDebug("%s: Invalid stream id %d", __FUNCTION__, streamId);
-    return false;
+    for (int i = 0; i < streamConfigList.stream_size(); i++)
+    {
+        const OstProto::Stream &stream = streamConfigList.stream(i);
+        uint streamId = stream.stream_id().id();
+        LazyStream *s = streamById.value(streamId);
 
-_found:
-    streamIndex = i;
+        if (!s) {
+            qDebug("%s: Invalid stream id %d", __FUNCTION__, streamId);
+            ret = false;
+            continue;
+        }
 
-    mStreams[streamIndex]->protoDataCopyFrom(*stream);
+        s->protoDataCopyFrom(stream);
+        lastSyncStreamConfig_[streamId] = s->protoData();
+    }
     reorderStreamsByOrdinals();
 
-    return true;
+    return ret;
 }
 
 void Port::getDeletedStreamsSinceLastSync(
@@ -442,6 +521,105 @@ void Port::getModifiedStreamsSinceLastSync(
     qDebug("Done %s", __FUNCTION__);
 }
 
+/*!
+ * Fills 'delta' with all the stream changes since the last sync - only
+ * the changed fields are sent for streams that existed at the last sync;
+ * if 'withSweeps' is true, duplicated streams are sent as stream sweeps
+ */
+void Port::getStreamDeltaSinceLastSync(OstProto::PortConfigDelta &delta,
+                                       bool withSweeps)
+{
+    OstProto::StreamIdList deleted;
+    QSet<quint32> lastSyncIds = mLastSyncStreamList.toSet();
+    QSet<quint32> sweptIds;
+
+    delta.mutable_port_id()->set_id(mPortId);
+
+    getDeletedStreamsSinceLastSync(deleted);
+    delta.mutable_deleted_stream_id()->MergeFrom(deleted.stream_id());
+
+    if (withSweeps)
+        getNewStreamSweeps(delta, sweptIds);
+
+    for (int i = 0; i < mStreams.size(); i++)
+    {
+        quint32 id = mStreams[i]->id();
+        QByteArray data;
+
+        if (!lastSyncIds.contains(id))
+        {
+            if (!sweptIds.contains(id))
+                mStreams[i]->protoDataCopyInto(*delta.add_new_stream());
+        }
+        else if (!lastSyncStreamConfig_.contains(id))
+        {
+            // Don't know what drone has - replace the stream whole
+            delta.add_deleted_stream_id()->set_id(id);
+            mStreams[i]->protoDataCopyInto(*delta.add_new_stream());
+        }
+        else if ((data = mStreams[i]->protoData())
+                    != lastSyncStreamConfig_.value(id))
+        {
+            // Parse only the streams whose serialized config has changed
+            OstProto::Stream lastConfig, config;
+            OstProto::StreamDelta streamDelta;
+            const QByteArray &lastData = lastSyncStreamConfig_.value(id);
+
+            lastConfig.ParsePartialFromArray(lastData.constData(),
+                                             lastData.size());
+            config.ParsePartialFromArray(data.constData(), data.size());
+            if (StreamBase::makeDelta(lastConfig, config, streamDelta))
+                delta.add_modified_stream()->CopyFrom(streamDelta);
+        }
+    }
+}
+
+/*!
+ * Adds to 'delta' the sweeps of duplicated streams whose streams are all
+ * unchanged since they were duplicated and the ids of those streams to
+ * 'sweptIds'; the other duplicated streams are sent as new streams
+ */
+void Port::getNewStreamSweeps(OstProto::PortConfigDelta &delta,
+                              QSet<quint32> &sweptIds)
+{
+    QHash<quint32, LazyStream*> streamById;
+
+    foreach (LazyStream *s, mStreams)
+        streamById.insert(s->id(), s);
+
+    foreach (const OstProto::StreamSweep &sweep, newStreamSweeps_)
+    {
+        QSet<quint32> ids;
+        uint i;
+
+        for (i = 0; i < sweep.count(); i++)
+        {
+            OstProto::Stream config;
+            LazyStream *s;
+            std::string data;
+
+            if (!StreamBase::sweepStream(sweep, i, config))
+                break;
+
+            s = streamById.value(config.stream_id().id());
+            if (!s || sweptIds.contains(s->id()))
+                break;
+
+            data = config.SerializePartialAsString();
+            if (s->protoData() != QByteArray(data.data(), int(data.size())))
+                break;
+
+            ids.insert(s->id());
+        }
+
+        if (i < sweep.count())
+            continue;
+
+        delta.add_new_stream_sweep()->CopyFrom(sweep);
+        sweptIds.unite(ids);
+    }
+}
+
 void Port::getDeletedDeviceGroupsSinceLastSync(
     OstProto::DeviceGroupIdList &deviceGroupIdList)
 {
@@ -511,8 +689,13 @@ void Port::when_syncComplete()
     //reorderStreamsByOrdinals();
 
     mLastSyncStreamList.clear();
-    for (int i=0; i<mStreams.size(); i++)
+    lastSyncStreamConfig_.clear();
+    newStreamSweeps_.clear();
+    for (int i=0; i<mStreams.size(); i++) {
         mLastSyncStreamList.append(mStreams[i]->id());
+        lastSyncStreamConfig_.insert(mStreams[i]->id(),
+                                     mStreams[i]->protoData());
+    }
 
     lastSyncDeviceGroupList_.clear();
     for (int i = 0; i < deviceGroups_.size(); i++) {
@@ -529,8 +712,27 @@ void Port::updateStats(OstProto::PortStats *portStats)
     OstProto::PortState        oldState;
 
     oldState = stats.state(); 
+
+    // Repeated fields, if present, are in full - notifications have only
+    // the changed fields, but MergeFrom() appends repeated fields
+    if (portStats->filter_count_size())
+        stats.clear_filter_count();
+    if (portStats->nic_counter_size())
+        stats.clear_nic_counter();
+    // ... and the fields that went away are listed instead
+    for (int i = 0; i < portStats->cleared_field_size(); i++) {
+        const google::protobuf::FieldDescriptor *f = stats.GetDescriptor()
+                ->FindFieldByNumber(portStats->cleared_field(i));
+        if (f)
+            stats.GetReflection()->ClearField(&stats, f);
+    }
+    portStats->clear_cleared_field();
     stats.MergeFrom(*portStats);
 
+    updateStatsSnapshot();
+    statsHistory_.append(QDateTime::currentDateTime().toMSecsSinceEpoch(),
+                         statsSnapshot_);
+
     if (oldState.link_state() != stats.state().link_state())
     {
         qDebug("portstate changed");
@@ -538,6 +740,43 @@ void Port::updateStats(OstProto::PortStats *portStats)
     }
 }
 
+//! Refreshes statsSnapshot_ from stats noting the changed ones
+void Port::updateStatsSnapshot()
+{
+    typedef PortStatsSnapshot S;
+    quint64 value[S::kStatCount];
+
+    value[S::kLinkState] = stats.state().link_state();
+    value[S::kTransmitState] = stats.state().is_transmit_on();
+    value[S::kCaptureState] = stats.state().is_capture_on();
+
+    value[S::kRxPkts] = stats.rx_pkts();
+    value[S::kTxPkts] = stats.tx_pkts();
+    value[S::kTxPps] = stats.tx_pps();
+    value[S::kRxPps] = stats.rx_pps();
+    value[S::kRxBytes] = stats.rx_bytes();
+    value[S::kTxBytes] = stats.tx_bytes();
+    value[S::kTxBps] = stats.tx_bps();
+    value[S::kRxBps] = stats.rx_bps();
+
+    value[S::kRxDrops] = stats.rx_drops();
+    value[S::kRxErrors] = stats.rx_errors();
+    value[S::kRxFifoErrors] = stats.rx_fifo_errors();
+    value[S::kRxFrameErrors] = stats.rx_frame_errors();
+
+    value[S::kRxStreamLost] = stats.rx_stream_lost();
+    value[S::kRxStreamReordered] = stats.rx_stream_reordered();
+    value[S::kRxStreamDuplicates] = stats.rx_stream_duplicates();
+    value[S::kRxStreamLate] = stats.rx_stream_late();
+
+    for (int i = 0; i < S::kStatCount; i++) {
+        if (value[i] != statsSnapshot_.value[i]) {
+            statsSnapshot_.value[i] = value[i];
+            changedStats_ |= 1U << i;
+        }
+    }
+}
+
 void Port::duplicateStreams(const QList<int> &list, int count)
 {
     QList<OstProto::Stream> sources;
@@ -551,11 +790,29 @@ void Port::duplicateStreams(const QList<int> &list, int count)
     int insertAt = mStreams.size();
     for (int i=0; i < count; i++) {
         for (int j=0; j < sources.size(); j++) {
-            newStreamAt(insertAt, &sources.at(j));
+            OstProto::Stream stream = sources.at(j);
+
             // Rename stream by appending the copy count
-            mStreams.at(insertAt)->setName(QString("%1 (%2)")
-                    .arg(mStreams.at(insertAt)->name())
-                    .arg(i+1));
+            stream.mutable_core()->set_name(QString("%1 (%2)")
+                    .arg(QString::fromStdString(sources.at(j).core().name()))
+                    .arg(i+1).toStdString());
+            newStreamAt(insertAt, &stream);
+
+            // Drone can create all copies of a stream from its first
+            if ((i == 0) && (count > 1)) {
+                OstProto::StreamSweep sweep;
+                OstProto::Stream *first = sweep.mutable_stream();
+
+                first->CopyFrom(sources.at(j));
+                first->mutable_stream_id()->set_id(
+                        mStreams.at(insertAt)->id());
+                first->mutable_core()->set_ordinal(
+                        mStreams.at(insertAt)->ordinal());
+                sweep.set_count(count);
+                sweep.set_stride(sources.size());
+                sweep.set_number_names(true);
+                newStreamSweeps_.append(sweep);
+            }
             insertAt++;
         }
     }
@@ -874,6 +1131,25 @@ const OstEmul::Device* Port::deviceByIndex(int index)
     return devices_.at(index);
 }
 
+int Port::totalDevices()
+{
+    return qMax(totalDevices_, numDevices());
+}
+
+bool Port::canFetchMoreDevices()
+{
+    return !isFetchingDevices_ && (numDevices() < totalDevices_);
+}
+
+void Port::fetchMoreDevices()
+{
+    if (!canFetchMoreDevices())
+        return;
+
+    isFetchingDevices_ = true;
+    emit moreDeviceInfoWanted(mPortGroupId, mPortId);
+}
+
 void Port::clearDeviceList()
 {
     while (devices_.size())
@@ -886,6 +1162,11 @@ void Port::insertDevice(const OstEmul::Device &device)
     devices_.append(dev);
 }
 
+void Port::setTotalDevices(int count)
+{
+    totalDevices_ = count;
+}
+
 // ------------- Device Neighbors (ARP/NDP) ------------- //
 
 const OstEmul::DeviceNeighborList* Port::deviceNeighbors(int deviceIndex)
@@ -961,6 +1242,13 @@ void Port::insertDeviceNeighbors(const OstEmul::DeviceNeighborList &neighList)
 
 void Port::deviceInfoRefreshed()
 {
+    isFetchingDevices_ = false;
     emit deviceInfoChanged();
 }
 
+void Port::deviceInfoAppended()
+{
+    isFetchingDevices_ = false;
+    emit deviceInfoGrown();
+}
+
@@ -27,6 +27,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 #include <QString>
 #include <QTemporaryFile>
 
+#include "statshistory.h"
 #include "stream.h"
 
 //class StreamModel;
@@ -44,6 +45,9 @@ class Port : public QObject {
 
     OstProto::Port        d;
     OstProto::PortStats   stats;
+    PortStatsSnapshot statsSnapshot_;
+    quint32 changedStats_; // bitmask of PortStatsSnapshot::Stat
+    StatsHistory statsHistory_;
     QTemporaryFile *capFile_;
 
     // FIXME(HI): consider removing mPortId as it is duplicated inside 'd'
@@ -57,12 +61,16 @@ class Port : public QObject {
     int numActiveStreams_;
 
     QList<quint32>    mLastSyncStreamList;
-    QList<Stream*>    mStreams;        // sorted by stream's ordinal value
+    QHash<quint32, QByteArray> lastSyncStreamConfig_; // serialized
+    QList<LazyStream*> mStreams;       // sorted by stream's ordinal value
+    QList<OstProto::StreamSweep> newStreamSweeps_; // of duplicated streams
 
     QList<quint32> lastSyncDeviceGroupList_;
     QSet<quint32>  modifiedDeviceGroupList_;
     QList<OstProto::DeviceGroup*> deviceGroups_;
     QList<OstEmul::Device*> devices_;
+    int totalDevices_;              // on drone; devices_ may be fewer
+    bool isFetchingDevices_;
     QHash<quint32, OstEmul::DeviceNeighborList*> deviceNeighbors_;
     QHash<quint32, quint32> arpResolvedCount_;
     QHash<quint32, quint32> ndpResolvedCount_;
@@ -70,8 +78,11 @@ class Port : public QObject {
     uint newStreamId();
     void updateStreamOrdinalsFromIndex();
     void reorderStreamsByOrdinals();
+    void getNewStreamSweeps(OstProto::PortConfigDelta &delta,
+                            QSet<quint32> &sweptIds);
 
     void setDirty(bool dirty);
+    void updateStatsSnapshot();
 
 public:
     enum AdminStatus    { AdminDisable, AdminEnable };
@@ -100,27 +111,36 @@ public:
         { return d.is_exclusive_control(); }
     OstProto::TransmitMode transmitMode() const
         { return d.transmit_mode(); }
+    // As computed by drone if there are no local changes; else as computed
+    // locally by recalculateAverageRates()
     double averagePacketRate() const
-        { return avgPacketsPerSec_; }
+        { return hasTransmitEstimate() ?
+            d.transmit_estimate().packets_per_sec() : avgPacketsPerSec_; }
     double averageBitRate() const
-        { return avgBitsPerSec_; }
+        { return hasTransmitEstimate() ?
+            d.transmit_estimate().bits_per_sec() : avgBitsPerSec_; }
+    bool hasTransmitEstimate() const
+        { return !dirty_ && d.has_transmit_estimate(); }
+    const OstProto::TransmitEstimate& transmitEstimate() const
+        { return d.transmit_estimate(); }
 
     //void setAdminEnable(AdminStatus status) { mAdminStatus = status; }
     void setAlias(QString alias) { mUserAlias = alias; }
     //void setExclusive(bool flag);
 
     int numStreams() { return mStreams.size(); }
-    const Stream* streamByIndex(int index) const
+    const LazyStream* streamByIndex(int index) const
     {
         Q_ASSERT(index < mStreams.size());
         return mStreams[index];
     }
+    //! Materializes the stream - see LazyStream::stream()
     Stream* mutableStreamByIndex(int index, bool assumeChange = true)
     {
         Q_ASSERT(index < mStreams.size());
         if (assumeChange)
             setDirty(true);
-        return mStreams[index];
+        return mStreams[index]->stream();
     }
     void setLocalConfigChanged(bool changed)
     {
@@ -129,7 +149,15 @@ public:
     OstProto::LinkState linkState()
         { return stats.state().link_state(); }
 
-    OstProto::PortStats    getStats() { return stats; }
+    const OstProto::PortStats& getStats() const { return stats; }
+    const PortStatsSnapshot& statsSnapshot() const { return statsSnapshot_; }
+    const StatsHistory& statsHistory() const { return statsHistory_; }
+    //! Returns the stats changed since the last call as a bitmask
+    quint32 takeChangedStats() {
+        quint32 changed = changedStats_;
+        changedStats_ = 0;
+        return changed;
+    }
     QTemporaryFile* getCaptureFile() 
     {
         delete capFile_;
@@ -150,12 +178,14 @@ public:
     //@{
     bool newStreamAt(int index, OstProto::Stream const *stream = NULL);
     bool deleteStreamAt(int index);
+    void deleteStreams(QList<int> indices);
+    void setStreamsEnabled(const QList<int> &indices, bool enabled);
     //@}
 
     //! Used by MyService::Stub to update from config received from server
     //@{
     bool insertStream(uint streamId);
-    bool updateStream(uint streamId, OstProto::Stream *stream);
+    bool updateStreams(const OstProto::StreamConfigList &streamConfigList);
     //@}
 
     bool isDirty() { return dirty_; }
@@ -163,6 +193,8 @@ public:
     void getNewStreamsSinceLastSync(OstProto::StreamIdList &streamIdList);
     void getModifiedStreamsSinceLastSync(
         OstProto::StreamConfigList &streamConfigList);
+    void getStreamDeltaSinceLastSync(OstProto::PortConfigDelta &delta,
+                                     bool withSweeps = false);
 
     void getDeletedDeviceGroupsSinceLastSync(
             OstProto::DeviceGroupIdList &streamIdList);
@@ -214,9 +246,17 @@ public:
     int numDevices();
     const OstEmul::Device* deviceByIndex(int index);
 
+    //! Devices are fetched from the server a page at a time
+    //@{
+    int totalDevices();
+    bool canFetchMoreDevices();
+    void fetchMoreDevices();
+    //@}
+
     //! Used by MyService::Stub to update from config received from server
     void clearDeviceList();
     void insertDevice(const OstEmul::Device &device);
+    void setTotalDevices(int count);
 
     const OstEmul::DeviceNeighborList* deviceNeighbors(int deviceIndex);
     int numArp(int deviceIndex);
@@ -229,6 +269,7 @@ public:
     void insertDeviceNeighbors(const OstEmul::DeviceNeighborList &neighList);
 
     void deviceInfoRefreshed();
+    void deviceInfoAppended();
 
 signals:
     //! Used when local config changed and when config received from server
@@ -238,8 +279,12 @@ signals:
     //@{
     void portDataChanged(int portGroupId, int portId);
     void deviceInfoChanged();
+    void deviceInfoGrown();
     //@}
 
+    //! Used by DeviceModel to fetch the next page of devices
+    void moreDeviceInfoWanted(int portGroupId, int portId);
+
     //! Used when local config changed
     //@{
     void streamListChanged(int portGroupId, int portId);
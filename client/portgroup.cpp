@@ -20,6 +20,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 #include "portgroup.h"
 
 #include "jumpurl.h"
+#include "pcapreader.h"
 #include "settings.h"
 
 #include "emulproto.pb.h"
@@ -54,6 +55,12 @@ PortGroup::PortGroup(QString serverName, quint16 port)
 
     statsController = new PbRpcController(portIdList_, portStatsList_);
     isGetStatsPending_ = false;
+    isStatsSubscribed_ = false;
+    statsInterval_ = 1000;
+    isApplyPortConfigSupported_ = true;
+    isStreamSweepSupported_ = false;
+    isAllConfigsSupported_ = false;
+    isPortContentRequested_ = false;
 
     atConnectConfig_ = NULL;
 
@@ -101,7 +108,12 @@ PortGroup::~PortGroup()
     delete atConnectConfig_;
 }
 
-void PortGroup::setConfigAtConnect(const OstProto::PortGroupContent *config)
+/*!
+  Sets the config to be applied to this portgroup's ports on connect
+
+  The content of config is moved (not copied) - config is left empty
+*/
+void PortGroup::setConfigAtConnect(OstProto::PortGroupContent *config)
 {
     if (!config) {
         delete atConnectConfig_;
@@ -111,7 +123,8 @@ void PortGroup::setConfigAtConnect(const OstProto::PortGroupContent *config)
 
     if (!atConnectConfig_)
         atConnectConfig_ = new OstProto::PortGroupContent;
-    atConnectConfig_->CopyFrom(*config);
+    atConnectConfig_->Clear();
+    atConnectConfig_->Swap(config);
 }
 
 int PortGroup::numReservedPorts() const
@@ -173,6 +186,8 @@ void PortGroup::on_rpcChannel_connected()
     qDebug("requesting version check ...");
     verInfo->set_client_name("ostinato");
     verInfo->set_version(version);
+    verInfo->set_rpc_pipelining(true);
+    verInfo->set_rpc_compression(true);
     
     PbRpcController *controller = new PbRpcController(verInfo, verCompat);
     serviceStub->checkVersion(controller, verInfo, verCompat, 
@@ -219,6 +234,14 @@ void PortGroup::processVersionCompatibility(PbRpcController *controller)
 
     compat = kCompatible;
 
+    // Must be before any other RPC - the framing changes
+    if (verCompat->rpc_pipelining())
+        rpcChannel->setPipelined(true);
+    if (verCompat->rpc_compression())
+        rpcChannel->setCompression(true);
+    isStreamSweepSupported_ = verCompat->stream_sweep();
+    isAllConfigsSupported_ = verCompat->all_configs();
+
     {
         OstProto::Void *void_ = new OstProto::Void;
         OstProto::PortIdList *portIdList = new OstProto::PortIdList;
@@ -238,14 +261,20 @@ void PortGroup::on_rpcChannel_disconnected()
     qDebug("disconnected\n");
     emit portListAboutToBeChanged(mPortGroupId);
 
-    while (!mPorts.isEmpty())
-        delete mPorts.takeFirst(); 
+    if (!mPorts.isEmpty()) {
+        emit portsAboutToBeRemoved(mPortGroupId, 0, mPorts.size() - 1);
+        while (!mPorts.isEmpty())
+            delete mPorts.takeFirst(); 
+        emit portsRemoved(mPortGroupId);
+    }
     atConnectPortConfig_.clear();
 
     emit portListChanged(mPortGroupId);
     emit portGroupDataChanged(mPortGroupId);
 
     isGetStatsPending_ = false;
+    isStatsSubscribed_ = false;
+    isApplyPortConfigSupported_ = true; // drone may have been upgraded
 
     if (reconnect)
     {
@@ -309,6 +338,61 @@ void PortGroup::on_rpcChannel_notification(int notifType,
                     controller));
             break;
         }
+        case OstProto::portStatsChanged: {
+            const OstProto::PortStatsList &list = notif->port_stats_list();
+
+            // Only the changed stats - merged into what we have
+            for (int i = 0; i < list.port_stats_size(); i++)
+            {
+                uint id = list.port_stats(i).port_id().id();
+
+                // FIXME: don't mix port id & index into mPorts[]
+                if (int(id) >= mPorts.size())
+                    continue;
+                mPorts[id]->updateStats(
+                        notif->mutable_port_stats_list()->mutable_port_stats(i));
+            }
+
+            emit statsChanged(mPortGroupId);
+            break;
+        }
+        case OstProto::portBuildProgress: {
+            const OstProto::BuildProgress &progress = notif->build_progress();
+
+            switch (progress.state()) {
+            case OstProto::BuildProgress::kBuildDone:
+                qDebug("port %d: built %d streams in %d msecs",
+                        progress.port_id().id(), progress.stream_count(),
+                        progress.elapsed_msec());
+                break;
+            case OstProto::BuildProgress::kBuildCancelled:
+                qDebug("port %d: build cancelled after %d msecs",
+                        progress.port_id().id(), progress.elapsed_msec());
+                break;
+            case OstProto::BuildProgress::kBuildInProgress:
+                qDebug("port %d: built %d/%d streams, %llu frames, "
+                        "%llu bytes", progress.port_id().id(),
+                        progress.streams_done(), progress.stream_count(),
+                        (unsigned long long) progress.frames_built(),
+                        (unsigned long long) progress.bytes_allocated());
+                break;
+            default:
+                qDebug("port %d: building %d streams",
+                        progress.port_id().id(), progress.stream_count());
+                break;
+            }
+            break;
+        }
+        case OstProto::neighborResolveProgress: {
+            const OstProto::ResolveProgress &progress =
+                                        notif->resolve_progress();
+
+            qDebug("port %d: neighbors %d pending, %d resolved, %d failed "
+                    "(%d requests sent)", progress.port_id().id(),
+                    progress.pending(), progress.resolved(), progress.failed(),
+                    progress.sent());
+            break;
+        }
         default:
             break;
     }
@@ -353,6 +437,9 @@ void PortGroup::processPortIdList(PbRpcController *controller)
 
     emit portListAboutToBeChanged(mPortGroupId);
 
+    if (portIdList->port_id_size())
+        emit portsAboutToBeAppended(mPortGroupId, mPorts.size(),
+                mPorts.size() + portIdList->port_id_size() - 1);
     for(int i = 0; i <  portIdList->port_id_size(); i++)
     {
         Port *p;
@@ -362,15 +449,21 @@ void PortGroup::processPortIdList(PbRpcController *controller)
                 this, SIGNAL(portGroupDataChanged(int, int)));
         connect(p, SIGNAL(localConfigChanged(int, int, bool)),
                 this, SIGNAL(portGroupDataChanged(int, int)));
+        connect(p, SIGNAL(moreDeviceInfoWanted(int, int)),
+                this, SLOT(when_port_moreDeviceInfoWanted(int, int)));
         qDebug("before port append\n");
         mPorts.append(p);
         atConnectPortConfig_.append(NULL); // will be filled later
     }
+    if (portIdList->port_id_size())
+        emit portsAppended(mPortGroupId);
 
     emit portListChanged(mPortGroupId);
 
     portIdList_->CopyFrom(*portIdList);
 
+    subscribePortStats();
+
     // Request PortConfigList
     {
         qDebug("requesting port config list ...");
@@ -384,6 +477,18 @@ void PortGroup::processPortIdList(PbRpcController *controller)
         serviceStub->getPortConfig(controller, portIdList2, portConfigList, 
                 NewCallback(this, &PortGroup::processPortConfigList, controller2));
 
+        // Unless some ports are to be configured at connect (which needs
+        // the port configs first), the ports' device groups and streams
+        // are requested right away too - pipelined, instead of a round
+        // trip later; the replies are in order, so the port configs are
+        // still processed before them
+        isPortContentRequested_ = isAllConfigsSupported_
+                                    && !atConnectConfig_ && (numPorts() > 0);
+        if (isPortContentRequested_) {
+            getDeviceGroupIdList();
+            getStreamIdList();
+        }
+
         goto _exit;
     }
 
@@ -415,25 +520,11 @@ void PortGroup::processPortConfigList(PbRpcController *controller)
         id = portConfigList->port(i).port_id().id();
         // FIXME: don't mix port id & index into mPorts[]
         mPorts[id]->updatePortConfig(portConfigList->mutable_port(i));
-    }
 
-    // FIXME: Ideally we should emit portGroupDataChanged since only 
-    // port data is changing; but writing the corresponding slot in 
-    // PortStatsModel for that signal turned out to be very bug prone 
-    // causing assert failures when portgroups are added/deleted or
-    // connected/disconnected in different orders
-    // TODO: Revisit this when we refactor the domain-objects/model/view 
-    // design
-    emit portListChanged(mPortGroupId);
-
-    if (numPorts() > 0) {
-        // XXX: The open session code (atConnectConfig_ related) assumes
-        // the following two RPCs are invoked in the below order
-        // Any change here without coressponding change in that code
-        // will break stuff
-        getDeviceGroupIdList();
-        getStreamIdList();
+        // Only the port data changes, not the port list
+        emit portGroupDataChanged(mPortGroupId, id);
     }
+    emit portGroupDataChanged(mPortGroupId);
 
     // Now that we have the port details, let's identify which ports
     // need to be re-configured based on atConnectConfig_
@@ -473,14 +564,23 @@ void PortGroup::processPortConfigList(PbRpcController *controller)
         }
     }
 
+    // After atConnectPortConfig_ is set - it is used to tell what to
+    // request alongwith the ids
+    if ((numPorts() > 0) && !isPortContentRequested_) {
+        // XXX: The open session code (atConnectConfig_ related) assumes
+        // the following two RPCs are invoked in the below order
+        // Any change here without coressponding change in that code
+        // will break stuff
+        getDeviceGroupIdList();
+        getStreamIdList();
+    }
+
 _error_exit:
     delete controller;
 }
 
 void PortGroup::when_configApply(int portIndex)
 {
-    OstProto::StreamIdList *streamIdList;
-    OstProto::StreamConfigList *streamConfigList;
     OstProto::Ack *ack;
     PbRpcController *controller;
 
@@ -500,6 +600,8 @@ void PortGroup::when_configApply(int portIndex)
     // Also, drone currently updates its packet list at the end of
     // modifyStream() implicitly assuming that will be the last API
     // called - this will also need to be fixed
+    // NOTE: The per-operation Stream RPCs are now used only with drones
+    // that don't support applyPortConfig which fixes both of the above
 
     //
     // Update/Sync DeviceGroups
@@ -560,6 +662,35 @@ void PortGroup::when_configApply(int portIndex)
     //
     // Update/Sync Streams
     //
+    if (isApplyPortConfigSupported_) {
+        OstProto::PortConfigDelta *portConfigDelta
+            = new OstProto::PortConfigDelta;
+
+        qDebug("applying stream changes ...");
+        mPorts[portIndex]->getStreamDeltaSinceLastSync(*portConfigDelta,
+                                                       isStreamSweepSupported_);
+
+        ack = new OstProto::Ack;
+        controller = new PbRpcController(portConfigDelta, ack);
+        serviceStub->applyPortConfig(controller, portConfigDelta, ack,
+                NewCallback(this, &PortGroup::processApplyPortConfigAck,
+                    portIndex, controller));
+    }
+    else
+        applyStreams(portIndex);
+}
+
+/*!
+  Syncs streams using the per-operation stream RPCs - for drones that
+  don't support applyPortConfig
+*/
+void PortGroup::applyStreams(int portIndex)
+{
+    OstProto::StreamIdList *streamIdList;
+    OstProto::StreamConfigList *streamConfigList;
+    OstProto::Ack *ack;
+    PbRpcController *controller;
+
     qDebug("applying 'deleted streams' ...");
     streamIdList = new OstProto::StreamIdList;
     ack = new OstProto::Ack;
@@ -640,9 +771,57 @@ void PortGroup::processModifyStreamAck(int portIndex,
     delete controller;
 }
 
-void PortGroup::getDeviceInfo(int portIndex)
+void PortGroup::processApplyPortConfigAck(int portIndex,
+        PbRpcController *controller)
+{
+    qDebug("In %s", __FUNCTION__);
+
+    if (controller->Failed())
+    {
+        QString error = controller->ErrorString();
+
+        qDebug("%s: rpc failed(%s)", __FUNCTION__, qPrintable(error));
+
+        // An older drone - redo using the legacy stream RPCs
+        if (error.startsWith("invalid RPC method")) {
+            isApplyPortConfigSupported_ = false;
+            applyStreams(portIndex);
+            goto _exit;
+        }
+
+        // Nothing was applied by drone - retain local changes as unsynced
+        QMessageBox::warning(NULL, tr("Apply"),
+                tr("Unable to apply changes to port %1 - %2")
+                    .arg(mPorts[portIndex]->id()).arg(error));
+        goto _restore_ui;
+    }
+
+    qDebug("apply completed");
+    mPorts[portIndex]->when_syncComplete();
+
+_restore_ui:
+    mainWindow->setEnabled(true);
+    QApplication::restoreOverrideCursor();
+_exit:
+    delete controller;
+}
+
+void PortGroup::when_port_moreDeviceInfoWanted(int /*portGroupId*/,
+                                               int portId)
+{
+    for (int i = 0; i < mPorts.size(); i++) {
+        if (int(mPorts[i]->id()) == portId) {
+            getDeviceInfo(i, mPorts[i]->numDevices());
+            break;
+        }
+    }
+}
+
+// Fetches a page of devices (and their neighbors) starting at offset -
+// the rest are fetched as the device list is scrolled
+void PortGroup::getDeviceInfo(int portIndex, int offset)
 {
-    OstProto::PortId *portId;
+    OstProto::DeviceListRequest *request;
     OstProto::PortDeviceList *deviceList;
     OstProto::PortNeighborList *neighList;
     PbRpcController *controller;
@@ -652,27 +831,30 @@ void PortGroup::getDeviceInfo(int portIndex)
     if (state() != QAbstractSocket::ConnectedState)
         return;
 
-    portId = new OstProto::PortId;
-    portId->set_id(mPorts[portIndex]->id());
+    request = new OstProto::DeviceListRequest;
+    request->mutable_port_id()->set_id(mPorts[portIndex]->id());
+    request->set_offset(offset);
+    request->set_count(kDeviceInfoPageSize);
     deviceList = new OstProto::PortDeviceList;
-    controller = new PbRpcController(portId, deviceList);
+    controller = new PbRpcController(request, deviceList);
 
-    serviceStub->getDeviceList(controller, portId, deviceList,
+    serviceStub->getDeviceListPage(controller, request, deviceList,
         NewCallback(this, &PortGroup::processDeviceList,
                     portIndex, controller));
 
-    portId = new OstProto::PortId;
-    portId->set_id(mPorts[portIndex]->id());
+    request = new OstProto::DeviceListRequest(*request);
     neighList = new OstProto::PortNeighborList;
-    controller = new PbRpcController(portId, neighList);
+    controller = new PbRpcController(request, neighList);
 
-    serviceStub->getDeviceNeighbors(controller, portId, neighList,
+    serviceStub->getDeviceNeighborsPage(controller, request, neighList,
         NewCallback(this, &PortGroup::processDeviceNeighbors,
                     portIndex, controller));
 }
 
 void PortGroup::processDeviceList(int portIndex, PbRpcController *controller)
 {
+    OstProto::DeviceListRequest *request
+        = static_cast<OstProto::DeviceListRequest*>(controller->request());
     OstProto::PortDeviceList *deviceList
         = static_cast<OstProto::PortDeviceList*>(controller->response());
 
@@ -694,7 +876,15 @@ void PortGroup::processDeviceList(int portIndex, PbRpcController *controller)
         goto _exit;
     }
 
-    mPorts[portIndex]->clearDeviceList();
+    if (request->offset() == 0)
+        mPorts[portIndex]->clearDeviceList();
+    else if (request->offset() != uint(mPorts[portIndex]->numDevices())) {
+        qDebug("%s: stale page (offset %u, have %d devices)", __FUNCTION__,
+                request->offset(), mPorts[portIndex]->numDevices());
+        goto _exit;
+    }
+
+    mPorts[portIndex]->setTotalDevices(deviceList->matched_devices());
     for(int i = 0; i < deviceList->ExtensionSize(OstEmul::device); i++) {
         mPorts[portIndex]->insertDevice(
                 deviceList->GetExtension(OstEmul::device, i));
@@ -707,6 +897,8 @@ _exit:
 void PortGroup::processDeviceNeighbors(
         int portIndex, PbRpcController *controller)
 {
+    OstProto::DeviceListRequest *request
+        = static_cast<OstProto::DeviceListRequest*>(controller->request());
     OstProto::PortNeighborList *neighList
         = static_cast<OstProto::PortNeighborList*>(controller->response());
 
@@ -728,13 +920,17 @@ void PortGroup::processDeviceNeighbors(
         goto _exit;
     }
 
-    mPorts[portIndex]->clearDeviceNeighbors();
+    if (request->offset() == 0)
+        mPorts[portIndex]->clearDeviceNeighbors();
     for(int i=0; i < neighList->ExtensionSize(OstEmul::device_neighbor); i++) {
         mPorts[portIndex]->insertDeviceNeighbors(
                 neighList->GetExtension(OstEmul::device_neighbor, i));
     }
 
-    mPorts[portIndex]->deviceInfoRefreshed();
+    if (request->offset() == 0)
+        mPorts[portIndex]->deviceInfoRefreshed();
+    else
+        mPorts[portIndex]->deviceInfoAppended();
 
 _exit:
     delete controller;
@@ -811,17 +1007,26 @@ _exit:
 void PortGroup::getStreamIdList()
 {
     for (int portIndex = 0; portIndex < numPorts(); portIndex++)
-    {
-        OstProto::PortId *portId = new OstProto::PortId;
-        OstProto::StreamIdList *streamIdList = new OstProto::StreamIdList;
-        PbRpcController *controller = new PbRpcController(portId, streamIdList);
+        getStreamIdList(portIndex);
+}
 
-        portId->set_id(mPorts[portIndex]->id());
+void PortGroup::getStreamIdList(int portIndex)
+{
+    OstProto::PortId *portId = new OstProto::PortId;
+    OstProto::StreamIdList *streamIdList = new OstProto::StreamIdList;
+    PbRpcController *controller = new PbRpcController(portId, streamIdList);
 
-        serviceStub->getStreamIdList(controller, portId, streamIdList,
-                NewCallback(this, &PortGroup::processStreamIdList, 
-                    portIndex, controller));
-    }
+    portId->set_id(mPorts[portIndex]->id());
+
+    serviceStub->getStreamIdList(controller, portId, streamIdList,
+            NewCallback(this, &PortGroup::processStreamIdList, 
+                portIndex, controller));
+
+    // The stream configs alongwith, instead of after the ids are received
+    // (see processStreamIdList()) - except for a port to be configured at
+    // connect, whose streams are replaced
+    if (isAllConfigsSupported_ && !atConnectPortConfig_.at(portIndex))
+        getStreamConfigList(portIndex, true);
 }
 
 void PortGroup::processStreamIdList(int portIndex, PbRpcController *controller)
@@ -857,12 +1062,13 @@ void PortGroup::processStreamIdList(int portIndex, PbRpcController *controller)
         // re-requesting getStreamId()
         //   * delete (existing) deviceGroups
         //     (already done by processDeviceIdList)
-        //   * delete (existing) streams
         //   * modify port
         //   * add (new) deviceGroup ids
         //   * modify (new) deviceGroups
-        //   * add (new) stream ids
-        //   * modify (new) streams
+        //   * delete (existing) streams, add (new) stream ids and
+        //     modify (new) streams - all with a single applyPortConfig
+        //     or, for older drones, the per-operation stream RPCs
+        //     (see applyAtConnectStreams())
         // XXX: This assumes getDeviceGroupIdList() was invoked before
         // getStreamIdList() - if the order changes this code will break!
 
@@ -872,20 +1078,6 @@ void PortGroup::processStreamIdList(int portIndex, PbRpcController *controller)
         QString myself = appSettings->value(kUserKey, kUserDefaultValue)
                             .toString();
 
-        // delete all existing streams
-        if (streamIdList->stream_id_size())
-        {
-            OstProto::StreamIdList *streamIdList2 = new OstProto::StreamIdList;
-            streamIdList2->CopyFrom(*streamIdList);
-
-            OstProto::Ack *ack = new OstProto::Ack;
-            controller = new PbRpcController(streamIdList2, ack);
-
-            serviceStub->deleteStream(controller, streamIdList2, ack,
-                NewCallback(this, &PortGroup::processDeleteStreamAck,
-                            controller));
-        }
-
         OstProto::Port portCfg = newPortContent->port_config();
         if (mPorts[portIndex]->modifiablePortConfig(portCfg))
         {
@@ -938,60 +1130,37 @@ void PortGroup::processStreamIdList(int portIndex, PbRpcController *controller)
                         portIndex, controller));
         }
 
-        // add/modify streams
-        if (newPortContent->streams_size())
-        {
-            OstProto::StreamIdList *streamIdList = new OstProto::StreamIdList;
-            OstProto::StreamConfigList *streamConfigList =
-                    new OstProto::StreamConfigList;
-            streamIdList->mutable_port_id()->set_id(portId);
-            streamConfigList->mutable_port_id()->set_id(portId);
-            for (int i = 0; i < newPortContent->streams_size(); i++)
-            {
-                const OstProto::Stream &s = newPortContent->streams(i);
-                streamIdList->add_stream_id()->set_id(s.stream_id().id());
-                streamConfigList->add_stream()->CopyFrom(s);
-            }
-
-            OstProto::Ack *ack = new OstProto::Ack;
-            controller = new PbRpcController(streamIdList, ack);
-
-            serviceStub->addStream(controller, streamIdList, ack,
-                    NewCallback(this, &PortGroup::processAddStreamAck,
-                                controller));
-
-            ack = new OstProto::Ack;
-            controller = new PbRpcController(streamConfigList, ack);
-
-            serviceStub->modifyStream(controller, streamConfigList, ack,
-                    NewCallback(this, &PortGroup::processModifyStreamAck,
-                        portIndex, controller));
-        }
+        // replace all existing streams with the new ones
+        OstProto::PortConfigDelta *portConfigDelta
+                = new OstProto::PortConfigDelta;
+        portConfigDelta->mutable_port_id()->set_id(portId);
+        portConfigDelta->mutable_deleted_stream_id()->CopyFrom(
+                streamIdList->stream_id());
+        portConfigDelta->mutable_new_stream()->CopyFrom(
+                newPortContent->streams());
 
         // delete newPortConfig
         atConnectPortConfig_[portIndex] = NULL;
 
         // return to normal sequence re-starting from
-        // getDeviceGroupIdList() and getStreamIdList()
-        OstProto::PortId *portId2 = new OstProto::PortId;
-        portId2->set_id(portId);
+        // getDeviceGroupIdList() and getStreamIdList() - the latter is
+        // requested once the streams have been replaced
+        getDeviceGroupIdList(portIndex);
 
-        OstProto::DeviceGroupIdList *devGrpIdList
-                = new OstProto::DeviceGroupIdList;
-        controller = new PbRpcController(portId2, devGrpIdList);
-
-        serviceStub->getDeviceGroupIdList(controller, portId2, devGrpIdList,
-                NewCallback(this, &PortGroup::processDeviceGroupIdList,
-                    portIndex, controller));
-
-        portId2 = new OstProto::PortId;
-        portId2->set_id(portId);
-        OstProto::StreamIdList *streamIdList = new OstProto::StreamIdList;
-        controller = new PbRpcController(portId2, streamIdList);
+        if (isApplyPortConfigSupported_)
+        {
+            OstProto::Ack *ack = new OstProto::Ack;
+            controller = new PbRpcController(portConfigDelta, ack);
 
-        serviceStub->getStreamIdList(controller, portId2, streamIdList,
-                NewCallback(this, &PortGroup::processStreamIdList,
-                    portIndex, controller));
+            serviceStub->applyPortConfig(controller, portConfigDelta, ack,
+                    NewCallback(this, &PortGroup::processAtConnectStreamsAck,
+                        portIndex, controller));
+        }
+        else
+        {
+            applyAtConnectStreams(portIndex, portConfigDelta);
+            delete portConfigDelta;
+        }
     }
     else
     {
@@ -1005,16 +1174,18 @@ void PortGroup::processStreamIdList(int portIndex, PbRpcController *controller)
 
         mPorts[portIndex]->when_syncComplete();
 
-        getStreamConfigList(portIndex);
+        // Requested alongwith the ids, if supported
+        if (!isAllConfigsSupported_)
+            getStreamConfigList(portIndex);
     }
 
 _exit:
     delete controller;
 }
 
-void PortGroup::getStreamConfigList(int portIndex)
+void PortGroup::getStreamConfigList(int portIndex, bool allStreams)
 {
-    if (mPorts[portIndex]->numStreams() == 0)
+    if (!allStreams && (mPorts[portIndex]->numStreams() == 0))
         return;
 
     qDebug("requesting stream config list (port %d)...", portIndex);
@@ -1026,7 +1197,9 @@ void PortGroup::getStreamConfigList(int portIndex)
             streamIdList, streamConfigList);
 
     streamIdList->mutable_port_id()->set_id(mPorts[portIndex]->id());
-    for (int j = 0; j < mPorts[portIndex]->numStreams(); j++)
+    if (allStreams)
+        streamIdList->set_all_streams(true);
+    for (int j = 0; !allStreams && (j < mPorts[portIndex]->numStreams()); j++)
     {
         OstProto::StreamId *s = streamIdList->add_stream_id();
         s->set_id(mPorts[portIndex]->streamByIndex(j)->id());
@@ -1063,14 +1236,7 @@ void PortGroup::processStreamConfigList(int portIndex,
         goto _exit;
     }
 
-    for(int i = 0; i <  streamConfigList->stream_size(); i++)
-    {
-        uint streamId;
-
-        streamId = streamConfigList->stream(i).stream_id().id();
-        mPorts[portIndex]->updateStream(streamId,
-            streamConfigList->mutable_stream(i));
-    }
+    mPorts[portIndex]->updateStreams(*streamConfigList);
 
 #if 0
     // FIXME: incorrect check - will never be true if last port does not have any streams configured
@@ -1091,17 +1257,116 @@ void PortGroup::getDeviceGroupIdList()
     using OstProto::DeviceGroupIdList;
 
     for (int portIndex = 0; portIndex < numPorts(); portIndex++)
+        getDeviceGroupIdList(portIndex);
+}
+
+void PortGroup::getDeviceGroupIdList(int portIndex)
+{
+    using OstProto::PortId;
+    using OstProto::DeviceGroupIdList;
+
+    PortId *portId = new PortId;
+    DeviceGroupIdList *devGrpIdList = new DeviceGroupIdList;
+    PbRpcController *controller = new PbRpcController(portId, devGrpIdList);
+
+    portId->set_id(mPorts[portIndex]->id());
+
+    serviceStub->getDeviceGroupIdList(controller, portId, devGrpIdList,
+            NewCallback(this, &PortGroup::processDeviceGroupIdList,
+                portIndex, controller));
+
+    // As for the streams - see getStreamIdList()
+    if (isAllConfigsSupported_ && !atConnectPortConfig_.at(portIndex))
+        getDeviceGroupConfigList(portIndex, true);
+}
+
+/*!
+  Replaces the streams of a port being configured at connect as per
+  delta using the per-operation stream RPCs - for drones that don't
+  support applyPortConfig; the stream id list is re-requested at the end
+*/
+void PortGroup::applyAtConnectStreams(int portIndex,
+        const OstProto::PortConfigDelta *delta)
+{
+    PbRpcController *controller;
+    quint32 portId = mPorts[portIndex]->id();
+
+    // delete all existing streams
+    if (delta->deleted_stream_id_size())
     {
-        PortId *portId = new PortId;
-        DeviceGroupIdList *devGrpIdList = new DeviceGroupIdList;
-        PbRpcController *controller = new PbRpcController(portId, devGrpIdList);
+        OstProto::StreamIdList *streamIdList = new OstProto::StreamIdList;
+        streamIdList->mutable_port_id()->set_id(portId);
+        streamIdList->mutable_stream_id()->CopyFrom(
+                delta->deleted_stream_id());
+
+        OstProto::Ack *ack = new OstProto::Ack;
+        controller = new PbRpcController(streamIdList, ack);
 
-        portId->set_id(mPorts[portIndex]->id());
+        serviceStub->deleteStream(controller, streamIdList, ack,
+            NewCallback(this, &PortGroup::processDeleteStreamAck,
+                        controller));
+    }
 
-        serviceStub->getDeviceGroupIdList(controller, portId, devGrpIdList,
-                NewCallback(this, &PortGroup::processDeviceGroupIdList,
+    // add/modify streams
+    if (delta->new_stream_size())
+    {
+        OstProto::StreamIdList *streamIdList = new OstProto::StreamIdList;
+        OstProto::StreamConfigList *streamConfigList =
+                new OstProto::StreamConfigList;
+        streamIdList->mutable_port_id()->set_id(portId);
+        streamConfigList->mutable_port_id()->set_id(portId);
+        for (int i = 0; i < delta->new_stream_size(); i++)
+            streamIdList->add_stream_id()->set_id(
+                    delta->new_stream(i).stream_id().id());
+        streamConfigList->mutable_stream()->CopyFrom(delta->new_stream());
+
+        OstProto::Ack *ack = new OstProto::Ack;
+        controller = new PbRpcController(streamIdList, ack);
+
+        serviceStub->addStream(controller, streamIdList, ack,
+                NewCallback(this, &PortGroup::processAddStreamAck,
+                            controller));
+
+        ack = new OstProto::Ack;
+        controller = new PbRpcController(streamConfigList, ack);
+
+        serviceStub->modifyStream(controller, streamConfigList, ack,
+                NewCallback(this, &PortGroup::processModifyStreamAck,
                     portIndex, controller));
     }
+
+    getStreamIdList(portIndex);
+}
+
+void PortGroup::processAtConnectStreamsAck(int portIndex,
+        PbRpcController *controller)
+{
+    qDebug("In %s (portIndex = %d)", __FUNCTION__, portIndex);
+
+    if (controller->Failed())
+    {
+        QString error = controller->ErrorString();
+
+        qDebug("%s: rpc failed(%s)", __FUNCTION__, qPrintable(error));
+
+        // An older drone - redo using the legacy stream RPCs
+        if (error.startsWith("invalid RPC method")) {
+            isApplyPortConfigSupported_ = false;
+            applyAtConnectStreams(portIndex,
+                    static_cast<OstProto::PortConfigDelta*>(
+                        controller->request()));
+            goto _exit;
+        }
+
+        QMessageBox::warning(NULL, tr("Open Session"),
+                tr("Unable to configure streams of port %1 - %2")
+                    .arg(mPorts[portIndex]->id()).arg(error));
+    }
+
+    getStreamIdList(portIndex);
+
+_exit:
+    delete controller;
 }
 
 void PortGroup::processDeviceGroupIdList(
@@ -1162,20 +1427,22 @@ void PortGroup::processDeviceGroupIdList(
             mPorts[portIndex]->insertDeviceGroup(devGrpId);
         }
 
-        getDeviceGroupConfigList(portIndex);
+        // Requested alongwith the ids, if supported
+        if (!isAllConfigsSupported_)
+            getDeviceGroupConfigList(portIndex);
     }
 
 _exit:
     delete controller;
 }
 
-void PortGroup::getDeviceGroupConfigList(int portIndex)
+void PortGroup::getDeviceGroupConfigList(int portIndex, bool allDeviceGroups)
 {
     using OstProto::DeviceGroupId;
     using OstProto::DeviceGroupIdList;
     using OstProto::DeviceGroupConfigList;
 
-    if (mPorts[portIndex]->numDeviceGroups() == 0)
+    if (!allDeviceGroups && (mPorts[portIndex]->numDeviceGroups() == 0))
         return;
 
     qDebug("requesting device group config list (port %d) ...", portIndex);
@@ -1186,7 +1453,10 @@ void PortGroup::getDeviceGroupConfigList(int portIndex)
             devGrpIdList, devGrpCfgList);
 
     devGrpIdList->mutable_port_id()->set_id(mPorts[portIndex]->id());
-    for (int j = 0; j < mPorts[portIndex]->numDeviceGroups(); j++)
+    if (allDeviceGroups)
+        devGrpIdList->set_all_device_groups(true);
+    for (int j = 0; !allDeviceGroups
+                        && (j < mPorts[portIndex]->numDeviceGroups()); j++)
     {
         DeviceGroupId *dgid = devGrpIdList->add_device_group_id();
         dgid->set_id(mPorts[portIndex]->deviceGroupByIndex(j)
@@ -1272,6 +1542,18 @@ void PortGroup::startTx(QList<uint> *portList)
             portId->set_id(portList->at(i));
         }
 
+        // Have drone build the packet lists of all the ports in parallel;
+        // startTransmit (which follows) waits for the builds to finish
+        OstProto::PortIdList *prepareIdList = new OstProto::PortIdList;
+        OstProto::Ack *prepareAck = new OstProto::Ack;
+        PbRpcController *prepareController =
+                new PbRpcController(prepareIdList, prepareAck);
+
+        prepareIdList->CopyFrom(*portIdList);
+        serviceStub->prepareTransmit(prepareController, prepareIdList,
+                prepareAck, NewCallback(this, &PortGroup::processPrepareTxAck,
+                    prepareController));
+
         serviceStub->startTransmit(controller, portIdList, ack,
                 NewCallback(this, &PortGroup::processStartTxAck, controller));
     }
@@ -1279,6 +1561,18 @@ _exit:
     return;
 }
 
+void PortGroup::processPrepareTxAck(PbRpcController *controller)
+{
+    qDebug("In %s", __FUNCTION__);
+
+    // an older drone without prepareTransmit builds in startTransmit
+    if (controller->Failed())
+        qDebug("%s: rpc failed(%s)", __FUNCTION__,
+                qPrintable(controller->ErrorString()));
+
+    delete controller;
+}
+
 void PortGroup::processStartTxAck(PbRpcController *controller)
 {
     qDebug("In %s", __FUNCTION__);
@@ -1434,6 +1728,22 @@ void PortGroup::processViewCaptureAck(PbRpcController *controller)
     capFile->flush();
     capFile->close();
 
+    if (!controller->Failed())
+    {
+        PcapReader reader;
+        PcapReader::Packet pkt;
+        QString error;
+
+        // Nothing to look at in Wireshark if there are no packets
+        if (reader.open(capFile->fileName(), error) && !reader.next(pkt)
+                && !reader.isTruncated())
+        {
+            QMessageBox::information(NULL, qApp->applicationName(),
+                    "No packets were captured on this port");
+            goto _exit;
+        }
+    }
+
     if (!QFile::exists(viewer))
     {
         QMessageBox::warning(NULL, "Can't find Wireshark", 
@@ -1449,6 +1759,61 @@ _exit:
     delete controller;
 }
 
+/*!
+  Fetches the capture records of a port from packetIndex onwards - upto
+  length bytes of records, each truncated to snapLen bytes; the records
+  are emitted with capturePacketsReceived()
+
+  The pcap file header is included only if withFileHeader is true - this
+  also takes a fresh snapshot of a ring capture, so only the first fetch
+  of a capture should ask for it
+*/
+void PortGroup::getCapturePackets(uint portId, quint64 packetIndex,
+        uint length, uint snapLen, bool withFileHeader)
+{
+    const int kFileHdrSize = 24;
+    OstProto::CaptureChunkRequest *request;
+    OstProto::CaptureChunk *chunk;
+    PbRpcController *controller;
+
+    if (state() != QAbstractSocket::ConnectedState) {
+        emit capturePacketsReceived(portId, packetIndex, NULL);
+        return;
+    }
+
+    request = new OstProto::CaptureChunkRequest;
+    chunk = new OstProto::CaptureChunk;
+    controller = new PbRpcController(request, chunk);
+
+    request->mutable_port_id()->set_id(portId);
+    request->set_offset(withFileHeader ? 0 : kFileHdrSize);
+    request->set_length(length);
+    request->set_snap_len(snapLen);
+    request->set_packet_index(packetIndex);
+
+    serviceStub->getCaptureChunk(controller, request, chunk,
+            NewCallback(this, &PortGroup::processCapturePackets, controller));
+}
+
+void PortGroup::processCapturePackets(PbRpcController *controller)
+{
+    OstProto::CaptureChunkRequest *request
+        = static_cast<OstProto::CaptureChunkRequest*>(controller->request());
+    OstProto::CaptureChunk *chunk
+        = static_cast<OstProto::CaptureChunk*>(controller->response());
+
+    if (controller->Failed())
+    {
+        qDebug("%s: rpc failed(%s)", __FUNCTION__,
+                qPrintable(controller->ErrorString()));
+        chunk = NULL;
+    }
+
+    emit capturePacketsReceived(request->port_id().id(),
+                                request->packet_index(), chunk);
+    delete controller;
+}
+
 void PortGroup::resolveDeviceNeighbors(QList<uint> *portList)
 {
     qDebug("In %s", __FUNCTION__);
@@ -1521,13 +1886,64 @@ void PortGroup::processClearDeviceNeighborsAck(PbRpcController *controller)
     delete controller;
 }
 
-void PortGroup::getPortStats()
+/*!
+  Sets the interval at which a subscribed drone pushes the stats - the
+  subscription (if any) is updated with the new interval
+*/
+void PortGroup::setStatsInterval(int msecs)
+{
+    if (msecs == statsInterval_)
+        return;
+
+    statsInterval_ = msecs;
+    if (isStatsSubscribed_ && (state() == QAbstractSocket::ConnectedState))
+        subscribePortStats();
+}
+
+void PortGroup::subscribePortStats()
+{
+    OstProto::StatsSubscription *subscription = new OstProto::StatsSubscription;
+    OstProto::Ack *ack = new OstProto::Ack;
+    PbRpcController *controller = new PbRpcController(subscription, ack);
+
+    qDebug("In %s", __FUNCTION__);
+
+    for (int i = 0; i < portIdList_->port_id_size(); i++)
+        subscription->add_port_id()->CopyFrom(portIdList_->port_id(i));
+    subscription->set_interval_msec(statsInterval_);
+
+    serviceStub->subscribeStats(controller, subscription, ack,
+        NewCallback(this, &PortGroup::processSubscribeStatsAck, controller));
+}
+
+void PortGroup::processSubscribeStatsAck(PbRpcController *controller)
+{
+    qDebug("In %s", __FUNCTION__);
+
+    // An older drone doesn't push stats - keep polling it
+    if (controller->Failed())
+        qDebug("%s: rpc failed(%s), will poll for stats", __FUNCTION__,
+                qPrintable(controller->ErrorString()));
+    else
+        isStatsSubscribed_ = true;
+
+    delete controller;
+}
+
+/*!
+  With a stats subscription the stats are pushed by the drone, so this is
+  a no-op unless forced
+*/
+void PortGroup::getPortStats(bool force)
 {
     //qDebug("In %s", __FUNCTION__);
 
     if (state() != QAbstractSocket::ConnectedState)
         goto _exit;
 
+    if (isStatsSubscribed_ && !force)
+        goto _exit;
+
     if (numPorts() <= 0)
         goto _exit;
 
@@ -1604,7 +2020,7 @@ void PortGroup::processClearStatsAck(PbRpcController *controller)
     qDebug("In %s", __FUNCTION__);
 
     // Refresh stats immediately after a stats clear/reset
-    getPortStats();
+    getPortStats(true);
 
     delete controller;
 }
@@ -61,15 +61,30 @@ private:
     PbRpcChannel    *rpcChannel;
     PbRpcController *statsController;
     bool            isGetStatsPending_;
+    bool            isStatsSubscribed_; // drone pushes stats, no polling
+    int             statsInterval_;     // of the pushes, in msecs
+    bool            isApplyPortConfigSupported_;
+    bool            isStreamSweepSupported_;
+    // Drone returns all configs of a port at once (see StreamIdList.
+    // all_streams) - so these are requested alongwith the ids
+    bool            isAllConfigsSupported_;
+    // Device groups and streams requested alongwith the port configs
+    bool            isPortContentRequested_;
 
     OstProto::OstService::Stub *serviceStub;
 
     OstProto::PortIdList       *portIdList_;
     OstProto::PortStatsList    *portStatsList_;
 
+    static const int kDeviceInfoPageSize = 1000;
+
     OstProto::PortGroupContent *atConnectConfig_;
     QList<const OstProto::PortContent*> atConnectPortConfig_;
 
+    void applyStreams(int portIndex);
+    void applyAtConnectStreams(int portIndex,
+            const OstProto::PortConfigDelta *delta);
+
 public: // FIXME(HIGH): member access
     QList<Port*>        mPorts;
 
@@ -90,7 +105,7 @@ public:
     }
     void disconnectFromHost() { reconnect = false; rpcChannel->tearDown(); }
 
-    void setConfigAtConnect(const OstProto::PortGroupContent *config);
+    void setConfigAtConnect(OstProto::PortGroupContent *config);
 
     int numPorts() const { return mPorts.size(); }
     int numReservedPorts() const;
@@ -117,6 +132,9 @@ public:
     void processAddStreamAck(PbRpcController *controller);
     void processDeleteStreamAck(PbRpcController *controller);
     void processModifyStreamAck(int portIndex, PbRpcController *controller);
+    void processApplyPortConfigAck(int portIndex, PbRpcController *controller);
+    void processAtConnectStreamsAck(int portIndex,
+            PbRpcController *controller);
 
     void processAddDeviceGroupAck(PbRpcController *controller);
     void processDeleteDeviceGroupAck(PbRpcController *controller);
@@ -130,20 +148,24 @@ public:
     void processUpdatedPortConfig(PbRpcController *controller);
 
     void getStreamIdList();
+    void getStreamIdList(int portIndex);
     void processStreamIdList(int portIndex, PbRpcController *controller);
-    void getStreamConfigList(int portIndex);
+    void getStreamConfigList(int portIndex, bool allStreams = false);
     void processStreamConfigList(int portIndex, PbRpcController *controller);
 
     void processModifyStreamAck(OstProto::Ack *ack);
 
     void getDeviceGroupIdList();
+    void getDeviceGroupIdList(int portIndex);
     void processDeviceGroupIdList(int portIndex, PbRpcController *controller);
-    void getDeviceGroupConfigList(int portIndex);
+    void getDeviceGroupConfigList(int portIndex,
+                                  bool allDeviceGroups = false);
     void processDeviceGroupConfigList(
             int portIndex,
             PbRpcController *controller);
 
     void startTx(QList<uint> *portList = NULL);
+    void processPrepareTxAck(PbRpcController *controller);
     void processStartTxAck(PbRpcController *controller);
     void stopTx(QList<uint> *portList = NULL);
     void processStopTxAck(PbRpcController *controller);
@@ -154,13 +176,19 @@ public:
     void processStopCaptureAck(PbRpcController *controller);
     void viewCapture(QList<uint> *portList = NULL);
     void processViewCaptureAck(PbRpcController *controller);
+    void getCapturePackets(uint portId, quint64 packetIndex, uint length,
+                           uint snapLen, bool withFileHeader = false);
+    void processCapturePackets(PbRpcController *controller);
 
     void resolveDeviceNeighbors(QList<uint> *portList = NULL);
     void processResolveDeviceNeighborsAck(PbRpcController *controller);
     void clearDeviceNeighbors(QList<uint> *portList = NULL);
     void processClearDeviceNeighborsAck(PbRpcController *controller);
 
-    void getPortStats();
+    void setStatsInterval(int msecs);
+    void subscribePortStats();
+    void processSubscribeStatsAck(PbRpcController *controller);
+    void getPortStats(bool force = false);
     void processPortStatsList();
     void clearPortStats(QList<uint> *portList = NULL);
     void processClearStatsAck(PbRpcController *controller);
@@ -169,7 +197,16 @@ signals:
     void portGroupDataChanged(int portGroupId, int portId = 0xFFFF);
     void portListAboutToBeChanged(quint32 portGroupId);
     void portListChanged(quint32 portGroupId);
+    // The ports (indexes) of a port list change - emitted between the
+    // above two, for the models to update just the rows of those ports
+    void portsAboutToBeAppended(quint32 portGroupId, int first, int last);
+    void portsAppended(quint32 portGroupId);
+    void portsAboutToBeRemoved(quint32 portGroupId, int first, int last);
+    void portsRemoved(quint32 portGroupId);
     void statsChanged(quint32 portGroupId);
+    // chunk is NULL if the fetch failed
+    void capturePacketsReceived(quint32 portId, quint64 packetIndex,
+                                const OstProto::CaptureChunk *chunk);
 
 private slots:
     void on_reconnectTimer_timeout();
@@ -182,10 +219,11 @@ private slots:
             ::google::protobuf::Message *notification);
 
     void when_portListChanged(quint32 portGroupId);
+    void when_port_moreDeviceInfoWanted(int portGroupId, int portId);
 
 public slots:
     void when_configApply(int portIndex);
-    void getDeviceInfo(int portIndex);
+    void getDeviceInfo(int portIndex, int offset = 0);
 
 };
 
@@ -20,6 +20,9 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 #include "portgrouplist.h"
 
 #include "params.h"
+#include "settings.h"
+
+#include <QTimer>
 
 // TODO(LOW): Remove
 #include <modeltest.h>
@@ -45,6 +48,15 @@ PortGroupList::PortGroupList()
     deviceModelTester_ = new ModelTest(getDeviceModel());
 #endif 
 
+    statsInterval_ = appSettings->value(kStatsIntervalKey,
+                        kStatsIntervalDefaultValue).toInt();
+    if (statsInterval_ <= 0)
+        statsInterval_ = kStatsIntervalDefaultValue;
+    isStatsVisible_ = true;
+    statsTimer_ = new QTimer(this);
+    connect(statsTimer_, SIGNAL(timeout()), this, SLOT(updateStats()));
+    updateStatsTimer();
+
     // Add the "Local" Port Group
     if (appParams.optLocalDrone()) {
         PortGroup *pg = new PortGroup;
@@ -98,34 +110,67 @@ void PortGroupList::addPortGroup(PortGroup &portGroup)
     connect(&portGroup, SIGNAL(portListChanged(quint32)),
         &mPortGroupListModel, SLOT(triggerLayoutChanged()));
 #endif
-    connect(&portGroup, SIGNAL(portListChanged(quint32)),
-        &mPortGroupListModel, SLOT(when_portListChanged()));
+    // Only the rows (or columns) of the ports added/removed are updated
+    // in the models - not a reset, that would lose the views' selection
+    connect(&portGroup,
+        SIGNAL(portsAboutToBeAppended(quint32, int, int)),
+        &mPortGroupListModel,
+        SLOT(when_portsAboutToBeAppended(quint32, int, int)));
+    connect(&portGroup, SIGNAL(portsAppended(quint32)),
+        &mPortGroupListModel, SLOT(when_portsAppended(quint32)));
+    connect(&portGroup,
+        SIGNAL(portsAboutToBeRemoved(quint32, int, int)),
+        &mPortGroupListModel,
+        SLOT(when_portsAboutToBeRemoved(quint32, int, int)));
+    connect(&portGroup, SIGNAL(portsRemoved(quint32)),
+        &mPortGroupListModel, SLOT(when_portsRemoved(quint32)));
 
-    connect(&portGroup, SIGNAL(portListChanged(quint32)),
-        &mPortStatsModel, SLOT(when_portListChanged()));
+    connect(&portGroup,
+        SIGNAL(portsAboutToBeAppended(quint32, int, int)),
+        &mPortStatsModel,
+        SLOT(when_portsAboutToBeAppended(quint32, int, int)));
+    connect(&portGroup, SIGNAL(portsAppended(quint32)),
+        &mPortStatsModel, SLOT(when_portsAppended(quint32)));
+    connect(&portGroup,
+        SIGNAL(portsAboutToBeRemoved(quint32, int, int)),
+        &mPortStatsModel,
+        SLOT(when_portsAboutToBeRemoved(quint32, int, int)));
+    connect(&portGroup, SIGNAL(portsRemoved(quint32)),
+        &mPortStatsModel, SLOT(when_portsRemoved(quint32)));
+    connect(&portGroup, SIGNAL(portGroupDataChanged(int, int)),
+        &mPortStatsModel, SLOT(when_portGroupDataChanged(int, int)));
 
     connect(&portGroup, SIGNAL(statsChanged(quint32)),
-        &mPortStatsModel, SLOT(when_portGroup_stats_update(quint32)));
+        this, SLOT(when_portGroup_statsChanged(quint32)));
 
     mPortGroups.append(&portGroup);
+    portGroup.setStatsInterval(statsTimer_->interval());
     portGroup.connectToHost();
 
     mPortGroupListModel.portGroupAppended();
 
-    mPortStatsModel.when_portListChanged();
+    // No ports yet - they are added when connected
+    mPortStatsModel.when_portGroupListChanged();
 }
 
 void PortGroupList::removePortGroup(PortGroup &portGroup)
 {
+    int portCount = portGroup.numPorts();
+
     mPortGroupListModel.portGroupAboutToBeRemoved(&portGroup);
+    if (portCount)
+        mPortStatsModel.when_portsAboutToBeRemoved(portGroup.id(),
+                0, portCount - 1);
 
     PortGroup* pg = mPortGroups.takeAt(mPortGroups.indexOf(&portGroup));
     qDebug("after takeAt()");
     mPortGroupListModel.portGroupRemoved();
+    if (portCount)
+        mPortStatsModel.when_portsRemoved(pg->id());
+    else
+        mPortStatsModel.when_portGroupListChanged();
 
     delete pg;
-
-    mPortStatsModel.when_portListChanged();
 }
 
 void PortGroupList::removeAllPortGroups()
@@ -145,9 +190,70 @@ void PortGroupList::removeAllPortGroups()
     mPortStatsModel.when_portListChanged();
 }
 
+//! Sets the interval at which the stats are fetched and shown
+void PortGroupList::setStatsInterval(int msecs)
+{
+    if (msecs <= 0)
+        return;
+
+    statsInterval_ = msecs;
+    updateStatsTimer();
+}
+
+/*!
+  Called by the stats views as they are shown or hidden - stats are
+  fetched less often while no one is looking at them
+*/
+void PortGroupList::setStatsVisible(bool visible)
+{
+    if (visible == isStatsVisible_)
+        return;
+
+    isStatsVisible_ = visible;
+    updateStatsTimer();
+
+    // Don't show stale stats till the next tick
+    if (visible)
+        updateStats();
+}
+
+void PortGroupList::when_portGroup_statsChanged(quint32 portGroupId)
+{
+    // Shown on the next tick alongwith the other portgroups' stats
+    statsChangedPortGroups_.insert(portGroupId);
+}
+
+/*!
+  Shows the stats received since the last tick - all portgroups together,
+  so that the views are repainted once per tick - and then polls the
+  portgroups whose drones don't push the stats
+*/
+void PortGroupList::updateStats()
+{
+    foreach (quint32 portGroupId, statsChangedPortGroups_)
+        mPortStatsModel.when_portGroup_stats_update(portGroupId);
+    statsChangedPortGroups_.clear();
+
+    for (int i = 0; i < mPortGroups.size(); i++)
+        mPortGroups[i]->getPortStats();
+}
+
 //....................
 // Private Methods
 //....................
+
+void PortGroupList::updateStatsTimer()
+{
+    int interval = isStatsVisible_ ?
+                    statsInterval_ : qMax(statsInterval_, kHiddenStatsInterval);
+
+    if (statsTimer_->isActive() && (statsTimer_->interval() == interval))
+        return;
+
+    statsTimer_->start(interval);
+    for (int i = 0; i < mPortGroups.size(); i++)
+        mPortGroups[i]->setStatsInterval(interval);
+}
 int PortGroupList::indexOfPortGroup(quint32 portGroupId)
 {
     for (int i = 0; i < mPortGroups.size(); i++) {
@@ -27,7 +27,10 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 #include "portstatsmodel.h"
 #include "streammodel.h"
 
+#include <QSet>
+
 class PortModel;
+class QTimer;
 class StreamModel;
 
 class PortGroupList : public QObject {
@@ -51,6 +54,15 @@ class PortGroupList : public QObject {
     QObject *deviceGroupModelTester_;
     QObject *deviceModelTester_;
 
+    // Stats of all portgroups are fetched and shown on a common tick
+    QTimer *statsTimer_;
+    int statsInterval_;     // msecs, when the stats are visible
+    bool isStatsVisible_;
+    QSet<quint32> statsChangedPortGroups_;
+
+    // Ports' link and transmit state is still shown when stats are not
+    static const int kHiddenStatsInterval = 10000; // msecs
+
 // Methods
 public:
     PortGroupList();
@@ -74,8 +86,17 @@ public:
     void removePortGroup(PortGroup &portGroup);
     void removeAllPortGroups();
 
+    int statsInterval() const { return statsInterval_; }
+    void setStatsInterval(int msecs);
+    void setStatsVisible(bool visible);
+
+private slots:
+    void when_portGroup_statsChanged(quint32 portGroupId);
+    void updateStats();
+
 private:
     int indexOfPortGroup(quint32 portGroupId);
+    void updateStatsTimer();
 
 };
 
@@ -35,6 +35,7 @@ PortModel::PortModel(PortGroupList *p, QObject *parent)
     : QAbstractItemModel(parent) 
 {
     pgl = p;
+    portsChange_ = kNoChange;
 
     portIconFactory[OstProto::LinkStateUnknown][false] = 
         QIcon(":/icons/bullet_white.png");
@@ -345,3 +346,47 @@ void PortModel::when_portListChanged()
 {
     reset();
 }
+
+void PortModel::when_portsAboutToBeAppended(quint32 portGroupId,
+        int first, int last)
+{
+    int row = pgl->indexOfPortGroup(portGroupId);
+
+    // A portgroup being removed (and so not in the list) may still signal
+    // its ports going away
+    if (row < 0)
+        return;
+
+    beginInsertRows(index(row, 0), first, last);
+    portsChange_ = kPortsInsert;
+}
+
+void PortModel::when_portsAppended(quint32 /*portGroupId*/)
+{
+    if (portsChange_ != kPortsInsert)
+        return;
+
+    portsChange_ = kNoChange;
+    endInsertRows();
+}
+
+void PortModel::when_portsAboutToBeRemoved(quint32 portGroupId,
+        int first, int last)
+{
+    int row = pgl->indexOfPortGroup(portGroupId);
+
+    if (row < 0)
+        return;
+
+    beginRemoveRows(index(row, 0), first, last);
+    portsChange_ = kPortsRemove;
+}
+
+void PortModel::when_portsRemoved(quint32 /*portGroupId*/)
+{
+    if (portsChange_ != kPortsRemove)
+        return;
+
+    portsChange_ = kNoChange;
+    endRemoveRows();
+}
@@ -56,6 +56,10 @@ private:
     static const int kExclusiveStatesCount = 2;
     QIcon portIconFactory[kLinkStatesCount][kExclusiveStatesCount];
 
+    // Ports being inserted/removed (between the begin and end signals) -
+    // none for a portgroup no longer in the list
+    enum { kNoChange, kPortsInsert, kPortsRemove } portsChange_;
+
 private slots:
     // FIXME: these are invoked from outside - how come they are "private"?
     void when_portGroupDataChanged(int portGroupId, int portId);
@@ -67,6 +71,11 @@ private slots:
 
     void when_portListChanged();
 
+    void when_portsAboutToBeAppended(quint32 portGroupId, int first, int last);
+    void when_portsAppended(quint32 portGroupId);
+    void when_portsAboutToBeRemoved(quint32 portGroupId, int first, int last);
+    void when_portsRemoved(quint32 portGroupId);
+
 #if 0
     void triggerLayoutAboutToBeChanged();
     void triggerLayoutChanged();
@@ -20,22 +20,15 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 #include "portstatsmodel.h"
 #include "portgrouplist.h"
 
-#include <QTimer>
-
 PortStatsModel::PortStatsModel(PortGroupList *p, QObject *parent)
     : QAbstractTableModel(parent) 
 {
     pgl = p;
-
-    timer = new QTimer();
-    connect(timer, SIGNAL(timeout()), this, SLOT(updateStats()));
-    timer->start(1000);
+    portsChange_ = kNoChange;
 }
 
 PortStatsModel::~PortStatsModel()
 {
-    timer->stop();
-    delete timer;
 }
 
 int PortStatsModel::rowCount(const QModelIndex &parent) const
@@ -112,9 +105,8 @@ QVariant PortStatsModel::data(const QModelIndex &index, int role) const
     // Check role
     if (role == Qt::DisplayRole)
     {
-        OstProto::PortStats    stats;
-
-        stats = pgl->mPortGroups.at(pgidx)->mPorts[pidx]->getStats();
+        const quint64 *stats = pgl->mPortGroups.at(pgidx)->mPorts[pidx]
+                                    ->statsSnapshot().value;
 
         switch(row)
         {
@@ -124,56 +116,37 @@ QVariant PortStatsModel::data(const QModelIndex &index, int role) const
 
             // States
             case e_LINK_STATE:
-                return LinkStateName.at(stats.state().link_state());
+                return LinkStateName.at(
+                        int(stats[PortStatsSnapshot::kLinkState]));
 
             case e_TRANSMIT_STATE:
-                return BoolStateName.at(stats.state().is_transmit_on());
+                return BoolStateName.at(
+                        int(stats[PortStatsSnapshot::kTransmitState]));
 
             case e_CAPTURE_STATE:
-                return BoolStateName.at(stats.state().is_capture_on());
+                return BoolStateName.at(
+                        int(stats[PortStatsSnapshot::kCaptureState]));
 
-            // Statistics
+            // Statistics - same order in the snapshot as the rows
             case e_STAT_FRAMES_RCVD:
-                return quint64(stats.rx_pkts());
-
             case e_STAT_FRAMES_SENT:
-                return quint64(stats.tx_pkts());
-
             case e_STAT_FRAME_SEND_RATE:
-                return quint64(stats.tx_pps());
-
             case e_STAT_FRAME_RECV_RATE:
-                return quint64(stats.rx_pps());
-
             case e_STAT_BYTES_RCVD:
-                return quint64(stats.rx_bytes());
-
             case e_STAT_BYTES_SENT:
-                return quint64(stats.tx_bytes());
-
             case e_STAT_BYTE_SEND_RATE:
-                return quint64(stats.tx_bps());
-
             case e_STAT_BYTE_RECV_RATE:
-                return quint64(stats.rx_bps());
-
-#if 0
-            case e_STAT_FRAMES_RCVD_NIC:
-                return stats.rx_pkts_nic();
 
-            case e_STAT_FRAMES_SENT_NIC:
-                return stats.tx_pkts_nic();
+            case e_STAT_RX_DROPS:
+            case e_STAT_RX_ERRORS:
+            case e_STAT_RX_FIFO_ERRORS:
+            case e_STAT_RX_FRAME_ERRORS:
 
-            case e_STAT_BYTES_RCVD_NIC:
-                return stats.rx_bytes_nic();
-
-            case e_STAT_BYTES_SENT_NIC:
-                return stats.tx_bytes_nic();
-#endif
-            case e_STAT_RX_DROPS : return quint64(stats.rx_drops());
-            case e_STAT_RX_ERRORS: return quint64(stats.rx_errors());
-            case e_STAT_RX_FIFO_ERRORS: return quint64(stats.rx_fifo_errors());
-            case e_STAT_RX_FRAME_ERRORS: return quint64(stats.rx_frame_errors());
+            case e_STAT_RX_STREAM_LOST:
+            case e_STAT_RX_STREAM_REORDERED:
+            case e_STAT_RX_STREAM_DUPLICATES:
+            case e_STAT_RX_STREAM_LATE:
+                return stats[row - e_STATE_START];
 
             default:
                 qWarning("%s: Unhandled stats id %d\n", __FUNCTION__,
@@ -285,6 +258,102 @@ void PortStatsModel::portListFromIndex(QModelIndexList indices,
 // Slots
 //
 void PortStatsModel::when_portListChanged()
+{
+    updateNumPorts();
+    reset();
+}
+
+void PortStatsModel::when_portGroupListChanged()
+{
+    updateNumPorts();
+}
+
+void PortStatsModel::when_portGroupDataChanged(int portGroupId, int portId)
+{
+    int column;
+
+    // The port names are the column headers
+    if ((portId == 0xFFFF) || (portsChange_ != kNoChange))
+        return;
+
+    column = firstColumn(portGroupId);
+    if (column < 0)
+        return;
+
+    column += portId;
+    if (column < columnCount())
+        emit headerDataChanged(Qt::Horizontal, column, column);
+}
+
+void PortStatsModel::when_portsAboutToBeAppended(quint32 portGroupId,
+        int first, int last)
+{
+    int column;
+
+    // A portgroup being removed (and so not in the list) may still signal
+    // its ports going away - its columns are gone already
+    if (pgl->indexOfPortGroup(portGroupId) < 0)
+        return;
+
+    column = firstColumn(portGroupId);
+    if ((column < 0) || !columnCount()) {
+        portsChange_ = kReset;
+        return;
+    }
+
+    beginInsertColumns(QModelIndex(), column + first, column + last);
+    portsChange_ = kPortsInsert;
+}
+
+void PortStatsModel::when_portsAppended(quint32 /*portGroupId*/)
+{
+    if (portsChange_ == kReset) {
+        portsChange_ = kNoChange;
+        when_portListChanged();
+        return;
+    }
+    if (portsChange_ != kPortsInsert)
+        return;
+
+    portsChange_ = kNoChange;
+    updateNumPorts();
+    endInsertColumns();
+}
+
+void PortStatsModel::when_portsAboutToBeRemoved(quint32 portGroupId,
+        int first, int last)
+{
+    int column;
+
+    if (pgl->indexOfPortGroup(portGroupId) < 0)
+        return;
+
+    column = firstColumn(portGroupId);
+    if ((column < 0) || ((last - first + 1) >= columnCount())) {
+        portsChange_ = kReset;
+        return;
+    }
+
+    beginRemoveColumns(QModelIndex(), column + first, column + last);
+    portsChange_ = kPortsRemove;
+}
+
+void PortStatsModel::when_portsRemoved(quint32 /*portGroupId*/)
+{
+    if (portsChange_ == kReset) {
+        portsChange_ = kNoChange;
+        when_portListChanged();
+        return;
+    }
+    if (portsChange_ != kPortsRemove)
+        return;
+
+    portsChange_ = kNoChange;
+    updateNumPorts();
+    endRemoveColumns();
+}
+
+void PortStatsModel::updateNumPorts()
 {
     int i, count = 0;
 
@@ -297,8 +366,20 @@ void PortStatsModel::when_portListChanged()
         count += pgl->mPortGroups.at(i)->numPorts();
         numPorts.append(count);
     }
+}
 
-    reset();
+/*!
+  Returns the column of the portgroup's first port as per numPorts (which
+  may not include the portgroup yet) or -1
+*/
+int PortStatsModel::firstColumn(quint32 portGroupId) const
+{
+    int i = pgl->indexOfPortGroup(portGroupId);
+
+    if ((i < 0) || (i >= numPorts.size()))
+        return -1;
+
+    return i ? numPorts.at(i - 1) : 0;
 }
 
 // FIXME: unused? if used, the index calculation row/column needs to be swapped
@@ -312,20 +393,42 @@ void PortStatsModel::on_portStatsUpdate(int port, void* /*stats*/)
 }
 #endif
 
-void PortStatsModel::updateStats()
+void PortStatsModel::when_portGroup_stats_update(quint32 portGroupId)
 {
-    // Request each portgroup to fetch updated stats - the port group
-    // raises a signal once updated stats are available
+    int column = 0;
+
+    // Only the changed stats of the portgroup's ports
     for (int i = 0; i < pgl->mPortGroups.size(); i++)
-        pgl->mPortGroups[i]->getPortStats();
-}
+    {
+        PortGroup *portGroup = pgl->mPortGroups.at(i);
 
-void PortStatsModel::when_portGroup_stats_update(quint32 /*portGroupId*/)
-{
-    // FIXME(MED): update only the changed ports, not all
+        if (portGroup->id() != portGroupId) {
+            column += portGroup->numPorts();
+            continue;
+        }
 
-    QModelIndex topLeft = index(0, 0, QModelIndex());
-    QModelIndex bottomRight = index(rowCount()-1, columnCount()-1, QModelIndex());
+        // numPorts may be stale if the port list has just changed
+        if ((i >= numPorts.size()) || (numPorts.at(i) != column
+                                        + portGroup->numPorts()))
+            return;
 
-    emit dataChanged(topLeft, bottomRight);
+        for (int j = 0; j < portGroup->numPorts(); j++, column++)
+        {
+            quint32 changed = portGroup->mPorts.at(j)->takeChangedStats();
+            int first, last;
+
+            if (!changed)
+                continue;
+
+            for (first = 0; !(changed & (1U << first)); first++)
+                ;
+            for (last = PortStatsSnapshot::kStatCount - 1;
+                    !(changed & (1U << last)); last--)
+                ;
+
+            emit dataChanged(index(e_STATE_START + first, column),
+                             index(e_STATE_START + last, column));
+        }
+        break;
+    }
 }
@@ -23,7 +23,6 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 #include <QAbstractTableModel>
 #include <QStringList>
 
-class QTimer;
 
 typedef enum {
     // Info
@@ -66,7 +65,13 @@ typedef enum {
     e_STAT_RX_FIFO_ERRORS,
     e_STAT_RX_FRAME_ERRORS,
 
-    e_STATISTICS_END = e_STAT_RX_FRAME_ERRORS,
+    // Tracked Streams Rx
+    e_STAT_RX_STREAM_LOST,
+    e_STAT_RX_STREAM_REORDERED,
+    e_STAT_RX_STREAM_DUPLICATES,
+    e_STAT_RX_STREAM_LATE,
+
+    e_STATISTICS_END = e_STAT_RX_STREAM_LATE,
 
     e_STAT_MAX
 } PortStat;
@@ -96,6 +101,11 @@ static QStringList PortStatName = (QStringList()
     << "Receive Errors"
     << "Receive Fifo Errors"
     << "Receive Frame Errors"
+
+    << "Stream Frames Lost"
+    << "Stream Frames Reordered"
+    << "Stream Frames Duplicated"
+    << "Stream Frames Late"
 );
 
 static QStringList LinkStateName = (QStringList()
@@ -136,12 +146,19 @@ class PortStatsModel : public QAbstractTableModel
 
     public slots:
         void when_portListChanged();
+        // A portgroup (without ports) is added or removed
+        void when_portGroupListChanged();
+        void when_portGroupDataChanged(int portGroupId, int portId);
+
+        void when_portsAboutToBeAppended(quint32 portGroupId,
+                int first, int last);
+        void when_portsAppended(quint32 portGroupId);
+        void when_portsAboutToBeRemoved(quint32 portGroupId,
+                int first, int last);
+        void when_portsRemoved(quint32 portGroupId);
         //void on_portStatsUpdate(int port, void*stats);
         void when_portGroup_stats_update(quint32 portGroupId);
 
-    private slots:
-        void updateStats();
-
     private:
         PortGroupList    *pgl;
 
@@ -150,7 +167,14 @@ class PortStatsModel : public QAbstractTableModel
         // Also it stores them as cumulative totals
         QList<quint16>    numPorts;
 
-        QTimer *timer;
+        // Ports (columns) being inserted/removed - a reset instead, if
+        // the rows come or go too (with the first port or the last)
+        enum {
+            kNoChange, kPortsInsert, kPortsRemove, kReset
+        } portsChange_;
+
+        void updateNumPorts();
+        int firstColumn(quint32 portGroupId) const;
 
         void getDomainIndexes(const QModelIndex &index,
               uint &portGroupIdx, uint &portIdx) const;
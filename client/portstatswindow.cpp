@@ -20,6 +20,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 
 #include "portstatswindow.h"
 
+#include "capturebrowser.h"
 #include "portstatsfilterdialog.h"
 #include "portstatsmodel.h"
 #include "portstatsproxymodel.h"
@@ -60,6 +61,21 @@ PortStatsWindow::~PortStatsWindow()
     delete proxyStatsModel;
 }
 
+/* ------------- Events (protected) -------------- */
+
+void PortStatsWindow::showEvent(QShowEvent *event)
+{
+    pgl->setStatsVisible(true);
+    QWidget::showEvent(event);
+}
+
+// Also when minimized or tabbed behind another dock
+void PortStatsWindow::hideEvent(QHideEvent *event)
+{
+    pgl->setStatsVisible(false);
+    QWidget::hideEvent(event);
+}
+
 /* ------------- SLOTS (public) -------------- */
 
 void PortStatsWindow::showMyReservedPortsOnly(bool enabled)
@@ -171,17 +187,22 @@ void PortStatsWindow::on_tbStopCapture_clicked()
 
 void PortStatsWindow::on_tbViewCapture_clicked()
 {
-    // TODO(MED)
     QList<PortStatsModel::PortGroupAndPortList>    pgpl;
 
     // Get selected ports
     model->portListFromIndex(selectedColumns, pgpl);
 
-    // Clear selected ports, portgroup by portgroup
+    // Browse each selected port's capture in its own window
     for (int i = 0; i < pgpl.size(); i++)
     {
-        pgl->portGroupByIndex(pgpl.at(i).portGroupId).
-            viewCapture(&pgpl[i].portList);
+        PortGroup &pg = pgl->portGroupByIndex(pgpl.at(i).portGroupId);
+
+        for (int j = 0; j < pgpl.at(i).portList.size(); j++)
+        {
+            CaptureBrowser *browser = new CaptureBrowser(&pg,
+                    pgpl.at(i).portList.at(j), this);
+            browser->show();
+        }
     }
 }
 
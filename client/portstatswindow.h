@@ -39,6 +39,10 @@ public:
 public slots:
     void showMyReservedPortsOnly(bool enabled);
 
+protected:
+    void showEvent(QShowEvent *event);
+    void hideEvent(QHideEvent *event);
+
 private slots:
     void when_tvPortStats_selectionChanged(const QItemSelection &selected,
                                            const QItemSelection &deselected);
@@ -73,6 +73,8 @@ PortsWindow::PortsWindow(PortGroupList *pgl, QWidget *parent)
     tvStreamList->addAction(actionEdit_Stream);
     tvStreamList->addAction(actionDuplicate_Stream);
     tvStreamList->addAction(actionDelete_Stream);
+    tvStreamList->addAction(actionEnable_Streams);
+    tvStreamList->addAction(actionDisable_Streams);
 
     sep = new QAction(this);
     sep->setSeparator(true);
@@ -189,9 +191,9 @@ int PortsWindow::reservedPortCount()
     return count;
 }
 
-//! Always return true
+//! Always return true; the port groups are moved out of session
 bool PortsWindow::openSession(
-        const OstProto::SessionContent *session,
+        OstProto::SessionContent *session,
         QString & /*error*/)
 {
     QProgressDialog progress("Opening Session", NULL,
@@ -202,11 +204,11 @@ bool PortsWindow::openSession(
     plm->removeAllPortGroups();
 
     for (int i = 0; i < session->port_groups_size(); i++) {
-        const OstProto::PortGroupContent &pgc = session->port_groups(i);
+        OstProto::PortGroupContent *pgc = session->mutable_port_groups(i);
         PortGroup *pg = new PortGroup(QString::fromStdString(
-                                                    pgc.server_name()),
-                                      quint16(pgc.server_port()));
-        pg->setConfigAtConnect(&pgc);
+                                                    pgc->server_name()),
+                                      quint16(pgc->server_port()));
+        pg->setConfigAtConnect(pgc);
         plm->addPortGroup(*pg);
         progress.setValue(i+1);
     }
@@ -219,7 +221,8 @@ bool PortsWindow::openSession(
  *
  * If port reservation is in use, saves only 'my' reserved ports
  *
- * Returns false, if user cancels op; true, otherwise
+ * Returns false, if user cancels op (checked after every port); true,
+ * otherwise
  */
 bool PortsWindow::saveSession(
         OstProto::SessionContent *session, // OUT param
@@ -227,11 +230,15 @@ bool PortsWindow::saveSession(
         QProgressDialog *progress)
 {
     int n = portGroupCount();
+    int portCount = 0, done = 0;
     QString myself;
 
+    for (int i = 0; i < n; i++)
+        portCount += plm->portGroupByIndex(i).numPorts();
+
     if (progress) {
         progress->setLabelText("Preparing Ports and PortGroups ...");
-        progress->setRange(0, n);
+        progress->setRange(0, portCount);
     }
 
     if (reservedPortCount())
@@ -245,39 +252,41 @@ bool PortsWindow::saveSession(
         pgc->set_server_name(pg.serverName().toStdString());
         pgc->set_server_port(pg.serverPort());
 
-        for (int j = 0; j < pg.numPorts(); j++)
+        for (int j = 0; j < pg.numPorts(); j++, done++)
         {
             if (myself != pg.mPorts.at(j)->userName())
                 continue;
 
+            Port *port = pg.mPorts.at(j);
             OstProto::PortContent *pc = pgc->add_ports();
             OstProto::Port *p = pc->mutable_port_config();
 
             // XXX: We save the entire OstProto::Port even though some
             // fields may be ephemeral; while opening we use only relevant
             // fields
-            pg.mPorts.at(j)->protoDataCopyInto(p);
+            port->protoDataCopyInto(p);
 
-            for (int k = 0; k < pg.mPorts.at(j)->numStreams(); k++)
+            pc->mutable_streams()->Reserve(port->numStreams());
+            for (int k = 0; k < port->numStreams(); k++)
             {
                 OstProto::Stream *s = pc->add_streams();
-                pg.mPorts.at(j)->streamByIndex(k)->protoDataCopyInto(*s);
+                port->streamByIndex(k)->protoDataCopyInto(*s);
             }
 
-            for (int k = 0; k < pg.mPorts.at(j)->numDeviceGroups(); k++)
+            pc->mutable_device_groups()->Reserve(port->numDeviceGroups());
+            for (int k = 0; k < port->numDeviceGroups(); k++)
             {
                 OstProto::DeviceGroup *dg = pc->add_device_groups();
-                dg->CopyFrom(*(pg.mPorts.at(j)->deviceGroupByIndex(k)));
+                dg->CopyFrom(*(port->deviceGroupByIndex(k)));
             }
-        }
 
-        if (progress) {
-            if (progress->wasCanceled())
-                return false;
-            progress->setValue(i);
-        }
-        if (i % 2 == 0)
+            if (progress) {
+                if (progress->wasCanceled())
+                    return false;
+                progress->setValue(done);
+            }
             qApp->processEvents();
+        }
     }
 
     return true;
@@ -472,6 +481,22 @@ void PortsWindow::updatePortRates()
             .arg(plm->port(current).averagePacketRate(), 0, 'f', 4));
     averageBitsPerSec->setText(QString("%L1")
             .arg(plm->port(current).averageBitRate(), 0, 'f', 0));
+
+    // Available only once the changes are applied
+    if (plm->port(current).hasTransmitEstimate()) {
+        const OstProto::TransmitEstimate &estimate =
+                plm->port(current).transmitEstimate();
+        QString duration = estimate.has_duration_nsec() ?
+            QString("%L1 pkts in %L2 s").arg(estimate.packet_count())
+                .arg(estimate.duration_nsec()/1e9, 0, 'f', 3) :
+            QString("Continuous");
+
+        transmitEstimate->setText(QString("%1, packet list %L2 KB")
+                .arg(duration)
+                .arg((estimate.packet_list_bytes() + 1023)/1024));
+    }
+    else
+        transmitEstimate->clear();
 }
 
 void PortsWindow::updateStreamViewActions()
@@ -505,6 +530,8 @@ void PortsWindow::updateStreamViewActions()
         // Duplicate/Delete are always enabled as long as we have a selection
         actionDuplicate_Stream->setEnabled(true);
         actionDelete_Stream->setEnabled(true);
+        actionEnable_Streams->setEnabled(true);
+        actionDisable_Streams->setEnabled(true);
     }
     else
     {
@@ -516,6 +543,8 @@ void PortsWindow::updateStreamViewActions()
         actionEdit_Stream->setDisabled(true);
         actionDuplicate_Stream->setDisabled(true);
         actionDelete_Stream->setDisabled(true);
+        actionEnable_Streams->setDisabled(true);
+        actionDisable_Streams->setDisabled(true);
     }
     actionOpen_Streams->setEnabled(plm->isPort(current));
     actionSave_Streams->setEnabled(tvStreamList->model()->rowCount() > 0);
@@ -858,22 +887,39 @@ void PortsWindow::on_actionDelete_Stream_triggered()
 {
     qDebug("Delete Stream Action");
 
-    QModelIndex        index;
-
     if (tvStreamList->selectionModel()->hasSelection())
     {
-        qDebug("SelectedIndexes %d",
-            tvStreamList->selectionModel()->selectedRows().size());
-        while(tvStreamList->selectionModel()->selectedRows().size())
-        {
-            index = tvStreamList->selectionModel()->selectedRows().at(0);
-            plm->getStreamModel()->removeRows(index.row(), 1);    
-        }
+        QModelIndexList indices =
+                tvStreamList->selectionModel()->selectedRows();
+        QList<int> rows;
+
+        foreach(QModelIndex index, indices)
+            rows.append(index.row());
+        qDebug("SelectedIndexes %d", rows.size());
+        plm->getStreamModel()->removeStreams(rows);
     }
     else
         qDebug("No selection");
 }
 
+void PortsWindow::on_actionEnable_Streams_triggered()
+{
+    QList<int> rows;
+
+    foreach(QModelIndex index, tvStreamList->selectionModel()->selectedRows())
+        rows.append(index.row());
+    plm->getStreamModel()->setStreamsEnabled(rows, true);
+}
+
+void PortsWindow::on_actionDisable_Streams_triggered()
+{
+    QList<int> rows;
+
+    foreach(QModelIndex index, tvStreamList->selectionModel()->selectedRows())
+        rows.append(index.row());
+    plm->getStreamModel()->setStreamsEnabled(rows, false);
+}
+
 void PortsWindow::on_actionOpen_Streams_triggered()
 {
     qDebug("Open Streams Action");
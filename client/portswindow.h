@@ -47,7 +47,7 @@ public:
     int portGroupCount();
     int reservedPortCount();
 
-    bool openSession(const OstProto::SessionContent *session,
+    bool openSession(OstProto::SessionContent *session,
                      QString &error);
     bool saveSession(OstProto::SessionContent *session,
                      QString &error,
@@ -94,6 +94,8 @@ private slots:
     void on_actionEdit_Stream_triggered();
     void on_actionDuplicate_Stream_triggered();
     void on_actionDelete_Stream_triggered();
+    void on_actionEnable_Streams_triggered();
+    void on_actionDisable_Streams_triggered();
 
     void on_actionOpen_Streams_triggered();
     void on_actionSave_Streams_triggered();
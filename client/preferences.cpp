@@ -49,6 +49,8 @@ Preferences::Preferences()
             kDiffPathDefaultValue).toString());
     awkPathEdit->setText(appSettings->value(kAwkPathKey, 
             kAwkPathDefaultValue).toString());
+    statsIntervalSpinBox->setValue(appSettings->value(kStatsIntervalKey,
+            kStatsIntervalDefaultValue).toInt());
 
     // TODO(only if required): kUserKey
 }
@@ -82,6 +84,7 @@ void Preferences::accept()
     appSettings->setValue(kGzipPathKey, gzipPathEdit->text());
     appSettings->setValue(kDiffPathKey, diffPathEdit->text());
     appSettings->setValue(kAwkPathKey, awkPathEdit->text());
+    appSettings->setValue(kStatsIntervalKey, statsIntervalSpinBox->value());
 
     OstProtoLib::setExternalApplicationPaths(
         appSettings->value(kTsharkPathKey, kTsharkPathDefaultValue).toString(),
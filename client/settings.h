@@ -77,6 +77,9 @@ const QString kAwkPathDefaultValue("/usr/bin/awk");
 const QString kUserKey("User");
 extern QString kUserDefaultValue;
 
+const QString kStatsIntervalKey("StatsInterval"); // msecs
+const int kStatsIntervalDefaultValue = 1000;
+
 //
 // LastUse Section Keys
 //
@@ -0,0 +1,186 @@
+/*
+Copyright (C) 2010 Srivats P.
+
+This file is part of "Ostinato"
+
+This is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+#include "statshistory.h"
+
+#include <QDateTime>
+#include <QTextStream>
+#include <string.h>
+
+// Same as the PortStats field names
+static const char* kStatName[PortStatsSnapshot::kStatCount] = {
+    "link_state",
+    "is_transmit_on",
+    "is_capture_on",
+
+    "rx_pkts",
+    "tx_pkts",
+    "tx_pps",
+    "rx_pps",
+    "rx_bytes",
+    "tx_bytes",
+    "tx_bps",
+    "rx_bps",
+
+    "rx_drops",
+    "rx_errors",
+    "rx_fifo_errors",
+    "rx_frame_errors",
+
+    "rx_stream_lost",
+    "rx_stream_reordered",
+    "rx_stream_duplicates",
+    "rx_stream_late",
+};
+
+// Interval and number of samples kept for each resolution - about 1.1MB
+// per port when all are full
+static const struct {
+    qint64 intervalMsecs;
+    int capacity;
+} kLevel[StatsHistory::kResolutionCount] = {
+    { 1000, 600 },      // 10 mins
+    { 10000, 2160 },    // 6 hours
+    { 60000, 4320 },    // 3 days
+};
+
+const char* PortStatsSnapshot::name(int stat)
+{
+    Q_ASSERT(stat < kStatCount);
+    return kStatName[stat];
+}
+
+bool PortStatsSnapshot::isRate(int stat)
+{
+    return (stat == kTxPps) || (stat == kRxPps)
+        || (stat == kTxBps) || (stat == kRxBps);
+}
+
+StatsHistory::StatsHistory()
+{
+    for (int i = 0; i < kResolutionCount; i++) {
+        levels_[i].intervalMsecs = kLevel[i].intervalMsecs;
+        levels_[i].capacity = kLevel[i].capacity;
+    }
+    clear();
+}
+
+void StatsHistory::clear()
+{
+    for (int i = 0; i < kResolutionCount; i++) {
+        levels_[i].ring.clear();
+        levels_[i].next = 0;
+        levels_[i].hasPending = false;
+        levels_[i].pendingCount = 0;
+    }
+}
+
+/*!
+  Adds the stats as of msecs (since the epoch) - multiple updates within
+  the same second are merged into one 1 sec sample
+*/
+void StatsHistory::append(qint64 msecs, const PortStatsSnapshot &stats)
+{
+    Sample sample;
+
+    sample.msecs = msecs;
+    sample.stats = stats;
+    add(k1Sec, sample);
+}
+
+int StatsHistory::count(Resolution resolution) const
+{
+    return levels_[resolution].ring.size();
+}
+
+//! Returns the index'th sample - index 0 is the oldest
+const StatsHistory::Sample& StatsHistory::sample(Resolution resolution,
+        int index) const
+{
+    const Level &level = levels_[resolution];
+
+    Q_ASSERT(index < level.ring.size());
+    if (level.ring.size() < level.capacity)
+        return level.ring.at(index);
+    return level.ring.at((level.next + index) % level.capacity);
+}
+
+//! Writes the samples, oldest first, as CSV with a header row
+void StatsHistory::writeCsv(QTextStream &out, Resolution resolution) const
+{
+    out << "time";
+    for (int i = 0; i < PortStatsSnapshot::kStatCount; i++)
+        out << "," << PortStatsSnapshot::name(i);
+    out << "\n";
+
+    for (int i = 0; i < count(resolution); i++) {
+        const Sample &s = sample(resolution, i);
+
+        out << QDateTime::fromMSecsSinceEpoch(s.msecs).toString(Qt::ISODate);
+        for (int j = 0; j < PortStatsSnapshot::kStatCount; j++)
+            out << "," << s.stats.value[j];
+        out << "\n";
+    }
+}
+
+void StatsHistory::add(int level, const Sample &sample)
+{
+    Level &l = levels_[level];
+    qint64 interval = sample.msecs / l.intervalMsecs;
+
+    if (l.hasPending && (interval != l.pendingInterval))
+        complete(level);
+
+    if (!l.hasPending) {
+        l.hasPending = true;
+        l.pendingInterval = interval;
+        l.pendingCount = 0;
+        memset(l.rateSum, 0, sizeof(l.rateSum));
+    }
+
+    l.pending = sample;
+    for (int i = 0; i < PortStatsSnapshot::kStatCount; i++) {
+        if (PortStatsSnapshot::isRate(i))
+            l.rateSum[i] += sample.stats.value[i];
+    }
+    l.pendingCount++;
+}
+
+//! Moves the pending sample of level into its ring and to the next level
+void StatsHistory::complete(int level)
+{
+    Level &l = levels_[level];
+    Sample &s = l.pending;
+
+    for (int i = 0; i < PortStatsSnapshot::kStatCount; i++) {
+        if (PortStatsSnapshot::isRate(i))
+            s.stats.value[i] = l.rateSum[i] / l.pendingCount;
+    }
+
+    if (l.ring.size() < l.capacity)
+        l.ring.append(s);
+    else {
+        l.ring[l.next] = s;
+        l.next = (l.next + 1) % l.capacity;
+    }
+    l.hasPending = false;
+
+    if ((level + 1) < kResolutionCount)
+        add(level + 1, s);
+}
@@ -0,0 +1,127 @@
+/*
+Copyright (C) 2010 Srivats P.
+
+This file is part of "Ostinato"
+
+This is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+#ifndef _STATS_HISTORY_H
+#define _STATS_HISTORY_H
+
+#include <QVector>
+#include <QtGlobal>
+
+class QTextStream;
+
+/*!
+  Plain copy of the displayed port stats, kept up to date by
+  Port::updateStats() - so that a stats view can read them without
+  copying the PortStats protobuf
+
+  The stats are in the same order as the state and statistics rows of
+  PortStatsModel
+*/
+struct PortStatsSnapshot
+{
+    enum Stat {
+        kLinkState,
+        kTransmitState,
+        kCaptureState,
+
+        kRxPkts,
+        kTxPkts,
+        kTxPps,
+        kRxPps,
+        kRxBytes,
+        kTxBytes,
+        kTxBps,
+        kRxBps,
+
+        kRxDrops,
+        kRxErrors,
+        kRxFifoErrors,
+        kRxFrameErrors,
+
+        kRxStreamLost,
+        kRxStreamReordered,
+        kRxStreamDuplicates,
+        kRxStreamLate,
+
+        kStatCount
+    };
+
+    quint64 value[kStatCount];
+
+    static const char* name(int stat);
+    static bool isRate(int stat);
+};
+
+/*!
+  History of a port's stats at 1 sec, 10 sec and 1 min resolutions, each
+  kept in a fixed size ring - so memory use is bounded irrespective of
+  how long the stats are collected
+
+  Each sample has the values at the end of its interval, except for the
+  rates which are averaged over the interval; only completed intervals
+  are available - the one in progress is not
+*/
+class StatsHistory
+{
+public:
+    enum Resolution {
+        k1Sec,
+        k10Sec,
+        k1Min,
+
+        kResolutionCount
+    };
+
+    struct Sample {
+        qint64 msecs;   // since the epoch, of the last update in interval
+        PortStatsSnapshot stats;
+    };
+
+    StatsHistory();
+
+    void clear();
+    void append(qint64 msecs, const PortStatsSnapshot &stats);
+
+    int count(Resolution resolution) const;
+    const Sample& sample(Resolution resolution, int index) const;
+
+    void writeCsv(QTextStream &out, Resolution resolution) const;
+
+private:
+    // Completed samples in a ring and the interval being accumulated
+    struct Level {
+        qint64 intervalMsecs;
+        int capacity;
+        QVector<Sample> ring;
+        int next;           // where the next sample goes once ring is full
+
+        bool hasPending;
+        qint64 pendingInterval;
+        Sample pending;
+        quint64 rateSum[PortStatsSnapshot::kStatCount];
+        int pendingCount;
+    };
+
+    void add(int level, const Sample &sample);
+    void complete(int level);
+
+    Level levels_[kResolutionCount];
+};
+
+#endif
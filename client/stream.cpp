@@ -50,6 +50,247 @@ void Stream::storeProtocolWidgets()
     return;
 }
 
+//! Creates a new (materialized) stream with the default config
+LazyStream::LazyStream()
+    : stream_(new Stream), isDataStale_(false)
+{
+    OstProto::Stream stream;
+
+    stream_->protoDataCopyInto(stream);
+    updateSummary(stream);
+}
+
+//! Creates an unmaterialized stream with the given config
+LazyStream::LazyStream(const OstProto::Stream &stream)
+    : stream_(NULL)
+{
+    protoDataCopyFrom(stream);
+}
+
+LazyStream::~LazyStream()
+{
+    delete stream_;
+}
+
+void LazyStream::protoDataCopyFrom(const OstProto::Stream &stream)
+{
+    if (stream_) {
+        stream_->protoDataCopyFrom(stream);
+        return;
+    }
+
+    data_.resize(stream.ByteSize());
+    stream.SerializePartialToArray(data_.data(), data_.size());
+    isDataStale_ = false;
+    updateSummary(stream);
+}
+
+void LazyStream::protoDataCopyInto(OstProto::Stream &stream) const
+{
+    if (stream_) {
+        stream_->protoDataCopyInto(stream);
+        return;
+    }
+
+    stream.ParsePartialFromArray(data_.constData(), data_.size());
+    stream.mutable_stream_id()->set_id(id_);
+    stream.mutable_core()->set_ordinal(ordinal_);
+}
+
+/*!
+  Returns the serialized config - without parsing it, if the stream is not
+  materialized
+*/
+QByteArray LazyStream::protoData() const
+{
+    OstProto::Stream stream;
+    QByteArray data;
+
+    if (!stream_ && !isDataStale_)
+        return data_;
+
+    protoDataCopyInto(stream);
+    data.resize(stream.ByteSize());
+    stream.SerializePartialToArray(data.data(), data.size());
+
+    if (!stream_) {
+        data_ = data;
+        isDataStale_ = false;
+    }
+
+    return data;
+}
+
+/*!
+  Returns the full Stream, materializing it if required - the stream
+  remains materialized thereafter
+*/
+Stream* LazyStream::stream()
+{
+    if (!stream_) {
+        OstProto::Stream stream;
+
+        protoDataCopyInto(stream);
+        stream_ = new Stream;
+        stream_->protoDataCopyFrom(stream);
+        data_.clear();
+    }
+
+    return stream_;
+}
+
+quint32 LazyStream::id() const
+{
+    return stream_ ? stream_->id() : id_;
+}
+
+void LazyStream::setId(quint32 id)
+{
+    if (stream_)
+        stream_->setId(id);
+    else if (id != id_) {
+        id_ = id;
+        isDataStale_ = true;
+    }
+}
+
+quint32 LazyStream::ordinal() const
+{
+    return stream_ ? stream_->ordinal() : ordinal_;
+}
+
+void LazyStream::setOrdinal(quint32 ordinal)
+{
+    if (stream_)
+        stream_->setOrdinal(ordinal);
+    else if (ordinal != ordinal_) {
+        ordinal_ = ordinal;
+        isDataStale_ = true;
+    }
+}
+
+QString LazyStream::name() const
+{
+    return stream_ ? stream_->name() : name_;
+}
+
+bool LazyStream::isEnabled() const
+{
+    return stream_ ? stream_->isEnabled() : isEnabled_;
+}
+
+void LazyStream::setEnabled(bool enabled)
+{
+    OstProto::Stream stream;
+
+    if (stream_) {
+        stream_->setEnabled(enabled);
+        return;
+    }
+
+    if (enabled == isEnabled_)
+        return;
+
+    protoDataCopyInto(stream);
+    stream.mutable_core()->set_is_enabled(enabled);
+    protoDataCopyFrom(stream);
+}
+
+StreamBase::NextWhat LazyStream::nextWhat() const
+{
+    return stream_ ? stream_->nextWhat() : nextWhat_;
+}
+
+quint16 LazyStream::frameLenAvg() const
+{
+    return stream_ ? stream_->frameLenAvg() : frameLenAvg_;
+}
+
+double LazyStream::averagePacketRate() const
+{
+    return stream_ ? stream_->averagePacketRate() : averagePacketRate_;
+}
+
+void LazyStream::setAveragePacketRate(double packetsPerSec)
+{
+    OstProto::Stream stream;
+    OstProto::StreamControl *control;
+
+    if (stream_) {
+        stream_->setAveragePacketRate(packetsPerSec);
+        return;
+    }
+
+    // Same as StreamBase::setAveragePacketRate()
+    protoDataCopyInto(stream);
+    control = stream.mutable_control();
+    switch (control->unit())
+    {
+    case OstProto::StreamControl::e_su_bursts:
+        control->set_bursts_per_sec(
+                packetsPerSec/double(control->packets_per_burst()));
+        break;
+    case OstProto::StreamControl::e_su_packets:
+        control->set_packets_per_sec(packetsPerSec);
+        break;
+    default:
+        Q_ASSERT(false); // Unreachable!!
+    }
+    protoDataCopyFrom(stream);
+}
+
+bool LazyStream::ordinalLessThan(const LazyStream *stream1,
+                                 const LazyStream *stream2)
+{
+    return stream1->ordinal() < stream2->ordinal();
+}
+
+// Values as computed by the corresponding StreamBase methods
+void LazyStream::updateSummary(const OstProto::Stream &stream)
+{
+    const OstProto::StreamCore &core = stream.core();
+    const OstProto::StreamControl &control = stream.control();
+
+    id_ = stream.stream_id().id();
+    ordinal_ = core.ordinal();
+    name_ = QString::fromStdString(core.name());
+    isEnabled_ = core.is_enabled();
+    nextWhat_ = StreamBase::NextWhat(control.next());
+
+    switch (core.len_mode())
+    {
+    case OstProto::StreamCore::e_fl_fixed:
+        frameLenAvg_ = core.frame_len();
+        break;
+    case OstProto::StreamCore::e_fl_imix:
+    case OstProto::StreamCore::e_fl_weighted: {
+        QVector<quint16> table = StreamBase::frameLenTable(core);
+        quint64 sum = 0;
+
+        for (int i = 0; i < table.size(); i++)
+            sum += table.at(i);
+        frameLenAvg_ = table.isEmpty() ? core.frame_len() : sum/table.size();
+        break;
+    }
+    default:
+        frameLenAvg_ = (core.frame_len_min() + core.frame_len_max())/2;
+        break;
+    }
+
+    switch (control.unit())
+    {
+    case OstProto::StreamControl::e_su_bursts:
+        averagePacketRate_ = control.bursts_per_sec()
+                                * control.packets_per_burst();
+        break;
+    case OstProto::StreamControl::e_su_packets:
+        averagePacketRate_ = control.packets_per_sec();
+        break;
+    default:
+        Q_ASSERT(false); // Unreachable!!
+    }
+}
+
 quint64 getDeviceMacAddress(
         int /*portId*/,
         int /*streamId*/,
@@ -21,6 +21,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 #define _STREAM_H
 
 #include <QtGlobal>
+#include <QByteArray>
 #include <QString>
 #include <QList>
 
@@ -39,4 +40,61 @@ public:
     void storeProtocolWidgets();
 };
 
+/*!
+  A stream in a port's stream list
+
+  The stream config is kept serialized along with the few fields needed to
+  list the stream and to compute the port rates; the full Stream, with its
+  protocol objects, is created only when it is needed for editing - see
+  stream(). So a port can have tens of thousands of streams without each
+  of them being parsed
+*/
+class LazyStream {
+public:
+    LazyStream();
+    LazyStream(const OstProto::Stream &stream);
+    ~LazyStream();
+
+    void protoDataCopyFrom(const OstProto::Stream &stream);
+    void protoDataCopyInto(OstProto::Stream &stream) const;
+    QByteArray protoData() const;
+
+    bool isMaterialized() const { return stream_ != NULL; }
+    Stream* stream();
+
+    quint32 id() const;
+    void setId(quint32 id);
+    quint32 ordinal() const;
+    void setOrdinal(quint32 ordinal);
+
+    QString name() const;
+    bool isEnabled() const;
+    void setEnabled(bool enabled);
+    StreamBase::NextWhat nextWhat() const;
+    quint16 frameLenAvg() const;
+
+    double averagePacketRate() const;
+    void setAveragePacketRate(double packetsPerSec);
+
+    static bool ordinalLessThan(const LazyStream *stream1,
+                                const LazyStream *stream2);
+
+private:
+    void updateSummary(const OstProto::Stream &stream);
+
+    Stream *stream_;        // NULL until materialized
+    // Serialized config, if not materialized - reserialized by protoData()
+    // if the id or ordinal has changed since
+    mutable QByteArray data_;
+    mutable bool isDataStale_;
+
+    quint32 id_;
+    quint32 ordinal_;
+    QString name_;
+    bool isEnabled_;
+    StreamBase::NextWhat nextWhat_;
+    quint16 frameLenAvg_;
+    double averagePacketRate_;
+};
+
 #endif
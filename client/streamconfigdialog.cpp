@@ -17,7 +17,11 @@ You should have received a copy of the GNU General Public License
 along with this program.  If not, see <http://www.gnu.org/licenses/>
 */
 
+#include <QApplication>
+#include <QEventLoop>
+#include <QFutureWatcher>
 #include <QHostAddress>
+#include <QtConcurrentRun>
 
 #include "streamconfigdialog.h"
 #include "stream.h"
@@ -39,6 +43,14 @@ int StreamConfigDialog::lastProtocolDataIndex = 0;
 
 static const uint kEthFrameOverHead = 20;
 
+static QStringList preflightCheck(const StreamBase *stream)
+{
+    QStringList log;
+
+    stream->preflightCheck(log);
+    return log;
+}
+
 StreamConfigDialog::StreamConfigDialog(
         QList<Stream*> &streamList,
         const Port &port,
@@ -326,9 +338,7 @@ StreamConfigDialog::~StreamConfigDialog()
     for (int i = ProtoMin; i < ProtoMax; i++)
         delete bgProto[i];
 
-    foreach (AbstractProtocolConfigForm* w, _protocolWidgets) {
-        OstProtocolWidgetFactory->deleteConfigWidget(w);
-    }
+    releaseProtocolWidgets();
 
     delete _iter;
     while (!_streamList.isEmpty())
@@ -345,22 +355,19 @@ void StreamConfigDialog::loadProtocolWidgets()
 {
     ProtocolListIterator    *iter;
 
-    // NOTE: Protocol Widgets are created on demand. Once created we
-    //       store them in _protocolWidgets indexed by the protocol
-    //       object's address (to ensure unique widgets for multiple
-    //       objects of the same class). Subsequently we check
-    //       _protocolWidgets before creating a new widget
+    // NOTE: Protocol Widgets are created on demand - only when the
+    //       Protocol Data tab is shown (see on_twTopLevel_currentChanged()).
+    //       Once created we store them in _protocolWidgets indexed by the
+    //       protocol object's address (to ensure unique widgets for
+    //       multiple objects of the same class). A protocol without a
+    //       widget yet has nothing to load
     iter = mpStream->createProtocolListIterator();
     while (iter->hasNext())
     {
         AbstractProtocol* p = iter->next();
         AbstractProtocolConfigForm *w = _protocolWidgets.value(p);
-        if (!w) {
-            w = OstProtocolWidgetFactory->createConfigWidget(
-                    p->protocolNumber());
-            _protocolWidgets.insert(p, w);
-        }
-        w->loadWidget(p);
+        if (w)
+            w->loadWidget(p);
     }
     delete iter;
 }
@@ -369,24 +376,44 @@ void StreamConfigDialog::storeProtocolWidgets()
 {
     ProtocolListIterator    *iter;
 
-    // NOTE: After creating a widget, we need to call loadWidget()
-    //       to load the protocol's default values
+    // NOTE: A protocol without a widget (never shown) can't have been
+    //       edited - so there's nothing to store
     iter = mpStream->createProtocolListIterator();
     while (iter->hasNext())
     {
         AbstractProtocol* p = iter->next();
         AbstractProtocolConfigForm *w = _protocolWidgets.value(p);
-        if (!w) {
-            w = OstProtocolWidgetFactory->createConfigWidget(
-                    p->protocolNumber());
-            w->loadWidget(p);
-            _protocolWidgets.insert(p, w);
-        }
-        w->storeWidget(p);
+        if (w)
+            w->storeWidget(p);
     }
     delete iter;
 }
 
+/*!
+  Gives back the widget (if any) of protocol to the widget factory for
+  reuse - by this or a later dialog
+*/
+void StreamConfigDialog::releaseProtocolWidget(AbstractProtocol *protocol)
+{
+    AbstractProtocolConfigForm *w = _protocolWidgets.take(protocol);
+    int index;
+
+    if (!w)
+        return;
+
+    index = tbProtocolData->indexOf(w);
+    if (index >= 0)
+        tbProtocolData->removeItem(index);
+
+    OstProtocolWidgetFactory->deleteConfigWidget(w);
+}
+
+void StreamConfigDialog::releaseProtocolWidgets()
+{
+    foreach (AbstractProtocol *p, _protocolWidgets.keys())
+        releaseProtocolWidget(p);
+}
+
 void StreamConfigDialog::on_cmbPktLenMode_currentIndexChanged(QString mode)
 {
     if (mode == "Fixed")
@@ -413,6 +440,13 @@ void StreamConfigDialog::on_cmbPktLenMode_currentIndexChanged(QString mode)
         lePktLenMin->setEnabled(true);
         lePktLenMax->setEnabled(true);
     }
+    else if ((mode == "IMIX") || (mode == "Weighted"))
+    {
+        // Weighted lengths are set via the API (frame_len_weight)
+        lePktLen->setDisabled(true);
+        lePktLenMin->setDisabled(true);
+        lePktLenMax->setDisabled(true);
+    }
     else
     {
         qWarning("Unhandled/Unknown PktLenMode = %s", mode.toAscii().data());
@@ -515,7 +549,7 @@ void StreamConfigDialog::on_tbDelete_clicked()
     Q_CHECK_PTR(p);
     _iter->remove();
     // Free both protocol and associated widget
-    delete _protocolWidgets.take(p);
+    releaseProtocolWidget(p);
     delete p;
 
     updateSelectProtocolsAdvancedWidget();
@@ -847,7 +881,7 @@ void StreamConfigDialog::__updateProtocol(int level, int newId)
                 else
                     _iter->remove();
                 // Free both protocol and associated widget
-                delete _protocolWidgets.take(p);
+                releaseProtocolWidget(p);
                 delete p;
                 if (level == ProtoPayload)
                 {
@@ -856,7 +890,7 @@ void StreamConfigDialog::__updateProtocol(int level, int newId)
                         p = _iter->next();
                         _iter->remove();
                         // Free both protocol and associated widget
-                        delete _protocolWidgets.take(p);
+                        releaseProtocolWidget(p);
                         delete p;
                     }
                 }
@@ -1132,10 +1166,7 @@ void StreamConfigDialog::on_lePacketsPerSec_textChanged(const QString &text)
     Stream *pStream = mpStream;
     uint frameLen;
 
-    if (pStream->lenMode() == Stream::e_fl_fixed)
-        frameLen = pStream->frameLen();
-    else
-        frameLen = (pStream->frameLenMin() + pStream->frameLenMax())/2;
+    frameLen = pStream->frameLenAvg();
 
     if (rbSendPackets->isChecked())
     {
@@ -1157,10 +1188,7 @@ void StreamConfigDialog::on_leBurstsPerSec_textChanged(const QString &text)
     uint frameLen;
 
     qDebug("start of %s(%s)", __FUNCTION__, text.toAscii().constData());
-    if (pStream->lenMode() == Stream::e_fl_fixed)
-        frameLen = pStream->frameLen();
-    else
-        frameLen = (pStream->frameLenMin() + pStream->frameLenMax())/2;
+    frameLen = pStream->frameLenAvg();
 
     if (rbSendBursts->isChecked())
     {
@@ -1182,10 +1210,7 @@ void StreamConfigDialog::on_leBitsPerSec_textEdited(const QString &text)
     uint burstSize = lePacketsPerBurst->text().toULong(&isOk);
     uint frameLen;
 
-    if (pStream->lenMode() == Stream::e_fl_fixed)
-        frameLen = pStream->frameLen();
-    else
-        frameLen = (pStream->frameLenMin() + pStream->frameLenMax())/2;
+    frameLen = pStream->frameLenAvg();
 
     if (rbSendPackets->isChecked())
     {
@@ -1212,7 +1237,26 @@ bool StreamConfigDialog::isCurrentStreamValid()
             "varying fields at transmit time may not be same as configured");
     }
 
-    mpStream->preflightCheck(log);
+    // Preflight checks every frame size of a variable size stream - run it
+    // in a worker thread, with the dialog disabled, so that the GUI doesn't
+    // freeze meanwhile
+    {
+        QFutureWatcher<QStringList> watcher;
+        QEventLoop loop;
+
+        setDisabled(true);
+        QApplication::setOverrideCursor(Qt::WaitCursor);
+
+        connect(&watcher, SIGNAL(finished()), &loop, SLOT(quit()));
+        watcher.setFuture(QtConcurrent::run(preflightCheck,
+                                            (const StreamBase*) mpStream));
+        if (!watcher.isFinished())
+            loop.exec();
+        log << watcher.result();
+
+        QApplication::restoreOverrideCursor();
+        setEnabled(true);
+    }
 
     if (log.size())
     {
@@ -1240,6 +1284,9 @@ void StreamConfigDialog::on_pbPrev_clicked()
     if (!isCurrentStreamValid())
         return;
 
+    // Stored already - reused (if possible) for the next stream's protocols
+    releaseProtocolWidgets();
+
     delete _iter;
     mpStream = _streamList.at(--mCurrentStreamIndex);
     _iter = mpStream->createProtocolListIterator();
@@ -1260,6 +1307,9 @@ void StreamConfigDialog::on_pbNext_clicked()
     if (!isCurrentStreamValid())
         return;
 
+    // Stored already - reused (if possible) for the next stream's protocols
+    releaseProtocolWidgets();
+
     delete _iter;
     mpStream = _streamList.at(++mCurrentStreamIndex);
     _iter = mpStream->createProtocolListIterator();
@@ -103,6 +103,8 @@ private:
     void StoreCurrentStream();
     void loadProtocolWidgets();
     void storeProtocolWidgets();
+    void releaseProtocolWidget(AbstractProtocol *protocol);
+    void releaseProtocolWidgets();
 
 private slots:
     void on_cmbPktLenMode_currentIndexChanged(QString mode);
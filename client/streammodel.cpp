@@ -161,10 +161,9 @@ bool StreamModel::setData(const QModelIndex &index, const QVariant &value, int r
             return true;
 
         case StreamStatus:
-            mCurrentPort->mutableStreamByIndex(index.row())
-                                        ->setEnabled(value.toBool());
-            emit(dataChanged(index, index));
-            return true;
+            // Doesn't need the stream to be materialized
+            return setStreamsEnabled(QList<int>() << index.row(),
+                                     value.toBool());
 
         case StreamNextWhat:
             if (role == Qt::EditRole)
@@ -273,6 +272,74 @@ bool StreamModel::removeRows(int row, int count, const QModelIndex &/*parent*/)
     return true;
 }
 
+/*!
+  Enables/disables the streams at rows - with a single dataChanged() for
+  all of them instead of a setData() per row
+*/
+bool StreamModel::setStreamsEnabled(const QList<int> &rows, bool enabled)
+{
+    int first, last;
+
+    if ((mCurrentPort == NULL) || rows.isEmpty())
+        return false;
+
+    first = last = rows.first();
+    foreach (int row, rows) {
+        first = qMin(first, row);
+        last = qMax(last, row);
+    }
+
+    mCurrentPort->setStreamsEnabled(rows, enabled);
+    emit dataChanged(index(first, StreamStatus), index(last, StreamStatus));
+
+    return true;
+}
+
+/*!
+  Removes the streams at rows - the rows need not be contiguous
+
+  Each contiguous range of rows is removed with its own removal
+  notification; if there are too many ranges, the model is reset instead
+*/
+bool StreamModel::removeStreams(const QList<int> &rows)
+{
+    const int kMaxRanges = 16;
+    QList<int> sorted = rows;
+    QList<QPair<int, int> > ranges; // (first, last) - highest first
+
+    if ((mCurrentPort == NULL) || rows.isEmpty())
+        return false;
+
+    qSort(sorted.begin(), sorted.end(), qGreater<int>());
+    foreach (int row, sorted) {
+        if (!ranges.isEmpty() && (row >= ranges.last().first - 1)) {
+            ranges.last().first = qMin(ranges.last().first, row);
+            continue;
+        }
+        ranges.append(qMakePair(row, row));
+    }
+
+    if (ranges.size() > kMaxRanges) {
+        mCurrentPort->deleteStreams(sorted);
+        reset();
+        return true;
+    }
+
+    for (int i = 0; i < ranges.size(); i++) {
+        QList<int> range;
+
+        for (int row = ranges.at(i).first; row <= ranges.at(i).second; row++)
+            range.append(row);
+
+        beginRemoveRows(QModelIndex(), ranges.at(i).first,
+                ranges.at(i).second);
+        mCurrentPort->deleteStreams(range);
+        endRemoveRows();
+    }
+
+    return true;
+}
+
 // --------------------- SLOTS ------------------------
 
 void StreamModel::setCurrentPortIndex(const QModelIndex &current)
@@ -50,6 +50,10 @@ class StreamModel : public QAbstractTableModel
             const QModelIndex & parent = QModelIndex());
         bool removeRows (int row, int count,
             const QModelIndex & parent = QModelIndex());
+
+        // For many rows at once - with one model update for all
+        bool setStreamsEnabled(const QList<int> &rows, bool enabled);
+        bool removeStreams(const QList<int> &rows);
     
 #if 0 // CleanedUp!
         // FIXME(HIGH): This *is* like a kludge
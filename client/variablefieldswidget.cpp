@@ -423,7 +423,7 @@ void VariableFieldsWidget::setVariableFieldItem(
     itemText = QString("%1 %2 %3 from %4 to %5")
             .arg(protocol->shortName())
             .arg(fieldName)
-            .arg(modeNames.at(vf.mode()))
+            .arg(modeNames.value(vf.mode(), "Custom"))
             .arg(from)
             .arg(to);
     if (vf.step() != 1)
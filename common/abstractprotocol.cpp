@@ -19,10 +19,64 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 
 #include "abstractprotocol.h" 
 
+#include "cksum.h"
 #include "protocollistiterator.h"
 #include "streambase.h"
+#include "trace.h"
 
+#include <QMutex>
+#include <QMutexLocker>
 #include <qendian.h>
+#include <math.h>
+#include <new>
+
+// Size in bytes of a variable field of type; 0 if unsupported
+static int variableFieldSize(OstProto::VariableField::Type type)
+{
+    switch (type) {
+    case OstProto::VariableField::kCounter8:   return 1;
+    case OstProto::VariableField::kCounter16:  return 2;
+    case OstProto::VariableField::kCounter32:  return 4;
+    case OstProto::VariableField::kCounter48:  return 6;
+    case OstProto::VariableField::kCounter64:  return 8;
+    case OstProto::VariableField::kCounter128: return 16;
+    default: return 0;
+    }
+}
+
+// Number of frames after which a variable field repeats its values
+static int variableFieldFrameCount(const OstProto::VariableField &varField)
+{
+    if (varField.mode() == OstProto::VariableField::kList)
+        return qMax(varField.values_size(), 1);
+
+    return qMax(int(varField.count()), 1);
+}
+
+// Base value and mask (low and high 64 bits) of a variable field
+static void variableFieldBase(const OstProto::VariableField &varField,
+        quint64 *value, quint64 *mask, quint64 *valueHi, quint64 *maskHi)
+{
+    int size = variableFieldSize(varField.type());
+
+    if (size <= 4) {
+        *value = varField.value();
+        *mask = varField.mask();
+    }
+    else {
+        *value = varField.value64();
+        *mask = varField.mask64();
+    }
+    if (size < 8)
+        *mask &= (quint64(1) << 8*size) - 1;
+
+    if (size == 16) {
+        *valueHi = varField.value_hi();
+        *maskHi = varField.mask_hi();
+    }
+    else
+        *valueHi = *maskHi = 0;
+}
 
 /*!
   \class AbstractProtocol
@@ -79,7 +133,11 @@ AbstractProtocol::AbstractProtocol(StreamBase *stream, AbstractProtocol *parent)
     _frameVariableCount = -1;
     protoSize = -1;
     _hasPayload = true;
-    _cacheFlags |= FieldFrameBitOffsetCache;
+    _cacheFlags = FieldFrameBitOffsetCache | FrameLayoutCache
+                    | FrameValueCache;
+    _hasFrameLayout = false;
+    _constantFrameCksum = 0;
+    _hasConstantFrameValue = false;
 }
 
 /*!
@@ -89,6 +147,74 @@ AbstractProtocol::~AbstractProtocol()
 {
 }
 
+// Recycled protocol objects - a free list per size class
+enum {
+    kPoolGranularity = 64,
+    kPoolSizeClasses = 32,      // objects upto 2K bytes are pooled
+    kPoolMaxFree = 1024         // per size class
+};
+struct PoolBlock { PoolBlock *next; };
+static PoolBlock *poolFreeList[kPoolSizeClasses];
+static int poolFreeCount[kPoolSizeClasses];
+static QMutex poolLock;
+
+/*!
+  Allocates memory for a protocol object
+
+  Protocols are created and destroyed in bulk - for every protocol of every
+  stream parsed, loaded from a file or cloned - so the memory of destroyed
+  protocols is kept aside (upto a limit) and reused for new ones instead
+  of going back to the heap each time
+*/
+void* AbstractProtocol::operator new(size_t size)
+{
+    uint sizeClass = (size - 1)/kPoolGranularity;
+
+    if (sizeClass >= kPoolSizeClasses)
+        return ::operator new(size);
+
+    QMutexLocker locker(&poolLock);
+    PoolBlock *block = poolFreeList[sizeClass];
+
+    if (block) {
+        poolFreeList[sizeClass] = block->next;
+        poolFreeCount[sizeClass]--;
+        return block;
+    }
+
+    return ::operator new((sizeClass + 1)*kPoolGranularity);
+}
+
+/*!
+  Frees (for reuse) the memory of a protocol object - size is the size of
+  the most derived class (the destructor is virtual)
+*/
+void AbstractProtocol::operator delete(void *ptr, size_t size)
+{
+    uint sizeClass = (size - 1)/kPoolGranularity;
+
+    if (!ptr)
+        return;
+
+    if (sizeClass >= kPoolSizeClasses) {
+        ::operator delete(ptr);
+        return;
+    }
+
+    QMutexLocker locker(&poolLock);
+
+    if (poolFreeCount[sizeClass] >= kPoolMaxFree) {
+        locker.unlock();
+        ::operator delete(ptr);
+        return;
+    }
+
+    PoolBlock *block = static_cast<PoolBlock*>(ptr);
+    block->next = poolFreeList[sizeClass];
+    poolFreeList[sizeClass] = block;
+    poolFreeCount[sizeClass]++;
+}
+
 /*! 
   Allocates and returns a new instance of the class. 
   
@@ -361,6 +487,9 @@ int AbstractProtocol::fieldFrameBitOffset(int index, int streamIndex) const
 {
     int ofs = 0;
 
+    if (_hasFrameLayout)
+        return _fieldBitOffset.value(index, -1);
+
     if ((index < 0) || (index >= fieldCount()) 
             || !fieldFlags(index).testFlag(FrameField))
         return -1;
@@ -381,11 +510,99 @@ int AbstractProtocol::fieldFrameBitOffset(int index, int streamIndex) const
     if ((_cacheFlags & FieldFrameBitOffsetCache))
         _fieldFrameBitOffset.insert(index, ofs);
 
-    qDebug("======> ffbo index: %d, ofs: %d", index, ofs);
+    qTrace("======> ffbo index: %d, ofs: %d", index, ofs);
 _exit:
     return ofs;
 }
 
+/*!
+  Computes the frame layout of the protocol - the bit offset and size of
+  each of its frame fields - from its current config
+
+  Frames are built (by the default protocolFrameValue()) using the layout
+  instead of finding out the size and flags of each field for each frame.
+  A layout is computed only when this is called - typically by the server
+  once a stream's config is final, before its frames are built (by many
+  threads) - and must be updated if the config changes thereafter
+
+  If the protocol's value is the same for every frame - it doesn't vary
+  any field, its size or its payload's size and doesn't derive any field
+  from other protocols - its frame value and checksum are also rendered
+  once here and returned for every frame thereafter
+
+  A protocol whose field sizes depend on anything other than its config
+  (e.g. on the frame length) should clear FrameLayoutCache; a protocol
+  whose value may differ from frame to frame in spite of the above (e.g.
+  random data) should clear FrameValueCache; a protocol
+  which caches anything else that is derived from its config may override
+  this to (re)compute it, calling the base class implementation too
+*/
+void AbstractProtocol::updateFrameLayout()
+{
+    int ofs = 0;
+
+    _hasFrameLayout = false;
+    _frameLayout.clear();
+    _fieldBitOffset.clear();
+    _fieldFrameBitOffset.clear();
+    protoSize = -1;
+
+    _hasConstantFrameValue = false;
+    _constantFrameValue.clear();
+
+    if (!(_cacheFlags & FieldFrameBitOffsetCache)
+            || !(_cacheFlags & FrameLayoutCache))
+        goto _frame_value;
+
+    _fieldBitOffset.fill(-1, fieldCount());
+    for (int i = 0; i < fieldCount(); i++)
+    {
+        FieldFlags flags = fieldFlags(i);
+        FieldLayout field;
+
+        if (!flags.testFlag(FrameField))
+            continue;
+
+        _fieldBitOffset[i] = ofs;
+
+        field.index = i;
+        field.bitOffset = ofs;
+        field.bitSize = fieldData(i, FieldBitSize).toInt();
+        field.isCksum = flags.testFlag(CksumField);
+        if (field.bitSize <= 0)
+            continue;
+
+        _frameLayout.append(field);
+        ofs += field.bitSize;
+    }
+
+    protoSize = (ofs + 7)/8;
+    _hasFrameLayout = true;
+
+_frame_value:
+    if (!(_cacheFlags & FrameValueCache)
+            || isProtocolFrameValueVariable()
+            || isProtocolFrameSizeVariable()
+            || isProtocolFrameValueDependent()
+            || isProtocolFramePayloadSizeVariable())
+        return;
+
+    // No cksum fields (else it would be dependent) - forCksum is the same
+    _constantFrameValue = protocolFrameValue(0);
+    _constantFrameCksum = protocolFrameCksum(0, CksumIp);
+    _hasConstantFrameValue = true;
+}
+
+/*!
+  Returns the frame layout computed by updateFrameLayout() or NULL if
+  there's none
+*/
+const QVector<AbstractProtocol::FieldLayout>*
+AbstractProtocol::frameLayout() const
+{
+    return _hasFrameLayout ? &_frameLayout : NULL;
+}
+
 /*!
  * Returns the count of variableFields in the protocol
  */
@@ -402,7 +619,8 @@ void AbstractProtocol::appendVariableField(const OstProto::VariableField &vf)
     _data.add_variable_field()->CopyFrom(vf);
 
     // Update the cached value
-    _frameVariableCount = lcm(_frameVariableCount, vf.count());
+    _frameVariableCount = lcm(_frameVariableCount,
+                              variableFieldFrameCount(vf));
 }
 
 /*!
@@ -432,7 +650,7 @@ void AbstractProtocol::removeVariableField(int index)
         _data.add_variable_field()->CopyFrom(temp.variable_field(i));
         // Recalculate the cached value
         _frameVariableCount = lcm(_frameVariableCount,
-                                  _data.variable_field(i).count());
+                variableFieldFrameCount(_data.variable_field(i)));
     }
 }
 
@@ -507,7 +725,7 @@ quint32 AbstractProtocol::payloadProtocolId(ProtocolIdType type) const
     else
         id = 0xFFFFFFFF;
 
-    qDebug("%s: payloadProtocolId = 0x%x", __FUNCTION__, id);
+    qTrace("%s: payloadProtocolId = 0x%x", __FUNCTION__, id);
     return id;
 }
 
@@ -535,7 +753,7 @@ int AbstractProtocol::protocolFrameSize(int streamIndex) const
         protoSize = (bitsize+7)/8;
     }
 
-    qDebug("%s: protoSize = %d", __FUNCTION__, protoSize);
+    qTrace("%s: protoSize = %d", __FUNCTION__, protoSize);
     return protoSize;
 }
 
@@ -559,7 +777,7 @@ int AbstractProtocol::protocolFrameOffset(int streamIndex) const
     if (parent)
         size += parent->protocolFrameOffset(streamIndex);
 
-    qDebug("%s: ofs = %d", __FUNCTION__, size);
+    qTrace("%s: ofs = %d", __FUNCTION__, size);
     return size;
 }
 
@@ -581,7 +799,7 @@ int AbstractProtocol::protocolFramePayloadSize(int streamIndex) const
     if (parent)
         size += parent->protocolFramePayloadSize(streamIndex);
 
-    qDebug("%s: payloadSize = %d", __FUNCTION__, size);
+    qTrace("%s: payloadSize = %d", __FUNCTION__, size);
     return size;
 }
 
@@ -599,13 +817,36 @@ QByteArray AbstractProtocol::protocolFrameValue(int streamIndex, bool forCksum)
     QByteArray proto, field;
     uint bits, lastbitpos = 0;
     FieldFlags flags;
+    int n = _hasFrameLayout ? _frameLayout.size() : fieldCount();
 
-    for (int i=0; i < fieldCount() ; i++) 
+    if (_hasConstantFrameValue)
+        return _constantFrameValue;
+
+    if (_hasFrameLayout)
+        proto.reserve(protoSize);
+
+    for (int k = 0; k < n; k++)
     {
-        flags = fieldFlags(i);
+        int i;
+
+        if (_hasFrameLayout) {
+            const FieldLayout &layout = _frameLayout.at(k);
+
+            i = layout.index;
+            bits = layout.bitSize;
+            flags = FrameField;
+            if (layout.isCksum)
+                flags |= CksumField;
+        }
+        else {
+            i = k;
+            flags = fieldFlags(i);
+            if (flags.testFlag(FrameField))
+                bits = fieldData(i, FieldBitSize, streamIndex).toUInt();
+        }
+
         if (flags.testFlag(FrameField))
         {
-            bits = fieldData(i, FieldBitSize, streamIndex).toUInt();
             if (bits == 0)
                 continue;
             Q_ASSERT(bits > 0);
@@ -617,9 +858,9 @@ QByteArray AbstractProtocol::protocolFrameValue(int streamIndex, bool forCksum)
             }
             else
                 field = fieldData(i, FieldFrameValue, streamIndex).toByteArray();
-            qDebug("<<< (%d, %db) %s >>>", proto.size(), lastbitpos,
+            qTraceField("<<< (%d, %db) %s >>>", proto.size(), lastbitpos,
                     QString(proto.toHex()).toAscii().constData());
-            qDebug("  < %d: (%db/%dB) %s >", i, bits, field.size(),
+            qTraceField("  < %d: (%db/%dB) %s >", i, bits, field.size(),
                     QString(field.toHex()).toAscii().constData());
 
             if (bits == (uint) field.size() * 8)
@@ -698,6 +939,25 @@ QByteArray AbstractProtocol::protocolFrameValue(int streamIndex, bool forCksum)
     return proto;
 }
 
+/*!
+  Writes the protocol's frame value (same as protocolFrameValue()) into buf
+  and returns its size - if the size is more than bufSize, only the first
+  bufSize bytes are written
+
+  This is the fast path used to build frames; subclasses should override
+  it to write their fields directly into buf instead of going through
+  fieldData() which builds a QByteArray per field. The default
+  implementation copies protocolFrameValue()
+*/
+int AbstractProtocol::writeFrameValue(uchar *buf, int bufSize,
+        int streamIndex, bool forCksum) const
+{
+    QByteArray fv = protocolFrameValue(streamIndex, forCksum);
+
+    memcpy(buf, fv.constData(), qMin(fv.size(), bufSize));
+    return fv.size();
+}
+
 /*!
   Returns true if the protocol varies one or more of its fields at run-time,
   false otherwise
@@ -719,6 +979,52 @@ bool AbstractProtocol::isProtocolFrameSizeVariable() const
     return false;
 }
 
+/*!
+  Returns true if the protocol's frame value depends on the value of other
+  protocols in the frame, false otherwise
+
+  Such a protocol may vary from frame to frame even if the protocol itself
+  doesn't vary any of its fields (i.e. isProtocolFrameValueVariable() is
+  false) e.g. a protocol with a checksum field
+
+  The default implementation returns true if the protocol has a checksum
+  field. A subclass should reimplement if it derives any other field from
+  other protocols
+*/
+bool AbstractProtocol::isProtocolFrameValueDependent() const
+{
+    for (int i = 0; i < fieldCount(); i++)
+    {
+        if (fieldFlags(i).testFlag(CksumField))
+            return true;
+    }
+
+    return false;
+}
+
+/*!
+  Returns true if any of the protocol's field values are random i.e. are
+  from random() and so change with the stream's random seed, false
+  otherwise
+
+  The default implementation returns true if the protocol has a random
+  variable field. A subclass should reimplement if it has random fields
+  of its own
+*/
+bool AbstractProtocol::isProtocolFrameValueRandom() const
+{
+    for (int i = 0; i < variableFieldCount(); i++)
+    {
+        OstProto::VariableField::Mode mode = variableField(i).mode();
+
+        if ((mode == OstProto::VariableField::kRandom)
+                || (mode == OstProto::VariableField::kExponential))
+            return true;
+    }
+
+    return false;
+}
+
 /*!
   Returns the minimum number of frames required for the protocol to 
   vary its fields
@@ -742,7 +1048,7 @@ int AbstractProtocol::protocolFrameVariableCount() const
     _frameVariableCount = 1;
     for (int i = 0; i < _data.variable_field_size(); i++)
         _frameVariableCount = lcm(_frameVariableCount, 
-                                  _data.variable_field(i).count());
+                variableFieldFrameCount(_data.variable_field(i)));
 
     return _frameVariableCount;
 }
@@ -852,6 +1158,9 @@ quint32 AbstractProtocol::protocolFrameCksum(int streamIndex,
     static int recursionCount = 0;
     quint32 cksum = 0xFFFFFFFF;
 
+    if (_hasConstantFrameValue && (cksumType == CksumIp))
+        return _constantFrameCksum;
+
     recursionCount++;
     Q_ASSERT_X(recursionCount < 10, "protocolFrameCksum", "potential infinite recursion - does a protocol checksum field not implement FieldBitSize?");
 
@@ -860,27 +1169,10 @@ quint32 AbstractProtocol::protocolFrameCksum(int streamIndex,
         case CksumIp:
         {
             QByteArray fv;
-            quint16 *ip;
-            quint32 len, sum = 0;
+            quint16 sum;
 
             fv = protocolFrameValue(streamIndex, true);
-            ip = (quint16*) fv.constData();
-            len = fv.size();
-
-            while(len > 1)
-            {
-                sum += *ip;
-                if(sum & 0x80000000)
-                    sum = (sum & 0xFFFF) + (sum >> 16);
-                ip++;
-                len -= 2;
-            }
-
-            if (len)
-                sum += (unsigned short) *(unsigned char *)ip;
-
-            while(sum>>16)
-                sum = (sum & 0xFFFF) + (sum >> 16);
+            sum = onesComplementSum((const quint8*) fv.constData(), fv.size());
 
             cksum = qFromBigEndian((quint16) ~sum);
             break;
@@ -937,7 +1229,7 @@ quint32 AbstractProtocol::protocolFrameHeaderCksum(int streamIndex,
     {
         cksum = p->protocolFrameCksum(streamIndex, cksumType);
         sum += (quint16) ~cksum;
-        qDebug("%s: sum = %u, cksum = %u", __FUNCTION__, sum, cksum);
+        qTrace("%s: sum = %u, cksum = %u", __FUNCTION__, sum, cksum);
         if (cksumScope == CksumScopeAdjacentProtocol)
             goto out;
         p = p->prev;
@@ -956,6 +1248,48 @@ out:
     return (quint16) ~sum;
 }
 
+/*!
+  Returns true if the protocol's checksum of the requested type is left to
+  the NIC to compute for the stream's frames
+
+  Only the IPv4 header (CksumIp) and TCP/UDP (CksumTcpUdp) checksums can be
+  offloaded - see StreamBase::cksumOffload(). If offloaded, the protocol
+  puts 0 (IPv4) or the pseudo header checksum (TCP/UDP) in its checksum
+  field instead - which is what the NIC expects
+*/
+bool AbstractProtocol::isCksumOffloaded(CksumType cksumType) const
+{
+    uint offload = mpStream ? mpStream->cksumOffload() : 0;
+
+    switch (cksumType)
+    {
+        case CksumIp:
+            return offload & StreamBase::kIpCksumOffload;
+        case CksumTcpUdp:
+            return offload & StreamBase::kL4CksumOffload;
+        default:
+            break;
+    }
+
+    return false;
+}
+
+/*!
+  Returns the offset of the protocol's TCP/UDP (CksumTcpUdp) checksum field
+  if the checksum is computed from the frame (i.e. not overridden or
+  offloaded), else -1
+
+  Such a checksum is left out (as 0) when the frame is built by
+  StreamBase::frameValue() - with writeFrameValue(..., forCksum=true) - and
+  filled in from the built frame instead of re-rendering the payload for it
+
+  The default implementation returns -1
+*/
+int AbstractProtocol::deferredCksumOffset() const
+{
+    return -1;
+}
+
 /*!
   Returns the checksum of the requested type for the protocol's payload
 
@@ -1059,78 +1393,264 @@ quint64 AbstractProtocol::lcm(quint64 u, quint64 v)
     return (u * v)/gcd(u, v);
 }
 
-/* 
- * XXX: varyCounter() is not a member of AbstractProtocol to avoid
+/*
+ * XXX: applyVariableField() is not a member of AbstractProtocol to avoid
  * moving it into the header file and thereby keeping the header file
  * clean
+ *
+ * Overwrites the mask bits of the field in buf with value (already masked)
  */
-template <typename T>
-bool varyCounter(QString protocolName, QByteArray &buf, int frameIndex, 
-                 const OstProto::VariableField &varField)
+static bool applyVariableField(QString protocolName, uchar *buf, int bufSize,
+        const OstProto::VariableField &varField,
+        quint64 value, quint64 valueHi)
 {
-    int x = (frameIndex % varField.count()) * varField.step();
+    int size = variableFieldSize(varField.type());
+    quint64 mask, maskHi, unused, fv;
+    uchar *p;
 
-    T oldfv, newfv;
+    if (!size)
+    {
+        qWarning("%s Unsupported varField type %d",
+                qPrintable(protocolName), varField.type());
+        return false;
+    }
 
-    if ((varField.offset() + sizeof(T)) > uint(buf.size()))
+    if ((varField.offset() + size) > uint(bufSize))
     {
         qWarning("%s varField ofs %d beyond protocol frame %d - skipping", 
-                qPrintable(protocolName), varField.offset(), buf.size());
+                qPrintable(protocolName), varField.offset(), bufSize);
         return false;
     }
 
-    oldfv = *((T*)((uchar*)buf.constData() + varField.offset()));
-    if (sizeof(T) > sizeof(quint8))
-        oldfv = qFromBigEndian(oldfv);
+    variableFieldBase(varField, &unused, &mask, &unused, &maskHi);
+    p = buf + varField.offset();
 
-    switch(varField.mode())
+    switch (size)
     {
-        case OstProto::VariableField::kIncrement:
-            newfv = (oldfv & ~varField.mask()) 
-                | ((varField.value() + x) & varField.mask());
-            break;
-        case OstProto::VariableField::kDecrement:
-            newfv = (oldfv & ~varField.mask()) 
-                | ((varField.value() - x) & varField.mask());
-            break;
-        case OstProto::VariableField::kRandom:
-            newfv = (oldfv & ~varField.mask()) 
-                | ((varField.value() + qrand()) & varField.mask());
-            break;
-        default:
-            qWarning("%s Unsupported varField mode %d", 
-                    qPrintable(protocolName), varField.mode());
-            return false;
+    case 1:
+        *p = (*p & ~mask) | value;
+        break;
+    case 2:
+        qToBigEndian(quint16((qFromBigEndian<quint16>(p) & ~mask) | value), p);
+        break;
+    case 4:
+        qToBigEndian(quint32((qFromBigEndian<quint32>(p) & ~mask) | value), p);
+        break;
+    case 6:
+        fv = (quint64(qFromBigEndian<quint16>(p)) << 32)
+                | qFromBigEndian<quint32>(p + 2);
+        fv = (fv & ~mask) | value;
+        qToBigEndian(quint16(fv >> 32), p);
+        qToBigEndian(quint32(fv), p + 2);
+        break;
+    case 8:
+        qToBigEndian((qFromBigEndian<quint64>(p) & ~mask) | value, p);
+        break;
+    case 16:
+        qToBigEndian((qFromBigEndian<quint64>(p) & ~maskHi) | valueHi, p);
+        qToBigEndian((qFromBigEndian<quint64>(p + 8) & ~mask) | value, p + 8);
+        break;
     }
 
-    if (sizeof(T) == sizeof(quint8))
-        *((uchar*)buf.constData() + varField.offset()) = newfv;
-    else
-        qToBigEndian(newfv, (uchar*)buf.constData() + varField.offset());
-
-    qDebug("%s varField ofs %d oldfv %x newfv %x", 
-            qPrintable(protocolName), varField.offset(), oldfv, newfv);
+    qTrace("%s varField ofs %d newfv %llx-%llx",
+            qPrintable(protocolName), varField.offset(), valueHi, value);
     return true;
 }
 
-void AbstractProtocol::varyProtocolFrameValue(QByteArray &buf, int frameIndex,
-        const OstProto::VariableField &varField) const
+/*!
+  Computes the values of the variable field at index for the count frames
+  starting at firstFrame - values[i] is the value (already masked) of
+  frame firstFrame + i and valuesHi[i], its high 64 bits for a
+  kCounter128 field (valuesHi may be NULL for other types)
+
+  Increment/decrement values are computed in loops with no dependency
+  between frames that the compiler can vectorize, so computing a field's
+  values for all the frames of a packet set at once is much cheaper than
+  computing them one frame at a time
+*/
+void AbstractProtocol::variableFieldValues(int index, int firstFrame,
+        int count, quint64 *values, quint64 *valuesHi) const
 {
+    Q_ASSERT(index < _data.variable_field_size());
+    Q_ASSERT(valuesHi || (variableField(index).type()
+                            != OstProto::VariableField::kCounter128));
+
+    variableFieldValues(_data.variable_field(index), firstFrame, count,
+                        values, valuesHi);
+}
+
+void AbstractProtocol::variableFieldValues(
+        const OstProto::VariableField &varField, int firstFrame, int count,
+        quint64 *values, quint64 *valuesHi) const
+{
+    quint64 value, mask, valueHi, maskHi;
+    quint64 step = varField.step();
+    int n = variableFieldFrameCount(varField);
+    bool isWide = (varField.type() == OstProto::VariableField::kCounter128);
+    quint32 field = 0x10000 | varField.offset(); // for random()
+
+    variableFieldBase(varField, &value, &mask, &valueHi, &maskHi);
 
-    switch (varField.type()) {
-    case OstProto::VariableField::kCounter8:
-        varyCounter<quint8>(shortName(), buf, frameIndex, varField);
+    switch (varField.mode())
+    {
+    case OstProto::VariableField::kIncrement:
+    case OstProto::VariableField::kDecrement:
+    {
+        bool isDecrement = (varField.mode()
+                                == OstProto::VariableField::kDecrement);
+
+        // In runs that don't wrap around n so that the loops don't branch
+        for (int i = 0; i < count; )
+        {
+            int k = (firstFrame + i) % n;
+            int run = qMin(count - i, n - k);
+            quint64 *v = values + i;
+
+            if (isDecrement) {
+                for (int j = 0; j < run; j++)
+                    v[j] = value - quint64(k + j)*step;
+            }
+            else {
+                for (int j = 0; j < run; j++)
+                    v[j] = value + quint64(k + j)*step;
+            }
+
+            // (k + j)*step < 2^64, so there's a carry/borrow of at most 1
+            if (isWide) {
+                quint64 *h = valuesHi + i;
+
+                if (isDecrement) {
+                    for (int j = 0; j < run; j++)
+                        h[j] = valueHi - (v[j] > value);
+                }
+                else {
+                    for (int j = 0; j < run; j++)
+                        h[j] = valueHi + (v[j] < value);
+                }
+            }
+            i += run;
+        }
         break;
-    case OstProto::VariableField::kCounter16:
-        varyCounter<quint16>(shortName(), buf, frameIndex, varField);
+    }
+    case OstProto::VariableField::kRandom:
+        for (int i = 0; i < count; i++)
+        {
+            Pcg32 rng = random(firstFrame + i, field);
+            quint64 r = (quint64(rng.next()) << 32) | rng.next();
+
+            values[i] = value + r;
+            if (isWide)
+                valuesHi[i] = valueHi + ((quint64(rng.next()) << 32)
+                                | rng.next()) + (values[i] < value);
+        }
         break;
-    case OstProto::VariableField::kCounter32:
-        varyCounter<quint32>(shortName(), buf, frameIndex, varField);
+    case OstProto::VariableField::kExponential:
+        for (int i = 0; i < count; i++)
+        {
+            Pcg32 rng = random(firstFrame + i, field);
+            double u = rng.next()/4294967296.0; // [0, 1)
+
+            values[i] = value + quint64(-log(1 - u)*step);
+            if (isWide)
+                valuesHi[i] = valueHi + (values[i] < value);
+        }
+        break;
+    case OstProto::VariableField::kList:
+        for (int i = 0; i < count; i++)
+        {
+            values[i] = varField.values_size() ?
+                varField.values((firstFrame + i) % n) : value;
+            if (isWide)
+                valuesHi[i] = valueHi;
+        }
         break;
     default:
+        qWarning("%s Unsupported varField mode %d", 
+                qPrintable(shortName()), varField.mode());
+        for (int i = 0; i < count; i++)
+        {
+            values[i] = value;
+            if (isWide)
+                valuesHi[i] = valueHi;
+        }
         break;
     }
 
-    return;
+    for (int i = 0; i < count; i++)
+        values[i] &= mask;
+    if (isWide) {
+        for (int i = 0; i < count; i++)
+            valuesHi[i] &= maskHi;
+    }
+}
+
+void AbstractProtocol::varyProtocolFrameValue(QByteArray &buf, int frameIndex,
+        const OstProto::VariableField &varField) const
+{
+    quint64 value, valueHi;
+
+    variableFieldValues(varField, frameIndex, 1, &value, &valueHi);
+    applyVariableField(shortName(), (uchar*) buf.data(), buf.size(),
+                       varField, value, valueHi);
+}
+
+/*!
+  Overwrites the protocol's frame value in buf (written by a subclass'
+  writeFrameValue()) with all its variable fields
+*/
+void AbstractProtocol::varyProtocolFrameValue(uchar *buf, int bufSize,
+        int frameIndex) const
+{
+    for (int i = 0; i < _data.variable_field_size(); i++)
+    {
+        const OstProto::VariableField &vf = _data.variable_field(i);
+        quint64 value, valueHi;
+
+        variableFieldValues(vf, frameIndex, 1, &value, &valueHi);
+        applyVariableField(shortName(), buf, bufSize, vf, value, valueHi);
+    }
+}
+
+/*!
+  Returns a generator for the random values of field in frame streamIndex
+
+  Each field of each protocol of the stream gets a substream of its own
+  (by the protocol's position in the stream), so that two random fields
+  don't get the same values
+*/
+Pcg32 AbstractProtocol::random(int streamIndex, quint32 field) const
+{
+    quint32 depth = 1; // substream 0 is the stream's (frame length)
+
+    for (AbstractProtocol *p = prev; p; p = p->prev)
+        depth++;
+
+    if (!mpStream)
+        return Pcg32(0, (quint64(quint32(streamIndex)) << 32)
+                            | (depth << 24) | field);
+
+    return mpStream->random(streamIndex, (depth << 24) | field);
+}
+
+/*!
+  Returns true if any of the variable fields of the protocol overlaps
+  the size bytes at offset in its frame value
+*/
+bool AbstractProtocol::hasVariableFieldAt(int offset, int size) const
+{
+    for (int i = 0; i < _data.variable_field_size(); i++)
+    {
+        const OstProto::VariableField &vf = _data.variable_field(i);
+        int vfSize = variableFieldSize(vf.type());
+
+        if (!vfSize)
+            continue;
+
+        if ((int(vf.offset()) < (offset + size))
+                && ((int(vf.offset()) + vfSize) > offset))
+            return true;
+    }
+
+    return false;
 }
 
@@ -26,8 +26,11 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 #include <QLinkedList>
 #include <QString>
 #include <QVariant>
+#include <QVector>
 #include <qendian.h>
 
+#include "prng.h"
+
 //#include "../rpc/pbhelper.h"
 #include "protocol.pb.h"
 
@@ -65,7 +68,9 @@ protected:
 
     //! Caching Control Flags
     enum CacheFlag {
-        FieldFrameBitOffsetCache = 0x1
+        FieldFrameBitOffsetCache = 0x1,
+        FrameLayoutCache = 0x2, //!< field sizes depend only on the config
+        FrameValueCache = 0x4   //!< invariant frame value can be memoized
     };
     quint32  _cacheFlags;
 
@@ -87,6 +92,14 @@ public:
         FieldBitSize,       //!< size in bits
     };
 
+    //! Position of a frame field in the protocol's frame value
+    struct FieldLayout {
+        int index;      //!< field index
+        int bitOffset;  //!< from the start of the protocol
+        int bitSize;    //!< always > 0
+        bool isCksum;   //!< CksumField
+    };
+
     //! Supported Protocol Id types 
     enum ProtocolIdType {
         ProtocolIdNone,     //!< Marker representing non-existent protocol id
@@ -114,6 +127,9 @@ public:
     AbstractProtocol(StreamBase *stream, AbstractProtocol *parent = 0);
     virtual ~AbstractProtocol();
 
+    static void* operator new(size_t size);
+    static void operator delete(void *ptr, size_t size);
+
     static AbstractProtocol* createInstance(StreamBase *stream,
         AbstractProtocol *parent = 0);
     virtual quint32 protocolNumber() const;
@@ -141,20 +157,32 @@ public:
         FieldAttrib attrib = FieldValue);
     int fieldFrameBitOffset(int index, int streamIndex = 0) const;
 
+    virtual void updateFrameLayout();
+    const QVector<FieldLayout>* frameLayout() const;
+    const QByteArray* constantFrameValue() const {
+        return _hasConstantFrameValue ? &_constantFrameValue : NULL;
+    }
+
     int variableFieldCount() const;
     void appendVariableField(const OstProto::VariableField &vf);
     void removeVariableField(int index);
     const OstProto::VariableField& variableField(int index) const;
     OstProto::VariableField* mutableVariableField(int index);
+    void variableFieldValues(int index, int firstFrame, int count,
+                             quint64 *values, quint64 *valuesHi = 0) const;
 
     QByteArray protocolFrameValue(int streamIndex = 0,
         bool forCksum = false) const;
+    virtual int writeFrameValue(uchar *buf, int bufSize,
+        int streamIndex = 0, bool forCksum = false) const;
     virtual int protocolFrameSize(int streamIndex = 0) const;
     int protocolFrameOffset(int streamIndex = 0) const;
     int protocolFramePayloadSize(int streamIndex = 0) const;
 
     virtual bool isProtocolFrameValueVariable() const;
     virtual bool isProtocolFrameSizeVariable() const;
+    virtual bool isProtocolFrameValueDependent() const;
+    virtual bool isProtocolFrameValueRandom() const;
     virtual int protocolFrameVariableCount() const;
     bool isProtocolFramePayloadValueVariable() const;
     bool isProtocolFramePayloadSizeVariable() const;
@@ -170,13 +198,36 @@ public:
     quint32 protocolFramePayloadCksum(int streamIndex = 0,
         CksumType cksumType = CksumIp,
         CksumScope cksumScope = CksumScopeAllProtocols) const;
+    bool isCksumOffloaded(CksumType cksumType) const;
+    virtual int deferredCksumOffset() const;
 
     static quint64 lcm(quint64 u, quint64 v);
     static quint64 gcd(quint64 u, quint64 v);
 
+protected:
+    bool hasVariableFieldAt(int offset, int size) const;
+    void varyProtocolFrameValue(uchar *buf, int bufSize, int frameIndex) const;
+
+    // Generator for the random values of field (one of the protocol's
+    // field ids) in frame streamIndex
+    Pcg32 random(int streamIndex, quint32 field) const;
+
 private:
+    QVector<FieldLayout> _frameLayout;
+    QVector<int> _fieldBitOffset;   //!< -1 for fields not in the frame
+    bool _hasFrameLayout;
+
+    //! Memoized frame value (and its checksum) of a protocol whose
+    //! value is the same for every frame - see updateFrameLayout()
+    QByteArray _constantFrameValue;
+    quint32 _constantFrameCksum;
+    bool _hasConstantFrameValue;
+
     void varyProtocolFrameValue(QByteArray &buf, int frameIndex,
                                 const OstProto::VariableField &varField) const;
+    void variableFieldValues(const OstProto::VariableField &varField,
+                             int firstFrame, int count,
+                             quint64 *values, quint64 *valuesHi) const;
 };
 Q_DECLARE_OPERATORS_FOR_FLAGS(AbstractProtocol::FieldFlags);
 #endif
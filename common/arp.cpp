@@ -346,7 +346,8 @@ QVariant ArpProtocol::fieldData(int index, FieldAttrib attrib,
                 case OstProto::Arp::kRandomHost:
                     subnet = data.sender_proto_addr() 
                             & data.sender_proto_addr_mask();
-                    host = (qrand() & ~data.sender_proto_addr_mask());
+                    host = (random(streamIndex, arp_senderProtoAddr).next()
+                            & ~data.sender_proto_addr_mask());
                     protoAddr = subnet | host;
                     break;
                 default:
@@ -454,7 +455,8 @@ QVariant ArpProtocol::fieldData(int index, FieldAttrib attrib,
                 case OstProto::Arp::kRandomHost:
                     subnet = data.target_proto_addr() 
                             & data.target_proto_addr_mask();
-                    host = (qrand() & ~data.target_proto_addr_mask());
+                    host = (random(streamIndex, arp_targetProtoAddr).next()
+                            & ~data.target_proto_addr_mask());
                     protoAddr = subnet | host;
                     break;
                 default:
@@ -808,3 +810,10 @@ int ArpProtocol::protocolFrameVariableCount() const
 
     return count;
 }
+
+bool ArpProtocol::isProtocolFrameValueRandom() const
+{
+    return (AbstractProtocol::isProtocolFrameValueRandom()
+            || (data.sender_proto_addr_mode() == OstProto::Arp::kRandomHost)
+            || (data.target_proto_addr_mode() == OstProto::Arp::kRandomHost));
+}
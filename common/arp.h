@@ -94,6 +94,7 @@ public:
             FieldAttrib attrib = FieldValue);
 
     virtual int protocolFrameVariableCount() const;
+    virtual bool isProtocolFrameValueRandom() const;
 
 private:
     OstProto::Arp    data;
@@ -0,0 +1,205 @@
+/*
+Copyright (C) 2017 Srivats P.
+
+
+This file is part of "Ostinato"
+
+This is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+#include "cksum.h"
+
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define CKSUM_X86
+#include <immintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define CKSUM_NEON
+#include <arm_neon.h>
+#endif
+
+/*
+ * The vector kernels add 16-bit words into 32-bit lanes - max 2 words per
+ * lane per block; the lanes are flushed to the 64-bit sum before they can
+ * overflow
+ */
+static const uint kMaxBlocks = 32768;
+
+typedef quint64 (*SumFunc)(const quint8 *buffer, uint length);
+
+static inline quint16 fold(quint64 sum)
+{
+    while (sum >> 16)
+        sum = (sum & 0xFFFF) + (sum >> 16);
+
+    return quint16(sum);
+}
+
+static quint64 sumScalar(const quint8 *buffer, uint length)
+{
+    quint64 sum = 0;
+
+    // 2^16 == 1 for a ones complement sum, so summing 32-bit words is
+    // the same as summing 16-bit words
+    while (length >= 4) {
+        quint32 word;
+
+        memcpy(&word, buffer, 4);
+        sum += word;
+        buffer += 4;
+        length -= 4;
+    }
+
+    if (length >= 2) {
+        quint16 word;
+
+        memcpy(&word, buffer, 2);
+        sum += word;
+        buffer += 2;
+        length -= 2;
+    }
+
+    if (length)
+        sum += *buffer;
+
+    return sum;
+}
+
+#if defined(CKSUM_X86)
+__attribute__((target("sse2")))
+static quint64 sumSse2(const quint8 *buffer, uint length)
+{
+    const __m128i zero = _mm_setzero_si128();
+    quint64 sum = 0;
+
+    while (length >= 16) {
+        uint blocks = qMin(length/16, kMaxBlocks);
+        __m128i acc = zero;
+        quint32 lane[4];
+
+        for (uint i = 0; i < blocks; i++) {
+            __m128i v = _mm_loadu_si128((const __m128i*) buffer);
+
+            acc = _mm_add_epi32(acc, _mm_unpacklo_epi16(v, zero));
+            acc = _mm_add_epi32(acc, _mm_unpackhi_epi16(v, zero));
+            buffer += 16;
+        }
+        length -= blocks*16;
+
+        _mm_storeu_si128((__m128i*) lane, acc);
+        sum += quint64(lane[0]) + lane[1] + lane[2] + lane[3];
+    }
+
+    return sum + sumScalar(buffer, length);
+}
+
+__attribute__((target("avx2")))
+static quint64 sumAvx2(const quint8 *buffer, uint length)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    quint64 sum = 0;
+
+    while (length >= 32) {
+        uint blocks = qMin(length/32, kMaxBlocks);
+        __m256i acc = zero;
+        quint32 lane[8];
+
+        for (uint i = 0; i < blocks; i++) {
+            __m256i v = _mm256_loadu_si256((const __m256i*) buffer);
+
+            acc = _mm256_add_epi32(acc, _mm256_unpacklo_epi16(v, zero));
+            acc = _mm256_add_epi32(acc, _mm256_unpackhi_epi16(v, zero));
+            buffer += 32;
+        }
+        length -= blocks*32;
+
+        _mm256_storeu_si256((__m256i*) lane, acc);
+        for (int i = 0; i < 8; i++)
+            sum += lane[i];
+    }
+
+    return sum + sumScalar(buffer, length);
+}
+#endif
+
+#if defined(CKSUM_NEON)
+static quint64 sumNeon(const quint8 *buffer, uint length)
+{
+    quint64 sum = 0;
+
+    while (length >= 16) {
+        uint blocks = qMin(length/16, kMaxBlocks);
+        uint32x4_t acc = vdupq_n_u32(0);
+
+        for (uint i = 0; i < blocks; i++) {
+            uint16x8_t v = vreinterpretq_u16_u8(vld1q_u8(buffer));
+
+            acc = vpadalq_u16(acc, v);
+            buffer += 16;
+        }
+        length -= blocks*16;
+
+        sum += quint64(vgetq_lane_u32(acc, 0)) + vgetq_lane_u32(acc, 1)
+                + vgetq_lane_u32(acc, 2) + vgetq_lane_u32(acc, 3);
+    }
+
+    return sum + sumScalar(buffer, length);
+}
+#endif
+
+static const char *sumKernel = "scalar";
+
+static SumFunc selectSumFunc()
+{
+#if defined(CKSUM_X86)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        sumKernel = "avx2";
+        return sumAvx2;
+    }
+    if (__builtin_cpu_supports("sse2")) {
+        sumKernel = "sse2";
+        return sumSse2;
+    }
+#elif defined(CKSUM_NEON)
+    sumKernel = "neon";
+    return sumNeon;
+#endif
+    return sumScalar;
+}
+
+static SumFunc sumFunc = NULL;
+
+quint16 onesComplementSum(const quint8 *buffer, uint length)
+{
+    // Benign race - all threads select the same kernel
+    if (!sumFunc)
+        sumFunc = selectSumFunc();
+
+    return fold(sumFunc(buffer, length));
+}
+
+quint16 onesComplementSumScalar(const quint8 *buffer, uint length)
+{
+    return fold(sumScalar(buffer, length));
+}
+
+const char* onesComplementSumKernel()
+{
+    if (!sumFunc)
+        sumFunc = selectSumFunc();
+
+    return sumKernel;
+}
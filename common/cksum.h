@@ -0,0 +1,42 @@
+/*
+Copyright (C) 2017 Srivats P.
+
+
+This file is part of "Ostinato"
+
+This is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+#ifndef _CKSUM_H
+#define _CKSUM_H
+
+#include <QtGlobal>
+
+/*
+ * Returns the 16-bit ones complement sum (not complemented) of the buffer
+ *
+ * The buffer is summed as 16-bit words in host byte order, so the caller
+ * needs to take care of byte order as with any ones complement sum. A
+ * trailing odd byte is added as is.
+ *
+ * Uses a vectorized kernel (SSE2/AVX2 or NEON) selected at runtime, if
+ * available - onesComplementSumScalar() is the reference implementation
+ */
+quint16 onesComplementSum(const quint8 *buffer, uint length);
+quint16 onesComplementSumScalar(const quint8 *buffer, uint length);
+
+// Name of the kernel used by onesComplementSum() e.g. "avx2"
+const char* onesComplementSumKernel();
+
+#endif
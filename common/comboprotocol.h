@@ -22,6 +22,14 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 
 #include "abstractprotocol.h"
 
+/*
+  Combines ProtoA followed by ProtoB as one protocol
+
+  protoA and protoB are always of exactly ProtoA and ProtoB, so the calls
+  that are made per field or per frame are qualified with the class -
+  the compiler calls (and can inline) the right one directly instead of
+  via the vtable
+*/
 template <int protoNumber, class ProtoA, class ProtoB>
 class ComboProtocol : public AbstractProtocol
 {
@@ -107,29 +115,30 @@ public:
 
     virtual int    fieldCount() const
     {
-        return protoA->fieldCount() + protoB->fieldCount();
+        return protoA->ProtoA::fieldCount() + protoB->ProtoB::fieldCount();
     }
     //virtual int    metaFieldCount() const;
     //int    frameFieldCount() const;
 
     virtual FieldFlags fieldFlags(int index) const
     {
-        int cnt = protoA->fieldCount();
+        int cnt = protoA->ProtoA::fieldCount();
 
         if (index < cnt)
-            return protoA->fieldFlags(index);
+            return protoA->ProtoA::fieldFlags(index);
         else
-            return protoB->fieldFlags(index - cnt);
+            return protoB->ProtoB::fieldFlags(index - cnt);
     }
     virtual QVariant fieldData(int index, FieldAttrib attrib,
         int streamIndex = 0) const
     {
-        int cnt = protoA->fieldCount();
+        int cnt = protoA->ProtoA::fieldCount();
 
         if (index < cnt)
-            return protoA->fieldData(index, attrib, streamIndex);
+            return protoA->ProtoA::fieldData(index, attrib, streamIndex);
         else
-            return protoB->fieldData(index - cnt, attrib, streamIndex);
+            return protoB->ProtoB::fieldData(index - cnt, attrib,
+                                             streamIndex);
     }
     virtual bool setFieldData(int index, const QVariant &value, 
         FieldAttrib attrib = FieldValue)
@@ -142,10 +151,36 @@ public:
             return protoB->setFieldData(index - cnt, value, attrib);
     }
 
+    /*!
+      Writes protoA and then protoB with their own (fast path)
+      writeFrameValue() - instead of the default which builds the frame
+      value field by field through fieldData(); the combo's own variable
+      fields, if any, are applied over both
+    */
+    virtual int writeFrameValue(uchar *buf, int bufSize,
+        int streamIndex = 0, bool forCksum = false) const
+    {
+        int size = protoA->ProtoA::writeFrameValue(buf, bufSize,
+                                                   streamIndex, forCksum);
+
+        if (size < bufSize)
+            size += protoB->ProtoB::writeFrameValue(buf + size,
+                                bufSize - size, streamIndex, forCksum);
+        else
+            size += protoB->ProtoB::protocolFrameSize(streamIndex);
+
+        varyProtocolFrameValue(buf, qMin(size, bufSize), streamIndex);
+
+        return size;
+    }
+    virtual int protocolFrameSize(int streamIndex = 0) const
+    {
+        return protoA->ProtoA::protocolFrameSize(streamIndex)
+                + protoB->ProtoB::protocolFrameSize(streamIndex);
+    }
 #if 0
     QByteArray protocolFrameValue(int streamIndex = 0,
         bool forCksum = false) const;
-    virtual int protocolFrameSize() const;
     int protocolFrameOffset() const;
     int protocolFramePayloadSize() const;
 #endif
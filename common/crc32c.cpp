@@ -25,9 +25,22 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 
 #include "crc32c.h"
 
+#include <QtEndian>
+#include <string.h>
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define CRC32C_X86
+#include <nmmintrin.h>
+#elif defined(__GNUC__) && defined(__aarch64__) && defined(__linux__)
+#define CRC32C_ARM
+#include <arm_acle.h>
+#include <asm/hwcap.h>
+#include <sys/auxv.h>
+#endif
+
 #define CRC32C(c,d) (c=(c>>8)^crc_c[(c^(d))&0xFF])
 
-quint32 crc_c[256] =
+static quint32 crc_c[256] =
 {
     0x00000000L, 0xF26B8303L, 0xE13B70F7L, 0x1350F3F4L,
     0xC79A971FL, 0x35F1141CL, 0x26A1E7E8L, 0xD4CA64EBL,
@@ -95,18 +108,271 @@ quint32 crc_c[256] =
     0xBE2DA0A5L, 0x4C4623A6L, 0x5F16D052L, 0xAD7D5351L,
 };
 
-quint32 checksumCrc32C(quint8 *buffer, uint length)
+typedef quint32 (*CrcFunc)(quint32 crc, const quint8 *buffer, uint length);
+
+// crc is the pre-conditioned (inverted) value for all the kernels
+static quint32 crcScalar(quint32 crc, const quint8 *buffer, uint length)
+{
+    for (uint i = 0; i < length; i++) {
+        CRC32C(crc, buffer[i]);
+    }
+
+    return crc;
+}
+
+#if defined(CRC32C_X86) || defined(CRC32C_ARM)
+/*
+ * The hardware CRC instruction has a latency of 3 cycles but a throughput
+ * of 1 per cycle, so the kernels run 3 independent CRCs over consecutive
+ * blocks of a 3-block stripe and combine them - a block's CRC is combined
+ * with the next by "shifting" it over a block's worth of zeros using the
+ * tables below and xor'ing (see Mark Adler's crc32c.c)
+ */
+static const uint kLongBlock = 8192;
+static const uint kShortBlock = 256;
+static const quint32 kPoly = 0x82f63b78; // reflected
+
+static quint32 crcLongShift[4][256];
+static quint32 crcShortShift[4][256];
+
+static quint32 gf2MatrixTimes(const quint32 *mat, quint32 vec)
+{
+    quint32 sum = 0;
+
+    while (vec) {
+        if (vec & 1)
+            sum ^= *mat;
+        vec >>= 1;
+        mat++;
+    }
+    return sum;
+}
+
+static void gf2MatrixSquare(quint32 *square, const quint32 *mat)
+{
+    for (int n = 0; n < 32; n++)
+        square[n] = gf2MatrixTimes(mat, mat[n]);
+}
+
+// Builds the tables to shift a crc over len (a power of 2) zero bytes
+static void crcShiftTables(quint32 shift[4][256], uint len)
+{
+    quint32 even[32], odd[32];
+    quint32 row = 1;
+
+    // operator for one zero bit in odd
+    odd[0] = kPoly;
+    for (int n = 1; n < 32; n++) {
+        odd[n] = row;
+        row <<= 1;
+    }
+
+    gf2MatrixSquare(even, odd); // two zero bits
+    gf2MatrixSquare(odd, even); // four zero bits
+
+    // successive squares - one zero byte, two zero bytes ...
+    forever {
+        gf2MatrixSquare(even, odd);
+        len >>= 1;
+        if (!len) {
+            memcpy(odd, even, sizeof(odd));
+            break;
+        }
+        gf2MatrixSquare(odd, even);
+        len >>= 1;
+        if (!len)
+            break;
+    }
+
+    for (quint32 n = 0; n < 256; n++) {
+        shift[0][n] = gf2MatrixTimes(odd, n);
+        shift[1][n] = gf2MatrixTimes(odd, n << 8);
+        shift[2][n] = gf2MatrixTimes(odd, n << 16);
+        shift[3][n] = gf2MatrixTimes(odd, n << 24);
+    }
+}
+
+static inline quint32 crcShift(quint32 shift[4][256], quint32 crc)
+{
+    return shift[0][crc & 0xff] ^ shift[1][(crc >> 8) & 0xff]
+        ^ shift[2][(crc >> 16) & 0xff] ^ shift[3][crc >> 24];
+}
+
+static inline quint64 load64(const quint8 *p)
+{
+    quint64 v;
+
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+#endif
+
+#if defined(CRC32C_X86)
+__attribute__((target("sse4.2")))
+static quint32 crcSse42(quint32 crc, const quint8 *buffer, uint length)
+{
+    quint64 crc0 = crc, crc1, crc2;
+
+    // Upto 7 leading bytes to align the buffer
+    while (length && (quintptr(buffer) & 7)) {
+        crc0 = _mm_crc32_u8(quint32(crc0), *buffer++);
+        length--;
+    }
+
+    while (length >= 3*kLongBlock) {
+        const quint8 *end = buffer + kLongBlock;
+
+        crc1 = crc2 = 0;
+        do {
+            crc0 = _mm_crc32_u64(crc0, load64(buffer));
+            crc1 = _mm_crc32_u64(crc1, load64(buffer + kLongBlock));
+            crc2 = _mm_crc32_u64(crc2, load64(buffer + 2*kLongBlock));
+            buffer += 8;
+        } while (buffer < end);
+        crc0 = crcShift(crcLongShift, quint32(crc0)) ^ quint32(crc1);
+        crc0 = crcShift(crcLongShift, quint32(crc0)) ^ quint32(crc2);
+        buffer += 2*kLongBlock;
+        length -= 3*kLongBlock;
+    }
+
+    while (length >= 3*kShortBlock) {
+        const quint8 *end = buffer + kShortBlock;
+
+        crc1 = crc2 = 0;
+        do {
+            crc0 = _mm_crc32_u64(crc0, load64(buffer));
+            crc1 = _mm_crc32_u64(crc1, load64(buffer + kShortBlock));
+            crc2 = _mm_crc32_u64(crc2, load64(buffer + 2*kShortBlock));
+            buffer += 8;
+        } while (buffer < end);
+        crc0 = crcShift(crcShortShift, quint32(crc0)) ^ quint32(crc1);
+        crc0 = crcShift(crcShortShift, quint32(crc0)) ^ quint32(crc2);
+        buffer += 2*kShortBlock;
+        length -= 3*kShortBlock;
+    }
+
+    while (length >= 8) {
+        crc0 = _mm_crc32_u64(crc0, load64(buffer));
+        buffer += 8;
+        length -= 8;
+    }
+
+    while (length--)
+        crc0 = _mm_crc32_u8(quint32(crc0), *buffer++);
+
+    return quint32(crc0);
+}
+#endif
+
+#if defined(CRC32C_ARM)
+__attribute__((target("+crc")))
+static quint32 crcArm(quint32 crc, const quint8 *buffer, uint length)
 {
-    uint i;
-    quint32 crc32 = ~0L;
-    quint32 result;
-    quint8 byte0,byte1,byte2,byte3;
+    quint32 crc0 = crc, crc1, crc2;
 
-    for (i = 0; i < length; i++) {
-        CRC32C(crc32, buffer[i]);
+    // Upto 7 leading bytes to align the buffer
+    while (length && (quintptr(buffer) & 7)) {
+        crc0 = __crc32cb(crc0, *buffer++);
+        length--;
     }
 
-    result = ~crc32;
+    while (length >= 3*kLongBlock) {
+        const quint8 *end = buffer + kLongBlock;
+
+        crc1 = crc2 = 0;
+        do {
+            crc0 = __crc32cd(crc0, load64(buffer));
+            crc1 = __crc32cd(crc1, load64(buffer + kLongBlock));
+            crc2 = __crc32cd(crc2, load64(buffer + 2*kLongBlock));
+            buffer += 8;
+        } while (buffer < end);
+        crc0 = crcShift(crcLongShift, crc0) ^ crc1;
+        crc0 = crcShift(crcLongShift, crc0) ^ crc2;
+        buffer += 2*kLongBlock;
+        length -= 3*kLongBlock;
+    }
+
+    while (length >= 3*kShortBlock) {
+        const quint8 *end = buffer + kShortBlock;
+
+        crc1 = crc2 = 0;
+        do {
+            crc0 = __crc32cd(crc0, load64(buffer));
+            crc1 = __crc32cd(crc1, load64(buffer + kShortBlock));
+            crc2 = __crc32cd(crc2, load64(buffer + 2*kShortBlock));
+            buffer += 8;
+        } while (buffer < end);
+        crc0 = crcShift(crcShortShift, crc0) ^ crc1;
+        crc0 = crcShift(crcShortShift, crc0) ^ crc2;
+        buffer += 2*kShortBlock;
+        length -= 3*kShortBlock;
+    }
+
+    while (length >= 8) {
+        crc0 = __crc32cd(crc0, load64(buffer));
+        buffer += 8;
+        length -= 8;
+    }
+
+    while (length--)
+        crc0 = __crc32cb(crc0, *buffer++);
+
+    return crc0;
+}
+#endif
+
+static const char *crcKernel = "scalar";
+
+static CrcFunc selectCrcFunc()
+{
+#if defined(CRC32C_X86)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse4.2")) {
+        crcShiftTables(crcLongShift, kLongBlock);
+        crcShiftTables(crcShortShift, kShortBlock);
+        crcKernel = "sse4.2";
+        return crcSse42;
+    }
+#elif defined(CRC32C_ARM)
+    if (getauxval(AT_HWCAP) & HWCAP_CRC32) {
+        crcShiftTables(crcLongShift, kLongBlock);
+        crcShiftTables(crcShortShift, kShortBlock);
+        crcKernel = "armv8-crc";
+        return crcArm;
+    }
+#endif
+    return crcScalar;
+}
+
+// Selected (and the shift tables built) during static initialization, so
+// before any other thread can use them
+static CrcFunc crcFunc = selectCrcFunc();
+
+quint32 crc32c(quint32 crc, const quint8 *buffer, uint length)
+{
+    // Only if called from another static initializer before ours
+    if (!crcFunc)
+        crcFunc = selectCrcFunc();
+
+    return ~crcFunc(~crc, buffer, length);
+}
+
+quint32 crc32cScalar(quint32 crc, const quint8 *buffer, uint length)
+{
+    return ~crcScalar(~crc, buffer, length);
+}
+
+const char* crc32cKernel()
+{
+    if (!crcFunc)
+        crcFunc = selectCrcFunc();
+
+    return crcKernel;
+}
+
+quint32 checksumCrc32C(const quint8 *buffer, uint length)
+{
+    quint32 result = crc32c(0, buffer, length);
 
     /*  result now holds the negated polynomial remainder;
      *  since the table and algorithm is "reflected" [williams95].
@@ -121,14 +387,5 @@ quint32 checksumCrc32C(quint8 *buffer, uint length)
      *  byteswap.  On a little-endian machine, this byteswap and
      *  the final ntohl cancel out and could be elided.
      */
-
-    byte0 = result & 0xff;
-    byte1 = (result>>8) & 0xff;
-    byte2 = (result>>16) & 0xff;
-    byte3 = (result>>24) & 0xff;
-    crc32 = ((byte0 << 24) |
-            (byte1 << 16) |
-            (byte2 << 8)  |
-            byte3);
-    return ( crc32 );
+    return qbswap(result);
 }
@@ -17,7 +17,26 @@ You should have received a copy of the GNU General Public License
 along with this program.  If not, see <http://www.gnu.org/licenses/>
 */
 
+#ifndef _CRC32C_H
+#define _CRC32C_H
+
 #include <QtGlobal>
 
-quint32 checksumCrc32C(quint8 *buffer, uint length);
+/*
+ * Returns the CRC-32C (Castagnoli) of the buffer, continuing from crc -
+ * the CRC of the preceding data (0 to start with)
+ *
+ * Uses the hardware CRC instruction (SSE4.2 or ARMv8 CRC) selected at
+ * runtime, if available - crc32cScalar() is the reference implementation
+ */
+quint32 crc32c(quint32 crc, const quint8 *buffer, uint length);
+quint32 crc32cScalar(quint32 crc, const quint8 *buffer, uint length);
+
+// Name of the kernel used by crc32c() e.g. "sse4.2"
+const char* crc32cKernel();
+
+// Byte swapped crc32c() of the buffer - as used by the native file format
+quint32 checksumCrc32C(const quint8 *buffer, uint length);
+
+#endif
 
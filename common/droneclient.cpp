@@ -0,0 +1,583 @@
+/*
+Copyright (C) 2017 Srivats P.
+
+This file is part of "Ostinato"
+
+This is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+#include "droneclient.h"
+
+#include "pbrpcchannel.h"
+#include "pbrpccontroller.h"
+
+#include <QTimer>
+#include <google/protobuf/descriptor.h>
+
+extern char *version;
+
+DroneClient::DroneClient(QString host, quint16 port, QObject *parent)
+    : QObject(parent)
+{
+    isReady_ = false;
+    nextRequestId_ = 1;
+
+    statsInterval_ = 1000;
+    isStatsPending_ = false;
+    statsTimer_ = new QTimer(this);
+    connect(statsTimer_, SIGNAL(timeout()), SLOT(pollStats()));
+
+    rpcChannel_ = new PbRpcChannel(host, port,
+                                   OstProto::Notification::default_instance());
+    serviceStub_ = new OstProto::OstService::Stub(rpcChannel_);
+
+    connect(rpcChannel_, SIGNAL(connected()),
+            SLOT(on_rpcChannel_connected()));
+    connect(rpcChannel_, SIGNAL(disconnected()),
+            SLOT(on_rpcChannel_disconnected()));
+    connect(rpcChannel_, SIGNAL(error(QAbstractSocket::SocketError)),
+            SLOT(on_rpcChannel_error()));
+    connect(rpcChannel_,
+            SIGNAL(notification(int, ::google::protobuf::Message*)),
+            SLOT(on_rpcChannel_notification(int,
+                                            ::google::protobuf::Message*)));
+}
+
+DroneClient::~DroneClient()
+{
+    rpcChannel_->tearDown();
+    delete serviceStub_;
+    delete rpcChannel_;
+    qDeleteAll(pendingDeltas_);
+}
+
+void DroneClient::connectToDrone()
+{
+    rpcChannel_->establish();
+}
+
+void DroneClient::disconnectFromDrone()
+{
+    rpcChannel_->tearDown();
+}
+
+const OstProto::Port* DroneClient::portConfig(uint portId) const
+{
+    QHash<uint, OstProto::Port>::const_iterator iter = ports_.find(portId);
+
+    return iter != ports_.constEnd() ? &iter.value() : NULL;
+}
+
+const OstProto::PortStats* DroneClient::portStats(uint portId) const
+{
+    QHash<uint, OstProto::PortStats>::const_iterator iter
+                                                = stats_.find(portId);
+
+    return iter != stats_.constEnd() ? &iter.value() : NULL;
+}
+
+quint32 DroneClient::startTransmit(const QList<uint> &portIds)
+{
+    if (!isReady_)
+        return failRequest("not connected");
+
+    quint32 requestId = nextRequestId_++;
+    OstProto::PortIdList *portIdList = newPortIdList(portIds);
+    OstProto::Ack *ack = new OstProto::Ack;
+    PbRpcController *controller = new PbRpcController(portIdList, ack);
+
+    serviceStub_->startTransmit(controller, portIdList, ack,
+            NewCallback(this, &DroneClient::processAck, requestId,
+                        controller));
+
+    return requestId;
+}
+
+quint32 DroneClient::stopTransmit(const QList<uint> &portIds)
+{
+    if (!isReady_)
+        return failRequest("not connected");
+
+    quint32 requestId = nextRequestId_++;
+    OstProto::PortIdList *portIdList = newPortIdList(portIds);
+    OstProto::Ack *ack = new OstProto::Ack;
+    PbRpcController *controller = new PbRpcController(portIdList, ack);
+
+    serviceStub_->stopTransmit(controller, portIdList, ack,
+            NewCallback(this, &DroneClient::processAck, requestId,
+                        controller));
+
+    return requestId;
+}
+
+quint32 DroneClient::startCapture(const QList<uint> &portIds)
+{
+    if (!isReady_)
+        return failRequest("not connected");
+
+    quint32 requestId = nextRequestId_++;
+    OstProto::PortIdList *portIdList = newPortIdList(portIds);
+    OstProto::Ack *ack = new OstProto::Ack;
+    PbRpcController *controller = new PbRpcController(portIdList, ack);
+
+    serviceStub_->startCapture(controller, portIdList, ack,
+            NewCallback(this, &DroneClient::processAck, requestId,
+                        controller));
+
+    return requestId;
+}
+
+quint32 DroneClient::stopCapture(const QList<uint> &portIds)
+{
+    if (!isReady_)
+        return failRequest("not connected");
+
+    quint32 requestId = nextRequestId_++;
+    OstProto::PortIdList *portIdList = newPortIdList(portIds);
+    OstProto::Ack *ack = new OstProto::Ack;
+    PbRpcController *controller = new PbRpcController(portIdList, ack);
+
+    serviceStub_->stopCapture(controller, portIdList, ack,
+            NewCallback(this, &DroneClient::processAck, requestId,
+                        controller));
+
+    return requestId;
+}
+
+quint32 DroneClient::clearStats(const QList<uint> &portIds)
+{
+    if (!isReady_)
+        return failRequest("not connected");
+
+    quint32 requestId = nextRequestId_++;
+    OstProto::PortIdList *portIdList = newPortIdList(portIds);
+    OstProto::Ack *ack = new OstProto::Ack;
+    PbRpcController *controller = new PbRpcController(portIdList, ack);
+
+    serviceStub_->clearStats(controller, portIdList, ack,
+            NewCallback(this, &DroneClient::processAck, requestId,
+                        controller));
+
+    return requestId;
+}
+
+/*!
+  Replaces all streams of the port with the given streams
+
+  The port's current stream ids are fetched first and then the deletes
+  and adds are sent as a single applyPortConfig; the stream ids in
+  streams are used as is
+*/
+quint32 DroneClient::setStreams(uint portId,
+                                const QList<OstProto::Stream> &streams)
+{
+    if (!isReady_)
+        return failRequest("not connected");
+
+    quint32 requestId = nextRequestId_++;
+    OstProto::PortConfigDelta *delta = new OstProto::PortConfigDelta;
+
+    delta->mutable_port_id()->set_id(portId);
+    for (int i = 0; i < streams.size(); i++)
+        delta->add_new_stream()->CopyFrom(streams.at(i));
+    pendingDeltas_.insert(requestId, delta);
+
+    OstProto::PortId *portId_ = new OstProto::PortId;
+    OstProto::StreamIdList *streamIdList = new OstProto::StreamIdList;
+    PbRpcController *controller = new PbRpcController(portId_, streamIdList);
+
+    portId_->set_id(portId);
+    serviceStub_->getStreamIdList(controller, portId_, streamIdList,
+            NewCallback(this, &DroneClient::processStreamIdList, requestId,
+                        controller));
+
+    return requestId;
+}
+
+quint32 DroneClient::applyPortConfig(const OstProto::PortConfigDelta &delta)
+{
+    if (!isReady_)
+        return failRequest("not connected");
+
+    quint32 requestId = nextRequestId_++;
+    OstProto::PortConfigDelta *portConfigDelta = new OstProto::PortConfigDelta;
+    OstProto::Ack *ack = new OstProto::Ack;
+    PbRpcController *controller = new PbRpcController(portConfigDelta, ack);
+
+    portConfigDelta->CopyFrom(delta);
+    serviceStub_->applyPortConfig(controller, portConfigDelta, ack,
+            NewCallback(this, &DroneClient::processAck, requestId,
+                        controller));
+
+    return requestId;
+}
+
+/*!
+  Sets the ports whose stats are kept (and statsChanged() emitted for)
+  and how often; an empty list stops the stats
+*/
+void DroneClient::setStatsInterval(const QList<uint> &portIds, int msecs)
+{
+    statsInterval_ = msecs;
+    statsPortIdList_.Clear();
+    for (int i = 0; i < portIds.size(); i++)
+        statsPortIdList_.add_port_id()->set_id(portIds.at(i));
+
+    statsTimer_->stop();
+    if (!isReady_)
+        return;
+
+    OstProto::StatsSubscription *subscription = new OstProto::StatsSubscription;
+    OstProto::Ack *ack = new OstProto::Ack;
+    PbRpcController *controller = new PbRpcController(subscription, ack);
+
+    subscription->mutable_port_id()->MergeFrom(statsPortIdList_.port_id());
+    subscription->set_interval_msec(statsInterval_);
+    serviceStub_->subscribeStats(controller, subscription, ack,
+            NewCallback(this, &DroneClient::processStatsSubscription,
+                        controller));
+}
+
+// ------------------------------------------------
+//                      Slots
+// ------------------------------------------------
+void DroneClient::on_rpcChannel_connected()
+{
+    OstProto::VersionInfo *verInfo = new OstProto::VersionInfo;
+    OstProto::VersionCompatibility *verCompat =
+            new OstProto::VersionCompatibility;
+    PbRpcController *controller = new PbRpcController(verInfo, verCompat);
+
+    verInfo->set_client_name("ostinato");
+    verInfo->set_version(version);
+    verInfo->set_rpc_pipelining(true);
+    verInfo->set_rpc_compression(true);
+
+    serviceStub_->checkVersion(controller, verInfo, verCompat,
+            NewCallback(this, &DroneClient::processVersionCompatibility,
+                        controller));
+}
+
+void DroneClient::on_rpcChannel_disconnected()
+{
+    bool wasReady = isReady_;
+
+    isReady_ = false;
+    isStatsPending_ = false;
+    statsTimer_->stop();
+    portIds_.clear();
+    ports_.clear();
+    stats_.clear();
+
+    // The callbacks of the RPCs in flight are not called anymore
+    qDeleteAll(pendingDeltas_);
+    pendingDeltas_.clear();
+
+    if (wasReady)
+        emit disconnected();
+}
+
+void DroneClient::on_rpcChannel_error()
+{
+    if (!isReady_)
+        emit failed(QString("unable to connect to drone at %1:%2")
+                        .arg(rpcChannel_->serverName())
+                        .arg(rpcChannel_->serverPort()));
+}
+
+void DroneClient::on_rpcChannel_notification(int notifType,
+        ::google::protobuf::Message *notification)
+{
+    OstProto::Notification *notif =
+        dynamic_cast<OstProto::Notification*>(notification);
+
+    if (!notif || (notifType != notif->notif_type()))
+        return;
+
+    switch (notifType)
+    {
+        case OstProto::portConfigChanged:
+            if (notif->port_id_list().port_id_size())
+                getPortConfig(notif->port_id_list(), false);
+            break;
+
+        case OstProto::portStatsChanged: {
+            const OstProto::PortStatsList &list = notif->port_stats_list();
+
+            // Only the changed stats - merged into what we have; repeated
+            // fields, if present, are in full and the fields that went
+            // away are listed in cleared_field
+            for (int i = 0; i < list.port_stats_size(); i++) {
+                const OstProto::PortStats &delta = list.port_stats(i);
+                OstProto::PortStats &stats = stats_[delta.port_id().id()];
+
+                if (delta.filter_count_size())
+                    stats.clear_filter_count();
+                if (delta.nic_counter_size())
+                    stats.clear_nic_counter();
+                for (int j = 0; j < delta.cleared_field_size(); j++) {
+                    const google::protobuf::FieldDescriptor *f =
+                        stats.GetDescriptor()->FindFieldByNumber(
+                                delta.cleared_field(j));
+                    if (f)
+                        stats.GetReflection()->ClearField(&stats, f);
+                }
+                stats.MergeFrom(delta);
+                stats.clear_cleared_field();
+            }
+
+            emit statsChanged();
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+void DroneClient::emitFailedRequests()
+{
+    QList<QPair<quint32, QString> > failedRequests = failedRequests_;
+
+    failedRequests_.clear();
+    for (int i = 0; i < failedRequests.size(); i++)
+        emit requestDone(failedRequests.at(i).first,
+                         failedRequests.at(i).second);
+}
+
+void DroneClient::pollStats()
+{
+    if (!isReady_ || isStatsPending_ || !statsPortIdList_.port_id_size())
+        return;
+
+    OstProto::PortIdList *portIdList = new OstProto::PortIdList;
+    OstProto::PortStatsList *portStatsList = new OstProto::PortStatsList;
+    PbRpcController *controller = new PbRpcController(portIdList,
+                                                      portStatsList);
+
+    portIdList->CopyFrom(statsPortIdList_);
+    isStatsPending_ = true;
+    serviceStub_->getStats(controller, portIdList, portStatsList,
+            NewCallback(this, &DroneClient::processPortStatsList, controller));
+}
+
+// ------------------------------------------------
+//                  RPC Callbacks
+// ------------------------------------------------
+void DroneClient::processVersionCompatibility(PbRpcController *controller)
+{
+    OstProto::VersionCompatibility *verCompat
+        = static_cast<OstProto::VersionCompatibility*>(controller->response());
+
+    if (controller->Failed()) {
+        emit failed(QString("version check failed (%1)")
+                        .arg(controller->ErrorString()));
+        goto _error_exit;
+    }
+
+    if (verCompat->result() == OstProto::VersionCompatibility::kIncompatible) {
+        emit failed(QString("drone is incompatible with version %1 (%2)")
+                        .arg(version)
+                        .arg(QString::fromStdString(verCompat->notes())));
+        rpcChannel_->tearDown();
+        goto _error_exit;
+    }
+
+    // Must be before any other RPC - the framing changes
+    if (verCompat->rpc_pipelining())
+        rpcChannel_->setPipelined(true);
+    if (verCompat->rpc_compression())
+        rpcChannel_->setCompression(true);
+
+    {
+        OstProto::Void *void_ = new OstProto::Void;
+        OstProto::PortIdList *portIdList = new OstProto::PortIdList;
+        PbRpcController *controller = new PbRpcController(void_, portIdList);
+
+        serviceStub_->getPortIdList(controller, void_, portIdList,
+                NewCallback(this, &DroneClient::processPortIdList,
+                            controller));
+    }
+
+_error_exit:
+    delete controller;
+}
+
+void DroneClient::processPortIdList(PbRpcController *controller)
+{
+    OstProto::PortIdList *portIdList
+        = static_cast<OstProto::PortIdList*>(controller->response());
+
+    if (controller->Failed()) {
+        emit failed(QString("unable to get port list (%1)")
+                        .arg(controller->ErrorString()));
+        goto _error_exit;
+    }
+
+    portIds_.clear();
+    for (int i = 0; i < portIdList->port_id_size(); i++)
+        portIds_.append(portIdList->port_id(i).id());
+
+    getPortConfig(*portIdList, true);
+
+_error_exit:
+    delete controller;
+}
+
+void DroneClient::processPortConfigList(bool isInitial,
+                                        PbRpcController *controller)
+{
+    OstProto::PortConfigList *portConfigList
+        = static_cast<OstProto::PortConfigList*>(controller->response());
+
+    if (controller->Failed()) {
+        if (isInitial)
+            emit failed(QString("unable to get port config (%1)")
+                            .arg(controller->ErrorString()));
+        goto _error_exit;
+    }
+
+    for (int i = 0; i < portConfigList->port_size(); i++) {
+        const OstProto::Port &port = portConfigList->port(i);
+
+        // Copy, not merge - the transmit estimate is sent only when valid
+        ports_[port.port_id().id()].CopyFrom(port);
+        if (!isInitial)
+            emit portConfigChanged(port.port_id().id());
+    }
+
+    if (isInitial) {
+        isReady_ = true;
+        if (statsPortIdList_.port_id_size()) {
+            QList<uint> portIds;
+            for (int i = 0; i < statsPortIdList_.port_id_size(); i++)
+                portIds.append(statsPortIdList_.port_id(i).id());
+            setStatsInterval(portIds, statsInterval_);
+        }
+        emit ready();
+    }
+
+_error_exit:
+    delete controller;
+}
+
+void DroneClient::processStreamIdList(quint32 requestId,
+                                      PbRpcController *controller)
+{
+    OstProto::StreamIdList *streamIdList
+        = static_cast<OstProto::StreamIdList*>(controller->response());
+    OstProto::PortConfigDelta *delta = pendingDeltas_.take(requestId);
+
+    if (!delta)
+        goto _exit;
+
+    if (controller->Failed()) {
+        emit requestDone(requestId, controller->ErrorString());
+        delete delta;
+        goto _exit;
+    }
+
+    {
+        OstProto::Ack *ack = new OstProto::Ack;
+        PbRpcController *controller = new PbRpcController(delta, ack);
+
+        delta->mutable_deleted_stream_id()->MergeFrom(
+                streamIdList->stream_id());
+        serviceStub_->applyPortConfig(controller, delta, ack,
+                NewCallback(this, &DroneClient::processAck, requestId,
+                            controller));
+    }
+
+_exit:
+    delete controller;
+}
+
+void DroneClient::processStatsSubscription(PbRpcController *controller)
+{
+    // An older drone doesn't push stats - poll it instead
+    if (controller->Failed() && statsPortIdList_.port_id_size())
+        statsTimer_->start(statsInterval_);
+
+    delete controller;
+}
+
+void DroneClient::processPortStatsList(PbRpcController *controller)
+{
+    OstProto::PortStatsList *portStatsList
+        = static_cast<OstProto::PortStatsList*>(controller->response());
+
+    isStatsPending_ = false;
+
+    if (controller->Failed())
+        goto _error_exit;
+
+    for (int i = 0; i < portStatsList->port_stats_size(); i++)
+        stats_[portStatsList->port_stats(i).port_id().id()].CopyFrom(
+                portStatsList->port_stats(i));
+
+    emit statsChanged();
+
+_error_exit:
+    delete controller;
+}
+
+void DroneClient::processAck(quint32 requestId, PbRpcController *controller)
+{
+    emit requestDone(requestId,
+                     controller->Failed() ? controller->ErrorString()
+                                          : QString());
+    delete controller;
+}
+
+// ------------------------------------------------
+//                  Private
+// ------------------------------------------------
+void DroneClient::getPortConfig(const OstProto::PortIdList &portIdList,
+                                bool isInitial)
+{
+    OstProto::PortIdList *request = new OstProto::PortIdList;
+    OstProto::PortConfigList *portConfigList = new OstProto::PortConfigList;
+    PbRpcController *controller = new PbRpcController(request,
+                                                      portConfigList);
+
+    request->CopyFrom(portIdList);
+    serviceStub_->getPortConfig(controller, request, portConfigList,
+            NewCallback(this, &DroneClient::processPortConfigList, isInitial,
+                        controller));
+}
+
+OstProto::PortIdList* DroneClient::newPortIdList(const QList<uint> &portIds)
+{
+    OstProto::PortIdList *portIdList = new OstProto::PortIdList;
+
+    for (int i = 0; i < portIds.size(); i++)
+        portIdList->add_port_id()->set_id(portIds.at(i));
+
+    return portIdList;
+}
+
+/*!
+  Returns a request id for a request that could not be sent - its
+  requestDone() is emitted (with the error) once control returns to
+  the event loop so that the caller has the id by then
+*/
+quint32 DroneClient::failRequest(QString error)
+{
+    quint32 requestId = nextRequestId_++;
+
+    if (failedRequests_.isEmpty())
+        QTimer::singleShot(0, this, SLOT(emitFailedRequests()));
+    failedRequests_.append(qMakePair(requestId, error));
+
+    return requestId;
+}
@@ -0,0 +1,130 @@
+/*
+Copyright (C) 2017 Srivats P.
+
+This file is part of "Ostinato"
+
+This is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+#ifndef _DRONE_CLIENT_H
+#define _DRONE_CLIENT_H
+
+#include "protocol.pb.h"
+
+#include <QHash>
+#include <QList>
+#include <QObject>
+#include <QPair>
+#include <QString>
+
+class PbRpcChannel;
+class PbRpcController;
+class QTimer;
+
+/*!
+  Headless client of a drone - for automation that drives many ports
+  without the GUI
+
+  All operations are asynchronous - each returns a request id right away
+  and requestDone() is emitted with the same id once drone has responded.
+  Operations on many ports are sent as a single RPC and, with a drone
+  that supports RPC pipelining, many RPCs are in flight at once; so
+  operations should be issued back to back rather than one after the
+  other's requestDone()
+
+  Needs a drone that supports applyPortConfig (for setStreams())
+*/
+class DroneClient : public QObject
+{
+    Q_OBJECT
+public:
+    DroneClient(QString host, quint16 port = 7878, QObject *parent = 0);
+    ~DroneClient();
+
+    void connectToDrone();
+    void disconnectFromDrone();
+    // Connected, compatible and the port configs fetched
+    bool isReady() const { return isReady_; }
+
+    QList<uint> portIds() const { return portIds_; }
+    const OstProto::Port* portConfig(uint portId) const;
+    const OstProto::PortStats* portStats(uint portId) const;
+
+    quint32 startTransmit(const QList<uint> &portIds);
+    quint32 stopTransmit(const QList<uint> &portIds);
+    quint32 startCapture(const QList<uint> &portIds);
+    quint32 stopCapture(const QList<uint> &portIds);
+    quint32 clearStats(const QList<uint> &portIds);
+
+    quint32 setStreams(uint portId, const QList<OstProto::Stream> &streams);
+    quint32 applyPortConfig(const OstProto::PortConfigDelta &delta);
+
+    void setStatsInterval(const QList<uint> &portIds, int msecs);
+
+signals:
+    void ready();
+    void disconnected();
+    // Connect or version check failed
+    void failed(QString error);
+    // error is empty on success
+    void requestDone(quint32 requestId, QString error);
+    void portConfigChanged(uint portId);
+    void statsChanged();
+
+private slots:
+    void on_rpcChannel_connected();
+    void on_rpcChannel_disconnected();
+    void on_rpcChannel_error();
+    void on_rpcChannel_notification(int notifType,
+                                    ::google::protobuf::Message *notif);
+    void pollStats();
+    void emitFailedRequests();
+
+private:
+    void processVersionCompatibility(PbRpcController *controller);
+    void processPortIdList(PbRpcController *controller);
+    void processPortConfigList(bool isInitial, PbRpcController *controller);
+    void processStreamIdList(quint32 requestId, PbRpcController *controller);
+    void processStatsSubscription(PbRpcController *controller);
+    void processPortStatsList(PbRpcController *controller);
+    void processAck(quint32 requestId, PbRpcController *controller);
+
+    void getPortConfig(const OstProto::PortIdList &portIdList,
+                       bool isInitial);
+    OstProto::PortIdList* newPortIdList(const QList<uint> &portIds);
+    quint32 failRequest(QString error);
+
+    PbRpcChannel *rpcChannel_;
+    OstProto::OstService::Stub *serviceStub_;
+
+    bool isReady_;
+    quint32 nextRequestId_;
+    QList<uint> portIds_;
+    QHash<uint, OstProto::Port> ports_;
+    QHash<uint, OstProto::PortStats> stats_;
+
+    // Streams of setStreams() waiting for the port's current stream ids
+    QHash<quint32, OstProto::PortConfigDelta*> pendingDeltas_;
+
+    // Requests that could not be sent, pending their requestDone()
+    QList<QPair<quint32, QString> > failedRequests_;
+
+    // Older drones don't push stats - those are polled
+    QTimer *statsTimer_;
+    OstProto::PortIdList statsPortIdList_;
+    int statsInterval_;
+    bool isStatsPending_;
+};
+
+#endif
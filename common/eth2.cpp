@@ -186,3 +186,19 @@ bool Eth2Protocol::setFieldData(int index, const QVariant &value,
     }
     return isOk;
 }
+
+int Eth2Protocol::writeFrameValue(uchar *buf, int bufSize,
+        int streamIndex, bool forCksum) const
+{
+    if (bufSize < 2)
+        return AbstractProtocol::writeFrameValue(buf, bufSize,
+                                                 streamIndex, forCksum);
+
+    quint16 type = data.is_override_type() ?
+        data.type() : payloadProtocolId(ProtocolIdEth);
+
+    qToBigEndian(type, buf);
+
+    varyProtocolFrameValue(buf, 2, streamIndex);
+    return 2;
+}
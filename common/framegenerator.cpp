@@ -0,0 +1,298 @@
+/*
+Copyright (C) 2017 Srivats P.
+
+
+This file is part of "Ostinato"
+
+This is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+
+#include "framegenerator.h"
+
+#include "streambase.h"
+
+#include <string.h>
+
+StreamFrameGenerator::StreamFrameGenerator(const StreamBase *stream,
+        quint64 count, quint64 burstSize, double burstGapNsec,
+        quint64 first, quint64 stride)
+    : stream_(stream), template_(stream)
+{
+    frameVariableCount_ = qMax(stream->frameVariableCount(), 1);
+    count_ = count;
+    burstSize_ = qMax(burstSize, quint64(1));
+    burstGapNsec_ = burstGapNsec;
+    first_ = first;
+    stride_ = qMax(stride, quint64(1));
+    index_ = first_;
+
+    // Offsets computed upfront so that nsecOffset() is still random access
+    // (for split()) and just a lookup
+    gapTableNsec_ = 0;
+    if ((burstSize_ == 1) && stream->hasGapTable()) {
+        QVector<quint64> gaps = stream->gapTable(StreamBase::kMinGapTableSize);
+
+        gapOffsets_.resize(gaps.size());
+        for (int i = 0; i < gaps.size(); i++) {
+            gapOffsets_[i] = gapTableNsec_;
+            gapTableNsec_ += gaps.at(i);
+        }
+    }
+}
+
+int StreamFrameGenerator::nextFrame(uchar *buf, int bufMaxSize,
+        quint64 &nsecOffset)
+{
+    // Frames repeat after frameVariableCount frames
+    int len = template_.frameValue(buf, bufMaxSize,
+                    int(index_ % frameVariableCount_));
+
+    nsecOffset = this->nsecOffset(index_);
+    index_ += stride_;
+
+    return len;
+}
+
+quint64 StreamFrameGenerator::nsecDuration() const
+{
+    return count_ ? nsecOffset(count_ - 1) : 0;
+}
+
+FrameGenerator* StreamFrameGenerator::split(quint64 first,
+        quint64 stride) const
+{
+    return new StreamFrameGenerator(stream_, count_, burstSize_,
+            burstGapNsec_, first_ + first*stride_, stride_*stride);
+}
+
+// Returns the time (in nsecs) at which the streamIndex-th frame is to be
+// sent relative to the first frame of the stream
+quint64 StreamFrameGenerator::nsecOffset(quint64 streamIndex) const
+{
+    if (!gapOffsets_.isEmpty()) {
+        quint64 size = quint64(gapOffsets_.size());
+
+        return (streamIndex/size)*gapTableNsec_
+                    + gapOffsets_.at(int(streamIndex % size));
+    }
+
+    return quint64(double(streamIndex/burstSize_) * burstGapNsec_);
+}
+
+ReplayFrameGenerator::ReplayFrameGenerator(const QByteArray &frames,
+        const QVector<int> &offset, quint64 count, quint64 burstSize,
+        double burstGapNsec, quint64 first, quint64 stride)
+    : frames_(frames), offset_(offset)
+{
+    frameCount_ = offset_.isEmpty() ? 0 : offset_.size() - 1;
+    count_ = frameCount_ ? count : 0;
+    burstSize_ = qMax(burstSize, quint64(1));
+    burstGapNsec_ = burstGapNsec;
+    first_ = first;
+    stride_ = qMax(stride, quint64(1));
+    index_ = first_;
+}
+
+int ReplayFrameGenerator::nextFrame(uchar *buf, int bufMaxSize,
+        quint64 &nsecOffset)
+{
+    int i = int(index_ % frameCount_);
+    int len = qMin(offset_.at(i+1) - offset_.at(i), bufMaxSize);
+
+    memcpy(buf, frames_.constData() + offset_.at(i), len);
+
+    nsecOffset = this->nsecOffset(index_);
+    index_ += stride_;
+
+    return len;
+}
+
+quint64 ReplayFrameGenerator::nsecDuration() const
+{
+    return count_ ? nsecOffset(count_ - 1) : 0;
+}
+
+FrameGenerator* ReplayFrameGenerator::split(quint64 first,
+        quint64 stride) const
+{
+    return new ReplayFrameGenerator(frames_, offset_, count_, burstSize_,
+            burstGapNsec_, first_ + first*stride_, stride_*stride);
+}
+
+// Same as StreamFrameGenerator::nsecOffset()
+quint64 ReplayFrameGenerator::nsecOffset(quint64 index) const
+{
+    return quint64(double(index/burstSize_) * burstGapNsec_);
+}
+
+InterleavedFrameGenerator::InterleavedFrameGenerator(
+        const QList<const StreamBase*> &streams, quint64 first, quint64 stride)
+    : streams_(streams)
+{
+    uchar buf[16384];
+
+    first_ = first;
+    stride_ = qMax(stride, quint64(1));
+
+    for (int i = 0; i < streams_.size(); i++)
+    {
+        const StreamBase *stream = streams_.at(i);
+        Source source(stream);
+        double rate;
+
+        switch (stream->sendUnit())
+        {
+        case OstProto::StreamControl::e_su_bursts:
+            source.burstSize = stream->burstSize();
+            rate = stream->burstRate();
+            break;
+        case OstProto::StreamControl::e_su_packets:
+            source.burstSize = 1;
+            rate = stream->packetRate();
+            break;
+        default:
+            qWarning("Unhandled stream control unit %d", stream->sendUnit());
+            continue;
+        }
+
+        if ((rate <= 0) || (source.burstSize == 0))
+            continue;
+
+        source.burstGapNsec = 1e9/rate;
+        source.frameVariableCount = qMax(stream->frameVariableCount(), 1);
+        if (!stream->isFrameVariable())
+        {
+            int len = stream->frameValue(buf, sizeof(buf), 0);
+            if (len > 0)
+                source.frame = QByteArray((const char*) buf, len);
+        }
+
+        sources_.append(source);
+    }
+
+    reset();
+}
+
+int InterleavedFrameGenerator::nextFrame(uchar *buf, int bufMaxSize,
+        quint64 &nsecOffset)
+{
+    const Source &source = sources_.at(current_.source);
+    int len;
+
+    if (!source.frame.isEmpty())
+    {
+        len = qMin(source.frame.size(), bufMaxSize);
+        memcpy(buf, source.frame.constData(), len);
+    }
+    else
+    {
+        quint64 frameIndex = current_.burst*source.burstSize + burstFrame_;
+        len = source.frameTemplate.frameValue(buf, bufMaxSize,
+                int(frameIndex % source.frameVariableCount));
+    }
+    nsecOffset = current_.nsec;
+
+    // Frames of other splits are skipped without being built
+    for (quint64 i = 0; i < stride_; i++)
+        advance();
+
+    return len;
+}
+
+void InterleavedFrameGenerator::reset()
+{
+    heap_.clear();
+    burstFrame_ = 0;
+    if (sources_.isEmpty())
+        return;
+
+    // First burst of all streams is at time 0
+    for (int i = 0; i < sources_.size(); i++)
+    {
+        Event event = { 0, i, 0 };
+        push(event);
+    }
+    current_ = pop();
+
+    for (quint64 i = 0; i < first_; i++)
+        advance();
+}
+
+FrameGenerator* InterleavedFrameGenerator::split(quint64 first,
+        quint64 stride) const
+{
+    return new InterleavedFrameGenerator(streams_,
+            first_ + first*stride_, stride_*stride);
+}
+
+// Moves to the next frame - the next one in the current burst or the
+// first frame of the earliest of the next bursts
+void InterleavedFrameGenerator::advance()
+{
+    const Source &source = sources_.at(current_.source);
+
+    if (++burstFrame_ < source.burstSize)
+        return;
+
+    Event next;
+
+    next.source = current_.source;
+    next.burst = current_.burst + 1;
+    // Computed afresh (not accumulated) to avoid drift
+    next.nsec = quint64(double(next.burst) * source.burstGapNsec);
+
+    push(next);
+    current_ = pop();
+    burstFrame_ = 0;
+}
+
+void InterleavedFrameGenerator::push(const Event &event)
+{
+    int i = heap_.size();
+
+    heap_.append(event);
+    while (i > 0)
+    {
+        int parent = (i - 1)/2;
+        if (!(heap_.at(i) < heap_.at(parent)))
+            break;
+        qSwap(heap_[i], heap_[parent]);
+        i = parent;
+    }
+}
+
+InterleavedFrameGenerator::Event InterleavedFrameGenerator::pop()
+{
+    Event top = heap_.first();
+    int n = heap_.size() - 1;
+    int i = 0;
+
+    heap_[0] = heap_.at(n);
+    heap_.resize(n);
+    while (true)
+    {
+        int child = 2*i + 1;
+        if (child >= n)
+            break;
+        if (((child + 1) < n) && (heap_.at(child + 1) < heap_.at(child)))
+            child++;
+        if (!(heap_.at(child) < heap_.at(i)))
+            break;
+        qSwap(heap_[i], heap_[child]);
+        i = child;
+    }
+
+    return top;
+}
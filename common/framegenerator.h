@@ -0,0 +1,206 @@
+/*
+Copyright (C) 2017 Srivats P.
+
+
+This file is part of "Ostinato"
+
+This is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+#ifndef _FRAME_GENERATOR_H
+#define _FRAME_GENERATOR_H
+
+#include "frametemplate.h"
+
+#include <QByteArray>
+#include <QList>
+#include <QVector>
+#include <QtGlobal>
+
+class StreamBase;
+
+/*!
+  Generates frames on the fly, instead of building them in advance
+
+  Used by the transmitter for streams with too many distinct frames to be
+  built in advance and for interleaved streams - the frames are generated
+  just ahead of being sent so memory used doesn't depend on the number of
+  frames. Also used to export streams as pcap - see
+  PcapFileFormat::saveFrames()
+
+  Frames are generated in the order they are to be sent. Each frame comes
+  with its send time (nsecs) relative to the time of the first frame of
+  the unsplit generator (see split())
+
+  \note A generator must not outlive any change to its stream(s)
+*/
+class FrameGenerator
+{
+public:
+    // nsecDuration() of a generator that never runs out of frames
+    static const quint64 kUnbounded = ~quint64(0);
+
+    virtual ~FrameGenerator() {}
+
+    virtual bool hasNext() const = 0;
+    virtual int nextFrame(uchar *buf, int bufMaxSize, quint64 &nsecOffset) = 0;
+    virtual void reset() = 0;
+
+    // Send time of the last frame or kUnbounded
+    virtual quint64 nsecDuration() const = 0;
+
+    // Returns a new generator for every stride-th frame starting at first;
+    // used to split frames across multiple transmit workers
+    virtual FrameGenerator* split(quint64 first, quint64 stride) const = 0;
+};
+
+/*!
+  Generates count frames of a stream sent in bursts of burstSize frames,
+  burstGapNsec apart (for a packet based stream, each packet is a burst
+  of 1) - or, for a stream with a gap table, the gaps of the table in turn
+*/
+class StreamFrameGenerator : public FrameGenerator
+{
+public:
+    StreamFrameGenerator(const StreamBase *stream, quint64 count,
+            quint64 burstSize, double burstGapNsec,
+            quint64 first = 0, quint64 stride = 1);
+
+    virtual bool hasNext() const { return index_ < count_; }
+    virtual int nextFrame(uchar *buf, int bufMaxSize, quint64 &nsecOffset);
+    virtual void reset() { index_ = first_; }
+    virtual quint64 nsecDuration() const;
+    virtual FrameGenerator* split(quint64 first, quint64 stride) const;
+
+private:
+    quint64 nsecOffset(quint64 streamIndex) const;
+
+    const StreamBase *stream_;
+    FrameTemplate template_;
+    quint64 frameVariableCount_;
+    quint64 count_;
+    quint64 burstSize_;
+    double burstGapNsec_;
+    quint64 first_;
+    quint64 stride_;
+    quint64 index_; // stream frame index of next frame
+
+    // Offset of each frame of the gap table (if any) from the first one
+    // and the offset of the frame after the last one
+    QVector<quint64> gapOffsets_;
+    quint64 gapTableNsec_;
+};
+
+/*!
+  Replays frames built in advance - count frames sent in bursts of
+  burstSize frames, burstGapNsec apart, cycling through the built frames
+
+  Used for a stream whose repeating packet set would be many times its
+  distinct frames - e.g. a burst size that isn't a multiple (or divisor)
+  of the frame variable count makes the set lcm() frames - so that only
+  the distinct frames are stored, whatever the count
+*/
+class ReplayFrameGenerator : public FrameGenerator
+{
+public:
+    // frames has the frames back to back; offset[i] is the offset of the
+    // i-th frame with offset[frameCount] the end of the last frame
+    ReplayFrameGenerator(const QByteArray &frames,
+            const QVector<int> &offset, quint64 count,
+            quint64 burstSize, double burstGapNsec,
+            quint64 first = 0, quint64 stride = 1);
+
+    virtual bool hasNext() const { return index_ < count_; }
+    virtual int nextFrame(uchar *buf, int bufMaxSize, quint64 &nsecOffset);
+    virtual void reset() { index_ = first_; }
+    virtual quint64 nsecDuration() const;
+    virtual FrameGenerator* split(quint64 first, quint64 stride) const;
+
+private:
+    quint64 nsecOffset(quint64 index) const;
+
+    QByteArray frames_; // implicitly shared with the frame set
+    QVector<int> offset_;
+    quint64 frameCount_;
+    quint64 count_;
+    quint64 burstSize_;
+    double burstGapNsec_;
+    quint64 first_;
+    quint64 stride_;
+    quint64 index_; // index of next frame
+};
+
+/*!
+  Generates the frames of multiple streams sent together (interleaved),
+  each at its own rate
+
+  Each stream's next burst is an event keyed by its send time in a
+  min-heap; the earliest burst is sent next. Send times are computed from
+  the burst count (not accumulated) so each stream's rate is exact. Streams
+  with no variable fields are built only once.
+
+  The streams are repeated forever
+*/
+class InterleavedFrameGenerator : public FrameGenerator
+{
+public:
+    InterleavedFrameGenerator(const QList<const StreamBase*> &streams,
+            quint64 first = 0, quint64 stride = 1);
+
+    virtual bool hasNext() const { return !sources_.isEmpty(); }
+    virtual int nextFrame(uchar *buf, int bufMaxSize, quint64 &nsecOffset);
+    virtual void reset();
+    virtual quint64 nsecDuration() const { return kUnbounded; }
+    virtual FrameGenerator* split(quint64 first, quint64 stride) const;
+
+private:
+    struct Source
+    {
+        const StreamBase *stream;
+        FrameTemplate frameTemplate;
+        QByteArray frame; // if stream has no variable fields
+        quint64 frameVariableCount;
+        quint64 burstSize;
+        double burstGapNsec;
+
+        Source(const StreamBase *s) : stream(s), frameTemplate(s) {}
+    };
+
+    struct Event
+    {
+        quint64 nsec;
+        int source;
+        quint64 burst;
+
+        bool operator<(const Event &other) const {
+            return (nsec < other.nsec)
+                || ((nsec == other.nsec) && (source < other.source));
+        }
+    };
+
+    void push(const Event &event);
+    Event pop();
+
+    QList<const StreamBase*> streams_;
+    QList<Source> sources_;
+    QVector<Event> heap_;
+    void advance();
+
+    Event current_;      // burst being generated
+    quint64 burstFrame_; // next frame within current burst
+    quint64 first_;
+    quint64 stride_;
+};
+
+#endif
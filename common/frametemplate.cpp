@@ -0,0 +1,302 @@
+/*
+Copyright (C) 2017 Srivats P.
+
+This file is part of "Ostinato"
+
+This is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+#include "frametemplate.h"
+
+#include "abstractprotocol.h"
+#include "protocollistiterator.h"
+#include "streambase.h"
+
+#include <QHash>
+#include <QtEndian>
+#include <string.h>
+
+/*!
+  Returns the checksum after incrementally updating it for the 16-bit
+  words that differ between oldData and newData (RFC 1624, Eqn. 3)
+
+  Both regions are of the same size and are covered by the checksum; the
+  word at skipOffset (the checksum itself) is not included
+*/
+static quint16 cksumUpdate(quint16 cksum, const uchar *oldData,
+        const uchar *newData, int size, int skipOffset)
+{
+    quint32 sum = quint16(~cksum);
+
+    for (int i = 0; i < (size - 1); i += 2)
+    {
+        if (i == skipOffset)
+            continue;
+
+        quint16 m = qFromBigEndian<quint16>(oldData + i);
+        quint16 m1 = qFromBigEndian<quint16>(newData + i);
+
+        if (m != m1)
+            sum += quint16(~m) + m1;
+    }
+
+    while (sum >> 16)
+        sum = (sum & 0xFFFF) + (sum >> 16);
+
+    return ~sum;
+}
+
+FrameTemplate::FrameTemplate(const StreamBase *stream)
+{
+    ProtocolListIterator *iter;
+    QHash<const AbstractProtocol*, int> offsets;
+    QHash<const AbstractProtocol*, const AbstractProtocol*> prevs;
+    const AbstractProtocol *prev = NULL;
+    int pktLen;
+
+    stream_ = stream;
+    isCompiled_ = false;
+    isSignaturePatched_ = false;
+
+    if (stream->isFrameSizeVariable() || (stream->frameSizeVariableCount() > 1))
+        return;
+
+    // pktLen is adjusted for CRC/FCS which will be added by the NIC
+    pktLen = stream->frameLen(0) - kFcsSize;
+    if (pktLen <= 0)
+        return;
+
+    base_.reserve(pktLen);
+
+    iter = stream->createProtocolListIterator();
+    while (iter->hasNext() && (base_.size() < pktLen))
+    {
+        AbstractProtocol *proto = iter->next();
+        QByteArray ba = proto->protocolFrameValue(0);
+        int size = qMin(ba.size(), pktLen - base_.size());
+
+        // NOTE: some protocols (e.g. payload) have a variable count > 1
+        // even if isProtocolFrameValueVariable() is false
+        if (proto->isProtocolFrameValueVariable()
+                || (proto->protocolFrameVariableCount() > 1)
+                || proto->isProtocolFrameValueDependent())
+        {
+            Patch patch;
+
+            patch.protocol = proto;
+            patch.offset = base_.size();
+            patch.size = ba.size();
+            patch.isEncoded = true;
+            patch.cksumOffset = -1;
+            patch.coverOffset = 0;
+            patch.coverSize = 0;
+            patch.isUdpCksum = false;
+            patch.isPseudoCksum = false;
+            patches_.append(patch);
+        }
+
+        offsets.insert(proto, base_.size());
+        prevs.insert(proto, prev);
+        prev = proto;
+        base_.append(ba.constData(), size);
+    }
+    delete iter;
+
+    // Pad with zero, if required
+    if (base_.size() < pktLen)
+        base_.append(QByteArray(pktLen - base_.size(), '\0'));
+
+    for (int i = 0; i < patches_.size(); i++) {
+        prev = prevs.value(patches_.at(i).protocol);
+        compileCksumPatch(patches_[i], prev, offsets.value(prev, -1),
+                i == (patches_.size() - 1));
+    }
+
+    if (stream->isTracked()) {
+        // A payload CRC covers the payload too
+        int offset = stream->hasPayloadCrc() ? stream->payloadOffset()
+                        : signatureOffset(base_.size());
+
+        stream->setFrameSignature((uchar*) base_.data(), base_.size());
+        for (int i = 0; i < patches_.size(); i++) {
+            if ((patches_.at(i).offset + patches_.at(i).size) > offset)
+                isSignaturePatched_ = true;
+        }
+    }
+
+    isCompiled_ = true;
+}
+
+/*!
+  Sets up the patch to update its checksum incrementally, if possible
+
+  This is done for -
+  - IPv4 - the header is encoded without the checksum which is then
+    fixed up for the header words that changed
+  - TCP/UDP over IPv4/IPv6 whose own fields and payload don't vary - the
+    header is not encoded at all, the checksum is fixed up for the change
+    in the src/dst IP addresses of the pseudo header
+
+  For an offloaded TCP/UDP checksum, the payload is not covered by the
+  pseudo header sum in the checksum field - so the TCP/UDP patch need not
+  be the last one. An offloaded IPv4 checksum is just 0 - nothing to do
+
+  The base frame's checksum must be the one computed by the protocol - if
+  the user has overridden it, the patch is left as-is
+*/
+void FrameTemplate::compileCksumPatch(Patch &patch,
+        const AbstractProtocol *prev, int prevOffset, bool isLastPatch)
+{
+    const AbstractProtocol *proto = patch.protocol;
+    int cksumOffset;
+    quint32 cksum;
+    uchar cksumValue[2];
+
+    if ((patch.offset + patch.size) > base_.size())
+        return;
+
+    switch (proto->protocolNumber())
+    {
+        case OstProto::Protocol::kIp4FieldNumber:
+            if ((patch.size < 20)
+                    || proto->isCksumOffloaded(AbstractProtocol::CksumIp))
+                return;
+
+            cksumOffset = patch.offset + 10;
+            cksum = proto->protocolFrameCksum(0, AbstractProtocol::CksumIp);
+            patch.coverOffset = patch.offset;
+            patch.coverSize = patch.size;
+            break;
+
+        case OstProto::Protocol::kTcpFieldNumber:
+        case OstProto::Protocol::kUdpFieldNumber:
+            patch.isPseudoCksum = proto->isCksumOffloaded(
+                                        AbstractProtocol::CksumTcpUdp);
+
+            // Anything else varying is also covered by the checksum
+            if ((!isLastPatch && !patch.isPseudoCksum)
+                    || proto->isProtocolFrameValueVariable()
+                    || (proto->protocolFrameVariableCount() > 1))
+                return;
+
+            if (!prev || (prevOffset < 0))
+                return;
+
+            if (prev->protocolNumber() == OstProto::Protocol::kIp4FieldNumber) {
+                patch.coverOffset = prevOffset + 12;
+                patch.coverSize = 8;
+            }
+            else if (prev->protocolNumber()
+                            == OstProto::Protocol::kIp6FieldNumber) {
+                patch.coverOffset = prevOffset + 8;
+                patch.coverSize = 32;
+            }
+            else
+                return;
+
+            if ((patch.coverOffset + patch.coverSize) > patch.offset)
+                return;
+
+            patch.isUdpCksum = (proto->protocolNumber()
+                                    == OstProto::Protocol::kUdpFieldNumber);
+            cksumOffset = patch.offset + (patch.isUdpCksum ? 6 : 16);
+            if ((cksumOffset + 2) > (patch.offset + patch.size))
+                return;
+
+            if (patch.isPseudoCksum) {
+                cksum = quint16(~proto->protocolFrameHeaderCksum(0,
+                                        AbstractProtocol::CksumIpPseudo));
+                patch.isUdpCksum = false;
+                break;
+            }
+
+            cksum = proto->protocolFrameCksum(0, AbstractProtocol::CksumTcpUdp);
+            if (patch.isUdpCksum && (cksum == 0))
+                cksum = 0xFFFF;
+            break;
+
+        default:
+            return;
+    }
+
+    // Checksum overridden by the user?
+    qToBigEndian(quint16(cksum), cksumValue);
+    if (memcmp(base_.constData() + cksumOffset, cksumValue, 2) != 0) {
+        patch.coverOffset = patch.coverSize = 0;
+        patch.isUdpCksum = patch.isPseudoCksum = false;
+        return;
+    }
+
+    patch.isEncoded = (proto->protocolNumber()
+                            == OstProto::Protocol::kIp4FieldNumber);
+    patch.cksumOffset = cksumOffset;
+}
+
+// Returns the same value as StreamBase::frameValue()
+int FrameTemplate::frameValue(uchar *buf, int bufMaxSize, int frameIndex) const
+{
+    int maxSize;
+
+    if (!isCompiled_)
+        return stream_->frameValue(buf, bufMaxSize, frameIndex);
+
+    maxSize = qMin(base_.size(), bufMaxSize);
+    memcpy(buf, base_.constData(), maxSize);
+
+    for (int i = 0; i < patches_.size(); i++)
+    {
+        const Patch &patch = patches_.at(i);
+
+        if (patch.offset >= maxSize)
+            break;
+
+        if (patch.isEncoded) {
+            // Skip computing the cksum, if we will update it incrementally
+            int size = patch.protocol->writeFrameValue(buf + patch.offset,
+                                    qMin(patch.size, maxSize - patch.offset),
+                                    frameIndex, patch.cksumOffset >= 0);
+
+            // Protocol changed its size - we can't patch this frame
+            if (size != patch.size)
+                return stream_->frameValue(buf, bufMaxSize, frameIndex);
+        }
+
+        if (patch.cksumOffset >= 0) {
+            if ((patch.offset + patch.size) > maxSize)
+                return stream_->frameValue(buf, bufMaxSize, frameIndex);
+
+            const uchar *base = (const uchar*) base_.constData();
+            quint16 cksum = qFromBigEndian<quint16>(base + patch.cksumOffset);
+
+            // A pseudo header sum is updated as a checksum of its complement
+            if (patch.isPseudoCksum)
+                cksum = ~cksumUpdate(~cksum,
+                        base + patch.coverOffset, buf + patch.coverOffset,
+                        patch.coverSize, patch.cksumOffset - patch.coverOffset);
+            else
+                cksum = cksumUpdate(cksum,
+                        base + patch.coverOffset, buf + patch.coverOffset,
+                        patch.coverSize, patch.cksumOffset - patch.coverOffset);
+
+            if (patch.isUdpCksum && (cksum == 0))
+                cksum = 0xFFFF;
+            qToBigEndian(cksum, buf + patch.cksumOffset);
+        }
+    }
+
+    if (isSignaturePatched_ && (maxSize == base_.size()))
+        stream_->setFrameSignature(buf, maxSize);
+
+    return maxSize;
+}
@@ -0,0 +1,90 @@
+/*
+Copyright (C) 2017 Srivats P.
+
+This file is part of "Ostinato"
+
+This is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+#ifndef _FRAME_TEMPLATE_H
+#define _FRAME_TEMPLATE_H
+
+#include <QByteArray>
+#include <QList>
+
+class AbstractProtocol;
+class StreamBase;
+
+/*!
+  A "compiled" form of a stream to build its frames faster than
+  StreamBase::frameValue()
+
+  The template is a base frame (frame 0) and a list of patches - one for
+  each protocol whose frame value may vary from frame to frame. Frame N is
+  built by copying the base frame and overwriting the patch spans with the
+  protocol's value for frame N. Protocols that don't vary (typically most
+  of them, including the payload) are thus encoded only once.
+
+  A template can be compiled only for streams whose frame size doesn't
+  vary - for any other stream frameValue() just uses
+  StreamBase::frameValue()
+
+  IPv4 header and TCP/UDP checksums are not recomputed for every frame -
+  they are fixed up incrementally (RFC 1624) from the base frame's checksum
+  and the 16-bit words that changed in the region covered by the checksum.
+  See compileCksumPatch() for when this is possible
+
+  Checksums offloaded to the NIC (StreamBase::cksumOffload()) are not
+  computed at all - an offloaded TCP/UDP checksum field has only the
+  pseudo header sum which is fixed up the same way
+
+  A tracked stream's signature is part of the base frame; it is rewritten
+  for a frame only if a patch overlaps it (or the payload, if the
+  signature has a payload CRC)
+
+  \note The template must not outlive any change to the stream
+*/
+class FrameTemplate
+{
+public:
+    FrameTemplate(const StreamBase *stream);
+
+    bool isCompiled() const { return isCompiled_; }
+    int frameValue(uchar *buf, int bufMaxSize, int frameIndex) const;
+
+private:
+    struct Patch
+    {
+        const AbstractProtocol *protocol;
+        int offset;
+        int size;
+        bool isEncoded;     // false if span is same as base (except cksum)
+        int cksumOffset;    // -1, if cksum is not updated incrementally
+        int coverOffset;    // frame region covered by the cksum
+        int coverSize;
+        bool isUdpCksum;    // zero cksum is sent as 0xFFFF
+        bool isPseudoCksum; // offloaded - field is the pseudo header sum
+    };
+
+    void compileCksumPatch(Patch &patch, const AbstractProtocol *prev,
+            int prevOffset, bool isLastPatch);
+
+    const StreamBase *stream_;
+    bool isCompiled_;
+    bool isSignaturePatched_; // signature overwritten by a patch
+    QByteArray base_;
+    QList<Patch> patches_;
+};
+
+#endif
@@ -0,0 +1,125 @@
+/*
+Copyright (C) 2017 Srivats P.
+
+
+This file is part of "Ostinato"
+
+This is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+
+#include "gzipdevice.h"
+
+#include <limits.h>
+#include <string.h>
+
+GzipDevice::GzipDevice(QIODevice *source)
+    : source_(source), isOpen_(false), isEnd_(false), isError_(false)
+{
+    memset(&zs_, 0, sizeof(zs_));
+}
+
+GzipDevice::~GzipDevice()
+{
+    close();
+}
+
+bool GzipDevice::open(OpenMode mode)
+{
+    if ((mode & QIODevice::ReadWrite) != QIODevice::ReadOnly) {
+        setErrorString("gzip device is read only");
+        return false;
+    }
+
+    memset(&zs_, 0, sizeof(zs_));
+
+    // 16 + MAX_WBITS => gzip (not zlib) header
+    if (inflateInit2(&zs_, 16 + MAX_WBITS) != Z_OK) {
+        setErrorString("unable to initialize zlib");
+        return false;
+    }
+
+    in_.resize(kChunkSize);
+    isOpen_ = true;
+    isEnd_ = isError_ = false;
+
+    return QIODevice::open(mode);
+}
+
+void GzipDevice::close()
+{
+    if (!isOpen_)
+        return;
+
+    inflateEnd(&zs_);
+    isOpen_ = false;
+    QIODevice::close();
+}
+
+// Not at end after an error - so callers can tell the two apart
+bool GzipDevice::atEnd() const
+{
+    return isEnd_ && (QIODevice::bytesAvailable() == 0);
+}
+
+// Fills all of data, unless the source runs out - like a regular file
+qint64 GzipDevice::readData(char *data, qint64 maxSize)
+{
+    qint64 len;
+
+    if (isEnd_ || isError_)
+        return isError_ ? -1 : 0;
+
+    zs_.next_out = (Bytef*) data;
+    zs_.avail_out = uInt(qMin(maxSize, qint64(INT_MAX)));
+
+    while (zs_.avail_out)
+    {
+        int ret;
+
+        if (!zs_.avail_in) {
+            qint64 n = source_->read(in_.data(), in_.size());
+
+            if (n <= 0) {
+                setErrorString("truncated gzip data");
+                isError_ = true;
+                break;
+            }
+            zs_.next_in = (Bytef*) in_.data();
+            zs_.avail_in = uInt(n);
+        }
+
+        ret = inflate(&zs_, Z_NO_FLUSH);
+        if (ret == Z_STREAM_END) {
+            // A gzip file may have multiple members back to back
+            if (zs_.avail_in || !source_->atEnd()) {
+                inflateReset(&zs_);
+                continue;
+            }
+            isEnd_ = true;
+            break;
+        }
+
+        if ((ret != Z_OK) && (ret != Z_BUF_ERROR)) {
+            setErrorString(QString("corrupt gzip data: %1")
+                    .arg(zs_.msg ? zs_.msg : "unknown error"));
+            isError_ = true;
+            break;
+        }
+    }
+
+    len = qMin(maxSize, qint64(INT_MAX)) - zs_.avail_out;
+
+    return (len || !isError_) ? len : -1;
+}
@@ -0,0 +1,64 @@
+/*
+Copyright (C) 2017 Srivats P.
+
+
+This file is part of "Ostinato"
+
+This is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+
+#ifndef _GZIP_DEVICE_H
+#define _GZIP_DEVICE_H
+
+#include <QByteArray>
+#include <QIODevice>
+
+#include <zlib.h>
+
+/*!
+  Read-only sequential device with the uncompressed contents of a gzip
+  compressed 'source' device - decompressed (with zlib) as it is read,
+  instead of being uncompressed to a temporary file first
+*/
+class GzipDevice : public QIODevice
+{
+public:
+    GzipDevice(QIODevice *source);
+    ~GzipDevice();
+
+    bool open(OpenMode mode);
+    void close();
+
+    bool isSequential() const { return true; }
+    bool atEnd() const;
+
+protected:
+    qint64 readData(char *data, qint64 maxSize);
+    qint64 writeData(const char * /*data*/, qint64 /*maxSize*/) {
+        return -1;
+    }
+
+private:
+    enum { kChunkSize = 64*1024 };
+
+    QIODevice *source_;
+    QByteArray in_;
+    z_stream zs_;
+    bool isOpen_;
+    bool isEnd_;
+    bool isError_;
+};
+
+#endif
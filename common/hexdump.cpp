@@ -23,6 +23,9 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 HexDumpProtocol::HexDumpProtocol(StreamBase *stream, AbstractProtocol *parent)
     : AbstractProtocol(stream, parent)
 {
+    // Size depends on the frame length (pad until end) - no fixed layout
+    // or frame value
+    _cacheFlags &= ~(FrameLayoutCache | FrameValueCache);
 }
 
 HexDumpProtocol::~HexDumpProtocol()
@@ -19,6 +19,8 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 
 #include "ip4.h"
 
+#include "cksum.h"
+
 #include <QHostAddress>
 
 Ip4Protocol::Ip4Protocol(StreamBase *stream, AbstractProtocol *parent)
@@ -371,6 +373,8 @@ QVariant Ip4Protocol::fieldData(int index, FieldAttrib attrib,
 
                     if (data.is_override_cksum())
                         cksum = data.cksum();
+                    else if (isCksumOffloaded(CksumIp))
+                        cksum = 0;
                     else
                         cksum = protocolFrameCksum(streamIndex, CksumIp);
                     return cksum;
@@ -382,6 +386,8 @@ QVariant Ip4Protocol::fieldData(int index, FieldAttrib attrib,
 
                     if (data.is_override_cksum())
                         cksum = data.cksum();
+                    else if (isCksumOffloaded(CksumIp))
+                        cksum = 0;
                     else
                         cksum = protocolFrameCksum(streamIndex, CksumIp);
 
@@ -395,6 +401,8 @@ QVariant Ip4Protocol::fieldData(int index, FieldAttrib attrib,
 
                     if (data.is_override_cksum())
                         cksum = data.cksum();
+                    else if (isCksumOffloaded(CksumIp))
+                        cksum = 0;
                     else
                         cksum = protocolFrameCksum(streamIndex, CksumIp);
                     return  QString("0x%1").
@@ -409,36 +417,7 @@ QVariant Ip4Protocol::fieldData(int index, FieldAttrib attrib,
         }
         case ip4_srcAddr:
         {
-            int        u;
-            quint32    subnet, host, srcIp = 0;
-
-            switch(data.src_ip_mode())
-            {
-                case OstProto::Ip4::e_im_fixed:
-                    srcIp = data.src_ip();
-                    break;
-                case OstProto::Ip4::e_im_inc_host:
-                    u = streamIndex % data.src_ip_count();
-                    subnet = data.src_ip() & data.src_ip_mask();
-                    host = (((data.src_ip() & ~data.src_ip_mask()) + u) &
-                        ~data.src_ip_mask());
-                    srcIp = subnet | host;
-                    break;
-                case OstProto::Ip4::e_im_dec_host:
-                    u = streamIndex % data.src_ip_count();
-                    subnet = data.src_ip() & data.src_ip_mask();
-                    host = (((data.src_ip() & ~data.src_ip_mask()) - u) &
-                        ~data.src_ip_mask());
-                    srcIp = subnet | host;
-                    break;
-                case OstProto::Ip4::e_im_random_host:
-                    subnet = data.src_ip() & data.src_ip_mask();
-                    host = (qrand() & ~data.src_ip_mask());
-                    srcIp = subnet | host;
-                    break;
-                default:
-                    qWarning("Unhandled src_ip_mode = %d", data.src_ip_mode());
-            }
+            quint32 srcIp = srcAddress(streamIndex);
 
             switch(attrib)
             {
@@ -462,36 +441,7 @@ QVariant Ip4Protocol::fieldData(int index, FieldAttrib attrib,
         }
         case ip4_dstAddr:
         {
-            int        u;
-            quint32    subnet, host, dstIp = 0;
-
-            switch(data.dst_ip_mode())
-            {
-                case OstProto::Ip4::e_im_fixed:
-                    dstIp = data.dst_ip();
-                    break;
-                case OstProto::Ip4::e_im_inc_host:
-                    u = streamIndex % data.dst_ip_count();
-                    subnet = data.dst_ip() & data.dst_ip_mask();
-                    host = (((data.dst_ip() & ~data.dst_ip_mask()) + u) &
-                        ~data.dst_ip_mask());
-                    dstIp = subnet | host;
-                    break;
-                case OstProto::Ip4::e_im_dec_host:
-                    u = streamIndex % data.dst_ip_count();
-                    subnet = data.dst_ip() & data.dst_ip_mask();
-                    host = (((data.dst_ip() & ~data.dst_ip_mask()) - u) &
-                        ~data.dst_ip_mask());
-                    dstIp = subnet | host;
-                    break;
-                case OstProto::Ip4::e_im_random_host:
-                    subnet = data.dst_ip() & data.dst_ip_mask();
-                    host = (qrand() & ~data.dst_ip_mask());
-                    dstIp = subnet | host;
-                    break;
-                default:
-                    qWarning("Unhandled dst_ip_mode = %d", data.dst_ip_mode());
-            }
+            quint32 dstIp = dstAddress(streamIndex);
 
             switch(attrib)
             {
@@ -831,6 +781,130 @@ _exit:
     return isOk;
 }
 
+int Ip4Protocol::writeFrameValue(uchar *buf, int bufSize,
+        int streamIndex, bool forCksum) const
+{
+    int ipLen = 20 + data.options().length();
+
+    // A variable field over the checksum has to be applied after the
+    // checksum is calculated - leave it to the regular path
+    if ((bufSize < ipLen) || hasVariableFieldAt(10, 2))
+        return AbstractProtocol::writeFrameValue(buf, bufSize,
+                                                 streamIndex, forCksum);
+
+    quint8 ver = data.is_override_ver() ? (data.ver_hdrlen() >> 4) & 0x0F : 4;
+    quint8 hdrLen = data.is_override_hdrlen() ?
+                        data.ver_hdrlen() : 5 + data.options().length()/4;
+    quint16 totLen = data.is_override_totlen() ? data.totlen() :
+                        (protocolFramePayloadSize(streamIndex) + ipLen);
+    quint8 proto = data.is_override_proto() ?
+                        data.proto() : payloadProtocolId(ProtocolIdIp);
+
+    buf[0] = (ver << 4) | (hdrLen & 0x0F);
+    buf[1] = data.tos();
+    qToBigEndian(totLen, buf + 2);
+    qToBigEndian(quint16(data.id()), buf + 4);
+    qToBigEndian(quint16(((data.flags() & 0x07) << 13)
+                            | (data.frag_ofs() & 0x1FFF)), buf + 6);
+    buf[8] = data.ttl();
+    buf[9] = proto;
+    qToBigEndian(quint16(0), buf + 10);
+    qToBigEndian(srcAddress(streamIndex), buf + 12);
+    qToBigEndian(dstAddress(streamIndex), buf + 16);
+    memcpy(buf + 20, data.options().data(), data.options().length());
+
+    varyProtocolFrameValue(buf, ipLen, streamIndex);
+
+    // Checksum the header as written, instead of building it again
+    if (!forCksum) {
+        quint16 cksum;
+
+        if (data.is_override_cksum())
+            cksum = data.cksum();
+        else if (isCksumOffloaded(CksumIp))
+            cksum = 0;
+        else
+            cksum = qFromBigEndian(quint16(~onesComplementSum(buf, ipLen)));
+        qToBigEndian(cksum, buf + 10);
+    }
+
+    return ipLen;
+}
+
+quint32 Ip4Protocol::srcAddress(int streamIndex) const
+{
+    int        u;
+    quint32    subnet, host, srcIp = 0;
+
+    switch(data.src_ip_mode())
+    {
+        case OstProto::Ip4::e_im_fixed:
+            srcIp = data.src_ip();
+            break;
+        case OstProto::Ip4::e_im_inc_host:
+            u = streamIndex % data.src_ip_count();
+            subnet = data.src_ip() & data.src_ip_mask();
+            host = (((data.src_ip() & ~data.src_ip_mask()) + u) &
+                ~data.src_ip_mask());
+            srcIp = subnet | host;
+            break;
+        case OstProto::Ip4::e_im_dec_host:
+            u = streamIndex % data.src_ip_count();
+            subnet = data.src_ip() & data.src_ip_mask();
+            host = (((data.src_ip() & ~data.src_ip_mask()) - u) &
+                ~data.src_ip_mask());
+            srcIp = subnet | host;
+            break;
+        case OstProto::Ip4::e_im_random_host:
+            subnet = data.src_ip() & data.src_ip_mask();
+            host = (random(streamIndex, ip4_srcAddr).next()
+                    & ~data.src_ip_mask());
+            srcIp = subnet | host;
+            break;
+        default:
+            qWarning("Unhandled src_ip_mode = %d", data.src_ip_mode());
+    }
+
+    return srcIp;
+}
+
+quint32 Ip4Protocol::dstAddress(int streamIndex) const
+{
+    int        u;
+    quint32    subnet, host, dstIp = 0;
+
+    switch(data.dst_ip_mode())
+    {
+        case OstProto::Ip4::e_im_fixed:
+            dstIp = data.dst_ip();
+            break;
+        case OstProto::Ip4::e_im_inc_host:
+            u = streamIndex % data.dst_ip_count();
+            subnet = data.dst_ip() & data.dst_ip_mask();
+            host = (((data.dst_ip() & ~data.dst_ip_mask()) + u) &
+                ~data.dst_ip_mask());
+            dstIp = subnet | host;
+            break;
+        case OstProto::Ip4::e_im_dec_host:
+            u = streamIndex % data.dst_ip_count();
+            subnet = data.dst_ip() & data.dst_ip_mask();
+            host = (((data.dst_ip() & ~data.dst_ip_mask()) - u) &
+                ~data.dst_ip_mask());
+            dstIp = subnet | host;
+            break;
+        case OstProto::Ip4::e_im_random_host:
+            subnet = data.dst_ip() & data.dst_ip_mask();
+            host = (random(streamIndex, ip4_dstAddr).next()
+                    & ~data.dst_ip_mask());
+            dstIp = subnet | host;
+            break;
+        default:
+            qWarning("Unhandled dst_ip_mode = %d", data.dst_ip_mode());
+    }
+
+    return dstIp;
+}
+
 int Ip4Protocol::protocolFrameVariableCount() const
 {
     int count = AbstractProtocol::protocolFrameVariableCount();
@@ -844,6 +918,13 @@ int Ip4Protocol::protocolFrameVariableCount() const
     return count;
 }
 
+bool Ip4Protocol::isProtocolFrameValueRandom() const
+{
+    return (AbstractProtocol::isProtocolFrameValueRandom()
+            || (data.src_ip_mode() == OstProto::Ip4::e_im_random_host)
+            || (data.dst_ip_mode() == OstProto::Ip4::e_im_random_host));
+}
+
 quint32 Ip4Protocol::protocolFrameCksum(int streamIndex,
     CksumType cksumType) const
 {
@@ -86,12 +86,19 @@ public:
     virtual bool setFieldData(int index, const QVariant &value, 
             FieldAttrib attrib = FieldValue);
 
+    virtual int writeFrameValue(uchar *buf, int bufSize,
+        int streamIndex = 0, bool forCksum = false) const;
+
     virtual int protocolFrameVariableCount() const;
+    virtual bool isProtocolFrameValueRandom() const;
 
     virtual quint32 protocolFrameCksum(int streamIndex = 0,
         CksumType cksumType = CksumIp) const;
 
 private:
+    quint32 srcAddress(int streamIndex) const;
+    quint32 dstAddress(int streamIndex) const;
+
     OstProto::Ip4    data;
 };
 
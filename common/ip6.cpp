@@ -18,6 +18,8 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 */
 
 #include "ip6.h"
+#include "cksum.h"
+
 #include <QHostAddress>
 
 
@@ -313,54 +315,9 @@ QVariant Ip6Protocol::fieldData(int index, FieldAttrib attrib,
 
         case ip6_srcAddress:
         {
-            int u, p, q;
-            quint64 maskHi = 0, maskLo = 0;
-            quint64 prefixHi, prefixLo;
-            quint64 hostHi = 0, hostLo = 0;
-            quint64 srcHi = 0, srcLo = 0;
+            quint64 srcHi, srcLo;
 
-            switch(data.src_addr_mode())
-            {
-                case OstProto::Ip6::kFixed:
-                    srcHi = data.src_addr_hi();
-                    srcLo = data.src_addr_lo();
-                    break;
-                case OstProto::Ip6::kIncHost:
-                case OstProto::Ip6::kDecHost:
-                case OstProto::Ip6::kRandomHost:
-                    u = streamIndex % data.src_addr_count();
-                    if (data.src_addr_prefix() > 64) {
-                        p = 64;
-                        q = data.src_addr_prefix() - 64;
-                    } else {
-                        p = data.src_addr_prefix();
-                        q = 0;
-                    }
-                    if (p > 0) 
-                        maskHi = ~((quint64(1) << p) - 1);
-                    if (q > 0) 
-                        maskLo = ~((quint64(1) << q) - 1);
-                    prefixHi = data.src_addr_hi() & maskHi;
-                    prefixLo = data.src_addr_lo() & maskLo;
-                    if (data.src_addr_mode() == OstProto::Ip6::kIncHost) {
-                        hostHi = ((data.src_addr_hi() & ~maskHi) + u) & ~maskHi;
-                        hostLo = ((data.src_addr_lo() & ~maskLo) + u) & ~maskLo;
-                    } 
-                    else if (data.src_addr_mode() == OstProto::Ip6::kDecHost) {
-                        hostHi = ((data.src_addr_hi() & ~maskHi) - u) & ~maskHi;
-                        hostLo = ((data.src_addr_lo() & ~maskLo) - u) & ~maskLo;
-                    } 
-                    else if (data.src_addr_mode()==OstProto::Ip6::kRandomHost) {
-                        hostHi = qrand() & ~maskHi;
-                        hostLo = qrand() & ~maskLo;
-                    }
-                    srcHi = prefixHi | hostHi;
-                    srcLo = prefixLo | hostLo;
-                    break;
-                default:
-                    qWarning("Unhandled src_addr_mode = %d", 
-                            data.src_addr_mode());
-            }
+            srcAddress(streamIndex, &srcHi, &srcLo);
 
             switch(attrib)
             {
@@ -387,54 +344,9 @@ QVariant Ip6Protocol::fieldData(int index, FieldAttrib attrib,
 
         case ip6_dstAddress:
         {
-            int u, p, q;
-            quint64 maskHi = 0, maskLo = 0;
-            quint64 prefixHi, prefixLo;
-            quint64 hostHi = 0, hostLo = 0;
-            quint64 dstHi = 0, dstLo = 0;
+            quint64 dstHi, dstLo;
 
-            switch(data.dst_addr_mode())
-            {
-                case OstProto::Ip6::kFixed:
-                    dstHi = data.dst_addr_hi();
-                    dstLo = data.dst_addr_lo();
-                    break;
-                case OstProto::Ip6::kIncHost:
-                case OstProto::Ip6::kDecHost:
-                case OstProto::Ip6::kRandomHost:
-                    u = streamIndex % data.dst_addr_count();
-                    if (data.dst_addr_prefix() > 64) {
-                        p = 64;
-                        q = data.dst_addr_prefix() - 64;
-                    } else {
-                        p = data.dst_addr_prefix();
-                        q = 0;
-                    }
-                    if (p > 0) 
-                        maskHi = ~((quint64(1) << p) - 1);
-                    if (q > 0) 
-                        maskLo = ~((quint64(1) << q) - 1);
-                    prefixHi = data.dst_addr_hi() & maskHi;
-                    prefixLo = data.dst_addr_lo() & maskLo;
-                    if (data.dst_addr_mode() == OstProto::Ip6::kIncHost) {
-                        hostHi = ((data.dst_addr_hi() & ~maskHi) + u) & ~maskHi;
-                        hostLo = ((data.dst_addr_lo() & ~maskLo) + u) & ~maskLo;
-                    } 
-                    else if (data.dst_addr_mode() == OstProto::Ip6::kDecHost) {
-                        hostHi = ((data.dst_addr_hi() & ~maskHi) - u) & ~maskHi;
-                        hostLo = ((data.dst_addr_lo() & ~maskLo) - u) & ~maskLo;
-                    } 
-                    else if (data.dst_addr_mode()==OstProto::Ip6::kRandomHost) {
-                        hostHi = qrand() & ~maskHi;
-                        hostLo = qrand() & ~maskLo;
-                    }
-                    dstHi = prefixHi | hostHi;
-                    dstLo = prefixLo | hostLo;
-                    break;
-                default:
-                    qWarning("Unhandled dst_addr_mode = %d", 
-                            data.dst_addr_mode());
-            }
+            dstAddress(streamIndex, &dstHi, &dstLo);
 
             switch(attrib)
             {
@@ -756,6 +668,159 @@ _exit:
     return isOk;
 }
 
+int Ip6Protocol::writeFrameValue(uchar *buf, int bufSize,
+        int streamIndex, bool forCksum) const
+{
+    if (bufSize < 40)
+        return AbstractProtocol::writeFrameValue(buf, bufSize,
+                                                 streamIndex, forCksum);
+
+    quint8 ver = data.is_override_version() ? data.version() & 0xF : 0x6;
+    quint16 len = data.is_override_payload_length() ?
+                    data.payload_length() : protocolFramePayloadSize(streamIndex);
+    quint8 nextHdr;
+    quint64 hi, lo;
+
+    if (data.is_override_next_header())
+        nextHdr = data.next_header();
+    else {
+        nextHdr = payloadProtocolId(ProtocolIdIp);
+        if ((nextHdr == 0)
+                && next
+                && (next->protocolIdType() == ProtocolIdNone)) {
+            nextHdr = 0x3b; // IPv6 No-Next-Header
+        }
+    }
+
+    qToBigEndian(quint32((ver << 28)
+                         | ((data.traffic_class() & 0xFF) << 20)
+                         | (data.flow_label() & 0xFFFFF)), buf);
+    qToBigEndian(len, buf + 4);
+    buf[6] = nextHdr;
+    buf[7] = data.hop_limit() & 0xFF;
+
+    srcAddress(streamIndex, &hi, &lo);
+    qToBigEndian(hi, buf + 8);
+    qToBigEndian(lo, buf + 16);
+
+    dstAddress(streamIndex, &hi, &lo);
+    qToBigEndian(hi, buf + 24);
+    qToBigEndian(lo, buf + 32);
+
+    varyProtocolFrameValue(buf, 40, streamIndex);
+    return 40;
+}
+
+void Ip6Protocol::srcAddress(int streamIndex,
+        quint64 *srcHi, quint64 *srcLo) const
+{
+    int u, p, q;
+    quint64 maskHi = 0, maskLo = 0;
+    quint64 prefixHi, prefixLo;
+    quint64 hostHi = 0, hostLo = 0;
+
+    *srcHi = *srcLo = 0;
+    switch(data.src_addr_mode())
+    {
+        case OstProto::Ip6::kFixed:
+            *srcHi = data.src_addr_hi();
+            *srcLo = data.src_addr_lo();
+            break;
+        case OstProto::Ip6::kIncHost:
+        case OstProto::Ip6::kDecHost:
+        case OstProto::Ip6::kRandomHost:
+            u = streamIndex % data.src_addr_count();
+            if (data.src_addr_prefix() > 64) {
+                p = 64;
+                q = data.src_addr_prefix() - 64;
+            } else {
+                p = data.src_addr_prefix();
+                q = 0;
+            }
+            if (p > 0) 
+                maskHi = ~((quint64(1) << p) - 1);
+            if (q > 0) 
+                maskLo = ~((quint64(1) << q) - 1);
+            prefixHi = data.src_addr_hi() & maskHi;
+            prefixLo = data.src_addr_lo() & maskLo;
+            if (data.src_addr_mode() == OstProto::Ip6::kIncHost) {
+                hostHi = ((data.src_addr_hi() & ~maskHi) + u) & ~maskHi;
+                hostLo = ((data.src_addr_lo() & ~maskLo) + u) & ~maskLo;
+            } 
+            else if (data.src_addr_mode() == OstProto::Ip6::kDecHost) {
+                hostHi = ((data.src_addr_hi() & ~maskHi) - u) & ~maskHi;
+                hostLo = ((data.src_addr_lo() & ~maskLo) - u) & ~maskLo;
+            } 
+            else if (data.src_addr_mode()==OstProto::Ip6::kRandomHost) {
+                Pcg32 rng = random(streamIndex, ip6_srcAddress);
+
+                hostHi = ((quint64(rng.next()) << 32) | rng.next()) & ~maskHi;
+                hostLo = ((quint64(rng.next()) << 32) | rng.next()) & ~maskLo;
+            }
+            *srcHi = prefixHi | hostHi;
+            *srcLo = prefixLo | hostLo;
+            break;
+        default:
+            qWarning("Unhandled src_addr_mode = %d", 
+                    data.src_addr_mode());
+    }
+}
+
+void Ip6Protocol::dstAddress(int streamIndex,
+        quint64 *dstHi, quint64 *dstLo) const
+{
+    int u, p, q;
+    quint64 maskHi = 0, maskLo = 0;
+    quint64 prefixHi, prefixLo;
+    quint64 hostHi = 0, hostLo = 0;
+
+    *dstHi = *dstLo = 0;
+    switch(data.dst_addr_mode())
+    {
+        case OstProto::Ip6::kFixed:
+            *dstHi = data.dst_addr_hi();
+            *dstLo = data.dst_addr_lo();
+            break;
+        case OstProto::Ip6::kIncHost:
+        case OstProto::Ip6::kDecHost:
+        case OstProto::Ip6::kRandomHost:
+            u = streamIndex % data.dst_addr_count();
+            if (data.dst_addr_prefix() > 64) {
+                p = 64;
+                q = data.dst_addr_prefix() - 64;
+            } else {
+                p = data.dst_addr_prefix();
+                q = 0;
+            }
+            if (p > 0) 
+                maskHi = ~((quint64(1) << p) - 1);
+            if (q > 0) 
+                maskLo = ~((quint64(1) << q) - 1);
+            prefixHi = data.dst_addr_hi() & maskHi;
+            prefixLo = data.dst_addr_lo() & maskLo;
+            if (data.dst_addr_mode() == OstProto::Ip6::kIncHost) {
+                hostHi = ((data.dst_addr_hi() & ~maskHi) + u) & ~maskHi;
+                hostLo = ((data.dst_addr_lo() & ~maskLo) + u) & ~maskLo;
+            } 
+            else if (data.dst_addr_mode() == OstProto::Ip6::kDecHost) {
+                hostHi = ((data.dst_addr_hi() & ~maskHi) - u) & ~maskHi;
+                hostLo = ((data.dst_addr_lo() & ~maskLo) - u) & ~maskLo;
+            } 
+            else if (data.dst_addr_mode()==OstProto::Ip6::kRandomHost) {
+                Pcg32 rng = random(streamIndex, ip6_dstAddress);
+
+                hostHi = ((quint64(rng.next()) << 32) | rng.next()) & ~maskHi;
+                hostLo = ((quint64(rng.next()) << 32) | rng.next()) & ~maskLo;
+            }
+            *dstHi = prefixHi | hostHi;
+            *dstLo = prefixLo | hostLo;
+            break;
+        default:
+            qWarning("Unhandled dst_addr_mode = %d", 
+                    data.dst_addr_mode());
+    }
+}
+
 int Ip6Protocol::protocolFrameVariableCount() const
 {
     int count = AbstractProtocol::protocolFrameVariableCount();
@@ -769,6 +834,13 @@ int Ip6Protocol::protocolFrameVariableCount() const
     return count;
 }
 
+bool Ip6Protocol::isProtocolFrameValueRandom() const
+{
+    return (AbstractProtocol::isProtocolFrameValueRandom()
+            || (data.src_addr_mode() == OstProto::Ip6::kRandomHost)
+            || (data.dst_addr_mode() == OstProto::Ip6::kRandomHost));
+}
+
 quint32 Ip6Protocol::protocolFrameCksum(int streamIndex, 
         CksumType cksumType) const
 {
@@ -779,8 +851,7 @@ quint32 Ip6Protocol::protocolFrameCksum(int streamIndex,
         const quint8 *p = (quint8*) fv.constData();
 
         // src-ip, dst-ip
-        for (int i = 8; i < fv.size(); i+=2)
-            sum += *((quint16*)(p + i));
+        sum += onesComplementSum(p + 8, fv.size() - 8);
         sum += *((quint16*)(p + 4)); // payload len
         sum += qToBigEndian((quint16) *(p + 6)); // proto
 
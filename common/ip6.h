@@ -100,11 +100,18 @@ public:
     virtual bool setFieldData(int index, const QVariant &value, 
             FieldAttrib attrib = FieldValue);
 
+    virtual int writeFrameValue(uchar *buf, int bufSize,
+        int streamIndex = 0, bool forCksum = false) const;
+
     virtual int protocolFrameVariableCount() const;
+    virtual bool isProtocolFrameValueRandom() const;
 
     virtual quint32 protocolFrameCksum(int streamIndex = 0,
             CksumType cksumType = CksumIp) const;
 private:
+    void srcAddress(int streamIndex, quint64 *srcHi, quint64 *srcLo) const;
+    void dstAddress(int streamIndex, quint64 *dstHi, quint64 *dstLo) const;
+
     OstProto::Ip6 data;
 };
 
@@ -109,36 +109,7 @@ QVariant MacProtocol::fieldData(int index, FieldAttrib attrib,
     {
         case mac_dstAddr:
         {
-            int u;
-            quint64 dstMac = 0;
-
-            switch (data.dst_mac_mode())
-            {
-                case OstProto::Mac::e_mm_fixed:
-                    dstMac = data.dst_mac();
-                    break;
-                case OstProto::Mac::e_mm_inc:
-                    u = (streamIndex % data.dst_mac_count()) * 
-                        data.dst_mac_step(); 
-                    dstMac = data.dst_mac() + u;
-                    break;
-                case OstProto::Mac::e_mm_dec:
-                    u = (streamIndex % data.dst_mac_count()) * 
-                        data.dst_mac_step(); 
-                    dstMac = data.dst_mac() - u;
-                    break;
-                case OstProto::Mac::e_mm_resolve:
-                    if (forResolve_)
-                        dstMac = 0;
-                    else {
-                        forResolve_ = true;
-                        dstMac = mpStream->neighborMacAddress(streamIndex);
-                        forResolve_ = false;
-                    }
-                    break;
-                default:
-                    qWarning("Unhandled dstMac_mode %d", data.dst_mac_mode());
-            }
+            quint64 dstMac = dstMacAddress(streamIndex);
 
             switch(attrib)
             {
@@ -163,36 +134,7 @@ QVariant MacProtocol::fieldData(int index, FieldAttrib attrib,
         }
         case mac_srcAddr:
         {
-            int u;
-            quint64 srcMac = 0;
-
-            switch (data.src_mac_mode())
-            {
-                case OstProto::Mac::e_mm_fixed:
-                    srcMac = data.src_mac();
-                    break;
-                case OstProto::Mac::e_mm_inc:
-                    u = (streamIndex % data.src_mac_count()) * 
-                        data.src_mac_step(); 
-                    srcMac = data.src_mac() + u;
-                    break;
-                case OstProto::Mac::e_mm_dec:
-                    u = (streamIndex % data.src_mac_count()) * 
-                        data.src_mac_step(); 
-                    srcMac = data.src_mac() - u;
-                    break;
-                case OstProto::Mac::e_mm_resolve:
-                    if (forResolve_)
-                        srcMac = 0;
-                    else {
-                        forResolve_ = true;
-                        srcMac = mpStream->deviceMacAddress(streamIndex);
-                        forResolve_ = false;
-                    }
-                    break;
-                default:
-                    qWarning("Unhandled srcMac_mode %d", data.src_mac_mode());
-            }
+            quint64 srcMac = srcMacAddress(streamIndex);
 
             switch(attrib)
             {
@@ -346,6 +288,104 @@ _exit:
     return isOk;
 }
 
+int MacProtocol::writeFrameValue(uchar *buf, int bufSize,
+        int streamIndex, bool forCksum) const
+{
+    if (bufSize < 12)
+        return AbstractProtocol::writeFrameValue(buf, bufSize,
+                                                 streamIndex, forCksum);
+
+    quint64 dstMac = dstMacAddress(streamIndex);
+    quint64 srcMac = srcMacAddress(streamIndex);
+
+    qToBigEndian(quint16(dstMac >> 32), buf);
+    qToBigEndian(quint32(dstMac), buf + 2);
+    qToBigEndian(quint16(srcMac >> 32), buf + 6);
+    qToBigEndian(quint32(srcMac), buf + 8);
+
+    varyProtocolFrameValue(buf, 12, streamIndex);
+    return 12;
+}
+
+quint64 MacProtocol::dstMacAddress(int streamIndex) const
+{
+    int u;
+    quint64 dstMac = 0;
+
+    switch (data.dst_mac_mode())
+    {
+        case OstProto::Mac::e_mm_fixed:
+            dstMac = data.dst_mac();
+            break;
+        case OstProto::Mac::e_mm_inc:
+            u = (streamIndex % data.dst_mac_count()) * 
+                data.dst_mac_step(); 
+            dstMac = data.dst_mac() + u;
+            break;
+        case OstProto::Mac::e_mm_dec:
+            u = (streamIndex % data.dst_mac_count()) * 
+                data.dst_mac_step(); 
+            dstMac = data.dst_mac() - u;
+            break;
+        case OstProto::Mac::e_mm_resolve:
+            if (forResolve_)
+                dstMac = 0;
+            else {
+                forResolve_ = true;
+                dstMac = mpStream->neighborMacAddress(streamIndex);
+                forResolve_ = false;
+            }
+            break;
+        default:
+            qWarning("Unhandled dstMac_mode %d", data.dst_mac_mode());
+    }
+
+    return dstMac;
+}
+
+quint64 MacProtocol::srcMacAddress(int streamIndex) const
+{
+    int u;
+    quint64 srcMac = 0;
+
+    switch (data.src_mac_mode())
+    {
+        case OstProto::Mac::e_mm_fixed:
+            srcMac = data.src_mac();
+            break;
+        case OstProto::Mac::e_mm_inc:
+            u = (streamIndex % data.src_mac_count()) * 
+                data.src_mac_step(); 
+            srcMac = data.src_mac() + u;
+            break;
+        case OstProto::Mac::e_mm_dec:
+            u = (streamIndex % data.src_mac_count()) * 
+                data.src_mac_step(); 
+            srcMac = data.src_mac() - u;
+            break;
+        case OstProto::Mac::e_mm_resolve:
+            if (forResolve_)
+                srcMac = 0;
+            else {
+                forResolve_ = true;
+                srcMac = mpStream->deviceMacAddress(streamIndex);
+                forResolve_ = false;
+            }
+            break;
+        default:
+            qWarning("Unhandled srcMac_mode %d", data.src_mac_mode());
+    }
+
+    return srcMac;
+}
+
+bool MacProtocol::isProtocolFrameValueDependent() const
+{
+    // Resolved mac addresses depend on the IP addresses in the frame
+    return (data.dst_mac_mode() == OstProto::Mac::e_mm_resolve)
+        || (data.src_mac_mode() == OstProto::Mac::e_mm_resolve);
+}
+
 int MacProtocol::protocolFrameVariableCount() const
 {
     int count = AbstractProtocol::protocolFrameVariableCount();
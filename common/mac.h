@@ -63,9 +63,16 @@ public:
     virtual bool setFieldData(int index, const QVariant &value, 
             FieldAttrib attrib = FieldValue);
 
+    virtual int writeFrameValue(uchar *buf, int bufSize,
+        int streamIndex = 0, bool forCksum = false) const;
+
+    virtual bool isProtocolFrameValueDependent() const;
     virtual int protocolFrameVariableCount() const;
 
 private:
+    quint64 dstMacAddress(int streamIndex) const;
+    quint64 srcMacAddress(int streamIndex) const;
+
     OstProto::Mac    data;
     mutable bool forResolve_;
 };
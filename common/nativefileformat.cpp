@@ -23,7 +23,9 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 
 #include <QApplication>
 #include <QFile>
+#include <QList>
 #include <QVariant>
+#include <QtEndian>
 
 #define tr(str) QObject::tr(str)
 
@@ -77,7 +79,7 @@ bool NativeFileFormat::open(
 {
     QFile file(fileName);
     QByteArray buf;
-    int size, contentOffset, contentSize;
+    int size, metaSize, contentOffset, contentSize;
     quint32 calcCksum;
     OstProto::FileMagic magic;
     OstProto::FileChecksum cksum, zeroCksum;
@@ -88,22 +90,10 @@ bool NativeFileFormat::open(
     if (file.size() < kFileMagicSize)
         goto _magic_missing;
 
-    if (file.size() < kFileMinSize)
-        goto _checksum_missing;
-
-    buf.resize(file.size());
-    size = file.read(buf.data(), buf.size());
-    if (size < 0)
-        goto _read_fail;
-
-    Q_ASSERT(file.atEnd());
-    file.close();
-
-    qDebug("%s: file.size() = %lld", __FUNCTION__, file.size());
-    qDebug("%s: size = %d", __FUNCTION__, size);
-
-    //qDebug("Read %d bytes", buf.size());
-    //qDebug("%s", QString(buf.toHex()).toAscii().constData());
+    // Magic and meta data are at the same place in all format versions -
+    // the version in the meta data decides how the rest is laid out
+    // Assume tag/length for MetaData will fit in 8 bytes
+    buf = file.peek(kFileMagicOffset + kFileMagicSize + 8);
 
     // Parse and verify magic
     if (!magic.ParseFromArray(
@@ -115,34 +105,12 @@ bool NativeFileFormat::open(
     if (magic.value() != kFileMagicValue)
         goto _magic_match_fail;
 
-    // Parse and verify checksum
-    if (!cksum.ParseFromArray(
-            (void*)(buf.constData() + size - kFileChecksumSize),
-            kFileChecksumSize))
-    {
-        goto _cksum_parse_fail;
-    }
-
-    zeroCksum.set_value(0);
-    if (!zeroCksum.SerializeToArray(
-                (void*) (buf.data() + size - kFileChecksumSize),
-                kFileChecksumSize))
-    {
-        goto _zero_cksum_serialize_fail;
-    }
-
-    calcCksum = checksumCrc32C((quint8*) buf.constData(), size);
-
-    qDebug("checksum \nExpected:%x Actual:%x",
-        calcCksum, cksum.value());
-
-    if (cksum.value() != calcCksum)
-        goto _cksum_verify_fail;
-
     // Parse the metadata first before we parse the full contents
-    if (!meta.ParseFromArray(
-                (void*)(buf.constData() + kFileMetaDataOffset),
-                fileMetaSize((quint8*)buf.constData(), size)))
+    metaSize = fileMetaSize((quint8*)buf.constData(), buf.size());
+    buf = file.read(kFileMetaDataOffset + metaSize);
+    if ((metaSize == 0) || (buf.size() != (kFileMetaDataOffset + metaSize))
+            || !meta.ParseFromArray(
+                (void*)(buf.constData() + kFileMetaDataOffset), metaSize))
     {
         goto _metadata_parse_fail;
     }
@@ -175,8 +143,55 @@ bool NativeFileFormat::open(
 
     Q_ASSERT(meta.data().format_version_major() == kFileFormatVersionMajor);
 
-    // ByteSize() does not include the Tag/Key, so we add 2 for that
-    contentOffset = kFileMetaDataOffset + meta.data().ByteSize() + 2;
+    if (meta.data().format_version_minor() >= kFileFormatChunkedMinor)
+    {
+        if (!openChunks(file, fileType, content, error))
+            goto _fail;
+        return true;
+    }
+
+    // Older files are a single File message with a checksum of the
+    // whole file at the end
+    if (file.size() < kFileMinSize)
+        goto _checksum_missing;
+
+    file.seek(0);
+    buf.resize(file.size());
+    size = file.read(buf.data(), buf.size());
+    if (size < 0)
+        goto _read_fail;
+
+    Q_ASSERT(file.atEnd());
+    file.close();
+
+    qDebug("%s: file.size() = %lld", __FUNCTION__, file.size());
+    qDebug("%s: size = %d", __FUNCTION__, size);
+
+    // Parse and verify checksum
+    if (!cksum.ParseFromArray(
+            (void*)(buf.constData() + size - kFileChecksumSize),
+            kFileChecksumSize))
+    {
+        goto _cksum_parse_fail;
+    }
+
+    zeroCksum.set_value(0);
+    if (!zeroCksum.SerializeToArray(
+                (void*) (buf.data() + size - kFileChecksumSize),
+                kFileChecksumSize))
+    {
+        goto _zero_cksum_serialize_fail;
+    }
+
+    calcCksum = checksumCrc32C((quint8*) buf.constData(), size);
+
+    qDebug("checksum \nExpected:%x Actual:%x",
+        calcCksum, cksum.value());
+
+    if (cksum.value() != calcCksum)
+        goto _cksum_verify_fail;
+
+    contentOffset = kFileMetaDataOffset + metaSize;
     contentSize = size - contentOffset - kFileChecksumSize;
     qDebug("%s: content offset/size = %d/%d", __FUNCTION__,
             contentOffset, contentSize);
@@ -275,19 +290,13 @@ bool NativeFileFormat::save(
 {
     OstProto::FileMagic magic;
     OstProto::FileMeta meta;
-    OstProto::FileChecksum cksum;
     QFile file(fileName);
-    int metaSize, contentSize;
-    int contentOffset, cksumOffset;
+    int metaSize;
     QByteArray buf;
-    quint32 calcCksum;
 
     magic.set_value(kFileMagicValue);
     Q_ASSERT(magic.IsInitialized());
 
-    cksum.set_value(0);
-    Q_ASSERT(cksum.IsInitialized());
-
     initFileMetaData(*(meta.mutable_data()));
     meta.mutable_data()->set_file_type(fileType);
     Q_ASSERT(meta.IsInitialized());
@@ -298,15 +307,12 @@ bool NativeFileFormat::save(
     Q_ASSERT(content.IsInitialized());
 
     metaSize = meta.ByteSize();
-    contentSize = content.ByteSize();
-    contentOffset = kFileMetaDataOffset + metaSize;
-    cksumOffset = contentOffset + contentSize;
 
     Q_ASSERT(magic.ByteSize() == kFileMagicSize);
-    Q_ASSERT(cksum.ByteSize() == kFileChecksumSize);
-    buf.resize(kFileMagicSize + metaSize + contentSize + kFileChecksumSize);
+    buf.resize(kFileMagicSize + metaSize);
 
-    // Serialize everything
+    // Serialize magic and meta data - the content is serialized and
+    // written one chunk at a time by saveChunks()
     if (!magic.SerializeToArray((void*) (buf.data() + kFileMagicOffset),
                 kFileMagicSize))
     {
@@ -319,33 +325,6 @@ bool NativeFileFormat::save(
         goto _meta_serialize_fail;
     }
 
-    if (!content.SerializeToArray((void*) (buf.data() + contentOffset),
-                contentSize))
-    {
-        goto _content_serialize_fail;
-    }
-
-    if (!cksum.SerializeToArray((void*) (buf.data() + cksumOffset),
-                kFileChecksumSize))
-    {
-        goto _zero_cksum_serialize_fail;
-    }
-
-    // TODO: emit status("Calculating checksum...");
-
-    // Calculate and write checksum
-    calcCksum = checksumCrc32C((quint8*)buf.constData(), buf.size());
-    cksum.set_value(calcCksum);
-    if (!cksum.SerializeToArray(
-                (void*) (buf.data() + cksumOffset),
-                kFileChecksumSize))
-    {
-        goto _cksum_serialize_fail;
-    }
-
-    qDebug("Writing %d bytes", buf.size());
-    //qDebug("%s", QString(buf.toHex()).toAscii().constData());
-
     // TODO: emit status("Writing to disk...");
     if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
         goto _open_fail;
@@ -353,6 +332,9 @@ bool NativeFileFormat::save(
     if (file.write(buf) < 0)
         goto _write_fail;
 
+    if (!saveChunks(file, fileType, content, error))
+        goto _fail;
+
     file.close();
 
     return true;
@@ -365,24 +347,6 @@ _open_fail:
         .arg(fileName)
         .arg(file.error());
     goto _fail;
-_cksum_serialize_fail:
-    error = QString(tr("Internal Error: Checksum Serialize failed\n%1\n%2"))
-                .arg(QString().fromStdString(
-                            cksum.InitializationErrorString()))
-                .arg(QString().fromStdString(cksum.DebugString()));
-    goto _fail;
-_zero_cksum_serialize_fail:
-    error = QString(tr("Internal Eror: Zero Checksum Serialize failed\n%1\n%2"))
-                .arg(QString().fromStdString(
-                            cksum.InitializationErrorString()))
-                .arg(QString().fromStdString(cksum.DebugString()));
-    goto _fail;
-_content_serialize_fail:
-    error = QString(tr("Internal Error: Content Serialize failed\n%1\n%2"))
-                .arg(QString().fromStdString(
-                            content.InitializationErrorString()))
-                .arg(QString().fromStdString(content.DebugString()));
-    goto _fail;
 _meta_serialize_fail:
     error = QString(tr("Internal Error: Meta Data Serialize failed\n%1\n%2"))
                 .arg(QString().fromStdString(
@@ -406,6 +370,311 @@ _fail:
     return false;
 }
 
+/*!
+  Reads the chunks following the meta data into content - see FileChunk
+  in fileformat.proto
+
+  Only the chunk being read is in memory (besides content) - each chunk's
+  checksum is verified and its message moved into content as it is read
+*/
+bool NativeFileFormat::openChunks(QFile &file, OstProto::FileType fileType,
+        OstProto::FileContent &content, QString &error)
+{
+    OstProto::FileChunk chunk;
+    QByteArray buf;
+    OstProto::StreamConfigList *streams = NULL;
+    OstProto::SessionContent *session = NULL;
+    QList<OstProto::PortContent*> ports; // in port_index order
+    int count = 0;
+
+    if (fileType == OstProto::kSessionFileType)
+        session = content.mutable_matter()->mutable_session();
+
+    forever
+    {
+        if (!readChunk(file, chunk, buf, error))
+            return false;
+
+        if (chunk.end())
+            break;
+
+        if (chunk.has_streams())
+        {
+            streams = content.mutable_matter()->mutable_streams();
+            streams->Swap(chunk.mutable_streams());
+        }
+        else if (chunk.has_port_group() && session)
+        {
+            session->add_port_groups()->Swap(chunk.mutable_port_group());
+        }
+        else if (chunk.has_port() && session && session->port_groups_size())
+        {
+            OstProto::PortContent *port = session->mutable_port_groups(
+                        session->port_groups_size() - 1)->add_ports();
+
+            port->Swap(chunk.mutable_port());
+            ports.append(port);
+        }
+        else if (chunk.has_stream())
+        {
+            if (chunk.has_port_index()
+                    && (chunk.port_index() < uint(ports.size())))
+                ports.at(chunk.port_index())->add_streams()->Swap(
+                        chunk.mutable_stream());
+            else if (streams)
+                streams->add_stream()->Swap(chunk.mutable_stream());
+            else
+                goto _orphan_chunk;
+        }
+        else if (chunk.has_device_group())
+        {
+            if (!chunk.has_port_index()
+                    || (chunk.port_index() >= uint(ports.size())))
+                goto _orphan_chunk;
+            ports.at(chunk.port_index())->add_device_groups()->Swap(
+                    chunk.mutable_device_group());
+        }
+        else
+        {
+            // Possibly from a newer revision - skip it
+            qDebug("%s: skipping unknown chunk at %lld", __FUNCTION__,
+                    file.pos());
+        }
+
+        chunk.Clear();
+
+        // Progress is in KB read, so that it fits an int
+        if ((++count % kChunkProgressInterval == 0)
+                && !chunkProgress(int(file.pos() >> 10),
+                                  int(file.size() >> 10)))
+        {
+            qDebug("%s: cancelled at %lld", __FUNCTION__, file.pos());
+            break; // user cancel - content is incomplete
+        }
+    }
+
+    return true;
+
+_orphan_chunk:
+    error = QString(tr("Failed parsing %1 contents - unexpected chunk at "
+                "offset %2")).arg(file.fileName()).arg(file.pos());
+    return false;
+}
+
+/*!
+  Writes content as chunks - see FileChunk in fileformat.proto
+
+  \note Only the fields of PortGroupContent and PortContent other than
+  the repeated ones are written in port group and port chunks - those
+  need to be added here if new fields are added to these messages
+*/
+bool NativeFileFormat::saveChunks(QFile &file, OstProto::FileType fileType,
+        const OstProto::FileContent &content, QString &error)
+{
+    OstProto::FileChunk chunk;
+    QByteArray buf;
+    int done = 0, total = 0;
+
+    Q_UNUSED(fileType);
+
+    // Progress is reported in streams and device groups written
+    if (content.matter().has_streams())
+        total += content.matter().streams().stream_size();
+    for (int i = 0; i < content.matter().session().port_groups_size(); i++)
+    {
+        const OstProto::PortGroupContent &pg =
+                content.matter().session().port_groups(i);
+        for (int j = 0; j < pg.ports_size(); j++)
+            total += pg.ports(j).streams_size()
+                        + pg.ports(j).device_groups_size();
+    }
+
+    if (content.matter().has_streams())
+    {
+        const OstProto::StreamConfigList &streams = content.matter().streams();
+
+        chunk.mutable_streams()->mutable_port_id()->CopyFrom(
+                streams.port_id());
+        if (!writeChunk(file, chunk, buf))
+            goto _write_fail;
+        chunk.Clear();
+
+        for (int i = 0; i < streams.stream_size(); i++)
+        {
+            chunk.mutable_stream()->CopyFrom(streams.stream(i));
+            if (!writeChunk(file, chunk, buf))
+                goto _write_fail;
+            chunk.Clear();
+
+            if ((++done % kChunkProgressInterval == 0)
+                    && !chunkProgress(done, total))
+                goto _user_cancel;
+        }
+    }
+
+    if (content.matter().has_session())
+    {
+        const OstProto::SessionContent &session = content.matter().session();
+        uint portIndex = 0;
+
+        // All port groups and ports first ...
+        for (int i = 0; i < session.port_groups_size(); i++)
+        {
+            const OstProto::PortGroupContent &pg = session.port_groups(i);
+
+            if (pg.has_server_name())
+                chunk.mutable_port_group()->set_server_name(pg.server_name());
+            if (pg.has_server_port())
+                chunk.mutable_port_group()->set_server_port(pg.server_port());
+            chunk.mutable_port_group(); // even if none of the above
+            if (!writeChunk(file, chunk, buf))
+                goto _write_fail;
+            chunk.Clear();
+
+            for (int j = 0; j < pg.ports_size(); j++)
+            {
+                if (pg.ports(j).has_port_config())
+                    chunk.mutable_port()->mutable_port_config()->CopyFrom(
+                            pg.ports(j).port_config());
+                chunk.mutable_port();
+                if (!writeChunk(file, chunk, buf))
+                    goto _write_fail;
+                chunk.Clear();
+            }
+        }
+
+        // ... followed by the streams and device groups of each port
+        for (int i = 0; i < session.port_groups_size(); i++)
+        {
+            const OstProto::PortGroupContent &pg = session.port_groups(i);
+
+            for (int j = 0; j < pg.ports_size(); j++, portIndex++)
+            {
+                const OstProto::PortContent &port = pg.ports(j);
+
+                for (int k = 0; k < port.streams_size(); k++)
+                {
+                    chunk.set_port_index(portIndex);
+                    chunk.mutable_stream()->CopyFrom(port.streams(k));
+                    if (!writeChunk(file, chunk, buf))
+                        goto _write_fail;
+                    chunk.Clear();
+
+                    if ((++done % kChunkProgressInterval == 0)
+                            && !chunkProgress(done, total))
+                        goto _user_cancel;
+                }
+
+                for (int k = 0; k < port.device_groups_size(); k++)
+                {
+                    chunk.set_port_index(portIndex);
+                    chunk.mutable_device_group()->CopyFrom(
+                            port.device_groups(k));
+                    if (!writeChunk(file, chunk, buf))
+                        goto _write_fail;
+                    chunk.Clear();
+
+                    if ((++done % kChunkProgressInterval == 0)
+                            && !chunkProgress(done, total))
+                        goto _user_cancel;
+                }
+            }
+        }
+    }
+
+    chunk.set_end(true);
+    if (!writeChunk(file, chunk, buf))
+        goto _write_fail;
+
+    return true;
+
+_user_cancel:
+    // Don't leave behind a file without an end chunk
+    qDebug("%s: cancelled after %d of %d", __FUNCTION__, done, total);
+    file.remove();
+    return true;
+
+_write_fail:
+    error = QString(tr("Error writing to %1")).arg(file.fileName());
+    return false;
+}
+
+bool NativeFileFormat::readChunk(QFile &file, OstProto::FileChunk &chunk,
+        QByteArray &buf, QString &error)
+{
+    uchar hdr[kChunkHeaderSize];
+    quint32 size, cksum, calcCksum;
+    qint64 offset = file.pos();
+
+    if (file.read((char*) hdr, kChunkHeaderSize) != kChunkHeaderSize)
+        goto _truncated;
+
+    size = qFromLittleEndian<quint32>(hdr);
+    cksum = qFromLittleEndian<quint32>(hdr + 4);
+
+    if (qint64(size) > (file.size() - file.pos()))
+        goto _truncated;
+
+    buf.resize(int(size));
+    if (file.read(buf.data(), size) != qint64(size))
+        goto _read_fail;
+
+    calcCksum = checksumCrc32C((quint8*) buf.data(), size);
+    if (calcCksum != cksum)
+        goto _cksum_verify_fail;
+
+    if (!chunk.ParseFromArray((void*) buf.constData(), size))
+        goto _chunk_parse_fail;
+
+    return true;
+
+_chunk_parse_fail:
+    error = QString(tr("Failed parsing %1 contents at offset %2"))
+                .arg(file.fileName()).arg(offset);
+    qDebug("Error: %s", QString().fromStdString(
+            chunk.InitializationErrorString())
+                .toAscii().constData());
+    return false;
+_cksum_verify_fail:
+    error = QString(tr("%1 checksum validation failed at offset %2!\n"
+                "Expected:%3 Actual:%4"))
+                .arg(file.fileName())
+                .arg(offset)
+                .arg(calcCksum, 0, kBaseHex)
+                .arg(cksum, 0, kBaseHex);
+    return false;
+_read_fail:
+    error = QString(tr("Error reading from %1")).arg(file.fileName());
+    return false;
+_truncated:
+    error = QString(tr("%1 is truncated at offset %2"))
+                .arg(file.fileName()).arg(offset);
+    return false;
+}
+
+bool NativeFileFormat::writeChunk(QFile &file,
+        const OstProto::FileChunk &chunk, QByteArray &buf)
+{
+    int size = chunk.ByteSize();
+
+    buf.resize(kChunkHeaderSize + size);
+    if (!chunk.SerializeToArray((void*) (buf.data() + kChunkHeaderSize),
+                size))
+        return false;
+
+    qToLittleEndian<quint32>(quint32(size), (uchar*) buf.data());
+    qToLittleEndian<quint32>(checksumCrc32C(
+                (quint8*) buf.data() + kChunkHeaderSize, size),
+            (uchar*) buf.data() + 4);
+
+    return file.write(buf) == buf.size();
+}
+
+bool NativeFileFormat::chunkProgress(int /*done*/, int /*total*/)
+{
+    return true;
+}
+
 bool NativeFileFormat::isNativeFileFormat(
         const QString fileName,
         OstProto::FileType fileType)
@@ -526,6 +795,7 @@ void NativeFileFormat::postParseFixup(OstProto::FileMetaData metaData,
 
         // fall-through to next higher version until native version
     }
+    case 2: // same content as 3, but not chunked
     case kFileFormatVersionMinor: // native version
         break;
 
@@ -33,8 +33,11 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 
 #include "fileformat.pb.h"
 
+#include <QByteArray>
 #include <QString>
 
+class QFile;
+
 class NativeFileFormat
 {
 public:
@@ -55,10 +58,24 @@ public:
     void postParseFixup(OstProto::FileMetaData metaData,
                         OstProto::FileContent &content);
 
+protected:
+    // Called every kChunkProgressInterval chunks while reading or writing
+    // a chunked file - returning false cancels the operation
+    virtual bool chunkProgress(int done, int total);
+
 private:
     void initFileMetaData(OstProto::FileMetaData &metaData);
     int fileMetaSize(const quint8* file, int size);
 
+    bool openChunks(QFile &file, OstProto::FileType fileType,
+                    OstProto::FileContent &content, QString &error);
+    bool saveChunks(QFile &file, OstProto::FileType fileType,
+                    const OstProto::FileContent &content, QString &error);
+    bool readChunk(QFile &file, OstProto::FileChunk &chunk,
+                   QByteArray &buf, QString &error);
+    bool writeChunk(QFile &file, const OstProto::FileChunk &chunk,
+                    QByteArray &buf);
+
     static const int kFileMagicSize = 12;
     static const int kFileChecksumSize = 5;
     static const int kFileMinSize = kFileMagicSize + kFileChecksumSize;
@@ -66,12 +83,19 @@ private:
     static const int kFileMagicOffset = 0;
     static const int kFileMetaDataOffset = kFileMagicSize;
 
+    // Length + CRC32C
+    static const int kChunkHeaderSize = 8;
+    static const int kChunkProgressInterval = 64;
+
     static const char* kFileMagicValue;
 
     // Native file format version
     static const uint kFileFormatVersionMajor = 0;
-    static const uint kFileFormatVersionMinor = 2;
-    static const uint kFileFormatVersionRevision = 4;
+    static const uint kFileFormatVersionMinor = 3;
+    static const uint kFileFormatVersionRevision = 0;
+
+    // Files of this and later minor versions are a sequence of chunks
+    static const uint kFileFormatChunkedMinor = 3;
 };
 
 #endif
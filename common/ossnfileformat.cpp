@@ -37,12 +37,15 @@ bool OssnFileFormat::open(const QString fileName,
     if (!ret)
         goto _exit;
 
+    if (stop_)
+        return true; // user cancel - session is incomplete
+
     if (!content.matter().has_session())
         goto _missing_session;
 
     postParseFixup(meta.data(), content);
 
-    session.CopyFrom(content.matter().session());
+    session.Swap(content.mutable_matter()->mutable_session());
 
     return true;
 
@@ -55,19 +58,26 @@ _exit:
     return false;
 }
 
-bool OssnFileFormat::save(const OstProto::SessionContent &session,
+bool OssnFileFormat::save(OstProto::SessionContent &session,
         const QString fileName, QString &error)
 {
     OstProto::FileContent content;
+    bool ret;
 
     if (!session.IsInitialized())
         goto _session_not_init;
 
-    content.mutable_matter()->mutable_session()->CopyFrom(session);
+    // Borrow the session instead of copying it - a session can have
+    // a large number of streams
+    content.mutable_matter()->mutable_session()->Swap(&session);
     Q_ASSERT(content.IsInitialized());
 
-    return NativeFileFormat::save(OstProto::kSessionFileType, content,
-                                  fileName, error);
+    emit status("Writing session ...");
+    ret = NativeFileFormat::save(OstProto::kSessionFileType, content,
+                                 fileName, error);
+    session.Swap(content.mutable_matter()->mutable_session());
+
+    return ret;
 
 _session_not_init:
     error = QString(tr("Internal Error: Session not initialized\n%1\n%2"))
@@ -80,6 +90,14 @@ _fail:
     return false;
 }
 
+bool OssnFileFormat::chunkProgress(int done, int total)
+{
+    emit target(total);
+    emit progress(done);
+
+    return !stop_;
+}
+
 bool OssnFileFormat::isMyFileFormat(const QString fileName)
 {
     return isNativeFileFormat(fileName, OstProto::kSessionFileType);
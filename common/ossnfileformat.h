@@ -30,11 +30,14 @@ public:
 
     virtual bool open(const QString fileName,
             OstProto::SessionContent &session, QString &error);
-    virtual bool save(const OstProto::SessionContent &session,
+    virtual bool save(OstProto::SessionContent &session,
             const QString fileName, QString &error);
 
     virtual bool isMyFileFormat(const QString fileName);
     virtual bool isMyFileType(const QString fileType);
+
+protected:
+    virtual bool chunkProgress(int done, int total);
 };
 
 extern OssnFileFormat ossnFileFormat;
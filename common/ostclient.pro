@@ -0,0 +1,15 @@
+TEMPLATE = lib
+CONFIG += qt staticlib
+QT -= gui
+QT += network
+INCLUDEPATH += "../rpc/"
+LIBS += \
+    -lprotobuf
+
+HEADERS = \
+    droneclient.h
+
+SOURCES = \
+    droneclient.cpp
+
+QMAKE_DISTCLEAN += object_script.*
@@ -37,12 +37,15 @@ bool OstmFileFormat::open(const QString fileName,
     if (!ret)
         goto _fail;
 
+    if (stop_)
+        return true; // user cancel - streams are incomplete
+
     if (!content.matter().has_streams())
         goto _missing_streams;
 
     postParseFixup(meta.data(), content);
 
-    streams.CopyFrom(content.matter().streams());
+    streams.Swap(content.mutable_matter()->mutable_streams());
 
     return true;
 
@@ -79,6 +82,14 @@ _fail:
     return false;
 }
 
+bool OstmFileFormat::chunkProgress(int done, int total)
+{
+    emit target(total);
+    emit progress(done);
+
+    return !stop_;
+}
+
 bool OstmFileFormat::isMyFileFormat(const QString fileName)
 {
     return isNativeFileFormat(fileName, OstProto::kStreamsFileType);
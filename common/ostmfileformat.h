@@ -36,6 +36,9 @@ public:
 
     bool isMyFileFormat(const QString fileName);
     bool isMyFileType(const QString fileType);
+
+protected:
+    virtual bool chunkProgress(int done, int total);
 };
 
 extern OstmFileFormat fileFormat;
@@ -42,6 +42,11 @@ PROTOS += \
 
 HEADERS = \
     abstractprotocol.h    \
+    cksum.h \
+    framegenerator.h \
+    frametemplate.h \
+    pcapreader.h \
+    trace.h \
     comboprotocol.h    \
     protocolmanager.h \
     protocollist.h \
@@ -81,7 +86,11 @@ HEADERS += \
 
 SOURCES = \
     abstractprotocol.cpp \
+    cksum.cpp \
     crc32c.cpp \
+    framegenerator.cpp \
+    frametemplate.cpp \
+    pcapreader.cpp \
     protocolmanager.cpp \
     protocollist.cpp \
     protocollistiterator.cpp \
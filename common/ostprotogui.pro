@@ -35,6 +35,7 @@ PROTOS = \
 # TODO: Move fileformat related stuff into a different library - why?
 HEADERS = \
     ostprotolib.h \
+    gzipdevice.h \
     ipv4addressdelegate.h \
     ipv6addressdelegate.h \
     nativefileformat.h \
@@ -83,6 +84,7 @@ HEADERS += \
 
 SOURCES += \
     ostprotolib.cpp \
+    gzipdevice.cpp \
     nativefileformat.cpp \
     ossnfileformat.cpp \
     ostmfileformat.cpp \
@@ -18,11 +18,55 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 */
 
 #include "payload.h"
+#include "prng.h"
 #include "streambase.h"
+#include "trace.h"
+
+/*
+  Precomputed pages of the patterns that are the same for every stream -
+  a payload is memcpy'd from these instead of being generated byte by
+  byte. A random payload is a few chunks, each from a random offset of
+  a pool of random bytes; the offsets are from the frame's own random
+  sequence, so a frame has the same bytes every time (for its cksum)
+*/
+static const int kPatternPageSize = 16*1024; // more than a jumbo frame
+static const int kRandomPoolSize = 64*1024;
+static const int kRandomChunkSize = 1024;
+
+static struct PatternPages
+{
+    PatternPages()
+    {
+        Pcg32 rng(0x5eed, 0);
+
+        for (int i = 0; i < kPatternPageSize; i++) {
+            incByte[i] = i;
+            decByte[i] = 0xFF - i;
+        }
+        for (int i = 0; i < kRandomPoolSize; i += 4)
+            qToBigEndian(rng.next(), random + i);
+        // A chunk at the end of the pool doesn't need to wrap around
+        memcpy(random + kRandomPoolSize, random, kRandomChunkSize);
+    }
+
+    uchar incByte[kPatternPageSize];
+    uchar decByte[kPatternPageSize];
+    uchar random[kRandomPoolSize + kRandomChunkSize];
+} patternPages;
+
+// Copies len bytes of page (of kPatternPageSize) to buf, repeatedly
+static void copyPage(uchar *buf, int len, const uchar *page)
+{
+    for (int i = 0; i < len; i += kPatternPageSize)
+        memcpy(buf + i, page, qMin(len - i, kPatternPageSize));
+}
 
 PayloadProtocol::PayloadProtocol(StreamBase *stream, AbstractProtocol *parent)
     : AbstractProtocol(stream, parent)
 {
+    // Size depends on the frame length - no fixed frame layout; random
+    // data differs from frame to frame
+    _cacheFlags &= ~(FrameLayoutCache | FrameValueCache);
 }
 
 PayloadProtocol::~PayloadProtocol()
@@ -73,7 +117,7 @@ int PayloadProtocol::protocolFrameSize(int streamIndex) const
     if (len < 0)
         len = 0;
 
-    qDebug("%s: this = %p, streamIndex = %d, len = %d", __FUNCTION__, this,
+    qTrace("%s: this = %p, streamIndex = %d, len = %d", __FUNCTION__, this,
             streamIndex, len);
     return len;
 }
@@ -104,6 +148,45 @@ AbstractProtocol::FieldFlags PayloadProtocol::fieldFlags(int index) const
     return flags;
 }
 
+// Fills len bytes of buf with the data pattern
+void PayloadProtocol::fillPattern(uchar *buf, int len, int streamIndex) const
+{
+    switch(data.pattern_mode())
+    {
+        case OstProto::Payload::e_dp_fixed_word:
+        {
+            quint32 pattern = data.pattern();
+            int i;
+
+            // One word and then double what's filled with each copy
+            for (i = 0; i < qMin(len, 4); i++)
+                buf[i] = pattern >> (24 - 8*i);
+            for (; i < len; i *= 2)
+                memcpy(buf + i, buf, qMin(i, len - i));
+            break;
+        }
+        case OstProto::Payload::e_dp_inc_byte:
+            copyPage(buf, len, patternPages.incByte);
+            break;
+        case OstProto::Payload::e_dp_dec_byte:
+            copyPage(buf, len, patternPages.decByte);
+            break;
+        case OstProto::Payload::e_dp_random:
+        {
+            // Same bytes for a frame every time, so the cksum is correct
+            Pcg32 rng = random(streamIndex, payload_dataPattern);
+
+            for (int i = 0; i < len; i += kRandomChunkSize)
+                memcpy(buf + i, patternPages.random
+                                    + rng.next(kRandomPoolSize),
+                        qMin(len - i, kRandomChunkSize));
+            break;
+        }
+        default:
+            qWarning("Unhandled data pattern %d", data.pattern_mode());
+    }
+}
+
 QVariant PayloadProtocol::fieldData(int index, FieldAttrib attrib,
         int streamIndex) const
 {
@@ -130,32 +213,8 @@ QVariant PayloadProtocol::fieldData(int index, FieldAttrib attrib,
                     if (dataLen <= 0)
                         dataLen = 1;
 
-                    fv.resize(dataLen+4);
-                    switch(data.pattern_mode())
-                    {
-                        case OstProto::Payload::e_dp_fixed_word:
-                            for (int i = 0; i < (dataLen/4)+1; i++)
-                                qToBigEndian((quint32) data.pattern(), 
-                                    (uchar*)(fv.data()+(i*4)) );
-                            break;
-                        case OstProto::Payload::e_dp_inc_byte:
-                            for (int i = 0; i < dataLen; i++)
-                                fv[i] = i % (0xFF + 1);
-                            break;
-                        case OstProto::Payload::e_dp_dec_byte:
-                            for (int i = 0; i < dataLen; i++)
-                                fv[i] = 0xFF - (i % (0xFF + 1));
-                            break;
-                        case OstProto::Payload::e_dp_random:
-                            //! \todo (HIGH) cksum is incorrect for random pattern
-                            for (int i = 0; i < dataLen; i++)
-                                fv[i] =  qrand() % (0xFF + 1);
-                            break;
-                        default:
-                            qWarning("Unhandled data pattern %d", 
-                                data.pattern_mode());
-                    }
                     fv.resize(dataLen);
+                    fillPattern((uchar*) fv.data(), dataLen, streamIndex);
                     return fv;
                 }
                 default:
@@ -248,8 +307,34 @@ int PayloadProtocol::protocolFrameVariableCount() const
     if (mpStream->lenMode() != StreamBase::e_fl_fixed)
     {
         count = AbstractProtocol::lcm(count, 
-                mpStream->frameLenMax() - mpStream->frameLenMin() + 1);
+                mpStream->frameSizeVariableCount());
     }
 
     return count;
 }
+
+bool PayloadProtocol::isProtocolFrameValueRandom() const
+{
+    return (AbstractProtocol::isProtocolFrameValueRandom()
+            || (data.pattern_mode() == OstProto::Payload::e_dp_random));
+}
+
+int PayloadProtocol::writeFrameValue(uchar *buf, int bufSize,
+        int streamIndex, bool /*forCksum*/) const
+{
+    int dataLen = protocolFrameSize(streamIndex);
+
+    // Same as the FrameValue hack in fieldData()
+    if (dataLen <= 0)
+        dataLen = 1;
+
+    // The payload is usually the bulk of the frame - fill only as much
+    // of it as there is room for
+    fillPattern(buf, qMin(dataLen, bufSize), streamIndex);
+    if (dataLen <= bufSize)
+        varyProtocolFrameValue(buf, dataLen, streamIndex);
+    else if (variableFieldCount())
+        return AbstractProtocol::writeFrameValue(buf, bufSize, streamIndex);
+
+    return dataLen;
+}
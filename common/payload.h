@@ -60,11 +60,17 @@ public:
     virtual bool setFieldData(int index, const QVariant &value, 
             FieldAttrib attrib = FieldValue);
 
+    virtual int writeFrameValue(uchar *buf, int bufSize,
+        int streamIndex = 0, bool forCksum = false) const;
+
     virtual bool isProtocolFrameValueVariable() const;
     virtual bool isProtocolFrameSizeVariable() const;
     virtual int protocolFrameVariableCount() const;
+    virtual bool isProtocolFrameValueRandom() const;
 
 private:
+    void fillPattern(uchar *buf, int len, int streamIndex) const;
+
     OstProto::Payload            data;
 };
 
@@ -19,16 +19,20 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 
 #include "pcapfileformat.h"
 
+#include "framegenerator.h"
+#include "gzipdevice.h"
+#include "pcapreader.h"
 #include "pdmlreader.h"
 #include "ostprotolib.h"
 #include "streambase.h"
 #include "hexdump.pb.h"
 
-#include <QDataStream>
 #include <QFile>
 #include <QFileInfo>
 #include <QProcess>
 #include <QTemporaryFile>
+#include <QThread>
+#include <QtConcurrentMap>
 #include <QtGlobal>
 
 static inline quint32 swap32(quint32 val)
@@ -46,6 +50,7 @@ static inline quint16 swap16(quint16 val)
 }
 
 const quint32 kPcapFileMagic = 0xa1b2c3d4;
+const quint32 kPcapFileMagicNsec = 0xa1b23c4d;
 const quint32 kPcapFileMagicSwapped = 0xd4c3b2a1;
 const quint16 kPcapFileVersionMajor = 2;
 const quint16 kPcapFileVersionMinor = 4;
@@ -54,6 +59,168 @@ const quint32 kDltEthernet = 1;
 
 PcapFileFormat pcapFileFormat;
 
+/*
+  Stream folding (the FoldStreams import option) - a run of frames that
+  differ from the run's first frame only in counters that change by the
+  same step from frame to frame (IP id, TCP seq/ack, ports, checksums
+  that change with these ...) is imported as one stream of as many
+  packets with a variable field per counter, instead of one stream per
+  frame. The variable fields reproduce the frames exactly; a frame that
+  doesn't fit the run (even by a carry into a byte outside the counter)
+  starts a new run
+*/
+struct FoldField
+{
+    int offset;
+    int size;       // bytes - 1, 2, 4 or 8
+    quint64 value;  // in the run's first frame
+    quint64 step;   // per frame, modulo the field size
+};
+
+// Frames with more counters than this are not folded - they are more
+// likely to be unrelated than a run
+static const int kMaxFoldFields = 8;
+
+static quint64 foldFieldValue(const uchar *p, int size)
+{
+    quint64 value = 0;
+
+    for (int i = 0; i < size; i++)
+        value = (value << 8) | p[i];
+
+    return value;
+}
+
+static quint64 foldFieldMask(int size)
+{
+    return (size < 8) ? (quint64(1) << 8*size) - 1 : ~quint64(0);
+}
+
+/*!
+  Finds the counters in which frame (the second frame of the run) differs
+  from first - each run of differing bytes is taken to be the low bytes
+  of a counter of the smallest size that covers it; returns false if the
+  frames can't be folded
+*/
+static bool findFoldFields(const QByteArray &first, const uchar *frame,
+                           QList<FoldField> *fields)
+{
+    const uchar *base = (const uchar*) first.constData();
+    int len = first.size();
+
+    fields->clear();
+    for (int i = 0; i < len; )
+    {
+        FoldField field;
+        int end = i;
+        int diff;
+
+        if (base[i] == frame[i]) {
+            i++;
+            continue;
+        }
+
+        while ((end < len) && (base[end] != frame[end]))
+            end++;
+        diff = end - i;
+
+        if (fields->size() == kMaxFoldFields || (diff > 8))
+            return false;
+
+        field.size = (diff <= 2) ? 2 : (diff <= 4) ? 4 : 8;
+        while (field.size > end)
+            field.size /= 2;
+        if (field.size < diff)
+            return false;
+        field.offset = end - field.size;
+
+        // Extended into the previous counter?
+        if (!fields->isEmpty() && (field.offset
+                    < fields->last().offset + fields->last().size))
+            return false;
+
+        field.value = foldFieldValue(base + field.offset, field.size);
+        field.step = (foldFieldValue(frame + field.offset, field.size)
+                        - field.value) & foldFieldMask(field.size);
+
+        // A VariableField step is 32 bits - a 64 bit counter must change
+        // by less than that (either way)
+        if ((field.size == 8) && (field.step > 0xffffffffULL)
+                && (-field.step > 0xffffffffULL))
+            return false;
+
+        fields->append(field);
+        i = end;
+    }
+
+    return true;
+}
+
+// Returns true if frame is frame index of the run of first and fields
+static bool foldsInto(const QByteArray &first, const QList<FoldField> &fields,
+                      int index, const uchar *frame)
+{
+    const uchar *base = (const uchar*) first.constData();
+    int ofs = 0;
+
+    foreach (const FoldField &field, fields)
+    {
+        quint64 mask = foldFieldMask(field.size);
+
+        if (memcmp(base + ofs, frame + ofs, field.offset - ofs))
+            return false;
+        if (foldFieldValue(frame + field.offset, field.size)
+                != ((field.value + quint64(index)*field.step) & mask))
+            return false;
+        ofs = field.offset + field.size;
+    }
+
+    return memcmp(base + ofs, frame + ofs, first.size() - ofs) == 0;
+}
+
+// Turns the fields of a run of count frames into variable fields of proto
+static void setFoldFields(OstProto::Protocol *proto,
+                          const QList<FoldField> &fields, int count)
+{
+    proto->clear_variable_field();
+    foreach (const FoldField &field, fields)
+    {
+        OstProto::VariableField *vf = proto->add_variable_field();
+
+        vf->set_offset(field.offset);
+        vf->set_count(count);
+        switch (field.size)
+        {
+        case 1:
+            vf->set_type(OstProto::VariableField::kCounter8);
+            break;
+        case 2:
+            vf->set_type(OstProto::VariableField::kCounter16);
+            break;
+        case 4:
+            vf->set_type(OstProto::VariableField::kCounter32);
+            break;
+        case 8:
+            vf->set_type(OstProto::VariableField::kCounter64);
+            break;
+        }
+
+        if (field.size <= 4) {
+            vf->set_value(field.value);
+            vf->set_step(field.step);
+        }
+        else if (field.step <= 0xffffffffULL) {
+            vf->set_value64(field.value);
+            vf->set_step(field.step);
+        }
+        else {
+            vf->set_value64(field.value);
+            vf->set_mode(OstProto::VariableField::kDecrement);
+            vf->set_step(-field.step);
+        }
+    }
+}
+
 PcapImportOptionsDialog::PcapImportOptionsDialog(QVariantMap *options)
     : QDialog(NULL)
 {
@@ -62,6 +229,8 @@ PcapImportOptionsDialog::PcapImportOptionsDialog(QVariantMap *options)
 
     viaPdml->setChecked(options_->value("ViaPdml").toBool());
     doDiff->setChecked(options_->value("DoDiff").toBool());
+    foldStreams->setChecked(options_->value("FoldStreams").toBool());
+    foldStreams->setDisabled(viaPdml->isChecked());
 
     connect(buttonBox, SIGNAL(accepted()), this, SLOT(accept()));
 }
@@ -74,6 +243,7 @@ void PcapImportOptionsDialog::accept()
 {
     options_->insert("ViaPdml", viaPdml->isChecked());
     options_->insert("DoDiff", doDiff->isChecked());
+    options_->insert("FoldStreams", foldStreams->isChecked());
 
     QDialog::accept();
 }
@@ -82,6 +252,7 @@ PcapFileFormat::PcapFileFormat()
 {
     importOptions_.insert("ViaPdml", true);
     importOptions_.insert("DoDiff", true);
+    importOptions_.insert("FoldStreams", false);
 
     importDialog_ = NULL;
 }
@@ -96,18 +267,21 @@ bool PcapFileFormat::open(const QString fileName,
 {
     bool isOk = false;
     QFile file(fileName);
-    QTemporaryFile file2;
-    quint32 magic;
+    GzipDevice gzipFile(&file);
     uchar gzipMagic[2];
     int len;
-    PcapFileHeader fileHdr;
-    PcapPacketHeader pktHdr;
+    PcapReader::Packet pkt;
     OstProto::Stream *prevStream = NULL;
     uint lastUsec = 0;
+    bool fold = importOptions_.value("FoldStreams").toBool();
+    OstProto::Stream *runStream = NULL;
+    QByteArray runFirst;
+    QList<FoldField> runFields;
+    int runLength = 0;
+    uint runStartUsec = 0;
     int pktCount;
-    qint64 byteCount = 0;
+    int skipCount = 0;
     qint64 byteTotal;
-    QByteArray pktBuf;
 
     if (!file.open(QIODevice::ReadOnly))
         goto _err_open;
@@ -116,86 +290,45 @@ bool PcapFileFormat::open(const QString fileName,
     if (len < int(sizeof(gzipMagic)))
         goto _err_reading_magic;
 
+    emit status("Reading File Header...");
+    emit target(0);
+
+    // Compressed files are uncompressed in-process into memory, others
+    // are mapped - packets are read in place in both cases
     if ((gzipMagic[0] == 0x1f) && (gzipMagic[1] == 0x8b))
     {
-        QProcess gzip;
+        QByteArray contents;
 
         emit status("Decompressing...");
-        emit target(0);
-
-        if (!file2.open())
-        {
-            error.append("Unable to open temporary file to uncompress .gz\n");
-            goto _err_unzip_fail;
-        }
-
-        qDebug("decompressing to %s", file2.fileName().toAscii().constData());
 
-        gzip.setStandardOutputFile(file2.fileName());
-        gzip.start(OstProtoLib::gzipPath(), 
-                QStringList() 
-                << "-d" 
-                << "-c" 
-                << fileName);
-        if (!gzip.waitForStarted(-1))
+        if (!gzipFile.open(QIODevice::ReadOnly))
         {
-            error.append(QString("Unable to start gzip. Check path in Preferences.\n"));
+            error.append(QString("Unable to uncompress .gz: %1\n")
+                    .arg(gzipFile.errorString()));
             goto _err_unzip_fail;
         }
 
-        if (!gzip.waitForFinished(-1))
+        contents = gzipFile.readAll();
+        if (!gzipFile.atEnd() || contents.isEmpty())
         {
-            error.append(QString("Error running gzip\n"));
+            error.append(QString("Unable to uncompress .gz: %1\n")
+                    .arg(gzipFile.errorString()));
             goto _err_unzip_fail;
         }
+        gzipFile.close();
+        file.close();
 
-        file2.seek(0);
-
-        fd_.setDevice(&file2);
+        if (!reader_.open(contents, error))
+            goto _err_bad_file;
     }
     else
     {
-        fd_.setDevice(&file);
+        file.close();
+        if (!reader_.open(fileName, error))
+            goto _err_bad_file;
     }
 
-    byteTotal = fd_.device()->size() - sizeof(fileHdr);
-
-    emit status("Reading File Header...");
-    emit target(0);
-
-    fd_ >> magic;
-
-    qDebug("magic = %08x", magic);
-
-    if (magic == kPcapFileMagicSwapped)
-    {
-        // Toggle Byte order
-        if (fd_.byteOrder() == QDataStream::BigEndian)
-            fd_.setByteOrder(QDataStream::LittleEndian);
-        else
-            fd_.setByteOrder(QDataStream::BigEndian);
-    }
-    else if (magic != kPcapFileMagic)
-        goto _err_bad_magic;
-
-    fd_ >> fileHdr.versionMajor;
-    fd_ >> fileHdr.versionMinor;
-    fd_ >> fileHdr.thisZone;
-    fd_ >> fileHdr.sigfigs;
-    fd_ >> fileHdr.snapLen;
-    fd_ >> fileHdr.network;
-   
-    if ((fileHdr.versionMajor != kPcapFileVersionMajor) ||
-            (fileHdr.versionMinor != kPcapFileVersionMinor))
-        goto _err_unsupported_version;
-
-#if 1
-    // XXX: we support only Ethernet, for now
-    if (fileHdr.network != kDltEthernet)
-        goto _err_unsupported_encap;
-#endif
-
-    pktBuf.resize(fileHdr.snapLen);
+    byteTotal = qMax(reader_.size(), qint64(1));
 
     if (importOptions_.value("ViaPdml").toBool())
     {
@@ -325,7 +458,7 @@ bool PcapFileFormat::open(const QString fileName,
             goto _diff_fail;
         }
 
-        if (!save(streams, importedPcapFile.fileName(), error))
+        if (!saveFrames(streams, importedPcapFile.fileName(), true, error))
         {
             error.append("Error saving imported streams as PCAP for diff");
             goto _diff_fail;
@@ -431,8 +564,41 @@ _non_pdml:
     emit status("Reading Packets...");
     emit target(100);  // in percentage
     pktCount = 1;
-    while (!fd_.atEnd())
+    while (reader_.next(pkt))
     {
+        // XXX: we support only Ethernet, for now
+        if (pkt.linkType != kDltEthernet)
+        {
+            skipCount++;
+            continue;
+        }
+
+        // setup packet rate to the timing in pcap (as close as possible)
+        const uint kUsecsInSec = uint(1e6);
+        uint usec = uint(pkt.nsec/1000);
+        uint delta = usec - lastUsec;
+
+        if (fold && runStream && (int(pkt.length) == runFirst.size()))
+        {
+            bool isFolded = (runLength == 1) ?
+                    findFoldFields(runFirst, pkt.data, &runFields) :
+                    foldsInto(runFirst, runFields, runLength, pkt.data);
+
+            if (isFolded) {
+                runLength++;
+                runStream->mutable_control()->set_num_packets(runLength);
+                setFoldFields(runStream->mutable_protocol(0), runFields,
+                              runLength);
+
+                lastUsec = usec;
+                pktCount++;
+                emit progress(int(reader_.pos()*100/byteTotal));
+                if (stop_)
+                    goto _user_cancel;
+                continue;
+            }
+        }
+
         OstProto::Stream *stream = streams.add_stream();
         OstProto::Protocol *proto = stream->add_protocol();
         OstProto::HexDump *hexDump = proto->MutableExtension(OstProto::hexDump);
@@ -440,39 +606,63 @@ _non_pdml:
         proto->mutable_protocol_id()->set_id(
                 OstProto::Protocol::kHexDumpFieldNumber);
 
-        readPacket(pktHdr, pktBuf);
-
-        // validations on inclLen <= origLen && inclLen <= snapLen
-        Q_ASSERT(pktHdr.inclLen <= fileHdr.snapLen); // TODO: convert to if
-
-        hexDump->set_content(pktBuf.data(), pktHdr.inclLen);
+        hexDump->set_content(pkt.data, pkt.length);
         hexDump->set_pad_until_end(false);
 
-        stream->mutable_stream_id()->set_id(pktCount);
+        stream->mutable_stream_id()->set_id(streams.stream_size());
         stream->mutable_core()->set_is_enabled(true);
-        stream->mutable_core()->set_frame_len(pktHdr.inclLen+4); // FCS
+        stream->mutable_core()->set_frame_len(pkt.length+4); // FCS
 
-        // setup packet rate to the timing in pcap (as close as possible)
-        const uint kUsecsInSec = uint(1e6);
-        uint usec = (pktHdr.tsSec*kUsecsInSec + pktHdr.tsUsec);
-        uint delta = usec - lastUsec;
-        
         if ((pktCount != 1) && delta)
             stream->mutable_control()->set_packets_per_sec(kUsecsInSec/delta);
 
-        if (prevStream)
+        if (prevStream) {
             prevStream->mutable_control()->CopyFrom(stream->control());
 
+            // A folded stream is sent at its average rate
+            if (runLength > 1) {
+                prevStream->mutable_control()->set_num_packets(runLength);
+                if (usec != runStartUsec)
+                    prevStream->mutable_control()->set_packets_per_sec(
+                        double(runLength)*kUsecsInSec/(usec - runStartUsec));
+            }
+        }
+
+        if (fold) {
+            runStream = stream;
+            runFirst = QByteArray((const char*) pkt.data, pkt.length);
+            runFields.clear();
+            runLength = 1;
+            runStartUsec = usec;
+        }
+
         lastUsec = usec;
         prevStream = stream;
         pktCount++;
         qDebug("pktCount = %d", pktCount);
-        byteCount += pktHdr.inclLen + sizeof(pktHdr);
-        emit progress(int(byteCount*100/byteTotal)); // in percentage
+        emit progress(int(reader_.pos()*100/byteTotal)); // in percentage
         if (stop_)
             goto _user_cancel;
     }
 
+    if (runLength > 1) {
+        // The last stream has no next stream to time it - use the run's own
+        const uint kUsecsInSec = uint(1e6);
+
+        if (lastUsec != runStartUsec)
+            runStream->mutable_control()->set_packets_per_sec(
+                double(runLength - 1)*kUsecsInSec/(lastUsec - runStartUsec));
+    }
+
+    if (reader_.isTruncated())
+        error.append(QString(tr("%1 is truncated or corrupt - imported "
+                        "%2 packets before the error\n"))
+                .arg(QFileInfo(fileName).fileName()).arg(pktCount-1));
+
+    if (skipCount)
+        error.append(QString(tr("%1 non-ethernet packets were skipped\n"))
+                .arg(skipCount));
+
     isOk = true;
     goto _exit;
 
@@ -483,20 +673,8 @@ _user_cancel:
 _diff_fail:
     goto _exit;
 
-_err_unsupported_encap:
-    error = QString(tr("%1 has non-ethernet encapsulation (%2) which is "
-                "not supported - Sorry!"))
-            .arg(QFileInfo(fileName).fileName()).arg(fileHdr.network);
-    goto _exit;
-
-_err_unsupported_version:
-    error = QString(tr("%1 is in PCAP version %2.%3 format which is "
-                "not supported - Sorry!"))
-            .arg(fileName).arg(fileHdr.versionMajor).arg(fileHdr.versionMinor);
-    goto _exit;
-
-_err_bad_magic:
-    error = QString(tr("%1 is not a valid PCAP file")).arg(fileName);
+_err_bad_file:
+    error = QString(tr("Unable to import PCAP - %1")).arg(error);
     goto _exit;
 
 #if 0
@@ -517,6 +695,8 @@ _err_open:
     goto _exit;
 
 _exit:
+    reader_.close();
+    gzipFile.close();
     file.close();
     return isOk;
 }
@@ -524,50 +704,152 @@ _exit:
 /*!
   Reads packet meta data into pktHdr and packet content into buf.
 
-  Returns true if packet is read successfully, false otherwise.
+  Returns true if packet is read successfully, false otherwise (at the
+  end of the file or if it is truncated/corrupt).
 */
 bool PcapFileFormat::readPacket(PcapPacketHeader &pktHdr, QByteArray &pktBuf)
 {
-    quint32 len;
+    PcapReader::Packet pkt;
 
-    // TODO: chk fd_.status()
+    if (!reader_.next(pkt))
+        return false;
 
-    // read PcapPacketHeader
-    fd_ >> pktHdr.tsSec;
-    fd_ >> pktHdr.tsUsec;
-    fd_ >> pktHdr.inclLen;
-    fd_ >> pktHdr.origLen;
+    pktHdr.tsSec = quint32(pkt.nsec/1000000000ULL);
+    pktHdr.tsUsec = quint32((pkt.nsec % 1000000000ULL)/1000);
+    pktHdr.inclLen = pkt.length;
+    pktHdr.origLen = pkt.origLength;
 
-    // TODO: chk fd_.status()
+    pktBuf = QByteArray((const char*)pkt.data, pkt.length);
 
-    // XXX: should never be required, but we play safe
-    if (quint32(pktBuf.size()) < pktHdr.inclLen)
-        pktBuf.resize(pktHdr.inclLen);
+    return true;
+}
+
+bool PcapFileFormat::save(const OstProto::StreamConfigList streams,
+        const QString fileName, QString &error)
+{
+    return saveFrames(streams, fileName, false, error);
+}
 
-    // read Pkt contents
-    len = fd_.readRawData(pktBuf.data(), pktHdr.inclLen); // TODO: use while?
+/*!
+  A run of (upto kMaxJobFrames) frames of a stream - built into pcap
+  records on a worker thread by buildSaveJob()
+*/
+struct PcapSaveJob
+{
+    const StreamBase *stream;
+    quint64 first;          // stream frame index of the first frame
+    quint64 count;
+    quint64 burstSize;
+    double burstGapNsec;
+    quint64 startNsec;      // timestamp of the stream's first frame
+    QByteArray records;     // pcap record header + frame, for each frame
+};
+
+// Runs on a worker thread
+static void buildSaveJob(PcapSaveJob &job)
+{
+    const quint64 kNsecsInSec = 1000000000ULL;
+    uchar buf[16384];
+    quint32 hdr[4];         // in host byte order, as is the file header
 
-    Q_ASSERT(len == pktHdr.inclLen); // TODO: remove assert
-    pktBuf.resize(len);
+    job.records.reserve(int(job.count*(sizeof(hdr)
+                        + job.stream->frameLenAvg())));
 
+    // Same as the transmit path - a compiled frame template, unless
+    // there's just the one frame
+    if (job.count == 1)
+    {
+        int len = job.stream->frameValue(buf, sizeof(buf), int(job.first
+                        % quint64(qMax(job.stream->frameVariableCount(), 1))));
+        quint64 nsec = job.startNsec + quint64(double(job.first
+                        / job.burstSize) * job.burstGapNsec);
+
+        if (len <= 0)
+            return;
+
+        hdr[0] = quint32(nsec/kNsecsInSec);
+        hdr[1] = quint32(nsec%kNsecsInSec);
+        hdr[2] = hdr[3] = quint32(len);
+        job.records.append((const char*) hdr, sizeof(hdr));
+        job.records.append((const char*) buf, len);
+        return;
+    }
+
+    StreamFrameGenerator generator(job.stream, job.first + job.count,
+            job.burstSize, job.burstGapNsec, job.first);
+
+    while (generator.hasNext())
+    {
+        quint64 nsec;
+        int len = generator.nextFrame(buf, sizeof(buf), nsec);
+
+        if (len <= 0)
+            continue;
+
+        nsec += job.startNsec;
+        hdr[0] = quint32(nsec/kNsecsInSec);
+        hdr[1] = quint32(nsec%kNsecsInSec);
+        hdr[2] = hdr[3] = quint32(len);
+        job.records.append((const char*) hdr, sizeof(hdr));
+        job.records.append((const char*) buf, len);
+    }
+}
+
+/*!
+  Builds the jobs of the window in parallel and writes them in order;
+  the window is emptied
+*/
+static bool writeSaveJobs(QList<PcapSaveJob> &window, QFile &file)
+{
+    QtConcurrent::blockingMap(window, buildSaveJob);
+
+    for (int i = 0; i < window.size(); i++)
+    {
+        const QByteArray &records = window.at(i).records;
+
+        if (file.write(records) != records.size())
+            return false;
+    }
+
+    window.clear();
     return true;
 }
 
-bool PcapFileFormat::save(const OstProto::StreamConfigList streams,
-        const QString fileName, QString &error)
+/*!
+  Writes the frames of all the streams to a nsec resolution pcap file
+
+  Each stream's frames are sent one after the other at the stream's rate
+  and the next stream starts a packet/burst gap after the last frame of
+  the previous one - as the drone would send them (except that "goto"
+  stream actions and repeats are not followed). A stream in continuous
+  mode contributes its distinct frames, rounded up to whole bursts.
+
+  If isFirstFrameOnly is set, only the first frame of each stream is
+  written - this is used to diff imported streams against the pcap they
+  were imported from
+
+  Frames are built using the same frame templates as the drone (see
+  StreamFrameGenerator) on the global thread pool, a window of jobs at a
+  time, and written in order with one write per job
+*/
+bool PcapFileFormat::saveFrames(const OstProto::StreamConfigList &streams,
+        const QString &fileName, bool isFirstFrameOnly, QString &error)
 {
+    const quint64 kMaxJobFrames = 4096;
+    const quint64 kMaxWindowBytes = 64*1024*1024;
     bool isOk = false;
     QFile file(fileName);
     PcapFileHeader fileHdr;
-    PcapPacketHeader pktHdr;
-    QByteArray pktBuf;
+    QList<StreamBase*> streamList;
+    QList<PcapSaveJob> window;
+    quint64 windowBytes = 0;
+    int maxWindowJobs = 4*qMax(1, QThread::idealThreadCount());
+    quint64 nsec = 0;
 
     if (!file.open(QIODevice::WriteOnly))
         goto _err_open;
 
-    fd_.setDevice(&file);
-
-    fileHdr.magicNumber = kPcapFileMagic;
+    fileHdr.magicNumber = kPcapFileMagicNsec;
     fileHdr.versionMajor = kPcapFileVersionMajor;
     fileHdr.versionMinor = kPcapFileVersionMinor;
     fileHdr.thisZone = 0;
@@ -575,61 +857,96 @@ bool PcapFileFormat::save(const OstProto::StreamConfigList streams,
     fileHdr.snapLen = kMaxSnapLen;
     fileHdr.network = kDltEthernet; 
 
-    fd_ << fileHdr.magicNumber;
-    fd_ << fileHdr.versionMajor;
-    fd_ << fileHdr.versionMinor;
-    fd_ << fileHdr.thisZone;
-    fd_ << fileHdr.sigfigs;
-    fd_ << fileHdr.snapLen;
-    fd_ << fileHdr.network;
-
-    pktBuf.resize(kMaxSnapLen);
+    if (file.write((const char*) &fileHdr, sizeof(fileHdr)) 
+            != qint64(sizeof(fileHdr)))
+        goto _err_write;
 
     emit status("Writing Packets...");
     emit target(streams.stream_size());
 
-    pktHdr.tsSec = 0;
-    pktHdr.tsUsec = 0;
     for (int i = 0; i < streams.stream_size(); i++)
     {
-        StreamBase s;
-        
-        s.setId(i);
-        s.protoDataCopyFrom(streams.stream(i));
-        // TODO: expand frameIndex for each stream
-        s.frameValue((uchar*)pktBuf.data(), pktBuf.size(), 0); 
+        StreamBase *s = new StreamBase;
+        quint64 count, burstSize;
+        double rate;
+
+        s->setId(i);
+        s->protoDataCopyFrom(streams.stream(i));
+        streamList.append(s);
 
-        pktHdr.inclLen = s.frameProtocolLength(0); // FIXME: stream index = 0
-        pktHdr.origLen = s.frameLen() - 4; // FCS; FIXME: Hardcoding
+        if (s->sendUnit() == OstProto::StreamControl::e_su_bursts)
+        {
+            burstSize = qMax(s->burstSize(), quint32(1));
+            count = quint64(s->numBursts())*burstSize;
+            rate = s->burstRate();
+        }
+        else
+        {
+            burstSize = 1;
+            count = s->numPackets();
+            rate = s->packetRate();
+        }
 
-        qDebug("savepcap i=%d, incl/orig len = %d/%d", i, 
-                pktHdr.inclLen, pktHdr.origLen);
+        if (s->sendMode() == StreamBase::e_sm_continuous)
+        {
+            quint64 n = qMax(s->frameVariableCount(), 1);
 
-        if (pktHdr.inclLen > fileHdr.snapLen)
-            pktHdr.inclLen = fileHdr.snapLen;
+            count = ((n + burstSize - 1)/burstSize)*burstSize;
+        }
 
-        fd_ << pktHdr.tsSec;
-        fd_ << pktHdr.tsUsec;
-        fd_ << pktHdr.inclLen;
-        fd_ << pktHdr.origLen;
-        fd_.writeRawData(pktBuf.data(), pktHdr.inclLen);
+        if (isFirstFrameOnly)
+            count = qMin(count, quint64(1));
 
-        if (s.packetRate())
-            pktHdr.tsUsec += quint32(1e6/s.packetRate());
-        if (pktHdr.tsUsec >= 1000000)
+        for (quint64 first = 0; first < count; first += kMaxJobFrames)
         {
-            pktHdr.tsSec++;
-            pktHdr.tsUsec -= 1000000;
+            PcapSaveJob job;
+
+            job.stream = s;
+            job.first = first;
+            job.count = qMin(count - first, kMaxJobFrames);
+            job.burstSize = burstSize;
+            job.burstGapNsec = (rate > 0) ? 1e9/rate : 0;
+            job.startNsec = nsec;
+            window.append(job);
+            windowBytes += job.count*s->frameLenAvg();
+
+            if ((windowBytes >= kMaxWindowBytes)
+                    || (window.size() >= maxWindowJobs))
+            {
+                if (!writeSaveJobs(window, file))
+                    goto _err_write;
+                windowBytes = 0;
+
+                // Only the current stream may have frames left to build
+                while (streamList.size() > 1)
+                    delete streamList.takeFirst();
+            }
         }
 
+        // Next stream starts one burst/packet gap after the last
+        // burst/packet of this stream
+        if (rate > 0)
+            nsec += quint64(double(count/burstSize) * (1e9/rate));
+
         emit progress(i);
     }
 
+    if (!writeSaveJobs(window, file))
+        goto _err_write;
+    qDeleteAll(streamList);
+    streamList.clear();
+
     file.close();
 
     isOk = true;
     goto _exit;
 
+_err_write:
+    error = QString(tr("Unable to write to file: %1 - %2"))
+                .arg(fileName).arg(file.errorString());
+    qDeleteAll(streamList);
+    goto _exit;
+
 _err_open:
     error = QString(tr("Unable to open file: %1")).arg(fileName);
     goto _exit;
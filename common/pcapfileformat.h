@@ -19,10 +19,10 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 #ifndef _PCAP_FILE_FORMAT_H
 #define _PCAP_FILE_FORMAT_H
 
+#include "pcapreader.h"
 #include "streamfileformat.h"
 #include "ui_pcapfileimport.h"
 
-#include <QDataStream>
 #include <QVariantMap>
 
 class PcapImportOptionsDialog: public QDialog, public Ui::PcapFileImport
@@ -76,8 +76,10 @@ private:
     } PcapPacketHeader;
 
     bool readPacket(PcapPacketHeader &pktHdr, QByteArray &pktBuf);
+    bool saveFrames(const OstProto::StreamConfigList &streams,
+            const QString &fileName, bool isFirstFrameOnly, QString &error);
 
-    QDataStream fd_;
+    PcapReader reader_;
     QVariantMap importOptions_;
     PcapImportOptionsDialog *importDialog_;
 };
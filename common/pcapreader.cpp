@@ -0,0 +1,345 @@
+/*
+Copyright (C) 2017 Srivats P.
+
+
+This file is part of "Ostinato"
+
+This is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+
+#include "pcapreader.h"
+
+#include <QtEndian>
+
+static const quint32 kPcapNgSectionHeader = 0x0A0D0D0A;
+static const quint32 kPcapNgByteOrderMagic = 0x1A2B3C4D;
+
+PcapReader::PcapReader()
+    : data_(NULL), isMapped_(false), size_(0), offset_(0),
+      isPcapNg_(false), isBigEndian_(false), fracToNsec_(1000),
+      linkType_(0), lastNsec_(0), isTruncated_(false)
+{
+}
+
+PcapReader::~PcapReader()
+{
+    close();
+}
+
+bool PcapReader::open(const QString &fileName, QString &error)
+{
+    close();
+
+    file_.setFileName(fileName);
+    if (!file_.open(QIODevice::ReadOnly)) {
+        error = QString("Unable to open %1: %2")
+                    .arg(fileName).arg(file_.errorString());
+        return false;
+    }
+
+    size_ = file_.size();
+    if (size_ < 4) {
+        error = QString("%1 is not a capture file").arg(fileName);
+        close();
+        return false;
+    }
+
+    data_ = file_.map(0, size_);
+    if (!data_) {
+        error = QString("Unable to map %1: %2")
+                    .arg(fileName).arg(file_.errorString());
+        close();
+        return false;
+    }
+    isMapped_ = true;
+
+    if (!readHeader(error)) {
+        error.prepend(fileName + ": ");
+        close();
+        return false;
+    }
+
+    return true;
+}
+
+bool PcapReader::open(const QByteArray &contents, QString &error)
+{
+    close();
+
+    contents_ = contents;
+    data_ = (const uchar*) contents_.constData();
+    size_ = contents_.size();
+
+    if (!readHeader(error)) {
+        close();
+        return false;
+    }
+
+    return true;
+}
+
+void PcapReader::close()
+{
+    if (isMapped_)
+        file_.unmap(const_cast<uchar*>(data_));
+    file_.close();
+    contents_.clear();
+
+    data_ = NULL;
+    isMapped_ = false;
+    size_ = offset_ = 0;
+    interfaces_.clear();
+}
+
+bool PcapReader::readHeader(QString &error)
+{
+    if (size_ < 4) {
+        error = QString("not a capture file");
+        return false;
+    }
+
+    if ((data_[0] == 0x1f) && (data_[1] == 0x8b)) {
+        error = QString("compressed (gzip) capture - uncompress it first");
+        return false;
+    }
+
+    if (qFromLittleEndian<quint32>(data_) == kPcapNgSectionHeader) {
+        isPcapNg_ = true;
+        rewind();
+        return true;
+    }
+
+    isPcapNg_ = false;
+    if (size_ < 24) {
+        error = QString("truncated pcap header");
+        return false;
+    }
+
+    switch (qFromLittleEndian<quint32>(data_)) {
+    case 0xa1b2c3d4: isBigEndian_ = false; fracToNsec_ = 1000; break;
+    case 0xa1b23c4d: isBigEndian_ = false; fracToNsec_ = 1; break;
+    case 0xd4c3b2a1: isBigEndian_ = true; fracToNsec_ = 1000; break;
+    case 0x4d3cb2a1: isBigEndian_ = true; fracToNsec_ = 1; break;
+    default:
+        error = QString("not a pcap or pcapng file");
+        return false;
+    }
+
+    if (read16(data_ + 4) != 2) {
+        error = QString("unsupported pcap version %1.%2")
+                    .arg(read16(data_ + 4)).arg(read16(data_ + 6));
+        return false;
+    }
+
+    // Upper bits may have FCS info
+    linkType_ = read32(data_ + 20) & 0xFFFF;
+
+    rewind();
+    return true;
+}
+
+void PcapReader::rewind()
+{
+    offset_ = isPcapNg_ ? 0 : 24;
+    lastNsec_ = 0;
+    isTruncated_ = false;
+    interfaces_.clear();
+}
+
+bool PcapReader::next(Packet &packet)
+{
+    if (!data_ || isTruncated_)
+        return false;
+
+    return isPcapNg_ ? nextPcapNg(packet) : nextPcap(packet);
+}
+
+bool PcapReader::nextPcap(Packet &packet)
+{
+    const uchar *hdr = data_ + offset_;
+    quint32 sec, frac;
+
+    if (offset_ == size_)
+        return false;
+
+    if ((offset_ + 16) > size_)
+        goto _truncated;
+
+    sec = read32(hdr);
+    frac = read32(hdr + 4);
+    packet.length = read32(hdr + 8);
+    packet.origLength = read32(hdr + 12);
+
+    if (packet.length > quint64(size_ - offset_ - 16))
+        goto _truncated;
+
+    packet.data = hdr + 16;
+    packet.nsec = quint64(sec)*1000000000ULL + quint64(frac)*fracToNsec_;
+    packet.linkType = linkType_;
+
+    offset_ += 16 + packet.length;
+    return true;
+
+_truncated:
+    qWarning("pcap: truncated packet at offset %lld", offset_);
+    isTruncated_ = true;
+    return false;
+}
+
+/*!
+  Returns the next packet of a pcapng file - from an enhanced, simple or
+  (obsolete) packet block of any section and interface
+*/
+bool PcapReader::nextPcapNg(Packet &packet)
+{
+    while ((offset_ + 12) <= size_) {
+        const uchar *block = data_ + offset_;
+        const uchar *body = block + 8;
+        quint32 type = read32(block);
+        quint32 blockLen;
+        int ifIndex = -1;
+        quint64 ts = 0;
+        bool hasTs = false;
+
+        // Byte order is per section
+        if (qFromLittleEndian<quint32>(block) == kPcapNgSectionHeader) {
+            quint32 bom = qFromLittleEndian<quint32>(body);
+
+            if (bom == kPcapNgByteOrderMagic)
+                isBigEndian_ = false;
+            else if (bom == qbswap(kPcapNgByteOrderMagic))
+                isBigEndian_ = true;
+            else
+                goto _truncated;
+            type = kPcapNgSectionHeader;
+            interfaces_.clear();
+        }
+
+        blockLen = read32(block + 4);
+        if ((blockLen < 12) || (blockLen % 4)
+                || (blockLen > quint64(size_ - offset_)))
+            goto _truncated;
+
+        offset_ += blockLen;
+
+        switch (type) {
+        case 1: // Interface Description Block
+        {
+            Interface intf;
+            quint32 optOffset = 16;
+
+            if (blockLen < 20)
+                goto _truncated;
+
+            intf.linkType = read16(body);
+            intf.snapLen = read32(body + 4);
+            intf.isPowerOf2 = false;
+            intf.exp = 6;
+
+            while ((optOffset + 4) <= (blockLen - 4)) {
+                quint16 code = read16(block + optOffset);
+                quint16 len = read16(block + optOffset + 2);
+
+                if (code == 0) // opt_endofopt
+                    break;
+                if ((code == 9) && (len == 1)) { // if_tsresol
+                    quint8 tsresol = block[optOffset + 4];
+
+                    intf.isPowerOf2 = tsresol & 0x80;
+                    intf.exp = qMin(tsresol & 0x7F, intf.isPowerOf2 ? 63 : 19);
+                }
+                optOffset += 4 + ((len + 3) & ~3);
+            }
+
+            interfaces_.append(intf);
+            continue;
+        }
+        case 6: // Enhanced Packet Block
+        case 2: // Packet Block (obsolete)
+            if (blockLen < 32)
+                goto _truncated;
+            ifIndex = (type == 6) ? int(read32(body)) : int(read16(body));
+            ts = (quint64(read32(body + 4)) << 32) | read32(body + 8);
+            hasTs = true;
+            packet.length = read32(body + 12);
+            packet.origLength = read32(body + 16);
+            packet.data = block + 28;
+            break;
+        case 3: // Simple Packet Block - no timestamp, caplen
+            if ((blockLen < 16) || interfaces_.isEmpty())
+                goto _truncated;
+            ifIndex = 0;
+            packet.origLength = read32(body);
+            packet.length = qMin(packet.origLength, blockLen - 16);
+            if (interfaces_.at(0).snapLen)
+                packet.length = qMin(packet.length, interfaces_.at(0).snapLen);
+            packet.data = block + 12;
+            break;
+        default:
+            // section header, name resolution, statistics etc.
+            continue;
+        }
+
+        if ((ifIndex < 0) || (ifIndex >= interfaces_.size())
+                || ((packet.data + packet.length) > (block + blockLen)))
+            goto _truncated;
+
+        const Interface &intf = interfaces_.at(ifIndex);
+
+        if (!hasTs)
+            packet.nsec = lastNsec_;
+        else if (intf.isPowerOf2) {
+            quint64 mask = (quint64(1) << intf.exp) - 1;
+            packet.nsec = (ts >> intf.exp)*1000000000ULL
+                + (((ts & mask)*1000000000ULL) >> intf.exp);
+        }
+        else if (intf.exp <= 9) {
+            quint64 mul = 1;
+            for (int i = intf.exp; i < 9; i++)
+                mul *= 10;
+            packet.nsec = ts*mul;
+        }
+        else {
+            quint64 div = 1;
+            for (int i = 9; i < intf.exp; i++)
+                div *= 10;
+            packet.nsec = ts/div;
+        }
+        packet.linkType = intf.linkType;
+
+        lastNsec_ = packet.nsec;
+        return true;
+    }
+
+    if (offset_ == size_)
+        return false;
+
+_truncated:
+    qWarning("pcapng: truncated or bad block at offset %lld", offset_);
+    isTruncated_ = true;
+    return false;
+}
+
+quint16 PcapReader::read16(const uchar *p) const
+{
+    return isBigEndian_ ? qFromBigEndian<quint16>(p)
+                        : qFromLittleEndian<quint16>(p);
+}
+
+quint32 PcapReader::read32(const uchar *p) const
+{
+    return isBigEndian_ ? qFromBigEndian<quint32>(p)
+                        : qFromLittleEndian<quint32>(p);
+}
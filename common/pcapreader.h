@@ -0,0 +1,101 @@
+/*
+Copyright (C) 2017 Srivats P.
+
+
+This file is part of "Ostinato"
+
+This is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+
+#ifndef _PCAP_READER_H
+#define _PCAP_READER_H
+
+#include <QByteArray>
+#include <QFile>
+#include <QString>
+#include <QVector>
+
+/*!
+  Reader for pcap (usec or nsec timestamps, in either byte order) and
+  pcapng capture files
+
+  The file is memory mapped and its headers are validated and decoded in
+  place as it is iterated using next() - packets are returned as views
+  into the mapping, valid until the reader is closed or reopened
+*/
+class PcapReader
+{
+public:
+    struct Packet
+    {
+        const uchar *data;  // captured bytes
+        quint32 length;     // captured length
+        quint32 origLength; // length on the wire
+        quint64 nsec;       // timestamp - nsecs since the epoch
+        quint32 linkType;   // DLT_xxx
+    };
+
+    PcapReader();
+    ~PcapReader();
+
+    bool open(const QString &fileName, QString &error);
+    // For contents not in a file of their own e.g. an uncompressed .gz
+    bool open(const QByteArray &contents, QString &error);
+    void close();
+
+    // Returns false at the end of the file (or if it's truncated/corrupt)
+    bool next(Packet &packet);
+    void rewind();
+
+    // If next() stopped before the end because of a bad packet or block
+    bool isTruncated() const { return isTruncated_; }
+
+    const uchar* data() const { return data_; }
+    qint64 size() const { return size_; }
+    qint64 pos() const { return offset_; }
+
+private:
+    struct Interface
+    {
+        quint16 linkType;
+        quint32 snapLen;
+        bool isPowerOf2; // tsresol is 2^-exp instead of 10^-exp secs
+        int exp;
+    };
+
+    bool readHeader(QString &error);
+    bool nextPcap(Packet &packet);
+    bool nextPcapNg(Packet &packet);
+
+    quint16 read16(const uchar *p) const;
+    quint32 read32(const uchar *p) const;
+
+    QFile file_;
+    QByteArray contents_;
+    const uchar *data_;
+    bool isMapped_;
+    qint64 size_;
+    qint64 offset_;
+
+    bool isPcapNg_;
+    bool isBigEndian_;      // of the file (or current pcapng section)
+    quint32 fracToNsec_;    // pcap only
+    quint32 linkType_;      // pcap only
+    QVector<Interface> interfaces_; // of the current pcapng section
+    quint64 lastNsec_;
+    bool isTruncated_;
+};
+
+#endif
@@ -42,16 +42,331 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 #include "udppdml.h"
 #include "vlanpdml.h"
 
+#include <QFuture>
+#include <QIODevice>
+#include <QList>
+#include <QThread>
+#include <QXmlStreamReader>
+#include <QtConcurrentRun>
+
+/*!
+  A run of consecutive <packet> elements and the streams converted from
+  them - the unit of work handed to the thread pool
+*/
+struct PdmlPacketBatch
+{
+    QByteArray pdml;                // the <packet> elements, verbatim
+    QList<QByteArray> pcapPackets;  // corresponding packets from the pcap
+    bool hasPcap;
+    bool isMldSupport;
+    int firstPacketNum;
+    qint64 firstLine;               // position of pdml in the document
+    qint64 firstColumn;
+    qint64 endOffset;               // document offset following pdml
+
+    OstProto::StreamConfigList streams;
+    QString errorString;
+    qint64 errorLine;
+    qint64 errorColumn;
+};
+
+/*!
+  Converts each <packet> of a batch to a stream
+*/
+class PdmlPacketParser : public QXmlStreamReader
+{
+public:
+    PdmlPacketParser(PdmlPacketBatch *batch);
+
+    void parse();
+
+private:
+    PdmlProtocol* allocPdmlProtocol(QString protoName);
+    void freePdmlProtocol(PdmlProtocol *proto);
+
+    bool isDontCareProto();
+    void skipElement();
+
+    void readPacket();
+    void readProto();
+    void readField(PdmlProtocol *pdmlProto, 
+            OstProto::Protocol *pbProto);
+
+    void appendHexDumpProto(int offset, int size);
+    PdmlProtocol* appendPdmlProto(const QString &protoName,
+            OstProto::Protocol **pbProto);
+
+    typedef PdmlProtocol* (*FactoryMethod)();
+
+    QMap<QString, FactoryMethod> factory_;
+
+    PdmlPacketBatch *batch_;
+    QByteArray pktBuf_;
+
+    int packetIndex_;
+    int expPos_;
+    bool skipUntilEnd_;
+    OstProto::Stream *currentStream_;
+};
+
+static void parseBatch(PdmlPacketBatch *batch)
+{
+    PdmlPacketParser parser(batch);
+
+    parser.parse();
+}
+
 PdmlReader::PdmlReader(OstProto::StreamConfigList *streams)
 {
-    //gPdmlReader = this;
-    pcap_ = NULL;
     streams_ = streams;
+    isMldSupport_ = true;
+    lineNumber_ = columnNumber_ = 0;
+}
 
-    currentStream_ = NULL;
-    prevStream_ = NULL;
+PdmlReader::~PdmlReader()
+{
+}
+
+/*!
+  Reads the PDML document from device and appends a stream for each packet
+
+  If pcap is given, it must be the capture the PDML was generated from -
+  bytes of the packet that the PDML doesn't describe are taken from it.
+  Returns false on a parse error; setting *stop cancels the read, but isn't
+  an error
+*/
+bool PdmlReader::read(QIODevice *device, PcapFileFormat *pcap, bool *stop)
+{
+    static const QByteArray kPdmlTag("<pdml");
+    static const QByteArray kPacketTag("<packet");
+    static const QByteArray kPacketEndTag("</packet>");
+    const qint64 kReadSize = 1 << 20;
+    const int kBatchPackets = 64;
+    const int maxPending = 2*qMax(1, QThread::idealThreadCount());
+
+    QList<PdmlPacketBatch*> pending;
+    QList<QFuture<void> > futures;
+    PdmlPacketBatch *batch = NULL;
+    OstProto::Stream *prevStream = NULL;
+    QByteArray buf;
+    qint64 bufOffset = 0;   // document offset of buf[0] ...
+    qint64 bufLine = 1;     // ... and its line number
+    qint64 docSize = qMax(device->size(), qint64(1));
+    int pos = 0;            // parsed until here in buf
+    int packetNum = 1;
+    bool isHeaderRead = false;
+    bool isEof = false;
+
+    errorString_.clear();
+    lineNumber_ = columnNumber_ = 0;
+
+    // The splitting happens here and the conversion on the thread pool -
+    // upto maxPending batches are in flight; the oldest is merged into
+    // the stream list once its conversion is done
+    while (errorString_.isEmpty())
+    {
+        if (stop && *stop)
+            break;
+
+        if (!isEof)
+        {
+            QByteArray data = device->read(kReadSize);
+
+            isEof = data.isEmpty();
+            buf.append(data);
+        }
+
+        if (!isHeaderRead)
+        {
+            int start = buf.indexOf(kPdmlTag);
+            int end = (start >= 0) ? buf.indexOf('>', start) : -1;
+
+            if (end < 0)
+            {
+                if (isEof || (buf.size() > kReadSize))
+                {
+                    errorString_ = QString("Not a pdml file!");
+                    lineNumber_ = bufLine + buf.count('\n');
+                }
+                continue;
+            }
+
+            if (!readPdmlHeader(buf.left(end + 1)))
+                break;
+            isHeaderRead = true;
+            pos = end + 1;
+        }
+
+        forever
+        {
+            int start = buf.indexOf(kPacketTag, pos);
+            int end = (start >= 0) ? buf.indexOf(kPacketEndTag, start) : -1;
+
+            if (end < 0)
+                break;
+            end += kPacketEndTag.size();
+
+            if (!batch)
+            {
+                int lineStart = buf.lastIndexOf('\n', start) + 1;
+
+                batch = new PdmlPacketBatch;
+                batch->hasPcap = (pcap != NULL);
+                batch->isMldSupport = isMldSupport_;
+                batch->firstPacketNum = packetNum;
+                batch->firstLine = bufLine + buf.left(start).count('\n');
+                batch->firstColumn = start - lineStart;
+                batch->errorLine = batch->errorColumn = 0;
+            }
+
+            batch->pdml.append(buf.constData() + start, end - start);
+            if (pcap)
+            {
+                PcapFileFormat::PcapPacketHeader pktHdr;
+                QByteArray pktBuf;
+
+                pcap->readPacket(pktHdr, pktBuf);
+                batch->pcapPackets.append(pktBuf);
+            }
+            packetNum++;
+            pos = end;
+
+            if ((packetNum - batch->firstPacketNum) == kBatchPackets)
+            {
+                batch->endOffset = bufOffset + pos;
+                pending.append(batch);
+                futures.append(QtConcurrent::run(parseBatch, batch));
+                batch = NULL;
+            }
+        }
+
+        // Discard what we're done with - at most the incomplete
+        // <packet> at the end is carried over to the next read
+        if (pos)
+        {
+            bufLine += buf.left(pos).count('\n');
+            bufOffset += pos;
+            buf.remove(0, pos);
+            pos = 0;
+        }
+
+        if (isEof && batch)
+        {
+            batch->endOffset = bufOffset;
+            pending.append(batch);
+            futures.append(QtConcurrent::run(parseBatch, batch));
+            batch = NULL;
+        }
+
+        // Merge completed batches, in order - wait for the oldest if too
+        // many are in flight or there's nothing more to split
+        while (!pending.isEmpty() && errorString_.isEmpty())
+        {
+            PdmlPacketBatch *done = pending.first();
+
+            if (!futures.first().isFinished()
+                    && (pending.size() < maxPending) && !isEof)
+                break;
+
+            futures.first().waitForFinished();
+
+            if (!done->errorString.isEmpty())
+            {
+                errorString_ = done->errorString;
+                lineNumber_ = done->errorLine;
+                columnNumber_ = done->errorColumn;
+            }
+
+            for (int i = 0; i < done->streams.stream_size(); i++)
+            {
+                OstProto::Stream *stream = streams_->add_stream();
+
+                stream->Swap(done->streams.mutable_stream(i));
+                if (prevStream)
+                    prevStream->mutable_control()->CopyFrom(stream->control());
+                prevStream = stream;
+            }
+
+            emit progress(int(done->endOffset*100/docSize)); // in % 
+
+            delete done;
+            pending.removeFirst();
+            futures.removeFirst();
+        }
+
+        if (isEof && pending.isEmpty())
+            break;
+    }
+
+    // On an error or cancel, let in-flight batches finish and discard them
+    for (int i = 0; i < pending.size(); i++)
+    {
+        futures.at(i).waitForFinished();
+        delete pending.at(i);
+    }
+    delete batch;
+
+    if (!errorString_.isEmpty())
+    {
+        qDebug("Line %lld", lineNumber_);
+        qDebug("Col %lld", columnNumber_);
+        qDebug("%s", errorString_.toAscii().constData());
+        return false;
+    }
+    return true;
+}
+
+/*!
+  Parses the document upto and including the <pdml> start tag
+*/
+bool PdmlReader::readPdmlHeader(const QByteArray &header)
+{
+    QXmlStreamReader xml(header);
+    QStringList creator;
 
-    stop_ = NULL;
+    while (!xml.atEnd())
+    {
+        xml.readNext();
+        if (xml.isStartElement())
+            break;
+    }
+
+    if (!xml.isStartElement() || (xml.name() != "pdml"))
+    {
+        errorString_ = xml.hasError() ? xml.errorString()
+                                      : QString("Not a pdml file!");
+        lineNumber_ = xml.lineNumber();
+        columnNumber_ = xml.columnNumber();
+        return false;
+    }
+
+    // If MLD is not supported by the creator of the PDML, we interpret
+    // ICMPv6 as ICMP (see PdmlPacketParser::allocPdmlProtocol())
+    isMldSupport_ = true;
+    creator = xml.attributes().value("creator").toString().split('/');
+    if ((creator.size() >= 2) && (creator.at(0) == "wireshark"))
+    {
+        QList<uint> minMldVer;  
+        minMldVer << 1 << 5 << 0;
+        QStringList version = creator.at(1).split('.');
+        
+        for (int i = 0; i < qMin(version.size(), minMldVer.size()); i++)
+        {
+            if (version.at(i).toUInt() < minMldVer.at(i))
+            {
+                isMldSupport_ = false;
+                break;
+            }
+        }
+    }
+
+    return true;
+}
+
+PdmlPacketParser::PdmlPacketParser(PdmlPacketBatch *batch)
+{
+    batch_ = batch;
+    currentStream_ = NULL;
 
     factory_.insert("hexdump", PdmlUnknownProtocol::createInstance);
     factory_.insert("geninfo", PdmlGenInfoProtocol::createInstance);
@@ -81,40 +396,41 @@ PdmlReader::PdmlReader(OstProto::StreamConfigList *streams)
     factory_.insert("vlan", PdmlVlanProtocol::createInstance);
 }
 
-PdmlReader::~PdmlReader()
+void PdmlPacketParser::parse()
 {
-}
+    // Wrap the batch in a (single) root element to make it a document
+    addData("<pdml>");
+    addData(batch_->pdml);
+    addData("</pdml>");
 
-bool PdmlReader::read(QIODevice *device, PcapFileFormat *pcap, bool *stop)
-{
-    setDevice(device);
-    pcap_ = pcap;
-    stop_ = stop;
+    packetIndex_ = 0;
 
     while (!atEnd())
     {
         readNext();
+
         if (isStartElement())
         {
-            if (name() == "pdml")
-                readPdml();
-            else
-                raiseError("Not a pdml file!");
+            if (name() == "packet")
+                readPacket();
+            else if (name() != "pdml")
+                skipElement();
         }
     }
 
-    if (error() && (errorString() != "USER-CANCEL"))
+    if (hasError())
     {
-        qDebug("Line %lld", lineNumber());
-        qDebug("Col %lld", columnNumber());
-        qDebug("%s", errorString().toAscii().constData());
-        return false;
+        const int kWrapperLen = 6; // <pdml>
+
+        batch_->errorString = errorString();
+        batch_->errorLine = batch_->firstLine + lineNumber() - 1;
+        batch_->errorColumn = (lineNumber() == 1) ?
+            batch_->firstColumn + columnNumber() - kWrapperLen : columnNumber();
     }
-    return true;
 }
 
 // TODO: use a temp pool to avoid a lot of new/delete
-PdmlProtocol* PdmlReader::allocPdmlProtocol(QString protoName)
+PdmlProtocol* PdmlPacketParser::allocPdmlProtocol(QString protoName)
 {
     // If protoName is not known, we use a hexdump
     if (!factory_.contains(protoName))
@@ -124,18 +440,18 @@ PdmlProtocol* PdmlReader::allocPdmlProtocol(QString protoName)
     // ICMPv6 as ICMP since our implementation of the ICMPv6 PDML protocol
     // exists just to distinguish between MLD and ICMP. Non MLD ICMPv6 is 
     // also handled by ICMP only
-    if (!isMldSupport_ && (protoName == "icmpv6"))
+    if (!batch_->isMldSupport && (protoName == "icmpv6"))
         protoName = "icmp";
 
     return (*(factory_.value(protoName)))();
 }
 
-void PdmlReader::freePdmlProtocol(PdmlProtocol *proto)
+void PdmlPacketParser::freePdmlProtocol(PdmlProtocol *proto)
 {
     delete proto;
 }
 
-bool PdmlReader::isDontCareProto()
+bool PdmlPacketParser::isDontCareProto()
 {
     Q_ASSERT(isStartElement() && name() == "proto");
 
@@ -147,7 +463,7 @@ bool PdmlReader::isDontCareProto()
     return false;
 }
 
-void PdmlReader::skipElement()
+void PdmlPacketParser::skipElement()
 {
     Q_ASSERT(isStartElement());
 
@@ -165,63 +481,19 @@ void PdmlReader::skipElement()
     }
 }
 
-void PdmlReader::readPdml()
-{
-    QStringList creator;
-
-    Q_ASSERT(isStartElement() && name() == "pdml");
-
-    isMldSupport_ = true;
-    creator = attributes().value("creator").toString().split('/');
-    if ((creator.size() >= 2) && (creator.at(0) == "wireshark"))
-    {
-        QList<uint> minMldVer;  
-        minMldVer << 1 << 5 << 0;
-        QStringList version = creator.at(1).split('.');
-        
-        for (int i = 0; i < qMin(version.size(), minMldVer.size()); i++)
-        {
-            if (version.at(i).toUInt() < minMldVer.at(i))
-            {
-                isMldSupport_ = false;
-                break;
-            }
-        }
-    }
-
-    packetCount_ = 1;
-
-    while (!atEnd())
-    {
-        readNext();
-
-        if (isEndElement())
-            break;
-
-        if (isStartElement())
-        {
-            if (name() == "packet")
-                readPacket();
-            else
-                skipElement();
-        }
-    }
-}
-
-void PdmlReader::readPacket()
+void PdmlPacketParser::readPacket()
 {
-    PcapFileFormat::PcapPacketHeader pktHdr;
-
     Q_ASSERT(isStartElement() && name() == "packet");
 
-    qDebug("%s: packetNum = %d", __FUNCTION__, packetCount_);
+    qDebug("%s: packetNum = %d", __FUNCTION__,
+            batch_->firstPacketNum + packetIndex_);
 
     skipUntilEnd_ = false;
 
     // XXX: we play dumb and convert each packet to a stream, for now
-    prevStream_ = currentStream_;
-    currentStream_ = streams_->add_stream();
-    currentStream_->mutable_stream_id()->set_id(packetCount_);
+    currentStream_ = batch_->streams.add_stream();
+    currentStream_->mutable_stream_id()->set_id(
+            batch_->firstPacketNum + packetIndex_);
     currentStream_->mutable_core()->set_is_enabled(true);
 
     // Set to a high number; will get reset to correct value during parse
@@ -229,8 +501,8 @@ void PdmlReader::readPacket()
 
     expPos_ = 0;
 
-    if (pcap_)
-        pcap_->readPacket(pktHdr, pktBuf_);
+    if (batch_->hasPcap)
+        pktBuf_ = batch_->pcapPackets.value(packetIndex_);
 
     while (!atEnd())
     {
@@ -255,7 +527,7 @@ void PdmlReader::readPacket()
     currentStream_->mutable_core()->set_name(""); // FIXME
 
     // If trailing bytes are missing, add those from the pcap 
-    if ((expPos_ < pktBuf_.size()) && pcap_)
+    if ((expPos_ < pktBuf_.size()) && batch_->hasPcap)
     {
         OstProto::Protocol *proto = currentStream_->add_protocol();
         OstProto::HexDump *hexDump = proto->MutableExtension(
@@ -271,15 +543,10 @@ void PdmlReader::readPacket()
         hexDump->set_pad_until_end(false);
     } 
 
-    packetCount_++;
-    emit progress(int(characterOffset()*100/device()->size())); // in % 
-    if (prevStream_)
-        prevStream_->mutable_control()->CopyFrom(currentStream_->control());
-    if (stop_ && *stop_)
-        raiseError("USER-CANCEL");
+    packetIndex_++;
 }
 
-void PdmlReader::readProto()
+void PdmlPacketParser::readProto()
 {
     PdmlProtocol *pdmlProto = NULL;
     OstProto::Protocol *pbProto = NULL;
@@ -319,14 +586,14 @@ void PdmlReader::readProto()
 
     // if we detect a gap between subsequent protocols, we "fill-in"
     // with a "hexdump" from the pcap
-    if (pos > expPos_ && pcap_)
+    if (pos > expPos_ && batch_->hasPcap)
     {
         appendHexDumpProto(expPos_, pos - expPos_);
         expPos_ = pos;
     }
 
     // for unknown protocol, read a hexdump from the pcap
-    if (!factory_.contains(protoName) && pcap_)
+    if (!factory_.contains(protoName) && batch_->hasPcap)
     {
         int size = -1;
 
@@ -447,7 +714,7 @@ void PdmlReader::readProto()
     }
 }
 
-void PdmlReader::readField(PdmlProtocol *pdmlProto, 
+void PdmlPacketParser::readField(PdmlProtocol *pdmlProto, 
         OstProto::Protocol *pbProto)
 {
     Q_ASSERT(isStartElement() && name() == "field");
@@ -503,7 +770,7 @@ void PdmlReader::readField(PdmlProtocol *pdmlProto,
     }
 }
 
-void PdmlReader::appendHexDumpProto(int offset, int size)
+void PdmlPacketParser::appendHexDumpProto(int offset, int size)
 {
     OstProto::Protocol *proto = currentStream_->add_protocol();
     OstProto::HexDump *hexDump = proto->MutableExtension(OstProto::hexDump);
@@ -516,7 +783,7 @@ void PdmlReader::appendHexDumpProto(int offset, int size)
     hexDump->set_pad_until_end(false);
 }
 
-PdmlProtocol* PdmlReader::appendPdmlProto(const QString &protoName,
+PdmlProtocol* PdmlPacketParser::appendPdmlProto(const QString &protoName,
         OstProto::Protocol **pbProto)
 {
     PdmlProtocol* pdmlProto = allocPdmlProtocol(protoName);
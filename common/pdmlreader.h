@@ -20,13 +20,22 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 #ifndef _PDML_READER_H
 #define _PDML_READER_H
 
-#include "pdmlprotocol.h"
+#include "protocol.pb.h"
 
-#include <QByteArray>
-#include <QXmlStreamReader>
+#include <QObject>
+#include <QString>
 
 class PcapFileFormat;
-class PdmlReader : public QObject, public QXmlStreamReader
+class QIODevice;
+
+/*!
+  Converts the packets of a PDML document to streams
+
+  The document is split at <packet> boundaries as it is read and batches
+  of packets are converted on the global thread pool - the resulting
+  streams are appended to the stream list in packet order
+*/
+class PdmlReader : public QObject
 {
     Q_OBJECT
 public:
@@ -35,41 +44,24 @@ public:
 
     bool read(QIODevice *device, PcapFileFormat *pcap = NULL, 
             bool *stop = NULL);
+
+    // Location and description of the error if read() failed
+    qint64 lineNumber() const { return lineNumber_; }
+    qint64 columnNumber() const { return columnNumber_; }
+    QString errorString() const { return errorString_; }
+
 signals:
     void progress(int value);
 
 private:
-    PdmlProtocol* allocPdmlProtocol(QString protoName);
-    void freePdmlProtocol(PdmlProtocol *proto);
-
-    bool isDontCareProto();
-    void skipElement();
-
-    void readPdml();
-    void readPacket();
-    void readProto();
-    void readField(PdmlProtocol *pdmlProto, 
-            OstProto::Protocol *pbProto);
-
-    void appendHexDumpProto(int offset, int size);
-    PdmlProtocol* appendPdmlProto(const QString &protoName,
-            OstProto::Protocol **pbProto);
-
-    typedef PdmlProtocol* (*FactoryMethod)();
-
-    QMap<QString, FactoryMethod> factory_;
+    bool readPdmlHeader(const QByteArray &header);
 
-    bool *stop_;
     OstProto::StreamConfigList *streams_;
-    PcapFileFormat *pcap_;
-    QByteArray pktBuf_;
 
     bool isMldSupport_;
-    int packetCount_;
-    int expPos_;
-    bool skipUntilEnd_;
-    OstProto::Stream *prevStream_;
-    OstProto::Stream *currentStream_;
+    qint64 lineNumber_;
+    qint64 columnNumber_;
+    QString errorString_;
 };
 
 #endif
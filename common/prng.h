@@ -0,0 +1,77 @@
+/*
+Copyright (C) 2017 Srivats P.
+
+
+This file is part of "Ostinato"
+
+This is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+
+#ifndef _PRNG_H
+#define _PRNG_H
+
+#include <QtGlobal>
+
+/*
+ * PCG32 (XSH RR) pseudo random number generator - see pcg-random.org
+ *
+ * Unlike qrand() there's no shared (global or per thread) state - a
+ * generator is cheap to create, so one is created for each (frame, field)
+ * from the stream's seed with the frame index and field as the sequence.
+ * With the same seed, the 'random' frames are the same irrespective of
+ * the order (or the threads) in which they are built
+ */
+class Pcg32
+{
+public:
+    Pcg32(quint64 seed, quint64 sequence)
+    {
+        state_ = 0;
+        inc_ = (sequence << 1) | 1;
+        next();
+        state_ += seed ^ mix(sequence); // decorrelate adjacent sequences
+        next();
+    }
+
+    quint32 next()
+    {
+        quint64 old = state_;
+        quint32 xorShifted = quint32(((old >> 18) ^ old) >> 27);
+        quint32 rot = quint32(old >> 59);
+
+        state_ = old*6364136223846793005ULL + inc_;
+        return (xorShifted >> rot) | (xorShifted << ((32 - rot) & 31));
+    }
+
+    // Returns a random number in [0, bound)
+    quint32 next(quint32 bound)
+    {
+        return quint32((quint64(next()) * bound) >> 32);
+    }
+
+private:
+    // SplitMix64 finalizer
+    static quint64 mix(quint64 x)
+    {
+        x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+        return x ^ (x >> 31);
+    }
+
+    quint64 state_;
+    quint64 inc_;
+};
+
+#endif
@@ -24,4 +24,5 @@ void ProtocolList::destroy()
 {
     while (!isEmpty())
         delete takeFirst(); 
+    touch();
 }
@@ -24,5 +24,13 @@ class AbstractProtocol;
 class ProtocolList : public QLinkedList<AbstractProtocol*>
 {
 public:
+    ProtocolList() : generation_(0) {}
     void destroy();
+
+    // Changes on every insert/remove/replace (via ProtocolListIterator)
+    uint generation() const { return generation_; }
+    void touch() { generation_++; }
+
+private:
+    uint generation_;
 };
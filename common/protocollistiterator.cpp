@@ -24,6 +24,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 ProtocolListIterator::ProtocolListIterator(ProtocolList &list)
 {
     _iter = new QMutableLinkedListIterator<AbstractProtocol*>(list);
+    _list = &list;
 }
 
 ProtocolListIterator::~ProtocolListIterator()
@@ -70,6 +71,7 @@ void ProtocolListIterator::insert(AbstractProtocol* value)
         value->next = NULL;
 
     _iter->insert(const_cast<AbstractProtocol*>(value));
+    _list->touch();
 }
 
 AbstractProtocol* ProtocolListIterator::next()
@@ -99,6 +101,7 @@ void ProtocolListIterator::remove()
     if (_iter->value()->next)
         _iter->value()->next->prev = _iter->value()->prev;
     _iter->remove();
+    _list->touch();
 }
 
 void ProtocolListIterator::setValue(AbstractProtocol* value) const
@@ -110,6 +113,7 @@ void ProtocolListIterator::setValue(AbstractProtocol* value) const
     value->prev = _iter->value()->prev;
     value->next = _iter->value()->next;
     _iter->setValue(const_cast<AbstractProtocol*>(value));
+    _list->touch();
 }
 
 void ProtocolListIterator::toBack()
@@ -26,6 +26,7 @@ class ProtocolListIterator
 {
 private:
     QMutableLinkedListIterator<AbstractProtocol*> *_iter;
+    ProtocolList *_list;
 
 public:
     ProtocolListIterator(ProtocolList &list);
@@ -145,6 +145,7 @@ ProtocolManager::~ProtocolManager()
     nameToNumberMap.clear();
     neighbourProtocols.clear();
     factory.clear();
+    hasPayload.clear();
     QList<AbstractProtocol*> pl = protocolList.values();
     while (!pl.isEmpty())
         delete pl.takeFirst();
@@ -155,12 +156,18 @@ void ProtocolManager::registerProtocol(int protoNumber,
 {
     AbstractProtocol *p;
 
-    Q_ASSERT(!factory.contains(protoNumber));
+    Q_ASSERT(protoNumber >= 0);
+    Q_ASSERT(!isRegisteredProtocol(protoNumber));
 
-    factory.insert(protoNumber, protoInstanceCreator);
+    if (protoNumber >= factory.size()) {
+        factory.resize(protoNumber + 1);
+        hasPayload.resize(protoNumber + 1);
+    }
+    factory[protoNumber] = (ProtocolCreator) protoInstanceCreator;
 
     p = createProtocol(protoNumber, NULL);
     protocolList.insert(protoNumber, p);
+    hasPayload[protoNumber] = p->protocolHasPayload();
 
     numberToNameMap.insert(protoNumber, p->shortName());
     nameToNumberMap.insert(p->shortName(), protoNumber);
@@ -186,18 +193,18 @@ void ProtocolManager::populateNeighbourProtocols()
 
 bool ProtocolManager::isRegisteredProtocol(int protoNumber)
 {
-    return factory.contains(protoNumber);
+    return (protoNumber >= 0) && (protoNumber < factory.size())
+                && factory.at(protoNumber);
 }
 
 AbstractProtocol* ProtocolManager::createProtocol(int protoNumber,
     StreamBase *stream, AbstractProtocol *parent)
 {
-    AbstractProtocol* (*pc)(StreamBase*, AbstractProtocol*);
+    ProtocolCreator pc;
     AbstractProtocol* p;
 
-    pc = (AbstractProtocol* (*)(StreamBase*, AbstractProtocol*))
-        factory.value(protoNumber);
-    
+    pc = isRegisteredProtocol(protoNumber) ? factory.at(protoNumber) : NULL;
+
     Q_ASSERT_X(pc != NULL, 
                __FUNCTION__, 
                QString("No Protocol Creator registered for protocol %1")
@@ -224,9 +231,9 @@ bool ProtocolManager::isValidNeighbour(int protoPrefix, int protoSuffix)
 
 bool ProtocolManager::protocolHasPayload(int protoNumber)
 {
-    Q_ASSERT(protocolList.contains(protoNumber));
+    Q_ASSERT(isRegisteredProtocol(protoNumber));
 
-    return protocolList.value(protoNumber)->protocolHasPayload();
+    return hasPayload.value(protoNumber);
 }
 
 QStringList ProtocolManager::protocolDatabase()
@@ -22,18 +22,26 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 
 #include <QMap>
 #include <QStringList>
+#include <QVector>
 
 class AbstractProtocol;
 class StreamBase;
 
 class ProtocolManager
 {
+    typedef AbstractProtocol* (*ProtocolCreator)(StreamBase*,
+                                                 AbstractProtocol*);
+
     QMap<int, QString>    numberToNameMap;
     QMap<QString, int>    nameToNumberMap;
     QMultiMap<int, int> neighbourProtocols;
-    QMap<int, void*>    factory;
     QMap<int, AbstractProtocol*>    protocolList;
 
+    // Indexed by protocol number (a few hundred at most) - these are
+    // looked up for every protocol of every stream created
+    QVector<ProtocolCreator>    factory;
+    QVector<bool>               hasPayload;
+
     void populateNeighbourProtocols();
 
 public:
@@ -161,6 +161,8 @@ ProtocolWidgetFactory::ProtocolWidgetFactory()
 
 ProtocolWidgetFactory::~ProtocolWidgetFactory()
 {
+    foreach (const QList<AbstractProtocolConfigForm*> &widgets, pool_)
+        qDeleteAll(widgets);
     configWidgetFactory.clear();
 }
 
@@ -177,6 +179,10 @@ AbstractProtocolConfigForm* ProtocolWidgetFactory::createConfigWidget(
 {
     AbstractProtocolConfigForm* (*pc)();
     AbstractProtocolConfigForm* p;
+    QList<AbstractProtocolConfigForm*> &pooled = pool_[protoNumber];
+
+    if (!pooled.isEmpty())
+        return pooled.takeLast();
 
     pc = (AbstractProtocolConfigForm* (*)()) 
             configWidgetFactory.value(protoNumber);
@@ -186,6 +192,7 @@ AbstractProtocolConfigForm* ProtocolWidgetFactory::createConfigWidget(
                QString(protoNumber).toAscii().constData());
 
     p = (*pc)();
+    protoNumber_.insert(p, protoNumber);
 
     return p;
 }
@@ -193,5 +200,19 @@ AbstractProtocolConfigForm* ProtocolWidgetFactory::createConfigWidget(
 void ProtocolWidgetFactory::deleteConfigWidget(
             AbstractProtocolConfigForm *configWidget)
 {
+    QHash<AbstractProtocolConfigForm*, int>::const_iterator iter =
+        protoNumber_.constFind(configWidget);
+
+    if (iter != protoNumber_.constEnd()) {
+        QList<AbstractProtocolConfigForm*> &pooled = pool_[iter.value()];
+
+        if (pooled.size() < kMaxPooledWidgets) {
+            configWidget->setParent(0);
+            pooled.append(configWidget);
+            return;
+        }
+        protoNumber_.remove(configWidget);
+    }
+
     delete configWidget;
 }
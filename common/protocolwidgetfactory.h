@@ -20,6 +20,8 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 #ifndef _PROTOCOL_WIDGET_FACTORY_H
 #define _PROTOCOL_WIDGET_FACTORY_H
 
+#include <QHash>
+#include <QList>
 #include <QMap>
 
 class AbstractProtocolConfigForm;
@@ -39,8 +41,19 @@ public:
     static void registerProtocolConfigWidget(int protoNumber, 
             void *protoConfigWidgetInstanceCreator);
 
+    // A widget given back by deleteConfigWidget() may be returned again
+    // by createConfigWidget() for the same protocol - widgets are costly
+    // to construct, so a few of each protocol are kept for reuse. The
+    // widget returned has no parent and is to be loaded (loadWidget())
+    // before use
     AbstractProtocolConfigForm* createConfigWidget(int protoNumber);
     void deleteConfigWidget(AbstractProtocolConfigForm *configWidget);
+
+private:
+    static const int kMaxPooledWidgets = 4; // per protocol
+
+    QHash<AbstractProtocolConfigForm*, int> protoNumber_; // of the widget
+    QHash<int, QList<AbstractProtocolConfigForm*> > pool_;
 };
 
 #endif
@@ -33,6 +33,11 @@ using google::protobuf::FieldDescriptor;
 
 PythonFileFormat pythonFileFormat;
 
+// Stream sets at least this large are exported as serialized blobs
+// instead of per-field assignments - see writeStreamBlobs()
+static const int kBlobStreamThreshold = 256;
+static const int kBlobChunkStreams = 1000;
+
 extern char *version;
 extern char *revision;
 
@@ -123,6 +128,11 @@ bool PythonFileFormat::save(const OstProto::StreamConfigList streams,
     emit target(0);
     writePrologue(out);
 
+    if (streams.stream_size() >= kBlobStreamThreshold) {
+        writeStreamBlobs(out, streams);
+        goto _epilogue;
+    }
+
     // Add streams
     emit status("Writing stream adds ...");
     emit target(streams.stream_size());
@@ -209,6 +219,7 @@ bool PythonFileFormat::save(const OstProto::StreamConfigList streams,
     out << "\n";
     out << "    drone.modifyStream(stream_cfg)\n";
 
+_epilogue:
     // end of script - transmit streams, disconnect from drone etc.
     emit status("Writing epilogue ...");
     emit target(0);
@@ -337,6 +348,57 @@ void PythonFileFormat::writeEpilogue(QTextStream &out)
     out << "    sys.exit(1)\n";
 }
 
+void PythonFileFormat::writeStreamBlobs(QTextStream &out,
+        const OstProto::StreamConfigList &streams)
+{
+    // Emitting per-field assignments for thousands of streams makes both
+    // the script and its execution very slow; instead embed the streams
+    // as base64 encoded StreamConfigList blobs of upto kBlobChunkStreams
+    // each and apply every blob with one addStream and one modifyStream
+    emit status("Writing stream blobs ...");
+    emit target(streams.stream_size());
+    out << "    # --------------------------#\n";
+    out << "    # add and configure streams #\n";
+    out << "    # --------------------------#\n";
+    out << "    import base64\n";
+    out << "    stream_blobs = [\n";
+    for (int i = 0; i < streams.stream_size(); i += kBlobChunkStreams) {
+        OstProto::StreamConfigList chunk;
+        int n = qMin(kBlobChunkStreams, streams.stream_size() - i);
+        std::string blob;
+        QByteArray b64;
+
+        chunk.mutable_port_id()->set_id(streams.port_id().id());
+        for (int j = 0; j < n; j++)
+            chunk.add_stream()->CopyFrom(streams.stream(i + j));
+        chunk.SerializeToString(&blob);
+        b64 = QByteArray(blob.data(), int(blob.size())).toBase64();
+
+        out << "        '''\n";
+        for (int j = 0; j < b64.size(); j += 76)
+            out << b64.mid(j, 76) << "\n";
+        out << "        ''',\n";
+        emit progress(i + n - 1);
+    }
+    out << "    ]\n";
+    out << "\n";
+    out << "    stream_id = ost_pb.StreamIdList()\n";
+    out << "    stream_id.port_id.id = tx_port_number\n";
+    out << "    for blob in stream_blobs:\n";
+    out << "        stream_cfg = ost_pb.StreamConfigList()\n";
+    out << "        stream_cfg.ParseFromString(base64.b64decode(blob))\n";
+    out << "        stream_cfg.port_id.id = tx_port_number\n";
+    out << "        blob_id = ost_pb.StreamIdList()\n";
+    out << "        blob_id.port_id.id = tx_port_number\n";
+    out << "        for s in stream_cfg.stream:\n";
+    out << "            blob_id.stream_id.add().id = s.stream_id.id\n";
+    out << "        drone.addStream(blob_id)\n";
+    out << "        drone.modifyStream(stream_cfg)\n";
+    out << "        stream_id.stream_id.extend(blob_id.stream_id)\n";
+    out << "    log.info('added %d streams' % len(stream_id.stream_id))\n";
+    out << "\n";
+}
+
 void PythonFileFormat::writeFieldAssignment(
         QTextStream &out, 
         QString fieldName,
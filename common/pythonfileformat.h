@@ -42,6 +42,8 @@ private:
     void writeStandardImports(QTextStream &out);
     void writePrologue(QTextStream &out);
     void writeEpilogue(QTextStream &out);
+    void writeStreamBlobs(QTextStream &out,
+            const OstProto::StreamConfigList &streams);
     void writeFieldAssignment(QTextStream &out, 
             QString fieldName,
             const google::protobuf::Message &msg,
@@ -22,6 +22,8 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 SampleProtocol::SampleProtocol(StreamBase *stream, AbstractProtocol *parent)
     : AbstractProtocol(stream, parent)
 {
+    // Size is not the sum of the field sizes - no fixed frame layout
+    _cacheFlags &= ~FrameLayoutCache;
 }
 
 SampleProtocol::~SampleProtocol()
@@ -0,0 +1,61 @@
+/*
+Copyright (C) 2017 Srivats P.
+
+
+This file is part of "Ostinato"
+
+This is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+
+#ifndef _SDT_PROBES_H
+#define _SDT_PROBES_H
+
+/*
+ * USDT (systemtap SDT) probes of provider "ostinato" - a probe is a nop
+ * instruction unless a tracer (bpftrace, perf, systemtap) attaches to it,
+ * e.g.
+ *
+ *   bpftrace -e 'usdt:/usr/bin/drone:ostinato:tx_overrun
+ *                { @lag[str(arg0)] = hist(arg1); }'
+ *
+ * Without <sys/sdt.h> at build time (HAVE_SDT) the probes are compiled
+ * out. Probes (args) -
+ *
+ *   tx_set_start (device, sequence, packets)
+ *   tx_set_end (device, sequence, result) - result < 0 => stopped/error
+ *   tx_overrun (device, nsecs behind schedule) - after a packet set
+ *   tx_batch (device, frames) - a sendmmsg() batch
+ *   packet_list_build_start (port id, streams)
+ *   packet_list_frames_built (port id, frame sets) - sequential transmit
+ *   packet_list_build_end (port id, nsecs)
+ *   rpc_dispatch (method id, request id, nsecs queued)
+ *   rpc_reply (method id, request id, failed)
+ *   emulation_rx (port id, length) - DeviceManager::receivePacket()
+ *
+ * Args are integers or (device) strings
+ */
+#ifdef HAVE_SDT
+#include <sys/sdt.h>
+
+#define OST_PROBE2(name, a1, a2) \
+    DTRACE_PROBE2(ostinato, name, a1, a2)
+#define OST_PROBE3(name, a1, a2, a3) \
+    DTRACE_PROBE3(ostinato, name, a1, a2, a3)
+#else
+#define OST_PROBE2(name, a1, a2) do {} while (0)
+#define OST_PROBE3(name, a1, a2, a3) do {} while (0)
+#endif
+
+#endif
@@ -67,7 +67,7 @@ void SessionFileFormat::openAsync(const QString fileName,
 }
 
 void SessionFileFormat::saveAsync(
-        const OstProto::SessionContent &session,
+        OstProto::SessionContent &session,
         const QString fileName, QString &error)
 {
     saveSession_ = &session;
@@ -39,7 +39,8 @@ public:
 
     virtual bool open(const QString fileName,
             OstProto::SessionContent &session, QString &error) = 0;
-    virtual bool save(const OstProto::SessionContent &session,
+    // session may be modified while saving, but is restored before return
+    virtual bool save(OstProto::SessionContent &session,
             const QString fileName, QString &error) = 0;
 
     virtual QDialog* openOptionsDialog();
@@ -47,7 +48,7 @@ public:
 
     void openAsync(const QString fileName,
             OstProto::SessionContent &session, QString &error);
-    void saveAsync(const OstProto::SessionContent &session,
+    void saveAsync(OstProto::SessionContent &session,
             const QString fileName, QString &error);
 
     bool result();
@@ -76,7 +77,7 @@ protected:
 private:
     QString fileName_;
     OstProto::SessionContent *openSession_;
-    const OstProto::SessionContent *saveSession_;
+    OstProto::SessionContent *saveSession_;
     QString *error_;
     Operation op_;
     bool result_;
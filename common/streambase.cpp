@@ -19,19 +19,38 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 
 #include "streambase.h"
 #include "abstractprotocol.h"
+#include "crc32c.h"
 #include "protocollist.h"
 #include "protocollistiterator.h"
 #include "protocolmanager.h"
 
+#include <QDateTime>
+#include <QtEndian>
+
+#include <algorithm>
+#include <math.h>
+
 extern ProtocolManager *OstProtocolManager;
 extern quint64 getDeviceMacAddress(int portId, int streamId, int frameIndex);
 extern quint64 getNeighborMacAddress(int portId, int streamId, int frameIndex);
 
+QMutex StreamBase::compactLock_;
+
 StreamBase::StreamBase(int portId) :
     portId_(portId),
+    cksumOffload_(0),
+    defaultSeed_(quint64(QDateTime::currentDateTime().toMSecsSinceEpoch())
+                 ^ quint64(quintptr(this))),
     mStreamId(new OstProto::StreamId),
     mCore(new OstProto::StreamCore),
-    mControl(new OstProto::StreamControl)
+    mControl(new OstProto::StreamControl),
+    protocolsGeneration_(0),
+    isFrameCacheValid_(false),
+    frameCacheGeneration_(0),
+    frameVariableCount_(1),
+    isFrameVariable_(false),
+    isFrameSizeVariable_(false),
+    preflightPass_(-1)
 {
     AbstractProtocol *proto;
     ProtocolListIterator *iter;
@@ -83,15 +102,27 @@ StreamBase::~StreamBase()
 
 void StreamBase::protoDataCopyFrom(const OstProto::Stream &stream)
 {
-    AbstractProtocol        *proto;
-    ProtocolListIterator    *iter;
-
     mStreamId->CopyFrom(stream.stream_id());
     mCore->CopyFrom(stream.core());
     mControl->CopyFrom(stream.control());
+    frameLenTable_ = frameLenTable(*mCore);
+    isFrameCacheValid_ = false;
+    serializedConfig_.clear();
+    preflightPass_ = -1;
 
+    isCompact_ = 0;
+    compactProtocols_.clear();
     currentFrameProtocols->destroy();
-    iter = createProtocolListIterator();
+    insertProtocols(stream);
+}
+
+// Instantiates the protocols of stream into the (empty) protocol list
+void StreamBase::insertProtocols(const OstProto::Stream &stream)
+{
+    AbstractProtocol        *proto;
+    ProtocolListIterator    *iter;
+
+    iter = new ProtocolListIterator(*currentFrameProtocols);
     for (int i=0; i < stream.protocol_size(); i++)
     {
         int protoId = stream.protocol(i).protocol_id().id();
@@ -117,6 +148,17 @@ void StreamBase::protoDataCopyInto(OstProto::Stream &stream) const
     stream.mutable_control()->CopyFrom(*mControl);
 
     stream.clear_protocol();
+    if (isCompact_) {
+        QMutexLocker locker(&compactLock_);
+
+        // Not expanded meanwhile?
+        if (isCompact_) {
+            stream.MergeFromArray(compactProtocols_.constData(),
+                                  compactProtocols_.size());
+            return;
+        }
+    }
+
     foreach (const AbstractProtocol* proto, *currentFrameProtocols)
     {
         OstProto::Protocol *p;
@@ -127,6 +169,333 @@ void StreamBase::protoDataCopyInto(OstProto::Stream &stream) const
     }
 }
 
+QByteArray StreamBase::serializedConfig() const
+{
+    if (serializedConfig_.isEmpty()) {
+        OstProto::Stream stream;
+        std::string data;
+
+        protoDataCopyInto(stream);
+        if (stream.SerializeToString(&data))
+            serializedConfig_ = QByteArray(data.data(), int(data.size()));
+    }
+
+    // QByteArray is implicitly shared, so this doesn't copy the bytes
+    return serializedConfig_;
+}
+
+// Returns a new copy of 'msg' with only field 'f' retained
+static google::protobuf::Message* fieldOnly(
+        const google::protobuf::Message &msg,
+        const google::protobuf::FieldDescriptor *f)
+{
+    const google::protobuf::Descriptor *desc = msg.GetDescriptor();
+    google::protobuf::Message *copy = msg.New();
+
+    copy->CopyFrom(msg);
+    for (int i = 0; i < desc->field_count(); i++) {
+        if (desc->field(i) != f)
+            copy->GetReflection()->ClearField(copy, desc->field(i));
+    }
+
+    return copy;
+}
+
+/*
+ * Merges into 'delta' the fields of 'to' that are not the same in 'from'
+ * and adds to 'cleared' the field numbers that must be cleared before
+ * merging 'delta' - message and repeated fields are replaced whole.
+ * Returns true if there are any changes
+ */
+static bool diffFields(const google::protobuf::Message &from,
+        const google::protobuf::Message &to,
+        google::protobuf::Message *delta,
+        google::protobuf::RepeatedField<google::protobuf::uint32> *cleared)
+{
+    const google::protobuf::Descriptor *desc = to.GetDescriptor();
+    const google::protobuf::Reflection *refl = to.GetReflection();
+    bool isChanged = false;
+
+    delta->Clear();
+    for (int i = 0; i < desc->field_count(); i++)
+    {
+        const google::protobuf::FieldDescriptor *f = desc->field(i);
+        google::protobuf::Message *a = fieldOnly(from, f);
+        google::protobuf::Message *b = fieldOnly(to, f);
+        bool isSet = f->is_repeated() ? refl->FieldSize(to, f) > 0
+                                      : refl->HasField(to, f);
+
+        // Both have the same (or no) value for this field
+        if (a->SerializeAsString() == b->SerializeAsString())
+            goto _next;
+
+        isChanged = true;
+        if (!isSet || f->is_repeated() || (f->cpp_type()
+                    == google::protobuf::FieldDescriptor::CPPTYPE_MESSAGE))
+            cleared->Add(f->number());
+        if (isSet)
+            delta->MergeFrom(*b);
+_next:
+        delete a;
+        delete b;
+    }
+
+    return isChanged;
+}
+
+static void applyFields(const google::protobuf::Message &delta,
+        const google::protobuf::RepeatedField<google::protobuf::uint32> &cleared,
+        google::protobuf::Message *msg)
+{
+    const google::protobuf::Descriptor *desc = msg->GetDescriptor();
+
+    for (int i = 0; i < cleared.size(); i++) {
+        const google::protobuf::FieldDescriptor *f
+                        = desc->FindFieldByNumber(cleared.Get(i));
+        if (f)
+            msg->GetReflection()->ClearField(msg, f);
+    }
+    msg->MergeFrom(delta);
+}
+
+bool StreamBase::makeDelta(const OstProto::Stream &from,
+                           const OstProto::Stream &to,
+                           OstProto::StreamDelta &delta)
+{
+    bool isChanged = false;
+    bool isSameList = from.protocol_size() == to.protocol_size();
+
+    delta.Clear();
+    delta.mutable_stream_id()->CopyFrom(to.stream_id());
+
+    if (diffFields(from.core(), to.core(), delta.mutable_core(),
+                   delta.mutable_core_cleared()))
+        isChanged = true;
+    else
+        delta.clear_core();
+
+    if (diffFields(from.control(), to.control(), delta.mutable_control(),
+                   delta.mutable_control_cleared()))
+        isChanged = true;
+    else
+        delta.clear_control();
+
+    for (int i = 0; isSameList && (i < to.protocol_size()); i++) {
+        if (from.protocol(i).protocol_id().id()
+                != to.protocol(i).protocol_id().id())
+            isSameList = false;
+    }
+
+    if (!isSameList)
+        delta.set_protocol_count(to.protocol_size());
+
+    for (int i = 0; i < to.protocol_size(); i++) {
+        if (isSameList && (from.protocol(i).SerializeAsString()
+                                == to.protocol(i).SerializeAsString()))
+            continue;
+
+        OstProto::ProtocolDelta *p = delta.add_protocol();
+        p->set_index(i);
+        p->mutable_protocol()->CopyFrom(to.protocol(i));
+        isChanged = true;
+    }
+
+    return isChanged || !isSameList;
+}
+
+bool StreamBase::applyDelta(const OstProto::StreamDelta &delta,
+                            OstProto::Stream &stream)
+{
+    applyFields(delta.core(), delta.core_cleared(), stream.mutable_core());
+    applyFields(delta.control(), delta.control_cleared(),
+                stream.mutable_control());
+
+    if (delta.has_protocol_count()) {
+        // A changed protocol list must be sent whole
+        if (int(delta.protocol_count()) != delta.protocol_size()) {
+            qWarning("stream %u: delta protocol count %u != %d protocols",
+                    delta.stream_id().id(), delta.protocol_count(),
+                    delta.protocol_size());
+            return false;
+        }
+        stream.clear_protocol();
+        for (uint i = 0; i < delta.protocol_count(); i++)
+            stream.add_protocol()->mutable_protocol_id()->set_id(0);
+    }
+
+    for (int i = 0; i < delta.protocol_size(); i++) {
+        int index = delta.protocol(i).index();
+
+        if (index >= stream.protocol_size()) {
+            qWarning("stream %u: delta protocol index %d out of range (%d)",
+                    delta.stream_id().id(), index, stream.protocol_size());
+            return false;
+        }
+        stream.mutable_protocol(index)->CopyFrom(delta.protocol(i).protocol());
+    }
+
+    return true;
+}
+
+/*
+ * Returns true if the delta changes only the rate of the stream - its
+ * frames stay the same
+ */
+bool StreamBase::isRateOnlyDelta(const OstProto::StreamDelta &delta)
+{
+    OstProto::StreamControl control;
+
+    if (delta.has_core() || delta.core_cleared_size()
+            || delta.has_protocol_count() || delta.protocol_size())
+        return false;
+
+    control.CopyFrom(delta.control());
+    control.clear_packets_per_sec();
+    control.clear_bursts_per_sec();
+    if (control.ByteSize())
+        return false;
+
+    for (int i = 0; i < delta.control_cleared_size(); i++) {
+        uint field = delta.control_cleared(i);
+
+        if ((field != OstProto::StreamControl::kPacketsPerSecFieldNumber)
+                && (field != OstProto::StreamControl::kBurstsPerSecFieldNumber))
+            return false;
+    }
+
+    return true;
+}
+
+bool StreamBase::sweepStream(const OstProto::StreamSweep &sweep, int index,
+                             OstProto::Stream &stream)
+{
+    const OstProto::Stream &base = sweep.stream();
+    quint32 offset = quint32(index) * sweep.stride();
+
+    stream.CopyFrom(base);
+    stream.mutable_stream_id()->set_id(base.stream_id().id() + offset);
+    stream.mutable_core()->set_ordinal(base.core().ordinal() + offset);
+    if (sweep.number_names())
+        stream.mutable_core()->set_name(base.core().name()
+                + QString(" (%1)").arg(index + 1).toStdString());
+
+    // Each swept field is set as a variable field of count 1 i.e. a value
+    // fixed for all frames of the stream
+    for (int i = 0; i < sweep.field_size(); i++) {
+        const OstProto::VariableField &field = sweep.field(i).field();
+        int protoIndex = sweep.field(i).protocol_index();
+        bool isWide = field.type() >= OstProto::VariableField::kCounter48;
+        OstProto::VariableField *vf;
+
+        if (protoIndex >= stream.protocol_size()) {
+            qWarning("stream sweep: protocol index %d out of range (%d)",
+                    protoIndex, stream.protocol_size());
+            return false;
+        }
+
+        vf = stream.mutable_protocol(protoIndex)->add_variable_field();
+        vf->CopyFrom(field);
+        vf->clear_values();
+        vf->set_mode(OstProto::VariableField::kIncrement);
+        vf->set_count(1);
+
+        switch (field.mode()) {
+        case OstProto::VariableField::kIncrement:
+        case OstProto::VariableField::kDecrement:
+        {
+            bool isDecrement =
+                    field.mode() == OstProto::VariableField::kDecrement;
+            quint64 delta = quint64(index % qMax(int(field.count()), 1))
+                                * field.step();
+
+            if (isWide) {
+                quint64 v = isDecrement ? field.value64() - delta
+                                        : field.value64() + delta;
+
+                // Carry/borrow into the high 64 bits (used by kCounter128)
+                if (isDecrement && (v > field.value64()))
+                    vf->set_value_hi(field.value_hi() - 1);
+                else if (!isDecrement && (v < field.value64()))
+                    vf->set_value_hi(field.value_hi() + 1);
+                vf->set_value64(v);
+            }
+            else
+                vf->set_value(isDecrement ? field.value() - quint32(delta)
+                                          : field.value() + quint32(delta));
+            break;
+        }
+        case OstProto::VariableField::kList:
+        {
+            quint64 v;
+
+            if (!field.values_size()) {
+                qWarning("stream sweep: empty value list");
+                return false;
+            }
+            v = field.values(index % field.values_size());
+            if (isWide)
+                vf->set_value64(v);
+            else
+                vf->set_value(quint32(v));
+            break;
+        }
+        default:
+            qWarning("stream sweep: unsupported field mode %d", field.mode());
+            return false;
+        }
+    }
+
+    return true;
+}
+
+const QVector<AbstractProtocol*>& StreamBase::protocols() const
+{
+    expand();
+    if (protocolsGeneration_ != currentFrameProtocols->generation()) {
+        protocols_.clear();
+        protocols_.reserve(currentFrameProtocols->size());
+        foreach (AbstractProtocol *proto, *currentFrameProtocols)
+            protocols_.append(proto);
+        protocolsGeneration_ = currentFrameProtocols->generation();
+    }
+
+    return protocols_;
+}
+
+bool StreamBase::isFrameCacheUsable() const
+{
+    return isFrameCacheValid_
+        && (isCompact_
+            || (frameCacheGeneration_ == currentFrameProtocols->generation()));
+}
+
+void StreamBase::updateFrameCache()
+{
+    isFrameCacheValid_ = false;
+
+    foreach (AbstractProtocol *proto, protocols())
+        proto->updateFrameLayout();
+
+    frameVariableCount_ = frameVariableCount();
+    isFrameVariable_ = isFrameVariable();
+    isFrameSizeVariable_ = isFrameSizeVariable();
+
+    frameCacheGeneration_ = currentFrameProtocols->generation();
+    isFrameCacheValid_ = true;
+}
+
+bool StreamBase::protoDataApplyDelta(const OstProto::StreamDelta &delta)
+{
+    OstProto::Stream stream;
+
+    protoDataCopyInto(stream);
+    if (!applyDelta(delta, stream))
+        return false;
+    protoDataCopyFrom(stream);
+
+    return true;
+}
+
 #if 0
 ProtocolList StreamBase::frameProtocol()
 {
@@ -142,9 +511,79 @@ void StreamBase::setFrameProtocol(ProtocolList protocolList)
 
 ProtocolListIterator*  StreamBase::createProtocolListIterator() const
 {
+    expand();
     return new ProtocolListIterator(*currentFrameProtocols);
 }
 
+/*!
+  Drops the protocol objects of the stream (along with their copies of the
+  config and their caches), keeping their config serialized instead - they
+  are instantiated again when next used (see expand()). This is for a drone
+  with very many streams, whose protocols are needed only to build frames;
+  the frame cache (see updateFrameCache()) is retained, and the config can
+  be read (protoDataCopyInto()) without instantiating the protocols
+
+  Must not be called while anything else is using the stream
+*/
+void StreamBase::compact()
+{
+    OstProto::Stream stream;
+    std::string data;
+
+    if (isCompact_)
+        return;
+
+    foreach (const AbstractProtocol* proto, *currentFrameProtocols)
+    {
+        OstProto::Protocol *p = stream.add_protocol();
+
+        proto->commonProtoDataCopyInto(*p);
+        proto->protoDataCopyInto(*p);
+    }
+    if (!stream.SerializeToString(&data))
+        return;
+
+    compactProtocols_ = QByteArray(data.data(), int(data.size()));
+    currentFrameProtocols->destroy();
+    protocols_.clear();
+    protocols_.squeeze();
+    isCompact_ = 1;
+}
+
+/*
+ * Instantiates the protocols of a compacted stream again - the frame cache
+ * stays valid, as the config is unchanged. Many threads may need a stream's
+ * protocols at the same time (e.g. stream config reads), so this is done
+ * under a lock
+ */
+void StreamBase::expand() const
+{
+    // A stream being expanded or used is never compacted at the same time
+    if (!isCompact_)
+        return;
+
+    QMutexLocker locker(&compactLock_);
+    StreamBase *self = const_cast<StreamBase*>(this); // logically const
+    OstProto::Stream stream;
+
+    if (!isCompact_)
+        return;
+
+    if (!stream.ParseFromArray(compactProtocols_.constData(),
+                               compactProtocols_.size()))
+        qWarning("stream %u: unable to expand protocols", id());
+    self->insertProtocols(stream);
+
+    if (isFrameCacheValid_) {
+        foreach (AbstractProtocol *proto, *currentFrameProtocols)
+            proto->updateFrameLayout();
+        self->frameCacheGeneration_ = currentFrameProtocols->generation();
+    }
+
+    self->compactProtocols_.clear();
+    self->isCompact_.fetchAndStoreRelease(0);
+}
+
 quint32 StreamBase::id() const
 {
     return mStreamId->id();
@@ -153,6 +592,7 @@ quint32 StreamBase::id() const
 bool StreamBase::setId(quint32 id)
 {
     mStreamId->set_id(id);
+    serializedConfig_.clear();
     return true;
 }
 
@@ -178,6 +618,60 @@ bool StreamBase::setEnabled(bool flag)
     return true;
 }
 
+bool StreamBase::isTracked() const
+{
+    return mCore->is_tracked();
+}
+
+bool StreamBase::setTracked(bool tracked)
+{
+    mCore->set_is_tracked(tracked);
+    return true;
+}
+
+bool StreamBase::hasPayloadCrc() const
+{
+    return mCore->payload_crc();
+}
+
+bool StreamBase::setPayloadCrc(bool payloadCrc)
+{
+    mCore->set_payload_crc(payloadCrc);
+    return true;
+}
+
+bool StreamBase::hasRandomSeed() const
+{
+    return mCore->has_random_seed();
+}
+
+quint64 StreamBase::randomSeed() const
+{
+    return mCore->has_random_seed() ? mCore->random_seed() : defaultSeed_;
+}
+
+bool StreamBase::setRandomSeed(quint64 seed)
+{
+    mCore->set_random_seed(seed);
+    return true;
+}
+
+bool StreamBase::hasFrameSet() const
+{
+    return mCore->has_frame_set_id();
+}
+
+quint32 StreamBase::frameSetId() const
+{
+    return mCore->frame_set_id();
+}
+
+bool StreamBase::setFrameSetId(quint32 frameSetId)
+{
+    mCore->set_frame_set_id(frameSetId);
+    return true;
+}
+
 const QString StreamBase::name() const 
 {
     return QString().fromStdString(mCore->name());
@@ -197,6 +691,8 @@ StreamBase::FrameLengthMode    StreamBase::lenMode() const
 bool StreamBase::setLenMode(FrameLengthMode    lenMode)
 {
     mCore->set_len_mode((OstProto::StreamCore::FrameLengthMode) lenMode); 
+    frameLenTable_ = frameLenTable(*mCore);
+    isFrameCacheValid_ = false;
     return true;
 }
 
@@ -219,13 +715,16 @@ quint16    StreamBase::frameLen(int streamIndex) const
                 (frameLenMax() - frameLenMin() + 1));
             break;
         case OstProto::StreamCore::e_fl_random:
-            //! \todo (MED) This 'random' sequence is same across iterations
-            pktLen = 64; // to avoid the 'maybe used uninitialized' warning
-            qsrand(reinterpret_cast<ulong>(this));
-            for (int i = 0; i <= streamIndex; i++)
-                pktLen = qrand();
-            pktLen = frameLenMin() + (pktLen %
-                (frameLenMax() - frameLenMin() + 1));
+            pktLen = frameLenMin() + random(streamIndex, 0).next(
+                frameLenMax() - frameLenMin() + 1);
+            break;
+        case OstProto::StreamCore::e_fl_imix:
+        case OstProto::StreamCore::e_fl_weighted:
+            if (frameLenTable_.isEmpty()) // no (valid) weights
+                pktLen = mCore->frame_len();
+            else
+                pktLen = frameLenTable_.at(streamIndex
+                                           % frameLenTable_.size());
             break;
         default:
             qWarning("Unhandled len mode %d. Using default 64", 
@@ -251,6 +750,7 @@ quint16    StreamBase::frameLenMin() const
 bool StreamBase::setFrameLenMin(quint16 frameLenMin)
 {
     mCore->set_frame_len_min(frameLenMin);  
+    isFrameCacheValid_ = false;
     return true;
 }
 
@@ -262,6 +762,7 @@ quint16    StreamBase::frameLenMax() const
 bool StreamBase::setFrameLenMax(quint16 frameLenMax)
 {
     mCore->set_frame_len_max(frameLenMax);  
+    isFrameCacheValid_ = false;
     return true;
 }
 
@@ -272,12 +773,114 @@ quint16 StreamBase::frameLenAvg() const
 
     if (lenMode() == e_fl_fixed)
         avgFrameLen = frameLen();
+    else if (!frameLenTable_.isEmpty()) {
+        quint64 sum = 0;
+        for (int i = 0; i < frameLenTable_.size(); i++)
+            sum += frameLenTable_.at(i);
+        avgFrameLen = sum/frameLenTable_.size();
+    }
+    else if ((lenMode() == e_fl_imix) || (lenMode() == e_fl_weighted))
+        avgFrameLen = mCore->frame_len();
     else
         avgFrameLen = (frameLenMin() + frameLenMax())/2;
 
     return avgFrameLen;
 }
 
+void StreamBase::clearFrameLenWeights()
+{
+    mCore->clear_frame_len_weight();
+    frameLenTable_ = frameLenTable(*mCore);
+    isFrameCacheValid_ = false;
+}
+
+bool StreamBase::addFrameLenWeight(quint16 frameLen, uint weight)
+{
+    OstProto::FrameLengthWeight *w = mCore->add_frame_len_weight();
+
+    w->set_frame_len(frameLen);
+    w->set_weight(weight);
+    frameLenTable_ = frameLenTable(*mCore);
+    isFrameCacheValid_ = false;
+    return true;
+}
+
+/*!
+  Returns the frame lengths of the imix and weighted modes - each length
+  appears in proportion to its weight, spread out evenly (smooth weighted
+  round robin) instead of in runs; the table is as short as the ratio of
+  the weights allows, so the packet list has only as many frames
+
+  Returns an empty table for the other modes and if there are no weights
+*/
+QVector<quint16> StreamBase::frameLenTable(const OstProto::StreamCore &core)
+{
+    // Keeps the packet list small for weights with a large sum
+    const uint kMaxTableSize = 1024;
+    QVector<quint16> lens;
+    QVector<uint> weights;
+    QVector<qint64> current;
+    QVector<quint16> table;
+    quint64 gcd = 0;
+    quint64 total = 0;
+
+    switch (core.len_mode()) {
+    case OstProto::StreamCore::e_fl_imix:
+        lens << 64 << 594 << 1518;
+        weights << 7 << 4 << 1;
+        break;
+    case OstProto::StreamCore::e_fl_weighted:
+        for (int i = 0; i < core.frame_len_weight_size(); i++) {
+            const OstProto::FrameLengthWeight &w = core.frame_len_weight(i);
+            if (!w.frame_len() || !w.weight() || (w.frame_len() > 0xffff))
+                continue;
+            lens.append(w.frame_len());
+            weights.append(w.weight());
+        }
+        break;
+    default:
+        return table;
+    }
+
+    if (lens.isEmpty())
+        return table;
+
+    for (int i = 0; i < weights.size(); i++)
+        gcd = AbstractProtocol::gcd(gcd, weights.at(i));
+    for (int i = 0; i < weights.size(); i++) {
+        weights[i] /= gcd;
+        total += weights.at(i);
+    }
+
+    // Scale down (approximately) - each length is still sent
+    if (total > kMaxTableSize) {
+        quint64 oldTotal = total;
+
+        total = 0;
+        for (int i = 0; i < weights.size(); i++) {
+            weights[i] = qMax(quint64(1),
+                              weights.at(i)*quint64(kMaxTableSize)/oldTotal);
+            total += weights.at(i);
+        }
+    }
+
+    current.fill(0, weights.size());
+    table.reserve(total);
+    for (quint64 n = 0; n < total; n++) {
+        int best = 0;
+
+        for (int i = 0; i < weights.size(); i++) {
+            current[i] += weights.at(i);
+            if (current.at(i) > current.at(best))
+                best = i;
+        }
+        current[best] -= total;
+        table.append(lens.at(best));
+    }
+
+    return table;
+}
+
 StreamBase::SendUnit StreamBase::sendUnit() const
 {
     return (StreamBase::SendUnit) mControl->unit();
@@ -312,6 +915,33 @@ bool StreamBase::setNextWhat(NextWhat nextWhat)
     return true;
 }
 
+bool StreamBase::hasGotoStreamId() const
+{
+    return mControl->has_goto_stream_id();
+}
+
+quint32 StreamBase::gotoStreamId() const
+{
+    return mControl->goto_stream_id();
+}
+
+bool StreamBase::setGotoStreamId(quint32 streamId)
+{
+    mControl->set_goto_stream_id(streamId);
+    return true;
+}
+
+bool StreamBase::isShuffled() const
+{
+    return mControl->shuffle_frames();
+}
+
+bool StreamBase::setShuffled(bool shuffled)
+{
+    mControl->set_shuffle_frames(shuffled);
+    return true;
+}
+
 quint32 StreamBase::numPackets() const
 {
     return (quint32) mControl->num_packets();
@@ -405,46 +1035,131 @@ bool StreamBase::setAveragePacketRate(double packetsPerSec)
     return true;
 }
 
+/*!
+  Returns true if the gaps between packets are not all the same - i.e.
+  the stream has a gapTable()
+*/
+bool StreamBase::hasGapTable() const
+{
+    if (sendUnit() != e_su_packets)
+        return false;
+
+    switch (mControl->gap_distribution()) {
+    case OstProto::StreamControl::e_gd_poisson:
+    case OstProto::StreamControl::e_gd_pareto:
+        return true;
+    case OstProto::StreamControl::e_gd_custom:
+        return mControl->gaps_size() > 0;
+    default:
+        return false;
+    }
+}
+
+/*!
+  Returns count gaps (nsecs) as per the stream's gap distribution - the
+  i-th gap is from the i-th packet to the next one. The gaps add up to
+  exactly count/packetRate() secs (rounded to nsecs), so a table that is
+  cycled through keeps the average rate exact
+
+  The random gaps are from the stream's random seed and so are the same
+  every time the table is built
+*/
+QVector<quint64> StreamBase::gapTable(int count) const
+{
+    QVector<quint64> gaps(count);
+    QVector<double> raw(count);
+    Pcg32 rng(randomSeed(), kGapTableSubstream);
+    double shape = qMax(mControl->pareto_shape(), 1.01);
+    double sum = 0, total, acc = 0;
+    quint64 prev = 0;
+
+    if ((count <= 0) || (packetRate() <= 0))
+        return gaps;
+
+    for (int i = 0; i < count; i++) {
+        // (0, 1] - so that log() and pow() are finite
+        double u = (rng.next() + 1.0)/4294967296.0;
+
+        switch (mControl->gap_distribution()) {
+        case OstProto::StreamControl::e_gd_poisson:
+            raw[i] = -log(u);
+            break;
+        case OstProto::StreamControl::e_gd_pareto:
+            raw[i] = pow(u, -1/shape);
+            break;
+        case OstProto::StreamControl::e_gd_custom:
+            raw[i] = mControl->gaps_size() ?
+                qMax(mControl->gaps(i % mControl->gaps_size()), 0.0) : 1;
+            break;
+        default:
+            raw[i] = 1;
+            break;
+        }
+        sum += raw[i];
+    }
+    if (sum <= 0) {
+        raw.fill(1);
+        sum = count;
+    }
+
+    // Rounding the running total (and not each gap) keeps the sum exact
+    total = double(count)*1e9/packetRate();
+    for (int i = 0; i < count; i++) {
+        quint64 t;
+
+        acc += raw[i];
+        t = quint64(acc*total/sum + 0.5);
+        gaps[i] = t - prev;
+        prev = t;
+    }
+
+    return gaps;
+}
+
 bool StreamBase::isFrameVariable() const
 {
-    ProtocolListIterator    *iter;
+    if (isFrameCacheUsable())
+        return isFrameVariable_;
 
-    iter = createProtocolListIterator();
-    while (iter->hasNext())
+    foreach (const AbstractProtocol *proto, protocols())
     {
-        AbstractProtocol    *proto;
-
-        proto = iter->next();
         if (proto->isProtocolFrameValueVariable())
-            goto _exit;
+            return true;
     }
-    delete iter;
-    return false;
 
-_exit:
-    delete iter;
-    return true;
+    return false;
 }
 
 bool StreamBase::isFrameSizeVariable() const
 {
-    ProtocolListIterator    *iter;
+    if (isFrameCacheUsable())
+        return isFrameSizeVariable_;
 
-    iter = createProtocolListIterator();
-    while (iter->hasNext())
+    foreach (const AbstractProtocol *proto, protocols())
     {
-        AbstractProtocol    *proto;
-
-        proto = iter->next();
         if (proto->isProtocolFrameSizeVariable())
-            goto _exit;
+            return true;
     }
-    delete iter;
+
     return false;
+}
 
-_exit:
-    delete iter;
-    return true;
+/*!
+  Returns true if the frames depend on the random seed - random frame
+  lengths or random protocol field values
+*/
+bool StreamBase::isFrameValueRandom() const
+{
+    if (lenMode() == e_fl_random)
+        return true;
+
+    foreach (const AbstractProtocol *proto, protocols())
+    {
+        if (proto->isProtocolFrameValueRandom())
+            return true;
+    }
+
+    return false;
 }
 
 int StreamBase::frameSizeVariableCount() const
@@ -460,6 +1175,10 @@ int StreamBase::frameSizeVariableCount() const
         case OstProto::StreamCore::e_fl_random:
             count = frameLenMax() - frameLenMin() + 1;
             break;
+        case OstProto::StreamCore::e_fl_imix:
+        case OstProto::StreamCore::e_fl_weighted:
+            count = qMax(frameLenTable_.size(), 1);
+            break;
         default:
             qWarning("%s: Unhandled len mode %d",  __FUNCTION__, lenMode());
             break;
@@ -470,17 +1189,14 @@ int StreamBase::frameSizeVariableCount() const
 
 int StreamBase::frameVariableCount() const
 {
-    ProtocolListIterator    *iter;
     quint64 frameCount = 1;
 
-    iter = createProtocolListIterator();
-    while (iter->hasNext())
-    {
-        AbstractProtocol    *proto;
-        int count;
+    if (isFrameCacheUsable())
+        return frameVariableCount_;
 
-        proto = iter->next();
-        count = proto->protocolFrameVariableCount();
+    foreach (const AbstractProtocol *proto, protocols())
+    {
+        int count = proto->protocolFrameVariableCount();
 
         // correct count for mis-behaving protocols
         if (count <= 0)
@@ -488,7 +1204,6 @@ int StreamBase::frameVariableCount() const
 
         frameCount = AbstractProtocol::lcm(frameCount, count);
     }
-    delete iter;
 
     return AbstractProtocol::lcm(frameCount, frameSizeVariableCount());
 }
@@ -498,15 +1213,9 @@ int StreamBase::frameVariableCount() const
 int StreamBase::frameProtocolLength(int frameIndex) const
 {
     int len = 0;
-    ProtocolListIterator *iter = createProtocolListIterator();
-
-    while (iter->hasNext())
-    {
-        AbstractProtocol *proto = iter->next();
 
+    foreach (const AbstractProtocol *proto, protocols())
         len += proto->protocolFrameSize(frameIndex);
-    }
-    delete iter;
 
     return len;
 }
@@ -525,11 +1234,36 @@ int StreamBase::frameCount() const
     return count;
 }
 
+// Ones complement sum of 16-bit words as they are in memory - an odd
+// trailing byte is padded with zero
+static quint16 onesSum(const uchar *buf, int size)
+{
+    quint32 sum = 0;
+
+    for (int i = 0; i < (size - 1); i += 2)
+        sum += *((const quint16*)(buf + i));
+
+    if (size & 1) {
+        quint16 last = 0;
+
+        *((uchar*)&last) = buf[size - 1];
+        sum += last;
+    }
+
+    while (sum >> 16)
+        sum = (sum & 0xFFFF) + (sum >> 16);
+
+    return sum;
+}
+
 // Returns packet length - if bufMaxSize < frameLen(), returns truncated
 // length i.e. bufMaxSize
 int StreamBase::frameValue(uchar *buf, int bufMaxSize, int frameIndex) const
 {
     int maxSize, size, pktLen, len = 0;
+    bool isTruncated = false;
+    DeferredCksum deferred[kMaxDeferredCksums];
+    int deferredCount = 0;
 
     pktLen = frameLen(frameIndex);
 
@@ -541,25 +1275,68 @@ int StreamBase::frameValue(uchar *buf, int bufMaxSize, int frameIndex) const
 
     maxSize = qMin(pktLen, bufMaxSize);
 
-    ProtocolListIterator    *iter;
-
-    iter = createProtocolListIterator();
-    while (iter->hasNext())
+    foreach (const AbstractProtocol *proto, protocols())
     {
-        AbstractProtocol    *proto;
-        QByteArray            ba;
+        const QByteArray *fv = proto->constantFrameValue();
 
-        proto = iter->next();
-        ba = proto->protocolFrameValue(frameIndex);
+        if (fv) {
+            size = fv->size();
+            memcpy(buf+len, fv->constData(), qMin(size, maxSize-len));
+        }
+        else {
+            // TCP/UDP cksum is filled in below from the frame built
+            int cksumOffset = deferredCount < kMaxDeferredCksums ?
+                                proto->deferredCksumOffset() : -1;
+
+            size = proto->writeFrameValue(buf+len, maxSize-len, frameIndex,
+                                          cksumOffset >= 0);
+            if (cksumOffset >= 0) {
+                deferred[deferredCount].proto = proto;
+                deferred[deferredCount].offset = len;
+                deferred[deferredCount].cksumOffset = cksumOffset;
+                deferredCount++;
+            }
+        }
 
-        size = qMin(ba.size(), maxSize-len);
-        memcpy(buf+len, ba.constData(), size);
-        len += size;
+        if (size > (maxSize-len))
+            isTruncated = true;
+        len += qMin(size, maxSize-len);
 
-        if (len == maxSize)
+        if (len == maxSize) {
+            if (proto != protocols().last())
+                isTruncated = true;
             break;
+        }
+    }
+
+    // Innermost first - an outer TCP/UDP's payload includes the inner one
+    for (int i = deferredCount - 1; i >= 0; i--)
+    {
+        const DeferredCksum &d = deferred[i];
+
+        // The frame has only a part of the payload - use the protocol to
+        // compute the cksum over all of it instead
+        if (isTruncated) {
+            d.proto->writeFrameValue(buf+d.offset, maxSize-d.offset,
+                                     frameIndex);
+            continue;
+        }
+
+        if ((d.offset + d.cksumOffset + 2) > len)
+            continue;
+
+        quint32 sum = qFromBigEndian(onesSum(buf+d.offset, len-d.offset));
+        sum += quint16(~d.proto->protocolFrameHeaderCksum(frameIndex,
+                                        AbstractProtocol::CksumIpPseudo));
+        while (sum >> 16)
+            sum = (sum & 0xFFFF) + (sum >> 16);
+
+        quint16 cksum = ~sum;
+        if ((cksum == 0) && (d.proto->protocolNumber()
+                                == OstProto::Protocol::kUdpFieldNumber))
+            cksum = 0xFFFF;
+        qToBigEndian(cksum, buf + d.offset + d.cksumOffset);
     }
-    delete iter;
 
     // Pad with zero, if required and if we have space
     if (len < maxSize) {
@@ -568,9 +1345,80 @@ int StreamBase::frameValue(uchar *buf, int bufMaxSize, int frameIndex) const
         len += size;
     }
 
+    if (isTracked() && (len == pktLen))
+        setFrameSignature(buf, len);
+
     return len;
 }
 
+
+/*!
+  Overwrites the trailing bytes of the frame with the stream's signature
+  (see kSignatureSize) with the sequence number and tx time as 0; these
+  are filled in by the transmitter. With payload_crc, the payload CRC
+  (see kPayloadCrcSize) is put in just before the signature
+
+  Does nothing if the frame is too short for a signature
+*/
+void StreamBase::setFrameSignature(uchar *frame, int length) const
+{
+    signFrame(frame, length, quint32(mStreamId->id()), quint16(portId_),
+              hasPayloadCrc() ? payloadOffset() : -1);
+}
+
+int StreamBase::payloadOffset() const
+{
+    int offset = 0;
+
+    foreach (const AbstractProtocol *proto, protocols())
+    {
+        if (proto->protocolNumber() == OstProto::Protocol::kPayloadFieldNumber)
+            break;
+        offset += proto->protocolFrameSize(0);
+    }
+
+    return offset;
+}
+
+/*!
+  Like setFrameSignature() but for any stream id and port id
+*/
+void StreamBase::signFrame(uchar *frame, int length, quint32 streamId,
+                           quint16 portId, int payloadOffset)
+{
+    int offset = signatureOffset(length);
+    int start = offset; // of the bytes replaced
+    uchar *sig = frame + offset;
+    quint32 sum;
+
+    if (offset < 0)
+        return;
+
+    if ((payloadOffset >= 0) && (offset >= kPayloadCrcSize))
+        start -= kPayloadCrcSize;
+    sum = onesSum(frame + start, offset + kSignatureSize - start);
+
+    if (start < offset) {
+        int payloadLen = qMax(0, start - payloadOffset);
+
+        qToBigEndian(crc32c(0, frame + start - payloadLen, payloadLen),
+                     frame + start);
+        qToBigEndian(quint16(payloadLen), frame + start + 4);
+        portId |= kSignaturePayloadCrc;
+    }
+
+    memset(sig, 0, kSignatureSize);
+    qToBigEndian(kSignatureMagic, sig);
+    qToBigEndian(streamId, sig + kSignatureStreamIdOffset);
+    qToBigEndian(portId, sig + kSignaturePortIdOffset);
+
+    // adjust = (sum of replaced bytes) - (sum of signature [+ crc])
+    sum += quint16(~onesSum(frame + start, offset + kSignatureSize - start));
+    while (sum >> 16)
+        sum = (sum & 0xFFFF) + (sum >> 16);
+    *((quint16*)(sig + kSignatureCksumOffset)) = sum;
+}
+
 quint64 StreamBase::deviceMacAddress(int frameIndex) const
 {
     return getDeviceMacAddress(portId_, int(mStreamId->id()), frameIndex);
@@ -584,31 +1432,94 @@ quint64 StreamBase::neighborMacAddress(int frameIndex) const
 bool StreamBase::preflightCheck(QStringList &result) const
 {
     bool pass = true;
-    int count = isFrameSizeVariable() ? frameCount() : 1;
+    bool isTruncated = false, isJumbo = false;
+    bool isLenOnly = true;
+    int shortest = 0;
+    // Frame and protocol lengths repeat every frameVariableCount() frames
+    int count = isFrameSizeVariable() ?
+                    qMin(frameCount(), frameVariableCount()) : 1;
+
+    // Unless a protocol's size varies by itself, the protocol length is
+    // by the frame length alone - and the payload (or padding) that fills
+    // upto the frame length grows no faster than the frame does. So only
+    // the shortest frame need be checked for truncation
+    foreach (const AbstractProtocol *proto, protocols())
+    {
+        if (proto->isProtocolFrameSizeVariable()
+                && (proto->protocolNumber()
+                    != OstProto::Protocol::kPayloadFieldNumber))
+            isLenOnly = false;
+    }
 
-    for (int i = 0; i < count; i++)
+    if (isLenOnly && (count > 1))
     {
-        if (frameLen(i) < (frameProtocolLength(i) + kFcsSize))
+        for (int i = 0; i < count; i++)
+        {
+            int len = frameLen(i);
+
+            if (len < frameLen(shortest))
+                shortest = i;
+            if (len > 1522)
+                isJumbo = true;
+        }
+        count = 0; // all checked
+        if (frameLen(shortest) < (frameProtocolLength(shortest) + kFcsSize))
         {
             result << QObject::tr("One or more frames may be truncated - "
                 "frame length should be at least %1")
-                .arg(frameProtocolLength(i) + kFcsSize);
+                .arg(frameProtocolLength(shortest) + kFcsSize);
             pass = false;
-            break;
         }
     }
 
     for (int i = 0; i < count; i++)
     {
-        if (frameLen(i) > 1522)
+        int len = frameLen(i);
+
+        if (!isTruncated && (len < (frameProtocolLength(i) + kFcsSize)))
         {
-            result << QObject::tr("Jumbo frames may be truncated or dropped "
-                "if not supported by the hardware");
+            result << QObject::tr("One or more frames may be truncated - "
+                "frame length should be at least %1")
+                .arg(frameProtocolLength(i) + kFcsSize);
             pass = false;
+            isTruncated = true;
+        }
+        if (len > 1522)
+            isJumbo = true;
+
+        if (isTruncated && isJumbo)
             break;
+    }
+
+    if (isTracked())
+    {
+        // Signature (and payload CRC) can overwrite only the payload
+        int headerLength = payloadOffset() + (hasPayloadCrc() ?
+                                                kPayloadCrcSize : 0);
+
+        int minLen = frameLenMin();
+
+        if (!frameLenTable_.isEmpty())
+            minLen = *std::min_element(frameLenTable_.constBegin(),
+                                       frameLenTable_.constEnd());
+        if ((frameLen(0) - kFcsSize - kSignatureSize) < headerLength
+                || (isFrameSizeVariable() && ((minLen - kFcsSize
+                        - kSignatureSize) < headerLength)))
+        {
+            result << QObject::tr("Stream stats signature will overwrite "
+                "protocol headers - frame length should be at least %1")
+                .arg(headerLength + kSignatureSize + kFcsSize);
+            pass = false;
         }
     }
 
+    if (isJumbo)
+    {
+        result << QObject::tr("Jumbo frames may be truncated or dropped "
+            "if not supported by the hardware");
+        pass = false;
+    }
+
     if (frameCount() <= averagePacketRate() && nextWhat() != e_nw_goto_id)
     {
         result << QObject::tr("Only %L1 frames at the rate of "
@@ -626,6 +1537,17 @@ bool StreamBase::preflightCheck(QStringList &result) const
     return pass;
 }
 
+bool StreamBase::cachedPreflightCheck(QStringList &result) const
+{
+    if (preflightPass_ < 0) {
+        preflightResult_.clear();
+        preflightPass_ = preflightCheck(preflightResult_);
+    }
+
+    result << preflightResult_;
+    return preflightPass_ > 0;
+}
+
 bool StreamBase::StreamLessThan(StreamBase* stream1, StreamBase* stream2)
 {
     return stream1->ordinal() < stream2->ordinal() ? true : false;
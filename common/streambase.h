@@ -20,13 +20,50 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 #ifndef _STREAM_BASE_H
 #define _STREAM_BASE_H
 
-#include <QString>
+#include <QAtomicInt>
+#include <QByteArray>
 #include <QLinkedList>
+#include <QMutex>
+#include <QString>
+#include <QStringList>
+#include <QVector>
 
+#include "prng.h"
 #include "protocol.pb.h"
 
 const int kFcsSize = 4;
 
+// Trailer of a tracked stream's frames - all fields are big endian
+//   magic (4) | stream id (4) | tx port id (2) | cksum adjust (2) |
+//   sequence number (4) | tx time in nsecs since the epoch (8)
+// The cksum adjust word keeps the ones complement sum of the trailer the
+// same as that of the bytes it replaces, so that any TCP/UDP checksum
+// stays valid however the other fields are changed
+const int kSignatureSize = 24;
+const quint32 kSignatureMagic = 0x4f535447; // "OSTG"
+const int kSignatureStreamIdOffset = 4;
+const int kSignaturePortIdOffset = 8;
+const int kSignatureCksumOffset = 10;
+const int kSignatureSeqOffset = 12;
+const int kSignatureTxTimeOffset = 16;
+
+// A stream with payload_crc has the CRC-32C of its payload (the bytes
+// after the protocol headers) just before the trailer, big endian -
+//   crc (4) | length of the payload (2)
+// and kSignaturePayloadCrc set in the trailer's tx port id; the cksum
+// adjust word covers these bytes too
+const int kPayloadCrcSize = 6;
+const quint16 kSignaturePayloadCrc = 0x8000;
+
+// Stream id of the probe frames of port pair discovery - not a stream
+const quint32 kProbeStreamId = 0xffffffff;
+
+// The trailer starts at an even offset for the cksum adjust to work
+inline int signatureOffset(int frameLength)
+{
+    return (frameLength - kSignatureSize) & ~1;
+}
+
 class AbstractProtocol;
 class ProtocolList;
 class ProtocolListIterator;
@@ -40,8 +77,44 @@ public:
     void protoDataCopyFrom(const OstProto::Stream &stream);
     void protoDataCopyInto(OstProto::Stream &stream) const;
 
+    // The config serialized as an OstProto::Stream - cached till the
+    // config is changed by protoDataCopyFrom() or setId() (the only ways
+    // the server changes a stream), so that it isn't rebuilt from the
+    // protocols for every read. Not thread safe
+    QByteArray serializedConfig() const;
+
+    // Field level changes between two configs of a stream - makeDelta()
+    // returns false if there are no changes
+    static bool makeDelta(const OstProto::Stream &from,
+                          const OstProto::Stream &to,
+                          OstProto::StreamDelta &delta);
+    static bool applyDelta(const OstProto::StreamDelta &delta,
+                           OstProto::Stream &stream);
+    bool protoDataApplyDelta(const OstProto::StreamDelta &delta);
+    static bool isRateOnlyDelta(const OstProto::StreamDelta &delta);
+
+    // Config of the index'th stream of a sweep - returns false if the
+    // sweep is invalid
+    static bool sweepStream(const OstProto::StreamSweep &sweep, int index,
+                            OstProto::Stream &stream);
+
     ProtocolListIterator* createProtocolListIterator() const;
 
+    // Protocols of the frame in order - for read-only iteration without
+    // allocating a ProtocolListIterator
+    const QVector<AbstractProtocol*>& protocols() const;
+
+    // Caches the protocols' frame layouts (AbstractProtocol::
+    // updateFrameLayout()) and the stream's frame variable counts; to be
+    // called once the config is final, before frames are built (possibly
+    // by many threads). The cache is dropped when the config is changed
+    // by protoDataCopyFrom() or a change to the protocol list
+    void updateFrameCache();
+
+    // Drops the protocol objects, keeping only their config - see compact()
+    void compact();
+    bool isCompact() const { return isCompact_; }
+
     //! \todo (LOW) should we have a copy constructor??
 
 public:
@@ -49,7 +122,9 @@ public:
         e_fl_fixed,
         e_fl_inc,
         e_fl_dec,
-        e_fl_random
+        e_fl_random,
+        e_fl_imix,
+        e_fl_weighted
     };
 
     enum SendUnit {
@@ -102,6 +177,38 @@ public:
 
     quint16 frameLenAvg() const;
 
+    // Frame lengths of e_fl_weighted
+    void clearFrameLenWeights();
+    bool addFrameLenWeight(quint16 frameLen, uint weight);
+
+    // Frame lengths of the imix/weighted modes (empty for the others) in
+    // the order they are cycled through
+    static QVector<quint16> frameLenTable(const OstProto::StreamCore &core);
+
+    bool isTracked() const;
+    bool setTracked(bool tracked);
+
+    bool hasPayloadCrc() const;
+    bool setPayloadCrc(bool payloadCrc);
+
+    bool hasRandomSeed() const;
+    quint64 randomSeed() const;
+    bool setRandomSeed(quint64 seed);
+
+    // Frames of an uploaded frame set instead of the protocols' - see
+    // StreamCore.frame_set_id
+    bool hasFrameSet() const;
+    quint32 frameSetId() const;
+    bool setFrameSetId(quint32 frameSetId);
+
+    // Generator for the random values of a frame - each random field of
+    // the frame uses a substream of its own (see AbstractProtocol::random)
+    Pcg32 random(int frameIndex, quint32 substream) const
+    {
+        return Pcg32(randomSeed(),
+                     (quint64(quint32(frameIndex)) << 32) | substream);
+    }
+
     SendUnit sendUnit() const;
     bool setSendUnit(SendUnit sendUnit);
 
@@ -111,6 +218,13 @@ public:
     NextWhat nextWhat() const;
     bool setNextWhat(NextWhat nextWhat);
 
+    bool hasGotoStreamId() const;
+    quint32 gotoStreamId() const;
+    bool setGotoStreamId(quint32 streamId);
+
+    bool isShuffled() const;
+    bool setShuffled(bool shuffled);
+
     quint32 numPackets() const;
     bool setNumPackets(quint32 numPackets);
 
@@ -129,29 +243,98 @@ public:
     double averagePacketRate() const;
     bool setAveragePacketRate(double packetsPerSec);
 
+    // Gaps between packets of the StreamControl gap distribution; a packet
+    // set (or generator) has a table of at least kMinGapTableSize gaps so
+    // that the distribution shows before the gaps repeat
+    static const int kMinGapTableSize = 1024;
+    bool hasGapTable() const;
+    QVector<quint64> gapTable(int count) const;
+
     bool isFrameVariable() const;
     bool isFrameSizeVariable() const;
+    bool isFrameValueRandom() const;
     int frameSizeVariableCount() const;
     int frameVariableCount() const;
     int frameProtocolLength(int frameIndex) const;
     int frameCount() const;
     int frameValue(uchar *buf, int bufMaxSize, int frameIndex) const;
+    void setFrameSignature(uchar *frame, int length) const;
+    // Of the first frame's payload - after its protocol headers
+    int payloadOffset() const;
+    // A payloadOffset >= 0 adds a payload CRC (see kPayloadCrcSize) of
+    // the bytes from there upto the CRC
+    static void signFrame(uchar *frame, int length, quint32 streamId,
+                          quint16 portId, int payloadOffset = -1);
+
+    // Checksums that are left for the NIC to compute (used by the server
+    // only and not part of the stream config)
+    enum CksumOffload {
+        kIpCksumOffload = 0x1,
+        kL4CksumOffload = 0x2
+    };
+
+    uint cksumOffload() const { return cksumOffload_; }
+    void setCksumOffload(uint offload) { cksumOffload_ = offload; }
 
     quint64 deviceMacAddress(int frameIndex) const;
     quint64 neighborMacAddress(int frameIndex) const;
 
     bool preflightCheck(QStringList &result) const;
+    // preflightCheck() - cached till the config is changed by
+    // protoDataCopyFrom(), as serializedConfig() is. Not thread safe
+    bool cachedPreflightCheck(QStringList &result) const;
 
     static bool StreamLessThan(StreamBase* stream1, StreamBase* stream2);
 
 private:
+    // A TCP/UDP cksum left out while building a frame - see frameValue()
+    enum { kMaxDeferredCksums = 4 };
+    struct DeferredCksum {
+        const AbstractProtocol *proto;
+        int offset;         // of proto in the frame
+        int cksumOffset;    // within proto
+    };
+
+    // Substream of random() not used by any frame field
+    static const quint32 kGapTableSubstream = 0xffffffff;
+
     int portId_;
+    uint cksumOffload_;
+    quint64 defaultSeed_; // if random_seed is not set
 
     OstProto::StreamId      *mStreamId;
     OstProto::StreamCore    *mCore;
     OstProto::StreamControl *mControl;
 
+    // Rebuilt whenever the frame length config changes, so that it can be
+    // used (by many threads) without a lock
+    QVector<quint16> frameLenTable_;
+
+    bool isFrameCacheUsable() const;
+    void insertProtocols(const OstProto::Stream &stream);
+    void expand() const;
+
     ProtocolList *currentFrameProtocols;
+
+    mutable QVector<AbstractProtocol*> protocols_;
+    mutable uint protocolsGeneration_;  // of currentFrameProtocols
+
+    // Set by updateFrameCache()
+    bool isFrameCacheValid_;
+    uint frameCacheGeneration_;
+    int frameVariableCount_;
+    bool isFrameVariable_;
+    bool isFrameSizeVariable_;
+
+    // Set by compact() - the protocols serialized (as those of a Stream)
+    // till expand() instantiates them again
+    QAtomicInt isCompact_;
+    QByteArray compactProtocols_;
+    static QMutex compactLock_; // for expand() - of all streams
+
+    mutable QByteArray serializedConfig_; // empty => not cached
+    mutable int preflightPass_; // -1 => not cached
+    mutable QStringList preflightResult_;
 };
 
 #endif
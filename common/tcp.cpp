@@ -359,6 +359,9 @@ QVariant TcpProtocol::fieldData(int index, FieldAttrib attrib,
 
                     if (data.is_override_cksum())
                         cksum = data.cksum();
+                    else if (isCksumOffloaded(CksumTcpUdp))
+                        cksum = ~protocolFrameHeaderCksum(streamIndex,
+                                                          CksumIpPseudo);
                     else 
                         cksum = protocolFrameCksum(streamIndex, CksumTcpUdp);
 
@@ -370,6 +373,9 @@ QVariant TcpProtocol::fieldData(int index, FieldAttrib attrib,
 
                     if (data.is_override_cksum())
                         cksum = data.cksum();
+                    else if (isCksumOffloaded(CksumTcpUdp))
+                        cksum = ~protocolFrameHeaderCksum(streamIndex,
+                                                          CksumIpPseudo);
                     else 
                         cksum = protocolFrameCksum(streamIndex, CksumTcpUdp);
 
@@ -381,6 +387,9 @@ QVariant TcpProtocol::fieldData(int index, FieldAttrib attrib,
 
                     if (data.is_override_cksum())
                         cksum = data.cksum();
+                    else if (isCksumOffloaded(CksumTcpUdp))
+                        cksum = ~protocolFrameHeaderCksum(streamIndex,
+                                                          CksumIpPseudo);
                     else 
                         cksum = protocolFrameCksum(streamIndex, CksumTcpUdp);
 
@@ -598,3 +607,52 @@ int TcpProtocol::protocolFrameVariableCount() const
     return count;
 }
 
+int TcpProtocol::deferredCksumOffset() const
+{
+    // A variable field over the cksum overwrites the computed cksum
+    if (data.is_override_cksum() || isCksumOffloaded(CksumTcpUdp)
+            || hasVariableFieldAt(16, 2))
+        return -1;
+
+    return 16;
+}
+
+int TcpProtocol::writeFrameValue(uchar *buf, int bufSize,
+        int streamIndex, bool forCksum) const
+{
+    if (bufSize < 20)
+        return AbstractProtocol::writeFrameValue(buf, bufSize,
+                                                 streamIndex, forCksum);
+
+    quint16 srcPort = data.is_override_src_port() ?
+        data.src_port() : payloadProtocolId(ProtocolIdTcpUdp);
+    quint16 dstPort = data.is_override_dst_port() ?
+        data.dst_port() : payloadProtocolId(ProtocolIdTcpUdp);
+    quint8 hdrLen = data.is_override_hdrlen() ?
+        ((data.hdrlen_rsvd() >> 4) & 0x0F) : 5;
+    quint16 cksum = 0;
+
+    // Checksum is over the pseudo header and payload too - we use the
+    // regular (fieldData based) path for it
+    if (forCksum)
+        cksum = 0;
+    else if (data.is_override_cksum())
+        cksum = data.cksum();
+    else if (isCksumOffloaded(CksumTcpUdp))
+        cksum = ~protocolFrameHeaderCksum(streamIndex, CksumIpPseudo);
+    else
+        cksum = protocolFrameCksum(streamIndex, CksumTcpUdp);
+
+    qToBigEndian(srcPort, buf);
+    qToBigEndian(dstPort, buf + 2);
+    qToBigEndian(quint32(data.seq_num()), buf + 4);
+    qToBigEndian(quint32(data.ack_num()), buf + 8);
+    buf[12] = (hdrLen << 4) | (data.hdrlen_rsvd() & 0x0F);
+    buf[13] = data.flags() & 0x3F;
+    qToBigEndian(quint16(data.window()), buf + 14);
+    qToBigEndian(cksum, buf + 16);
+    qToBigEndian(quint16(data.urg_ptr()), buf + 18);
+
+    varyProtocolFrameValue(buf, 20, streamIndex);
+    return 20;
+}
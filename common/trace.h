@@ -0,0 +1,54 @@
+/*
+Copyright (C) 2017 Srivats P.
+
+
+This file is part of "Ostinato"
+
+This is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+
+#ifndef _OST_TRACE_H
+#define _OST_TRACE_H
+
+#include <QtGlobal>
+
+/*
+ * Compile-time trace level for the debug messages on the per-packet/
+ * per-field paths - these are compiled out (arguments and all) unless
+ * built with say DEFINES+=OST_TRACE_LEVEL=2
+ *
+ * 0 - none (default)
+ * 1 - qTrace(): per packet (packet list build, emulation rx/tx etc.)
+ * 2 - qTraceField(): per protocol field (hexdumps of frame values)
+ */
+#ifndef OST_TRACE_LEVEL
+#define OST_TRACE_LEVEL 0
+#endif
+
+#define qTraceNone(...) do {} while (0)
+
+#if OST_TRACE_LEVEL >= 1
+#define qTrace qDebug
+#else
+#define qTrace qTraceNone
+#endif
+
+#if OST_TRACE_LEVEL >= 2
+#define qTraceField qDebug
+#else
+#define qTraceField qTraceNone
+#endif
+
+#endif
@@ -252,6 +252,9 @@ QVariant UdpProtocol::fieldData(int index, FieldAttrib attrib,
                 {
                     if (data.is_override_cksum())
                         cksum = data.cksum();
+                    else if (isCksumOffloaded(CksumTcpUdp))
+                        cksum = ~protocolFrameHeaderCksum(streamIndex,
+                                                          CksumIpPseudo);
                     else
                     {
                         cksum = protocolFrameCksum(streamIndex, CksumTcpUdp);
@@ -431,3 +434,51 @@ int UdpProtocol::protocolFrameVariableCount() const
 
     return count;
 }
+
+int UdpProtocol::deferredCksumOffset() const
+{
+    // A variable field over the cksum overwrites the computed cksum
+    if (data.is_override_cksum() || isCksumOffloaded(CksumTcpUdp)
+            || hasVariableFieldAt(6, 2))
+        return -1;
+
+    return 6;
+}
+
+int UdpProtocol::writeFrameValue(uchar *buf, int bufSize,
+        int streamIndex, bool forCksum) const
+{
+    if (bufSize < 8)
+        return AbstractProtocol::writeFrameValue(buf, bufSize,
+                                                 streamIndex, forCksum);
+
+    quint16 srcPort = data.is_override_src_port() ?
+        data.src_port() : payloadProtocolId(ProtocolIdTcpUdp);
+    quint16 dstPort = data.is_override_dst_port() ?
+        data.dst_port() : payloadProtocolId(ProtocolIdTcpUdp);
+    quint16 totLen = data.is_override_totlen() ?
+        data.totlen() : (protocolFramePayloadSize(streamIndex) + 8);
+    quint16 cksum = 0;
+
+    // Checksum is over the pseudo header and payload too - we use the
+    // regular (fieldData based) path for it
+    if (forCksum)
+        cksum = 0;
+    else if (data.is_override_cksum())
+        cksum = data.cksum();
+    else if (isCksumOffloaded(CksumTcpUdp))
+        cksum = ~protocolFrameHeaderCksum(streamIndex, CksumIpPseudo);
+    else {
+        cksum = protocolFrameCksum(streamIndex, CksumTcpUdp);
+        if (cksum == 0)
+            cksum = 0xFFFF;
+    }
+
+    qToBigEndian(srcPort, buf);
+    qToBigEndian(dstPort, buf + 2);
+    qToBigEndian(totLen, buf + 4);
+    qToBigEndian(cksum, buf + 6);
+
+    varyProtocolFrameValue(buf, 8, streamIndex);
+    return 8;
+}
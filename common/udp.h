@@ -65,7 +65,11 @@ public:
     virtual bool setFieldData(int index, const QVariant &value, 
             FieldAttrib attrib = FieldValue);
 
+    virtual int writeFrameValue(uchar *buf, int bufSize,
+        int streamIndex = 0, bool forCksum = false) const;
+
     virtual int protocolFrameVariableCount() const;
+    virtual int deferredCksumOffset() const;
 
 private:
     OstProto::Udp    data;
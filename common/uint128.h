@@ -25,6 +25,12 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 #include <QtGlobal>
 #include <qendian.h>
 
+// gcc/clang have a native 128-bit integer on 64-bit targets - the compiler
+// does the carries (+, *) and the cross half shifts far better than we can
+#if defined(__SIZEOF_INT128__)
+#define UINT128_NATIVE
+#endif
+
 class UInt128
 {
 public:
@@ -46,8 +52,16 @@ public:
     UInt128 operator|(const UInt128 &other) const;
 
 private:
+#ifdef UINT128_NATIVE
+    typedef unsigned __int128 Native;
+
+    explicit UInt128(Native value) : value_(value) {}
+
+    Native value_;
+#else
     quint64 hi_;
     quint64 lo_;
+#endif
     quint8 array_[16]; 
 };
 
@@ -56,15 +70,11 @@ inline UInt128::UInt128()
     // Do nothing - value will be garbage like any other uint
 }
 
-inline UInt128::UInt128(quint64 hi, quint64 lo)
-{
-    hi_ = hi;
-    lo_ = lo;
-}
-
 inline UInt128::UInt128(quint8 *value)
 {
-    hi_ = (quint64(value[0]) << 56)
+    quint64 hi, lo;
+
+    hi = (quint64(value[0]) << 56)
         | (quint64(value[1]) << 48)
         | (quint64(value[2]) << 40)
         | (quint64(value[3]) << 32)
@@ -73,7 +83,7 @@ inline UInt128::UInt128(quint8 *value)
         | (quint64(value[6]) <<  8)
         | (quint64(value[7]) <<  0);
 
-    lo_ = (quint64(value[ 8]) << 56)
+    lo = (quint64(value[ 8]) << 56)
         | (quint64(value[ 9]) << 48)
         | (quint64(value[10]) << 40)
         | (quint64(value[11]) << 32)
@@ -81,24 +91,94 @@ inline UInt128::UInt128(quint8 *value)
         | (quint64(value[13]) << 16)
         | (quint64(value[14]) <<  8)
         | (quint64(value[15]) <<  0);
+
+    *this = UInt128(hi, lo);
+}
+
+inline quint8* UInt128::toArray() const
+{
+    qToBigEndian(hi64(), const_cast<uchar*>(array_ + 0));
+    qToBigEndian(lo64(), const_cast<uchar*>(array_ + 8));
+
+    return (quint8*)array_;
+}
+
+#ifdef UINT128_NATIVE
+
+inline UInt128::UInt128(quint64 hi, quint64 lo)
+{
+    value_ = (Native(hi) << 64) | lo;
 }
 
 inline quint64 UInt128::hi64() const
 {
-    return hi_;
+    return quint64(value_ >> 64);
 }
 
 inline quint64 UInt128::lo64() const
 {
-    return lo_;
+    return quint64(value_);
 }
 
-inline quint8* UInt128::toArray() const
+inline bool UInt128::operator==(const UInt128 &other) const
 {
-    qToBigEndian(hi_, const_cast<uchar*>(array_ + 0));
-    qToBigEndian(lo_, const_cast<uchar*>(array_ + 8));
+    return value_ == other.value_;
+}
 
-    return (quint8*)array_;
+inline bool UInt128::operator!=(const UInt128 &other) const
+{
+    return value_ != other.value_;
+}
+
+inline UInt128 UInt128::operator+(const UInt128 &other) const
+{
+    return UInt128(Native(value_ + other.value_));
+}
+
+inline UInt128 UInt128::operator*(const uint &other) const
+{
+    return UInt128(Native(value_ * other));
+}
+
+inline UInt128 UInt128::operator<<(const int &shift) const
+{
+    if (shift >= 128)
+        return UInt128(Native(0));
+
+    return UInt128(Native(value_ << shift));
+}
+
+inline UInt128 UInt128::operator~() const
+{
+    return UInt128(Native(~value_));
+}
+
+inline UInt128 UInt128::operator&(const UInt128 &other) const
+{
+    return UInt128(Native(value_ & other.value_));
+}
+
+inline UInt128 UInt128::operator|(const UInt128 &other) const
+{
+    return UInt128(Native(value_ | other.value_));
+}
+
+#else
+
+inline UInt128::UInt128(quint64 hi, quint64 lo)
+{
+    hi_ = hi;
+    lo_ = lo;
+}
+
+inline quint64 UInt128::hi64() const
+{
+    return hi_;
+}
+
+inline quint64 UInt128::lo64() const
+{
+    return lo_;
 }
 
 inline bool UInt128::operator==(const UInt128 &other) const
@@ -124,22 +204,27 @@ inline UInt128 UInt128::operator+(const UInt128 &other) const
 inline UInt128 UInt128::operator*(const uint &other) const
 {
     UInt128 product;
-  
-    // FIXME 
-    product.hi_ = 0;
-    product.lo_ = lo_ * other;
+    // lo_ in 32-bit halves, so that no partial product overflows
+    quint64 low = (lo_ & 0xffffffff) * other;
+    quint64 high = (lo_ >> 32) * other + (low >> 32);
+
+    product.lo_ = (high << 32) | (low & 0xffffffff);
+    product.hi_ = hi_ * other + (high >> 32);
 
     return product;
 }
 
 inline UInt128 UInt128::operator<<(const int &shift) const
 {
-    UInt128 shifted;
-
+    // A shift by the width of the type (or more) is undefined
+    if (shift == 0)
+        return *this;
+    if (shift >= 128)
+        return UInt128(0, 0);
     if (shift < 64)
         return UInt128((hi_<<shift) | (lo_>>(64-shift)), lo_ << shift);
 
-    return UInt128(hi_<<(shift-64), 0);
+    return UInt128(lo_<<(shift-64), 0);
 }
 
 inline UInt128 UInt128::operator~() const
@@ -157,6 +242,8 @@ inline UInt128 UInt128::operator|(const UInt128 &other) const
     return UInt128(hi_ | other.hi_, lo_ | other.lo_);
 }
 
+#endif
+
 template <> inline UInt128 qFromBigEndian<UInt128>(const uchar *src)
 {
     quint64 hi, lo;
@@ -177,9 +264,22 @@ template <> inline UInt128 qToBigEndian<UInt128>(const UInt128 src)
     return UInt128(hi, lo);
 }
 
+/*
+  Both halves are mixed with the 64-bit finalizer of MurmurHash3 - the
+  addresses of a device group differ only in a few low bits (and share
+  the high half), which XOR-ing the halves' hashes left poorly spread
+*/
 inline uint qHash(const UInt128 &key)
 {
-    return qHash(key.hi64()) ^ qHash(key.lo64());
+    quint64 h = (key.hi64() * Q_UINT64_C(0x9e3779b97f4a7c15)) ^ key.lo64();
+
+    h ^= h >> 33;
+    h *= Q_UINT64_C(0xff51afd7ed558ccd);
+    h ^= h >> 33;
+    h *= Q_UINT64_C(0xc4ceb9fe1a85ec53);
+    h ^= h >> 33;
+
+    return uint(h);
 }
 
 #endif
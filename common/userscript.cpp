@@ -19,16 +19,25 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 
 #include "userscript.h"
 
+#include <QMutexLocker>
+
 //
 // -------------------- UserScriptProtocol --------------------
 //
 
 UserScriptProtocol::UserScriptProtocol(StreamBase *stream, AbstractProtocol *parent)
     : AbstractProtocol(stream, parent),
-        userProtocol_(this)
+        userProtocol_(this),
+        frameCacheLock_(QMutex::Recursive) // script may call back into us
 {
     isScriptValid_ = false;
     errorLineNumber_ = 0;
+    isFrameCacheEnabled_ = false;
+    isFrameIndexInvariant_ = false;
+
+    // Size is decided by the script - no fixed frame layout; the script's
+    // results are cached separately (see updateFrameLayout())
+    _cacheFlags &= ~(FrameLayoutCache | FrameValueCache);
 
     userProtocolScriptValue_ = engine_.newQObject(&userProtocol_);
     engine_.globalObject().setProperty("protocol", userProtocolScriptValue_);
@@ -82,6 +91,8 @@ quint32 UserScriptProtocol::protocolId(ProtocolIdType type) const
     QScriptValue userFunction;
     QScriptValue userValue;
 
+    QMutexLocker locker(&frameCacheLock_);
+
     if (!isScriptValid_)
         goto _do_default;
 
@@ -130,26 +141,20 @@ QVariant UserScriptProtocol::fieldData(int index, FieldAttrib attrib,
             if (!isScriptValid_)
                 return QByteArray();
 
-            QScriptValue userFunction = userProtocolScriptValue_.property(
-                    "protocolFrameValue");
+            QMutexLocker locker(&frameCacheLock_);
+            if (!isFrameCacheEnabled_)
+                return scriptFrameValue(streamIndex);
 
-            Q_ASSERT(userFunction.isValid());
-            Q_ASSERT(userFunction.isFunction());
+            int key = frameCacheKey(streamIndex);
+            QHash<int, QByteArray>::const_iterator cached =
+                    frameValueCache_.constFind(key);
 
-            QScriptValue userValue = userFunction.call(QScriptValue(),
-                QScriptValueList() << QScriptValue(&engine_, streamIndex));
+            if (cached != frameValueCache_.constEnd())
+                return cached.value();
 
-            Q_ASSERT(userValue.isValid());
-            Q_ASSERT(userValue.isArray());
-
-            QByteArray fv;
-            QList<int> pktBuf;
-               
-            qScriptValueToSequence(userValue, pktBuf); 
-
-            fv.resize(pktBuf.size());
-            for (int i = 0; i < pktBuf.size(); i++)
-                fv[i] = pktBuf.at(i) & 0xFF;
+            QByteArray fv = scriptFrameValue(streamIndex);
+            if (frameValueCache_.size() < kMaxCachedFrames)
+                frameValueCache_.insert(key, fv);
 
             return fv;
         }
@@ -198,18 +203,21 @@ int UserScriptProtocol::protocolFrameSize(int streamIndex) const
     if (!isScriptValid_)
         return 0;
 
-    QScriptValue userFunction = userProtocolScriptValue_.property(
-            "protocolFrameSize");
+    QMutexLocker locker(&frameCacheLock_);
+    if (!isFrameCacheEnabled_)
+        return scriptFrameSize(streamIndex);
 
-    Q_ASSERT(userFunction.isValid());
-    Q_ASSERT(userFunction.isFunction());
+    int key = frameCacheKey(streamIndex);
+    QHash<int, int>::const_iterator cached = frameSizeCache_.constFind(key);
 
-    QScriptValue userValue = userFunction.call(QScriptValue(), 
-            QScriptValueList() << QScriptValue(&engine_, streamIndex));
+    if (cached != frameSizeCache_.constEnd())
+        return cached.value();
 
-    Q_ASSERT(userValue.isNumber());
+    int size = scriptFrameSize(streamIndex);
+    if (frameSizeCache_.size() < kMaxCachedFrames)
+        frameSizeCache_.insert(key, size);
 
-    return userValue.toInt32();
+    return size;
 }
 
 bool UserScriptProtocol::isProtocolFrameSizeVariable() const
@@ -229,6 +237,7 @@ quint32 UserScriptProtocol::protocolFrameCksum(int streamIndex,
 {
     QScriptValue userFunction;
     QScriptValue userValue;
+    QMutexLocker locker(&frameCacheLock_);
 
     if (!isScriptValid_)
         goto _do_default;
@@ -243,7 +252,154 @@ quint32 UserScriptProtocol::protocolFrameCksum(int streamIndex,
 
     Q_ASSERT(userFunction.isFunction());
 
-    userValue = userFunction.call(QScriptValue(),
+    if (!isFrameCacheEnabled_)
+        return scriptFrameCksum(streamIndex, cksumType);
+
+    {
+        qint64 key = (qint64(frameCacheKey(streamIndex)) << 8) | cksumType;
+        QHash<qint64, quint32>::const_iterator cached =
+                frameCksumCache_.constFind(key);
+
+        if (cached != frameCksumCache_.constEnd())
+            return cached.value();
+
+        quint32 cksum = scriptFrameCksum(streamIndex, cksumType);
+        if (frameCksumCache_.size() < kMaxCachedFrames)
+            frameCksumCache_.insert(key, cksum);
+
+        return cksum;
+    }
+
+_do_default:
+    return AbstractProtocol::protocolFrameCksum(streamIndex, cksumType);
+}
+
+/*!
+  Enables caching of the script's results so that the script is called
+  only once for each unique frame (instead of for every frame and every
+  time a frame's value, size or checksum is needed)
+
+  Frames are unique modulo protocolFrameVariableCount if the script sets it,
+  else per frame index; a script whose functions don't take the frame index
+  is called exactly once. A script whose results vary from call to call for
+  the same frame (e.g. random values) can opt out by setting
+  protocolFrameValueCacheable to false
+
+  The cache is dropped when the script is changed
+*/
+void UserScriptProtocol::updateFrameLayout()
+{
+    AbstractProtocol::updateFrameLayout();
+
+    clearFrameCache();
+
+    QMutexLocker locker(&frameCacheLock_);
+    isFrameCacheEnabled_ = isScriptValid_
+            && userProtocol_.isProtocolFrameValueCacheable();
+    isFrameIndexInvariant_ = isFrameCacheEnabled_ && isFrameIndexInvariant();
+}
+
+void UserScriptProtocol::clearFrameCache() const
+{
+    QMutexLocker locker(&frameCacheLock_);
+
+    isFrameCacheEnabled_ = false;
+    isFrameIndexInvariant_ = false;
+    frameValueCache_.clear();
+    frameSizeCache_.clear();
+    frameCksumCache_.clear();
+}
+
+// A script can't depend on the frame index if none of its functions take
+// it as an arg
+bool UserScriptProtocol::isFrameIndexInvariant() const
+{
+    static const char* functions[] = {
+        "protocolFrameValue",
+        "protocolFrameSize",
+        "protocolFrameCksum"
+    };
+
+    if (QString::fromStdString(data.program()).contains("arguments"))
+        return false;
+
+    for (uint i = 0; i < sizeof(functions)/sizeof(functions[0]); i++)
+    {
+        QScriptValue userFunction = userProtocolScriptValue_.property(
+                functions[i]);
+
+        if (userFunction.isFunction()
+                && (userFunction.property("length").toInt32() > 0))
+            return false;
+    }
+
+    return true;
+}
+
+int UserScriptProtocol::frameCacheKey(int streamIndex) const
+{
+    int count;
+
+    if (isFrameIndexInvariant_)
+        return 0;
+
+    count = protocolFrameVariableCount();
+    if (count > 1)
+        return streamIndex % count;
+
+    // Script uses the frame index but hasn't told us how many unique
+    // frames there are
+    return streamIndex;
+}
+
+QByteArray UserScriptProtocol::scriptFrameValue(int streamIndex) const
+{
+    QScriptValue userFunction = userProtocolScriptValue_.property(
+            "protocolFrameValue");
+
+    Q_ASSERT(userFunction.isValid());
+    Q_ASSERT(userFunction.isFunction());
+
+    QScriptValue userValue = userFunction.call(QScriptValue(),
+        QScriptValueList() << QScriptValue(&engine_, streamIndex));
+
+    Q_ASSERT(userValue.isValid());
+    Q_ASSERT(userValue.isArray());
+
+    QByteArray fv;
+    QList<int> pktBuf;
+
+    qScriptValueToSequence(userValue, pktBuf);
+
+    fv.resize(pktBuf.size());
+    for (int i = 0; i < pktBuf.size(); i++)
+        fv[i] = pktBuf.at(i) & 0xFF;
+
+    return fv;
+}
+
+int UserScriptProtocol::scriptFrameSize(int streamIndex) const
+{
+    QScriptValue userFunction = userProtocolScriptValue_.property(
+            "protocolFrameSize");
+
+    Q_ASSERT(userFunction.isValid());
+    Q_ASSERT(userFunction.isFunction());
+
+    QScriptValue userValue = userFunction.call(QScriptValue(),
+            QScriptValueList() << QScriptValue(&engine_, streamIndex));
+
+    Q_ASSERT(userValue.isNumber());
+
+    return userValue.toInt32();
+}
+
+quint32 UserScriptProtocol::scriptFrameCksum(int streamIndex,
+        CksumType cksumType) const
+{
+    QScriptValue userFunction = userProtocolScriptValue_.property(
+            "protocolFrameCksum");
+    QScriptValue userValue = userFunction.call(QScriptValue(),
             QScriptValueList() << QScriptValue(&engine_, streamIndex)
             << QScriptValue(&engine_, cksumType));
 
@@ -251,9 +407,6 @@ quint32 UserScriptProtocol::protocolFrameCksum(int streamIndex,
     Q_ASSERT(userValue.isNumber());
 
     return userValue.toUInt32();
-
-_do_default:
-    return AbstractProtocol::protocolFrameCksum(streamIndex, cksumType);
 }
 
 void UserScriptProtocol::evaluateUserScript() const
@@ -261,9 +414,11 @@ void UserScriptProtocol::evaluateUserScript() const
     QScriptValue    userFunction;
     QScriptValue    userValue;
     QString         property;
+    QMutexLocker    locker(&frameCacheLock_);
 
     isScriptValid_ = false;
     errorLineNumber_ = userScriptLineCount();
+    clearFrameCache();
 
     // Reset all properties including the dynamic ones
     userProtocol_.reset();
@@ -459,6 +614,7 @@ void UserProtocol::reset()
     name_ = QString();
     protocolFrameSizeVariable_ = false;
     protocolFrameVariableCount_ = 1;
+    protocolFrameValueCacheable_ = true;
 }
 
 QString UserProtocol::name() const
@@ -491,6 +647,16 @@ void UserProtocol::setProtocolFrameVariableCount(int count)
     protocolFrameVariableCount_ = count;
 }
 
+bool UserProtocol::isProtocolFrameValueCacheable() const
+{
+    return protocolFrameValueCacheable_;
+}
+
+void UserProtocol::setProtocolFrameValueCacheable(bool cacheable)
+{
+    protocolFrameValueCacheable_ = cacheable;
+}
+
 quint32 UserProtocol::payloadProtocolId(UserProtocol::ProtocolIdType type) const
 {
     return parent_->payloadProtocolId(
@@ -23,6 +23,8 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 #include "abstractprotocol.h"
 #include "userscript.pb.h"
 
+#include <QHash>
+#include <QMutex>
 #include <QScriptEngine>
 #include <QScriptValue>
 
@@ -41,6 +43,9 @@ class UserProtocol : public QObject
     Q_PROPERTY(int protocolFrameVariableCount
             READ protocolFrameVariableCount
             WRITE setProtocolFrameVariableCount);
+    Q_PROPERTY(bool protocolFrameValueCacheable
+            READ isProtocolFrameValueCacheable
+            WRITE setProtocolFrameValueCacheable);
     
 public:
     enum ProtocolIdType
@@ -70,6 +75,8 @@ public slots:
     void setProtocolFrameSizeVariable(bool variable);
     int protocolFrameVariableCount() const;
     void setProtocolFrameVariableCount(int count);
+    bool isProtocolFrameValueCacheable() const;
+    void setProtocolFrameValueCacheable(bool cacheable);
 
     quint32 payloadProtocolId(UserProtocol::ProtocolIdType type) const;
     int protocolFrameOffset(int streamIndex = 0) const;
@@ -90,6 +97,7 @@ private:
     QString name_;
     bool protocolFrameSizeVariable_;
     int protocolFrameVariableCount_;
+    bool protocolFrameValueCacheable_;
 };
 
 class UserScriptProtocol : public AbstractProtocol
@@ -128,19 +136,32 @@ public:
     virtual int protocolFrameSize(int streamIndex = 0) const;
 
     virtual bool isProtocolFrameSizeVariable() const;
+    virtual bool isProtocolFrameValueDependent() const { return true; }
     virtual int protocolFrameVariableCount() const;
 
     virtual quint32 protocolFrameCksum(int streamIndex = 0,
             CksumType cksumType = CksumIp) const;
 
+    virtual void updateFrameLayout();
+
     void evaluateUserScript() const;
     bool isScriptValid() const;
     int userScriptErrorLineNumber() const;
     QString userScriptErrorText() const;
 
 private:
+    enum { kMaxCachedFrames = 4096 };
+
     int userScriptLineCount() const;
 
+    void clearFrameCache() const;
+    bool isFrameIndexInvariant() const;
+    int frameCacheKey(int streamIndex) const;
+
+    QByteArray scriptFrameValue(int streamIndex) const;
+    int scriptFrameSize(int streamIndex) const;
+    quint32 scriptFrameCksum(int streamIndex, CksumType cksumType) const;
+
     OstProto::UserScript    data;
 
     mutable QScriptEngine   engine_;
@@ -150,6 +171,15 @@ private:
     mutable bool            isScriptValid_;
     mutable int             errorLineNumber_;
     mutable QString         errorText_;
+
+    // Script results per unique frame - see updateFrameLayout(); the lock
+    // also serializes all use of engine_ (not thread safe), cached or not
+    mutable QMutex          frameCacheLock_;
+    mutable bool            isFrameCacheEnabled_;
+    mutable bool            isFrameIndexInvariant_;
+    mutable QHash<int, QByteArray>  frameValueCache_;
+    mutable QHash<int, int>         frameSizeCache_;
+    mutable QHash<qint64, quint32>  frameCksumCache_;
 };
 
 #endif
@@ -268,3 +268,19 @@ bool VlanProtocol::setFieldData(int index, const QVariant &value,
 _exit:
     return isOk;
 }
+
+int VlanProtocol::writeFrameValue(uchar *buf, int bufSize,
+        int streamIndex, bool forCksum) const
+{
+    if (bufSize < 4)
+        return AbstractProtocol::writeFrameValue(buf, bufSize,
+                                                 streamIndex, forCksum);
+
+    quint16 tpid = data.is_override_tpid() ? data.tpid() : 0x8100;
+
+    qToBigEndian(tpid, buf);
+    qToBigEndian(quint16(data.vlan_tag()), buf + 2); // prio|cfi|vlanId
+
+    varyProtocolFrameValue(buf, 4, streamIndex);
+    return 4;
+}
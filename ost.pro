@@ -1,5 +1,6 @@
 TEMPLATE = subdirs
-SUBDIRS = client server ostproto ostprotogui rpc binding extra
+SUBDIRS = client server dronecore ostproto ostprotogui ostclient rpc binding \
+    extra
 
 client.target = client
 client.file = client/ostinato.pro
@@ -7,13 +8,19 @@ client.depends = ostproto ostprotogui rpc extra
 
 server.target = server
 server.file = server/drone.pro
-server.depends = ostproto rpc
+server.depends = dronecore ostproto rpc
+
+dronecore.file = server/dronecore.pro
+dronecore.depends = ostproto rpc
 
 ostproto.file = common/ostproto.pro
 
 ostprotogui.file = common/ostprotogui.pro
 ostprotogui.depends = extra
 
+ostclient.file = common/ostclient.pro
+ostclient.depends = ostproto rpc
+
 rpc.file = rpc/pbrpc.pro
 
 binding.target = binding
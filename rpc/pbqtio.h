@@ -1,38 +1,228 @@
 #ifndef _PBQTIO_H
 #define _PBQTIO_H
 
-#include <google/protobuf/io/zero_copy_stream_impl.h>
+#include <QByteArray>
+#include <QIODevice>
+#include <QtGlobal>
 
-class PbQtInputStream : public google::protobuf::io::CopyingInputStream
+#include <google/protobuf/io/coded_stream.h>
+#include <google/protobuf/io/zero_copy_stream.h>
+#include <google/protobuf/message.h>
+
+#include <qendian.h>
+#include <string.h>
+
+#include "pbrpccommon.h"
+
+/*
+ * Reusable buffer to read messages of known length off 'dev' - a message
+ * is read in a single read once all of it has been received and can be
+ * parsed in place (ParseFromArray doesn't copy), instead of being copied
+ * in pieces through a CopyingInputStreamAdaptor
+ */
+class PbQtInputBuffer
 {
 public:
-    PbQtInputStream(QIODevice *dev) 
+    PbQtInputBuffer(QIODevice *dev)
         : dev_(dev) {};
-    int Read(void *buffer, int size) {
-        if (dev_->bytesAvailable())
-            return dev_->read(static_cast<char*>(buffer), size);
-        else
-            return 0;
+
+    // Returns NULL if all of len bytes are not available (yet)
+    const char* read(int len) {
+        if (dev_->bytesAvailable() < len)
+            return NULL;
+        reset(len);
+        if (dev_->read(buffer_.data(), len) != len)
+            return NULL;
+        return buffer_.constData();
+    }
+
+    // Reads upto size bytes (in chunks) of whatever is available; returns
+    // NULL if nothing is
+    const char* readAvailable(int size, int *len) {
+        size = qMin(size, int(kChunkSize));
+        reset(size);
+        *len = int(dev_->read(buffer_.data(),
+                              qMin(qint64(size), dev_->bytesAvailable())));
+        return *len > 0 ? buffer_.constData() : NULL;
+    }
+
+    // Replaces data (of a compressed msg) with its uncompressed contents;
+    // returns false if it's corrupt or would uncompress to more than
+    // maxLen bytes - checked against the declared (uncompressed) length
+    // before anything is allocated for it
+    bool uncompress(const char **data, int *len,
+                    quint32 maxLen = PB_MAX_MSG_SIZE) {
+        if ((*len < 4)
+                || (qFromBigEndian<quint32>((const uchar*)*data) > maxLen))
+            return false;
+        uncompressed_ = qUncompress((const uchar*)*data, *len);
+        if (uncompressed_.isEmpty())
+            return false;
+        *data = uncompressed_.constData();
+        *len = uncompressed_.size();
+        return true;
     }
 
 private:
+    enum {
+        kChunkSize = 64*1024,
+        kMaxRetainSize = 1024*1024 // don't hold on to a big msg's buffer
+    };
+
+    void reset(int size) {
+        if ((buffer_.size() > kMaxRetainSize) && (size <= kMaxRetainSize))
+            buffer_.clear();
+        if (buffer_.size() < size)
+            buffer_.resize(size);
+    }
+
     QIODevice *dev_;
+    QByteArray buffer_;
+    QByteArray uncompressed_;
 };
 
-class PbQtOutputStream : public google::protobuf::io::CopyingOutputStream
+/*
+ * ZeroCopyOutputStream over a reusable buffer for the messages sent on
+ * 'dev' - the header and message are serialized straight into the buffer
+ * and handed to the device in a single write, instead of being copied in
+ * small pieces through a CopyingOutputStreamAdaptor
+ */
+class PbQtBufferedOutputStream
+    : public google::protobuf::io::ZeroCopyOutputStream
 {
 public:
-    PbQtOutputStream(QIODevice *dev) 
-        : dev_(dev) {};
-    bool Write(const void *buffer, int size) {
-        if (dev_->write(static_cast<const char*>(buffer), size) == size)
-            return true;
-        else
-            return false;
+    PbQtBufferedOutputStream(QIODevice *dev)
+        : dev_(dev), isCompressionEnabled_(false), start_(0), pos_(0) {};
+
+    // Compress large msgs (see pbrpccommon.h) - header passed to the
+    // write methods below should have the uncompressed type and length
+    void setCompression(bool enabled) {
+        isCompressionEnabled_ = enabled;
+    }
+
+    bool Next(void **data, int *size) {
+        if (pos_ == buffer_.size())
+            buffer_.resize(qMax(2*buffer_.size(), int(kChunkSize)));
+        *data = buffer_.data() + pos_;
+        *size = buffer_.size() - pos_;
+        pos_ = buffer_.size();
+        return true;
+    }
+    void BackUp(int count) {
+        pos_ -= count;
+    }
+    google::protobuf::int64 ByteCount() const {
+        return pos_ - start_;
+    }
+
+    // Writes header followed by msg - msg's size 'len' should have been
+    // calculated (and cached) by msg.ByteSize() already
+    bool writeMessage(const char *header, int hdrLen,
+                      const google::protobuf::Message &msg, int len) {
+        bool ok;
+
+        reset(hdrLen + len);
+        memcpy(buffer_.data(), header, hdrLen);
+        start_ = pos_ = hdrLen;
+        {
+            google::protobuf::io::CodedOutputStream coded(this);
+            msg.SerializeWithCachedSizes(&coded);
+            ok = !coded.HadError();
+        } // coded backs up the unused part of the buffer when destroyed
+
+        if (ok)
+            compressMessage(hdrLen, len);
+
+        return ok && flush();
+    }
+
+    // Writes header followed by an already serialized msg
+    bool writeMessage(const char *header, int hdrLen, const QByteArray &msg) {
+        reset(hdrLen + msg.size());
+        memcpy(buffer_.data(), header, hdrLen);
+        memcpy(buffer_.data() + hdrLen, msg.constData(), msg.size());
+        pos_ = hdrLen + msg.size();
+
+        compressMessage(hdrLen, msg.size());
+
+        return flush();
+    }
+
+    // Writes header followed by the contents of blob, in large chunks
+    bool writeBlob(const char *header, int hdrLen, QIODevice *blob) {
+        bool ok = true;
+
+        reset(kChunkSize);
+        memcpy(buffer_.data(), header, hdrLen);
+        pos_ = hdrLen;
+
+        blob->seek(0);
+
+        // Blobs (captures) are big and compress well - ratio over speed
+        if (isCompressionEnabled_ && (blob->size() >= PB_COMPRESS_THRESHOLD)) {
+            QByteArray compressed = qCompress(blob->readAll());
+            if (compressed.size() < blob->size()) {
+                setCompressed(compressed.size());
+                return flush() && (dev_->write(compressed) == compressed.size());
+            }
+            blob->seek(0);
+        }
+        do {
+            qint64 len = blob->read(buffer_.data() + pos_,
+                                    buffer_.size() - pos_);
+            if (len > 0)
+                pos_ += len;
+            ok = flush();
+            pos_ = 0;
+        } while (ok && !blob->atEnd());
+
+        return ok;
     }
 
 private:
+    enum {
+        kChunkSize = 64*1024,
+        kMaxRetainSize = 1024*1024 // don't hold on to a big msg's buffer
+    };
+
+    void reset(int size) {
+        if ((buffer_.size() > kMaxRetainSize) && (size <= kMaxRetainSize))
+            buffer_.clear();
+        if (buffer_.size() < size)
+            buffer_.resize(size);
+        start_ = pos_ = 0;
+    }
+    bool flush() {
+        return dev_->write(buffer_.constData(), pos_) == pos_;
+    }
+    // Compresses the len bytes of msg that follow the header in the buffer
+    void compressMessage(int hdrLen, int len) {
+        // Speed over ratio for messages
+        if (isCompressionEnabled_ && (len >= PB_COMPRESS_THRESHOLD)) {
+            QByteArray compressed = qCompress(
+                    (const uchar*)buffer_.constData() + hdrLen, len, 1);
+            if (compressed.size() < len) {
+                setCompressed(compressed.size());
+                memcpy(buffer_.data() + hdrLen, compressed.constData(),
+                       compressed.size());
+                pos_ = hdrLen + compressed.size();
+            }
+        }
+    }
+    // Updates the header at the start of the buffer for a compressed msg
+    void setCompressed(quint32 len) {
+        uchar *header = (uchar*)buffer_.data();
+        quint16 type = qFromBigEndian<quint16>(header);
+
+        qToBigEndian<quint16>(type | PB_MSG_FLAG_COMPRESSED, header);
+        qToBigEndian<quint32>(len, header+4);
+    }
+
     QIODevice *dev_;
+    bool isCompressionEnabled_;
+    QByteArray buffer_;
+    int start_;
+    int pos_;
 };
 
 #endif
@@ -2,6 +2,8 @@ TEMPLATE = lib
 CONFIG += qt staticlib
 QT += network
 DEFINES += HAVE_REMOTE
+linux*:exists(/usr/include/sys/sdt.h): \
+    DEFINES += HAVE_SDT
 LIBS += -lprotobuf
 HEADERS += rpcserver.h rpcconn.h pbrpccontroller.h pbrpcchannel.h pbqtio.h
 SOURCES += rpcserver.cpp rpcconn.cpp pbrpcchannel.cpp
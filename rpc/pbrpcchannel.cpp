@@ -18,35 +18,31 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 */
 
 #include "pbrpcchannel.h"
-#include "pbqtio.h"
 
 #include <QtGlobal>
 #include <qendian.h>
+#include <limits.h>
 
 static uchar msgBuf[4096];
 
+const char *PbRpcChannel::kLocalPrefix = "local:";
+
 PbRpcChannel::PbRpcChannel(QString serverName, quint16 port,
                            const ::google::protobuf::Message &notifProto)
     : notifPrototype(notifProto)
 {
-    isPending = false;
-    pendingMethodId = -1;    // don't care as long as isPending is false
-
-    method = NULL;
-    controller = NULL;
-    done = NULL;
-    response = NULL;
+    isPipelined_ = false;
+    nextRequestId_ = 1;
 
     mServerHost = serverName;
     mServerPort = port;
     mpSocket = new QTcpSocket(this);
+    mpLocalSocket = new QLocalSocket(this);
 
-    inStream = new google::protobuf::io::CopyingInputStreamAdaptor(
-            new PbQtInputStream(mpSocket));
-    inStream->SetOwnsCopyingStream(true);
-    outStream = new google::protobuf::io::CopyingOutputStreamAdaptor(
-            new PbQtOutputStream(mpSocket));
-    outStream->SetOwnsCopyingStream(true);
+    mpDevice = NULL;
+    inBuffer_ = NULL;
+    outStream_ = NULL;
+    setDevice();
 
     // FIXME: Not quite sure why this ain't working!
     // QMetaObject::connectSlotsByName(this);
@@ -63,20 +59,55 @@ PbRpcChannel::PbRpcChannel(QString serverName, quint16 port,
     connect(mpSocket, SIGNAL(readyRead()),
         this, SLOT(on_mpSocket_readyRead()));
 
+    connect(mpLocalSocket, SIGNAL(connected()),
+        this, SLOT(on_mpSocket_connected()));
+    connect(mpLocalSocket, SIGNAL(disconnected()),
+        this, SLOT(on_mpSocket_disconnected()));
+    connect(mpLocalSocket,
+        SIGNAL(stateChanged(QLocalSocket::LocalSocketState)),
+        this,
+        SLOT(on_mpLocalSocket_stateChanged(QLocalSocket::LocalSocketState)));
+    connect(mpLocalSocket, SIGNAL(error(QLocalSocket::LocalSocketError)),
+        this, SLOT(on_mpLocalSocket_error(QLocalSocket::LocalSocketError)));
+    connect(mpLocalSocket, SIGNAL(readyRead()),
+        this, SLOT(on_mpSocket_readyRead()));
 }
 
 PbRpcChannel::~PbRpcChannel()
 {
-    delete inStream;
-    delete outStream;
+    delete inBuffer_;
+    delete outStream_;
     delete mpSocket;
+    delete mpLocalSocket;
+}
+
+// Picks the socket for the server name - must not be connected
+void PbRpcChannel::setDevice()
+{
+    QIODevice *device = isLocalServer(mServerHost) ?
+        (QIODevice*) mpLocalSocket : (QIODevice*) mpSocket;
+
+    if (device == mpDevice)
+        return;
+
+    delete inBuffer_;
+    delete outStream_;
+
+    mpDevice = device;
+    inBuffer_ = new PbQtInputBuffer(mpDevice);
+    outStream_ = new PbQtBufferedOutputStream(mpDevice);
 }
 
 void PbRpcChannel::establish()
 {
     qDebug("In %s", __FUNCTION__);
 
-    mpSocket->connectToHost(mServerHost, mServerPort);
+    setDevice();
+    if (isLocal())
+        mpLocalSocket->connectToServer(
+                mServerHost.mid(QString(kLocalPrefix).length()));
+    else
+        mpSocket->connectToHost(mServerHost, mServerPort);
 }
 
 void PbRpcChannel::establish(QString serverName, quint16 port)
@@ -90,7 +121,25 @@ void PbRpcChannel::tearDown()
 {
     qDebug("In %s", __FUNCTION__);
 
-    mpSocket->disconnectFromHost();
+    if (isLocal())
+        mpLocalSocket->disconnectFromServer();
+    else
+        mpSocket->disconnectFromHost();
+}
+
+void PbRpcChannel::setPipelined(bool pipelined)
+{
+    // Framing changes - so nothing must be in flight
+    Q_ASSERT(inFlightCalls_.isEmpty());
+
+    qDebug("RpcChannel: pipelining %s", pipelined ? "on" : "off");
+    isPipelined_ = pipelined;
+}
+
+void PbRpcChannel::setCompression(bool enabled)
+{
+    qDebug("RpcChannel: compression %s", enabled ? "on" : "off");
+    outStream_->setCompression(enabled);
 }
 
 void PbRpcChannel::CallMethod(
@@ -100,112 +149,150 @@ void PbRpcChannel::CallMethod(
     ::google::protobuf::Message *response,
     ::google::protobuf::Closure* done)
 {
-    char* msg = (char*) &msgBuf[0];
-    int     len;
-    bool    ret;
-  
-    if (isPending)
+    RpcCall call;
+
+    call.method = method;
+    call.controller = controller;
+    call.request = req;
+    call.response = response;
+    call.done = done;
+
+    // Queue behind any already queued to keep the order of calls
+    if (pendingCallList.size()
+            || (inFlightCalls_.size() >= (isPipelined_ ? kMaxInFlightCalls : 1)))
     {
-        RpcCall call;
-        qDebug("RpcChannel: queueing rpc since method %d is pending;<----\n "
+        qDebug("RpcChannel: queueing rpc since %d calls are in flight;<----\n "
                 "queued method = %d:%s\n"
                 "queued message = \n%s\n---->", 
-                pendingMethodId, method->index(), method->name().c_str(),
+                inFlightCalls_.size(), method->index(), method->name().c_str(),
                 req->DebugString().c_str());
 
-        call.method = method;
-        call.controller = controller;
-        call.request = req;
-        call.response = response;
-        call.done = done;
-
         pendingCallList.append(call);
 	qDebug("pendingCallList size = %d", pendingCallList.size());
 
-        Q_ASSERT(pendingCallList.size() < 100);
-
         return;
     }
 
-    if (!req->IsInitialized())
+    sendCall(call);
+}
+
+void PbRpcChannel::sendCall(const RpcCall &call)
+{
+    char* msg = (char*) &msgBuf[0];
+    int     hdrLen = PB_HDR_SIZE;
+    int     len;
+    bool    ret;
+    quint32 requestId = 0;
+  
+    if (!call.request->IsInitialized())
     {
         qWarning("RpcChannel: missing required fields in request <----");
-        qDebug("req = %s\n%s", method->input_type()->name().c_str(),
-                req->DebugString().c_str());
-        qDebug("error = \n%s\n--->", req->InitializationErrorString().c_str());
+        qDebug("req = %s\n%s", call.method->input_type()->name().c_str(),
+                call.request->DebugString().c_str());
+        qDebug("error = \n%s\n--->",
+                call.request->InitializationErrorString().c_str());
 
-        controller->SetFailed("Required fields missing");
-        done->Run();
+        call.controller->SetFailed("Required fields missing");
+        call.done->Run();
         return;
     }
 
-    pendingMethodId = method->index();
-    this->method=method;
-    this->controller=controller;
-    this->done=done;
-    this->response=response;
-    isPending = true;
+    if (isPipelined_) {
+        // 0 is used by notifications; skip it (and any in flight) on wrap
+        do {
+            requestId = nextRequestId_++;
+        } while (!requestId || inFlightCalls_.contains(requestId));
+    }
+    inFlightCalls_.insert(requestId, call);
 
-    len = req->ByteSize();
+    len = call.request->ByteSize();
     *((quint16*)(msg+0)) = qToBigEndian(quint16(PB_MSG_TYPE_REQUEST)); // type
-    *((quint16*)(msg+2)) = qToBigEndian(quint16(method->index())); // method id
+    *((quint16*)(msg+2)) = qToBigEndian(quint16(call.method->index())); // method id
     *((quint32*)(msg+4)) = qToBigEndian(quint32(len)); // len
+    if (isPipelined_) {
+        *((quint32*)(msg+8)) = qToBigEndian(requestId);
+        hdrLen = PB_HDR_MAX_SIZE;
+    }
 
     // Avoid printing stats since it happens every couple of seconds
-    if (pendingMethodId != 13)
+    if (call.method->index() != 13)
     {
         qDebug("client(%s) sending %d bytes <----", __FUNCTION__, 
-                PB_HDR_SIZE + len);
-        BUFDUMP(msg, PB_HDR_SIZE);
+                hdrLen + len);
+        BUFDUMP(msg, hdrLen);
         qDebug("method = %d:%s\n req = %s\n%s\n---->",
-                method->index(), method->name().c_str(),
-                method->input_type()->name().c_str(),
-                req->DebugString().c_str());
+                call.method->index(), call.method->name().c_str(),
+                call.method->input_type()->name().c_str(),
+                call.request->DebugString().c_str());
     }
 
-    mpSocket->write(msg, PB_HDR_SIZE);
-    ret = req->SerializeToZeroCopyStream(outStream);
+    ret = outStream_->writeMessage(msg, hdrLen, *call.request, len);
     Q_ASSERT(ret == true);
     Q_UNUSED(ret);
-    outStream->Flush();
 }
 
 void PbRpcChannel::on_mpSocket_readyRead()
 {
-    const uchar      *msg;
-    int               msgLen;
+    const char       *msg;
+    int               hdrLen;
     static bool parsing = false;
     static quint16    type, method;
     static quint32    len;
+    static quint32    requestId;
+    static bool isCompressed;
+    static quint32    discardLen = 0;
 
 _top:
     //qDebug("%s(entry): bytesAvail = %d", __FUNCTION__, mpSocket->bytesAvailable());
 
+    // Drop the rest of a msg we couldn't handle
+    while (discardLen) {
+        int l;
+
+        if (!inBuffer_->readAvailable(discardLen, &l))
+            goto _exit;
+        discardLen -= l;
+    }
+
     if (!parsing)
     {
-        // Do we have an entire header? If not, we'll wait ...
-        if (inStream->Next((const void**)&msg, &msgLen) == false) {
-            qDebug("No more data or stream error");
-            goto _exit;
-        }
+        hdrLen = isPipelined_ ? PB_HDR_MAX_SIZE : PB_HDR_SIZE;
 
-        if (msgLen < PB_HDR_SIZE) {
-            qDebug("read less than PB_HDR_SIZE bytes; putting back");
-            inStream->BackUp(msgLen);
+        // Do we have an entire header? If not, we'll wait ...
+        msg = inBuffer_->read(hdrLen);
+        if (!msg)
             goto _exit;
-        }
-
-        type = qFromBigEndian<quint16>(msg+0);
-        method = qFromBigEndian<quint16>(msg+2);
-        len = qFromBigEndian<quint32>(msg+4);
 
-        if (msgLen > PB_HDR_SIZE)
-            inStream->BackUp(msgLen - PB_HDR_SIZE);
+        type = qFromBigEndian<quint16>((uchar*)msg+0);
+        method = qFromBigEndian<quint16>((uchar*)msg+2);
+        len = qFromBigEndian<quint32>((uchar*)msg+4);
+        requestId = isPipelined_ ? qFromBigEndian<quint32>((uchar*)msg+8) : 0;
+        isCompressed = type & PB_MSG_FLAG_COMPRESSED;
+        type &= PB_MSG_TYPE_MASK;
 
-        //BUFDUMP(msg, PB_HDR_SIZE);
+        //BUFDUMP(msg, hdrLen);
         //qDebug("type = %hu, method = %hu, len = %u", type, method, len);
 
         parsing = true;
+
+        // Find the call this is the response of
+        if (type != PB_MSG_TYPE_NOTIFY)
+        {
+            if (!inFlightCalls_.contains(requestId))
+            {
+                qWarning("not waiting for response (request id %u)",
+                        requestId);
+                goto _error_exit;
+            }
+
+            call_ = inFlightCalls_.value(requestId);
+            if (call_.method->index() != method)
+            {
+                qWarning("invalid method id %d (expected = %d)", method, 
+                    call_.method->index());
+                goto _error_exit;
+            }
+        }
     }
 
     switch (type)
@@ -214,192 +301,138 @@ _top:
         {
             static quint32 cumLen = 0;
             QIODevice *blob;
-            int l = 0;
+            int l;
 
-            blob = static_cast<PbRpcController*>(controller)->binaryBlob();
+            blob = static_cast<PbRpcController*>(call_.controller)->binaryBlob();
             Q_ASSERT(blob != NULL);
 
-            msgLen = 0;
+            // A compressed blob can be uncompressed only as a whole
+            if (isCompressed) {
+                msg = inBuffer_->read(len);
+                if (!msg)
+                    goto _exit;
+
+                // A capture is as big as it is - not limited like a msg
+                l = len;
+                if (!inBuffer_->uncompress(&msg, &l, INT_MAX)) {
+                    qWarning("failed to uncompress bin blob of len %d", len);
+                    call_.controller->SetFailed("Corrupt compressed msg");
+                    break;
+                }
+                blob->write(msg, l);
+                qDebug("%s: bin blob rcvd %d (%d compressed)",
+                        __PRETTY_FUNCTION__, l, len);
+                break;
+            }
+
+            // A blob (capture) may be too big to wait for all of it
             while (cumLen < len)
             {
-                if (inStream->Next((const void**)&msg, &msgLen) == false) {
-                    //qDebug("No more data or stream error");
+                msg = inBuffer_->readAvailable(len - cumLen, &l);
+                if (!msg)
                     goto _exit;
-                }
 
-                l = qMin(msgLen, int(len - cumLen));
-                blob->write((char*)msg, l);
+                blob->write(msg, l);
                 cumLen += l;
                 //qDebug("%s: bin blob rcvd %d/%d/%d", __PRETTY_FUNCTION__, l, cumLen, len);
             }
 
-            if (l < msgLen) {
-                qDebug("read extra bytes after blob; putting back");
-                inStream->BackUp(msgLen - l);
-            }
-
             qDebug("%s: bin blob rcvd %d/%d", __PRETTY_FUNCTION__, cumLen, len);
 
-            if (cumLen < len)
-                goto _exit;
-
             cumLen = 0;
 
-            if (!isPending)
-            {
-                qWarning("not waiting for response");
-                goto _error_exit2;
-            }
-
-            if (pendingMethodId != method)
-            {
-                qWarning("invalid method id %d (expected = %d)", method, 
-                    pendingMethodId);
-                goto _error_exit2;
-            }
-
             break;
         }
 
         case PB_MSG_TYPE_RESPONSE:
         {
-            static quint32 cumLen = 0;
-            static QByteArray buffer;
-            int l = 0;
+            // Wait for all of it and parse it in place
+            int l;
 
-            if (!isPending)
-            {
-                qWarning("not waiting for response");
-                goto _error_exit;
-            }
-
-            if (pendingMethodId != method)
-            {
-                qWarning("invalid method id %d (expected = %d)", method, 
-                    pendingMethodId);
-                goto _error_exit;
-            }
-
-            msgLen = 0;
-            while (cumLen < len)
-            {
-                if (inStream->Next((const void**)&msg, &msgLen) == false) {
-                    //qDebug("No more data or stream error");
-                    goto _exit;
-                }
-
-                l = qMin(msgLen, int(len - cumLen));
-                buffer.append(QByteArray((char*)msg, l));
-                cumLen += l;
-                //qDebug("%s: buffer rcvd %d/%d/%d", __PRETTY_FUNCTION__, l, cumLen, len);
-            }
-
-            if (l < msgLen) {
-                qDebug("read extra bytes after response; putting back");
-                inStream->BackUp(msgLen - l);
-            }
-
-#if 0 // not needed?
-            if (cumLen < len)
+            msg = inBuffer_->read(len);
+            if (!msg)
                 goto _exit;
-#endif
 
-            if (len)
-                response->ParseFromArray((const void*)buffer, len);
+            l = len;
+            if (isCompressed && !inBuffer_->uncompress(&msg, &l)) {
+                qWarning("failed to uncompress response of len %d", len);
+                call_.controller->SetFailed("Corrupt compressed msg");
+                break;
+            }
 
-            cumLen = 0;
-            buffer.resize(0);
+            if (l)
+                call_.response->ParseFromArray(msg, l);
 
             // Avoid printing stats
             if (method != 13)
             {
                 qDebug("client(%s): Received Msg <---- ", __FUNCTION__);
                 qDebug("method = %d:%s\nresp = %s\n%s\n---->",
-                        method, this->method->name().c_str(),
-                        this->method->output_type()->name().c_str(),
-                        response->DebugString().c_str());
+                        method, call_.method->name().c_str(),
+                        call_.method->output_type()->name().c_str(),
+                        call_.response->DebugString().c_str());
             }
 
-            if (!response->IsInitialized())
+            if (!call_.response->IsInitialized())
             {
                 qWarning("RpcChannel: missing required fields in response <----");
                 qDebug("resp = %s\n%s",
-                        this->method->output_type()->name().c_str(),
-                        response->DebugString().c_str());
+                        call_.method->output_type()->name().c_str(),
+                        call_.response->DebugString().c_str());
                 qDebug("error = \n%s\n--->", 
-                        response->InitializationErrorString().c_str());
+                        call_.response->InitializationErrorString().c_str());
 
-                controller->SetFailed("Required fields missing");
+                call_.controller->SetFailed("Required fields missing");
             }
             break;
         }
         case PB_MSG_TYPE_ERROR:
         {
-            static quint32 cumLen = 0;
-            static QByteArray error;
-            int l = 0;
+            msg = inBuffer_->read(len);
+            if (!msg)
+                goto _exit;
 
-            msgLen = 0;
-            while (cumLen < len)
-            {
-                if (inStream->Next((const void**)&msg, &msgLen) == false) {
-                    //qDebug("No more data or stream error");
-                    goto _exit;
-                }
+            qDebug("%s: error rcvd %d", __PRETTY_FUNCTION__, len);
 
-                l = qMin(msgLen, int(len - cumLen));
-                error.append(QByteArray((char*)msg, l));
-                cumLen += l;
-                //qDebug("%s: error rcvd %d/%d/%d", __PRETTY_FUNCTION__, l, cumLen, len);
-            }
+            static_cast<PbRpcController*>(call_.controller)->SetFailed(
+                    QString::fromUtf8(msg, len));
 
-            if (l < msgLen) {
-                qDebug("read extra bytes after error; putting back");
-                inStream->BackUp(msgLen - l);
-            }
+            break;
+        }
 
-            qDebug("%s: error rcvd %d/%d", __PRETTY_FUNCTION__, cumLen, len);
+        case PB_MSG_TYPE_NOTIFY: 
+        {
+            // Notifications (e.g. stats) may be large enough to arrive in
+            // parts - wait for all of it like a response
+            int l;
 
-            if (cumLen < len)
+            msg = inBuffer_->read(len);
+            if (!msg)
                 goto _exit;
 
-            static_cast<PbRpcController*>(controller)->SetFailed(
-                    QString::fromUtf8(error, len));
-
-            cumLen = 0;
-            error.resize(0);
-
-            if (!isPending)
-            {
-                qWarning("not waiting for response");
+            l = len;
+            if (isCompressed && !inBuffer_->uncompress(&msg, &l)) {
+                qWarning("failed to uncompress notify of len %d", len);
                 goto _error_exit2;
             }
 
-            if (pendingMethodId != method)
-            {
-                qWarning("invalid method id %d (expected = %d)", method, 
-                    pendingMethodId);
-                goto _error_exit2;
-            }
-
-            break;
-        }
-
-        case PB_MSG_TYPE_NOTIFY: 
-        {
             notif = notifPrototype.New();
             if (!notif)
             {
                 qWarning("failed to alloc notify");
-                goto _error_exit;
+                goto _error_exit2;
             }
 
-            if (len)
-                notif->ParseFromBoundedZeroCopyStream(inStream, len);
+            if (l)
+                notif->ParseFromArray(msg, l);
 
-            qDebug("client(%s): Received Notif Msg <---- ", __FUNCTION__);
-            qDebug("type = %d\nnotif = \n%s\n---->",
-                    method, notif->DebugString().c_str());
+            // Avoid printing (frequent) stats notifications
+            if (method != 2)
+            {
+                qDebug("client(%s): Received Notif Msg <---- ", __FUNCTION__);
+                qDebug("type = %d\nnotif = \n%s\n---->",
+                        method, notif->DebugString().c_str());
+            }
 
             if (!notif->IsInitialized())
             {
@@ -415,7 +448,7 @@ _top:
             notif = NULL;
 
             parsing = false;
-            goto _exit;
+            goto _more;
 
             break;
         }
@@ -426,16 +459,14 @@ _top:
                 
     }
 
-    done->Run();
-
-    pendingMethodId = -1;
-    this->method = NULL;
-    controller = NULL;
-    response = NULL;
-    isPending = false;
+    // The call is done before running its callback, which may make more
+    // calls (or change the framing after checkVersion)
+    inFlightCalls_.remove(requestId);
     parsing = false;
+    call_.done->Run();
 
-    if (pendingCallList.size())
+    while (pendingCallList.size()
+            && (inFlightCalls_.size() < (isPipelined_ ? kMaxInFlightCalls : 1)))
     {
         RpcCall call = pendingCallList.takeFirst();
         qDebug("RpcChannel: executing queued method <----\n"
@@ -444,29 +475,25 @@ _top:
                 call.method->index(), call.method->name().c_str(),
                 call.method->input_type()->name().c_str(),
                 call.request->DebugString().c_str());
-        CallMethod(call.method, call.controller, call.request, call.response,
-                call.done);
+        sendCall(call);
     }
 
-    goto _exit;
+    goto _more;
 
 _error_exit:
-    inStream->Skip(len);
+    discardLen = len;
 _error_exit2:
     parsing = false;
     qDebug("client(%s) discarding received msg <----", __FUNCTION__);
     qDebug("method = %d\n---->", method);
-_exit:
+_more:
     // If we have some data still available continue reading/parsing
-    if (inStream->Next((const void**)&msg, &msgLen)) {
-        if (msgLen >= PB_HDR_SIZE) {
-            inStream->BackUp(msgLen);
-            qDebug("===>> MORE DATA PENDING (%d bytes)... CONTINUE", msgLen);
-            goto _top;
-        }
+    if (mpDevice->bytesAvailable()) {
+        qDebug("===>> MORE DATA PENDING (%lld bytes)... CONTINUE",
+                mpDevice->bytesAvailable());
+        goto _top;
     }
-    if (mpSocket->bytesAvailable())
-        qDebug("%s (exit): bytesAvail = %lld", __FUNCTION__, mpSocket->bytesAvailable());
+_exit:
     return;
 }
 
@@ -487,11 +514,9 @@ void PbRpcChannel::on_mpSocket_disconnected()
 {
     qDebug("In %s", __FUNCTION__);
 
-    pendingMethodId = -1;
-    method = NULL;
-    controller = NULL;
-    response = NULL;
-    isPending = false;
+    inFlightCalls_.clear();
+    isPipelined_ = false;
+    outStream_->setCompression(false);
     // \todo convert parsing from static to data member
     //parsing = false 
     pendingCallList.clear();
@@ -505,3 +530,17 @@ void PbRpcChannel::on_mpSocket_error(QAbstractSocket::SocketError socketError)
     emit error(socketError);
 }
 
+void PbRpcChannel::on_mpLocalSocket_stateChanged(
+    QLocalSocket::LocalSocketState socketState)
+{
+    qDebug("In %s", __FUNCTION__);
+    emit stateChanged(QAbstractSocket::SocketState(socketState));
+}
+
+void PbRpcChannel::on_mpLocalSocket_error(
+    QLocalSocket::LocalSocketError socketError)
+{
+    qDebug("In %s", __FUNCTION__);
+    emit error(QAbstractSocket::SocketError(socketError));
+}
+
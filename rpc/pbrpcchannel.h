@@ -20,15 +20,18 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 #ifndef _PB_RPC_CHANNEL_H
 #define _PB_RPC_CHANNEL_H
 
+#include <QHash>
+#include <QList>
+#include <QLocalSocket>
 #include <QString>
 #include <QTcpServer>
 #include <QTcpSocket>
 
-#include <google/protobuf/io/zero_copy_stream_impl.h>
 #include <google/protobuf/message.h>
 #include <google/protobuf/descriptor.h>
 #include <google/protobuf/service.h>
 
+#include "pbqtio.h"
 #include "pbrpccommon.h"
 #include "pbrpccontroller.h"
 
@@ -36,24 +39,6 @@ class PbRpcChannel : public QObject, public ::google::protobuf::RpcChannel
 {
     Q_OBJECT
     
-    // If isPending is TRUE, then  controller, done, response
-    // and pendingMethodId correspond to the last method called by
-    // the service stub
-    bool            isPending;
-    int                pendingMethodId;
-
-    // controller, done, response are set to the corresponding values
-    // passed by the stub to CallMethod(). They are reset to NULL when
-    // we get a response back from the server in on_mpSocket_readyRead()
-    // after calling done->Run().
-
-    /*! \todo (MED) : change controller, done and response to references
-     instead of pointers? */
-    const ::google::protobuf::MethodDescriptor *method;
-    ::google::protobuf::RpcController    *controller;
-    ::google::protobuf::Closure            *done;
-    ::google::protobuf::Message            *response;
-
     typedef struct _RpcCall {
         const ::google::protobuf::MethodDescriptor    *method;
         ::google::protobuf::RpcController        *controller;
@@ -61,17 +46,30 @@ class PbRpcChannel : public QObject, public ::google::protobuf::RpcChannel
         ::google::protobuf::Message                *response;
         ::google::protobuf::Closure                *done;
     } RpcCall;
+
+    // Calls waiting to be sent because the max calls are in flight
     QList<RpcCall>        pendingCallList;
 
+    // Calls sent, waiting for a response; key is the request id (always
+    // 0 if not pipelined, so at most one call)
+    QHash<quint32, RpcCall> inFlightCalls_;
+    RpcCall call_; // whose response is being received
+
+    bool isPipelined_;
+    quint32 nextRequestId_;
+    static const int kMaxInFlightCalls = 64; // if pipelined
+
     const ::google::protobuf::Message   &notifPrototype;
     ::google::protobuf::Message     *notif;
 
     QString            mServerHost;
     quint16            mServerPort;
     QTcpSocket        *mpSocket;
+    QLocalSocket      *mpLocalSocket;
+    QIODevice         *mpDevice; // whichever of the above is in use
 
-    ::google::protobuf::io::CopyingInputStreamAdaptor  *inStream;
-    ::google::protobuf::io::CopyingOutputStreamAdaptor *outStream;
+    PbQtInputBuffer             *inBuffer_;
+    PbQtBufferedOutputStream    *outStream_;
 
 public:
     PbRpcChannel(QString serverName, quint16 port,
@@ -82,14 +80,33 @@ public:
     void establish(QString serverName, quint16 port);
     void tearDown();
 
+    // A serverName of "local:<name>" connects to the local socket name
+    // (see RpcServer::listenLocal()) instead of a TCP port
+    static bool isLocalServer(const QString &serverName)
+        { return serverName.startsWith(kLocalPrefix); }
+    bool isLocal() const { return mpDevice == mpLocalSocket; }
+
     const QString serverName() const
     {
-        return mpSocket->peerName();
+        return isLocal() ? mServerHost : mpSocket->peerName();
     }
     quint16 serverPort() const { return mServerPort; } 
 
+    // The local socket states and errors have the same values as these
     QAbstractSocket::SocketState state() const
-        { return mpSocket->state(); }    
+    {
+        return isLocal() ?
+            QAbstractSocket::SocketState(mpLocalSocket->state()) :
+            mpSocket->state();
+    }
+
+    // Use request ids and allow many calls in flight - only after
+    // checkVersion has negotiated it (and before any other call is made)
+    void setPipelined(bool pipelined);
+    bool isPipelined() const { return isPipelined_; }
+
+    // Compress large requests - only after checkVersion has negotiated it
+    void setCompression(bool enabled);
 
     void CallMethod(const ::google::protobuf::MethodDescriptor *method,
         ::google::protobuf::RpcController *controller,
@@ -105,11 +122,20 @@ signals:
 
     void notification(int notifType, ::google::protobuf::Message *notifData);
 
+private:
+    static const char *kLocalPrefix;
+
+    void setDevice();
+    void sendCall(const RpcCall &call);
+
 private slots:
     void on_mpSocket_connected();
     void on_mpSocket_disconnected();
     void on_mpSocket_stateChanged(QAbstractSocket::SocketState socketState);
     void on_mpSocket_error(QAbstractSocket::SocketError socketError);
+    void on_mpLocalSocket_stateChanged(
+            QLocalSocket::LocalSocketState socketState);
+    void on_mpLocalSocket_error(QLocalSocket::LocalSocketError socketError);
 
     void on_mpSocket_readyRead();
 };
@@ -25,12 +25,33 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
     (len)).toHex()).toAscii().data()); 
 
 /*
-** RPC Header (8)
+** RPC Header (8 or 12)
 **    - MSG_TYPE (2)
 **    - METHOD_ID/NOTIF_TYPE (2)
 **    - LEN (4) [not including this header]
+**    - REQUEST_ID (4) [only if pipelined]
+**
+** Pipelining is negotiated by checkVersion - after its response both sides
+** use the longer header. Requests are then not limited to one at a time;
+** a response (or binblob/error) has the id of its request and responses
+** may be in any order. Notifications have a request id of 0
+**
+** Compression is also negotiated by checkVersion - after its response a
+** side may compress any msg of PB_COMPRESS_THRESHOLD bytes or more and set
+** PB_MSG_FLAG_COMPRESSED in its MSG_TYPE. The msg is then in qCompress()
+** format - the uncompressed length (4, big endian) followed by zlib data
+** - and LEN is the compressed length
 */
 #define PB_HDR_SIZE                8
+#define PB_HDR_REQ_ID_SIZE         4
+#define PB_HDR_MAX_SIZE            (PB_HDR_SIZE + PB_HDR_REQ_ID_SIZE)
+
+#define PB_MSG_FLAG_COMPRESSED     0x8000
+#define PB_MSG_TYPE_MASK           0x7fff
+#define PB_COMPRESS_THRESHOLD      (64*1024)
+// protobuf's default limit for parsing a msg - a bigger one can't be
+// parsed anyway, so a compressed msg is rejected if it claims to be bigger
+#define PB_MAX_MSG_SIZE            (64*1024*1024)
 
 #define PB_MSG_TYPE_REQUEST        1
 #define PB_MSG_TYPE_RESPONSE       2
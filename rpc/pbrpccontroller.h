@@ -22,8 +22,10 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 
 #include <google/protobuf/message.h>
 #include <google/protobuf/service.h>
+#include <QtGlobal>
 
 class QIODevice;
+class QObject;
 
 /*!
 PbRpcController takes ownership of the 'request' and 'response' messages and
@@ -36,6 +38,12 @@ public:
             ::google::protobuf::Message *response) { 
         request_ = request;
         response_ = response;
+        connection_ = NULL;
+        methodId_ = -1;
+        requestId_ = 0;
+        queueTime_ = 0;
+        pipelining = false;
+        compression = false;
         Reset(); 
     }
     ~PbRpcController() { delete request_; delete response_; }
@@ -77,16 +85,61 @@ public:
     bool NotifEnabled() {
         return notif;
     }
+    void EnablePipelining(bool enabled) {
+        pipelining = enabled;
+    }
+    bool PipeliningEnabled() {
+        return pipelining;
+    }
+    void EnableCompression(bool enabled) {
+        compression = enabled;
+    }
+    bool CompressionEnabled() {
+        return compression;
+    }
 
     // srivatsp added
     QIODevice* binaryBlob() { return blob; };
     void setBinaryBlob(QIODevice *binaryBlob) { blob = binaryBlob; };
 
+    // Server side - the RpcConnection of the client that made the call;
+    // it lives as long as the client is connected and has a
+    // sendNotification(int, SharedProtobufMessage) slot for notifications
+    // to just this client
+    QObject* connection() { return connection_; }
+    void setConnection(QObject *connection) { connection_ = connection; }
+
+    // Server side - of the request being served; the reply has the same
+    int methodId() const { return methodId_; }
+    quint32 requestId() const { return requestId_; }
+    void setRequest(int methodId, quint32 requestId) {
+        methodId_ = methodId;
+        requestId_ = requestId;
+    }
+
+    // Server side - nsecs the request waited (behind earlier requests on
+    // the connection) after it was received, before it was served
+    qint64 queueTime() const { return queueTime_; }
+    void setQueueTime(qint64 nsecs) { queueTime_ = nsecs; }
+
+    // Server side - hands over the request and response to the caller
+    // (for reuse in a later call); they are no longer deleted by us
+    void releaseMessages() {
+        request_ = NULL;
+        response_ = NULL;
+    }
+
 private:
     bool failed;
     bool disconnect;
     bool notif;
+    bool pipelining;
+    bool compression;
     QIODevice *blob;
+    QObject *connection_;
+    int methodId_;
+    quint32 requestId_;
+    qint64 queueTime_;
     QString errStr;
     ::google::protobuf::Message *request_;
     ::google::protobuf::Message *response_;
@@ -22,16 +22,19 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 #include "pbqtio.h"
 #include "pbrpccommon.h"
 #include "pbrpccontroller.h"
+#include "../common/sdtprobes.h"
 
 #include <google/protobuf/message.h>
 #include <google/protobuf/descriptor.h>
 #include <google/protobuf/service.h>
-#include <google/protobuf/io/zero_copy_stream_impl.h>
 
 #include <QDateTime>
 #include <QHostAddress>
+#include <QLocalSocket>
+#include <QRunnable>
 #include <QString>
 #include <QTcpSocket>
+#include <QThreadPool>
 #include <QThreadStorage>
 #include <QtGlobal>
 #include <qendian.h>
@@ -41,34 +44,92 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 
 static QThreadStorage<QString*> connId;
 
-RpcConnection::RpcConnection(int socketDescriptor, 
-                             ::google::protobuf::Service *service)
+// A thread serves many connections, so the id of the connection being
+// served is set each time before it logs anything
+static void setConnId(const QString &id)
+{
+    if (!connId.hasLocalData())
+        connId.setLocalData(new QString);
+    *connId.localData() = id;
+}
+
+/*!
+  Serves a call in a worker pool thread - the reply is sent back on the
+  connection's own thread
+*/
+class RpcConnection::WorkerCall : public QRunnable
+{
+public:
+    WorkerCall(RpcConnection *conn,
+               const ::google::protobuf::MethodDescriptor *methodDesc,
+               PbRpcController *controller)
+        : conn(conn), methodDesc(methodDesc), controller(controller)
+    {
+        queuedTime.start();
+    }
+
+    void run()
+    {
+        setConnId(conn->id);
+
+        // Include the time spent waiting for a free worker
+        controller->setQueueTime(controller->queueTime()
+                                 + queuedTime.nsecsElapsed());
+        conn->service->CallMethod(methodDesc, controller,
+                controller->request(), controller->response(),
+                google::protobuf::NewCallback(conn,
+                        &RpcConnection::workerCallDone, controller));
+    }
+
+private:
+    RpcConnection *conn;
+    const ::google::protobuf::MethodDescriptor *methodDesc;
+    PbRpcController *controller;
+    QElapsedTimer queuedTime;
+};
+
+RpcConnection::RpcConnection(quintptr socketDescriptor,
+                             ::google::protobuf::Service *service,
+                             QThreadPool *workerPool,
+                             const QSet<int> &workerMethods,
+                             bool isLocal)
     : socketDescriptor(socketDescriptor),
-      service(service)
+      isLocal(isLocal),
+      service(service),
+      workerPool(workerPool),
+      workerMethods(workerMethods)
 {
-    inStream = NULL;
+    inBuffer = NULL;
     outStream = NULL;
 
     isPending = false;
     pendingMethodId = -1; // don't care as long as isPending is false
+    isWorkerCallPending = false;
+    isClosing = false;
 
     isCompatCheckDone = false;
     isNotifEnabled = true;
+    isPipelined = false;
 }
 
 RpcConnection::~RpcConnection()
 { 
-    qDebug("destroying connection to %s: %d", 
-            clientSock->peerAddress().toString().toAscii().constData(),
-            clientSock->peerPort());
+    setConnId(id);
+    qDebug("destroying connection to %s", qPrintable(peerName()));
 
     // If still connected, disconnect 
-    if (clientSock->state() != QAbstractSocket::UnconnectedState) {
-        clientSock->disconnectFromHost();
-        clientSock->waitForDisconnected();
+    if (isSockConnected()) {
+        disconnectSock();
+        if (isLocal)
+            static_cast<QLocalSocket*>(clientSock)->waitForDisconnected();
+        else
+            static_cast<QTcpSocket*>(clientSock)->waitForDisconnected();
     }
 
-    delete inStream;
+    qDeleteAll(requestCache);
+    qDeleteAll(responseCache);
+
+    delete inBuffer;
     delete outStream;
 
     delete clientSock;
@@ -76,60 +137,111 @@ RpcConnection::~RpcConnection()
 
 void RpcConnection::start()
 {
-    QString id = QString("[%1:%2] ");
-    clientSock = new QTcpSocket;
-    if (!clientSock->setSocketDescriptor(socketDescriptor)) {
-        qWarning("Unable to initialize TCP socket for incoming connection");
-        return;
+    if (isLocal) {
+        QLocalSocket *sock = new QLocalSocket;
+
+        clientSock = sock;
+        if (!sock->setSocketDescriptor(socketDescriptor)) {
+            qWarning("Unable to initialize local socket for incoming "
+                     "connection");
+            return;
+        }
+        connect(sock, SIGNAL(error(QLocalSocket::LocalSocketError)),
+            this, SLOT(on_clientSock_localError(
+                            QLocalSocket::LocalSocketError)));
+    }
+    else {
+        QTcpSocket *sock = new QTcpSocket;
+
+        clientSock = sock;
+        if (!sock->setSocketDescriptor(socketDescriptor)) {
+            qWarning("Unable to initialize TCP socket for incoming "
+                     "connection");
+            return;
+        }
+        connect(sock, SIGNAL(error(QAbstractSocket::SocketError)),
+            this, SLOT(on_clientSock_error(QAbstractSocket::SocketError)));
     }
     qDebug("clientSock Thread = %p", clientSock->thread());
     qsrand(QDateTime::currentDateTime().toTime_t());
 
-    connId.setLocalData(new QString(id.arg(clientSock->peerAddress().toString())
-                                      .arg(clientSock->peerPort())));
+    id = QString("[%1] ").arg(peerName());
+    setConnId(id);
 
-    qDebug("accepting new connection from %s: %d", 
-            clientSock->peerAddress().toString().toAscii().constData(),
-            clientSock->peerPort());
-    inStream = new google::protobuf::io::CopyingInputStreamAdaptor(
-                            new PbQtInputStream(clientSock));
-    inStream->SetOwnsCopyingStream(true);
-    outStream = new google::protobuf::io::CopyingOutputStreamAdaptor(
-                            new PbQtOutputStream(clientSock));
-    outStream->SetOwnsCopyingStream(true);
+    qDebug("accepting new connection from %s", qPrintable(peerName()));
+    inBuffer = new PbQtInputBuffer(clientSock);
+    outStream = new PbQtBufferedOutputStream(clientSock);
 
     connect(clientSock, SIGNAL(readyRead()), 
         this, SLOT(on_clientSock_dataAvail()));
     connect(clientSock, SIGNAL(disconnected()), 
         this, SLOT(on_clientSock_disconnected()));
-    connect(clientSock, SIGNAL(error(QAbstractSocket::SocketError)), 
-        this, SLOT(on_clientSock_error(QAbstractSocket::SocketError)));
 }
 
-void RpcConnection::writeHeader(char* header, quint16 type, quint16 method, 
-                                quint32 length)
+// A local socket peer has no address - the descriptor tells it apart
+QString RpcConnection::peerName() const
+{
+    if (isLocal)
+        return QString("local:%1").arg(socketDescriptor);
+
+    const QTcpSocket *sock = static_cast<const QTcpSocket*>(clientSock);
+    return QString("%1:%2").arg(sock->peerAddress().toString())
+                           .arg(sock->peerPort());
+}
+
+bool RpcConnection::isSockConnected() const
+{
+    if (isLocal)
+        return static_cast<const QLocalSocket*>(clientSock)->state()
+                    != QLocalSocket::UnconnectedState;
+
+    return static_cast<const QTcpSocket*>(clientSock)->state()
+                != QAbstractSocket::UnconnectedState;
+}
+
+void RpcConnection::disconnectSock()
+{
+    if (isLocal)
+        static_cast<QLocalSocket*>(clientSock)->disconnectFromServer();
+    else
+        static_cast<QTcpSocket*>(clientSock)->disconnectFromHost();
+}
+
+// Returns the header size
+int RpcConnection::writeHeader(char* header, quint16 type, quint16 method, 
+                               quint32 length, quint32 requestId)
 {
     *((quint16*)(header+0)) = qToBigEndian(type);
     *((quint16*)(header+2)) = qToBigEndian(method);
     *((quint32*)(header+4)) = qToBigEndian(length);
+
+    if (!isPipelined)
+        return PB_HDR_SIZE;
+
+    *((quint32*)(header+8)) = qToBigEndian(requestId);
+    return PB_HDR_MAX_SIZE;
 }
 
 void RpcConnection::sendRpcReply(PbRpcController *controller)
 {
     google::protobuf::Message *response = controller->response();
     QIODevice *blob;
-    char msgBuf[PB_HDR_SIZE];
+    char msgBuf[PB_HDR_MAX_SIZE];
     char* const msg = &msgBuf[0];
+    int methodId = controller->methodId();
+    quint32 requestId = controller->requestId();
+    int hdrLen;
     int len;
 
+    OST_PROBE3(rpc_reply, methodId, requestId, controller->Failed());
     if (controller->Failed())
     {
         QByteArray err = controller->ErrorString().toUtf8();
 
         qWarning("rpc failed (%s)", qPrintable(controller->ErrorString()));
         len = err.size();
-        writeHeader(msg, PB_MSG_TYPE_ERROR, pendingMethodId, len);
-        clientSock->write(msg, PB_HDR_SIZE);
+        hdrLen = writeHeader(msg, PB_MSG_TYPE_ERROR, methodId, len, requestId);
+        clientSock->write(msg, hdrLen);
         clientSock->write(err.constData(), len);
 
         goto _exit;
@@ -141,19 +253,10 @@ void RpcConnection::sendRpcReply(PbRpcController *controller)
         len = blob->size();
         qDebug("is binary blob of len %d", len);
 
-        writeHeader(msg, PB_MSG_TYPE_BINBLOB, pendingMethodId, len);
-        clientSock->write(msg, PB_HDR_SIZE);
-
-        blob->seek(0);
-        while (!blob->atEnd())
-        {    
-            int l;
-
-            len = blob->read(msg, sizeof(msgBuf));
-            l = clientSock->write(msg, len);
-            Q_ASSERT(l == len);
-            Q_UNUSED(l);
-        }
+        hdrLen = writeHeader(msg, PB_MSG_TYPE_BINBLOB, methodId, len,
+                             requestId);
+        if (!outStream->writeBlob(msg, hdrLen, blob))
+            qWarning("failed to write binary blob of len %d", len);
 
         goto _exit;
     }
@@ -170,40 +273,84 @@ void RpcConnection::sendRpcReply(PbRpcController *controller)
     }
 
     len = response->ByteSize();
-    writeHeader(msg, PB_MSG_TYPE_RESPONSE, pendingMethodId, len);
+    hdrLen = writeHeader(msg, PB_MSG_TYPE_RESPONSE, methodId, len, requestId);
 
     // Avoid printing stats since it happens once every couple of seconds
-    if (pendingMethodId != 13)
+    if (methodId != 13)
     {
         qDebug("Server(%s): sending %d bytes to client <----",
-            __FUNCTION__, len + PB_HDR_SIZE);
-        BUFDUMP(msg, 8);
+            __FUNCTION__, len + hdrLen);
+        BUFDUMP(msg, hdrLen);
         qDebug("method = %d\nreq = \n%s---->", 
-            pendingMethodId, response->DebugString().c_str());
+            methodId, response->DebugString().c_str());
     }
 
-    clientSock->write(msg, PB_HDR_SIZE);
-    response->SerializeToZeroCopyStream(outStream);
-    outStream->Flush();
+    if (!outStream->writeMessage(msg, hdrLen, *response, len))
+        qWarning("failed to write response of len %d", len);
 
-    if (pendingMethodId == 15) {
+    // Framing changes (if at all) only after the checkVersion response
+    if (methodId == 15) {
         isCompatCheckDone = true;
         isNotifEnabled = controller->NotifEnabled();
+        isPipelined = controller->PipeliningEnabled();
+        outStream->setCompression(controller->CompressionEnabled());
     }
 
+    // Keep the messages for reuse by the next call of this method
+    recycleMessage(requestCache, methodId, controller->request(),
+                   controller->request()->ByteSize());
+    recycleMessage(responseCache, methodId, response, len);
+    controller->releaseMessages();
+
 _exit:
     if (controller->Disconnect())
-        clientSock->disconnectFromHost();
+        disconnectSock();
 
     delete controller;
     isPending = false;
 }
 
+/*!
+  Returns a (cleared) message of the same type as prototype - reused from
+  an earlier call of method, if possible
+*/
+google::protobuf::Message* RpcConnection::newMessage(
+        QHash<int, google::protobuf::Message*> &cache, int method,
+        const google::protobuf::Message &prototype)
+{
+    google::protobuf::Message *msg = cache.take(method);
+
+    if (!msg)
+        msg = prototype.New();
+
+    return msg;
+}
+
+/*!
+  Clears msg and keeps it for reuse by the next call of method, unless
+  it's too big (size is the serialized size) to hold on to
+*/
+void RpcConnection::recycleMessage(
+        QHash<int, google::protobuf::Message*> &cache, int method,
+        google::protobuf::Message *msg, int size)
+{
+    if ((size > kMaxRecycleSize) || cache.contains(method)) {
+        delete msg;
+        return;
+    }
+
+    msg->Clear();
+    cache.insert(method, msg);
+}
+
 void RpcConnection::sendNotification(int notifType,
         SharedProtobufMessage notifData)
 {
-    char msgBuf[PB_HDR_SIZE];
+    char msgBuf[PB_HDR_MAX_SIZE];
     char* const msg = &msgBuf[0];
+    QByteArray bytes;
+    bool isFirst = false;
+    int hdrLen;
     int len;
 
     if (!isCompatCheckDone)
@@ -212,6 +359,8 @@ void RpcConnection::sendNotification(int notifType,
     if (!isNotifEnabled)
         return;
 
+    setConnId(id);
+
     if (!notifData->IsInitialized())
     {
         qWarning("notification missing required fields!! <----");
@@ -223,25 +372,39 @@ void RpcConnection::sendNotification(int notifType,
         return;
     }
 
-    len = notifData->ByteSize();
-    writeHeader(msg, PB_MSG_TYPE_NOTIFY, notifType, len);
+    // Serialized once for all connections by whichever gets here first
+    bytes = notifData.serialized(&isFirst);
+    len = bytes.size();
+    hdrLen = writeHeader(msg, PB_MSG_TYPE_NOTIFY, notifType, len);
 
-    qDebug("Server(%s): sending %d bytes to client <----",
-        __FUNCTION__, len + PB_HDR_SIZE);
-    BUFDUMP(msg, 8);
-    qDebug("notif = %d\ndata = \n%s---->", 
-        notifType, notifData->DebugString().c_str());
+    // Skip the dump for the (frequent) stats notifications - like we do
+    // for getStats replies; the content is dumped only once, not once
+    // per connection
+#ifndef QT_NO_DEBUG_OUTPUT
+    if (notifType != 2) {
+        qDebug("Server(%s): sending %d bytes to client <----",
+            __FUNCTION__, len + hdrLen);
+        BUFDUMP(msg, hdrLen);
+        if (isFirst)
+            qDebug("notif = %d\ndata = \n%s---->",
+                notifType, notifData->DebugString().c_str());
+    }
+#endif
 
-    clientSock->write(msg, PB_HDR_SIZE);
-    notifData->SerializeToZeroCopyStream(outStream);
-    outStream->Flush();
+    if (!outStream->writeMessage(msg, hdrLen, bytes))
+        qWarning("failed to write notification of len %d", len);
 }
 
 void RpcConnection::on_clientSock_disconnected()
 {
-    qDebug("connection closed from %s: %d",
-            clientSock->peerAddress().toString().toAscii().constData(),
-            clientSock->peerPort());
+    setConnId(id);
+    qDebug("connection closed from %s", qPrintable(peerName()));
+
+    // The worker call refers to us - go away only after it is done
+    if (isWorkerCallPending) {
+        isClosing = true;
+        return;
+    }
 
     deleteLater();
     emit closed();
@@ -249,46 +412,108 @@ void RpcConnection::on_clientSock_disconnected()
 
 void RpcConnection::on_clientSock_error(QAbstractSocket::SocketError socketError)
 {
+    setConnId(id);
     qDebug("%s (%d)", clientSock->errorString().toAscii().constData(), 
             socketError);
 }
 
+void RpcConnection::on_clientSock_localError(
+        QLocalSocket::LocalSocketError socketError)
+{
+    setConnId(id);
+    qDebug("%s (%d)", qPrintable(clientSock->errorString()), socketError);
+}
+
 void RpcConnection::on_clientSock_dataAvail()
 {
-    uchar    msg[PB_HDR_SIZE];
+    // A pipelining client may have sent many requests - readyRead is not
+    // signalled again for what's already been received
+    receivedTime.start();
+
+    // Resumed once the worker call is done
+    if (isWorkerCallPending)
+        return;
+
+    setConnId(id);
+    while (processMessage())
+        ;
+}
+
+// Called on the worker thread that served the call
+void RpcConnection::workerCallDone(PbRpcController *controller)
+{
+    QMetaObject::invokeMethod(this, "on_workerCall_done",
+            Qt::QueuedConnection, Q_ARG(void*, controller));
+}
+
+void RpcConnection::on_workerCall_done(void *controller)
+{
+    isWorkerCallPending = false;
+
+    if (isClosing) {
+        delete static_cast<PbRpcController*>(controller);
+        deleteLater();
+        emit closed();
+        return;
+    }
+
+    setConnId(id);
+    sendRpcReply(static_cast<PbRpcController*>(controller));
+
+    // Process the requests received in the meantime
+    while (processMessage())
+        ;
+}
+
+/*!
+  Processes the next request if it has been fully received
+
+  Returns false if there isn't one yet
+*/
+bool RpcConnection::processMessage()
+{
+    uchar    msg[PB_HDR_MAX_SIZE];
     int      msgLen;
+    int      hdrLen = isPipelined ? PB_HDR_MAX_SIZE : PB_HDR_SIZE;
     quint16 type, method;
     quint32 len;
+    quint32 requestId = 0;
+    bool isCompressed;
     const ::google::protobuf::MethodDescriptor    *methodDesc;
     ::google::protobuf::Message    *req, *resp;
     PbRpcController *controller;
+    qint64 queueNsec;
     QString error;
     bool disconnect = false;
 
     // Do we have enough bytes for a msg header? 
     // If yes, peek into the header and get msg length
-    if (clientSock->bytesAvailable() < PB_HDR_SIZE)
-        return;
+    if (clientSock->bytesAvailable() < hdrLen)
+        return false;
 
-    msgLen = clientSock->peek((char*)msg, PB_HDR_SIZE);
-    if (msgLen != PB_HDR_SIZE) {
+    msgLen = clientSock->peek((char*)msg, hdrLen);
+    if (msgLen != hdrLen) {
         qWarning("asked to peek %d bytes, was given only %d bytes",
-                PB_HDR_SIZE, msgLen);
-        return;
+                hdrLen, msgLen);
+        return false;
     }
 
     len = qFromBigEndian<quint32>(&msg[4]);
 
     // Is the full msg available to read? If not, wait till such time
-    if (clientSock->bytesAvailable() < (PB_HDR_SIZE+len))
-        return;
+    if (clientSock->bytesAvailable() < (hdrLen+len))
+        return false;
 
-    msgLen = clientSock->read((char*)msg, PB_HDR_SIZE);
-    Q_ASSERT(msgLen == PB_HDR_SIZE);
+    msgLen = clientSock->read((char*)msg, hdrLen);
+    Q_ASSERT(msgLen == hdrLen);
 
     type = qFromBigEndian<quint16>(&msg[0]);
     method = qFromBigEndian<quint16>(&msg[2]);
     len = qFromBigEndian<quint32>(&msg[4]);
+    if (isPipelined)
+        requestId = qFromBigEndian<quint32>(&msg[8]);
+    isCompressed = type & PB_MSG_FLAG_COMPRESSED;
+    type &= PB_MSG_TYPE_MASK;
     //qDebug("type = %d, method = %d, len = %d", type, method, len);
 
     if (type != PB_MSG_TYPE_REQUEST)
@@ -324,7 +549,8 @@ void RpcConnection::on_clientSock_dataAvail()
         goto _error_exit;
     }
 
-    if (isPending)
+    // Without pipelining, the client waits for each reply
+    if (isPending && !isPipelined)
     {
         qDebug("server(%s): rpc pending, try again", __FUNCTION__);
         error = QString("RPC %1() is pending; only one RPC allowed at a time; "
@@ -337,13 +563,31 @@ void RpcConnection::on_clientSock_dataAvail()
     pendingMethodId = method;
     isPending = true;
 
-    req = service->GetRequestPrototype(methodDesc).New();
-    resp = service->GetResponsePrototype(methodDesc).New();
+    req = newMessage(requestCache, method,
+                     service->GetRequestPrototype(methodDesc));
+    resp = newMessage(responseCache, method,
+                      service->GetResponsePrototype(methodDesc));
 
+    // Read just this msg off the socket - the next request may follow
+    // right behind
     if (len) {
-        bool ok = req->ParseFromBoundedZeroCopyStream(inStream, len);
+        const char *data = inBuffer->read(len);
+        int dataLen = len;
+        if (data && isCompressed && !inBuffer->uncompress(&data, &dataLen)) {
+            qWarning("failed to uncompress request for method %d "
+                     "and len %d", method, len);
+            error = QString("RPC %1() request is corrupt or bigger than "
+                            "%2 bytes uncompressed")
+                        .arg(QString::fromStdString(methodDesc->name()))
+                        .arg(PB_MAX_MSG_SIZE);
+            delete req;
+            delete resp;
+
+            goto _error_exit2;
+        }
+        bool ok = data && req->ParseFromArray(data, dataLen);
         if (!ok)
-            qWarning("ParseFromBoundedZeroCopyStream fail "
+            qWarning("ParseFromArray fail "
                      "for method %d and len %d", method, len);
     }
 
@@ -358,7 +602,7 @@ void RpcConnection::on_clientSock_dataAvail()
         error = QString("RPC %1() missing required fields in request - %2")
                     .arg(QString::fromStdString(
                                 service->GetDescriptor()->method(
-                                    pendingMethodId)->name()),
+                                    method)->name()),
                         QString(req->InitializationErrorString().c_str()));
         delete req;
         delete resp;
@@ -375,28 +619,40 @@ void RpcConnection::on_clientSock_dataAvail()
     }
 
     controller = new PbRpcController(req, resp);
+    controller->setConnection(this);
+    controller->setRequest(method, requestId);
+    queueNsec = receivedTime.nsecsElapsed();
+    controller->setQueueTime(queueNsec);
+    OST_PROBE3(rpc_dispatch, method, requestId, queueNsec);
 
     //qDebug("before service->callmethod()");
 
+    if (workerPool && workerMethods.contains(method)) {
+        isWorkerCallPending = true;
+        workerPool->start(new WorkerCall(this, methodDesc, controller));
+        return false;
+    }
+
     service->CallMethod(methodDesc, controller, req, resp,
         google::protobuf::NewCallback(this, &RpcConnection::sendRpcReply, 
                                       controller));
 
-    return;
+    return true;
 
 _error_exit:
-    inStream->Skip(len);
+    clientSock->read(len);
 _error_exit2:
     qDebug("server(%s): return error %s for msg from client", __FUNCTION__,
             qPrintable(error));
     pendingMethodId = method;
     isPending = true;
     controller = new PbRpcController(NULL, NULL);
+    controller->setRequest(method, requestId);
     controller->SetFailed(error);
     if (disconnect)
         controller->TriggerDisconnect();
     sendRpcReply(controller);
-    return;
+    return true;
 }
 
 void RpcConnection::connIdMsgHandler(QtMsgType /*type*/, const char* msg)
@@ -23,17 +23,21 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 #include "sharedprotobufmessage.h"
 
 #include <QAbstractSocket>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QLocalSocket>
+#include <QSet>
+#include <QString>
 
 // forward declarations
+class PbQtBufferedOutputStream;
+class PbQtInputBuffer;
 class PbRpcController;
-class QTcpSocket;
+class QIODevice;
+class QThreadPool;
 namespace google {
     namespace protobuf {
         class Service;
-        namespace io {
-            class CopyingInputStreamAdaptor;
-            class CopyingOutputStreamAdaptor;
-        }
         class Message;
     }
 }
@@ -43,15 +47,33 @@ class RpcConnection : public QObject
     Q_OBJECT
 
 public:
-    RpcConnection(int socketDescriptor, ::google::protobuf::Service *service);
+    // isLocal: socketDescriptor is of a QLocalServer connection (AF_UNIX
+    // or a named pipe) instead of a QTcpServer one
+    RpcConnection(quintptr socketDescriptor,
+                  ::google::protobuf::Service *service,
+                  QThreadPool *workerPool = NULL,
+                  const QSet<int> &workerMethods = QSet<int>(),
+                  bool isLocal = false);
     virtual ~RpcConnection();
 
     static void connIdMsgHandler(QtMsgType type, const char* msg);
 
 private:
-    void writeHeader(char* header, quint16 type, quint16 method, 
-                     quint32 length);
+    int writeHeader(char* header, quint16 type, quint16 method, 
+                    quint32 length, quint32 requestId = 0);
+    bool processMessage();
     void sendRpcReply(PbRpcController *controller);
+    void workerCallDone(PbRpcController *controller);
+
+    QString peerName() const;
+    bool isSockConnected() const;
+    void disconnectSock();
+
+    ::google::protobuf::Message* newMessage(
+            QHash<int, ::google::protobuf::Message*> &cache, int method,
+            const ::google::protobuf::Message &prototype);
+    void recycleMessage(QHash<int, ::google::protobuf::Message*> &cache,
+            int method, ::google::protobuf::Message *msg, int size);
 
 signals:
     void closed();
@@ -63,21 +85,46 @@ private slots:
     void start();
     void on_clientSock_dataAvail();
     void on_clientSock_error(QAbstractSocket::SocketError socketError);
+    void on_clientSock_localError(QLocalSocket::LocalSocketError socketError);
     void on_clientSock_disconnected();
+    void on_workerCall_done(void *controller);
 
 private:
-    int socketDescriptor;
-    QTcpSocket *clientSock;
+    class WorkerCall;
+
+    quintptr socketDescriptor;
+    bool isLocal;
+    QIODevice *clientSock; // a QTcpSocket or a QLocalSocket (isLocal)
+    QString id; // for the log messages of this connection
 
     ::google::protobuf::Service *service;
-    ::google::protobuf::io::CopyingInputStreamAdaptor  *inStream;
-    ::google::protobuf::io::CopyingOutputStreamAdaptor *outStream;
+    PbQtInputBuffer *inBuffer;
+    PbQtBufferedOutputStream *outStream;
 
     bool isPending;
     int pendingMethodId;
 
+    // A call of one of workerMethods is served by workerPool instead of
+    // our (shared) thread; requests that follow it are processed only
+    // after its reply is sent, so that they are still served in order
+    QThreadPool *workerPool;
+    QSet<int> workerMethods;
+    bool isWorkerCallPending;
+    bool isClosing; // disconnected while a worker call was pending
+
+    // Since the requests being processed were received
+    QElapsedTimer receivedTime;
+
+    // Cleared request/response of the last call of each method for the
+    // next call of that method to reuse - protobuf retains the memory of
+    // cleared sub-messages, so this avoids reallocating all of them
+    QHash<int, ::google::protobuf::Message*> requestCache;
+    QHash<int, ::google::protobuf::Message*> responseCache;
+    static const int kMaxRecycleSize = 1024*1024; // bytes (serialized)
+
     bool isCompatCheckDone;
     bool isNotifEnabled;
+    bool isPipelined;
 };
 
 #endif
@@ -21,7 +21,9 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 
 #include "rpcconn.h"
 
+#include <QLocalServer>
 #include <QThread>
+#include <QThreadPool>
 
 // FIXME: QThreadX till we change minimum version of Qt from Qt4.3+ to Qt4.4+
 class QThreadX: public QThread
@@ -31,15 +33,61 @@ protected:
     void run() { exec(); }
 };
 
+class LocalRpcServer: public QLocalServer
+{
+public:
+    LocalRpcServer(RpcServer *rpcServer)
+        : QLocalServer(rpcServer), rpcServer_(rpcServer) {}
+protected:
+    void incomingConnection(quintptr socketDescriptor) {
+        rpcServer_->addConnection(socketDescriptor, true);
+    }
+private:
+    RpcServer *rpcServer_;
+};
+
+// Connections mostly wait on the network, so a few threads are enough
+static const int kMaxDefaultIoThreads = 4;
+
 RpcServer::RpcServer()
 {
     service = NULL; 
 
+    ioThreadCount = 0;
+    nextIoThread = 0;
+    localServer = NULL;
+    workerPool = new QThreadPool(this);
+
     qInstallMsgHandler(RpcConnection::connIdMsgHandler);
 }
 
 RpcServer::~RpcServer()
 { 
+    close();
+    if (localServer)
+        localServer->close();
+    workerPool->waitForDone();
+
+    foreach(QThread *thread, ioThreads) {
+        thread->quit();
+        thread->wait();
+    }
+}
+
+void RpcServer::setIoThreadCount(int count)
+{
+    ioThreadCount = count;
+}
+
+void RpcServer::setWorkerThreadCount(int count)
+{
+    if (count > 0)
+        workerPool->setMaxThreadCount(count);
+}
+
+void RpcServer::setWorkerMethods(const QSet<int> &methodIds)
+{
+    workerMethods = methodIds;
 }
 
 bool RpcServer::registerService(::google::protobuf::Service *service,
@@ -58,27 +106,66 @@ bool RpcServer::registerService(::google::protobuf::Service *service,
     qDebug("The server is running on %s: %d", 
             serverAddress().toString().toAscii().constData(),
             serverPort());
+
+    if (ioThreadCount <= 0)
+        ioThreadCount = qBound(1, QThread::idealThreadCount(),
+                               kMaxDefaultIoThreads);
+    for (int i = 0; i < ioThreadCount; i++) {
+        QThread *thread = new QThreadX;
+
+        // Not parented - deleted only once it has finished
+        connect(thread, SIGNAL(finished()), thread, SLOT(deleteLater()));
+        thread->start();
+        ioThreads.append(thread);
+    }
+    qDebug("rpc threads: %d I/O, %d worker", ioThreads.size(),
+            workerPool->maxThreadCount());
+
+    return true;
+}
+
+bool RpcServer::listenLocal(const QString &name)
+{
+    Q_ASSERT(service);
+
+    if (!localServer)
+        localServer = new LocalRpcServer(this);
+
+    // A server that went down without cleaning up leaves its socket file
+    // behind which fails the listen
+    QLocalServer::removeServer(name);
+    if (!localServer->listen(name))
+    {
+        qWarning("Unable to start the local server on <%s>: %s",
+                qPrintable(name), qPrintable(localServer->errorString()));
+        return false;
+    }
+
+    qDebug("The server is running on local socket %s",
+            qPrintable(localServer->fullServerName()));
     return true;
 }
 
 void RpcServer::incomingConnection(int socketDescriptor)
 {
-    QThread *thread = new QThreadX; // FIXME:QThreadX pending Qt4.4+
-    RpcConnection *conn = new RpcConnection(socketDescriptor, service);
+    addConnection(quintptr(socketDescriptor), false);
+}
 
-    conn->moveToThread(thread);
+void RpcServer::addConnection(quintptr socketDescriptor, bool isLocal)
+{
+    QThread *thread = ioThreads.at(nextIoThread);
+    RpcConnection *conn = new RpcConnection(socketDescriptor, service,
+                                            workerPool, workerMethods,
+                                            isLocal);
 
-    connect(thread, SIGNAL(started()), conn, SLOT(start()));
+    nextIoThread = (nextIoThread + 1) % ioThreads.size();
 
     // NOTE: conn "self-destructs" after emitting closed
-    // use 'closed' to stop execution of the thread
-    connect(conn, SIGNAL(closed()), thread, SLOT(quit()));
-
-    // setup thread to "self-destruct" when it is done
-    connect(thread, SIGNAL(finished()), thread, SLOT(deleteLater()));
+    conn->moveToThread(thread);
 
     connect(this, SIGNAL(notifyClients(int, SharedProtobufMessage)),
             conn, SLOT(sendNotification(int, SharedProtobufMessage)));
 
-    thread->start();
+    // The thread is already running - start conn in it
+    QMetaObject::invokeMethod(conn, "start", Qt::QueuedConnection);
 }
@@ -22,9 +22,14 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 
 #include "sharedprotobufmessage.h"
 
+#include <QList>
+#include <QSet>
 #include <QTcpServer>
 
 // forward declaration
+class LocalRpcServer;
+class QThread;
+class QThreadPool;
 namespace google {
     namespace protobuf {
         class Service;
@@ -40,9 +45,20 @@ public:
     RpcServer();    //! \todo (LOW) use 'parent' param
     virtual ~RpcServer();
 
+    // These take effect only if set before registerService(); a count
+    // of 0 (default) picks one based on the number of CPUs
+    void setIoThreadCount(int count);
+    void setWorkerThreadCount(int count);
+    void setWorkerMethods(const QSet<int> &methodIds);
+
     bool registerService(::google::protobuf::Service *service,
         QHostAddress address, quint16 tcpPortNum);
 
+    // Also serve local clients over an AF_UNIX socket (a named pipe on
+    // Windows) - a name without a path is created in the temp dir; only
+    // after registerService()
+    bool listenLocal(const QString &name);
+
 signals:
     void notifyClients(int notifType, SharedProtobufMessage notifData);
 
@@ -50,7 +66,25 @@ protected:
     void incomingConnection(int socketDescriptor);
 
 private:
+    friend class LocalRpcServer;
+
+    void addConnection(quintptr socketDescriptor, bool isLocal);
+
     ::google::protobuf::Service *service;
+
+    // Connections are spread over a fixed set of threads, each with an
+    // event loop shared by its connections, instead of a thread each
+    int ioThreadCount;
+    QList<QThread*> ioThreads;
+    int nextIoThread;
+
+    LocalRpcServer *localServer;
+
+    // Methods that may take long (or block) are served by the worker
+    // pool so that they don't hold up the other connections of the
+    // I/O thread
+    QThreadPool *workerPool;
+    QSet<int> workerMethods;
 };
 
 #endif
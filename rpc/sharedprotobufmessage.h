@@ -21,7 +21,9 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 #define _SHARED_PROTOBUF_MESSAGE_H
 
 #include <google/protobuf/message.h>
+#include <QByteArray>
 #include <QMutex>
+#include <QMutexLocker>
 
 // TODO: Use QSharedPointer instead once the minimum Qt version becomes >= 4.5
 
@@ -35,26 +37,11 @@ public:
         mutex_ = new QMutex();
         refCnt_ = new unsigned int;
         *refCnt_ = 1;
-        qDebug("sharedptr %p(constr) refcnt %p(%u)", this, refCnt_, *refCnt_);
     }
 
     ~SharedPointer()
     {
-        mutex_->lock();
-
-        (*refCnt_)--;
-        if (*refCnt_ == 0) {
-            delete ptr_;
-            delete refCnt_;
-
-            mutex_->unlock();
-            delete mutex_;
-            qDebug("sharedptr %p destroyed", this);
-            return;
-        }
-
-        qDebug("sharedptr %p(destr) refcnt %p(%u)", this, refCnt_, *refCnt_);
-        mutex_->unlock();
+        release();
     }
 
     SharedPointer(const SharedPointer<T> &other)
@@ -65,16 +52,60 @@ public:
 
         mutex_->lock();
         (*refCnt_)++;
-        qDebug("sharedptr %p(copy) refcnt %p(%u)", this, refCnt_,*refCnt_);
         mutex_->unlock();
     }
 
+    SharedPointer<T>& operator=(const SharedPointer<T> &other)
+    {
+        if (refCnt_ == other.refCnt_)
+            return *this;
+
+        other.mutex_->lock();
+        (*other.refCnt_)++;
+        other.mutex_->unlock();
+
+        release();
+
+        ptr_ = other.ptr_;
+        refCnt_ = other.refCnt_;
+        mutex_ = other.mutex_;
+
+        return *this;
+    }
+
     T* operator->() const
     {
         return ptr_;
     }
 
+    T& operator*() const
+    {
+        return *ptr_;
+    }
+
+    bool isNull() const
+    {
+        return ptr_ == 0;
+    }
+
 protected:
+    void release()
+    {
+        mutex_->lock();
+
+        (*refCnt_)--;
+        if (*refCnt_ == 0) {
+            delete ptr_;
+            delete refCnt_;
+
+            mutex_->unlock();
+            delete mutex_;
+            return;
+        }
+
+        mutex_->unlock();
+    }
+
     T *ptr_;
 
     // use uint+mutex to simulate a QAtomicInt
@@ -82,7 +113,53 @@ protected:
     QMutex *mutex_;
 };
 
-typedef class SharedPointer< ::google::protobuf::Message> SharedProtobufMessage;
+/*
+ * A message shared by many receivers (e.g. a notification sent on every
+ * RPC connection) - the message must not be modified once shared, so it
+ * is serialized only once, by the first receiver that needs the bytes
+ */
+class SharedProtobufMessage
+    : public SharedPointer< ::google::protobuf::Message>
+{
+public:
+    SharedProtobufMessage(::google::protobuf::Message *msg = 0)
+        : SharedPointer< ::google::protobuf::Message>(msg),
+          serialized_(new Serialized)
+    {
+    }
+
+    // Returns the serialized message; if serializedNow is given, it is
+    // set to true only for the (one) caller that did the serialization
+    QByteArray serialized(bool *serializedNow = 0) const
+    {
+        QMutexLocker locker(&serialized_->lock);
+        bool now = !serialized_->done && !isNull();
+
+        if (now) {
+            QByteArray &bytes = serialized_->bytes;
+
+            bytes.resize(ptr_->ByteSize());
+            ptr_->SerializeWithCachedSizesToArray((uchar*)bytes.data());
+            serialized_->done = true;
+        }
+        if (serializedNow)
+            *serializedNow = now;
+
+        // QByteArray is implicitly shared, so this doesn't copy the bytes
+        return serialized_->bytes;
+    }
+
+private:
+    struct Serialized {
+        Serialized() : done(false) {}
+
+        QMutex lock;
+        bool done;
+        QByteArray bytes;
+    };
+
+    SharedPointer<Serialized> serialized_;
+};
 
 #endif
 
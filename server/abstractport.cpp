@@ -22,18 +22,47 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 #include "abstractport.h"
 
 #include "../common/abstractprotocol.h"
+#include "../common/framegenerator.h"
+#include "../common/frametemplate.h"
+#include "../common/mac.h"
+#include "../common/protocollistiterator.h"
+#include "../common/sdtprobes.h"
 #include "../common/streambase.h"
 #include "devicemanager.h"
+#include "framesetstore.h"
 #include "packetbuffer.h"
-
+#include "pcapreplay.h"
+#include "timestamp.h"
+#include "tracebuffer.h"
+#include "../common/trace.h"
+
+#include <QCryptographicHash>
+#include <QFileInfo>
+#include <QPair>
+#include <QSet>
 #include <QString>
 #include <QIODevice>
+#include <QtConcurrentMap>
+#include <QtEndian>
 
 #include <inttypes.h>
 #include <limits.h>
 #include <math.h>
 
+QHash<QByteArray, AbstractPort::SharedFrames> AbstractPort::sharedFrameSets_;
+QMutex AbstractPort::sharedFrameSetsLock_;
+
+quint64 AbstractPort::portPacketListBudget_ = 0;
+quint64 AbstractPort::totalPacketListBudget_ = 0;
+quint64 AbstractPort::totalPacketListBytes_ = 0;
+QMutex AbstractPort::packetListBudgetLock_;
+bool AbstractPort::compactStreams_ = false;
+
+// See sequentialStreamOrder()
+static const int kStreamNotSent = -2;
+
 AbstractPort::AbstractPort(int id, const char *device)
+    : metrics_("build", device)
 {
     isUsable_ = true;
     data_.mutable_port_id()->set_id(id);
@@ -44,10 +73,21 @@ AbstractPort::AbstractPort(int id, const char *device)
 
     data_.set_is_exclusive_control(false);
 
+    // Backends add whatever else their NIC can do
+    data_.mutable_tx_offload_capability()->set_fcs(true);
+    data_.mutable_tx_offload()->set_fcs(true);
+
     isSendQueueDirty_ = false;
+    packetListBytes_ = 0;
+    isPacketListStreamed_ = false;
+    reservedPacketListBytes_ = 0;
+    isResolvingMacs_ = false;
     rateAccuracy_ = kHighAccuracy;
+    targetPacketRate_ = 0;
+    txStopTime_ = 0;
     linkState_ = OstProto::LinkStateUnknown;
     minPacketSetSize_ = 1;
+    loopCacheBytes_ = 0;
 
     deviceManager_ = new DeviceManager(this);
 
@@ -58,9 +98,21 @@ AbstractPort::AbstractPort(int id, const char *device)
 
 AbstractPort::~AbstractPort()
 {
+    packetListBudgetLock_.lock();
+    totalPacketListBytes_ -= reservedPacketListBytes_;
+    packetListBudgetLock_.unlock();
+
     delete deviceManager_;
 }    
 
+void AbstractPort::setPacketListBudget(quint64 portBytes, quint64 totalBytes)
+{
+    QMutexLocker locker(&packetListBudgetLock_);
+
+    portPacketListBudget_ = portBytes;
+    totalPacketListBudget_ = totalBytes;
+}
+
 void AbstractPort::init()
 {
 }    
@@ -79,21 +131,155 @@ bool AbstractPort::modify(const OstProto::Port &port)
             data_.set_is_exclusive_control(val);
     }
 
-    if (port.has_transmit_mode())
+    if (port.has_transmit_mode()
+            && (port.transmit_mode() != data_.transmit_mode())) {
         data_.set_transmit_mode(port.transmit_mode());
+        // Till the packet list is rebuilt for the new mode
+        data_.clear_transmit_estimate();
+        setDirty();
+    }
+
+    if (port.has_pcap_replay()) {
+        QFileInfo file(QString::fromStdString(
+                            port.pcap_replay().file_name()));
+
+        if (port.pcap_replay().file_name().empty()
+                || (file.exists() && file.isReadable())) {
+            data_.mutable_pcap_replay()->CopyFrom(port.pcap_replay());
+            setDirty();
+        }
+        else {
+            qWarning("port %d: replay file %s not found or not readable",
+                    id(), port.pcap_replay().file_name().c_str());
+            ret = false;
+        }
+    }
 
     if (port.has_user_name()) {
         data_.set_user_name(port.user_name());
     }
 
+    if (port.has_transmit_duration())
+        data_.set_transmit_duration(port.transmit_duration());
+
+    if (port.has_max_rate())
+        data_.set_max_rate(port.max_rate());
+
+    if (port.has_tx_thread_placement()
+            || port.has_rx_thread_placement()
+            || port.has_emulation_thread_placement()) {
+        if (port.has_tx_thread_placement())
+            data_.mutable_tx_thread_placement()->CopyFrom(
+                    port.tx_thread_placement());
+        if (port.has_rx_thread_placement())
+            data_.mutable_rx_thread_placement()->CopyFrom(
+                    port.rx_thread_placement());
+        if (port.has_emulation_thread_placement())
+            data_.mutable_emulation_thread_placement()->CopyFrom(
+                    port.emulation_thread_placement());
+        applyThreadPlacement();
+    }
+
+    if (port.has_tx_offload() && setTxOffload(port.tx_offload()))
+        setDirty();
+
+    if (port.has_reflect_probes()) {
+        if (setProbeReflection(port.reflect_probes()))
+            data_.set_reflect_probes(port.reflect_probes());
+        else {
+            qWarning("%s: probe reflection is not supported", name());
+            ret = false;
+        }
+    }
+
+    if (port.has_pcap_rx()) {
+        OstProto::PcapRx pcapRx = data_.pcap_rx();
+
+        pcapRx.MergeFrom(port.pcap_rx());
+        if (setPcapRx(pcapRx))
+            data_.mutable_pcap_rx()->CopyFrom(pcapRx);
+        else {
+            qWarning("%s: pcap rx config is invalid or not supported",
+                    name());
+            ret = false;
+        }
+    }
+
+    if (port.has_rx_stream_stats()) {
+        data_.set_rx_stream_stats(port.rx_stream_stats());
+        enableRxStreamStats(port.rx_stream_stats());
+    }
+
+    if (port.has_counter_filters()) {
+        QMutexLocker locker(&statsLock_);
+
+        if (setCounterFilters(port.counter_filters())) {
+            data_.mutable_counter_filters()->CopyFrom(port.counter_filters());
+            epochFilterCounts_.clear();
+        }
+        else
+            ret = false;
+    }
+
     return ret;
 }    
 
+/*!
+  Enables the requested tx offloads that the port supports (as in
+  OstProto::Port::tx_offload_capability)
+
+  Returns true if the offloads in use changed - frames already built need
+  to be rebuilt then
+*/
+bool AbstractPort::setTxOffload(const OstProto::TxOffload &offload)
+{
+    const OstProto::TxOffload &cap = data_.tx_offload_capability();
+    OstProto::TxOffload txOffload = data_.tx_offload();
+
+    txOffload.MergeFrom(offload);
+
+    if ((txOffload.ip_checksum() && !cap.ip_checksum())
+            || (txOffload.l4_checksum() && !cap.l4_checksum())
+            || (txOffload.tcp_segmentation() && !cap.tcp_segmentation())
+            || (txOffload.udp_segmentation() && !cap.udp_segmentation()))
+        qWarning("%s: some requested tx offloads are not supported",
+                name());
+
+    txOffload.set_fcs(cap.fcs());
+    txOffload.set_ip_checksum(txOffload.ip_checksum() && cap.ip_checksum());
+    txOffload.set_l4_checksum(txOffload.l4_checksum() && cap.l4_checksum());
+    txOffload.set_tcp_segmentation(txOffload.tcp_segmentation()
+            && cap.tcp_segmentation() && txOffload.l4_checksum());
+    txOffload.set_udp_segmentation(txOffload.udp_segmentation()
+            && cap.udp_segmentation() && txOffload.l4_checksum());
+    if (txOffload.segment_size() == 0)
+        txOffload.clear_segment_size();
+
+    if (txOffload.SerializeAsString() == data_.tx_offload().SerializeAsString())
+        return false;
+
+    data_.mutable_tx_offload()->CopyFrom(txOffload);
+    return true;
+}
+
 DeviceManager* AbstractPort::deviceManager()
 {
     return deviceManager_;
 }
 
+// Ports that can send a batch more efficiently than one at a time
+// override this; returns the count sent
+int AbstractPort::sendEmulationPackets(const QList<PacketBuffer*> &pktBufs)
+{
+    int count = 0;
+
+    foreach(PacketBuffer *pktBuf, pktBufs) {
+        if (sendEmulationPacket(pktBuf) >= 0)
+            count++;
+    }
+    return count;
+}
+
 StreamBase* AbstractPort::streamAtIndex(int index)
 {
     Q_ASSERT(index < streamList_.size());
@@ -102,41 +288,206 @@ StreamBase* AbstractPort::streamAtIndex(int index)
 
 StreamBase* AbstractPort::stream(int streamId)
 {
-    for (int i = 0; i < streamList_.size(); i++)
-    {
-        if ((uint)streamId == streamList_.at(i)->id())
-            return streamList_.at(i);
-    }
-
-    return NULL;
+    return streamIndex_.value(uint(streamId));
 }
 
 bool AbstractPort::addStream(StreamBase *stream)
 {
     streamList_.append(stream);
+    streamIndex_.insert(stream->id(), stream);
     isSendQueueDirty_ = true;
     return true;
 }
 
 bool AbstractPort::deleteStream(int streamId)
 {
+    StreamBase *stream = streamIndex_.take(uint(streamId));
+
+    if (!stream)
+        return false;
+
+    streamList_.removeOne(stream);
+    frameSetCache_.remove(stream->id());
+    delete stream;
+
+    isSendQueueDirty_ = true;
+    return true;
+}
+
+/*!
+  Deletes the streams of streamIds (those that exist) - returns the count
+  deleted
+*/
+int AbstractPort::deleteStreams(const QSet<uint> &streamIds)
+{
+    QList<StreamBase*> remaining;
+    int count = 0;
+
+    if (streamIds.isEmpty())
+        return 0;
+
+    remaining.reserve(streamList_.size());
     for (int i = 0; i < streamList_.size(); i++)
     {
-        StreamBase *stream;
+        StreamBase *stream = streamList_.at(i);
+
+        if (!streamIds.contains(stream->id())) {
+            remaining.append(stream);
+            continue;
+        }
+
+        streamIndex_.remove(stream->id());
+        frameSetCache_.remove(stream->id());
+        delete stream;
+        count++;
+    }
+    streamList_.swap(remaining);
+
+    if (count)
+        isSendQueueDirty_ = true;
+    return count;
+}
+
+/*!
+  Adds the chunk to the upload in progress of its frame set - the last
+  chunk completes the upload, which then replaces the port's set of that
+  id (an empty one deletes it); the streams that send the set are marked
+  dirty
+*/
+bool AbstractPort::addFrameSetChunk(const OstProto::FrameSetChunk &chunk,
+                                    QString &error)
+{
+    uint setId = chunk.frame_set_id();
+    QByteArray upload = frameSetUploads_.take(setId);
+    UploadedFrames frames;
+    int pos = 0;
+
+    if (chunk.offset() == 0)
+        upload.clear();
+    else if (chunk.offset() != quint64(upload.size())) {
+        error = QString("frame set %1: chunk at offset %2, expected %3")
+                    .arg(setId).arg(chunk.offset()).arg(upload.size());
+        goto _error;
+    }
+
+    if ((quint64(upload.size()) + chunk.data().size()) > kMaxFrameSetBytes)
+        goto _too_big;
+    upload.append(chunk.data().data(), int(chunk.data().size()));
+
+    if (!chunk.is_last()) {
+        frameSetUploads_.insert(setId, upload);
+        return true;
+    }
+
+    if (upload.isEmpty()) {
+        uploadedFrames_.remove(setId);
+        goto _done;
+    }
+
+    // The uncompressed size (qCompress() header) is checked before
+    // qUncompress() allocates that much
+    if (chunk.is_compressed()) {
+        if ((upload.size() < 4)
+                || (qFromBigEndian<quint32>((const uchar*) upload.constData())
+                        > kMaxFrameSetBytes))
+            goto _too_big;
+        upload = qUncompress(upload);
+        if (upload.isEmpty()) {
+            error = QString("frame set %1: bad compressed data").arg(setId);
+            goto _error;
+        }
+        if (quint64(upload.size()) > kMaxFrameSetBytes)
+            goto _too_big;
+    }
+
+    while (pos < upload.size())
+    {
+        const uchar *record = (const uchar*) upload.constData() + pos;
+        int len;
 
-        if ((uint)streamId == streamList_.at(i)->id())
+        if ((upload.size() - pos) < kFrameRecordHeaderSize)
+            goto _truncated;
+        len = qFromBigEndian<quint16>(record + 4);
+        if ((len == 0) || (len > kMaxPktSize))
         {
-            stream = streamList_.takeAt(i);
-            delete stream;
-            
-            isSendQueueDirty_ = true;
-            return true;
+            error = QString("frame set %1: frame %2 of length %3")
+                        .arg(setId).arg(frames.offset.size()).arg(len);
+            goto _error;
         }
+        if ((upload.size() - pos - kFrameRecordHeaderSize) < len)
+            goto _truncated;
+
+        frames.offset.append(frames.data.size());
+        frames.gapNsec.append(qFromBigEndian<quint32>(record));
+        frames.data.append((const char*) record + kFrameRecordHeaderSize,
+                           len);
+        pos += kFrameRecordHeaderSize + len;
+    }
+    frames.offset.append(frames.data.size());
+
+    // Rounded such that the gaps add up to the rate exactly
+    if (chunk.packets_per_sec() > 0) {
+        double ipg = 1e9/chunk.packets_per_sec();
+
+        for (int i = 0; i < frames.gapNsec.size(); i++)
+            frames.gapNsec[i] = quint64(floor((i+1)*ipg + 0.5))
+                                    - quint64(floor(i*ipg + 0.5));
+    }
+
+    uploadedFrames_.insert(setId, frames);
+
+_done:
+    for (int i = 0; i < streamList_.size(); i++)
+    {
+        if (streamList_.at(i)->hasFrameSet()
+                && (streamList_.at(i)->frameSetId() == setId))
+            setStreamDirty(streamList_.at(i)->id());
     }
+    return true;
+
+_too_big:
+    error = QString("frame set %1: more than %2 MB")
+                .arg(setId).arg(kMaxFrameSetBytes >> 20);
+    goto _error;
 
+_truncated:
+    error = QString("frame set %1: truncated after frame %2")
+                .arg(setId).arg(frames.offset.size());
+_error:
+    qWarning("port %d: %s", id(), qPrintable(error));
     return false;
 }
 
+/*
+ * Sorts the streams by ordinal - only if they are not in order already,
+ * which they mostly are (the ordinals change only when streams are added
+ * or reordered)
+ */
+void AbstractPort::sortStreams()
+{
+    for (int i = 1; i < streamList_.size(); i++)
+    {
+        if (StreamBase::StreamLessThan(streamList_.at(i),
+                                       streamList_.at(i-1))) {
+            qSort(streamList_.begin(), streamList_.end(),
+                    StreamBase::StreamLessThan);
+            return;
+        }
+    }
+}
+
+/*!
+  Marks the stream as modified - the frames built for it are rebuilt
+  with the packet list, unless only its rate was changed (isRateOnly)
+  in which case just the packet list is
+*/
+void AbstractPort::setStreamDirty(int streamId, bool isRateOnly)
+{
+    if (!isRateOnly)
+        frameSetCache_.remove(streamId);
+    isSendQueueDirty_ = true;
+}
+
 void AbstractPort::addNote(QString note)
 {
     QString notes = QString::fromStdString(data_.notes());
@@ -155,6 +506,17 @@ void AbstractPort::addNote(QString note)
     data_.set_notes(notes.toStdString());
 }
 
+void AbstractPort::removeNote(QString note)
+{
+    QString notes = QString::fromStdString(data_.notes());
+
+    notes.remove(QString("<li>%1</li>").arg(note));
+    if (!notes.contains("<li>"))
+        notes.clear();
+
+    data_.set_notes(notes.toStdString());
+}
+
 AbstractPort::Accuracy AbstractPort::rateAccuracy()
 {
     return rateAccuracy_;
@@ -166,8 +528,112 @@ bool AbstractPort::setRateAccuracy(Accuracy accuracy)
     return true;
 }
 
-void AbstractPort::updatePacketList()
+/*
+ * Appends a reference entry - 'repeats' copies of packet, 'gapNsec' apart,
+ * starting at sec/nsec. Ports that can replay a stored frame override this
+ * so that the frame is stored only once; the default just appends copies
+ */
+bool AbstractPort::appendRefToPacketList(long sec, long nsec,
+        const uchar *packet, int length, quint64 repeats, quint64 gapNsec)
+{
+    for (quint64 i = 0; i < repeats; i++)
+    {
+        if (!appendToPacketList(sec, nsec, packet, length))
+            return false;
+
+        nsec += gapNsec;
+        while (nsec >= long(1e9))
+        {
+            sec++;
+            nsec -= long(1e9);
+        }
+    }
+
+    return true;
+}
+
+/*!
+  Appends the frames of the generator to the packet list starting at
+  sec/nsec - the frames are generated on the fly; takes ownership of the
+  generator
+
+  The base class implementation generates all the frames upfront and
+  appends them individually (a generator that never runs out of frames is
+  cut short at 1s and the packet list looped); subclasses should override
+  this to generate the frames only when they are about to be sent
+*/
+bool AbstractPort::appendGeneratorToPacketList(long sec, long nsec,
+        FrameGenerator *generator)
+{
+    quint64 start = quint64(sec)*quint64(1e9) + nsec;
+    quint64 end = (generator->nsecDuration() == FrameGenerator::kUnbounded) ?
+                        quint64(1e9) : generator->nsecDuration();
+    quint64 last = 0;
+    bool ret = true;
+
+    generator->reset();
+    while (generator->hasNext())
+    {
+        quint64 offset;
+        int len = generator->nextFrame(pktBuf_, sizeof(pktBuf_), offset);
+        quint64 ts = start + offset;
+
+        if (offset > end)
+            break;
+        last = offset;
+
+        if (len <= 0)
+            continue;
+
+        if (!appendToPacketList(ts/quint64(1e9), ts%quint64(1e9),
+                    pktBuf_, len)) {
+            ret = false;
+            break;
+        }
+    }
+
+    if (ret && (generator->nsecDuration() == FrameGenerator::kUnbounded))
+        setPacketListLoopMode(true, 0, end - last);
+
+    delete generator;
+    return ret;
+}
+
+void AbstractPort::updatePacketList(bool isCancellable)
 {
+    TimeStamp start, end;
+
+    TraceBuffer::record(OstProto::TraceRecord::kPacketListBuild,
+                        id(), streamList_.size());
+    OST_PROBE2(packet_list_build_start, id(), streamList_.size());
+    getTimeStamp(&start);
+    buildProgress_.reset(isCancellable);
+    sortStreams();
+    streamBuildNsec_.fill(0, streamList_.size());
+
+    // Frames may be built by many threads - the layouts are computed
+    // before any of that
+    for (int i = 0; i < streamList_.size(); i++)
+        streamList_[i]->updateFrameCache();
+
+    resolveStreamMacs();
+
+    // The last build's memory (see fitPacketListBudget()) is replaced
+    packetListBudgetLock_.lock();
+    totalPacketListBytes_ -= reservedPacketListBytes_;
+    reservedPacketListBytes_ = 0;
+    packetListBudgetLock_.unlock();
+    if (!budgetNote_.isEmpty()) {
+        removeNote(budgetNote_);
+        budgetNote_.clear();
+    }
+    if (!buildNote_.isEmpty()) {
+        removeNote(buildNote_);
+        buildNote_.clear();
+    }
+
+    packetListBytes_ = 0;
+    isPacketListStreamed_ = false;
     switch(data_.transmit_mode())
     {
     case OstProto::kSequentialTransmit:
@@ -176,28 +642,833 @@ void AbstractPort::updatePacketList()
     case OstProto::kInterleavedTransmit:
         updatePacketListInterleaved();
         break;
+    case OstProto::kPcapReplayTransmit:
+        updatePacketListReplay();
+        break;
     default:
         Q_ASSERT(false); // Unreachable!!!
         break;
     }
-}
 
-void AbstractPort::updatePacketListSequential()
-{
-    long    sec = 0; 
-    long    nsec = 0;
+    // A cancelled build leaves an empty packet list (and the port dirty) -
+    // the memory reserved for it is released
+    if (isSendQueueDirty_) {
+        packetListBudgetLock_.lock();
+        totalPacketListBytes_ -= reservedPacketListBytes_;
+        reservedPacketListBytes_ = 0;
+        packetListBudgetLock_.unlock();
+    }
+
+    updateTransmitEstimate();
+    commitPacketList();
+
+    // The protocols are needed again only for the next build - unless
+    // frames are generated from them while transmitting (by this list or
+    // by the one still being sent)
+    if (compactStreams_ && !isPacketListStreamed_ && !isTransmitOn()) {
+        for (int i = 0; i < streamList_.size(); i++)
+            streamList_[i]->compact();
+    }
+
+    getTimeStamp(&end);
+    OST_PROBE2(packet_list_build_end, id(), ndiffTimeStamp(&start, &end));
+    metrics_.add(OstProto::DroneMetric::kPacketListBuilds);
+    metrics_.add(OstProto::DroneMetric::kPacketListBuildNsec,
+                 ndiffTimeStamp(&start, &end));
+    updateBuildNote(ndiffTimeStamp(&start, &end));
+}
+
+/*!
+  Stops the (cancellable) packet list build in progress - between streams
+  or chunks of frames; frames already built are kept for the next build
+*/
+void AbstractPort::cancelPacketListBuild()
+{
+    QMutexLocker locker(&buildProgress_.lock);
+
+    if (buildProgress_.isCancellable)
+        buildProgress_.isCancelled = true;
+}
+
+void AbstractPort::packetListBuildProgress(int *streamsDone,
+        quint64 *framesBuilt, quint64 *bytes)
+{
+    QMutexLocker locker(&buildProgress_.lock);
+
+    *streamsDone = buildProgress_.streamsDone;
+    *framesBuilt = buildProgress_.framesBuilt;
+    *bytes = buildProgress_.bytes;
+}
+
+/*
+ * Adds a port note of the build time and the slowest streams if the build
+ * was slow (or cancelled) - so that the user can see which streams are
+ * expensive to build
+ */
+void AbstractPort::updateBuildNote(quint64 buildNsec)
+{
+    QList<QPair<quint64, int> > slowest;
+    QStringList streams;
+
+    if (isSendQueueDirty_) {
+        buildNote_ = QString("Packet list build cancelled after %1 s")
+                        .arg(buildNsec/1e9, 0, 'f', 2);
+        addNote(buildNote_);
+        return;
+    }
+
+    if (buildNsec < kBuildNoteMinNsec)
+        return;
+
+    for (int i = 0; i < streamBuildNsec_.size(); i++) {
+        if (streamBuildNsec_.at(i))
+            slowest.append(qMakePair(streamBuildNsec_.at(i), i));
+    }
+    qSort(slowest.begin(), slowest.end(), qGreater<QPair<quint64, int> >());
+
+    for (int i = 0; (i < slowest.size()) && (i < kBuildNoteStreams); i++) {
+        StreamBase *stream = streamList_.at(slowest.at(i).second);
+        QString name = stream->name();
+
+        if (name.isEmpty())
+            name = QString("stream id %1").arg(stream->id());
+        name.replace('&', "&amp;").replace('<', "&lt;").replace('>', "&gt;");
+        streams.append(QString("%1 %2 s").arg(name)
+                        .arg(slowest.at(i).first/1e9, 0, 'f', 2));
+    }
+
+    buildNote_ = QString("Packet list built in %1 s")
+                    .arg(buildNsec/1e9, 0, 'f', 2);
+    if (!streams.isEmpty())
+        buildNote_.append(QString(" - slowest stream(s): %1")
+                            .arg(streams.join(", ")));
+    addNote(buildNote_);
+}
+
+/*!
+  Computes the offered load and duration of the (just built) packet list
+  from the streams - so that clients can show these without deriving them
+
+  Streams are in ordinal order (as sorted by the build)
+*/
+void AbstractPort::updateTransmitEstimate()
+{
+    OstProto::TransmitEstimate *estimate;
+    bool isSequential = (data_.transmit_mode()
+                            == OstProto::kSequentialTransmit);
+    bool isEndless = false;
+    double pps = 0, bps = 0;
+    double secs = 0;
+    double endlessPps = 0, endlessBps = 0;
+    quint64 packets = 0;
+    QVector<int> next;
+
+    // The frames sent are those of the capture file - not estimated
+    if (data_.transmit_mode() == OstProto::kPcapReplayTransmit) {
+        data_.clear_transmit_estimate();
+        return;
+    }
+
+    // Sequential transmit is endless if its streams go round in a loop
+    // i.e. none of them is the last one sent
+    if (isSequential) {
+        next = sequentialStreamOrder();
+        isEndless = (next.count(kStreamNotSent) < next.size())
+                        && !next.contains(-1);
+    }
+
+    for (int i = 0; i < streamList_.size(); i++)
+    {
+        const StreamBase *stream = streamList_.at(i);
+        double rate = stream->averagePacketRate();
+        double frameBits = (stream->frameLenAvg() + kEthOverhead) * 8;
+        quint64 count;
+
+        // Uploaded frames are sent with their own gaps (sequential only)
+        if (stream->hasFrameSet()) {
+            const UploadedFrames frames = uploadedFrames_.value(
+                                            stream->frameSetId());
+            quint64 nsecs = 0;
+
+            for (int j = 0; j < frames.gapNsec.size(); j++)
+                nsecs += frames.gapNsec.at(j);
+            rate = (isSequential && nsecs) ?
+                        frames.gapNsec.size() * 1e9 / nsecs : 0;
+            if (!frames.gapNsec.isEmpty())
+                frameBits = (double(frames.data.size())
+                                / frames.gapNsec.size() + kEthOverhead) * 8;
+        }
+
+        if (!stream->isEnabled() || (rate <= 0))
+            continue;
+        if (isSequential && (next.at(i) == kStreamNotSent))
+            continue;
+
+        if (stream->sendMode() == StreamBase::e_sm_continuous) {
+            isEndless = true;
+            endlessPps += rate;
+            endlessBps += rate * frameBits;
+            // Nothing after a continuous stream is ever sent
+            if (isSequential)
+                break;
+            continue;
+        }
+
+        if (stream->hasFrameSet())
+            count = uploadedFrames_.value(stream->frameSetId())
+                                            .gapNsec.size();
+        else
+            count = (stream->sendUnit() == StreamBase::e_su_bursts) ?
+                        quint64(stream->numBursts()) * stream->burstSize() :
+                        stream->numPackets();
+        packets += count;
+
+        if (isSequential) {
+            // One after the other - the load is averaged over the streams
+            secs += count / rate;
+            bps += count * frameBits;
+        }
+        else {
+            // All together - the load is the sum of the streams
+            pps += rate;
+            bps += rate * frameBits;
+            secs = qMax(secs, count / rate);
+        }
+    }
+
+    if (isSequential) {
+        if (endlessPps > 0) {
+            // A continuous stream is sent for ever once it is reached
+            pps = endlessPps;
+            bps = endlessBps;
+        }
+        else if (secs > 0) {
+            pps = packets / secs;
+            bps = bps / secs;
+        }
+        else
+            bps = 0;
+    }
+    else {
+        pps += endlessPps;
+        bps += endlessBps;
+    }
+
+    estimate = data_.mutable_transmit_estimate();
+    estimate->Clear();
+    estimate->set_packets_per_sec(pps);
+    estimate->set_bits_per_sec(bps);
+    if (!isEndless) {
+        estimate->set_duration_nsec(quint64(secs * 1e9));
+        estimate->set_packet_count(packets);
+    }
+    estimate->set_packet_list_bytes(packetListBytes_);
+}
+
+/*
+ * We derive n, x, y such that
+ * n * x + y = total number of packets to be sent
+ * where x is the size of the packet set that is repeated n times
+ */
+void AbstractPort::packetSetSize(const StreamBase *stream,
+        ulong frameVariableCount, ulong &n, ulong &x, ulong &y)
+{
+    ulong burstSize;
+
+    switch (stream->sendUnit())
+    {
+    case OstProto::StreamControl::e_su_bursts:
+        burstSize = stream->burstSize();
+        x = AbstractProtocol::lcm(frameVariableCount, burstSize);
+        n = ulong(burstSize * stream->numBursts()) / x;
+        y = ulong(burstSize * stream->numBursts()) % x;
+        break;
+    case OstProto::StreamControl::e_su_packets:
+        x = frameVariableCount;
+        n = 2;
+        while (x < minPacketSetSize_) 
+            x = frameVariableCount*n++;
+
+        // Loop over as many frames as fit in the transmit cpu's cache -
+        // fewer passes over the set, but each frame is still a cache hit
+        // when the set comes around again; a set bigger than the cache
+        // is kept as small as possible
+        if (loopCacheBytes_) {
+            quint64 setBytes = quint64(frameVariableCount)
+                        * (stream->frameLenAvg() + kPacketEntryOverhead);
+            ulong fit = ulong(loopCacheBytes_/setBytes);
+            ulong maxSets = frameVariableCount <= stream->numPackets() ?
+                        stream->numPackets()/frameVariableCount : 1;
+
+            if (stream->sendMode() == StreamBase::e_sm_continuous)
+                maxSets = fit;
+            x = frameVariableCount * qMax(ulong(1), qMin(fit, maxSets));
+        }
+
+        // The set has a gap per frame - see StreamBase::gapTable()
+        if (stream->hasGapTable()) {
+            ulong sets = (StreamBase::kMinGapTableSize + frameVariableCount - 1)
+                            / frameVariableCount;
+
+            if (stream->sendMode() != StreamBase::e_sm_continuous)
+                sets = qMax(ulong(1), qMin(sets,
+                            ulong(stream->numPackets()/frameVariableCount)));
+            x = qMax(x, frameVariableCount * sets);
+        }
+
+        n = stream->numPackets() / x;
+        y = stream->numPackets() % x;
+        break;
+    default:
+        n = x = y = 0;
+        break;
+    }
+
+    // A continuous stream is a single packet set repeated till stopped
+    if (stream->sendMode() == StreamBase::e_sm_continuous)
+    {
+        n = (x > 0) ? 1 : 0;
+        y = 0;
+    }
+
+    if (n == 0)
+        x = 0;
+}
+
+// Runs on a worker thread - must not touch any port state other than
+// (the thread safe) frameSet.progress
+void AbstractPort::buildFrameSet(FrameSet &frameSet)
+{
+    uchar buf[kMaxPktSize];
+    int len = 0;
+    int chunkLen = 0;
+    TimeStamp start, end;
+
+    frameSet.buildNsec = 0;
+    if (frameSet.isBuilt) {
+        frameSet.progress->update(1, 0, 0);
+        return;
+    }
+    if (!frameSet.progress->update(0, 0, 0))
+        return; // cancelled
+
+    getTimeStamp(&start);
+
+    // Not worth compiling a template for just one frame
+    FrameTemplate *frameTemplate = (frameSet.count > 1) ?
+                        new FrameTemplate(frameSet.stream) : NULL;
+
+    frameSet.offset.resize(frameSet.count + 1);
+    for (int j = 0; j < frameSet.count; j++)
+    {
+        frameSet.offset[j] = len;
+        int pktLen = frameTemplate ?
+                frameTemplate->frameValue(buf, sizeof(buf), j) :
+                frameSet.stream->frameValue(buf, sizeof(buf), j);
+        if (pktLen > 0)
+        {
+            frameSet.data.append((const char*) buf, pktLen);
+            len += pktLen;
+        }
+
+        if (((j + 1) % kBuildChunkFrames) == 0) {
+            if (!frameSet.progress->update(0, kBuildChunkFrames,
+                                           len - chunkLen))
+                goto _cancelled;
+            chunkLen = len;
+        }
+    }
+    frameSet.offset[frameSet.count] = len;
+    frameSet.isBuilt = true;
+    frameSet.progress->update(1, frameSet.count % kBuildChunkFrames,
+                              len - chunkLen);
+
+    delete frameTemplate;
+    getTimeStamp(&end);
+    frameSet.buildNsec = ndiffTimeStamp(&start, &end);
+    return;
+
+_cancelled:
+    // The partial set is dropped - built afresh by the next build
+    delete frameTemplate;
+    frameSet.data.clear();
+    frameSet.offset.clear();
+}
+
+/*
+ * Returns the key of the frame set's frames in sharedFrameSets_ - a hash of
+ * the stream config without the fields that don't change the frames (the
+ * frame count is part of the key instead); empty if the frames are this
+ * port's own i.e. have MACs resolved via this port's devices
+ */
+QByteArray AbstractPort::sharedFrameSetKey(const FrameSet &frameSet)
+{
+    const StreamBase *stream = frameSet.stream;
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    OstProto::Stream config;
+    std::string buf;
+    quint64 extra[4];
+
+    if (deviceManager_->deviceCount()
+            && (resolvedMacs_.contains(stream->id())
+                || (stream->frameVariableCount() > kMaxResolvedMacFrames)))
+        return QByteArray();
+
+    stream->protoDataCopyInto(config);
+    config.mutable_stream_id()->set_id(0);
+    config.mutable_core()->clear_name();
+    config.mutable_core()->clear_ordinal();
+    config.mutable_core()->clear_is_enabled();
+    config.clear_control();
+    config.SerializePartialToString(&buf);
+    hash.addData(buf.data(), buf.size());
+
+    // Random frames are as per the seed - an unseeded stream's is its own
+    // so identical such streams have different frames; a tracked stream's
+    // signature has its id and port
+    extra[0] = (stream->hasRandomSeed() || stream->isFrameValueRandom()) ?
+                    stream->randomSeed() : 0;
+    extra[1] = stream->isTracked() ?
+                    ((quint64(id()) << 32) | stream->id()) : 0;
+    extra[2] = frameSet.count;
+    extra[3] = frameSet.txOffload.cksumOffload;
+    hash.addData((const char*) extra, sizeof(extra));
+
+    return hash.result();
+}
+
+/*
+ * Uses the frames of an identical stream (of any port) if already built -
+ * by this drone or, if in the FrameSetStore, by an earlier one
+ */
+void AbstractPort::findSharedFrameSet(FrameSet &frameSet)
+{
+    QHash<QByteArray, SharedFrames>::const_iterator shared;
+
+    frameSet.sharedKey = sharedFrameSetKey(frameSet);
+    if (frameSet.sharedKey.isEmpty())
+        return;
+
+    QMutexLocker locker(&sharedFrameSetsLock_);
+
+    shared = sharedFrameSets_.constFind(frameSet.sharedKey);
+    if (shared == sharedFrameSets_.constEnd()) {
+        locker.unlock();
+        if (FrameSetStore::isEnabled()
+                && FrameSetStore::load(frameSet.sharedKey,
+                        &frameSet.data, &frameSet.offset)
+                && (frameSet.offset.size() == frameSet.count + 1)) {
+            frameSet.isBuilt = true;
+            frameSet.isStored = true;
+            qDebug("%s: stream %u frames mapped from store", __FUNCTION__,
+                    frameSet.stream->id());
+        }
+        else {
+            frameSet.data.clear();
+            frameSet.offset.clear();
+        }
+        return;
+    }
+
+    frameSet.data = shared.value().data;
+    frameSet.offset = shared.value().offset;
+    frameSet.isBuilt = true;
+    qDebug("%s: stream %u frames shared", __FUNCTION__,
+            frameSet.stream->id());
+}
+
+/*
+ * Adds the frames just built to sharedFrameSets_ (and to the
+ * FrameSetStore) and drops the shared sets not in use (by a frame set
+ * cache or packet list) any more
+ */
+void AbstractPort::publishSharedFrameSets(const QList<FrameSet> &frameSets)
+{
+    QMutexLocker locker(&sharedFrameSetsLock_);
+    QHash<QByteArray, SharedFrames>::iterator i;
+    QList<int> toStore;
+
+    for (int j = 0; j < frameSets.size(); j++) {
+        const FrameSet &frameSet = frameSets.at(j);
+
+        if (frameSet.sharedKey.isEmpty() || !frameSet.isBuilt
+                || frameSet.isStreamed
+                || sharedFrameSets_.contains(frameSet.sharedKey))
+            continue;
+
+        SharedFrames &shared = sharedFrameSets_[frameSet.sharedKey];
+        shared.data = frameSet.data;
+        shared.offset = frameSet.offset;
+        if (!frameSet.isStored)
+            toStore.append(j);
+    }
+
+    i = sharedFrameSets_.begin();
+    while (i != sharedFrameSets_.end()) {
+        if (i.value().data.isDetached())
+            i = sharedFrameSets_.erase(i);
+        else
+            i++;
+    }
+
+    // Files are written without holding up the other ports' builds
+    locker.unlock();
+    if (FrameSetStore::isEnabled()) {
+        foreach(int j, toStore) {
+            const FrameSet &frameSet = frameSets.at(j);
+            FrameSetStore::save(frameSet.sharedKey, frameSet.data,
+                                frameSet.offset);
+        }
+    }
+}
+
+/*
+ * Checks the projected memory of the packet list against the budget (see
+ * setPacketListBudget()) before anything is built - if over, the largest
+ * frame sets are generated while transmitting instead, if the port can;
+ * returns false if the packet list still doesn't fit, in which case it
+ * is not built (and so is empty)
+ *
+ * A port note says if either happened
+ */
+bool AbstractPort::fitPacketListBudget(QList<FrameSet> &frameSets)
+{
+    quint64 projected = 0;
+    quint64 budget = portPacketListBudget_ ?
+                        portPacketListBudget_ : ~quint64(0);
+    int streamed = 0;
+    bool fits;
+
+    for (int i = 0; i < frameSets.size(); i++)
+        projected += frameSets.at(i).bytes;
+
+    packetListBudgetLock_.lock();
+
+    if (totalPacketListBudget_) {
+        quint64 available = (totalPacketListBudget_ > totalPacketListBytes_) ?
+                        totalPacketListBudget_ - totalPacketListBytes_ : 0;
+        budget = qMin(budget, available);
+    }
+
+    while ((projected > budget) && hasNativeFrameGenerators()) {
+        int largest = -1;
+
+        // Uploaded frames can't be generated
+        for (int i = 0; i < frameSets.size(); i++) {
+            if (frameSets.at(i).bytes && !frameSets.at(i).isUploaded
+                    && ((largest < 0)
+                    || (frameSets.at(i).bytes > frameSets.at(largest).bytes)))
+                largest = i;
+        }
+        if (largest < 0)
+            break;
+
+        FrameSet &frameSet = frameSets[largest];
+        projected -= frameSet.bytes;
+        frameSet.bytes = 0;
+        frameSet.count = 0;
+        frameSet.data.clear();
+        frameSet.offset.clear();
+        frameSet.sharedKey.clear();
+        frameSet.isStreamed = true;
+        frameSet.isReplayed = false;
+        frameSet.isBuilt = true;
+        streamed++;
+    }
+
+    fits = (projected <= budget);
+    if (fits) {
+        reservedPacketListBytes_ = projected;
+        totalPacketListBytes_ += projected;
+    }
+
+    packetListBudgetLock_.unlock();
+
+    qDebug("%s: projected %llu bytes, budget %llu bytes, %d streamed",
+            __FUNCTION__, projected, budget, streamed);
+
+    if (!fits)
+        budgetNote_ = QString("Packet list (%1 MB) exceeds the packet list "
+                              "memory budget (%2 MB) - not built")
+                        .arg(projected >> 20).arg(budget >> 20);
+    else if (streamed)
+        budgetNote_ = QString("%1 stream(s) generated while transmitting to "
+                              "fit the packet list memory budget (%2 MB)")
+                        .arg(streamed).arg(budget >> 20);
+    if (!budgetNote_.isEmpty())
+        addNote(budgetNote_);
+
+    return fits;
+}
+
+/*!
+  Finds the offloads that can be used for the stream's frames and sets up
+  the stream to leave the offloaded checksums to the NIC
+
+  Only plain L2 + IPv4/IPv6 [+ TCP/UDP] frames are offloaded - the NIC is
+  told where the headers are and doesn't need to parse the frame. A
+  checksum overridden by the user is not offloaded
+*/
+void AbstractPort::streamTxOffload(StreamBase *stream, TxOffloadInfo &info)
+{
+    const OstProto::TxOffload &offload = data_.tx_offload();
+    ProtocolListIterator *iter;
+    AbstractProtocol *l3 = NULL;
+    AbstractProtocol *l4 = NULL;
+    int len = 0;
+
+    memset(&info, 0, sizeof(info));
+    stream->setCksumOffload(0);
+
+    if (!offload.ip_checksum() && !offload.l4_checksum())
+        return;
+
+    iter = stream->createProtocolListIterator();
+    while (iter->hasNext())
+    {
+        AbstractProtocol *proto = iter->next();
+
+        switch (proto->protocolNumber())
+        {
+            case OstProto::Protocol::kMacFieldNumber:
+            case OstProto::Protocol::kEth2FieldNumber:
+            case OstProto::Protocol::kDot3FieldNumber:
+            case OstProto::Protocol::kLlcFieldNumber:
+            case OstProto::Protocol::kSnapFieldNumber:
+            case OstProto::Protocol::kSvlanFieldNumber:
+            case OstProto::Protocol::kVlanFieldNumber:
+            case OstProto::Protocol::kDot2LlcFieldNumber:
+            case OstProto::Protocol::kDot2SnapFieldNumber:
+            case OstProto::Protocol::kVlanStackFieldNumber:
+                if (l3)
+                    goto _done;
+                len += proto->protocolFrameSize(0);
+                break;
+
+            case OstProto::Protocol::kIp4FieldNumber:
+            case OstProto::Protocol::kIp6FieldNumber:
+                if (l3)
+                    goto _done;
+                l3 = proto;
+                break;
+
+            case OstProto::Protocol::kTcpFieldNumber:
+            case OstProto::Protocol::kUdpFieldNumber:
+                if (l3 && !l4)
+                    l4 = proto;
+                goto _done;
+
+            default:
+                goto _done;
+        }
+    }
+_done:
+    delete iter;
+
+    if (!l3)
+        return;
+
+    info.isIp6 = (l3->protocolNumber() == OstProto::Protocol::kIp6FieldNumber);
+    info.l2Len = len;
+    info.l3Len = l3->protocolFrameSize(0);
+
+    if (offload.ip_checksum() && !info.isIp6) {
+        QByteArray fv = l3->protocolFrameValue(0);
+
+        if ((fv.size() >= 20) && (qFromBigEndian<quint16>(
+                (const uchar*) fv.constData() + 10)
+                    == quint16(l3->protocolFrameCksum(0,
+                                    AbstractProtocol::CksumIp))))
+            info.cksumOffload |= StreamBase::kIpCksumOffload;
+    }
+
+    if (offload.l4_checksum() && l4) {
+        QByteArray fv = l4->protocolFrameValue(0);
+        quint16 cksum = l4->protocolFrameCksum(0, AbstractProtocol::CksumTcpUdp);
+        int cksumOffset;
+
+        info.isUdp = (l4->protocolNumber() == OstProto::Protocol::kUdpFieldNumber);
+        info.l4Len = l4->protocolFrameSize(0);
+        cksumOffset = info.isUdp ? 6 : 16;
+        if (info.isUdp && (cksum == 0))
+            cksum = 0xFFFF;
+
+        if ((fv.size() >= (cksumOffset + 2)) && (qFromBigEndian<quint16>(
+                (const uchar*) fv.constData() + cksumOffset) == cksum)) {
+            info.cksumOffload |= StreamBase::kL4CksumOffload;
+            if (info.isUdp ? offload.udp_segmentation()
+                                : offload.tcp_segmentation())
+                info.segmentSize = offload.segment_size();
+        }
+    }
+
+    stream->setCksumOffload(info.cksumOffload);
+}
+
+void AbstractPort::updatePacketListSequential()
+{
+    long    sec = 0; 
+    long    nsec = 0;
+    QList<FrameSet> frameSets;
+    double  streamRate = -1;
+    bool    isRateUniform = true;
+
+    qDebug("In %s", __FUNCTION__);
+
+    // The streams are in ordinal order - see updatePacketList()
+    clearPacketList();
+
+    // Building frames is the expensive part - build each stream's frames in
+    // parallel (unless we have them already from a previous build) and then
+    // add them to the packet list in ordinal order
+    for (int i = 0; i < streamList_.size(); i++)
+    {
+        FrameSet frameSet;
+
+        frameSet.stream = streamList_[i];
+        frameSet.count = 0;
+        frameSet.isBuilt = false;
+        frameSet.isStreamed = false;
+        frameSet.isReplayed = false;
+        frameSet.isStored = false;
+        frameSet.isUploaded = false;
+        frameSet.bytes = 0;
+        frameSet.progress = &buildProgress_;
+        frameSet.buildNsec = 0;
+        memset(&frameSet.txOffload, 0, sizeof(frameSet.txOffload));
+        if (streamList_[i]->isEnabled() && streamList_[i]->hasFrameSet())
+        {
+            // Frames as uploaded - nothing to build (or offload)
+            UploadedFrames frames = uploadedFrames_.value(
+                                        streamList_[i]->frameSetId());
+
+            frameSet.isUploaded = true;
+            frameSet.isBuilt = true;
+            frameSet.count = frames.gapNsec.size();
+            frameSet.data = frames.data;
+            frameSet.offset = frames.offset;
+            frameSet.gapNsec = frames.gapNsec;
+            frameSet.bytes = frames.data.size()
+                        + quint64(frameSet.count) * kPacketEntryOverhead;
+        }
+        else if (streamList_[i]->isEnabled())
+        {
+            ulong n, x, y;
+            ulong frameVariableCount = streamList_[i]->frameVariableCount();
+            quint64 frameLenAvg = streamList_[i]->frameLenAvg();
+            quint64 count;
+
+            packetSetSize(streamList_[i], frameVariableCount, n, x, y);
+
+            // Must be done before the frames are built
+            streamTxOffload(streamList_[i], frameSet.txOffload);
+
+            // The n*x + y frames are sent as n repeats of x frames followed
+            // by y frames - x may be many times the distinct frames (e.g.
+            // lcm(frameVariableCount, burstSize)) and y is upto x; build
+            // just the distinct frames in that case and replay them
+            count = (frameVariableCount > 1) ? (x+y) : 1;
+            if (hasNativeFrameGenerators()
+                    && (count > kMaxReplayExpansion*frameVariableCount)
+                    && ((count * frameLenAvg) > kMinReplayBytes))
+            {
+                frameSet.isReplayed = true;
+                count = frameVariableCount;
+            }
+
+            // Too many frames to build in advance - these will be
+            // generated while transmitting instead
+            if ((frameVariableCount > 1)
+                    && ((count * frameLenAvg) > kMaxFrameSetBytes))
+            {
+                frameSet.isStreamed = true;
+                frameSet.isReplayed = false;
+                frameSet.isBuilt = true;
+                frameSets.append(frameSet);
+                continue;
+            }
+
+            frameSet.count = count;
+
+            // A replayed set's frames are the packet list; otherwise each
+            // of the x+y frames has an entry (and a copy) in the list
+            frameSet.bytes = count * frameLenAvg;
+            if (!frameSet.isReplayed)
+                frameSet.bytes += quint64(x + y)
+                                    * (frameLenAvg + kPacketEntryOverhead);
+
+            QHash<uint, FrameSet>::const_iterator cached =
+                    frameSetCache_.constFind(streamList_[i]->id());
+            if ((cached != frameSetCache_.constEnd())
+                    && (cached.value().count == frameSet.count))
+                frameSet = cached.value();
+            else
+                findSharedFrameSet(frameSet);
+        }
+        frameSets.append(frameSet);
+    }
+
+    if (!fitPacketListBudget(frameSets)) {
+        targetPacketRate_ = 0;
+        isSendQueueDirty_ = false;
+        return;
+    }
+    QtConcurrent::blockingMap(frameSets, buildFrameSet);
+    OST_PROBE2(packet_list_frames_built, id(), frameSets.size());
 
-    qDebug("In %s", __FUNCTION__);
+    // Sets built before a cancel are kept for the next build
+    frameSetCache_.clear();
+    for (int i = 0; i < frameSets.size(); i++)
+    {
+        if (frameSets.at(i).isBuilt && !frameSets.at(i).isStreamed
+                && !frameSets.at(i).isUploaded)
+            frameSetCache_.insert(frameSets.at(i).stream->id(), frameSets.at(i));
+        streamBuildNsec_[i] = frameSets.at(i).buildNsec;
+    }
+    publishSharedFrameSets(frameSets);
 
-    // First sort the streams by ordinalValue
-    qSort(streamList_.begin(), streamList_.end(), StreamBase::StreamLessThan);
+    if (!buildProgress_.update(0, 0, 0)) {
+        targetPacketRate_ = 0;
+        return; // cancelled - the port stays dirty
+    }
 
-    clearPacketList();
+    // The streams sent are added in ordinal order - with a jump after a
+    // stream that isn't followed by the one next in the list
+    QVector<int> next = sequentialStreamOrder();
+    QVector<int> following(streamList_.size(), -1); // next in the list
+    QVector<bool> isJumpTarget(streamList_.size(), false);
+    int first = -1;
+    int last = -1; // stream added last
+    TimeStamp lastStart, now;
+    quint64 lastBytes = 0;
+
+    for (int i = streamList_.size() - 1; i >= 0; i--) {
+        following[i] = first;
+        if (next.at(i) != kStreamNotSent)
+            first = i;
+    }
+    for (int i = 0; i < streamList_.size(); i++) {
+        // Back from the last one to the first is a loop, not a jump
+        if ((next.at(i) >= 0) && (next.at(i) != following.at(i))
+                && ((following.at(i) >= 0) || (next.at(i) != first)))
+            isJumpTarget[next.at(i)] = true;
+    }
 
     for (int i = 0; i < streamList_.size(); i++)
     {
-        if (streamList_[i]->isEnabled())
+        getTimeStamp(&now);
+        if (last >= 0)
+            streamBuildNsec_[last] += ndiffTimeStamp(&lastStart, &now);
+        if (!buildProgress_.update(0, 0, packetListBytes_ - lastBytes))
+            goto _cancelled;
+        last = i;
+        lastStart = now;
+        lastBytes = packetListBytes_;
+
+        if (next.at(i) != kStreamNotSent)
         {
+            const FrameSet &frameSet = frameSets.at(i);
+            const uchar *pkt = NULL;
             int len = 0;
             ulong n, x, y;
             ulong burstSize;
@@ -208,19 +1479,25 @@ void AbstractPort::updatePacketListSequential()
             quint64 ipg1 = 0, ipg2 = 0;
             quint64 npx1 = 0, npx2 = 0;
             quint64 npy1 = 0, npy2 = 0;
+            QVector<quint64> gaps; // if the stream has a gap table
             quint64 loopDelay;
             ulong frameVariableCount = streamList_[i]->frameVariableCount();
+            bool isContinuous = (streamList_[i]->sendMode()
+                                    == StreamBase::e_sm_continuous);
 
-            // We derive n, x, y such that
-            // n * x + y = total number of packets to be sent
+            packetSetSize(streamList_[i], frameVariableCount, n, x, y);
+
+            // We have a target rate only if all streams are at the same rate
+            if (streamRate < 0)
+                streamRate = streamList_[i]->averagePacketRate();
+            else if (qAbs(streamList_[i]->averagePacketRate() - streamRate)
+                        > (streamRate * 0.001))
+                isRateUniform = false;
 
             switch (streamList_[i]->sendUnit())
             {
             case OstProto::StreamControl::e_su_bursts:
                 burstSize = streamList_[i]->burstSize();
-                x = AbstractProtocol::lcm(frameVariableCount, burstSize);
-                n = ulong(burstSize * streamList_[i]->numBursts()) / x;
-                y = ulong(burstSize * streamList_[i]->numBursts()) % x;
                 if (streamList_[i]->burstRate() > 0)
                 {
                     ibg = 1e9/double(streamList_[i]->burstRate());
@@ -232,12 +1509,6 @@ void AbstractPort::updatePacketListSequential()
                 loopDelay = ibg2;
                 break;
             case OstProto::StreamControl::e_su_packets:
-                x = frameVariableCount;
-                n = 2;
-                while (x < minPacketSetSize_) 
-                    x = frameVariableCount*n++;
-                n = streamList_[i]->numPackets() / x;
-                y = streamList_[i]->numPackets() % x;
                 burstSize = x + y;
                 if (streamList_[i]->packetRate() > 0)
                 {
@@ -250,6 +1521,11 @@ void AbstractPort::updatePacketListSequential()
                     npy2  = y - npy1;
                 }
                 loopDelay = ipg2;
+                // The y frames after the n sets use the first y gaps
+                if (streamList_[i]->hasGapTable() && (x > 0)) {
+                    gaps = streamList_[i]->gapTable(int(x));
+                    loopDelay = gaps.last();
+                }
                 break;
             default:
                 qWarning("Unhandled stream control unit %d",
@@ -257,44 +1533,128 @@ void AbstractPort::updatePacketListSequential()
                 continue;
             }
 
-            qDebug("\nframeVariableCount = %lu", frameVariableCount);
-            qDebug("n = %lu, x = %lu, y = %lu, burstSize = %lu",
+            // Uploaded frames are sent once (or looped if continuous) as
+            // a single set with a gap table of their own
+            if (frameSet.isUploaded)
+            {
+                frameVariableCount = frameSet.count;
+                n = (frameSet.count > 0) ? 1 : 0;
+                x = frameSet.count;
+                y = 0;
+                burstSize = x;
+                gaps = frameSet.gapNsec;
+                loopDelay = gaps.isEmpty() ? 0 : gaps.last();
+                ibg1 = ibg2 = ipg1 = ipg2 = loopDelay;
+                nb1 = npx1 = npy1 = 0;
+                isRateUniform = false; // not at the stream's rate
+            }
+
+            qTrace("\nframeVariableCount = %lu", frameVariableCount);
+            qTrace("n = %lu, x = %lu, y = %lu, burstSize = %lu",
                     n, x, y, burstSize);
 
-            qDebug("ibg  = %g", ibg);
-            qDebug("ibg1 = %" PRIu64, ibg1);
-            qDebug("nb1  = %" PRIu64, nb1);
-            qDebug("ibg2 = %" PRIu64, ibg2);
-            qDebug("nb2  = %" PRIu64 "\n", nb2);
-
-            qDebug("ipg  = %g", ipg);
-            qDebug("ipg1 = %" PRIu64, ipg1);
-            qDebug("npx1 = %" PRIu64, npx1);
-            qDebug("npy1 = %" PRIu64, npy1);
-            qDebug("ipg2 = %" PRIu64, ipg2);
-            qDebug("npx2 = %" PRIu64, npx2);
-            qDebug("npy2 = %" PRIu64 "\n", npy2);
-
-            if (n > 1)
+            qTrace("ibg  = %g", ibg);
+            qTrace("ibg1 = %" PRIu64, ibg1);
+            qTrace("nb1  = %" PRIu64, nb1);
+            qTrace("ibg2 = %" PRIu64, ibg2);
+            qTrace("nb2  = %" PRIu64 "\n", nb2);
+
+            qTrace("ipg  = %g", ipg);
+            qTrace("ipg1 = %" PRIu64, ipg1);
+            qTrace("npx1 = %" PRIu64, npx1);
+            qTrace("npy1 = %" PRIu64, npy1);
+            qTrace("ipg2 = %" PRIu64, ipg2);
+            qTrace("npx2 = %" PRIu64, npx2);
+            qTrace("npy2 = %" PRIu64 "\n", npy2);
+
+            if (isJumpTarget.at(i))
+                markPacketListStream(streamList_[i]->id());
+            setPacketListTxOffload(frameSet.txOffload);
+            // Tracked stream frames are counted as they are stamped -
+            // uploaded frames have no signature to stamp
+            setPacketListStream((streamList_[i]->isTracked()
+                                    && !frameSet.isUploaded) ?
+                    -1 : qint64(streamList_[i]->id()));
+            setPacketListShuffle(streamList_[i]->isShuffled()
+                        && (frameVariableCount > 1),
+                    streamList_[i]->randomSeed());
+
+            if (frameSet.isStreamed || frameSet.isReplayed)
+            {
+                bool isBursts = (streamList_[i]->sendUnit() ==
+                                    OstProto::StreamControl::e_su_bursts);
+                quint64 count = isContinuous ?
+                                kContinuousFrameCount : quint64(n)*x + y;
+                quint64 next;
+
+                qTrace("q(%d) sec = %lu nsec = %lu generated = %" PRIu64,
+                        i, sec, nsec, count);
+
+                if (frameSet.isReplayed)
+                {
+                    appendGeneratorToPacketList(sec, nsec,
+                            new ReplayFrameGenerator(frameSet.data,
+                                frameSet.offset, count,
+                                isBursts ? burstSize : 1,
+                                isBursts ? ibg : ipg));
+                    packetListBytes_ += frameSet.data.size();
+                }
+                else if (isBursts)
+                    appendGeneratorToPacketList(sec, nsec,
+                            new StreamFrameGenerator(streamList_[i], count,
+                                burstSize, ibg));
+                else
+                    appendGeneratorToPacketList(sec, nsec,
+                            new StreamFrameGenerator(streamList_[i], count,
+                                1, ipg));
+                if (!frameSet.isReplayed)
+                    isPacketListStreamed_ = true;
+
+                // Next stream starts one burst/packet gap after the last
+                // burst/packet of this stream
+                next = quint64(nsec) + (isBursts ?
+                        quint64(double(count/burstSize) * ibg) :
+                        quint64(double(count) * ipg));
+                sec += next/quint64(1e9);
+                nsec = next%quint64(1e9);
+            }
+            else if (isContinuous)
+                loopNextPacketSet(x, -1, 0, loopDelay);
+            else if (n > 1)
                 loopNextPacketSet(x, n, 0, loopDelay);
-            else if (n == 0)
-                x = 0;
 
-            for (uint j = 0; j < (x+y); j++)
+            // All frames of a burst are identical if there are no variable
+            // fields - add the burst as a single reference entry so that
+            // the frame is stored once, not burstSize times
+            bool isRefBurst = (streamList_[i]->sendUnit() ==
+                                    OstProto::StreamControl::e_su_bursts)
+                                && (frameVariableCount == 1)
+                                && (burstSize > 1) && (x == burstSize);
+
+            for (uint j = 0; !(frameSet.isStreamed || frameSet.isReplayed)
+                    && (j < (x+y)); j++)
             {
                 
                 if (j == 0 || frameVariableCount > 1)
                 {
-                    len = streamList_[i]->frameValue(
-                            pktBuf_, sizeof(pktBuf_), j);
+                    pkt = frameSet.frame(j);
+                    len = frameSet.frameLen(j);
                 }
                 if (len <= 0)
                     continue;
 
-                qDebug("q(%d, %d) sec = %lu nsec = %lu",
+                qTrace("q(%d, %d) sec = %lu nsec = %lu",
                         i, j, sec, nsec);
 
-                appendToPacketList(sec, nsec, pktBuf_, len); 
+                if (isRefBurst)
+                {
+                    appendRefToPacketList(sec, nsec, pkt, len,
+                            burstSize, 0);
+                    j += burstSize - 1; // last pkt of burst
+                }
+                else
+                    appendToPacketList(sec, nsec, pkt, len); 
+                packetListBytes_ += len;
 
                 if ((j > 0) && (((j+1) % burstSize) == 0))
                 {
@@ -305,6 +1665,15 @@ void AbstractPort::updatePacketListSequential()
                         nsec -= long(1e9);
                     }
                 }
+                else if (!gaps.isEmpty())
+                {
+                    nsec += gaps.at((j < x) ? j : j - x);
+                    while (nsec >= long(1e9))
+                    {
+                        sec++;
+                        nsec -= long(1e9);
+                    }
+                }
                 else
                 {
                     if (j < x)
@@ -320,312 +1689,461 @@ void AbstractPort::updatePacketListSequential()
                 }
             }
 
-            switch(streamList_[i]->nextWhat())
-            {
-                case ::OstProto::StreamControl::e_nw_stop:
-                    goto _stop_no_more_pkts;
+            // A continuous stream never ends - so its next action is
+            // never reached
+            if (isContinuous || (next.at(i) == following.at(i)))
+                continue;
 
-                case ::OstProto::StreamControl::e_nw_goto_id:
-                    /*! \todo (MED): define and use 
-                    streamList_[i].d.control().goto_stream_id(); */
-
-                    /*! \todo (MED): assumes goto Id is less than current!!!! 
-                     To support goto to any id, do
-                     if goto_id > curr_id then 
-                         i = goto_id;
-                         goto restart;
-                     else
-                         returnToQIdx = 0;
-                     */
-
-                    setPacketListLoopMode(true, 0, 
-                            streamList_[i]->sendUnit() == 
-                                StreamBase::e_su_bursts ? ibg1 : ipg1);
+            if (next.at(i) < 0) {
+                if (following.at(i) < 0)
                     goto _stop_no_more_pkts;
-
-                case ::OstProto::StreamControl::e_nw_goto_next:
-                    break;
-
-                default:
-                    qFatal("---------- %s: Unhandled case (%d) -----------",
-                            __FUNCTION__, streamList_[i]->nextWhat() );
-                    break;
+                appendJumpToPacketList(-1, 0);
             }
+            else if ((following.at(i) < 0) && (next.at(i) == first)) {
+                setPacketListLoopMode(true, 0,
+                        streamList_[i]->sendUnit() ==
+                            StreamBase::e_su_bursts ? ibg1 : ipg1);
+                goto _stop_no_more_pkts;
+            }
+            else
+                appendJumpToPacketList(streamList_[next.at(i)]->id(),
+                        streamList_[i]->sendUnit() ==
+                            StreamBase::e_su_bursts ? ibg1 : ipg1);
 
-        } // if (stream is enabled)
+        } // if (stream is sent)
     } // for (numStreams)
 
 _stop_no_more_pkts:
+    getTimeStamp(&now);
+    if (last >= 0)
+        streamBuildNsec_[last] += ndiffTimeStamp(&lastStart, &now);
+    buildProgress_.update(0, 0, packetListBytes_ - lastBytes);
+
+    targetPacketRate_ = (isRateUniform && (streamRate > 0)) ? streamRate : 0;
     isSendQueueDirty_ = false;
+    return;
+
+_cancelled:
+    // The port stays dirty
+    clearPacketList();
+    targetPacketRate_ = 0;
 }
 
-void AbstractPort::updatePacketListInterleaved()
+/*
+  Follows the streams as sequential transmit sends them - from the first
+  enabled stream, each stream's next action leads to the one sent after
+  it - and returns for each stream (in streamList_ order) the index of
+  the stream sent after it; -1 => transmit stops after it, kStreamNotSent
+  => it is never sent
+
+  A goto without a target stream (as set by older clients) or to one
+  which is not enabled goes back to the first stream. A backend which
+  can't jump in its packet list (see canJumpInPacketList()) sends the
+  streams only upto the first one that doesn't go to the next one, and a
+  goto always goes back to the first stream
+*/
+QVector<int> AbstractPort::sequentialStreamOrder()
 {
-    int numStreams = 0;
-    quint64 minGap = ULLONG_MAX;
-    quint64 duration = quint64(1e9);
-    QList<quint64> ibg1, ibg2;
-    QList<quint64> nb1, nb2;
-    QList<quint64> ipg1, ipg2;
-    QList<quint64> np1, np2;
-    QList<ulong> schedSec, schedNsec;
-    QList<ulong> pktCount, burstCount;
-    QList<ulong> burstSize;
-    QList<bool> isVariable;
-    QList<QByteArray> pktBuf;
-    QList<ulong> pktLen;
+    QVector<int> next(streamList_.size(), kStreamNotSent);
+    bool canJump = canJumpInPacketList();
+    int first = -1;
 
-    qDebug("In %s", __FUNCTION__);
+    for (int i = 0; i < streamList_.size(); i++) {
+        if (streamList_[i]->isEnabled()) {
+            first = i;
+            break;
+        }
+    }
 
-    clearPacketList();
-    if (streamList_.size() == 0)
+    for (int i = first; (i >= 0) && (next.at(i) == kStreamNotSent);
+            i = next.at(i))
     {
-        isSendQueueDirty_ = false;
-        return;
+        const StreamBase *stream = streamList_[i];
+        int after = -1;
+
+        for (int j = i + 1; j < streamList_.size(); j++) {
+            if (streamList_[j]->isEnabled()) {
+                after = j;
+                break;
+            }
+        }
+
+        next[i] = -1;
+        if (stream->sendMode() == StreamBase::e_sm_continuous)
+            continue;
+
+        switch (stream->nextWhat())
+        {
+        case StreamBase::e_nw_stop:
+            break;
+        case StreamBase::e_nw_goto_next:
+            next[i] = after;
+            break;
+        case StreamBase::e_nw_goto_id:
+            next[i] = first;
+            if (!canJump || !stream->hasGotoStreamId())
+                break;
+            for (int j = 0; j < streamList_.size(); j++) {
+                if (streamList_[j]->isEnabled()
+                        && (streamList_[j]->id() == stream->gotoStreamId())) {
+                    next[i] = j;
+                    break;
+                }
+            }
+            break;
+        default:
+            qWarning("%s: unhandled next action %d", __FUNCTION__,
+                    stream->nextWhat());
+            break;
+        }
     }
 
-    // First sort the streams by ordinalValue
-    qSort(streamList_.begin(), streamList_.end(), StreamBase::StreamLessThan);
+    return next;
+}
+
+void AbstractPort::updatePacketListInterleaved()
+{
+    QList<const StreamBase*> streams;
+
+    qDebug("In %s", __FUNCTION__);
+
+    clearPacketList();
+    targetPacketRate_ = 0;
 
     for (int i = 0; i < streamList_.size(); i++)
     {
-        if (!streamList_[i]->isEnabled())
-            continue;
-
-        double numBursts = 0;
-        double numPackets = 0;
+        // Frames of different streams are mixed as they are generated - so
+        // no per-stream tx offload
+        streamList_[i]->setCksumOffload(0);
 
-        quint64 _burstSize = 0;
-        double ibg = 0;
-        quint64 _ibg1 = 0, _ibg2 = 0;
-        quint64 _nb1 = 0, _nb2 = 0;
-        double ipg = 0;
-        quint64 _ipg1 = 0, _ipg2 = 0;
-        quint64 _np1 = 0, _np2 = 0;
+        // Uploaded frames are sent by sequential transmit only
+        if (!streamList_[i]->isEnabled() || streamList_[i]->hasFrameSet())
+            continue;
 
         switch (streamList_[i]->sendUnit())
         {
         case OstProto::StreamControl::e_su_bursts:
-            numBursts = streamList_[i]->burstRate();
-            if (streamList_[i]->burstRate() > 0)
-            {
-                ibg = 1e9/double(streamList_[i]->burstRate());
-                _ibg1 = quint64(ceil(ibg));
-                _ibg2 = quint64(floor(ibg));
-                _nb1 = quint64((ibg - double(_ibg2)) * double(numBursts));
-                _nb2 = quint64(numBursts) - _nb1;
-                _burstSize = streamList_[i]->burstSize();
-            }
+            if (streamList_[i]->burstRate() <= 0)
+                continue;
             break;
         case OstProto::StreamControl::e_su_packets:
-            numPackets = streamList_[i]->packetRate();
-            if (streamList_[i]->packetRate() > 0)
-            {
-                ipg = 1e9/double(streamList_[i]->packetRate());
-                _ipg1 = llrint(ceil(ipg));
-                _ipg2 = quint64(floor(ipg));
-                _np1 = quint64((ipg - double(_ipg2)) * double(numPackets));
-                _np2 = quint64(numPackets) - _np1;
-                _burstSize = 1;
-            }
+            if (streamList_[i]->packetRate() <= 0)
+                continue;
             break;
         default:
             qWarning("Unhandled stream control unit %d",
                 streamList_[i]->sendUnit());
             continue;
         }
-        qDebug("numBursts = %g, numPackets = %g\n", numBursts, numPackets);
 
-        qDebug("ibg  = %g", ibg);
-        qDebug("ibg1 = %" PRIu64, _ibg1);
-        qDebug("nb1  = %" PRIu64, _nb1);
-        qDebug("ibg2 = %" PRIu64, _ibg2);
-        qDebug("nb2  = %" PRIu64 "\n", _nb2);
+        // All streams are sent together - the target is the aggregate rate
+        targetPacketRate_ += streamList_[i]->averagePacketRate();
+        streams.append(streamList_[i]);
+    }
 
-        qDebug("ipg  = %g", ipg);
-        qDebug("ipg1 = %" PRIu64, _ipg1);
-        qDebug("np1  = %" PRIu64, _np1);
-        qDebug("ipg2 = %" PRIu64, _ipg2);
-        qDebug("np2  = %" PRIu64 "\n", _np2);
+    qDebug("interleaved streams = %d, aggregate rate = %g pps",
+            streams.size(), targetPacketRate_);
 
+    // Each stream's frames are scheduled at exactly its own rate by the
+    // generator as they are sent - instead of a (lossy) fixed length
+    // schedule built upfront
+    if (!streams.isEmpty()) {
+        appendGeneratorToPacketList(0, 0,
+                new InterleavedFrameGenerator(streams));
+        isPacketListStreamed_ = true;
+    }
 
-        if (_ibg2 && (_ibg2 < minGap))
-            minGap = _ibg2;
+    isSendQueueDirty_ = false;
+}
 
-        if (_ibg1 && (_ibg1 > duration))
-            duration = _ibg1;
+/*!
+  Packet list of the port's pcap replay file - the file's frames are sent
+  as is by a generator, the port's streams are not used
+*/
+void AbstractPort::updatePacketListReplay()
+{
+    FrameGenerator *generator;
+    QString error;
 
-        ibg1.append(_ibg1);
-        ibg2.append(_ibg2);
+    clearPacketList();
+    targetPacketRate_ = 0;
 
-        nb1.append(_nb1);
-        nb2.append(_nb1);
+    if (data_.pcap_replay().file_name().empty()) {
+        qWarning("port %d: no pcap replay file set", id());
+        goto _exit;
+    }
 
-        burstSize.append(_burstSize);
+    generator = PcapReplayGenerator::create(data_.pcap_replay(), error);
+    if (!generator) {
+        qWarning("port %d: %s", id(), qPrintable(error));
+        goto _exit;
+    }
 
-        if (_ipg2 && (_ipg2 < minGap))
-            minGap = _ipg2;
+    // Sent time is relative to the start of transmit
+    appendGeneratorToPacketList(0, 0, generator);
 
-        if (_np1)
-        {
-            if (_ipg1 && (_ipg1 > duration))
-                duration = _ipg1;
-        }
-        else
-        {
-            if (_ipg2 && (_ipg2 > duration))
-                duration = _ipg2;
-        }
+_exit:
+    isSendQueueDirty_ = false;
+}
 
-        ipg1.append(_ipg1);
-        ipg2.append(_ipg2);
+/*!
+  Backends that don't support a synchronized start - transmit is started
+  right away, ahead of the release time
+*/
+void AbstractPort::armTransmit(StartBarrierPtr /*barrier*/)
+{
+    qWarning("port %d: synchronized start not supported - starting now",
+            id());
+    startTransmit();
+}
 
-        np1.append(_np1);
-        np2.append(_np1);
+void AbstractPort::updateRates(quint64 rxPkts, quint64 rxBytes,
+                               quint64 txPkts, quint64 txBytes)
+{
+    rxRate_.update(rxPkts, rxBytes);
+    txRate_.update(txPkts, txBytes);
+
+    stats_.rxLock.writeBegin();
+    stats_.rxPps = rxRate_.pps();
+    stats_.rxBps = rxRate_.bps();
+    stats_.rxLock.writeEnd();
+
+    stats_.txRateLock.writeBegin();
+    stats_.txPps = txRate_.pps();
+    stats_.txBps = txRate_.bps();
+    stats_.txRateLock.writeEnd();
+}
 
-        schedSec.append(0);
-        schedNsec.append(0);
+/*!
+  Copies the stats into copy - each group of counters as of one instant
+*/
+void AbstractPort::PortStats::snapshot(PortStats *copy) const
+{
+    int retries = 0;
+    uint seq;
+
+    do {
+        seq = rxLock.readBegin();
+        copy->rxPkts = rxPkts;
+        copy->rxBytes = rxBytes;
+        copy->rxPps = rxPps;
+        copy->rxBps = rxBps;
+        copy->rxDrops = rxDrops;
+        copy->rxErrors = rxErrors;
+        copy->rxFifoErrors = rxFifoErrors;
+        copy->rxFrameErrors = rxFrameErrors;
+        copy->rxPcapDrops = rxPcapDrops;
+        copy->rxPcapIfDrops = rxPcapIfDrops;
+    } while (rxLock.readRetry(seq, &retries));
+
+    retries = 0;
+    do {
+        seq = txLock.readBegin();
+        copy->txPkts = txPkts;
+        copy->txBytes = txBytes;
+    } while (txLock.readRetry(seq, &retries));
+
+    retries = 0;
+    do {
+        seq = txRateLock.readBegin();
+        copy->txPps = txPps;
+        copy->txBps = txBps;
+    } while (txRateLock.readRetry(seq, &retries));
+
+    copy->txRateError = txRateError;
+}
 
-        pktCount.append(0);
-        burstCount.append(0);
+void AbstractPort::stats(PortStats *stats)
+{
+    QMutexLocker locker(&statsLock_);
+    PortStats now;
+
+    stats_.snapshot(&now);
+
+    stats->rxPkts = (now.rxPkts >= epochStats_.rxPkts) ?
+                        now.rxPkts - epochStats_.rxPkts :
+                        now.rxPkts + (maxStatsValue_ - epochStats_.rxPkts);
+    stats->rxBytes = (now.rxBytes >= epochStats_.rxBytes) ?
+                        now.rxBytes - epochStats_.rxBytes :
+                        now.rxBytes + (maxStatsValue_ - epochStats_.rxBytes);
+    stats->rxPps = now.rxPps;
+    stats->rxBps = now.rxBps;
+
+    stats->txPkts = (now.txPkts >= epochStats_.txPkts) ?
+                        now.txPkts - epochStats_.txPkts :
+                        now.txPkts + (maxStatsValue_ - epochStats_.txPkts);
+    stats->txBytes = (now.txBytes >= epochStats_.txBytes) ?
+                        now.txBytes - epochStats_.txBytes :
+                        now.txBytes + (maxStatsValue_ - epochStats_.txBytes);
+    stats->txPps = now.txPps;
+    stats->txBps = now.txBps;
+    stats->txRateError = now.txRateError;
+
+    stats->rxDrops = (now.rxDrops >= epochStats_.rxDrops) ?
+                        now.rxDrops - epochStats_.rxDrops :
+                        now.rxDrops + (maxStatsValue_ - epochStats_.rxDrops);
+    stats->rxErrors = (now.rxErrors >= epochStats_.rxErrors) ?
+                        now.rxErrors - epochStats_.rxErrors :
+                        now.rxErrors + (maxStatsValue_ - epochStats_.rxErrors);
+    stats->rxFifoErrors = (now.rxFifoErrors >= epochStats_.rxFifoErrors) ?
+                        now.rxFifoErrors - epochStats_.rxFifoErrors :
+                        now.rxFifoErrors + (maxStatsValue_ - epochStats_.rxFifoErrors);
+    stats->rxFrameErrors = (now.rxFrameErrors >= epochStats_.rxFrameErrors) ?
+                        now.rxFrameErrors - epochStats_.rxFrameErrors :
+                        now.rxFrameErrors + (maxStatsValue_ - epochStats_.rxFrameErrors);
+    stats->rxPcapDrops = (now.rxPcapDrops >= epochStats_.rxPcapDrops) ?
+                        now.rxPcapDrops - epochStats_.rxPcapDrops :
+                        now.rxPcapDrops + (maxStatsValue_ - epochStats_.rxPcapDrops);
+    stats->rxPcapIfDrops = (now.rxPcapIfDrops >= epochStats_.rxPcapIfDrops) ?
+                        now.rxPcapIfDrops - epochStats_.rxPcapIfDrops :
+                        now.rxPcapIfDrops + (maxStatsValue_ - epochStats_.rxPcapIfDrops);
+}
 
-        if (streamList_[i]->isFrameVariable())
-        {
-            isVariable.append(true);
-            pktBuf.append(QByteArray());
-            pktLen.append(0);
-        }
-        else
-        {
-            isVariable.append(false);
-            pktBuf.append(QByteArray());
-            pktBuf.last().resize(kMaxPktSize);
-            pktLen.append(streamList_[i]->frameValue(
-                    (uchar*)pktBuf.last().data(), pktBuf.last().size(), 0));
-        }
-
-        numStreams++;
-    } // for i
-
-    qDebug("minGap   = %" PRIu64, minGap);
-    qDebug("duration = %" PRIu64, duration);
-
-    uchar* buf;
-    int len;
-    quint64 durSec = duration/ulong(1e9);
-    quint64 durNsec = duration % ulong(1e9);
-    quint64 sec = 0; 
-    quint64 nsec = 0;
-    quint64 lastPktTxSec = 0;
-    quint64 lastPktTxNsec = 0;
-    do
-    {
-        for (int i = 0; i < numStreams; i++)
-        {
-            // If a packet is not scheduled yet, look at the next stream
-            if ((schedSec.at(i) > sec) || (schedNsec.at(i) > nsec))
-                continue;
+void AbstractPort::resetStats()
+{
+    QMutexLocker locker(&statsLock_);
 
-            for (uint j = 0; j < burstSize[i]; j++)
-            {
-                if (isVariable.at(i))
-                {
-                    buf = pktBuf_;
-                    len = streamList_[i]->frameValue(pktBuf_, sizeof(pktBuf_), 
-                            pktCount[i]);
-                }
-                else
-                {
-                    buf = (uchar*) pktBuf.at(i).data();
-                    len = pktLen.at(i);
-                }
+    stats_.snapshot(&epochStats_);
+    epochNicCounters_ = nicCounters_;
+}
 
-                if (len <= 0)
-                    continue;
+/*!
+  Returns the NIC driver's counters (if the backend samples them) since
+  the last resetStats()
+*/
+void AbstractPort::nicCounters(QStringList &names, QList<quint64> &values)
+{
+    QMutexLocker locker(&statsLock_);
 
-                qDebug("q(%d) sec = %" PRIu64 " nsec = %" PRIu64, i, sec, nsec);
-                appendToPacketList(sec, nsec, buf, len); 
-                lastPktTxSec = sec;
-                lastPktTxNsec = nsec;
+    names = nicCounterNames_;
+    values = nicCounters_;
 
-                pktCount[i]++;
-                schedNsec[i] += (pktCount.at(i) < np1.at(i)) ? 
-                    ipg1.at(i) : ipg2.at(i);
-                while (schedNsec.at(i) >= 1e9)
-                {
-                    schedSec[i]++;
-                    schedNsec[i] -= long(1e9);
-                }
-            }
+    // A counter lower than at reset was reset by the driver
+    for (int i = 0; i < qMin(values.size(), epochNicCounters_.size()); i++)
+        if (values.at(i) >= epochNicCounters_.at(i))
+            values[i] -= epochNicCounters_.at(i);
+}
 
-            burstCount[i]++;
-            schedNsec[i] += (burstCount.at(i) < nb1.at(i)) ? 
-                    ibg1.at(i) : ibg2.at(i);
-            while (schedNsec.at(i) >= 1e9)
-            {
-                schedSec[i]++;
-                schedNsec[i] -= long(1e9);
-            }
-        } 
+void AbstractPort::setNicCounters(const QStringList &names,
+                                  const QList<quint64> &values)
+{
+    QMutexLocker locker(&statsLock_);
 
-        nsec += minGap;
-        while (nsec >= 1e9)
-        {
-            sec++;
-            nsec -= long(1e9);
-        }
-    } while ((sec < durSec) || (nsec < durNsec));
+    // Different counters (driver reloaded?) - no longer comparable
+    if (names != nicCounterNames_) {
+        nicCounterNames_ = names;
+        epochNicCounters_.clear();
+    }
+    nicCounters_ = values;
+}
+
+/*!
+  Returns the stats of the tracked streams sent or received on the port
+  (and the tx counts of its untracked streams, if the backend keeps them)
+  since the last resetStreamStats()
+*/
+void AbstractPort::streamStats(StreamStatsHash &stats)
+{
+    QMutexLocker locker(&statsLock_);
+
+    addStreamStats(stats);
 
-    qint64 delaySec = durSec - lastPktTxSec;
-    qint64 delayNsec = durNsec - lastPktTxNsec;
-    while (delayNsec < 0)
+    for (StreamStatsHash::iterator i = stats.begin(); i != stats.end(); i++)
     {
-        delayNsec += long(1e9);
-        delaySec--;
+        StreamStatsHash::const_iterator epoch =
+                epochStreamStats_.constFind(i.key());
+
+        if (epoch == epochStreamStats_.constEnd())
+            continue;
+
+        // All counters only ever increase
+        i.value().txPkts -= epoch.value().txPkts;
+        i.value().txBytes -= epoch.value().txBytes;
+        i.value().txHwDelaySum -= epoch.value().txHwDelaySum;
+        i.value().txHwDelayCount -= epoch.value().txHwDelayCount;
+        i.value().rxPkts -= epoch.value().rxPkts;
+        i.value().rxBytes -= epoch.value().rxBytes;
+        i.value().rxSeqErrors -= epoch.value().rxSeqErrors;
+        i.value().rxLatencySum -= epoch.value().rxLatencySum;
+        i.value().rxLatencyCount -= epoch.value().rxLatencyCount;
+        i.value().rxJitterSum -= epoch.value().rxJitterSum;
+        i.value().rxJitterCount -= epoch.value().rxJitterCount;
+        i.value().rxLost -= epoch.value().rxLost;
+        i.value().rxReordered -= epoch.value().rxReordered;
+        i.value().rxDuplicates -= epoch.value().rxDuplicates;
+        i.value().rxLate -= epoch.value().rxLate;
+        i.value().rxPayloadErrors -= epoch.value().rxPayloadErrors;
+
+        // Min/Max are restarted by resetStreamStats() instead
+        const QVector<quint64> &h = epoch.value().rxLatencyHistogram;
+        for (int j = 0; j < qMin(h.size(),
+                                 i.value().rxLatencyHistogram.size()); j++)
+            i.value().rxLatencyHistogram[j] -= h.at(j);
     }
-    qDebug("loop Delay = %" PRId64 "/%" PRId64, delaySec, delayNsec);
-    setPacketListLoopMode(true, delaySec, delayNsec); 
-    isSendQueueDirty_ = false;
 }
 
-void AbstractPort::stats(PortStats *stats)
+void AbstractPort::resetStreamStats()
+{
+    QMutexLocker locker(&statsLock_);
+
+    epochStreamStats_.clear();
+    addStreamStats(epochStreamStats_);
+    rxStreamStats_.resetLatency();
+}
+
+// Adds the current counters of the port's stream stats tables to stats
+void AbstractPort::addStreamStats(StreamStatsHash &stats)
+{
+    rxStreamStats_.addTo(stats);
+}
+
+/*!
+  Returns the rx frames matching each of the port's counter filters since
+  the last resetFilterCounts()
+*/
+void AbstractPort::filterCounts(QStringList &names, QList<quint64> &counts)
+{
+    QMutexLocker locker(&statsLock_);
+
+    filterCountsLocked(names, counts);
+}
+
+// Caller should hold statsLock_
+void AbstractPort::filterCountsLocked(
+        QStringList &names, QList<quint64> &counts)
+{
+    const OstProto::CounterFilterList &filters = data_.counter_filters();
+
+    for (int i = 0; i < filters.counter_filter_size(); i++) {
+        names.append(QString::fromStdString(filters.counter_filter(i).name()));
+        counts.append(0);
+    }
+    addFilterCounts(counts);
+
+    for (int i = 0; i < qMin(counts.size(), epochFilterCounts_.size()); i++)
+        counts[i] -= epochFilterCounts_.at(i);
+}
+
+void AbstractPort::resetFilterCounts()
+{
+    QStringList names;
+    QMutexLocker locker(&statsLock_);
+
+    epochFilterCounts_.clear();
+    filterCountsLocked(names, epochFilterCounts_);
+}
+
+bool AbstractPort::setCounterFilters(
+        const OstProto::CounterFilterList & /*filters*/)
 {
-    stats->rxPkts = (stats_.rxPkts >= epochStats_.rxPkts) ?
-                        stats_.rxPkts - epochStats_.rxPkts :
-                        stats_.rxPkts + (maxStatsValue_ - epochStats_.rxPkts);
-    stats->rxBytes = (stats_.rxBytes >= epochStats_.rxBytes) ?
-                        stats_.rxBytes - epochStats_.rxBytes :
-                        stats_.rxBytes + (maxStatsValue_ - epochStats_.rxBytes);
-    stats->rxPps = stats_.rxPps;
-    stats->rxBps = stats_.rxBps;
-
-    stats->txPkts = (stats_.txPkts >= epochStats_.txPkts) ?
-                        stats_.txPkts - epochStats_.txPkts :
-                        stats_.txPkts + (maxStatsValue_ - epochStats_.txPkts);
-    stats->txBytes = (stats_.txBytes >= epochStats_.txBytes) ?
-                        stats_.txBytes - epochStats_.txBytes :
-                        stats_.txBytes + (maxStatsValue_ - epochStats_.txBytes);
-    stats->txPps = stats_.txPps;
-    stats->txBps = stats_.txBps;
-
-    stats->rxDrops = (stats_.rxDrops >= epochStats_.rxDrops) ?
-                        stats_.rxDrops - epochStats_.rxDrops :
-                        stats_.rxDrops + (maxStatsValue_ - epochStats_.rxDrops);
-    stats->rxErrors = (stats_.rxErrors >= epochStats_.rxErrors) ?
-                        stats_.rxErrors - epochStats_.rxErrors :
-                        stats_.rxErrors + (maxStatsValue_ - epochStats_.rxErrors);
-    stats->rxFifoErrors = (stats_.rxFifoErrors >= epochStats_.rxFifoErrors) ?
-                        stats_.rxFifoErrors - epochStats_.rxFifoErrors :
-                        stats_.rxFifoErrors + (maxStatsValue_ - epochStats_.rxFifoErrors);
-    stats->rxFrameErrors = (stats_.rxFrameErrors >= epochStats_.rxFrameErrors) ?
-                        stats_.rxFrameErrors - epochStats_.rxFrameErrors :
-                        stats_.rxFrameErrors + (maxStatsValue_ - epochStats_.rxFrameErrors);
+    qWarning("%s: counter filters are not supported", name());
+    return false;
 }
 
 void AbstractPort::clearDeviceNeighbors()
 {
     deviceManager_->clearDeviceNeighbors();
-    isSendQueueDirty_ = true;
+    setDirty();
 }
 
 void AbstractPort::resolveDeviceNeighbors()
@@ -654,33 +2172,215 @@ void AbstractPort::resolveDeviceNeighbors()
     // 2. For a unidirectional stream, at egress, this will create ARP
     // entries on the DUT for each of the source addresses
     //
-    // TODO(optimization): Identify if stream does not vary in srcIp or dstIp
-    // - in which case resolve for only one frame of the stream
+    // Only the frames with distinct L3 addressing (vlans, src/dst ip) are
+    // resolved - these are found for all streams in parallel
+    QList<NeighborFrames> neighborFrames;
+    QSet<QByteArray> resolved;
+
     for (int i = 0; i < streamList_.size(); i++)
     {
-        const StreamBase *stream = streamList_.at(i);
-        int frameCount = stream->frameVariableCount();
+        NeighborFrames nf;
+
+        nf.stream = streamList_.at(i);
+        nf.deviceManager = deviceManager_;
+        nf.count = l3FrameVariableCount(nf.stream);
+        if (nf.count)
+            neighborFrames.append(nf);
+    }
+
+    // MACs don't matter for these renders - and need to be looked up
+    // without the port lock (held by us) from the worker threads
+    isResolvingMacs_ = true;
+    QtConcurrent::blockingMap(neighborFrames, findNeighborFrames);
+    isResolvingMacs_ = false;
 
+    for (int i = 0; i < neighborFrames.size(); i++)
+    {
+        const NeighborFrames &nf = neighborFrames.at(i);
+
+        for (int j = 0; j < nf.keys.size(); j++) {
+            if (resolved.contains(nf.keys.at(j)))
+                continue;
+            resolved.insert(nf.keys.at(j));
+
+            QByteArray frame = nf.frames.at(j);
+            PacketBuffer pktBuf((uchar*) frame.data(), frame.size());
+            deviceManager_->resolveDeviceNeighbor(&pktBuf);
+        }
+    }
+    qDebug("%s: resolved %d unique neighbor keys", __FUNCTION__,
+            resolved.size());
+    TraceBuffer::record(OstProto::TraceRecord::kNeighborResolve,
+                        id(), resolved.size());
+    setDirty();
+}
+
+/*!
+  Resolves the device and neighbor MACs of all the frames of the streams
+  that use them (i.e. MAC mode 'resolve') - for the packet list being
+  built (and the frames generated while transmitting)
+*/
+void AbstractPort::resolveStreamMacs()
+{
+    resolvedMacs_.clear();
+
+    if (!deviceManager_->deviceCount())
+        return;
+
+    for (int i = 0; i < streamList_.size(); i++)
+    {
+        StreamBase *stream = streamList_.at(i);
+        ProtocolListIterator *iter;
+        bool isResolve = false;
+        int frameCount;
+
+        if (!stream->isEnabled() || stream->hasFrameSet())
+            continue;
+
+        iter = stream->createProtocolListIterator();
+        if (iter->hasNext()) {
+            AbstractProtocol *proto = iter->next();
+
+            if (proto->protocolNumber() == OstProto::Protocol::kMacFieldNumber)
+                isResolve = (proto->fieldData(MacProtocol::mac_dstMacMode,
+                                AbstractProtocol::FieldValue).toUInt()
+                                    == OstProto::Mac::e_mm_resolve)
+                            || (proto->fieldData(MacProtocol::mac_srcMacMode,
+                                AbstractProtocol::FieldValue).toUInt()
+                                    == OstProto::Mac::e_mm_resolve);
+        }
+        delete iter;
+
+        frameCount = stream->frameVariableCount();
+        if (!isResolve || (frameCount > kMaxResolvedMacFrames))
+            continue;
+
+        ResolvedMacs &macs = resolvedMacs_[stream->id()];
+
+        macs.deviceMac.resize(frameCount);
+        macs.neighborMac.resize(frameCount);
+
+        // The MACs are not needed (and not looked up) for these renders
+        isResolvingMacs_ = true;
         for (int j = 0; j < frameCount; j++) {
             // we need the packet contents only uptil the L3 header
             int pktLen = stream->frameValue(pktBuf_, kMaxL3PktSize, j);
             if (pktLen) {
                 PacketBuffer pktBuf(pktBuf_, pktLen);
-                deviceManager_->resolveDeviceNeighbor(&pktBuf);
+                macs.deviceMac[j] = deviceManager_->deviceMacAddress(&pktBuf);
+                macs.neighborMac[j] =
+                        deviceManager_->neighborMacAddress(&pktBuf);
             }
+            else
+                macs.deviceMac[j] = macs.neighborMac[j] = 0;
         }
+        isResolvingMacs_ = false;
+    }
+}
+
+// Frames repeat after frameVariableCount, and so do their MACs
+bool AbstractPort::resolvedDeviceMacAddress(int streamId, int frameIndex,
+                                            quint64 *mac)
+{
+    QHash<uint, ResolvedMacs>::const_iterator it;
+
+    if (isResolvingMacs_) {
+        *mac = 0;
+        return true;
+    }
+
+    it = resolvedMacs_.constFind(streamId);
+    if (it == resolvedMacs_.constEnd())
+        return false;
+
+    *mac = it->deviceMac.at(frameIndex % it->deviceMac.size());
+    return true;
+}
+
+bool AbstractPort::resolvedNeighborMacAddress(int streamId, int frameIndex,
+                                              quint64 *mac)
+{
+    QHash<uint, ResolvedMacs>::const_iterator it;
+
+    if (isResolvingMacs_) {
+        *mac = 0;
+        return true;
+    }
+
+    it = resolvedMacs_.constFind(streamId);
+    if (it == resolvedMacs_.constEnd())
+        return false;
+
+    *mac = it->neighborMac.at(frameIndex % it->neighborMac.size());
+    return true;
+}
+
+/*!
+  Returns the number of frames of the stream after which its L2/L3
+  headers (and so the addressing) repeat - only the protocols upto the
+  first IPv4/IPv6 header are considered, so a varying payload or L4 field
+  doesn't count; returns 0 if the stream is not IP
+*/
+int AbstractPort::l3FrameVariableCount(const StreamBase *stream)
+{
+    ProtocolListIterator *iter;
+    quint64 count = 1;
+    bool isIp = false;
+
+    iter = stream->createProtocolListIterator();
+    while (iter->hasNext())
+    {
+        AbstractProtocol *proto = iter->next();
+        int n = proto->protocolFrameVariableCount();
+
+        count = AbstractProtocol::lcm(count, n > 0 ? n : 1);
+
+        if ((proto->protocolNumber() == OstProto::Protocol::kIp4FieldNumber)
+                || (proto->protocolNumber()
+                        == OstProto::Protocol::kIp6FieldNumber)) {
+            isIp = true;
+            break;
+        }
+    }
+    delete iter;
+
+    return isIp ? int(qMin(count, quint64(stream->frameVariableCount()))) : 0;
+}
+
+// Runs on a worker thread - must not touch any port state
+void AbstractPort::findNeighborFrames(NeighborFrames &nf)
+{
+    uchar buf[kMaxL3PktSize];
+    QSet<QByteArray> keys;
+
+    for (int j = 0; j < nf.count; j++) {
+        // we need the packet contents only uptil the L3 header
+        int pktLen = nf.stream->frameValue(buf, kMaxL3PktSize, j);
+        if (!pktLen)
+            continue;
+
+        QByteArray key = nf.deviceManager->neighborKey(buf, pktLen);
+        if (key.isEmpty() || keys.contains(key))
+            continue;
+
+        keys.insert(key);
+        nf.keys.append(key);
+        nf.frames.append(QByteArray((const char*) buf, pktLen));
     }
-    isSendQueueDirty_ = true;
 }
 
+// NOTE: may be called from multiple threads while building the packet
+// list, so we don't use pktBuf_ here
 quint64 AbstractPort::deviceMacAddress(int streamId, int frameIndex)
 {
+    uchar buf[kMaxL3PktSize];
+
     // we need the packet contents only uptil the L3 header
     StreamBase *s = stream(streamId);
-    int pktLen = s->frameValue(pktBuf_, kMaxL3PktSize, frameIndex);
+    int pktLen = s->frameValue(buf, kMaxL3PktSize, frameIndex);
 
     if (pktLen) {
-        PacketBuffer pktBuf(pktBuf_, pktLen);
+        PacketBuffer pktBuf(buf, pktLen);
         return deviceManager_->deviceMacAddress(&pktBuf);
     }
 
@@ -689,12 +2389,14 @@ quint64 AbstractPort::deviceMacAddress(int streamId, int frameIndex)
 
 quint64 AbstractPort::neighborMacAddress(int streamId, int frameIndex)
 {
+    uchar buf[kMaxL3PktSize];
+
     // we need the packet contents only uptil the L3 header
     StreamBase *s = stream(streamId);
-    int pktLen = s->frameValue(pktBuf_, kMaxL3PktSize, frameIndex);
+    int pktLen = s->frameValue(buf, kMaxL3PktSize, frameIndex);
 
     if (pktLen) {
-        PacketBuffer pktBuf(pktBuf_, pktLen);
+        PacketBuffer pktBuf(buf, pktLen);
         return deviceManager_->neighborMacAddress(&pktBuf);
     }
 
@@ -20,12 +20,25 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 #ifndef _SERVER_ABSTRACT_PORT_H
 #define _SERVER_ABSTRACT_PORT_H
 
+#include <QByteArray>
+#include <QHash>
 #include <QList>
+#include <QMutex>
+#include <QSet>
+#include <QStringList>
+#include <QVector>
 #include <QtGlobal>
 
 #include "../common/protocol.pb.h"
+#include "dronemetrics.h"
+#include "ratemeter.h"
+#include "seqlock.h"
+#include "startbarrier.h"
+#include "streamstats.h"
 
+class CaptureAnalytics;
 class DeviceManager;
+class FrameGenerator;
 class StreamBase;
 class PacketBuffer;
 class QIODevice;
@@ -36,8 +49,22 @@ class QIODevice;
 class AbstractPort
 {
 public:
+    static const int kCacheLineSize = 64;
+
+    /*!
+      Each group of counters has one writer - rx: the rx monitor or the
+      stats monitor; tx: the transmitter, the tx monitor or the stats
+      monitor; tx rates: the tx monitor or the stats monitor - which
+      updates it within writeBegin()/writeEnd() of the group's lock, so
+      that a reader on another thread (see snapshot()) sees the group
+      consistent and without torn 64-bit values
+
+      The rx and tx groups are a cacheline apart so that the rx and tx
+      threads don't bounce a line between them on every frame
+    */
     struct PortStats
     {
+        SeqLock    rxLock;
         quint64    rxPkts;
         quint64    rxBytes;
         quint64    rxPps;
@@ -47,11 +74,36 @@ public:
         quint64    rxErrors;
         quint64    rxFifoErrors;
         quint64    rxFrameErrors;
+        quint64    rxPcapDrops;    // by the rx monitor's pcap handle
+        quint64    rxPcapIfDrops;
 
+        char       rxPad[kCacheLineSize];
+
+        SeqLock    txLock;
         quint64    txPkts;
         quint64    txBytes;
+
+        SeqLock    txRateLock;
         quint64    txPps;
         quint64    txBps;
+
+        double     txRateError; // (achieved - target)/target tx pps
+
+        char       txPad[kCacheLineSize];
+
+        void snapshot(PortStats *copy) const;
+    };
+
+    // Offloads for a stream's frames - see setPacketListTxOffload()
+    struct TxOffloadInfo
+    {
+        uint cksumOffload;  // StreamBase::CksumOffload flags; 0 => none
+        bool isIp6;
+        bool isUdp;
+        int l2Len;
+        int l3Len;
+        int l4Len;
+        int segmentSize;    // max L4 payload per segment; 0 => no segments
     };
 
     enum Accuracy
@@ -64,13 +116,25 @@ public:
     AbstractPort(int id, const char *device);
     virtual ~AbstractPort();
 
+    // Memory (bytes) for the packet list of a port and for those of all
+    // ports together; 0 => no limit
+    static void setPacketListBudget(quint64 portBytes, quint64 totalBytes);
+    // Streams are compacted (see StreamBase::compact()) once their frames
+    // are built - for drones with very many streams
+    static void setCompactStreams(bool isCompact) {
+        compactStreams_ = isCompact;
+    }
+
     bool isUsable() { return isUsable_; }
 
     virtual void init();
 
     int id() { return data_.port_id().id(); }
     const char* name() { return data_.name().c_str(); }
-    void protoDataCopyInto(OstProto::Port *port) { port->CopyFrom(data_); }
+    void protoDataCopyInto(OstProto::Port *port) {
+        port->CopyFrom(data_);
+        threadPlacementStatus(port);
+    }
 
     bool modify(const OstProto::Port &port);
 
@@ -83,9 +147,18 @@ public:
     StreamBase* stream(int streamId);
     bool addStream(StreamBase *stream);
     bool deleteStream(int streamId);
+    // One pass over the streams, however many are deleted
+    int deleteStreams(const QSet<uint> &streamIds);
+
+    // Adds a chunk of an upload to the port's frame sets - see
+    // OstProto::FrameSetChunk; on error (e.g. a chunk out of order or a
+    // malformed set) the upload is dropped and error says why
+    bool addFrameSetChunk(const OstProto::FrameSetChunk &chunk,
+                          QString &error);
 
     bool isDirty() { return isSendQueueDirty_; }
-    void setDirty() { isSendQueueDirty_ = true; }
+    void setDirty() { isSendQueueDirty_ = true; frameSetCache_.clear(); }
+    void setStreamDirty(int streamId, bool isRateOnly = false);
 
     Accuracy rateAccuracy();
     virtual bool setRateAccuracy(Accuracy accuracy);
@@ -95,26 +168,110 @@ public:
             long repeatDelaySec, long repeatDelayNsec) = 0;
     virtual bool appendToPacketList(long sec, long nsec, const uchar *packet, 
             int length) = 0;
+    virtual bool appendRefToPacketList(long sec, long nsec,
+            const uchar *packet, int length, quint64 repeats, quint64 gapNsec);
+    virtual bool appendGeneratorToPacketList(long sec, long nsec,
+            FrameGenerator *generator);
+    // False if generators are expanded into the packet list (the default
+    // appendGeneratorToPacketList()) instead of being run while sending
+    virtual bool hasNativeFrameGenerators() const { return false; }
     virtual void setPacketListLoopMode(bool loop, 
             quint64 secDelay, quint64 nsecDelay) = 0;
-    void updatePacketList();
+    virtual void setPacketListTxOffload(const TxOffloadInfo & /*info*/) {}
+    // Frames appended from now on are of the (untracked) stream - for the
+    // backend to count the frames of each stream sent; -1 => none
+    virtual void setPacketListStream(qint64 /*streamId*/) {}
+    // Frames appended from now on are sent in a new random order (from
+    // seed) every time they are sent - see StreamControl.shuffle_frames
+    virtual void setPacketListShuffle(bool /*isShuffled*/,
+            quint64 /*seed*/) {}
+    // Backends that can jump within the packet list send streams with a
+    // goto_stream_id without duplicating any frames - the frames appended
+    // next are marked as those of streamId, and a jump goes on, nsecDelay
+    // after the frames appended before it, from those of streamId (-1 =>
+    // to the end of the list i.e. stop); see sequentialStreamOrder()
+    virtual bool canJumpInPacketList() { return false; }
+    virtual void markPacketListStream(uint /*streamId*/) {}
+    virtual void appendJumpToPacketList(qint64 /*streamId*/,
+            quint64 /*nsecDelay*/) {}
+    // Backends that can switch to a new packet list while transmitting
+    // (at a packet set boundary) build the new list alongside the one
+    // being sent - it is used only once committed
+    virtual bool canSwitchPacketList() { return false; }
+    virtual void commitPacketList() {}
+    // A cancellable build (see cancelPacketListBuild()) may leave the port
+    // dirty with an empty packet list
+    void updatePacketList(bool isCancellable = false);
+    // Both may be called from any thread, without the port lock - the
+    // progress is that of the build in progress, if any, else of the last
+    // one
+    void cancelPacketListBuild();
+    void packetListBuildProgress(int *streamsDone, quint64 *framesBuilt,
+                                 quint64 *bytes);
+    // Streams can be changed without stopping transmit only if the packet
+    // list being sent doesn't generate frames from them
+    bool isLiveUpdatable() {
+        return canSwitchPacketList() && !isPacketListStreamed_;
+    }
 
     virtual void startTransmit() = 0;
+    // Like startTransmit() but frames are sent only once the barrier
+    // (shared with other ports) is released
+    virtual void armTransmit(StartBarrierPtr barrier);
     virtual void stopTransmit() = 0;
     virtual bool isTransmitOn() = 0;
-
-    virtual void startCapture(const char *filter) = 0;
+    // The next transmit stops by itself at stopTime (nsecs since the Unix
+    // epoch as per CLOCK_REALTIME) - if before its transmit_duration ends
+    void setTransmitStopTime(quint64 stopTime) { txStopTime_ = stopTime; }
+    // Scales the stream rates of the next transmit (e.g. 0.5 halves them)
+    // without rebuilding the packet list; if not supported, false
+    virtual bool setTransmitLoad(double /*load*/) { return false; }
+    // Frames sent by the last (or current) transmit and its duration, as
+    // counted by the transmitter(s); false if not supported
+    virtual bool transmitRunStats(quint64 * /*pkts*/, quint64 * /*bytes*/,
+                                  quint64 * /*nsec*/) { return false; }
+    // The tx rate is corrected towards the target in closed loop (see
+    // PortStats::txRateError); false if not supported
+    virtual bool hasRateControl() { return false; }
+
+    virtual void startCapture(const char *filter,
+                              const OstProto::CaptureConfig &config) = 0;
     virtual void stopCapture() = 0;
     virtual bool isCaptureOn() = 0;
+    // A ring capture's frames can be retrieved while it is on - as of
+    // the last snapshotCaptureRing()
+    virtual bool isCaptureRing() { return false; }
+    virtual void snapshotCaptureRing() {}
     virtual QIODevice* captureData() = 0;
-
-    void stats(PortStats *stats);
-    void resetStats() { epochStats_ = stats_; }
+    // Payload digests of the records of captureData() - NULL unless the
+    // capture is header-only, see CaptureDigest
+    virtual QIODevice* captureDigests() { return NULL; }
+    // Of the current (or last) capture; NULL if not supported
+    virtual CaptureAnalytics* captureAnalytics() { return NULL; }
+
+    // Stats methods don't need the port (config) lock of the caller
+    virtual void stats(PortStats *stats);
+    void resetStats();
+
+    void streamStats(StreamStatsHash &stats);
+    void resetStreamStats();
+    // Counts rx tracked stream frames or not, regardless of the port's
+    // rx_stream_stats - e.g. for port pair discovery
+    void enableRxStreamStats(bool enable) {
+        rxStreamStats_.setEnabled(enable);
+    }
+    bool isRxStreamStatsEnabled() { return data_.rx_stream_stats(); }
+
+    void filterCounts(QStringList &names, QList<quint64> &counts);
+    void resetFilterCounts();
+
+    void nicCounters(QStringList &names, QList<quint64> &values);
 
     DeviceManager* deviceManager();
     virtual void startDeviceEmulation() = 0;
     virtual void stopDeviceEmulation() = 0;
     virtual int sendEmulationPacket(PacketBuffer *pktBuf) = 0;
+    virtual int sendEmulationPackets(const QList<PacketBuffer*> &pktBufs);
 
     void clearDeviceNeighbors();
     void resolveDeviceNeighbors();
@@ -122,28 +279,185 @@ public:
     quint64 deviceMacAddress(int streamId, int frameIndex);
     quint64 neighborMacAddress(int streamId, int frameIndex);
 
+    // Lock free lookup of the MACs resolved for the stream's frames when
+    // the packet list was last built; return false if not resolved
+    bool resolvedDeviceMacAddress(int streamId, int frameIndex, quint64 *mac);
+    bool resolvedNeighborMacAddress(int streamId, int frameIndex, quint64 *mac);
+
 protected:
     void addNote(QString note);
+    void removeNote(QString note);
+
+    virtual void addStreamStats(StreamStatsHash &stats);
+
+    // Counter filters are implemented by the port backend - counts are
+    // the total matches of each filter in the same order as set
+    virtual bool setCounterFilters(const OstProto::CounterFilterList &filters);
+    virtual void addFilterCounts(QList<quint64> & /*counts*/) {}
+
+    virtual void applyThreadPlacement() {}
+    virtual void threadPlacementStatus(OstProto::Port * /*port*/) {}
+
+    // Sends received tracked stream frames back or not - see
+    // OstProto::Port::reflect_probes; returns false if not supported
+    virtual bool setProbeReflection(bool enable) { return !enable; }
+
+    // Checks (and takes) the port's OstProto::Port::pcap_rx; returns false
+    // if invalid or not supported
+    virtual bool setPcapRx(const OstProto::PcapRx & /*config*/) {
+        return false;
+    }
 
     void updatePacketListSequential();
+    QVector<int> sequentialStreamOrder();
     void updatePacketListInterleaved();
+    void updatePacketListReplay();
+
+    bool setTxOffload(const OstProto::TxOffload &offload);
+
+    // For backends that sample the NIC driver's counters - values are the
+    // driver's totals
+    void setNicCounters(const QStringList &names,
+                        const QList<quint64> &values);
+
+    // For backends that sample the port counters periodically - the counts
+    // are since the last sample
+    void updateRates(quint64 rxPkts, quint64 rxBytes,
+                     quint64 txPkts, quint64 txBytes);
 
     bool isUsable_;
     OstProto::Port          data_;
     OstProto::LinkState     linkState_;
     ulong minPacketSetSize_;
+    // Bytes of a looping packet set that fit in the transmit cpu's cache
+    // (0 => unknown) - see packetSetSize()
+    quint64 loopCacheBytes_;
     Accuracy rateAccuracy_;
 
+    // Aggregate tx pps of the packet list; 0 if the rate is not uniform
+    double targetPacketRate_;
+
+    // See setTransmitStopTime(); 0 => none
+    quint64 txStopTime_;
+
     quint64 maxStatsValue_;
     struct PortStats    stats_;
     //! \todo Need lock for stats access/update
+    RateMeter rxRate_;
+    RateMeter txRate_;
+
+    // Tracked streams received on this port - updated by the backend's rx
+    // thread; tx is counted by the backend's transmitter(s)
+    StreamStatsTable rxStreamStats_;
 
     DeviceManager *deviceManager_;
 
+    // Packet list builds - by whichever thread builds it
+    DroneMetrics::Counters metrics_;
+
 private:
+    // Progress of a packet list build - updated by the threads building
+    // the frames too, a chunk of frames at a time
+    struct BuildProgress
+    {
+        BuildProgress() { reset(false); }
+        void reset(bool cancellable) {
+            QMutexLocker locker(&lock);
+            isCancellable = cancellable;
+            isCancelled = false;
+            streamsDone = 0;
+            framesBuilt = 0;
+            bytes = 0;
+        }
+        // Returns false if the build is cancelled
+        bool update(int streams, quint64 frames, quint64 frameBytes) {
+            QMutexLocker locker(&lock);
+            streamsDone += streams;
+            framesBuilt += frames;
+            bytes += frameBytes;
+            return !isCancelled;
+        }
+
+        QMutex lock;
+        bool isCancellable;
+        bool isCancelled;
+        int streamsDone; // streams whose frames are built (or found)
+        quint64 framesBuilt;
+        quint64 bytes; // frames built and added to the packet list
+    };
+
+    // Frames of a stream built in advance by updatePacketListSequential()
+    struct FrameSet
+    {
+        const StreamBase *stream;
+        int count;
+        bool isBuilt;
+        bool isStreamed; // frames generated while transmitting, not built
+        bool isReplayed; // only the distinct frames built, see below
+        TxOffloadInfo txOffload;
+        QByteArray data; // all frames back to back
+        QVector<int> offset; // offset of i-th frame in data; has count+1
+        QByteArray sharedKey; // see sharedFrameSets_; empty => not shared
+        bool isStored; // frames mapped from the FrameSetStore
+        bool isUploaded; // frames of uploadedFrames_, not built
+        QVector<quint64> gapNsec; // after each frame, if isUploaded
+        quint64 bytes; // projected memory of the frames and their entries
+        BuildProgress *progress; // of the build in progress
+        quint64 buildNsec; // 0 if not built by the last build
+
+        const uchar* frame(int i) const {
+            return (const uchar*) data.constData() + offset.at(i);
+        }
+        int frameLen(int i) const { return offset.at(i+1) - offset.at(i); }
+    };
+
+    // Frames of a stream with distinct L3 addressing - for neighbor
+    // resolution, found by findNeighborFrames()
+    struct NeighborFrames
+    {
+        const StreamBase *stream;
+        const DeviceManager *deviceManager;
+        int count; // frames to look at
+        QList<QByteArray> keys; // see DeviceManager::neighborKey()
+        QList<QByteArray> frames; // upto L3 header
+    };
+
+    static int l3FrameVariableCount(const StreamBase *stream);
+    static void findNeighborFrames(NeighborFrames &nf);
+
+    void packetSetSize(const StreamBase *stream, ulong frameVariableCount,
+            ulong &n, ulong &x, ulong &y);
+    static void buildFrameSet(FrameSet &frameSet);
+    QByteArray sharedFrameSetKey(const FrameSet &frameSet);
+    void findSharedFrameSet(FrameSet &frameSet);
+    static void publishSharedFrameSets(const QList<FrameSet> &frameSets);
+    bool fitPacketListBudget(QList<FrameSet> &frameSets);
+    void streamTxOffload(StreamBase *stream, TxOffloadInfo &info);
+    void updateTransmitEstimate();
+
     bool    isSendQueueDirty_;
+    quint64 packetListBytes_; // frame bytes added by the last build
+    bool    isPacketListStreamed_; // has generators that use the streams
 
     static const int kMaxPktSize = 16384;
+
+    // Per frame overhead of the packet list entry (pcap_pkthdr)
+    static const int kPacketEntryOverhead = 24;
+
+    // Max memory for the frames built in advance for a stream
+    static const quint64 kMaxFrameSetBytes = 256*1024*1024;
+
+    // A packet set of more than kMaxReplayExpansion times the stream's
+    // distinct frames (and kMinReplayBytes) has just the distinct frames
+    // built, which are then replayed - smaller sets are sent as is
+    static const quint64 kMaxReplayExpansion = 16;
+    static const quint64 kMinReplayBytes = 1024*1024;
+
+    // Frames generated for a continuous stream - effectively forever
+    static const quint64 kContinuousFrameCount = quint64(1) << 62;
+
+    // Preamble, SFD and inter frame gap sent with each frame
+    static const int kEthOverhead = 20;
     uchar   pktBuf_[kMaxPktSize];
 
     // When finding a corresponding device for a packet, we need to inspect
@@ -153,10 +467,94 @@ private:
     static const int kMaxL3PktSize = 80;
 
     /*! \note StreamBase::id() and index into streamList[] are NOT same! */
-    QList<StreamBase*>  streamList_;
+    QList<StreamBase*>  streamList_; // by ordinal - see sortStreams()
+    QHash<uint, StreamBase*> streamIndex_; // by id
+    void sortStreams();
+
+    // Frames built for each stream (key: stream id) are retained across
+    // packet list rebuilds; only those of modified streams are rebuilt
+    QHash<uint, FrameSet> frameSetCache_;
+
+    // Frame sets uploaded to the port (key: frame set id) and the uploads
+    // in progress, as received so far - see addFrameSetChunk()
+    struct UploadedFrames
+    {
+        QByteArray data; // all frames back to back
+        QVector<int> offset; // as FrameSet.offset
+        QVector<quint64> gapNsec;
+    };
+    QHash<uint, UploadedFrames> uploadedFrames_;
+    QHash<uint, QByteArray> frameSetUploads_;
+    static const int kFrameRecordHeaderSize = 6; // gap + length
+
+    // Frames built for the streams of all ports, by content (stream config
+    // less what doesn't change the frames) - identical streams on
+    // different ports build their frames once and share them (the Qt
+    // containers are implicitly shared, i.e. copy-on-write); a set no port
+    // refers to any more is dropped at the next build of any port; if the
+    // FrameSetStore is enabled, sets are also persisted there
+    struct SharedFrames
+    {
+        QByteArray data;
+        QVector<int> offset;
+    };
+    static QHash<QByteArray, SharedFrames> sharedFrameSets_;
+    static QMutex sharedFrameSetsLock_;
+
+    // See setPacketListBudget(); 0 => no limit
+    static quint64 portPacketListBudget_;
+    static quint64 totalPacketListBudget_;
+    static quint64 totalPacketListBytes_; // reserved by all ports
+    static QMutex packetListBudgetLock_;
+    static bool compactStreams_;
+    quint64 reservedPacketListBytes_; // by this port's last build
+    QString budgetNote_;
+
+    BuildProgress buildProgress_;
+
+    // Time taken by each stream (in streamList_ order) in the last build -
+    // building its frames and adding them to the packet list; a build
+    // that takes longer than kBuildNoteMinNsec has a port note of the
+    // slowest kBuildNoteStreams streams
+    QVector<quint64> streamBuildNsec_;
+    QString buildNote_;
+    void updateBuildNote(quint64 buildNsec);
+    static const quint64 kBuildNoteMinNsec = 1000000000ULL;
+    static const int kBuildNoteStreams = 5;
+
+    // Progress/cancellation is checked after every kBuildChunkFrames
+    // frames built
+    static const int kBuildChunkFrames = 4096;
+
+    // Device/neighbor MACs of each frame (upto frameVariableCount) of the
+    // streams that use them - resolved once per packet list build, instead
+    // of rendering each frame once more for every MAC lookup
+    struct ResolvedMacs
+    {
+        QVector<quint64> deviceMac;
+        QVector<quint64> neighborMac;
+    };
+    void resolveStreamMacs();
+    QHash<uint, ResolvedMacs> resolvedMacs_; // key: stream id
+    bool isResolvingMacs_;
+
+    // Beyond this, the MACs of a stream's frames are looked up per frame
+    static const int kMaxResolvedMacFrames = 1024*1024;
 
     struct PortStats    epochStats_;
+    StreamStatsHash     epochStreamStats_;
+    QList<quint64>      epochFilterCounts_;
+
+    QStringList         nicCounterNames_;
+    QList<quint64>      nicCounters_;
+    QList<quint64>      epochNicCounters_;
+
+    // Guards the epoch*_ stats and the counter filters - so that stats
+    // reads don't have to wait on the (config) writers of the port; never
+    // held for long
+    QMutex statsLock_;
 
+    void filterCountsLocked(QStringList &names, QList<quint64> &counts);
 };
 
 #endif
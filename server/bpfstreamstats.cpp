@@ -0,0 +1,263 @@
+/*
+Copyright (C) 2017 Srivats P.
+
+
+This file is part of "Ostinato"
+
+This is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+
+#include "bpfstreamstats.h"
+
+#ifdef HAVE_EBPF
+
+#include <QFile>
+#include <QVector>
+
+#include <errno.h>
+#include <linux/bpf.h>
+#include <linux/if_packet.h>
+#include <stddef.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#ifndef SO_ATTACH_BPF
+#define SO_ATTACH_BPF 50
+#endif
+
+// Value of a map entry (per cpu)
+struct BpfCounts
+{
+    quint64 pkts;
+    quint64 bytes;
+};
+
+static int bpf(int cmd, union bpf_attr *attr)
+{
+    return syscall(__NR_bpf, cmd, attr, sizeof(*attr));
+}
+
+static struct bpf_insn insn(quint8 code, quint8 dst, quint8 src,
+                            qint16 off, qint32 imm)
+{
+    struct bpf_insn i;
+
+    memset(&i, 0, sizeof(i));
+    i.code = code;
+    i.dst_reg = dst;
+    i.src_reg = src;
+    i.off = off;
+    i.imm = imm;
+
+    return i;
+}
+
+// Number of possible cpus - from /sys/devices/system/cpu/possible (0-N)
+static int possibleCpus()
+{
+    QFile file("/sys/devices/system/cpu/possible");
+    QByteArray cpus;
+    int sep;
+
+    if (!file.open(QIODevice::ReadOnly))
+        return int(sysconf(_SC_NPROCESSORS_CONF));
+
+    cpus = file.readAll().trimmed();
+    sep = qMax(cpus.lastIndexOf('-'), cpus.lastIndexOf(','));
+
+    return cpus.mid(sep + 1).toInt() + 1;
+}
+
+BpfStreamStats::BpfStreamStats()
+{
+    mapFd_ = progFd_ = -1;
+    cpuCount_ = possibleCpus();
+}
+
+BpfStreamStats::~BpfStreamStats()
+{
+    if (progFd_ >= 0)
+        close(progFd_);
+    if (mapFd_ >= 0)
+        close(mapFd_);
+}
+
+/*!
+  Creates the map and loads the filter program
+*/
+bool BpfStreamStats::load()
+{
+    union bpf_attr attr;
+    QVector<struct bpf_insn> prog;
+    char log[4096] = "";
+
+    memset(&attr, 0, sizeof(attr));
+    attr.map_type = BPF_MAP_TYPE_PERCPU_HASH;
+    attr.key_size = sizeof(quint64);
+    attr.value_size = sizeof(BpfCounts);
+    attr.max_entries = kMaxEntries;
+    mapFd_ = bpf(BPF_MAP_CREATE, &attr);
+    if (mapFd_ < 0) {
+        qWarning("unable to create stream stats bpf map (%s)",
+                strerror(errno));
+        return false;
+    }
+
+    // r6 = skb (LD_IND uses it implicitly); r7 = frame length; r8 =
+    // signature offset; r9 = key. Jump offsets are relative to the
+    // next insn - see the numbers on the right
+    prog
+        << insn(BPF_ALU64 | BPF_MOV | BPF_X, 6, 1, 0, 0)                //  0
+        // Our own tx frames are not counted
+        << insn(BPF_LDX | BPF_MEM | BPF_W, 7, 6,
+                offsetof(struct __sk_buff, pkt_type), 0)                //  1
+        << insn(BPF_JMP | BPF_JEQ | BPF_K, 7, 0, 38, PACKET_OUTGOING)   //  2
+        << insn(BPF_LDX | BPF_MEM | BPF_W, 7, 6,
+                offsetof(struct __sk_buff, len), 0)                     //  3
+        << insn(BPF_JMP | BPF_JGT | BPF_K, 7, 0, 1, kSignatureSize - 1) //  4
+        << insn(BPF_JMP | BPF_JA, 0, 0, 35, 0)                          //  5
+        // signatureOffset()
+        << insn(BPF_ALU64 | BPF_MOV | BPF_X, 8, 7, 0, 0)                //  6
+        << insn(BPF_ALU64 | BPF_ADD | BPF_K, 8, 0, 0, -kSignatureSize)  //  7
+        << insn(BPF_ALU64 | BPF_AND | BPF_K, 8, 0, 0, ~1)               //  8
+        << insn(BPF_LD | BPF_IND | BPF_W, 0, 8, 0, 0)                   //  9
+        << insn(BPF_JMP | BPF_JNE | BPF_K, 0, 0, 30, kSignatureMagic)   // 10
+        // key = port id << 32 | stream id
+        << insn(BPF_LD | BPF_IND | BPF_W, 0, 8, 0,
+                kSignatureStreamIdOffset)                               // 11
+        << insn(BPF_ALU64 | BPF_MOV | BPF_X, 9, 0, 0, 0)                // 12
+        << insn(BPF_LD | BPF_IND | BPF_H, 0, 8, 0,
+                kSignaturePortIdOffset)                                 // 13
+        << insn(BPF_ALU64 | BPF_LSH | BPF_K, 0, 0, 0, 32)               // 14
+        << insn(BPF_ALU64 | BPF_OR | BPF_X, 9, 0, 0, 0)                 // 15
+        << insn(BPF_STX | BPF_MEM | BPF_DW, 10, 9, -8, 0)               // 16
+        // Existing entry? Add to it
+        << insn(BPF_LD | BPF_DW | BPF_IMM, 1, BPF_PSEUDO_MAP_FD, 0,
+                mapFd_)                                                 // 17
+        << insn(0, 0, 0, 0, 0)                                          // 18
+        << insn(BPF_ALU64 | BPF_MOV | BPF_X, 2, 10, 0, 0)               // 19
+        << insn(BPF_ALU64 | BPF_ADD | BPF_K, 2, 0, 0, -8)               // 20
+        << insn(BPF_JMP | BPF_CALL, 0, 0, 0, BPF_FUNC_map_lookup_elem)  // 21
+        << insn(BPF_JMP | BPF_JEQ | BPF_K, 0, 0, 7, 0)                  // 22
+        << insn(BPF_LDX | BPF_MEM | BPF_DW, 1, 0,
+                offsetof(BpfCounts, pkts), 0)                           // 23
+        << insn(BPF_ALU64 | BPF_ADD | BPF_K, 1, 0, 0, 1)                // 24
+        << insn(BPF_STX | BPF_MEM | BPF_DW, 0, 1,
+                offsetof(BpfCounts, pkts), 0)                           // 25
+        << insn(BPF_LDX | BPF_MEM | BPF_DW, 1, 0,
+                offsetof(BpfCounts, bytes), 0)                          // 26
+        << insn(BPF_ALU64 | BPF_ADD | BPF_X, 1, 7, 0, 0)                // 27
+        << insn(BPF_STX | BPF_MEM | BPF_DW, 0, 1,
+                offsetof(BpfCounts, bytes), 0)                          // 28
+        << insn(BPF_JMP | BPF_JA, 0, 0, 11, 0)                          // 29
+        // ... else add an entry of {1, len} (for this cpu)
+        << insn(BPF_ALU64 | BPF_MOV | BPF_K, 1, 0, 0, 1)                // 30
+        << insn(BPF_STX | BPF_MEM | BPF_DW, 10, 1, -24, 0)              // 31
+        << insn(BPF_STX | BPF_MEM | BPF_DW, 10, 7, -16, 0)              // 32
+        << insn(BPF_LD | BPF_DW | BPF_IMM, 1, BPF_PSEUDO_MAP_FD, 0,
+                mapFd_)                                                 // 33
+        << insn(0, 0, 0, 0, 0)                                          // 34
+        << insn(BPF_ALU64 | BPF_MOV | BPF_X, 2, 10, 0, 0)               // 35
+        << insn(BPF_ALU64 | BPF_ADD | BPF_K, 2, 0, 0, -8)               // 36
+        << insn(BPF_ALU64 | BPF_MOV | BPF_X, 3, 10, 0, 0)               // 37
+        << insn(BPF_ALU64 | BPF_ADD | BPF_K, 3, 0, 0, -24)              // 38
+        << insn(BPF_ALU64 | BPF_MOV | BPF_K, 4, 0, 0, BPF_ANY)          // 39
+        << insn(BPF_JMP | BPF_CALL, 0, 0, 0, BPF_FUNC_map_update_elem)  // 40
+        // Drop - the monitor doesn't need any frame once this counts them
+        << insn(BPF_ALU64 | BPF_MOV | BPF_K, 0, 0, 0, 0)                // 41
+        << insn(BPF_JMP | BPF_EXIT, 0, 0, 0, 0);                        // 42
+
+    memset(&attr, 0, sizeof(attr));
+    attr.prog_type = BPF_PROG_TYPE_SOCKET_FILTER;
+    attr.insns = quint64(quintptr(prog.constData()));
+    attr.insn_cnt = prog.size();
+    attr.license = quint64(quintptr("GPL"));
+    attr.log_buf = quint64(quintptr(log));
+    attr.log_size = sizeof(log);
+    attr.log_level = 1;
+    progFd_ = bpf(BPF_PROG_LOAD, &attr);
+    if (progFd_ < 0) {
+        qWarning("unable to load stream stats bpf program (%s)\n%s",
+                strerror(errno), log);
+        close(mapFd_);
+        mapFd_ = -1;
+        return false;
+    }
+
+    return true;
+}
+
+/*!
+  Attaches the filter to packet socket fd (replacing its filter, if any);
+  returns false if eBPF is not available
+*/
+bool BpfStreamStats::attach(int fd)
+{
+    if ((progFd_ < 0) && !load())
+        return false;
+
+    if (setsockopt(fd, SOL_SOCKET, SO_ATTACH_BPF,
+                &progFd_, sizeof(progFd_)) < 0) {
+        qWarning("unable to attach stream stats bpf program (%s)",
+                strerror(errno));
+        return false;
+    }
+
+    return true;
+}
+
+/*!
+  Adds the rx counts of all entries (summed over the cpus) to stats
+*/
+void BpfStreamStats::addTo(StreamStatsHash &stats) const
+{
+    QVector<BpfCounts> values(cpuCount_);
+    quint64 key = ~quint64(0); // never a key - so next is the first
+    quint64 next;
+
+    if (mapFd_ < 0)
+        return;
+
+    forever {
+        union bpf_attr attr;
+
+        memset(&attr, 0, sizeof(attr));
+        attr.map_fd = mapFd_;
+        attr.key = quint64(quintptr(&key));
+        attr.next_key = quint64(quintptr(&next));
+        if (bpf(BPF_MAP_GET_NEXT_KEY, &attr) < 0)
+            break;
+
+        memset(&attr, 0, sizeof(attr));
+        attr.map_fd = mapFd_;
+        attr.key = quint64(quintptr(&next));
+        attr.value = quint64(quintptr(values.data()));
+        if (bpf(BPF_MAP_LOOKUP_ELEM, &attr) == 0) {
+            // The key's port id may have the payload CRC flag
+            StreamStats &s = stats[next
+                    & ~(quint64(kSignaturePayloadCrc) << 32)]; // zeroed, if new
+
+            for (int i = 0; i < values.size(); i++) {
+                s.rxPkts += values.at(i).pkts;
+                s.rxBytes += values.at(i).bytes;
+            }
+        }
+        key = next;
+    }
+}
+
+#endif
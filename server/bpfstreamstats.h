@@ -0,0 +1,65 @@
+/*
+Copyright (C) 2017 Srivats P.
+
+
+This file is part of "Ostinato"
+
+This is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+
+#ifndef _SERVER_BPF_STREAM_STATS_H
+#define _SERVER_BPF_STREAM_STATS_H
+
+#include <QtGlobal>
+
+#ifdef HAVE_EBPF
+
+#include "streamstats.h"
+
+/*!
+  Counts the tracked stream frames received on a packet socket in the
+  kernel - an eBPF socket filter parses the signature of each frame and
+  adds it to a per cpu hash map of rx packets/bytes keyed by
+  StreamStatsTable::key(); the filter then drops the frame, so nothing
+  reaches user space just to be counted
+
+  Only the rx packet and byte counts are kept - the sequence number and
+  latency stats need the per frame state of StreamStatsTable and are not
+  available when counting in the kernel
+
+  This is a TU of its own as the kernel's struct bpf_insn clashes with
+  pcap's
+*/
+class BpfStreamStats
+{
+public:
+    BpfStreamStats();
+    ~BpfStreamStats();
+
+    bool attach(int fd);
+    void addTo(StreamStatsHash &stats) const;
+
+private:
+    bool load();
+
+    static const int kMaxEntries = 1024;
+
+    int mapFd_;
+    int progFd_;
+    int cpuCount_;  // possible cpus - the per cpu values of an entry
+};
+
+#endif
+#endif
@@ -17,16 +17,29 @@ You should have received a copy of the GNU General Public License
 along with this program.  If not, see <http://www.gnu.org/licenses/>
 */
 
+#include <QtGlobal>
+
+#ifdef HAVE_BPF_ZBUF
+// Before pcap.h (via bsdport.h) - pcap's bpf.h then defers to this one
+#include <net/bpf.h>
+#endif
+
 #include "bsdport.h"
 
 #ifdef Q_OS_BSD4
 
+#include "latencyclock.h"
+#include "settings.h"
+
 #include <QByteArray>
 #include <QHash>
 #include <QTime>
 
 #include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/sysctl.h>
@@ -36,6 +49,11 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 #include <net/route.h>
 #include <unistd.h>
 
+#ifdef HAVE_NETMAP
+#define NETMAP_WITH_LIBS
+#include <net/netmap_user.h>
+#endif
+
 #ifdef Q_OS_MAC
 #define ifr_flagshigh ifr_flags
 #define IFF_PPROMISC (IFF_PROMISC << 16)
@@ -57,10 +75,38 @@ BsdPort::BsdPort(int id, const char *device)
     delete monitorTx_;
     monitorRx_ = monitorTx_ = NULL;
 
+    // ... except to look at the rx frames for stream stats
+    if (appSettings->value(kStreamStatsKey, kStreamStatsDefaultValue).toBool()) {
+        monitorRx_ = new PortMonitor(device, kDirectionRx, NULL);
+        if (monitorRx_->handle()) {
+            rxStreamStats_.enableHistograms();
+            monitorRx_->setStreamStats(&rxStreamStats_);
+        }
+        else {
+            delete monitorRx_;
+            monitorRx_ = NULL;
+        }
+    }
+
     // We have one monitor for both Rx/Tx of all ports
     if (!monitor_)
         monitor_ = new StatsMonitor();
 
+    // Capture can also use zero-copy BPF, if asked for
+    delete capturer_;
+    capturer_ = new PortCapturer(device);
+
+    // Transmit can use netmap, if asked for
+    delete transmitter_;
+    transmitter_ = new PortTransmitter(device);
+    for (int i = 0; i < txWorkers_.size(); i++) {
+        delete txWorkers_[i];
+        txWorkers_[i] = new PortTransmitter(device);
+        txWorkers_[i]->placer().setName(QString("tx%1").arg(i + 1));
+        txWorkers_[i]->metrics().setThread(QString("tx%1").arg(i + 1));
+        txWorkers_[i]->setStreamStatsLane(i + 1);
+    }
+
     data_.set_is_exclusive_control(hasExclusiveControl());
     minPacketSetSize_ = 16;
 
@@ -119,6 +165,9 @@ void BsdPort::init()
 
     monitor_->waitForSetupFinished();
 
+    if (monitorRx_)
+        monitorRx_->start();
+
     if (!isPromisc_)
         addNote("Non Promiscuous Mode");
 }
@@ -147,6 +196,7 @@ void BsdPort::StatsMonitor::run()
     int mib[] = {CTL_NET, PF_ROUTE, 0, 0, NET_RT_IFLIST, 0};
     const int mibLen = sizeof(mib)/sizeof(mib[0]);
     QHash<uint, PortStats*> portStats;
+    QHash<uint, BsdPort*> ports;
     QHash<uint, OstProto::LinkState*> linkState;
     int sd;
     QByteArray buf;
@@ -202,6 +252,7 @@ void BsdPort::StatsMonitor::run()
                 {
                     Q_ASSERT(ifm->ifm_index == sdl->sdl_index);
                     portStats[uint(ifm->ifm_index)] = &(port->stats_);
+                    ports[uint(ifm->ifm_index)] = port;
                     linkState[uint(ifm->ifm_index)] = &(port->linkState_);
 
                     // Set promisc mode, if not already set
@@ -294,33 +345,32 @@ void BsdPort::StatsMonitor::run()
 #endif
 
                 in_packets = ifd->ifi_ipackets + ifd->ifi_noproto;
-                stats->rxPps = 
-                    ((in_packets >= stats->rxPkts) ?
+                ports[ifm->ifm_index]->updateRates(
+                    (in_packets >= stats->rxPkts) ?
                          in_packets - stats->rxPkts :
-                         in_packets + (kMaxValue32 - stats->rxPkts))
-                     / kRefreshFreq_;
-                stats->rxBps  = 
-                    ((ifd->ifi_ibytes >= stats->rxBytes) ?
+                         in_packets + (kMaxValue32 - stats->rxPkts),
+                    (ifd->ifi_ibytes >= stats->rxBytes) ?
                          ifd->ifi_ibytes - stats->rxBytes :
-                         ifd->ifi_ibytes + (kMaxValue32 - stats->rxBytes))
-                     / kRefreshFreq_;
-                stats->rxPkts  = in_packets;
-                stats->rxBytes = ifd->ifi_ibytes;
-                stats->txPps  = 
-                    ((ifd->ifi_opackets >= stats->txPkts) ?
+                         ifd->ifi_ibytes + (kMaxValue32 - stats->rxBytes),
+                    (ifd->ifi_opackets >= stats->txPkts) ?
                          ifd->ifi_opackets - stats->txPkts :
-                         ifd->ifi_opackets + (kMaxValue32 - stats->txPkts))
-                     / kRefreshFreq_;
-                stats->txBps  = 
-                    ((ifd->ifi_obytes >= stats->txBytes) ?
+                         ifd->ifi_opackets + (kMaxValue32 - stats->txPkts),
+                    (ifd->ifi_obytes >= stats->txBytes) ?
                          ifd->ifi_obytes - stats->txBytes :
-                         ifd->ifi_obytes + (kMaxValue32 - stats->txBytes))
-                     / kRefreshFreq_;
+                         ifd->ifi_obytes + (kMaxValue32 - stats->txBytes));
+                stats->rxLock.writeBegin();
+                stats->rxPkts  = in_packets;
+                stats->rxBytes = ifd->ifi_ibytes;
+                stats->rxDrops = ifd->ifi_iqdrops;
+                stats->rxErrors = ifd->ifi_ierrors;
+                stats->rxLock.writeEnd();
+
+                stats->txLock.writeBegin();
                 stats->txPkts  = ifd->ifi_opackets;
                 stats->txBytes = ifd->ifi_obytes;
+                stats->txLock.writeEnd();
 
-                stats->rxDrops = ifd->ifi_iqdrops;
-                stats->rxErrors = ifd->ifi_ierrors;
+                ports[ifm->ifm_index]->updateRateControl();
             }
 _next:
             p += ifm->ifm_msglen;
@@ -330,6 +380,7 @@ _try_later:
     }
 
     portStats.clear();
+    ports.clear();
     linkState.clear();
 }
 
@@ -353,4 +404,691 @@ bool BsdPort::StatsMonitor::waitForSetupFinished(int msecs)
 
     return true;
 }
+
+/*
+ * ------------------------------------------------------------------- *
+ * Zero-copy BPF
+ * ------------------------------------------------------------------- *
+ */
+BsdPort::ZeroCopyBpf::ZeroCopyBpf()
+{
+    fd_ = -1;
+    buffer_[0] = buffer_[1] = NULL;
+    bufferSize_ = 0;
+    current_ = -1;
+    next_ = 0;
+}
+
+BsdPort::ZeroCopyBpf::~ZeroCopyBpf()
+{
+    close();
+}
+
+/*!
+  Opens a BPF device for the frames of the given direction, with the
+  filter (if any), in zero-copy mode with two buffers of bufferSize (or
+  the max the kernel allows, if less)
+
+  Returns false if zero-copy BPF is not available
+*/
+bool BsdPort::ZeroCopyBpf::open(const char *device, uint bufferSize,
+        const struct bpf_program *filter, Direction direction)
+{
+#ifdef HAVE_BPF_ZBUF
+    struct bpf_zbuf zbuf;
+    struct ifreq ifr;
+    u_int mode = BPF_BUFMODE_ZBUF;
+    u_int tstamp = BPF_T_NANOTIME;
+    u_int dir = (direction == kDirectionRx) ? BPF_D_IN : BPF_D_OUT;
+    size_t maxSize;
+    int pageSize = getpagesize();
+
+    fd_ = ::open("/dev/bpf", O_RDWR);
+    if (fd_ < 0) {
+        qDebug("%s: unable to open /dev/bpf (%s)", device, strerror(errno));
+        return false;
+    }
+
+    if (ioctl(fd_, BIOCSETBUFMODE, &mode) < 0) {
+        qDebug("%s: zero-copy BPF not supported (%s)", device,
+                strerror(errno));
+        goto _error;
+    }
+
+    if (ioctl(fd_, BIOCGETZMAX, &maxSize) == 0)
+        bufferSize = qMin(bufferSize, uint(maxSize));
+    bufferSize_ = ((bufferSize + pageSize - 1)/pageSize)*pageSize;
+
+    for (int i = 0; i < 2; i++) {
+        void *p = mmap(NULL, bufferSize_, PROT_READ | PROT_WRITE, MAP_ANON,
+                        -1, 0);
+        if (p == MAP_FAILED) {
+            qWarning("%s: unable to allocate BPF buffers (%s)", device,
+                    strerror(errno));
+            goto _error;
+        }
+        buffer_[i] = (uchar*) p;
+    }
+
+    // The buffers must be set before the interface
+    memset(&zbuf, 0, sizeof(zbuf));
+    zbuf.bz_bufa = buffer_[0];
+    zbuf.bz_bufb = buffer_[1];
+    zbuf.bz_buflen = bufferSize_;
+    if (ioctl(fd_, BIOCSETZBUF, &zbuf) < 0) {
+        qWarning("%s: unable to set BPF buffers (%s)", device,
+                strerror(errno));
+        goto _error;
+    }
+
+    memset(&ifr, 0, sizeof(ifr));
+    strncpy(ifr.ifr_name, device, sizeof(ifr.ifr_name) - 1);
+    if (ioctl(fd_, BIOCSETIF, &ifr) < 0) {
+        qWarning("%s: unable to attach BPF (%s)", device, strerror(errno));
+        goto _error;
+    }
+
+    // Records then have a struct bpf_xhdr with a timestamp in nsecs
+    if (ioctl(fd_, BIOCSTSTAMP, &tstamp) < 0) {
+        qWarning("%s: unable to set BPF nsec timestamps (%s)", device,
+                strerror(errno));
+        goto _error;
+    }
+
+    if (ioctl(fd_, BIOCSDIRECTION, &dir) < 0)
+        qDebug("%s: unable to set BPF direction (%s)", device,
+                strerror(errno));
+
+    if (ioctl(fd_, BIOCPROMISC, NULL) < 0)
+        qDebug("%s: unable to set promiscuous mode (%s)", device,
+                strerror(errno));
+
+    if (filter && (ioctl(fd_, BIOCSETF, filter) < 0)) {
+        qWarning("%s: unable to set BPF filter (%s)", device,
+                strerror(errno));
+        goto _error;
+    }
+
+    current_ = -1;
+    next_ = 0;
+    qDebug("%s: zero-copy BPF with 2 buffers of %u bytes", device,
+            bufferSize_);
+    return true;
+
+_error:
+    close();
+    return false;
+#else
+    Q_UNUSED(device);
+    Q_UNUSED(bufferSize);
+    Q_UNUSED(filter);
+    Q_UNUSED(direction);
+    return false;
+#endif
+}
+
+void BsdPort::ZeroCopyBpf::close()
+{
+    if (fd_ >= 0)
+        ::close(fd_);
+    fd_ = -1;
+
+    for (int i = 0; i < 2; i++) {
+        if (buffer_[i])
+            munmap(buffer_[i], bufferSize_);
+        buffer_[i] = NULL;
+    }
+}
+
+const uchar* BsdPort::ZeroCopyBpf::nextBuffer(int timeout, uint *length)
+{
+#ifdef HAVE_BPF_ZBUF
+    Q_ASSERT(current_ < 0);
+
+    for (int attempt = 0; attempt < 2; attempt++) {
+        struct pollfd pfd;
+        struct bpf_zbuf zbuf;
+
+        // A buffer is ours when its generations differ
+        for (int i = 0; i < 2; i++) {
+            int j = (next_ + i) % 2;
+            struct bpf_zbuf_header *hdr =
+                    (struct bpf_zbuf_header*) buffer_[j];
+
+            if (hdr->bzh_kernel_gen != hdr->bzh_user_gen) {
+                // Don't read the length (or data) before the generation
+                __sync_synchronize();
+                current_ = j;
+                next_ = (j + 1) % 2;
+                *length = hdr->bzh_kernel_len;
+                return buffer_[j] + sizeof(*hdr);
+            }
+        }
+
+        if (attempt)
+            break;
+
+        pfd.fd = fd_;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+
+        // No full buffer in time - take whatever the kernel has so far
+        if ((poll(&pfd, 1, timeout) == 0)
+                && (ioctl(fd_, BIOCROTZBUF, &zbuf) < 0))
+            break;
+    }
+#else
+    Q_UNUSED(timeout);
+    Q_UNUSED(length);
+#endif
+
+    return NULL;
+}
+
+void BsdPort::ZeroCopyBpf::releaseBuffer()
+{
+#ifdef HAVE_BPF_ZBUF
+    struct bpf_zbuf_header *hdr;
+
+    Q_ASSERT(current_ >= 0);
+    hdr = (struct bpf_zbuf_header*) buffer_[current_];
+
+    // We are done with the data before the kernel gets it back
+    __sync_synchronize();
+    hdr->bzh_user_gen = hdr->bzh_kernel_gen;
+    current_ = -1;
+#endif
+}
+
+// Frames dropped as both buffers were full - since open()
+quint64 BsdPort::ZeroCopyBpf::drops()
+{
+#ifdef HAVE_BPF_ZBUF
+    struct bpf_stat stat;
+
+    if (ioctl(fd_, BIOCGSTATS, &stat) == 0)
+        return stat.bs_drop;
+#endif
+    return 0;
+}
+
+/*
+ * ------------------------------------------------------------------- *
+ * Port Monitor
+ * ------------------------------------------------------------------- *
+ */
+/*
+  Looks at the frames via zero-copy BPF instead of pcap - we wakeup once
+  per buffer of frames, not per read() of the pcap buffer
+
+  Falls back to the pcap handle opened by PcapPort::PortMonitor if
+  zero-copy BPF is not available
+*/
+BsdPort::PortMonitor::PortMonitor(const char *device, Direction direction,
+        AbstractPort::PortStats *stats)
+    : PcapPort::PortMonitor(device, direction, stats)
+{
+    if (!handle())
+        return;
+
+    if (!bpf_.open(device, kBufferSize, NULL, direction)) {
+        qWarning("%s: zero-copy BPF not available, using pcap to receive",
+                device);
+        return;
+    }
+
+    // Retain the pcap handle (for promisc mode), but don't let it take
+    // any frames
+    struct bpf_insn dropAll = BPF_STMT(BPF_RET | BPF_K, 0);
+    struct bpf_program program = { 1, &dropAll };
+
+    if (pcap_setfilter(handle(), &program) < 0)
+        qDebug("%s: unable to set pcap drop filter (%s)", device,
+                pcap_geterr(handle()));
+}
+
+void BsdPort::PortMonitor::run()
+{
+    if (!bpf_.isOpen()) {
+        PcapPort::PortMonitor::run();
+        return;
+    }
+
+    ThreadPlacer::Scope placement(placer());
+
+    while (!stop_)
+    {
+        const uchar *buffer;
+        uint length;
+
+        // Timeout so that we see stop_ in reasonable time
+        buffer = bpf_.nextBuffer(100 /* ms */, &length);
+        if (!buffer)
+            continue;
+
+        processBuffer(buffer, length);
+        bpf_.releaseBuffer();
+
+        metrics_.set(OstProto::DroneMetric::kRxDrops, bpf_.drops());
+    }
+}
+
+void BsdPort::PortMonitor::processBuffer(const uchar *buffer, uint length)
+{
+#ifdef HAVE_BPF_ZBUF
+    const uchar *p = buffer;
+    const uchar *end = buffer + length;
+    bool isRx = (direction() == kDirectionRx);
+
+    while (p < end)
+    {
+        const struct bpf_xhdr *hdr = (const struct bpf_xhdr*) p;
+
+        if (stats_) {
+            if (isRx) {
+                stats_->rxLock.writeBegin();
+                stats_->rxPkts++;
+                stats_->rxBytes += hdr->bh_datalen;
+                stats_->rxLock.writeEnd();
+            }
+            else {
+                stats_->txLock.writeBegin();
+                stats_->txPkts++;
+                stats_->txBytes += hdr->bh_datalen;
+                stats_->txLock.writeEnd();
+            }
+        }
+        if (isRx && streamStats_ && (hdr->bh_caplen == hdr->bh_datalen))
+            streamStats_->countRx(p + hdr->bh_hdrlen, hdr->bh_datalen,
+                    LatencyClock::fromSystemTime(
+                        quint64(hdr->bh_tstamp.bt_sec)*quint64(1e9)
+                            + hdr->bh_tstamp.bt_frac));
+
+        p += BPF_WORDALIGN(hdr->bh_hdrlen + hdr->bh_caplen);
+    }
+#else
+    Q_UNUSED(buffer);
+    Q_UNUSED(length);
+#endif
+}
+
+/*
+ * ------------------------------------------------------------------- *
+ * Port Capturer
+ * ------------------------------------------------------------------- *
+ */
+BsdPort::PortCapturer::PortCapturer(const char *device)
+    : PcapPort::PortCapturer(device)
+{
+}
+
+void BsdPort::PortCapturer::run()
+{
+    if (config_.is_high_rate() && zeroCopyCapture())
+        return;
+
+    if (config_.is_high_rate())
+        qWarning("%s: zero-copy BPF capture not available, using pcap",
+                device_.toAscii().constData());
+    PcapPort::PortCapturer::run();
+}
+
+/*
+  High rate capture - the kernel fills the zero-copy BPF buffers (each
+  half the buffer_size of the capture config) with the filtered frames
+  and we write a whole buffer of them (as pcap records) to the capture
+  file at a time
+
+  Returns false if the capture couldn't be started
+*/
+bool BsdPort::PortCapturer::zeroCopyCapture()
+{
+    ThreadPlacer::Scope placement(placer());
+    QByteArray device = device_.toAscii();
+    char errbuf[PCAP_ERRBUF_SIZE] = "";
+    bpf_u_int32 net, mask;
+    struct bpf_program fp;
+    struct pcap_file_header fileHdr;
+    QFile file;
+    ZeroCopyBpf bpf;
+    int snapLen = int(qMax(1U, config_.snap_len()));
+    uint bufferSize = qMax(uint(kMinBufferSize),
+                            config_.buffer_size()*1024/2);
+    bool isOpen;
+
+    if (!capFile_.isOpen())
+        return false;
+
+    if (pcap_lookupnet(device.constData(), &net, &mask, errbuf) == -1)
+        mask = 0;
+
+    // The capture filter with the snap length as its return value
+    if (pcap_compile_nopcap(snapLen, DLT_EN10MB, &fp,
+                filter_.toAscii().constData(), 1, mask) < 0) {
+        qDebug("%s: can't compile BPF program: %s", device.constData(),
+                filter_.toAscii().constData());
+        return false;
+    }
+
+    isOpen = bpf.open(device.constData(), bufferSize, &fp, kDirectionRx);
+    pcap_freecode(&fp);
+    if (!isOpen)
+        return false;
+
+    if (CaptureRing::isRing(config_)) {
+        if (!ring_.open(config_, snapLen, capFile_.fileName()))
+            return false;
+        goto _capture;
+    }
+
+    file.setFileName(capFile_.fileName());
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        qWarning("unable to open %s (%s)", qPrintable(file.fileName()),
+                qPrintable(file.errorString()));
+        return false;
+    }
+
+    memset(&fileHdr, 0, sizeof(fileHdr));
+    fileHdr.magic = 0xa1b2c3d4;
+    fileHdr.version_major = PCAP_VERSION_MAJOR;
+    fileHdr.version_minor = PCAP_VERSION_MINOR;
+    fileHdr.snaplen = snapLen;
+    fileHdr.linktype = DLT_EN10MB;
+    file.write((const char*) &fileHdr, sizeof(fileHdr));
+
+_capture:
+    analytics_.reset();
+    state_.set(kRunning);
+    // Done => a triggered capture has its window
+    while (!stop_ && !ring_.isDone())
+    {
+        const uchar *buffer;
+        uint length;
+
+        buffer = bpf.nextBuffer(100 /* ms */, &length);
+        if (!buffer)
+            continue;
+
+        processBuffer(buffer, length, &file);
+        bpf.releaseBuffer();
+    }
+
+    qDebug("%s: zero-copy BPF capture dropped %llu", device.constData(),
+            bpf.drops());
+    metrics_.add(OstProto::DroneMetric::kRxDrops, bpf.drops());
+
+    file.close();
+    bpf.close();
+    stop_ = false;
+    state_.set(kFinished);
+    return true;
+}
+
+void BsdPort::PortCapturer::processBuffer(const uchar *buffer, uint length,
+        QFile *file)
+{
+#ifdef HAVE_BPF_ZBUF
+    const uchar *p = buffer;
+    const uchar *end = buffer + length;
+    bool isRing = ring_.isOpen();
+    QByteArray records;
+
+    if (!isRing)
+        records.reserve(length);
+
+    while (p < end)
+    {
+        const struct bpf_xhdr *hdr = (const struct bpf_xhdr*) p;
+
+        if (sigFilter_.isOpen() && !sigFilter_.match(p + hdr->bh_hdrlen,
+                                        hdr->bh_datalen, hdr->bh_caplen)) {
+            p += BPF_WORDALIGN(hdr->bh_hdrlen + hdr->bh_caplen);
+            continue;
+        }
+
+        analytics_.add(quint64(hdr->bh_tstamp.bt_sec)*1000000000
+                            + hdr->bh_tstamp.bt_frac,
+                hdr->bh_datalen, p + hdr->bh_hdrlen, hdr->bh_caplen);
+
+        if (isRing) {
+            struct pcap_pkthdr pktHdr;
+
+            pktHdr.ts.tv_sec = hdr->bh_tstamp.bt_sec;
+            pktHdr.ts.tv_usec = hdr->bh_tstamp.bt_frac/1000;
+            pktHdr.caplen = hdr->bh_caplen;
+            pktHdr.len = hdr->bh_datalen;
+            ring_.append(&pktHdr, p + hdr->bh_hdrlen);
+        }
+        else {
+            // pcap file record header - with 32 bit timestamps
+            quint32 rec[4];
+
+            rec[0] = hdr->bh_tstamp.bt_sec;
+            rec[1] = hdr->bh_tstamp.bt_frac/1000;
+            rec[2] = hdr->bh_caplen;
+            rec[3] = hdr->bh_datalen;
+            records.append((const char*) rec, sizeof(rec));
+            records.append((const char*) p + hdr->bh_hdrlen, hdr->bh_caplen);
+        }
+
+        p += BPF_WORDALIGN(hdr->bh_hdrlen + hdr->bh_caplen);
+    }
+
+    if (!isRing)
+        file->write(records);
+#else
+    Q_UNUSED(buffer);
+    Q_UNUSED(length);
+    Q_UNUSED(file);
+#endif
+}
+
+/*
+ * ------------------------------------------------------------------- *
+ * Port Transmitter
+ * ------------------------------------------------------------------- *
+ */
+/*
+  With the TxEngine setting as "Netmap", frames are sent via a netmap tx
+  ring - a batch of frames is handed to the NIC per NIOCTXSYNC instead of
+  a write() per frame; the port is in netmap mode only while transmitting
+  (entering it may reset the link on some NICs)
+
+  Falls back to pcap (see PcapPort) if netmap is not available
+*/
+BsdPort::PortTransmitter::PortTransmitter(const char *device)
+    : PcapPort::PortTransmitter(device)
+{
+    device_ = device;
+    useNetmap_ = false;
+    netmap_ = NULL;
+    txRing_ = NULL;
+    pendingPkts_ = 0;
+    pendingBytes_ = 0;
+
+#ifdef HAVE_NETMAP
+    useNetmap_ = appSettings->value(kTxEngineKey,
+                        kTxEngineDefaultValue).toString() == "Netmap";
+#endif
+}
+
+void BsdPort::PortTransmitter::run()
+{
+#ifdef HAVE_NETMAP
+    if (useNetmap_) {
+        // Only the first tx ring - so that frames are sent in order
+        QByteArray name = QString("netmap:%1-0/T").arg(device_).toAscii();
+
+        netmap_ = nm_open(name.constData(), NULL, 0, NULL);
+        if (netmap_)
+            txRing_ = NETMAP_TXRING(netmap_->nifp, netmap_->first_tx_ring);
+        else
+            qWarning("%s: unable to open netmap port (%s), using pcap",
+                    qPrintable(device_), strerror(errno));
+    }
+#endif
+
+    PcapPort::PortTransmitter::run();
+
+#ifdef HAVE_NETMAP
+    if (netmap_) {
+        flushTxRing();
+        nm_close(netmap_);
+        netmap_ = NULL;
+        txRing_ = NULL;
+    }
+#endif
+}
+
+int BsdPort::PortTransmitter::sendQueueTransmit(pcap_t *p,
+        pcap_send_queue *queue, qint64 &overHead, int sync)
+{
+    TimeStamp ovrStart, ovrEnd;
+    struct timeval ts;
+    struct pcap_pkthdr *hdr = (struct pcap_pkthdr*) queue->buffer;
+    char *end = queue->buffer + queue->len;
+
+    if (!txRing_)
+        return PcapPort::PortTransmitter::sendQueueTransmit(p, queue,
+                    overHead, sync);
+
+    ts = hdr->ts;
+
+    getTimeStamp(&ovrStart);
+    while((char*) hdr < end)
+    {
+        uchar *pkt = (uchar*)hdr + sizeof(*hdr);
+        int pktLen = hdr->caplen;
+        int ret;
+
+        if (sync)
+        {
+            qint64 nsec = pacedGap(nsecTsDiff(hdr->ts, ts));
+
+            getTimeStamp(&ovrEnd);
+
+            overHead -= ndiffTimeStamp(&ovrStart, &ovrEnd);
+            Q_ASSERT(overHead <= 0);
+            nsec += overHead;
+            if (isPastStopTime(nsec))
+                return (flushTxRing() < 0) ? -1 : -2;
+            if (nsec > 0)
+            {
+                // Frames queued so far must go out before we wait
+                if (flushTxRing() < 0)
+                    return -1;
+                (*ndelayFn_)(nsec);
+                overHead = 0;
+            }
+            else
+                overHead = nsec;
+
+            ts = hdr->ts;
+            getTimeStamp(&ovrStart);
+        }
+
+        Q_ASSERT(pktLen > 0);
+
+        streamStats_.stampTx(pkt, pktLen);
+        ret = queueTxFrame(pkt, pktLen);
+        if (ret < 0)
+            return ret;
+
+        // Step to the next packet in the buffer
+        hdr = (struct pcap_pkthdr*) (pkt + pktLen);
+        pkt = (uchar*) ((uchar*)hdr + sizeof(*hdr));
+
+        if (stop_)
+        {
+            flushTxRing();
+            return -2;
+        }
+    }
+
+    return flushTxRing();
+}
+
+/*!
+  Queues the frame in the netmap tx ring, waiting for a free slot if the
+  ring is full; a frame too large for a slot is sent via pcap (after the
+  frames queued before it)
+
+  Returns 0 on success, -1 on error and -2 if stopped while waiting
+*/
+int BsdPort::PortTransmitter::queueTxFrame(const uchar *frame, int length)
+{
+#ifdef HAVE_NETMAP
+    struct netmap_slot *slot;
+
+    if (length > int(txRing_->nr_buf_size)) {
+        if (flushTxRing() < 0)
+            return -1;
+        if (pcap_sendpacket(handle_, frame, length) < 0)
+            metrics_.add(OstProto::DroneMetric::kTxSendErrors);
+        stats_->txLock.writeBegin();
+        stats_->txPkts++;
+        stats_->txBytes += length;
+        stats_->txLock.writeEnd();
+        return 0;
+    }
+
+    while (nm_ring_empty(txRing_))
+    {
+        struct pollfd pfd;
+
+        if (flushTxRing() < 0)
+            return -1;
+        if (!nm_ring_empty(txRing_))
+            break;
+
+        // Ring full - wait for the NIC to send some
+        metrics_.add(OstProto::DroneMetric::kTxSendRetries);
+        pfd.fd = NETMAP_FD(netmap_);
+        pfd.events = POLLOUT;
+        pfd.revents = 0;
+        poll(&pfd, 1, 100 /* ms */);
+        if (stop_)
+            return -2;
+    }
+
+    slot = &txRing_->slot[txRing_->cur];
+    memcpy(NETMAP_BUF(txRing_, slot->buf_idx), frame, length);
+    slot->len = length;
+    txRing_->head = txRing_->cur = nm_ring_next(txRing_, txRing_->cur);
+
+    pendingPkts_++;
+    pendingBytes_ += length;
+    if (pendingPkts_ >= kTxRingMaxBatch)
+        return flushTxRing();
+#else
+    Q_UNUSED(frame);
+    Q_UNUSED(length);
+#endif
+
+    return 0;
+}
+
+// Hands the queued frames to the NIC
+int BsdPort::PortTransmitter::flushTxRing()
+{
+#ifdef HAVE_NETMAP
+    if (ioctl(NETMAP_FD(netmap_), NIOCTXSYNC, NULL) < 0) {
+        qWarning("%s: NIOCTXSYNC failed (%s)", qPrintable(device_),
+                strerror(errno));
+        metrics_.add(OstProto::DroneMetric::kTxSendErrors, pendingPkts_);
+        pendingPkts_ = 0;
+        pendingBytes_ = 0;
+        return -1;
+    }
+#endif
+
+    stats_->txLock.writeBegin();
+    stats_->txPkts += pendingPkts_;
+    stats_->txBytes += pendingBytes_;
+    stats_->txLock.writeEnd();
+    pendingPkts_ = 0;
+    pendingBytes_ = 0;
+
+    return 0;
+}
 #endif
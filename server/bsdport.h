@@ -26,6 +26,9 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 
 #include "pcapport.h"
 
+struct nm_desc;
+struct netmap_ring;
+
 class BsdPort : public PcapPort
 {
 public:
@@ -51,6 +54,80 @@ protected:
         bool setupDone_;
     };
 
+    // A BPF device in zero-copy mode (FreeBSD's BIOCSETZBUF) - the kernel
+    // fills two buffers shared with us in turn, so a whole buffer of frames
+    // is looked at per wakeup without a read() copying it
+    class ZeroCopyBpf
+    {
+    public:
+        ZeroCopyBpf();
+        ~ZeroCopyBpf();
+        bool open(const char *device, uint bufferSize,
+                  const struct bpf_program *filter, Direction direction);
+        void close();
+        bool isOpen() { return fd_ >= 0; }
+        // Returns the next buffer of frames (as BPF records) waiting upto
+        // timeout msecs for one; NULL if none - release it when done
+        const uchar* nextBuffer(int timeout, uint *length);
+        void releaseBuffer();
+        quint64 drops();
+    private:
+        int fd_;
+        uchar *buffer_[2];
+        uint bufferSize_;
+        int current_;   // buffer with the user; -1 => none
+        int next_;      // buffer the kernel hands over next
+    };
+
+    class PortMonitor: public PcapPort::PortMonitor
+    {
+    public:
+        PortMonitor(const char *device, Direction direction,
+                AbstractPort::PortStats *stats);
+        void run();
+    private:
+        void processBuffer(const uchar *buffer, uint length);
+
+        static const int kBufferSize = 1024*1024;
+
+        ZeroCopyBpf bpf_;
+    };
+
+    class PortCapturer: public PcapPort::PortCapturer
+    {
+    public:
+        PortCapturer(const char *device);
+        void run();
+    private:
+        bool zeroCopyCapture();
+        void processBuffer(const uchar *buffer, uint length, QFile *file);
+
+        static const uint kMinBufferSize = 1024*1024;
+    };
+
+    class PortTransmitter: public PcapPort::PortTransmitter
+    {
+    public:
+        PortTransmitter(const char *device);
+        void run();
+    protected:
+        virtual int sendQueueTransmit(pcap_t *p, pcap_send_queue *queue,
+                    qint64 &overHead, int sync);
+    private:
+        int queueTxFrame(const uchar *frame, int length);
+        int flushTxRing();
+
+        // Max frames queued in the ring before we kick the NIC
+        static const int kTxRingMaxBatch = 256;
+
+        QString device_;
+        bool useNetmap_;
+        struct nm_desc *netmap_;
+        struct netmap_ring *txRing_;
+        int pendingPkts_;
+        quint64 pendingBytes_;
+    };
+
     bool isPromisc_;
     bool clearPromisc_;
     static QList<BsdPort*> allPorts_;
@@ -0,0 +1,337 @@
+/*
+Copyright (C) 2017 Srivats P.
+
+
+This file is part of "Ostinato"
+
+This is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+
+#include "captureanalytics.h"
+
+#include <QMutexLocker>
+#include <QtAlgorithms>
+#include <QtEndian>
+#include <string.h>
+
+// Upper bounds (frame length incl. FCS as captured) of the size buckets -
+// as the RMON etherStatsPkts* buckets, plus jumbo frames
+const uint CaptureAnalytics::kSizeBucketMax[kSizeBuckets] = {
+    63, 64, 127, 255, 511, 1023, 1518, 2047, 9216, 0xffffffff
+};
+
+bool CaptureAnalytics::FlowKey::operator==(const FlowKey &other) const
+{
+    return memcmp(this, &other, sizeof(*this)) == 0;
+}
+
+uint qHash(const CaptureAnalytics::FlowKey &key)
+{
+    const uchar *p = (const uchar*) &key;
+    quint64 h = Q_UINT64_C(0xcbf29ce484222325);
+
+    // FNV-1a; the key has no padding and is zeroed before it is filled
+    for (uint i = 0; i < sizeof(key); i++)
+        h = (h ^ p[i]) * Q_UINT64_C(0x100000001b3);
+
+    return uint(h ^ (h >> 32));
+}
+
+static bool flowGreaterThan(const OstProto::CaptureFlow &a,
+                            const OstProto::CaptureFlow &b)
+{
+    return a.packets() > b.packets();
+}
+
+CaptureAnalytics::CaptureAnalytics()
+{
+    reset();
+}
+
+void CaptureAnalytics::reset(bool isNsec)
+{
+    QMutexLocker locker(&lock_);
+
+    isNsec_ = isNsec;
+    total_ = Count();
+    firstNsec_ = lastNsec_ = 0;
+
+    etherType_.clear();
+    for (int i = 0; i < 256; i++)
+        ipProtocol_[i] = Count();
+
+    flowIndex_.clear();
+    flows_.clear();
+    flows_.reserve(kFlows);
+
+    memset(size_, 0, sizeof(size_));
+
+    rate_.clear();
+    rateStart_ = 0;
+}
+
+void CaptureAnalytics::add(const struct pcap_pkthdr *hdr, const uchar *data)
+{
+    quint64 nsec = quint64(hdr->ts.tv_sec)*1000000000
+                    + quint64(hdr->ts.tv_usec)*(isNsec_ ? 1 : 1000);
+
+    add(nsec, hdr->len, data, hdr->caplen);
+}
+
+/*!
+  Counts a frame of length bytes (on the wire) captured at nsec (since the
+  epoch) - data is the first caplen bytes of it
+*/
+void CaptureAnalytics::add(quint64 nsec, uint length, const uchar *data,
+        uint caplen)
+{
+    QMutexLocker locker(&lock_);
+    quint16 etherType;
+    FlowKey flow;
+    int i;
+
+    if (!total_.packets)
+        firstNsec_ = nsec;
+    if (nsec > lastNsec_)
+        lastNsec_ = nsec;
+    total_.packets++;
+    total_.bytes += length;
+
+    for (i = 0; length > kSizeBucketMax[i]; i++)
+        ;
+    size_[i]++;
+
+    countRate(nsec, length);
+
+    if (!parse(data, caplen, etherType, flow))
+        return;
+
+    Count &count = etherType_[etherType];
+    count.packets++;
+    count.bytes += length;
+
+    if (flow.ipVersion) {
+        ipProtocol_[flow.protocol].packets++;
+        ipProtocol_[flow.protocol].bytes += length;
+        countFlow(flow, length);
+    }
+}
+
+void CaptureAnalytics::snapshot(OstProto::CaptureAnalytics *analytics)
+{
+    QMutexLocker locker(&lock_);
+    QList<OstProto::CaptureFlow> flows;
+
+    analytics->set_packets(total_.packets);
+    analytics->set_bytes(total_.bytes);
+    analytics->set_first_time(firstNsec_);
+    analytics->set_last_time(lastNsec_);
+
+    QHashIterator<quint16, Count> iter(etherType_);
+    while (iter.hasNext()) {
+        OstProto::CaptureProtocolCount *p = analytics->add_ether_type();
+
+        iter.next();
+        p->set_id(iter.key());
+        p->set_packets(iter.value().packets);
+        p->set_bytes(iter.value().bytes);
+    }
+
+    for (int i = 0; i < 256; i++) {
+        if (!ipProtocol_[i].packets)
+            continue;
+
+        OstProto::CaptureProtocolCount *p = analytics->add_ip_protocol();
+        p->set_id(i);
+        p->set_packets(ipProtocol_[i].packets);
+        p->set_bytes(ipProtocol_[i].bytes);
+    }
+
+    for (int i = 0; i < flows_.size(); i++) {
+        const Flow &f = flows_.at(i);
+        int addrLen = (f.key.ipVersion == 4) ? 4 : 16;
+        OstProto::CaptureFlow flow;
+
+        flow.set_ip_version(f.key.ipVersion);
+        flow.set_src_ip(f.key.srcIp, addrLen);
+        flow.set_dst_ip(f.key.dstIp, addrLen);
+        flow.set_protocol(f.key.protocol);
+        flow.set_src_port(f.key.srcPort);
+        flow.set_dst_port(f.key.dstPort);
+        flow.set_packets(f.count.packets);
+        flow.set_bytes(f.count.bytes);
+        flow.set_error(f.error);
+        flows.append(flow);
+    }
+    qSort(flows.begin(), flows.end(), flowGreaterThan);
+    for (int i = 0; i < flows.size(); i++)
+        analytics->add_top_flow()->CopyFrom(flows.at(i));
+
+    for (int i = 0; i < kSizeBuckets; i++) {
+        OstProto::CaptureSizeBucket *b = analytics->add_size();
+
+        b->set_max_length(kSizeBucketMax[i]);
+        b->set_packets(size_[i]);
+    }
+
+    analytics->set_interval(kIntervalNsec);
+    for (int i = 0; i < rate_.size(); i++) {
+        OstProto::CaptureRateSample *r = analytics->add_rate();
+
+        r->set_time(firstNsec_ + (rateStart_ + i)*kIntervalNsec);
+        r->set_packets(rate_.at(i).packets);
+        r->set_bytes(rate_.at(i).bytes);
+    }
+}
+
+/*
+  Ethertype (after any VLAN tags; 0 for an 802.3 length field) and, for
+  IPv4/IPv6, the flow; false if the frame is too short to tell
+*/
+bool CaptureAnalytics::parse(const uchar *data, uint caplen,
+        quint16 &etherType, FlowKey &flow) const
+{
+    uint offset = 12;
+    uint ipHdrLen;
+
+    memset(&flow, 0, sizeof(flow));
+
+    if (caplen < offset + 2)
+        return false;
+    etherType = qFromBigEndian<quint16>(data + offset);
+    offset += 2;
+
+    for (int tags = 0; tags < 2; tags++) {
+        if ((etherType != 0x8100) && (etherType != 0x88a8)
+                && (etherType != 0x9100))
+            break;
+        if (caplen < offset + 4)
+            return false;
+        etherType = qFromBigEndian<quint16>(data + offset + 2);
+        offset += 4;
+    }
+
+    if (etherType < 0x0600) {
+        etherType = 0;
+        return true;
+    }
+
+    if ((etherType == 0x0800) && (caplen >= offset + 20)) {
+        const uchar *ip = data + offset;
+
+        if ((ip[0] >> 4) != 4)
+            return true;
+        flow.ipVersion = 4;
+        flow.protocol = ip[9];
+        memcpy(flow.srcIp, ip + 12, 4);
+        memcpy(flow.dstIp, ip + 16, 4);
+        ipHdrLen = (ip[0] & 0x0f)*4;
+
+        // No ports in the non-first fragments
+        if (qFromBigEndian<quint16>(ip + 6) & 0x1fff)
+            return true;
+    }
+    else if ((etherType == 0x86dd) && (caplen >= offset + 40)) {
+        const uchar *ip = data + offset;
+
+        if ((ip[0] >> 4) != 6)
+            return true;
+        flow.ipVersion = 6;
+        flow.protocol = ip[6];
+        memcpy(flow.srcIp, ip + 8, 16);
+        memcpy(flow.dstIp, ip + 24, 16);
+        ipHdrLen = 40;
+    }
+    else
+        return true;
+
+    offset += ipHdrLen;
+    if (((flow.protocol == 6) || (flow.protocol == 17)
+                || (flow.protocol == 132))
+            && (caplen >= offset + 4)) {
+        flow.srcPort = qFromBigEndian<quint16>(data + offset);
+        flow.dstPort = qFromBigEndian<quint16>(data + offset + 2);
+    }
+
+    return true;
+}
+
+// Space-Saving - see the class description
+void CaptureAnalytics::countFlow(const FlowKey &key, uint length)
+{
+    QHash<FlowKey, int>::const_iterator iter = flowIndex_.constFind(key);
+    int min = 0;
+
+    if (iter != flowIndex_.constEnd()) {
+        Flow &flow = flows_[iter.value()];
+
+        flow.count.packets++;
+        flow.count.bytes += length;
+        return;
+    }
+
+    if (flows_.size() < kFlows) {
+        Flow flow;
+
+        flow.key = key;
+        flow.count.packets = 1;
+        flow.count.bytes = length;
+        flow.error = 0;
+        flowIndex_.insert(key, flows_.size());
+        flows_.append(flow);
+        return;
+    }
+
+    for (int i = 1; i < flows_.size(); i++) {
+        if (flows_.at(i).count.packets < flows_.at(min).count.packets)
+            min = i;
+    }
+
+    Flow &flow = flows_[min];
+    flowIndex_.remove(flow.key);
+    flow.key = key;
+    flow.error = flow.count.packets;
+    flow.count.packets++;
+    flow.count.bytes = length; // bytes of the flow taken over are not kept
+    flowIndex_.insert(key, min);
+}
+
+// Samples of the last kMaxIntervals intervals
+void CaptureAnalytics::countRate(quint64 nsec, uint length)
+{
+    quint64 interval = (nsec > firstNsec_) ?
+                            (nsec - firstNsec_)/kIntervalNsec : 0;
+    quint64 end = rateStart_ + rate_.size();
+
+    if (interval >= end) {
+        if ((interval - rateStart_) >= quint64(kMaxIntervals)) {
+            quint64 start = interval - kMaxIntervals + 1;
+
+            if (start >= end)
+                rate_.clear();
+            else
+                rate_.remove(0, int(start - rateStart_));
+            rateStart_ = start;
+        }
+        rate_.resize(int(interval - rateStart_ + 1));
+    }
+
+    // A frame timestamped before the oldest sample (out of order) is
+    // counted in that sample
+    Count &count = rate_[(interval > rateStart_) ?
+                                int(interval - rateStart_) : 0];
+    count.packets++;
+    count.bytes += length;
+}
@@ -0,0 +1,114 @@
+/*
+Copyright (C) 2017 Srivats P.
+
+
+This file is part of "Ostinato"
+
+This is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+
+#ifndef _CAPTURE_ANALYTICS_H
+#define _CAPTURE_ANALYTICS_H
+
+#include "../common/protocol.pb.h"
+
+#include <QHash>
+#include <QMutex>
+#include <QVector>
+#include <pcap.h>
+
+/*!
+  Aggregates of the frames of a capture, kept as they are captured - the
+  protocol mix (ethertypes and IP protocols), the top flows by packets,
+  a frame size histogram and the rate per interval - so that a client
+  can look at a capture without downloading it (getCaptureAnalytics)
+
+  The top flows are a Space-Saving sketch of kFlows counters - a flow
+  not being counted takes over the counter with the least count, so a
+  flow's count may be over by (at most) the count it took over; any flow
+  with more than packets/kFlows packets is sure to be in the sketch
+
+  The capture thread add()s frames (after the capture filter) and
+  snapshot() may be called from any other thread
+*/
+class CaptureAnalytics
+{
+public:
+    CaptureAnalytics();
+
+    // isNsec => the timestamps of the pcap headers given to add() are
+    // sec + nsec (in place of usec)
+    void reset(bool isNsec = false);
+
+    void add(quint64 nsec, uint length, const uchar *data, uint caplen);
+    void add(const struct pcap_pkthdr *hdr, const uchar *data);
+
+    void snapshot(OstProto::CaptureAnalytics *analytics);
+
+private:
+    struct Count {
+        Count() : packets(0), bytes(0) {}
+        quint64 packets;
+        quint64 bytes;
+    };
+
+    struct FlowKey {
+        bool operator==(const FlowKey &other) const;
+        quint8 ipVersion;   // 0 => not an IP frame
+        quint8 protocol;
+        quint16 srcPort;
+        quint16 dstPort;
+        quint8 srcIp[16];   // IPv4 - first 4 bytes only
+        quint8 dstIp[16];
+    };
+    friend uint qHash(const FlowKey &key);
+
+    struct Flow {
+        FlowKey key;
+        Count count;
+        quint64 error;      // count.packets may be over by this
+    };
+
+    static const int kFlows = 64;
+    static const int kSizeBuckets = 10;
+    static const uint kSizeBucketMax[kSizeBuckets];
+    static const quint64 kIntervalNsec = Q_UINT64_C(1000000000);
+    static const int kMaxIntervals = 600;
+
+    bool parse(const uchar *data, uint caplen, quint16 &etherType,
+               FlowKey &flow) const;
+    void countFlow(const FlowKey &key, uint length);
+    void countRate(quint64 nsec, uint length);
+
+    QMutex lock_;
+    bool isNsec_;
+    Count total_;
+    quint64 firstNsec_;
+    quint64 lastNsec_;
+
+    QHash<quint16, Count> etherType_;
+    Count ipProtocol_[256];
+
+    QHash<FlowKey, int> flowIndex_;     // into flows_
+    QVector<Flow> flows_;
+
+    quint64 size_[kSizeBuckets];
+
+    // Interval rateStart_ (since firstNsec_) onwards
+    QVector<Count> rate_;
+    quint64 rateStart_;
+};
+
+#endif
@@ -0,0 +1,148 @@
+/*
+Copyright (C) 2017 Srivats P.
+
+
+This file is part of "Ostinato"
+
+This is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+
+#include "capturedigest.h"
+
+#include <QtEndian>
+
+static inline quint64 rotl(quint64 x, int bits)
+{
+    return (x << bits) | (x >> (64 - bits));
+}
+
+CaptureDigest::CaptureDigest()
+{
+    length_ = 0;
+    dumper_ = NULL;
+    file_ = NULL;
+    hasDigests_ = false;
+}
+
+CaptureDigest::~CaptureDigest()
+{
+    reset();
+}
+
+/*!
+  Creates (or truncates) the sidecar of captureFileName; dumper is where
+  pcapHandler() writes the (truncated) records to
+*/
+bool CaptureDigest::open(const OstProto::CaptureConfig &config,
+        const QString &captureFileName, pcap_dumper_t *dumper)
+{
+    QString fileName = captureFileName + ".digest";
+
+    reset();
+
+    file_ = fopen(qPrintable(fileName), "wb");
+    if (!file_) {
+        qWarning("unable to open capture digest file %s",
+                qPrintable(fileName));
+        return false;
+    }
+
+    readFile_.setFileName(fileName);
+    if (!readFile_.open(QIODevice::ReadOnly)) {
+        fclose(file_);
+        file_ = NULL;
+        return false;
+    }
+
+    length_ = config.digest_len();
+    dumper_ = dumper;
+    hasDigests_ = true;
+
+    return true;
+}
+
+// The sidecar stays readable till the next open()
+void CaptureDigest::close()
+{
+    if (file_) {
+        fclose(file_);
+        file_ = NULL;
+    }
+    dumper_ = NULL;
+}
+
+// Closes and removes the sidecar, if any
+void CaptureDigest::reset()
+{
+    close();
+    readFile_.close();
+    if (hasDigests_)
+        QFile::remove(readFile_.fileName());
+    hasDigests_ = false;
+}
+
+uint CaptureDigest::append(const uchar *data, uint caplen)
+{
+    uchar digest[8];
+
+    if (caplen > length_) {
+        qToLittleEndian(hash(data + length_, caplen - length_), digest);
+        caplen = length_;
+    }
+    else
+        qToLittleEndian(quint64(0), digest);
+
+    fwrite(digest, 1, sizeof(digest), file_);
+    return caplen;
+}
+
+void CaptureDigest::flush()
+{
+    if (file_)
+        fflush(file_);
+}
+
+void CaptureDigest::pcapHandler(uchar *digest,
+        const struct pcap_pkthdr *hdr, const uchar *data)
+{
+    CaptureDigest *d = (CaptureDigest*) digest;
+    struct pcap_pkthdr recHdr = *hdr;
+
+    recHdr.caplen = d->append(data, hdr->caplen);
+    pcap_dump((uchar*) d->dumper_, &recHdr, data);
+}
+
+/*!
+  64-bit hash of length bytes of data - 8 bytes at a time, each multiplied
+  in and rotated (like the rounds of xxHash64), then the tail bytes and a
+  SplitMix64 finalizer. Same value on any host, not a cryptographic hash
+*/
+quint64 CaptureDigest::hash(const uchar *data, int length)
+{
+    const quint64 kPrime1 = Q_UINT64_C(0x9e3779b185ebca87);
+    const quint64 kPrime2 = Q_UINT64_C(0xc2b2ae3d27d4eb4f);
+    quint64 h = kPrime2 ^ (quint64(length) * kPrime1);
+
+    for (; length >= 8; data += 8, length -= 8) {
+        h ^= rotl(qFromLittleEndian<quint64>(data) * kPrime2, 31) * kPrime1;
+        h = rotl(h, 27) * kPrime1;
+    }
+    for (; length > 0; data++, length--)
+        h = rotl(h ^ (quint64(*data) * kPrime1), 11) * kPrime2;
+
+    h = (h ^ (h >> 30)) * Q_UINT64_C(0xbf58476d1ce4e5b9);
+    h = (h ^ (h >> 27)) * Q_UINT64_C(0x94d049bb133111eb);
+    return h ^ (h >> 31);
+}
@@ -0,0 +1,84 @@
+/*
+Copyright (C) 2017 Srivats P.
+
+
+This file is part of "Ostinato"
+
+This is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+
+#ifndef _CAPTURE_DIGEST_H
+#define _CAPTURE_DIGEST_H
+
+#include "../common/protocol.pb.h"
+
+#include <QFile>
+#include <QString>
+#include <pcap.h>
+#include <stdio.h>
+
+/*!
+  Header-only capture - a frame is captured in full (upto snap_len) but
+  only its first digest_len bytes (of the CaptureConfig) are kept in the
+  capture file; the rest of the frame is reduced to a 64-bit hash (0 if
+  there's nothing beyond digest_len)
+
+  The hashes are kept in a sidecar file - <capture file>.digest - one
+  little endian quint64 per record of the capture file, in record order
+  i.e. the digest of packet N is at offset N*8. The capture thread
+  append()s (or pcapHandler() with pcap_loop) and flush()es; the sidecar
+  can be read via readFile() from any thread, any time, till the next
+  open() or reset()
+
+  Not for ring captures (see CaptureRing) - their records are dropped and
+  rewritten by snapshots
+*/
+class CaptureDigest
+{
+public:
+    CaptureDigest();
+    ~CaptureDigest();
+
+    static bool isDigest(const OstProto::CaptureConfig &config) {
+        return config.digest_len() > 0;
+    }
+
+    bool open(const OstProto::CaptureConfig &config,
+              const QString &captureFileName, pcap_dumper_t *dumper = NULL);
+    void close();
+    void reset();
+    bool isOpen() const { return file_ != NULL; }
+
+    // Bytes kept of a frame of caplen bytes; writes the digest of the rest
+    uint append(const uchar *data, uint caplen);
+    void flush();
+    // Writes the kept bytes to the dumper given to open()
+    static void pcapHandler(uchar *digest, const struct pcap_pkthdr *hdr,
+                            const uchar *data);
+
+    // NULL if the last capture was not header-only
+    QFile* readFile() { return hasDigests_ ? &readFile_ : NULL; }
+
+    static quint64 hash(const uchar *data, int length);
+
+private:
+    uint length_;
+    pcap_dumper_t *dumper_;
+    FILE *file_;
+    QFile readFile_;
+    bool hasDigests_;
+};
+
+#endif
@@ -0,0 +1,160 @@
+/*
+Copyright (C) 2017 Srivats P.
+
+
+This file is part of "Ostinato"
+
+This is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+
+
+#include "capturefilter.h"
+
+#include "streamstats.h"
+
+#include <QtEndian>
+
+CaptureSignatureFilter::CaptureSignatureFilter()
+{
+    isOpen_ = false;
+    seqTable_ = NULL;
+}
+
+CaptureSignatureFilter::~CaptureSignatureFilter()
+{
+    close();
+}
+
+void CaptureSignatureFilter::open(const OstProto::CaptureConfig &config)
+{
+    close();
+    if (!isFilter(config))
+        return;
+
+    for (int i = 0; i < config.signature_stream_id_size(); i++)
+        streamIds_.insert(config.signature_stream_id(i));
+
+    // Sequence numbers of the frames seen so far - of this capture only
+    if (config.signature_errors_only())
+        seqTable_ = new StreamStatsTable;
+
+    isOpen_ = true;
+}
+
+void CaptureSignatureFilter::close()
+{
+    delete seqTable_;
+    seqTable_ = NULL;
+    streamIds_.clear();
+    isOpen_ = false;
+}
+
+/*!
+  Returns true if the frame is to be kept - the signature is at the end of
+  the frame, so a frame not captured in full (capLength < length) never is
+*/
+bool CaptureSignatureFilter::match(const uchar *frame, int length,
+                                   int capLength)
+{
+    bool isOk;
+
+    if ((capLength < length) || !StreamStatsTable::isSigned(frame, length))
+        return false;
+
+    if (!streamIds_.isEmpty()
+            && !streamIds_.contains(qFromBigEndian<quint32>(frame
+                    + signatureOffset(length) + kSignatureStreamIdOffset)))
+        return false;
+
+    if (!seqTable_)
+        return true;
+
+    // No rx time => latency isn't counted
+    // Out of sequence or a bad payload CRC?
+    isOk = seqTable_->countRx(frame, length, 0);
+
+    return !isOk || !isL4CksumOk(frame, length);
+}
+
+static inline quint32 onesSum(const uchar *data, int length, quint32 sum)
+{
+    for (int i = 0; i < (length & ~1); i += 2)
+        sum += qFromBigEndian<quint16>(data + i);
+    if (length & 1)
+        sum += quint32(data[length - 1]) << 8;
+
+    return sum;
+}
+
+/*!
+  Returns true if the frame's TCP/UDP checksum is right - or if it isn't
+  a TCP/UDP frame (or a fragment of one) or has no UDP checksum
+*/
+bool CaptureSignatureFilter::isL4CksumOk(const uchar *frame, int length)
+{
+    int offset = 12;
+    int l4Proto, l4Length;
+    quint16 type;
+    quint32 sum;
+
+    if (length < 14)
+        return true;
+
+    type = qFromBigEndian<quint16>(frame + offset);
+    while (((type == 0x8100) || (type == 0x88a8))
+            && ((offset + 6) <= length)) {
+        offset += 4;
+        type = qFromBigEndian<quint16>(frame + offset);
+    }
+    offset += 2;
+
+    if ((type == 0x0800) && ((offset + 20) <= length)) {
+        const uchar *ip = frame + offset;
+        int hdrLength = (ip[0] & 0x0f)*4;
+
+        if (qFromBigEndian<quint16>(ip + 6) & 0x3fff) // fragment
+            return true;
+        l4Proto = ip[9];
+        l4Length = qFromBigEndian<quint16>(ip + 2) - hdrLength;
+        sum = onesSum(ip + 12, 8, 0); // src and dst address
+        offset += hdrLength;
+    }
+    else if ((type == 0x86dd) && ((offset + 40) <= length)) {
+        const uchar *ip = frame + offset;
+
+        l4Proto = ip[6]; // extension headers are not looked into
+        l4Length = qFromBigEndian<quint16>(ip + 4);
+        sum = onesSum(ip + 8, 32, 0);
+        offset += 40;
+    }
+    else
+        return true;
+
+    if (((l4Proto != 6) && (l4Proto != 17))
+            || (l4Length < 8) || ((offset + l4Length) > length))
+        return true;
+
+    // UDP over IPv4 without a checksum
+    if ((l4Proto == 17) && (type == 0x0800)
+            && !qFromBigEndian<quint16>(frame + offset + 6))
+        return true;
+
+    sum += l4Proto + l4Length;
+    sum = onesSum(frame + offset, l4Length, sum);
+    while (sum >> 16)
+        sum = (sum & 0xffff) + (sum >> 16);
+
+    return sum == 0xffff;
+}
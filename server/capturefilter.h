@@ -0,0 +1,70 @@
+/*
+Copyright (C) 2017 Srivats P.
+
+
+This file is part of "Ostinato"
+
+This is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+
+
+#ifndef _CAPTURE_FILTER_H
+#define _CAPTURE_FILTER_H
+
+#include "../common/protocol.pb.h"
+
+#include <QSet>
+
+class StreamStatsTable;
+
+/*!
+  Signature filter of a capture - keeps only the tracked stream frames
+  (see StreamStatsTable) of the streams in the CaptureConfig's
+  signature_stream_id (any tracked stream if none) and, with
+  signature_errors_only, of these only the ones in error: out of sequence
+  (some lost before, reordered or late), duplicate or with a bad TCP/UDP
+  checksum or payload CRC (a corrupted payload)
+
+  Cheaper than a BPF filter on the signature fields (which are at the end
+  of the frame) and, for errors only, it keeps just the few frames of
+  interest of a long run. Applied after the capture's BPF filter, by the
+  capture thread - for each frame, match() says whether to keep it
+*/
+class CaptureSignatureFilter
+{
+public:
+    CaptureSignatureFilter();
+    ~CaptureSignatureFilter();
+
+    static bool isFilter(const OstProto::CaptureConfig &config) {
+        return (config.signature_stream_id_size() > 0)
+                    || config.signature_errors_only();
+    }
+
+    void open(const OstProto::CaptureConfig &config);
+    void close();
+    bool isOpen() const { return isOpen_; }
+
+    bool match(const uchar *frame, int length, int capLength);
+
+private:
+    static bool isL4CksumOk(const uchar *frame, int length);
+
+    bool isOpen_;
+    QSet<quint32> streamIds_; // empty => any
+    StreamStatsTable *seqTable_; // errors only, else NULL
+};
+
+#endif
@@ -0,0 +1,221 @@
+/*
+Copyright (C) 2017 Srivats P.
+
+
+This file is part of "Ostinato"
+
+This is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+
+#include "captureindex.h"
+
+#include <QByteArray>
+#include <QIODevice>
+#include <QtEndian>
+#include <string.h>
+
+CaptureIndex::CaptureIndex()
+{
+    reset();
+}
+
+void CaptureIndex::reset()
+{
+    blocks_.clear();
+    count_ = 0;
+    end_ = 0;
+    isValid_ = false;
+    isSwapped_ = false;
+    isNsec_ = false;
+}
+
+/*!
+  Indexes the (whole) records added to file since the last update
+
+  Returns false if file is not (yet) a pcap file or has a bad record
+*/
+bool CaptureIndex::update(QIODevice *file)
+{
+    quint64 size = file->size();
+
+    // Capture file was rewritten without a reset()
+    if (end_ > size)
+        reset();
+
+    if (!isValid_)
+    {
+        QByteArray hdr;
+        quint32 magic;
+
+        if (!file->seek(0) || ((hdr = file->read(kFileHdrSize)).size()
+                                    < kFileHdrSize))
+            return false;
+
+        memcpy(&magic, hdr.constData(), sizeof(magic));
+        switch (magic)
+        {
+            case 0xa1b2c3d4: isSwapped_ = false; isNsec_ = false; break;
+            case 0xa1b23c4d: isSwapped_ = false; isNsec_ = true; break;
+            case 0xd4c3b2a1: isSwapped_ = true; isNsec_ = false; break;
+            case 0x4d3cb2a1: isSwapped_ = true; isNsec_ = true; break;
+            default:
+                qWarning("%s: capture file is not a pcap file", __FUNCTION__);
+                return false;
+        }
+        isValid_ = true;
+        end_ = kFileHdrSize;
+    }
+
+    // Read in large pieces and index the whole records in each
+    while ((end_ + kRecordHdrSize) <= size)
+    {
+        QByteArray buf;
+        int pos = 0;
+
+        if (!file->seek(end_))
+            break;
+        buf = file->read(int(qMin(quint64(kReadSize), size - end_)));
+
+        while ((pos + kRecordHdrSize) <= buf.size())
+        {
+            const uchar *rec = (const uchar*) buf.constData() + pos;
+            quint32 caplen = field(rec, 2);
+            quint64 nsec;
+
+            if (caplen > 256*1024) {
+                qWarning("%s: bad capture record at %llu", __FUNCTION__,
+                        end_ + pos);
+                return false;
+            }
+            if ((pos + kRecordHdrSize + int(caplen)) > buf.size())
+                break;
+
+            nsec = timestamp(rec);
+            if ((count_ % kBlockPackets) == 0) {
+                Block block;
+
+                block.offset = end_ + pos;
+                block.lastNsec = nsec;
+                blocks_.append(block);
+            }
+            else if (nsec > blocks_.last().lastNsec)
+                blocks_.last().lastNsec = nsec;
+
+            count_++;
+            pos += kRecordHdrSize + caplen;
+        }
+
+        // Incomplete record at the end - the capture is still writing it
+        if (pos == 0)
+            break;
+        end_ += pos;
+    }
+
+    return true;
+}
+
+/*!
+  Finds the file offset of the record of packet index (0-based)
+
+  Returns false if the packet is not (yet) indexed
+*/
+bool CaptureIndex::findPacket(QIODevice *file, quint64 index,
+        quint64 &offset)
+{
+    quint64 nsec;
+    quint32 caplen;
+
+    if (index >= count_)
+        return false;
+
+    // Start of the packet's block and then walk the record headers
+    offset = blocks_.at(int(index / kBlockPackets)).offset;
+    for (int i = 0; i < int(index % kBlockPackets); i++) {
+        if (!readRecordHeader(file, offset, nsec, caplen))
+            return false;
+        offset += kRecordHdrSize + caplen;
+    }
+
+    return true;
+}
+
+/*!
+  Finds the file offset and the index of the first packet with a
+  timestamp at or after nsec (since the epoch)
+
+  Returns false if there is no such packet (yet)
+*/
+bool CaptureIndex::findTime(QIODevice *file, quint64 nsec,
+        quint64 &offset, quint64 &index)
+{
+    int lo = 0, hi = blocks_.size();
+    quint64 ts;
+    quint32 caplen;
+
+    // First block with a packet at or after nsec
+    while (lo < hi) {
+        int mid = lo + (hi - lo)/2;
+        if (blocks_.at(mid).lastNsec < nsec)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if (lo == blocks_.size())
+        return false;
+
+    offset = blocks_.at(lo).offset;
+    index = quint64(lo) * kBlockPackets;
+    while (index < count_) {
+        if (!readRecordHeader(file, offset, ts, caplen))
+            return false;
+        if (ts >= nsec)
+            return true;
+        offset += kRecordHdrSize + caplen;
+        index++;
+    }
+
+    return false;
+}
+
+bool CaptureIndex::readRecordHeader(QIODevice *file, quint64 offset,
+        quint64 &nsec, quint32 &caplen)
+{
+    uchar rec[kRecordHdrSize];
+
+    if (!file->seek(offset)
+            || (file->read((char*) rec, kRecordHdrSize) < kRecordHdrSize))
+        return false;
+
+    nsec = timestamp(rec);
+    caplen = field(rec, 2);
+    return true;
+}
+
+quint64 CaptureIndex::timestamp(const uchar *recordHdr) const
+{
+    quint64 sec = field(recordHdr, 0);
+    quint64 frac = field(recordHdr, 1);
+
+    return sec*1000000000ULL + (isNsec_ ? frac : frac*1000);
+}
+
+// i'th 32-bit field of a pcap record header
+quint32 CaptureIndex::field(const uchar *recordHdr, int i) const
+{
+    quint32 value;
+
+    memcpy(&value, recordHdr + 4*i, sizeof(value));
+    return isSwapped_ ? qbswap(value) : value;
+}
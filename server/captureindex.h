@@ -0,0 +1,79 @@
+/*
+Copyright (C) 2017 Srivats P.
+
+
+This file is part of "Ostinato"
+
+This is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+
+#ifndef _CAPTURE_INDEX_H
+#define _CAPTURE_INDEX_H
+
+#include <QVector>
+#include <QtGlobal>
+
+class QIODevice;
+
+/*!
+  Block index of the records of a pcap capture file - the file offset and
+  the latest timestamp of every kBlockPackets packets - so that a
+  chunked capture download can start at any packet or time without
+  reading the capture from the beginning
+
+  The index is built incrementally - each update() indexes only the
+  records added to the capture file since the last one; the index must be
+  reset() whenever the capture file is rewritten (new capture or ring
+  snapshot)
+*/
+class CaptureIndex
+{
+public:
+    CaptureIndex();
+
+    void reset();
+    bool update(QIODevice *file);
+
+    quint64 packetCount() const { return count_; }
+
+    bool findPacket(QIODevice *file, quint64 index, quint64 &offset);
+    bool findTime(QIODevice *file, quint64 nsec,
+                  quint64 &offset, quint64 &index);
+
+private:
+    struct Block {
+        quint64 offset;     // of the first record
+        quint64 lastNsec;   // latest timestamp of the records (so far)
+    };
+
+    static const int kBlockPackets = 1024;
+    static const int kFileHdrSize = 24;
+    static const int kRecordHdrSize = 16;
+    static const int kReadSize = 1024*1024;
+
+    bool readRecordHeader(QIODevice *file, quint64 offset,
+                          quint64 &nsec, quint32 &caplen);
+    quint64 timestamp(const uchar *recordHdr) const;
+    quint32 field(const uchar *recordHdr, int i) const;
+
+    QVector<Block> blocks_;
+    quint64 count_;
+    quint64 end_;       // offset after the last indexed record
+    bool isValid_;      // file header seen and is a pcap header
+    bool isSwapped_;
+    bool isNsec_;
+};
+
+#endif
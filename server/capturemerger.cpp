@@ -0,0 +1,297 @@
+/*
+Copyright (C) 2017 Srivats P.
+
+
+This file is part of "Ostinato"
+
+This is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+
+#include "capturemerger.h"
+
+#include "abstractport.h"
+
+#include <QDateTime>
+#include <QtEndian>
+#include <string.h>
+
+// pcapng blocks and options (in host byte order, as per the section's
+// byte order magic)
+static const quint32 kSectionHeaderBlock = 0x0a0d0d0a;
+static const quint32 kInterfaceBlock = 0x00000001;
+static const quint32 kEnhancedPacketBlock = 0x00000006;
+static const quint32 kByteOrderMagic = 0x1a2b3c4d;
+static const quint16 kOptEnd = 0;
+static const quint16 kOptShbUserAppl = 4;
+static const quint16 kOptIfName = 2;
+static const quint16 kOptIfTsResol = 9;
+
+static void append16(QByteArray &block, quint16 value)
+{
+    block.append((const char*) &value, sizeof(value));
+}
+
+static void append32(QByteArray &block, quint32 value)
+{
+    block.append((const char*) &value, sizeof(value));
+}
+
+static void appendOption(QByteArray &block, quint16 code,
+        const QByteArray &value)
+{
+    quint16 hdr[2] = { code, quint16(value.size()) };
+
+    block.append((const char*) hdr, sizeof(hdr));
+    block.append(value);
+    while (block.size() % 4)
+        block.append('\0');
+}
+
+// Fills in the block total length (at both ends) of a block built as its
+// type, a placeholder length and its body
+static void finishBlock(QByteArray &block)
+{
+    quint32 length = block.size() + 4;
+
+    memcpy(block.data() + 4, &length, sizeof(length));
+    append32(block, length);
+}
+
+CaptureMerger::CaptureMerger()
+{
+    stop_ = false;
+}
+
+CaptureMerger::~CaptureMerger()
+{
+    while (!inputs_.isEmpty())
+        delete inputs_.takeFirst();
+}
+
+/*!
+  Adds port's capture (must be on) to the merge as the next interface;
+  false if it can't be merged
+*/
+bool CaptureMerger::addPort(AbstractPort *port)
+{
+    QFile *capFile = qobject_cast<QFile*>(port->captureData());
+    Input *input;
+
+    if (!capFile || port->isCaptureRing())
+        return false;
+
+    input = new Input;
+    input->port = port;
+    input->isValid = false;
+    input->isSwapped = false;
+    input->isNsec = false;
+    input->snapLen = 65535;
+    input->isDone = false;
+    input->hasHead = false;
+    input->headNsec = 0;
+    input->headLength = 0;
+
+    // Our own file handle - the capture file's is used by the RPCs
+    input->file.setFileName(capFile->fileName());
+    if (!input->file.open(QIODevice::ReadOnly | QIODevice::Unbuffered)) {
+        qWarning("%s: unable to open capture file %s", port->name(),
+                qPrintable(capFile->fileName()));
+        delete input;
+        return false;
+    }
+
+    inputs_.append(input);
+    return true;
+}
+
+void CaptureMerger::run()
+{
+    if (!file_.open()) {
+        qWarning("unable to open merged capture file");
+        return;
+    }
+    file_.resize(0);
+
+    while (!stop_)
+    {
+        Input *next = NULL;
+        int nextIndex = -1;
+        bool isReady = true; // all ports not done have a record
+        bool isDone = true;
+
+        for (int i = 0; i < inputs_.size(); i++) {
+            Input *input = inputs_.at(i);
+
+            if (!input->hasHead && !input->isDone) {
+                // On before the read => no records after a failed read
+                bool isOn = input->port->isCaptureOn();
+
+                if (!readHead(input) && !isOn)
+                    input->isDone = true;
+            }
+
+            if (input->hasHead) {
+                if (!next || (input->headNsec < next->headNsec)) {
+                    next = input;
+                    nextIndex = i;
+                }
+                isDone = false;
+            }
+            else if (!input->isDone) {
+                isReady = false;
+                isDone = false;
+            }
+        }
+
+        if (isDone)
+            break;
+
+        if (!next || (!isReady && ((next->headNsec/1000000 + kMaxLagMsecs)
+                        > quint64(QDateTime::currentMSecsSinceEpoch())))) {
+            QThread::msleep(kPollMsecs);
+            continue;
+        }
+
+        // The interfaces (all known by now) before the first record
+        if (!file_.size())
+            writeHeader();
+        writeRecord(nextIndex, next);
+        next->hasHead = false;
+    }
+
+    if (!file_.size())
+        writeHeader();
+    file_.flush();
+}
+
+/*
+  Reads the next record of input's capture file, if it has been written
+  out whole, into the input's head
+*/
+bool CaptureMerger::readHead(Input *input)
+{
+    qint64 size = input->file.size();
+    qint64 pos;
+    quint32 rec[4];
+
+    if (!input->isValid) {
+        quint32 hdr[6];
+
+        if ((size < qint64(sizeof(hdr)))
+                || (input->file.read((char*) hdr, sizeof(hdr))
+                        < qint64(sizeof(hdr)))) {
+            input->file.seek(0);
+            return false;
+        }
+
+        if ((hdr[0] == 0xa1b2c3d4) || (hdr[0] == 0xa1b23c4d))
+            input->isSwapped = false;
+        else if ((hdr[0] == 0xd4c3b2a1) || (hdr[0] == 0x4d3cb2a1))
+            input->isSwapped = true;
+        else {
+            qWarning("%s: capture file is not a pcap file",
+                    input->port->name());
+            input->isDone = true;
+            return false;
+        }
+        input->isNsec = (hdr[0] == 0xa1b23c4d) || (hdr[0] == 0x4d3cb2a1);
+        input->snapLen = input->isSwapped ? qbswap(hdr[4]) : hdr[4];
+        input->isValid = true;
+    }
+
+    pos = input->file.pos();
+    if (size < (pos + qint64(sizeof(rec))))
+        return false;
+    if (input->file.read((char*) rec, sizeof(rec)) < qint64(sizeof(rec)))
+        goto _incomplete;
+
+    if (input->isSwapped) {
+        for (int i = 0; i < 4; i++)
+            rec[i] = qbswap(rec[i]);
+    }
+    if (rec[2] > 256*1024) {
+        qWarning("%s: bad capture record at %lld", input->port->name(), pos);
+        input->isDone = true;
+        return false;
+    }
+    if (size < (pos + qint64(sizeof(rec)) + rec[2]))
+        goto _incomplete;
+
+    input->head = input->file.read(rec[2]);
+    if (input->head.size() < int(rec[2]))
+        goto _incomplete;
+
+    input->headNsec = quint64(rec[0])*1000000000
+                        + quint64(rec[1])*(input->isNsec ? 1 : 1000);
+    input->headLength = rec[3];
+    input->hasHead = true;
+    return true;
+
+_incomplete:
+    input->file.seek(pos);
+    return false;
+}
+
+// Section header and an interface per port - all with nsec timestamps
+void CaptureMerger::writeHeader()
+{
+    QByteArray block;
+
+    append32(block, kSectionHeaderBlock);
+    append32(block, 0);
+    append32(block, kByteOrderMagic);
+    append16(block, 1); // version 1.0
+    append16(block, 0);
+    append32(block, 0xffffffff); // section length unknown (64 bit)
+    append32(block, 0xffffffff);
+    appendOption(block, kOptShbUserAppl, QByteArray("Ostinato drone"));
+    appendOption(block, kOptEnd, QByteArray());
+    finishBlock(block);
+    file_.write(block);
+
+    for (int i = 0; i < inputs_.size(); i++) {
+        block.clear();
+        append32(block, kInterfaceBlock);
+        append32(block, 0);
+        append16(block, 1); // linktype ethernet
+        append16(block, 0);
+        append32(block, inputs_.at(i)->snapLen);
+        appendOption(block, kOptIfName,
+                QByteArray(inputs_.at(i)->port->name()));
+        appendOption(block, kOptIfTsResol, QByteArray(1, char(9)));
+        appendOption(block, kOptEnd, QByteArray());
+        finishBlock(block);
+        file_.write(block);
+    }
+}
+
+void CaptureMerger::writeRecord(int interfaceId, const Input *input)
+{
+    QByteArray block;
+
+    block.reserve(32 + input->head.size() + 4);
+    append32(block, kEnhancedPacketBlock);
+    append32(block, 0);
+    append32(block, interfaceId);
+    append32(block, quint32(input->headNsec >> 32));
+    append32(block, quint32(input->headNsec));
+    append32(block, input->head.size());
+    append32(block, input->headLength);
+    block.append(input->head);
+    while (block.size() % 4)
+        block.append('\0');
+    finishBlock(block);
+    file_.write(block);
+}
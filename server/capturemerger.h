@@ -0,0 +1,94 @@
+/*
+Copyright (C) 2017 Srivats P.
+
+
+This file is part of "Ostinato"
+
+This is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+
+#ifndef _CAPTURE_MERGER_H
+#define _CAPTURE_MERGER_H
+
+#include <QByteArray>
+#include <QFile>
+#include <QList>
+#include <QTemporaryFile>
+#include <QThread>
+
+class AbstractPort;
+
+/*!
+  Merges the captures of a set of ports, as they are captured, into a
+  single pcapng file - an interface (IDB) per port and the frames of all
+  (as EPBs) in timestamp order - for startMergedCapture
+
+  The ports capture as usual, each in its own thread to its own pcap
+  file; the merger thread tails these files and does a k-way merge of
+  their records - a record is written once every other port has a later
+  record or is done, or once it is older than kMaxLagMsecs (so that an
+  idle port doesn't hold up the others) - a port's frames written out by
+  its capture later than that may be out of order in the merged file
+
+  Ring captures are not merged - their capture files are rewritten by
+  every snapshot. The merger is done once the captures of all its ports
+  are stopped and their records merged; wait() for it before file()
+*/
+class CaptureMerger : public QThread
+{
+public:
+    CaptureMerger();
+    ~CaptureMerger();
+
+    // Before start() - port's capture must be on
+    bool addPort(AbstractPort *port);
+    int portCount() const { return inputs_.size(); }
+    AbstractPort* port(int i) const { return inputs_.at(i)->port; }
+
+    // Aborts the merge - the merged file has the records merged so far
+    void stop() { stop_ = true; }
+    QFile* file() { return &file_; }
+
+protected:
+    void run();
+
+private:
+    struct Input {
+        AbstractPort *port;
+        QFile file;
+        bool isValid;       // pcap file header seen
+        bool isSwapped;
+        bool isNsec;
+        quint32 snapLen;
+        bool isDone;        // capture off and all records read
+        bool hasHead;       // next record read, not merged yet
+        quint64 headNsec;
+        quint32 headLength; // on the wire
+        QByteArray head;    // frame
+    };
+
+    static const int kPollMsecs = 10;
+    static const int kMaxLagMsecs = 1000;
+
+    bool readHead(Input *input);
+    void writeHeader();
+    void writeRecord(int interfaceId, const Input *input);
+
+    QList<Input*> inputs_;
+    QTemporaryFile file_;
+    volatile bool stop_;
+};
+
+#endif
@@ -0,0 +1,322 @@
+/*
+Copyright (C) 2017 Srivats P.
+
+
+This file is part of "Ostinato"
+
+This is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+
+#include "capturering.h"
+
+#include <QFile>
+#include <string.h>
+
+CaptureRing::CaptureRing()
+{
+    isOpen_ = false;
+    buffer_ = NULL;
+    file_ = NULL;
+    maxFiles_ = 0;
+    isNsec_ = false;
+    hasTrigger_ = false;
+    close();
+}
+
+CaptureRing::~CaptureRing()
+{
+    close();
+}
+
+/*!
+  Sets up an (empty) ring as per config - any earlier ring and its frames
+  are discarded. The ring files, if any, are named fileBase.N; isNsec =>
+  the timestamps of the appended frames have nsecs (in place of usecs)
+*/
+bool CaptureRing::open(const OstProto::CaptureConfig &config, int snapLen,
+        const QString &fileBase, bool isNsec)
+{
+    quint64 size = config.ring_size() ?
+                        quint64(config.ring_size())*1024 : kDefaultSize;
+
+    close();
+
+    QMutexLocker locker(&lock_);
+
+    // A frame must fit in the ring (or a ring file)
+    snapLen_ = snapLen;
+    isNsec_ = isNsec;
+    maxPackets_ = config.ring_packets();
+    maxFiles_ = config.ring_files();
+
+    if (!config.trigger().empty()) {
+        pcap_t *handle = pcap_open_dead(DLT_EN10MB, snapLen);
+
+        if (!handle)
+            return false;
+        if (pcap_compile(handle, &trigger_, config.trigger().c_str(), 1,
+                    PCAP_NETMASK_UNKNOWN) < 0) {
+            qWarning("can't compile capture trigger: %s (%s)",
+                    config.trigger().c_str(), pcap_geterr(handle));
+            pcap_close(handle);
+            return false;
+        }
+        pcap_close(handle);
+        hasTrigger_ = true;
+        postPackets_ = config.trigger_post_packets();
+    }
+
+    if (maxFiles_) {
+        fileBase_ = fileBase;
+        maxFileBytes_ = qMax(size/maxFiles_,
+                             quint64(kFileHdrSize + kRecordHdrSize + snapLen));
+        maxFilePackets_ = maxPackets_ ?
+                            qMax(maxPackets_/maxFiles_, quint64(1)) : 0;
+        fileIndex_ = -1;
+        if (!openNextFile())
+            return false;
+    }
+    else {
+        size_ = int(qMin(qMax(size, quint64(kRecordHdrSize + snapLen)),
+                         quint64(1) << 30));
+        buffer_ = new uchar[size_];
+    }
+
+    isOpen_ = true;
+    return true;
+}
+
+/*!
+  Discards the ring and its frames
+*/
+void CaptureRing::close()
+{
+    QMutexLocker locker(&lock_);
+
+    delete[] buffer_;
+    buffer_ = NULL;
+    size_ = head_ = tail_ = end_ = 0;
+    wrapped_ = false;
+    count_ = 0;
+
+    if (file_)
+        fclose(file_);
+    file_ = NULL;
+    for (int i = 0; i < maxFiles_; i++)
+        QFile::remove(fileName(i));
+    fileIndex_ = -1;
+    fileCount_ = 0;
+    fileBytes_ = filePackets_ = 0;
+
+    if (hasTrigger_)
+        pcap_freecode(&trigger_);
+    hasTrigger_ = false;
+    isTriggered_ = isDone_ = false;
+    postPackets_ = postCount_ = 0;
+    post_.clear();
+
+    isOpen_ = false;
+}
+
+/*!
+  Adds a frame to the ring, dropping the oldest frames to make room for it
+*/
+void CaptureRing::append(const struct pcap_pkthdr *hdr, const uchar *data)
+{
+    quint32 rec[4];
+    int caplen = qMin(int(hdr->caplen), snapLen_);
+    int len = kRecordHdrSize + caplen;
+
+    rec[0] = hdr->ts.tv_sec;
+    rec[1] = hdr->ts.tv_usec;
+    rec[2] = caplen;
+    rec[3] = hdr->len;
+
+    QMutexLocker locker(&lock_);
+
+    if (isTriggered_) {
+        if (isDone_)
+            return;
+        post_.append((const char*) rec, sizeof(rec));
+        post_.append((const char*) data, caplen);
+        if (++postCount_ >= postPackets_)
+            isDone_ = true;
+        return;
+    }
+
+    // The trigger frame is the last one in the ring
+    if (hasTrigger_ && pcap_offline_filter(&trigger_, hdr, data)) {
+        isTriggered_ = true;
+        isDone_ = !postPackets_;
+        qDebug("capture triggered - %llu more frames to capture",
+                postPackets_);
+    }
+
+    if (maxFiles_) {
+        if (!file_)
+            return;
+
+        if ((fileBytes_ + len > maxFileBytes_)
+                || (maxFilePackets_ && (filePackets_ >= maxFilePackets_))) {
+            if (!openNextFile())
+                return;
+        }
+        fwrite(rec, sizeof(rec), 1, file_);
+        fwrite(data, caplen, 1, file_);
+        fileBytes_ += len;
+        filePackets_++;
+        return;
+    }
+
+    if (!buffer_)
+        return;
+
+    forever {
+        if (maxPackets_ && (count_ >= maxPackets_)) {
+            dropOldest();
+            continue;
+        }
+
+        if (!wrapped_) {
+            if (size_ - tail_ >= len)
+                break;
+            // Wrap around if there's room before the oldest frame
+            if (head_ >= len) {
+                end_ = tail_;
+                tail_ = 0;
+                wrapped_ = true;
+                break;
+            }
+        }
+        else if (head_ - tail_ >= len)
+            break;
+
+        dropOldest();
+    }
+
+    memcpy(buffer_ + tail_, rec, sizeof(rec));
+    memcpy(buffer_ + tail_ + kRecordHdrSize, data, caplen);
+    tail_ += len;
+    count_++;
+}
+
+// A pcap_handler for pcap_loop() with ring as the user arg
+void CaptureRing::pcapHandler(uchar *ring, const struct pcap_pkthdr *hdr,
+        const uchar *data)
+{
+    ((CaptureRing*) ring)->append(hdr, data);
+}
+
+/*!
+  Writes the frames currently in the ring to file as a pcap file,
+  replacing its contents
+*/
+bool CaptureRing::snapshot(QFile *file)
+{
+    QMutexLocker locker(&lock_);
+
+    if (!isOpen_)
+        return false;
+
+    if (!file->resize(0) || !file->seek(0))
+        return false;
+    file->write(fileHeader());
+
+    if (maxFiles_) {
+        if (file_)
+            fflush(file_);
+
+        // Oldest first
+        for (int i = fileCount_ - 1; i >= 0; i--) {
+            QFile ringFile(fileName((fileIndex_ + maxFiles_ - i) % maxFiles_));
+
+            if (!ringFile.open(QIODevice::ReadOnly))
+                continue;
+            ringFile.seek(kFileHdrSize);
+            while (!ringFile.atEnd())
+                file->write(ringFile.read(1024*1024));
+        }
+    }
+    else if (wrapped_) {
+        file->write((const char*) buffer_ + head_, end_ - head_);
+        file->write((const char*) buffer_, tail_);
+    }
+    else
+        file->write((const char*) buffer_ + head_, tail_ - head_);
+
+    file->write(post_);
+
+    return file->flush();
+}
+
+// Drops the oldest frame from the (in memory) ring
+void CaptureRing::dropOldest()
+{
+    Q_ASSERT(count_);
+
+    head_ += kRecordHdrSize + ((quint32*)(buffer_ + head_))[2];
+    count_--;
+
+    if (!count_) {
+        head_ = tail_ = 0;
+        wrapped_ = false;
+    }
+    else if (wrapped_ && (head_ == end_)) {
+        head_ = 0;
+        wrapped_ = false;
+    }
+}
+
+// Starts the next ring file, overwriting the oldest one
+bool CaptureRing::openNextFile()
+{
+    QByteArray hdr = fileHeader();
+
+    if (file_)
+        fclose(file_);
+
+    fileIndex_ = (fileIndex_ + 1) % maxFiles_;
+    file_ = fopen(fileName(fileIndex_).toLocal8Bit().constData(), "wb");
+    if (!file_) {
+        qWarning("unable to open capture ring file %s",
+                qPrintable(fileName(fileIndex_)));
+        return false;
+    }
+
+    fwrite(hdr.constData(), hdr.size(), 1, file_);
+    fileCount_ = qMin(fileCount_ + 1, maxFiles_);
+    fileBytes_ = hdr.size();
+    filePackets_ = 0;
+    return true;
+}
+
+QString CaptureRing::fileName(int index) const
+{
+    return QString("%1.%2").arg(fileBase_).arg(index);
+}
+
+QByteArray CaptureRing::fileHeader() const
+{
+    struct pcap_file_header hdr;
+
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.magic = isNsec_ ? 0xa1b23c4d : 0xa1b2c3d4;
+    hdr.version_major = PCAP_VERSION_MAJOR;
+    hdr.version_minor = PCAP_VERSION_MINOR;
+    hdr.snaplen = snapLen_;
+    hdr.linktype = DLT_EN10MB;
+
+    return QByteArray((const char*) &hdr, sizeof(hdr));
+}
@@ -0,0 +1,123 @@
+/*
+Copyright (C) 2017 Srivats P.
+
+
+This file is part of "Ostinato"
+
+This is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+
+#ifndef _CAPTURE_RING_H
+#define _CAPTURE_RING_H
+
+#include "../common/protocol.pb.h"
+
+#include <QByteArray>
+#include <QMutex>
+#include <QString>
+#include <pcap.h>
+#include <stdio.h>
+
+class QFile;
+
+/*!
+  Keeps just the last frames of a capture - the last ring_size KB and/or
+  ring_packets frames of the CaptureConfig - either in memory or in a set
+  of ring_files rotating files
+
+  The capture thread adds frames with append() (or pcapHandler() with
+  pcap_loop); snapshot() may be called from any thread at any time to get
+  the frames currently in the ring as a pcap file
+
+  With a trigger (CaptureConfig.trigger), the ring is frozen on the first
+  frame that matches the trigger filter - the next trigger_post_packets
+  frames are kept (in memory) in addition to the ring's and then the ring
+  is done i.e. appends are ignored; capture threads stop on isDone()
+*/
+class CaptureRing
+{
+public:
+    CaptureRing();
+    ~CaptureRing();
+
+    static bool isRing(const OstProto::CaptureConfig &config) {
+        return config.ring_size() || config.ring_packets()
+                || !config.trigger().empty();
+    }
+
+    bool open(const OstProto::CaptureConfig &config, int snapLen,
+              const QString &fileBase, bool isNsec = false);
+    void close();
+    bool isOpen() const { return isOpen_; }
+    bool isTriggered() const { return isTriggered_; }
+    bool isDone() const { return isDone_; }
+
+    void append(const struct pcap_pkthdr *hdr, const uchar *data);
+    static void pcapHandler(uchar *ring, const struct pcap_pkthdr *hdr,
+                            const uchar *data);
+
+    bool snapshot(QFile *file);
+
+private:
+    static const int kRecordHdrSize = 16; // pcap record header
+    static const int kFileHdrSize = 24;   // pcap file header
+    // If only ring_packets is given
+    static const quint64 kDefaultSize = 64*1024*1024;
+
+    void dropOldest();
+    bool openNextFile();
+    QString fileName(int index) const;
+    QByteArray fileHeader() const;
+
+    QMutex lock_;
+    bool isOpen_;
+    int snapLen_;
+    bool isNsec_;               // record timestamps are sec + nsec
+    quint64 maxPackets_;        // 0 => no limit
+
+    // Trigger (if any) - once triggered, frames go to post_ (as pcap
+    // records) instead of the ring, till there are postPackets_ of them
+    bool hasTrigger_;
+    struct bpf_program trigger_;
+    volatile bool isTriggered_;
+    volatile bool isDone_;
+    quint64 postPackets_;
+    quint64 postCount_;
+    QByteArray post_;
+
+    // In memory - variable length records in a circular buffer; data is
+    // [head_, tail_) or, if wrapped_, [head_, end_) + [0, tail_)
+    uchar *buffer_;
+    int size_;
+    int head_;
+    int tail_;
+    int end_;
+    bool wrapped_;
+    quint64 count_;
+
+    // In files - fileCount_ files (of fileBase_.N) with the newest in
+    // file_ (fileIndex_)
+    QString fileBase_;
+    int maxFiles_;              // 0 => in memory
+    quint64 maxFileBytes_;
+    quint64 maxFilePackets_;
+    FILE *file_;
+    int fileIndex_;
+    int fileCount_;
+    quint64 fileBytes_;
+    quint64 filePackets_;
+};
+
+#endif
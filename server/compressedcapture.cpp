@@ -0,0 +1,177 @@
+/*
+Copyright (C) 2017 Srivats P.
+
+
+This file is part of "Ostinato"
+
+This is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+
+#include "compressedcapture.h"
+
+#include <QtEndian>
+#include <string.h>
+
+CompressedCaptureFile::CompressedCaptureFile()
+{
+    fileEnd_ = size_ = 0;
+    isBad_ = false;
+    current_ = -1;
+}
+
+CompressedCaptureFile::~CompressedCaptureFile()
+{
+    close();
+}
+
+bool CompressedCaptureFile::open(const QString &fileName)
+{
+    close();
+
+    file_.setFileName(fileName);
+    if (!file_.open(QIODevice::ReadOnly))
+        return false;
+
+    return QIODevice::open(QIODevice::ReadOnly | QIODevice::Unbuffered);
+}
+
+void CompressedCaptureFile::close()
+{
+    QIODevice::close();
+    file_.close();
+    blocks_.clear();
+    fileEnd_ = size_ = 0;
+    isBad_ = false;
+    current_ = -1;
+    data_.clear();
+}
+
+qint64 CompressedCaptureFile::size() const
+{
+    update();
+    return size_;
+}
+
+/*!
+  Speed over ratio - blocks are compressed as fast as the capture fills
+  them
+*/
+QByteArray CompressedCaptureFile::compress(const uchar *data, int length)
+{
+    QByteArray block(kHeaderSize, '\0');
+    QByteArray compressed = qCompress(data, length, 1);
+    uchar *hdr = (uchar*) block.data();
+
+    qToLittleEndian(kMagic, hdr);
+    qToLittleEndian(quint32(length), hdr + 4);
+    qToLittleEndian(quint32(compressed.size()), hdr + 8);
+    block.append(compressed);
+
+    return block;
+}
+
+qint64 CompressedCaptureFile::readData(char *data, qint64 maxSize)
+{
+    qint64 offset = pos();
+    qint64 count = 0;
+
+    update();
+    while ((count < maxSize) && (offset < size_))
+    {
+        int lo = 0, hi = blocks_.size() - 1;
+        int n;
+
+        // Last block at/before offset
+        while (lo < hi) {
+            int mid = (lo + hi + 1)/2;
+
+            if (blocks_.at(mid).offset <= offset)
+                lo = mid;
+            else
+                hi = mid - 1;
+        }
+        if (!load(lo))
+            return count ? count : -1;
+
+        n = int(qMin(maxSize - count,
+                    blocks_.at(lo).offset + blocks_.at(lo).length - offset));
+        memcpy(data + count,
+               data_.constData() + (offset - blocks_.at(lo).offset), n);
+        count += n;
+        offset += n;
+    }
+
+    return count;
+}
+
+// Indexes the blocks written out whole since the last update
+void CompressedCaptureFile::update() const
+{
+    qint64 fileSize = file_.size();
+
+    while (!isBad_ && ((fileEnd_ + kHeaderSize) <= fileSize))
+    {
+        uchar hdr[kHeaderSize];
+        Block block;
+
+        if (!file_.seek(fileEnd_)
+                || (file_.read((char*) hdr, kHeaderSize) < kHeaderSize))
+            break;
+        if (qFromLittleEndian<quint32>(hdr) != kMagic) {
+            qWarning("%s: bad compressed capture block at %lld",
+                    qPrintable(file_.fileName()), fileEnd_);
+            isBad_ = true;
+            break;
+        }
+
+        block.offset = size_;
+        block.fileOffset = fileEnd_;
+        block.length = int(qFromLittleEndian<quint32>(hdr + 4));
+        block.compressedLength = int(qFromLittleEndian<quint32>(hdr + 8));
+        if ((fileEnd_ + kHeaderSize + block.compressedLength) > fileSize)
+            break;
+
+        blocks_.append(block);
+        fileEnd_ += kHeaderSize + block.compressedLength;
+        size_ += block.length;
+    }
+}
+
+// Uncompresses block index into data_
+bool CompressedCaptureFile::load(int index)
+{
+    const Block &block = blocks_.at(index);
+    QByteArray compressed;
+
+    if (index == current_)
+        return true;
+
+    if (!file_.seek(block.fileOffset + kHeaderSize))
+        return false;
+    compressed = file_.read(block.compressedLength);
+    if (compressed.size() < block.compressedLength)
+        return false;
+
+    data_ = qUncompress(compressed);
+    if (data_.size() != block.length) {
+        qWarning("%s: bad compressed capture block at %lld",
+                qPrintable(file_.fileName()), block.fileOffset);
+        current_ = -1;
+        return false;
+    }
+
+    current_ = index;
+    return true;
+}
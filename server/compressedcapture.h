@@ -0,0 +1,89 @@
+/*
+Copyright (C) 2017 Srivats P.
+
+
+This file is part of "Ostinato"
+
+This is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+
+#ifndef _COMPRESSED_CAPTURE_H
+#define _COMPRESSED_CAPTURE_H
+
+#include <QByteArray>
+#include <QFile>
+#include <QIODevice>
+#include <QVector>
+
+/*!
+  Read-only, seekable view of a block compressed capture file - as the
+  (pcap) capture data it is the compression of - so that getCaptureChunk,
+  the CaptureIndex and getCaptureBuffer work on it as on a plain capture
+  file
+
+  The file is a sequence of independently compressed blocks (see
+  compress()), each a header - magic, length and compressed length (32
+  bit, little endian) - followed by the block compressed with qCompress();
+  the file may be read while blocks are being added to it - size() is of
+  the whole blocks written out so far. Only the block being read is kept
+  uncompressed
+*/
+class CompressedCaptureFile : public QIODevice
+{
+public:
+    CompressedCaptureFile();
+    ~CompressedCaptureFile();
+
+    bool open(const QString &fileName);
+    void close();
+
+    bool isSequential() const { return false; }
+    qint64 size() const;
+
+    // A block of the file for length bytes of data
+    static QByteArray compress(const uchar *data, int length);
+
+protected:
+    qint64 readData(char *data, qint64 maxSize);
+    qint64 writeData(const char * /*data*/, qint64 /*maxSize*/) {
+        return -1;
+    }
+
+private:
+    struct Block {
+        qint64 offset;      // in the capture data
+        qint64 fileOffset;  // of the block header
+        int length;
+        int compressedLength;
+    };
+
+    static const quint32 kMagic = 0x3142434f; // "OCB1"
+    static const int kHeaderSize = 12;
+
+    void update() const;
+    bool load(int index);
+
+    // Indexed as size() finds new blocks
+    mutable QFile file_;
+    mutable QVector<Block> blocks_;
+    mutable qint64 fileEnd_;    // after the last indexed block
+    mutable qint64 size_;
+    mutable bool isBad_;
+
+    int current_;               // block in data_, -1 => none
+    QByteArray data_;
+};
+
+#endif
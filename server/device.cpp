@@ -22,16 +22,58 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 #include "../common/emulproto.pb.h"
 #include "devicemanager.h"
 #include "packetbuffer.h"
+#include "../common/trace.h"
 
+#include <QDateTime>
 #include <QHostAddress>
 #include <qendian.h>
+#include <time.h>
 
 const int kBaseHex = 16;
 const quint64 kBcastMac = 0xffffffffffffULL;
 const quint16 kEthTypeIp4 = 0x0800;
 const quint16 kEthTypeIp6 = 0x86dd;
 const int kIp6HdrLen = 40;
+const quint8 kIpProtoIgmp = 2;
+const quint8 kIpProtoTcp = 6;
+const quint8 kIpProtoUdp = 17;
 const quint8 kIpProtoIcmp6 = 58;
+const int kTcpHdrLen = 20;
+const uchar kTcpFin = 0x01;
+const uchar kTcpSyn = 0x02;
+const uchar kTcpRst = 0x04;
+const uchar kTcpAck = 0x10;
+
+// DHCPv4 (RFC 2131) and DHCPv6 (RFC 8415) message types and ports
+const quint8 kDhcpDiscover = 1;
+const quint8 kDhcpOffer = 2;
+const quint8 kDhcpRequest = 3;
+const quint8 kDhcpAck = 5;
+const quint8 kDhcpNak = 6;
+const quint8 kDhcpRelease = 7;
+const quint8 kDhcp6Solicit = 1;
+const quint8 kDhcp6Advertise = 2;
+const quint8 kDhcp6Request = 3;
+const quint8 kDhcp6Renew = 5;
+const quint8 kDhcp6Reply = 7;
+const quint8 kDhcp6Release = 8;
+const quint16 kDhcpServerPort = 67;
+const quint16 kDhcpClientPort = 68;
+const quint16 kDhcp6ServerPort = 547;
+const quint16 kDhcp6ClientPort = 546;
+const quint32 kDhcpMagicCookie = 0x63825363;
+const int kBootpLen = 300; // with options - the minimum of BOOTP (RFC 1542)
+
+// MSS values a SYN cookie can encode (3 bits) - the largest one not
+// above the client's is used
+const quint16 kSynCookieMss[] = { 536, 1220, 1440, 1460, 8960 };
+const int kSynCookieMssCount = sizeof(kSynCookieMss)/sizeof(kSynCookieMss[0]);
+
+// Group records that fit in a 1500 byte IGMPv3/MLDv2 report - after the
+// IP header (with router alert), the hop-by-hop header (MLD) and the
+// report header
+const int kMaxIgmpRecords = (1500 - 24 - 8)/8;
+const int kMaxMldRecords = (1500 - 40 - 8 - 8)/20;
 
 /*
  * NOTE:
@@ -57,9 +99,60 @@ inline bool isIp6Mcast(UInt128 ip)
     return (ip.hi64() >> 56) == 0xff;
 }
 
+inline bool isIp6LinkLocal(UInt128 ip)
+{
+    return (ip.hi64() >> 54) == (0xfe80 >> 6); // fe80::/10
+}
+
+// Ones complement sum of len bytes (len even) added to sum
+inline quint32 sumBytes(const uchar *p, int len, quint32 sum)
+{
+    for (int i = 0; i < len; i += 2)
+        sum += qFromBigEndian<quint16>(p + i);
+    return sum;
+}
+
+inline quint16 foldSum(quint32 sum)
+{
+    while(sum >> 16)
+        sum = (sum & 0xFFFF) + (sum >> 16);
+    return quint16(~sum);
+}
+
+/*
+ * SYN cookie (as in RFC 4987) - the top 5 bits are the time in 64 sec
+ * units, the next 3 the MSS index and the rest a hash of the connection
+ * and the time with a secret of this process; so a SYN retransmitted
+ * within a minute gets the same sequence number and nothing is kept per
+ * connection
+ */
+static quint32 synCookie(const uchar *srcIp, const uchar *dstIp, int addrLen,
+        quint16 srcPort, quint16 dstPort, int mssIndex)
+{
+    static const quint64 secret =
+            quint64(QDateTime::currentMSecsSinceEpoch())
+                * Q_UINT64_C(0x9e3779b97f4a7c15);
+    quint32 t = quint32(time(NULL) >> 6) & 0x1f;
+    quint64 h = secret ^ (quint64(srcPort) << 32 | quint64(dstPort) << 16 | t);
+
+    // FNV-1a over the addresses, then a SplitMix64 finalizer
+    for (int i = 0; i < addrLen; i++)
+        h = (h ^ srcIp[i]) * Q_UINT64_C(0x100000001b3);
+    for (int i = 0; i < addrLen; i++)
+        h = (h ^ dstIp[i]) * Q_UINT64_C(0x100000001b3);
+    h = (h ^ (h >> 30)) * Q_UINT64_C(0xbf58476d1ce4e5b9);
+    h = (h ^ (h >> 27)) * Q_UINT64_C(0x94d049bb133111eb);
+    h ^= h >> 31;
+
+    return (t << 27) | (quint32(mssIndex) << 24) | quint32(h & 0xffffff);
+}
+
 Device::Device(DeviceManager *deviceManager)
 {
     deviceManager_ = deviceManager;
+    stats_ = NULL;
+    shard_ = 0;
+    mcastGroups_ = NULL;
 
     for (int i = 0; i < kMaxVlan; i++)
         vlan_[i] = 0;
@@ -74,8 +167,6 @@ Device::Device(DeviceManager *deviceManager)
 
 void Device::setVlan(int index, quint16 vlan, quint16 tpid)
 {
-    int ofs;
-
     if ((index < 0) || (index >= kMaxVlan)) {
         qWarning("%s: vlan index %d out of range (0 - %d)", __FUNCTION__,
                 index, kMaxVlan - 1);
@@ -83,15 +174,22 @@ void Device::setVlan(int index, quint16 vlan, quint16 tpid)
     }
 
     vlan_[index] = (tpid << 16) | vlan;
-
-    ofs = index * sizeof(quint16);
-    key_[ofs]   = vlan >> 8;
-    key_[ofs+1] = vlan & 0xff;
+    key_.setVlan(index, vlan);
 
     if (index >= numVlanTags_)
         numVlanTags_ = index + 1;
 }
 
+// Is vlanId the id of any of our vlan tags?
+bool Device::hasVlanId(quint16 vlanId) const
+{
+    for (int i = 0; i < numVlanTags_; i++)
+        if ((vlan_[i] & 0x0fff) == vlanId)
+            return true;
+
+    return false;
+}
+
 quint64 Device::mac()
 {
     return mac_;
@@ -99,10 +197,8 @@ quint64 Device::mac()
 
 void Device::setMac(quint64 mac)
 {
-    int ofs = kMaxVlan * sizeof(quint16);
-
     mac_ = mac & ~(0xffffULL << 48);
-    memcpy(key_.data() + ofs, (char*)&mac_, sizeof(mac_));
+    key_.mac = mac_;
 }
 
 void Device::setIp4(quint32 address, int prefixLength, quint32 gateway)
@@ -140,6 +236,9 @@ void Device::getConfig(OstEmul::Device *deviceConfig)
         deviceConfig->set_ip4_prefix_length(ip4PrefixLength_);
         deviceConfig->set_ip4_default_gateway(ip4Gateway_);
     }
+    if (dhcp4_.state != DhcpLease::kDisabled)
+        deviceConfig->set_ip4_dhcp_state(
+                OstEmul::DhcpState(dhcp4_.state));
 
     if (hasIp6_) {
         deviceConfig->mutable_ip6()->set_hi(ip6_.hi64());
@@ -148,6 +247,9 @@ void Device::getConfig(OstEmul::Device *deviceConfig)
         deviceConfig->mutable_ip6_default_gateway()->set_hi(ip6Gateway_.hi64());
         deviceConfig->mutable_ip6_default_gateway()->set_lo(ip6Gateway_.lo64());
     }
+    if (dhcp6_.state != DhcpLease::kDisabled)
+        deviceConfig->set_ip6_dhcp_state(
+                OstEmul::DhcpState(dhcp6_.state));
 }
 
 QString Device::config()
@@ -186,7 +288,7 @@ DeviceKey Device::key()
 
 void Device::clearKey()
 {
-    key_.fill(0, kMaxVlan * sizeof(quint16) + sizeof(quint64));
+    key_ = DeviceKey();
 }
 
 int Device::encapSize()
@@ -233,7 +335,7 @@ void Device::receivePacket(PacketBuffer *pktBuf)
     quint16 ethType = qFromBigEndian<quint16>(pktBuf->data());
     pktBuf->pull(2);
 
-    qDebug("%s: ethType 0x%x", __PRETTY_FUNCTION__, ethType);
+    qTrace("%s: ethType 0x%x", __PRETTY_FUNCTION__, ethType);
 
     switch(ethType)
     {
@@ -248,7 +350,8 @@ void Device::receivePacket(PacketBuffer *pktBuf)
         break;
 
     case 0x86dd: // IPv6
-        if (hasIp6_)
+        // Without an address yet, for NDP of our link-local (DHCPv6)
+        if (hasIp6_ || (dhcp6_.state != DhcpLease::kDisabled))
             receiveIp6(pktBuf);
         break;
 
@@ -259,9 +362,14 @@ void Device::receivePacket(PacketBuffer *pktBuf)
     pktBuf->push(2);
 }
 
-void Device::transmitPacket(PacketBuffer *pktBuf)
+// Called with our shard locked (see DeviceManager)
+int Device::transmitPacket(PacketBuffer *pktBuf)
 {
-    deviceManager_->transmitPacket(pktBuf);
+    int ret = deviceManager_->transmitPacket(pktBuf);
+
+    if (ret < 0)
+        counters()->txDrops++;
+    return ret;
 }
 
 void Device::resolveGateway()
@@ -282,6 +390,8 @@ void Device::clearNeighbors(Device::NeighborSet set)
     case kAllNeighbors:
         arpTable_.clear();
         ndpTable_.clear();
+        staleArp_.clear();
+        staleNdp_.clear();
         break;
 
     case kUnresolvedNeighbors:
@@ -302,6 +412,69 @@ void Device::clearNeighbors(Device::NeighborSet set)
     }
 }
 
+void Device::countNeighbors(int *arpResolved, int *arpUnresolved,
+                            int *ndpResolved, int *ndpUnresolved) const
+{
+    *arpResolved = *arpUnresolved = *ndpResolved = *ndpUnresolved = 0;
+
+    foreach(quint64 mac, arpTable_)
+        mac ? (*arpResolved)++ : (*arpUnresolved)++;
+
+    foreach(quint64 mac, ndpTable_)
+        mac ? (*ndpResolved)++ : (*ndpUnresolved)++;
+}
+
+// Takes over the neighbors of other (a previous incarnation of this device)
+// for the address families where our address is unchanged
+void Device::copyNeighbors(const Device &other)
+{
+    if (hasIp4_ && other.hasIp4_ && (ip4_ == other.ip4_)) {
+        arpTable_ = other.arpTable_;
+        staleArp_ = other.staleArp_;
+    }
+
+    if (hasIp6_ && other.hasIp6_ && (ip6_ == other.ip6_)) {
+        ndpTable_ = other.ndpTable_;
+        staleNdp_ = other.staleNdp_;
+    }
+}
+
+// Returns false if ip is not in the neighbor cache; *mac is 0 if unresolved
+bool Device::lookupNeighbor(quint32 ip, quint64 *mac)
+{
+    QHash<quint32, quint64>::const_iterator it = arpTable_.constFind(ip);
+
+    if (it == arpTable_.constEnd())
+        return false;
+    *mac = it.value();
+    return true;
+}
+
+bool Device::lookupNeighbor(UInt128 ip, quint64 *mac)
+{
+    QHash<UInt128, quint64>::const_iterator it = ndpTable_.constFind(ip);
+
+    if (it == ndpTable_.constEnd())
+        return false;
+    *mac = it.value();
+    return true;
+}
+
+// A stale entry not confirmed by its refresh is unresolved again
+void Device::expireNeighbor(quint32 ip)
+{
+    staleArp_.remove(ip);
+    if (arpTable_.contains(ip))
+        arpTable_.insert(ip, 0);
+}
+
+void Device::expireNeighbor(UInt128 ip)
+{
+    staleNdp_.remove(ip);
+    if (ndpTable_.contains(ip))
+        ndpTable_.insert(ip, 0);
+}
+
 // Resolve the Neighbor IP address for this to-be-transmitted pktBuf
 // We expect pktBuf to point to EthType on entry
 void Device::resolveNeighbor(PacketBuffer *pktBuf)
@@ -309,7 +482,7 @@ void Device::resolveNeighbor(PacketBuffer *pktBuf)
     quint16 ethType = qFromBigEndian<quint16>(pktBuf->data());
     pktBuf->pull(2);
 
-    qDebug("%s: ethType 0x%x", __PRETTY_FUNCTION__, ethType);
+    qTrace("%s: ethType 0x%x", __PRETTY_FUNCTION__, ethType);
 
     switch(ethType)
     {
@@ -364,7 +537,7 @@ bool Device::isOrigin(const PacketBuffer *pktBuf)
     const uchar *pktData = pktBuf->data();
     quint16 ethType = qFromBigEndian<quint16>(pktData);
 
-    qDebug("%s: ethType 0x%x", __PRETTY_FUNCTION__, ethType);
+    qTrace("%s: ethType 0x%x", __PRETTY_FUNCTION__, ethType);
     pktData += 2;
 
     // We know only about IP packets - adjust for ethType length (2 bytes)
@@ -374,25 +547,25 @@ bool Device::isOrigin(const PacketBuffer *pktBuf)
         quint32 srcIp;
 
         if (pktBuf->length() < (ipHdrLen+2)) {
-            qDebug("incomplete IPv4 header: expected %d, actual %d",
+            qTrace("incomplete IPv4 header: expected %d, actual %d",
                     ipHdrLen, pktBuf->length());
             return false;
         }
 
         srcIp = qFromBigEndian<quint32>(pktData + ipHdrLen - 8);
-        qDebug("%s: pktSrcIp/selfIp = 0x%x/0x%x", __FUNCTION__, srcIp, ip4_);
+        qTrace("%s: pktSrcIp/selfIp = 0x%x/0x%x", __FUNCTION__, srcIp, ip4_);
         return (srcIp == ip4_);
     }
     else if ((ethType == kEthTypeIp6) && hasIp6_) { // IPv6
         UInt128 srcIp;
         if (pktBuf->length() < (kIp6HdrLen+2)) {
-            qDebug("incomplete IPv6 header: expected %d, actual %d",
+            qTrace("incomplete IPv6 header: expected %d, actual %d",
                     kIp6HdrLen, pktBuf->length()-2);
             return false;
         }
 
         srcIp = qFromBigEndian<UInt128>(pktData + 8);
-        qDebug("%s: pktSrcIp6/selfIp6 = %llx-%llx/%llx-%llx", __FUNCTION__,
+        qTrace("%s: pktSrcIp6/selfIp6 = %llx-%llx/%llx-%llx", __FUNCTION__,
                 srcIp.hi64(), srcIp.lo64(), ip6_.hi64(), ip6_.lo64());
         return (srcIp == ip6_);
     }
@@ -407,7 +580,7 @@ quint64 Device::neighborMac(const PacketBuffer *pktBuf)
     const uchar *pktData = pktBuf->data();
     quint16 ethType = qFromBigEndian<quint16>(pktData);
 
-    qDebug("%s: ethType 0x%x", __PRETTY_FUNCTION__, ethType);
+    qTrace("%s: ethType 0x%x", __PRETTY_FUNCTION__, ethType);
     pktData += 2;
 
     // We know only about IP packets
@@ -416,14 +589,14 @@ quint64 Device::neighborMac(const PacketBuffer *pktBuf)
         quint32 dstIp, tgtIp;
 
         if (pktBuf->length() < ipHdrLen) {
-            qDebug("incomplete IPv4 header: expected %d, actual %d",
+            qTrace("incomplete IPv4 header: expected %d, actual %d",
                     ipHdrLen, pktBuf->length());
             return false;
         }
 
         dstIp = qFromBigEndian<quint32>(pktData + ipHdrLen - 4);
         if ((dstIp & 0xF0000000) == 0xE0000000) { // Mcast IP?
-            qDebug("mcast dst %x", dstIp);
+            qTrace("mcast dst %x", dstIp);
             return (quint64(0x01005e) << 24) | (dstIp & 0x7FFFFF);
         }
         tgtIp = ((dstIp & ip4Mask_) == ip4Subnet_) ? dstIp : ip4Gateway_;
@@ -434,14 +607,14 @@ quint64 Device::neighborMac(const PacketBuffer *pktBuf)
         UInt128 dstIp, tgtIp;
 
         if (pktBuf->length() < (kIp6HdrLen+2)) {
-            qDebug("incomplete IPv6 header: expected %d, actual %d",
+            qTrace("incomplete IPv6 header: expected %d, actual %d",
                     kIp6HdrLen, pktBuf->length()-2);
             return false;
         }
 
         dstIp = qFromBigEndian<UInt128>(pktData + 24);
         if (dstIp.toArray()[0] == 0xFF) { // Mcast IP?
-            qDebug("mcast dst %s",
+            qTrace("mcast dst %s",
                     qPrintable(QHostAddress(dstIp.toArray()).toString()));
             return (quint64(0x3333) << 32) | (dstIp.lo64() & 0xFFFFFFFF);
         }
@@ -463,7 +636,6 @@ quint64 Device::neighborMac(const PacketBuffer *pktBuf)
  */
 void Device::receiveArp(PacketBuffer *pktBuf)
 {
-    PacketBuffer *rspPkt;
     uchar *pktData = pktBuf->data();
     int offset = 0;
     quint16 hwType, protoType;
@@ -475,11 +647,12 @@ void Device::receiveArp(PacketBuffer *pktBuf)
     // Extract tgtIp first to check quickly if this packet is for us or not
     tgtIp = qFromBigEndian<quint32>(pktData + 24);
     if (tgtIp != ip4_) {
-        qDebug("tgtIp %s is not me %s",
+        qTrace("tgtIp %s is not me %s",
                 qPrintable(QHostAddress(tgtIp).toString()),
                 qPrintable(QHostAddress(ip4_).toString()));
         return;
     }
+    counters()->arpRx++;
 
     // Extract annd verify ARP packet contents
     hwType = qFromBigEndian<quint16>(pktData + offset);
@@ -522,34 +695,32 @@ void Device::receiveArp(PacketBuffer *pktBuf)
     {
     case 1:  // ARP Request
         arpTable_.insert(srcIp, srcMac);
+        staleArp_.remove(srcIp);
 
-        rspPkt = new PacketBuffer;
-        rspPkt->reserve(encapSize());
-        pktData = rspPkt->put(28);
-        if (pktData) {
-            // HTYP, PTYP
-            *(quint32*)(pktData   ) = qToBigEndian(quint32(0x00010800));
-            // HLEN, PLEN, OPER
-            *(quint32*)(pktData+ 4) = qToBigEndian(quint32(0x06040002));
-            // Source H/W Addr, Proto Addr
-            *(quint32*)(pktData+ 8) = qToBigEndian(quint32(mac_ >> 16));
-            *(quint16*)(pktData+12) = qToBigEndian(quint16(mac_ & 0xffff));
-            *(quint32*)(pktData+14) = qToBigEndian(ip4_);
-            // Target H/W Addr, Proto Addr
-            *(quint32*)(pktData+18) = qToBigEndian(quint32(srcMac >> 16));
-            *(quint16*)(pktData+22) = qToBigEndian(quint16(srcMac & 0xffff));
-            *(quint32*)(pktData+24) = qToBigEndian(srcIp);
-        }
+        // Reply by rewriting the request in place (HTYP, PTYP, HLEN and
+        // PLEN are the same) - and the same encap as it was received with
+        // OPER
+        *(quint16*)(pktData+ 6) = qToBigEndian(quint16(0x0002));
+        // Source H/W Addr, Proto Addr
+        *(quint32*)(pktData+ 8) = qToBigEndian(quint32(mac_ >> 16));
+        *(quint16*)(pktData+12) = qToBigEndian(quint16(mac_ & 0xffff));
+        *(quint32*)(pktData+14) = qToBigEndian(ip4_);
+        // Target H/W Addr, Proto Addr
+        *(quint32*)(pktData+18) = qToBigEndian(quint32(srcMac >> 16));
+        *(quint16*)(pktData+22) = qToBigEndian(quint16(srcMac & 0xffff));
+        *(quint32*)(pktData+24) = qToBigEndian(srcIp);
 
-        encap(rspPkt, srcMac, 0x0806);
-        transmitPacket(rspPkt);
+        encap(pktBuf, srcMac, 0x0806);
+        if (transmitPacket(pktBuf) >= 0)
+            counters()->arpTx++;
 
-        qDebug("Sent ARP Reply for srcIp/tgtIp=%s/%s",
+        qTrace("Sent ARP Reply for srcIp/tgtIp=%s/%s",
                 qPrintable(QHostAddress(srcIp).toString()),
                 qPrintable(QHostAddress(tgtIp).toString()));
         break;
     case 2: // ARP Response
         arpTable_.insert(srcIp, srcMac);
+        staleArp_.remove(srcIp);
         break;
 
     default:
@@ -572,7 +743,7 @@ void Device::sendArpRequest(PacketBuffer *pktBuf)
     quint32 dstIp, tgtIp;
 
     if (pktBuf->length() < ipHdrLen) {
-        qDebug("incomplete IPv4 header: expected %d, actual %d",
+        qTrace("incomplete IPv4 header: expected %d, actual %d",
                 ipHdrLen, pktBuf->length());
         return;
     }
@@ -587,10 +758,6 @@ void Device::sendArpRequest(PacketBuffer *pktBuf)
 
 void Device::sendArpRequest(quint32 tgtIp)
 {
-    quint32 srcIp = ip4_;
-    PacketBuffer *reqPkt;
-    uchar *pktData;
-
     // Validate target IP
     if (!tgtIp)
         return;
@@ -604,8 +771,19 @@ void Device::sendArpRequest(quint32 tgtIp)
     if (arpTable_.contains(tgtIp))
         return;
 
-    reqPkt = new PacketBuffer;
-    reqPkt->reserve(encapSize());
+    // The request is sent (and resent, if required) by the resolver
+    arpTable_.insert(tgtIp, 0);
+    deviceManager_->queueNeighborRequest(key_, tgtIp);
+}
+
+// Returns a new ARP request for tgtIp (caller releases it)
+PacketBuffer* Device::arpRequest(quint32 tgtIp)
+{
+    quint32 srcIp = ip4_;
+    PacketBuffer *reqPkt;
+    uchar *pktData;
+
+    reqPkt = PacketBuffer::alloc(encapSize());
     pktData = reqPkt->put(28);
     if (pktData) {
         // HTYP, PTYP
@@ -623,12 +801,12 @@ void Device::sendArpRequest(quint32 tgtIp)
     }
 
     encap(reqPkt, kBcastMac, 0x0806);
-    transmitPacket(reqPkt);
-    arpTable_.insert(tgtIp, 0);
 
-    qDebug("Sent ARP Request for srcIp/tgtIp=%s/%s",
+    qTrace("ARP Request for srcIp/tgtIp=%s/%s",
             qPrintable(QHostAddress(srcIp).toString()),
             qPrintable(QHostAddress(tgtIp).toString()));
+
+    return reqPkt;
 }
 
 void Device::receiveIp4(PacketBuffer *pktBuf)
@@ -638,13 +816,13 @@ void Device::receiveIp4(PacketBuffer *pktBuf)
     quint32 dstIp;
 
     if (pktData[0] != 0x45) {
-        qDebug("%s: Unsupported IP version or options (%02x) ", __FUNCTION__,
+        qTrace("%s: Unsupported IP version or options (%02x) ", __FUNCTION__,
                 pktData[0]);
         goto _invalid_exit;
     }
 
     if (pktBuf->length() < 20) {
-        qDebug("incomplete IPv4 header: expected 20, actual %d",
+        qTrace("incomplete IPv4 header: expected 20, actual %d",
                 pktBuf->length());
         goto _invalid_exit;
     }
@@ -653,17 +831,24 @@ void Device::receiveIp4(PacketBuffer *pktBuf)
 
     dstIp = qFromBigEndian<quint32>(pktData + 16);
     if (dstIp != ip4_) {
-        qDebug("%s: dstIp %x is not me (%x)", __FUNCTION__, dstIp, ip4_);
+        qTrace("%s: dstIp %x is not me (%x)", __FUNCTION__, dstIp, ip4_);
         goto _invalid_exit;
     }
 
     ipProto = pktData[9];
-    qDebug("%s: ipProto = %d", __FUNCTION__, ipProto);
+    qTrace("%s: ipProto = %d", __FUNCTION__, ipProto);
     switch (ipProto) {
     case 1: // ICMP
         pktBuf->pull(20);
         receiveIcmp4(pktBuf);
         break;
+    case kIpProtoTcp:
+        // Not a fragment (MF or offset) - the TCP header must be all there
+        if (qFromBigEndian<quint16>(pktData + 6) & 0x3fff)
+            break;
+        pktBuf->pull(20);
+        receiveTcp(pktBuf, 20);
+        break;
     default:
         qWarning("%s: Unsupported ipProto %d", __FUNCTION__, ipProto);
         break;
@@ -678,13 +863,14 @@ _invalid_exit:
 // ingress packet for egress; in other words, it assumes the
 // original IP header is intact and will just reuse it after
 // minimal modifications
-void Device::sendIp4Reply(PacketBuffer *pktBuf)
+bool Device::sendIp4Reply(PacketBuffer *pktBuf)
 {
     uchar *pktData = pktBuf->push(20);
     uchar origTtl = pktData[8];
     uchar ipProto = pktData[9];
     quint32 srcIp, dstIp, tgtIp, mask;
     quint32 sum;
+    quint64 dstMac;
 
     // Swap src/dst IP addresses
     dstIp = qFromBigEndian<quint32>(pktData + 12); // srcIp in original pkt
@@ -692,10 +878,10 @@ void Device::sendIp4Reply(PacketBuffer *pktBuf)
 
     tgtIp = ((dstIp & ip4Mask_) == ip4Subnet_) ? dstIp : ip4Gateway_;
 
-    if (!arpTable_.contains(tgtIp)) {
+    if (!lookupNeighbor(tgtIp, &dstMac)) {
         qWarning("%s: mac not found for %s; unable to send IPv4 packet",
                 __FUNCTION__, qPrintable(QHostAddress(tgtIp).toString()));
-        return;
+        return false;
     }
 
     *(quint32*)(pktData + 12) = qToBigEndian(srcIp);
@@ -713,8 +899,8 @@ void Device::sendIp4Reply(PacketBuffer *pktBuf)
         sum = (sum & 0xFFFF) + (sum >> 16);
     *(quint16*)(pktData + 10) = qToBigEndian(quint16(~sum));
 
-    encap(pktBuf, arpTable_.value(tgtIp), 0x0800);
-    transmitPacket(pktBuf);
+    encap(pktBuf, dstMac, 0x0800);
+    return transmitPacket(pktBuf) >= 0;
 }
 
 void Device::receiveIcmp4(PacketBuffer *pktBuf)
@@ -726,9 +912,10 @@ void Device::receiveIcmp4(PacketBuffer *pktBuf)
 
     // We handle only ping request
     if (pktData[0] != 8) { // Echo Request
-        qDebug("%s: Ignoring non echo request (%d)", __FUNCTION__, pktData[0]);
+        qTrace("%s: Ignoring non echo request (%d)", __FUNCTION__, pktData[0]);
         return;
     }
+    counters()->pingRx++;
 
     pktData[0] = 0; // Echo Reply
 
@@ -741,8 +928,11 @@ void Device::receiveIcmp4(PacketBuffer *pktBuf)
         sum = (sum & 0xFFFF) + (sum >> 16);
     *(quint16*)(pktData + 2) = qToBigEndian(quint16(~sum));
 
-    sendIp4Reply(pktBuf);
-    qDebug("Sent ICMP Echo Reply");
+    // The request is turned into the reply in place
+    if (sendIp4Reply(pktBuf)) {
+        counters()->pingReplies++;
+        qTrace("Sent ICMP Echo Reply");
+    }
 }
 
 /*
@@ -758,13 +948,13 @@ void Device::receiveIp6(PacketBuffer *pktBuf)
     UInt128 dstIp;
 
     if ((pktData[0] & 0xF0) != 0x60) {
-        qDebug("%s: Unsupported IP version (%02x) ", __FUNCTION__,
+        qTrace("%s: Unsupported IP version (%02x) ", __FUNCTION__,
                 pktData[0]);
         goto _invalid_exit;
     }
 
     if (pktBuf->length() < kIp6HdrLen) {
-        qDebug("incomplete IPv6 header: expected %d, actual %d",
+        qTrace("incomplete IPv6 header: expected %d, actual %d",
                 kIp6HdrLen, pktBuf->length());
         goto _invalid_exit;
     }
@@ -772,7 +962,7 @@ void Device::receiveIp6(PacketBuffer *pktBuf)
     // FIXME: check for specific mcast address(es) instead of any mcast?
     dstIp = qFromBigEndian<UInt128>(pktData + 24);
     if (!isIp6Mcast(dstIp) && (dstIp != ip6_)) {
-        qDebug("%s: dstIp %s is not me (%s)", __FUNCTION__,
+        qTrace("%s: dstIp %s is not me (%s)", __FUNCTION__,
                 qPrintable(QHostAddress(dstIp.toArray()).toString()),
                 qPrintable(QHostAddress(ip6_.toArray()).toString()));
         goto _invalid_exit;
@@ -784,6 +974,12 @@ void Device::receiveIp6(PacketBuffer *pktBuf)
         pktBuf->pull(kIp6HdrLen);
         receiveIcmp6(pktBuf);
         break;
+    case kIpProtoTcp:
+        if (dstIp != ip6_)
+            break;
+        pktBuf->pull(kIp6HdrLen);
+        receiveTcp(pktBuf, kIp6HdrLen);
+        break;
     default:
         break;
     }
@@ -794,6 +990,21 @@ _invalid_exit:
 
 // pktBuf should point to start of IP payload
 bool Device::sendIp6(PacketBuffer *pktBuf, UInt128 dstIp, quint8 protocol)
+{
+    if (!encapIp6(pktBuf, dstIp, protocol))
+        return false;
+
+    return transmitPacket(pktBuf) >= 0;
+}
+
+// Adds the IPv6 and L2 headers to pktBuf (pointing to the IPv6 payload)
+bool Device::encapIp6(PacketBuffer *pktBuf, UInt128 dstIp, quint8 protocol)
+{
+    return encapIp6(pktBuf, ip6_, dstIp, protocol);
+}
+
+bool Device::encapIp6(PacketBuffer *pktBuf, UInt128 srcIp, UInt128 dstIp,
+                      quint8 protocol)
 {
     int payloadLen = pktBuf->length();
     uchar *p = pktBuf->push(kIp6HdrLen);
@@ -809,7 +1020,8 @@ bool Device::sendIp6(PacketBuffer *pktBuf, UInt128 dstIp, quint8 protocol)
     if ((dstIp.hi64() >> 56) == 0xff)
         dstMac = (quint64(0x3333) << 32) | (dstIp.lo64() & 0xffffffff);
     else {
-        UInt128 tgtIp = ((dstIp & ip6Mask_) == ip6Subnet_)? dstIp : ip6Gateway_;
+        UInt128 tgtIp = (((dstIp & ip6Mask_) == ip6Subnet_)
+                            || isIp6LinkLocal(dstIp)) ? dstIp : ip6Gateway_;
         dstMac = ndpTable_.value(tgtIp);
     }
 
@@ -825,12 +1037,11 @@ bool Device::sendIp6(PacketBuffer *pktBuf, UInt128 dstIp, quint8 protocol)
     *(quint16*)(p+ 4) = qToBigEndian(quint16(payloadLen));
     p[6] = protocol;
     p[7] = 255; // HopLimit
-    memcpy(p+ 8,  ip6_.toArray(), 16); // Source IP
+    memcpy(p+ 8, srcIp.toArray(), 16); // Source IP
     memcpy(p+24, dstIp.toArray(), 16); // Destination IP
 
-    // FIXME: both these functions should return success/failure
+    // FIXME: this function should return success/failure
     encap(pktBuf, dstMac, kEthTypeIp6);
-    transmitPacket(pktBuf);
 
     return true;
 
@@ -838,26 +1049,37 @@ _error_exit:
     return false;
 }
 
+// fe80::/64 with the modified EUI-64 interface id of our MAC
+UInt128 Device::linkLocalIp6() const
+{
+    quint64 interfaceId = ((mac_ >> 24) << 40) | (quint64(0xfffe) << 24)
+                                | (mac_ & 0xffffff);
+
+    return UInt128(quint64(0xfe80) << 48,
+                   interfaceId ^ (quint64(0x02) << 56));
+}
+
 // This function assumes we are replying back to the same IP
 // that originally sent us the packet and therefore we can reuse the
 // ingress packet for egress; in other words, it assumes the
 // original IP header is intact and will just reuse it after
 // minimal modifications
-void Device::sendIp6Reply(PacketBuffer *pktBuf)
+bool Device::sendIp6Reply(PacketBuffer *pktBuf)
 {
     uchar *pktData = pktBuf->push(kIp6HdrLen);
     UInt128 srcIp, dstIp, tgtIp;
+    quint64 dstMac;
 
     // Swap src/dst IP addresses
     dstIp = qFromBigEndian<UInt128>(pktData +  8); // srcIp in original pkt
     srcIp = qFromBigEndian<UInt128>(pktData + 24); // dstIp in original pkt
 
     tgtIp = ((dstIp & ip6Mask_) == ip6Subnet_) ? dstIp : ip6Gateway_;
-    if (!ndpTable_.contains(tgtIp)) {
+    if (!lookupNeighbor(tgtIp, &dstMac)) {
         qWarning("%s: mac not found for %s; unable to send IPv6 packet",
                 __FUNCTION__,
                 qPrintable(QHostAddress(tgtIp.toArray()).toString()));
-        return;
+        return false;
     }
 
     memcpy(pktData +  8, srcIp.toArray(), 16); // Source IP
@@ -866,8 +1088,8 @@ void Device::sendIp6Reply(PacketBuffer *pktBuf)
     // Reset TTL
     pktData[7] = 64;
 
-    encap(pktBuf, ndpTable_.value(tgtIp), 0x86dd);
-    transmitPacket(pktBuf);
+    encap(pktBuf, dstMac, 0x86dd);
+    return transmitPacket(pktBuf) >= 0;
 }
 
 void Device::receiveIcmp6(PacketBuffer *pktBuf)
@@ -880,6 +1102,9 @@ void Device::receiveIcmp6(PacketBuffer *pktBuf)
 
     switch (type) {
         case 128: // ICMPv6 Echo Request
+            if (!hasIp6_)
+                break;
+            counters()->pingRx++;
             pktData[0] = 129; // Echo Reply
 
             // Incremental checksum update (RFC 1624 [Eqn.3])
@@ -891,8 +1116,11 @@ void Device::receiveIcmp6(PacketBuffer *pktBuf)
                 sum = (sum & 0xFFFF) + (sum >> 16);
             *(quint16*)(pktData + 2) = qToBigEndian(quint16(~sum));
 
-            sendIp6Reply(pktBuf);
-            qDebug("Sent ICMPv6 Echo Reply");
+            // The request is turned into the reply in place
+            if (sendIp6Reply(pktBuf)) {
+                counters()->pingReplies++;
+                qTrace("Sent ICMPv6 Echo Reply");
+            }
             break;
 
         case 135: // Neigh Solicit
@@ -904,6 +1132,302 @@ void Device::receiveIcmp6(PacketBuffer *pktBuf)
     }
 }
 
+/*
+ * Stateless TCP responder (if enabled) - a SYN is turned into a SYN-ACK
+ * in place, with a SYN cookie as our sequence number, so that a DUT
+ * tracking connections (firewall, load balancer) sees its half open
+ * entries complete. Nothing is kept per connection, so there's nothing
+ * to do for the client's ACK or anything after it
+ *
+ * pktBuf should point to the TCP header with the ipHdrLen bytes before it
+ * the IPv4 (no options) or IPv6 header
+ */
+void Device::receiveTcp(PacketBuffer *pktBuf, int ipHdrLen)
+{
+    uchar *tcp = pktBuf->data();
+    uchar *ip = tcp - ipHdrLen;
+    bool isIp6 = (ipHdrLen == kIp6HdrLen);
+    int addrLen = isIp6 ? 16 : 4;
+    const uchar *srcIp = ip + (isIp6 ? 8 : 12);
+    const uchar *dstIp = srcIp + addrLen;
+    int hdrLen, optLen, mss = kSynCookieMss[0], mssIndex = 0;
+    quint16 srcPort, dstPort;
+    quint32 seq, sum;
+    bool isSent;
+
+    if (!deviceManager_->isTcpResponderEnabled()
+            || (pktBuf->length() < kTcpHdrLen))
+        return;
+
+    // Only a SYN is answered
+    if ((tcp[13] & (kTcpSyn | kTcpAck | kTcpRst | kTcpFin)) != kTcpSyn)
+        return;
+    hdrLen = (tcp[12] >> 4)*4;
+    if ((hdrLen < kTcpHdrLen) || (hdrLen > pktBuf->length()))
+        return;
+    counters()->tcpSynRx++;
+
+    // The client's MSS option, if any
+    for (int i = kTcpHdrLen; i < hdrLen; ) {
+        if (tcp[i] == 0) // end of options
+            break;
+        if (tcp[i] == 1) { // nop
+            i++;
+            continue;
+        }
+        if (((i + 1) >= hdrLen) || (tcp[i+1] < 2))
+            break;
+        if ((tcp[i] == 2) && (tcp[i+1] == 4) && ((i + 4) <= hdrLen))
+            mss = qFromBigEndian<quint16>(tcp + i + 2);
+        i += tcp[i+1];
+    }
+    while (((mssIndex + 1) < kSynCookieMssCount)
+            && (kSynCookieMss[mssIndex + 1] <= mss))
+        mssIndex++;
+
+    srcPort = qFromBigEndian<quint16>(tcp);
+    dstPort = qFromBigEndian<quint16>(tcp + 2);
+    seq = qFromBigEndian<quint32>(tcp + 4);
+
+    // Our MSS option only if the frame has room for it (a minimum size
+    // frame always has - there's padding after a SYN with no options)
+    optLen = (pktBuf->length() >= (kTcpHdrLen + 4)) ? 4 : 0;
+
+    *(quint16*)(tcp    ) = qToBigEndian(dstPort);
+    *(quint16*)(tcp + 2) = qToBigEndian(srcPort);
+    *(quint32*)(tcp + 4) = qToBigEndian(synCookie(srcIp, dstIp, addrLen,
+                                            srcPort, dstPort, mssIndex));
+    *(quint32*)(tcp + 8) = qToBigEndian(seq + 1);
+    tcp[12] = quint8(((kTcpHdrLen + optLen)/4) << 4);
+    tcp[13] = kTcpSyn | kTcpAck;
+    *(quint16*)(tcp + 14) = qToBigEndian(quint16(0xffff)); // window
+    *(quint16*)(tcp + 16) = 0; // checksum
+    *(quint16*)(tcp + 18) = 0; // urgent pointer
+    if (optLen) {
+        tcp[20] = 2; // MSS
+        tcp[21] = 4;
+        *(quint16*)(tcp + 22) = qToBigEndian(kSynCookieMss[mssIndex]);
+    }
+    pktBuf->trim(kTcpHdrLen + optLen);
+
+    // Pseudo header sum is the same with the addresses swapped
+    sum = sumBytes(srcIp, addrLen, 0);
+    sum = sumBytes(dstIp, addrLen, sum);
+    sum += kIpProtoTcp + kTcpHdrLen + optLen;
+    sum = sumBytes(tcp, kTcpHdrLen + optLen, sum);
+    *(quint16*)(tcp + 16) = qToBigEndian(foldSum(sum));
+
+    if (isIp6) {
+        *(quint16*)(ip + 4) = qToBigEndian(quint16(kTcpHdrLen + optLen));
+        isSent = sendIp6Reply(pktBuf);
+    }
+    else {
+        *(quint16*)(ip + 2) = qToBigEndian(quint16(20 + kTcpHdrLen + optLen));
+        *(quint16*)(ip + 10) = 0;
+        *(quint16*)(ip + 10) = qToBigEndian(foldSum(sumBytes(ip, 20, 0)));
+        isSent = sendIp4Reply(pktBuf);
+    }
+
+    if (isSent)
+        counters()->tcpSynAcks++;
+}
+
+/*
+ * ---------------------------------------------------------
+ * Multicast (IGMP/MLD) related methods
+ * ---------------------------------------------------------
+ */
+
+bool McastGroups::contains(quint32 group) const
+{
+    foreach(const Ip4Range &range, ip4) {
+        quint32 delta = group - range.first;
+
+        if (((delta % range.step) == 0) && ((delta / range.step) < range.count))
+            return true;
+    }
+    return false;
+}
+
+bool McastGroups::contains(UInt128 group) const
+{
+    foreach(const Ip6Range &range, ip6) {
+        quint64 delta = group.lo64() - range.first.lo64();
+
+        if ((group.hi64() == range.first.hi64())
+                && ((delta % range.step) == 0)
+                && ((delta / range.step) < range.count))
+            return true;
+    }
+    return false;
+}
+
+// Group 0 (i.e. a general query) => a member of any group
+bool Device::isMcastMember(quint32 group) const
+{
+    if (!hasIp4_ || !mcastGroups_)
+        return false;
+
+    return group ? mcastGroups_->contains(group) : !mcastGroups_->ip4.isEmpty();
+}
+
+bool Device::isMcastMember(UInt128 group) const
+{
+    if (!hasIp6_ || !mcastGroups_)
+        return false;
+
+    return (group != UInt128(0, 0)) ? mcastGroups_->contains(group)
+                                    : !mcastGroups_->ip6.isEmpty();
+}
+
+/*!
+  Appends to reports the IGMPv3 (or MLDv2, if isIp6) reports with a record
+  of recordType (see McastGroups::RecordType) for each of our groups - as
+  few reports as the records fit in. Caller releases the reports
+*/
+void Device::mcastReports(bool isIp6, int recordType,
+                          QList<PacketBuffer*> *reports)
+{
+    PacketBuffer *pktBuf;
+
+    if (!mcastGroups_)
+        return;
+
+    if (!isIp6 && hasIp4_) {
+        QList<quint32> groups;
+
+        foreach(const McastGroups::Ip4Range &range, mcastGroups_->ip4) {
+            for (quint32 i = 0; i < range.count; i++) {
+                groups.append(range.first + i*range.step);
+                if (groups.size() < kMaxIgmpRecords)
+                    continue;
+                if ((pktBuf = igmpReport(recordType, groups)))
+                    reports->append(pktBuf);
+                groups.clear();
+            }
+        }
+        if (!groups.isEmpty() && (pktBuf = igmpReport(recordType, groups)))
+            reports->append(pktBuf);
+    }
+
+    if (isIp6 && hasIp6_) {
+        QList<UInt128> groups;
+
+        foreach(const McastGroups::Ip6Range &range, mcastGroups_->ip6) {
+            for (quint32 i = 0; i < range.count; i++) {
+                groups.append(UInt128(range.first.hi64(),
+                            range.first.lo64() + quint64(i)*range.step));
+                if (groups.size() < kMaxMldRecords)
+                    continue;
+                if ((pktBuf = mldReport(recordType, groups)))
+                    reports->append(pktBuf);
+                groups.clear();
+            }
+        }
+        if (!groups.isEmpty() && (pktBuf = mldReport(recordType, groups)))
+            reports->append(pktBuf);
+    }
+}
+
+// Returns a new IGMPv3 report (caller releases it); NULL on error
+PacketBuffer* Device::igmpReport(int recordType, const QList<quint32> &groups)
+{
+    const quint32 kAllIgmpv3Routers = 0xe0000016; // 224.0.0.22
+    int igmpLen = 8 + 8*groups.size();
+    PacketBuffer *reportPkt = PacketBuffer::alloc(encapSize());
+    uchar *ipHdr = reportPkt->put(24 + igmpLen);
+    uchar *pktData;
+
+    if (!ipHdr) {
+        reportPkt->release();
+        return NULL;
+    }
+
+    // IPv4 header with the Router Alert option
+    *(quint32*)(ipHdr    ) = qToBigEndian(quint32(0x46c00000 | (24 + igmpLen)));
+    *(quint32*)(ipHdr + 4) = 0; // Id, Flags, Frag Offset
+    ipHdr[8] = 1; // TTL
+    ipHdr[9] = kIpProtoIgmp;
+    *(quint16*)(ipHdr + 10) = 0;
+    *(quint32*)(ipHdr + 12) = qToBigEndian(ip4_);
+    *(quint32*)(ipHdr + 16) = qToBigEndian(kAllIgmpv3Routers);
+    *(quint32*)(ipHdr + 20) = qToBigEndian(quint32(0x94040000));
+    *(quint16*)(ipHdr + 10) = qToBigEndian(foldSum(sumBytes(ipHdr, 24, 0)));
+
+    // Type, Reserved, Checksum, Reserved, Num Group Records
+    pktData = ipHdr + 24;
+    *(quint32*)(pktData    ) = qToBigEndian(quint32(0x22000000));
+    *(quint16*)(pktData + 4) = 0;
+    *(quint16*)(pktData + 6) = qToBigEndian(quint16(groups.size()));
+    for (int i = 0; i < groups.size(); i++) {
+        uchar *record = pktData + 8 + 8*i;
+
+        // Record Type, Aux Data Len, Num Sources (0 => any source), Group
+        *(quint32*)(record    ) = qToBigEndian(quint32(recordType) << 24);
+        *(quint32*)(record + 4) = qToBigEndian(groups.at(i));
+    }
+    *(quint16*)(pktData + 2) =
+        qToBigEndian(foldSum(sumBytes(pktData, igmpLen, 0)));
+
+    encap(reportPkt, 0x01005e000016ULL, 0x0800);
+
+    return reportPkt;
+}
+
+// Returns a new MLDv2 report (caller releases it); NULL on error
+PacketBuffer* Device::mldReport(int recordType, const QList<UInt128> &groups)
+{
+    const UInt128 kAllMldv2Routers(quint64(0xff02) << 48, 0x16); // ff02::16
+    int mldLen = 8 + 20*groups.size();
+    PacketBuffer *reportPkt = PacketBuffer::alloc(encapSize());
+    uchar *ip6Hdr = reportPkt->put(kIp6HdrLen + 8 + mldLen);
+    uchar *pktData;
+    quint32 sum;
+
+    if (!ip6Hdr) {
+        reportPkt->release();
+        return NULL;
+    }
+
+    // MLD is sent from the link-local address (RFC 3810)
+
+    // Ver, TrfClass, FlowLabel, PayloadLen, NextHdr (hop-by-hop), HopLimit
+    *(quint32*)(ip6Hdr    ) = qToBigEndian(quint32(0x60000000));
+    *(quint16*)(ip6Hdr + 4) = qToBigEndian(quint16(8 + mldLen));
+    ip6Hdr[6] = 0;
+    ip6Hdr[7] = 1;
+    memcpy(ip6Hdr +  8, linkLocalIp6().toArray(), 16);
+    memcpy(ip6Hdr + 24, kAllMldv2Routers.toArray(), 16);
+
+    // Hop-by-hop header - Router Alert (MLD) and PadN
+    pktData = ip6Hdr + kIp6HdrLen;
+    *(quint32*)(pktData    ) = qToBigEndian(
+                                (quint32(kIpProtoIcmp6) << 24) | 0x0502);
+    *(quint32*)(pktData + 4) = qToBigEndian(quint32(0x00000100));
+
+    // Type, Code, Checksum, Reserved, Num Mcast Address Records
+    pktData += 8;
+    *(quint32*)(pktData    ) = qToBigEndian(quint32(143) << 24);
+    *(quint16*)(pktData + 4) = 0;
+    *(quint16*)(pktData + 6) = qToBigEndian(quint16(groups.size()));
+    for (int i = 0; i < groups.size(); i++) {
+        uchar *record = pktData + 8 + 20*i;
+
+        // Record Type, Aux Data Len, Num Sources (0 => any source), Group
+        *(quint32*)(record    ) = qToBigEndian(quint32(recordType) << 24);
+        memcpy(record + 4, groups.at(i).toArray(), 16);
+    }
+
+    sum = sumBytes(ip6Hdr + 8, 32, 0); // pseudo header
+    sum += mldLen + kIpProtoIcmp6;
+    sum = sumBytes(pktData, mldLen, sum);
+    *(quint16*)(pktData + 2) = qToBigEndian(foldSum(sum));
+
+    encap(reportPkt, 0x333300000016ULL, kEthTypeIp6);
+
+    return reportPkt;
+}
+
 void Device::receiveNdp(PacketBuffer *pktBuf)
 {
     uchar *pktData = pktBuf->data();
@@ -912,10 +1436,11 @@ void Device::receiveNdp(PacketBuffer *pktBuf)
     int minLen = 24 + (type == 136 ? 8 : 0); // NA should have the Target TLV
 
     if (len < minLen) {
-        qDebug("%s: incomplete NS/NA header: expected %d, actual %d",
+        qTrace("%s: incomplete NS/NA header: expected %d, actual %d",
                 __FUNCTION__, minLen, pktBuf->length());
         goto _invalid_exit;
     }
+    counters()->ndpRx++;
 
     switch (type)
     {
@@ -934,6 +1459,7 @@ void Device::receiveNdp(PacketBuffer *pktBuf)
             // Update NDP table only for solicited responses
             if (!(flags & kSFlag))
                 break;
+            staleNdp_.remove(tgtIp);
 
             if ((flags & kOFlag) || (mac == 0)) {
                 // Check if we have a Target Link-Layer TLV
@@ -959,7 +1485,7 @@ void Device::sendNeighborSolicit(PacketBuffer *pktBuf)
     UInt128 dstIp, tgtIp;
 
     if (pktBuf->length() < kIp6HdrLen) {
-        qDebug("incomplete IPv6 header: expected %d, actual %d",
+        qTrace("incomplete IPv6 header: expected %d, actual %d",
                 kIp6HdrLen, pktBuf->length());
         return;
     }
@@ -973,10 +1499,6 @@ void Device::sendNeighborSolicit(PacketBuffer *pktBuf)
 
 void Device::sendNeighborSolicit(UInt128 tgtIp)
 {
-    UInt128 dstIp, srcIp = ip6_;
-    PacketBuffer *reqPkt;
-    uchar *pktData;
-
     // Validate target IP
     if (tgtIp == UInt128(0, 0))
         return;
@@ -986,13 +1508,24 @@ void Device::sendNeighborSolicit(UInt128 tgtIp)
     if (ndpTable_.contains(tgtIp))
         return;
 
+    // The request is sent (and resent, if required) by the resolver
+    ndpTable_.insert(tgtIp, 0);
+    deviceManager_->queueNeighborRequest(key_, tgtIp);
+}
+
+// Returns a new NS for tgtIp (caller releases it); NULL on error
+PacketBuffer* Device::neighborSolicit(UInt128 tgtIp)
+{
+    UInt128 dstIp, srcIp = ip6_;
+    PacketBuffer *reqPkt;
+    uchar *pktData;
+
     // Form the solicited node address to be used as dstIp
     // ff02::1:ffXX:XXXX/104
     dstIp = UInt128((quint64(0xff02) << 48),
                     (quint64(0x01ff) << 24) | (tgtIp.lo64() & 0xFFFFFF));
 
-    reqPkt = new PacketBuffer;
-    reqPkt->reserve(encapSize() + kIp6HdrLen);
+    reqPkt = PacketBuffer::alloc(encapSize() + kIp6HdrLen);
     pktData = reqPkt->put(32);
     if (pktData) {
         // Calculate checksum first -
@@ -1024,14 +1557,16 @@ void Device::sendNeighborSolicit(UInt128 tgtIp)
         *(quint16*)(pktData+30) = qToBigEndian(quint16(mac_ & 0xffff));
     }
 
-    if (!sendIp6(reqPkt, dstIp , kIpProtoIcmp6))
-        return;
-
-    ndpTable_.insert(tgtIp, 0);
+    if (!encapIp6(reqPkt, dstIp , kIpProtoIcmp6)) {
+        reqPkt->release();
+        return NULL;
+    }
 
-    qDebug("Sent NDP Request for srcIp/tgtIp=%s/%s",
+    qTrace("NDP Request for srcIp/tgtIp=%s/%s",
             qPrintable(QHostAddress(srcIp.toArray()).toString()),
             qPrintable(QHostAddress(tgtIp.toArray()).toString()));
+
+    return reqPkt;
 }
 
 // Send NA for the NS packet in pktBuf
@@ -1043,10 +1578,15 @@ void Device::sendNeighborAdvertisement(PacketBuffer *pktBuf)
     quint16 flags = 0x6000; // solicit = 1; overide = 1
     uchar *ip6Hdr;
     UInt128 tgtIp, srcIp;
+    bool isSent;
 
+    // Our link-local address is answered for only if we use DHCPv6 - for
+    // the server's (or relay's) messages to reach us
     tgtIp = qFromBigEndian<UInt128>(pktData + 8);
-    if (tgtIp != ip6_) {
-        qDebug("%s: NS tgtIp %s is not us %s", __FUNCTION__,
+    if (((tgtIp != ip6_) || !hasIp6_)
+            && ((dhcp6_.state == DhcpLease::kDisabled)
+                || (tgtIp != linkLocalIp6()))) {
+        qTrace("%s: NS tgtIp %s is not us %s", __FUNCTION__,
                 qPrintable(QHostAddress(tgtIp.toArray()).toString()),
                 qPrintable(QHostAddress(ip6_.toArray()).toString()));
         ip6Hdr = pktBuf->push(kIp6HdrLen);
@@ -1068,11 +1608,11 @@ void Device::sendNeighborAdvertisement(PacketBuffer *pktBuf)
             mac = qFromBigEndian<quint32>(pktData + 26);
             mac = (mac << 16) | qFromBigEndian<quint16>(pktData + 30);
             ndpTable_.insert(srcIp, mac);
+            staleNdp_.remove(srcIp);
         }
     }
 
-    naPkt = new PacketBuffer;
-    naPkt->reserve(encapSize() + kIp6HdrLen);
+    naPkt = PacketBuffer::alloc(encapSize() + kIp6HdrLen);
     pktData = naPkt->put(32);
     if (pktData) {
         // Calculate checksum first -
@@ -1084,7 +1624,7 @@ void Device::sendNeighborAdvertisement(PacketBuffer *pktBuf)
         sum += (mac_ >> 32) + ((mac_ >> 16) & 0xffff) + (mac_ & 0xffff);
 
         // and variable fields from IPv6 pseudo header
-        sum += sumUInt128(ip6_);
+        sum += sumUInt128(tgtIp);
         sum += sumUInt128(srcIp);
 
         while(sum >> 16)
@@ -1104,25 +1644,474 @@ void Device::sendNeighborAdvertisement(PacketBuffer *pktBuf)
         *(quint16*)(pktData+30) = qToBigEndian(quint16(mac_ & 0xffff));
     }
 
-    if (!sendIp6(naPkt, srcIp , kIpProtoIcmp6))
+    // From the target - ip6_ or our link-local
+    isSent = encapIp6(naPkt, tgtIp, srcIp, kIpProtoIcmp6)
+                && (transmitPacket(naPkt) >= 0);
+    naPkt->release();
+    if (!isSent)
         return;
+    counters()->ndpTx++;
 
-    qDebug("Sent Neigh Advt to dstIp for tgtIp=%s/%s",
+    qTrace("Sent Neigh Advt to dstIp for tgtIp=%s/%s",
             qPrintable(QHostAddress(srcIp.toArray()).toString()),
             qPrintable(QHostAddress(tgtIp.toArray()).toString()));
 }
 
-bool operator<(const DeviceKey &a1, const DeviceKey &a2)
+/*
+ * ---------------------------------------------------------
+ * DHCP client - the messages and lease state; the timeouts and
+ * pacing are DhcpClient's
+ * ---------------------------------------------------------
+ */
+
+/*!
+  Has the device acquire its IPv4 (or IPv6) address with DHCP - it has no
+  address till then. The prefix length and gateway set before (setIp4()
+  or setIp6()) are used if the lease doesn't have these
+*/
+void Device::enableDhcp(bool isIp6)
 {
-    int i = 0;
+    DhcpLease *lease = dhcpLease(isIp6);
 
-    while (i < a1.size()) {
-        if (uchar(a1.at(i)) < uchar(a2.at(i)))
-            return true;
-        if (uchar(a1.at(i)) > uchar(a2.at(i)))
-            return false;
-        i++;
+    // A random first sequence - so that the events of a deleted device
+    // with the same key aren't taken for ours
+    *lease = DhcpLease();
+    lease->sequence = quint16(qrand());
+    restartDhcp(isIp6);
+}
+
+/*!
+  Drops the address (if any) and has the lease acquired afresh - the
+  sequence of the lease is left to the caller
+*/
+void Device::restartDhcp(bool isIp6)
+{
+    DhcpLease *lease = dhcpLease(isIp6);
+
+    lease->state = DhcpLease::kInit;
+    lease->attempts = 0;
+    if (isIp6)
+        hasIp6_ = false;
+    else
+        hasIp4_ = false;
+}
+
+/*!
+  Returns a new message (caller releases it) for the current state of the
+  lease - Discover (Solicit) while selecting, Request (Renew) while
+  requesting or renewing; NULL if none or on error
+*/
+PacketBuffer* Device::dhcpMessage(bool isIp6)
+{
+    switch (dhcpLease(isIp6)->state) {
+    case DhcpLease::kSelecting:
+        return isIp6 ? dhcp6Packet(kDhcp6Solicit) : dhcp4Packet(kDhcpDiscover);
+    case DhcpLease::kRequesting:
+        return isIp6 ? dhcp6Packet(kDhcp6Request) : dhcp4Packet(kDhcpRequest);
+    case DhcpLease::kRenewing:
+        return isIp6 ? dhcp6Packet(kDhcp6Renew) : dhcp4Packet(kDhcpRequest);
+    default:
+        break;
     }
 
-    return false;
+    return NULL;
+}
+
+// Returns a new Release of the lease, if bound (caller releases it)
+PacketBuffer* Device::dhcpRelease(bool isIp6)
+{
+    quint8 state = dhcpLease(isIp6)->state;
+
+    if ((state != DhcpLease::kBound) && (state != DhcpLease::kRenewing))
+        return NULL;
+
+    return isIp6 ? dhcp6Packet(kDhcp6Release) : dhcp4Packet(kDhcpRelease);
+}
+
+/*!
+  Handles a server's message to us - msg is the UDP payload, sent from
+  srcMac; returns the DhcpLease::Event
+*/
+int Device::receiveDhcp(bool isIp6, const uchar *msg, int length,
+                        quint64 srcMac)
+{
+    if (dhcpLease(isIp6)->state == DhcpLease::kDisabled)
+        return DhcpLease::kIgnored;
+
+    return isIp6 ? receiveDhcp6(msg, length, srcMac)
+                 : receiveDhcp4(msg, length, srcMac);
+}
+
+// Returns a new DHCPv4 message of msgType (caller releases it); NULL on
+// error. Sent as a broadcast till we have the address, with replies also
+// asked to be broadcast - as we can't answer the ARP for it till then
+PacketBuffer* Device::dhcp4Packet(quint8 msgType)
+{
+    bool isUnicast = (dhcp4_.state == DhcpLease::kRenewing)
+                        || (msgType == kDhcpRelease);
+    quint32 serverIp = (dhcp4_.serverId.size() == 4) ?
+        qFromBigEndian<quint32>((const uchar*) dhcp4_.serverId.constData()) : 0;
+    PacketBuffer *pktBuf = PacketBuffer::alloc(encapSize());
+    uchar *ipHdr = pktBuf->put(20 + 8 + kBootpLen);
+    uchar *udp, *msg, *opt;
+    quint32 sum;
+    quint16 cksum;
+
+    if (!ipHdr) {
+        pktBuf->release();
+        return NULL;
+    }
+    memset(ipHdr, 0, 20 + 8 + kBootpLen);
+
+    *(quint32*)(ipHdr    ) = qToBigEndian(quint32(0x45000000
+                                                  | (20 + 8 + kBootpLen)));
+    ipHdr[8] = 64; // TTL
+    ipHdr[9] = kIpProtoUdp;
+    *(quint32*)(ipHdr + 12) = qToBigEndian(isUnicast ? ip4_ : 0);
+    *(quint32*)(ipHdr + 16) = qToBigEndian(isUnicast ? serverIp : 0xffffffff);
+    *(quint16*)(ipHdr + 10) = qToBigEndian(foldSum(sumBytes(ipHdr, 20, 0)));
+
+    udp = ipHdr + 20;
+    *(quint16*)(udp    ) = qToBigEndian(kDhcpClientPort);
+    *(quint16*)(udp + 2) = qToBigEndian(kDhcpServerPort);
+    *(quint16*)(udp + 4) = qToBigEndian(quint16(8 + kBootpLen));
+
+    // Op (request), HType (ethernet), HLen, Hops, Xid, Secs, Flags
+    msg = udp + 8;
+    *(quint32*)(msg    ) = qToBigEndian(quint32(0x01010600));
+    *(quint32*)(msg + 4) = qToBigEndian(dhcp4_.xid);
+    if (isUnicast)
+        *(quint32*)(msg + 12) = qToBigEndian(ip4_); // ciaddr
+    else
+        *(quint16*)(msg + 10) = qToBigEndian(quint16(0x8000)); // Broadcast
+    *(quint32*)(msg + 28) = qToBigEndian(quint32(mac_ >> 16)); // chaddr
+    *(quint16*)(msg + 32) = qToBigEndian(quint16(mac_ & 0xffff));
+    *(quint32*)(msg + 236) = qToBigEndian(kDhcpMagicCookie);
+
+    // Options - Message Type, Client Identifier (HType + MAC), Requested
+    // IP and Server Identifier (for an Offer), Parameter Request List
+    // (Subnet Mask, Router)
+    opt = msg + 240;
+    opt[0] = 53; opt[1] = 1; opt[2] = msgType;
+    opt += 3;
+    opt[0] = 61; opt[1] = 7; opt[2] = 1;
+    memcpy(opt + 3, msg + 28, 6);
+    opt += 9;
+    if (dhcp4_.state == DhcpLease::kRequesting) {
+        opt[0] = 50; opt[1] = 4;
+        *(quint32*)(opt + 2) = qToBigEndian(quint32(dhcp4_.address.lo64()));
+        opt += 6;
+    }
+    if (((dhcp4_.state == DhcpLease::kRequesting) || (msgType == kDhcpRelease))
+            && serverIp) {
+        opt[0] = 54; opt[1] = 4;
+        memcpy(opt + 2, dhcp4_.serverId.constData(), 4);
+        opt += 6;
+    }
+    if (msgType != kDhcpRelease) {
+        opt[0] = 55; opt[1] = 2; opt[2] = 1; opt[3] = 3;
+        opt += 4;
+    }
+    opt[0] = 255; // End
+
+    // UDP checksum - 0 is sent as all ones (0 => no checksum)
+    sum = sumBytes(ipHdr + 12, 8, 0) + kIpProtoUdp + 8 + kBootpLen;
+    cksum = foldSum(sumBytes(udp, 8 + kBootpLen, sum));
+    *(quint16*)(udp + 6) = qToBigEndian(quint16(cksum ? cksum : 0xffff));
+
+    encap(pktBuf, isUnicast ? dhcp4_.serverMac : kBcastMac, kEthTypeIp4);
+
+    return pktBuf;
+}
+
+// Returns a new DHCPv6 message of msgType (caller releases it); NULL on
+// error. Always sent from our link-local to All DHCP Agents (no Unicast
+// option support)
+PacketBuffer* Device::dhcp6Packet(quint8 msgType)
+{
+    // ff02::1:2
+    const UInt128 kAllDhcpAgents(quint64(0xff02) << 48, 0x00010002);
+    bool hasAddress = (msgType != kDhcp6Solicit);
+    bool hasServerId = hasAddress && !dhcp6_.serverId.isEmpty();
+    int iaLen = 12 + (hasAddress ? 28 : 0);
+    int msgLen = 4 + 14 + (hasServerId ? 4 + dhcp6_.serverId.size() : 0)
+                    + 6 + 4 + iaLen;
+    PacketBuffer *pktBuf = PacketBuffer::alloc(encapSize());
+    uchar *ip6Hdr = pktBuf->put(kIp6HdrLen + 8 + msgLen);
+    uchar *udp, *opt;
+    quint32 sum;
+    quint16 cksum;
+
+    if (!ip6Hdr) {
+        pktBuf->release();
+        return NULL;
+    }
+    memset(ip6Hdr, 0, kIp6HdrLen + 8 + msgLen);
+
+    *(quint32*)(ip6Hdr    ) = qToBigEndian(quint32(0x60000000));
+    *(quint16*)(ip6Hdr + 4) = qToBigEndian(quint16(8 + msgLen));
+    ip6Hdr[6] = kIpProtoUdp;
+    ip6Hdr[7] = 1; // HopLimit - link scope
+    memcpy(ip6Hdr +  8, linkLocalIp6().toArray(), 16);
+    memcpy(ip6Hdr + 24, kAllDhcpAgents.toArray(), 16);
+
+    udp = ip6Hdr + kIp6HdrLen;
+    *(quint16*)(udp    ) = qToBigEndian(kDhcp6ClientPort);
+    *(quint16*)(udp + 2) = qToBigEndian(kDhcp6ServerPort);
+    *(quint16*)(udp + 4) = qToBigEndian(quint16(8 + msgLen));
+
+    // Msg Type, Transaction Id
+    opt = udp + 8;
+    *(quint32*)(opt) = qToBigEndian((quint32(msgType) << 24)
+                                    | (dhcp6_.xid & 0xffffff));
+    opt += 4;
+
+    // Client Identifier - a DUID-LL (type 3, ethernet) of our MAC
+    *(quint32*)(opt    ) = qToBigEndian(quint32(0x0001000a));
+    *(quint32*)(opt + 4) = qToBigEndian(quint32(0x00030001));
+    *(quint32*)(opt + 8) = qToBigEndian(quint32(mac_ >> 16));
+    *(quint16*)(opt + 12) = qToBigEndian(quint16(mac_ & 0xffff));
+    opt += 14;
+
+    if (hasServerId) {
+        *(quint16*)(opt    ) = qToBigEndian(quint16(2));
+        *(quint16*)(opt + 2) = qToBigEndian(quint16(dhcp6_.serverId.size()));
+        memcpy(opt + 4, dhcp6_.serverId.constData(), dhcp6_.serverId.size());
+        opt += 4 + dhcp6_.serverId.size();
+    }
+
+    // Elapsed Time (0)
+    *(quint32*)(opt) = qToBigEndian(quint32(0x00080002));
+    opt += 6;
+
+    // IA_NA - IAID from our MAC, T1/T2 (0) left to the server; with the
+    // (offered or leased) address as an IA Address option, lifetimes 0
+    *(quint16*)(opt    ) = qToBigEndian(quint16(3));
+    *(quint16*)(opt + 2) = qToBigEndian(quint16(iaLen));
+    *(quint32*)(opt + 4) = qToBigEndian(quint32(mac_));
+    if (hasAddress) {
+        *(quint32*)(opt + 16) = qToBigEndian(quint32(0x00050018));
+        memcpy(opt + 20, dhcp6_.address.toArray(), 16);
+    }
+
+    // The server id may be of an odd length
+    sum = sumBytes(ip6Hdr + 8, 32, 0) + kIpProtoUdp + 8 + msgLen;
+    sum = sumBytes(udp, (8 + msgLen) & ~1, sum);
+    if (msgLen & 1)
+        sum += quint32(udp[8 + msgLen - 1]) << 8;
+    cksum = foldSum(sum);
+    *(quint16*)(udp + 6) = qToBigEndian(quint16(cksum ? cksum : 0xffff));
+
+    encap(pktBuf, 0x333300010002ULL, kEthTypeIp6);
+
+    return pktBuf;
+}
+
+int Device::receiveDhcp4(const uchar *msg, int length, quint64 srcMac)
+{
+    quint8 msgType = 0;
+    quint32 address, mask = 0, router = 0;
+    quint32 leaseSecs = DhcpLease::kInfiniteSecs, renewSecs = 0;
+    int prefixLength;
+    QByteArray serverId;
+
+    if ((length < 240) || (msg[0] != 2) // BOOTREPLY
+            || (qFromBigEndian<quint32>(msg + 4) != dhcp4_.xid)
+            || (qFromBigEndian<quint32>(msg + 236) != kDhcpMagicCookie))
+        return DhcpLease::kIgnored;
+
+    address = qFromBigEndian<quint32>(msg + 16); // yiaddr
+
+    for (int i = 240; i < length; ) {
+        quint8 code = msg[i];
+        int len;
+
+        if (code == 255) // End
+            break;
+        if (code == 0) { // Pad
+            i++;
+            continue;
+        }
+        if ((i + 2 > length) || (i + 2 + msg[i+1] > length))
+            break;
+        len = msg[i+1];
+
+        switch (code) {
+        case 1: // Subnet Mask
+            if (len >= 4)
+                mask = qFromBigEndian<quint32>(msg + i + 2);
+            break;
+        case 3: // Router
+            if (len >= 4)
+                router = qFromBigEndian<quint32>(msg + i + 2);
+            break;
+        case 51: // Lease Time
+            if (len >= 4)
+                leaseSecs = qFromBigEndian<quint32>(msg + i + 2);
+            break;
+        case 53: // Message Type
+            if (len >= 1)
+                msgType = msg[i+2];
+            break;
+        case 54: // Server Identifier
+            serverId = QByteArray((const char*) msg + i + 2, len);
+            break;
+        case 58: // Renewal (T1) Time
+            if (len >= 4)
+                renewSecs = qFromBigEndian<quint32>(msg + i + 2);
+            break;
+        default:
+            break;
+        }
+        i += 2 + len;
+    }
+
+    switch (msgType) {
+    case kDhcpOffer:
+        if (dhcp4_.state != DhcpLease::kSelecting)
+            break;
+        dhcp4_.address = UInt128(0, address);
+        dhcp4_.serverId = serverId;
+        dhcp4_.serverMac = srcMac;
+        dhcp4_.state = DhcpLease::kRequesting;
+        dhcp4_.attempts = 0;
+        dhcp4_.sequence++;
+        return DhcpLease::kOffered;
+
+    case kDhcpAck:
+        if ((dhcp4_.state != DhcpLease::kRequesting)
+                && (dhcp4_.state != DhcpLease::kRenewing))
+            break;
+        prefixLength = ip4PrefixLength_;
+        if (mask) {
+            for (prefixLength = 0; prefixLength < 32; prefixLength++)
+                if (!(mask & (0x80000000U >> prefixLength)))
+                    break;
+        }
+        setIp4(address, prefixLength, router ? router : ip4Gateway_);
+        if (!serverId.isEmpty())
+            dhcp4_.serverId = serverId;
+        dhcp4_.address = UInt128(0, address);
+        if (!renewSecs) // T1 defaults to half the lease
+            renewSecs = (leaseSecs == DhcpLease::kInfiniteSecs) ?
+                            leaseSecs : leaseSecs/2;
+        dhcp4_.renewSecs = renewSecs;
+        dhcp4_.state = DhcpLease::kBound;
+        dhcp4_.sequence++;
+        return DhcpLease::kAcked;
+
+    case kDhcpNak:
+        if ((dhcp4_.state != DhcpLease::kRequesting)
+                && (dhcp4_.state != DhcpLease::kRenewing))
+            break;
+        restartDhcp(false);
+        dhcp4_.sequence++;
+        return DhcpLease::kNaked;
+
+    default:
+        break;
+    }
+
+    return DhcpLease::kIgnored;
+}
+
+int Device::receiveDhcp6(const uchar *msg, int length, quint64 srcMac)
+{
+    quint8 msgType;
+    quint16 status = 0;
+    quint32 renewSecs = 0, validSecs = DhcpLease::kInfiniteSecs;
+    bool hasAddress = false;
+    UInt128 address;
+    QByteArray serverId;
+
+    if ((length < 4) || ((qFromBigEndian<quint32>(msg) & 0xffffff)
+                            != (dhcp6_.xid & 0xffffff)))
+        return DhcpLease::kIgnored;
+    msgType = msg[0];
+
+    for (int i = 4; i + 4 <= length; ) {
+        quint16 code = qFromBigEndian<quint16>(msg + i);
+        int len = qFromBigEndian<quint16>(msg + i + 2);
+        const uchar *data = msg + i + 4;
+
+        if (i + 4 + len > length)
+            break;
+
+        switch (code) {
+        case 2: // Server Identifier
+            serverId = QByteArray((const char*) data, len);
+            break;
+        case 3: // IA_NA - IAID, T1, T2 and its options
+            if ((len < 12) || (qFromBigEndian<quint32>(data) != quint32(mac_)))
+                break;
+            renewSecs = qFromBigEndian<quint32>(data + 4);
+            for (int j = 12; j + 4 <= len; ) {
+                quint16 subCode = qFromBigEndian<quint16>(data + j);
+                int subLen = qFromBigEndian<quint16>(data + j + 2);
+
+                if (j + 4 + subLen > len)
+                    break;
+                if ((subCode == 5) && (subLen >= 24) && !hasAddress) {
+                    address = qFromBigEndian<UInt128>(data + j + 4);
+                    validSecs = qFromBigEndian<quint32>(data + j + 24);
+                    hasAddress = true;
+                }
+                else if ((subCode == 13) && (subLen >= 2))
+                    status = qFromBigEndian<quint16>(data + j + 4);
+                j += 4 + subLen;
+            }
+            break;
+        case 13: // Status Code
+            if (len >= 2)
+                status = qFromBigEndian<quint16>(data);
+            break;
+        default:
+            break;
+        }
+        i += 4 + len;
+    }
+
+    if (msgType == kDhcp6Advertise) {
+        // One without an address (NoAddrsAvail) is ignored
+        if ((dhcp6_.state != DhcpLease::kSelecting) || status || !hasAddress
+                || serverId.isEmpty())
+            return DhcpLease::kIgnored;
+        dhcp6_.address = address;
+        dhcp6_.serverId = serverId;
+        dhcp6_.serverMac = srcMac;
+        dhcp6_.state = DhcpLease::kRequesting;
+        dhcp6_.attempts = 0;
+        dhcp6_.sequence++;
+        return DhcpLease::kOffered;
+    }
+
+    if ((msgType != kDhcp6Reply)
+            || ((dhcp6_.state != DhcpLease::kRequesting)
+                && (dhcp6_.state != DhcpLease::kRenewing)))
+        return DhcpLease::kIgnored;
+
+    if (status || !hasAddress || !validSecs) {
+        restartDhcp(true);
+        dhcp6_.sequence++;
+        return DhcpLease::kNaked;
+    }
+
+    setIp6(address, ip6PrefixLength_, ip6Gateway_);
+    if (!serverId.isEmpty())
+        dhcp6_.serverId = serverId;
+    dhcp6_.address = address;
+    if (!renewSecs)
+        renewSecs = (validSecs == DhcpLease::kInfiniteSecs) ?
+                        validSecs : validSecs/2;
+    dhcp6_.renewSecs = renewSecs;
+    dhcp6_.state = DhcpLease::kBound;
+    dhcp6_.sequence++;
+    return DhcpLease::kAcked;
+}
+
+bool operator<(const DeviceKey &a1, const DeviceKey &a2)
+{
+    if (a1.vlans != a2.vlans)
+        return a1.vlans < a2.vlans;
+    return a1.mac < a2.mac;
 }
@@ -26,12 +26,173 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 
 #include <QByteArray>
 #include <QHash>
+#include <QList>
+#include <QSet>
+
+#include <string.h>
 
 class DeviceManager;
 class PacketBuffer;
 
-class DeviceKey: public QByteArray
+/*!
+  Device Key is (VLANS + MAC) - fixed width, so that building, hashing
+  and comparing keys (for every received packet) needs no allocation
+*/
+class DeviceKey
+{
+public:
+    static const int kMaxVlan = 4;
+
+    DeviceKey() : vlans(0), mac(0) {}
+
+    void setVlan(int index, quint16 vlan) {
+        if ((index < 0) || (index >= kMaxVlan))
+            return;
+        int shift = (kMaxVlan - 1 - index) * 16;
+        vlans = (vlans & ~(0xffffULL << shift))
+                    | (quint64(vlan) << shift);
+    }
+
+    bool operator==(const DeviceKey &other) const {
+        return (vlans == other.vlans) && (mac == other.mac);
+    }
+
+    quint64 vlans; // outermost tag in the highest 16 bits
+    quint64 mac;   // or an IPv4 address for an IP keyed lookup
+};
+
+inline uint qHash(const DeviceKey &key)
+{
+    return qHash(key.mac ^ (key.vlans * 0x9e3779b97f4a7c15ULL));
+}
+
+/*!
+  Emulation counters of a device group
+
+  Each thread that updates them has a slot (cache line) of its own - the
+  port's emulation receive thread (or, with emulation workers, the worker
+  of each shard - see DeviceManager) a 'receive' slot per shard, its
+  neighbor resolver the 'resolver' slot, its multicast reporter the
+  'reporter' slot and its DHCP client the 'dhcp' slot; so no locks or
+  atomics are needed. Readers add up the slots
+*/
+struct DeviceGroupStats
 {
+    struct Counters {
+        quint64 arpRx;
+        quint64 arpTx;
+        quint64 ndpRx;
+        quint64 ndpTx;
+        quint64 pingRx;
+        quint64 pingReplies;
+        quint64 txDrops;    // emulation tx backlog (ring/queue full)
+        quint64 tcpSynRx;
+        quint64 tcpSynAcks;
+        quint64 mcastQueryRx;
+        quint64 mcastReports;
+        quint64 dhcpTx;
+        quint64 dhcpRx;
+        quint64 dhcpLeases;
+        quint64 dhcpFailures;
+        quint64 pad_[1];    // to a cache line multiple
+
+        // Adds up other's counts - all the counters are quint64s
+        void add(const Counters &other) {
+            quint64 *p = (quint64*) this;
+            const quint64 *q = (const quint64*) &other;
+
+            for (uint i = 0; i < sizeof(Counters)/sizeof(quint64); i++)
+                p[i] += q[i];
+        }
+    };
+
+    // Max shards the devices of a port are split into (see DeviceManager)
+    static const int kMaxShards = 16;
+
+    DeviceGroupStats() { memset((void*) this, 0, sizeof(*this)); }
+
+    Counters receive[kMaxShards]; // by shard
+    Counters resolver;
+    Counters reporter;
+    Counters dhcp;
+};
+
+/*!
+  Multicast groups the devices of a device group are members of - as
+  ranges (a device may be a member of thousands of groups), shared by all
+  the devices of the group
+*/
+struct McastGroups
+{
+    struct Ip4Range {
+        quint32 first;
+        quint32 count;
+        quint32 step;
+    };
+    struct Ip6Range {
+        UInt128 first;
+        quint32 count;
+        quint32 step;   // added to the low 64 bits
+    };
+
+    // Group record types (IGMPv3 and MLDv2) used in the reports
+    enum RecordType {
+        kModeIsExclude = 2,     // current state - in reply to a query
+        kChangeToExclude = 4    // state change - on join
+    };
+
+    McastGroups() : robustness(0), interval(0) {}
+
+    bool contains(quint32 group) const;
+    bool contains(UInt128 group) const;
+
+    QList<Ip4Range> ip4;
+    QList<Ip6Range> ip6;
+    int robustness;     // unsolicited reports on join
+    int interval;       // msecs between these
+};
+
+/*!
+  DHCPv4 or DHCPv6 client state of a device - kept in the device (which
+  are allocated together, 100K+ of them) rather than in a table of the
+  DhcpClient, that has only the timer events. All of it is accessed with
+  all the DeviceManager's shards locked
+*/
+struct DhcpLease
+{
+    // Same values as OstEmul::DhcpState
+    enum State {
+        kDisabled = 0,      // static address, if any
+        kInit,
+        kSelecting,
+        kRequesting,
+        kBound,
+        kRenewing,
+        kFailed
+    };
+
+    // What a server's message did to the lease - see Device::receiveDhcp()
+    enum Event {
+        kIgnored,
+        kOffered,           // Request to be sent
+        kAcked,             // bound (or renewed)
+        kNaked              // to start over
+    };
+
+    static const quint32 kInfiniteSecs = 0xffffffff;
+
+    DhcpLease()
+        : state(kDisabled), attempts(0), sequence(0), xid(0),
+          renewSecs(0), serverMac(0) {}
+
+    quint8 state;
+    quint8 attempts;        // of the message being sent
+    quint16 sequence;       // changed on every state change
+    quint32 xid;
+    quint32 renewSecs;      // T1; kInfiniteSecs => never
+    quint64 serverMac;
+    UInt128 address;        // offered or leased; IPv4 in the low 32 bits
+    QByteArray serverId;    // server identifier option's value
 };
 
 class Device
@@ -45,11 +206,16 @@ public:
     };
 
 public:
-    Device(DeviceManager *deviceManager);
+    Device(DeviceManager *deviceManager = NULL);
 
     void setVlan(int index, quint16 vlan, quint16 tpid = kVlanTpid);
+    bool hasVlanId(quint16 vlanId) const;
     quint64 mac();
     void setMac(quint64 mac);
+    bool hasIp4() const { return hasIp4_; }
+    quint32 ip4() const { return ip4_; }
+    bool hasIp6() const { return hasIp6_; }
+    UInt128 ip6() const { return ip6_; }
     void setIp4(quint32 address, int prefixLength, quint32 gateway);
     void setIp6(UInt128 address, int prefixLength, UInt128 gateway);
     void getConfig(OstEmul::Device *deviceConfig);
@@ -61,14 +227,53 @@ public:
     int encapSize();
     void encap(PacketBuffer *pktBuf, quint64 dstMac, quint16 type);
 
+    DeviceGroupStats* stats() { return stats_; }
+    void setStats(DeviceGroupStats *stats) { stats_ = stats; }
+    // The receive counters of our shard
+    DeviceGroupStats::Counters* counters() {
+        return &stats_->receive[shard_];
+    }
+
+    // Shard (see DeviceManager) - a function of the key
+    int shard() const { return shard_; }
+    void setShard(int shard) { shard_ = shard; }
+
+    const McastGroups* mcastGroups() const { return mcastGroups_; }
+    void setMcastGroups(const McastGroups *groups) { mcastGroups_ = groups; }
+    bool isMcastMember(quint32 group) const;
+    bool isMcastMember(UInt128 group) const;
+    void mcastReports(bool isIp6, int recordType,
+                      QList<PacketBuffer*> *reports);
+
     void receivePacket(PacketBuffer *pktBuf);
-    void transmitPacket(PacketBuffer *pktBuf);
+    int transmitPacket(PacketBuffer *pktBuf);
 
     void resolveGateway();
 
+    DhcpLease* dhcpLease(bool isIp6) { return isIp6 ? &dhcp6_ : &dhcp4_; }
+    void enableDhcp(bool isIp6);
+    void restartDhcp(bool isIp6);
+    PacketBuffer* dhcpMessage(bool isIp6);
+    PacketBuffer* dhcpRelease(bool isIp6);
+    int receiveDhcp(bool isIp6, const uchar *msg, int length, quint64 srcMac);
+
     void clearNeighbors(Device::NeighborSet set);
     void resolveNeighbor(PacketBuffer *pktBuf);
     void getNeighbors(OstEmul::DeviceNeighborList *neighbors);
+    void copyNeighbors(const Device &other);
+    void countNeighbors(int *arpResolved, int *arpUnresolved,
+                        int *ndpResolved, int *ndpUnresolved) const;
+    bool lookupNeighbor(quint32 ip, quint64 *mac);
+    bool lookupNeighbor(UInt128 ip, quint64 *mac);
+    void markNeighborStale(quint32 ip) { staleArp_.insert(ip); }
+    void markNeighborStale(UInt128 ip) { staleNdp_.insert(ip); }
+    bool isNeighborStale(quint32 ip) const { return staleArp_.contains(ip); }
+    bool isNeighborStale(UInt128 ip) const { return staleNdp_.contains(ip); }
+    void expireNeighbor(quint32 ip);
+    void expireNeighbor(UInt128 ip);
+
+    PacketBuffer* arpRequest(quint32 tgtIp);
+    PacketBuffer* neighborSolicit(UInt128 tgtIp);
 
     bool isOrigin(const PacketBuffer *pktBuf);
     quint64 neighborMac(const PacketBuffer *pktBuf);
@@ -79,25 +284,42 @@ private: // methods
     void sendArpRequest(quint32 tgtIp);
 
     void receiveIp4(PacketBuffer *pktBuf);
-    void sendIp4Reply(PacketBuffer *pktBuf);
+    bool sendIp4Reply(PacketBuffer *pktBuf);
 
     void receiveIcmp4(PacketBuffer *pktBuf);
 
     void receiveIp6(PacketBuffer *pktBuf);
     bool sendIp6(PacketBuffer *pktBuf, UInt128 dstIp, quint8 protocol);
-    void sendIp6Reply(PacketBuffer *pktBuf);
+    bool encapIp6(PacketBuffer *pktBuf, UInt128 dstIp, quint8 protocol);
+    bool encapIp6(PacketBuffer *pktBuf, UInt128 srcIp, UInt128 dstIp,
+                  quint8 protocol);
+    UInt128 linkLocalIp6() const;
+    bool sendIp6Reply(PacketBuffer *pktBuf);
 
     void receiveIcmp6(PacketBuffer *pktBuf);
 
+    void receiveTcp(PacketBuffer *pktBuf, int ipHdrLen);
+
+    PacketBuffer* igmpReport(int recordType, const QList<quint32> &groups);
+    PacketBuffer* mldReport(int recordType, const QList<UInt128> &groups);
+
     void receiveNdp(PacketBuffer *pktBuf);
     void sendNeighborSolicit(PacketBuffer *pktBuf);
     void sendNeighborSolicit(UInt128 tgtIp);
     void sendNeighborAdvertisement(PacketBuffer *pktBuf);
 
+    PacketBuffer* dhcp4Packet(quint8 msgType);
+    PacketBuffer* dhcp6Packet(quint8 msgType);
+    int receiveDhcp4(const uchar *msg, int length, quint64 srcMac);
+    int receiveDhcp6(const uchar *msg, int length, quint64 srcMac);
+
 private: // data
-    static const int kMaxVlan = 4;
+    static const int kMaxVlan = DeviceKey::kMaxVlan;
 
     DeviceManager *deviceManager_;
+    DeviceGroupStats *stats_;
+    int shard_;
+    const McastGroups *mcastGroups_;
 
     int numVlanTags_;
     quint32 vlan_[kMaxVlan];
@@ -121,6 +343,13 @@ private: // data
 
     QHash<quint32, quint64> arpTable_;
     QHash<UInt128, quint64> ndpTable_;
+    // Resolved entries being refreshed that haven't been confirmed since
+    // (by an ARP or solicited NA from the neighbor) - see NeighborResolver
+    QSet<quint32> staleArp_;
+    QSet<UInt128> staleNdp_;
+
+    DhcpLease dhcp4_;
+    DhcpLease dhcp6_;
 };
 
 bool operator<(const DeviceKey &a1, const DeviceKey &a2);
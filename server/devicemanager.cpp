@@ -22,16 +22,27 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 #include "abstractport.h"
 #include "device.h"
 #include "../common/emulation.h"
+#include "../common/sdtprobes.h"
 #include "packetbuffer.h"
+#include "settings.h"
+#include "tracebuffer.h"
+#include "../common/trace.h"
 
 #include "../common/emulproto.pb.h"
 
+#include <QMutexLocker>
+#include <QSet>
 #include <qendian.h>
 
 #define __STDC_FORMAT_MACROS
 #include <inttypes.h>
 
 const quint64 kBcastMac = 0xffffffffffffULL;
+const quint8 kIpProtoIgmp = 2;
+const quint8 kIpProtoUdp = 17;
+const quint8 kIpProtoIcmp6 = 58;
+const quint16 kDhcpClientPort = 68;
+const quint16 kDhcp6ClientPort = 546;
 
 inline UInt128 UINT128(OstEmul::Ip6Address x)
 {
@@ -45,20 +56,48 @@ inline bool isMacMcast(quint64 mac)
 
 
 // XXX: Port owning DeviceManager already uses locks, so we don't use any
-// locks within DeviceManager to protect deviceGroupList_ et.al.
+// locks within DeviceManager to protect deviceGroupList_ et.al. - except
+// the shard locks against the neighbor resolver, mcast reporter and DHCP
+// client threads and the emulation workers
 
 DeviceManager::DeviceManager(AbstractPort *parent)
 {
     port_ = parent;
+    resolver_ = new NeighborResolver(this, parent ? parent->id() : -1);
+    reporter_ = new McastReporter(this, parent ? parent->id() : -1);
+    dhcpClient_ = new DhcpClient(this, parent ? parent->id() : -1);
+    dhcpDevices_ = 0;
+    isTcpResponderEnabled_ = appSettings->value(kTcpResponderKey,
+                                kTcpResponderDefaultValue).toBool();
+
+    shardCount_ = qBound(1, appSettings->value(kEmulationWorkersKey,
+                        kEmulationWorkersDefaultValue).toInt(),
+                        int(DeviceGroupStats::kMaxShards));
+    for (int i = 0; (shardCount_ > 1) && (i < shardCount_); i++)
+        workers_.append(new EmulationWorker(this, i,
+                                parent ? QString(parent->name()) : QString()));
 }
 
 DeviceManager::~DeviceManager()
 {
-    foreach(Device *dev, deviceList_)
-        delete dev;
+    while (!workers_.isEmpty())
+        delete workers_.takeFirst();
+
+    delete resolver_;
+    delete reporter_;
+    delete dhcpClient_;
+
+    foreach(QVector<Device> *devices, groupDevices_)
+        delete devices;
 
     foreach(OstProto::DeviceGroup *devGrp, deviceGroupList_)
         delete devGrp;
+
+    foreach(DeviceGroupStats *stats, groupStats_)
+        delete stats;
+
+    foreach(McastGroups *groups, groupMcast_)
+        delete groups;
 }
 
 int DeviceManager::deviceGroupCount()
@@ -96,6 +135,8 @@ bool DeviceManager::addDeviceGroup(uint deviceGroupId)
     deviceGroup = newDeviceGroup(port_->id());
     deviceGroup->mutable_device_group_id()->set_id(deviceGroupId);
     deviceGroupList_.insert(deviceGroupId, deviceGroup);
+    groupStats_.insert(deviceGroupId, new DeviceGroupStats);
+    groupMcast_.insert(deviceGroupId, new McastGroups);
 
     enumerateDevices(deviceGroup, kAdd);
 
@@ -118,6 +159,8 @@ bool DeviceManager::deleteDeviceGroup(uint deviceGroupId)
     deviceGroup = deviceGroupList_.take(deviceGroupId);
     enumerateDevices(deviceGroup, kDelete);
     delete deviceGroup;
+    delete groupStats_.take(deviceGroupId);
+    delete groupMcast_.take(deviceGroupId);
 
     // Stop emulation if no devices remain
     if ((deviceCount() == 0) && port_)
@@ -135,24 +178,169 @@ bool DeviceManager::modifyDeviceGroup(const OstProto::DeviceGroup *deviceGroup)
         return false;
     }
 
-    enumerateDevices(myDeviceGroup, kDelete);
-
-    myDeviceGroup->CopyFrom(*deviceGroup);
+    OstProto::DeviceGroup newDeviceGroup(*deviceGroup);
     // If mac step is 0, silently override to 1 - otherwise we won't have
     // unique DeviceKeys
-    if (myDeviceGroup->GetExtension(OstEmul::mac).step() == 0)
-        myDeviceGroup->MutableExtension(OstEmul::mac)->set_step(1);
+    if (newDeviceGroup.GetExtension(OstEmul::mac).step() == 0)
+        newDeviceGroup.MutableExtension(OstEmul::mac)->set_step(1);
     // Default value for ip6 step should be 1 (not 0)
-    if (myDeviceGroup->HasExtension(OstEmul::ip6)
-           && !myDeviceGroup->GetExtension(OstEmul::ip6).has_step())
-        myDeviceGroup->MutableExtension(OstEmul::ip6)
+    if (newDeviceGroup.HasExtension(OstEmul::ip6)
+           && !newDeviceGroup.GetExtension(OstEmul::ip6).has_step())
+        newDeviceGroup.MutableExtension(OstEmul::ip6)
             ->mutable_step()->set_lo(1);
 
+    // Same devices (keys and addresses)? Then just update them in place
+    if (deviceLayout(*myDeviceGroup) == deviceLayout(newDeviceGroup)) {
+        bool isMcastChanged =
+            myDeviceGroup->GetExtension(OstEmul::mcast).SerializeAsString()
+            != newDeviceGroup.GetExtension(OstEmul::mcast).SerializeAsString();
+
+        myDeviceGroup->CopyFrom(newDeviceGroup);
+        updateDevices(myDeviceGroup);
+        updateMcastGroups(myDeviceGroup, isMcastChanged);
+        return true;
+    }
+
+    // Otherwise re-create the devices, but keep the neighbors learned by
+    // those with the same key and address
+    QHash<DeviceKey, Device> oldDevices;
+    QVector<Device> *devices = groupDevices_.value(id);
+
+    for (int i = 0; devices && (i < devices->size()); i++)
+        oldDevices.insert((*devices)[i].key(), devices->at(i));
+
+    enumerateDevices(myDeviceGroup, kDelete);
+    myDeviceGroup->CopyFrom(newDeviceGroup);
     enumerateDevices(myDeviceGroup, kAdd);
 
+    devices = groupDevices_.value(id);
+    if (devices && !oldDevices.isEmpty()) {
+        ShardsLocker locker(this);
+
+        for (int i = 0; i < devices->size(); i++) {
+            Device &device = (*devices)[i];
+            QHash<DeviceKey, Device>::const_iterator it =
+                                oldDevices.constFind(device.key());
+
+            if (it != oldDevices.constEnd())
+                device.copyNeighbors(it.value());
+        }
+    }
+
+    updateMcastGroups(myDeviceGroup, true);
+
     return true;
 }
 
+/*!
+  Returns the device group config sans the attributes that can be applied
+  to its existing devices (see updateDevices()) - two device groups with
+  the same layout have the same devices (keys and addresses)
+*/
+std::string DeviceManager::deviceLayout(const OstProto::DeviceGroup &deviceGroup)
+{
+    OstProto::DeviceGroup layout(deviceGroup);
+
+    layout.clear_core();
+    layout.ClearExtension(OstEmul::mcast);
+    if (layout.HasExtension(OstEmul::ip4)) {
+        OstEmul::Ip4Emulation *ip4 = layout.MutableExtension(OstEmul::ip4);
+        ip4->clear_prefix_length();
+        ip4->clear_default_gateway();
+    }
+    if (layout.HasExtension(OstEmul::ip6)) {
+        OstEmul::Ip6Emulation *ip6 = layout.MutableExtension(OstEmul::ip6);
+        ip6->clear_prefix_length();
+        ip6->clear_default_gateway();
+    }
+
+    return layout.SerializeAsString();
+}
+
+// Applies the prefix lengths and gateways of deviceGroup to its devices
+void DeviceManager::updateDevices(const OstProto::DeviceGroup *deviceGroup)
+{
+    ShardsLocker locker(this);
+    QVector<Device> *devices =
+        groupDevices_.value(deviceGroup->device_group_id().id());
+    OstEmul::Ip4Emulation ip4 = deviceGroup->GetExtension(OstEmul::ip4);
+    OstEmul::Ip6Emulation ip6 = deviceGroup->GetExtension(OstEmul::ip6);
+
+    if (!devices)
+        return;
+
+    // Leased addresses have their own prefix lengths and gateways
+    for (int i = 0; i < devices->size(); i++) {
+        Device &device = (*devices)[i];
+
+        if (device.hasIp4() && !ip4.dhcp())
+            device.setIp4(device.ip4(), ip4.prefix_length(),
+                          ip4.default_gateway());
+        if (device.hasIp6() && !ip6.dhcp())
+            device.setIp6(device.ip6(), ip6.prefix_length(),
+                          UINT128(ip6.default_gateway()));
+    }
+    qDebug("%s: updated %d devices of group %u", __FUNCTION__,
+            devices->size(), deviceGroup->device_group_id().id());
+}
+
+// Applies the multicast groups of deviceGroup to its devices - and has
+// them all report their groups if isJoin
+void DeviceManager::updateMcastGroups(const OstProto::DeviceGroup *deviceGroup,
+                                      bool isJoin)
+{
+    uint id = deviceGroup->device_group_id().id();
+    McastGroups *groups = groupMcast_.value(id);
+    QVector<Device> *devices = groupDevices_.value(id);
+    OstEmul::McastEmulation mcast = deviceGroup->GetExtension(OstEmul::mcast);
+
+    if (!groups)
+        return;
+
+    lockShards();
+    groups->ip4.clear();
+    groups->ip6.clear();
+    for (int i = 0; i < mcast.group_size(); i++) {
+        const OstEmul::McastGroupRange &range = mcast.group(i);
+
+        if (!range.count())
+            continue;
+        if (range.has_ip4_address()) {
+            McastGroups::Ip4Range ip4;
+
+            ip4.first = range.ip4_address();
+            ip4.count = range.count();
+            ip4.step = qMax(1U, range.step());
+            groups->ip4.append(ip4);
+        }
+        if (range.has_ip6_address()) {
+            McastGroups::Ip6Range ip6;
+
+            ip6.first = UINT128(range.ip6_address());
+            ip6.count = range.count();
+            ip6.step = qMax(1U, range.step());
+            groups->ip6.append(ip6);
+        }
+    }
+    groups->robustness = mcast.robustness();
+    groups->interval = mcast.unsolicited_report_interval();
+    unlockShards();
+
+    if (!isJoin || !devices)
+        return;
+
+    for (int i = 0; i < devices->size(); i++) {
+        Device &device = (*devices)[i];
+
+        if (device.hasIp4() && !groups->ip4.isEmpty())
+            reporter_->join(device.key(), false,
+                            groups->robustness, groups->interval);
+        if (device.hasIp6() && !groups->ip6.isEmpty())
+            reporter_->join(device.key(), true,
+                            groups->robustness, groups->interval);
+    }
+}
+
 int DeviceManager::deviceCount()
 {
     return deviceList_.size();
@@ -161,23 +349,86 @@ int DeviceManager::deviceCount()
 void DeviceManager::getDeviceList(
         OstProto::PortDeviceList *deviceList)
 {
-    foreach(Device *device, sortedDeviceList_) {
+    foreach(Device *device, sortedDevices()) {
         OstEmul::Device *dev =
             deviceList->AddExtension(OstEmul::device);
         device->getConfig(dev);
     }
 }
 
+void DeviceManager::getDeviceList(
+        const OstProto::DeviceListRequest &request,
+        OstProto::PortDeviceList *deviceList)
+{
+    QList<Device*> devices = matchingDevices(request);
+    int first = qMin(quint64(request.offset()), quint64(devices.size()));
+    int last = request.count() ? qMin(quint64(devices.size()),
+                                      quint64(first) + request.count())
+                               : devices.size();
+
+    deviceList->set_total_devices(deviceList_.size());
+    deviceList->set_matched_devices(devices.size());
+
+    for (int i = first; i < last; i++) {
+        OstEmul::Device *dev =
+            deviceList->AddExtension(OstEmul::device);
+        devices.at(i)->getConfig(dev);
+    }
+}
+
+void DeviceManager::getDeviceGroupStats(
+        OstProto::DeviceGroupStatsList *statsList)
+{
+    QList<uint> ids = groupStats_.keys();
+
+    qSort(ids);
+    foreach(uint id, ids) {
+        const DeviceGroupStats *stats = groupStats_.value(id);
+        const DeviceGroupStats::Counters &rsl = stats->resolver;
+        DeviceGroupStats::Counters rcv = stats->receive[0];
+        OstProto::DeviceGroupStats *s = statsList->add_device_group_stats();
+
+        for (int i = 1; i < shardCount_; i++)
+            rcv.add(stats->receive[i]);
+
+        s->mutable_port_id()->set_id(port_->id());
+        s->mutable_device_group_id()->set_id(id);
+        s->set_arp_rx(rcv.arpRx + rsl.arpRx);
+        s->set_arp_tx(rcv.arpTx + rsl.arpTx);
+        s->set_ndp_rx(rcv.ndpRx + rsl.ndpRx);
+        s->set_ndp_tx(rcv.ndpTx + rsl.ndpTx);
+        s->set_ping_rx(rcv.pingRx + rsl.pingRx);
+        s->set_ping_replies(rcv.pingReplies + rsl.pingReplies);
+        s->set_tx_drops(rcv.txDrops + rsl.txDrops);
+        s->set_tcp_syn_rx(rcv.tcpSynRx + rsl.tcpSynRx);
+        s->set_tcp_syn_acks(rcv.tcpSynAcks + rsl.tcpSynAcks);
+        s->set_mcast_query_rx(rcv.mcastQueryRx);
+        s->set_mcast_reports(stats->reporter.mcastReports);
+        s->set_dhcp_tx(rcv.dhcpTx + stats->dhcp.dhcpTx);
+        s->set_dhcp_rx(rcv.dhcpRx);
+        s->set_dhcp_leases(rcv.dhcpLeases);
+        s->set_dhcp_failures(stats->dhcp.dhcpFailures);
+    }
+}
+
+// pktBuf is owned by the caller - it may be modified (e.g. turned into a
+// reply in place) but is not retained after the call
 void DeviceManager::receivePacket(PacketBuffer *pktBuf)
 {
     uchar *pktData = pktBuf->data();
     int offset = 0;
-    Device dk(this);
-    Device *device;
+    DeviceKey dk;
+    DeviceKey deviceKey;
     quint64 dstMac;
+    quint64 srcMac;
     quint16 ethType;
     quint16 vlan;
     int idx = 0;
+    int shard;
+
+    TraceBuffer::record(OstProto::TraceRecord::kEmulationRx,
+                        port_->id(), pktBuf->length());
+    OST_PROBE2(emulation_rx, port_->id(), pktBuf->length());
 
     // We assume pkt is ethernet
     // TODO: extend for other link layer types
@@ -193,36 +444,107 @@ void DeviceManager::receivePacket(PacketBuffer *pktBuf)
     offset += 4;
     dstMac = (dstMac << 16) | qFromBigEndian<quint16>(pktData + offset);
 
-    qDebug("dstMac %012" PRIx64, dstMac);
+    qTrace("dstMac %012" PRIx64, dstMac);
 
     // XXX: Treat multicast as bcast
     if (isMacMcast(dstMac))
         dstMac = kBcastMac;
 
-    dk.setMac(dstMac);
+    dk.mac = dstMac;
     offset += 2;
 
-    // Skip srcMac - don't care
-    offset += 6;
+    // Extract srcMac - only DHCP (the server's or relay's) cares
+    srcMac = qFromBigEndian<quint32>(pktData + offset);
+    offset += 4;
+    srcMac = (srcMac << 16) | qFromBigEndian<quint16>(pktData + offset);
+    offset += 2;
 
 _eth_type:
     // Extract EthType
     ethType = qFromBigEndian<quint16>(pktData + offset);
-    qDebug("%s: ethType 0x%x", __PRETTY_FUNCTION__, ethType);
+    qTrace("%s: ethType 0x%x", __PRETTY_FUNCTION__, ethType);
 
     if (tpidList_.contains(ethType)) {
         offset += 2;
         vlan = qFromBigEndian<quint16>(pktData + offset);
         dk.setVlan(idx++, vlan);
         offset += 2;
-        qDebug("%s: idx: %d vlan %d", __FUNCTION__, idx, vlan);
+        qTrace("%s: idx: %d vlan %d", __FUNCTION__, idx, vlan);
         goto _eth_type;
     }
 
     pktBuf->pull(offset);
 
-    if (dstMac == kBcastMac) {
-        QList<Device*> list = bcastList_.values(dk.key());
+    // The neighbor tables are updated by the resolver thread too (aging)
+    // - so all of it is done with all the shards locked, unless the frame
+    // can be handed to the worker of its device's shard
+    if (workers_.isEmpty()) {
+        lockShards();
+        receiveFrame(dk, ethType, srcMac, pktBuf);
+        unlockShards();
+        goto _exit;
+    }
+
+    dispatchLock_.lock();
+    shard = frameShard(dk, ethType, pktBuf, &deviceKey);
+    dispatchLock_.unlock();
+
+    if (shard == kAllShards) {
+        lockShards();
+        receiveFrame(dk, ethType, srcMac, pktBuf);
+        unlockShards();
+    }
+    else if (shard >= 0) {
+        // A copy (with the headroom for a reply in place) for the worker
+        int length = offset + pktBuf->length();
+        PacketBuffer *copy = PacketBuffer::alloc();
+
+        if ((copy->end() - copy->data()) < length) {
+            copy->release();
+            copy = new PacketBuffer(length);
+        }
+        memcpy(copy->put(length), pktBuf->data() - offset, length);
+        copy->pull(offset);
+        workers_.at(shard)->queue(deviceKey, copy);
+    }
+
+_exit:
+    return;
+}
+
+/*
+ * A frame for the devices - with all the shards locked. pktBuf points to
+ * the EthType
+ */
+void DeviceManager::receiveFrame(const DeviceKey &dstKey, quint16 ethType,
+                                 quint64 srcMac, PacketBuffer *pktBuf)
+{
+    Device *device;
+
+    // A DHCP reply is for a device that may not have its address yet -
+    // so it's matched by the client's MAC, not the IP
+    if (dhcpDevices_ && ((ethType == 0x0800) || (ethType == 0x86dd))
+            && receiveDhcp(dstKey, ethType, srcMac, pktBuf))
+        return;
+
+    if (dstKey.mac == kBcastMac) {
+        if (((ethType == 0x0800) || (ethType == 0x86dd))
+                && receiveMcastQuery(dstKey, ethType, pktBuf))
+            return;
+
+        // An ARP request is only for the device with the target IP - all
+        // others ignore it; so don't fan it out (e.g. for an ARP flood)
+        if ((ethType == 0x0806) && (pktBuf->length() >= 30)) {
+            DeviceKey ik = dstKey;
+
+            ik.mac = qFromBigEndian<quint32>(pktBuf->data() + 2 + 24);
+            device = ip4List_.value(ik);
+            if (device)
+                device->receivePacket(pktBuf);
+            return;
+        }
+
+        const QList<Device*> list = bcastList_.value(dstKey);
         // FIXME: We need to clone the pktBuf before passing to each
         // device, otherwise only the first device gets the original
         // packet - all subsequent ones get the modified packet!
@@ -230,29 +552,337 @@ _eth_type:
         // in the HDTE pointers - which is bad as well!
         foreach(Device *device, list)
             device->receivePacket(pktBuf);
-        goto _exit;
+        return;
     }
 
     // Is it destined for us?
-    device = deviceList_.value(dk.key());
+    device = deviceList_.value(dstKey);
     if (!device) {
-        qDebug("%s: dstMac %012llx is not us", __FUNCTION__, dstMac);
-        goto _exit;
+        qTrace("%s: dstMac %012llx is not us", __FUNCTION__, dstKey.mac);
+        return;
     }
 
     device->receivePacket(pktBuf);
+}
 
-_exit:
-    delete pktBuf;
+/*
+ * The shard whose worker handles a frame - that of the one device it's
+ * for (*deviceKey is set to its key); kAllShards for a frame that's
+ * handled for many devices at once or may change the device tables
+ * (DHCP) - see receiveFrame(); kNoShard if it's for none of our devices.
+ * pktBuf points to the EthType. Caller must hold dispatchLock_
+ */
+int DeviceManager::frameShard(const DeviceKey &dstKey, quint16 ethType,
+                              PacketBuffer *pktBuf, DeviceKey *deviceKey)
+{
+    Device *device;
+
+    if (dhcpDevices_ && isDhcpClientMessage(ethType, pktBuf))
+        return kAllShards;
+
+    if (dstKey.mac == kBcastMac) {
+        DeviceKey ik = dstKey;
+
+        if ((ethType != 0x0806) || (pktBuf->length() < 30))
+            return kAllShards;
+
+        // ARP request - for the device with the target IP, if any
+        ik.mac = qFromBigEndian<quint32>(pktBuf->data() + 2 + 24);
+        device = ip4List_.value(ik);
+    }
+    else
+        device = deviceList_.value(dstKey);
+
+    if (!device)
+        return kNoShard;
+
+    *deviceKey = device->key();
+    return device->shard();
+}
+
+/*
+ * Frames from the worker of shard - for its devices (see receivePacket())
+ */
+void DeviceManager::receiveShardPackets(int shard,
+        const QList<EmulationWorker::Item> &items)
+{
+    QMutexLocker locker(&shardLock_[shard]);
+
+    foreach(const EmulationWorker::Item &item, items) {
+        // The device may have been deleted since
+        Device *device = deviceList_.value(item.device);
+
+        if (device)
+            device->receivePacket(item.pktBuf);
+    }
+}
+
+// Is it a UDP datagram to a DHCP client port? pktBuf points to the EthType
+bool DeviceManager::isDhcpClientMessage(quint16 ethType,
+                                        const PacketBuffer *pktBuf)
+{
+    const uchar *pktData = pktBuf->data() + 2;
+    int length = pktBuf->length() - 2;
+
+    if (ethType == 0x0800) {
+        int ipHdrLen;
+
+        if ((length < 20) || ((pktData[0] >> 4) != 4)
+                || (pktData[9] != kIpProtoUdp))
+            return false;
+        ipHdrLen = (pktData[0] & 0x0f)*4;
+        return (length >= (ipHdrLen + 8))
+                && (qFromBigEndian<quint16>(pktData + ipHdrLen + 2)
+                        == kDhcpClientPort);
+    }
+
+    if (ethType == 0x86dd)
+        return (length >= (40 + 8)) && ((pktData[0] >> 4) == 6)
+                && (pktData[6] == kIpProtoUdp)
+                && (qFromBigEndian<quint16>(pktData + 40 + 2)
+                        == kDhcp6ClientPort);
+
+    return false;
+}
+
+/*
+ * Locks all the shards - in order, the dispatch last; so any device and
+ * the device tables can be accessed
+ */
+void DeviceManager::lockShards()
+{
+    for (int i = 0; i < shardCount_; i++)
+        shardLock_[i].lock();
+    dispatchLock_.lock();
+}
+
+void DeviceManager::unlockShards()
+{
+    dispatchLock_.unlock();
+    for (int i = shardCount_ - 1; i >= 0; i--)
+        shardLock_[i].unlock();
+}
+
+/*
+ * An IGMP or MLD query is handled here for all the devices of bcastKey
+ * (the query's vlans) that are members of the queried group at once -
+ * each just has its reply scheduled with the reporter. pktBuf points to
+ * the EthType. Returns false if not a query
+ */
+bool DeviceManager::receiveMcastQuery(const DeviceKey &bcastKey,
+                                      quint16 ethType, PacketBuffer *pktBuf)
+{
+    const uchar *pktData = pktBuf->data() + 2;
+    int length = pktBuf->length() - 2;
+    quint32 group4 = 0;
+    UInt128 group6(0, 0);
+    int maxRespMsecs;
+    bool isIp6;
+
+    if (ethType == 0x0800) {
+        int ipHdrLen;
+        quint8 code;
+
+        if ((length < 20) || ((pktData[0] >> 4) != 4)
+                || (pktData[9] != kIpProtoIgmp))
+            return false;
+        ipHdrLen = (pktData[0] & 0x0f)*4;
+        if (length < (ipHdrLen + 8))
+            return false;
+        pktData += ipHdrLen;
+        length -= ipHdrLen;
+        if (pktData[0] != 0x11) // Membership Query
+            return false;
+
+        // Max Resp Code (1/10 secs) - 0 for IGMPv1; exponential if >= 128
+        // for IGMPv3 (a longer query)
+        code = pktData[1];
+        if (!code)
+            maxRespMsecs = 10000;
+        else if ((length >= 12) && (code >= 128))
+            maxRespMsecs = (((code & 0x0f) | 0x10) << (((code >> 4) & 0x07) + 3))
+                                * 100;
+        else
+            maxRespMsecs = code*100;
+        group4 = qFromBigEndian<quint32>(pktData + 4);
+        isIp6 = false;
+    }
+    else {
+        quint8 nextHdr;
+        quint16 code;
+
+        if ((length < 40) || ((pktData[0] >> 4) != 6))
+            return false;
+        nextHdr = pktData[6];
+        pktData += 40;
+        length -= 40;
+
+        // An MLD query has a hop-by-hop header (router alert) first
+        if (nextHdr == 0) {
+            int extLen;
+
+            if (length < 8)
+                return false;
+            nextHdr = pktData[0];
+            extLen = (pktData[1] + 1)*8;
+            if (length < extLen)
+                return false;
+            pktData += extLen;
+            length -= extLen;
+        }
+        if ((nextHdr != kIpProtoIcmp6) || (length < 24)
+                || (pktData[0] != 130)) // Multicast Listener Query
+            return false;
+
+        // Max Resp Code (msecs) - exponential if >= 32768 for MLDv2
+        code = qFromBigEndian<quint16>(pktData + 4);
+        if ((length >= 28) && (code >= 32768))
+            maxRespMsecs = ((code & 0x0fff) | 0x1000)
+                                << (((code >> 12) & 0x07) + 3);
+        else
+            maxRespMsecs = code;
+        group6 = qFromBigEndian<UInt128>(pktData + 8);
+        isIp6 = true;
+    }
+
+    foreach(Device *device, bcastList_.value(bcastKey)) {
+        if (isIp6 ? !device->isMcastMember(group6)
+                  : !device->isMcastMember(group4))
+            continue;
+
+        device->counters()->mcastQueryRx++;
+        reporter_->query(device->key(), isIp6, maxRespMsecs);
+    }
+
+    return true;
+}
+
+/*
+ * A DHCP server's (or relay's) message to a client is handled here - for
+ * the device with the client's MAC (chaddr) of a DHCPv4 message, that's
+ * broadcast till the device has its address, or with the destination MAC
+ * of a DHCPv6 one, that's sent to our link-local. pktBuf points to the
+ * EthType. Returns false if not a message to a DHCP client
+ */
+bool DeviceManager::receiveDhcp(const DeviceKey &dstKey, quint16 ethType,
+                                quint64 srcMac, PacketBuffer *pktBuf)
+{
+    const uchar *pktData = pktBuf->data() + 2;
+    int length = pktBuf->length() - 2;
+    bool isIp6 = (ethType == 0x86dd);
+    DeviceKey key = dstKey;
+    Device *device;
+    DhcpLease *lease;
+    PacketBuffer *reqPkt;
+    bool hadIp4;
+    quint32 oldIp4;
+    quint8 oldState;
+    int udpLen;
+
+    if (!isIp6) {
+        int ipHdrLen;
+
+        // Not a fragment (MF or offset) - the DHCP message must be there
+        if ((length < 20) || ((pktData[0] >> 4) != 4)
+                || (pktData[9] != kIpProtoUdp)
+                || (qFromBigEndian<quint16>(pktData + 6) & 0x3fff))
+            return false;
+        ipHdrLen = (pktData[0] & 0x0f)*4;
+        if ((length < (ipHdrLen + 8))
+                || (qFromBigEndian<quint16>(pktData + ipHdrLen + 2)
+                        != kDhcpClientPort))
+            return false;
+        pktData += ipHdrLen;
+        length -= ipHdrLen;
+
+        if (length < (8 + 34)) // upto chaddr
+            return true;
+        key.mac = qFromBigEndian<quint32>(pktData + 8 + 28);
+        key.mac = (key.mac << 16) | qFromBigEndian<quint16>(pktData + 8 + 32);
+    }
+    else {
+        if ((length < (40 + 8)) || ((pktData[0] >> 4) != 6)
+                || (pktData[6] != kIpProtoUdp)
+                || (qFromBigEndian<quint16>(pktData + 40 + 2)
+                        != kDhcp6ClientPort))
+            return false;
+        pktData += 40;
+        length -= 40;
+    }
+
+    // Sans any ethernet padding
+    udpLen = qFromBigEndian<quint16>(pktData + 4);
+    if ((udpLen >= 8) && (udpLen < length))
+        length = udpLen;
+
+    device = deviceList_.value(key);
+    if (!device)
+        return true;
+    lease = device->dhcpLease(isIp6);
+    if (lease->state == DhcpLease::kDisabled)
+        return true;
+    device->counters()->dhcpRx++;
+
+    hadIp4 = device->hasIp4();
+    oldIp4 = device->ip4();
+    oldState = lease->state;
+    switch (device->receiveDhcp(isIp6, pktData + 8, length - 8, srcMac)) {
+    case DhcpLease::kOffered:
+        // The Request is sent right away - its retries are paced by the
+        // DHCP client, as is everything else
+        if ((reqPkt = device->dhcpMessage(isIp6))) {
+            if (transmitPacket(reqPkt) >= 0)
+                device->counters()->dhcpTx++;
+            reqPkt->release();
+        }
+        lease->attempts++;
+        dhcpClient_->schedule(key, isIp6, lease->sequence,
+                              dhcpClient_->timeout());
+        break;
+
+    case DhcpLease::kAcked:
+        device->counters()->dhcpLeases++;
+        if (lease->renewSecs != DhcpLease::kInfiniteSecs)
+            dhcpClient_->schedule(key, isIp6, lease->sequence,
+                                  qint64(lease->renewSecs)*1000);
+        // Newly bound (not renewed) - resolve the gateway right away
+        if (oldState == DhcpLease::kRequesting)
+            device->resolveGateway();
+        break;
+
+    case DhcpLease::kNaked:
+        dhcpClient_->schedule(key, isIp6, lease->sequence,
+                              dhcpClient_->timeout());
+        break;
+
+    default:
+        break;
+    }
+
+    if (!isIp6)
+        updateIp4Key(device, hadIp4, oldIp4);
+
+    return true;
 }
 
-void DeviceManager::transmitPacket(PacketBuffer *pktBuf)
+int DeviceManager::transmitPacket(PacketBuffer *pktBuf)
 {
-    port_->sendEmulationPacket(pktBuf);
+    return port_->sendEmulationPacket(pktBuf);
+}
+
+// Sends all of pktBufs as a batch; the pktBufs are released
+void DeviceManager::transmitPackets(const QList<PacketBuffer*> &pktBufs)
+{
+    if (!pktBufs.isEmpty())
+        port_->sendEmulationPackets(pktBufs);
+    foreach(PacketBuffer *pktBuf, pktBufs)
+        pktBuf->release();
 }
 
 void DeviceManager::resolveDeviceGateways()
 {
+    ShardsLocker locker(this);
+
     foreach(Device *device, deviceList_) {
         device->resolveGateway();
     }
@@ -260,6 +890,11 @@ void DeviceManager::resolveDeviceGateways()
 
 void DeviceManager::clearDeviceNeighbors(Device::NeighborSet set)
 {
+    ShardsLocker locker(this);
+
+    // Any requests pending are for the entries being cleared
+    resolver_->clear();
+
     foreach(Device *device, deviceList_)
         device->clearNeighbors(set);
 }
@@ -269,7 +904,7 @@ void DeviceManager::getDeviceNeighbors(
 {
     int count = 0;
 
-    foreach(Device *device, sortedDeviceList_) {
+    foreach(Device *device, sortedDevices()) {
         OstEmul::DeviceNeighborList *neighList =
             neighborList->AddExtension(OstEmul::device_neighbor);
         neighList->set_device_index(count++);
@@ -277,14 +912,283 @@ void DeviceManager::getDeviceNeighbors(
     }
 }
 
+void DeviceManager::getDeviceNeighbors(
+        const OstProto::DeviceListRequest &request,
+        OstProto::PortNeighborList *neighborList)
+{
+    QList<Device*> devices = matchingDevices(request);
+    int first = qMin(quint64(request.offset()), quint64(devices.size()));
+    int last = request.count() ? qMin(quint64(devices.size()),
+                                      quint64(first) + request.count())
+                               : devices.size();
+    int arpResolved = 0, arpUnresolved = 0;
+    int ndpResolved = 0, ndpUnresolved = 0;
+
+    for (int i = 0; i < devices.size(); i++) {
+        int arpOk, arpNok, ndpOk, ndpNok;
+
+        devices.at(i)->countNeighbors(&arpOk, &arpNok, &ndpOk, &ndpNok);
+        arpResolved += arpOk;
+        arpUnresolved += arpNok;
+        ndpResolved += ndpOk;
+        ndpUnresolved += ndpNok;
+
+        if ((i < first) || (i >= last))
+            continue;
+
+        OstEmul::DeviceNeighborList *neighList =
+            neighborList->AddExtension(OstEmul::device_neighbor);
+        neighList->set_device_index(i);
+        devices.at(i)->getNeighbors(neighList);
+    }
+
+    neighborList->set_total_devices(deviceList_.size());
+    neighborList->set_matched_devices(devices.size());
+    neighborList->set_arp_resolved(arpResolved);
+    neighborList->set_arp_unresolved(arpUnresolved);
+    neighborList->set_ndp_resolved(ndpResolved);
+    neighborList->set_ndp_unresolved(ndpUnresolved);
+}
+
 void DeviceManager::resolveDeviceNeighbor(PacketBuffer *pktBuf)
 {
+    ShardsLocker locker(this);
     Device *device = originDevice(pktBuf);
 
     if (device)
         device->resolveNeighbor(pktBuf);
 }
 
+void DeviceManager::queueNeighborRequest(const DeviceKey &device, quint32 ip4)
+{
+    resolver_->add(device, ip4);
+}
+
+void DeviceManager::queueNeighborRequest(const DeviceKey &device, UInt128 ip6)
+{
+    resolver_->add(device, ip6);
+}
+
+/*!
+  Called by the neighbor resolver (in its thread) with the requests due -
+  returns the NeighborResolver::Result for each request and the packets
+  to be sent for them (caller releases these)
+*/
+void DeviceManager::processNeighborRequests(
+        const QList<NeighborResolver::Request> &requests, int maxAttempts,
+        QList<int> *results, QList<PacketBuffer*> *packets)
+{
+    ShardsLocker locker(this);
+
+    for (int i = 0; i < requests.size(); i++) {
+        const NeighborResolver::Request &request = requests.at(i);
+        Device *device = deviceList_.value(request.device);
+        PacketBuffer *pktBuf;
+        quint64 mac = 0;
+        bool exists;
+
+        if (!device) {
+            results->append(NeighborResolver::kDropped);
+            continue;
+        }
+
+        exists = request.isIp6 ? device->lookupNeighbor(request.ip6, &mac)
+                               : device->lookupNeighbor(request.ip4, &mac);
+        if (!exists) {
+            results->append(NeighborResolver::kDropped);
+            continue;
+        }
+        if (request.isRefresh) {
+            // Resolved again since the refresh was queued or not stale
+            // i.e. confirmed after a refresh request was sent
+            if (!mac) {
+                results->append(NeighborResolver::kDropped);
+                continue;
+            }
+            if (request.attempts == 0) {
+                if (request.isIp6)
+                    device->markNeighborStale(request.ip6);
+                else
+                    device->markNeighborStale(request.ip4);
+            }
+            else if (request.isIp6 ? !device->isNeighborStale(request.ip6)
+                                   : !device->isNeighborStale(request.ip4)) {
+                results->append(NeighborResolver::kResolved);
+                continue;
+            }
+            else if (request.attempts >= maxAttempts) {
+                if (request.isIp6)
+                    device->expireNeighbor(request.ip6);
+                else
+                    device->expireNeighbor(request.ip4);
+                results->append(NeighborResolver::kFailed);
+                continue;
+            }
+        }
+        else if (mac) {
+            results->append(NeighborResolver::kResolved);
+            continue;
+        }
+        else if (request.attempts >= maxAttempts) {
+            results->append(NeighborResolver::kFailed);
+            continue;
+        }
+
+        pktBuf = request.isIp6 ? device->neighborSolicit(request.ip6)
+                               : device->arpRequest(request.ip4);
+        if (!pktBuf) {
+            results->append(NeighborResolver::kDropped);
+            continue;
+        }
+        packets->append(pktBuf);
+        results->append(NeighborResolver::kSent);
+        if (request.isIp6)
+            device->stats()->resolver.ndpTx++;
+        else
+            device->stats()->resolver.arpTx++;
+    }
+}
+
+/*!
+  Called by the mcast reporter (in its thread) with the reports due -
+  returns the packets to be sent for them (caller releases these)
+*/
+void DeviceManager::processMcastReports(
+        const QList<McastReporter::Report> &reports,
+        QList<PacketBuffer*> *packets)
+{
+    ShardsLocker locker(this);
+
+    for (int i = 0; i < reports.size(); i++) {
+        const McastReporter::Report &report = reports.at(i);
+        Device *device = deviceList_.value(report.device);
+        int count = packets->size();
+
+        if (!device)
+            continue;
+
+        device->mcastReports(report.isIp6, report.recordType, packets);
+        device->stats()->reporter.mcastReports += packets->size() - count;
+    }
+}
+
+/*!
+  Called by the DHCP client (in its thread) with the lease events due -
+  returns for each event the msecs after which it's due again (-1 => not)
+  and the messages to be sent for them (caller releases these)
+*/
+void DeviceManager::processDhcpRequests(
+        const QList<DhcpClient::Request> &requests,
+        QList<qint64> *delays, QList<PacketBuffer*> *packets)
+{
+    ShardsLocker locker(this);
+    int maxAttempts = dhcpClient_->maxAttempts();
+    int timeout = dhcpClient_->timeout();
+
+    for (int i = 0; i < requests.size(); i++) {
+        const DhcpClient::Request &request = requests.at(i);
+        Device *device = deviceList_.value(request.device);
+        DhcpLease *lease = device ? device->dhcpLease(request.isIp6) : NULL;
+        PacketBuffer *pktBuf;
+
+        // Device deleted or its lease has moved on since
+        if (!lease || (lease->sequence != request.sequence)) {
+            delays->append(-1);
+            continue;
+        }
+
+        switch (lease->state) {
+        case DhcpLease::kInit:
+        case DhcpLease::kBound:
+            // A new exchange - to acquire or renew
+            lease->state = (lease->state == DhcpLease::kInit) ?
+                            DhcpLease::kSelecting : DhcpLease::kRenewing;
+            lease->attempts = 0;
+            lease->xid = quint32(qrand()) ^ qHash(request.device);
+            break;
+
+        case DhcpLease::kSelecting:
+        case DhcpLease::kRequesting:
+        case DhcpLease::kRenewing:
+            if (lease->attempts < maxAttempts)
+                break; // resend
+            device->stats()->dhcp.dhcpFailures++;
+            if (lease->state == DhcpLease::kRenewing) {
+                // Lease not renewed - give it up and start over
+                bool hadIp4 = device->hasIp4();
+                quint32 oldIp4 = device->ip4();
+
+                device->restartDhcp(request.isIp6);
+                if (!request.isIp6)
+                    updateIp4Key(device, hadIp4, oldIp4);
+                delays->append(0);
+                continue;
+            }
+            lease->state = DhcpLease::kFailed;
+            delays->append(-1);
+            continue;
+
+        default:
+            delays->append(-1);
+            continue;
+        }
+
+        pktBuf = device->dhcpMessage(request.isIp6);
+        if (pktBuf) {
+            packets->append(pktBuf);
+            device->stats()->dhcp.dhcpTx++;
+        }
+        lease->attempts++;
+        // Wait longer for each retry
+        delays->append(qint64(timeout) << (lease->attempts - 1));
+    }
+}
+
+/*!
+  Returns the fields of a frame (upto L3) that decide its origin device
+  and neighbor - i.e. the vlan tags and the IP src/dst; frames with the
+  same key need to be resolved only once. Returns an empty key for a non
+  IP frame
+
+  May be called from multiple threads
+*/
+QByteArray DeviceManager::neighborKey(const uchar *pktData, int length) const
+{
+    int offset = 12; // start parsing after mac addresses
+    quint16 ethType = 0;
+    QByteArray key;
+
+    while ((offset + 2) <= length) {
+        ethType = qFromBigEndian<quint16>(pktData + offset);
+        if (!tpidList_.contains(ethType))
+            break;
+        offset += 4;
+    }
+    offset += 2;
+
+    switch (ethType)
+    {
+    case 0x0800: // IPv4
+        if ((offset + 20) > length)
+            break;
+        key.append((const char*) pktData + 12, offset - 12);
+        key.append((const char*) pktData + offset + 12, 8);
+        break;
+
+    case 0x86dd: // IPv6
+        if ((offset + 40) > length)
+            break;
+        key.append((const char*) pktData + 12, offset - 12);
+        key.append((const char*) pktData + offset + 8, 32);
+        break;
+
+    default:
+        break;
+    }
+
+    return key;
+}
+
 quint64 DeviceManager::deviceMacAddress(PacketBuffer *pktBuf)
 {
     Device *device = originDevice(pktBuf);
@@ -307,7 +1211,7 @@ Device* DeviceManager::originDevice(PacketBuffer *pktBuf)
 {
     uchar *pktData = pktBuf->data();
     int offset = 12; // start parsing after mac addresses
-    Device dk(this);
+    DeviceKey dk;
     quint16 ethType;
     quint16 vlan;
     int idx = 0;
@@ -319,36 +1223,125 @@ Device* DeviceManager::originDevice(PacketBuffer *pktBuf)
     // pktBuf will not have the correct dstMac populated, so use bcastMac
     // and search for device by IP
 
-    dk.setMac(kBcastMac);
+    dk.mac = kBcastMac;
 
 _eth_type:
     ethType = qFromBigEndian<quint16>(pktData + offset);
-    qDebug("%s: ethType 0x%x", __PRETTY_FUNCTION__, ethType);
+    qTrace("%s: ethType 0x%x", __PRETTY_FUNCTION__, ethType);
 
     if (tpidList_.contains(ethType)) {
         offset += 2;
         vlan = qFromBigEndian<quint16>(pktData + offset);
         dk.setVlan(idx++, vlan);
         offset += 2;
-        qDebug("%s: idx: %d vlan %d", __FUNCTION__, idx, vlan);
+        qTrace("%s: idx: %d vlan %d", __FUNCTION__, idx, vlan);
         goto _eth_type;
     }
 
     pktBuf->pull(offset);
 
-    foreach(Device *device, bcastList_.values(dk.key())) {
+    foreach(Device *device, bcastList_.value(dk)) {
         if (device->isOrigin(pktBuf))
             return device;
     }
 
-    qDebug("couldn't find origin device for packet");
+    qTrace("couldn't find origin device for packet");
     return NULL;
 }
 
+// Re-keys device in ip4List_ after its (DHCP) address has changed
+void DeviceManager::updateIp4Key(Device *device, bool hadIp4, quint32 oldIp4)
+{
+    DeviceKey key = device->key();
+
+    if ((hadIp4 == device->hasIp4()) && (oldIp4 == device->ip4()))
+        return;
+
+    if (hadIp4) {
+        key.mac = oldIp4;
+        if (ip4List_.value(key) == device)
+            ip4List_.remove(key);
+    }
+    if (device->hasIp4()) {
+        key.mac = device->ip4();
+        ip4List_.insert(key, device);
+    }
+}
+
+// Devices in the order of their keys - not kept sorted as it's needed
+// only for the (infrequent) device and neighbor list requests
+QList<Device*> DeviceManager::sortedDevices() const
+{
+    QList<DeviceKey> keys = deviceList_.keys();
+    QList<Device*> devices;
+
+    qSort(keys.begin(), keys.end());
+    devices.reserve(keys.size());
+    foreach(const DeviceKey &key, keys)
+        devices.append(deviceList_.value(key));
+
+    return devices;
+}
+
+// Returns the sorted devices that match all the filters of request
+QList<Device*> DeviceManager::matchingDevices(
+        const OstProto::DeviceListRequest &request) const
+{
+    QList<Device*> devices = sortedDevices();
+    QList<Device*> matches;
+    int ip4PrefixLength = qMin(request.ip4_prefix_length(), 32U);
+    int ip6PrefixLength = qMin(request.ip6_prefix_length(), 128U);
+    quint32 ip4Mask = ip4PrefixLength ? ~0U << (32 - ip4PrefixLength) : 0;
+    UInt128 ip6Mask = ip6PrefixLength ?
+                ~UInt128(0, 0) << (128 - ip6PrefixLength) : UInt128(0, 0);
+    UInt128 ip6Subnet = UInt128(request.ip6_subnet_hi(),
+                                request.ip6_subnet_lo()) & ip6Mask;
+
+    if (!request.has_neighbor_filter() && !request.has_vlan_id()
+            && !request.has_ip4_subnet()
+            && !request.has_ip6_subnet_hi() && !request.has_ip6_subnet_lo())
+        return devices;
+
+    foreach(Device *device, devices) {
+        if (request.has_vlan_id() && !device->hasVlanId(request.vlan_id()))
+            continue;
+
+        if (request.has_ip4_subnet()
+                && (!device->hasIp4()
+                    || ((device->ip4() & ip4Mask)
+                            != (request.ip4_subnet() & ip4Mask))))
+            continue;
+
+        if ((request.has_ip6_subnet_hi() || request.has_ip6_subnet_lo())
+                && (!device->hasIp6()
+                    || ((device->ip6() & ip6Mask) != ip6Subnet)))
+            continue;
+
+        if (request.neighbor_filter()
+                != OstProto::DeviceListRequest::kAnyNeighbors) {
+            int arpOk, arpNok, ndpOk, ndpNok;
+
+            device->countNeighbors(&arpOk, &arpNok, &ndpOk, &ndpNok);
+            if (request.neighbor_filter()
+                    == OstProto::DeviceListRequest::kUnresolvedNeighbors) {
+                if (!arpNok && !ndpNok)
+                    continue;
+            }
+            else if (arpNok || ndpNok || (!arpOk && !ndpOk))
+                continue;
+        }
+
+        matches.append(device);
+    }
+
+    return matches;
+}
+
 void DeviceManager::enumerateDevices(
     const OstProto::DeviceGroup *deviceGroup,
     Operation oper)
 {
+    ShardsLocker locker(this);
     Device dk(this);
     OstEmul::VlanEmulation pbVlan = deviceGroup->encap()
                                         .GetExtension(OstEmul::vlan);
@@ -361,6 +1354,8 @@ void DeviceManager::enumerateDevices(
     OstEmul::MacEmulation mac = deviceGroup->GetExtension(OstEmul::mac);
     OstEmul::Ip4Emulation ip4 = deviceGroup->GetExtension(OstEmul::ip4);
     OstEmul::Ip6Emulation ip6 = deviceGroup->GetExtension(OstEmul::ip6);
+    bool isDhcp4 = hasIp4 && ip4.dhcp();
+    bool isDhcp6 = hasIp6 && ip6.dhcp();
 
     /*
      * vlanCount[] stores the number of unique vlans at each tag level
@@ -430,6 +1425,83 @@ void DeviceManager::enumerateDevices(
         iter++;
     }
 
+    uint id = deviceGroup->device_group_id().id();
+
+    if (oper == kDelete) {
+        QVector<Device> *devices = groupDevices_.take(id);
+        QHash<DeviceKey, QList<Device*> > bcastDeleted;
+        QList<PacketBuffer*> releases;
+
+        if (!devices)
+            return;
+
+        for (int i = 0; i < devices->size(); i++) {
+            Device *device = &(*devices)[i];
+            DeviceKey key = device->key();
+            PacketBuffer *pktBuf;
+
+            // Leases are released - not left to expire on the server
+            if (isDhcp4 || isDhcp6) {
+                if ((pktBuf = device->dhcpRelease(false)))
+                    releases.append(pktBuf);
+                if ((pktBuf = device->dhcpRelease(true)))
+                    releases.append(pktBuf);
+                dhcpDevices_--;
+            }
+
+            deviceList_.remove(key);
+            if (device->hasIp4()) {
+                DeviceKey ik = key;
+                ik.mac = device->ip4();
+                if (ip4List_.value(ik) == device)
+                    ip4List_.remove(ik);
+            }
+            key.mac = kBcastMac;
+            bcastDeleted[key].append(device);
+        }
+
+        // Devices of other groups may share the bcast key
+        QHash<DeviceKey, QList<Device*> >::const_iterator it;
+        for (it = bcastDeleted.constBegin(); it != bcastDeleted.constEnd();
+                it++) {
+            QList<Device*> &list = bcastList_[it.key()];
+
+            if (list.size() == it.value().size())
+                list.clear();
+            else {
+                QSet<Device*> deleted;
+                QList<Device*> remaining;
+
+                foreach(Device *device, it.value())
+                    deleted.insert(device);
+
+                foreach(Device *device, list) {
+                    if (!deleted.contains(device))
+                        remaining.append(device);
+                }
+                list = remaining;
+            }
+            if (list.isEmpty())
+                bcastList_.remove(it.key());
+        }
+
+        qDebug("enumerate(del): %d devices of group %u", devices->size(), id);
+        delete devices;
+        transmitPackets(releases);
+        return;
+    }
+
+    // All the devices are copies of dk
+    dk.setStats(groupStats_.value(id));
+    dk.setMcastGroups(groupMcast_.value(id));
+
+    // The vector is never grown beyond this, so the device pointers held
+    // in the lists are stable
+    QVector<Device> *devices = new QVector<Device>;
+    devices->reserve(vlanCount.at(0) * deviceGroup->device_count());
+    Q_ASSERT(!groupDevices_.contains(id));
+    groupDevices_.insert(id, devices);
+
     for (int i = 0; i < vlanCount.at(0); i++) {
         for (int j = 0; j < numTags; j++) {
             OstEmul::VlanEmulation::Vlan vlan = pbVlan.stack(j);
@@ -446,49 +1518,48 @@ void DeviceManager::enumerateDevices(
 
             dk.setMac(mac.address() + macAdd);
             if (hasIp4)
-                dk.setIp4(ip4.address() + ip4Add,
+                dk.setIp4(isDhcp4 ? 0 : ip4.address() + ip4Add,
                           ip4.prefix_length(),
                           ip4.default_gateway());
             if (hasIp6)
-                dk.setIp6(UINT128(ip6.address()) + ip6Add,
+                dk.setIp6(isDhcp6 ? UInt128(0, 0)
+                                  : UINT128(ip6.address()) + ip6Add,
                           ip6.prefix_length(),
                           UINT128(ip6.default_gateway()));
-
-            switch (oper) {
-                case kAdd:
-                    if (deviceList_.contains(dk.key())) {
-                        qWarning("%s: error adding device %s (EEXIST)",
-                                __FUNCTION__, qPrintable(dk.config()));
-                        break;
-                    }
-                    device = new Device(this);
-                    *device = dk;
-                    deviceList_.insert(dk.key(), device);
-                    sortedDeviceList_.insert(dk.key(), device);
-
-                    dk.setMac(kBcastMac);
-                    bcastList_.insert(dk.key(), device);
-                    qDebug("enumerate(add): %s", qPrintable(device->config()));
-                    break;
-
-                case kDelete:
-                    device = deviceList_.take(dk.key());
-                    if (!device) {
-                        qWarning("%s: error deleting device %s (NOTFOUND)",
-                                __FUNCTION__, qPrintable(dk.config()));
-                        break;
-                    }
-                    qDebug("enumerate(del): %s", qPrintable(device->config()));
-                    delete device;
-                    sortedDeviceList_.take(dk.key()); // already freed above
-
-                    dk.setMac(kBcastMac);
-                    bcastList_.take(dk.key()); // device already freed above
-                    break;
-
-                default:
-                    Q_ASSERT(0); // Unreachable
+            // No address till a lease is acquired
+            if (isDhcp4)
+                dk.enableDhcp(false);
+            if (isDhcp6)
+                dk.enableDhcp(true);
+
+            if (deviceList_.contains(dk.key())) {
+                qWarning("%s: error adding device %s (EEXIST)",
+                        __FUNCTION__, qPrintable(dk.config()));
+                continue;
+            }
+            dk.setShard(qHash(dk.key()) % shardCount_);
+            devices->append(dk);
+            device = &devices->last();
+            deviceList_.insert(dk.key(), device);
+
+            DeviceKey key = dk.key();
+            if (device->hasIp4()) {
+                key.mac = device->ip4();
+                ip4List_.insert(key, device);
             }
+            key.mac = kBcastMac;
+            bcastList_[key].append(device);
+
+            // DHCP clients start together - the client paces them
+            if (isDhcp4)
+                dhcpClient_->schedule(dk.key(), false,
+                                      dk.dhcpLease(false)->sequence, 0);
+            if (isDhcp6)
+                dhcpClient_->schedule(dk.key(), true,
+                                      dk.dhcpLease(true)->sequence, 0);
+            if (isDhcp4 || isDhcp6)
+                dhcpDevices_++;
         } // foreach device
     } // foreach vlan
+    qDebug("enumerate(add): %d devices of group %u", devices->size(), id);
 }
@@ -21,16 +21,22 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 #define _DEVICE_MANAGER_H
 
 #include "device.h"
+#include "dhcpclient.h"
+#include "emulationworker.h"
+#include "mcastreporter.h"
+#include "neighborresolver.h"
 
 #include <QHash>
-#include <QMap>
-#include <QMultiHash>
+#include <QList>
+#include <QMutex>
+#include <QVector>
 #include <QtGlobal>
 
 class AbstractPort;
 class PacketBuffer;
 namespace OstProto {
     class DeviceGroup;
+    class DeviceListRequest;
 };
 
 class DeviceManager
@@ -49,15 +55,39 @@ public:
 
     int deviceCount();
     void getDeviceList(OstProto::PortDeviceList *deviceList);
+    void getDeviceList(const OstProto::DeviceListRequest &request,
+                       OstProto::PortDeviceList *deviceList);
+
+    void getDeviceGroupStats(OstProto::DeviceGroupStatsList *statsList);
 
     void receivePacket(PacketBuffer *pktBuf);
-    void transmitPacket(PacketBuffer *pktBuf);
+    void receiveShardPackets(int shard,
+                             const QList<EmulationWorker::Item> &items);
+    int transmitPacket(PacketBuffer *pktBuf);
+    void transmitPackets(const QList<PacketBuffer*> &pktBufs);
 
     void resolveDeviceGateways();
 
     void clearDeviceNeighbors(Device::NeighborSet set = Device::kAllNeighbors);
     void resolveDeviceNeighbor(PacketBuffer *pktBuf);
+    QByteArray neighborKey(const uchar *pktData, int length) const;
     void getDeviceNeighbors(OstProto::PortNeighborList *neighborList);
+    void getDeviceNeighbors(const OstProto::DeviceListRequest &request,
+                            OstProto::PortNeighborList *neighborList);
+
+    NeighborResolver* neighborResolver() { return resolver_; }
+    bool isTcpResponderEnabled() const { return isTcpResponderEnabled_; }
+    void queueNeighborRequest(const DeviceKey &device, quint32 ip4);
+    void queueNeighborRequest(const DeviceKey &device, UInt128 ip6);
+    void processNeighborRequests(const QList<NeighborResolver::Request> &requests,
+            int maxAttempts, QList<int> *results,
+            QList<PacketBuffer*> *packets);
+
+    void processMcastReports(const QList<McastReporter::Report> &reports,
+            QList<PacketBuffer*> *packets);
+
+    void processDhcpRequests(const QList<DhcpClient::Request> &requests,
+            QList<qint64> *delays, QList<PacketBuffer*> *packets);
 
     quint64 deviceMacAddress(PacketBuffer *pktBuf);
     quint64 neighborMacAddress(PacketBuffer *pktBuf);
@@ -65,17 +95,74 @@ public:
 private:
     enum Operation { kAdd, kDelete };
 
+    // frameShard() results other than a shard
+    enum { kAllShards = -1, kNoShard = -2 };
+
+    // Locks all the shards (and the dispatch) for the lifetime of the
+    // locker - for the device tables and any device
+    class ShardsLocker
+    {
+    public:
+        ShardsLocker(DeviceManager *manager) : manager_(manager) {
+            manager_->lockShards();
+        }
+        ~ShardsLocker() { manager_->unlockShards(); }
+    private:
+        DeviceManager *manager_;
+    };
+
+    void lockShards();
+    void unlockShards();
+    int frameShard(const DeviceKey &dstKey, quint16 ethType,
+                   PacketBuffer *pktBuf, DeviceKey *deviceKey);
+    void receiveFrame(const DeviceKey &dstKey, quint16 ethType,
+                      quint64 srcMac, PacketBuffer *pktBuf);
+    static bool isDhcpClientMessage(quint16 ethType,
+                                    const PacketBuffer *pktBuf);
     Device* originDevice(PacketBuffer *pktBuf);
+    static std::string deviceLayout(const OstProto::DeviceGroup &deviceGroup);
+    void updateDevices(const OstProto::DeviceGroup *deviceGroup);
+    void updateMcastGroups(const OstProto::DeviceGroup *deviceGroup,
+                           bool isJoin);
+    bool receiveMcastQuery(const DeviceKey &bcastKey, quint16 ethType,
+                           PacketBuffer *pktBuf);
+    bool receiveDhcp(const DeviceKey &dstKey, quint16 ethType,
+                     quint64 srcMac, PacketBuffer *pktBuf);
+    void updateIp4Key(Device *device, bool hadIp4, quint32 oldIp4);
+    QList<Device*> sortedDevices() const;
+    QList<Device*> matchingDevices(
+            const OstProto::DeviceListRequest &request) const;
     void enumerateDevices(
             const OstProto::DeviceGroup *deviceGroup,
             Operation oper);
 
     AbstractPort *port_;
+    bool isTcpResponderEnabled_;
     QHash<uint, OstProto::DeviceGroup*> deviceGroupList_;
+    // All devices of a group are allocated together (key: group id) -
+    // a group may have 100K+ devices
+    QHash<uint, QVector<Device>*> groupDevices_;
     QHash<DeviceKey, Device*> deviceList_; // fast access to devices
-    QMap<DeviceKey, Device*> sortedDeviceList_; // sorted access to devices
-    QMultiHash<DeviceKey, Device*> bcastList_;
+    QHash<DeviceKey, QList<Device*> > bcastList_; // key with bcast mac
+    QHash<DeviceKey, Device*> ip4List_; // key with ip4 in place of mac
     QHash<quint16, uint> tpidList_; // Key: TPID, Value: RefCount
+    QHash<uint, DeviceGroupStats*> groupStats_; // key: group id
+    QHash<uint, McastGroups*> groupMcast_; // key: group id
+
+    NeighborResolver *resolver_;
+    McastReporter *reporter_;
+    DhcpClient *dhcpClient_;
+    int dhcpDevices_; // with DHCPv4 and/or DHCPv6
+
+    // Devices are split by their key into shardCount_ shards - a device is
+    // handled only with the lock of its shard held, the device tables (and
+    // so any device) only with all of them and dispatchLock_ (see
+    // lockShards()) - e.g. by the resolver, reporter and dhcp client
+    // threads
+    int shardCount_;
+    QMutex shardLock_[DeviceGroupStats::kMaxShards];
+    QMutex dispatchLock_; // the receive thread's lookups vs. the tables
+    QList<EmulationWorker*> workers_; // one per shard; empty => none
 };
 
 #endif
@@ -0,0 +1,149 @@
+/*
+Copyright (C) 2017 Srivats P.
+
+
+This file is part of "Ostinato"
+
+This is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+
+#include "dhcpclient.h"
+
+#include "devicemanager.h"
+#include "settings.h"
+
+DhcpClient::DhcpClient(DeviceManager *deviceManager, int portId)
+{
+    deviceManager_ = deviceManager;
+    portId_ = portId;
+
+    rate_ = qMax(1, appSettings->value(kDhcpRateKey,
+                        kDhcpRateDefaultValue).toInt());
+    maxAttempts_ = 1 + qBound(0, appSettings->value(kDhcpRetriesKey,
+                        kDhcpRetriesDefaultValue).toInt(), 16);
+    timeout_ = qMax(kTickMsecs, appSettings->value(kDhcpTimeoutKey,
+                        kDhcpTimeoutDefaultValue).toInt());
+
+    timer_.start();
+    generation_ = 0;
+    isActive_ = false;
+    stop_ = false;
+}
+
+DhcpClient::~DhcpClient()
+{
+    stop_ = true;
+    wait();
+}
+
+/*!
+  Schedules the next event of device's DHCPv4 (or DHCPv6) lease, delay
+  msecs from now; sequence is that of the lease (see DhcpLease)
+*/
+void DhcpClient::schedule(const DeviceKey &device, bool isIp6,
+                          quint16 sequence, qint64 delay)
+{
+    QMutexLocker locker(&lock_);
+    Request request;
+
+    request.device = device;
+    request.isIp6 = isIp6;
+    request.sequence = sequence;
+
+    schedule(timer_.elapsed() + delay, request);
+}
+
+/*!
+  Drops all pending events - e.g. when the devices are deleted
+*/
+void DhcpClient::clear()
+{
+    QMutexLocker locker(&lock_);
+
+    wheel_.clear();
+    generation_++;
+}
+
+// Caller holds lock_
+void DhcpClient::schedule(qint64 msecs, const Request &request)
+{
+    // Round up - so that a message is never sent early
+    wheel_.schedule(quint64(msecs + kTickMsecs - 1)/kTickMsecs, request);
+
+    if (!isActive_) {
+        isActive_ = true;
+        wait(); // for the previous run (if any) to return
+        QThread::start();
+    }
+}
+
+void DhcpClient::run()
+{
+    qint64 lastTick;
+    double credit = 0;
+    // Unused credit is not carried over beyond a couple of ticks
+    double maxCredit = qMax(1.0, 2.0*rate_*kTickMsecs/1000);
+
+    qDebug("In %s", __PRETTY_FUNCTION__);
+
+    lock_.lock();
+    lastTick = timer_.elapsed();
+    lock_.unlock();
+
+    while (!stop_)
+    {
+        QList<Request> batch;
+        QList<qint64> delays;
+        QList<PacketBuffer*> packets;
+        uint generation;
+        qint64 now;
+
+        lock_.lock();
+        if (!wheel_.size()) {
+            isActive_ = false;
+            lock_.unlock();
+            return;
+        }
+
+        now = timer_.elapsed();
+        credit = qMin(maxCredit, credit + double(rate_)*(now - lastTick)/1000);
+        lastTick = now;
+
+        // Due events not handled for lack of credit stay ready for the
+        // next tick, ahead of those due then
+        wheel_.advance(quint64(now)/kTickMsecs);
+        while (wheel_.hasReady() && (batch.size() < int(credit)))
+            batch.append(wheel_.takeReady());
+        generation = generation_;
+        lock_.unlock();
+
+        // Build the messages due and send them all in one go
+        if (!batch.isEmpty()) {
+            deviceManager_->processDhcpRequests(batch, &delays, &packets);
+            deviceManager_->transmitPackets(packets);
+            credit -= packets.size();
+        }
+
+        lock_.lock();
+        for (int i = 0; (i < batch.size()) && (generation == generation_); i++)
+        {
+            if (delays.at(i) >= 0)
+                schedule(now + delays.at(i), batch.at(i));
+        }
+        lock_.unlock();
+
+        msleep(kTickMsecs);
+    }
+}
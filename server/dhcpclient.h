@@ -0,0 +1,99 @@
+/*
+Copyright (C) 2017 Srivats P.
+
+
+This file is part of "Ostinato"
+
+This is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+
+#ifndef _DHCP_CLIENT_H
+#define _DHCP_CLIENT_H
+
+#include "device.h"
+#include "timerwheel.h"
+
+#include <QElapsedTimer>
+#include <QList>
+#include <QMutex>
+#include <QThread>
+
+class DeviceManager;
+
+/*!
+  Paces the DHCPv4 (DORA) and DHCPv6 (SARR) exchanges of a port's devices
+  that acquire their addresses with DHCP
+
+  The lease state is kept in each device (see DhcpLease) - the client has
+  only the timer events: a device's next Discover/Solicit or retry is due,
+  or its lease is due for renewal (T1). Due events are handled at (upto) a
+  configured rate in batches every tick, driven by a TimerWheel - so the
+  exchanges of thousands of devices are pipelined, the Discovers of the
+  next batch going out while the Offers of the previous ones are still on
+  their way. The Request for an Offer (Advertise) is sent right away by
+  the DeviceManager as it's received, with its retry scheduled here
+
+  A message is resent with an exponential backoff, a configured number of
+  times; a device that gets no Offer (or Ack) is then marked failed. A
+  lease not renewed is given up and the device starts over (no Rebind)
+
+  An event carries the sequence of the lease when scheduled - a lease
+  changes its sequence on every state change, so stale events (e.g. the
+  retry of a Discover whose Offer has since been received) are dropped
+
+  The thread runs only while there are events pending
+*/
+class DhcpClient : public QThread
+{
+public:
+    struct Request {
+        DeviceKey device;
+        bool isIp6;
+        quint16 sequence; // of the device's lease
+    };
+
+    DhcpClient(DeviceManager *deviceManager, int portId);
+    ~DhcpClient();
+
+    void schedule(const DeviceKey &device, bool isIp6, quint16 sequence,
+                  qint64 delay);
+    void clear();
+
+    int maxAttempts() const { return maxAttempts_; }
+    int timeout() const { return timeout_; }
+
+protected:
+    void run();
+
+private:
+    void schedule(qint64 msecs, const Request &request);
+
+    static const int kTickMsecs = 10;
+
+    DeviceManager *deviceManager_;
+    int portId_;
+    int rate_;          // messages/sec
+    int maxAttempts_;
+    int timeout_;       // msecs, for the first attempt
+
+    QMutex lock_;       // for all of the below
+    TimerWheel<Request> wheel_; // tick: kTickMsecs of timer_
+    QElapsedTimer timer_;
+    uint generation_;   // incremented by clear()
+    bool isActive_;
+    volatile bool stop_;
+};
+
+#endif
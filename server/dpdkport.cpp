@@ -0,0 +1,846 @@
+/*
+Copyright (C) 2017 Srivats P.
+
+
+This file is part of "Ostinato"
+
+This is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+
+#include "dpdkport.h"
+
+#ifdef HAVE_DPDK
+
+#include "devicemanager.h"
+#include "latencyclock.h"
+#include "packetbuffer.h"
+#include "settings.h"
+#include "../common/streambase.h"
+
+#include <QByteArray>
+#include <QStringList>
+
+#include <rte_cycles.h>
+#include <rte_eal.h>
+#include <rte_errno.h>
+#include <rte_ethdev.h>
+#include <rte_mbuf.h>
+#include <rte_pause.h>
+
+#include <limits.h>
+#include <string.h>
+#include <sys/time.h>
+
+static quint64 nsecToTsc(quint64 nsec)
+{
+    return quint64(double(nsec) * double(rte_get_tsc_hz()) / 1e9);
+}
+
+/*!
+  Initializes the DPDK EAL with the args in the Dpdk/EalArgs setting
+
+  Must be called once, before any other DpdkPort method
+*/
+bool DpdkPort::initEal()
+{
+    // EAL may keep pointers to the args, so these must stay around
+    static QList<QByteArray> args;
+    static QVector<char*> argv;
+    QStringList ealArgs = appSettings->value(kDpdkEalArgsKey).toString()
+                                .split(' ', QString::SkipEmptyParts);
+    int ret;
+
+    args.append("drone");
+    for (int i = 0; i < ealArgs.size(); i++)
+        args.append(ealArgs.at(i).toAscii());
+    for (int i = 0; i < args.size(); i++)
+        argv.append(args[i].data());
+
+    ret = rte_eal_init(argv.size(), argv.data());
+    if (ret < 0) {
+        qWarning("DPDK EAL initialization failed (%s)",
+                rte_strerror(rte_errno));
+        return false;
+    }
+
+    qDebug("DPDK EAL initialized - %d ports", rte_eth_dev_count_avail());
+    return true;
+}
+
+QList<quint16> DpdkPort::dpdkPortIds()
+{
+    QList<quint16> ids;
+    quint16 id;
+
+    RTE_ETH_FOREACH_DEV(id)
+        ids.append(id);
+
+    return ids;
+}
+
+// Returns the device name (typically the PCI address) of the DPDK port
+QString DpdkPort::dpdkPortName(quint16 dpdkPortId)
+{
+    char name[RTE_ETH_NAME_MAX_LEN] = "";
+
+    rte_eth_dev_get_name_by_port(dpdkPortId, name);
+
+    return QString(name);
+}
+
+DpdkPort::DpdkPort(int id, quint16 dpdkPortId)
+    : AbstractPort(id, qPrintable(dpdkPortName(dpdkPortId)))
+{
+    dpdkPortId_ = dpdkPortId;
+    pool_ = NULL;
+    emulationTxQueue_ = -1;
+    isLooping_ = false;
+    loopDelay_ = 0;
+    memset(&txOffload_, 0, sizeof(txOffload_));
+    txOffloads_ = 0;
+    captureHandle_ = pcap_open_dead(DLT_EN10MB, 65535);
+    dumpHandle_ = NULL;
+    hasFilter_ = false;
+    captureSnapLen_ = 65535;
+    isCaptureOn_ = false;
+    isEmulationOn_ = false;
+    lastStatsTsc_ = 0;
+    memset((void*) &lastStats_, 0, sizeof(lastStats_));
+    rxStreamStats_.enableHistograms();
+
+    transmitter_ = new Transmitter(this);
+    receiver_ = new Receiver(this);
+
+    data_.set_description("DPDK");
+    data_.set_is_exclusive_control(true);
+    data_.set_numa_node(rte_eth_dev_socket_id(dpdkPortId_));
+    maxStatsValue_ = ULLONG_MAX;
+
+    if (!capFile_.open())
+        qWarning("Unable to open temp cap file");
+
+    if (!setupDevice())
+        isUsable_ = false;
+}
+
+DpdkPort::~DpdkPort()
+{
+    qDebug("In %s", __FUNCTION__);
+
+    if (transmitter_->isRunning())
+        transmitter_->stop();
+    receiver_->stop();
+    delete transmitter_;
+    delete receiver_;
+
+    clearPacketList();
+
+    rte_eth_dev_stop(dpdkPortId_);
+    rte_eth_dev_close(dpdkPortId_);
+    if (pool_)
+        rte_mempool_free(pool_);
+
+    stopCapture();
+    if (hasFilter_)
+        pcap_freecode(&filter_);
+    pcap_close(captureHandle_);
+}
+
+bool DpdkPort::setupDevice()
+{
+    struct rte_eth_conf conf;
+    struct rte_eth_dev_info info;
+    quint16 rxDescs = 1024;
+    quint16 txDescs = 1024;
+    int socket = rte_eth_dev_socket_id(dpdkPortId_);
+    int txQueues;
+    int ret;
+    uint mbufs = appSettings->value(kDpdkMbufCountKey,
+                    kDpdkMbufCountDefaultValue).toUInt();
+    QByteArray poolName = QString("ost_pool_%1").arg(dpdkPortId_).toAscii();
+
+    ret = rte_eth_dev_info_get(dpdkPortId_, &info);
+    if (ret < 0) {
+        qWarning("%s: unable to get device info (%s)", data_.name().c_str(),
+                rte_strerror(-ret));
+        return false;
+    }
+
+    // Frames of the packet list (and emulation/rx frames) live in here
+    pool_ = rte_pktmbuf_pool_create(poolName.constData(), mbufs,
+                256 /* cache */, 0, RTE_MBUF_DEFAULT_BUF_SIZE,
+                (socket < 0) ? int(rte_socket_id()) : socket);
+    if (!pool_) {
+        qWarning("%s: unable to create mbuf pool of %u mbufs (%s)",
+                data_.name().c_str(), mbufs, rte_strerror(rte_errno));
+        return false;
+    }
+
+    txQueues = (info.max_tx_queues > 1) ? 2 : 1;
+    emulationTxQueue_ = (txQueues > 1) ? 1 : -1;
+
+    // Enable all the offloads we may use - whether they are used for a
+    // frame is set in its mbuf
+    txOffloads_ = info.tx_offload_capa & (RTE_ETH_TX_OFFLOAD_IPV4_CKSUM
+                    | RTE_ETH_TX_OFFLOAD_TCP_CKSUM
+                    | RTE_ETH_TX_OFFLOAD_UDP_CKSUM
+                    | RTE_ETH_TX_OFFLOAD_TCP_TSO
+                    | RTE_ETH_TX_OFFLOAD_UDP_TSO
+                    | RTE_ETH_TX_OFFLOAD_MULTI_SEGS);
+
+    OstProto::TxOffload *cap = data_.mutable_tx_offload_capability();
+    cap->set_ip_checksum(txOffloads_ & RTE_ETH_TX_OFFLOAD_IPV4_CKSUM);
+    cap->set_l4_checksum((txOffloads_ & RTE_ETH_TX_OFFLOAD_TCP_CKSUM)
+                            && (txOffloads_ & RTE_ETH_TX_OFFLOAD_UDP_CKSUM));
+    cap->set_tcp_segmentation(txOffloads_ & RTE_ETH_TX_OFFLOAD_TCP_TSO);
+    cap->set_udp_segmentation(txOffloads_ & RTE_ETH_TX_OFFLOAD_UDP_TSO);
+
+    memset(&conf, 0, sizeof(conf));
+    conf.txmode.offloads = txOffloads_;
+    ret = rte_eth_dev_configure(dpdkPortId_, 1, txQueues, &conf);
+    if (ret < 0) {
+        qWarning("%s: unable to configure device (%s)", data_.name().c_str(),
+                rte_strerror(-ret));
+        return false;
+    }
+
+    rte_eth_dev_adjust_nb_rx_tx_desc(dpdkPortId_, &rxDescs, &txDescs);
+
+    ret = rte_eth_rx_queue_setup(dpdkPortId_, 0, rxDescs, socket, NULL,
+                pool_);
+    for (int i = 0; (ret >= 0) && (i < txQueues); i++)
+        ret = rte_eth_tx_queue_setup(dpdkPortId_, i, txDescs, socket, NULL);
+    if (ret < 0) {
+        qWarning("%s: unable to setup queues (%s)", data_.name().c_str(),
+                rte_strerror(-ret));
+        return false;
+    }
+
+    ret = rte_eth_dev_start(dpdkPortId_);
+    if (ret < 0) {
+        qWarning("%s: unable to start device (%s)", data_.name().c_str(),
+                rte_strerror(-ret));
+        return false;
+    }
+    rte_eth_promiscuous_enable(dpdkPortId_);
+
+    return true;
+}
+
+void DpdkPort::init()
+{
+    if (emulationTxQueue_ < 0)
+        addNote("Device emulation can't transmit while traffic is being "
+                "transmitted");
+
+    receiver_->start();
+}
+
+OstProto::LinkState DpdkPort::linkState()
+{
+    struct rte_eth_link link;
+
+    memset(&link, 0, sizeof(link));
+    if (rte_eth_link_get_nowait(dpdkPortId_, &link) < 0)
+        linkState_ = OstProto::LinkStateUnknown;
+    else
+        linkState_ = link.link_status ?
+                OstProto::LinkStateUp : OstProto::LinkStateDown;
+
+    return linkState_;
+}
+
+void DpdkPort::clearPacketList()
+{
+    Q_ASSERT(!transmitter_->isRunning());
+
+    for (int i = 0; i < packets_.size(); i++)
+        rte_pktmbuf_free(packets_.at(i).mbuf);
+    packets_.clear();
+    packetSets_.clear();
+    memset(&txOffload_, 0, sizeof(txOffload_));
+
+    setPacketListLoopMode(false, 0, 0);
+}
+
+void DpdkPort::loopNextPacketSet(qint64 size, qint64 repeats,
+        long repeatDelaySec, long repeatDelayNsec)
+{
+    PacketSet set;
+
+    set.first = packets_.size();
+    set.count = 0;
+    set.size = size;
+    set.repeats = repeats;
+    set.nsecDelay = repeatDelaySec * quint64(1e9) + repeatDelayNsec;
+
+    packetSets_.append(set);
+}
+
+bool DpdkPort::appendToPacketList(long sec, long nsec, const uchar *packet,
+        int length)
+{
+    Packet pkt;
+
+    pkt.nsec = quint64(sec) * quint64(1e9) + nsec;
+    pkt.mbuf = newFrame(packet, length);
+    if (!pkt.mbuf)
+        return false;
+
+    // A packet that doesn't belong to an open loop set starts a set of
+    // its own which is sent once; the gap between the (last packet of)
+    // the previous set and this one is the previous set's delay
+    if (packetSets_.isEmpty()
+            || (packetSets_.last().size
+                && (packetSets_.last().count == packetSets_.last().size))) {
+        PacketSet set;
+
+        set.first = packets_.size();
+        set.count = 0;
+        set.size = 0;
+        set.repeats = 1;
+        set.nsecDelay = 0;
+        packetSets_.append(set);
+    }
+
+    PacketSet &set = packetSets_.last();
+    if (!set.count && (packetSets_.size() > 1)) {
+        PacketSet &prev = packetSets_[packetSets_.size() - 2];
+        if (!prev.size && prev.count) {
+            const Packet &last = packets_.at(prev.first + prev.count - 1);
+            prev.nsecDelay = (pkt.nsec > last.nsec) ? pkt.nsec - last.nsec : 0;
+        }
+    }
+
+    packets_.append(pkt);
+    set.count++;
+
+    return true;
+}
+
+/*!
+  Returns a new mbuf (chain, if the frame doesn't fit an mbuf) with the
+  frame and the tx offloads for it; NULL on error
+*/
+struct rte_mbuf* DpdkPort::newFrame(const uchar *packet, int length)
+{
+    struct rte_mbuf *head = NULL;
+    const TxOffloadInfo &offload = txOffload_;
+    int offset = 0;
+
+    while (offset < length)
+    {
+        struct rte_mbuf *mbuf = rte_pktmbuf_alloc(pool_);
+        int size;
+
+        if (!mbuf) {
+            qWarning("%s: out of mbufs - increase %s", data_.name().c_str(),
+                    qPrintable(kDpdkMbufCountKey));
+            goto _error;
+        }
+
+        size = qMin(length - offset, int(rte_pktmbuf_tailroom(mbuf)));
+        memcpy(rte_pktmbuf_append(mbuf, size), packet + offset, size);
+        offset += size;
+
+        if (!head)
+            head = mbuf;
+        else if (!(txOffloads_ & RTE_ETH_TX_OFFLOAD_MULTI_SEGS)
+                || (rte_pktmbuf_chain(head, mbuf) < 0)) {
+            qWarning("%s: frame of %d bytes is too large",
+                    data_.name().c_str(), length);
+            rte_pktmbuf_free(mbuf);
+            goto _error;
+        }
+    }
+
+    if (!head || !offload.cksumOffload)
+        return head;
+
+    head->l2_len = offload.l2Len;
+    head->l3_len = offload.l3Len;
+    head->l4_len = offload.l4Len;
+    head->ol_flags |= offload.isIp6 ? RTE_MBUF_F_TX_IPV6 : RTE_MBUF_F_TX_IPV4;
+    if (offload.cksumOffload & StreamBase::kIpCksumOffload)
+        head->ol_flags |= RTE_MBUF_F_TX_IP_CKSUM;
+    if (offload.cksumOffload & StreamBase::kL4CksumOffload) {
+        if (offload.segmentSize && (length > (offload.l2Len + offload.l3Len
+                        + offload.l4Len + offload.segmentSize))) {
+            head->ol_flags |= offload.isUdp ?
+                    RTE_MBUF_F_TX_UDP_SEG : RTE_MBUF_F_TX_TCP_SEG;
+            head->tso_segsz = offload.segmentSize;
+        }
+        else
+            head->ol_flags |= offload.isUdp ?
+                    RTE_MBUF_F_TX_UDP_CKSUM : RTE_MBUF_F_TX_TCP_CKSUM;
+    }
+
+    // Let the driver fix up the frame for the offloads it does (e.g. the
+    // pseudo header cksum without the length for TSO) - just once, as the
+    // same mbuf is sent every time
+    if (rte_eth_tx_prepare(dpdkPortId_, 0, &head, 1) != 1) {
+        qWarning("%s: unable to prepare frame for tx offload (%s)",
+                data_.name().c_str(), rte_strerror(rte_errno));
+        goto _error;
+    }
+
+    return head;
+
+_error:
+    if (head)
+        rte_pktmbuf_free(head);
+    return NULL;
+}
+
+void DpdkPort::setPacketListTxOffload(const TxOffloadInfo &info)
+{
+    txOffload_ = info;
+}
+
+void DpdkPort::setPacketListLoopMode(bool loop, quint64 secDelay,
+        quint64 nsecDelay)
+{
+    isLooping_ = loop;
+    loopDelay_ = secDelay * quint64(1e9) + nsecDelay;
+}
+
+void DpdkPort::startTransmit()
+{
+    Q_ASSERT(!isDirty());
+
+    transmitter_->start();
+}
+
+void DpdkPort::armTransmit(StartBarrierPtr barrier)
+{
+    Q_ASSERT(!isDirty());
+
+    transmitter_->setStartBarrier(barrier);
+    transmitter_->start();
+}
+
+void DpdkPort::stopTransmit()
+{
+    if (transmitter_->isRunning())
+        transmitter_->stop();
+}
+
+bool DpdkPort::isTransmitOn()
+{
+    return transmitter_->isRunning();
+}
+
+void DpdkPort::startCapture(const char *filter,
+                            const OstProto::CaptureConfig &config)
+{
+    QMutexLocker locker(&captureLock_);
+
+    if (isCaptureOn_)
+        return;
+
+    if (hasFilter_) {
+        pcap_freecode(&filter_);
+        hasFilter_ = false;
+    }
+    if (filter && *filter) {
+        if (pcap_compile(captureHandle_, &filter_, filter, 1,
+                    PCAP_NETMASK_UNKNOWN) < 0)
+            qWarning("%s: can't compile BPF program: %s (%s)",
+                    data_.name().c_str(), filter,
+                    pcap_geterr(captureHandle_));
+        else
+            hasFilter_ = true;
+    }
+
+    // The rx burst loop is the capture loop, so the high rate options
+    // don't apply
+    captureSnapLen_ = int(qMax(1U, config.snap_len()));
+
+    capFile_.resize(0);
+    captureRing_.close();
+    captureAnalytics_.reset();
+    captureSigFilter_.open(config);
+    if (CaptureRing::isRing(config)) {
+        if (captureRing_.open(config, captureSnapLen_, capFile_.fileName()))
+            isCaptureOn_ = true;
+        return;
+    }
+
+    dumpHandle_ = pcap_dump_open(captureHandle_,
+            capFile_.fileName().toAscii().constData());
+    if (!dumpHandle_) {
+        qWarning("%s: unable to open capture file (%s)",
+                data_.name().c_str(), pcap_geterr(captureHandle_));
+        return;
+    }
+    isCaptureOn_ = true;
+}
+
+void DpdkPort::stopCapture()
+{
+    QMutexLocker locker(&captureLock_);
+
+    isCaptureOn_ = false;
+    if (dumpHandle_)
+        pcap_dump_close(dumpHandle_);
+    dumpHandle_ = NULL;
+}
+
+bool DpdkPort::isCaptureOn()
+{
+    // A triggered capture is over once it has its window
+    return isCaptureOn_ && !captureRing_.isDone();
+}
+
+void DpdkPort::snapshotCaptureRing()
+{
+    if (captureRing_.isOpen() && !captureRing_.snapshot(&capFile_))
+        qWarning("%s: unable to get capture ring snapshot",
+                data_.name().c_str());
+}
+
+void DpdkPort::startDeviceEmulation()
+{
+    isEmulationOn_ = true;
+}
+
+void DpdkPort::stopDeviceEmulation()
+{
+    isEmulationOn_ = false;
+}
+
+int DpdkPort::sendEmulationPacket(PacketBuffer *pktBuf)
+{
+    struct rte_mbuf *mbuf;
+    uchar *data;
+    int queue = emulationTxQueue_;
+
+    // Without a tx queue of its own, share tx queue 0 only while the
+    // transmitter is not using it
+    if (queue < 0) {
+        if (transmitter_->isRunning())
+            return -1;
+        queue = 0;
+    }
+
+    mbuf = rte_pktmbuf_alloc(pool_);
+    if (!mbuf)
+        return -1;
+
+    data = (uchar*) rte_pktmbuf_append(mbuf, pktBuf->length());
+    if (!data) {
+        rte_pktmbuf_free(mbuf);
+        return -1;
+    }
+    memcpy(data, pktBuf->data(), pktBuf->length());
+
+    if (rte_eth_tx_burst(dpdkPortId_, queue, &mbuf, 1) != 1) {
+        rte_pktmbuf_free(mbuf);
+        return -1;
+    }
+
+    return pktBuf->length();
+}
+
+void DpdkPort::stats(PortStats *stats)
+{
+    updateStats();
+    AbstractPort::stats(stats);
+}
+
+// Updates port stats from the NIC's counters
+void DpdkPort::updateStats()
+{
+    struct rte_eth_stats nicStats;
+    quint64 tsc = rte_rdtsc();
+
+    if (rte_eth_stats_get(dpdkPortId_, &nicStats) < 0)
+        return;
+
+    stats_.rxLock.writeBegin();
+    stats_.rxPkts = nicStats.ipackets;
+    stats_.rxBytes = nicStats.ibytes;
+    stats_.rxDrops = nicStats.imissed + nicStats.rx_nombuf;
+    stats_.rxErrors = nicStats.ierrors;
+    stats_.rxLock.writeEnd();
+
+    stats_.txLock.writeBegin();
+    stats_.txPkts = nicStats.opackets;
+    stats_.txBytes = nicStats.obytes;
+    stats_.txLock.writeEnd();
+
+    // Rates are averaged over the intervals between updates (typically the
+    // client's stats poll interval) as timed by the TSC
+    if (lastStatsTsc_ && (tsc > lastStatsTsc_)) {
+        double sec = double(tsc - lastStatsTsc_) / double(rte_get_tsc_hz());
+
+        if (sec >= 0.5) {
+            rxRate_.update(stats_.rxPkts - lastStats_.rxPkts,
+                           stats_.rxBytes - lastStats_.rxBytes,
+                           qint64(sec*1e9));
+            txRate_.update(stats_.txPkts - lastStats_.txPkts,
+                           stats_.txBytes - lastStats_.txBytes,
+                           qint64(sec*1e9));
+            stats_.rxLock.writeBegin();
+            stats_.rxPps = rxRate_.pps();
+            stats_.rxBps = rxRate_.bps();
+            stats_.rxLock.writeEnd();
+
+            stats_.txRateLock.writeBegin();
+            stats_.txPps = txRate_.pps();
+            stats_.txBps = txRate_.bps();
+            stats_.txRateLock.writeEnd();
+        }
+        else
+            return; // too soon - keep the last rates and reference
+    }
+
+    lastStats_ = stats_;
+    lastStatsTsc_ = tsc;
+}
+
+void DpdkPort::applyThreadPlacement()
+{
+    if (data_.has_tx_thread_placement())
+        transmitter_->placer().setPlacement(data_.tx_thread_placement());
+    if (data_.has_rx_thread_placement())
+        receiver_->placer().setPlacement(data_.rx_thread_placement());
+}
+
+void DpdkPort::threadPlacementStatus(OstProto::Port *port)
+{
+    transmitter_->placer().status(port->add_thread_placement_status());
+    receiver_->placer().status(port->add_thread_placement_status());
+}
+
+/*
+ * ------------------------------------------------------------------- *
+ * Transmitter
+ * ------------------------------------------------------------------- *
+ */
+DpdkPort::Transmitter::Transmitter(DpdkPort *port)
+    : placer_("tx")
+{
+    port_ = port;
+    stop_ = false;
+    isRunning_ = false;
+}
+
+void DpdkPort::Transmitter::start()
+{
+    if (isRunning_) {
+        qWarning("Transmit start requested but is already running!");
+        return;
+    }
+
+    stop_ = false;
+    isRunning_ = true;
+    QThread::start();
+}
+
+void DpdkPort::Transmitter::stop()
+{
+    stop_ = true;
+    wait();
+}
+
+void DpdkPort::Transmitter::run()
+{
+    ThreadPlacer::Scope placement(placer_);
+    const QVector<Packet> &packets = port_->packets_;
+    const QList<PacketSet> &sets = port_->packetSets_;
+    struct rte_mbuf *burst[kMaxBurst];
+    int count = 0;
+    quint64 due;
+    // Unpaced - every frame is due right away (see Port.max_rate)
+    bool isMaxRate = port_->data_.max_rate();
+
+    if (packets.isEmpty())
+        goto _exit;
+
+    // Wait for the other ports (if any) starting along with us
+    if (!barrier_.isNull()) {
+        bool released = barrier_->wait(&stop_);
+
+        barrier_ = StartBarrierPtr();
+        if (!released)
+            goto _exit;
+    }
+
+    // Frames are sent when due - in bursts of all frames due by then;
+    // 'due' is the TSC at which the next frame is due
+    due = rte_rdtsc();
+    do
+    {
+        for (int i = 0; i < sets.size(); i++)
+        {
+            const PacketSet &set = sets.at(i);
+
+            for (qint64 r = 0; (set.repeats < 0) || (r < set.repeats); r++)
+            {
+                for (int j = set.first; j < (set.first + set.count); j++)
+                {
+                    if (j > set.first)
+                        due += nsecToTsc(packets.at(j).nsec
+                                    - packets.at(j-1).nsec);
+
+                    if (!isMaxRate && (rte_rdtsc() < due)) {
+                        count = flush(burst, count);
+                        if (!waitTill(due))
+                            goto _stop;
+                    }
+
+                    // The transmitted mbuf is freed by the driver - keep
+                    // our reference (to every segment of a chain)
+                    for (struct rte_mbuf *m = packets.at(j).mbuf; m;
+                            m = m->next)
+                        rte_mbuf_refcnt_update(m, 1);
+                    burst[count++] = packets.at(j).mbuf;
+                    if (count == kMaxBurst)
+                        count = flush(burst, count);
+                }
+                due += nsecToTsc(set.nsecDelay);
+
+                if (stop_)
+                    goto _stop;
+            }
+        }
+        due += nsecToTsc(port_->loopDelay_);
+    } while (port_->isLooping_ && !stop_);
+
+_stop:
+    count = flush(burst, count);
+    // Drop whatever couldn't be sent (only on stop)
+    for (int i = 0; i < count; i++)
+        rte_pktmbuf_free(burst[i]);
+
+_exit:
+    // Nothing to send - don't hold up the others
+    if (!barrier_.isNull()) {
+        barrier_->leave();
+        barrier_ = StartBarrierPtr();
+    }
+    isRunning_ = false;
+}
+
+// Sends the burst, retrying while the tx ring is full; returns the number
+// of frames not sent (only if stopped)
+int DpdkPort::Transmitter::flush(struct rte_mbuf **burst, int count)
+{
+    int sent = 0;
+
+    while (sent < count)
+    {
+        sent += rte_eth_tx_burst(port_->dpdkPortId_, 0, burst + sent,
+                    count - sent);
+        if ((sent < count) && stop_)
+            break;
+    }
+
+    if (sent && (sent < count))
+        memmove(burst, burst + sent, (count - sent) * sizeof(*burst));
+
+    return count - sent;
+}
+
+// Busy waits till the TSC reaches tsc; returns false if stopped while
+// waiting
+bool DpdkPort::Transmitter::waitTill(quint64 tsc)
+{
+    while (rte_rdtsc() < tsc)
+    {
+        if (stop_)
+            return false;
+        rte_pause();
+    }
+
+    return true;
+}
+
+/*
+ * ------------------------------------------------------------------- *
+ * Receiver
+ * ------------------------------------------------------------------- *
+ */
+DpdkPort::Receiver::Receiver(DpdkPort *port)
+    : placer_("rx")
+{
+    port_ = port;
+    stop_ = false;
+}
+
+void DpdkPort::Receiver::run()
+{
+    ThreadPlacer::Scope placement(placer_);
+    struct rte_mbuf *burst[kMaxBurst];
+
+    while (!stop_)
+    {
+        int count = rte_eth_rx_burst(port_->dpdkPortId_, 0, burst, kMaxBurst);
+
+        if (!count) {
+            // Nothing to be done - don't hog the cpu
+            QThread::usleep(100);
+            continue;
+        }
+
+        for (int i = 0; i < count; i++)
+        {
+            // Only the first segment - rx frames fit in an mbuf
+            const uchar *data = rte_pktmbuf_mtod(burst[i], const uchar*);
+            int len = rte_pktmbuf_data_len(burst[i]);
+
+            if ((len == int(rte_pktmbuf_pkt_len(burst[i])))
+                    && StreamStatsTable::isSigned(data, len))
+                port_->rxStreamStats_.countRx(data, len,
+                        LatencyClock::now());
+
+            if (port_->isCaptureOn_)
+            {
+                QMutexLocker locker(&port_->captureLock_);
+                struct pcap_pkthdr hdr;
+
+                gettimeofday(&hdr.ts, NULL);
+                hdr.caplen = qMin(len, port_->captureSnapLen_);
+                hdr.len = rte_pktmbuf_pkt_len(burst[i]);
+                // The whole frame is at hand for the signature filter,
+                // whatever the snap length
+                if ((!port_->hasFilter_
+                        || pcap_offline_filter(&port_->filter_, &hdr, data))
+                    && (!port_->captureSigFilter_.isOpen()
+                        || port_->captureSigFilter_.match(data, hdr.len,
+                                                          len))) {
+                    port_->captureAnalytics_.add(&hdr, data);
+                    if (port_->captureRing_.isOpen())
+                        port_->captureRing_.append(&hdr, data);
+                    else if (port_->dumpHandle_)
+                        pcap_dump((uchar*) port_->dumpHandle_, &hdr, data);
+                }
+            }
+
+            if (port_->isEmulationOn_)
+            {
+                PacketBuffer pktBuf(data, len);
+
+                // replies may be built in place, see EmulationTransceiver
+                port_->deviceManager_->receivePacket(&pktBuf);
+            }
+
+            rte_pktmbuf_free(burst[i]);
+        }
+    }
+    stop_ = false;
+}
+#endif
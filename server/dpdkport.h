@@ -0,0 +1,212 @@
+/*
+Copyright (C) 2017 Srivats P.
+
+
+This file is part of "Ostinato"
+
+This is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+
+#ifndef _SERVER_DPDK_PORT_H
+#define _SERVER_DPDK_PORT_H
+
+#include <QtGlobal>
+
+#ifdef HAVE_DPDK
+
+#include "abstractport.h"
+#include "captureanalytics.h"
+#include "capturefilter.h"
+#include "capturering.h"
+#include "threadplacer.h"
+
+#include <QList>
+#include <QMutex>
+#include <QTemporaryFile>
+#include <QThread>
+#include <QVector>
+#include <pcap.h>
+
+struct rte_mbuf;
+struct rte_mempool;
+
+/*!
+  A port on a NIC owned by DPDK (i.e. bound to vfio-pci or similar)
+
+  Each frame of the packet list is stored once in an mbuf; the transmitter
+  sends a frame by taking a reference to its mbuf, so repeated frames are
+  never copied. Frames are paced using the TSC and sent in bursts of all
+  frames that are due.
+
+  The NIC is owned exclusively by the drone - a receiver polls it for
+  frames to be captured or handed to device emulation; port stats are the
+  NIC's own counters
+
+  Queues - rx 0 (receiver), tx 0 (transmitter), tx 1 (device emulation).
+  The mbuf pool is allocated on the NIC's NUMA node
+
+  Tx offloads are set up on each frame's mbuf when it is appended to the
+  packet list; frames larger than an mbuf are stored as mbuf chains
+*/
+class DpdkPort : public AbstractPort
+{
+public:
+    DpdkPort(int id, quint16 dpdkPortId);
+    ~DpdkPort();
+
+    static bool initEal();
+    static QList<quint16> dpdkPortIds();
+    static QString dpdkPortName(quint16 dpdkPortId);
+
+    void init();
+
+    virtual OstProto::LinkState linkState();
+    virtual bool hasExclusiveControl() { return true; }
+    virtual bool setExclusiveControl(bool exclusive) { return exclusive; }
+
+    virtual void clearPacketList();
+    virtual void loopNextPacketSet(qint64 size, qint64 repeats,
+            long repeatDelaySec, long repeatDelayNsec);
+    virtual bool appendToPacketList(long sec, long nsec, const uchar *packet,
+            int length);
+    virtual void setPacketListLoopMode(bool loop,
+            quint64 secDelay, quint64 nsecDelay);
+    virtual void setPacketListTxOffload(const TxOffloadInfo &info);
+
+    virtual void startTransmit();
+    virtual void armTransmit(StartBarrierPtr barrier);
+    virtual void stopTransmit();
+    virtual bool isTransmitOn();
+
+    virtual void startCapture(const char *filter,
+                              const OstProto::CaptureConfig &config);
+    virtual void stopCapture();
+    virtual bool isCaptureOn();
+    virtual bool isCaptureRing() { return captureRing_.isOpen(); }
+    virtual void snapshotCaptureRing();
+    virtual QIODevice* captureData() { return &capFile_; }
+    virtual CaptureAnalytics* captureAnalytics() {
+        return &captureAnalytics_;
+    }
+
+    virtual void startDeviceEmulation();
+    virtual void stopDeviceEmulation();
+    virtual int sendEmulationPacket(PacketBuffer *pktBuf);
+
+    virtual void stats(PortStats *stats);
+
+protected:
+    virtual void applyThreadPlacement();
+    virtual void threadPlacementStatus(OstProto::Port *port);
+
+private:
+    struct Packet
+    {
+        struct rte_mbuf *mbuf;
+        quint64 nsec; // send time relative to the packet list start
+    };
+
+    // A run of packets sent 'repeats' times (-1 => till stopped) with a
+    // delay of nsecDelay after every pass
+    struct PacketSet
+    {
+        int first;
+        int count;
+        int size;       // expected count for a loop set; 0 otherwise
+        qint64 repeats;
+        quint64 nsecDelay;
+    };
+
+    class Transmitter: public QThread
+    {
+    public:
+        Transmitter(DpdkPort *port);
+        void run();
+        void start();
+        void stop();
+        bool isRunning() { return isRunning_; }
+        ThreadPlacer& placer() { return placer_; }
+        // Hold the next start() till the barrier is released
+        void setStartBarrier(StartBarrierPtr barrier) {
+            barrier->addParty();
+            barrier_ = barrier;
+        }
+    private:
+        int flush(struct rte_mbuf **burst, int count);
+        bool waitTill(quint64 tsc);
+
+        static const int kMaxBurst = 32;
+
+        DpdkPort *port_;
+        StartBarrierPtr barrier_;
+        volatile bool stop_;
+        volatile bool isRunning_;
+        ThreadPlacer placer_;
+    };
+
+    class Receiver: public QThread
+    {
+    public:
+        Receiver(DpdkPort *port);
+        void run();
+        void stop() { stop_ = true; wait(); }
+        ThreadPlacer& placer() { return placer_; }
+    private:
+        static const int kMaxBurst = 32;
+
+        DpdkPort *port_;
+        volatile bool stop_;
+        ThreadPlacer placer_;
+    };
+
+    bool setupDevice();
+    struct rte_mbuf* newFrame(const uchar *packet, int length);
+    void updateStats();
+
+    quint16 dpdkPortId_;
+    struct rte_mempool *pool_;
+    int emulationTxQueue_; // -1 => no separate queue available
+
+    QVector<Packet> packets_;
+    QList<PacketSet> packetSets_;
+    bool isLooping_;
+    quint64 loopDelay_;
+    TxOffloadInfo txOffload_; // for the frames being appended
+    quint64 txOffloads_;    // RTE_ETH_TX_OFFLOAD_xxx enabled on the NIC
+
+    Transmitter *transmitter_;
+    Receiver *receiver_;
+
+    // Capture state is shared with the receiver
+    QMutex captureLock_;
+    QTemporaryFile capFile_;
+    CaptureRing captureRing_;
+    CaptureAnalytics captureAnalytics_;
+    CaptureSignatureFilter captureSigFilter_;
+    pcap_t *captureHandle_;   // dead handle - for the dumper and filter
+    pcap_dumper_t *dumpHandle_;
+    struct bpf_program filter_;
+    bool hasFilter_;
+    int captureSnapLen_;
+    volatile bool isCaptureOn_;
+    volatile bool isEmulationOn_;
+
+    // NIC counters at the last stats update - for rates
+    quint64 lastStatsTsc_;
+    PortStats lastStats_;
+};
+#endif
+
+#endif
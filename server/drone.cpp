@@ -19,17 +19,63 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 
 #include "drone.h"
 
+#include "abstractport.h"
+#include "framesetstore.h"
+#include "latencyclock.h"
 #include "myservice.h"
 #include "rpcserver.h"
 #include "settings.h"
+#include "statsexporter.h"
+#include "tracebuffer.h"
 #include "../common/updater.h"
 
+#include <google/protobuf/descriptor.h>
 #include <QMetaType>
 
+#ifdef Q_OS_UNIX
+#include <unistd.h>
+#endif
+
 extern int myport;
 extern const char* version;
 extern const char* revision;
 
+// RPCs that may take long - building packet lists, waiting for the
+// transmit/capture threads or copying out a capture - are served off
+// the RPC I/O threads
+static const char* kWorkerMethods[] = {
+    "modifyPort",
+    "deleteStream",
+    "getStreamConfig",
+    "modifyStream",
+    "startTransmit",
+    "stopTransmit",
+    "startCapture",
+    "stopCapture",
+    "getCaptureBuffer",
+    "getCaptureChunk",
+    "startFilteredCapture",
+    "startMergedCapture",
+    "getMergedCaptureBuffer",
+    "applyPortConfig",
+    "startTransmitSync",
+    "uploadFrameSet",
+    "discoverPortPairs",
+};
+
+// Bytes; 0 if unknown
+static quint64 physicalMemory()
+{
+#if defined(Q_OS_UNIX) && defined(_SC_PHYS_PAGES)
+    long pages = sysconf(_SC_PHYS_PAGES);
+    long pageSize = sysconf(_SC_PAGESIZE);
+
+    if ((pages > 0) && (pageSize > 0))
+        return quint64(pages) * quint64(pageSize);
+#endif
+    return 0;
+}
+
 Drone::Drone(QObject *parent)
      : QObject(parent)
 {
@@ -58,8 +104,69 @@ bool Drone::init()
 
     Q_ASSERT(rpcServer);
 
+    TraceBuffer::init(appSettings->value(kTraceBufferKey,
+                kTraceBufferDefaultValue).toBool());
+    LatencyClock::init(appSettings->value(kPtpClockKey,
+                kPtpClockDefaultValue).toString());
+
+    {
+        qint64 portBudget = appSettings->value(kPacketListPortBudgetKey,
+                kPacketListPortBudgetDefaultValue).toLongLong();
+        qint64 totalBudget = appSettings->value(kPacketListTotalBudgetKey,
+                kPacketListTotalBudgetDefaultValue).toLongLong();
+
+        totalBudget = (totalBudget == 0) ? qint64(physicalMemory()/2)
+                                         : (totalBudget << 20);
+        AbstractPort::setPacketListBudget(
+                quint64(qMax(portBudget, qint64(0))) << 20,
+                quint64(qMax(totalBudget, qint64(0))));
+    }
+    AbstractPort::setCompactStreams(appSettings->value(kCompactStreamsKey,
+                kCompactStreamsDefaultValue).toBool());
+    FrameSetStore::init(appSettings->value(kPacketListCacheDirKey,
+                kPacketListCacheDirDefaultValue).toString(),
+            quint64(qMax(appSettings->value(kPacketListCacheMaxSizeKey,
+                kPacketListCacheMaxSizeDefaultValue).toLongLong(),
+                qint64(0))) << 20);
+
     qRegisterMetaType<SharedProtobufMessage>("SharedProtobufMessage");
 
+    {
+        QString shm = appSettings->value(kStatsExportShmKey,
+                kStatsExportShmDefaultValue).toString();
+
+        if (!shm.isEmpty()) {
+            StatsExporter *exporter = new StatsExporter(this);
+
+            if (!exporter->start(shm,
+                        appSettings->value(kStatsExportIntervalKey,
+                            kStatsExportIntervalDefaultValue).toInt(),
+                        appSettings->value(kStatsExportMaxStreamsKey,
+                            kStatsExportMaxStreamsDefaultValue).toInt()))
+                delete exporter;
+        }
+    }
+
+    rpcServer->setIoThreadCount(appSettings->value(kRpcServerIoThreadsKey,
+                kRpcServerIoThreadsDefaultValue).toInt());
+    rpcServer->setWorkerThreadCount(appSettings->value(
+                kRpcServerWorkerThreadsKey,
+                kRpcServerWorkerThreadsDefaultValue).toInt());
+    {
+        const google::protobuf::ServiceDescriptor *desc =
+            service->GetDescriptor();
+        QSet<int> methodIds;
+
+        for (uint i = 0; i < sizeof(kWorkerMethods)/sizeof(kWorkerMethods[0]);
+                i++) {
+            const google::protobuf::MethodDescriptor *method =
+                desc->FindMethodByName(kWorkerMethods[i]);
+            if (method)
+                methodIds.insert(method->index());
+        }
+        rpcServer->setWorkerMethods(methodIds);
+    }
+
     if (address.isNull()) {
         qWarning("Invalid RpcServer Address <%s> specified. Using 'Any'",
                 qPrintable(addr));
@@ -72,6 +179,15 @@ bool Drone::init()
         return false;
     }
 
+    {
+        QString localSocket = appSettings->value(kRpcServerLocalSocketKey,
+                kRpcServerLocalSocketDefaultValue).toString();
+
+        // Not fatal - the clients can still use TCP
+        if (!localSocket.isEmpty())
+            rpcServer->listenLocal(localSocket);
+    }
+
     connect(service, SIGNAL(notification(int, SharedProtobufMessage)), 
             rpcServer, SIGNAL(notifyClients(int, SharedProtobufMessage)));
 
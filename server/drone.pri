@@ -0,0 +1,53 @@
+# Build config of drone's sources - shared by the dronecore library of
+# them, the drone app and anything else that links the library
+QT += network script xml
+QT -= gui
+DEFINES += HAVE_REMOTE WPCAP
+linux*:system(grep -q IFLA_STATS64 /usr/include/linux/if_link.h): \
+    DEFINES += HAVE_IFLA_STATS64
+linux*:system(grep -qs sendmmsg /usr/include/bits/socket.h /usr/include/*/bits/socket.h): \
+    DEFINES += HAVE_SENDMMSG
+linux*:system(grep -qs XDP_UMEM_REG /usr/include/linux/if_xdp.h): \
+    DEFINES += HAVE_AF_XDP
+linux*:system(grep -qs BPF_MAP_TYPE_PERCPU_HASH /usr/include/linux/bpf.h): \
+    DEFINES += HAVE_EBPF
+linux*:exists(/usr/include/sys/sdt.h): \
+    DEFINES += HAVE_SDT
+freebsd-*:system(grep -qs BIOCSETZBUF /usr/include/net/bpf.h): \
+    DEFINES += HAVE_BPF_ZBUF
+freebsd-*:exists(/usr/include/net/netmap_user.h): \
+    DEFINES += HAVE_NETMAP
+# DPDK ports are built only on request - qmake CONFIG+=dpdk
+dpdk {
+    DEFINES += HAVE_DPDK
+    CONFIG += link_pkgconfig
+    PKGCONFIG += libdpdk
+}
+INCLUDEPATH += "$$PWD/../rpc"
+win32 {
+    CONFIG += console
+    LIBS += -lwpcap -lpacket
+    CONFIG(debug, debug|release) {
+        LIBS += -L"$$PWD/../common/debug" -lostproto
+        LIBS += -L"$$PWD/../rpc/debug" -lpbrpc
+        POST_TARGETDEPS += \
+            "$$PWD/../common/debug/libostproto.a" \
+            "$$PWD/../rpc/debug/libpbrpc.a"
+    } else {
+        LIBS += -L"$$PWD/../common/release" -lostproto
+        LIBS += -L"$$PWD/../rpc/release" -lpbrpc
+        POST_TARGETDEPS += \
+            "$$PWD/../common/release/libostproto.a" \
+            "$$PWD/../rpc/release/libpbrpc.a"
+    }
+} else {
+    LIBS += -lpcap
+    LIBS += -L"$$PWD/../common" -lostproto
+    LIBS += -L"$$PWD/../rpc" -lpbrpc
+    POST_TARGETDEPS += \
+        "$$PWD/../common/libostproto.a" \
+        "$$PWD/../rpc/libpbrpc.a"
+}
+LIBS += -lm
+linux*:LIBS += -lrt # shm_open() - see StatsExporter
+LIBS += -lprotobuf
@@ -1,51 +1,20 @@
 TEMPLATE = app
 CONFIG += qt ver_info
-QT += network script xml
-QT -= gui
-DEFINES += HAVE_REMOTE WPCAP
-linux*:system(grep -q IFLA_STATS64 /usr/include/linux/if_link.h): \
-    DEFINES += HAVE_IFLA_STATS64
-INCLUDEPATH += "../rpc"
+# dronecore before the libs it needs (see drone.pri)
 win32 {
-    CONFIG += console
-    LIBS += -lwpcap -lpacket
     CONFIG(debug, debug|release) {
-        LIBS += -L"../common/debug" -lostproto
-        LIBS += -L"../rpc/debug" -lpbrpc
-        POST_TARGETDEPS += \
-            "../common/debug/libostproto.a" \
-            "../rpc/debug/libpbrpc.a"
+        LIBS += -L"debug" -ldronecore
+        POST_TARGETDEPS += "debug/libdronecore.a"
     } else {
-        LIBS += -L"../common/release" -lostproto
-        LIBS += -L"../rpc/release" -lpbrpc
-        POST_TARGETDEPS += \
-            "../common/release/libostproto.a" \
-            "../rpc/release/libpbrpc.a"
+        LIBS += -L"release" -ldronecore
+        POST_TARGETDEPS += "release/libdronecore.a"
     }
 } else {
-    LIBS += -lpcap
-    LIBS += -L"../common" -lostproto
-    LIBS += -L"../rpc" -lpbrpc
-    POST_TARGETDEPS += "../common/libostproto.a" "../rpc/libpbrpc.a"
+    LIBS += -L"." -ldronecore
+    POST_TARGETDEPS += "libdronecore.a"
 }
-LIBS += -lm
-LIBS += -lprotobuf
-HEADERS += drone.h \
-    myservice.h
-SOURCES += \
-    devicemanager.cpp \
-    device.cpp \
-    drone_main.cpp \
-    drone.cpp \
-    portmanager.cpp \
-    abstractport.cpp \
-    pcapport.cpp \
-    bsdport.cpp \
-    linuxport.cpp \
-    winpcapport.cpp 
-SOURCES += myservice.cpp 
-SOURCES += pcapextra.cpp 
-SOURCES += packetbuffer.cpp
+include(drone.pri)
+SOURCES += drone_main.cpp
 
 QMAKE_DISTCLEAN += object_script.*
 
@@ -0,0 +1,70 @@
+TEMPLATE = lib
+CONFIG += qt staticlib
+# All of drone except its main() - linked by drone and its benchmarks
+include(drone.pri)
+HEADERS += dhcpclient.h \
+    drone.h \
+    dronemetrics.h \
+    emulationworker.h \
+    injectqueue.h \
+    latencyclock.h \
+    mcastreporter.h \
+    myservice.h \
+    neighborresolver.h \
+    packetlistbuilder.h \
+    pcapreplay.h \
+    seqlock.h \
+    statsexporter.h \
+    statshistory.h \
+    statssubscriber.h \
+    timerwheel.h \
+    tracebuffer.h \
+    virtualport.h
+SOURCES += \
+    captureanalytics.cpp \
+    capturedigest.cpp \
+    capturefilter.cpp \
+    captureindex.cpp \
+    capturemerger.cpp \
+    capturering.cpp \
+    compressedcapture.cpp \
+    devicemanager.cpp \
+    device.cpp \
+    dhcpclient.cpp \
+    dpdkport.cpp \
+    dronemetrics.cpp \
+    drone.cpp \
+    emulationworker.cpp \
+    framesetstore.cpp \
+    latencyclock.cpp \
+    mcastreporter.cpp \
+    portmanager.cpp \
+    ratemeter.cpp \
+    rxpoller.cpp \
+    statsexporter.cpp \
+    statshistory.cpp \
+    statssubscriber.cpp \
+    abstractport.cpp \
+    bpfstreamstats.cpp \
+    pcapreplay.cpp \
+    neighborresolver.cpp \
+    packetarena.cpp \
+    packetlistbuilder.cpp \
+    startbarrier.cpp \
+    pcapport.cpp \
+    pktgentransmitter.cpp \
+    bsdport.cpp \
+    linuxport.cpp \
+    streamstats.cpp \
+    threadplacer.cpp \
+    throughputtest.cpp \
+    tracebuffer.cpp \
+    txscheduler.cpp \
+    virtualport.cpp \
+    winpcapport.cpp \
+    xdpport.cpp 
+SOURCES += myservice.cpp 
+SOURCES += pcapextra.cpp 
+SOURCES += packetbuffer.cpp
+
+QMAKE_DISTCLEAN += object_script.*
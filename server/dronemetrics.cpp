@@ -0,0 +1,176 @@
+/*
+Copyright (C) 2017 Srivats P.
+
+
+This file is part of "Ostinato"
+
+This is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+
+#include "dronemetrics.h"
+
+#include <QList>
+#include <QMutex>
+#include <QMutexLocker>
+
+// Prometheus name, type and help of each counter - indexed by Counter
+static const struct {
+    const char *name;
+    const char *type;
+    const char *help;
+} kCounterInfo[OstProto::DroneMetric::Counter_ARRAYSIZE] = {
+    { NULL, NULL, NULL },
+    { "ostinato_tx_loop_iterations_total", "counter",
+      "Packet sets sent by the transmit thread" },
+    { "ostinato_tx_lag_nanoseconds", "gauge",
+      "How far behind schedule the transmit thread is" },
+    { "ostinato_tx_max_lag_nanoseconds", "gauge",
+      "Max time the transmit thread has been behind schedule" },
+    { "ostinato_tx_send_errors_total", "counter",
+      "Frames that could not be sent" },
+    { "ostinato_tx_send_retries_total", "counter",
+      "Sends retried as the tx queue was full (EAGAIN/ENOBUFS)" },
+    { "ostinato_packet_list_builds_total", "counter",
+      "Packet list builds" },
+    { "ostinato_packet_list_build_nanoseconds_total", "counter",
+      "Time spent building packet lists" },
+    { "ostinato_rx_drops_total", "counter",
+      "Frames dropped by the kernel before capture/monitor saw them" },
+    { "ostinato_rx_if_drops_total", "counter",
+      "Frames dropped by the interface" },
+    { "ostinato_rpc_calls_total", "counter",
+      "RPCs served" },
+    { "ostinato_rpc_queue_nanoseconds_total", "counter",
+      "Time RPC requests waited (behind other requests) to be served" },
+    { "ostinato_rpc_max_queue_nanoseconds", "gauge",
+      "Max time an RPC request waited to be served" },
+    { "ostinato_tx_injected_total", "counter",
+      "Device emulation frames sent by the transmit thread" },
+    { "ostinato_rx_reflected_total", "counter",
+      "Tracked stream frames received and sent back to their sender" },
+};
+
+static QMutex registryLock;
+static QList<DroneMetrics::Counters*> registry;
+
+DroneMetrics::Counters::Counters(const QString &thread,
+                                 const QString &portName)
+    : thread_(thread), portName_(portName)
+{
+    for (int i = 0; i < OstProto::DroneMetric::Counter_ARRAYSIZE; i++)
+        value_[i] = 0;
+
+    QMutexLocker locker(&registryLock);
+    registry.append(this);
+}
+
+DroneMetrics::Counters::~Counters()
+{
+    QMutexLocker locker(&registryLock);
+    registry.removeOne(this);
+}
+
+void DroneMetrics::Counters::setThread(const QString &thread)
+{
+    QMutexLocker locker(&registryLock);
+    thread_ = thread;
+}
+
+/*!
+  Appends the non-zero counters of all registered Counters to list;
+  port_id is not set - only the caller knows the port of a port name
+*/
+void DroneMetrics::dump(OstProto::DroneMetricList *list)
+{
+    QMutexLocker locker(&registryLock);
+
+    for (int i = 0; i < registry.size(); i++) {
+        const Counters *counters = registry.at(i);
+
+        for (int j = 0; j < OstProto::DroneMetric::Counter_ARRAYSIZE; j++) {
+            OstProto::DroneMetric *metric;
+            quint64 value = counters->value_[j];
+
+            if (!value || !OstProto::DroneMetric::Counter_IsValid(j))
+                continue;
+
+            metric = list->add_metric();
+            metric->set_thread(counters->thread_.toStdString());
+            if (!counters->portName_.isEmpty())
+                metric->set_port_name(counters->portName_.toStdString());
+            metric->set_counter(OstProto::DroneMetric::Counter(j));
+            metric->set_value(value);
+        }
+    }
+}
+
+static std::string labelValue(const std::string &value)
+{
+    std::string escaped;
+
+    for (size_t i = 0; i < value.size(); i++) {
+        if ((value[i] == '\\') || (value[i] == '"'))
+            escaped += '\\';
+        escaped += value[i];
+    }
+
+    return escaped;
+}
+
+/*!
+  Returns the metrics in list in the Prometheus text exposition format -
+  for scraping by a Prometheus server (via a proxy that calls the RPC)
+*/
+std::string DroneMetrics::prometheusText(
+        const OstProto::DroneMetricList &list)
+{
+    std::string text;
+
+    for (int i = 0; i < OstProto::DroneMetric::Counter_ARRAYSIZE; i++) {
+        bool hasHeader = false;
+
+        if (!OstProto::DroneMetric::Counter_IsValid(i))
+            continue;
+
+        for (int j = 0; j < list.metric_size(); j++) {
+            const OstProto::DroneMetric &metric = list.metric(j);
+
+            if (metric.counter() != i)
+                continue;
+
+            if (!hasHeader) {
+                text.append("# HELP ").append(kCounterInfo[i].name)
+                    .append(" ").append(kCounterInfo[i].help).append("\n");
+                text.append("# TYPE ").append(kCounterInfo[i].name)
+                    .append(" ").append(kCounterInfo[i].type).append("\n");
+                hasHeader = true;
+            }
+
+            text.append(kCounterInfo[i].name).append("{");
+            if (metric.has_port_id())
+                text.append(QString("port=\"%1\",").arg(metric.port_id())
+                                .toStdString());
+            if (metric.has_port_name())
+                text.append("port_name=\"")
+                    .append(labelValue(metric.port_name())).append("\",");
+            text.append("thread=\"").append(labelValue(metric.thread()))
+                .append("\"} ");
+            text.append(QString::number(metric.value()).toStdString())
+                .append("\n");
+        }
+    }
+
+    return text;
+}
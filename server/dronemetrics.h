@@ -0,0 +1,73 @@
+/*
+Copyright (C) 2017 Srivats P.
+
+
+This file is part of "Ostinato"
+
+This is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+
+#ifndef _DRONE_METRICS_H
+#define _DRONE_METRICS_H
+
+#include "../common/protocol.pb.h"
+
+#include <QString>
+
+/*
+ * Registry of drone's internal performance counters - each thread (of a
+ * port, if any) has a Counters of its own that only it updates, so no
+ * lock is taken while counting; all registered Counters can be dumped
+ * via the getDroneMetrics RPC
+ */
+class DroneMetrics
+{
+public:
+    class Counters
+    {
+    public:
+        Counters(const QString &thread, const QString &portName = QString());
+        ~Counters();
+
+        void setThread(const QString &thread);
+
+        void add(OstProto::DroneMetric::Counter counter, quint64 value = 1)
+        {
+            value_[counter] += value;
+        }
+        void set(OstProto::DroneMetric::Counter counter, quint64 value)
+        {
+            value_[counter] = value;
+        }
+        void setMax(OstProto::DroneMetric::Counter counter, quint64 value)
+        {
+            if (value > value_[counter])
+                value_[counter] = value;
+        }
+
+    private:
+        friend class DroneMetrics;
+
+        QString thread_;    // protected by the registry lock
+        QString portName_;
+        // A dump reads these as is - a value may be a count or so stale
+        volatile quint64 value_[OstProto::DroneMetric::Counter_ARRAYSIZE];
+    };
+
+    static void dump(OstProto::DroneMetricList *list);
+    static std::string prometheusText(const OstProto::DroneMetricList &list);
+};
+
+#endif
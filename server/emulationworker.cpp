@@ -0,0 +1,112 @@
+/*
+Copyright (C) 2017 Srivats P.
+
+
+This file is part of "Ostinato"
+
+This is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+
+#include "emulationworker.h"
+
+#include "devicemanager.h"
+#include "packetbuffer.h"
+
+EmulationWorker::EmulationWorker(DeviceManager *deviceManager, int shard,
+                                 const QString &portName)
+    : metrics_(QString("emul%1").arg(shard + 1), portName)
+{
+    deviceManager_ = deviceManager;
+    shard_ = shard;
+    stop_ = false;
+}
+
+EmulationWorker::~EmulationWorker()
+{
+    lock_.lock();
+    stop_ = true;
+    queued_.wakeAll();
+    lock_.unlock();
+
+    wait();
+
+    foreach(const Item &item, items_)
+        item.pktBuf->release();
+    foreach(PacketBuffer *pktBuf, done_)
+        pktBuf->release();
+}
+
+/*!
+  Queues pktBuf (pointing to the EthType, as DeviceManager::receivePacket()
+  leaves it) for the device - the worker takes ownership of pktBuf
+*/
+void EmulationWorker::queue(const DeviceKey &device, PacketBuffer *pktBuf)
+{
+    QList<PacketBuffer*> done;
+    Item item;
+
+    lock_.lock();
+    done.swap(done_);
+
+    if (items_.size() >= kMaxBacklog) {
+        metrics_.add(OstProto::DroneMetric::kRxDrops);
+        lock_.unlock();
+        pktBuf->release();
+        goto _release_done;
+    }
+
+    item.device = device;
+    item.pktBuf = pktBuf;
+    items_.append(item);
+
+    if (!isRunning())
+        start();
+    else if (items_.size() == 1)
+        queued_.wakeAll();
+    lock_.unlock();
+
+_release_done:
+    // On our (the receive) thread - the one these were allocated by
+    foreach(PacketBuffer *buf, done)
+        buf->release();
+}
+
+void EmulationWorker::run()
+{
+    QList<Item> batch;
+
+    qDebug("In %s (shard %d)", __PRETTY_FUNCTION__, shard_);
+
+    lock_.lock();
+    forever {
+        if (stop_)
+            break;
+        if (items_.isEmpty()) {
+            queued_.wait(&lock_);
+            continue;
+        }
+
+        batch.swap(items_);
+        lock_.unlock();
+
+        deviceManager_->receiveShardPackets(shard_, batch);
+
+        lock_.lock();
+        foreach(const Item &item, batch)
+            done_.append(item.pktBuf);
+        batch.clear();
+    }
+    lock_.unlock();
+}
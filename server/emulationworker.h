@@ -0,0 +1,85 @@
+/*
+Copyright (C) 2017 Srivats P.
+
+
+This file is part of "Ostinato"
+
+This is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+
+#ifndef _EMULATION_WORKER_H
+#define _EMULATION_WORKER_H
+
+#include "device.h"
+#include "dronemetrics.h"
+
+#include <QList>
+#include <QMutex>
+#include <QThread>
+#include <QWaitCondition>
+
+class DeviceManager;
+class PacketBuffer;
+
+/*!
+  Handles the received frames of one shard of a port's emulated devices -
+  see DeviceManager::receivePacket(). The receive thread only finds the
+  device a frame is for and queues (a copy of) the frame to the worker of
+  the device's shard; so the devices of different shards are handled in
+  parallel, each worker holding just the lock of its own shard
+
+  Frames are handled in batches - all those queued since the last batch,
+  under a single lock of the shard. A frame queued beyond kMaxBacklog is
+  dropped (and counted), as the ring would've dropped it had the worker
+  been the receive thread
+
+  The frames handled are handed back to the receive thread to release
+  (with the next frame queued) - the pooled buffers are per thread, so
+  they go back to the pool they were allocated from
+
+  The thread is started with the first frame queued
+*/
+class EmulationWorker : public QThread
+{
+public:
+    struct Item {
+        DeviceKey device;
+        PacketBuffer *pktBuf; // owned by the item
+    };
+
+    EmulationWorker(DeviceManager *deviceManager, int shard,
+                    const QString &portName);
+    ~EmulationWorker();
+
+    void queue(const DeviceKey &device, PacketBuffer *pktBuf);
+
+protected:
+    void run();
+
+private:
+    static const int kMaxBacklog = 4096;
+
+    DeviceManager *deviceManager_;
+    int shard_;
+    DroneMetrics::Counters metrics_;
+
+    QMutex lock_;           // for all below
+    QWaitCondition queued_;
+    QList<Item> items_;
+    QList<PacketBuffer*> done_; // handled, for queue() to release
+    bool stop_;
+};
+
+#endif
@@ -0,0 +1,260 @@
+/*
+Copyright (C) 2017 Srivats P.
+
+
+This file is part of "Ostinato"
+
+This is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+
+#include "framesetstore.h"
+
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QHash>
+#include <QMutex>
+#include <QMutexLocker>
+
+#include <string.h>
+
+extern char *revision;
+
+// A set's file is this header, the count+1 offsets (int32) padded to a
+// multiple of 8 bytes and then the frames - all in host byte order; a
+// file of another host (byte order), format version or drone revision
+// (whose frames may differ for the same stream config) is not used
+struct StoreHeader
+{
+    quint32 magic;
+    quint32 version;
+    quint32 count;
+    quint32 keyLength;
+    quint64 dataLength;
+    char key[32];
+    char revision[32];
+};
+
+static const quint32 kMagic = 0x3153464f; // "OFS1"
+static const quint32 kVersion = 1;
+
+struct MappedSet
+{
+    QFile *file;
+    const uchar *map;
+};
+
+bool FrameSetStore::enabled_ = false;
+
+static QMutex storeLock;
+static QDir storeDir;
+static quint64 storeMaxBytes;
+static QHash<QByteArray, MappedSet> mappedSets; // never unmapped
+
+static QString fileName(const QByteArray &key)
+{
+    return storeDir.filePath(QString(key.toHex()));
+}
+
+static qint64 dataOffset(quint32 count)
+{
+    return (qint64(sizeof(StoreHeader))
+            + qint64(count + 1) * qint64(sizeof(qint32)) + 7) & ~qint64(7);
+}
+
+// Maps (and validates) the file of key; NULL if none or invalid
+static const uchar* mapFile(const QByteArray &key, QFile *file)
+{
+    const StoreHeader *hdr;
+    const qint32 *offsets;
+    const uchar *map;
+    qint64 size;
+
+    file->setFileName(fileName(key));
+    if (!file->open(QIODevice::ReadOnly))
+        return NULL;
+
+    size = file->size();
+    if (size < qint64(sizeof(StoreHeader)))
+        goto _invalid;
+    map = file->map(0, size);
+    if (!map)
+        goto _invalid;
+
+    hdr = (const StoreHeader*) map;
+    if ((hdr->magic != kMagic) || (hdr->version != kVersion)
+            || (hdr->keyLength != quint32(key.size()))
+            || memcmp(hdr->key, key.constData(), key.size())
+            || qstrncmp(hdr->revision, revision, sizeof(hdr->revision) - 1)
+            || ((dataOffset(hdr->count) + qint64(hdr->dataLength)) != size))
+        goto _invalid;
+
+    // The offsets of a damaged file could point anywhere
+    offsets = (const qint32*) (map + sizeof(StoreHeader));
+    if (offsets[0] != 0)
+        goto _invalid;
+    for (quint32 i = 0; i < hdr->count; i++) {
+        if (offsets[i] > offsets[i+1])
+            goto _invalid;
+    }
+    if (quint64(offsets[hdr->count]) != hdr->dataLength)
+        goto _invalid;
+
+    return map;
+
+_invalid:
+    qWarning("FrameSetStore: ignoring invalid %s",
+            qPrintable(file->fileName()));
+    file->close();
+    return NULL;
+}
+
+// Removes the oldest sets not mapped till there's room for size bytes
+static void makeRoom(qint64 size)
+{
+    QFileInfoList files = storeDir.entryInfoList(QDir::Files, QDir::Time);
+    qint64 total = size;
+
+    foreach(const QFileInfo &info, files)
+        total += info.size();
+
+    // Sorted newest first
+    for (int i = files.size() - 1;
+            (i >= 0) && (quint64(total) > storeMaxBytes); i--) {
+        QByteArray key = QByteArray::fromHex(files.at(i).fileName().toAscii());
+
+        if (mappedSets.contains(key))
+            continue;
+        if (storeDir.remove(files.at(i).fileName()))
+            total -= files.at(i).size();
+    }
+}
+
+void FrameSetStore::init(const QString &dir, quint64 maxBytes)
+{
+    enabled_ = false;
+    if (dir.isEmpty())
+        return;
+
+    if (!QDir().mkpath(dir)) {
+        qWarning("FrameSetStore: unable to create %s", qPrintable(dir));
+        return;
+    }
+
+    storeDir = QDir(dir);
+    storeMaxBytes = maxBytes;
+    enabled_ = true;
+    qDebug("FrameSetStore: %s (max %llu MB)", qPrintable(dir),
+            (unsigned long long) (maxBytes >> 20));
+}
+
+/*
+ * Maps the set stored as key, if any and valid - the mapping is kept (and
+ * shared by later loads of the same key) till we exit
+ */
+bool FrameSetStore::load(const QByteArray &key, QByteArray *data,
+                         QVector<int> *offset)
+{
+    QMutexLocker locker(&storeLock);
+    QHash<QByteArray, MappedSet>::const_iterator mapped;
+    const StoreHeader *hdr;
+    const qint32 *offsets;
+
+    if (!enabled_ || (key.size() > int(sizeof(hdr->key))))
+        return false;
+
+    mapped = mappedSets.constFind(key);
+    if (mapped == mappedSets.constEnd()) {
+        MappedSet set;
+
+        set.file = new QFile;
+        set.map = mapFile(key, set.file);
+        if (!set.map) {
+            delete set.file;
+            return false;
+        }
+        mapped = mappedSets.insert(key, set);
+    }
+
+    hdr = (const StoreHeader*) mapped.value().map;
+    offsets = (const qint32*) (mapped.value().map + sizeof(StoreHeader));
+
+    *data = QByteArray::fromRawData(
+            (const char*) mapped.value().map + dataOffset(hdr->count),
+            int(hdr->dataLength));
+    offset->resize(hdr->count + 1);
+    memcpy(offset->data(), offsets, (hdr->count + 1) * sizeof(qint32));
+
+    return true;
+}
+
+/*
+ * Saves a set - to a temporary file renamed to the set's, so that the set
+ * is never seen partially written
+ */
+void FrameSetStore::save(const QByteArray &key, const QByteArray &data,
+                         const QVector<int> &offset)
+{
+    QMutexLocker locker(&storeLock);
+    StoreHeader hdr;
+    QFile file;
+    QString name;
+    quint32 count = offset.size() - 1;
+    qint64 offsetsSize = offset.size() * sizeof(qint32);
+    qint64 pad = dataOffset(count) - qint64(sizeof(hdr)) - offsetsSize;
+    qint64 size = dataOffset(count) + data.size();
+    static const char kPad[8] = { 0 };
+
+    if (!enabled_ || offset.isEmpty() || (key.size() > int(sizeof(hdr.key)))
+            || mappedSets.contains(key))
+        return;
+
+    if (quint64(size) > storeMaxBytes)
+        return;
+    makeRoom(size);
+
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.magic = kMagic;
+    hdr.version = kVersion;
+    hdr.count = count;
+    hdr.keyLength = key.size();
+    hdr.dataLength = data.size();
+    memcpy(hdr.key, key.constData(), key.size());
+    qstrncpy(hdr.revision, revision, sizeof(hdr.revision));
+
+    name = fileName(key);
+    file.setFileName(name + ".tmp");
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+        goto _error;
+
+    if ((file.write((const char*) &hdr, sizeof(hdr)) != qint64(sizeof(hdr)))
+            || (file.write((const char*) offset.constData(), offsetsSize)
+                    != offsetsSize)
+            || (file.write(kPad, pad) != pad)
+            || (file.write(data) != data.size()))
+        goto _error;
+
+    file.close();
+    QFile::remove(name);
+    if (!file.rename(name))
+        goto _error;
+
+    return;
+
+_error:
+    qWarning("FrameSetStore: unable to save %s (%s)", qPrintable(name),
+            qPrintable(file.errorString()));
+    file.remove();
+}
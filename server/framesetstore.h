@@ -0,0 +1,58 @@
+/*
+Copyright (C) 2017 Srivats P.
+
+
+This file is part of "Ostinato"
+
+This is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+
+#ifndef _FRAME_SET_STORE_H
+#define _FRAME_SET_STORE_H
+
+#include <QByteArray>
+#include <QString>
+#include <QVector>
+
+/*
+ * Built frame sets persisted across drone restarts - a file per set in a
+ * directory, named by the set's key (see AbstractPort::sharedFrameSetKey(),
+ * a hash of the stream config); a set found here is memory mapped instead
+ * of being built again, so that a port's packet list is rebuilt quickly
+ * after a restart if its streams haven't changed - except for streams with
+ * random frames and no random_seed, whose frames differ every run
+ *
+ * Sets are saved as they are built, upto a max size of the store - the
+ * oldest sets (not mapped) are removed to make room; a mapped set stays
+ * mapped till the drone exits
+ */
+class FrameSetStore
+{
+public:
+    // Empty dir => disabled
+    static void init(const QString &dir, quint64 maxBytes);
+    static bool isEnabled() { return enabled_; }
+
+    // data refers to the mapped file, offset is a copy
+    static bool load(const QByteArray &key, QByteArray *data,
+                     QVector<int> *offset);
+    static void save(const QByteArray &key, const QByteArray &data,
+                     const QVector<int> &offset);
+
+private:
+    static bool enabled_;
+};
+
+#endif
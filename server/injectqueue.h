@@ -0,0 +1,106 @@
+/*
+Copyright (C) 2017 Srivats P.
+
+
+This file is part of "Ostinato"
+
+This is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+
+#ifndef _INJECT_QUEUE_H
+#define _INJECT_QUEUE_H
+
+#include <QAtomicPointer>
+#include <QByteArray>
+
+/*!
+  Lock-free multi-producer single-consumer queue of frames (copies of) -
+  Vyukov's intrusive MPSC queue. A push() is a single atomic exchange, so
+  any number of threads push without a lock and without waiting for each
+  other or for the consumer; only one thread may pop()
+
+  A push() in progress (exchanged, not yet linked) makes pop() see the
+  queue as empty till it is done - its frame, and those pushed after it,
+  are popped by a later pop()
+
+  Used by the transmitter to send the frames of other threads (device
+  emulation) between its own - see PcapPort::PortTransmitter::inject()
+*/
+class InjectQueue
+{
+public:
+    InjectQueue() : head_(&stub_), tail_(&stub_) {}
+    ~InjectQueue() {
+        QByteArray frame;
+        while (pop(&frame))
+            ;
+    }
+
+    void push(const uchar *data, int length) {
+        Node *node = new Node;
+
+        node->frame = QByteArray((const char*) data, length);
+        link(node);
+    }
+
+    bool pop(QByteArray *frame) {
+        Node *tail = tail_;
+        Node *next = tail->next;
+
+        if (tail == &stub_) {
+            if (!next)
+                return false;
+            tail_ = tail = next;
+            next = next->next;
+        }
+
+        if (!next) {
+            // The last node can't go till another one is linked after
+            // it; a push() in progress => try later
+            if (tail != (Node*) head_)
+                return false;
+            link(&stub_);
+            next = tail->next;
+            if (!next)
+                return false;
+        }
+
+        tail_ = next;
+        *frame = tail->frame;
+        delete tail;
+        return true;
+    }
+
+private:
+    struct Node {
+        Node() : next(0) {}
+        QAtomicPointer<Node> next;
+        QByteArray frame;
+    };
+
+    void link(Node *node) {
+        Node *prev;
+
+        node->next = 0;
+        prev = head_.fetchAndStoreOrdered(node);
+        prev->next.fetchAndStoreRelease(node);
+    }
+
+    Node stub_;
+    QAtomicPointer<Node> head_;     // last pushed - producers
+    Node *tail_;                    // next to pop - consumer only
+};
+
+#endif
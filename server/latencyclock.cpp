@@ -0,0 +1,145 @@
+/*
+Copyright (C) 2017 Srivats P.
+
+
+This file is part of "Ostinato"
+
+This is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+
+
+#include "latencyclock.h"
+
+#include "streamstats.h"
+
+#include <QMutexLocker>
+
+#ifdef Q_OS_LINUX
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// See the kernel's Documentation/ptp/testptp.c
+#define FD_TO_CLOCKID(fd) ((~(clockid_t) (fd) << 3) | 3)
+#endif
+
+int LatencyClock::phcFd_ = -1;
+QString LatencyClock::source_("system");
+volatile qint64 LatencyClock::offset_ = 0;
+volatile quint64 LatencyClock::uncertainty_ = 0;
+volatile quint64 LatencyClock::lastSampleNsec_ = 0;
+QMutex LatencyClock::sampleLock_;
+
+/*!
+  Uses the PTP hardware clock ptpDevice (if not empty) - to be called
+  before any port is created
+*/
+void LatencyClock::init(const QString &ptpDevice)
+{
+    if (ptpDevice.isEmpty())
+        return;
+
+#ifdef Q_OS_LINUX
+    phcFd_ = open(qPrintable(ptpDevice), O_RDONLY);
+    if (phcFd_ < 0) {
+        qWarning("unable to open PTP clock %s (%s) - using the system clock",
+                qPrintable(ptpDevice), strerror(errno));
+        return;
+    }
+
+    source_ = ptpDevice;
+    samplePhc();
+    qDebug("latency clock is %s, offset %lld +/- %llu ns",
+            qPrintable(ptpDevice), offset_, uncertainty_);
+#else
+    qWarning("PTP clock %s not supported - using the system clock",
+            qPrintable(ptpDevice));
+#endif
+}
+
+/*!
+  Returns the current time of the clock - the PHC offset is resampled
+  here (by whichever thread finds it stale first) so that no thread of
+  its own is needed
+*/
+quint64 LatencyClock::now()
+{
+    quint64 nsec = StreamStatsTable::realTimeNsec();
+
+    if ((phcFd_ >= 0) && (nsec - lastSampleNsec_ > kPhcSampleNsec)
+            && sampleLock_.tryLock()) {
+        samplePhc();
+        sampleLock_.unlock();
+    }
+
+    return nsec + offset_;
+}
+
+/*!
+  Sets the offset from the system clock; fails if the clock is a PHC
+*/
+bool LatencyClock::setOffset(qint64 offset, quint64 uncertainty)
+{
+    if (phcFd_ >= 0)
+        return false;
+
+    offset_ = offset;
+    uncertainty_ = uncertainty;
+    return true;
+}
+
+void LatencyClock::info(OstProto::ClockInfo *info)
+{
+    info->set_nsec(now());
+    info->set_system_nsec(StreamStatsTable::realTimeNsec());
+    info->set_offset_nsec(offset_);
+    info->set_uncertainty_nsec(uncertainty_);
+    info->set_source(source_.toStdString());
+}
+
+/*!
+  Samples the PHC's offset from the system clock - the PHC read that is
+  bracketed by the closest pair of system clock reads is used; the
+  uncertainty is half of that bracket
+*/
+void LatencyClock::samplePhc()
+{
+#ifdef Q_OS_LINUX
+    quint64 bestWindow = ~quint64(0);
+    qint64 bestOffset = 0;
+
+    for (int i = 0; i < kPhcSamples; i++) {
+        struct timespec ts;
+        quint64 before, after, phc;
+
+        before = StreamStatsTable::realTimeNsec();
+        if (clock_gettime(FD_TO_CLOCKID(phcFd_), &ts) < 0)
+            return;
+        after = StreamStatsTable::realTimeNsec();
+
+        phc = quint64(ts.tv_sec)*quint64(1e9) + ts.tv_nsec;
+        if (after - before < bestWindow) {
+            bestWindow = after - before;
+            bestOffset = qint64(phc - (before + bestWindow/2));
+        }
+    }
+
+    offset_ = bestOffset;
+    uncertainty_ = bestWindow/2;
+    lastSampleNsec_ = StreamStatsTable::realTimeNsec();
+#endif
+}
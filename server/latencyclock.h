@@ -0,0 +1,77 @@
+/*
+Copyright (C) 2017 Srivats P.
+
+
+This file is part of "Ostinato"
+
+This is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+
+
+#ifndef _LATENCY_CLOCK_H
+#define _LATENCY_CLOCK_H
+
+#include "../common/protocol.pb.h"
+
+#include <QMutex>
+#include <QString>
+
+/*!
+  The clock that tracked stream frames are timestamped with - the tx time
+  in the signature and the rx time for the latency; it is the system clock
+  plus an offset, so that the latency of frames sent by another drone can
+  be measured if the two drones agree on the time:
+
+  - With a PTP hardware clock (the PtpClock setting - a /dev/ptpN synced
+    across the hosts by ptp4l) it is the PHC's time - the offset of the
+    PHC from the system clock is sampled every kPhcSampleNsec. NIC rx
+    timestamps are PHC time already, so they are used as is
+  - Else the offset is whatever the client sets with setClockOffset,
+    typically estimated from getClock round trips to this and the other
+    drone (see ClockInfo). NIC rx timestamps are taken to be system time,
+    i.e. the NIC clock is synced to the system clock (phc2sys)
+
+  The offset is read by the tx and rx threads for every frame, without
+  any lock
+*/
+class LatencyClock
+{
+public:
+    static void init(const QString &ptpDevice);
+
+    static quint64 now();
+    static quint64 fromSystemTime(quint64 nsec) { return nsec + offset_; }
+    static quint64 fromNicTime(quint64 nsec) {
+        return (phcFd_ >= 0) ? nsec : nsec + offset_;
+    }
+
+    static bool setOffset(qint64 offset, quint64 uncertainty);
+    static void info(OstProto::ClockInfo *info);
+
+private:
+    static void samplePhc();
+
+    static const quint64 kPhcSampleNsec = 100000000ULL; // 100ms
+    static const int kPhcSamples = 5; // best of
+
+    static int phcFd_;          // -1 => no PHC
+    static QString source_;
+    static volatile qint64 offset_;
+    static volatile quint64 uncertainty_;
+    static volatile quint64 lastSampleNsec_;
+    static QMutex sampleLock_;
+};
+
+#endif
@@ -19,22 +19,41 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 
 #include "linuxport.h"
 
+#include "../common/streambase.h"
+#include "devicemanager.h"
+#include "latencyclock.h"
+#include "packetbuffer.h"
+#include "settings.h"
+
 #ifdef Q_OS_LINUX
 
 #include <QByteArray>
+#include <QFile>
 #include <QHash>
+#include <QMutexLocker>
 #include <QTime>
 
 #include <errno.h>
 #include <fcntl.h>
 #include <net/if.h>
+#include <poll.h>
 #include <sys/ioctl.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
 
+#include <arpa/inet.h>
+#include <linux/ethtool.h>
+#include <linux/filter.h>
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
+#include <linux/net_tstamp.h>
 #include <linux/rtnetlink.h>
+#include <linux/sockios.h>
+#include <sys/mman.h>
+
+#include "timestamp.h"
 
 QList<LinuxPort*> LinuxPort::allPorts_;
 LinuxPort::StatsMonitor *LinuxPort::monitor_;
@@ -50,6 +69,56 @@ typedef struct rtnl_link_stats64 x_rtnl_link_stats;
 typedef struct rtnl_link_stats x_rtnl_link_stats;
 #endif
 
+// Stats of just the given interface (kernel 4.7+) - see linkStats()
+#if defined(HAVE_IFLA_STATS64) && defined(RTM_GETSTATS)
+#define HAVE_RTM_GETSTATS
+#endif
+
+// Returns the NUMA node of the NIC's PCIe slot; -1 if not known (or the
+// interface is not a physical NIC)
+static int interfaceNumaNode(const char *device)
+{
+    QFile file(QString("/sys/class/net/%1/device/numa_node").arg(device));
+    bool isOk = false;
+    int node;
+
+    if (!file.open(QIODevice::ReadOnly))
+        return -1;
+
+    node = QString(file.readAll()).trimmed().toInt(&isOk);
+    return isOk ? node : -1;
+}
+
+// Fills cap with the timestamps the interface can provide (ethtool -T)
+static void queryTimestampCapability(const char *device,
+                                     OstProto::TimestampCapability *cap)
+{
+    struct ifreq ifr;
+    struct ethtool_ts_info info;
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+
+    // The kernel can always timestamp rx frames
+    cap->set_sw_rx(true);
+    if (fd < 0)
+        return;
+
+    memset(&ifr, 0, sizeof(ifr));
+    strncpy(ifr.ifr_name, device, sizeof(ifr.ifr_name) - 1);
+    memset(&info, 0, sizeof(info));
+    info.cmd = ETHTOOL_GET_TS_INFO;
+    ifr.ifr_data = (char*) &info;
+
+    if (ioctl(fd, SIOCETHTOOL, &ifr) == 0) {
+        cap->set_hw_rx((info.so_timestamping & SOF_TIMESTAMPING_RX_HARDWARE)
+                && (info.rx_filters & (1 << HWTSTAMP_FILTER_ALL)));
+        cap->set_hw_tx((info.so_timestamping & SOF_TIMESTAMPING_TX_HARDWARE)
+                && (info.tx_types & (1 << HWTSTAMP_TX_ON)));
+        cap->set_sw_tx(info.so_timestamping & SOF_TIMESTAMPING_TX_SOFTWARE);
+    }
+
+    close(fd);
+}
+
 LinuxPort::LinuxPort(int id, const char *device)
     : PcapPort(id, device) 
 {
@@ -61,13 +130,90 @@ LinuxPort::LinuxPort(int id, const char *device)
     delete monitorTx_;
     monitorRx_ = monitorTx_ = NULL;
 
+    // ... except as the port's tap - to look at the rx frames for stream
+    // stats and hand them to capture and emulation (see PortMonitor)
+    bool streamStats = appSettings->value(kStreamStatsKey,
+                            kStreamStatsDefaultValue).toBool();
+    PortMonitor *monitor = new PortMonitor(device, kDirectionRx, NULL,
+                                           streamStats);
+    if (!monitor->handle() || (!streamStats && !monitor->isTap())) {
+        delete monitor;
+        monitor = NULL;
+    }
+    else if (streamStats) {
+        rxStreamStats_.enableHistograms();
+        monitor->setStreamStats(&rxStreamStats_);
+    }
+    monitorRx_ = monitor;
+
+#ifdef HAVE_EBPF
+    // ... or let the kernel count them without handing them to us
+    bpfStreamStats_ = NULL;
+    if (monitor && streamStats && (monitor->rxPollFd() >= 0)
+            && appSettings->value(kStreamStatsInKernelKey,
+                    kStreamStatsInKernelDefaultValue).toBool()) {
+        bpfStreamStats_ = new BpfStreamStats();
+        if (!bpfStreamStats_->attach(monitor->rxPollFd())) {
+            qWarning("%s: counting stream stats in user space", device);
+            delete bpfStreamStats_;
+            bpfStreamStats_ = NULL;
+        }
+    }
+#endif
+
     // We have one monitor for both Rx/Tx of all ports
     if (!monitor_)
         monitor_ = new StatsMonitor();
 
+    // The frames counted in the kernel aren't handed to the tap either
+    PortMonitor *tap = (monitor && monitor->isTap()) ? monitor : NULL;
+#ifdef HAVE_EBPF
+    if (bpfStreamStats_)
+        tap = NULL;
+#endif
+
+    // Capture can also use a PACKET_RX_RING (or the tap), if asked for
+    PortCapturer *capturer = new PortCapturer(device);
+    capturer->setTap(tap);
+    delete capturer_;
+    capturer_ = capturer;
+
+    // ... and the pcap based emulation transceiver with a ring based one
+    EmulationTransceiver *emulXcvr = new EmulationTransceiver(device,
+                                                              deviceManager_);
+    emulXcvr->setTap(tap);
+    delete emulXcvr_;
+    emulXcvr_ = emulXcvr;
+
+    // Replace the pcap based transmitter with a PACKET_TX_RING based one
+    delete transmitter_;
+    transmitter_ = new PortTransmitter(device);
+    for (int i = 0; i < txWorkers_.size(); i++) {
+        delete txWorkers_[i];
+        txWorkers_[i] = new PortTransmitter(device);
+        txWorkers_[i]->placer().setName(QString("tx%1").arg(i + 1));
+        txWorkers_[i]->metrics().setThread(QString("tx%1").arg(i + 1));
+        txWorkers_[i]->setStreamStatsLane(i + 1);
+    }
+
     data_.set_is_exclusive_control(hasExclusiveControl());
+    queryTimestampCapability(device, data_.mutable_timestamp_capability());
     minPacketSetSize_ = 16;
 
+    // Keep frames to be sent in memory local to the NIC
+    data_.set_numa_node(interfaceNumaNode(device));
+    updateTxNumaNode();
+
+    pktgen_ = NULL;
+    isPktgenRun_ = false;
+    if (appSettings->value(kPktgenOffloadKey,
+                kPktgenOffloadDefaultValue).toBool()) {
+        if (PktgenTransmitter::isAvailable())
+            pktgen_ = new PktgenTransmitter(device);
+        else
+            qWarning("%s: pktgen not available (modprobe pktgen)", device);
+    }
+
     qDebug("adding dev to all ports list <%s>", device);
     allPorts_.append(this);
 
@@ -82,6 +228,11 @@ LinuxPort::~LinuxPort()
     qDebug("In %s", __FUNCTION__);
 
     allPorts_.removeAll(this);
+    clearCounterFilters();
+    delete pktgen_;
+#ifdef HAVE_EBPF
+    delete bpfStreamStats_;
+#endif
 
     if (monitor_->isRunning())
     {
@@ -122,6 +273,10 @@ void LinuxPort::init()
 
     monitor_->waitForSetupFinished();
 
+    // Created by us - see constructor
+    if (monitorRx_)
+        static_cast<PortMonitor*>(monitorRx_)->start();
+
     if (!isPromisc_)
         addNote("Non Promiscuous Mode");
 }
@@ -143,6 +298,229 @@ bool LinuxPort::setExclusiveControl(bool /*exclusive*/)
     return false;
 }
 
+/*
+  Each counter filter is a packet socket with the filter attached that we
+  never read from - rx frames that match are counted by the kernel and,
+  since the socket's receive buffer is kept full, dropped without being
+  queued; the filter returns a snap length of 1, so nothing much is
+  copied for the frames that are queued before it fills up
+*/
+bool LinuxPort::setCounterFilters(const OstProto::CounterFilterList &filters)
+{
+    QList<int> fds;
+    int ifIndex = if_nametoindex(name());
+    int bufSize = 0; // kernel rounds this up to its min
+
+    if (!ifIndex) {
+        qWarning("%s: unable to get ifIndex (%s)", name(), strerror(errno));
+        return false;
+    }
+
+    for (int i = 0; i < filters.counter_filter_size(); i++)
+    {
+        const char *filter = filters.counter_filter(i).filter().c_str();
+        struct bpf_program fp;
+        QVector<struct sock_filter> insns;
+        struct sock_filter skipTx[3] = {
+            BPF_STMT(BPF_LD | BPF_B | BPF_ABS, SKF_AD_OFF + SKF_AD_PKTTYPE),
+            BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, PACKET_OUTGOING, 0, 1),
+            BPF_STMT(BPF_RET | BPF_K, 0),
+        };
+        struct sock_fprog program;
+        struct sockaddr_ll addr;
+        int fd;
+
+        if (pcap_compile_nopcap(1, DLT_EN10MB, &fp, filter, 1,
+                    PCAP_NETMASK_UNKNOWN) < 0) {
+            qWarning("%s: can't compile counter filter %s", name(), filter);
+            goto _error;
+        }
+
+        // Skip our own tx frames, then the (relative jumps only) filter
+        for (int j = 0; j < 3; j++)
+            insns.append(skipTx[j]);
+        for (uint j = 0; j < fp.bf_len; j++)
+            insns.append(((struct sock_filter*) fp.bf_insns)[j]);
+        pcap_freecode(&fp);
+
+        program.len = insns.size();
+        program.filter = insns.data();
+
+        fd = socket(AF_PACKET, SOCK_RAW, htons(ETH_P_ALL));
+        if (fd < 0) {
+            qWarning("%s: unable to open packet socket (%s)", name(),
+                    strerror(errno));
+            goto _error;
+        }
+        fds.append(fd);
+
+        setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &bufSize, sizeof(bufSize));
+        if (setsockopt(fd, SOL_SOCKET, SO_ATTACH_FILTER,
+                    &program, sizeof(program)) < 0) {
+            qWarning("%s: unable to attach counter filter %s (%s)", name(),
+                    filter, strerror(errno));
+            goto _error;
+        }
+
+        memset(&addr, 0, sizeof(addr));
+        addr.sll_family = AF_PACKET;
+        addr.sll_protocol = htons(ETH_P_ALL);
+        addr.sll_ifindex = ifIndex;
+        if (bind(fd, (struct sockaddr*) &addr, sizeof(addr)) < 0) {
+            qWarning("%s: unable to bind packet socket (%s)", name(),
+                    strerror(errno));
+            goto _error;
+        }
+    }
+
+    clearCounterFilters();
+
+    counterFilterLock_.lock();
+    counterFilterFds_ = fds;
+    for (int i = 0; i < fds.size(); i++)
+        counterFilterCounts_.append(0);
+    counterFilterLock_.unlock();
+    return true;
+
+_error:
+    while (fds.size())
+        close(fds.takeFirst());
+    return false;
+}
+
+void LinuxPort::startTransmit()
+{
+    if (pktgen_ && startPktgen())
+        return;
+
+    isPktgenRun_ = false;
+    PcapPort::startTransmit();
+}
+
+/*
+ * Sends the port's only stream with pktgen - if it can, else the packet
+ * list (built as usual) is sent by our transmitters instead. The tx
+ * stats are the NIC's anyway
+ */
+bool LinuxPort::startPktgen()
+{
+    const StreamBase *stream = NULL;
+    QString reason;
+    int cpu;
+
+    if (data_.transmit_mode() != OstProto::kSequentialTransmit) {
+        reason = "not sequential transmit";
+        goto _not_offloaded;
+    }
+    if (data_.transmit_duration() || txStopTime_) {
+        reason = "transmit duration or stop time set";
+        goto _not_offloaded;
+    }
+
+    for (int i = 0; i < streamCount(); i++) {
+        if (!streamAtIndex(i)->isEnabled())
+            continue;
+        if (stream) {
+            reason = "more than one stream";
+            goto _not_offloaded;
+        }
+        stream = streamAtIndex(i);
+    }
+    if (!stream) {
+        reason = "no stream";
+        goto _not_offloaded;
+    }
+
+    cpu = (data_.has_tx_thread_placement()
+                && (data_.tx_thread_placement().cpu() >= 0)) ?
+            data_.tx_thread_placement().cpu() :
+            id() % qMax(1, QThread::idealThreadCount());
+    if (!pktgen_->start(stream, cpu, data_.max_rate() ? 0 : transmitLoad(),
+                        reason))
+        goto _not_offloaded;
+
+    isPktgenRun_ = true;
+    return true;
+
+_not_offloaded:
+    qDebug("%s: not sent via pktgen - %s", name(), qPrintable(reason));
+    return false;
+}
+
+void LinuxPort::stopTransmit()
+{
+    if (pktgen_)
+        pktgen_->stop();
+    PcapPort::stopTransmit();
+}
+
+bool LinuxPort::isTransmitOn()
+{
+    if (pktgen_ && pktgen_->isRunning())
+        return true;
+    return PcapPort::isTransmitOn();
+}
+
+bool LinuxPort::transmitRunStats(quint64 *pkts, quint64 *bytes,
+                                 quint64 *nsec)
+{
+    if (isPktgenRun_) {
+        pktgen_->runStats(pkts, bytes, nsec);
+        return true;
+    }
+    return PcapPort::transmitRunStats(pkts, bytes, nsec);
+}
+
+void LinuxPort::addStreamStats(StreamStatsHash &stats)
+{
+    PcapPort::addStreamStats(stats);
+    if (pktgen_)
+        pktgen_->addStreamStats(id(), stats);
+
+#ifdef HAVE_EBPF
+    if (bpfStreamStats_)
+        bpfStreamStats_->addTo(stats);
+#endif
+}
+
+bool LinuxPort::setProbeReflection(bool enable)
+{
+#ifdef HAVE_EBPF
+    // The frames counted in the kernel aren't handed to us
+    if (enable && bpfStreamStats_)
+        return false;
+#endif
+    return PcapPort::setProbeReflection(enable);
+}
+
+void LinuxPort::addFilterCounts(QList<quint64> &counts)
+{
+    QMutexLocker locker(&counterFilterLock_);
+
+    for (int i = 0; i < counterFilterFds_.size(); i++)
+    {
+        struct tpacket_stats stats;
+        socklen_t len = sizeof(stats);
+
+        // Kernel resets these on every read; tp_packets includes tp_drops
+        if (getsockopt(counterFilterFds_.at(i), SOL_PACKET,
+                    PACKET_STATISTICS, &stats, &len) == 0)
+            counterFilterCounts_[i] += stats.tp_packets;
+
+        if (i < counts.size())
+            counts[i] += counterFilterCounts_.at(i);
+    }
+}
+
+void LinuxPort::clearCounterFilters()
+{
+    QMutexLocker locker(&counterFilterLock_);
+
+    while (counterFilterFds_.size())
+        close(counterFilterFds_.takeFirst());
+    counterFilterCounts_.clear();
+}
+
 LinuxPort::StatsMonitor::StatsMonitor()
     : QThread()
 {
@@ -159,6 +537,12 @@ LinuxPort::StatsMonitor::~StatsMonitor()
 
 void LinuxPort::StatsMonitor::run()
 {
+    if (appSettings->value(kNicCountersKey, kNicCountersDefaultValue).toBool())
+    {
+        foreach(LinuxPort *port, allPorts_)
+            setupNicCounters(port);
+    }
+
     if (netlinkStats() < 0)
     {
         qDebug("netlink stats not available - using /proc stats");
@@ -169,6 +553,7 @@ void LinuxPort::StatsMonitor::run()
 void LinuxPort::StatsMonitor::procStats()
 {
     PortStats **portStats;
+    LinuxPort **ports;
     int fd;
     QByteArray buf;
     int len;
@@ -225,6 +610,8 @@ void LinuxPort::StatsMonitor::procStats()
 
     portStats = (PortStats**) calloc(count, sizeof(PortStats));
     Q_ASSERT(portStats != NULL);
+    ports = (LinuxPort**) calloc(count, sizeof(LinuxPort*));
+    Q_ASSERT(ports != NULL);
 
     //
     // Populate the port stats array
@@ -261,6 +648,7 @@ void LinuxPort::StatsMonitor::procStats()
                 if (strncmp(port->name(), p, int(q-p)) == 0)
                 {
                     portStats[index] = &(port->stats_);
+                    ports[index] = port;
 
                     if (setPromisc(port->name()))
                         port->clearPromisc_ = true;
@@ -346,36 +734,32 @@ void LinuxPort::StatsMonitor::procStats()
                 AbstractPort::PortStats *stats = portStats[index];
                 if (stats)
                 {
-                    // TODO: fix the pps/Bps calc similar to netlink stats
-                    stats->rxPps = 
-                        ((rxPkts >= stats->rxPkts) ? 
-                                rxPkts - stats->rxPkts : 
-                                rxPkts + (kMaxValue32 - stats->rxPkts))
-                        / kRefreshFreq_;
-                    stats->rxBps = 
-                        ((rxBytes >= stats->rxBytes) ? 
-                                rxBytes - stats->rxBytes : 
-                                rxBytes + (kMaxValue32 - stats->rxBytes))
-                        / kRefreshFreq_;
+                    ports[index]->updateRates(
+                        (rxPkts >= stats->rxPkts) ?
+                                rxPkts - stats->rxPkts :
+                                rxPkts + (kMaxValue32 - stats->rxPkts),
+                        (rxBytes >= stats->rxBytes) ?
+                                rxBytes - stats->rxBytes :
+                                rxBytes + (kMaxValue32 - stats->rxBytes),
+                        (txPkts >= stats->txPkts) ?
+                                txPkts - stats->txPkts :
+                                txPkts + (kMaxValue32 - stats->txPkts),
+                        (txBytes >= stats->txBytes) ?
+                                txBytes - stats->txBytes :
+                                txBytes + (kMaxValue32 - stats->txBytes));
+                    stats->rxLock.writeBegin();
                     stats->rxPkts  = rxPkts;
                     stats->rxBytes = rxBytes;
-                    stats->txPps = 
-                        ((txPkts >= stats->txPkts) ? 
-                                txPkts - stats->txPkts : 
-                                txPkts + (kMaxValue32 - stats->txPkts))
-                        / kRefreshFreq_;
-                    stats->txBps = 
-                        ((txBytes >= stats->txBytes) ? 
-                                txBytes - stats->txBytes : 
-                                txBytes + (kMaxValue32 - stats->txBytes))
-                        / kRefreshFreq_;
-                    stats->txPkts  = txPkts;
-                    stats->txBytes = txBytes;
-
                     stats->rxDrops = rxDrops;
                     stats->rxErrors = rxErrors;
                     stats->rxFifoErrors = rxFifo;
                     stats->rxFrameErrors = rxFrame;
+                    stats->rxLock.writeEnd();
+
+                    stats->txLock.writeBegin();
+                    stats->txPkts  = txPkts;
+                    stats->txBytes = txBytes;
+                    stats->txLock.writeEnd();
                 }
             }
 
@@ -384,16 +768,22 @@ void LinuxPort::StatsMonitor::procStats()
             p++;
             index++;
         }
-        QThread::sleep(kRefreshFreq_);
+
+        for (int i = 0; i < allPorts_.size(); i++) {
+            updateNicCounters(allPorts_.at(i));
+            allPorts_.at(i)->updateRateControl();
+        }
+
+        QThread::msleep(kRefreshInterval_);
     }
 
     free(portStats);
+    free(ports);
 }
 
 int LinuxPort::StatsMonitor::netlinkStats()
 {
-    QHash<uint, PortStats*> portStats;
-    QHash<uint, quint64*> portMaxStatsValue;
+    QHash<uint, LinuxPort*> ports;
     QHash<uint, OstProto::LinkState*> linkState;
     int fd;
     struct sockaddr_nl local;
@@ -408,6 +798,9 @@ int LinuxPort::StatsMonitor::netlinkStats()
     struct msghdr msg;
     struct nlmsghdr *nlm;
     bool done = false;
+    int ifCount = 0;
+    int eventFd = -1;
+    int interval, ticksPerRefresh;
 
     //
     // We first setup stuff before we start polling for stats
@@ -566,14 +959,15 @@ _retry:
         }
 
         qDebug("if: %s(%d)", ifname, ifi->ifi_index);
+        ifCount++;
         foreach(LinuxPort* port, allPorts_)
         {
             if (strcmp(port->name(), ifname) == 0)
             {
-                portStats[uint(ifi->ifi_index)] = &(port->stats_);
-                portMaxStatsValue[uint(ifi->ifi_index)] = 
-                        &(port->maxStatsValue_);
+                ports[uint(ifi->ifi_index)] = port;
                 linkState[uint(ifi->ifi_index)] = &(port->linkState_);
+                port->linkState_ = ifi->ifi_flags & IFF_RUNNING ?
+                        OstProto::LinkStateUp : OstProto::LinkStateDown;
 
                 if (setPromisc(port->name()))
                     port->clearPromisc_ = true;
@@ -600,11 +994,57 @@ _retry:
     qDebug("stats for %d ports setup", count);
     setupDone_ = true;
 
+    interval = qBound(int(kMinRefreshInterval_),
+                    appSettings->value(kStatsIntervalKey,
+                        kStatsIntervalDefaultValue).toInt(),
+                    int(kRefreshInterval_));
+    ticksPerRefresh = kRefreshInterval_/interval;
+
+#ifdef HAVE_RTM_GETSTATS
+    // With many more interfaces than ports (e.g. a host with hundreds of
+    // VFs), ask for the stats of just our ports instead of dumping all
+    // the interfaces; the link state then comes from link notifications
+    if ((count*4 < ifCount) && ((eventFd = openLinkEvents()) >= 0))
+        qDebug("stats of %d of %d interfaces via RTM_GETSTATS",
+                count, ifCount);
+#endif
+
     //
     // We are all set - Let's start polling for stats!
     //
-    while (!stop_)
+    for (uint tick = 0; !stop_; tick++)
     {
+        // Ports with traffic are refreshed every interval; all ports (and
+        // the rate control) only every kRefreshInterval_
+        bool isFullRefresh = (tick % ticksPerRefresh) == 0;
+
+        if (!isFullRefresh && !hasActivePort(ports.values()))
+            goto _try_later;
+
+#ifdef HAVE_RTM_GETSTATS
+        // Missed link notifications are made up for by a dump (this time)
+        if ((eventFd >= 0) && processLinkEvents(eventFd, ports))
+        {
+            QHashIterator<uint, LinuxPort*> iter(ports);
+
+            while (iter.hasNext())
+            {
+                iter.next();
+                if (!isFullRefresh && !isActivePort(iter.value()))
+                    continue;
+                if (linkStats(fd, iter.key(), iter.value()) < 0)
+                {
+                    qWarning("RTM_GETSTATS failed - dumping all stats");
+                    close(eventFd);
+                    eventFd = -1;
+                    break;
+                }
+            }
+            if (eventFd >= 0)
+                goto _rate_control;
+        }
+#endif
+
         if (send(fd, (void*)&ifListReq, sizeof(ifListReq), 0) < 0)
         {
             qWarning("Unable to send GETLINK request (errno %d)", errno);
@@ -660,86 +1100,13 @@ _retry_recv:
             {
                 if (rta->rta_type == X_IFLA_STATS)
                 {
-                    x_rtnl_link_stats *rtnlStats = 
-                            (x_rtnl_link_stats*) RTA_DATA(rta);
-                    AbstractPort::PortStats *stats = portStats[ifi->ifi_index];
-                    quint64 *maxStatsValue = portMaxStatsValue[ifi->ifi_index];
+                    LinuxPort *port = ports.value(ifi->ifi_index);
                     OstProto::LinkState *state = linkState[ifi->ifi_index];
 
-                    if (!stats)
+                    if (!port)
                         break;
 
-                    if (rtnlStats->rx_packets >= stats->rxPkts) {
-                        stats->rxPps = (rtnlStats->rx_packets - stats->rxPkts)
-                                            / kRefreshFreq_;
-                    }
-                    else {
-                        if (*maxStatsValue == 0) {
-                            *maxStatsValue = stats->rxPkts > kMaxValue32 ?
-                                kMaxValue64 : kMaxValue32;
-                        }
-                        stats->rxPps = ((*maxStatsValue - stats->rxPkts)
-                                            + rtnlStats->rx_packets)
-                                        / kRefreshFreq_;
-                    }
-
-                    if (rtnlStats->rx_bytes >= stats->rxBytes) {
-                        stats->rxBps = (rtnlStats->rx_bytes - stats->rxBytes)
-                                            / kRefreshFreq_;
-                    }
-                    else {
-                        if (*maxStatsValue == 0) {
-                            *maxStatsValue = stats->rxBytes > kMaxValue32 ?
-                                kMaxValue64 : kMaxValue32;
-                        }
-                        stats->rxBps = ((*maxStatsValue - stats->rxBytes)
-                                            + rtnlStats->rx_bytes)
-                                        / kRefreshFreq_;
-                    }
-
-                    stats->rxPkts  = rtnlStats->rx_packets;
-                    stats->rxBytes = rtnlStats->rx_bytes;
-
-                    if (rtnlStats->tx_packets >= stats->txPkts) {
-                        stats->txPps = (rtnlStats->tx_packets - stats->txPkts)
-                                            / kRefreshFreq_;
-                    }
-                    else {
-                        if (*maxStatsValue == 0) {
-                            *maxStatsValue = stats->txPkts > kMaxValue32 ?
-                                kMaxValue64 : kMaxValue32;
-                        }
-                        stats->txPps = ((*maxStatsValue - stats->txPkts)
-                                            + rtnlStats->tx_packets)
-                                        / kRefreshFreq_;
-                    }
-
-                    if (rtnlStats->tx_bytes >= stats->txBytes) {
-                        stats->txBps = (rtnlStats->tx_bytes - stats->txBytes)
-                                            / kRefreshFreq_;
-                    }
-                    else {
-                        if (*maxStatsValue == 0) {
-                            *maxStatsValue = stats->txBytes > kMaxValue32 ?
-                                kMaxValue64 : kMaxValue32;
-                        }
-                        stats->txBps = ((*maxStatsValue - stats->txBytes)
-                                            + rtnlStats->tx_bytes)
-                                        / kRefreshFreq_;
-                    }
-
-                    stats->txPkts  = rtnlStats->tx_packets;
-                    stats->txBytes = rtnlStats->tx_bytes;
-
-                    // TODO: export detailed error stats
-                    stats->rxDrops =   rtnlStats->rx_dropped 
-                                     + rtnlStats->rx_missed_errors;
-                    stats->rxErrors = rtnlStats->rx_errors;
-                    stats->rxFifoErrors = rtnlStats->rx_fifo_errors;
-                    stats->rxFrameErrors =   rtnlStats->rx_crc_errors
-                                           + rtnlStats->rx_length_errors
-                                           + rtnlStats->rx_over_errors
-                                           + rtnlStats->rx_frame_errors;
+                    updatePortStats(port, (x_rtnl_link_stats*) RTA_DATA(rta));
 
                     Q_ASSERT(state);  
                     *state = ifi->ifi_flags & IFF_RUNNING ?
@@ -755,67 +1122,2191 @@ _retry_recv:
         if (!done)
             goto _retry_recv;
 
+_rate_control:
+        if (isFullRefresh)
+        {
+            for (int i = 0; i < allPorts_.size(); i++) {
+                updateNicCounters(allPorts_.at(i));
+                allPorts_.at(i)->updateRateControl();
+            }
+        }
+
 _try_later:
-        QThread::sleep(kRefreshFreq_);
+        QThread::msleep(interval);
     }
 
-    portStats.clear();
+    if (eventFd >= 0)
+        close(eventFd);
+    ports.clear();
     linkState.clear();
 
     return 0;
 }
 
-int LinuxPort::StatsMonitor::setPromisc(const char * portName)
-{ 
+/*!
+  Gets the names of the port's NIC driver counters (ethtool -S) - a port
+  whose driver has none is not sampled
+*/
+void LinuxPort::StatsMonitor::setupNicCounters(LinuxPort *port)
+{
     struct ifreq ifr;
+    struct ethtool_drvinfo drvInfo;
+    struct ethtool_gstrings *strings;
+    QByteArray buf;
+
+    port->nicCounterNames_.clear();
 
     memset(&ifr, 0, sizeof(ifr));
-    strncpy(ifr.ifr_name, portName, sizeof(ifr.ifr_name));
+    strncpy(ifr.ifr_name, port->name(), sizeof(ifr.ifr_name) - 1);
 
-    if (ioctl(ioctlSocket_, SIOCGIFFLAGS, &ifr) != -1)
+    memset(&drvInfo, 0, sizeof(drvInfo));
+    drvInfo.cmd = ETHTOOL_GDRVINFO;
+    ifr.ifr_data = (char*) &drvInfo;
+    if ((ioctl(ioctlSocket_, SIOCETHTOOL, &ifr) < 0) || !drvInfo.n_stats)
+        return;
+
+    buf.fill('\0', sizeof(*strings) + drvInfo.n_stats*ETH_GSTRING_LEN);
+    strings = (struct ethtool_gstrings*) buf.data();
+    strings->cmd = ETHTOOL_GSTRINGS;
+    strings->string_set = ETH_SS_STATS;
+    strings->len = drvInfo.n_stats;
+    ifr.ifr_data = (char*) strings;
+    if (ioctl(ioctlSocket_, SIOCETHTOOL, &ifr) < 0)
     {
-        if ((ifr.ifr_flags & IFF_PROMISC) == 0)
-        {
-            ifr.ifr_flags |= IFF_PROMISC;
-            if (ioctl(ioctlSocket_, SIOCSIFFLAGS, &ifr) != -1)
-            {
-                return 1;
-            }
-            else
-            {
-                qDebug("%s: failed to set promisc; "
-                        "SIOCSIFFLAGS failed (%s)", 
-                        portName, strerror(errno));
-            }
-        }
+        qWarning("%s: unable to get NIC counter names (errno %d)",
+                port->name(), errno);
+        return;
     }
-    else
+
+    for (uint i = 0; i < strings->len; i++)
     {
-        qDebug("%s: failed to set promisc; SIOCGIFFLAGS failed (%s)",
-                portName, strerror(errno));
+        const char *name = (const char*) strings->data + i*ETH_GSTRING_LEN;
+        port->nicCounterNames_.append(QString::fromLatin1(name,
+                    qstrnlen(name, ETH_GSTRING_LEN)));
     }
+    qDebug("%s: %d NIC counters", port->name(),
+            port->nicCounterNames_.size());
+}
 
-    return 0;
+/*!
+  Samples the NIC driver's counters (ethtool -S) of the port
+*/
+void LinuxPort::StatsMonitor::updateNicCounters(LinuxPort *port)
+{
+    int count = port->nicCounterNames_.size();
+    struct ifreq ifr;
+    struct ethtool_stats *stats;
+    QByteArray buf;
+    QList<quint64> values;
+
+    if (!count)
+        return;
+
+    buf.fill('\0', sizeof(*stats) + count*sizeof(quint64));
+    stats = (struct ethtool_stats*) buf.data();
+    stats->cmd = ETHTOOL_GSTATS;
+    stats->n_stats = count;
+
+    memset(&ifr, 0, sizeof(ifr));
+    strncpy(ifr.ifr_name, port->name(), sizeof(ifr.ifr_name) - 1);
+    ifr.ifr_data = (char*) stats;
+
+    if (ioctl(ioctlSocket_, SIOCETHTOOL, &ifr) < 0)
+    {
+        qWarning("%s: unable to get NIC counters (errno %d) - not sampling "
+                "them any more", port->name(), errno);
+        port->nicCounterNames_.clear();
+        return;
+    }
+
+    // The counters change with the queues (ethtool -L) - sample the new
+    // ones from the next time
+    if (stats->n_stats != uint(count))
+    {
+        setupNicCounters(port);
+        return;
+    }
+
+    values.reserve(count);
+    for (int i = 0; i < count; i++)
+        values.append(stats->data[i]);
+
+    port->setNicCounters(port->nicCounterNames_, values);
 }
 
-void LinuxPort::StatsMonitor::stop()
+/*!
+  Updates the port's stats (and rates) from the kernel's counters
+*/
+void LinuxPort::StatsMonitor::updatePortStats(LinuxPort *port,
+        const void *linkStats)
 {
-    stop_ = true;
+    const x_rtnl_link_stats *rtnlStats = (const x_rtnl_link_stats*) linkStats;
+    AbstractPort::PortStats *stats = &port->stats_;
+    quint64 *maxStatsValue = &port->maxStatsValue_;
+    quint64 rxPkts, rxBytes, txPkts, txBytes;
+
+    if (rtnlStats->rx_packets >= stats->rxPkts) {
+        rxPkts = rtnlStats->rx_packets - stats->rxPkts;
+    }
+    else {
+        if (*maxStatsValue == 0) {
+            *maxStatsValue = stats->rxPkts > kMaxValue32 ?
+                kMaxValue64 : kMaxValue32;
+        }
+        rxPkts = (*maxStatsValue - stats->rxPkts)
+                            + rtnlStats->rx_packets;
+    }
+
+    if (rtnlStats->rx_bytes >= stats->rxBytes) {
+        rxBytes = rtnlStats->rx_bytes - stats->rxBytes;
+    }
+    else {
+        if (*maxStatsValue == 0) {
+            *maxStatsValue = stats->rxBytes > kMaxValue32 ?
+                kMaxValue64 : kMaxValue32;
+        }
+        rxBytes = (*maxStatsValue - stats->rxBytes)
+                            + rtnlStats->rx_bytes;
+    }
+
+    stats->rxLock.writeBegin();
+    stats->rxPkts  = rtnlStats->rx_packets;
+    stats->rxBytes = rtnlStats->rx_bytes;
+    stats->rxLock.writeEnd();
+
+    if (rtnlStats->tx_packets >= stats->txPkts) {
+        txPkts = rtnlStats->tx_packets - stats->txPkts;
+    }
+    else {
+        if (*maxStatsValue == 0) {
+            *maxStatsValue = stats->txPkts > kMaxValue32 ?
+                kMaxValue64 : kMaxValue32;
+        }
+        txPkts = (*maxStatsValue - stats->txPkts)
+                            + rtnlStats->tx_packets;
+    }
+
+    if (rtnlStats->tx_bytes >= stats->txBytes) {
+        txBytes = rtnlStats->tx_bytes - stats->txBytes;
+    }
+    else {
+        if (*maxStatsValue == 0) {
+            *maxStatsValue = stats->txBytes > kMaxValue32 ?
+                kMaxValue64 : kMaxValue32;
+        }
+        txBytes = (*maxStatsValue - stats->txBytes)
+                            + rtnlStats->tx_bytes;
+    }
+
+    stats->txLock.writeBegin();
+    stats->txPkts  = rtnlStats->tx_packets;
+    stats->txBytes = rtnlStats->tx_bytes;
+    stats->txLock.writeEnd();
+
+    port->updateRates(rxPkts, rxBytes, txPkts, txBytes);
+
+    // TODO: export detailed error stats
+    stats->rxLock.writeBegin();
+    stats->rxDrops =   rtnlStats->rx_dropped 
+                     + rtnlStats->rx_missed_errors;
+    stats->rxErrors = rtnlStats->rx_errors;
+    stats->rxFifoErrors = rtnlStats->rx_fifo_errors;
+    stats->rxFrameErrors =   rtnlStats->rx_crc_errors
+                           + rtnlStats->rx_length_errors
+                           + rtnlStats->rx_over_errors
+                           + rtnlStats->rx_frame_errors;
+    stats->rxLock.writeEnd();
 }
 
-bool LinuxPort::StatsMonitor::waitForSetupFinished(int msecs)
+// A port with traffic has its stats refreshed more often than the others
+bool LinuxPort::StatsMonitor::isActivePort(LinuxPort *port)
 {
-    QTime t;
+    return port->isTransmitOn() || port->stats_.rxPps || port->stats_.txPps;
+}
 
-    t.start();
-    while (!setupDone_)
+bool LinuxPort::StatsMonitor::hasActivePort(const QList<LinuxPort*> &ports)
+{
+    foreach(LinuxPort *port, ports)
     {
-        if (t.elapsed() > msecs)
-            return false;
+        if (isActivePort(port))
+            return true;
+    }
+    return false;
+}
 
-        QThread::msleep(10);
+#ifdef HAVE_RTM_GETSTATS
+/*!
+  Opens a (non blocking) netlink socket subscribed to the kernel's link
+  notifications - for the link state when we don't dump the links
+*/
+int LinuxPort::StatsMonitor::openLinkEvents()
+{
+    struct sockaddr_nl local;
+    int fd;
+
+    fd = socket(AF_NETLINK, SOCK_RAW | SOCK_NONBLOCK, NETLINK_ROUTE);
+    if (fd < 0)
+    {
+        qWarning("Unable to open netlink socket (errno %d)", errno);
+        return -1;
     }
 
-    return true;
+    memset(&local, 0, sizeof(local));
+    local.nl_family = AF_NETLINK;
+    local.nl_groups = RTMGRP_LINK;
+
+    if (bind(fd, (struct sockaddr*) &local, sizeof(local)) < 0)
+    {
+        qWarning("Unable to bind netlink socket (errno %d)", errno);
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+/*!
+  Updates the link state of our ports from the link notifications
+  received since the last call
+
+  Returns false if some notifications were lost (socket overrun)
+*/
+bool LinuxPort::StatsMonitor::processLinkEvents(int fd,
+        const QHash<uint, LinuxPort*> &ports)
+{
+    char buf[8192];
+    int len;
+
+    while ((len = recv(fd, buf, sizeof(buf), 0)) > 0)
+    {
+        struct nlmsghdr *nlm = (struct nlmsghdr*) buf;
+
+        while (NLMSG_OK(nlm, (uint)len))
+        {
+            if ((nlm->nlmsg_type == RTM_NEWLINK)
+                    || (nlm->nlmsg_type == RTM_DELLINK))
+            {
+                struct ifinfomsg *ifi = (struct ifinfomsg*) NLMSG_DATA(nlm);
+                LinuxPort *port = ports.value(uint(ifi->ifi_index));
+
+                if (port)
+                    port->linkState_ = (nlm->nlmsg_type == RTM_NEWLINK)
+                                    && (ifi->ifi_flags & IFF_RUNNING) ?
+                            OstProto::LinkStateUp : OstProto::LinkStateDown;
+            }
+            nlm = NLMSG_NEXT(nlm, len);
+        }
+    }
+
+    if ((len < 0) && (errno == ENOBUFS))
+    {
+        qWarning("netlink link notifications overrun");
+        return false;
+    }
+
+    return true;
+}
+
+/*!
+  Gets the 64-bit stats of just the one interface (instead of dumping
+  all interfaces) and updates the port's stats
+
+  Returns -1 if the kernel doesn't support RTM_GETSTATS
+*/
+int LinuxPort::StatsMonitor::linkStats(int fd, uint ifIndex, LinuxPort *port)
+{
+    struct {
+        struct nlmsghdr nlh;
+        struct if_stats_msg ifsm;
+    } req;
+    char buf[1024];
+    struct nlmsghdr *nlm = (struct nlmsghdr*) buf;
+    int len;
+
+    memset(&req, 0, sizeof(req));
+    req.nlh.nlmsg_len = sizeof(req);
+    req.nlh.nlmsg_type = RTM_GETSTATS;
+    req.nlh.nlmsg_flags = NLM_F_REQUEST;
+    req.ifsm.family = AF_UNSPEC;
+    req.ifsm.ifindex = ifIndex;
+    req.ifsm.filter_mask = IFLA_STATS_FILTER_BIT(IFLA_STATS_LINK_64);
+
+    if (send(fd, (void*)&req, sizeof(req), 0) < 0)
+    {
+        qWarning("Unable to send GETSTATS request (errno %d)", errno);
+        return -1;
+    }
+
+    do {
+        len = recv(fd, buf, sizeof(buf), 0);
+    } while ((len < 0) && (errno == EINTR));
+
+    if ((len < 0) || !NLMSG_OK(nlm, (uint)len))
+        return -1;
+
+    if (nlm->nlmsg_type == NLMSG_ERROR)
+    {
+        struct nlmsgerr *err = (struct nlmsgerr*) NLMSG_DATA(nlm);
+        qDebug("RTNETLINK error: %s", strerror(-err->error));
+
+        // Interface is gone - it's not the kernel lacking support
+        return err->error == -ENODEV ? 0 : -1;
+    }
+
+    if (nlm->nlmsg_type == RTM_NEWSTATS)
+    {
+        struct rtattr *rta = (struct rtattr*) ((char*)NLMSG_DATA(nlm)
+                                + NLMSG_ALIGN(sizeof(struct if_stats_msg)));
+        int rtaLen = nlm->nlmsg_len
+                        - NLMSG_LENGTH(sizeof(struct if_stats_msg));
+
+        while (RTA_OK(rta, rtaLen))
+        {
+            if (rta->rta_type == IFLA_STATS_LINK_64)
+            {
+                updatePortStats(port, RTA_DATA(rta));
+                break;
+            }
+            rta = RTA_NEXT(rta, rtaLen);
+        }
+    }
+
+    return 0;
+}
+#endif
+
+int LinuxPort::StatsMonitor::setPromisc(const char * portName)
+{ 
+    struct ifreq ifr;
+
+    memset(&ifr, 0, sizeof(ifr));
+    strncpy(ifr.ifr_name, portName, sizeof(ifr.ifr_name));
+
+    if (ioctl(ioctlSocket_, SIOCGIFFLAGS, &ifr) != -1)
+    {
+        if ((ifr.ifr_flags & IFF_PROMISC) == 0)
+        {
+            ifr.ifr_flags |= IFF_PROMISC;
+            if (ioctl(ioctlSocket_, SIOCSIFFLAGS, &ifr) != -1)
+            {
+                return 1;
+            }
+            else
+            {
+                qDebug("%s: failed to set promisc; "
+                        "SIOCSIFFLAGS failed (%s)", 
+                        portName, strerror(errno));
+            }
+        }
+    }
+    else
+    {
+        qDebug("%s: failed to set promisc; SIOCGIFFLAGS failed (%s)",
+                portName, strerror(errno));
+    }
+
+    return 0;
+}
+
+void LinuxPort::StatsMonitor::stop()
+{
+    stop_ = true;
+}
+
+bool LinuxPort::StatsMonitor::waitForSetupFinished(int msecs)
+{
+    QTime t;
+
+    t.start();
+    while (!setupDone_)
+    {
+        if (t.elapsed() > msecs)
+            return false;
+
+        QThread::msleep(10);
+    }
+
+    return true;
+}
+
+/*
+  Opens a packet socket bound to device with a TPACKET_V3 PACKET_RX_RING
+  of blockCount blocks mmap'd at *ring; the retire timeout (ms) is the max
+  time the kernel holds a partly filled block. The filter, if any, is
+  attached before any frame is received
+
+  Returns the socket or -1 on error
+*/
+static int openRxRing(const char *device, int blockSize, int blockCount,
+        int frameSize, int blockTimeout, const struct sock_fprog *filter,
+        uchar **ring)
+{
+    struct tpacket_req3 req;
+    struct sockaddr_ll addr;
+    int version = TPACKET_V3;
+    int ifIndex;
+    int fd;
+    uint size = blockSize * blockCount;
+    void *mem;
+
+    ifIndex = if_nametoindex(device);
+    if (!ifIndex) {
+        qDebug("%s: unable to get ifIndex (%s)", device, strerror(errno));
+        return -1;
+    }
+
+    // No protocol till bind() - else the socket receives the frames of
+    // all interfaces (unfiltered) until then
+    fd = socket(AF_PACKET, SOCK_RAW, 0);
+    if (fd < 0) {
+        qDebug("%s: unable to open packet socket (%s)", device,
+                strerror(errno));
+        return -1;
+    }
+
+    if (setsockopt(fd, SOL_PACKET, PACKET_VERSION,
+                &version, sizeof(version)) < 0) {
+        qDebug("%s: unable to set TPACKET_V3 (%s)", device, strerror(errno));
+        goto _error;
+    }
+
+    if (filter && (setsockopt(fd, SOL_SOCKET, SO_ATTACH_FILTER,
+                        filter, sizeof(*filter)) < 0)) {
+        qDebug("%s: unable to set filter (%s)", device, strerror(errno));
+        goto _error;
+    }
+
+    memset(&req, 0, sizeof(req));
+    req.tp_block_size = blockSize;
+    req.tp_block_nr = blockCount;
+    req.tp_frame_size = frameSize;
+    req.tp_frame_nr = (blockSize/frameSize) * blockCount;
+    req.tp_retire_blk_tov = blockTimeout;
+
+    if (setsockopt(fd, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)) < 0) {
+        qDebug("%s: unable to setup PACKET_RX_RING (%s)", device,
+                strerror(errno));
+        goto _error;
+    }
+
+    mem = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_LOCKED, fd, 0);
+    if (mem == MAP_FAILED) // MAP_LOCKED may fail due to RLIMIT_MEMLOCK
+        mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (mem == MAP_FAILED) {
+        qDebug("%s: unable to mmap RX_RING (%s)", device, strerror(errno));
+        goto _error;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sll_family = AF_PACKET;
+    addr.sll_protocol = htons(ETH_P_ALL);
+    addr.sll_ifindex = ifIndex;
+
+    if (bind(fd, (struct sockaddr*) &addr, sizeof(addr)) < 0) {
+        qDebug("%s: unable to bind packet socket (%s)", device,
+                strerror(errno));
+        munmap(mem, size);
+        goto _error;
+    }
+
+    *ring = (uchar*) mem;
+    return fd;
+
+_error:
+    close(fd);
+    return -1;
+}
+
+/*
+ * ------------------------------------------------------------------- *
+ * Port Monitor
+ * ------------------------------------------------------------------- *
+ */
+/*
+  Looks at the frames via a PACKET_RX_RING (TPACKET_V3) instead of pcap -
+  the kernel fills whole blocks of frames and we wakeup once per block,
+  not per frame. If needFrames is false, only the frame lengths are needed
+  (for counters, if any) and a filter limits the snap length so that no
+  frame data is copied to the ring
+
+  The ring is serviced by the RxPoller of the NIC's NUMA node (shared with
+  the other ports on that node), not a thread of our own; the monitor's
+  thread placement applies only if the ring isn't polled
+
+  The ring is also the port's tap - capture and emulation subscribe() to
+  it with a filter of their own instead of opening a socket (and ring) each,
+  so that every frame is copied by the kernel once and looked at by all of
+  them in a single pass over the block. The kernel's filter is widened to
+  what the subscribers need (see kernelFilter())
+
+  Falls back to the pcap handle opened by PcapPort::PortMonitor if the
+  ring can't be setup - without a tap
+*/
+LinuxPort::PortMonitor::PortMonitor(const char *device, Direction direction,
+        AbstractPort::PortStats *stats, bool needFrames)
+    : PcapPort::PortMonitor(device, direction, stats)
+{
+    device_ = device;
+    needFrames_ = needFrames;
+    rxRingFd_ = -1;
+    rxRing_ = NULL;
+    rxRingSize_ = 0;
+    rxRingBlockIndex_ = 0;
+    numaNode_ = interfaceNumaNode(device);
+    poller_ = NULL;
+
+    if (!handle())
+        return;
+
+    if (!setupRxRing(device)) {
+        qWarning("%s: RX_RING not available, using pcap to receive", device);
+        return;
+    }
+
+    // Retain the pcap handle (for promisc mode and the NIC timestamping
+    // setup), but don't let it take any frames
+    struct bpf_insn dropAll = BPF_STMT(BPF_RET | BPF_K, 0);
+    struct bpf_program program = { 1, &dropAll };
+
+    if (pcap_setfilter(handle(), &program) < 0)
+        qDebug("%s: unable to set pcap drop filter (%s)", device,
+                pcap_geterr(handle()));
+}
+
+LinuxPort::PortMonitor::~PortMonitor()
+{
+    if (poller_)
+        poller_->remove(this);
+    if (rxRing_)
+        munmap(rxRing_, rxRingSize_);
+    if (rxRingFd_ >= 0)
+        close(rxRingFd_);
+    for (int i = 0; i < taps_.size(); i++)
+        pcap_freecode(&taps_[i].program);
+}
+
+bool LinuxPort::PortMonitor::setupRxRing(const char *device)
+{
+    int tstamp = SOF_TIMESTAMPING_RAW_HARDWARE;
+    struct sock_fprog program;
+
+    kernelFilter(&program);
+    rxRingSize_ = kRxRingBlockSize * kRxRingBlockCount;
+    rxRingFd_ = openRxRing(device, kRxRingBlockSize, kRxRingBlockCount,
+                    kRxRingFrameSize, kRxRingBlockTimeout,
+                    program.len ? &program : NULL, &rxRing_);
+    if (rxRingFd_ < 0)
+        return false;
+
+    // NIC timestamps, if the NIC has them enabled (the pcap handle asks
+    // for them); the kernel falls back to software timestamps otherwise
+    if (setsockopt(rxRingFd_, SOL_PACKET, PACKET_TIMESTAMP,
+                &tstamp, sizeof(tstamp)) < 0)
+        qDebug("%s: unable to set PACKET_TIMESTAMP (%s)", device,
+                strerror(errno));
+
+    qDebug("%s: RX_RING with %d blocks of %d bytes setup", device,
+            kRxRingBlockCount, kRxRingBlockSize);
+    return true;
+}
+
+/*
+  The ring's (kernel) filter - all frames if we need them ourselves or have
+  more than one subscriber, the single subscriber's filter if that's all
+  there is, else just the lengths (for counters) or nothing at all. An
+  empty program (len 0) => no filter. Caller must hold tapLock_ (or be the
+  constructor)
+
+  The subscribers' filters are run again on every frame (see tapFrame()),
+  so frames let in by a wider filter than needed are still sorted right
+*/
+void LinuxPort::PortMonitor::kernelFilter(struct sock_fprog *program)
+{
+    // A filter can't return a snap length of 0 - that drops the frame
+    static struct sock_filter snapOne = BPF_STMT(BPF_RET | BPF_K, 1);
+    static struct sock_filter dropAll = BPF_STMT(BPF_RET | BPF_K, 0);
+
+    program->len = 0;
+    program->filter = NULL;
+
+    if (needFrames_ || (taps_.size() > 1))
+        return;
+
+    if (taps_.size() == 1) {
+        // A bpf_insn is laid out the same as sock_filter
+        program->len = taps_.at(0).program.bf_len;
+        program->filter = (struct sock_filter*) taps_.at(0).program.bf_insns;
+        return;
+    }
+
+    program->len = 1;
+    program->filter = stats_ ? &snapOne : &dropAll;
+}
+
+// Caller must hold tapLock_
+void LinuxPort::PortMonitor::updateKernelFilter()
+{
+    struct sock_fprog program;
+
+    kernelFilter(&program);
+    if (!program.len) {
+        if ((setsockopt(rxRingFd_, SOL_SOCKET, SO_DETACH_FILTER, NULL, 0) < 0)
+                && (errno != ENOENT))
+            qDebug("%s: unable to remove filter (%s)", device_.constData(),
+                    strerror(errno));
+        return;
+    }
+
+    if (setsockopt(rxRingFd_, SOL_SOCKET, SO_ATTACH_FILTER,
+                &program, sizeof(program)) < 0)
+        qDebug("%s: unable to set filter (%s)", device_.constData(),
+                strerror(errno));
+}
+
+// Subscribers see the frames to other MACs too - the ring's socket is
+// promiscuous while there's any (membership is counted by the kernel)
+bool LinuxPort::PortMonitor::setPromisc(bool on)
+{
+    struct packet_mreq mreq;
+
+    memset(&mreq, 0, sizeof(mreq));
+    mreq.mr_ifindex = if_nametoindex(device_.constData());
+    mreq.mr_type = PACKET_MR_PROMISC;
+    if (setsockopt(rxRingFd_, SOL_PACKET,
+                on ? PACKET_ADD_MEMBERSHIP : PACKET_DROP_MEMBERSHIP,
+                &mreq, sizeof(mreq)) < 0) {
+        qDebug("%s: can't %s promiscuous mode (%s)", device_.constData(),
+                on ? "set" : "clear", strerror(errno));
+        return false;
+    }
+
+    return true;
+}
+
+// Thread in which the subscribers are called
+QThread* LinuxPort::PortMonitor::tapThread()
+{
+    if (poller_)
+        return poller_;
+    return this;
+}
+
+/*
+  Hands client (in the tap's thread) the frames that match filter - with
+  upto snapLen bytes of each - from the next block onwards
+
+  Returns false if we aren't a tap or the filter can't be compiled
+*/
+bool LinuxPort::PortMonitor::subscribe(TapClient *client,
+        const QString &filter, int snapLen, bpf_u_int32 netmask)
+{
+    QMutexLocker locker(&tapLock_);
+    Tap tap;
+
+    if (!rxRing_)
+        return false;
+
+    if (pcap_compile_nopcap(snapLen, DLT_EN10MB, &tap.program,
+                filter.toAscii().constData(), 1, netmask) < 0) {
+        qDebug("%s: can't compile BPF program: %s", device_.constData(),
+                filter.toAscii().constData());
+        return false;
+    }
+
+    if (!setPromisc(true)) {
+        pcap_freecode(&tap.program);
+        return false;
+    }
+
+    tap.client = client;
+    taps_.append(tap);
+    updateKernelFilter();
+
+    qDebug("%s: tap subscriber %p added (%d)", device_.constData(),
+            client, taps_.size());
+    return true;
+}
+
+/*
+  Once this returns, client isn't being called and won't be again
+*/
+void LinuxPort::PortMonitor::unsubscribe(TapClient *client)
+{
+    QMutexLocker locker(&tapLock_);
+
+    for (int i = 0; i < taps_.size(); i++) {
+        if (taps_.at(i).client != client)
+            continue;
+
+        pcap_freecode(&taps_[i].program);
+        taps_.removeAt(i);
+        setPromisc(false);
+        updateKernelFilter();
+
+        qDebug("%s: tap subscriber %p removed (%d)", device_.constData(),
+                client, taps_.size());
+        return;
+    }
+}
+
+void LinuxPort::PortMonitor::start()
+{
+    if (rxRing_) {
+        poller_ = RxPoller::instance(numaNode_);
+        if (poller_->add(this))
+            return;
+        poller_ = NULL;
+    }
+
+    QThread::start();
+}
+
+void LinuxPort::PortMonitor::run()
+{
+    if (!rxRing_) {
+        PcapPort::PortMonitor::run();
+        return;
+    }
+
+    ThreadPlacer::Scope placement(placer());
+    struct pollfd pfd;
+
+    pfd.fd = rxRingFd_;
+    pfd.events = POLLIN | POLLERR;
+    pfd.revents = 0;
+
+    while (!stop_)
+    {
+        // Timeout so that we see stop_ in reasonable time
+        if (poll(&pfd, 1, 100 /* ms */) > 0)
+            rxPollReady();
+    }
+}
+
+// Processes the ready blocks - at most a ring's worth, so that we don't
+// hog a poller shared with other ports
+void LinuxPort::PortMonitor::rxPollReady()
+{
+    for (int i = 0; i < kRxRingBlockCount; i++)
+    {
+        struct tpacket_block_desc *block = (struct tpacket_block_desc*)
+                (rxRing_ + rxRingBlockIndex_*kRxRingBlockSize);
+
+        if (!(block->hdr.bh1.block_status & TP_STATUS_USER))
+            break;
+
+        processRxRingBlock(block);
+
+        // Return the block to the kernel
+        __sync_synchronize();
+        block->hdr.bh1.block_status = TP_STATUS_KERNEL;
+        rxRingBlockIndex_ = (rxRingBlockIndex_ + 1) % kRxRingBlockCount;
+
+        // Kernel resets these on every read - so once per ring's worth
+        if (!rxRingBlockIndex_) {
+            struct tpacket_stats_v3 ringStats;
+            socklen_t len = sizeof(ringStats);
+
+            if (getsockopt(rxRingFd_, SOL_PACKET, PACKET_STATISTICS,
+                        &ringStats, &len) == 0)
+                metrics_.add(OstProto::DroneMetric::kRxDrops,
+                             ringStats.tp_drops);
+        }
+    }
+}
+
+void LinuxPort::PortMonitor::processRxRingBlock(
+        struct tpacket_block_desc *block)
+{
+    QMutexLocker locker(&tapLock_);
+    struct tpacket3_hdr *hdr = (struct tpacket3_hdr*)
+                ((uchar*)block + block->hdr.bh1.offset_to_first_pkt);
+    bool isRx = (direction() == kDirectionRx);
+    bool hasTaps = !taps_.isEmpty();
+
+    for (uint i = 0; i < block->hdr.bh1.num_pkts; i++)
+    {
+        const struct sockaddr_ll *sll = (const struct sockaddr_ll*)
+                ((uchar*)hdr + TPACKET_ALIGN(sizeof(struct tpacket3_hdr)));
+        bool isOutgoing = (sll->sll_pkttype == PACKET_OUTGOING);
+
+        if (isOutgoing != isRx) {
+            if (stats_) {
+                if (isRx) {
+                    stats_->rxLock.writeBegin();
+                    stats_->rxPkts++;
+                    stats_->rxBytes += hdr->tp_len;
+                    stats_->rxLock.writeEnd();
+                }
+                else {
+                    stats_->txLock.writeBegin();
+                    stats_->txPkts++;
+                    stats_->txBytes += hdr->tp_len;
+                    stats_->txLock.writeEnd();
+                }
+            }
+            if (isRx && streamStats_ && (hdr->tp_snaplen == hdr->tp_len)) {
+                quint64 nsec = quint64(hdr->tp_sec)*quint64(1e9)
+                                    + hdr->tp_nsec;
+
+                streamStats_->countRx((uchar*)hdr + hdr->tp_mac, hdr->tp_len,
+                        (hdr->tp_status & TP_STATUS_TS_RAW_HARDWARE) ?
+                            LatencyClock::fromNicTime(nsec) :
+                            LatencyClock::fromSystemTime(nsec));
+            }
+            if (isRx && reflector_ && (hdr->tp_snaplen == hdr->tp_len))
+                reflect((uchar*)hdr + hdr->tp_mac, hdr->tp_len);
+        }
+
+        if (hasTaps)
+            tapFrame(hdr, isOutgoing);
+
+        hdr = (struct tpacket3_hdr*)((uchar*)hdr + hdr->tp_next_offset);
+    }
+
+    for (int i = 0; i < taps_.size(); i++)
+        taps_.at(i).client->tapBlockDone();
+}
+
+// Hands the frame to the subscribers whose filter it matches; caller must
+// hold tapLock_
+void LinuxPort::PortMonitor::tapFrame(const struct tpacket3_hdr *hdr,
+        bool isOutgoing)
+{
+    const uchar *data = (const uchar*)hdr + hdr->tp_mac;
+    TapFrame frame;
+    bool isFrameSet = false;
+
+    for (int i = 0; i < taps_.size(); i++)
+    {
+        const Tap &tap = taps_.at(i);
+        // The filters see the frame as the kernel's did - without the tag
+        uint snapLen = bpf_filter(tap.program.bf_insns, data,
+                                  hdr->tp_len, hdr->tp_snaplen);
+
+        if (!snapLen)
+            continue;
+
+        if (!isFrameSet) {
+            frame.data = data;
+            frame.length = hdr->tp_snaplen;
+            frame.wireLength = hdr->tp_len;
+            frame.sec = hdr->tp_sec;
+            frame.nsec = hdr->tp_nsec;
+            frame.isOutgoing = isOutgoing;
+
+            // Put back the (outer) vlan tag, if the kernel had stripped it
+            if ((hdr->tp_status & TP_STATUS_VLAN_VALID)
+                    && (frame.length >= 12)
+                    && (frame.length <= kRxRingFrameSize)) {
+                quint16 tpid = 0x8100;
+#ifdef TP_STATUS_VLAN_TPID_VALID
+                if (hdr->tp_status & TP_STATUS_VLAN_TPID_VALID)
+                    tpid = hdr->hv1.tp_vlan_tpid;
+#endif
+                memcpy(tapFrame_, data, 12);
+                qToBigEndian<quint16>(tpid, tapFrame_ + 12);
+                qToBigEndian<quint16>(hdr->hv1.tp_vlan_tci, tapFrame_ + 14);
+                memcpy(tapFrame_ + 16, data + 12, frame.length - 12);
+                frame.data = tapFrame_;
+                frame.length += 4;
+                frame.wireLength += 4;
+            }
+            isFrameSet = true;
+        }
+
+        TapFrame snapped = frame;
+        snapped.length = qMin(frame.length, int(qMin(snapLen, 65535U)));
+        tap.client->tapFrame(snapped);
+    }
+}
+
+/*
+ * ------------------------------------------------------------------- *
+ * Port Capturer
+ * ------------------------------------------------------------------- *
+ */
+LinuxPort::PortCapturer::PortCapturer(const char *device)
+    : PcapPort::PortCapturer(device)
+{
+    tap_ = NULL;
+    isCompressed_ = false;
+}
+
+void LinuxPort::PortCapturer::run()
+{
+    // The RPCs don't look at the capture data till we are running
+    isCompressed_ = false;
+    compressedData_.close();
+
+    if (config_.is_high_rate() && ringCapture())
+        return;
+
+    if (config_.is_high_rate())
+        qWarning("%s: RX_RING capture not available, using pcap",
+                device_.toAscii().constData());
+    PcapPort::PortCapturer::run();
+}
+
+QIODevice* LinuxPort::PortCapturer::captureData()
+{
+    if (isCompressed_)
+        return &compressedData_;
+    return PcapPort::PortCapturer::captureData();
+}
+
+/*
+  High rate capture - the kernel fills a PACKET_RX_RING (TPACKET_V3) with
+  the filtered frames and we copy whole blocks of them (as pcap records)
+  into large buffers that writer_ writes to the capture file in its own
+  thread; if the disk can't keep up, the kernel drops frames when the
+  ring fills (the buffer_size of the capture config)
+
+  If the port has a tap, the frames are taken from it (in its thread)
+  instead of a ring of our own - the tap's ring size then applies, not
+  the buffer_size, and its drops are counted by the tap
+
+  Returns false if the capture couldn't be started
+*/
+bool LinuxPort::PortCapturer::ringCapture()
+{
+    ThreadPlacer::Scope placement(placer());
+    QByteArray device = device_.toAscii();
+    char errbuf[PCAP_ERRBUF_SIZE] = "";
+    bpf_u_int32 net, mask;
+    struct bpf_program fp;
+    struct sock_fprog program;
+    struct packet_mreq mreq;
+    struct pcap_file_header fileHdr;
+    struct tpacket_stats_v3 ringStats;
+    socklen_t len = sizeof(ringStats);
+    struct pollfd pfd;
+    int snapLen = int(qMax(1U, config_.snap_len()));
+    int blockCount = int(qMax(4U,
+                        config_.buffer_size()/(kRingBlockSize/1024)));
+    int blockIndex = 0;
+    uchar *ring = NULL;
+    int fd = -1;
+
+    if (!capFile_.isOpen())
+        return false;
+
+    if (pcap_lookupnet(device.constData(), &net, &mask, errbuf) == -1)
+        mask = 0;
+
+    if (CaptureRing::isRing(config_)) {
+        if (!ring_.open(config_, snapLen, capFile_.fileName(),
+                        config_.nsec_timestamps()))
+            return false;
+        goto _capture;
+    }
+
+    if (!writer_.open(capFile_.fileName(), config_.is_direct_io(),
+                      config_.is_compressed()))
+        return false;
+    if (config_.is_compressed()) {
+        if (!compressedData_.open(capFile_.fileName()))
+            goto _error;
+        isCompressed_ = true;
+    }
+
+    memset(&fileHdr, 0, sizeof(fileHdr));
+    fileHdr.magic = config_.nsec_timestamps() ? 0xa1b23c4d : 0xa1b2c3d4;
+    fileHdr.version_major = PCAP_VERSION_MAJOR;
+    fileHdr.version_minor = PCAP_VERSION_MINOR;
+    fileHdr.snaplen = snapLen;
+    fileHdr.linktype = DLT_EN10MB;
+    writer_.append(&fileHdr, sizeof(fileHdr));
+
+    if (CaptureDigest::isDigest(config_)
+            && !digest_.open(config_, capFile_.fileName()))
+        goto _error;
+
+_capture:
+    analytics_.reset(config_.nsec_timestamps());
+
+    if (tap_ && tap_->subscribe(this, filter_, snapLen, mask)) {
+        qDebug("%s: capture via the port's tap", device.constData());
+
+        state_.set(kRunning);
+        // Done => a triggered capture has its window
+        while (!stop_ && !ring_.isDone())
+            msleep(100);
+
+        tap_->unsubscribe(this);
+        goto _done;
+    }
+
+    // The capture filter with the snap length as its return value
+    if (pcap_compile_nopcap(snapLen, DLT_EN10MB, &fp,
+                filter_.toAscii().constData(), 1, mask) < 0) {
+        qDebug("%s: can't compile BPF program: %s", device.constData(),
+                filter_.toAscii().constData());
+        goto _error;
+    }
+    program.len = fp.bf_len;
+    program.filter = (struct sock_filter*) fp.bf_insns;
+
+    fd = openRxRing(device.constData(), kRingBlockSize, blockCount,
+            kRingFrameSize, kRingBlockTimeout, &program, &ring);
+    pcap_freecode(&fp);
+    if (fd < 0)
+        goto _error;
+
+    memset(&mreq, 0, sizeof(mreq));
+    mreq.mr_ifindex = if_nametoindex(device.constData());
+    mreq.mr_type = PACKET_MR_PROMISC;
+    if (setsockopt(fd, SOL_PACKET, PACKET_ADD_MEMBERSHIP,
+                &mreq, sizeof(mreq)) < 0)
+        qDebug("%s: can't set promiscuous mode (%s)", device.constData(),
+                strerror(errno));
+
+    // NIC timestamps, if the NIC has them enabled - like the PortMonitor's
+    if (config_.nsec_timestamps()) {
+        int tstamp = SOF_TIMESTAMPING_RAW_HARDWARE;
+
+        if (setsockopt(fd, SOL_PACKET, PACKET_TIMESTAMP,
+                    &tstamp, sizeof(tstamp)) < 0)
+            qDebug("%s: unable to set PACKET_TIMESTAMP (%s)",
+                    device.constData(), strerror(errno));
+    }
+
+    qDebug("%s: RX_RING capture with %d blocks of %d bytes", device.constData(),
+            blockCount, kRingBlockSize);
+
+    pfd.fd = fd;
+    pfd.events = POLLIN | POLLERR;
+    pfd.revents = 0;
+
+    state_.set(kRunning);
+    // Done => a triggered capture has its window
+    while (!stop_ && !ring_.isDone())
+    {
+        struct tpacket_block_desc *block = (struct tpacket_block_desc*)
+                (ring + blockIndex*kRingBlockSize);
+
+        if (!(block->hdr.bh1.block_status & TP_STATUS_USER)) {
+            poll(&pfd, 1, 100 /* ms */);
+            continue;
+        }
+
+        processRingBlock(block);
+
+        __sync_synchronize();
+        block->hdr.bh1.block_status = TP_STATUS_KERNEL;
+        blockIndex = (blockIndex + 1) % blockCount;
+    }
+
+    if (getsockopt(fd, SOL_PACKET, PACKET_STATISTICS, &ringStats, &len) == 0) {
+        qDebug("%s: captured %u frames, dropped %u", device.constData(),
+                ringStats.tp_packets - ringStats.tp_drops, ringStats.tp_drops);
+        metrics_.add(OstProto::DroneMetric::kRxDrops, ringStats.tp_drops);
+    }
+    munmap(ring, kRingBlockSize*blockCount);
+    close(fd);
+
+_done:
+    digest_.close();
+    if (!ring_.isOpen())
+        writer_.close();
+    stop_ = false;
+    state_.set(kFinished);
+    return true;
+
+_error:
+    digest_.close();
+    if (ring_.isOpen())
+        ring_.close();
+    else
+        writer_.close();
+    if (isCompressed_) {
+        compressedData_.close();
+        isCompressed_ = false;
+    }
+    return false;
+}
+
+void LinuxPort::PortCapturer::processRingBlock(
+        struct tpacket_block_desc *block)
+{
+    struct tpacket3_hdr *hdr = (struct tpacket3_hdr*)
+                ((uchar*)block + block->hdr.bh1.offset_to_first_pkt);
+
+    for (uint i = 0; i < block->hdr.bh1.num_pkts; i++)
+    {
+        captureFrame(hdr->tp_sec, hdr->tp_nsec, (uchar*)hdr + hdr->tp_mac,
+                     hdr->tp_snaplen, hdr->tp_len);
+        hdr = (struct tpacket3_hdr*)((uchar*)hdr + hdr->tp_next_offset);
+    }
+
+    if (digest_.isOpen())
+        digest_.flush();
+}
+
+void LinuxPort::PortCapturer::tapFrame(const PortMonitor::TapFrame &frame)
+{
+    captureFrame(frame.sec, frame.nsec, frame.data, frame.length,
+                 frame.wireLength);
+}
+
+void LinuxPort::PortCapturer::tapBlockDone()
+{
+    if (digest_.isOpen())
+        digest_.flush();
+}
+
+// Adds a frame (as a pcap record) to the capture - if it passes the
+// signature filter
+void LinuxPort::PortCapturer::captureFrame(quint32 sec, quint32 nsec,
+        const uchar *data, int length, int wireLength)
+{
+    uint fracDivisor = config_.nsec_timestamps() ? 1 : 1000;
+
+    if (sigFilter_.isOpen() && !sigFilter_.match(data, wireLength, length))
+        return;
+
+    analytics_.add(quint64(sec)*1000000000 + nsec, wireLength, data, length);
+
+    if (ring_.isOpen()) {
+        struct pcap_pkthdr pktHdr;
+
+        pktHdr.ts.tv_sec = sec;
+        pktHdr.ts.tv_usec = nsec/fracDivisor;
+        pktHdr.caplen = length;
+        pktHdr.len = wireLength;
+        ring_.append(&pktHdr, data);
+    }
+    else {
+        // pcap file record header - with 32 bit timestamps
+        quint32 rec[4];
+
+        rec[0] = sec;
+        rec[1] = nsec/fracDivisor;
+        rec[2] = digest_.isOpen() ? digest_.append(data, length) : length;
+        rec[3] = wireLength;
+        writer_.append(rec, sizeof(rec));
+        writer_.append(data, rec[2]);
+    }
+}
+
+/*!
+  Opens fileName (truncating it) and starts the writer thread; if
+  isCompressed, each buffer is written as a block of a compressed capture
+  file (see CompressedCaptureFile) - not aligned, so not with O_DIRECT
+*/
+bool LinuxPort::PortCapturer::Writer::open(const QString &fileName,
+        bool isDirectIo, bool isCompressed)
+{
+    QByteArray name = fileName.toLocal8Bit();
+
+    // Buffers are allocated once and kept for later captures
+    while (free_.size() < kBufferCount) {
+        void *p;
+
+        // Aligned for O_DIRECT
+        if (posix_memalign(&p, 4096, kBufferSize)) {
+            qWarning("unable to allocate capture buffers");
+            return false;
+        }
+        free_.append((uchar*) p);
+    }
+
+    fd_ = -1;
+    isCompressed_ = isCompressed;
+    if (isDirectIo && !isCompressed) {
+        fd_ = ::open(name.constData(), O_WRONLY | O_TRUNC | O_DIRECT);
+        if (fd_ < 0) // e.g. tmpfs doesn't support O_DIRECT
+            qDebug("can't open %s with O_DIRECT (%s)", name.constData(),
+                    strerror(errno));
+    }
+    isDirectIo_ = (fd_ >= 0);
+    if (fd_ < 0)
+        fd_ = ::open(name.constData(), O_WRONLY | O_TRUNC);
+    if (fd_ < 0) {
+        qWarning("unable to open %s (%s)", name.constData(), strerror(errno));
+        return false;
+    }
+
+    stop_ = false;
+    QThread::start();
+    return true;
+}
+
+/*!
+  Appends data to the capture file - waits for the writer if all buffers
+  are waiting to be written
+*/
+void LinuxPort::PortCapturer::Writer::append(const void *data, int length)
+{
+    const uchar *p = (const uchar*) data;
+
+    while (length > 0)
+    {
+        int n;
+
+        if (!buffer_) {
+            buffer_ = freeBuffer();
+            bufferLength_ = 0;
+        }
+
+        n = qMin(length, kBufferSize - bufferLength_);
+        memcpy(buffer_ + bufferLength_, p, n);
+        bufferLength_ += n;
+        p += n;
+        length -= n;
+
+        // Only full buffers are written till close()
+        if (bufferLength_ == kBufferSize) {
+            QMutexLocker locker(&lock_);
+
+            full_.append(buffer_);
+            buffer_ = NULL;
+            changed_.wakeAll();
+        }
+    }
+}
+
+/*!
+  Writes out everything appended and stops the writer thread
+*/
+void LinuxPort::PortCapturer::Writer::close()
+{
+    lock_.lock();
+    tail_ = buffer_;
+    tailLength_ = bufferLength_;
+    buffer_ = NULL;
+    stop_ = true;
+    changed_.wakeAll();
+    lock_.unlock();
+
+    QThread::wait();
+
+    ::close(fd_);
+    fd_ = -1;
+}
+
+void LinuxPort::PortCapturer::Writer::run()
+{
+    forever {
+        uchar *buffer;
+
+        lock_.lock();
+        while (full_.isEmpty() && !stop_)
+            changed_.wait(&lock_);
+        if (full_.isEmpty()) {
+            lock_.unlock();
+            break;
+        }
+        buffer = full_.takeFirst();
+        lock_.unlock();
+
+        if (!write(buffer, kBufferSize))
+            qWarning("capture file write failed (%s)", strerror(errno));
+
+        lock_.lock();
+        free_.append(buffer);
+        changed_.wakeAll();
+        lock_.unlock();
+    }
+
+    if (tail_) {
+        // The tail is not a multiple of the O_DIRECT block size
+        if (isDirectIo_)
+            fcntl(fd_, F_SETFL, fcntl(fd_, F_GETFL) & ~O_DIRECT);
+        if (tailLength_ && !write(tail_, tailLength_))
+            qWarning("capture file write failed (%s)", strerror(errno));
+
+        lock_.lock();
+        free_.append(tail_);
+        tail_ = NULL;
+        lock_.unlock();
+    }
+}
+
+// Writes a buffer of capture data - as is or as a compressed block
+bool LinuxPort::PortCapturer::Writer::write(const uchar *buffer, int length)
+{
+    if (isCompressed_) {
+        QByteArray block = CompressedCaptureFile::compress(buffer, length);
+
+        return ::write(fd_, block.constData(), block.size()) == block.size();
+    }
+
+    return ::write(fd_, buffer, length) == length;
+}
+
+uchar* LinuxPort::PortCapturer::Writer::freeBuffer()
+{
+    QMutexLocker locker(&lock_);
+
+    while (free_.isEmpty())
+        changed_.wait(&lock_);
+    return free_.takeFirst();
+}
+
+/*
+ * ------------------------------------------------------------------- *
+ * Port Transmitter
+ * ------------------------------------------------------------------- *
+ */
+LinuxPort::PortTransmitter::PortTransmitter(const char *device)
+    : PcapPort::PortTransmitter(device)
+{
+    txRingFd_ = -1;
+    txRing_ = NULL;
+    txRingSize_ = 0;
+    txRingFrameCount_ = 0;
+    txRingIndex_ = 0;
+    txRingMaxPktLen_ = 0;
+    pendingPkts_ = 0;
+    pendingBytes_ = 0;
+
+    // Setup on the first transmit, like the pcap handle - see open()
+    QString engine = appSettings->value(kTxEngineKey,
+                                        kTxEngineDefaultValue).toString();
+
+    useTxRing_ = engine.compare("Pcap", Qt::CaseInsensitive)
+                    && engine.compare("Sendmmsg", Qt::CaseInsensitive);
+    if (!useTxRing_)
+        qWarning("%s: TX_RING not used - TxEngine is %s", device,
+                qPrintable(engine));
+
+    // Also setup with the TX_RING - see enableHwTxTimestamps()
+    useHwTxTimestamps_ = appSettings->value(kHwTxTimestampsKey,
+                            kHwTxTimestampsDefaultValue).toBool();
+}
+
+LinuxPort::PortTransmitter::~PortTransmitter()
+{
+    if (txRing_)
+        munmap(txRing_, txRingSize_);
+    if (txRingFd_ >= 0)
+        close(txRingFd_);
+}
+
+bool LinuxPort::PortTransmitter::open()
+{
+    bool isOpen = PcapPort::PortTransmitter::open();
+
+    // Tried only once - we don't retry (and warn) on every transmit
+    if (useTxRing_) {
+        useTxRing_ = false;
+        if (!setupTxRing(deviceName_.constData()))
+            qWarning("%s: TX_RING not available, using pcap to transmit",
+                    deviceName_.constData());
+    }
+
+    return isOpen;
+}
+
+bool LinuxPort::PortTransmitter::setupTxRing(const char *device)
+{
+    struct tpacket_req req;
+    struct sockaddr_ll addr;
+    int version = TPACKET_V2;
+    int discard = 1;
+    int ifIndex;
+    void *ring;
+
+    ifIndex = if_nametoindex(device);
+    if (!ifIndex) {
+        qDebug("%s: unable to get ifIndex (%s)", device, strerror(errno));
+        return false;
+    }
+
+    // Protocol is 0 - this socket is used only for Tx, never for Rx
+    txRingFd_ = socket(AF_PACKET, SOCK_RAW, 0);
+    if (txRingFd_ < 0) {
+        qDebug("%s: unable to open packet socket (%s)", device,
+                strerror(errno));
+        return false;
+    }
+
+    if (setsockopt(txRingFd_, SOL_PACKET, PACKET_VERSION,
+                &version, sizeof(version)) < 0) {
+        qDebug("%s: unable to set TPACKET_V2 (%s)", device, strerror(errno));
+        goto _error;
+    }
+
+    // Drop malformed frames instead of blocking the ring forever
+    if (setsockopt(txRingFd_, SOL_PACKET, PACKET_LOSS,
+                &discard, sizeof(discard)) < 0)
+        qDebug("%s: unable to set PACKET_LOSS (%s)", device, strerror(errno));
+
+#ifdef PACKET_QDISC_BYPASS
+    // Opt-in - the bypass also skips the taps, so a capture on the port
+    // wouldn't see the frames we send
+    if (appSettings->value(kTxQdiscBypassKey,
+                kTxQdiscBypassDefaultValue).toBool()) {
+        int bypass = 1;
+
+        // Not fatal - available only on kernel 3.14+
+        if (setsockopt(txRingFd_, SOL_PACKET, PACKET_QDISC_BYPASS,
+                    &bypass, sizeof(bypass)) < 0)
+            qDebug("%s: unable to set PACKET_QDISC_BYPASS (%s)", device,
+                    strerror(errno));
+    }
+#endif
+
+    memset(&req, 0, sizeof(req));
+    req.tp_block_size = kTxRingBlockSize;
+    req.tp_block_nr = kTxRingBlockCount;
+    req.tp_frame_size = kTxRingFrameSize;
+    req.tp_frame_nr = (kTxRingBlockSize/kTxRingFrameSize) * kTxRingBlockCount;
+
+    if (setsockopt(txRingFd_, SOL_PACKET, PACKET_TX_RING,
+                &req, sizeof(req)) < 0) {
+        qDebug("%s: unable to setup PACKET_TX_RING (%s)", device,
+                strerror(errno));
+        goto _error;
+    }
+
+    txRingSize_ = req.tp_block_size * req.tp_block_nr;
+    txRingFrameCount_ = req.tp_frame_nr;
+    txRingMaxPktLen_ = kTxRingFrameSize
+                        - TPACKET_ALIGN(sizeof(struct tpacket2_hdr));
+
+    ring = mmap(NULL, txRingSize_, PROT_READ | PROT_WRITE, MAP_SHARED,
+                txRingFd_, 0);
+    if (ring == MAP_FAILED) {
+        qDebug("%s: unable to mmap TX_RING (%s)", device, strerror(errno));
+        goto _error;
+    }
+    txRing_ = (uchar*) ring;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sll_family = AF_PACKET;
+    addr.sll_protocol = 0;
+    addr.sll_ifindex = ifIndex;
+
+    if (bind(txRingFd_, (struct sockaddr*) &addr, sizeof(addr)) < 0) {
+        qDebug("%s: unable to bind packet socket (%s)", device,
+                strerror(errno));
+        goto _error;
+    }
+
+    qDebug("%s: TX_RING with %u frames of %d bytes setup", device,
+            txRingFrameCount_, kTxRingFrameSize);
+
+    if (useHwTxTimestamps_ && !enableHwTxTimestamps(device)) {
+        qWarning("%s: NIC tx timestamps not available, latency is from "
+                 "the signature tx time", device);
+        useHwTxTimestamps_ = false;
+    }
+    return true;
+
+_error:
+    if (txRing_)
+        munmap(txRing_, txRingSize_);
+    txRing_ = NULL;
+    close(txRingFd_);
+    txRingFd_ = -1;
+    return false;
+}
+
+/*
+  Asks the NIC to timestamp the frames it sends and the kernel to return
+  each timestamp with a copy of its frame on the TX_RING socket's error
+  queue - see readTxTimestamps(); the NIC's rx timestamping config (that
+  pcap may have enabled) is retained
+*/
+bool LinuxPort::PortTransmitter::enableHwTxTimestamps(const char *device)
+{
+    struct ifreq ifr;
+    struct hwtstamp_config config;
+    int flags = SOF_TIMESTAMPING_TX_HARDWARE | SOF_TIMESTAMPING_RAW_HARDWARE;
+
+    memset(&ifr, 0, sizeof(ifr));
+    strncpy(ifr.ifr_name, device, sizeof(ifr.ifr_name) - 1);
+    memset(&config, 0, sizeof(config));
+    ifr.ifr_data = (char*) &config;
+
+#ifdef SIOCGHWTSTAMP
+    if (ioctl(txRingFd_, SIOCGHWTSTAMP, &ifr) < 0)
+#endif
+        config.rx_filter = HWTSTAMP_FILTER_ALL;
+
+    config.tx_type = HWTSTAMP_TX_ON;
+    if (ioctl(txRingFd_, SIOCSHWTSTAMP, &ifr) < 0) {
+        qDebug("%s: unable to enable NIC tx timestamps (%s)", device,
+                strerror(errno));
+        return false;
+    }
+
+    if (setsockopt(txRingFd_, SOL_SOCKET, SO_TIMESTAMPING,
+                &flags, sizeof(flags)) < 0) {
+        qDebug("%s: unable to set SO_TIMESTAMPING (%s)", device,
+                strerror(errno));
+        return false;
+    }
+
+    return true;
+}
+
+/*
+  Counts the NIC tx timestamps queued on the error queue so far - a few at
+  a time; the kernel drops timestamps once the queue is full, so at high
+  rates only a sample of the frames is timestamped
+*/
+void LinuxPort::PortTransmitter::readTxTimestamps()
+{
+    uchar frame[kTxRingFrameSize];
+    char control[256];
+
+    for (int i = 0; i < kMaxTxTimestampReads; i++)
+    {
+        struct msghdr msg;
+        struct iovec iov;
+        struct cmsghdr *cmsg;
+        int len;
+
+        iov.iov_base = frame;
+        iov.iov_len = sizeof(frame);
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+
+        len = recvmsg(txRingFd_, &msg, MSG_ERRQUEUE | MSG_DONTWAIT);
+        if (len <= 0)
+            break;
+        if (msg.msg_flags & MSG_TRUNC)
+            continue;
+
+        for (cmsg = CMSG_FIRSTHDR(&msg); cmsg;
+                cmsg = CMSG_NXTHDR(&msg, cmsg))
+        {
+            // ts[0] is the sw timestamp, ts[2] the raw NIC timestamp
+            const struct timespec *ts = (const struct timespec*)
+                                            CMSG_DATA(cmsg);
+
+            if ((cmsg->cmsg_level != SOL_SOCKET)
+                    || (cmsg->cmsg_type != SO_TIMESTAMPING))
+                continue;
+            if (ts[2].tv_sec || ts[2].tv_nsec)
+                streamStats_.countTxTimestamp(frame, len,
+                        LatencyClock::fromNicTime(quint64(ts[2].tv_sec)
+                            *quint64(1e9) + ts[2].tv_nsec));
+        }
+    }
+}
+
+// Returns the next ring frame that we own, kicking the kernel and
+// waiting for it to release a frame if the ring is full
+struct tpacket2_hdr* LinuxPort::PortTransmitter::nextTxRingFrame()
+{
+    struct tpacket2_hdr *frame = (struct tpacket2_hdr*)
+                                    (txRing_ + txRingIndex_*kTxRingFrameSize);
+
+    while (frame->tp_status & (TP_STATUS_SEND_REQUEST | TP_STATUS_SENDING))
+    {
+        struct pollfd pfd;
+
+        if (flushTxRing() < 0)
+            return NULL;
+
+        pfd.fd = txRingFd_;
+        pfd.events = POLLOUT;
+        pfd.revents = 0;
+        if ((poll(&pfd, 1, 1000 /* ms */) < 0) && (errno != EINTR)) {
+            qWarning("TX_RING poll failed (%s)", strerror(errno));
+            return NULL;
+        }
+        if (stop_)
+            return NULL;
+    }
+
+    txRingIndex_ = (txRingIndex_ + 1) % txRingFrameCount_;
+    return frame;
+}
+
+// Ask the kernel to transmit all frames queued in the ring so far
+int LinuxPort::PortTransmitter::flushTxRing()
+{
+    // Also keeps the error queue from waking up nextTxRingFrame()'s poll
+    if (useHwTxTimestamps_)
+        readTxTimestamps();
+
+    if (!pendingPkts_)
+        return 0;
+
+    while (send(txRingFd_, NULL, 0, MSG_DONTWAIT) < 0)
+    {
+        if (errno == EINTR)
+            continue;
+        // EAGAIN/ENOBUFS: the kernel will pick up the frames on the next kick
+        if ((errno == EAGAIN) || (errno == ENOBUFS)) {
+            metrics_.add(OstProto::DroneMetric::kTxSendRetries);
+            break;
+        }
+        qWarning("TX_RING send failed (%s)", strerror(errno));
+        metrics_.add(OstProto::DroneMetric::kTxSendErrors);
+        return -1;
+    }
+
+    // The frames are now owned by the kernel, so account for them in one go
+    stats_->txLock.writeBegin();
+    stats_->txPkts += pendingPkts_;
+    stats_->txBytes += pendingBytes_;
+    stats_->txLock.writeEnd();
+    pendingPkts_ = 0;
+    pendingBytes_ = 0;
+
+    return 0;
+}
+
+int LinuxPort::PortTransmitter::sendQueueTransmit(pcap_t *p,
+        pcap_send_queue *queue, qint64 &overHead, int sync)
+{
+    TimeStamp ovrStart, ovrEnd;
+    struct timeval ts;
+    struct pcap_pkthdr *hdr = (struct pcap_pkthdr*) queue->buffer;
+    char *end = queue->buffer + queue->len;
+
+    if (!txRing_)
+        return PcapPort::PortTransmitter::sendQueueTransmit(p, queue,
+                    overHead, sync);
+
+    ts = hdr->ts;
+
+    getTimeStamp(&ovrStart);
+    while((char*) hdr < end)
+    {
+        uchar *pkt = (uchar*)hdr + sizeof(*hdr);
+        int pktLen = hdr->caplen;
+
+        if (sync)
+        {
+            qint64 nsec = pacedGap(nsecTsDiff(hdr->ts, ts));
+
+            getTimeStamp(&ovrEnd);
+
+            overHead -= ndiffTimeStamp(&ovrStart, &ovrEnd);
+            Q_ASSERT(overHead <= 0);
+            nsec += overHead;
+            if (isPastStopTime(nsec))
+                return (flushTxRing() < 0) ? -1 : -2;
+            if (nsec > 0)
+            {
+                // Frames queued so far must go out before we wait
+                if (flushTxRing() < 0)
+                    return -1;
+                delay(nsec);
+                overHead = 0;
+            }
+            else
+                overHead = nsec;
+
+            ts = hdr->ts;
+            getTimeStamp(&ovrStart);
+        }
+
+        Q_ASSERT(pktLen > 0);
+
+        streamStats_.stampTx(pkt, pktLen);
+        if (pktLen <= txRingMaxPktLen_)
+        {
+            struct tpacket2_hdr *frame = nextTxRingFrame();
+
+            if (!frame)
+                return stop_ ? -2 : -1;
+
+            memcpy((uchar*)frame + TPACKET_ALIGN(sizeof(struct tpacket2_hdr)),
+                    pkt, pktLen);
+            frame->tp_len = pktLen;
+            // Frame contents must be visible before the kernel owns it
+            __sync_synchronize();
+            frame->tp_status = TP_STATUS_SEND_REQUEST;
+
+            pendingPkts_++;
+            pendingBytes_ += pktLen;
+            if ((pendingPkts_ >= kTxRingMaxBatch) && (flushTxRing() < 0))
+                return -1;
+        }
+        else
+        {
+            // Frame doesn't fit in a ring slot - send it the slow way,
+            // but only after the frames queued before it
+            if (flushTxRing() < 0)
+                return -1;
+            if (pcap_sendpacket(p, pkt, pktLen) < 0)
+                metrics_.add(OstProto::DroneMetric::kTxSendErrors);
+            stats_->txLock.writeBegin();
+            stats_->txPkts++;
+            stats_->txBytes += pktLen;
+            stats_->txLock.writeEnd();
+        }
+
+        // Step to the next packet in the buffer
+        hdr = (struct pcap_pkthdr*) (pkt + pktLen);
+        pkt = (uchar*) ((uchar*)hdr + sizeof(*hdr));
+
+        if (stop_)
+        {
+            flushTxRing();
+            return -2;
+        }
+    }
+
+    return flushTxRing();
+}
+
+/*
+ * ------------------------------------------------------------------- *
+ * Emulation Transceiver
+ * ------------------------------------------------------------------- *
+ */
+/*
+  Receives ARP/NDP/ICMP via a PACKET_RX_RING and sends the replies via a
+  PACKET_TX_RING of its own (not the traffic transmitter's) - a whole block
+  of requests is handled per wakeup and the replies generated for it are
+  handed to the kernel in a single send() instead of one pcap_sendpacket()
+  per reply
+
+  Like the PortMonitor's, the rx ring is serviced by the RxPoller of the
+  NIC's NUMA node and not a thread of our own. If the port has a tap, we
+  subscribe to it with our capture filter instead of an rx ring of our own
+
+  Falls back to pcap (see PcapPort) if the rings can't be setup
+*/
+LinuxPort::EmulationTransceiver::EmulationTransceiver(const char *device,
+        DeviceManager *deviceManager)
+    : PcapPort::EmulationTransceiver(device, deviceManager)
+{
+    tap_ = NULL;
+    isTapped_ = false;
+    rxRingFd_ = -1;
+    rxRing_ = NULL;
+    rxRingBlockIndex_ = 0;
+    poller_ = NULL;
+    rxThread_ = this;
+
+    txRingFd_ = -1;
+    txRing_ = NULL;
+    txRingFrameCount_ = 0;
+    txRingIndex_ = 0;
+    txRingMaxPktLen_ = 0;
+    pendingPkts_ = 0;
+}
+
+LinuxPort::EmulationTransceiver::~EmulationTransceiver()
+{
+    if (isRunning() || poller_ || isTapped_)
+        stop();
+}
+
+bool LinuxPort::EmulationTransceiver::setupRxRing()
+{
+    QByteArray deviceName = device_.toLocal8Bit();
+    const char *device = deviceName.constData();
+    pcap_t *deadHandle = pcap_open_dead(DLT_EN10MB, 65535);
+    struct bpf_program bpf;
+    struct sock_fprog filter;
+    struct packet_mreq mreq;
+
+    // Same filter as pcap; a bpf_insn is laid out the same as sock_filter.
+    // If the kernel has stripped the vlan tag(s), the frame matches the
+    // untagged part of the filter
+    if (pcap_compile(deadHandle, &bpf, captureFilter(), 1, 0) < 0) {
+        qDebug("%s: error compiling filter: %s", device,
+                pcap_geterr(deadHandle));
+        pcap_close(deadHandle);
+        return false;
+    }
+    filter.len = bpf.bf_len;
+    filter.filter = (struct sock_filter*) bpf.bf_insns;
+
+    rxRingFd_ = openRxRing(device, kRxRingBlockSize, kRxRingBlockCount,
+                    kRxRingFrameSize, kRxRingBlockTimeout, &filter, &rxRing_);
+    pcap_freecode(&bpf);
+    pcap_close(deadHandle);
+    if (rxRingFd_ < 0)
+        return false;
+
+    // Emulated devices have MACs of their own
+    memset(&mreq, 0, sizeof(mreq));
+    mreq.mr_ifindex = if_nametoindex(device);
+    mreq.mr_type = PACKET_MR_PROMISC;
+    if (setsockopt(rxRingFd_, SOL_PACKET, PACKET_ADD_MEMBERSHIP,
+                &mreq, sizeof(mreq)) < 0) {
+        notify("Unable to set promiscuous mode on <%s> - "
+                "device emulation will not work", device);
+        return false;
+    }
+
+    rxRingBlockIndex_ = 0;
+    return true;
+}
+
+bool LinuxPort::EmulationTransceiver::setupTxRing()
+{
+    QByteArray deviceName = device_.toLocal8Bit();
+    const char *device = deviceName.constData();
+    struct tpacket_req req;
+    struct sockaddr_ll addr;
+    int version = TPACKET_V2;
+    void *ring;
+
+    // Protocol is 0 - this socket is used only for Tx, never for Rx
+    txRingFd_ = socket(AF_PACKET, SOCK_RAW, 0);
+    if (txRingFd_ < 0) {
+        qDebug("%s: unable to open packet socket (%s)", device,
+                strerror(errno));
+        return false;
+    }
+
+    if (setsockopt(txRingFd_, SOL_PACKET, PACKET_VERSION,
+                &version, sizeof(version)) < 0) {
+        qDebug("%s: unable to set TPACKET_V2 (%s)", device, strerror(errno));
+        return false;
+    }
+
+    memset(&req, 0, sizeof(req));
+    req.tp_block_size = kTxRingBlockSize;
+    req.tp_block_nr = kTxRingBlockCount;
+    req.tp_frame_size = kTxRingFrameSize;
+    req.tp_frame_nr = (kTxRingBlockSize/kTxRingFrameSize) * kTxRingBlockCount;
+
+    if (setsockopt(txRingFd_, SOL_PACKET, PACKET_TX_RING,
+                &req, sizeof(req)) < 0) {
+        qDebug("%s: unable to setup PACKET_TX_RING (%s)", device,
+                strerror(errno));
+        return false;
+    }
+
+    txRingFrameCount_ = req.tp_frame_nr;
+    txRingMaxPktLen_ = kTxRingFrameSize
+                        - TPACKET_ALIGN(sizeof(struct tpacket2_hdr));
+
+    ring = mmap(NULL, kTxRingBlockSize * kTxRingBlockCount,
+                PROT_READ | PROT_WRITE, MAP_SHARED, txRingFd_, 0);
+    if (ring == MAP_FAILED) {
+        qDebug("%s: unable to mmap TX_RING (%s)", device, strerror(errno));
+        return false;
+    }
+    txRing_ = (uchar*) ring;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sll_family = AF_PACKET;
+    addr.sll_protocol = 0;
+    addr.sll_ifindex = if_nametoindex(device);
+
+    if (bind(txRingFd_, (struct sockaddr*) &addr, sizeof(addr)) < 0) {
+        qDebug("%s: unable to bind packet socket (%s)", device,
+                strerror(errno));
+        return false;
+    }
+
+    txRingIndex_ = 0;
+    pendingPkts_ = 0;
+    return true;
+}
+
+void LinuxPort::EmulationTransceiver::closeRings()
+{
+    QMutexLocker locker(&txLock_);
+
+    if (rxRing_)
+        munmap(rxRing_, kRxRingBlockSize * kRxRingBlockCount);
+    rxRing_ = NULL;
+    if (rxRingFd_ >= 0)
+        close(rxRingFd_);
+    rxRingFd_ = -1;
+
+    if (txRing_)
+        munmap(txRing_, kTxRingBlockSize * kTxRingBlockCount);
+    txRing_ = NULL;
+    if (txRingFd_ >= 0)
+        close(txRingFd_);
+    txRingFd_ = -1;
+}
+
+void LinuxPort::EmulationTransceiver::start()
+{
+    if (isRunning() || isTapped_) {
+        qWarning("Receive start requested but is already running!");
+        return;
+    }
+
+    // The tap's thread handles our rx (and the replies to it)
+    if (tap_ && setupTxRing()
+            && tap_->subscribe(this, captureFilter(), kRxRingFrameSize)) {
+        qDebug("%s: emulation via the port's tap and a TX_RING",
+                qPrintable(device_));
+        isTapped_ = true;
+        rxThread_ = tap_->tapThread();
+        state_.set(kRunning);
+        return;
+    }
+    closeRings();
+
+    if (!setupRxRing() || !setupTxRing()) {
+        closeRings();
+        qWarning("%s: emulation rings not available, using pcap",
+                qPrintable(device_));
+        PcapPort::EmulationTransceiver::start();
+        return;
+    }
+    qDebug("%s: emulation RX_RING/TX_RING setup", qPrintable(device_));
+
+    poller_ = RxPoller::instance(interfaceNumaNode(qPrintable(device_)));
+    rxThread_ = poller_;
+    if (poller_->add(this)) {
+        state_.set(kRunning);
+        return;
+    }
+
+    // Service the rings from our own thread instead
+    poller_ = NULL;
+    rxThread_ = this;
+    PcapPort::EmulationTransceiver::start();
+}
+
+void LinuxPort::EmulationTransceiver::stop()
+{
+    if (isTapped_) {
+        tap_->unsubscribe(this);
+        isTapped_ = false;
+        rxThread_ = this;
+
+        closeRings();
+        state_.set(kFinished);
+        return;
+    }
+
+    if (!poller_) {
+        PcapPort::EmulationTransceiver::stop();
+        return;
+    }
+
+    poller_->remove(this);
+    poller_ = NULL;
+    rxThread_ = this;
+
+    closeRings();
+    state_.set(kFinished);
+}
+
+void LinuxPort::EmulationTransceiver::run()
+{
+    if (!rxRing_) {
+        PcapPort::EmulationTransceiver::run();
+        return;
+    }
+
+    ThreadPlacer::Scope placement(placer_);
+    struct pollfd pfd;
+
+    qDebug("In %s", __PRETTY_FUNCTION__);
+
+    pfd.fd = rxRingFd_;
+    pfd.events = POLLIN | POLLERR;
+    pfd.revents = 0;
+
+    state_.set(kRunning);
+    while (!stop_)
+    {
+        // Timeout so that we see stop_ in reasonable time
+        if (poll(&pfd, 1, 100 /* ms */) > 0)
+            rxPollReady();
+    }
+    qDebug("user requested receiver stop\n");
+
+    closeRings();
+    stop_ = false;
+
+    state_.set(kFinished);
+}
+
+// Processes the ready blocks (at most a ring's worth) sending the replies
+// for each block in one go
+void LinuxPort::EmulationTransceiver::rxPollReady()
+{
+    for (int i = 0; i < kRxRingBlockCount; i++)
+    {
+        struct tpacket_block_desc *block = (struct tpacket_block_desc*)
+                (rxRing_ + rxRingBlockIndex_*kRxRingBlockSize);
+
+        if (!(block->hdr.bh1.block_status & TP_STATUS_USER))
+            break;
+
+        processRxRingBlock(block);
+
+        // Return the block to the kernel
+        __sync_synchronize();
+        block->hdr.bh1.block_status = TP_STATUS_KERNEL;
+        rxRingBlockIndex_ = (rxRingBlockIndex_ + 1) % kRxRingBlockCount;
+
+        txLock_.lock();
+        flushTxRing();
+        txLock_.unlock();
+    }
+}
+
+void LinuxPort::EmulationTransceiver::processRxRingBlock(
+        struct tpacket_block_desc *block)
+{
+    struct tpacket3_hdr *hdr = (struct tpacket3_hdr*)
+                ((uchar*)block + block->hdr.bh1.offset_to_first_pkt);
+
+    for (uint i = 0; i < block->hdr.bh1.num_pkts; i++,
+            hdr = (struct tpacket3_hdr*)((uchar*)hdr + hdr->tp_next_offset))
+    {
+        const struct sockaddr_ll *sll = (const struct sockaddr_ll*)
+                ((uchar*)hdr + TPACKET_ALIGN(sizeof(struct tpacket3_hdr)));
+        uchar *frame = (uchar*)hdr + hdr->tp_mac;
+        int len = hdr->tp_snaplen;
+
+        // Skip the replies/requests we sent ourselves
+        if (sll->sll_pkttype == PACKET_OUTGOING)
+            continue;
+
+        // Put back the (outer) vlan tag, if the kernel had stripped it
+        if ((hdr->tp_status & TP_STATUS_VLAN_VALID)
+                && (len >= 12) && (len <= kRxRingFrameSize)) {
+            quint16 tpid = 0x8100;
+#ifdef TP_STATUS_VLAN_TPID_VALID
+            if (hdr->tp_status & TP_STATUS_VLAN_TPID_VALID)
+                tpid = hdr->hv1.tp_vlan_tpid;
+#endif
+            memcpy(rxFrame_, frame, 12);
+            qToBigEndian<quint16>(tpid, rxFrame_ + 12);
+            qToBigEndian<quint16>(hdr->hv1.tp_vlan_tci, rxFrame_ + 14);
+            memcpy(rxFrame_ + 16, frame + 12, len - 12);
+            frame = rxFrame_;
+            len += 4;
+        }
+
+        // XXX: as with pcap, deviceManager copies pktBuf if needed later
+        // since the data is owned by the ring
+        PacketBuffer pktBuf(frame, len);
+        deviceManager_->receivePacket(&pktBuf);
+    }
+}
+
+void LinuxPort::EmulationTransceiver::tapFrame(
+        const PortMonitor::TapFrame &frame)
+{
+    // Skip the replies/requests we sent ourselves
+    if (frame.isOutgoing)
+        return;
+
+    // XXX: as with pcap, deviceManager copies pktBuf if needed later
+    // since the data is owned by the tap
+    PacketBuffer pktBuf(frame.data, frame.length);
+    deviceManager_->receivePacket(&pktBuf);
+}
+
+// Sends the replies to the tap's block in one go
+void LinuxPort::EmulationTransceiver::tapBlockDone()
+{
+    QMutexLocker locker(&txLock_);
+
+    flushTxRing();
+}
+
+int LinuxPort::EmulationTransceiver::transmitPacket(PacketBuffer *pktBuf)
+{
+    QMutexLocker locker(&txLock_);
+
+    if (!txRing_)
+        return PcapPort::EmulationTransceiver::transmitPacket(pktBuf);
+
+    if (queueTxRingFrame(pktBuf) < 0)
+        return -1;
+
+    // Replies are sent once the whole rx block is processed (see
+    // rxPollReady()); anything else (sent from other threads) right away
+    if ((QThread::currentThread() != rxThread_)
+            || (pendingPkts_ >= kTxRingMaxBatch))
+        return flushTxRing();
+
+    return 0;
+}
+
+// Returns the count sent
+int LinuxPort::EmulationTransceiver::transmitPackets(
+        const QList<PacketBuffer*> &pktBufs)
+{
+    QMutexLocker locker(&txLock_);
+    int count = 0;
+
+    foreach(PacketBuffer *pktBuf, pktBufs) {
+        if (!txRing_) {
+            if (PcapPort::EmulationTransceiver::transmitPacket(pktBuf) == 0)
+                count++;
+            continue;
+        }
+        if (queueTxRingFrame(pktBuf) < 0)
+            continue;
+        count++;
+        if (pendingPkts_ >= kTxRingMaxBatch)
+            flushTxRing();
+    }
+    flushTxRing();
+
+    return count;
+}
+
+// Copies pktBuf to the next frame of the tx ring (sent on the next flush);
+// caller must hold txLock_
+int LinuxPort::EmulationTransceiver::queueTxRingFrame(PacketBuffer *pktBuf)
+{
+    struct tpacket2_hdr *frame = (struct tpacket2_hdr*)
+                                    (txRing_ + txRingIndex_*kTxRingFrameSize);
+    int len = pktBuf->length();
+
+    if (len > txRingMaxPktLen_) {
+        qWarning("%s: emulation pkt too long (%d)", qPrintable(device_), len);
+        return -1;
+    }
+
+    // Ring full - kick the kernel and give it a moment to free a frame
+    if (frame->tp_status & (TP_STATUS_SEND_REQUEST | TP_STATUS_SENDING)) {
+        struct pollfd pfd;
+
+        flushTxRing();
+        pfd.fd = txRingFd_;
+        pfd.events = POLLOUT;
+        pfd.revents = 0;
+        poll(&pfd, 1, 10 /* ms */);
+        if (frame->tp_status & (TP_STATUS_SEND_REQUEST | TP_STATUS_SENDING))
+            return -1;
+    }
+
+    memcpy((uchar*)frame + TPACKET_ALIGN(sizeof(struct tpacket2_hdr)),
+            pktBuf->data(), len);
+    frame->tp_len = len;
+    __sync_synchronize();
+    frame->tp_status = TP_STATUS_SEND_REQUEST;
+    txRingIndex_ = (txRingIndex_ + 1) % txRingFrameCount_;
+    pendingPkts_++;
+
+    return 0;
+}
+
+// Ask the kernel to transmit all frames queued in the ring so far; caller
+// must hold txLock_
+int LinuxPort::EmulationTransceiver::flushTxRing()
+{
+    if (!pendingPkts_ || !txRing_)
+        return 0;
+
+    while (send(txRingFd_, NULL, 0, MSG_DONTWAIT) < 0)
+    {
+        if (errno == EINTR)
+            continue;
+        // EAGAIN/ENOBUFS: the kernel will pick up the frames on the next kick
+        if ((errno == EAGAIN) || (errno == ENOBUFS))
+            break;
+        qWarning("%s: emulation TX_RING send failed (%s)",
+                qPrintable(device_), strerror(errno));
+        return -1;
+    }
+    pendingPkts_ = 0;
+
+    return 0;
 }
 #endif
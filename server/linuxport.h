@@ -24,7 +24,17 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 
 #ifdef Q_OS_LINUX
 
+#include "bpfstreamstats.h"
+#include "compressedcapture.h"
 #include "pcapport.h"
+#include "pktgentransmitter.h"
+#include "rxpoller.h"
+
+#include <QByteArray>
+#include <QHash>
+#include <QList>
+#include <QMutex>
+#include <QWaitCondition>
 
 class LinuxPort : public PcapPort
 {
@@ -38,7 +48,18 @@ public:
     virtual bool hasExclusiveControl();
     virtual bool setExclusiveControl(bool exclusive);
 
+    virtual void startTransmit();
+    virtual void stopTransmit();
+    virtual bool isTransmitOn();
+    virtual bool transmitRunStats(quint64 *pkts, quint64 *bytes,
+                                  quint64 *nsec);
+
 protected:
+    virtual bool setCounterFilters(const OstProto::CounterFilterList &filters);
+    virtual void addFilterCounts(QList<quint64> &counts);
+    virtual void addStreamStats(StreamStatsHash &stats);
+    virtual bool setProbeReflection(bool enable);
+
     class StatsMonitor: public QThread
     {
     public:
@@ -51,15 +72,276 @@ protected:
         int netlinkStats();
         void procStats();
         int setPromisc(const char* portName);
+        void setupNicCounters(LinuxPort *port);
+        void updateNicCounters(LinuxPort *port);
+        void updatePortStats(LinuxPort *port, const void *linkStats);
+        static bool isActivePort(LinuxPort *port);
+        static bool hasActivePort(const QList<LinuxPort*> &ports);
+        int openLinkEvents();
+        bool processLinkEvents(int fd, const QHash<uint, LinuxPort*> &ports);
+        int linkStats(int fd, uint ifIndex, LinuxPort *port);
 
-        static const int kRefreshFreq_ = 1; // in seconds
+        static const int kRefreshInterval_ = 1000; // msecs
+        static const int kMinRefreshInterval_ = 10; // msecs
         bool stop_;
         bool setupDone_;
         int ioctlSocket_;
     };
 
+    class PortMonitor: public PcapPort::PortMonitor, public RxPoller::Client
+    {
+    public:
+        // A frame seen by the tap - with its vlan tag, if the kernel had
+        // stripped it, put back
+        struct TapFrame
+        {
+            const uchar *data;
+            int length;     // captured
+            int wireLength;
+            quint32 sec;
+            quint32 nsec;
+            bool isOutgoing; // sent by this host, not received
+        };
+
+        // A subscriber to the tap - called in the tap's thread
+        class TapClient
+        {
+        public:
+            virtual ~TapClient() {}
+            virtual void tapFrame(const TapFrame &frame) = 0;
+            // After each block of frames - whether or not any was ours
+            virtual void tapBlockDone() {}
+        };
+
+        PortMonitor(const char *device, Direction direction,
+                AbstractPort::PortStats *stats, bool needFrames);
+        ~PortMonitor();
+        void start();
+        void run();
+        int rxPollFd() { return rxRingFd_; }
+        void rxPollReady();
+
+        bool isTap() { return rxRing_ != NULL; }
+        QThread* tapThread();
+        bool subscribe(TapClient *client, const QString &filter,
+                       int snapLen, bpf_u_int32 netmask = 0);
+        void unsubscribe(TapClient *client);
+    private:
+        struct Tap
+        {
+            TapClient *client;
+            struct bpf_program program; // snap length as its return value
+        };
+
+        bool setupRxRing(const char *device);
+        void processRxRingBlock(struct tpacket_block_desc *block);
+        void tapFrame(const struct tpacket3_hdr *hdr, bool isOutgoing);
+        void kernelFilter(struct sock_fprog *program);
+        void updateKernelFilter();
+        bool setPromisc(bool on);
+
+        // Ring of kRxRingBlockCount blocks, each with as many frames as fit
+        static const int kRxRingBlockSize = 256*1024;
+        static const int kRxRingBlockCount = 32;
+        static const int kRxRingFrameSize = 2048;
+        // Max time (ms) before the kernel hands over a partly filled block
+        static const int kRxRingBlockTimeout = 10;
+
+        QByteArray device_;
+        bool needFrames_;
+        int rxRingFd_;
+        uchar *rxRing_;
+        uint rxRingSize_;
+        int rxRingBlockIndex_;
+
+        int numaNode_;
+        RxPoller *poller_; // NULL => ring is serviced by our own thread
+
+        QMutex tapLock_; // subscribe() vs. the frames handed to taps_
+        QList<Tap> taps_;
+        // Frame with its vlan tag (stripped by the kernel) put back
+        uchar tapFrame_[kRxRingFrameSize + 4];
+    };
+
+    class PortCapturer: public PcapPort::PortCapturer,
+                        public PortMonitor::TapClient
+    {
+    public:
+        PortCapturer(const char *device);
+        // High rate captures take their frames from tap, if not NULL,
+        // instead of a ring of their own
+        void setTap(PortMonitor *tap) { tap_ = tap; }
+        void run();
+        virtual QIODevice* captureData();
+        void tapFrame(const PortMonitor::TapFrame &frame);
+        void tapBlockDone();
+    private:
+        // Writes fixed size (and aligned - for O_DIRECT) buffers of
+        // capture data to the capture file in its own thread
+        class Writer: public QThread
+        {
+        public:
+            Writer();
+            ~Writer();
+            bool open(const QString &fileName, bool isDirectIo,
+                      bool isCompressed = false);
+            void append(const void *data, int length);
+            void close();
+            void run();
+        private:
+            bool write(const uchar *buffer, int length);
+            uchar* freeBuffer();
+
+            static const int kBufferSize = 1024*1024;
+            static const int kBufferCount = 16;
+
+            QMutex lock_;
+            QWaitCondition changed_;
+            QList<uchar*> free_;
+            QList<uchar*> full_;
+            uchar *buffer_;     // being filled by append()
+            int bufferLength_;
+            uchar *tail_;       // last (partly filled) buffer
+            int tailLength_;
+            int fd_;
+            bool isDirectIo_;
+            bool isCompressed_;
+            bool stop_;
+        };
+
+        bool ringCapture();
+        void processRingBlock(struct tpacket_block_desc *block);
+        void captureFrame(quint32 sec, quint32 nsec, const uchar *data,
+                          int length, int wireLength);
+
+        static const int kRingBlockSize = 1024*1024;
+        static const int kRingFrameSize = 2048;
+        static const int kRingBlockTimeout = 100; // ms
+
+        PortMonitor *tap_; // NULL => no tap
+        Writer writer_;
+        // Of the last capture - if it was compressed
+        bool isCompressed_;
+        CompressedCaptureFile compressedData_;
+    };
+
+    class PortTransmitter: public PcapPort::PortTransmitter
+    {
+    public:
+        PortTransmitter(const char *device);
+        ~PortTransmitter();
+    protected:
+        virtual bool open();
+        virtual int sendQueueTransmit(pcap_t *p, pcap_send_queue *queue,
+                    qint64 &overHead, int sync);
+    private:
+        bool setupTxRing(const char *device);
+        bool enableHwTxTimestamps(const char *device);
+        void readTxTimestamps();
+        struct tpacket2_hdr* nextTxRingFrame();
+        int flushTxRing();
+
+        // Ring of (kTxRingBlockSize/kTxRingFrameSize)*kTxRingBlockCount frames
+        static const int kTxRingFrameSize = 2048;
+        static const int kTxRingBlockSize = 64*1024;
+        static const int kTxRingBlockCount = 64;
+        // Max frames queued in the ring before we kick the kernel
+        static const int kTxRingMaxBatch = 256;
+        // Max tx timestamps read per readTxTimestamps()
+        static const int kMaxTxTimestampReads = 64;
+
+        int txRingFd_;
+        uchar *txRing_;
+        uint txRingSize_;
+        uint txRingFrameCount_;
+        uint txRingIndex_;
+        int txRingMaxPktLen_;
+        int pendingPkts_;
+        quint64 pendingBytes_;
+        bool useTxRing_; // but not setup yet
+        bool useHwTxTimestamps_;
+    };
+
+    class EmulationTransceiver: public PcapPort::EmulationTransceiver,
+                                public RxPoller::Client,
+                                public PortMonitor::TapClient
+    {
+    public:
+        EmulationTransceiver(const char *device, DeviceManager *deviceManager);
+        ~EmulationTransceiver();
+        // Frames are received from tap, if not NULL, instead of a ring of
+        // our own
+        void setTap(PortMonitor *tap) { tap_ = tap; }
+        virtual void start();
+        virtual void stop();
+        void run();
+        int rxPollFd() { return rxRingFd_; }
+        void rxPollReady();
+        void tapFrame(const PortMonitor::TapFrame &frame);
+        void tapBlockDone();
+        virtual int transmitPacket(PacketBuffer *pktBuf);
+        virtual int transmitPackets(const QList<PacketBuffer*> &pktBufs);
+    private:
+        bool setupRxRing();
+        bool setupTxRing();
+        void closeRings();
+        void processRxRingBlock(struct tpacket_block_desc *block);
+        int queueTxRingFrame(PacketBuffer *pktBuf);
+        int flushTxRing();
+
+        // ARP/NDP is low rate except for (refresh) bursts - small blocks
+        // but retired quickly so that replies aren't delayed
+        static const int kRxRingBlockSize = 64*1024;
+        static const int kRxRingBlockCount = 16;
+        static const int kRxRingFrameSize = 2048;
+        static const int kRxRingBlockTimeout = 2; // ms
+
+        static const int kTxRingFrameSize = 2048;
+        static const int kTxRingBlockSize = 64*1024;
+        static const int kTxRingBlockCount = 8;
+        static const int kTxRingMaxBatch = 64;
+
+        PortMonitor *tap_; // NULL => no tap
+        bool isTapped_; // rx is via tap_, not our rx ring
+
+        int rxRingFd_;
+        uchar *rxRing_;
+        int rxRingBlockIndex_;
+
+        RxPoller *poller_; // NULL => rings are serviced by our own thread
+        QThread *rxThread_; // thread that handles the rx ring
+
+        QMutex txLock_; // replies (our thread) vs. requests (rpc threads)
+        int txRingFd_;
+        uchar *txRing_;
+        uint txRingFrameCount_;
+        uint txRingIndex_;
+        int txRingMaxPktLen_;
+        int pendingPkts_;
+
+        // Frame with its vlan tag (stripped by the kernel) put back
+        uchar rxFrame_[kRxRingFrameSize + 4];
+    };
+
+    void clearCounterFilters();
+    bool startPktgen();
+
+    // A packet socket per counter filter, that is never read - the kernel
+    // counts the matches (as drops once the tiny rcvbuf is full)
+    QList<int> counterFilterFds_;
+    QList<quint64> counterFilterCounts_;
+    QMutex counterFilterLock_;
+
+#ifdef HAVE_EBPF
+    BpfStreamStats *bpfStreamStats_; // NULL => counted by monitorRx_
+#endif
+
+    PktgenTransmitter *pktgen_; // NULL => not enabled
+    bool isPktgenRun_; // last transmit was by pktgen_
+
     bool isPromisc_;
     bool clearPromisc_;
+    QStringList nicCounterNames_; // ethtool -S; only used by StatsMonitor
     static QList<LinuxPort*> allPorts_;
     static StatsMonitor *monitor_; // rx/tx stats for ALL ports
 };
@@ -0,0 +1,186 @@
+/*
+Copyright (C) 2017 Srivats P.
+
+
+This file is part of "Ostinato"
+
+This is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+
+#include "mcastreporter.h"
+
+#include "devicemanager.h"
+#include "settings.h"
+
+McastReporter::McastReporter(DeviceManager *deviceManager, int portId)
+{
+    deviceManager_ = deviceManager;
+    portId_ = portId;
+
+    rate_ = qMax(1, appSettings->value(kMcastReportRateKey,
+                        kMcastReportRateDefaultValue).toInt());
+
+    timer_.start();
+    generation_ = 0;
+    isActive_ = false;
+    stop_ = false;
+}
+
+McastReporter::~McastReporter()
+{
+    stop_ = true;
+    wait();
+}
+
+/*!
+  Sends robustness state change reports for all the groups of device,
+  interval msecs apart - the first one right away
+*/
+void McastReporter::join(const DeviceKey &device, bool isIp6,
+                         int robustness, int interval)
+{
+    QMutexLocker locker(&lock_);
+    Report report;
+
+    if (robustness <= 0)
+        return;
+
+    report.device = device;
+    report.isIp6 = isIp6;
+    report.recordType = McastGroups::kChangeToExclude;
+    report.remaining = robustness;
+    report.interval = interval;
+
+    schedule(timer_.elapsed(), report);
+}
+
+/*!
+  Schedules a current state report of device at a random time within
+  maxRespMsecs - unless one is already pending
+*/
+void McastReporter::query(const DeviceKey &device, bool isIp6,
+                          int maxRespMsecs)
+{
+    QMutexLocker locker(&lock_);
+    QSet<DeviceKey> &pending = isIp6 ? pendingIp6_ : pendingIp4_;
+    Report report;
+
+    if (pending.contains(device))
+        return;
+    pending.insert(device);
+
+    report.device = device;
+    report.isIp6 = isIp6;
+    report.recordType = McastGroups::kModeIsExclude;
+    report.remaining = 1;
+    report.interval = 0;
+
+    schedule(timer_.elapsed() + (maxRespMsecs > 0 ? qrand() % maxRespMsecs : 0),
+             report);
+}
+
+/*!
+  Drops all pending reports - e.g. when the devices are deleted
+*/
+void McastReporter::clear()
+{
+    QMutexLocker locker(&lock_);
+
+    wheel_.clear();
+    pendingIp4_.clear();
+    pendingIp6_.clear();
+    generation_++;
+}
+
+// Caller holds lock_
+void McastReporter::schedule(qint64 msecs, const Report &report)
+{
+    // Round up - so that a report is never sent early
+    wheel_.schedule(quint64(msecs + kTickMsecs - 1)/kTickMsecs, report);
+
+    if (!isActive_) {
+        isActive_ = true;
+        wait(); // for the previous run (if any) to return
+        QThread::start();
+    }
+}
+
+void McastReporter::run()
+{
+    qint64 lastTick;
+    double credit = 0;
+    // Unused credit is not carried over beyond a couple of ticks
+    double maxCredit = qMax(1.0, 2.0*rate_*kTickMsecs/1000);
+
+    qDebug("In %s", __PRETTY_FUNCTION__);
+
+    lock_.lock();
+    lastTick = timer_.elapsed();
+    lock_.unlock();
+
+    while (!stop_)
+    {
+        QList<Report> batch;
+        QList<PacketBuffer*> packets;
+        uint generation;
+        qint64 now;
+
+        lock_.lock();
+        if (!wheel_.size()) {
+            isActive_ = false;
+            lock_.unlock();
+            return;
+        }
+
+        now = timer_.elapsed();
+        credit = qMin(maxCredit, credit + double(rate_)*(now - lastTick)/1000);
+        lastTick = now;
+
+        wheel_.advance(quint64(now)/kTickMsecs);
+        while (wheel_.hasReady() && (batch.size() < int(credit))) {
+            Report report = wheel_.takeReady();
+
+            if (report.recordType == McastGroups::kModeIsExclude) {
+                if (report.isIp6)
+                    pendingIp6_.remove(report.device);
+                else
+                    pendingIp4_.remove(report.device);
+            }
+            batch.append(report);
+        }
+        generation = generation_;
+        lock_.unlock();
+
+        // Build the reports and send them all in one go; a report of
+        // many groups may take several packets - all count for the rate
+        if (!batch.isEmpty()) {
+            deviceManager_->processMcastReports(batch, &packets);
+            deviceManager_->transmitPackets(packets);
+            credit -= packets.size();
+        }
+
+        lock_.lock();
+        for (int i = 0; (i < batch.size()) && (generation == generation_); i++)
+        {
+            Report &report = batch[i];
+
+            if (--report.remaining > 0)
+                schedule(now + report.interval, report);
+        }
+        lock_.unlock();
+
+        msleep(kTickMsecs);
+    }
+}
@@ -0,0 +1,94 @@
+/*
+Copyright (C) 2017 Srivats P.
+
+
+This file is part of "Ostinato"
+
+This is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+
+#ifndef _MCAST_REPORTER_H
+#define _MCAST_REPORTER_H
+
+#include "device.h"
+#include "timerwheel.h"
+
+#include <QElapsedTimer>
+#include <QList>
+#include <QMutex>
+#include <QSet>
+#include <QThread>
+
+class DeviceManager;
+
+/*!
+  Sends the IGMPv3/MLDv2 reports of a port's devices - the unsolicited
+  reports on joining their groups and the replies to queries
+
+  A query is handled for all the member devices at once (by the
+  DeviceManager) - each device's reply is scheduled at a random delay
+  within the max response time of the query, as a host would; so the
+  replies of thousands of devices are spread out instead of arriving at
+  the querier together. A device with a reply already pending doesn't
+  schedule another. Reports are sent at (upto) a configured rate, in
+  batches every tick, driven by a TimerWheel
+
+  A report has all the groups of a device (as many as fit in a packet) -
+  so a device with 1000 groups sends 6 IGMP packets, not 1000
+
+  The thread runs only while there are reports pending
+*/
+class McastReporter : public QThread
+{
+public:
+    struct Report {
+        DeviceKey device;
+        bool isIp6;
+        int recordType;     // McastGroups::RecordType
+        int remaining;      // reports still to be sent, interval apart
+        int interval;       // msecs
+    };
+
+    McastReporter(DeviceManager *deviceManager, int portId);
+    ~McastReporter();
+
+    void join(const DeviceKey &device, bool isIp6, int robustness,
+              int interval);
+    void query(const DeviceKey &device, bool isIp6, int maxRespMsecs);
+    void clear();
+
+protected:
+    void run();
+
+private:
+    void schedule(qint64 msecs, const Report &report);
+
+    static const int kTickMsecs = 10;
+
+    DeviceManager *deviceManager_;
+    int portId_;
+    int rate_;          // reports/sec
+
+    QMutex lock_;       // for all of the below
+    TimerWheel<Report> wheel_; // tick: kTickMsecs of timer_
+    QElapsedTimer timer_;
+    QSet<DeviceKey> pendingIp4_; // devices with a query reply pending
+    QSet<DeviceKey> pendingIp6_;
+    uint generation_;   // incremented by clear()
+    bool isActive_;
+    volatile bool stop_;
+};
+
+#endif
@@ -33,17 +33,33 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 
 #include "../common/streambase.h"
 #include "../rpc/pbrpccontroller.h"
+#include "captureanalytics.h"
+#include "captureindex.h"
+#include "capturemerger.h"
 #include "device.h"
 #include "devicemanager.h"
+#include "latencyclock.h"
+#include "packetbuffer.h"
+#include "packetlistbuilder.h"
 #include "portmanager.h"
-
+#include "settings.h"
+#include "statshistory.h"
+#include "statssubscriber.h"
+#include "throughputtest.h"
+#include "tracebuffer.h"
+
+#include <QSet>
+#include <QtConcurrentMap>
 #include <QStringList>
+#include <QWaitCondition>
+#include <pcap.h>
 
 
 extern Drone *drone;
 extern char *version;
 
 MyService::MyService()
+    : captureMerger(NULL), rpcMetrics("rpc")
 {
     PortManager *portManager = PortManager::instance();
     int n = portManager->portCount();
@@ -55,11 +71,67 @@ MyService::MyService()
 #else
         portLock.append(new QReadWriteLock());
 #endif
+        streamSnapshots.append(StreamSnapshotPtr(new StreamSnapshot));
+        publishStreamSnapshot(i);
+        builders.append(NULL);
+        throughputTests.append(NULL);
+        captureIndex.append(new CaptureIndex);
+
+        connect(portInfo[i]->deviceManager()->neighborResolver(),
+                SIGNAL(progress(int, int, int, int, int)),
+                this,
+                SLOT(on_neighborResolver_progress(int, int, int, int, int)));
     }
+
+    buildProgressTimer.setInterval(kBuildProgressMsecs);
+    connect(&buildProgressTimer, SIGNAL(timeout()),
+            this, SLOT(on_buildProgressTimer_timeout()));
+
+    statsHistory = NULL;
+    if (appSettings->value(kStatsHistorySizeKey,
+                kStatsHistorySizeDefaultValue).toInt() > 0)
+        statsHistory = new StatsHistory(this, n,
+                appSettings->value(kStatsHistorySizeKey,
+                    kStatsHistorySizeDefaultValue).toInt(),
+                appSettings->value(kStatsHistoryMaxStreamsKey,
+                    kStatsHistoryMaxStreamsDefaultValue).toInt());
 }
 
 MyService::~MyService()
 {
+    buildersLock.lock();
+    for (int i = 0; i < builders.size(); i++) {
+        if (builders.at(i)) {
+            builders.at(i)->wait();
+            delete builders.at(i);
+        }
+    }
+    builders.clear();
+    buildersLock.unlock();
+
+    throughputTestsLock.lock();
+    while (!throughputTests.isEmpty()) {
+        ThroughputTest *test = throughputTests.takeFirst();
+
+        if (test) {
+            test->stop();
+            test->wait();
+            delete test;
+        }
+    }
+    throughputTestsLock.unlock();
+
+    captureMergerLock.lock();
+    if (captureMerger) {
+        captureMerger->stop();
+        captureMerger->wait();
+        delete captureMerger;
+        captureMerger = NULL;
+    }
+    captureMergerLock.unlock();
+
+    while (!captureIndex.isEmpty())
+        delete captureIndex.takeFirst();
     while (!portLock.isEmpty())
         delete portLock.takeFirst();
     //! \todo Use a singleton destroyer instead 
@@ -67,6 +139,89 @@ MyService::~MyService()
     delete PortManager::instance();
 }
 
+/*!
+  Publishes a new snapshot of the port's streams - caller should hold the
+  port lock for write
+*/
+void MyService::publishStreamSnapshot(int portId)
+{
+    StreamSnapshot *snapshot = new StreamSnapshot;
+    AbstractPort *port = portInfo[portId];
+
+    snapshot->idList.mutable_port_id()->set_id(portId);
+    for (int i = 0; i < port->streamCount(); i++)
+    {
+        StreamBase *stream = port->streamAtIndex(i);
+
+        snapshot->idList.add_stream_id()->set_id(stream->id());
+        snapshot->streams.insert(stream->id(), stream->serializedConfig());
+    }
+
+    // Readers of the old snapshot (if any) retain it till they are done;
+    // else it is freed when 'old' goes out of scope - outside the lock
+    StreamSnapshotPtr next(snapshot);
+    StreamSnapshotPtr old;
+
+    snapshotLock.lock();
+    old = streamSnapshots.at(portId);
+    streamSnapshots[portId] = next;
+    snapshotLock.unlock();
+}
+
+static void preflightStream(StreamBase* &stream)
+{
+    QStringList result;
+
+    stream->cachedPreflightCheck(result);
+}
+
+/*!
+  Adds the preflight check warnings of the streams (that fail it) to ack -
+  the checks are run in parallel and their results cached by the streams,
+  so a stream is checked again only after it is changed. Caller should
+  hold the port lock for write
+*/
+void MyService::preflightStreams(QList<StreamBase*> streams,
+                                 OstProto::Ack *ack)
+{
+    QtConcurrent::blockingMap(streams, preflightStream);
+
+    foreach (StreamBase *stream, streams)
+    {
+        QStringList result;
+        OstProto::StreamPreflight *preflight;
+
+        if (stream->cachedPreflightCheck(result))
+            continue;
+
+        preflight = ack->add_stream_preflight();
+        preflight->mutable_stream_id()->set_id(stream->id());
+        foreach (const QString &warning, result)
+            preflight->add_warning(warning.toStdString());
+    }
+}
+
+MyService::StreamSnapshotPtr MyService::streamSnapshot(int portId)
+{
+    QMutexLocker locker(&snapshotLock);
+
+    return streamSnapshots.at(portId);
+}
+
+/*!
+  Tells the clients to refetch the port config - e.g. for the transmit
+  estimate updated by a packet list build
+*/
+void MyService::notifyPortConfigChanged(int portId)
+{
+    // notification needs to be on heap because signal/slot is across threads!
+    OstProto::Notification *notif = new OstProto::Notification;
+
+    notif->set_notif_type(OstProto::portConfigChanged);
+    notif->mutable_port_id_list()->add_port_id()->set_id(portId);
+    emit notification(notif->notif_type(), SharedProtobufMessage(notif));
+}
+
 void MyService::getPortIdList(::google::protobuf::RpcController* /*controller*/,
     const ::OstProto::Void* /*request*/,
     ::OstProto::PortIdList* response,
@@ -163,16 +318,7 @@ void MyService::getStreamIdList(::google::protobuf::RpcController* controller,
     if ((portId < 0) || (portId >= portInfo.size()))
         goto _invalid_port;
 
-    response->mutable_port_id()->set_id(portId);
-    portLock[portId]->lockForRead();
-    for (int i = 0; i < portInfo[portId]->streamCount(); i++)
-    {
-        OstProto::StreamId    *s;
-
-        s = response->add_stream_id();
-        s->set_id(portInfo[portId]->streamAtIndex(i)->id());
-    }
-    portLock[portId]->unlock();
+    response->CopyFrom(streamSnapshot(portId)->idList);
 
     done->Run();
     return;
@@ -195,21 +341,32 @@ void MyService::getStreamConfig(::google::protobuf::RpcController* controller,
     if ((portId < 0) || (portId >= portInfo.size()))
         goto _invalid_port;
 
-    response->mutable_port_id()->set_id(portId);
-    portLock[portId]->lockForRead();
-    for (int i = 0; i < request->stream_id_size(); i++)
     {
-        StreamBase          *stream;
-        OstProto::Stream    *s;
+        StreamSnapshotPtr snapshot = streamSnapshot(portId);
+        const google::protobuf::RepeatedPtrField<OstProto::StreamId> &ids =
+            request->all_streams() ?
+                snapshot->idList.stream_id() : request->stream_id();
+        google::protobuf::UnknownFieldSet *streams =
+            response->mutable_unknown_fields();
+
+        // The serialized configs are added as (unknown) fields of the
+        // 'stream' field number - on the wire, that is the same as adding
+        // them to 'stream', but without parsing and reserializing them
+
+        response->mutable_port_id()->set_id(portId);
+        for (int i = 0; i < ids.size(); i++)
+        {
+            QHash<uint, QByteArray>::const_iterator stream =
+                snapshot->streams.constFind(ids.Get(i).id());
 
-        stream = portInfo[portId]->stream(request->stream_id(i).id());
-        if (!stream)
-            continue;        //! \todo(LOW): Partial status of RPC
+            if (stream == snapshot->streams.constEnd())
+                continue;    //! \todo(LOW): Partial status of RPC
 
-        s = response->add_stream();
-        stream->protoDataCopyInto(*s);
+            streams->AddLengthDelimited(
+                    OstProto::StreamConfigList::kStreamFieldNumber)->assign(
+                        stream.value().constData(), stream.value().size());
+        }
     }
-    portLock[portId]->unlock();
 
     done->Run();
     return;
@@ -232,7 +389,8 @@ void MyService::addStream(::google::protobuf::RpcController* controller,
     if ((portId < 0) || (portId >= portInfo.size()))
         goto _invalid_port;
 
-    if (portInfo[portId]->isTransmitOn())
+    if (portInfo[portId]->isTransmitOn()
+            && !portInfo[portId]->isLiveUpdatable())
         goto _port_busy;
 
     portLock[portId]->lockForWrite();
@@ -252,6 +410,7 @@ void MyService::addStream(::google::protobuf::RpcController* controller,
         stream->setId(request->stream_id(i).id());
         portInfo[portId]->addStream(stream);
     }
+    publishStreamSnapshot(portId);
     portLock[portId]->unlock();
 
     //! \todo (LOW): fill-in response "Ack"????
@@ -282,12 +441,23 @@ void MyService::deleteStream(::google::protobuf::RpcController* controller,
     if ((portId < 0) || (portId >= portInfo.size()))
         goto _invalid_port;
 
-    if (portInfo[portId]->isTransmitOn())
+    if (portInfo[portId]->isTransmitOn()
+            && !portInfo[portId]->isLiveUpdatable())
         goto _port_busy;
 
     portLock[portId]->lockForWrite();
-    for (int i = 0; i < request->stream_id_size(); i++)
-        portInfo[portId]->deleteStream(request->stream_id(i).id());
+    {
+        QSet<uint> ids;
+
+        for (int i = 0; i < request->stream_id_size(); i++)
+            ids.insert(request->stream_id(i).id());
+        portInfo[portId]->deleteStreams(ids);
+    }
+    publishStreamSnapshot(portId);
+
+    // Stop sending the deleted streams right away
+    if (portInfo[portId]->isDirty())
+        portInfo[portId]->updatePacketList();
     portLock[portId]->unlock();
 
     //! \todo (LOW): fill-in response "Ack"????
@@ -306,10 +476,11 @@ _exit:
 
 void MyService::modifyStream(::google::protobuf::RpcController* controller,
     const ::OstProto::StreamConfigList* request,
-    ::OstProto::Ack* /*response*/,
+    ::OstProto::Ack* response,
     ::google::protobuf::Closure* done)
 {
     int    portId;
+    QList<StreamBase*> streams;
 
     qDebug("In %s", __PRETTY_FUNCTION__);
 
@@ -317,7 +488,10 @@ void MyService::modifyStream(::google::protobuf::RpcController* controller,
     if ((portId < 0) || (portId >= portInfo.size()))
         goto _invalid_port;
 
-    if (portInfo[portId]->isTransmitOn())
+    // Streams may be changed while transmitting only if the port can
+    // switch to the new packet list without stopping
+    if (portInfo[portId]->isTransmitOn()
+            && !portInfo[portId]->isLiveUpdatable())
         goto _port_busy;
 
     portLock[portId]->lockForWrite();
@@ -328,18 +502,32 @@ void MyService::modifyStream(::google::protobuf::RpcController* controller,
         stream = portInfo[portId]->stream(request->stream(i).stream_id().id());
         if (stream)
         {
+            OstProto::Stream config;
+            OstProto::StreamDelta delta;
+
+            streams.append(stream);
+
+            // A rate change alone doesn't need the frames to be rebuilt;
+            // an unchanged stream retains its cached serialized config
+            // and preflight check
+            stream->protoDataCopyInto(config);
+            if (!StreamBase::makeDelta(config, request->stream(i), delta))
+                continue;
+
             stream->protoDataCopyFrom(request->stream(i));
-            portInfo[portId]->setDirty();
+            portInfo[portId]->setStreamDirty(stream->id(),
+                    StreamBase::isRateOnlyDelta(delta));
         }
     }
+    publishStreamSnapshot(portId);
+    preflightStreams(streams, response);
 
     if (portInfo[portId]->isDirty())
         portInfo[portId]->updatePacketList();
     portLock[portId]->unlock();
 
-    //! \todo(LOW): fill-in response "Ack"????
-
     done->Run();
+    notifyPortConfigChanged(portId);
     return;
 
 _port_busy:
@@ -351,7 +539,8 @@ _exit:
     done->Run();
 }
 
-void MyService::startTransmit(::google::protobuf::RpcController* /*controller*/,
+void MyService::prepareTransmit(
+    ::google::protobuf::RpcController* /*controller*/,
     const ::OstProto::PortIdList* request,
     ::OstProto::Ack* /*response*/,
     ::google::protobuf::Closure* done)
@@ -360,24 +549,243 @@ void MyService::startTransmit(::google::protobuf::RpcController* /*controller*/,
 
     for (int i = 0; i < request->port_id_size(); i++)
     {
+        PacketListBuilder *builder;
         int portId;
+        int streamCount;
+        bool isDirty;
 
         portId = request->port_id(i).id();
         if ((portId < 0) || (portId >= portInfo.size()))
             continue;     //! \todo (LOW): partial RPC?
 
+        portLock[portId]->lockForRead();
+        isDirty = portInfo[portId]->isDirty()
+                        && !portInfo[portId]->isTransmitOn();
+        streamCount = portInfo[portId]->streamCount();
+        portLock[portId]->unlock();
+
+        if (!isDirty)
+            continue;
+
+        buildersLock.lock();
+        if (builders.at(portId)) {
+            buildersLock.unlock();
+            continue; // build already in progress
+        }
+        builder = new PacketListBuilder(portId, portInfo[portId],
+                                        portLock[portId]);
+        // deleted by us when done, not by the RPC connection's thread
+        builder->moveToThread(thread());
+        connect(builder, SIGNAL(finished()),
+                this, SLOT(on_packetListBuilder_finished()));
+        builders[portId] = builder;
+        builder->start();
+        buildersLock.unlock();
+
+        emitBuildProgress(portId, OstProto::BuildProgress::kBuildStarted,
+                          streamCount);
+        // Timer is of our thread, not the RPC connection's
+        QMetaObject::invokeMethod(&buildProgressTimer, "start",
+                                  Qt::QueuedConnection);
+    }
+
+    //! \todo (LOW): fill-in response "Ack"????
+
+    done->Run();
+}
+
+void MyService::on_packetListBuilder_finished()
+{
+    PacketListBuilder *builder = qobject_cast<PacketListBuilder*>(sender());
+
+    if (!builder)
+        return;
+
+    buildersLock.lock();
+    if (builders.value(builder->portId()) == builder)
+        builders[builder->portId()] = NULL;
+    buildersLock.unlock();
+
+    emitBuildProgress(builder->portId(), builder->isCancelled() ?
+                OstProto::BuildProgress::kBuildCancelled :
+                OstProto::BuildProgress::kBuildDone,
+            streamSnapshot(builder->portId())->idList.stream_id_size(),
+            builder->elapsedMsecs());
+    // The build may have changed the port notes (build time)
+    if (builder->isBuilt() || builder->isCancelled())
+        notifyPortConfigChanged(builder->portId());
+    builder->deleteLater();
+}
+
+void MyService::on_buildProgressTimer_timeout()
+{
+    QList<int> building;
+
+    buildersLock.lock();
+    for (int i = 0; i < builders.size(); i++) {
+        if (builders.at(i))
+            building.append(i);
+    }
+    buildersLock.unlock();
+
+    if (building.isEmpty()) {
+        buildProgressTimer.stop();
+        return;
+    }
+
+    foreach(int portId, building)
+        emitBuildProgress(portId, OstProto::BuildProgress::kBuildInProgress,
+                streamSnapshot(portId)->idList.stream_id_size());
+}
+
+void MyService::emitBuildProgress(int portId,
+                                  OstProto::BuildProgress::State state,
+                                  int streamCount, int elapsedMsecs)
+{
+    // notification needs to be on heap because signal/slot is across threads!
+    OstProto::Notification *notif = new OstProto::Notification;
+    OstProto::BuildProgress *progress = notif->mutable_build_progress();
+    int streamsDone;
+    quint64 framesBuilt, bytes;
+
+    notif->set_notif_type(OstProto::portBuildProgress);
+    progress->mutable_port_id()->set_id(portId);
+    progress->set_state(state);
+    progress->set_stream_count(streamCount);
+    if ((state == OstProto::BuildProgress::kBuildDone)
+            || (state == OstProto::BuildProgress::kBuildCancelled))
+        progress->set_elapsed_msec(elapsedMsecs);
+    if (state != OstProto::BuildProgress::kBuildStarted) {
+        // Doesn't need the port lock (held by the build)
+        portInfo[portId]->packetListBuildProgress(&streamsDone,
+                &framesBuilt, &bytes);
+        progress->set_streams_done(streamsDone);
+        progress->set_frames_built(framesBuilt);
+        progress->set_bytes_allocated(bytes);
+    }
+
+    emit notification(notif->notif_type(), SharedProtobufMessage(notif));
+}
+
+void MyService::on_neighborResolver_progress(int portId, int pending,
+        int sent, int resolved, int failed)
+{
+    // notification needs to be on heap because signal/slot is across threads!
+    OstProto::Notification *notif = new OstProto::Notification;
+    OstProto::ResolveProgress *progress = notif->mutable_resolve_progress();
+
+    notif->set_notif_type(OstProto::neighborResolveProgress);
+    progress->mutable_port_id()->set_id(portId);
+    progress->set_pending(pending);
+    progress->set_sent(sent);
+    progress->set_resolved(resolved);
+    progress->set_failed(failed);
+
+    emit notification(notif->notif_type(), SharedProtobufMessage(notif));
+}
+
+/*!
+  Returns the valid and unique port ids of the list in ascending order -
+  the order in which the port locks of multiple ports should be taken so
+  that concurrent requests for overlapping ports can't deadlock
+*/
+QList<int> MyService::sortedPortIds(const OstProto::PortIdList &list)
+{
+    QList<int> portIds;
+
+    for (int i = 0; i < list.port_id_size(); i++)
+    {
+        int portId;
+
+        portId = list.port_id(i).id();
+        if ((portId < 0) || (portId >= portInfo.size()))
+            continue;     //! \todo (LOW): partial RPC?
+
+        if (!portIds.contains(portId))
+            portIds.append(portId);
+    }
+    qSort(portIds);
+
+    return portIds;
+}
+
+void MyService::startTransmit(::google::protobuf::RpcController* /*controller*/,
+    const ::OstProto::PortIdList* request,
+    ::OstProto::Ack* /*response*/,
+    ::google::protobuf::Closure* done)
+{
+    QList<int> portIds = sortedPortIds(*request);
+
+    qDebug("In %s", __PRETTY_FUNCTION__);
+
+    // A build in progress (prepareTransmit) holds the lock till it is done
+    foreach (int portId, portIds) {
         portLock[portId]->lockForWrite();
         if (portInfo[portId]->isDirty())
             portInfo[portId]->updatePacketList();
+    }
+
+    // Start only after all packet lists are built to minimize the skew
+    // between ports
+    foreach (int portId, portIds) {
+        TraceBuffer::record(OstProto::TraceRecord::kTransmitStart, portId);
         portInfo[portId]->startTransmit();
-        portLock[portId]->unlock();
     }
 
+    foreach (int portId, portIds)
+        portLock[portId]->unlock();
+
     //! \todo (LOW): fill-in response "Ack"????
 
     done->Run();
 }
 
+void MyService::startTransmitSync(
+    ::google::protobuf::RpcController* controller,
+    const ::OstProto::SyncStartRequest* request,
+    ::OstProto::Ack* /*response*/,
+    ::google::protobuf::Closure* done)
+{
+    QList<int> portIds = sortedPortIds(request->port_id_list());
+    StartBarrierPtr barrier(new StartBarrier(request->start_time()));
+
+    qDebug("In %s", __PRETTY_FUNCTION__);
+
+    foreach (int portId, portIds)
+        portLock[portId]->lockForWrite();
+
+    foreach (int portId, portIds) {
+        if (portInfo[portId]->isTransmitOn())
+            goto _port_busy;
+    }
+
+    foreach (int portId, portIds) {
+        if (portInfo[portId]->isDirty())
+            portInfo[portId]->updatePacketList();
+    }
+
+    // The tx workers wait for the barrier, which is released (at the
+    // requested time) once all of them are armed
+    foreach (int portId, portIds) {
+        TraceBuffer::record(OstProto::TraceRecord::kTransmitStart, portId);
+        portInfo[portId]->setTransmitStopTime(request->stop_time());
+        portInfo[portId]->armTransmit(barrier);
+    }
+    barrier->seal();
+
+    foreach (int portId, portIds)
+        portLock[portId]->unlock();
+
+    goto _exit;
+
+_port_busy:
+    foreach (int portId, portIds)
+        portLock[portId]->unlock();
+    controller->SetFailed("Port Busy");
+_exit:
+    done->Run();
+}
+
 void MyService::stopTransmit(::google::protobuf::RpcController* /*controller*/,
     const ::OstProto::PortIdList* request,
     ::OstProto::Ack* /*response*/,
@@ -394,6 +802,7 @@ void MyService::stopTransmit(::google::protobuf::RpcController* /*controller*/,
             continue;     //! \todo (LOW): partial RPC?
 
         portLock[portId]->lockForWrite();
+        TraceBuffer::record(OstProto::TraceRecord::kTransmitStop, portId);
         portInfo[portId]->stopTransmit();
         portLock[portId]->unlock();
     }
@@ -419,7 +828,8 @@ void MyService::startCapture(::google::protobuf::RpcController* /*controller*/,
             continue;     //! \todo (LOW): partial RPC?
 
         portLock[portId]->lockForWrite();
-        portInfo[portId]->startCapture(NULL);
+        portInfo[portId]->startCapture(NULL, OstProto::CaptureConfig());
+        captureIndex[portId]->reset();
         portLock[portId]->unlock();
     }
 
@@ -446,7 +856,9 @@ void MyService::startFilteredCapture(::google::protobuf::RpcController* /*contro
             continue;     //! \todo (LOW): partial RPC?
 
         portLock[portId]->lockForWrite();
-        portInfo[portId]->startCapture(filter.c_str());
+        portInfo[portId]->startCapture(filter.c_str(),
+                                       request->port_id(i).config());
+        captureIndex[portId]->reset();
         portLock[portId]->unlock();
     }
 
@@ -493,7 +905,12 @@ void MyService::getCaptureBuffer(::google::protobuf::RpcController* controller,
         goto _invalid_port;
 
     portLock[portId]->lockForWrite();
-    portInfo[portId]->stopCapture();
+    if (portInfo[portId]->isCaptureRing()) {
+        portInfo[portId]->snapshotCaptureRing();
+        captureIndex[portId]->reset();
+    }
+    else
+        portInfo[portId]->stopCapture();
     static_cast<PbRpcController*>(controller)->setBinaryBlob(
         portInfo[portId]->captureData());
     portLock[portId]->unlock();
@@ -506,6 +923,195 @@ _invalid_port:
     done->Run();
 }
 
+void MyService::getCaptureChunk(::google::protobuf::RpcController* controller,
+    const ::OstProto::CaptureChunkRequest* request,
+    ::OstProto::CaptureChunk* response,
+    ::google::protobuf::Closure* done)
+{
+    // Don't hold the port lock or the RPC for too long - neither with
+    // a filter that matches few (or no) records
+    const uint kMaxChunkLength = 16*1024*1024;
+    const quint64 kMaxScanLength = 64*1024*1024;
+    // pcap file and record header sizes
+    const int kFileHdrSize = 24;
+    const int kRecordHdrSize = 16;
+
+    int portId;
+    QIODevice *file;
+    QIODevice *digests = NULL;
+    pcap_t *deadHandle = NULL;
+    struct bpf_program filter;
+    bool hasFilter = false;
+    bool isSwapped;
+    quint32 magic;
+    quint64 offset = request->offset();
+    quint64 scanStart;
+    quint64 size;
+    quint64 packetIndex = 0;
+    uint maxLength = qMax(1U, qMin(request->length(), kMaxChunkLength));
+    uint snapLen = request->snap_len();
+    QByteArray hdr;
+    std::string *data = response->mutable_data();
+
+    //qDebug("In %s", __PRETTY_FUNCTION__);
+
+    portId = request->port_id().id();
+    if ((portId < 0) || (portId >= portInfo.size()))
+        goto _invalid_port;
+
+    if (request->has_filter() && !request->filter().empty()) {
+        deadHandle = pcap_open_dead(DLT_EN10MB, 65535);
+        if (pcap_compile(deadHandle, &filter, request->filter().c_str(), 1,
+                    PCAP_NETMASK_UNKNOWN) < 0)
+            goto _invalid_filter;
+        hasFilter = true;
+    }
+
+    response->mutable_port_id()->set_id(portId);
+
+    portLock[portId]->lockForWrite();
+
+    if ((offset == 0) && portInfo[portId]->isCaptureRing()) {
+        portInfo[portId]->snapshotCaptureRing();
+        captureIndex[portId]->reset();
+    }
+    response->set_is_capture_on(portInfo[portId]->isCaptureOn());
+
+    file = portInfo[portId]->captureData();
+    size = file->size();
+    response->set_capture_size(size);
+
+    // The file header tells the byte order of the record headers; an
+    // incomplete file header => no data yet
+    if (!file->seek(0) || ((hdr = file->read(kFileHdrSize)).size()
+                                < kFileHdrSize))
+        goto _done;
+
+    magic = *((const quint32*) hdr.constData());
+    if ((magic == 0xa1b2c3d4) || (magic == 0xa1b23c4d))
+        isSwapped = false;
+    else if ((magic == 0xd4c3b2a1) || (magic == 0x4d3cb2a1))
+        isSwapped = true;
+    else {
+        qWarning("%s: capture file is not a pcap file", __FUNCTION__);
+        goto _done;
+    }
+
+    if (offset == 0) {
+        if (snapLen) {
+            quint32 *p = (quint32*) (hdr.data() + 16); // snaplen
+            *p = isSwapped ? qbswap(quint32(snapLen)) : snapLen;
+        }
+        data->append(hdr.constData(), hdr.size());
+        offset = kFileHdrSize;
+    }
+
+    // Digests are per packet index - known only at the first record or
+    // at a packet_index/start_time
+    if (request->payload_digests() && (offset == kFileHdrSize))
+        digests = portInfo[portId]->captureDigests();
+
+    // Index any new records and start at the requested packet/time, if any
+    captureIndex[portId]->update(file);
+    response->set_packet_count(captureIndex[portId]->packetCount());
+    if (request->has_packet_index() || request->has_start_time())
+    {
+        quint64 index = request->packet_index();
+        quint64 start;
+        bool found = request->has_packet_index() ?
+            captureIndex[portId]->findPacket(file, index, start) :
+            captureIndex[portId]->findTime(file, request->start_time(),
+                                           start, index);
+
+        // Not captured yet - no records
+        if (!found)
+            goto _done;
+        response->set_first_packet_index(index);
+        offset = start;
+        packetIndex = index;
+        if (request->payload_digests())
+            digests = portInfo[portId]->captureDigests();
+    }
+
+    // Only whole records - the capture may be in the midst of writing one
+    if (!file->seek(offset))
+        goto _done;
+    scanStart = offset;
+    while (((offset + kRecordHdrSize) <= size)
+            && ((offset - scanStart) < kMaxScanLength))
+    {
+        QByteArray rec = file->read(kRecordHdrSize);
+        quint32 *f = (quint32*) rec.data();
+        struct pcap_pkthdr pktHdr;
+        QByteArray frame;
+        QByteArray digest;
+
+        if (rec.size() < kRecordHdrSize)
+            break;
+
+        pktHdr.ts.tv_sec = 0;
+        pktHdr.ts.tv_usec = 0;
+        pktHdr.caplen = isSwapped ? qbswap(f[2]) : f[2];
+        pktHdr.len = isSwapped ? qbswap(f[3]) : f[3];
+        if (pktHdr.caplen > 256*1024) {
+            qWarning("%s: bad capture record at %llu", __FUNCTION__, offset);
+            break;
+        }
+        if ((offset + kRecordHdrSize + pktHdr.caplen) > size)
+            break;
+
+        frame = file->read(pktHdr.caplen);
+        if (frame.size() < int(pktHdr.caplen))
+            break;
+
+        // The digest may not be written out yet - the record is for later
+        if (digests && (!digests->seek(packetIndex*8)
+                    || ((digest = digests->read(8)).size() < 8)))
+            break;
+
+        if (!hasFilter || pcap_offline_filter(&filter, &pktHdr,
+                                (const uchar*) frame.constData())) {
+            uint caplen = (snapLen && (pktHdr.caplen > snapLen)) ?
+                                snapLen : pktHdr.caplen;
+
+            // At least one record per chunk
+            if (data->size() && ((data->size() + kRecordHdrSize + caplen)
+                                    > maxLength))
+                break;
+
+            f[2] = isSwapped ? qbswap(quint32(caplen)) : caplen;
+            data->append(rec.constData(), kRecordHdrSize);
+            data->append(frame.constData(), caplen);
+            if (digests)
+                response->add_payload_digest(qFromLittleEndian<quint64>(
+                            (const uchar*) digest.constData()));
+        }
+        offset += kRecordHdrSize + pktHdr.caplen;
+        packetIndex++;
+    }
+
+_done:
+    portLock[portId]->unlock();
+    response->set_next_offset(offset);
+
+    if (hasFilter)
+        pcap_freecode(&filter);
+    if (deadHandle)
+        pcap_close(deadHandle);
+    done->Run();
+    return;
+
+_invalid_filter:
+    controller->SetFailed("invalid filter");
+    pcap_close(deadHandle);
+    done->Run();
+    return;
+
+_invalid_port:
+    controller->SetFailed("invalid portid");
+    done->Run();
+}
+
 void MyService::getStats(::google::protobuf::RpcController* /*controller*/,
     const ::OstProto::PortIdList* request,
     ::OstProto::PortStatsList* response,
@@ -515,49 +1121,107 @@ void MyService::getStats(::google::protobuf::RpcController* /*controller*/,
 
     for (int i = 0; i < request->port_id_size(); i++)
     {
-        int     portId;
-        AbstractPort::PortStats stats;
-        OstProto::PortStats     *s;
-        OstProto::PortState     *st;
+        int portId = request->port_id(i).id();
 
-        portId = request->port_id(i).id();
         if ((portId < 0) || (portId >= portInfo.size()))
             continue;     //! \todo(LOW): partial rpc?
 
-        s = response->add_port_stats();
-        s->mutable_port_id()->set_id(request->port_id(i).id());
+        portStats(portId, response->add_port_stats());
+    }
+
+    done->Run();
+}
 
-        st = s->mutable_state(); 
-        portLock[portId]->lockForRead();
-        st->set_link_state(portInfo[portId]->linkState()); 
-        st->set_is_transmit_on(portInfo[portId]->isTransmitOn()); 
-        st->set_is_capture_on(portInfo[portId]->isCaptureOn()); 
+/*!
+  Fills in all the stats of a (valid) port - for getStats and the stats
+  notifications of a subscription
+*/
+void MyService::portStats(int portId, OstProto::PortStats *s)
+{
+    AbstractPort::PortStats stats;
+    StreamStatsHash         streamStats;
+    QStringList             filterNames;
+    QList<quint64>          filterCounts;
+    QStringList             nicCounterNames;
+    QList<quint64>          nicCounters;
+    OstProto::PortState     *st;
 
-        portInfo[portId]->stats(&stats);
-        portLock[portId]->unlock();
+    Q_ASSERT((portId >= 0) && (portId < portInfo.size()));
+
+    s->mutable_port_id()->set_id(portId);
+
+    // No portLock - see the NOTES in myservice.h
+    st = s->mutable_state(); 
+    st->set_link_state(portInfo[portId]->linkState()); 
+    st->set_is_transmit_on(portInfo[portId]->isTransmitOn()); 
+    st->set_is_capture_on(portInfo[portId]->isCaptureOn()); 
+
+    portInfo[portId]->stats(&stats);
+    portInfo[portId]->streamStats(streamStats);
+    portInfo[portId]->filterCounts(filterNames, filterCounts);
+    portInfo[portId]->nicCounters(nicCounterNames, nicCounters);
 
 #if 0
-        if (portId == 2)
-            qDebug(">%llu", stats.rxPkts);
+    if (portId == 2)
+        qDebug(">%llu", stats.rxPkts);
 #endif
 
-        s->set_rx_pkts(stats.rxPkts);
-        s->set_rx_bytes(stats.rxBytes);
-        s->set_rx_pps(stats.rxPps);
-        s->set_rx_bps(stats.rxBps);
+    s->set_rx_pkts(stats.rxPkts);
+    s->set_rx_bytes(stats.rxBytes);
+    s->set_rx_pps(stats.rxPps);
+    s->set_rx_bps(stats.rxBps);
+
+    s->set_tx_pkts(stats.txPkts);
+    s->set_tx_bytes(stats.txBytes);
+    s->set_tx_pps(stats.txPps);
+    s->set_tx_bps(stats.txBps);
+    if (portInfo[portId]->hasRateControl())
+        s->set_tx_rate_error(stats.txRateError);
+
+    quint64 runPkts, runBytes, runNsec;
+    if (portInfo[portId]->transmitRunStats(&runPkts, &runBytes, &runNsec)) {
+        s->set_tx_run_pkts(runPkts);
+        s->set_tx_run_bytes(runBytes);
+        s->set_tx_run_duration(runNsec);
+    }
+
+    s->set_rx_drops(stats.rxDrops);
+    s->set_rx_errors(stats.rxErrors);
+    s->set_rx_fifo_errors(stats.rxFifoErrors);
+    s->set_rx_frame_errors(stats.rxFrameErrors);
+    s->set_rx_pcap_drops(stats.rxPcapDrops);
+    s->set_rx_pcap_if_drops(stats.rxPcapIfDrops);
+
+    quint64 lost = 0, reordered = 0, duplicates = 0, late = 0;
+    quint64 payloadErrors = 0;
+    for (StreamStatsHash::const_iterator j = streamStats.constBegin();
+            j != streamStats.constEnd(); j++)
+    {
+        lost += j.value().rxLost;
+        reordered += j.value().rxReordered;
+        duplicates += j.value().rxDuplicates;
+        late += j.value().rxLate;
+        payloadErrors += j.value().rxPayloadErrors;
+    }
+    s->set_rx_stream_lost(lost);
+    s->set_rx_stream_reordered(reordered);
+    s->set_rx_stream_duplicates(duplicates);
+    s->set_rx_stream_late(late);
+    s->set_rx_stream_payload_errors(payloadErrors);
 
-        s->set_tx_pkts(stats.txPkts);
-        s->set_tx_bytes(stats.txBytes);
-        s->set_tx_pps(stats.txPps);
-        s->set_tx_bps(stats.txBps);
+    for (int j = 0; j < filterNames.size(); j++) {
+        OstProto::FilterCount *fc = s->add_filter_count();
 
-        s->set_rx_drops(stats.rxDrops);
-        s->set_rx_errors(stats.rxErrors);
-        s->set_rx_fifo_errors(stats.rxFifoErrors);
-        s->set_rx_frame_errors(stats.rxFrameErrors);
+        fc->set_name(filterNames.at(j).toStdString());
+        fc->set_rx_pkts(filterCounts.at(j));
     }
 
-    done->Run();
+    for (int j = 0; j < nicCounterNames.size(); j++) {
+        OstProto::NicCounter *nc = s->add_nic_counter();
+
+        nc->set_name(nicCounterNames.at(j).toStdString());
+        nc->set_value(nicCounters.at(j));
+    }
 }
 
 void MyService::clearStats(::google::protobuf::RpcController* /*controller*/,
@@ -575,9 +1239,9 @@ void MyService::clearStats(::google::protobuf::RpcController* /*controller*/,
         if ((portId < 0) || (portId >= portInfo.size()))
             continue;     //! \todo (LOW): partial RPC?
 
-        portLock[portId]->lockForWrite();
         portInfo[portId]->resetStats();
-        portLock[portId]->unlock();
+        portInfo[portId]->resetStreamStats();
+        portInfo[portId]->resetFilterCounts();
     }
 
     //! \todo (LOW): fill-in response "Ack"????
@@ -585,23 +1249,324 @@ void MyService::clearStats(::google::protobuf::RpcController* /*controller*/,
     done->Run();
 }
 
-void MyService::checkVersion(::google::protobuf::RpcController* controller,
-    const ::OstProto::VersionInfo* request,
-    ::OstProto::VersionCompatibility* response,
+void MyService::getStreamStats(
+    ::google::protobuf::RpcController* /*controller*/,
+    const ::OstProto::PortIdList* request,
+    ::OstProto::StreamStatsList* response,
     ::google::protobuf::Closure* done)
 {
-    QString myVersion(version);
-    QString clientVersion;
-    QStringList my, client;
+    // Stream stats of the tx ports - for their NIC tx delay
+    QHash<int, StreamStatsHash> txPortStats;
 
-    qDebug("In %s", __PRETTY_FUNCTION__);
+    //qDebug("In %s", __PRETTY_FUNCTION__);
 
-    my = myVersion.split('.');
+    for (int i = 0; i < request->port_id_size(); i++)
+    {
+        int portId;
 
-    Q_ASSERT(my.size() >= 2);
+        portId = request->port_id(i).id();
+        if ((portId < 0) || (portId >= portInfo.size()))
+            continue;     //! \todo(LOW): partial rpc?
 
-    clientVersion = QString::fromStdString(request->version());
-    client = clientVersion.split('.');
+        streamStats(portId, response, txPortStats);
+    }
+
+    done->Run();
+}
+
+/*!
+  Adds the stats of the streams seen by the port to list - txPortStats
+  keeps the stream stats of the tx ports (for their NIC tx delay) fetched
+  so far, for the next call
+*/
+void MyService::streamStats(int portId, OstProto::StreamStatsList *list,
+                            QHash<int, StreamStatsHash> &txPortStats,
+                            bool withHistograms)
+{
+    StreamStatsHash stats;
+
+    portInfo[portId]->streamStats(stats);
+
+    for (StreamStatsHash::const_iterator j = stats.constBegin();
+            j != stats.constEnd(); j++)
+    {
+        if ((j.key() & 0xFFFFFFFF) == kProbeStreamId)
+            continue; // see discoverPortPairs()
+
+        OstProto::StreamStats *s = list->add_stream_stats();
+        const StreamStats &ss = j.value();
+        int txPortId = int(j.key() >> 32);
+        quint64 txHwDelay = 0;
+
+        // The signature's tx time is when the frame was queued; if the
+        // tx port knows when the NIC sent the frames, latency is from
+        // then - on average
+        if (ss.rxLatencyCount && (txPortId < portInfo.size())) {
+            if (!txPortStats.contains(txPortId))
+                portInfo[txPortId]->streamStats(txPortStats[txPortId]);
+
+            StreamStatsHash::const_iterator tx =
+                    txPortStats[txPortId].constFind(j.key());
+            if ((tx != txPortStats[txPortId].constEnd())
+                    && tx.value().txHwDelayCount)
+                txHwDelay = tx.value().txHwDelaySum
+                                / tx.value().txHwDelayCount;
+        }
+
+        s->mutable_port_id()->set_id(portId);
+        s->set_tx_port_id(txPortId);
+        s->set_stream_id(j.key() & 0xFFFFFFFF);
+
+        s->set_tx_pkts(ss.txPkts);
+        s->set_tx_bytes(ss.txBytes);
+        s->set_tx_hw_delay_nsec(ss.txHwDelayCount ?
+                ss.txHwDelaySum/ss.txHwDelayCount : 0);
+
+        s->set_rx_pkts(ss.rxPkts);
+        s->set_rx_bytes(ss.rxBytes);
+        s->set_rx_seq_errors(ss.rxSeqErrors);
+        s->set_rx_latency_nsec(ss.rxLatencyCount ?
+                ss.rxLatencySum/ss.rxLatencyCount
+                    - qMin(txHwDelay, ss.rxLatencySum/ss.rxLatencyCount)
+                : 0);
+        s->set_rx_latency_min_nsec(ss.rxLatencyMin
+                - qMin(txHwDelay, ss.rxLatencyMin));
+        s->set_rx_latency_max_nsec(ss.rxLatencyMax
+                - qMin(txHwDelay, ss.rxLatencyMax));
+        s->set_rx_jitter_nsec(ss.rxJitterCount ?
+                ss.rxJitterSum/ss.rxJitterCount : 0);
+
+        for (int k = 0; withHistograms
+                && (k < ss.rxLatencyHistogram.size()); k++)
+        {
+            if (!ss.rxLatencyHistogram.at(k))
+                continue;
+
+            OstProto::LatencyBucket *b = s->add_rx_latency_histogram();
+            b->set_min_nsec(StreamStatsTable::latencyBucketMin(k));
+            b->set_max_nsec(StreamStatsTable::latencyBucketMin(k+1));
+            b->set_count(ss.rxLatencyHistogram.at(k));
+        }
+
+        s->set_rx_lost(ss.rxLost);
+        s->set_rx_reordered(ss.rxReordered);
+        s->set_rx_duplicates(ss.rxDuplicates);
+        s->set_rx_late(ss.rxLate);
+        s->set_rx_payload_errors(ss.rxPayloadErrors);
+    }
+}
+
+void MyService::subscribeStats(::google::protobuf::RpcController* controller,
+    const ::OstProto::StatsSubscription* request,
+    ::OstProto::Ack* /*response*/,
+    ::google::protobuf::Closure* done)
+{
+    QObject *connection;
+    StatsSubscriber *subscriber;
+
+    qDebug("In %s", __PRETTY_FUNCTION__);
+
+    connection = static_cast<PbRpcController*>(controller)->connection();
+    if (!connection)
+        goto _no_connection;
+
+    for (int i = 0; i < request->port_id_size(); i++)
+    {
+        int portId = request->port_id(i).id();
+
+        if ((portId < 0) || (portId >= portInfo.size()))
+            goto _invalid_port;
+    }
+
+    // A client has at most one subscription - owned by its connection, so
+    // that it goes away with the client
+    subscriber = connection->findChild<StatsSubscriber*>();
+    if (!request->port_id_size()) {
+        delete subscriber;
+        goto _exit;
+    }
+
+    if (!subscriber)
+        subscriber = new StatsSubscriber(this, connection);
+    subscriber->subscribe(*request);
+
+_exit:
+    done->Run();
+    return;
+
+_invalid_port:
+    controller->SetFailed("invalid portid");
+    done->Run();
+    return;
+
+_no_connection:
+    controller->SetFailed("stats subscription not supported");
+    done->Run();
+}
+
+/*
+ * Applies all stream changes on a port as one unit - either all of them
+ * are applied or none are. The packet list is rebuilt (if required)
+ * only once at the end
+ */
+void MyService::applyPortConfig(::google::protobuf::RpcController* controller,
+    const ::OstProto::PortConfigDelta* request,
+    ::OstProto::Ack* response,
+    ::google::protobuf::Closure* done)
+{
+    int portId;
+    QSet<uint> deleted;
+    QSet<uint> added;
+    QList<OstProto::Stream> swept;
+    QList<OstProto::Stream> modified;
+    QList<StreamBase*> changed;
+    QString error;
+
+    qDebug("In %s", __PRETTY_FUNCTION__);
+
+    portId = request->port_id().id();
+    if ((portId < 0) || (portId >= portInfo.size()))
+        goto _invalid_port;
+
+    if (portInfo[portId]->isTransmitOn()
+            && !portInfo[portId]->isLiveUpdatable())
+        goto _port_busy;
+
+    portLock[portId]->lockForWrite();
+
+    // Validate everything before making any change
+    for (int i = 0; i < request->deleted_stream_id_size(); i++)
+        deleted.insert(request->deleted_stream_id(i).id());
+
+    for (int i = 0; i < request->new_stream_size(); i++)
+    {
+        uint id = request->new_stream(i).stream_id().id();
+        if (portInfo[portId]->stream(id) && !deleted.contains(id)) {
+            error = QString("stream %1 exists already").arg(id);
+            goto _invalid_config;
+        }
+        added.insert(id);
+    }
+
+    // Expand the sweeps into their streams
+    for (int i = 0; i < request->new_stream_sweep_size(); i++)
+    {
+        const OstProto::StreamSweep &sweep = request->new_stream_sweep(i);
+
+        for (uint j = 0; j < sweep.count(); j++)
+        {
+            OstProto::Stream config;
+            uint id;
+
+            if (!StreamBase::sweepStream(sweep, j, config)) {
+                error = QString("invalid sweep of stream %1")
+                                .arg(sweep.stream().stream_id().id());
+                goto _invalid_config;
+            }
+            id = config.stream_id().id();
+            if ((portInfo[portId]->stream(id) && !deleted.contains(id))
+                    || added.contains(id)) {
+                error = QString("stream %1 exists already").arg(id);
+                goto _invalid_config;
+            }
+            added.insert(id);
+            swept.append(config);
+        }
+    }
+
+    for (int i = 0; i < request->modified_stream_size(); i++)
+    {
+        const OstProto::StreamDelta &delta = request->modified_stream(i);
+        StreamBase *stream = portInfo[portId]->stream(delta.stream_id().id());
+        OstProto::Stream config;
+
+        if (!stream || deleted.contains(delta.stream_id().id())) {
+            error = QString("stream %1 not found").arg(delta.stream_id().id());
+            goto _invalid_config;
+        }
+        stream->protoDataCopyInto(config);
+        if (!StreamBase::applyDelta(delta, config)) {
+            error = QString("invalid delta for stream %1")
+                            .arg(delta.stream_id().id());
+            goto _invalid_config;
+        }
+        modified.append(config);
+    }
+
+    portInfo[portId]->deleteStreams(deleted);
+
+    for (int i = 0; i < request->new_stream_size(); i++)
+    {
+        StreamBase *stream = new StreamBase(portId);
+
+        stream->setId(request->new_stream(i).stream_id().id());
+        stream->protoDataCopyFrom(request->new_stream(i));
+        portInfo[portId]->addStream(stream);
+        portInfo[portId]->setStreamDirty(stream->id());
+        changed.append(stream);
+    }
+
+    for (int i = 0; i < swept.size(); i++)
+    {
+        StreamBase *stream = new StreamBase(portId);
+
+        stream->setId(swept.at(i).stream_id().id());
+        stream->protoDataCopyFrom(swept.at(i));
+        portInfo[portId]->addStream(stream);
+        portInfo[portId]->setStreamDirty(stream->id());
+        changed.append(stream);
+    }
+
+    for (int i = 0; i < modified.size(); i++)
+    {
+        StreamBase *stream = portInfo[portId]->stream(
+                                    modified.at(i).stream_id().id());
+        stream->protoDataCopyFrom(modified.at(i));
+        portInfo[portId]->setStreamDirty(stream->id(),
+                StreamBase::isRateOnlyDelta(request->modified_stream(i)));
+        changed.append(stream);
+    }
+    publishStreamSnapshot(portId);
+    preflightStreams(changed, response);
+
+    if (portInfo[portId]->isDirty())
+        portInfo[portId]->updatePacketList();
+    portLock[portId]->unlock();
+
+    done->Run();
+    notifyPortConfigChanged(portId);
+    return;
+
+_invalid_config:
+    portLock[portId]->unlock();
+    controller->SetFailed(error.toStdString());
+    goto _exit;
+_port_busy:
+    controller->SetFailed("Port Busy");
+    goto _exit;
+_invalid_port:
+    controller->SetFailed("invalid portid");
+_exit:
+    done->Run();
+}
+
+void MyService::checkVersion(::google::protobuf::RpcController* controller,
+    const ::OstProto::VersionInfo* request,
+    ::OstProto::VersionCompatibility* response,
+    ::google::protobuf::Closure* done)
+{
+    QString myVersion(version);
+    QString clientVersion;
+    QStringList my, client;
+
+    qDebug("In %s", __PRETTY_FUNCTION__);
+
+    my = myVersion.split('.');
+
+    Q_ASSERT(my.size() >= 2);
+
+    clientVersion = QString::fromStdString(request->version());
+    client = clientVersion.split('.');
 
     qDebug("client = %s, my = %s", 
             qPrintable(clientVersion), qPrintable(myVersion));
@@ -614,6 +1579,16 @@ void MyService::checkVersion(::google::protobuf::RpcController* controller,
         response->set_result(OstProto::VersionCompatibility::kCompatible);
         static_cast<PbRpcController*>(controller)->EnableNotif(
             request->client_name() == "python-ostinato" ? false : true);
+        if (request->rpc_pipelining()) {
+            static_cast<PbRpcController*>(controller)->EnablePipelining(true);
+            response->set_rpc_pipelining(true);
+        }
+        if (request->rpc_compression()) {
+            static_cast<PbRpcController*>(controller)->EnableCompression(true);
+            response->set_rpc_compression(true);
+        }
+        response->set_stream_sweep(true);
+        response->set_all_configs(true);
     }
     else {
         response->set_result(OstProto::VersionCompatibility::kIncompatible);
@@ -696,15 +1671,24 @@ void MyService::getDeviceGroupConfig(
 
     response->mutable_port_id()->set_id(portId);
     portLock[portId]->lockForRead();
-    for (int i = 0; i < request->device_group_id_size(); i++)
+    if (request->all_device_groups())
+    {
+        for (int i = 0; i < devMgr->deviceGroupCount(); i++)
+            response->add_device_group()->CopyFrom(
+                    *devMgr->deviceGroupAtIndex(i));
+    }
+    else
     {
-        const OstProto::DeviceGroup *dg;
+        for (int i = 0; i < request->device_group_id_size(); i++)
+        {
+            const OstProto::DeviceGroup *dg;
 
-        dg = devMgr->deviceGroup(request->device_group_id(i).id());
-        if (!dg)
-            continue;        //! \todo(LOW): Partial status of RPC
+            dg = devMgr->deviceGroup(request->device_group_id(i).id());
+            if (!dg)
+                continue;        //! \todo(LOW): Partial status of RPC
 
-        response->add_device_group()->CopyFrom(*dg);
+            response->add_device_group()->CopyFrom(*dg);
+        }
     }
     portLock[portId]->unlock();
 
@@ -748,6 +1732,8 @@ void MyService::addDeviceGroup(
 
         devMgr->addDeviceGroup(id);
     }
+    // Stream frames may use device (mac) addresses
+    portInfo[portId]->setDirty();
     portLock[portId]->unlock();
 
     //! \todo (LOW): fill-in response "Ack"????
@@ -788,6 +1774,8 @@ void MyService::deleteDeviceGroup(
     portLock[portId]->lockForWrite();
     for (int i = 0; i < request->device_group_id_size(); i++)
         devMgr->deleteDeviceGroup(request->device_group_id(i).id());
+    // Stream frames may use device (mac) addresses
+    portInfo[portId]->setDirty();
     portLock[portId]->unlock();
 
     //! \todo (LOW): fill-in response "Ack"????
@@ -827,6 +1815,8 @@ void MyService::modifyDeviceGroup(
     portLock[portId]->lockForWrite();
     for (int i = 0; i < request->device_group_size(); i++)
         devMgr->modifyDeviceGroup(&request->device_group(i));
+    // Stream frames may use device (mac) addresses
+    portInfo[portId]->setDirty();
     portLock[portId]->unlock();
 
     //! \todo(LOW): fill-in response "Ack"????
@@ -955,6 +1945,37 @@ _invalid_port:
     done->Run();
 }
 
+void MyService::getDeviceGroupStats(
+    ::google::protobuf::RpcController* controller,
+    const ::OstProto::PortIdList* request,
+    ::OstProto::DeviceGroupStatsList* response,
+    ::google::protobuf::Closure* done)
+{
+    qDebug("In %s", __PRETTY_FUNCTION__);
+
+    for (int i = 0; i < request->port_id_size(); i++)
+    {
+        int portId;
+
+        portId = request->port_id(i).id();
+        if ((portId < 0) || (portId >= portInfo.size()))
+            goto _invalid_port;
+
+        // Counters are updated without locks; the port lock only keeps
+        // the device groups from going away while we read them
+        portLock[portId]->lockForRead();
+        portInfo[portId]->deviceManager()->getDeviceGroupStats(response);
+        portLock[portId]->unlock();
+    }
+
+    done->Run();
+    return;
+
+_invalid_port:
+    controller->SetFailed("Invalid Port Id");
+    done->Run();
+}
+
 /*
  * ===================================================================
  * Friends
@@ -976,6 +1997,12 @@ quint64 getDeviceMacAddress(int portId, int streamId, int frameIndex)
     if (!devMgr || !devMgr->deviceCount())
         return 0;
 
+    // Resolved already when the packet list is built - no lock needed as
+    // it's not modified till the next build (which isn't concurrent)
+    if (service->portInfo[portId]->resolvedDeviceMacAddress(
+                streamId, frameIndex, &mac))
+        return mac;
+
     /*
      * FIXME: We don't need lockForWrite, only lockForRead here.
      * However, this function is called in the following sequence
@@ -1007,6 +2034,10 @@ quint64 getNeighborMacAddress(int portId, int streamId, int frameIndex)
     if (!devMgr || !devMgr->deviceCount())
         return 0;
 
+    if (service->portInfo[portId]->resolvedNeighborMacAddress(
+                streamId, frameIndex, &mac))
+        return mac;
+
     /*
      * FIXME: We don't need lockForWrite, only lockForRead here.
      * See comment in getDeviceMacAddress() for more
@@ -1017,3 +2048,642 @@ quint64 getNeighborMacAddress(int portId, int streamId, int frameIndex)
 
     return mac;
 }
+
+void MyService::getDeviceListPage(
+    ::google::protobuf::RpcController* controller,
+    const ::OstProto::DeviceListRequest* request,
+    ::OstProto::PortDeviceList* response,
+    ::google::protobuf::Closure* done)
+{
+    DeviceManager *devMgr;
+    int portId;
+
+    qDebug("In %s", __PRETTY_FUNCTION__);
+
+    portId = request->port_id().id();
+    if ((portId < 0) || (portId >= portInfo.size()))
+        goto _invalid_port;
+
+    devMgr = portInfo[portId]->deviceManager();
+
+    response->mutable_port_id()->set_id(portId);
+    portLock[portId]->lockForRead();
+    devMgr->getDeviceList(*request, response);
+    portLock[portId]->unlock();
+
+    done->Run();
+    return;
+
+_invalid_port:
+    controller->SetFailed("Invalid Port Id");
+    done->Run();
+}
+
+void MyService::getDeviceNeighborsPage(
+    ::google::protobuf::RpcController* controller,
+    const ::OstProto::DeviceListRequest* request,
+    ::OstProto::PortNeighborList* response,
+    ::google::protobuf::Closure* done)
+{
+    DeviceManager *devMgr;
+    int portId;
+
+    qDebug("In %s", __PRETTY_FUNCTION__);
+
+    portId = request->port_id().id();
+    if ((portId < 0) || (portId >= portInfo.size()))
+        goto _invalid_port;
+
+    devMgr = portInfo[portId]->deviceManager();
+
+    response->mutable_port_id()->set_id(portId);
+    portLock[portId]->lockForRead();
+    devMgr->getDeviceNeighbors(*request, response);
+    portLock[portId]->unlock();
+
+    done->Run();
+    return;
+
+_invalid_port:
+    controller->SetFailed("Invalid Port Id");
+    done->Run();
+}
+
+void MyService::getTraceRecords(
+    ::google::protobuf::RpcController* /*controller*/,
+    const ::OstProto::Void* /*request*/,
+    ::OstProto::TraceRecordList* response,
+    ::google::protobuf::Closure* done)
+{
+    qDebug("In %s", __PRETTY_FUNCTION__);
+
+    TraceBuffer::dump(response);
+
+    done->Run();
+}
+
+void MyService::CallMethod(
+    const ::google::protobuf::MethodDescriptor* method,
+    ::google::protobuf::RpcController* controller,
+    const ::google::protobuf::Message* request,
+    ::google::protobuf::Message* response,
+    ::google::protobuf::Closure* done)
+{
+    quint64 queueTime = static_cast<PbRpcController*>(controller)->queueTime();
+
+    rpcMetricsLock.lock();
+    rpcMetrics.add(OstProto::DroneMetric::kRpcCalls);
+    rpcMetrics.add(OstProto::DroneMetric::kRpcQueueNsec, queueTime);
+    rpcMetrics.setMax(OstProto::DroneMetric::kRpcMaxQueueNsec, queueTime);
+    rpcMetricsLock.unlock();
+
+    OstProto::OstService::CallMethod(method, controller, request, response,
+                                     done);
+}
+
+void MyService::getDroneMetrics(
+    ::google::protobuf::RpcController* /*controller*/,
+    const ::OstProto::Void* /*request*/,
+    ::OstProto::DroneMetricList* response,
+    ::google::protobuf::Closure* done)
+{
+    QHash<QString, int> portIds;
+
+    qDebug("In %s", __PRETTY_FUNCTION__);
+
+    for (int i = 0; i < portInfo.size(); i++)
+        portIds.insert(QString(portInfo[i]->name()), i);
+
+    DroneMetrics::dump(response);
+    for (int i = 0; i < response->metric_size(); i++) {
+        OstProto::DroneMetric *metric = response->mutable_metric(i);
+        QString portName = QString::fromStdString(metric->port_name());
+
+        if (metric->has_port_name() && portIds.contains(portName))
+            metric->set_port_id(portIds.value(portName));
+    }
+    response->set_text(DroneMetrics::prometheusText(*response));
+
+    done->Run();
+}
+
+void MyService::startThroughputTest(
+    ::google::protobuf::RpcController* controller,
+    const ::OstProto::ThroughputTestConfig* request,
+    ::OstProto::Ack* /*response*/,
+    ::google::protobuf::Closure* done)
+{
+    int txPortId = request->tx_port_id().id();
+    int rxPortId = request->rx_port_id().id();
+    ThroughputTest *test;
+
+    qDebug("In %s", __PRETTY_FUNCTION__);
+
+    if ((txPortId < 0) || (txPortId >= portInfo.size())
+            || (rxPortId < 0) || (rxPortId >= portInfo.size()))
+        goto _invalid_port;
+
+    throughputTestsLock.lock();
+    test = throughputTests.at(txPortId);
+    if ((test && test->isRunning()) || portInfo[txPortId]->isTransmitOn()) {
+        throughputTestsLock.unlock();
+        goto _port_busy;
+    }
+    if (!portInfo[txPortId]->setTransmitLoad(1.0)) {
+        throughputTestsLock.unlock();
+        goto _not_supported;
+    }
+
+    delete test;
+    test = new ThroughputTest(*request, portInfo[txPortId],
+                              portLock[txPortId], portInfo[rxPortId]);
+    throughputTests[txPortId] = test;
+    test->start();
+    throughputTestsLock.unlock();
+
+    goto _exit;
+
+_not_supported:
+    controller->SetFailed("throughput test not supported on tx port");
+    goto _exit;
+_port_busy:
+    controller->SetFailed("Port Busy");
+    goto _exit;
+_invalid_port:
+    controller->SetFailed("invalid portid");
+_exit:
+    done->Run();
+}
+
+void MyService::stopThroughputTest(
+    ::google::protobuf::RpcController* controller,
+    const ::OstProto::PortId* request,
+    ::OstProto::Ack* /*response*/,
+    ::google::protobuf::Closure* done)
+{
+    int portId = request->id();
+
+    qDebug("In %s", __PRETTY_FUNCTION__);
+
+    if ((portId < 0) || (portId >= portInfo.size())) {
+        controller->SetFailed("invalid portid");
+        goto _exit;
+    }
+
+    // The test stops (and its transmit) shortly after - its state
+    // becomes kStopped
+    throughputTestsLock.lock();
+    if (throughputTests.at(portId))
+        throughputTests.at(portId)->stop();
+    throughputTestsLock.unlock();
+
+_exit:
+    done->Run();
+}
+
+void MyService::getThroughputTestResult(
+    ::google::protobuf::RpcController* controller,
+    const ::OstProto::PortId* request,
+    ::OstProto::ThroughputTestResult* response,
+    ::google::protobuf::Closure* done)
+{
+    int portId = request->id();
+
+    if ((portId < 0) || (portId >= portInfo.size())) {
+        controller->SetFailed("invalid portid");
+        goto _exit;
+    }
+
+    throughputTestsLock.lock();
+    if (throughputTests.at(portId))
+        throughputTests.at(portId)->result(response);
+    else {
+        response->mutable_tx_port_id()->set_id(portId);
+        response->set_state(OstProto::ThroughputTestResult::kIdle);
+    }
+    throughputTestsLock.unlock();
+
+_exit:
+    done->Run();
+}
+
+void MyService::getClock(
+    ::google::protobuf::RpcController* /*controller*/,
+    const ::OstProto::Void* /*request*/,
+    ::OstProto::ClockInfo* response,
+    ::google::protobuf::Closure* done)
+{
+    // Not logged - this is timed by the client
+    LatencyClock::info(response);
+
+    done->Run();
+}
+
+void MyService::setClockOffset(
+    ::google::protobuf::RpcController* controller,
+    const ::OstProto::ClockOffset* request,
+    ::OstProto::Ack* /*response*/,
+    ::google::protobuf::Closure* done)
+{
+    qDebug("In %s", __PRETTY_FUNCTION__);
+
+    if (!LatencyClock::setOffset(request->offset_nsec(),
+                                 request->uncertainty_nsec()))
+        controller->SetFailed("Clock is a PTP clock - its offset can't be set");
+
+    done->Run();
+}
+
+// Ethertype of the default probe frame - IEEE local experimental
+static const quint16 kProbeEtherType = 0x88b5;
+static const int kProbeFrameSize = 60; // without the FCS
+static const int kEthHdrSize = 14;
+
+static void sleepMsecs(ulong msecs)
+{
+    QMutex mutex;
+    QWaitCondition never;
+
+    mutex.lock();
+    never.wait(&mutex, msecs);
+    mutex.unlock();
+}
+
+/*!
+  Sends probe frames from each port and finds the ports that receive them
+  from their stream stats - the probes are counted as the (hidden) stream
+  kProbeStreamId of the tx port
+
+  Probes are sent with the port's device emulation path, which is started
+  for the purpose if the port has no devices. All of the ports count rx
+  stream stats while probing; afterwards, they are back to as configured,
+  unless the request is to apply the pairs found
+*/
+void MyService::discoverPortPairs(
+    ::google::protobuf::RpcController* controller,
+    const ::OstProto::PortPairDiscovery* request,
+    ::OstProto::PortPairList* response,
+    ::google::protobuf::Closure* done)
+{
+    // Served by a worker thread, but not one to hold for long
+    const uint kMaxProbeCount = 1000;
+    const uint kMaxWaitMsec = 10000;
+
+    QList<int> ports;
+    QList<StreamStatsHash> before;
+    QSet<int> rxPorts;
+    QByteArray probe;
+    // notification needs to be on heap because signal/slot is across threads!
+    OstProto::Notification *notif = NULL;
+
+    qDebug("In %s", __PRETTY_FUNCTION__);
+
+    for (int i = 0; i < request->port_id_size(); i++) {
+        int portId = request->port_id(i).id();
+
+        if ((portId < 0) || (portId >= portInfo.size()))
+            goto _invalid_port;
+        if (!ports.contains(portId))
+            ports.append(portId);
+    }
+    if (ports.isEmpty()) {
+        for (int i = 0; i < portInfo.size(); i++)
+            ports.append(i);
+    }
+
+    if ((request->probe_count() > kMaxProbeCount)
+            || (request->wait_msec() > kMaxWaitMsec))
+        goto _invalid_limits;
+
+    if (request->has_probe_frame()) {
+        probe = QByteArray(request->probe_frame().c_str(),
+                           int(request->probe_frame().size()));
+        if (probe.size() < (kEthHdrSize + kSignatureSize))
+            goto _invalid_probe;
+    }
+    else {
+        uchar *p;
+
+        probe.fill('\0', kProbeFrameSize);
+        p = (uchar*) probe.data();
+        memset(p, 0xff, 6);
+        p[6] = 0x02; // locally administered
+        qToBigEndian(kProbeEtherType, p + 12);
+    }
+
+    foreach(int portId, ports) {
+        before.append(StreamStatsHash());
+        portLock[portId]->lockForWrite();
+        portInfo[portId]->enableRxStreamStats(true);
+        portLock[portId]->unlock();
+        portInfo[portId]->streamStats(before.last());
+    }
+
+    foreach(int txPortId, ports) {
+        AbstractPort *port = portInfo[txPortId];
+        QList<PacketBuffer*> pktBufs;
+        bool isEmulationStarted;
+
+        // Source MAC is per port, so that a switch learns each separately
+        qToBigEndian(quint32(txPortId), (uchar*) probe.data() + 8);
+        StreamBase::signFrame((uchar*) probe.data(), probe.size(),
+                              kProbeStreamId, quint16(txPortId));
+
+        for (uint i = 0; i < request->probe_count(); i++) {
+            PacketBuffer *pktBuf = PacketBuffer::alloc();
+
+            memcpy(pktBuf->put(probe.size()), probe.constData(),
+                   probe.size());
+            pktBufs.append(pktBuf);
+        }
+
+        portLock[txPortId]->lockForWrite();
+        isEmulationStarted = (port->deviceManager()->deviceCount() == 0);
+        if (isEmulationStarted)
+            port->startDeviceEmulation();
+        port->sendEmulationPackets(pktBufs);
+        if (isEmulationStarted)
+            port->stopDeviceEmulation();
+        portLock[txPortId]->unlock();
+
+        foreach(PacketBuffer *pktBuf, pktBufs)
+            pktBuf->release();
+    }
+
+    sleepMsecs(request->wait_msec());
+
+    for (int i = 0; i < ports.size(); i++) {
+        int rxPortId = ports.at(i);
+        StreamStatsHash after;
+
+        portInfo[rxPortId]->streamStats(after);
+
+        foreach(int txPortId, ports) {
+            quint64 key = StreamStatsTable::key(txPortId, kProbeStreamId);
+            quint64 rxPkts = after.value(key).rxPkts
+                                - before.at(i).value(key).rxPkts;
+            OstProto::PortPair *pair;
+
+            if (!rxPkts)
+                continue;
+
+            pair = response->add_pair();
+            pair->mutable_tx_port_id()->set_id(txPortId);
+            pair->mutable_rx_port_id()->set_id(rxPortId);
+            pair->set_rx_probes(uint(rxPkts));
+            rxPorts.insert(rxPortId);
+
+            qDebug("port %d: receives from port %d (%llu probes)",
+                    rxPortId, txPortId, rxPkts);
+        }
+    }
+
+    foreach(int portId, ports) {
+        if (request->apply()) {
+            OstProto::Port port;
+
+            port.mutable_port_id()->set_id(portId);
+            port.set_rx_stream_stats(rxPorts.contains(portId));
+
+            portLock[portId]->lockForWrite();
+            portInfo[portId]->modify(port);
+            portLock[portId]->unlock();
+
+            if (!notif)
+                notif = new OstProto::Notification;
+            notif->mutable_port_id_list()->add_port_id()->set_id(portId);
+        }
+        else {
+            portLock[portId]->lockForWrite();
+            portInfo[portId]->enableRxStreamStats(
+                    portInfo[portId]->isRxStreamStatsEnabled());
+            portLock[portId]->unlock();
+        }
+    }
+
+    done->Run();
+
+    if (notif) {
+        notif->set_notif_type(OstProto::portConfigChanged);
+        emit notification(notif->notif_type(), SharedProtobufMessage(notif));
+    }
+    return;
+
+_invalid_probe:
+    controller->SetFailed("probe frame too short for a signature");
+    goto _exit;
+_invalid_limits:
+    controller->SetFailed(QString("probe_count > %1 or wait_msec > %2")
+                            .arg(kMaxProbeCount).arg(kMaxWaitMsec)
+                            .toStdString());
+    goto _exit;
+_invalid_port:
+    controller->SetFailed("invalid portid");
+_exit:
+    done->Run();
+}
+
+void MyService::getCaptureAnalytics(
+    ::google::protobuf::RpcController* controller,
+    const ::OstProto::PortId* request,
+    ::OstProto::CaptureAnalytics* response,
+    ::google::protobuf::Closure* done)
+{
+    int portId = request->id();
+    CaptureAnalytics *analytics;
+
+    if ((portId < 0) || (portId >= portInfo.size())) {
+        controller->SetFailed("invalid portid");
+        goto _exit;
+    }
+
+    // Not under the port lock - the analytics have a lock of their own
+    response->mutable_port_id()->set_id(portId);
+    analytics = portInfo[portId]->captureAnalytics();
+    if (!analytics) {
+        controller->SetFailed("capture analytics not supported on port");
+        goto _exit;
+    }
+    analytics->snapshot(response);
+
+_exit:
+    done->Run();
+}
+
+void MyService::startMergedCapture(
+    ::google::protobuf::RpcController* controller,
+    const ::OstProto::FilteredPortIdList* request,
+    ::OstProto::Ack* /*response*/,
+    ::google::protobuf::Closure* done)
+{
+    CaptureMerger *merger = new CaptureMerger;
+
+    qDebug("In %s", __PRETTY_FUNCTION__);
+
+    captureMergerLock.lock();
+    if (captureMerger) {
+        captureMerger->stop();
+        captureMerger->wait();
+        delete captureMerger;
+        captureMerger = NULL;
+    }
+
+    for (int i = 0; i < request->port_id_size(); i++)
+    {
+        int portId = request->port_id(i).id();
+
+        if ((portId < 0) || (portId >= portInfo.size()))
+            continue;     //! \todo (LOW): partial RPC?
+
+        portLock[portId]->lockForWrite();
+        portInfo[portId]->startCapture(request->port_id(i).filter().c_str(),
+                                       request->port_id(i).config());
+        captureIndex[portId]->reset();
+        if (!portInfo[portId]->isCaptureOn()
+                || !merger->addPort(portInfo[portId]))
+            qWarning("%s: port %d capture can't be merged", __FUNCTION__,
+                    portId);
+        portLock[portId]->unlock();
+    }
+
+    if (!merger->portCount()) {
+        delete merger;
+        controller->SetFailed("no port capture to merge");
+        goto _exit;
+    }
+
+    merger->start();
+    captureMerger = merger;
+
+_exit:
+    captureMergerLock.unlock();
+    done->Run();
+}
+
+void MyService::getMergedCaptureBuffer(
+    ::google::protobuf::RpcController* controller,
+    const ::OstProto::Void* /*request*/,
+    ::OstProto::CaptureBuffer* /*response*/,
+    ::google::protobuf::Closure* done)
+{
+    qDebug("In %s", __PRETTY_FUNCTION__);
+
+    captureMergerLock.lock();
+    if (!captureMerger) {
+        controller->SetFailed("no merged capture");
+        goto _exit;
+    }
+
+    // The merger is done once all its ports' captures are stopped
+    for (int i = 0; i < captureMerger->portCount(); i++) {
+        AbstractPort *port = captureMerger->port(i);
+
+        portLock[port->id()]->lockForWrite();
+        if (port->isCaptureOn())
+            port->stopCapture();
+        portLock[port->id()]->unlock();
+    }
+    captureMerger->wait();
+
+    static_cast<PbRpcController*>(controller)->setBinaryBlob(
+        captureMerger->file());
+
+_exit:
+    // Not before the blob is sent - the next start replaces the merger
+    done->Run();
+    captureMergerLock.unlock();
+}
+
+void MyService::cancelPrepareTransmit(
+    ::google::protobuf::RpcController* /*controller*/,
+    const ::OstProto::PortIdList* request,
+    ::OstProto::Ack* /*response*/,
+    ::google::protobuf::Closure* done)
+{
+    qDebug("In %s", __PRETTY_FUNCTION__);
+
+    // Not the port lock - held by the build till it is done
+    buildersLock.lock();
+    for (int i = 0; i < request->port_id_size(); i++)
+    {
+        int portId = request->port_id(i).id();
+
+        if ((portId < 0) || (portId >= portInfo.size()))
+            continue;     //! \todo (LOW): partial RPC?
+
+        if (builders.at(portId))
+            portInfo[portId]->cancelPacketListBuild();
+    }
+    buildersLock.unlock();
+
+    done->Run();
+}
+
+void MyService::getStatsHistory(
+    ::google::protobuf::RpcController* controller,
+    const ::OstProto::StatsHistoryRequest* request,
+    ::OstProto::StatsHistory* response,
+    ::google::protobuf::Closure* done)
+{
+    int portId;
+
+    qDebug("In %s", __PRETTY_FUNCTION__);
+
+    portId = request->port_id().id();
+    if ((portId < 0) || (portId >= portInfo.size()))
+        goto _invalid_port;
+
+    response->mutable_port_id()->set_id(portId);
+    if (statsHistory)
+        statsHistory->history(portId, request->start_time(),
+                              request->with_stream_stats(), response);
+
+    done->Run();
+    return;
+
+_invalid_port:
+    controller->SetFailed("invalid portid");
+    done->Run();
+}
+
+void MyService::uploadFrameSet(
+    ::google::protobuf::RpcController* controller,
+    const ::OstProto::FrameSetChunk* request,
+    ::OstProto::Ack* /*response*/,
+    ::google::protobuf::Closure* done)
+{
+    int portId;
+    QString error;
+
+    qDebug("In %s", __PRETTY_FUNCTION__);
+
+    portId = request->port_id().id();
+    if ((portId < 0) || (portId >= portInfo.size()))
+        goto _invalid_port;
+
+    // The last chunk changes the frames of the streams that send the set
+    if (request->is_last() && portInfo[portId]->isTransmitOn()
+            && !portInfo[portId]->isLiveUpdatable())
+        goto _port_busy;
+
+    portLock[portId]->lockForWrite();
+    if (!portInfo[portId]->addFrameSetChunk(*request, error)) {
+        portLock[portId]->unlock();
+        controller->SetFailed(error.toStdString());
+        goto _exit;
+    }
+    if (portInfo[portId]->isDirty() && portInfo[portId]->isTransmitOn())
+        portInfo[portId]->updatePacketList();
+    portLock[portId]->unlock();
+
+    done->Run();
+    return;
+
+_port_busy:
+    controller->SetFailed("Port Busy");
+    goto _exit;
+_invalid_port:
+    controller->SetFailed("invalid portid");
+_exit:
+    done->Run();
+}
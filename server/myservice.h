@@ -22,15 +22,25 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 
 #include "../common/protocol.pb.h"
 #include "../rpc/sharedprotobufmessage.h"
+#include "dronemetrics.h"
+#include "streamstats.h"
 
+#include <QHash>
 #include <QList>
+#include <QMutex>
 #include <QObject>
 #include <QReadWriteLock>
+#include <QTimer>
 
 #define MAX_PKT_HDR_SIZE            1536
 #define MAX_STREAM_NAME_SIZE        64
 
 class AbstractPort;
+class CaptureIndex;
+class CaptureMerger;
+class PacketListBuilder;
+class StatsHistory;
+class ThroughputTest;
 
 class MyService: public QObject, public OstProto::OstService
 {
@@ -39,6 +49,14 @@ public:
     MyService();
     virtual ~MyService();
 
+    // Counts every RPC before dispatching it to its method
+    virtual void CallMethod(
+        const ::google::protobuf::MethodDescriptor* method,
+        ::google::protobuf::RpcController* controller,
+        const ::google::protobuf::Message* request,
+        ::google::protobuf::Message* response,
+        ::google::protobuf::Closure* done);
+
     /* Methods provided by the service */
     virtual void getPortIdList(::google::protobuf::RpcController* controller,
         const ::OstProto::Void* request,
@@ -76,6 +94,15 @@ public:
         const ::OstProto::PortIdList* request,
         ::OstProto::Ack* response,
         ::google::protobuf::Closure* done);
+    virtual void prepareTransmit(::google::protobuf::RpcController* controller,
+        const ::OstProto::PortIdList* request,
+        ::OstProto::Ack* response,
+        ::google::protobuf::Closure* done);
+    virtual void startTransmitSync(
+        ::google::protobuf::RpcController* controller,
+        const ::OstProto::SyncStartRequest* request,
+        ::OstProto::Ack* response,
+        ::google::protobuf::Closure* done);
     virtual void stopTransmit(::google::protobuf::RpcController* controller,
         const ::OstProto::PortIdList* request,
         ::OstProto::Ack* response,
@@ -96,6 +123,10 @@ public:
         const ::OstProto::PortId* request,
         ::OstProto::CaptureBuffer* response,
         ::google::protobuf::Closure* done);
+    virtual void getCaptureChunk(::google::protobuf::RpcController* controller,
+        const ::OstProto::CaptureChunkRequest* request,
+        ::OstProto::CaptureChunk* response,
+        ::google::protobuf::Closure* done);
     virtual void getStats(::google::protobuf::RpcController* controller,
         const ::OstProto::PortIdList* request,
         ::OstProto::PortStatsList* response,
@@ -104,6 +135,18 @@ public:
         const ::OstProto::PortIdList* request,
         ::OstProto::Ack* response,
         ::google::protobuf::Closure* done);
+    virtual void getStreamStats(::google::protobuf::RpcController* controller,
+        const ::OstProto::PortIdList* request,
+        ::OstProto::StreamStatsList* response,
+        ::google::protobuf::Closure* done);
+    virtual void subscribeStats(::google::protobuf::RpcController* controller,
+        const ::OstProto::StatsSubscription* request,
+        ::OstProto::Ack* response,
+        ::google::protobuf::Closure* done);
+    virtual void applyPortConfig(::google::protobuf::RpcController* controller,
+        const ::OstProto::PortConfigDelta* request,
+        ::OstProto::Ack* response,
+        ::google::protobuf::Closure* done);
     virtual void checkVersion(::google::protobuf::RpcController* controller,
         const ::OstProto::VersionInfo* request,
         ::OstProto::VersionCompatibility* response,
@@ -157,6 +200,101 @@ public:
         const ::OstProto::PortId* request,
         ::OstProto::PortNeighborList* response,
         ::google::protobuf::Closure* done);
+    virtual void getDeviceGroupStats(
+        ::google::protobuf::RpcController* controller,
+        const ::OstProto::PortIdList* request,
+        ::OstProto::DeviceGroupStatsList* response,
+        ::google::protobuf::Closure* done);
+    virtual void getDeviceListPage(
+        ::google::protobuf::RpcController* controller,
+        const ::OstProto::DeviceListRequest* request,
+        ::OstProto::PortDeviceList* response,
+        ::google::protobuf::Closure* done);
+    virtual void getDeviceNeighborsPage(
+        ::google::protobuf::RpcController* controller,
+        const ::OstProto::DeviceListRequest* request,
+        ::OstProto::PortNeighborList* response,
+        ::google::protobuf::Closure* done);
+    virtual void getTraceRecords(
+        ::google::protobuf::RpcController* controller,
+        const ::OstProto::Void* request,
+        ::OstProto::TraceRecordList* response,
+        ::google::protobuf::Closure* done);
+    virtual void getDroneMetrics(
+        ::google::protobuf::RpcController* controller,
+        const ::OstProto::Void* request,
+        ::OstProto::DroneMetricList* response,
+        ::google::protobuf::Closure* done);
+    virtual void startThroughputTest(
+        ::google::protobuf::RpcController* controller,
+        const ::OstProto::ThroughputTestConfig* request,
+        ::OstProto::Ack* response,
+        ::google::protobuf::Closure* done);
+    virtual void stopThroughputTest(
+        ::google::protobuf::RpcController* controller,
+        const ::OstProto::PortId* request,
+        ::OstProto::Ack* response,
+        ::google::protobuf::Closure* done);
+    virtual void getThroughputTestResult(
+        ::google::protobuf::RpcController* controller,
+        const ::OstProto::PortId* request,
+        ::OstProto::ThroughputTestResult* response,
+        ::google::protobuf::Closure* done);
+    virtual void getClock(
+        ::google::protobuf::RpcController* controller,
+        const ::OstProto::Void* request,
+        ::OstProto::ClockInfo* response,
+        ::google::protobuf::Closure* done);
+    virtual void setClockOffset(
+        ::google::protobuf::RpcController* controller,
+        const ::OstProto::ClockOffset* request,
+        ::OstProto::Ack* response,
+        ::google::protobuf::Closure* done);
+
+    virtual void discoverPortPairs(
+        ::google::protobuf::RpcController* controller,
+        const ::OstProto::PortPairDiscovery* request,
+        ::OstProto::PortPairList* response,
+        ::google::protobuf::Closure* done);
+
+    virtual void getCaptureAnalytics(
+        ::google::protobuf::RpcController* controller,
+        const ::OstProto::PortId* request,
+        ::OstProto::CaptureAnalytics* response,
+        ::google::protobuf::Closure* done);
+
+    virtual void startMergedCapture(
+        ::google::protobuf::RpcController* controller,
+        const ::OstProto::FilteredPortIdList* request,
+        ::OstProto::Ack* response,
+        ::google::protobuf::Closure* done);
+    virtual void getMergedCaptureBuffer(
+        ::google::protobuf::RpcController* controller,
+        const ::OstProto::Void* request,
+        ::OstProto::CaptureBuffer* response,
+        ::google::protobuf::Closure* done);
+
+    virtual void cancelPrepareTransmit(
+        ::google::protobuf::RpcController* controller,
+        const ::OstProto::PortIdList* request,
+        ::OstProto::Ack* response,
+        ::google::protobuf::Closure* done);
+    virtual void getStatsHistory(
+        ::google::protobuf::RpcController* controller,
+        const ::OstProto::StatsHistoryRequest* request,
+        ::OstProto::StatsHistory* response,
+        ::google::protobuf::Closure* done);
+    virtual void uploadFrameSet(
+        ::google::protobuf::RpcController* controller,
+        const ::OstProto::FrameSetChunk* request,
+        ::OstProto::Ack* response,
+        ::google::protobuf::Closure* done);
+
+    // portId must be valid
+    void portStats(int portId, OstProto::PortStats *stats);
+    void streamStats(int portId, OstProto::StreamStatsList *list,
+                     QHash<int, StreamStatsHash> &txPortStats,
+                     bool withHistograms = true);
 
     friend quint64 getDeviceMacAddress(
             int portId, int streamId, int frameIndex);
@@ -165,6 +303,12 @@ public:
 signals:
     void notification(int notifType, SharedProtobufMessage notifData);
 
+private slots:
+    void on_packetListBuilder_finished();
+    void on_buildProgressTimer_timeout();
+    void on_neighborResolver_progress(int portId, int pending, int sent,
+                                      int resolved, int failed);
+
 private:
     /* 
      * NOTES:
@@ -175,10 +319,64 @@ private:
      *   never change (objects in the list can change, but not the list itself)
      * - locking is at port granularity, not at stream granularity - for now
      *   this seems sufficient. Revisit later, if required
+     * - stats reads don't take portLock (AbstractPort guards its stats
+     *   itself) and stream config reads use streamSnapshots instead, so
+     *   that these are not blocked by long writes e.g. a packet list
+     *   rebuild or stopping a capture
      */
     QList<AbstractPort*>    portInfo;
     QList<QReadWriteLock*>  portLock;
 
+    // Read-only copy of a port's streams - a new one is published (with
+    // portLock held for write) after every change to the streams and is
+    // never modified after; readers hold on to the copy they got. The
+    // configs are kept serialized (StreamBase::serializedConfig() - shared,
+    // not copied, for the streams unchanged since the last snapshot) and
+    // are spliced as is into the getStreamConfig replies
+    struct StreamSnapshot {
+        OstProto::StreamIdList idList; // in port order
+        QHash<uint, QByteArray> streams; // serialized OstProto::Stream
+    };
+    typedef SharedPointer<StreamSnapshot> StreamSnapshotPtr;
+
+    void publishStreamSnapshot(int portId);
+    StreamSnapshotPtr streamSnapshot(int portId);
+
+    void notifyPortConfigChanged(int portId);
+    void preflightStreams(QList<StreamBase*> streams, OstProto::Ack *ack);
+
+    QList<StreamSnapshotPtr> streamSnapshots;
+    QMutex snapshotLock; // held only to get/replace the pointer
+
+    // Background packet list build (if any) in progress for each port
+    QList<PacketListBuilder*> builders;
+    QMutex buildersLock;
+    QTimer buildProgressTimer; // runs while any build is in progress
+    static const int kBuildProgressMsecs = 1000;
+    void emitBuildProgress(int portId, OstProto::BuildProgress::State state,
+                           int streamCount, int elapsedMsecs = 0);
+
+    QList<int> sortedPortIds(const OstProto::PortIdList &list);
+
+    // Last throughput test (running or finished, if any) of each tx port -
+    // kept for its result till the next one is started
+    QList<ThroughputTest*> throughputTests;
+    QMutex throughputTestsLock;
+
+    // Index of each port's capture data for getCaptureChunk() - reset
+    // whenever the capture data is rewritten; guarded by portLock
+    QList<CaptureIndex*> captureIndex;
+
+    // Of the last merged capture session (if any) - kept for its file till
+    // the next one is started
+    CaptureMerger *captureMerger;
+    QMutex captureMergerLock;
+
+    // Of all RPC connections (each has a thread of its own)
+    DroneMetrics::Counters rpcMetrics;
+    QMutex rpcMetricsLock;
+
+    StatsHistory *statsHistory; // NULL => not kept
 };
 
 #endif
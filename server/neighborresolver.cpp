@@ -0,0 +1,236 @@
+/*
+Copyright (C) 2017 Srivats P.
+
+
+This file is part of "Ostinato"
+
+This is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+
+#include "neighborresolver.h"
+
+#include "devicemanager.h"
+#include "settings.h"
+
+NeighborResolver::NeighborResolver(DeviceManager *deviceManager, int portId)
+{
+    deviceManager_ = deviceManager;
+    portId_ = portId;
+
+    rate_ = qMax(1, appSettings->value(kNeighborResolveRateKey,
+                        kNeighborResolveRateDefaultValue).toInt());
+    maxAttempts_ = 1 + qBound(0, appSettings->value(kNeighborResolveRetriesKey,
+                        kNeighborResolveRetriesDefaultValue).toInt(), 16);
+    timeout_ = qMax(kTickMsecs, appSettings->value(kNeighborResolveTimeoutKey,
+                        kNeighborResolveTimeoutDefaultValue).toInt());
+    refresh_ = qMax(0, appSettings->value(kNeighborRefreshKey,
+                        kNeighborRefreshDefaultValue).toInt());
+
+    timer_.start();
+    generation_ = 0;
+    isActive_ = false;
+    stop_ = false;
+    pending_ = sent_ = resolved_ = failed_ = 0;
+}
+
+NeighborResolver::~NeighborResolver()
+{
+    stop_ = true;
+    wait();
+}
+
+void NeighborResolver::add(const DeviceKey &device, quint32 ip4)
+{
+    Request request;
+
+    request.device = device;
+    request.isIp6 = false;
+    request.ip4 = ip4;
+    request.attempts = 0;
+    request.isRefresh = false;
+
+    add(request);
+}
+
+void NeighborResolver::add(const DeviceKey &device, UInt128 ip6)
+{
+    Request request;
+
+    request.device = device;
+    request.isIp6 = true;
+    request.ip4 = 0;
+    request.ip6 = ip6;
+    request.attempts = 0;
+    request.isRefresh = false;
+
+    add(request);
+}
+
+void NeighborResolver::add(const Request &request)
+{
+    QMutexLocker locker(&lock_);
+
+    schedule(timer_.elapsed(), request);
+
+    if (!isActive_) {
+        isActive_ = true;
+        wait(); // for the previous run (if any) to return
+        QThread::start();
+    }
+}
+
+/*!
+  Drops all pending requests - e.g. when the neighbor cache is cleared
+*/
+void NeighborResolver::clear()
+{
+    QMutexLocker locker(&lock_);
+
+    wheel_.clear();
+    generation_++;
+    pending_ = sent_ = resolved_ = failed_ = 0;
+}
+
+// Caller holds lock_
+void NeighborResolver::schedule(qint64 msecs, const Request &request)
+{
+    // Round up - so that a request is never sent early
+    wheel_.schedule(quint64(msecs + kTickMsecs - 1)/kTickMsecs, request);
+    if (!request.isRefresh)
+        pending_++;
+}
+
+void NeighborResolver::run()
+{
+    QTime progressTimer;
+    qint64 lastTick;
+    bool isResolving = false; // requests pending (refreshes don't count)
+    double credit = 0;
+    // Unused credit is not carried over beyond a couple of ticks
+    double maxCredit = qMax(1.0, 2.0*rate_*kTickMsecs/1000);
+
+    qDebug("In %s", __PRETTY_FUNCTION__);
+
+    lock_.lock();
+    lastTick = timer_.elapsed();
+    lock_.unlock();
+    progressTimer.start();
+
+    while (!stop_)
+    {
+        QList<Request> batch;
+        QList<int> results;
+        QList<PacketBuffer*> packets;
+        uint generation;
+        qint64 now;
+
+        lock_.lock();
+        if (pending_)
+            isResolving = true;
+        else if (isResolving) {
+            int sent = sent_, resolved = resolved_, failed = failed_;
+
+            isResolving = false;
+            sent_ = resolved_ = failed_ = 0;
+            lock_.unlock();
+
+            qDebug("port %d: resolve done - %d sent, %d resolved, %d failed",
+                    portId_, sent, resolved, failed);
+            emit progress(portId_, 0, sent, resolved, failed);
+            lock_.lock();
+        }
+        if (!wheel_.size()) {
+            isActive_ = false;
+            lock_.unlock();
+            return;
+        }
+
+        now = timer_.elapsed();
+        credit = qMin(maxCredit, credit + double(rate_)*(now - lastTick)/1000);
+        lastTick = now;
+
+        // Due requests not sent for lack of credit stay ready for the
+        // next tick, ahead of those due then
+        wheel_.advance(quint64(now)/kTickMsecs);
+        while (wheel_.hasReady() && (batch.size() < int(credit))) {
+            batch.append(wheel_.takeReady());
+            if (!batch.last().isRefresh)
+                pending_--;
+        }
+        generation = generation_;
+        lock_.unlock();
+
+        // Build the requests to be sent and send them all in one go
+        if (!batch.isEmpty()) {
+            deviceManager_->processNeighborRequests(batch, maxAttempts_,
+                    &results, &packets);
+            deviceManager_->transmitPackets(packets);
+            credit -= packets.size();
+        }
+
+        lock_.lock();
+        for (int i = 0; (i < batch.size()) && (generation == generation_); i++)
+        {
+            Request &request = batch[i];
+
+            switch (results.at(i)) {
+            case kSent:
+                if (!request.isRefresh)
+                    sent_++;
+                request.attempts++;
+                // Wait longer for each retry
+                schedule(now + (qint64(timeout_) << (request.attempts-1)),
+                         request);
+                break;
+            case kResolved:
+                if (!request.isRefresh)
+                    resolved_++;
+                if (refresh_) {
+                    // Spread the refreshes of entries resolved together
+                    // over an eighth of the interval
+                    uint jitter = (qHash(request.device) ^ request.ip4
+                                    ^ qHash(request.ip6)) % (refresh_/8 + 1);
+                    request.attempts = 0;
+                    request.isRefresh = true;
+                    schedule(now + refresh_ - jitter, request);
+                }
+                break;
+            case kFailed:
+                if (!request.isRefresh)
+                    failed_++;
+                else
+                    qDebug("port %d: neighbor aged out", portId_);
+                break;
+            default:
+                break;
+            }
+        }
+        lock_.unlock();
+
+        if (isResolving && (progressTimer.elapsed() >= kProgressMsecs)) {
+            emitProgress();
+            progressTimer.restart();
+        }
+
+        msleep(kTickMsecs);
+    }
+}
+
+void NeighborResolver::emitProgress()
+{
+    QMutexLocker locker(&lock_);
+
+    emit progress(portId_, pending_, sent_, resolved_, failed_);
+}
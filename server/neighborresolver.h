@@ -0,0 +1,116 @@
+/*
+Copyright (C) 2017 Srivats P.
+
+
+This file is part of "Ostinato"
+
+This is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+
+#ifndef _NEIGHBOR_RESOLVER_H
+#define _NEIGHBOR_RESOLVER_H
+
+#include "device.h"
+#include "timerwheel.h"
+
+#include <QElapsedTimer>
+#include <QList>
+#include <QMutex>
+#include <QThread>
+
+class DeviceManager;
+
+/*!
+  Paces the ARP/NDP requests of a port's devices - instead of the devices
+  sending a request for each unresolved neighbor right away (50K devices
+  => 50K requests at once, most of which the DUT drops)
+
+  Requests are sent at (upto) a configured rate in batches every tick and
+  resent with an exponential backoff till resolved or all retries are
+  used up. Progress is reported with the progress() signal
+
+  If a refresh interval is configured, an entry resolved here is resolved
+  again (with the same retries) every interval, the old MAC being used
+  meanwhile - if there's no reply to any of the retries, the entry ages
+  out i.e. is unresolved again. Refreshes are not part of the progress
+
+  All of these are timer events of a TimerWheel, so scheduling one costs
+  the same however many devices and neighbors there are
+
+  The thread runs only while there are requests (or refreshes) pending
+*/
+class NeighborResolver : public QThread
+{
+    Q_OBJECT
+public:
+    struct Request {
+        DeviceKey device;
+        bool isIp6;
+        quint32 ip4;
+        UInt128 ip6;
+        int attempts; // sent so far
+        bool isRefresh;
+    };
+
+    enum Result {
+        kDropped,   // device or neighbor entry no longer exists
+        kResolved,
+        kSent,
+        kFailed
+    };
+
+    NeighborResolver(DeviceManager *deviceManager, int portId);
+    ~NeighborResolver();
+
+    void add(const DeviceKey &device, quint32 ip4);
+    void add(const DeviceKey &device, UInt128 ip6);
+    void clear();
+
+    int maxAttempts() const { return maxAttempts_; }
+
+signals:
+    void progress(int portId, int pending, int sent, int resolved, int failed);
+
+protected:
+    void run();
+
+private:
+    void add(const Request &request);
+    void schedule(qint64 msecs, const Request &request);
+    void emitProgress();
+
+    static const int kTickMsecs = 10;
+    static const int kProgressMsecs = 500;
+
+    DeviceManager *deviceManager_;
+    int portId_;
+    int rate_;          // requests/sec
+    int maxAttempts_;
+    int timeout_;       // msecs, for the first attempt
+    int refresh_;       // msecs, 0 => never
+
+    QMutex lock_;       // for all of the below
+    TimerWheel<Request> wheel_; // tick: kTickMsecs of timer_
+    QElapsedTimer timer_;
+    uint generation_;   // incremented by clear()
+    bool isActive_;
+    volatile bool stop_;
+    int pending_;       // requests (not refreshes) in wheel_
+    int sent_;
+    int resolved_;
+    int failed_;
+};
+
+#endif
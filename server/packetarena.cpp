@@ -0,0 +1,245 @@
+/*
+Copyright (C) 2017 Srivats P.
+
+
+This file is part of "Ostinato"
+
+This is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+
+#include "packetarena.h"
+
+#include <stdlib.h>
+
+#ifdef Q_OS_LINUX
+#include <errno.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <linux/mempolicy.h>
+#endif
+
+PacketArena::PacketArena(size_t blockSize)
+{
+    blockSize_ = blockSize;
+    numaNode_ = -1;
+    current_ = 0;
+    offset_ = 0;
+    last_ = NULL;
+}
+
+PacketArena::~PacketArena()
+{
+    while (blocks_.size())
+        freeBlock(blocks_.takeFirst());
+}
+
+/*!
+  Returns a buffer of size bytes; NULL if no memory is available
+
+  The buffer is valid until clear() is called
+*/
+char* PacketArena::alloc(size_t size)
+{
+    QMutexLocker locker(&lock_);
+
+    size = (size + kAlign - 1) & ~(kAlign - 1);
+
+    // Blocks are used in order - skip those without enough free space
+    while (current_ < blocks_.size())
+    {
+        if ((offset_ + size) <= blocks_.at(current_).size)
+            break;
+        current_++;
+        offset_ = 0;
+    }
+
+    if (current_ == blocks_.size())
+    {
+        Block block = allocBlock(qMax(size, blockSize_));
+
+        if (!block.base)
+            return NULL;
+        if (numaNode_ >= 0)
+            bindBlock(block, numaNode_, false);
+        blocks_.append(block);
+        offset_ = 0;
+    }
+
+    last_ = blocks_.at(current_).base + offset_;
+    offset_ += size;
+
+    return last_;
+}
+
+/*!
+  Returns the unused tail of the last buffer allocated (only size bytes
+  of it are used) to the arena; does nothing for any other buffer
+*/
+void PacketArena::trim(char *buffer, size_t size)
+{
+    QMutexLocker locker(&lock_);
+
+    if (!buffer || (buffer != last_))
+        return;
+
+    size = (size + kAlign - 1) & ~(kAlign - 1);
+    offset_ = (buffer - blocks_.at(current_).base) + size;
+}
+
+/*!
+  Releases all buffers; blocks beyond those used since the last clear()
+  are freed so that a large packet list doesn't pin its memory for good
+*/
+void PacketArena::clear()
+{
+    QMutexLocker locker(&lock_);
+    int used = offset_ ? current_ + 1 : current_;
+
+    // Keep one block even if unused - an empty list is often followed by
+    // a small one
+    while (blocks_.size() > qMax(used, 1))
+        freeBlock(blocks_.takeLast());
+
+    current_ = 0;
+    offset_ = 0;
+    last_ = NULL;
+}
+
+/*!
+  Places the arena's memory on the given NUMA node (-1 for no preference);
+  memory already allocated is migrated to the node
+
+  The node is a preference, not a hard binding - if the node has no free
+  memory, the kernel allocates from other nodes
+*/
+void PacketArena::setNumaNode(int node)
+{
+    QMutexLocker locker(&lock_);
+
+    if (node == numaNode_)
+        return;
+
+    numaNode_ = node;
+    for (int i = 0; i < blocks_.size(); i++)
+        bindBlock(blocks_.at(i), numaNode_, true);
+}
+
+size_t PacketArena::capacity() const
+{
+    QMutexLocker locker(&lock_);
+    size_t size = 0;
+
+    for (int i = 0; i < blocks_.size(); i++)
+        size += blocks_.at(i).size;
+
+    return size;
+}
+
+bool PacketArena::isHugePageBacked() const
+{
+    QMutexLocker locker(&lock_);
+
+    for (int i = 0; i < blocks_.size(); i++) {
+        if (!blocks_.at(i).isHugePage)
+            return false;
+    }
+
+    return !blocks_.isEmpty();
+}
+
+PacketArena::Block PacketArena::allocBlock(size_t size)
+{
+    Block block;
+
+    block.isMapped = false;
+    block.isHugePage = false;
+
+#ifdef Q_OS_LINUX
+#ifdef MAP_HUGETLB
+    // Explicit hugepages (of the default hugepage size - 2MB/1GB) if the
+    // admin has reserved some ...
+    block.base = (char*) mmap(NULL, size, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (block.base != MAP_FAILED) {
+        block.size = size;
+        block.isMapped = true;
+        block.isHugePage = true;
+        return block;
+    }
+    qDebug("%s: no hugetlb pages for %zu bytes (%s)", __FUNCTION__,
+            size, strerror(errno));
+#endif
+
+    // ... otherwise ask for transparent hugepages
+    block.base = (char*) mmap(NULL, size, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (block.base != MAP_FAILED) {
+        block.size = size;
+        block.isMapped = true;
+#ifdef MADV_HUGEPAGE
+        block.isHugePage = (madvise(block.base, size, MADV_HUGEPAGE) == 0);
+#endif
+        return block;
+    }
+    qWarning("%s: unable to mmap %zu bytes (%s)", __FUNCTION__,
+            size, strerror(errno));
+#endif
+
+    block.base = (char*) malloc(size);
+    block.size = block.base ? size : 0;
+
+    return block;
+}
+
+void PacketArena::bindBlock(const Block &block, int node, bool move)
+{
+#if defined(Q_OS_LINUX) && defined(SYS_mbind)
+    const int kMaxNodes = 1024;
+    const int kBitsPerLong = 8*sizeof(unsigned long);
+    unsigned long nodeMask[kMaxNodes/kBitsPerLong];
+
+    // mbind() needs page aligned memory - only mmap()ed blocks are
+    if (!block.isMapped || (node >= kMaxNodes))
+        return;
+
+    memset(nodeMask, 0, sizeof(nodeMask));
+    if (node >= 0)
+        nodeMask[node/kBitsPerLong] |= 1UL << (node % kBitsPerLong);
+
+    if (syscall(SYS_mbind, block.base, block.size,
+                (node >= 0) ? MPOL_PREFERRED : MPOL_DEFAULT,
+                (node >= 0) ? nodeMask : NULL, kMaxNodes,
+                move ? MPOL_MF_MOVE : 0) < 0)
+        qWarning("%s: unable to bind %zu bytes to numa node %d (%s)",
+                __FUNCTION__, block.size, node, strerror(errno));
+#else
+    Q_UNUSED(block);
+    Q_UNUSED(node);
+    Q_UNUSED(move);
+#endif
+}
+
+void PacketArena::freeBlock(const Block &block)
+{
+#ifdef Q_OS_LINUX
+    if (block.isMapped) {
+        munmap(block.base, block.size);
+        return;
+    }
+#endif
+    free(block.base);
+}
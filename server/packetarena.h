@@ -0,0 +1,92 @@
+/*
+Copyright (C) 2017 Srivats P.
+
+
+This file is part of "Ostinato"
+
+This is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+
+#ifndef _PACKET_ARENA_H
+#define _PACKET_ARENA_H
+
+#include <QList>
+#include <QMutex>
+#include <QtGlobal>
+
+#include <stddef.h>
+
+/*!
+  Bump allocator for the send queue buffers of a transmitter's packet
+  sequences
+
+  Buffers are carved contiguously from large blocks - backed by hugepages
+  where available - instead of a separate heap allocation for each
+  sequence; this keeps the frames to be sent together in memory and
+  reduces TLB misses while transmitting.
+
+  Individual buffers are never freed - clear() releases all of them at
+  once; the blocks the cleared packet list used (its high-water mark) are
+  retained and reused for the next packet list, any more are freed
+
+  On multi-socket systems, the memory can be placed on a NUMA node - the
+  one local to the port's NIC - see setNumaNode()
+
+  The blocks are guarded by a lock so that a NUMA node can be set (by a
+  port config change) while a packet list is being built
+*/
+class PacketArena
+{
+public:
+    PacketArena(size_t blockSize = kDefaultBlockSize);
+    ~PacketArena();
+
+    char* alloc(size_t size);
+    void trim(char *buffer, size_t size);
+    void clear();
+
+    int numaNode() const { return numaNode_; }
+    void setNumaNode(int node);
+
+    size_t capacity() const;
+    bool isHugePageBacked() const;
+
+private:
+    struct Block
+    {
+        char *base;
+        size_t size;
+        bool isMapped;  // mmap()ed, not malloc()ed
+        bool isHugePage;
+    };
+
+    static Block allocBlock(size_t size);
+    static void freeBlock(const Block &block);
+    static void bindBlock(const Block &block, int node, bool move);
+
+    // Multiple of 1GB/2MB hugepage sizes
+    static const size_t kDefaultBlockSize = 64*1024*1024;
+    static const size_t kAlign = 64; // cacheline
+
+    mutable QMutex lock_;
+    size_t blockSize_;
+    int numaNode_;      // -1 => no preference
+    QList<Block> blocks_;
+    int current_;       // index of block being allocated from
+    size_t offset_;     // offset of free space in current block
+    char *last_;        // last buffer allocated
+};
+
+#endif
@@ -19,11 +19,35 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 
 #include "packetbuffer.h"
 
+#include <QThreadStorage>
+#include <QVector>
+
+static const int kDefaultSize = 1600;
+static const int kMaxPoolSize = 256; // per thread; excess buffers are freed
+
+// Buffers released by a thread - no locks needed as only that thread
+// uses its pool (a buffer released by another thread joins that one's)
+class PacketBufferPool
+{
+public:
+    ~PacketBufferPool() { qDeleteAll(free_); }
+    QVector<PacketBuffer*> free_;
+};
+
+static QThreadStorage<PacketBufferPool*> pools;
+
+static PacketBufferPool* threadPool()
+{
+    if (!pools.hasLocalData())
+        pools.setLocalData(new PacketBufferPool);
+    return pools.localData();
+}
+
 // PacketBuffer with full control
 PacketBuffer::PacketBuffer(int size)
 {
     if (size == 0)
-        size = 1600;
+        size = kDefaultSize;
 
     buffer_ = new uchar[size];
     is_own_buffer_ = true;
@@ -49,6 +73,40 @@ PacketBuffer::~PacketBuffer()
         delete[] buffer_;
 }
 
+PacketBuffer* PacketBuffer::alloc(int headroom)
+{
+    PacketBufferPool *pool = threadPool();
+    PacketBuffer *pktBuf;
+
+    if (pool->free_.isEmpty())
+        pktBuf = new PacketBuffer;
+    else {
+        pktBuf = pool->free_.last();
+        pool->free_.pop_back();
+        pktBuf->reset();
+    }
+    pktBuf->reserve(headroom);
+
+    return pktBuf;
+}
+
+void PacketBuffer::release()
+{
+    PacketBufferPool *pool = threadPool();
+
+    if (!is_own_buffer_ || (end_ - buffer_ != kDefaultSize)
+            || (pool->free_.size() >= kMaxPoolSize)) {
+        delete this;
+        return;
+    }
+    pool->free_.append(this);
+}
+
+void PacketBuffer::reset()
+{
+    head_ = data_ = tail_ = buffer_;
+}
+
 int PacketBuffer::length() const
 {
     return tail_ - data_;
@@ -108,3 +166,10 @@ uchar* PacketBuffer::put(int len)
 
     return oldTail;
 }
+
+// Drops all but the first len bytes of data
+void PacketBuffer::trim(int len)
+{
+    if ((len >= 0) && (len < (tail_ - data_)))
+        tail_ = data_ + len;
+}
@@ -29,6 +29,11 @@ public:
     PacketBuffer(const uchar *buffer, int size);
     ~PacketBuffer();
 
+    // Pooled (per-thread) buffers of the default size for the emulation
+    // path - get one with headroom reserved; release() instead of delete
+    static PacketBuffer* alloc(int headroom = 0);
+    void release();
+
     int length() const;
 
     uchar* head() const;
@@ -40,8 +45,11 @@ public:
     uchar* pull(int len);
     uchar* push(int len);
     uchar* put(int len);
+    void trim(int len);
 
 private:
+    void reset();
+
     uchar *buffer_;
     bool is_own_buffer_;
     uchar *head_, *data_, *tail_, *end_;
@@ -0,0 +1,56 @@
+/*
+Copyright (C) 2017 Srivats P.
+
+
+This file is part of "Ostinato"
+
+This is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+
+#include "packetlistbuilder.h"
+
+#include "abstractport.h"
+
+#include <QReadWriteLock>
+#include <QTime>
+
+PacketListBuilder::PacketListBuilder(int portId, AbstractPort *port,
+                                     QReadWriteLock *lock)
+    : portId_(portId), port_(port), lock_(lock)
+{
+    isBuilt_ = false;
+    isCancelled_ = false;
+    elapsedMsecs_ = 0;
+}
+
+void PacketListBuilder::run()
+{
+    QTime timer;
+
+    timer.start();
+    lock_->lockForWrite();
+    if (port_->isDirty() && !port_->isTransmitOn()) {
+        qDebug("port %d: building packet list", portId_);
+        port_->updatePacketList(true);
+        isCancelled_ = port_->isDirty();
+        isBuilt_ = !isCancelled_;
+    }
+    lock_->unlock();
+    elapsedMsecs_ = timer.elapsed();
+
+    qDebug("port %d: packet list %s in %d msecs", portId_,
+            isBuilt_ ? "built" : isCancelled_ ? "cancelled" : "not dirty",
+            elapsedMsecs_);
+}
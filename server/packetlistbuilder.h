@@ -0,0 +1,62 @@
+/*
+Copyright (C) 2017 Srivats P.
+
+
+This file is part of "Ostinato"
+
+This is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+
+#ifndef _PACKET_LIST_BUILDER_H
+#define _PACKET_LIST_BUILDER_H
+
+#include <QThread>
+
+class AbstractPort;
+class QReadWriteLock;
+
+/*!
+  Builds a port's (dirty) packet list in the background - for
+  prepareTransmit
+
+  The port lock is held for write for the duration of the build, so
+  anything else that needs the packet list or the port config (e.g.
+  startTransmit) waits for the build to finish - or cancels it, see
+  AbstractPort::cancelPacketListBuild()
+*/
+class PacketListBuilder : public QThread
+{
+    Q_OBJECT
+public:
+    PacketListBuilder(int portId, AbstractPort *port, QReadWriteLock *lock);
+
+    int portId() const { return portId_; }
+    bool isBuilt() const { return isBuilt_; }
+    bool isCancelled() const { return isCancelled_; }
+    int elapsedMsecs() const { return elapsedMsecs_; }
+
+protected:
+    void run();
+
+private:
+    int portId_;
+    AbstractPort *port_;
+    QReadWriteLock *lock_;
+    bool isBuilt_; // false if there was nothing to build
+    bool isCancelled_;
+    int elapsedMsecs_;
+};
+
+#endif
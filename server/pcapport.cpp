@@ -20,72 +20,88 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 #include "pcapport.h"
 
 #include "devicemanager.h"
+#include "latencyclock.h"
 #include "packetbuffer.h"
+#include "settings.h"
+#include "timestamp.h"
 
+#include <QtConcurrentRun>
 #include <QtGlobal>
+#include <string.h>
 
 #ifdef Q_OS_WIN32
 #include <windows.h>
 #endif
 
-pcap_if_t *PcapPort::deviceList_ = NULL;
-
-
-#if defined(Q_OS_LINUX)
-typedef struct timeval TimeStamp;
-static void inline getTimeStamp(TimeStamp *stamp)
-{
-    gettimeofday(stamp, NULL);
-}
-
-// Returns time diff in usecs between end and start
-static long inline udiffTimeStamp(const TimeStamp *start, const TimeStamp *end)
-{
-    struct timeval diff;
-    long usecs;
+#ifdef HAVE_SENDMMSG
+#include <sys/socket.h>
+#endif
 
-    timersub(end, start, &diff);
+#ifdef Q_OS_LINUX
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#endif
 
-    usecs = diff.tv_usec;
-    if (diff.tv_sec)
-        usecs += diff.tv_sec*1e6;
+pcap_if_t *PcapPort::deviceList_ = NULL;
 
-    return usecs;
-}
-#elif defined(Q_OS_WIN32)
-static quint64 gTicksFreq;
-typedef LARGE_INTEGER TimeStamp;
-static void inline getTimeStamp(TimeStamp* stamp)
-{
-    QueryPerformanceCounter(stamp);
-}
+#ifdef Q_OS_WIN32
+quint64 gTicksFreq;
+#endif
 
-static long inline udiffTimeStamp(const TimeStamp *start, const TimeStamp *end)
+// See kPcapRxBufferSizeKey and friends
+static OstProto::PcapRx defaultPcapRx()
 {
-    if (end->QuadPart >= start->QuadPart)
-        return (end->QuadPart - start->QuadPart)*long(1e6)/gTicksFreq;
-    else
-    {
-        // FIXME: incorrect! what's the max value for this counter before
-        // it rolls over?
-        return (start->QuadPart)*long(1e6)/gTicksFreq;
-    }
+    OstProto::PcapRx config;
+
+    config.set_buffer_size(appSettings->value(kPcapRxBufferSizeKey,
+                kPcapRxBufferSizeDefaultValue).toUInt());
+    config.set_immediate_mode(appSettings->value(kPcapRxImmediateModeKey,
+                kPcapRxImmediateModeDefaultValue).toBool());
+    config.set_tpacket_version(appSettings->value(kPcapRxTpacketVersionKey,
+                kPcapRxTpacketVersionDefaultValue).toUInt());
+    config.set_dispatch_batch(appSettings->value(kPcapRxDispatchBatchKey,
+                kPcapRxDispatchBatchDefaultValue).toUInt());
+
+    return config;
 }
-#else
-typedef int TimeStamp;
-static void inline getTimeStamp(TimeStamp*) {}
-static long inline udiffTimeStamp(const TimeStamp*, const TimeStamp*) { return 0; }
-#endif
 
 PcapPort::PcapPort(int id, const char *device)
     : AbstractPort(id, device)
 {
+    data_.mutable_pcap_rx()->CopyFrom(defaultPcapRx());
+
     monitorRx_ = new PortMonitor(device, kDirectionRx, &stats_);
     monitorTx_ = new PortMonitor(device, kDirectionTx, &stats_);
+    monitorTx_->setRateControl(this);
     transmitter_ = new PortTransmitter(device);
     capturer_ = new PortCapturer(device);
     emulXcvr_ = new EmulationTransceiver(device, deviceManager_);
 
+    // Each additional transmit worker has its own pcap handle (and hence
+    // its own socket and, with worker cpu pinning, its own NIC tx queue)
+    int workers = appSettings->value(kTxWorkersKey,
+                        kTxWorkersDefaultValue).toInt();
+    workers = qBound(1, workers, qMax(1, QThread::idealThreadCount()));
+    for (int i = 1; i < workers; i++) {
+        txWorkers_.append(new PortTransmitter(device));
+        txWorkers_.last()->placer().setName(QString("tx%1").arg(i));
+        txWorkers_.last()->metrics().setThread(QString("tx%1").arg(i));
+        txWorkers_.last()->setStreamStatsLane(i);
+    }
+    nextTxWorker_ = 0;
+    skippedSet_.remaining = 0;
+    rateScale_ = 1.0;
+    rateControlTicks_ = 0;
+    txLoad_ = 1.0;
+    isSharedTransmit_ = appSettings->value(kSharedTransmitKey,
+                            kSharedTransmitDefaultValue).toBool();
+
+    // Each worker sends (and stores) only its share of a packet set; half
+    // of each worker cpu's cache is left for everything else
+    loopCacheBytes_ = ThreadPlacer::cpuCacheSize()/2 * txWorkerCount();
+
     if (!monitorRx_->handle() || !monitorTx_->handle())
         isUsable_ = false;
 
@@ -113,11 +129,17 @@ PcapPort::PcapPort(int id, const char *device)
 
 void PcapPort::init()
 {
-    if (!monitorTx_->isDirectional())
+    // With multiple tx workers, per worker stats are summed in stats()
+    if (!monitorTx_->isDirectional() && txWorkers_.isEmpty())
         transmitter_->useExternalStats(&stats_);
 
     transmitter_->setHandle(monitorRx_->handle());
 
+    if (appSettings->value(kStreamStatsKey, kStreamStatsDefaultValue).toBool()) {
+        rxStreamStats_.enableHistograms();
+        monitorRx_->setStreamStats(&rxStreamStats_);
+    }
+
     updateNotes();
 
     monitorRx_->start();
@@ -136,6 +158,8 @@ PcapPort::~PcapPort()
     delete emulXcvr_;
     delete capturer_;
     delete transmitter_;
+    while (txWorkers_.size())
+        delete txWorkers_.takeFirst();
 
     if (monitorRx_)
         monitorRx_->wait();
@@ -170,15 +194,437 @@ void PcapPort::updateNotes()
 
 bool PcapPort::setRateAccuracy(AbstractPort::Accuracy accuracy)
 {
-    if (transmitter_->setRateAccuracy(accuracy)) {
-        AbstractPort::setRateAccuracy(accuracy);
-        return true;
+    for (int i = 0; i < txWorkerCount(); i++) {
+        if (!txWorker(i)->setRateAccuracy(accuracy))
+            return false;
+    }
+    AbstractPort::setRateAccuracy(accuracy);
+    return true;
+}
+
+void PcapPort::clearPacketList()
+{
+    for (int i = 0; i < txWorkerCount(); i++)
+        txWorker(i)->clearPacketList();
+    nextTxWorker_ = 0;
+    skippedSet_.remaining = 0;
+    setPacketListLoopMode(false, 0, 0);
+}
+
+/*
+ * With multiple tx workers, the packets are distributed across the workers
+ * in a round robin manner - each packet retains its original timestamp, so
+ * each worker sends at (1/N)th of the rate and the aggregate is the
+ * configured rate. A packet set of size S is split into N packet sets with
+ * the i-th worker getting every N-th packet starting from the i-th one
+ *
+ * If S < N, the workers with no packets in the set wait out its repeats
+ * instead - with a jump whose delay is known once the set's packets are
+ * all appended (see countSkippedSet())
+ */
+void PcapPort::loopNextPacketSet(qint64 size, qint64 repeats,
+        long repeatDelaySec, long repeatDelayNsec)
+{
+    int n = txWorkerCount();
+
+    for (int i = 0; i < n; i++) {
+        qint64 workerSize = (size - i + n - 1)/n;
+
+        if (workerSize > 0)
+            txWorker(i)->loopNextPacketSet(workerSize, repeats,
+                    repeatDelaySec, repeatDelayNsec);
+        else
+            txWorker(i)->skipNextPacketSet(repeats);
+    }
+    nextTxWorker_ = 0;
+
+    skippedSet_.remaining = (size < n) ? size : 0;
+    skippedSet_.repeats = repeats;
+    skippedSet_.repeatDelay = repeatDelaySec*quint64(1e9) + repeatDelayNsec;
+}
+
+/*
+ * Notes a packet appended to a packet set that some workers skip - once
+ * the set is complete, the skipping workers wait out all its repeats but
+ * the first (the timestamps of the packets after the set account for that)
+ */
+void PcapPort::countSkippedSet(long sec, long nsec, quint64 repeats,
+        quint64 gapNsec)
+{
+    quint64 start = quint64(sec)*quint64(1e9) + nsec;
+    quint64 duration = 0;
+
+    if (skippedSet_.remaining <= 0)
+        return;
+
+    if (nextTxWorker_ == 0) // the set's first packet
+        skippedSet_.firstNsec = start;
+    skippedSet_.lastNsec = start + (repeats - 1)*gapNsec;
+    skippedSet_.remaining -= repeats;
+    if (skippedSet_.remaining > 0)
+        return;
+
+    if (skippedSet_.repeats > 1)
+        duration = quint64(skippedSet_.repeats - 1)
+                    * (skippedSet_.lastNsec - skippedSet_.firstNsec
+                        + skippedSet_.repeatDelay);
+    for (int i = 0; i < txWorkerCount(); i++)
+        txWorker(i)->setSkippedSetDuration(duration);
+    skippedSet_.remaining = 0;
+}
+
+bool PcapPort::appendToPacketList(long sec, long nsec, const uchar *packet,
+        int length)
+{
+    PortTransmitter *worker = txWorker(nextTxWorker_);
+
+    countSkippedSet(sec, nsec, 1, 0);
+    nextTxWorker_ = (nextTxWorker_ + 1) % txWorkerCount();
+    return worker->appendToPacketList(sec, nsec, packet, length);
+}
+
+bool PcapPort::appendRefToPacketList(long sec, long nsec,
+        const uchar *packet, int length, quint64 repeats, quint64 gapNsec)
+{
+    int n = txWorkerCount();
+    bool ret = true;
+
+    countSkippedSet(sec, nsec, repeats, gapNsec);
+
+    // Split the repeats round robin across the workers just like we do
+    // for individual packets
+    for (int i = 0; (i < n) && (quint64(i) < repeats); i++) {
+        PortTransmitter *worker = txWorker((nextTxWorker_ + i) % n);
+        quint64 start = quint64(sec)*quint64(1e9) + nsec + i*gapNsec;
+
+        if (!worker->appendRefToPacketList(start/quint64(1e9),
+                    start%quint64(1e9), packet, length,
+                    (repeats - i + n - 1)/n, gapNsec*n))
+            ret = false;
+    }
+    nextTxWorker_ = (nextTxWorker_ + repeats) % n;
+
+    return ret;
+}
+
+bool PcapPort::appendGeneratorToPacketList(long sec, long nsec,
+        FrameGenerator *generator)
+{
+    int n = txWorkerCount();
+    bool ret = true;
+
+    if (n == 1)
+        return txWorker(0)->appendGeneratorToPacketList(sec, nsec, generator);
+
+    // Each worker generates (and sends) every N-th frame just like we
+    // distribute individual packets; frame times are relative to sec/nsec
+    // for all the splits
+    for (int i = 0; i < n; i++) {
+        PortTransmitter *worker = txWorker((nextTxWorker_ + i) % n);
+
+        if (!worker->appendGeneratorToPacketList(sec, nsec,
+                    generator->split(i, n)))
+            ret = false;
+    }
+    delete generator;
+
+    return ret;
+}
+
+void PcapPort::setPacketListLoopMode(bool loop, quint64 secDelay,
+        quint64 nsecDelay)
+{
+    for (int i = 0; i < txWorkerCount(); i++)
+        txWorker(i)->setPacketListLoopMode(loop, secDelay, nsecDelay);
+}
+
+void PcapPort::setPacketListStream(qint64 streamId)
+{
+    for (int i = 0; i < txWorkerCount(); i++)
+        txWorker(i)->setPacketListStream(streamId < 0 ?
+                -1 : qint64(StreamStatsTable::key(id(), quint32(streamId))));
+}
+
+void PcapPort::setPacketListShuffle(bool isShuffled, quint64 seed)
+{
+    for (int i = 0; i < txWorkerCount(); i++)
+        txWorker(i)->setPacketListShuffle(isShuffled, seed);
+}
+
+/*
+ * Each worker has every stream's marks and jumps - a worker with none of
+ * a stream's frames jumps to where they would have been
+ */
+void PcapPort::markPacketListStream(uint streamId)
+{
+    for (int i = 0; i < txWorkerCount(); i++)
+        txWorker(i)->markPacketListStream(streamId);
+}
+
+void PcapPort::appendJumpToPacketList(qint64 streamId, quint64 nsecDelay)
+{
+    for (int i = 0; i < txWorkerCount(); i++)
+        txWorker(i)->appendJumpToPacketList(streamId, nsecDelay);
+}
+
+void PcapPort::commitPacketList()
+{
+    for (int i = 0; i < txWorkerCount(); i++)
+        txWorker(i)->commitPacketList();
+
+    // A new list while transmitting may be at a different rate - let the
+    // rate control settle again
+    rateControlTicks_ = 0;
+}
+
+void PcapPort::startTransmit()
+{
+    Q_ASSERT(!isDirty());
+
+    // Unless configured otherwise, pin workers to (different) cores only
+    // if we have more than one
+    if (!data_.has_tx_thread_placement() && !txWorkers_.isEmpty()) {
+        int cpus = qMax(1, QThread::idealThreadCount());
+        for (int i = 0; i < txWorkerCount(); i++) {
+            OstProto::ThreadPlacement placement;
+
+            placement.set_cpu((id()*txWorkerCount() + i) % cpus);
+            txWorker(i)->placer().setPlacement(placement);
+        }
+    }
+
+    rateScale_ = 1.0;
+    rateControlTicks_ = 0;
+    stats_.txRateError = 0;
+    for (int i = 0; i < txWorkerCount(); i++) {
+        txWorker(i)->setRateScale(rateScale_/txLoad_);
+        txWorker(i)->setStopTime(data_.transmit_duration(), txStopTime_);
+        txWorker(i)->setMaxRate(data_.max_rate());
+        // Multiple workers are for high rates - a thread each
+        txWorker(i)->setSharedTransmit(isSharedTransmit_
+                                       && txWorkers_.isEmpty());
+        txWorker(i)->start();
+    }
+
+    // A stop time is for this transmit only
+    txStopTime_ = 0;
+}
+
+void PcapPort::armTransmit(StartBarrierPtr barrier)
+{
+    for (int i = 0; i < txWorkerCount(); i++)
+        txWorker(i)->setStartBarrier(barrier);
+    startTransmit();
+}
+
+void PcapPort::addStreamStats(StreamStatsHash &stats)
+{
+    AbstractPort::addStreamStats(stats);
+
+    for (int i = 0; i < txWorkerCount(); i++)
+        txWorker(i)->streamStats().addTo(stats);
+}
+
+bool PcapPort::setProbeReflection(bool enable)
+{
+    // Our own frames must not be seen as received (and reflected again);
+    // and the frames must be monitored in full to find their signature
+    if (!monitorRx_)
+        return !enable;
+    if (enable && (!monitorRx_->isDirectional()
+                || !appSettings->value(kStreamStatsKey,
+                        kStreamStatsDefaultValue).toBool()))
+        return false;
+
+    monitorRx_->setReflector(enable ? transmitter_ : NULL);
+    return true;
+}
+
+// Capture and emulation take the config at their next start
+bool PcapPort::setPcapRx(const OstProto::PcapRx &config)
+{
+    // libpcap picks the TPACKET version by immediate mode - see PcapRx
+    if ((config.tpacket_version() != 0) && (config.tpacket_version() != 2)
+            && ((config.tpacket_version() != 3) || config.immediate_mode()))
+        return false;
+
+    return true;
+}
+
+void PcapPort::applyThreadPlacement()
+{
+    if (data_.has_tx_thread_placement()) {
+        for (int i = 0; i < txWorkerCount(); i++) {
+            OstProto::ThreadPlacement placement = data_.tx_thread_placement();
+
+            // One cpu per worker
+            if (placement.cpu() >= 0)
+                placement.set_cpu(placement.cpu() + i);
+            txWorker(i)->placer().setPlacement(placement);
+        }
+    }
+
+    // Some ports (e.g. Linux) don't have per port monitors
+    if (data_.has_rx_thread_placement()) {
+        if (monitorRx_)
+            monitorRx_->placer().setPlacement(data_.rx_thread_placement());
+        if (monitorTx_)
+            monitorTx_->placer().setPlacement(data_.rx_thread_placement());
+        capturer_->placer().setPlacement(data_.rx_thread_placement());
+    }
+
+    if (data_.has_emulation_thread_placement())
+        emulXcvr_->placer().setPlacement(data_.emulation_thread_placement());
+
+    updateTxNumaNode();
+}
+
+/*
+ * Frames to be sent are placed on the NUMA node the tx workers are
+ * configured to run on, if any, otherwise on the node local to the NIC
+ */
+void PcapPort::updateTxNumaNode()
+{
+    int node = data_.numa_node();
+
+    if (data_.has_tx_thread_placement()
+            && (data_.tx_thread_placement().numa_node() >= 0))
+        node = data_.tx_thread_placement().numa_node();
+
+    for (int i = 0; i < txWorkerCount(); i++)
+        txWorker(i)->setNumaNode(node);
+}
+
+void PcapPort::threadPlacementStatus(OstProto::Port *port)
+{
+    for (int i = 0; i < txWorkerCount(); i++)
+        txWorker(i)->placer().status(port->add_thread_placement_status());
+    if (monitorRx_)
+        monitorRx_->placer().status(port->add_thread_placement_status());
+    if (monitorTx_)
+        monitorTx_->placer().status(port->add_thread_placement_status());
+    capturer_->placer().status(port->add_thread_placement_status());
+    emulXcvr_->placer().status(port->add_thread_placement_status());
+}
+
+void PcapPort::stopTransmit()
+{
+    transmitter_->stop();
+    for (int i = 0; i < txWorkers_.size(); i++) {
+        if (txWorkers_.at(i)->isRunning())
+            txWorkers_.at(i)->stop();
+    }
+}
+
+bool PcapPort::isTransmitOn()
+{
+    for (int i = 0; i < txWorkerCount(); i++) {
+        if (txWorker(i)->isRunning())
+            return true;
     }
     return false;
 }
 
+/*
+ * The gaps of the packet list are scaled by 1/load - load is expected to
+ * be upto 1.0 as the packet list rates may be at the line rate already
+ */
+bool PcapPort::setTransmitLoad(double load)
+{
+    if (load <= 0)
+        return false;
+
+    txLoad_ = load;
+    return true;
+}
+
+bool PcapPort::transmitRunStats(quint64 *pkts, quint64 *bytes, quint64 *nsec)
+{
+    *pkts = *bytes = *nsec = 0;
+
+    // The workers start (and stop) together - the longest is the duration
+    for (int i = 0; i < txWorkerCount(); i++) {
+        quint64 workerPkts, workerBytes, workerNsec;
+
+        txWorker(i)->runStats(&workerPkts, &workerBytes, &workerNsec);
+        *pkts += workerPkts;
+        *bytes += workerBytes;
+        *nsec = qMax(*nsec, workerNsec);
+    }
+
+    return true;
+}
+
+void PcapPort::stats(PortStats *stats)
+{
+    // If tx stats are not available from the tx monitor and we have
+    // multiple workers, sum up the individual worker stats
+    if (!txWorkers_.isEmpty() && monitorTx_ && !monitorTx_->isDirectional()) {
+        quint64 pkts = 0, bytes = 0;
+
+        for (int i = 0; i < txWorkerCount(); i++) {
+            PortStats workerStats;
+
+            txWorker(i)->txStats().snapshot(&workerStats);
+            pkts += workerStats.txPkts;
+            bytes += workerStats.txBytes;
+        }
+        stats_.txLock.writeBegin();
+        stats_.txPkts = pkts;
+        stats_.txBytes = bytes;
+        stats_.txLock.writeEnd();
+    }
+
+    AbstractPort::stats(stats);
+}
+
+/*
+ * Closed loop tx rate control - to be called once every stats refresh
+ * interval after the tx rate has been updated; by the tx monitor or, for
+ * ports without one, by the port type's stats monitor (Linux, BSD)
+ *
+ * The transmitters pace frames as per the packet list timestamps which is
+ * open loop - host load or NIC backpressure make the achieved rate drift
+ * from the target. We compare the NIC tx rate against the target and scale
+ * the scheduled gaps to correct for it (integral control). The scale is
+ * bounded so that a bogus counter can't run away with the rate.
+ */
+void PcapPort::updateRateControl()
+{
+    const double kGain = 0.5;
+    const double kMinScale = 0.8;
+    const double kMaxScale = 1.25;
+    double target, deadband, error;
+
+    if (!isTransmitOn() || (targetPacketRate_ <= 0)) {
+        stats_.txRateError = 0;
+        return;
+    }
+
+    // Skip the first few samples which include the transmit start
+    if (rateControlTicks_++ < kRateControlSettleTicks)
+        return;
+
+    target = targetPacketRate_*txLoad_;
+    error = (double(stats_.txPps) - target)/target;
+    stats_.txRateError = error;
+
+    // Don't chase the error due to the pps being an integer count
+    deadband = qMax(0.001, 2/target);
+    if (qAbs(error) < deadband)
+        return;
+
+    rateScale_ = qBound(kMinScale, rateScale_*(1 + kGain*error), kMaxScale);
+    qDebug("port %d: tx rate error %g, pacing scale %g", id(), error,
+            rateScale_);
+
+    for (int i = 0; i < txWorkerCount(); i++)
+        txWorker(i)->setRateScale(rateScale_/txLoad_);
+}
+
 void PcapPort::startDeviceEmulation()
 {
+    emulXcvr_->setRxConfig(data_.pcap_rx());
     emulXcvr_->start();
 }
 
@@ -187,29 +633,187 @@ void PcapPort::stopDeviceEmulation()
     emulXcvr_->stop();
 }
 
+// While transmitting, emulation frames are sent by the transmitter
+// between its own - see PortTransmitter::inject()
 int PcapPort::sendEmulationPacket(PacketBuffer *pktBuf)
 {
+    if (transmitter_->inject(pktBuf->data(), pktBuf->length()))
+        return 0;
     return emulXcvr_->transmitPacket(pktBuf);
 }
 
+// Returns the count sent (or queued to be sent)
+int PcapPort::sendEmulationPackets(const QList<PacketBuffer*> &pktBufs)
+{
+    int count = 0;
+
+    foreach(PacketBuffer *pktBuf, pktBufs) {
+        if (sendEmulationPacket(pktBuf) == 0)
+            count++;
+    }
+    return count;
+}
+
 /*
  * ------------------------------------------------------------------- *
  * Port Monitor
  * ------------------------------------------------------------------- *
  */
+#ifndef Q_OS_WIN32
+/*
+  Sets up the kernel buffering of config on handle - created but not yet
+  activated
+*/
+static void setRxBuffering(pcap_t *handle, const OstProto::PcapRx &config)
+{
+    if (config.buffer_size())
+        pcap_set_buffer_size(handle, int(config.buffer_size()*1024));
+
+#ifdef PCAP_TSTAMP_PRECISION_NANO // libpcap 1.5+
+    // On Linux libpcap uses TPACKET_V2 in immediate mode, else TPACKET_V3
+    // (whose blocks are handed over only once full or timed out)
+    if (config.immediate_mode() || (config.tpacket_version() == 2))
+        pcap_set_immediate_mode(handle, 1);
+#endif
+}
+
+/*
+  Same as pcap_open_live() - including its error messages, which callers
+  look into - but with the kernel buffering of config
+*/
+static pcap_t* openLive(const char *device, int snapLen, bool promisc,
+                        int timeout, const OstProto::PcapRx &config,
+                        char *errbuf)
+{
+    int ret;
+    pcap_t *handle = pcap_create(device, errbuf);
+
+    if (!handle)
+        return NULL;
+
+    pcap_set_snaplen(handle, snapLen);
+    pcap_set_promisc(handle, int(promisc));
+    pcap_set_timeout(handle, timeout);
+    setRxBuffering(handle, config);
+
+    // Warnings (>0) are ok
+    ret = pcap_activate(handle);
+    if (ret < 0) {
+        qsnprintf(errbuf, PCAP_ERRBUF_SIZE, "%s: %s (%s)", device,
+                pcap_statustostr(ret), pcap_geterr(handle));
+        pcap_close(handle);
+        return NULL;
+    }
+
+    return handle;
+}
+#else
+// WinPcap/Npcap can change these on an open handle
+static void setRxBuffering(pcap_t *handle, const OstProto::PcapRx &config)
+{
+    if (config.buffer_size())
+        pcap_setbuff(handle, int(config.buffer_size()*1024));
+    if (config.immediate_mode())
+        pcap_setmintocopy(handle, 0);
+}
+#endif
+
+#if !defined(Q_OS_WIN32) && defined(PCAP_TSTAMP_PRECISION_NANO)
+/*
+  Opens device with nanosec timestamps - from the NIC if it can timestamp
+  rx frames (libpcap uses SO_TIMESTAMPING for this on Linux), from the
+  kernel otherwise; returns NULL on failure
+*/
+static pcap_t* openTimestamped(const char *device, int snapLen,
+                               const OstProto::PcapRx &config,
+                               bool *isNicTs = NULL)
+{
+    char errbuf[PCAP_ERRBUF_SIZE] = "";
+    int *types = NULL;
+    int count;
+    pcap_t *handle = pcap_create(device, errbuf);
+
+    if (!handle)
+        return NULL;
+
+    pcap_set_snaplen(handle, snapLen);
+    pcap_set_promisc(handle, 1);
+    pcap_set_timeout(handle, 1000 /* ms */);
+
+    // Only a NIC clock synced to the system clock is comparable with
+    // the tx timestamps
+    count = pcap_list_tstamp_types(handle, &types);
+    for (int i = 0; i < count; i++) {
+        if (types[i] == PCAP_TSTAMP_ADAPTER) {
+            if (pcap_set_tstamp_type(handle, PCAP_TSTAMP_ADAPTER) == 0) {
+                qDebug("%s: using NIC rx timestamps", device);
+                if (isNicTs)
+                    *isNicTs = true;
+            }
+            break;
+        }
+    }
+    if (count > 0)
+        pcap_free_tstamp_types(types);
+
+    pcap_set_tstamp_precision(handle, PCAP_TSTAMP_PRECISION_NANO);
+    setRxBuffering(handle, config);
+
+    // Warnings (>0) are ok
+    if (pcap_activate(handle) < 0) {
+        qDebug("%s: can't open with nanosec timestamps: %s", device,
+                pcap_geterr(handle));
+        pcap_close(handle);
+        return NULL;
+    }
+
+    return handle;
+}
+#endif
+
 PcapPort::PortMonitor::PortMonitor(const char *device, Direction direction,
         AbstractPort::PortStats *stats)
+    : metrics_(direction == kDirectionRx ? "rx-monitor" : "tx-monitor",
+               device),
+      placer_(direction == kDirectionRx ? "rx-monitor" : "tx-monitor")
 {
     int ret;
     char errbuf[PCAP_ERRBUF_SIZE] = "";
     bool noLocalCapture;
+    // Opened once - with the drone settings, not the port's config
+    OstProto::PcapRx rxConfig = defaultPcapRx();
+    // Stream signatures are at the end of the frame - so for stream stats
+    // we need the full frame
+    int snapLen = ((direction == kDirectionRx)
+                    && appSettings->value(kStreamStatsKey,
+                            kStreamStatsDefaultValue).toBool()) ? 65535 : 64;
 
     direction_ = direction;
     isDirectional_ = true;
     isPromisc_ = true;
     noLocalCapture = true;
     stats_ = stats;
+    streamStats_ = NULL;
+    reflector_ = NULL;
+    rateControl_ = NULL;
     stop_ = false;
+    isNsecTs_ = false;
+    isNicTs_ = false;
+    lastPkts_ = lastBytes_ = 0;
+    lastRateSec_ = 0;
+    dispatchBatch_ = int(rxConfig.dispatch_batch());
+
+#if !defined(Q_OS_WIN32) && defined(PCAP_TSTAMP_PRECISION_NANO)
+    // Full frames are needed only for stream stats - and so latency
+    if (snapLen > 64) {
+        handle_ = openTimestamped(device, snapLen, rxConfig, &isNicTs_);
+        if (handle_) {
+            isNsecTs_ = (pcap_get_tstamp_precision(handle_)
+                            == PCAP_TSTAMP_PRECISION_NANO);
+            goto _set_direction;
+        }
+    }
+#endif
 
 _retry:
 #ifdef Q_OS_WIN32
@@ -220,11 +824,13 @@ _retry:
     if (noLocalCapture)
         flags |= PCAP_OPENFLAG_NOCAPTURE_LOCAL;
 
-    handle_ = pcap_open(device, 64 /* FIXME */, flags,
+    handle_ = pcap_open(device, snapLen, flags,
                 1000 /* ms */, NULL, errbuf);
+    if (handle_)
+        setRxBuffering(handle_, rxConfig);
 #else
-    handle_ = pcap_open_live(device, 64 /* FIXME */, int(isPromisc_),
-                1000 /* ms */, errbuf);
+    handle_ = openLive(device, snapLen, isPromisc_, 1000 /* ms */,
+                rxConfig, errbuf);
 #endif
 
     if (handle_ == NULL)
@@ -244,6 +850,10 @@ _retry:
         else
             goto _open_error;
     }
+
+#if !defined(Q_OS_WIN32) && defined(PCAP_TSTAMP_PRECISION_NANO)
+_set_direction:
+#endif
 #ifdef Q_OS_WIN32
     // pcap_setdirection() API is not supported in Windows.
     // NOTE: WinPcap 4.1.1 and above exports a dummy API that returns -1
@@ -288,69 +898,189 @@ PcapPort::PortMonitor::~PortMonitor()
 
 void PcapPort::PortMonitor::run()
 {
+    ThreadPlacer::Scope placement(placer_);
+
     while (!stop_)
     {
-        int ret;
-        struct pcap_pkthdr *hdr;
-        const uchar *data;
-
-        ret = pcap_next_ex(handle_, &hdr, &data);
+        int ret = pcap_dispatch(handle_, dispatchBatch_, rxHandler,
+                                (uchar*) this);
         switch (ret)
         {
-            case 1:
-                switch (direction_)
-                {
-                case kDirectionRx:
-                    stats_->rxPkts++;
-                    stats_->rxBytes += hdr->len;
-                    break;
-
-                case kDirectionTx:
-                    if (isDirectional_)
-                    {
-                        stats_->txPkts++;
-                        stats_->txBytes += hdr->len;
-                    }
-                    break;
-
-                default:
-                    Q_ASSERT(false);
-                }
-
-                //! \todo TODO pkt/bit rates
-                break;
             case 0:
                 //qDebug("%s: timeout. continuing ...", __PRETTY_FUNCTION__);
-                continue;
+                updateRate(); // nothing for a while - rate has dropped
+                updateDrops();
+                break;
             case -1:
                 qWarning("%s: error reading packet (%d): %s",
                         __PRETTY_FUNCTION__, ret, pcap_geterr(handle_));
                 break;
             case -2:
-                qWarning("%s: error reading packet (%d): %s",
-                        __PRETTY_FUNCTION__, ret, pcap_geterr(handle_));
+                // stop() broke the loop
                 break;
             default:
-                qFatal("%s: Unexpected return value %d", __PRETTY_FUNCTION__, ret);
+                if (ret < 0)
+                    qFatal("%s: Unexpected return value %d",
+                            __PRETTY_FUNCTION__, ret);
         }
     }
 }
 
-void PcapPort::PortMonitor::stop()
+void PcapPort::PortMonitor::rxHandler(uchar *monitor,
+        const struct pcap_pkthdr *hdr, const uchar *data)
 {
-    stop_ = true;
-    pcap_breakloop(handle());
+    ((PortMonitor*) monitor)->receive(hdr, data);
 }
 
-/*
- * ------------------------------------------------------------------- *
- * Port Transmitter
- * ------------------------------------------------------------------- *
- */
-PcapPort::PortTransmitter::PortTransmitter(const char *device)
+void PcapPort::PortMonitor::receive(const struct pcap_pkthdr *hdr,
+                                    const uchar *data)
 {
-    char errbuf[PCAP_ERRBUF_SIZE] = "";
+    switch (direction_)
+    {
+    case kDirectionRx:
+        if (stats_)
+        {
+            stats_->rxLock.writeBegin();
+            stats_->rxPkts++;
+            stats_->rxBytes += hdr->len;
+            stats_->rxLock.writeEnd();
+        }
+        // tv_usec is nsecs with nanosec precision
+        if (streamStats_ && (hdr->caplen == hdr->len)) {
+            quint64 nsec = quint64(hdr->ts.tv_sec)*quint64(1e9)
+                            + quint64(hdr->ts.tv_usec)
+                                * (isNsecTs_ ? 1 : 1000);
+
+            streamStats_->countRx(data, hdr->len, isNicTs_ ?
+                    LatencyClock::fromNicTime(nsec) :
+                    LatencyClock::fromSystemTime(nsec));
+        }
+        if (reflector_ && (hdr->caplen == hdr->len))
+            reflect(data, hdr->len);
+        break;
+
+    case kDirectionTx:
+        if (stats_ && isDirectional_)
+        {
+            stats_->txLock.writeBegin();
+            stats_->txPkts++;
+            stats_->txBytes += hdr->len;
+            stats_->txLock.writeEnd();
+        }
+        break;
+
+    default:
+        Q_ASSERT(false);
+    }
+
+    // Cheap check to sample the rate about once a second
+    if (long(hdr->ts.tv_sec) != lastRateSec_) {
+        lastRateSec_ = long(hdr->ts.tv_sec);
+        updateRate();
+        updateDrops();
+    }
+}
+
+/*!
+  Sends a received tracked stream frame back to its sender (with its
+  source and destination swapped, see StreamStatsTable::reflect()) -
+  between the transmitter's frames if it is running, else right away on
+  our own handle. The frame's signature is left as is, so its sender
+  measures the round trip time as the frame's latency
+*/
+void PcapPort::PortMonitor::reflect(const uchar *data, int length)
+{
+    PortTransmitter *transmitter = reflector_;
+
+    if (!transmitter || !StreamStatsTable::isSigned(data, length))
+        return;
+
+    reflected_.resize(length);
+    memcpy(reflected_.data(), data, length);
+    StreamStatsTable::reflect((uchar*) reflected_.data(), length);
+
+    if (!transmitter->inject((const uchar*) reflected_.constData(), length))
+        pcap_sendpacket(handle_, (const uchar*) reflected_.constData(),
+                        length);
+    metrics_.add(OstProto::DroneMetric::kRxReflected);
+}
+
+/*!
+  Updates the port rate of the monitor's direction from the counts since
+  the last update - the tx counts may be updated by the transmitter
+  instead of by us (!isDirectional_), so we use the counts and not what
+  we saw since the last update
+*/
+void PcapPort::PortMonitor::updateRate()
+{
+    AbstractPort::PortStats now;
+    quint64 pkts, bytes;
 
+    if (!stats_)
+        return;
+
+    stats_->snapshot(&now);
+    if (direction_ == kDirectionRx) {
+        pkts = now.rxPkts;
+        bytes = now.rxBytes;
+    }
+    else {
+        pkts = now.txPkts;
+        bytes = now.txBytes;
+    }
+
+    rate_.update(pkts - lastPkts_, bytes - lastBytes_);
+    lastPkts_ = pkts;
+    lastBytes_ = bytes;
+
+    if (direction_ == kDirectionRx) {
+        stats_->rxLock.writeBegin();
+        stats_->rxPps = rate_.pps();
+        stats_->rxBps = rate_.bps();
+        stats_->rxLock.writeEnd();
+    }
+    else {
+        stats_->txRateLock.writeBegin();
+        stats_->txPps = rate_.pps();
+        stats_->txBps = rate_.bps();
+        stats_->txRateLock.writeEnd();
+        if (rateControl_)
+            rateControl_->updateRateControl();
+    }
+}
+
+// The pcap drop counts are cumulative since the handle was opened
+void PcapPort::PortMonitor::updateDrops()
+{
+    struct pcap_stat ps;
+
+    if (pcap_stats(handle_, &ps) == 0) {
+        metrics_.set(OstProto::DroneMetric::kRxDrops, ps.ps_drop);
+        metrics_.set(OstProto::DroneMetric::kRxIfDrops, ps.ps_ifdrop);
+
+        if (stats_ && (direction_ == kDirectionRx)) {
+            stats_->rxLock.writeBegin();
+            stats_->rxPcapDrops = ps.ps_drop;
+            stats_->rxPcapIfDrops = ps.ps_ifdrop;
+            stats_->rxLock.writeEnd();
+        }
+    }
+}
+
+void PcapPort::PortMonitor::stop()
+{
+    stop_ = true;
+    pcap_breakloop(handle());
+}
+
+/*
+ * ------------------------------------------------------------------- *
+ * Port Transmitter
+ * ------------------------------------------------------------------- *
+ */
+PcapPort::PortTransmitter::PortTransmitter(const char *device)
+    : placer_("tx"), metrics_("tx", device)
+{
 #ifdef Q_OS_WIN32
     LARGE_INTEGER   freq;
     if (QueryPerformanceFrequency(&freq))
@@ -359,28 +1089,44 @@ PcapPort::PortTransmitter::PortTransmitter(const char *device)
         Q_ASSERT_X(false, "PortTransmitter::PortTransmitter",
                 "This Win32 platform does not support performance counter");
 #endif
-    state_ = kNotStarted;
-    returnToQIdx_ = -1;
-    loopDelay_ = 0;
+    state_.set(kNotStarted);
+    packetList_ = txPacketList_ = &packetLists_[0];
+    streamKey_ = -1;
+    isShuffled_ = false;
+    shuffleSeed_ = 0;
+    isSequenceBreak_ = false;
+    skippedSetJump_ = NULL;
+    rateScale_ = kRateScaleOne;
+    isMaxRate_ = false;
+    duration_ = stopTime_ = 0;
+    stopNsec_ = -1;
+    isStoppedByTime_ = false;
+    isVirtualTime_ = false;
+    virtualNsec_ = 0;
+    getTimeStamp(&runStart_);
+    runStartPkts_ = runStartBytes_ = 0;
+    runNsec_ = 0;
     stop_ = false;
     stats_ = new AbstractPort::PortStats;
+    memset((void*) stats_, 0, sizeof(*stats_));
     usingInternalStats_ = true;
-    handle_ = pcap_open_live(device, 64 /* FIXME */, 0, 1000 /* ms */, errbuf);
-
-    if (handle_ == NULL)
-        goto _open_error;
-
-    usingInternalHandle_ = true;
-
-    return;
-
-_open_error:
-    qDebug("%s: Error opening port %s: %s\n", __FUNCTION__, device, errbuf);
+#ifdef HAVE_SENDMMSG
+    useSendBatch_ = false;
+#endif
+    // Opened on first transmit - see open()
+    deviceName_ = device;
+    handle_ = NULL;
     usingInternalHandle_ = false;
+    useShared_ = false;
+    isShared_ = false;
 }
 
 PcapPort::PortTransmitter::~PortTransmitter()
 {
+    if (isShared_)
+        TxScheduler::instance()->remove(this);
+    packetLists_[0].clear();
+    packetLists_[1].clear();
     if (usingInternalStats_)
         delete stats_;
     if (usingInternalHandle_)
@@ -392,11 +1138,16 @@ bool PcapPort::PortTransmitter::setRateAccuracy(
 {
     switch (accuracy) {
     case kHighAccuracy:
-        udelayFn_ = udelay;
+        ndelayFn_ = ndelay;
         qWarning("%s: rate accuracy set to High - busy wait", __FUNCTION__);
         break;
+    case kMediumAccuracy:
+        ndelayFn_ = ndelayHybrid;
+        qWarning("%s: rate accuracy set to Medium - sleep + busy wait",
+                __FUNCTION__);
+        break;
     case kLowAccuracy:
-        udelayFn_ = QThread::usleep;
+        ndelayFn_ = nsleep;
         qWarning("%s: rate accuracy set to Low - usleep", __FUNCTION__);
         break;
     default:
@@ -407,79 +1158,188 @@ bool PcapPort::PortTransmitter::setRateAccuracy(
     return true;
 }
 
+void PcapPort::PortTransmitter::PacketList::clear()
+{
+    while (sequences.size())
+        delete sequences.takeFirst();
+    generatedQueue[0] = generatedQueue[1] = NULL;
+    arena.clear();
+    returnToQIdx = -1;
+    loopDelay = 0;
+}
+
+/*
+ * Starts a new packet list - while transmitting, it is built in the list
+ * not being sent, which can be reused only after run() has switched over
+ * from it to the last list committed (if any)
+ */
 void PcapPort::PortTransmitter::clearPacketList()
 {
-    Q_ASSERT(!isRunning());
-    // \todo lock for packetSequenceList
-    while(packetSequenceList_.size())
-        delete packetSequenceList_.takeFirst();
+    listLock_.lock();
+    if (isRunning()) {
+        // The wait times out so as to notice the transmit stopping too
+        while (pendingPacketList_ && isRunning())
+            listSwitched_.wait(&listLock_, 100);
+
+        packetList_ = (txPacketList_ == &packetLists_[0]) ?
+                            &packetLists_[1] : &packetLists_[0];
+        packetList_->clear();
+    }
+    else {
+        pendingPacketList_.fetchAndStoreRelaxed(NULL);
+        packetLists_[0].clear();
+        packetLists_[1].clear();
+        packetList_ = txPacketList_ = &packetLists_[0];
+    }
+    listLock_.unlock();
 
     currentPacketSequence_ = NULL;
+    streamKey_ = -1;
+    isShuffled_ = false;
     repeatSequenceStart_ = -1;
     repeatSize_ = 0;
     packetCount_ = 0;
-
-    returnToQIdx_ = -1;
+    streamStarts_.clear();
+    isSequenceBreak_ = false;
+    skippedSetJump_ = NULL;
 
     setPacketListLoopMode(false, 0, 0);
 }
 
+/*
+ * Makes the packet list built since clearPacketList() the one to be sent -
+ * if transmitting, from the next packet set boundary onwards
+ */
+void PcapPort::PortTransmitter::commitPacketList()
+{
+    // Jumps may be to streams marked after them
+    for (int i = 0; i < packetList_->sequences.size(); i++) {
+        PacketSequence *seq = packetList_->sequences.at(i);
+
+        if (!seq->isJump_)
+            continue;
+        if (seq->jumpStreamId_ == kJumpToNext)
+            seq->jumpToQIdx_ = i + 1;
+        else
+            seq->jumpToQIdx_ = (seq->jumpStreamId_ < 0) ? -1 :
+                    streamStarts_.value(uint(seq->jumpStreamId_), -1);
+    }
+
+    QMutexLocker locker(&listLock_);
+
+    if (packetList_ == txPacketList_)
+        return;
+
+    if (isRunning())
+        pendingPacketList_.fetchAndStoreRelease(packetList_);
+    else
+        txPacketList_ = packetList_;
+}
+
+/*
+ * Makes the list committed while transmitting, if any, the one being sent
+ * and returns it (NULL if none) - the pending and the tx list are changed
+ * together under listLock_, so that clearPacketList() never sees the one
+ * without the other and reuses the list still being sent
+ */
+PcapPort::PortTransmitter::PacketList*
+PcapPort::PortTransmitter::switchPacketList()
+{
+    QMutexLocker locker(&listLock_);
+    PacketList *list = pendingPacketList_.fetchAndStoreAcquire(NULL);
+
+    if (list) {
+        txPacketList_ = list;
+        listSwitched_.wakeAll();
+    }
+
+    return list;
+}
+
 void PcapPort::PortTransmitter::loopNextPacketSet(qint64 size, qint64 repeats,
         long repeatDelaySec, long repeatDelayNsec)
 {
-    currentPacketSequence_ = new PacketSequence;
+    currentPacketSequence_ = newPacketSequence();
+    if (isShuffled_)
+        currentPacketSequence_->setShuffled(shuffleSeed_,
+                packetList_->sequences.size());
     currentPacketSequence_->repeatCount_ = repeats;
-    currentPacketSequence_->usecDelay_ = repeatDelaySec * long(1e6)
-                                            + repeatDelayNsec/1000;
+    currentPacketSequence_->nsecDelay_ = repeatDelaySec * qint64(1e9)
+                                            + repeatDelayNsec;
 
-    repeatSequenceStart_ = packetSequenceList_.size();
+    repeatSequenceStart_ = packetList_->sequences.size();
     repeatSize_ = size;
     packetCount_ = 0;
+    isSequenceBreak_ = false;
 
-    packetSequenceList_.append(currentPacketSequence_);
+    packetList_->sequences.append(currentPacketSequence_);
 }
 
 bool PcapPort::PortTransmitter::appendToPacketList(long sec, long nsec,
         const uchar *packet, int length)
+{
+    return appendRefToPacketList(sec, nsec, packet, length, 1, 0);
+}
+
+bool PcapPort::PortTransmitter::appendRefToPacketList(long sec, long nsec,
+        const uchar *packet, int length, quint64 repeats, quint64 gapNsec)
 {
     bool op = true;
     pcap_pkthdr pktHdr;
+    bool isRef = (repeats > 1);
 
     pktHdr.caplen = pktHdr.len = length;
     pktHdr.ts.tv_sec = sec;
-    pktHdr.ts.tv_usec = nsec/1000;
+    pktHdr.ts.tv_usec = nsec/(1000000000/kTsUnitsPerSec);
 
+    // A reference entry needs a packet sequence of its own
     if (currentPacketSequence_ == NULL ||
+            currentPacketSequence_->isRef() ||
+            currentPacketSequence_->isGenerated() ||
+            (isRef && currentPacketSequence_->packets_) ||
+            isSequenceBreak_ ||
             !currentPacketSequence_->hasFreeSpace(2*sizeof(pcap_pkthdr)+length))
     {
         if (currentPacketSequence_ != NULL)
         {
-            long usecs;
-
-            usecs = (pktHdr.ts.tv_sec
-                        - currentPacketSequence_->lastPacket_->ts.tv_sec)
-                            * long(1e6);
-            usecs += (pktHdr.ts.tv_usec
-                        - currentPacketSequence_->lastPacket_->ts.tv_usec);
-            currentPacketSequence_->usecDelay_ = usecs;
+            PacketSequence *seq = currentPacketSequence_;
+
+            // Delay is from the last replay of the last packet
+            seq->nsecDelay_ = nsecTsDiff(pktHdr.ts, seq->lastPacket_->ts)
+                    - seq->nsecLastPacketOffset();
         }
 
         //! \todo (LOW): calculate sendqueue size
-        currentPacketSequence_ = new PacketSequence;
+        currentPacketSequence_ = newPacketSequence();
+        isSequenceBreak_ = false;
 
-        packetSequenceList_.append(currentPacketSequence_);
+        // Each sequence of a stream has an order of its own
+        if (isShuffled_ && !isRef)
+            currentPacketSequence_->setShuffled(shuffleSeed_,
+                    packetList_->sequences.size());
+        packetList_->sequences.append(currentPacketSequence_);
 
         // Validate that the pkt will fit inside the new currentSendQueue_
         Q_ASSERT(currentPacketSequence_->hasFreeSpace(
                     sizeof(pcap_pkthdr) + length));
     }
 
-    if (currentPacketSequence_->appendPacket(&pktHdr, (u_char*) packet) < 0)
+    if (isRef)
+    {
+        if (currentPacketSequence_->appendPacketRef(&pktHdr, packet,
+                    repeats, gapNsec) < 0)
+            op = false;
+    }
+    else if (currentPacketSequence_->appendPacket(&pktHdr, (u_char*) packet) < 0)
     {
         op = false;
     }
 
-    packetCount_++;
+    if (op)
+        currentPacketSequence_->countStream(streamKey_, repeats,
+                                            repeats*length);
+
+    packetCount_ += repeats;
     if (repeatSize_ > 0 && packetCount_ == repeatSize_)
     {
         qDebug("repeatSequenceStart_=%d, repeatSize_ = %llu",
@@ -487,16 +1347,18 @@ bool PcapPort::PortTransmitter::appendToPacketList(long sec, long nsec,
 
         // Set the packetSequence repeatSize
         Q_ASSERT(repeatSequenceStart_ >= 0);
-        Q_ASSERT(repeatSequenceStart_ < packetSequenceList_.size());
+        Q_ASSERT(repeatSequenceStart_ < packetList_->sequences.size());
 
-        if (currentPacketSequence_ != packetSequenceList_[repeatSequenceStart_])
+        if (currentPacketSequence_
+                != packetList_->sequences[repeatSequenceStart_])
         {
-            PacketSequence *start = packetSequenceList_[repeatSequenceStart_];
+            PacketSequence *start =
+                    packetList_->sequences[repeatSequenceStart_];
 
-            currentPacketSequence_->usecDelay_ = start->usecDelay_;
-            start->usecDelay_ = 0;
+            currentPacketSequence_->nsecDelay_ = start->nsecDelay_;
+            start->nsecDelay_ = 0;
             start->repeatSize_ =
-                    packetSequenceList_.size() - repeatSequenceStart_;
+                    packetList_->sequences.size() - repeatSequenceStart_;
         }
 
         repeatSize_ = 0;
@@ -505,195 +1367,1257 @@ bool PcapPort::PortTransmitter::appendToPacketList(long sec, long nsec,
         currentPacketSequence_ = NULL;
     }
 
-    return op;
-}
-
-void PcapPort::PortTransmitter::setHandle(pcap_t *handle)
-{
-    if (usingInternalHandle_)
-        pcap_close(handle_);
-    handle_ = handle;
-    usingInternalHandle_ = false;
+    return op;
+}
+
+bool PcapPort::PortTransmitter::appendGeneratorToPacketList(long sec,
+        long nsec, FrameGenerator *generator)
+{
+    pcap_pkthdr pktHdr;
+
+    generator->reset();
+    if (!generator->hasNext()) {
+        delete generator;
+        return true;
+    }
+
+    pktHdr.caplen = pktHdr.len = 0;
+    pktHdr.ts.tv_sec = sec;
+    pktHdr.ts.tv_usec = nsec/(1000000000/kTsUnitsPerSec);
+
+    // Generated frames are never part of a repeating packet set
+    Q_ASSERT(repeatSize_ == 0);
+
+    if (currentPacketSequence_ != NULL)
+    {
+        PacketSequence *seq = currentPacketSequence_;
+
+        seq->nsecDelay_ = nsecTsDiff(pktHdr.ts, seq->lastPacket_->ts)
+                - seq->nsecLastPacketOffset();
+    }
+
+    currentPacketSequence_ = newPacketSequence();
+    isSequenceBreak_ = false;
+
+    // Like the packet sequences, the generated queues are allocated from
+    // the arena and freed with it
+    for (int i = 0; i < 2; i++) {
+        if (packetList_->generatedQueue[i])
+            continue;
+
+        pcap_send_queue *queue = (pcap_send_queue*)
+                packetList_->arena.alloc(sizeof(pcap_send_queue));
+        if (!queue || !(queue->buffer =
+                    packetList_->arena.alloc(kGeneratedQueueSize))) {
+            qWarning("%s: unable to allocate generated queue", __FUNCTION__);
+            delete currentPacketSequence_;
+            currentPacketSequence_ = NULL;
+            delete generator;
+            return false;
+        }
+        queue->maxlen = kGeneratedQueueSize;
+        queue->len = 0;
+        packetList_->generatedQueue[i] = queue;
+    }
+
+    packetList_->sequences.append(currentPacketSequence_);
+    currentPacketSequence_->countStream(streamKey_, 0, 0);
+
+    return currentPacketSequence_->appendGenerator(&pktHdr, generator) >= 0;
+}
+
+/*
+ * The frames appended from now on are those of streamId, a jump target -
+ * they start at the next sequence
+ */
+void PcapPort::PortTransmitter::markPacketListStream(uint streamId)
+{
+    streamStarts_.insert(streamId, packetList_->sequences.size());
+    isSequenceBreak_ = true;
+}
+
+/*
+ * Appends a jump to the frames of streamId (see markPacketListStream())
+ * or, if streamId is -1, to the end of the list - taken nsecDelay after
+ * the last frame appended so far
+ */
+void PcapPort::PortTransmitter::appendJumpToPacketList(qint64 streamId,
+        quint64 nsecDelay)
+{
+    PacketSequence *seq = newPacketSequence();
+
+    // A jump is never within a packet set
+    Q_ASSERT(repeatSize_ == 0);
+
+    seq->isJump_ = true;
+    seq->jumpStreamId_ = streamId;
+    seq->nsecDelay_ = nsecDelay;
+    packetList_->sequences.append(seq);
+
+    // The delay to the frames after the jump is the jump's, not the gap
+    // between the frames before and after it
+    currentPacketSequence_ = NULL;
+    isSequenceBreak_ = false;
+}
+
+/*
+ * Appends a jump to the next sequence in place of a packet set that has no
+ * frames of ours - so that we wait out the set's repeats (the delay is set
+ * by setSkippedSetDuration()) like the workers sending it, rather than run
+ * ahead of them. A set repeated till stopped is never left, so we just end
+ *
+ * The last sequence before the jump is kept current (but closed), so that
+ * its delay is still the gap to the next frame appended
+ */
+void PcapPort::PortTransmitter::skipNextPacketSet(qint64 repeats)
+{
+    PacketSequence *seq = newPacketSequence();
+
+    seq->isJump_ = true;
+    seq->jumpStreamId_ = (repeats < 0) ? -1 : kJumpToNext;
+    seq->nsecDelay_ = 0;
+    packetList_->sequences.append(seq);
+
+    skippedSetJump_ = seq;
+    if (currentPacketSequence_)
+        isSequenceBreak_ = true;
+}
+
+void PcapPort::PortTransmitter::setSkippedSetDuration(quint64 nsec)
+{
+    if (skippedSetJump_)
+        skippedSetJump_->nsecDelay_ = nsec;
+    skippedSetJump_ = NULL;
+}
+
+/*
+ * Returns a new packet sequence; the unused space of the last sequence's
+ * send queue is returned to the arena first, so that consecutive sequences
+ * are contiguous in memory
+ */
+PcapPort::PortTransmitter::PacketSequence*
+PcapPort::PortTransmitter::newPacketSequence()
+{
+    if (!packetList_->sequences.isEmpty()) {
+        pcap_send_queue *queue = packetList_->sequences.last()->sendQueue_;
+
+        packetList_->arena.trim(queue->buffer, queue->len);
+        queue->maxlen = queue->len;
+    }
+
+    return new PacketSequence(&packetList_->arena);
+}
+
+void PcapPort::PortTransmitter::setHandle(pcap_t *handle)
+{
+    if (usingInternalHandle_)
+        pcap_close(handle_);
+    handle_ = handle;
+    usingInternalHandle_ = false;
+#ifdef HAVE_SENDMMSG
+    useSendBatch_ = (pcap_fileno(handle_) >= 0) && isSendBatchAllowed();
+#endif
+}
+
+/*!
+  Opens our pcap handle, unless we already have one (ours or one given
+  via setHandle()) - this is done on the first transmit and not when the
+  port is created, as most ports of a host with many interfaces are never
+  transmitted on; returns false if the handle can't be opened
+*/
+bool PcapPort::PortTransmitter::open()
+{
+    char errbuf[PCAP_ERRBUF_SIZE] = "";
+
+    if (handle_)
+        return true;
+
+    handle_ = pcap_open_live(deviceName_.constData(), 64 /* FIXME */, 0,
+                             1000 /* ms */, errbuf);
+    if (handle_ == NULL) {
+        qDebug("%s: Error opening port %s: %s\n", __FUNCTION__,
+                deviceName_.constData(), errbuf);
+        return false;
+    }
+
+    usingInternalHandle_ = true;
+#ifdef HAVE_SENDMMSG
+    useSendBatch_ = (pcap_fileno(handle_) >= 0) && isSendBatchAllowed();
+#endif
+
+    return true;
+}
+
+void PcapPort::PortTransmitter::useExternalStats(AbstractPort::PortStats *stats)
+{
+    if (usingInternalStats_)
+        delete stats_;
+    stats_ = stats;
+    usingInternalStats_ = false;
+}
+
+void PcapPort::PortTransmitter::run()
+{
+    // NOTE1: We can't use pcap_sendqueue_transmit() directly even on Win32
+    // 'coz of 2 reasons - there's no way of stopping it before all packets
+    // in the sendQueue are sent out and secondly, stats are available only
+    // when all packets have been sent - no periodic updates
+    //
+    // NOTE2: Transmit on the Rx Handle so that we can receive it back
+    // on the Tx Handle to do stats
+    //
+    // NOTE3: Update pcapExtra counters - port TxStats will be updated in the
+    // 'stats callback' function so that both Rx and Tx stats are updated
+    // together
+
+    const int kSyncTransmit = 1;
+    ThreadPlacer::Scope placement(placer_);
+    PacketList *list;
+    int i;
+    // Unpaced (max rate) - there are no gaps to wait out, so the stop
+    // time is checked only once a sequence is sent
+    int sync = isMaxRate_ ? 0 : kSyncTransmit;
+    qint64 overHead = 0; // overHead should be negative or zero (except
+                         // when frames are sent as a batch)
+
+    // A list committed after we last stopped
+    switchPacketList();
+    list = txPacketList_;
+
+    qDebug("packetSequenceList.size = %d", list->sequences.size());
+    if (list->sequences.size() <= 0)
+        goto _exit;
+
+    for(i = 0; i < list->sequences.size(); i++) {
+        qDebug("sendQ[%d]: rptCnt = %d, rptSz = %d, nsecDelay = %lld", i,
+                list->sequences.at(i)->repeatCount_,
+                list->sequences.at(i)->repeatSize_,
+                (long long) list->sequences.at(i)->nsecDelay_);
+        qDebug("sendQ[%d]: pkts = %ld, nsecDuration = %llu", i,
+                list->sequences.at(i)->packets_,
+                (unsigned long long) list->sequences.at(i)->nsecDuration_);
+    }
+
+    // Wait for the other ports (if any) starting along with us
+    if (!barrier_.isNull()) {
+        state_.set(kArmed);
+        if (!barrier_->wait(&stop_)) {
+            barrier_ = StartBarrierPtr();
+            stop_ = false;
+            goto _exit;
+        }
+        barrier_ = StartBarrierPtr();
+    }
+
+    // The duration is from the (synchronized) start, not from when we
+    // were started
+    virtualNsec_ = 0;
+    getTime(&runStart_);
+    runStartPkts_ = stats_->txPkts;
+    runStartBytes_ = stats_->txBytes;
+    runNsec_ = -1;
+    isStoppedByTime_ = false;
+    stopNsec_ = duration_ ? qint64(duration_) : -1;
+    if (stopTime_) {
+        qint64 left = qMax(qint64(stopTime_ - StartBarrier::realtimeNsec()),
+                           qint64(0));
+        if ((stopNsec_ < 0) || (left < stopNsec_))
+            stopNsec_ = left;
+    }
+
+    state_.set(kRunning);
+    // With virtual time, frames don't go out on the wire
+    if (!isVirtualTime_ && handle_)
+        injectOpen_.fetchAndStoreOrdered(1);
+    i = 0;
+    while (i < list->sequences.size())
+    {
+
+_restart:
+        if (list->sequences.at(i)->isJump_)
+        {
+            PacketSequence *jump = list->sequences.at(i);
+            qint64 nsecs = sync ? pacedGap(jump->nsecDelay_) + overHead : 0;
+
+            // A loop of jumps alone doesn't send anything that sees stop_
+            if (stop_ || (jump->jumpToQIdx_ < 0))
+                goto _exit;
+            if (isPastStopTime(nsecs))
+                goto _exit;
+            if (nsecs > 0)
+            {
+                delay(nsecs);
+                overHead = 0;
+            }
+            else
+                overHead = nsecs;
+
+            i = jump->jumpToQIdx_;
+            continue;
+        }
+
+        int rptSz  = list->sequences.at(i)->repeatSize_;
+        int rptCnt = list->sequences.at(i)->repeatCount_;
+
+        // A negative repeat count means repeat till stopped - j is then
+        // never compared (and being unsigned, may wrap around)
+        for (quint64 j = 0; (rptCnt < 0) || (j < quint64(rptCnt)); j++)
+        {
+            for (int k = 0; k < rptSz; k++)
+            {
+                int ret;
+                PacketSequence *seq = list->sequences.at(i+k);
+                quint64 seqStartPkts = 0, seqStartBytes = 0;
+
+                if (!seq->streamCounts_.isEmpty()) {
+                    seqStartPkts = stats_->txPkts;
+                    seqStartBytes = stats_->txBytes;
+                }
+
+                OST_PROBE3(tx_set_start, deviceName_.constData(), i+k,
+                        seq->packets_);
+
+                // On Win32, WinPcapPort's sendQueueTransmit() uses the
+                // native (kernel paced) send queue transmit
+                if (seq->isRef())
+                    ret = sendPacketRef(seq, overHead, sync);
+                else if (seq->isShuffled())
+                    ret = sendShuffled(seq, overHead, sync);
+                else if (seq->isGenerated())
+                    ret = sendGenerated(seq, overHead, sync);
+                else
+                    ret = sendQueueTransmit(handle_, seq->sendQueue_,
+                            overHead, sync);
+
+                OST_PROBE3(tx_set_end, deviceName_.constData(), i+k, ret);
+
+                if (!seq->streamCounts_.isEmpty())
+                    countSequence(seq, (ret >= 0) && !seq->isGenerated(),
+                            stats_->txPkts - seqStartPkts,
+                            stats_->txBytes - seqStartBytes);
+
+                if (injectOpen_)
+                    sendInjected();
+
+                if ((ret >= 0) && !sync)
+                {
+                    countPacketSet(0);
+                    if (isPastStopTime(0))
+                        goto _exit;
+                }
+                else if (ret >= 0)
+                {
+                    qint64 nsecs = pacedGap(seq->nsecDelay_) + overHead;
+
+                    countPacketSet(overHead);
+                    if (isPastStopTime(nsecs))
+                        goto _exit;
+                    if (nsecs > 0)
+                    {
+                        delay(nsecs);
+                        overHead = 0;
+                    }
+                    else
+                        overHead = nsecs;
+                }
+                else
+                {
+                    qDebug("error %d in sendQueueTransmit()", ret);
+                    qDebug("overHead = %lld", (long long) overHead);
+                    stop_ = false;
+                    goto _exit;
+                }
+
+                // Switch to a list committed while transmitting at the end
+                // of a packet set (or of a generated sequence, which may
+                // be endless) - there's no gap in the frames sent as the
+                // list is already built; the new list is sent from its
+                // beginning
+                if (pendingPacketList_
+                        && ((k == rptSz - 1) || seq->isGenerated()))
+                {
+                    list = switchPacketList();
+                    qDebug("switched to new packet list (size = %d)",
+                            list->sequences.size());
+                    if (list->sequences.isEmpty())
+                        goto _exit;
+                    i = 0;
+                    goto _restart;
+                }
+            }
+        }
+
+        // Move to the next Packet Set
+        i += rptSz;
+    }
+
+    if (list->returnToQIdx >= 0)
+    {
+        qint64 nsecs = sync ? pacedGap(list->loopDelay) + overHead : 0;
+
+        if (isPastStopTime(nsecs))
+            goto _exit;
+        if (nsecs > 0)
+        {
+            delay(nsecs);
+            overHead = 0;
+        }
+        else
+            overHead = nsecs;
+
+        i = list->returnToQIdx;
+        goto _restart;
+    }
+
+_exit:
+    // Frames injected after this are sent by the caller itself; wait for
+    // the ones being queued (if any) and send them
+    if (injectOpen_.fetchAndStoreOrdered(0)) {
+        while (injectors_)
+            QThread::yieldCurrentThread();
+        sendInjected();
+    }
+
+    // Nothing to send - don't hold up the others
+    if (!barrier_.isNull()) {
+        barrier_->leave();
+        barrier_ = StartBarrierPtr();
+    }
+
+    if (runNsec_ < 0) {
+        TimeStamp now;
+
+        // Transmit is on till the stop time, even if the last frame (due
+        // before it) was sent much earlier
+        if (isStoppedByTime_)
+            waitForStopTime();
+        getTime(&now);
+        runNsec_ = ndiffTimeStamp(&runStart_, &now);
+        stopNsec_ = -1;
+        stop_ = false;
+    }
+    state_.set(kFinished);
+}
+
+void PcapPort::PortTransmitter::runStats(quint64 *pkts, quint64 *bytes,
+        quint64 *nsec)
+{
+    qint64 elapsed = runNsec_;
+    AbstractPort::PortStats stats;
+
+    if (elapsed < 0) {
+        TimeStamp now;
+
+        getTime(&now);
+        elapsed = ndiffTimeStamp(&runStart_, &now);
+    }
+
+    stats_->snapshot(&stats);
+    *pkts = stats.txPkts - runStartPkts_;
+    *bytes = stats.txBytes - runStartBytes_;
+    *nsec = elapsed;
+}
+
+/*!
+  Queues a frame to be sent by run() between its packet sets (or during
+  its waits) - so that frames sent while transmitting, such as those of
+  device emulation, share the transmit path with the traffic instead of
+  contending with it for the interface
+
+  Returns false if the frame was not queued - we are not transmitting
+*/
+bool PcapPort::PortTransmitter::inject(const uchar *data, int length)
+{
+    bool isQueued = false;
+
+    // run() closes the queue, then waits for the injectors in progress
+    injectors_.ref();
+    if (injectOpen_) {
+        injectQueue_.push(data, length);
+        isQueued = true;
+    }
+    injectors_.deref();
+
+    return isQueued;
+}
+
+// Sends the frames injected so far
+void PcapPort::PortTransmitter::sendInjected()
+{
+    QByteArray frame;
+
+    while (injectQueue_.pop(&frame)) {
+        if (pcap_sendpacket(handle_, (const uchar*) frame.constData(),
+                            frame.size()) < 0)
+            metrics_.add(OstProto::DroneMetric::kTxSendErrors);
+        else
+            metrics_.add(OstProto::DroneMetric::kTxInjected);
+    }
+}
+
+// Waits for nsec sending injected frames every kInjectPollNsec - the
+// wait ends on time irrespective of the time spent sending them
+void PcapPort::PortTransmitter::delayInjecting(quint64 nsec)
+{
+    TimeStamp start, now;
+    qint64 waited = 0; // for platforms without a TimeStamp clock
+    qint64 left;
+
+    getTimeStamp(&start);
+    forever {
+        sendInjected();
+        getTimeStamp(&now);
+        left = qint64(nsec) - qMax(ndiffTimeStamp(&start, &now), waited);
+        if (left <= qint64(kInjectPollNsec))
+            break;
+        (*ndelayFn_)(kInjectPollNsec);
+        waited += kInjectPollNsec;
+    }
+
+    if (left > 0)
+        (*ndelayFn_)(left);
+}
+
+bool PcapPort::PortTransmitter::isStopTimeReached(qint64 nsec)
+{
+    TimeStamp now;
+
+    getTime(&now);
+    if ((ndiffTimeStamp(&runStart_, &now) + qMax(nsec, qint64(0)))
+            < stopNsec_)
+        return false;
+
+    isStoppedByTime_ = true;
+    return true;
+}
+
+// Waits (abortably) till the stop time
+void PcapPort::PortTransmitter::waitForStopTime()
+{
+    const qint64 kMaxWaitSlice = 10000000; // 10ms
+
+    while (!stop_)
+    {
+        TimeStamp now;
+        qint64 left;
+
+        getTime(&now);
+        left = stopNsec_ - ndiffTimeStamp(&runStart_, &now);
+        if (left <= 0)
+            break;
+        delay(qMin(left, kMaxWaitSlice));
+    }
+}
+
+void PcapPort::PortTransmitter::start()
+{
+    // FIXME: return error
+    if ((state_ == kRunning) || (state_ == kArmed)) {
+        qWarning("Transmit start requested but is already running!");
+        return;
+    }
+
+    if (!open())
+        qWarning("%s: unable to open port for transmit",
+                deviceName_.constData());
+
+    isShared_ = false;
+    if (useShared_ && startShared())
+        return;
+
+    state_.set(kNotStarted);
+    QThread::start();
+
+    state_.waitWhile(kNotStarted);
+}
+
+void PcapPort::PortTransmitter::stop()
+{
+    if ((state_ == kRunning) || (state_ == kArmed)) {
+        stop_ = true;
+        if (isShared_) {
+            // Unless the scheduler has just finished it by itself
+            TxScheduler::instance()->remove(this);
+            if (state_ == kRunning)
+                finishShared();
+        }
+        state_.waitFor(kFinished);
+    }
+    else {
+        // FIXME: return error
+        qWarning("Transmit stop requested but is not running!");
+        return;
+    }
+}
+
+bool PcapPort::PortTransmitter::isRunning()
+{
+    return (state_ == kRunning) || (state_ == kArmed);
+}
+
+/*!
+  Starts sending the packet list by the TxScheduler instead of our own
+  thread, if the list can be sent so (see canShare()) - returns false if
+  not. This is meant for low rate ports: the scheduler paces frames only
+  to its tick, not to the ns; and frames injected meanwhile are sent by
+  their callers themselves
+*/
+bool PcapPort::PortTransmitter::startShared()
+{
+    TxScheduler *scheduler;
+
+    switchPacketList();
+    if (!canShare(txPacketList_))
+        return false;
+
+    scheduler = TxScheduler::instance();
+
+    getTime(&runStart_);
+    runStartPkts_ = sharedSeqStartPkts_ = stats_->txPkts;
+    runStartBytes_ = sharedSeqStartBytes_ = stats_->txBytes;
+    runNsec_ = -1;
+    isStoppedByTime_ = false;
+    stopNsec_ = -1;
+    stop_ = false;
+
+    sharedSetIdx_ = sharedIdx_ = sharedRepeat_ = 0;
+    sharedOffset_ = 0;
+    sharedReplays_ = 0;
+    sharedDue_ = scheduler->nowNsec();
+
+    qDebug("%s: shared transmit of %d sequences", deviceName_.constData(),
+            txPacketList_->sequences.size());
+
+    isShared_ = true;
+    state_.set(kRunning);
+    scheduler->add(this, sharedDue_);
+
+    return true;
+}
+
+/*!
+  Returns true if the TxScheduler can send list - frames that are paced
+  (not at max rate) and stored (not generated), with no stop time or start
+  barrier, on the wire (not virtual time)
+*/
+bool PcapPort::PortTransmitter::canShare(const PacketList *list) const
+{
+    if (isVirtualTime_ || isMaxRate_ || duration_ || stopTime_
+            || !barrier_.isNull() || !handle_ || list->sequences.isEmpty())
+        return false;
+
+    // Shuffled sequences are sent only by run()
+    foreach (const PacketSequence *seq, list->sequences) {
+        if (seq->generator_ || (seq->frameOffsets_.size() > 1))
+            return false;
+    }
+
+    return true;
+}
+
+/*!
+  Sends the frames of the packet list due before limitNsec (TxScheduler
+  time) - in the order and with the gaps that run() would, but returning
+  when the next frame (or the end of a gap) isn't due yet instead of
+  waiting for it; returns when that is due or TxScheduler::kDone once the
+  list is done or we are stopped. Jumps and list loops count as frames
+  towards kMaxSharedBurst, so that an endless loop of them returns too
+*/
+quint64 PcapPort::PortTransmitter::txScheduleDue(quint64 limitNsec)
+{
+    PacketList *list = txPacketList_;
+    int sent = 0;
+
+    forever {
+        PacketSequence *seq, *set;
+
+        if (stop_)
+            goto _done;
+        if ((sharedDue_ > limitNsec) || (sent >= kMaxSharedBurst))
+            return sharedDue_;
+
+        if (sharedIdx_ >= list->sequences.size()) {
+            if (list->returnToQIdx < 0)
+                goto _done;
+            sharedDue_ += pacedGap(list->loopDelay);
+            sharedSetIdx_ = sharedIdx_ = list->returnToQIdx;
+            sharedRepeat_ = 0;
+            sent++;
+            continue;
+        }
+
+        seq = list->sequences.at(sharedIdx_);
+        if (seq->isJump_) {
+            if (seq->jumpToQIdx_ < 0)
+                goto _done;
+            sharedDue_ += pacedGap(seq->nsecDelay_);
+            sharedSetIdx_ = sharedIdx_ = seq->jumpToQIdx_;
+            sharedRepeat_ = 0;
+            sent++;
+            continue;
+        }
+
+        // The next frame of the sequence, if any
+        if (sharedOffset_ < seq->sendQueue_->len) {
+            struct pcap_pkthdr *hdr = (struct pcap_pkthdr*)
+                    (seq->sendQueue_->buffer + sharedOffset_);
+
+            sendShared(hdr);
+            sent++;
+
+            if (seq->isRef()) {
+                if (++sharedReplays_ < seq->packetRepeats_) {
+                    sharedDue_ += pacedGap(seq->packetGapNsec_);
+                    continue;
+                }
+            }
+            else {
+                sharedOffset_ += sizeof(*hdr) + hdr->caplen;
+                if (sharedOffset_ < seq->sendQueue_->len) {
+                    struct pcap_pkthdr *next = (struct pcap_pkthdr*)
+                            (seq->sendQueue_->buffer + sharedOffset_);
+
+                    sharedDue_ += pacedGap(nsecTsDiff(next->ts, hdr->ts));
+                    continue;
+                }
+            }
+        }
+
+        // Sequence done - on to the next one of the packet set, the next
+        // repeat of the set or the next set
+        if (!seq->streamCounts_.isEmpty())
+            countSequence(seq, true, 0, 0);
+        metrics_.add(OstProto::DroneMetric::kTxLoopIterations);
+        sharedDue_ += pacedGap(seq->nsecDelay_);
+        sharedOffset_ = 0;
+        sharedReplays_ = 0;
+        sharedSeqStartPkts_ = stats_->txPkts;
+        sharedSeqStartBytes_ = stats_->txBytes;
+
+        set = list->sequences.at(sharedSetIdx_);
+        if (sharedIdx_ < (sharedSetIdx_ + set->repeatSize_ - 1)) {
+            sharedIdx_++;
+            continue;
+        }
+
+        // Switch to a list committed meanwhile - as run() does
+        if (pendingPacketList_) {
+            list = switchPacketList();
+            qDebug("switched to new packet list (size = %d)",
+                    list->sequences.size());
+            if (!canShare(list)) {
+                if (!list->sequences.isEmpty())
+                    qWarning("%s: new packet list can't be sent by the "
+                            "tx scheduler, transmit stopped",
+                            deviceName_.constData());
+                goto _done;
+            }
+            sharedSetIdx_ = sharedIdx_ = sharedRepeat_ = 0;
+            continue;
+        }
+
+        sharedRepeat_++;
+        if ((set->repeatCount_ < 0) || (sharedRepeat_ < set->repeatCount_)) {
+            sharedIdx_ = sharedSetIdx_;
+            continue;
+        }
+
+        sharedSetIdx_ = sharedIdx_ = sharedSetIdx_ + set->repeatSize_;
+        sharedRepeat_ = 0;
+    }
+
+_done:
+    finishShared();
+    return TxScheduler::kDone;
+}
+
+void PcapPort::PortTransmitter::sendShared(struct pcap_pkthdr *hdr)
+{
+    uchar *pkt = (uchar*)hdr + sizeof(*hdr);
+    int pktLen = hdr->caplen;
+
+    streamStats_.stampTx(pkt, pktLen);
+    if (pcap_sendpacket(handle_, pkt, pktLen) < 0)
+        metrics_.add(OstProto::DroneMetric::kTxSendErrors);
+    stats_->txLock.writeBegin();
+    stats_->txPkts++;
+    stats_->txBytes += pktLen;
+    stats_->txLock.writeEnd();
+}
+
+/*
+ * Ends a shared transmit run - in the scheduler thread once the list is
+ * done or stopped, else by stop() once the scheduler lets go of us
+ */
+void PcapPort::PortTransmitter::finishShared()
+{
+    TimeStamp now;
+
+    // A sequence cut short - see countSequence()
+    if ((sharedOffset_ || sharedReplays_)
+            && (sharedIdx_ < txPacketList_->sequences.size())) {
+        PacketSequence *seq = txPacketList_->sequences.at(sharedIdx_);
+
+        if (!seq->streamCounts_.isEmpty())
+            countSequence(seq, false, stats_->txPkts - sharedSeqStartPkts_,
+                    stats_->txBytes - sharedSeqStartBytes_);
+    }
+    sharedOffset_ = 0;
+    sharedReplays_ = 0;
+
+    getTime(&now);
+    runNsec_ = ndiffTimeStamp(&runStart_, &now);
+    stop_ = false;
+    state_.set(kFinished);
+}
+
+// Starts loading the header and the first bytes of the frame at hdr into
+// the cache, while the current frame is being sent
+static inline void prefetchPacket(const struct pcap_pkthdr *hdr)
+{
+#if defined(__GNUC__)
+    __builtin_prefetch(hdr);
+    __builtin_prefetch((const char*)hdr + sizeof(*hdr) + 32);
+#else
+    Q_UNUSED(hdr);
+#endif
+}
+
+int PcapPort::PortTransmitter::sendQueueTransmit(pcap_t *p,
+        pcap_send_queue *queue, qint64 &overHead, int sync)
+{
+    TimeStamp ovrStart, ovrEnd;
+    struct timeval ts;
+    struct pcap_pkthdr *hdr = (struct pcap_pkthdr*) queue->buffer;
+    char *end = queue->buffer + queue->len;
+
+#ifdef HAVE_SENDMMSG
+    if (useSendBatch_)
+        return sendQueueTransmitBatched(p, queue, overHead, sync);
+#endif
+
+    ts = hdr->ts;
+
+    getTime(&ovrStart);
+    while((char*) hdr < end)
+    {
+        uchar *pkt = (uchar*)hdr + sizeof(*hdr);
+        int pktLen = hdr->caplen;
+
+        if (sync)
+        {
+            qint64 nsec = pacedGap(nsecTsDiff(hdr->ts, ts));
+
+            getTime(&ovrEnd);
+
+            overHead -= ndiffTimeStamp(&ovrStart, &ovrEnd);
+            Q_ASSERT(overHead <= 0);
+            nsec += overHead;
+            if (isPastStopTime(nsec))
+                return -2;
+            if (nsec > 0)
+            {
+                delay(nsec);
+                overHead = 0;
+            }
+            else
+                overHead = nsec;
+
+            ts = hdr->ts;
+            getTime(&ovrStart);
+        }
+
+        Q_ASSERT(pktLen > 0);
+
+        streamStats_.stampTx(pkt, pktLen);
+        if (pcap_sendpacket(p, pkt, pktLen) < 0)
+            metrics_.add(OstProto::DroneMetric::kTxSendErrors);
+        stats_->txLock.writeBegin();
+        stats_->txPkts++;
+        stats_->txBytes += pktLen;
+        stats_->txLock.writeEnd();
+
+        // Step to the next packet in the buffer
+        hdr = (struct pcap_pkthdr*) (pkt + pktLen);
+        pkt = (uchar*) ((uchar*)hdr + sizeof(*hdr));
+        prefetchPacket(hdr);
+
+        if (stop_)
+        {
+            return -2;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Counts the frames of each stream of a packet sequence just sent - as
+ * counted when the sequence was built, if all of it was sent. Otherwise
+ * (cut short, or generated) pkts and bytes are what the port counted as
+ * sent meanwhile and are attributed to the streams in the order sent -
+ * a backend that counts a batch of frames only once the batch is handed
+ * over (see LinuxPort::PortTransmitter::flushTxRing()) may undercount
+ * the last batch of these
+ */
+void PcapPort::PortTransmitter::countSequence(const PacketSequence *seq,
+        bool isComplete, quint64 pkts, quint64 bytes)
+{
+    int last = seq->streamCounts_.size() - 1;
+
+    for (int i = 0; i <= last; i++) {
+        const PacketSequence::StreamCount &count = seq->streamCounts_.at(i);
+
+        if (isComplete) {
+            streamStats_.countTx(count.key, count.pkts, count.bytes);
+            continue;
+        }
+
+        quint64 p = (i == last) ? pkts : qMin(pkts, count.pkts);
+        quint64 b = (i == last) ? bytes : qMin(bytes, count.bytes);
+
+        if (!p)
+            break;
+        streamStats_.countTx(count.key, p, b);
+        pkts -= p;
+        bytes -= b;
+    }
+}
+
+/*
+ * Replays the (only) frame of a reference packet sequence
+ *
+ * Unpaced, the replays are sent as batches of copies of the frame - so
+ * that a transmitter that sends a queue with one syscall (TX_RING or
+ * sendmmsg) does so for each batch and not for each replay
+ */
+int PcapPort::PortTransmitter::sendPacketRef(PacketSequence *seq,
+        qint64 &overHead, int sync)
+{
+    // Unpaced, the stop time is checked once every these many frames
+    const quint64 kUnpacedStopCheck = 1024;
+    TimeStamp ovrStart, ovrEnd;
+
+    if (!sync)
+    {
+        const struct pcap_pkthdr *hdr =
+                (const struct pcap_pkthdr*) seq->sendQueue_->buffer;
+        int frameSize = sizeof(*hdr) + hdr->caplen;
+        quint64 batch = qMin(kUnpacedStopCheck,
+                            quint64(qMax(1, kRefBatchBytes/frameSize)));
+        pcap_send_queue queue;
+
+        batch = qMin(batch, seq->packetRepeats_);
+        refBatch_.resize(int(batch)*frameSize);
+        for (quint64 i = 0; i < batch; i++)
+            memcpy(refBatch_.data() + i*frameSize, hdr, frameSize);
+
+        for (quint64 i = 0; i < seq->packetRepeats_; i += batch)
+        {
+            quint64 count = qMin(batch, seq->packetRepeats_ - i);
+            int ret;
+
+            queue.buffer = refBatch_.data();
+            queue.len = queue.maxlen = u_int(count*frameSize);
+            ret = sendQueueTransmit(handle_, &queue, overHead, sync);
+            if (ret < 0)
+                return ret;
+            if (isPastStopTime(0))
+                return -2;
+        }
+
+        return 0;
+    }
+
+    for (quint64 i = 0; i < seq->packetRepeats_; i++)
+    {
+        int ret;
+
+        getTime(&ovrStart);
+        ret = sendQueueTransmit(handle_, seq->sendQueue_, overHead, sync);
+        if (ret < 0)
+            return ret;
+        getTime(&ovrEnd);
+
+        overHead -= ndiffTimeStamp(&ovrStart, &ovrEnd);
+
+        // No gap after the last replay - that's the sequence delay
+        if (i < (seq->packetRepeats_ - 1))
+        {
+            qint64 nsec = pacedGap(seq->packetGapNsec_) + overHead;
+            if (isPastStopTime(nsec))
+                return -2;
+            if (nsec > 0)
+            {
+                delay(nsec);
+                overHead = 0;
+            }
+            else
+                overHead = nsec;
+        }
+    }
+
+    return 0;
 }
 
-void PcapPort::PortTransmitter::useExternalStats(AbstractPort::PortStats *stats)
+/*
+ * Sends the frames of a shuffled packet sequence in a new order - each
+ * frame as a send queue of its own (a view of the frame where it is
+ * stored, like a ref sequence's frame), so the frames are neither copied
+ * nor rebuilt; the gaps are those between the frames as stored
+ */
+int PcapPort::PortTransmitter::sendShuffled(PacketSequence *seq,
+        qint64 &overHead, int sync)
 {
-    if (usingInternalStats_)
-        delete stats_;
-    stats_ = stats;
-    usingInternalStats_ = false;
-}
+    TimeStamp ovrStart, ovrEnd;
+    int count = seq->frameOffsets_.size();
 
-void PcapPort::PortTransmitter::run()
-{
-    //! \todo (MED) Stream Mode - continuous: define before implement
+    seq->shuffle();
+    for (int i = 0; i < count; i++)
+    {
+        struct pcap_pkthdr *hdr = (struct pcap_pkthdr*)
+                (seq->sendQueue_->buffer
+                    + seq->frameOffsets_.at(seq->order_.at(i)));
+        pcap_send_queue frame;
+        int ret;
 
-    // NOTE1: We can't use pcap_sendqueue_transmit() directly even on Win32
-    // 'coz of 2 reasons - there's no way of stopping it before all packets
-    // in the sendQueue are sent out and secondly, stats are available only
-    // when all packets have been sent - no periodic updates
-    //
-    // NOTE2: Transmit on the Rx Handle so that we can receive it back
-    // on the Tx Handle to do stats
-    //
-    // NOTE3: Update pcapExtra counters - port TxStats will be updated in the
-    // 'stats callback' function so that both Rx and Tx stats are updated
-    // together
+        frame.buffer = (char*) hdr;
+        frame.len = frame.maxlen = sizeof(*hdr) + hdr->caplen;
 
-    const int kSyncTransmit = 1;
-    int i;
-    long overHead = 0; // overHead should be negative or zero
+        getTime(&ovrStart);
+        ret = sendQueueTransmit(handle_, &frame, overHead, sync);
+        if (ret < 0)
+            return ret;
+        getTime(&ovrEnd);
 
-    qDebug("packetSequenceList_.size = %d", packetSequenceList_.size());
-    if (packetSequenceList_.size() <= 0)
-        goto _exit;
+        overHead -= ndiffTimeStamp(&ovrStart, &ovrEnd);
 
-    for(i = 0; i < packetSequenceList_.size(); i++) {
-        qDebug("sendQ[%d]: rptCnt = %d, rptSz = %d, usecDelay = %ld", i,
-                packetSequenceList_.at(i)->repeatCount_,
-                packetSequenceList_.at(i)->repeatSize_,
-                packetSequenceList_.at(i)->usecDelay_);
-        qDebug("sendQ[%d]: pkts = %ld, usecDuration = %ld", i,
-                packetSequenceList_.at(i)->packets_,
-                packetSequenceList_.at(i)->usecDuration_);
+        // No gap after the last frame - that's the sequence delay
+        if (sync && (i < (count - 1)))
+        {
+            const struct pcap_pkthdr *slot = (struct pcap_pkthdr*)
+                    (seq->sendQueue_->buffer + seq->frameOffsets_.at(i));
+            const struct pcap_pkthdr *nextSlot = (struct pcap_pkthdr*)
+                    (seq->sendQueue_->buffer + seq->frameOffsets_.at(i+1));
+            qint64 nsec = pacedGap(nsecTsDiff(nextSlot->ts, slot->ts))
+                            + overHead;
+
+            if (isPastStopTime(nsec))
+                return -2;
+            if (nsec > 0)
+            {
+                delay(nsec);
+                overHead = 0;
+            }
+            else
+                overHead = nsec;
+        }
     }
 
-    state_ = kRunning;
-    i = 0;
-    while (i < packetSequenceList_.size())
-    {
+    return 0;
+}
 
-_restart:
-        int rptSz  = packetSequenceList_.at(i)->repeatSize_;
-        int rptCnt = packetSequenceList_.at(i)->repeatCount_;
+/*
+ * Sends the frames of a generated packet sequence - frames are generated
+ * (on another thread) into one of the two generatedQueues while the
+ * frames already generated into the other one are being sent
+ */
+int PcapPort::PortTransmitter::sendGenerated(PacketSequence *seq,
+        qint64 &overHead, int sync)
+{
+    FrameGenerator *generator = seq->generator_;
+    pcap_send_queue **generatedQueue = txPacketList_->generatedQueue;
+    struct timeval lastTs = seq->lastPacket_->ts;
+    int current = 0;
+    bool hasNext;
 
-        for (int j = 0; j < rptCnt; j++)
+    generator->reset();
+    hasNext = generateFrames(generator, seq->lastPacket_->ts,
+                generatedQueue[current], &generatedLastTs_[current]);
+
+    while (true)
+    {
+        QFuture<bool> future;
+        TimeStamp ovrStart, ovrEnd;
+        pcap_send_queue *queue = generatedQueue[current];
+        int ret = 0;
+
+        // Gap from the last frame sent till the first one of this lot -
+        // a split generator's first frame may not be at the sequence start
+        if (sync && queue->len)
         {
-            for (int k = 0; k < rptSz; k++)
+            pcap_pkthdr *first = (pcap_pkthdr*) queue->buffer;
+            qint64 nsec = pacedGap(nsecTsDiff(first->ts, lastTs)) + overHead;
+            if (isPastStopTime(nsec))
+                return -2;
+            if (nsec > 0)
             {
-                int ret;
-                PacketSequence *seq = packetSequenceList_.at(i+k);
-#ifdef Q_OS_WIN32
-                TimeStamp ovrStart, ovrEnd;
+                delay(nsec);
+                overHead = 0;
+            }
+            else
+                overHead = nsec;
+        }
 
-                if (seq->usecDuration_ <= long(1e6)) // 1s
-                {
-                    getTimeStamp(&ovrStart);
-                    ret = pcap_sendqueue_transmit(handle_,
-                            seq->sendQueue_, kSyncTransmit);
-                    if (ret >= 0)
-                    {
-                        stats_->txPkts += seq->packets_;
-                        stats_->txBytes += seq->bytes_;
+        if (hasNext)
+            future = QtConcurrent::run(generateFrames, generator,
+                        seq->lastPacket_->ts, generatedQueue[1 - current],
+                        &generatedLastTs_[1 - current]);
 
-                        getTimeStamp(&ovrEnd);
-                        overHead += seq->usecDuration_
-                            - udiffTimeStamp(&ovrStart, &ovrEnd);
-                        Q_ASSERT(overHead <= 0);
-                    }
-                    if (stop_)
-                        ret = -2;
-                }
-                else
-                {
-                    ret = sendQueueTransmit(handle_, seq->sendQueue_,
-                            overHead, kSyncTransmit);
-                }
-#else
-                ret = sendQueueTransmit(handle_, seq->sendQueue_,
-                            overHead, kSyncTransmit);
-#endif
+        if (queue->len)
+        {
+            ret = sendQueueTransmit(handle_, queue, overHead, sync);
+            lastTs = generatedLastTs_[current];
+        }
+        if ((ret >= 0) && (stop_ || (!sync && isPastStopTime(0))))
+            ret = -2;
+        if (ret < 0) {
+            future.waitForFinished();
+            return ret;
+        }
 
-                if (ret >= 0)
-                {
-                    long usecs = seq->usecDelay_ + overHead;
-                    if (usecs > 0)
-                    {
-                        (*udelayFn_)(usecs);
-                        overHead = 0;
-                    }
-                    else
-                        overHead = usecs;
-                }
-                else
-                {
-                    qDebug("error %d in sendQueueTransmit()", ret);
-                    qDebug("overHead = %ld", overHead);
-                    stop_ = false;
-                    goto _exit;
-                }
-            }
+        // Cut short for a new packet list - see run()
+        if (pendingPacketList_) {
+            future.waitForFinished();
+            return 0;
         }
 
-        // Move to the next Packet Set
-        i += rptSz;
+        if (!hasNext)
+            break;
+
+        getTime(&ovrStart);
+        hasNext = future.result();
+        getTime(&ovrEnd);
+
+        overHead -= ndiffTimeStamp(&ovrStart, &ovrEnd);
+
+        current = 1 - current;
     }
 
-    if (returnToQIdx_ >= 0)
+    // A split generator's last frame may be before the sequence end
+    if (sync)
     {
-        long usecs = loopDelay_ + overHead;
-
-        if (usecs > 0)
+        qint64 nsec = pacedGap(qint64(seq->nsecDuration_)
+                - nsecTsDiff(lastTs, seq->lastPacket_->ts)) + overHead;
+        if (isPastStopTime(nsec))
+            return -2;
+        if (nsec > 0)
         {
-            (*udelayFn_)(usecs);
+            delay(nsec);
             overHead = 0;
         }
         else
-            overHead = usecs;
-
-        i = returnToQIdx_;
-        goto _restart;
+            overHead = nsec;
     }
 
-_exit:
-    state_ = kFinished;
+    return 0;
 }
 
-void PcapPort::PortTransmitter::start()
+/*
+ * Generates the next frames of the generator into the (cleared) queue
+ * till the queue is full; ts is the timestamp of the generator's start and
+ * lastTs is set to the timestamp of the last frame queued
+ *
+ * Returns true if the generator has more frames
+ *
+ * NOTE: Runs on a worker thread - must not touch any transmitter state
+ */
+bool PcapPort::PortTransmitter::generateFrames(FrameGenerator *generator,
+        struct timeval ts, pcap_send_queue *queue, struct timeval *lastTs)
 {
-    // FIXME: return error
-    if (state_ == kRunning) {
-        qWarning("Transmit start requested but is already running!");
-        return;
-    }
+    const int kMaxPktSize = 16384;
+    const quint64 kNsecPerTsUnit = 1000000000/kTsUnitsPerSec;
+    uchar pkt[kMaxPktSize];
+    quint64 first = quint64(ts.tv_sec)*quint64(1e9)
+                        + quint64(ts.tv_usec)*kNsecPerTsUnit;
+
+    queue->len = 0;
+    while (generator->hasNext()
+            && ((queue->len + sizeof(pcap_pkthdr) + kMaxPktSize)
+                    <= queue->maxlen))
+    {
+        quint64 offset;
+        int len = generator->nextFrame(pkt, sizeof(pkt), offset);
 
-    state_ = kNotStarted;
-    QThread::start();
+        if (len > 0)
+        {
+            pcap_pkthdr pktHdr;
+            quint64 nsec = first + offset;
+
+            pktHdr.caplen = pktHdr.len = len;
+            pktHdr.ts.tv_sec = nsec/quint64(1e9);
+            pktHdr.ts.tv_usec = (nsec%quint64(1e9))/kNsecPerTsUnit;
+            pcap_sendqueue_queue(queue, &pktHdr, pkt);
+            *lastTs = pktHdr.ts;
+        }
+    }
 
-    while (state_ == kNotStarted)
-        QThread::msleep(10);
+    return generator->hasNext();
 }
 
-void PcapPort::PortTransmitter::stop()
+#ifdef HAVE_SENDMMSG
+// Returns 0 if all frames were sent, -1 otherwise
+static int sendPacketBatch(int fd, struct mmsghdr *msgs, int count,
+                           const char *device, DroneMetrics::Counters *metrics)
 {
-    if (state_ == kRunning) {
-        stop_ = true;
-        while (state_ == kRunning)
-            QThread::msleep(10);
-    }
-    else {
-        // FIXME: return error
-        qWarning("Transmit stop requested but is not running!");
-        return;
+    int sent = 0;
+
+    OST_PROBE2(tx_batch, device, count);
+
+    while (sent < count)
+    {
+        int ret = sendmmsg(fd, msgs + sent, count - sent, 0);
+
+        if (ret < 0)
+        {
+            // ENOBUFS => qdisc/driver queue full; retry till there's space
+            if ((errno == EINTR) || (errno == EAGAIN) || (errno == ENOBUFS)) {
+                if (errno != EINTR)
+                    metrics->add(OstProto::DroneMetric::kTxSendRetries);
+                continue;
+            }
+            qWarning("sendmmsg failed (%s)", strerror(errno));
+            metrics->add(OstProto::DroneMetric::kTxSendErrors, count - sent);
+            return -1;
+        }
+        sent += ret;
     }
+
+    return 0;
 }
 
-bool PcapPort::PortTransmitter::isRunning()
+// sendmmsg() is used unless the TxEngine setting asks for plain pcap
+bool PcapPort::PortTransmitter::isSendBatchAllowed()
 {
-    return (state_ == kRunning);
+    return appSettings->value(kTxEngineKey, kTxEngineDefaultValue)
+                .toString().compare("Pcap", Qt::CaseInsensitive) != 0;
 }
 
-int PcapPort::PortTransmitter::sendQueueTransmit(pcap_t *p,
-        pcap_send_queue *queue, long &overHead, int sync)
+/*
+ * Same as sendQueueTransmit() except that consecutive frames whose gap is
+ * too small to be honored individually are sent as a batch with a single
+ * sendmmsg() call on the socket underlying the pcap handle. Any time we
+ * gain by sending a frame early is carried forward in overHead, so the
+ * timing is still honored across batches
+ */
+int PcapPort::PortTransmitter::sendQueueTransmitBatched(pcap_t *p,
+        pcap_send_queue *queue, qint64 &overHead, int sync)
 {
     TimeStamp ovrStart, ovrEnd;
     struct timeval ts;
     struct pcap_pkthdr *hdr = (struct pcap_pkthdr*) queue->buffer;
     char *end = queue->buffer + queue->len;
+    struct mmsghdr msgs[kMaxSendBatch];
+    struct iovec iovs[kMaxSendBatch];
+    int count = 0;
+    quint64 bytes = 0;
+    int fd = pcap_fileno(p);
+
+    memset(msgs, 0, sizeof(msgs));
 
     ts = hdr->ts;
 
-    getTimeStamp(&ovrStart);
+    getTime(&ovrStart);
     while((char*) hdr < end)
     {
         uchar *pkt = (uchar*)hdr + sizeof(*hdr);
@@ -701,96 +2625,201 @@ int PcapPort::PortTransmitter::sendQueueTransmit(pcap_t *p,
 
         if (sync)
         {
-            long usec = (hdr->ts.tv_sec - ts.tv_sec) * 1000000 +
-                (hdr->ts.tv_usec - ts.tv_usec);
+            qint64 nsec = pacedGap(nsecTsDiff(hdr->ts, ts));
 
-            getTimeStamp(&ovrEnd);
+            getTime(&ovrEnd);
 
-            overHead -= udiffTimeStamp(&ovrStart, &ovrEnd);
-            Q_ASSERT(overHead <= 0);
-            usec += overHead;
-            if (usec > 0)
+            // If we are going to wait, send out the current batch first
+            if ((count > 0) && ((nsec + overHead
+                        - ndiffTimeStamp(&ovrStart, &ovrEnd)) > kMaxBatchGap))
+            {
+                if (sendPacketBatch(fd, msgs, count, deviceName_.constData(),
+                        &metrics_) < 0)
+                    return -1;
+                stats_->txLock.writeBegin();
+                stats_->txPkts += count;
+                stats_->txBytes += bytes;
+                stats_->txLock.writeEnd();
+                count = 0;
+                bytes = 0;
+                getTime(&ovrEnd);
+            }
+
+            overHead -= ndiffTimeStamp(&ovrStart, &ovrEnd);
+            nsec += overHead;
+            if (isPastStopTime(nsec))
             {
-                (*udelayFn_)(usec);
+                if ((count > 0)
+                        && (sendPacketBatch(fd, msgs, count,
+                                deviceName_.constData(), &metrics_) < 0))
+                    return -1;
+                stats_->txLock.writeBegin();
+                stats_->txPkts += count;
+                stats_->txBytes += bytes;
+                stats_->txLock.writeEnd();
+                return -2;
+            }
+            if (nsec > kMaxBatchGap)
+            {
+                delay(nsec);
                 overHead = 0;
             }
             else
-                overHead = usec;
+                overHead = nsec; // may be +ve i.e. ahead of schedule
 
             ts = hdr->ts;
-            getTimeStamp(&ovrStart);
+            getTime(&ovrStart);
         }
 
         Q_ASSERT(pktLen > 0);
 
-        pcap_sendpacket(p, pkt, pktLen);
-        stats_->txPkts++;
-        stats_->txBytes += pktLen;
+        streamStats_.stampTx(pkt, pktLen);
+        iovs[count].iov_base = pkt;
+        iovs[count].iov_len = pktLen;
+        msgs[count].msg_hdr.msg_iov = &iovs[count];
+        msgs[count].msg_hdr.msg_iovlen = 1;
+        count++;
+        bytes += pktLen;
+
+        if (count == kMaxSendBatch)
+        {
+            if (sendPacketBatch(fd, msgs, count, deviceName_.constData(),
+                        &metrics_) < 0)
+                return -1;
+            stats_->txLock.writeBegin();
+            stats_->txPkts += count;
+            stats_->txBytes += bytes;
+            stats_->txLock.writeEnd();
+            count = 0;
+            bytes = 0;
+        }
 
         // Step to the next packet in the buffer
         hdr = (struct pcap_pkthdr*) (pkt + pktLen);
         pkt = (uchar*) ((uchar*)hdr + sizeof(*hdr));
+        prefetchPacket(hdr);
 
         if (stop_)
-        {
-            return -2;
-        }
+            break;
     }
 
-    return 0;
+    if (count > 0)
+    {
+        if (sendPacketBatch(fd, msgs, count, deviceName_.constData(),
+                        &metrics_) < 0)
+            return -1;
+        stats_->txLock.writeBegin();
+        stats_->txPkts += count;
+        stats_->txBytes += bytes;
+        stats_->txLock.writeEnd();
+    }
+
+    return stop_ ? -2 : 0;
 }
+#endif
 
-void PcapPort::PortTransmitter::udelay(unsigned long usec)
+// Busy wait for nsec
+void PcapPort::PortTransmitter::ndelay(quint64 nsec)
 {
 #if defined(Q_OS_WIN32)
     LARGE_INTEGER tgtTicks;
     LARGE_INTEGER curTicks;
 
     QueryPerformanceCounter(&curTicks);
-    tgtTicks.QuadPart = curTicks.QuadPart + (usec*gTicksFreq)/1000000;
+    tgtTicks.QuadPart = curTicks.QuadPart
+                            + qint64(double(nsec)*gTicksFreq/1e9);
 
     while (curTicks.QuadPart < tgtTicks.QuadPart)
         QueryPerformanceCounter(&curTicks);
 #elif defined(Q_OS_LINUX)
-    struct timeval delay, target, now;
+    struct timespec target, now;
+
+    //qDebug("nsec delay = %llu", nsec);
+
+    clock_gettime(CLOCK_MONOTONIC, &target);
+    target.tv_sec += nsec/1000000000;
+    target.tv_nsec += nsec%1000000000;
+    if (target.tv_nsec >= 1000000000)
+    {
+        target.tv_sec++;
+        target.tv_nsec -= 1000000000;
+    }
 
-    //qDebug("usec delay = %ld", usec);
+    do {
+        clock_gettime(CLOCK_MONOTONIC, &now);
+    } while ((now.tv_sec < target.tv_sec)
+            || ((now.tv_sec == target.tv_sec)
+                && (now.tv_nsec < target.tv_nsec)));
+#else
+    QThread::usleep(nsec/1000);
+#endif
+}
 
-    delay.tv_sec = 0;
-    delay.tv_usec = usec;
+// Sleep for most of nsec and busy wait for the rest - the sleep wakeup
+// latency is not accurate enough to sleep for all of it
+void PcapPort::PortTransmitter::ndelayHybrid(quint64 nsec)
+{
+#if defined(Q_OS_LINUX)
+    // Should cover timer slack (50us default) + sleep wakeup latency
+    const quint64 kSpinNsec = 100000;
+    struct timespec target, now;
+
+    if (nsec <= kSpinNsec)
+    {
+        ndelay(nsec);
+        return;
+    }
 
-    while (delay.tv_usec >= 1000000)
+    clock_gettime(CLOCK_MONOTONIC, &target);
+    target.tv_sec += nsec/1000000000;
+    target.tv_nsec += nsec%1000000000;
+    if (target.tv_nsec >= 1000000000)
     {
-        delay.tv_sec++;
-        delay.tv_usec -= 1000000;
+        target.tv_sec++;
+        target.tv_nsec -= 1000000000;
     }
 
-    gettimeofday(&now, NULL);
-    timeradd(&now, &delay, &target);
+    // Wakeup kSpinNsec before target ...
+    struct timespec wakeup = target;
+    if (wakeup.tv_nsec >= long(kSpinNsec))
+        wakeup.tv_nsec -= kSpinNsec;
+    else
+    {
+        wakeup.tv_sec--;
+        wakeup.tv_nsec += 1000000000 - kSpinNsec;
+    }
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &wakeup, NULL)
+            == EINTR)
+        ;
 
+    // ... and busy wait for the rest
     do {
-        gettimeofday(&now, NULL);
-    } while (timercmp(&now, &target, <));
+        clock_gettime(CLOCK_MONOTONIC, &now);
+    } while ((now.tv_sec < target.tv_sec)
+            || ((now.tv_sec == target.tv_sec)
+                && (now.tv_nsec < target.tv_nsec)));
 #else
-    QThread::usleep(usec);
+    //! \todo sleep + busy wait for other platforms
+    ndelay(nsec);
 #endif
 }
 
+void PcapPort::PortTransmitter::nsleep(quint64 nsec)
+{
+    QThread::usleep(nsec/1000);
+}
+
 /*
  * ------------------------------------------------------------------- *
  * Port Capturer
  * ------------------------------------------------------------------- *
  */
 PcapPort::PortCapturer::PortCapturer(const char *device)
+    : metrics_("capture", device), placer_("capture")
 {
     device_ = QString::fromAscii(device);
     stop_ = false;
-    state_ = kNotStarted;
-
-    if (!capFile_.open())
-        qWarning("Unable to open temp cap file");
-
-    qDebug("cap file = %s", capFile_.fileName().toAscii().constData());
+    state_.set(kNotStarted);
 
     dumpHandle_ = NULL;
     handle_ = NULL;
@@ -803,11 +2832,14 @@ PcapPort::PortCapturer::~PortCapturer()
 
 void PcapPort::PortCapturer::run()
 {
+    ThreadPlacer::Scope placement(placer_);
     int flag = PCAP_OPENFLAG_PROMISCUOUS;
     char errbuf[PCAP_ERRBUF_SIZE] = "";
     struct bpf_program fp;
     bpf_u_int32 net, mask;
     int looping = 0;
+    bool isNsec = false;
+    int batch = int(rxConfig_.dispatch_batch());
 
     qDebug("In %s", __PRETTY_FUNCTION__);
 
@@ -822,9 +2854,32 @@ void PcapPort::PortCapturer::run()
         net = 0;
         mask = 0;
     }
+
+#if !defined(Q_OS_WIN32) && defined(PCAP_TSTAMP_PRECISION_NANO)
+    if (config_.nsec_timestamps()) {
+        handle_ = openTimestamped(device_.toAscii().constData(),
+                                  qMax(1U, config_.snap_len()), rxConfig_);
+        if (handle_) {
+            isNsec = (pcap_get_tstamp_precision(handle_)
+                        == PCAP_TSTAMP_PRECISION_NANO);
+            goto _set_filter;
+        }
+        qWarning("%s: nanosec capture timestamps not available",
+                device_.toAscii().constData());
+    }
+#endif
+
 _retry:
-    handle_ = pcap_open_live(device_.toAscii().constData(), 65535,
-                    flag, 1000 /* ms */, errbuf);
+#ifdef Q_OS_WIN32
+    handle_ = pcap_open_live(device_.toAscii().constData(),
+                    qMax(1U, config_.snap_len()), flag, 1000 /* ms */, errbuf);
+    if (handle_)
+        setRxBuffering(handle_, rxConfig_);
+#else
+    handle_ = openLive(device_.toAscii().constData(),
+                    qMax(1U, config_.snap_len()), flag, 1000 /* ms */,
+                    rxConfig_, errbuf);
+#endif
 
     if (handle_ == NULL)
     {
@@ -843,6 +2898,7 @@ _retry:
         }
     }
 
+_set_filter:
     if (-1 == pcap_compile(handle_, &fp, filter_.toAscii().constData(), 0, mask))
     {
             qDebug("%s:can't compile BPF program: %s (%s)",
@@ -860,22 +2916,46 @@ _retry:
             goto _exit;
     }
     pcap_freecode(&fp);
-    pcap_setnonblock(handle_, 1, errbuf);
 
-    dumpHandle_ = pcap_dump_open(handle_,
-            capFile_.fileName().toAscii().constData());
-    state_ = kRunning;
+    if (CaptureRing::isRing(config_)) {
+        if (!ring_.open(config_, qMax(1U, config_.snap_len()),
+                        capFile_.fileName(), isNsec)) {
+            pcap_close(handle_);
+            handle_ = NULL;
+            goto _exit;
+        }
+    }
+    else {
+        dumpHandle_ = pcap_dump_open(handle_,
+                capFile_.fileName().toAscii().constData());
+        if (CaptureDigest::isDigest(config_)
+                && !digest_.open(config_, capFile_.fileName(), dumpHandle_)) {
+            pcap_dump_close(dumpHandle_);
+            pcap_close(handle_);
+            dumpHandle_ = NULL;
+            handle_ = NULL;
+            goto _exit;
+        }
+    }
+    analytics_.reset(isNsec);
+    state_.set(kRunning);
     looping = 1;
     while (looping)
     {
         int ret;
+        struct pcap_stat ps;
 
-        ret = pcap_loop(handle_, 1000, pcap_dump, (uchar *)dumpHandle_);
+        // Blocks till there are frames or the read timeout (1000 ms) with
+        // none - ret 0 then; the drops are updated either way
+        ret = pcap_dispatch(handle_, batch, pcapHandler, (uchar *)this);
+        digest_.flush();
+
+        if (pcap_stats(handle_, &ps) == 0) {
+            metrics_.set(OstProto::DroneMetric::kRxDrops, ps.ps_drop);
+            metrics_.set(OstProto::DroneMetric::kRxIfDrops, ps.ps_ifdrop);
+        }
         switch (ret)
         {
-            case 0:
-                // 1000 continuous packets processed, can do next 1000
-                break;
             case -1:
                 qWarning("%s: error reading packet (%d): %s",
                         __PRETTY_FUNCTION__, ret, pcap_geterr(handle_));
@@ -886,21 +2966,52 @@ _retry:
                 looping = 0;
                 break;
             default:
-                qFatal("%s: Unexpected return value %d", __PRETTY_FUNCTION__, ret);
-                looping = 0;
+                // upto a batch of packets processed, can do the next
+                if (ret < 0) {
+                    qFatal("%s: Unexpected return value %d",
+                            __PRETTY_FUNCTION__, ret);
+                    looping = 0;
+                }
         }
+
+        // Triggered capture has its window
+        if (ring_.isDone())
+            looping = 0;
     }
-    pcap_dump_close(dumpHandle_);
+    digest_.close();
+    if (dumpHandle_)
+        pcap_dump_close(dumpHandle_);
     pcap_close(handle_);
     dumpHandle_ = NULL;
     handle_ = NULL;
     stop_ = false;
 
 _exit:
-    state_ = kFinished;
+    state_.set(kFinished);
+}
+
+// Counts the frame in analytics_ and keeps it as per the capture config
+void PcapPort::PortCapturer::pcapHandler(uchar *capturer,
+        const struct pcap_pkthdr *hdr, const uchar *data)
+{
+    PortCapturer *self = (PortCapturer*) capturer;
+
+    if (self->sigFilter_.isOpen()
+            && !self->sigFilter_.match(data, hdr->len, hdr->caplen))
+        return;
+
+    self->analytics_.add(hdr, data);
+
+    if (self->ring_.isOpen())
+        self->ring_.append(hdr, data);
+    else if (self->digest_.isOpen())
+        CaptureDigest::pcapHandler((uchar*) &self->digest_, hdr, data);
+    else
+        pcap_dump((uchar*) self->dumpHandle_, hdr, data);
 }
 
-void PcapPort::PortCapturer::start(const char *filter)
+void PcapPort::PortCapturer::start(const char *filter,
+                                   const OstProto::CaptureConfig &config)
 {
     // FIXME: return error
     if (state_ == kRunning) {
@@ -908,23 +3019,32 @@ void PcapPort::PortCapturer::start(const char *filter)
         return;
     }
     filter_ = QString::fromAscii(filter);
+    config_ = config;
+    ring_.close();
+    digest_.reset();
+    sigFilter_.open(config);
+
+    // Created on the first capture, not for every port at startup
+    if (!capFile_.isOpen()) {
+        if (capFile_.open())
+            qDebug("cap file = %s", capFile_.fileName().toAscii().constData());
+        else
+            qWarning("Unable to open temp cap file");
+    }
 
-    state_ = kNotStarted;
+    state_.set(kNotStarted);
     QThread::start();
 
-    while (state_ == kNotStarted)
-        QThread::msleep(10);
+    state_.waitWhile(kNotStarted);
 }
 
 void PcapPort::PortCapturer::stop()
 {
     if (state_ == kRunning) {
         stop_ = true;
-        pcap_breakloop(handle_);
-        while (state_ == kRunning) {
-            qDebug("capture stoping...\n");
-            QThread::msleep(500);
-        }
+        if (handle_)
+            pcap_breakloop(handle_);
+        state_.waitFor(kFinished);
     }
     else {
         // FIXME: return error
@@ -938,6 +3058,18 @@ bool PcapPort::PortCapturer::isRunning()
     return (state_ == kRunning);
 }
 
+bool PcapPort::PortCapturer::isRing()
+{
+    return ring_.isOpen();
+}
+
+// Replaces the capture file contents with the ring's current frames
+void PcapPort::PortCapturer::snapshotRing()
+{
+    if (ring_.isOpen() && !ring_.snapshot(&capFile_))
+        qWarning("unable to get capture ring snapshot");
+}
+
 QFile* PcapPort::PortCapturer::captureFile()
 {
     return &capFile_;
@@ -951,11 +3083,12 @@ QFile* PcapPort::PortCapturer::captureFile()
  */
 PcapPort::EmulationTransceiver::EmulationTransceiver(const char *device,
         DeviceManager *deviceManager)
+    : placer_("emulation")
 {
     device_ = QString::fromAscii(device);
     deviceManager_ = deviceManager;
     stop_ = false;
-    state_ = kNotStarted;
+    state_.set(kNotStarted);
     handle_ = NULL;
 }
 
@@ -964,13 +3097,10 @@ PcapPort::EmulationTransceiver::~EmulationTransceiver()
     stop();
 }
 
-void PcapPort::EmulationTransceiver::run()
+const char* PcapPort::EmulationTransceiver::captureFilter()
 {
-    int flags = PCAP_OPENFLAG_PROMISCUOUS;
-    char errbuf[PCAP_ERRBUF_SIZE] = "";
-    struct bpf_program bpf;
 #if 0
-    const char *capture_filter =
+    return
         "arp or icmp or icmp6 or "
         "(vlan and (arp or icmp or icmp6)) or "
         "(vlan and vlan and (arp or icmp or icmp6)) or "
@@ -995,15 +3125,39 @@ void PcapPort::EmulationTransceiver::run()
     libpcap changes their implementation, this will need to change as well.
 */
 #else
-    const char *capture_filter =
+    // With the TCP responder on, also TCP SYNs (no ACK) - for IPv6 only
+    // if TCP is the next header (the ip6[] offsets are of the TCP flags)
+#define TCP_SYN "((tcp[tcpflags] & (tcp-syn|tcp-ack)) == tcp-syn) or " \
+                "(ip6 and ip6[6] == 6 and (ip6[53] & 0x12) == 0x02)"
+    static const bool isTcpResponderEnabled = appSettings->value(
+            kTcpResponderKey, kTcpResponderDefaultValue).toBool();
+
+    if (isTcpResponderEnabled)
+        return
+            "arp or icmp or icmp6 or " TCP_SYN " or "
+            "(vlan and (arp or icmp or icmp6 or " TCP_SYN ")) or "
+            "(vlan and (arp or icmp or icmp6 or " TCP_SYN ")) or "
+            "(vlan and (arp or icmp or icmp6 or " TCP_SYN ")) or "
+            "(vlan and (arp or icmp or icmp6 or " TCP_SYN "))";
+#undef TCP_SYN
+
+    return
         "arp or icmp or icmp6 or "
         "(vlan and (arp or icmp or icmp6)) or "
         "(vlan and (arp or icmp or icmp6)) or "
         "(vlan and (arp or icmp or icmp6)) or "
         "(vlan and (arp or icmp or icmp6))";
 #endif
+}
 
+void PcapPort::EmulationTransceiver::run()
+{
+    ThreadPlacer::Scope placement(placer_);
+    int flags = PCAP_OPENFLAG_PROMISCUOUS;
+    char errbuf[PCAP_ERRBUF_SIZE] = "";
+    struct bpf_program bpf;
     const int optimize = 1;
+    int batch = int(rxConfig_.dispatch_batch());
 
     qDebug("In %s", __PRETTY_FUNCTION__);
 
@@ -1016,9 +3170,11 @@ _retry:
     // NOCAPTURE_LOCAL needs windows only pcap_open()
     handle_ = pcap_open(qPrintable(device_), 65535,
                 flags, 100 /* ms */, NULL, errbuf);
+    if (handle_)
+        setRxBuffering(handle_, rxConfig_);
 #else
-    handle_ = pcap_open_live(qPrintable(device_), 65535,
-                    flags, 100 /* ms */, errbuf);
+    handle_ = openLive(qPrintable(device_), 65535,
+                    flags, 100 /* ms */, rxConfig_, errbuf);
 #endif
 
     if (handle_ == NULL)
@@ -1050,7 +3206,7 @@ _retry:
     // ARP/NDP or ICMPv4/v6; when more protocols are added, we may need
     // to derive this filter based on which protocols are configured
     // on the devices
-    if (pcap_compile(handle_, &bpf, capture_filter, optimize, 0) < 0)
+    if (pcap_compile(handle_, &bpf, captureFilter(), optimize, 0) < 0)
     {
         qWarning("%s: error compiling filter: %s", qPrintable(device_),
                 pcap_geterr(handle_));
@@ -1065,46 +3221,19 @@ _retry:
     }
 
 _skip_filter:
-    state_ = kRunning;
+    state_.set(kRunning);
     while (1)
     {
-        int ret;
-        struct pcap_pkthdr *hdr;
-        const uchar *data;
+        int ret = pcap_dispatch(handle_, batch, rxHandler, (uchar*) this);
 
-        ret = pcap_next_ex(handle_, &hdr, &data);
-        switch (ret)
-        {
-            case 1:
-            {
-                PacketBuffer *pktBuf = new PacketBuffer(data, hdr->caplen);
-#if 0
-                for (int i = 0; i < 64; i++) {
-                    printf("%02x ", data[i]);
-                    if (i % 16 == 0)
-                        printf("\n");
-                }
-                printf("\n");
-#endif
-                // XXX: deviceManager should free pktBuf before returning
-                // from this call; if it needs to process the pkt async
-                // it should make a copy as the pktBuf's data buffer is
-                // owned by libpcap which does not guarantee data will
-                // persist across calls to pcap_next_ex()
-                deviceManager_->receivePacket(pktBuf);
-                break;
-            }
-            case 0:
-                // timeout: just go back to the loop
-                break;
-            case -1:
-                qWarning("%s: error reading packet (%d): %s",
-                        __PRETTY_FUNCTION__, ret, pcap_geterr(handle_));
-                break;
-            case -2:
-            default:
-                qFatal("%s: Unexpected return value %d", __PRETTY_FUNCTION__,
-                        ret);
+        // 0 => timeout: just go back to the loop
+        if (ret == -1) {
+            qWarning("%s: error reading packet (%d): %s",
+                    __PRETTY_FUNCTION__, ret, pcap_geterr(handle_));
+        }
+        else if (ret < 0) {
+            qFatal("%s: Unexpected return value %d", __PRETTY_FUNCTION__,
+                    ret);
         }
 
         if (stop_)
@@ -1118,7 +3247,19 @@ _skip_filter:
     stop_ = false;
 
 _exit:
-    state_ = kFinished;
+    state_.set(kFinished);
+}
+
+void PcapPort::EmulationTransceiver::rxHandler(uchar *xcvr,
+        const struct pcap_pkthdr *hdr, const uchar *data)
+{
+    EmulationTransceiver *self = (EmulationTransceiver*) xcvr;
+    PacketBuffer pktBuf(data, hdr->caplen);
+
+    // XXX: if deviceManager needs to process the pkt async it should make
+    // a copy as the pktBuf's data buffer is owned by libpcap which does not
+    // guarantee data will persist across calls to pcap_dispatch()
+    self->deviceManager_->receivePacket(&pktBuf);
 }
 
 void PcapPort::EmulationTransceiver::start()
@@ -1128,19 +3269,17 @@ void PcapPort::EmulationTransceiver::start()
         return;
     }
 
-    state_ = kNotStarted;
+    state_.set(kNotStarted);
     QThread::start();
 
-    while (state_ == kNotStarted)
-        QThread::msleep(10);
+    state_.waitWhile(kNotStarted);
 }
 
 void PcapPort::EmulationTransceiver::stop()
 {
     if (state_ == kRunning) {
         stop_ = true;
-        while (state_ == kRunning)
-            QThread::msleep(10);
+        state_.waitFor(kFinished);
     }
     else {
         qWarning("Receive stop requested but is not running!");
@@ -1157,3 +3296,16 @@ int PcapPort::EmulationTransceiver::transmitPacket(PacketBuffer *pktBuf)
 {
     return pcap_sendpacket(handle_, pktBuf->data(), pktBuf->length());
 }
+
+// Returns the count sent
+int PcapPort::EmulationTransceiver::transmitPackets(
+        const QList<PacketBuffer*> &pktBufs)
+{
+    int count = 0;
+
+    foreach(PacketBuffer *pktBuf, pktBufs) {
+        if (transmitPacket(pktBuf) == 0)
+            count++;
+    }
+    return count;
+}
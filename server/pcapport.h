@@ -20,11 +20,31 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 #ifndef _SERVER_PCAP_PORT_H
 #define _SERVER_PCAP_PORT_H
 
+#include <QAtomicInt>
+#include <QAtomicPointer>
+#include <QHash>
+#include <QMutex>
 #include <QTemporaryFile>
 #include <QThread>
+#include <QVector>
+#include <QWaitCondition>
 #include <pcap.h>
 
 #include "abstractport.h"
+#include "captureanalytics.h"
+#include "capturedigest.h"
+#include "capturefilter.h"
+#include "capturering.h"
+#include "dronemetrics.h"
+#include "../common/framegenerator.h"
+#include "../common/prng.h"
+#include "../common/sdtprobes.h"
+#include "injectqueue.h"
+#include "packetarena.h"
+#include "threadplacer.h"
+#include "threadstate.h"
+#include "timestamp.h"
+#include "txscheduler.h"
 #include "pcapextra.h"
 
 class PcapPort : public AbstractPort
@@ -40,39 +60,57 @@ public:
 
     virtual bool setRateAccuracy(AbstractPort::Accuracy accuracy); 
 
-    virtual void clearPacketList() { 
-        transmitter_->clearPacketList();
-        setPacketListLoopMode(false, 0, 0);
-    }
+    virtual void clearPacketList();
     virtual void loopNextPacketSet(qint64 size, qint64 repeats,
-            long repeatDelaySec, long repeatDelayNsec) {
-        transmitter_->loopNextPacketSet(size, repeats, 
-                repeatDelaySec, repeatDelayNsec);
-    }
+            long repeatDelaySec, long repeatDelayNsec);
     virtual bool appendToPacketList(long sec, long nsec, const uchar *packet, 
-            int length) {
-        return transmitter_->appendToPacketList(sec, nsec, packet, length); 
-    }
-    virtual void setPacketListLoopMode(bool loop, quint64 secDelay, quint64 nsecDelay)
-    {
-        transmitter_->setPacketListLoopMode(loop, secDelay, nsecDelay);
-    }
-
-    virtual void startTransmit() { 
-        Q_ASSERT(!isDirty());
-        transmitter_->start(); 
+            int length);
+    virtual bool appendRefToPacketList(long sec, long nsec,
+            const uchar *packet, int length, quint64 repeats, quint64 gapNsec);
+    virtual bool appendGeneratorToPacketList(long sec, long nsec,
+            FrameGenerator *generator);
+    virtual bool hasNativeFrameGenerators() const { return true; }
+    virtual void setPacketListLoopMode(bool loop, quint64 secDelay, quint64 nsecDelay);
+    virtual void setPacketListStream(qint64 streamId);
+    virtual void setPacketListShuffle(bool isShuffled, quint64 seed);
+    virtual bool canJumpInPacketList() { return true; }
+    virtual void markPacketListStream(uint streamId);
+    virtual void appendJumpToPacketList(qint64 streamId, quint64 nsecDelay);
+    virtual bool canSwitchPacketList() { return true; }
+    virtual void commitPacketList();
+
+    virtual void startTransmit();
+    virtual void armTransmit(StartBarrierPtr barrier);
+    virtual void stopTransmit();
+    virtual bool isTransmitOn();
+    virtual bool transmitRunStats(quint64 *pkts, quint64 *bytes,
+                                  quint64 *nsec);
+    virtual bool setTransmitLoad(double load);
+    virtual bool hasRateControl() { return true; }
+
+    virtual void startCapture(const char *filter,
+                              const OstProto::CaptureConfig &config) {
+        capturer_->setRxConfig(data_.pcap_rx());
+        capturer_->start(filter, config);
     }
-    virtual void stopTransmit()  { transmitter_->stop();  }
-    virtual bool isTransmitOn() { return transmitter_->isRunning(); }
-
-    virtual void startCapture(const char *filter) { capturer_->start(filter); }
     virtual void stopCapture()  { capturer_->stop(); }
     virtual bool isCaptureOn()  { return capturer_->isRunning(); }
-    virtual QIODevice* captureData() { return capturer_->captureFile(); }
+    virtual bool isCaptureRing() { return capturer_->isRing(); }
+    virtual void snapshotCaptureRing() { capturer_->snapshotRing(); }
+    virtual QIODevice* captureData() { return capturer_->captureData(); }
+    virtual QIODevice* captureDigests() { return capturer_->digestFile(); }
+    virtual CaptureAnalytics* captureAnalytics() {
+        return capturer_->analytics();
+    }
 
     virtual void startDeviceEmulation();
     virtual void stopDeviceEmulation();
     virtual int sendEmulationPacket(PacketBuffer *pktBuf);
+    virtual int sendEmulationPackets(const QList<PacketBuffer*> &pktBufs);
+
+    virtual void stats(PortStats *stats);
+
+    void updateRateControl();
 
 protected:
     enum Direction
@@ -81,6 +119,8 @@ protected:
         kDirectionTx
     };
 
+    class PortTransmitter;
+
     class PortMonitor: public QThread
     {
     public:
@@ -93,17 +133,50 @@ protected:
         Direction direction() { return direction_; }
         bool isDirectional() { return isDirectional_; }
         bool isPromiscuous() { return isPromisc_; }
+        ThreadPlacer& placer() { return placer_; }
+        DroneMetrics::Counters& metrics() { return metrics_; }
+        // rx only; frames are captured in full for this
+        void setStreamStats(StreamStatsTable *table) { streamStats_ = table; }
+        // rx only; tracked stream frames received are sent back via
+        // transmitter (see reflect()) - NULL => not
+        void setReflector(PortTransmitter *transmitter) {
+            reflector_ = transmitter;
+        }
+        // tx only; port's rate control is run after every tx rate update
+        // - NULL => not
+        void setRateControl(PcapPort *port) { rateControl_ = port; }
     protected:
-        AbstractPort::PortStats *stats_;
+        void receive(const struct pcap_pkthdr *hdr, const uchar *data);
+        void updateRate();
+        void updateDrops();
+        void reflect(const uchar *data, int length);
+
+        AbstractPort::PortStats *stats_; // NULL => don't count port stats
+        StreamStatsTable *streamStats_;
+        PortTransmitter * volatile reflector_;
+        PcapPort *rateControl_;
+        QByteArray reflected_; // reused for every frame reflected
+        RateMeter rate_; // of direction_
+        DroneMetrics::Counters metrics_;
         bool stop_;
     private:
+        static void rxHandler(uchar *monitor, const struct pcap_pkthdr *hdr,
+                              const uchar *data);
+
         pcap_t *handle_;
+        int dispatchBatch_; // frames per pcap_dispatch()
+        quint64 lastPkts_;
+        quint64 lastBytes_;
+        long lastRateSec_;
         Direction direction_;
         bool isDirectional_;
         bool isPromisc_;
+        bool isNsecTs_;
+        bool isNicTs_; // timestamps are from the NIC's clock
+        ThreadPlacer placer_;
     };
 
-    class PortTransmitter: public QThread
+    class PortTransmitter: public QThread, public TxScheduler::Client
     {
     public:
         PortTransmitter(const char *device);
@@ -114,41 +187,172 @@ protected:
         void clearPacketList();
         void loopNextPacketSet(qint64 size, qint64 repeats, 
             long repeatDelaySec, long repeatDelayNsec);
-        bool appendToPacketList(long sec, long usec, const uchar *packet, 
+        bool appendToPacketList(long sec, long nsec, const uchar *packet, 
             int length);
+        bool appendRefToPacketList(long sec, long nsec, const uchar *packet,
+            int length, quint64 repeats, quint64 gapNsec);
+        bool appendGeneratorToPacketList(long sec, long nsec,
+            FrameGenerator *generator);
+        void markPacketListStream(uint streamId);
+        void appendJumpToPacketList(qint64 streamId, quint64 nsecDelay);
+        void skipNextPacketSet(qint64 repeats);
+        void setSkippedSetDuration(quint64 nsec);
         void setPacketListLoopMode(bool loop, quint64 secDelay, quint64 nsecDelay) {
-            returnToQIdx_ = loop ? 0 : -1;
-            loopDelay_ = secDelay*long(1e6) + nsecDelay/1000;
+            packetList_->returnToQIdx = loop ? 0 : -1;
+            packetList_->loopDelay = secDelay*quint64(1e9) + nsecDelay;
+        }
+        // key is StreamStatsTable::key() of the frames appended from now
+        // on; -1 => not counted per stream
+        void setPacketListStream(qint64 key) { streamKey_ = key; }
+        // A shuffled stream's frames are in sequences of their own
+        void setPacketListShuffle(bool isShuffled, quint64 seed) {
+            if (isShuffled || isShuffled_)
+                isSequenceBreak_ = true;
+            isShuffled_ = isShuffled;
+            shuffleSeed_ = seed;
         }
+        void commitPacketList();
         void setHandle(pcap_t *handle);
         void useExternalStats(AbstractPort::PortStats *stats);
+        const AbstractPort::PortStats& txStats() { return *stats_; }
+        ThreadPlacer& placer() { return placer_; }
+        DroneMetrics::Counters& metrics() { return metrics_; }
+        void setNumaNode(int node) {
+            packetLists_[0].arena.setNumaNode(node);
+            packetLists_[1].arena.setNumaNode(node);
+        }
+        const StreamStatsTable& streamStats() const { return streamStats_; }
+        void setStreamStatsLane(int lane) { streamStats_.setLane(lane); }
+        void setRateScale(double scale) {
+            rateScale_.fetchAndStoreRelaxed(qRound(scale*kRateScaleOne));
+        }
+        // Send frames back to back, without pacing - see Port.max_rate
+        void setMaxRate(bool isMaxRate) { isMaxRate_ = isMaxRate; }
+        // Stop by ourselves after duration nsecs from the start or at
+        // stopTime (CLOCK_REALTIME nsecs), whichever is earlier; 0 => none
+        void setStopTime(quint64 duration, quint64 stopTime) {
+            duration_ = duration;
+            stopTime_ = stopTime;
+        }
+        void runStats(quint64 *pkts, quint64 *bytes, quint64 *nsec);
+        // Queues a frame (from any thread) to be sent between our own -
+        // false if we are not transmitting; see sendInjected()
+        bool inject(const uchar *data, int length);
+        // Hold the next start() till the barrier is released
+        void setStartBarrier(StartBarrierPtr barrier) {
+            barrier->addParty();
+            barrier_ = barrier;
+        }
+        // Have the TxScheduler send the packet list, if it can - see
+        // startShared()
+        void setSharedTransmit(bool isShared) { useShared_ = isShared; }
         void run();
         void start();
         void stop();
         bool isRunning();
-    private:
+        quint64 txScheduleDue(quint64 limitNsec);
+    protected:
         enum State 
         {
             kNotStarted,
+            kArmed,     // waiting for the start barrier
             kRunning,
             kFinished
         };
 
+        // Packet timestamps in the sendQueue are in nsecs (stored in
+        // ts.tv_usec) except on Win32 where the sendQueue is WinPcap's
+        // and so needs usecs
+#ifdef Q_OS_WIN32
+        static const long kTsUnitsPerSec = 1000000;
+#else
+        static const long kTsUnitsPerSec = 1000000000;
+#endif
+        // Counts a packet set sent and how far behind schedule we are
+        void countPacketSet(qint64 overHead) {
+            quint64 lag = overHead < 0 ? quint64(-overHead) : 0;
+            if (lag)
+                OST_PROBE2(tx_overrun, deviceName_.constData(), lag);
+            metrics_.add(OstProto::DroneMetric::kTxLoopIterations);
+            metrics_.set(OstProto::DroneMetric::kTxLagNsec, lag);
+            metrics_.setMax(OstProto::DroneMetric::kTxMaxLagNsec, lag);
+        }
+
+        // Returns true if a frame (or the end of a gap) due nsec from now
+        // is at or past the stop time - to be checked before every frame
+        // sent and every wait; run() then waits out the rest till the
+        // stop time before finishing
+        bool isPastStopTime(qint64 nsec) {
+            return (stopNsec_ >= 0) && isStopTimeReached(nsec);
+        }
+        bool isStopTimeReached(qint64 nsec);
+        void waitForStopTime();
+
+        // Injected frames are sent after every packet set and every
+        // kInjectPollNsec of a longer wait
+        static const quint64 kInjectPollNsec = 1000000; // 1ms
+        void sendInjected();
+        void delayInjecting(quint64 nsec);
+
+        // With virtual time (see VirtualPort) the transmitter doesn't
+        // wait - a wait only advances the clock, so frames are sent as
+        // fast as they can be with the clock at their scheduled time
+        void delay(quint64 nsec) {
+            if (isVirtualTime_)
+                virtualNsec_ += nsec;
+            else if (injectOpen_ && (nsec > kInjectPollNsec))
+                delayInjecting(nsec);
+            else
+                (*ndelayFn_)(nsec);
+        }
+        void getTime(TimeStamp *stamp) const {
+            if (isVirtualTime_)
+                nsecToTimeStamp(virtualNsec_, stamp);
+            else
+                getTimeStamp(stamp);
+        }
+
+        // Returns the scheduled gap as adjusted by the rate controller
+        qint64 pacedGap(qint64 nsec) const {
+            int scale = rateScale_;
+            return (scale == kRateScaleOne) ?
+                    nsec : (nsec * scale) / kRateScaleOne;
+        }
+
+        // Returns (end - start) in nsecs
+        static qint64 nsecTsDiff(const struct timeval &end,
+                const struct timeval &start) {
+            return qint64(end.tv_sec - start.tv_sec)*qint64(1e9)
+                + qint64(end.tv_usec - start.tv_usec)*(1000000000/kTsUnitsPerSec);
+        }
+
         class PacketSequence
         {
         public:
-            PacketSequence() {
-                sendQueue_ = pcap_sendqueue_alloc(1*1024*1024);
+            // The send queue buffer is allocated from (and owned by)
+            // the arena
+            PacketSequence(PacketArena *arena) : rng_(0, 0) {
+                queue_.buffer = arena->alloc(kQueueSize);
+                queue_.maxlen = queue_.buffer ? kQueueSize : 0;
+                queue_.len = 0;
+                sendQueue_ = &queue_;
                 lastPacket_ = NULL;
                 packets_ = 0;
                 bytes_ = 0;
-                usecDuration_ = 0;
+                nsecDuration_ = 0;
                 repeatCount_ = 1;
                 repeatSize_ = 1;
-                usecDelay_ = 0;
+                nsecDelay_ = 0;
+                packetRepeats_ = 1;
+                packetGapNsec_ = 0;
+                generator_ = NULL;
+                isJump_ = false;
+                jumpStreamId_ = -1;
+                jumpToQIdx_ = -1;
+                isShuffled_ = false;
             }
             ~PacketSequence() {
-                pcap_sendqueue_destroy(sendQueue_);
+                delete generator_;
             }
             bool hasFreeSpace(int size) {
                 if ((sendQueue_->len + size) <= sendQueue_->maxlen)
@@ -159,49 +363,260 @@ protected:
             int appendPacket(const struct pcap_pkthdr *pktHeader, 
                     const uchar *pktData) {
                 if (lastPacket_) 
-                {
-                    usecDuration_ += (pktHeader->ts.tv_sec 
-                                        - lastPacket_->ts.tv_sec) * long(1e6);
-                    usecDuration_ += (pktHeader->ts.tv_usec 
-                                        - lastPacket_->ts.tv_usec);
-                }
+                    nsecDuration_ += nsecTsDiff(pktHeader->ts, lastPacket_->ts);
                 packets_++;
                 bytes_ += pktHeader->caplen;
                 lastPacket_ = (struct pcap_pkthdr *) 
                                     (sendQueue_->buffer + sendQueue_->len);
+                if (isShuffled_)
+                    frameOffsets_.append(sendQueue_->len);
                 return pcap_sendqueue_queue(sendQueue_, pktHeader, pktData);
             }
+            // A reference sequence has only one stored frame which is
+            // replayed 'repeats' times, 'gapNsec' apart
+            int appendPacketRef(const struct pcap_pkthdr *pktHeader,
+                    const uchar *pktData, quint64 repeats, quint64 gapNsec) {
+                Q_ASSERT(packets_ == 0);
+                int ret = appendPacket(pktHeader, pktData);
+                packets_ = repeats;
+                bytes_ = repeats * pktHeader->caplen;
+                nsecDuration_ = (repeats - 1) * gapNsec;
+                packetRepeats_ = repeats;
+                packetGapNsec_ = gapNsec;
+                return ret;
+            }
+            bool isRef() { return packetRepeats_ > 1; }
+            // A generated sequence has no stored frames - they are
+            // generated by 'generator' (owned by the sequence) while
+            // transmitting; it stores only a dummy packet header with the
+            // timestamp of the first frame
+            int appendGenerator(const struct pcap_pkthdr *pktHeader,
+                    FrameGenerator *generator) {
+                Q_ASSERT(packets_ == 0);
+                Q_ASSERT(pktHeader->caplen == 0);
+                int ret = appendPacket(pktHeader, (const uchar*) pktHeader);
+                packets_ = 0; // not known until generated
+                bytes_ = 0;
+                nsecDuration_ = generator->nsecDuration();
+                generator_ = generator;
+                return ret;
+            }
+            bool isGenerated() { return generator_ != NULL; }
+            // Counts pkts frames (bytes in all) just appended as of the
+            // stream key (-1 => none); consecutive frames of a stream
+            // share a StreamCount
+            void countStream(qint64 key, quint64 pkts, quint64 bytes) {
+                if (key < 0)
+                    return;
+                if (streamCounts_.isEmpty()
+                        || (streamCounts_.last().key != quint64(key))) {
+                    StreamCount count = { quint64(key), 0, 0 };
+                    streamCounts_.append(count);
+                }
+                streamCounts_.last().pkts += pkts;
+                streamCounts_.last().bytes += bytes;
+            }
+            // Frames are shuffled (only) if there's more than one
+            void setShuffled(quint64 seed, quint64 sequence) {
+                isShuffled_ = true;
+                rng_ = Pcg32(seed, sequence);
+            }
+            bool isShuffled() { return frameOffsets_.size() > 1; }
+            // A new random order (Fisher-Yates) of the frames - of their
+            // indices in frameOffsets_, the frames stay where they are
+            void shuffle() {
+                if (order_.size() != frameOffsets_.size()) {
+                    order_.resize(frameOffsets_.size());
+                    for (int i = 0; i < order_.size(); i++)
+                        order_[i] = i;
+                }
+                for (int i = order_.size() - 1; i > 0; i--)
+                    qSwap(order_[i], order_[int(rng_.next(i + 1))]);
+            }
+            // Time from the last stored packet to the last packet sent
+            quint64 nsecLastPacketOffset() {
+                return (isRef() || isGenerated()) ? nsecDuration_ : 0;
+            }
+
+            static const u_int kQueueSize = 1*1024*1024;
+
+            pcap_send_queue queue_;
             pcap_send_queue *sendQueue_;
             struct pcap_pkthdr *lastPacket_;
             long packets_;
             long bytes_;
-            ulong usecDuration_;
-            int repeatCount_;
+            quint64 nsecDuration_;
+            int repeatCount_; // -1 => repeat till stopped
             int repeatSize_;
-            long usecDelay_;
+            qint64 nsecDelay_;
+            quint64 packetRepeats_;
+            quint64 packetGapNsec_;
+            FrameGenerator *generator_;
+
+            // A jump has no frames - after its nsecDelay_, run() goes on
+            // from jumpToQIdx_ (-1 => the end of the list), the start of
+            // stream jumpStreamId_'s frames as resolved on commit
+            bool isJump_;
+            qint64 jumpStreamId_;
+            int jumpToQIdx_;
+
+            // Shuffled - the offsets of the frames in the send queue (in
+            // the order stored) and the order they are sent in this time
+            bool isShuffled_;
+            QVector<uint> frameOffsets_;
+            QVector<int> order_;
+            Pcg32 rng_;
+
+            // Frames of each untracked stream in the sequence, in the
+            // order sent - see PortTransmitter::countSequence(); a
+            // generated sequence's counts are not known upfront (0)
+            struct StreamCount
+            {
+                quint64 key;
+                quint64 pkts;
+                quint64 bytes;
+            };
+            QVector<StreamCount> streamCounts_;
+        };
+
+        virtual bool open();
+        static void ndelay(quint64 nsec);
+        static void ndelayHybrid(quint64 nsec);
+        static void nsleep(quint64 nsec);
+        virtual int sendQueueTransmit(pcap_t *p, pcap_send_queue *queue,
+                    qint64 &overHead, int sync);
+        int sendPacketRef(PacketSequence *seq, qint64 &overHead, int sync);
+        int sendShuffled(PacketSequence *seq, qint64 &overHead, int sync);
+        int sendGenerated(PacketSequence *seq, qint64 &overHead, int sync);
+        void countSequence(const PacketSequence *seq, bool isComplete,
+                quint64 pkts, quint64 bytes);
+        static bool generateFrames(FrameGenerator *generator,
+                struct timeval ts, pcap_send_queue *queue,
+                struct timeval *lastTs);
+#ifdef HAVE_SENDMMSG
+        static bool isSendBatchAllowed();
+        int sendQueueTransmitBatched(pcap_t *p, pcap_send_queue *queue,
+                    qint64 &overHead, int sync);
+
+        // Max frames sent with one sendmmsg() call
+        static const int kMaxSendBatch = 64;
+        // Frames with a gap (nsecs) upto this value are sent as a batch
+        static const qint64 kMaxBatchGap = 10000;
+
+        bool useSendBatch_;
+#endif
+
+        // The packet sequences (and their memory) sent by run() - there
+        // are two lists, so that a new list can be built while the other
+        // one is being sent
+        struct PacketList
+        {
+            PacketList() {
+                generatedQueue[0] = generatedQueue[1] = NULL;
+                returnToQIdx = -1;
+                loopDelay = 0;
+            }
+            void clear();
+
+            PacketArena arena;
+            QList<PacketSequence*> sequences;
+            // Frames of a generated sequence are sent from one of these
+            // while the next lot of frames is generated into the other
+            pcap_send_queue *generatedQueue[2];
+            int returnToQIdx;
+            quint64 loopDelay;
         };
 
-        static void udelay(unsigned long usec);
-        int sendQueueTransmit(pcap_t *p, pcap_send_queue *queue, long &overHead,
-                    int sync);
+        PacketSequence* newPacketSequence();
+        bool canShare(const PacketList *list) const;
+        bool startShared();
+        void finishShared();
+        void sendShared(struct pcap_pkthdr *hdr);
+        PacketList* switchPacketList();
+
+        PacketList packetLists_[2];
+        PacketList *packetList_;    // being built
+        PacketList *txPacketList_;  // being sent; changed only by run()
+        // Committed while transmitting - run() switches to it at the next
+        // packet set boundary
+        QAtomicPointer<PacketList> pendingPacketList_;
+        // The switch is made under listLock_ and signalled by listSwitched_
+        // - see clearPacketList()
+        QMutex listLock_;
+        QWaitCondition listSwitched_;
 
-        QList<PacketSequence*> packetSequenceList_;
         PacketSequence *currentPacketSequence_;
+        qint64 streamKey_; // see setPacketListStream()
+        bool isShuffled_; // see setPacketListShuffle()
+        quint64 shuffleSeed_;
+        static const u_int kGeneratedQueueSize = 1*1024*1024;
+        struct timeval generatedLastTs_[2]; // ts of last frame in queue
         int repeatSequenceStart_;
         quint64 repeatSize_;
         quint64 packetCount_;
-
-        int returnToQIdx_;
-        quint64 loopDelay_;
-
-        void (*udelayFn_)(unsigned long);
+        // Jump targets - stream id to the index of its first sequence; a
+        // marked stream's frames start a new sequence
+        QHash<uint, int> streamStarts_;
+        bool isSequenceBreak_;
+        // Waits out a packet set with no frames of ours - see
+        // skipNextPacketSet(); its jumpStreamId_ is kJumpToNext
+        PacketSequence *skippedSetJump_;
+        static const qint64 kJumpToNext = -2;
+        // Copies of a ref sequence's frame - see sendPacketRef()
+        QByteArray refBatch_;
+        static const int kRefBatchBytes = 256*1024;
+
+        void (*ndelayFn_)(quint64 nsec);
+        bool isVirtualTime_;
+        volatile quint64 virtualNsec_; // since the run start
+        ThreadPlacer placer_;
+        DroneMetrics::Counters metrics_;
+        // Fixed point (kRateScaleOne => 1.0) - set by the rate controller
+        // of another thread
+        QAtomicInt rateScale_;
+        static const int kRateScaleOne = 1 << 16;
+        bool isMaxRate_;
+
+        quint64 duration_;
+        quint64 stopTime_;
+        qint64 stopNsec_; // since runStart_; -1 => no stop time
+        bool isStoppedByTime_;
+        TimeStamp runStart_;
+        quint64 runStartPkts_;
+        quint64 runStartBytes_;
+        volatile qint64 runNsec_; // -1 => running
 
         bool usingInternalStats_;
         AbstractPort::PortStats *stats_;
+        // Tracked stream frames are stamped and counted as they are sent
+        StreamStatsTable streamStats_;
+        QByteArray deviceName_;
         bool usingInternalHandle_;
         pcap_t *handle_;
+        StartBarrierPtr barrier_;
         volatile bool stop_;
-        volatile State state_;
+        ThreadState state_;
+
+        InjectQueue injectQueue_;
+        QAtomicInt injectOpen_; // accepting frames - set only by run()
+        QAtomicInt injectors_;  // inject() calls in progress
+
+        // Shared transmit - where run() would be in txPacketList_: the
+        // packet set (i), its repeat (j), the sequence in it (i+k) and
+        // the next frame of that (byte offset/replays of a ref); the
+        // frame is due at sharedDue_ (TxScheduler time)
+        bool useShared_;
+        bool isShared_; // the current/last run is by the TxScheduler
+        int sharedSetIdx_;
+        int sharedRepeat_;
+        int sharedIdx_;
+        uint sharedOffset_;
+        quint64 sharedReplays_;
+        quint64 sharedDue_;
+        quint64 sharedSeqStartPkts_;
+        quint64 sharedSeqStartBytes_;
+        // Frames sent per txScheduleDue() at most
+        static const int kMaxSharedBurst = 64;
     };
 
     class PortCapturer: public QThread
@@ -210,12 +625,24 @@ protected:
         PortCapturer(const char *device);
         ~PortCapturer();
         void run();
-        void start(const char *filter);
+        void start(const char *filter, const OstProto::CaptureConfig &config);
         void stop();
+        // Used from the next start()
+        void setRxConfig(const OstProto::PcapRx &config) {
+            rxConfig_ = config;
+        }
         bool isRunning();
+        bool isRing();
+        void snapshotRing();
         QFile* captureFile();
+        // The capture file or a view of it
+        virtual QIODevice* captureData() { return &capFile_; }
+        QFile* digestFile() { return digest_.readFile(); }
+        CaptureAnalytics* analytics() { return &analytics_; }
+        ThreadPlacer& placer() { return placer_; }
+        DroneMetrics::Counters& metrics() { return metrics_; }
 
-    private:
+    protected:
         enum State 
         {
             kNotStarted,
@@ -226,10 +653,24 @@ protected:
         QString         device_;
         volatile bool   stop_;
         QTemporaryFile  capFile_;
+        ThreadState     state_;
+        QString         filter_;
+        OstProto::CaptureConfig config_;
+        OstProto::PcapRx rxConfig_;
+        CaptureRing     ring_;
+        CaptureDigest   digest_;
+        CaptureSignatureFilter sigFilter_;
+        CaptureAnalytics analytics_;
+        DroneMetrics::Counters metrics_;
+
+    private:
+        static void pcapHandler(uchar *capturer,
+                                const struct pcap_pkthdr *hdr,
+                                const uchar *data);
+
         pcap_t          *handle_;
         pcap_dumper_t   *dumpHandle_;
-        volatile State  state_;
-        QString         filter_;
+        ThreadPlacer    placer_;
     };
 
     class EmulationTransceiver: public QThread
@@ -238,12 +679,18 @@ protected:
         EmulationTransceiver(const char *device, DeviceManager *deviceManager);
         ~EmulationTransceiver();
         void run();
-        void start();
-        void stop();
+        virtual void start();
+        virtual void stop();
         bool isRunning();
-        int transmitPacket(PacketBuffer *pktBuf);
+        virtual int transmitPacket(PacketBuffer *pktBuf);
+        virtual int transmitPackets(const QList<PacketBuffer*> &pktBufs);
+        ThreadPlacer& placer() { return placer_; }
+        // Used from the next start()
+        void setRxConfig(const OstProto::PcapRx &config) {
+            rxConfig_ = config;
+        }
 
-    private:
+    protected:
         enum State
         {
             kNotStarted,
@@ -251,23 +698,66 @@ protected:
             kFinished
         };
 
+        static const char* captureFilter();
+        static void rxHandler(uchar *xcvr, const struct pcap_pkthdr *hdr,
+                              const uchar *data);
+
         QString         device_;
         DeviceManager   *deviceManager_;
         volatile bool   stop_;
+        OstProto::PcapRx rxConfig_;
         pcap_t          *handle_;
-        volatile State  state_;
+        ThreadState     state_;
+        ThreadPlacer    placer_;
     };
 
+    virtual void addStreamStats(StreamStatsHash &stats);
+    virtual void applyThreadPlacement();
+    virtual void threadPlacementStatus(OstProto::Port *port);
+    virtual bool setProbeReflection(bool enable);
+    virtual bool setPcapRx(const OstProto::PcapRx &config);
+    void updateTxNumaNode();
+
     PortMonitor     *monitorRx_;
     PortMonitor     *monitorTx_;
 
-    void updateNotes();
-
-private:
     PortTransmitter *transmitter_;
+    // Additional transmit workers (other than transmitter_), if any
+    QList<PortTransmitter*> txWorkers_;
     PortCapturer    *capturer_;
     EmulationTransceiver *emulXcvr_;
 
+    void updateNotes();
+    double transmitLoad() const { return txLoad_; }
+
+private:
+    int txWorkerCount() { return txWorkers_.size() + 1; }
+    PortTransmitter* txWorker(int index) {
+        return index ? txWorkers_.at(index - 1) : transmitter_;
+    }
+
+    void countSkippedSet(long sec, long nsec, quint64 repeats,
+                         quint64 gapNsec);
+
+    int nextTxWorker_;
+
+    // The packet set being appended, if some workers have no frames in it
+    // - see loopNextPacketSet()
+    struct SkippedSet {
+        qint64 remaining;   // frames yet to be appended; 0 => none
+        qint64 repeats;
+        quint64 repeatDelay;
+        quint64 firstNsec;
+        quint64 lastNsec;
+    } skippedSet_;
+
+    // Closed loop rate control - see updateRateControl()
+    static const int kRateControlSettleTicks = 2;
+    double rateScale_;
+    int rateControlTicks_;
+    double txLoad_; // see setTransmitLoad()
+    bool isSharedTransmit_; // see PortTransmitter::startShared()
+
     static pcap_if_t *deviceList_;
 };
 
@@ -0,0 +1,139 @@
+/*
+Copyright (C) 2017 Srivats P.
+
+
+This file is part of "Ostinato"
+
+This is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+
+#include "pcapreplay.h"
+
+#include <string.h>
+
+// Ethernet is the only link type a port can send
+static const quint32 kLinkTypeEthernet = 1;
+
+PcapReplayGenerator* PcapReplayGenerator::create(
+        const OstProto::PcapReplay &config, QString &error)
+{
+    CapturePtr capture(new Capture);
+    QString fileName = QString::fromStdString(config.file_name());
+    PcapReader::Packet packet;
+    int n;
+    quint64 base, last = 0;
+
+    if (config.rate_multiplier() <= 0) {
+        error = QString("Invalid replay rate multiplier %1")
+                    .arg(config.rate_multiplier());
+        return NULL;
+    }
+
+    if (!capture->reader.open(fileName, error))
+        return NULL;
+
+    while (capture->reader.next(packet)) {
+        Frame frame;
+
+        if (packet.linkType != kLinkTypeEthernet)
+            continue;
+
+        frame.offset = packet.data - capture->reader.data();
+        frame.length = packet.length;
+        frame.nsec = packet.nsec;
+        capture->frames.append(frame);
+    }
+
+    if (capture->reader.isTruncated()) {
+        if (capture->frames.isEmpty()) {
+            error = QString("%1 is corrupt").arg(fileName);
+            return NULL;
+        }
+        qWarning("pcap replay: ignoring truncated end of %s",
+                qPrintable(fileName));
+    }
+
+    n = capture->frames.size();
+    if (!n) {
+        error = QString("%1 has no ethernet frames").arg(fileName);
+        return NULL;
+    }
+
+    // Capture timestamps to (scaled) send times relative to the first
+    // frame - these can't go back in time
+    base = capture->frames.at(0).nsec;
+    for (int i = 0; i < n; i++) {
+        Frame &frame = capture->frames[i];
+        quint64 nsec = 0;
+
+        if (!config.ignore_timing() && (frame.nsec > base))
+            nsec = quint64((frame.nsec - base)/config.rate_multiplier());
+
+        frame.nsec = last = qMax(nsec, last);
+    }
+    capture->loopNsec = last + ((n > 1) ? last/(n - 1) : 0);
+
+    qDebug("pcap replay %s: %d frames, %llu nsecs per loop",
+            qPrintable(fileName), n, capture->loopNsec);
+
+    return new PcapReplayGenerator(capture,
+            config.loop_count() ?
+                quint64(config.loop_count()) * n : kContinuousFrameCount,
+            0, 1);
+}
+
+PcapReplayGenerator::PcapReplayGenerator(CapturePtr capture, quint64 count,
+        quint64 first, quint64 stride)
+    : capture_(capture)
+{
+    count_ = count;
+    first_ = first;
+    stride_ = qMax(stride, quint64(1));
+    index_ = first_;
+}
+
+int PcapReplayGenerator::nextFrame(uchar *buf, int bufMaxSize,
+        quint64 &nsecOffset)
+{
+    quint64 n = capture_->frames.size();
+    const Frame &frame = capture_->frames.at(int(index_ % n));
+    int len = qMin(int(frame.length), bufMaxSize);
+
+    memcpy(buf, capture_->reader.data() + frame.offset, len);
+
+    nsecOffset = (index_ / n)*capture_->loopNsec + frame.nsec;
+    index_ += stride_;
+
+    return len;
+}
+
+quint64 PcapReplayGenerator::nsecDuration() const
+{
+    quint64 n = capture_->frames.size();
+
+    if (count_ == kContinuousFrameCount)
+        return kUnbounded;
+
+    return count_ ? ((count_ - 1)/n)*capture_->loopNsec
+                        + capture_->frames.at(int((count_ - 1) % n)).nsec
+                  : 0;
+}
+
+FrameGenerator* PcapReplayGenerator::split(quint64 first,
+        quint64 stride) const
+{
+    return new PcapReplayGenerator(capture_, count_,
+            first_ + first*stride_, stride_*stride);
+}
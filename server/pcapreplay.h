@@ -0,0 +1,91 @@
+/*
+Copyright (C) 2017 Srivats P.
+
+
+This file is part of "Ostinato"
+
+This is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+
+#ifndef _PCAP_REPLAY_H
+#define _PCAP_REPLAY_H
+
+#include "../common/framegenerator.h"
+#include "../common/pcapreader.h"
+#include "../common/protocol.pb.h"
+#include "../rpc/sharedprotobufmessage.h"
+
+#include <QString>
+#include <QVector>
+
+/*!
+  Generates the frames of a capture file (pcap or pcapng) as captured,
+  for the kPcapReplayTransmit mode of a port
+
+  The file is memory mapped and indexed once by create(); frames are
+  copied straight from the mapping as they are sent. Send times are the
+  capture timestamps relative to the first frame's, scaled by the replay
+  rate multiplier (or 0, if the timing is ignored). Each loop of the file
+  starts one average inter-frame gap after the last frame of the
+  previous loop
+*/
+class PcapReplayGenerator : public FrameGenerator
+{
+public:
+    // Returns NULL with error set if the file can't be replayed
+    static PcapReplayGenerator* create(const OstProto::PcapReplay &config,
+                                       QString &error);
+
+    virtual bool hasNext() const { return index_ < count_; }
+    virtual int nextFrame(uchar *buf, int bufMaxSize, quint64 &nsecOffset);
+    virtual void reset() { index_ = first_; }
+    virtual quint64 nsecDuration() const;
+    virtual FrameGenerator* split(quint64 first, quint64 stride) const;
+
+    // Frames in one loop of the file
+    int fileFrameCount() const { return capture_->frames.size(); }
+
+private:
+    struct Frame
+    {
+        qint64 offset;  // in the file
+        quint32 length;
+        quint64 nsec;   // send time in the loop (scaled)
+    };
+
+    struct Capture
+    {
+        PcapReader reader;  // owns the mapping frames are sent from
+        QVector<Frame> frames;
+        quint64 loopNsec;   // duration of one loop incl. gap to the next
+
+        Capture() : loopNsec(0) {}
+    };
+    typedef SharedPointer<Capture> CapturePtr;
+
+    PcapReplayGenerator(CapturePtr capture, quint64 count,
+                        quint64 first, quint64 stride);
+
+    // Frames generated for a replay looped forever - effectively forever
+    static const quint64 kContinuousFrameCount = quint64(1) << 62;
+
+    CapturePtr capture_;
+    quint64 count_;
+    quint64 first_;
+    quint64 stride_;
+    quint64 index_;
+};
+
+#endif
@@ -0,0 +1,476 @@
+/*
+Copyright (C) 2017 Srivats P.
+
+
+This file is part of "Ostinato"
+
+This is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+
+#include "pktgentransmitter.h"
+
+#ifdef Q_OS_LINUX
+
+#include "../common/ip4.pb.h"
+#include "../common/mac.pb.h"
+#include "../common/streambase.h"
+#include "../common/udp.pb.h"
+
+#include <QFile>
+#include <QMutexLocker>
+#include <QRegExp>
+#include <QtEndian>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+static const QString kPktgenDir("/proc/net/pktgen/");
+
+QMutex PktgenTransmitter::activeLock_;
+PktgenTransmitter *PktgenTransmitter::active_ = NULL;
+
+static QString macString(const uchar *mac)
+{
+    QStringList bytes;
+
+    for (int i = 0; i < 6; i++)
+        bytes.append(QString("%1").arg(mac[i], 2, 16, QChar('0')));
+    return bytes.join(":");
+}
+
+static QString ipString(quint32 ip)
+{
+    return QString("%1.%2.%3.%4").arg(ip >> 24).arg((ip >> 16) & 0xff)
+                .arg((ip >> 8) & 0xff).arg(ip & 0xff);
+}
+
+PktgenTransmitter::PktgenTransmitter(const char *device)
+    : device_(device)
+{
+    pktgenDevice_ = QString("%1@ost").arg(device);
+    streamId_ = 0;
+    frameLen_ = 0;
+    isLive_ = false;
+    runPkts_ = runUsecs_ = 0;
+}
+
+PktgenTransmitter::~PktgenTransmitter()
+{
+    stop();
+    wait();
+}
+
+bool PktgenTransmitter::isAvailable()
+{
+    return QFile::exists(kPktgenDir + "pgctrl");
+}
+
+bool PktgenTransmitter::start(const StreamBase *stream, int cpu, double load,
+                              QString &reason)
+{
+    QStringList commands;
+    int frameLen;
+
+    if (isRunning()) {
+        reason = "pktgen still running";
+        return false;
+    }
+    if (!streamCommands(stream, load, commands, frameLen, reason))
+        return false;
+
+    activeLock_.lock();
+    if (active_) {
+        activeLock_.unlock();
+        reason = "pktgen in use by another port";
+        return false;
+    }
+    active_ = this;
+    activeLock_.unlock();
+
+    threadFile_ = kPktgenDir + QString("kpktgend_%1").arg(cpu);
+    if (!QFile::exists(threadFile_))
+        threadFile_ = kPktgenDir + "kpktgend_0";
+
+    // Devices left over (e.g. by a drone that crashed) would be started
+    // with ours
+    if (!write(threadFile_, "rem_device_all")
+            || !write(threadFile_, QString("add_device %1")
+                                        .arg(pktgenDevice_))) {
+        reason = QString("unable to add %1 to %2").arg(pktgenDevice_)
+                        .arg(threadFile_);
+        goto _error;
+    }
+
+    foreach(QString command, commands) {
+        if (!write(kPktgenDir + pktgenDevice_, command)) {
+            reason = QString("pktgen rejected '%1'").arg(command);
+            goto _error;
+        }
+    }
+
+    statsLock_.lock();
+    streamId_ = stream->id();
+    frameLen_ = frameLen;
+    runPkts_ = runUsecs_ = 0;
+    isLive_ = true;
+    statsLock_.unlock();
+
+    qDebug("%s: stream %u sent via pktgen (%s)", qPrintable(device_),
+            streamId_, qPrintable(commands.join(", ")));
+    QThread::start();
+    return true;
+
+_error:
+    write(threadFile_, "rem_device_all");
+    activeLock_.lock();
+    active_ = NULL;
+    activeLock_.unlock();
+    return false;
+}
+
+void PktgenTransmitter::stop()
+{
+    // Stops all of pktgen's devices - only ours are running
+    if (isRunning())
+        write(kPktgenDir + "pgctrl", "stop");
+}
+
+void PktgenTransmitter::run()
+{
+    quint64 pkts = 0, usecs = 0;
+
+    // Returns when all devices are done or stopped
+    write(kPktgenDir + "pgctrl", "start");
+
+    readCounters(&pkts, &usecs);
+    statsLock_.lock();
+    runPkts_ = pkts;
+    runUsecs_ = usecs;
+    streamPkts_[streamId_] += pkts;
+    isLive_ = false;
+    statsLock_.unlock();
+
+    write(threadFile_, "rem_device_all");
+
+    activeLock_.lock();
+    active_ = NULL;
+    activeLock_.unlock();
+
+    qDebug("%s: pktgen sent %llu pkts in %llu usecs", qPrintable(device_),
+            pkts, usecs);
+}
+
+void PktgenTransmitter::runStats(quint64 *pkts, quint64 *bytes,
+                                 quint64 *nsec)
+{
+    QMutexLocker locker(&statsLock_);
+    quint64 usecs = runUsecs_;
+
+    *pkts = runPkts_;
+    if (isLive_)
+        readCounters(pkts, &usecs);
+    *bytes = *pkts * frameLen_;
+    *nsec = usecs * 1000;
+}
+
+void PktgenTransmitter::addStreamStats(quint32 portId,
+                                       StreamStatsHash &stats)
+{
+    QMutexLocker locker(&statsLock_);
+    QHash<uint, quint64> pkts = streamPkts_;
+    quint64 livePkts = 0, usecs;
+
+    if (isLive_ && readCounters(&livePkts, &usecs))
+        pkts[streamId_] += livePkts;
+
+    // Frames of all runs of a stream are of the same length only if the
+    // stream wasn't changed in between - close enough for a flood
+    QHash<uint, quint64>::const_iterator i;
+    for (i = pkts.constBegin(); i != pkts.constEnd(); i++) {
+        StreamStats &s = stats[StreamStatsTable::key(portId, i.key())];
+
+        s.txPkts += i.value();
+        s.txBytes += i.value() * frameLen_;
+    }
+}
+
+// An IPv4 address mode pktgen can do - a range that increments by 1
+static bool isPktgenIpMode(OstProto::Ip4::IpAddrMode mode, quint32 ip,
+                           quint32 count, quint32 mask)
+{
+    if (mode == OstProto::Ip4::e_im_fixed)
+        return true;
+
+    // The host part mustn't wrap around within the range
+    return (mode == OstProto::Ip4::e_im_inc_host) && (count > 0)
+            && ((quint64(ip & ~mask) + count - 1) <= quint64(~mask));
+}
+
+static bool isPktgenMacMode(OstProto::Mac::MacAddrMode mode, quint32 step)
+{
+    return (mode == OstProto::Mac::e_mm_fixed)
+            || ((mode == OstProto::Mac::e_mm_inc) && (step == 1));
+}
+
+/*
+ * Commands for our pktgen device to send the stream - the frame's fields
+ * are taken from its first frame and their ranges from the stream config
+ */
+bool PktgenTransmitter::streamCommands(const StreamBase *stream, double load,
+        QStringList &commands, int &frameLen, QString &reason)
+{
+    OstProto::Stream config;
+    const OstProto::Mac *mac = NULL;
+    const OstProto::Ip4 *ip4 = NULL;
+    uchar frame[16384];
+    int layer = 0;
+    int l3 = 14;
+    int vlanTag = -1;
+    quint32 srcIp, dstIp;
+    quint32 srcIpCount = 1, dstIpCount = 1;
+    quint16 srcPort, dstPort;
+    quint32 srcPortCount = 1, dstPortCount = 1;
+    quint64 count;
+    quint64 delay = 0;
+    double rate;
+    bool isBursts = (stream->sendUnit() == StreamBase::e_su_bursts);
+
+    if (stream->hasFrameSet()) {
+        reason = "stream sends uploaded frames";
+        return false;
+    }
+    if (stream->isTracked()) {
+        reason = "stream is tracked";
+        return false;
+    }
+    if (stream->lenMode() != StreamBase::e_fl_fixed) {
+        reason = "frame length is not fixed";
+        return false;
+    }
+    if (stream->hasGapTable()) {
+        reason = "gaps are not fixed";
+        return false;
+    }
+
+    // mac, eth2, [vlan], ip4, udp, [payload] - only the UDP ports may
+    // have variable fields
+    stream->protoDataCopyInto(config);
+    for (int i = 0; i < config.protocol_size(); i++) {
+        const OstProto::Protocol &proto = config.protocol(i);
+        int id = proto.protocol_id().id();
+
+        if ((layer == 0) && (id == OstProto::Protocol::kMacFieldNumber)) {
+            mac = &proto.GetExtension(OstProto::mac);
+            layer = 1;
+        }
+        else if ((layer == 1) && (id == OstProto::Protocol::kEth2FieldNumber))
+            layer = 2;
+        else if ((layer == 2) && (id == OstProto::Protocol::kVlanFieldNumber))
+            layer = 3;
+        else if (((layer == 2) || (layer == 3))
+                && (id == OstProto::Protocol::kIp4FieldNumber)) {
+            ip4 = &proto.GetExtension(OstProto::ip4);
+            layer = 4;
+        }
+        else if ((layer == 4) && (id == OstProto::Protocol::kUdpFieldNumber)) {
+            const OstProto::Udp &udp = proto.GetExtension(OstProto::udp);
+
+            if (udp.is_override_totlen() || udp.is_override_cksum()) {
+                reason = "UDP length/checksum overridden";
+                return false;
+            }
+            for (int j = 0; j < proto.variable_field_size(); j++) {
+                const OstProto::VariableField &vf = proto.variable_field(j);
+
+                if ((vf.type() != OstProto::VariableField::kCounter16)
+                        || ((vf.offset() != 0) && (vf.offset() != 2))
+                        || ((vf.mask() & 0xffff) != 0xffff)
+                        || (vf.mode() != OstProto::VariableField::kIncrement)
+                        || (vf.step() != 1) || (vf.count() == 0)
+                        || ((vf.value() & 0xffff) + vf.count() > 0x10000)) {
+                    reason = "UDP variable field other than a port range";
+                    return false;
+                }
+                if (vf.offset() == 0)
+                    srcPortCount = vf.count();
+                else
+                    dstPortCount = vf.count();
+            }
+            layer = 5;
+            continue;
+        }
+        else if ((layer == 5)
+                && (id == OstProto::Protocol::kPayloadFieldNumber))
+            layer = 6;
+        else
+            layer = -1;
+
+        if ((layer < 0) || proto.variable_field_size())
+            break;
+    }
+    if (layer < 5) {
+        reason = "not a plain Ethernet/IPv4/UDP frame";
+        return false;
+    }
+
+    if (!isPktgenMacMode(mac->dst_mac_mode(), mac->dst_mac_step())
+            || !isPktgenMacMode(mac->src_mac_mode(), mac->src_mac_step())) {
+        reason = "MAC mode other than fixed or increment by 1";
+        return false;
+    }
+
+    if (ip4->is_override_ver() || ip4->is_override_hdrlen()
+            || ip4->is_override_totlen() || ip4->is_override_proto()
+            || ip4->is_override_cksum() || !ip4->options().empty()) {
+        reason = "IPv4 header overridden";
+        return false;
+    }
+    if (!isPktgenIpMode(ip4->src_ip_mode(), ip4->src_ip(),
+                        ip4->src_ip_count(), ip4->src_ip_mask())
+            || !isPktgenIpMode(ip4->dst_ip_mode(), ip4->dst_ip(),
+                               ip4->dst_ip_count(), ip4->dst_ip_mask())) {
+        reason = "IP mode other than fixed or an increment within the subnet";
+        return false;
+    }
+    if (ip4->src_ip_mode() == OstProto::Ip4::e_im_inc_host)
+        srcIpCount = ip4->src_ip_count();
+    if (ip4->dst_ip_mode() == OstProto::Ip4::e_im_inc_host)
+        dstIpCount = ip4->dst_ip_count();
+
+    frameLen = stream->frameValue(frame, sizeof(frame), 0);
+    if (frameLen >= 18 && (qFromBigEndian<quint16>(frame + 12) == 0x8100)) {
+        vlanTag = qFromBigEndian<quint16>(frame + 14);
+        l3 = 18;
+    }
+    if ((frameLen < (l3 + 28))
+            || (qFromBigEndian<quint16>(frame + l3 - 2) != 0x0800)
+            || (frame[l3] != 0x45) || (frame[l3 + 9] != 17)) {
+        reason = "not a plain Ethernet/IPv4/UDP frame";
+        return false;
+    }
+    srcIp = qFromBigEndian<quint32>(frame + l3 + 12);
+    dstIp = qFromBigEndian<quint32>(frame + l3 + 16);
+    srcPort = qFromBigEndian<quint16>(frame + l3 + 20);
+    dstPort = qFromBigEndian<quint16>(frame + l3 + 22);
+
+    // A stream that isn't the last one (the only one) is sent again and
+    // again - like a continuous one
+    if ((stream->sendMode() == StreamBase::e_sm_continuous)
+            || (stream->nextWhat() != StreamBase::e_nw_stop))
+        count = 0; // till stopped
+    else {
+        count = isBursts ? quint64(stream->numBursts())*stream->burstSize()
+                         : stream->numPackets();
+        if (!count) {
+            reason = "no packets to send";
+            return false;
+        }
+    }
+
+    rate = isBursts ? stream->burstRate() : stream->packetRate();
+    if (rate <= 0) {
+        reason = "rate is 0";
+        return false;
+    }
+    if (load > 0)
+        delay = quint64(1e9/(rate*load));
+
+    commands.clear();
+    commands.append(QString("count %1").arg(count));
+    commands.append(QString("clone_skb %1")
+            .arg(stream->frameVariableCount() > 1 ? 0 : kCloneSkb));
+    commands.append(QString("pkt_size %1").arg(frameLen));
+    commands.append(QString("delay %1").arg(delay));
+    commands.append(QString("burst %1").arg(isBursts ?
+                                            stream->burstSize() : 1));
+    commands.append(QString("dst_mac %1").arg(macString(frame)));
+    commands.append(QString("src_mac %1").arg(macString(frame + 6)));
+    commands.append(QString("dst_mac_count %1").arg(
+            mac->dst_mac_mode() == OstProto::Mac::e_mm_inc ?
+                mac->dst_mac_count() : 0));
+    commands.append(QString("src_mac_count %1").arg(
+            mac->src_mac_mode() == OstProto::Mac::e_mm_inc ?
+                mac->src_mac_count() : 0));
+    commands.append(QString("dst_min %1").arg(ipString(dstIp)));
+    commands.append(QString("dst_max %1").arg(
+                ipString(dstIp + dstIpCount - 1)));
+    commands.append(QString("src_min %1").arg(ipString(srcIp)));
+    commands.append(QString("src_max %1").arg(
+                ipString(srcIp + srcIpCount - 1)));
+    commands.append(QString("tos %1").arg(frame[l3 + 1], 2, 16, QChar('0')));
+    commands.append(QString("udp_src_min %1").arg(srcPort));
+    commands.append(QString("udp_src_max %1").arg(
+                srcPort + srcPortCount - 1));
+    commands.append(QString("udp_dst_min %1").arg(dstPort));
+    commands.append(QString("udp_dst_max %1").arg(
+                dstPort + dstPortCount - 1));
+    if (vlanTag >= 0) {
+        commands.append(QString("vlan_id %1").arg(vlanTag & 0xfff));
+        commands.append(QString("vlan_p %1").arg(vlanTag >> 13));
+        commands.append(QString("vlan_cfi %1").arg((vlanTag >> 12) & 1));
+    }
+    else
+        commands.append("vlan_id 65535"); // none
+
+    return true;
+}
+
+// One command per write - pktgen rejects a bad one with an error
+bool PktgenTransmitter::write(const QString &fileName, const QString &command)
+{
+    QByteArray file = QFile::encodeName(fileName);
+    QByteArray data = command.toAscii();
+    int fd = ::open(file.constData(), O_WRONLY);
+    bool ok;
+
+    if (fd < 0) {
+        qWarning("pktgen: unable to open %s: %s", file.constData(),
+                strerror(errno));
+        return false;
+    }
+
+    ok = (::write(fd, data.constData(), data.size()) == data.size());
+    if (!ok)
+        qWarning("pktgen: %s: '%s' failed: %s", file.constData(),
+                data.constData(), strerror(errno));
+    ::close(fd);
+
+    return ok;
+}
+
+// Packets sent so far and (once done) the run time, from our device
+bool PktgenTransmitter::readCounters(quint64 *pkts, quint64 *usecs)
+{
+    QFile file(kPktgenDir + pktgenDevice_);
+    QRegExp sofar("pkts-sofar:\\s*(\\d+)");
+    QRegExp result("Result: OK:\\s*(\\d+)");
+    QString status;
+
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+    status = QString(file.readAll());
+
+    if (sofar.indexIn(status) < 0)
+        return false;
+    *pkts = sofar.cap(1).toULongLong();
+    if (result.indexIn(status) >= 0)
+        *usecs = result.cap(1).toULongLong();
+
+    return true;
+}
+
+#endif
@@ -0,0 +1,107 @@
+/*
+Copyright (C) 2017 Srivats P.
+
+
+This file is part of "Ostinato"
+
+This is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+
+#ifndef _SERVER_PKTGEN_TRANSMITTER_H
+#define _SERVER_PKTGEN_TRANSMITTER_H
+
+#include <QtGlobal>
+
+#ifdef Q_OS_LINUX
+
+#include "streamstats.h"
+
+#include <QHash>
+#include <QMutex>
+#include <QString>
+#include <QStringList>
+#include <QThread>
+
+class StreamBase;
+
+/*!
+  Sends a stream with the kernel's packet generator (pktgen - see the
+  kernel's Documentation/networking/pktgen.rst) instead of a transmitter
+  of ours - a fixed frame flood at line rate with hardly any CPU
+
+  Only a stream of Ethernet [+ VLAN] + IPv4 + UDP [+ payload] with a fixed
+  frame length, a fixed gap and no tracking can be sent - the MACs and IP
+  addresses may increment (step 1, as pktgen's ranges do) and the UDP
+  ports too, via variable fields. pktgen fills in the payload (its own
+  header), the IP id and the TTL itself - so those differ from the
+  stream's frames
+
+  pktgen starts and stops all its devices together - so only one port at
+  a time sends with pktgen; the thread blocks in pktgen's start till the
+  run is done or stopped
+*/
+class PktgenTransmitter : public QThread
+{
+public:
+    PktgenTransmitter(const char *device);
+    ~PktgenTransmitter();
+
+    static bool isAvailable();
+
+    // Starts sending the stream from pktgen's kernel thread of cpu; load
+    // scales the stream rate, 0 => as fast as possible. On failure (the
+    // stream can't be sent by pktgen or another port is using it), reason
+    // says why
+    bool start(const StreamBase *stream, int cpu, double load,
+               QString &reason);
+    void stop();
+
+    // Of the current run if any, else of the last one
+    void runStats(quint64 *pkts, quint64 *bytes, quint64 *nsec);
+    // Tx of each stream sent, across runs
+    void addStreamStats(quint32 portId, StreamStatsHash &stats);
+
+protected:
+    void run();
+
+private:
+    static bool streamCommands(const StreamBase *stream, double load,
+                               QStringList &commands, int &frameLen,
+                               QString &reason);
+    static bool write(const QString &fileName, const QString &command);
+    bool readCounters(quint64 *pkts, quint64 *usecs);
+
+    QString device_;
+    QString pktgenDevice_; // device_@ost - ours, not the user's devices
+    QString threadFile_;   // kpktgend_<cpu> that runs it
+    uint streamId_;
+    int frameLen_;
+
+    QMutex statsLock_;
+    bool isLive_; // counters are read from pktgen
+    quint64 runPkts_;
+    quint64 runUsecs_;
+    QHash<uint, quint64> streamPkts_; // of the runs done
+
+    static QMutex activeLock_;
+    static PktgenTransmitter *active_;
+
+    // Copies of a frame sent when nothing in it varies
+    static const int kCloneSkb = 1000;
+};
+
+#endif
+
+#endif
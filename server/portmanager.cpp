@@ -20,10 +20,13 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 #include "portmanager.h"
 
 #include "bsdport.h"
+#include "dpdkport.h"
 #include "linuxport.h"
 #include "pcapport.h"
 #include "settings.h"
+#include "virtualport.h"
 #include "winpcapport.h"
+#include "xdpport.h"
 
 #include <QStringList>
 #include <pcap.h>
@@ -44,6 +47,10 @@ PortManager::PortManager()
         qDebug("Error in pcap_findalldevs_ex: %s\n", errbuf);
 
     txRateAccuracy = rateAccuracy();
+    loadPortFilter();
+#ifdef HAVE_AF_XDP
+    bool useAfXdp = appSettings->value(kAfXdpKey, kAfXdpDefaultValue).toBool();
+#endif
 
     for(device = deviceList, i = 0; device != NULL; device = device->next, i++)
     {
@@ -68,6 +75,11 @@ PortManager::PortManager()
 #if defined(Q_OS_WIN32)
         port = new WinPcapPort(i, device->name);
 #elif defined(Q_OS_LINUX)
+#ifdef HAVE_AF_XDP
+        if (useAfXdp && XdpPort::isSupported(device->name))
+            port = new XdpPort(i, device->name);
+        else
+#endif
         port = new LinuxPort(i, device->name);
 #elif defined(Q_OS_BSD4)
         port = new BsdPort(i, device->name);
@@ -92,6 +104,57 @@ PortManager::PortManager()
 
     pcap_freealldevs(deviceList);
 
+#ifdef HAVE_DPDK
+    // NICs bound to DPDK are not seen by pcap - add them after pcap ports
+    if (DpdkPort::initEal()) {
+        foreach(quint16 dpdkPortId, DpdkPort::dpdkPortIds()) {
+            QString name = DpdkPort::dpdkPortName(dpdkPortId);
+            AbstractPort *port;
+
+            if (!filterAcceptsPort(qPrintable(name))) {
+                qDebug("%s rejected by filter. Skipping!", qPrintable(name));
+                continue;
+            }
+
+            port = new DpdkPort(portList_.size(), dpdkPortId);
+            if (!port->isUsable()) {
+                qDebug("%s: unable to setup DPDK port %s. Skipping!",
+                        __FUNCTION__, qPrintable(name));
+                delete port;
+                continue;
+            }
+
+            if (!port->setRateAccuracy(txRateAccuracy))
+                qWarning("failed to set rateAccuracy (%d)", txRateAccuracy);
+
+            portList_.append(port);
+        }
+    }
+#endif
+
+    // Virtual ports, if any, are last so that they don't renumber NICs
+    int nullPorts = appSettings->value(kVirtualPortsNullKey,
+                            kVirtualPortsNullDefaultValue).toInt();
+    for (i = 0; i < nullPorts; i++) {
+        AbstractPort *port = new VirtualPort(portList_.size(),
+                qPrintable(QString("null%1").arg(i)), VirtualPort::kNullSink);
+
+        if (!port->setRateAccuracy(txRateAccuracy))
+            qWarning("failed to set rateAccuracy (%d)", txRateAccuracy);
+        portList_.append(port);
+    }
+    i = 0;
+    foreach(QString fileName,
+            appSettings->value(kVirtualPortsPcapFilesKey).toStringList()) {
+        AbstractPort *port = new VirtualPort(portList_.size(),
+                qPrintable(QString("pcapfile%1").arg(i++)),
+                VirtualPort::kPcapFileSink, fileName);
+
+        if (!port->setRateAccuracy(txRateAccuracy))
+            qWarning("failed to set rateAccuracy (%d)", txRateAccuracy);
+        portList_.append(port);
+    }
+
     foreach(AbstractPort *port, portList_)
         port->init();
     
@@ -118,6 +181,8 @@ AbstractPort::Accuracy PortManager::rateAccuracy()
                                   kRateAccuracyDefaultValue).toString();
     if (rateAccuracy == "High")
         return AbstractPort::kHighAccuracy;
+    else if (rateAccuracy == "Medium")
+        return AbstractPort::kMediumAccuracy;
     else if (rateAccuracy == "Low")
         return AbstractPort::kLowAccuracy;
     else
@@ -127,26 +192,36 @@ AbstractPort::Accuracy PortManager::rateAccuracy()
     return AbstractPort::kHighAccuracy;
 }
 
-bool PortManager::filterAcceptsPort(const char *name)
+void PortManager::loadPortFilter()
 {
-    QRegExp pattern;
     QStringList includeList = appSettings->value(kPortListIncludeKey)
                                     .toStringList();
     QStringList excludeList = appSettings->value(kPortListExcludeKey)
                                     .toStringList();
 
-    pattern.setPatternSyntax(QRegExp::Wildcard);
-
     // An empty (or missing) includeList accepts all ports
     // NOTE: A blank "IncludeList=" is read as a stringlist with one
     // string which is empty => treat it same as an empty stringlist
-    if (includeList.isEmpty()
-            || (includeList.size() == 1 && includeList.at(0).isEmpty()))
+    foreach (QString str, includeList) {
+        if (!str.isEmpty())
+            includePatterns_.append(QRegExp(str, Qt::CaseSensitive,
+                                            QRegExp::Wildcard));
+    }
+
+    foreach (QString str, excludeList)
+        excludePatterns_.append(QRegExp(str, Qt::CaseSensitive,
+                                        QRegExp::Wildcard));
+}
+
+bool PortManager::filterAcceptsPort(const char *name)
+{
+    QString portName = QString::fromLocal8Bit(name);
+
+    if (includePatterns_.isEmpty())
         goto _include_pass;
 
-    foreach (QString str, includeList) {
-        pattern.setPattern(str);
-        if (pattern.exactMatch(name))
+    foreach (const QRegExp &pattern, includePatterns_) {
+        if (pattern.exactMatch(portName))
             goto _include_pass;
     }
 
@@ -154,9 +229,8 @@ bool PortManager::filterAcceptsPort(const char *name)
     return false;
 
 _include_pass:
-    foreach (QString str, excludeList) {
-        pattern.setPattern(str);
-        if (pattern.exactMatch(name))
+    foreach (const QRegExp &pattern, excludePatterns_) {
+        if (pattern.exactMatch(portName))
             return false;
     }
 
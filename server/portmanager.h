@@ -21,6 +21,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 #define _SERVER_PORT_MANAGER_H
 
 #include <QList>
+#include <QRegExp>
 #include "abstractport.h"
 
 class PortManager
@@ -36,10 +37,14 @@ public:
 
 private:
     AbstractPort::Accuracy rateAccuracy();
+    void loadPortFilter();
     bool filterAcceptsPort(const char *name);
 
 private:
     QList<AbstractPort*>    portList_;
+    // PortList Include/Exclude patterns - parsed once, not per interface
+    QList<QRegExp>          includePatterns_;
+    QList<QRegExp>          excludePatterns_;
 
     static PortManager      *instance_;
 };
@@ -0,0 +1,93 @@
+/*
+Copyright (C) 2017 Srivats P.
+
+
+This file is part of "Ostinato"
+
+This is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+
+#include "ratemeter.h"
+
+#include "settings.h"
+
+#include <math.h>
+
+/*!
+  windowMsec < 0 => use the RateWindow setting
+*/
+RateMeter::RateMeter(int intervalMsec, int windowMsec)
+{
+    if (windowMsec < 0)
+        windowMsec = appSettings ?
+            appSettings->value(kRateWindowKey, kRateWindowDefaultValue).toInt()
+            : kRateWindowDefaultValue;
+
+    interval_ = double(intervalMsec)*1e6;
+    window_ = double(qMax(windowMsec, 1))*1e6;
+    reset();
+}
+
+void RateMeter::update(quint64 pkts, quint64 bytes)
+{
+    TimeStamp now;
+    qint64 nsecs = 0;
+
+    getTimeStamp(&now);
+    if (isStarted_)
+        nsecs = ndiffTimeStamp(&lastTs_, &now);
+    lastTs_ = now;
+
+    if (!isStarted_) {
+        isStarted_ = true;
+        return;
+    }
+
+    update(pkts, bytes, nsecs > 0 ? nsecs : qint64(interval_));
+}
+
+/*!
+  Updates with a count over an interval measured by the caller
+*/
+void RateMeter::update(quint64 pkts, quint64 bytes, qint64 nsecs)
+{
+    if (nsecs <= 0)
+        return;
+
+    // Nothing at all over the interval - show it right away instead of
+    // decaying towards zero
+    if (!pkts) {
+        pps_ = bps_ = 0;
+        return;
+    }
+
+    double pps = double(pkts)*1e9/nsecs;
+    double bps = double(bytes)*1e9/nsecs;
+
+    if (pps_) {
+        // alpha for a time based EWMA - the weight of a sample grows with
+        // the time it covers, so the smoothing is independent of how
+        // often the rate is updated
+        double alpha = 1 - exp(-double(nsecs)/window_);
+
+        pps_ += alpha*(pps - pps_);
+        bps_ += alpha*(bps - bps_);
+    }
+    else {
+        // Start from the first sample instead of ramping up from zero
+        pps_ = pps;
+        bps_ = bps;
+    }
+}
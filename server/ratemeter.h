@@ -0,0 +1,66 @@
+/*
+Copyright (C) 2017 Srivats P.
+
+
+This file is part of "Ostinato"
+
+This is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+
+#ifndef _RATE_METER_H
+#define _RATE_METER_H
+
+#include "timestamp.h"
+
+#include <QtGlobal>
+
+/*!
+  Measures the packet and byte rate of a counter pair as an exponentially
+  weighted moving average (EWMA) over a time window
+
+  Each update() is the count since the previous update - the caller takes
+  care of counter wrap arounds - and is weighted by the actual (monotonic
+  clock) time between the updates rather than the nominal update interval,
+  so a late or early update doesn't skew the rate. The nominal interval is
+  used only on platforms with no high resolution timestamps. Backends that
+  have their own timestamps for the counts use the update() overload that
+  takes the interval instead
+
+  Rates are not updated from the first update after construction or
+  reset() since the count it reports is not over a known interval
+*/
+class RateMeter
+{
+public:
+    RateMeter(int intervalMsec = 1000, int windowMsec = -1);
+
+    void reset() { isStarted_ = false; pps_ = bps_ = 0; }
+
+    void update(quint64 pkts, quint64 bytes);
+    void update(quint64 pkts, quint64 bytes, qint64 nsecs);
+
+    quint64 pps() const { return quint64(pps_ + 0.5); }
+    quint64 bps() const { return quint64(bps_ + 0.5); }
+
+private:
+    bool isStarted_;
+    TimeStamp lastTs_;
+    double interval_;   // nsecs
+    double window_;     // nsecs
+    double pps_;
+    double bps_;
+};
+
+#endif
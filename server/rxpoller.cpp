@@ -0,0 +1,206 @@
+/*
+Copyright (C) 2017 Srivats P.
+
+
+This file is part of "Ostinato"
+
+This is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+
+
+#include "rxpoller.h"
+
+#ifdef Q_OS_LINUX
+
+#include <QMutexLocker>
+
+#include <errno.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+QMutex RxPoller::instancesLock_;
+QHash<int, RxPoller*> RxPoller::instances_;
+
+/*!
+  Returns the poller of numaNode (-1 => not known) - created on first use
+  and never deleted
+*/
+RxPoller* RxPoller::instance(int numaNode)
+{
+    QMutexLocker locker(&instancesLock_);
+    RxPoller *poller = instances_.value(numaNode);
+
+    if (!poller) {
+        poller = new RxPoller(numaNode);
+        instances_.insert(numaNode, poller);
+    }
+
+    return poller;
+}
+
+RxPoller::RxPoller(int numaNode)
+    : placer_(QString("rx-poller%1").arg(qMax(numaNode, 0)))
+{
+    struct epoll_event event;
+
+    stop_ = false;
+    busy_ = NULL;
+
+    if (numaNode >= 0) {
+        OstProto::ThreadPlacement placement;
+
+        placement.set_numa_node(numaNode);
+        placer_.setPlacement(placement);
+    }
+
+    epollFd_ = epoll_create(kMaxEvents);
+    if (epollFd_ < 0)
+        qWarning("rx poller: epoll_create failed (%s)", strerror(errno));
+
+    wakeupFd_ = eventfd(0, 0);
+    if (wakeupFd_ < 0) {
+        qWarning("rx poller: eventfd failed (%s)", strerror(errno));
+        return;
+    }
+
+    // A NULL client marks the wakeup
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.ptr = NULL;
+    if ((epollFd_ >= 0)
+            && (epoll_ctl(epollFd_, EPOLL_CTL_ADD, wakeupFd_, &event) < 0))
+        qWarning("rx poller: unable to poll eventfd (%s)", strerror(errno));
+}
+
+/*!
+  Starts polling client's fd; returns false if it can't be polled, in
+  which case the caller must service the fd by itself
+*/
+bool RxPoller::add(Client *client)
+{
+    QMutexLocker control(&controlLock_);
+    struct epoll_event event;
+
+    if ((epollFd_ < 0) || (wakeupFd_ < 0))
+        return false;
+
+    lock_.lock();
+    clients_.insert(client);
+    lock_.unlock();
+
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.ptr = client;
+    if (epoll_ctl(epollFd_, EPOLL_CTL_ADD, client->rxPollFd(), &event) < 0) {
+        qWarning("rx poller: unable to poll fd %d (%s)", client->rxPollFd(),
+                strerror(errno));
+        lock_.lock();
+        clients_.remove(client);
+        lock_.unlock();
+        return false;
+    }
+
+    if (!isRunning()) {
+        stop_ = false;
+        start();
+    }
+
+    return true;
+}
+
+/*!
+  Stops polling client's fd - once this returns, client's rxPollReady() is
+  not running and won't be called again; must not be called from the
+  poller thread
+*/
+void RxPoller::remove(Client *client)
+{
+    QMutexLocker control(&controlLock_);
+    bool isEmpty;
+
+    Q_ASSERT(QThread::currentThread() != this);
+
+    if (epoll_ctl(epollFd_, EPOLL_CTL_DEL, client->rxPollFd(), NULL) < 0)
+        qDebug("rx poller: unable to remove fd %d (%s)", client->rxPollFd(),
+                strerror(errno));
+
+    lock_.lock();
+    clients_.remove(client);
+    while (busy_ == client)
+        idle_.wait(&lock_);
+    isEmpty = clients_.isEmpty();
+    lock_.unlock();
+
+    if (isEmpty && isRunning()) {
+        quint64 one = 1;
+
+        stop_ = true;
+        if (write(wakeupFd_, &one, sizeof(one)) < 0)
+            qWarning("rx poller: wakeup failed (%s)", strerror(errno));
+        wait();
+    }
+}
+
+void RxPoller::run()
+{
+    ThreadPlacer::Scope placement(placer_);
+    struct epoll_event events[kMaxEvents];
+
+    qDebug("In %s", __PRETTY_FUNCTION__);
+
+    while (!stop_) {
+        int count = epoll_wait(epollFd_, events, kMaxEvents, -1);
+
+        if (count < 0) {
+            if (errno == EINTR)
+                continue;
+            qWarning("rx poller: epoll_wait failed (%s)", strerror(errno));
+            break;
+        }
+
+        for (int i = 0; i < count; i++) {
+            Client *client = (Client*) events[i].data.ptr;
+
+            if (!client) {
+                quint64 value;
+
+                if (read(wakeupFd_, &value, sizeof(value)) < 0)
+                    qDebug("rx poller: eventfd read failed (%s)",
+                            strerror(errno));
+                continue;
+            }
+
+            // Removed after epoll_wait() returned?
+            lock_.lock();
+            if (!clients_.contains(client)) {
+                lock_.unlock();
+                continue;
+            }
+            busy_ = client;
+            lock_.unlock();
+
+            client->rxPollReady();
+
+            lock_.lock();
+            busy_ = NULL;
+            idle_.wakeAll();
+            lock_.unlock();
+        }
+    }
+}
+
+#endif
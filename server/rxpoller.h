@@ -0,0 +1,91 @@
+/*
+Copyright (C) 2017 Srivats P.
+
+
+This file is part of "Ostinato"
+
+This is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+
+
+#ifndef _RX_POLLER_H
+#define _RX_POLLER_H
+
+#include <QtGlobal>
+
+#ifdef Q_OS_LINUX
+
+#include "threadplacer.h"
+
+#include <QHash>
+#include <QMutex>
+#include <QSet>
+#include <QThread>
+#include <QWaitCondition>
+
+/*!
+  One thread per NUMA node that services the rx fds (PACKET_RX_RING
+  sockets) of all the ports on that node via epoll - instead of a thread
+  per port per purpose, most of which sleep most of the time
+
+  A client's rxPollReady() is called (in the poller thread) when its fd is
+  readable; it must handle what's ready without blocking - and no more
+  than a bounded amount of it, so that the other clients aren't starved.
+  The fd is level triggered, so anything left is seen on the next wakeup
+
+  The thread runs only while it has clients
+*/
+class RxPoller : public QThread
+{
+public:
+    class Client
+    {
+    public:
+        virtual ~Client() {}
+        virtual int rxPollFd() = 0;
+        virtual void rxPollReady() = 0;
+    };
+
+    static RxPoller* instance(int numaNode);
+
+    bool add(Client *client);
+    void remove(Client *client);
+
+protected:
+    void run();
+
+private:
+    RxPoller(int numaNode);
+
+    static const int kMaxEvents = 64;
+
+    int epollFd_;
+    int wakeupFd_;          // eventfd - to see stop_ without a timeout
+    volatile bool stop_;
+    ThreadPlacer placer_;
+
+    QMutex controlLock_;    // serializes add()/remove() and so start/stop
+    QMutex lock_;           // for clients_ and busy_
+    QWaitCondition idle_;   // busy_ has changed
+    QSet<Client*> clients_;
+    Client *busy_;          // whose rxPollReady() is running, if any
+
+    static QMutex instancesLock_;
+    static QHash<int, RxPoller*> instances_;
+};
+
+#endif
+
+#endif
@@ -0,0 +1,82 @@
+/*
+Copyright (C) 2017 Srivats P.
+
+
+This file is part of "Ostinato"
+
+This is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+
+#ifndef _SEQ_LOCK_H
+#define _SEQ_LOCK_H
+
+#include <QtGlobal>
+
+// x86 doesn't reorder stores with stores or loads with loads, so only
+// the compiler needs to be kept from doing so
+#if defined(__i386__) || defined(__x86_64__)
+#define seqLockBarrier() asm volatile("" ::: "memory")
+#else
+#define seqLockBarrier() __sync_synchronize()
+#endif
+
+/*!
+  Sequence lock for data that one thread writes and others read - the
+  writer never waits (an update is two plain stores more) and a reader
+  retries if the data changed while it was reading it
+
+    lock.writeBegin(); ... update ...; lock.writeEnd();
+
+    int retries = 0;
+    do {
+        seq = lock.readBegin(); ... copy ...
+    } while (lock.readRetry(seq, &retries));
+
+  The writer must be just one thread. If there is a second one, an odd
+  sequence may persist - so a reader gives up after kMaxReadRetries and
+  keeps what it read, which is no worse than no lock at all
+*/
+class SeqLock
+{
+public:
+    SeqLock() : seq_(0) {}
+
+    void writeBegin() {
+        seq_ = seq_ + 1;
+        seqLockBarrier();
+    }
+    void writeEnd() {
+        seqLockBarrier();
+        seq_ = seq_ + 1;
+    }
+
+    uint readBegin() const {
+        uint seq = seq_;
+        seqLockBarrier();
+        return seq;
+    }
+    bool readRetry(uint seq, int *retries) const {
+        seqLockBarrier();
+        return ((seq & 1) || (seq_ != seq))
+                    && ((*retries)++ < kMaxReadRetries);
+    }
+
+    static const int kMaxReadRetries = 64;
+
+private:
+    volatile uint seq_;
+};
+
+#endif
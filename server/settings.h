@@ -30,11 +30,78 @@ extern QSettings *appSettings;
 //
 const QString kRateAccuracyKey("RateAccuracy");
 const QString kRateAccuracyDefaultValue("High");
+const QString kTxWorkersKey("TxWorkers");
+const int kTxWorkersDefaultValue = 1;
+// Paced ports (of one tx worker) are sent by one thread for all, instead
+// of a thread each - for many low rate ports; see TxScheduler
+const QString kSharedTransmitKey("SharedTransmit");
+const bool kSharedTransmitDefaultValue = false;
+// Linux only - Auto (TX_RING, else sendmmsg), TxRing, Sendmmsg or Pcap
+// (pcap_sendpacket); AF_XDP is selected by kAfXdpKey
+const QString kTxEngineKey("TxEngine");
+const QString kTxEngineDefaultValue("Auto");
+const QString kAfXdpKey("AfXdp");
+const bool kAfXdpDefaultValue = false;
+// Linux only - TX_RING frames skip the qdisc (PACKET_QDISC_BYPASS); such
+// frames aren't seen by a capture on the same port either
+const QString kTxQdiscBypassKey("TxQdiscBypass");
+const bool kTxQdiscBypassDefaultValue = false;
+const QString kStreamStatsKey("StreamStats");
+const bool kStreamStatsDefaultValue = false;
+// Linux only - count the rx stream stats in the kernel (eBPF); no
+// sequence/latency stats then, see BpfStreamStats
+const QString kStreamStatsInKernelKey("StreamStatsInKernel");
+const bool kStreamStatsInKernelDefaultValue = false;
+// Linux only - NIC tx timestamps (if the NIC can) to correct the rx
+// latency of tracked streams; changes the NIC's timestamping config
+const QString kHwTxTimestampsKey("HwTxTimestamps");
+const bool kHwTxTimestampsDefaultValue = false;
+// Linux only - PTP hardware clock (e.g. /dev/ptp0, synced by ptp4l) that
+// stream latency timestamps are taken in; empty => system clock plus the
+// offset set via the setClockOffset RPC
+const QString kPtpClockKey("PtpClock");
+const QString kPtpClockDefaultValue("");
+// Linux only - a port's only stream is sent by the kernel's pktgen instead,
+// if pktgen can send it (see PktgenTransmitter)
+const QString kPktgenOffloadKey("PktgenOffload");
+const bool kPktgenOffloadDefaultValue = false;
+const QString kRateWindowKey("RateWindow"); // msecs
+const int kRateWindowDefaultValue = 2000;
+const QString kStatsIntervalKey("StatsInterval"); // msecs
+const int kStatsIntervalDefaultValue = 1000;
+const QString kNicCountersKey("NicCounters");
+const bool kNicCountersDefaultValue = false;
+const QString kTraceBufferKey("TraceBuffer");
+const bool kTraceBufferDefaultValue = true;
+// Memory (MB) for the packet lists of a port and of all ports together -
+// see AbstractPort::setPacketListBudget(); port: 0 => no limit, total:
+// 0 => half the physical memory, -1 => no limit
+const QString kPacketListPortBudgetKey("PacketListPortBudget");
+const int kPacketListPortBudgetDefaultValue = 0;
+const QString kPacketListTotalBudgetKey("PacketListTotalBudget");
+const int kPacketListTotalBudgetDefaultValue = 0;
+// Directory to persist built frames in across restarts - see
+// FrameSetStore; empty => not persisted. Max size is in MB
+const QString kPacketListCacheDirKey("PacketListCacheDir");
+const QString kPacketListCacheDirDefaultValue("");
+const QString kPacketListCacheMaxSizeKey("PacketListCacheMaxSize");
+const int kPacketListCacheMaxSizeDefaultValue = 4096;
+// Keep only the serialized config of a stream's protocols once its frames
+// are built - less memory for very many streams, see StreamBase::compact()
+const QString kCompactStreamsKey("CompactStreams");
+const bool kCompactStreamsDefaultValue = false;
 
 //
 // RpcServer Section Keys
 //
 const QString kRpcServerAddress("RpcServer/Address");
+const QString kRpcServerIoThreadsKey("RpcServer/IoThreads");
+const int kRpcServerIoThreadsDefaultValue = 0; // based on CPUs
+const QString kRpcServerWorkerThreadsKey("RpcServer/WorkerThreads");
+const int kRpcServerWorkerThreadsDefaultValue = 0; // based on CPUs
+// AF_UNIX socket (named pipe on Windows) for local clients; empty => none
+const QString kRpcServerLocalSocketKey("RpcServer/LocalSocket");
+const QString kRpcServerLocalSocketDefaultValue("");
 
 //
 // PortList Section Keys
@@ -42,4 +109,91 @@ const QString kRpcServerAddress("RpcServer/Address");
 const QString kPortListIncludeKey("PortList/Include");
 const QString kPortListExcludeKey("PortList/Exclude");
 
+//
+// VirtualPorts Section Keys
+//
+// Ports with no NIC (see VirtualPort) - Null is the count of ports that
+// discard what they send; PcapFiles is a list of pcap files, each written
+// by a port of its own. Not subject to the PortList filters
+const QString kVirtualPortsNullKey("VirtualPorts/Null");
+const int kVirtualPortsNullDefaultValue = 0;
+const QString kVirtualPortsPcapFilesKey("VirtualPorts/PcapFiles");
+
+//
+// DeviceEmulation Section Keys
+//
+const QString kNeighborResolveRateKey(
+        "DeviceEmulation/NeighborResolveRate"); // requests/sec
+const int kNeighborResolveRateDefaultValue = 1000;
+const QString kNeighborResolveRetriesKey(
+        "DeviceEmulation/NeighborResolveRetries");
+const int kNeighborResolveRetriesDefaultValue = 3;
+const QString kNeighborResolveTimeoutKey(
+        "DeviceEmulation/NeighborResolveTimeout"); // msecs, doubled per retry
+const int kNeighborResolveTimeoutDefaultValue = 1000;
+const QString kNeighborRefreshKey(
+        "DeviceEmulation/NeighborRefresh"); // msecs, 0 => never
+const int kNeighborRefreshDefaultValue = 0;
+const QString kMcastReportRateKey(
+        "DeviceEmulation/McastReportRate"); // IGMP/MLD packets/sec
+const int kMcastReportRateDefaultValue = 1000;
+const QString kDhcpRateKey(
+        "DeviceEmulation/DhcpRate"); // DHCP client messages/sec
+const int kDhcpRateDefaultValue = 1000;
+const QString kDhcpRetriesKey("DeviceEmulation/DhcpRetries");
+const int kDhcpRetriesDefaultValue = 3;
+const QString kDhcpTimeoutKey(
+        "DeviceEmulation/DhcpTimeout"); // msecs, doubled per retry
+const int kDhcpTimeoutDefaultValue = 2000;
+// Threads the received frames of a port's devices are handled in - the
+// devices are split into as many shards (see DeviceManager); 1 => the
+// receive thread handles them all itself
+const QString kEmulationWorkersKey("DeviceEmulation/Workers");
+const int kEmulationWorkersDefaultValue = 1;
+// Devices answer TCP SYNs (to any port) with a SYN-ACK - see
+// Device::receiveTcp()
+const QString kTcpResponderKey("DeviceEmulation/TcpResponder");
+const bool kTcpResponderDefaultValue = false;
+
+//
+// PcapRx Section Keys
+//
+// Defaults of each port's OstProto::PcapRx - the only config of the rx
+// monitor's pcap handle. BufferSize is in KB, 0 => libpcap's default;
+// TpacketVersion 0 => libpcap's choice
+const QString kPcapRxBufferSizeKey("PcapRx/BufferSize");
+const uint kPcapRxBufferSizeDefaultValue = 0;
+const QString kPcapRxImmediateModeKey("PcapRx/ImmediateMode");
+const bool kPcapRxImmediateModeDefaultValue = false;
+const QString kPcapRxTpacketVersionKey("PcapRx/TpacketVersion");
+const uint kPcapRxTpacketVersionDefaultValue = 0;
+const QString kPcapRxDispatchBatchKey("PcapRx/DispatchBatch");
+const uint kPcapRxDispatchBatchDefaultValue = 64;
+
+//
+// StatsExport Section Keys
+//
+// Name of the shared memory segment to publish the stats in (see
+// StatsExporter) - e.g. ostinato-stats; empty => not published
+const QString kStatsExportShmKey("StatsExport/SharedMemory");
+const QString kStatsExportShmDefaultValue("");
+const QString kStatsExportIntervalKey("StatsExport/Interval"); // msecs
+const int kStatsExportIntervalDefaultValue = 1000;
+const QString kStatsExportMaxStreamsKey("StatsExport/MaxStreams");
+const int kStatsExportMaxStreamsDefaultValue = 4096;
+// Samples of each port's stats kept - one a second - for getStatsHistory
+// (see StatsHistory); 0 => none
+const QString kStatsHistorySizeKey("StatsExport/HistorySize");
+const int kStatsHistorySizeDefaultValue = 300;
+// Streams (per port) of each sample - the rest are left out
+const QString kStatsHistoryMaxStreamsKey("StatsExport/HistoryMaxStreams");
+const int kStatsHistoryMaxStreamsDefaultValue = 256;
+
+//
+// Dpdk Section Keys
+//
+const QString kDpdkEalArgsKey("Dpdk/EalArgs");
+const QString kDpdkMbufCountKey("Dpdk/MbufCount");
+const uint kDpdkMbufCountDefaultValue = 65535;
+
 #endif
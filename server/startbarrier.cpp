@@ -0,0 +1,131 @@
+/*
+Copyright (C) 2017 Srivats P.
+
+
+This file is part of "Ostinato"
+
+This is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+
+#include "startbarrier.h"
+
+#include <QDateTime>
+
+#if defined(Q_OS_UNIX)
+#include <time.h>
+#endif
+
+StartBarrier::StartBarrier(quint64 releaseNsec)
+{
+    parties_ = 0;
+    arrived_ = 0;
+    isSealed_ = false;
+    isReleased_ = false;
+    releaseNsec_ = releaseNsec;
+}
+
+void StartBarrier::addParty()
+{
+    QMutexLocker locker(&lock_);
+
+    Q_ASSERT(!isSealed_);
+    parties_++;
+}
+
+void StartBarrier::seal()
+{
+    QMutexLocker locker(&lock_);
+
+    isSealed_ = true;
+    releaseIfComplete();
+}
+
+bool StartBarrier::wait(volatile bool *stop)
+{
+    QMutexLocker locker(&lock_);
+
+    arrived_++;
+    releaseIfComplete();
+
+    // Wait for the others (and till close to the release time) ...
+    forever {
+        if (*stop) {
+            arrived_--;
+            parties_--;
+            releaseIfComplete();
+            return false;
+        }
+
+        if (isReleased_) {
+            qint64 remaining = releaseNsec_ - realtimeNsec();
+
+            if (remaining <= kSpinNsec)
+                break;
+            complete_.wait(&lock_,
+                    qMin(qint64(kPollMsec), (remaining - kSpinNsec)/1000000));
+        }
+        else
+            complete_.wait(&lock_, kPollMsec);
+    }
+    locker.unlock();
+
+    // ... and then spin till the release time
+    while (realtimeNsec() < releaseNsec_) {
+        if (*stop)
+            return false;
+    }
+
+    return true;
+}
+
+void StartBarrier::leave()
+{
+    QMutexLocker locker(&lock_);
+
+    parties_--;
+    releaseIfComplete();
+}
+
+void StartBarrier::releaseIfComplete()
+{
+    if (isReleased_ || !isComplete())
+        return;
+
+    quint64 now = realtimeNsec();
+
+    if (!releaseNsec_)
+        releaseNsec_ = now + kReleaseMarginNsec;
+    else if (releaseNsec_ < now)
+        qWarning("start barrier: release time is %llu nsecs in the past",
+                (unsigned long long)(now - releaseNsec_));
+
+    qDebug("start barrier: %d parties, release in %lld nsecs", parties_,
+            (long long)(releaseNsec_ - now));
+    isReleased_ = true;
+    complete_.wakeAll();
+}
+
+quint64 StartBarrier::realtimeNsec()
+{
+#if defined(Q_OS_UNIX)
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return quint64(ts.tv_sec)*quint64(1e9) + ts.tv_nsec;
+#else
+    //! \todo (LOW) use a better resolution clock on Windows
+    return quint64(QDateTime::currentMSecsSinceEpoch())*quint64(1e6);
+#endif
+}
@@ -0,0 +1,85 @@
+/*
+Copyright (C) 2017 Srivats P.
+
+
+This file is part of "Ostinato"
+
+This is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+
+#ifndef _START_BARRIER_H
+#define _START_BARRIER_H
+
+#include "../rpc/sharedprotobufmessage.h"
+
+#include <QMutex>
+#include <QWaitCondition>
+
+/*!
+  Holds the transmit workers of multiple ports till all of them are armed
+  and then releases them together at an absolute (wall clock) time - for
+  a synchronized start across ports
+
+  Each worker is added as a party before it is started; the owner seals
+  the barrier once all parties have been added. A worker waits (in its
+  own thread) till the barrier is complete and then busy-waits for the
+  last bit till the release time, so all workers start within a few usecs
+  of each other (and of other drones, if their CLOCK_REALTIME is
+  synchronized using PTP/NTP)
+*/
+class StartBarrier
+{
+public:
+    // releaseNsec is nsecs since the Unix epoch; 0 => as soon as all
+    // parties are armed
+    StartBarrier(quint64 releaseNsec = 0);
+
+    void addParty();
+    void seal();
+
+    // Returns false if 'stop' was set before the release; a party that
+    // won't wait (e.g. has nothing to send) should leave() instead
+    bool wait(volatile bool *stop);
+    void leave();
+
+    quint64 releaseNsec() const { return releaseNsec_; }
+
+    static quint64 realtimeNsec();
+
+private:
+    bool isComplete() const {
+        return isSealed_ && (arrived_ == parties_);
+    }
+    void releaseIfComplete();
+
+    // Busy-wait for the last of the wait for precise alignment
+    static const qint64 kSpinNsec = 2000000;
+    // Margin for all waiting parties to wake up when released asap
+    static const qint64 kReleaseMarginNsec = 1000000;
+    // Poll interval for the parties' stop flag
+    static const int kPollMsec = 10;
+
+    QMutex lock_;
+    QWaitCondition complete_;
+    int parties_;
+    int arrived_;
+    bool isSealed_;
+    bool isReleased_;
+    quint64 releaseNsec_;
+};
+
+typedef SharedPointer<StartBarrier> StartBarrierPtr;
+
+#endif
@@ -0,0 +1,217 @@
+/*
+Copyright (C) 2017 Srivats P.
+
+
+This file is part of "Ostinato"
+
+This is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+
+#include "statsexporter.h"
+
+#include "abstractport.h"
+#include "portmanager.h"
+
+#include <QByteArray>
+#include <QTimer>
+
+#ifdef Q_OS_UNIX
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Don't let a misconfiguration make us spend all our time publishing
+static const int kMinInterval = 100; // msecs
+
+StatsExporter::StatsExporter(QObject *parent)
+    : QObject(parent)
+{
+    fd_ = -1;
+    segment_ = NULL;
+    size_ = 0;
+    timer_ = new QTimer(this);
+    connect(timer_, SIGNAL(timeout()), this, SLOT(publish()));
+}
+
+StatsExporter::~StatsExporter()
+{
+#ifdef Q_OS_UNIX
+    if (segment_) {
+        munmap(segment_, size_);
+        shm_unlink(qPrintable(name_));
+    }
+    if (fd_ >= 0)
+        close(fd_);
+#endif
+}
+
+/*!
+  Creates the segment name (replacing a stale one) sized for all ports
+  and maxStreams stream records and publishes the stats into it every
+  intervalMsec; returns false if the segment can't be created
+*/
+bool StatsExporter::start(const QString &name, int intervalMsec,
+                          int maxStreams)
+{
+#ifdef Q_OS_UNIX
+    int portCount = PortManager::instance()->portCount();
+    Header *header;
+
+    name_ = name.startsWith('/') ? name : QString("/") + name;
+    size_ = sizeof(Header) + portCount*sizeof(PortRecord)
+                + qMax(maxStreams, 0)*sizeof(StreamRecord);
+
+    shm_unlink(qPrintable(name_));
+    fd_ = shm_open(qPrintable(name_), O_RDWR | O_CREAT | O_EXCL, 0644);
+    if (fd_ < 0)
+        goto _open_fail;
+    if (ftruncate(fd_, off_t(size_)) < 0)
+        goto _size_fail;
+    segment_ = (uchar*) mmap(NULL, size_, PROT_READ | PROT_WRITE,
+                             MAP_SHARED, fd_, 0);
+    if (segment_ == MAP_FAILED) {
+        segment_ = NULL;
+        goto _size_fail;
+    }
+
+    // ftruncate() zero fills the segment
+    header = (Header*) segment_;
+    header->magic = kMagic;
+    header->version = kVersion;
+    header->headerSize = sizeof(Header);
+    header->portCount = portCount;
+    header->portRecordSize = sizeof(PortRecord);
+    header->streamRecordSize = sizeof(StreamRecord);
+    header->maxStreams = qMax(maxStreams, 0);
+    header->intervalMsec = qMax(intervalMsec, kMinInterval);
+
+    qDebug("stats exported to shared memory %s (%llu bytes) every %u msecs",
+            qPrintable(name_), size_, header->intervalMsec);
+
+    publish();
+    timer_->start(header->intervalMsec);
+    return true;
+
+_size_fail:
+    qWarning("failed to size stats shared memory %s: %s",
+            qPrintable(name_), strerror(errno));
+    close(fd_);
+    fd_ = -1;
+    shm_unlink(qPrintable(name_));
+    return false;
+
+_open_fail:
+    qWarning("failed to create stats shared memory %s: %s",
+            qPrintable(name_), strerror(errno));
+    return false;
+#else
+    Q_UNUSED(intervalMsec);
+    Q_UNUSED(maxStreams);
+    qWarning("stats shared memory %s not supported on this platform",
+            qPrintable(name));
+    return false;
+#endif
+}
+
+void StatsExporter::publish()
+{
+    PortManager *portManager = PortManager::instance();
+    Header *header = (Header*) segment_;
+    PortRecord *ports;
+    StreamRecord *streams;
+    quint32 streamCount = 0;
+    QList<AbstractPort::PortStats> portStats;
+    QList<StreamStatsHash> streamStats;
+
+    if (!header)
+        return;
+
+    ports = (PortRecord*) (segment_ + sizeof(Header));
+    streams = (StreamRecord*) (ports + header->portCount);
+
+    // Stats are gathered before the write begins so that readers retry
+    // less - the write is just the copy
+    for (quint32 i = 0; i < header->portCount; i++) {
+        portStats.append(AbstractPort::PortStats());
+        streamStats.append(StreamStatsHash());
+        portManager->port(i)->stats(&portStats.last());
+        portManager->port(i)->streamStats(streamStats.last());
+    }
+
+    header->seq.writeBegin();
+
+    for (quint32 i = 0; i < header->portCount; i++) {
+        AbstractPort *port = portManager->port(i);
+        const AbstractPort::PortStats &stats = portStats.at(i);
+        PortRecord *p = ports + i;
+        const StreamStatsHash &hash = streamStats.at(i);
+
+        p->portId = quint32(port->id());
+        p->linkState = quint32(port->linkState());
+        qstrncpy(p->name, port->name(), sizeof(p->name));
+        p->rxPkts = stats.rxPkts;
+        p->rxBytes = stats.rxBytes;
+        p->rxPps = stats.rxPps;
+        p->rxBps = stats.rxBps;
+        p->rxDrops = stats.rxDrops;
+        p->rxErrors = stats.rxErrors;
+        p->rxFifoErrors = stats.rxFifoErrors;
+        p->rxFrameErrors = stats.rxFrameErrors;
+        p->txPkts = stats.txPkts;
+        p->txBytes = stats.txBytes;
+        p->txPps = stats.txPps;
+        p->txBps = stats.txBps;
+
+        for (StreamStatsHash::const_iterator j = hash.constBegin();
+                j != hash.constEnd(); j++) {
+            const StreamStats &ss = j.value();
+            StreamRecord *s = streams + streamCount;
+
+            if ((j.key() & 0xFFFFFFFF) == kProbeStreamId)
+                continue; // see MyService::discoverPortPairs()
+            if (streamCount >= header->maxStreams)
+                break;
+
+            s->portId = quint32(port->id());
+            s->txPortId = quint32(j.key() >> 32);
+            s->streamId = quint32(j.key() & 0xFFFFFFFF);
+            s->txPkts = ss.txPkts;
+            s->txBytes = ss.txBytes;
+            s->rxPkts = ss.rxPkts;
+            s->rxBytes = ss.rxBytes;
+            s->rxSeqErrors = ss.rxSeqErrors;
+            s->rxLatencySum = ss.rxLatencySum;
+            s->rxLatencyCount = ss.rxLatencyCount;
+            s->rxLatencyMin = ss.rxLatencyMin;
+            s->rxLatencyMax = ss.rxLatencyMax;
+            s->rxJitterSum = ss.rxJitterSum;
+            s->rxJitterCount = ss.rxJitterCount;
+            s->rxLost = ss.rxLost;
+            s->rxReordered = ss.rxReordered;
+            s->rxDuplicates = ss.rxDuplicates;
+            s->rxLate = ss.rxLate;
+            streamCount++;
+        }
+    }
+
+    header->streamCount = streamCount;
+    header->updateNsec = StreamStatsTable::realTimeNsec();
+
+    header->seq.writeEnd();
+}
@@ -0,0 +1,129 @@
+/*
+Copyright (C) 2017 Srivats P.
+
+
+This file is part of "Ostinato"
+
+This is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+
+#ifndef _STATS_EXPORTER_H
+#define _STATS_EXPORTER_H
+
+#include "seqlock.h"
+
+#include <QObject>
+#include <QString>
+
+class QTimer;
+
+/*!
+  Publishes the port and stream stats in a shared memory segment (POSIX
+  shm, e.g. /dev/shm/ostinato-stats on Linux) every interval - for local
+  monitoring agents to read at any rate without an RPC
+
+  The segment is a Header followed by Header::portCount PortRecords and
+  Header::streamCount StreamRecords (of Header::maxStreams), all in host
+  byte order. A reader copies what it needs between two reads of
+  Header::seq and retries if the seq was odd or has changed (a seqlock).
+  A reader must check magic and version and use the record sizes in the
+  Header - newer versions only append fields to the records
+
+  The stats are as those of getStats/getStreamStats - since the last
+  clearStats - less the derived ones (e.g. the NIC tx delay correction)
+*/
+class StatsExporter : public QObject
+{
+    Q_OBJECT
+public:
+    static const quint32 kMagic = 0x5354534f; // "OSTS"
+    static const quint32 kVersion = 1;
+
+    struct Header
+    {
+        quint32 magic;
+        quint32 version;
+        SeqLock seq;
+        quint32 headerSize;
+        quint32 portCount;
+        quint32 portRecordSize;
+        quint32 streamCount;
+        quint32 streamRecordSize;
+        quint32 maxStreams;
+        quint32 intervalMsec;
+        quint64 updateNsec; // when last published, nsecs since the epoch
+    };
+
+    struct PortRecord
+    {
+        quint32 portId;
+        quint32 linkState;  // OstProto::LinkState
+        char name[64];      // nul terminated, truncated if longer
+        quint64 rxPkts;
+        quint64 rxBytes;
+        quint64 rxPps;
+        quint64 rxBps;
+        quint64 rxDrops;
+        quint64 rxErrors;
+        quint64 rxFifoErrors;
+        quint64 rxFrameErrors;
+        quint64 txPkts;
+        quint64 txBytes;
+        quint64 txPps;
+        quint64 txBps;
+    };
+
+    // Stats of a tracked stream as counted by a port - by the tx port for
+    // tx and the rx port(s) for rx
+    struct StreamRecord
+    {
+        quint32 portId;
+        quint32 txPortId;
+        quint32 streamId;
+        quint32 reserved;
+        quint64 txPkts;
+        quint64 txBytes;
+        quint64 rxPkts;
+        quint64 rxBytes;
+        quint64 rxSeqErrors;
+        quint64 rxLatencySum;   // nsecs
+        quint64 rxLatencyCount;
+        quint64 rxLatencyMin;
+        quint64 rxLatencyMax;
+        quint64 rxJitterSum;    // nsecs
+        quint64 rxJitterCount;
+        quint64 rxLost;
+        quint64 rxReordered;
+        quint64 rxDuplicates;
+        quint64 rxLate;
+    };
+
+    StatsExporter(QObject *parent = 0);
+    ~StatsExporter();
+
+    bool start(const QString &name, int intervalMsec, int maxStreams);
+
+private slots:
+    void publish();
+
+private:
+    QString name_;
+    int fd_;
+    uchar *segment_;
+    quint64 size_;
+    QTimer *timer_;
+};
+
+#endif
@@ -0,0 +1,142 @@
+/*
+Copyright (C) 2017 Srivats P.
+
+
+This file is part of "Ostinato"
+
+This is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+
+
+#include "statshistory.h"
+
+#include "myservice.h"
+#include "statssubscriber.h"
+
+#include <QDateTime>
+#include <QHash>
+#include <QTimer>
+
+StatsHistory::StatsHistory(MyService *service, int portCount, int size,
+                           int maxStreams)
+    : QObject(service), service_(service)
+{
+    size_ = qMax(size, 1);
+    maxStreams_ = qMax(maxStreams, 0);
+
+    for (int i = 0; i < portCount; i++) {
+        rings_.append(Ring());
+        rings_.last().samples.resize(size_);
+        rings_.last().next = 0;
+        rings_.last().count = 0;
+    }
+
+    timer_ = new QTimer(this);
+    connect(timer_, SIGNAL(timeout()), this, SLOT(sample()));
+    timer_->start(kIntervalMsec);
+}
+
+void StatsHistory::sample()
+{
+    quint64 now = quint64(QDateTime::currentDateTime().toMSecsSinceEpoch())
+                    * 1000000;
+    QHash<int, StreamStatsHash> txPortStats;
+
+    for (int i = 0; i < rings_.size(); i++)
+    {
+        Sample sample;
+
+        // Gathered outside the lock - only the copy into the ring is
+        // under it
+        sample.time = now;
+        service_->portStats(i, &sample.portStats);
+        if (maxStreams_) {
+            service_->streamStats(i, &sample.streamStats, txPortStats,
+                                  false);
+            while (sample.streamStats.stream_stats_size() > maxStreams_)
+                sample.streamStats.mutable_stream_stats()->RemoveLast();
+        }
+
+        QMutexLocker locker(&lock_);
+        Ring &ring = rings_[i];
+
+        ring.samples[ring.next].time = sample.time;
+        ring.samples[ring.next].portStats.Swap(&sample.portStats);
+        ring.samples[ring.next].streamStats.Swap(&sample.streamStats);
+        ring.next = (ring.next + 1) % size_;
+        ring.count = qMin(ring.count + 1, size_);
+    }
+}
+
+/*!
+  Fills in history with the port's samples taken at or after startTime -
+  each delta encoded over the one before it (see OstProto::StatsHistory)
+*/
+void StatsHistory::history(int portId, quint64 startTime,
+                           bool withStreamStats,
+                           OstProto::StatsHistory *history)
+{
+    QList<Sample> samples;
+    const Sample *last = NULL;
+    QHash<quint64, std::string> lastStreams; // key: tx port, stream id
+
+    history->mutable_port_id()->set_id(portId);
+    history->set_interval_msec(kIntervalMsec);
+    if ((portId < 0) || (portId >= rings_.size()))
+        return;
+
+    lock_.lock();
+    {
+        const Ring &ring = rings_.at(portId);
+        int first = (ring.next - ring.count + size_) % size_;
+
+        for (int i = 0; i < ring.count; i++) {
+            const Sample &sample = ring.samples.at((first + i) % size_);
+
+            if (sample.time >= startTime)
+                samples.append(sample);
+        }
+    }
+    lock_.unlock();
+
+    for (int i = 0; i < samples.size(); i++)
+    {
+        const Sample &sample = samples.at(i);
+        OstProto::StatsHistorySample *s = history->add_sample();
+
+        s->set_time(sample.time);
+        s->mutable_port_stats()->CopyFrom(sample.portStats);
+        if (last)
+            StatsSubscriber::deltaEncode(s->mutable_port_stats(),
+                                         last->portStats);
+        last = &sample;
+
+        if (!withStreamStats)
+            continue;
+
+        for (int j = 0; j < sample.streamStats.stream_stats_size(); j++) {
+            const OstProto::StreamStats &stats =
+                                    sample.streamStats.stream_stats(j);
+            quint64 key = (quint64(stats.tx_port_id()) << 32)
+                                | stats.stream_id();
+            std::string data = stats.SerializeAsString();
+
+            if (lastStreams.value(key) == data)
+                continue;
+            lastStreams.insert(key, data);
+            s->add_stream_stats()->CopyFrom(stats);
+        }
+    }
+}
@@ -0,0 +1,87 @@
+/*
+Copyright (C) 2017 Srivats P.
+
+
+This file is part of "Ostinato"
+
+This is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+
+
+#ifndef _STATS_HISTORY_H
+#define _STATS_HISTORY_H
+
+#include "../common/protocol.pb.h"
+
+#include <QList>
+#include <QMutex>
+#include <QObject>
+#include <QVector>
+
+class MyService;
+class QTimer;
+
+/*!
+  The recent stats of all ports - a sample of each port's stats (as of
+  getStats and getStreamStats, less the latency histograms) every
+  kIntervalMsec, in a ring of the last size samples per port - so that
+  a client, even one that connects later, can get the recent stats with
+  one getStatsHistory call instead of having to poll and keep them itself
+
+  Sampled by a timer in the thread that created it; history() may be
+  called from any thread - the ring is locked only to add a sample or to
+  copy the samples asked for
+*/
+class StatsHistory : public QObject
+{
+    Q_OBJECT
+public:
+    static const int kIntervalMsec = 1000;
+
+    StatsHistory(MyService *service, int portCount, int size,
+                 int maxStreams);
+
+    void history(int portId, quint64 startTime, bool withStreamStats,
+                 OstProto::StatsHistory *history);
+
+private slots:
+    void sample();
+
+private:
+    struct Sample
+    {
+        quint64 time; // nsecs since the epoch
+        OstProto::PortStats portStats;
+        OstProto::StreamStatsList streamStats;
+    };
+
+    // Of a port - the oldest sample is at next once the ring is full
+    struct Ring
+    {
+        QVector<Sample> samples;
+        int next;
+        int count;
+    };
+
+    MyService *service_;
+    QTimer *timer_;
+    int size_;
+    int maxStreams_;
+
+    QMutex lock_; // for rings_
+    QList<Ring> rings_; // index: portId
+};
+
+#endif
@@ -0,0 +1,159 @@
+/*
+Copyright (C) 2017 Srivats P.
+
+
+This file is part of "Ostinato"
+
+This is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+
+#include "statssubscriber.h"
+
+#include "myservice.h"
+
+#include <google/protobuf/descriptor.h>
+#include <QTimer>
+
+// Don't let a client make us spend all our time serializing stats
+static const int kMinInterval = 100; // msecs
+
+StatsSubscriber::StatsSubscriber(MyService *service, QObject *connection)
+    : QObject(connection), service_(service)
+{
+    timer_ = new QTimer(this);
+    connect(timer_, SIGNAL(timeout()), this, SLOT(sendStats()));
+    connect(this, SIGNAL(notification(int, SharedProtobufMessage)),
+            connection, SLOT(sendNotification(int, SharedProtobufMessage)));
+}
+
+/*!
+  Replaces the current subscription (if any) - the next notification has
+  all the stats of all the ports
+*/
+void StatsSubscriber::subscribe(const OstProto::StatsSubscription &subscription)
+{
+    portIdList_.clear_port_id();
+    for (int i = 0; i < subscription.port_id_size(); i++)
+        portIdList_.add_port_id()->CopyFrom(subscription.port_id(i));
+    lastStats_.clear();
+
+    qDebug("stats subscription: %d ports every %u msecs",
+            portIdList_.port_id_size(), subscription.interval_msec());
+
+    timer_->start(qMax(int(subscription.interval_msec()), kMinInterval));
+    sendStats();
+}
+
+void StatsSubscriber::sendStats()
+{
+    // notification needs to be on heap because signal/slot may be across
+    // threads (it isn't here, but sendNotification() doesn't know that)
+    OstProto::Notification *notif = new OstProto::Notification;
+    OstProto::PortStatsList *list = notif->mutable_port_stats_list();
+
+    for (int i = 0; i < portIdList_.port_id_size(); i++)
+    {
+        int portId = portIdList_.port_id(i).id();
+        OstProto::PortStats *stats = list->add_port_stats();
+        OstProto::PortStats current;
+
+        service_->portStats(portId, stats);
+        current.CopyFrom(*stats);
+
+        if (lastStats_.contains(portId)
+                && !deltaEncode(stats, lastStats_.value(portId)))
+            list->mutable_port_stats()->RemoveLast(); // no change
+        lastStats_.insert(portId, current);
+    }
+
+    if (!list->port_stats_size()) {
+        delete notif;
+        return;
+    }
+
+    notif->set_notif_type(OstProto::portStatsChanged);
+    emit notification(notif->notif_type(), SharedProtobufMessage(notif));
+}
+
+/*!
+  Clears the fields of stats that are the same as in last, except port id;
+  the repeated fields are either cleared or sent in full. Fields set (or
+  non-empty) in last but not in stats are added to stats' cleared_field
+
+  Returns false if nothing has changed
+*/
+bool StatsSubscriber::deltaEncode(OstProto::PortStats *stats,
+                                  const OstProto::PortStats &last)
+{
+    const google::protobuf::Descriptor *desc = stats->GetDescriptor();
+    const google::protobuf::Reflection *refl = stats->GetReflection();
+    bool isChanged = false;
+
+    for (int i = 0; i < desc->field_count(); i++)
+    {
+        const google::protobuf::FieldDescriptor *f = desc->field(i);
+        bool isSame;
+
+        if ((f->number() == OstProto::PortStats::kPortIdFieldNumber)
+                || (f->number()
+                        == OstProto::PortStats::kClearedFieldFieldNumber))
+            continue;
+
+        // Gone - an absent/empty field in a delta means unchanged
+        if (f->is_repeated() ? (!refl->FieldSize(*stats, f)
+                                    && refl->FieldSize(last, f))
+                : (!refl->HasField(*stats, f) && refl->HasField(last, f))) {
+            stats->add_cleared_field(f->number());
+            isChanged = true;
+            continue;
+        }
+
+        if (f->is_repeated()) {
+            isSame = refl->FieldSize(*stats, f) == refl->FieldSize(last, f);
+            for (int j = 0; isSame && (j < refl->FieldSize(*stats, f)); j++)
+                isSame = refl->GetRepeatedMessage(*stats, f, j)
+                            .SerializeAsString()
+                         == refl->GetRepeatedMessage(last, f, j)
+                            .SerializeAsString();
+        }
+        else if (!refl->HasField(*stats, f))
+            continue;
+        else if (!refl->HasField(last, f))
+            isSame = false;
+        else switch (f->cpp_type())
+        {
+        case google::protobuf::FieldDescriptor::CPPTYPE_UINT64:
+            isSame = refl->GetUInt64(*stats, f) == refl->GetUInt64(last, f);
+            break;
+        case google::protobuf::FieldDescriptor::CPPTYPE_DOUBLE:
+            isSame = refl->GetDouble(*stats, f) == refl->GetDouble(last, f);
+            break;
+        case google::protobuf::FieldDescriptor::CPPTYPE_MESSAGE:
+            isSame = refl->GetMessage(*stats, f).SerializeAsString()
+                        == refl->GetMessage(last, f).SerializeAsString();
+            break;
+        default:
+            isSame = false; // no other types (yet) - send as is
+            break;
+        }
+
+        if (isSame)
+            refl->ClearField(stats, f);
+        else
+            isChanged = true;
+    }
+
+    return isChanged;
+}
@@ -0,0 +1,69 @@
+/*
+Copyright (C) 2017 Srivats P.
+
+
+This file is part of "Ostinato"
+
+This is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+
+#ifndef _STATS_SUBSCRIBER_H
+#define _STATS_SUBSCRIBER_H
+
+#include "../common/protocol.pb.h"
+#include "../rpc/sharedprotobufmessage.h"
+
+#include <QHash>
+#include <QObject>
+
+class MyService;
+class QTimer;
+
+/*!
+  A client's stats subscription - sends the client the stats of the
+  subscribed ports as portStatsChanged notifications every interval
+
+  Each notification is a delta over the previous one, so the client can
+  just merge it into the stats it has. The subscriber is a child of the
+  client's RpcConnection and lives in the connection's thread, so the
+  notifications go directly to that client alone
+*/
+class StatsSubscriber : public QObject
+{
+    Q_OBJECT
+public:
+    StatsSubscriber(MyService *service, QObject *connection);
+
+    void subscribe(const OstProto::StatsSubscription &subscription);
+
+    // Also for StatsHistory
+    static bool deltaEncode(OstProto::PortStats *stats,
+                            const OstProto::PortStats &last);
+
+signals:
+    void notification(int notifType, SharedProtobufMessage notifData);
+
+private slots:
+    void sendStats();
+
+private:
+
+    MyService *service_;
+    QTimer *timer_;
+    OstProto::PortIdList portIdList_;
+    QHash<int, OstProto::PortStats> lastStats_; // as last sent; key: portId
+};
+
+#endif
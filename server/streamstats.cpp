@@ -0,0 +1,534 @@
+/*
+Copyright (C) 2017 Srivats P.
+
+
+This file is part of "Ostinato"
+
+This is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+
+#include "streamstats.h"
+
+#include "latencyclock.h"
+#include "../common/crc32c.h"
+
+#include <string.h>
+#ifdef Q_OS_WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+StreamStatsTable::StreamStatsTable()
+{
+    memset(entries_, 0, sizeof(entries_));
+    histograms_ = NULL;
+    epoch_ = 0;
+    lane_ = 0;
+    isFull_ = false;
+    isEnabled_ = true;
+}
+
+StreamStatsTable::~StreamStatsTable()
+{
+    delete[] histograms_;
+}
+
+static inline void swapBytes(uchar *a, uchar *b, int length)
+{
+    for (int i = 0; i < length; i++) {
+        uchar t = a[i];
+        a[i] = b[i];
+        b[i] = t;
+    }
+}
+
+/*!
+  Swaps the source and destination (in place) of a received frame - the
+  MACs and, as found, the IPv4/IPv6 addresses and TCP/UDP ports - to send
+  it back to its sender; the checksums remain valid since the fields
+  swapped are summed alike
+*/
+void StreamStatsTable::reflect(uchar *frame, int length)
+{
+    int offset = 12;
+    int l4Proto = -1;
+    quint16 type;
+
+    if (length < 14)
+        return;
+
+    swapBytes(frame, frame + 6, 6);
+
+    type = qFromBigEndian<quint16>(frame + offset);
+    while (((type == 0x8100) || (type == 0x88a8))
+            && ((offset + 6) <= length)) {
+        offset += 4;
+        type = qFromBigEndian<quint16>(frame + offset);
+    }
+    offset += 2;
+
+    if ((type == 0x0800) && ((offset + 20) <= length)) {
+        uchar *ip = frame + offset;
+
+        swapBytes(ip + 12, ip + 16, 4);
+        // Only the first fragment has the L4 header
+        if ((qFromBigEndian<quint16>(ip + 6) & 0x1fff) == 0) {
+            l4Proto = ip[9];
+            offset += (ip[0] & 0x0f)*4;
+        }
+    }
+    else if ((type == 0x86dd) && ((offset + 40) <= length)) {
+        uchar *ip = frame + offset;
+
+        swapBytes(ip + 8, ip + 24, 16);
+        l4Proto = ip[6]; // extension headers are not looked into
+        offset += 40;
+    }
+
+    if (((l4Proto == 6) || (l4Proto == 17)) && ((offset + 4) <= length))
+        swapBytes(frame + offset, frame + offset + 2, 2);
+}
+
+/*!
+  Allocates the latency histograms - must be done before the rx thread
+  starts counting
+*/
+void StreamStatsTable::enableHistograms()
+{
+    if (histograms_)
+        return;
+
+    histograms_ = new quint64[kMaxEntries*kLatencyBuckets];
+    memset(histograms_, 0, kMaxEntries*kLatencyBuckets*sizeof(quint64));
+}
+
+/*!
+  Restarts the latency min/max (the other counters only increase - reset
+  them with an epoch, see AbstractPort::resetStreamStats())
+
+  The rx thread resets an entry's min/max when it next counts a frame for
+  it; till then the entry's min/max are not reported
+*/
+void StreamStatsTable::resetLatency()
+{
+    epoch_++;
+}
+
+// Returns the (HDR style) latency histogram bucket for nsec
+int StreamStatsTable::latencyBucket(quint64 nsec)
+{
+    int bucket;
+    int msb = 0;
+
+    if (nsec < quint64(kLatencySubBuckets))
+        return int(nsec);
+
+    for (quint64 v = nsec; v >>= 1; )
+        msb++;
+
+    // msb >= log2(kLatencySubBuckets); the top bits after the msb select
+    // the sub-bucket
+    bucket = (msb - 1) * kLatencySubBuckets
+                + int((nsec >> (msb - 2)) & (kLatencySubBuckets - 1));
+    return qMin(bucket, kLatencyBuckets - 1);
+}
+
+// Returns the min latency (nsecs) counted in the bucket
+quint64 StreamStatsTable::latencyBucketMin(int bucket)
+{
+    int msb;
+
+    if (bucket < kLatencySubBuckets)
+        return bucket;
+
+    msb = bucket/kLatencySubBuckets + 1;
+    return quint64(kLatencySubBuckets + (bucket % kLatencySubBuckets))
+                << (msb - 2);
+}
+
+// Returns the current (wall clock) time - to timestamp tx and rx frames
+quint64 StreamStatsTable::realTimeNsec()
+{
+#ifdef Q_OS_WIN32
+    FILETIME ft;
+    quint64 t;
+
+    // 100ns units since 1601
+    GetSystemTimeAsFileTime(&ft);
+    t = (quint64(ft.dwHighDateTime) << 32) | ft.dwLowDateTime;
+    return (t - 116444736000000000ULL)*100;
+#else
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return quint64(ts.tv_sec)*quint64(1e9) + ts.tv_nsec;
+#endif
+}
+
+// Returns the entry for the signature's stream - see the other entry()
+StreamStatsTable::Entry* StreamStatsTable::entry(const uchar *signature,
+        bool isTx, int lane)
+{
+    return entry(qFromBigEndian<quint16>(signature + kSignaturePortIdOffset)
+                    & ~kSignaturePayloadCrc,
+                 qFromBigEndian<quint32>(signature + kSignatureStreamIdOffset),
+                 isTx, lane);
+}
+
+/*!
+  Returns the entry for the stream - a new one if it doesn't exist; NULL
+  if the table is full
+*/
+StreamStatsTable::Entry* StreamStatsTable::entry(quint32 portId,
+        quint32 streamId, bool isTx, int lane)
+{
+    quint64 k = key(portId, streamId) | (quint64(lane) << kKeyLaneShift)
+                    | kUsed;
+    uint i = (streamId * 2654435761U) ^ portId ^ (uint(lane) << 16);
+
+    for (int n = 0; n < kMaxEntries; n++, i++)
+    {
+        Entry *e = &entries_[i & (kMaxEntries - 1)];
+
+        if (e->key == k)
+            return e;
+
+        if (!e->key) {
+            e->isTx = isTx;
+            e->latencyMin = ~quint64(0);
+            e->latencyEpoch = epoch_;
+            // Entry must be set up before a reader can find it
+            __sync_synchronize();
+            e->key = k;
+            return e;
+        }
+    }
+
+    if (!isFull_) {
+        qWarning("stream stats table is full - "
+                 "stats for more than %d streams are not kept", kMaxEntries);
+        isFull_ = true;
+    }
+    return NULL;
+}
+
+/*!
+  Sets the sequence number and tx time in the frame's signature and counts
+  the frame as sent - does nothing if the frame has no signature
+*/
+void StreamStatsTable::stampTx(uchar *frame, int length)
+{
+    uchar *sig;
+    Entry *e;
+    quint16 *words;
+    quint32 sum;
+
+    if (!isSigned(frame, length))
+        return;
+
+    sig = frame + signatureOffset(length);
+    e = entry(sig, true, 0);
+    if (!e)
+        return;
+
+    // Keep the ones complement sum of the signature unchanged -
+    //   adjust' = adjust + (old words) - (new words)
+    words = (quint16*)(sig + kSignatureSeqOffset);
+    sum = *((quint16*)(sig + kSignatureCksumOffset));
+    for (int i = 0; i < 6; i++)
+        sum += words[i];
+
+    qToBigEndian((quint32(lane_) << kLaneShift) | (e->seq++ & kLaneSeqMask),
+                 sig + kSignatureSeqOffset);
+    qToBigEndian(LatencyClock::now(), sig + kSignatureTxTimeOffset);
+
+    for (int i = 0; i < 6; i++)
+        sum += quint16(~words[i]);
+    while (sum >> 16)
+        sum = (sum & 0xFFFF) + (sum >> 16);
+    *((quint16*)(sig + kSignatureCksumOffset)) = sum;
+
+    e->pkts++;
+    e->bytes += length;
+}
+
+/*!
+  Counts pkts frames (of bytes in all) of an untracked stream as sent -
+  the transmitter counts these a packet sequence at a time, not per frame
+  as stampTx() does for the tracked streams
+*/
+void StreamStatsTable::countTx(quint64 key, quint64 pkts, quint64 bytes)
+{
+    Entry *e = entry(quint32(key >> 32), quint32(key & 0xFFFFFFFF), true, 0);
+
+    if (!e)
+        return;
+
+    e->pkts += pkts;
+    e->bytes += bytes;
+}
+
+/*!
+  Counts the NIC tx timestamp of a frame sent earlier (with stampTx()) -
+  txNsec is when the NIC sent it (LatencyClock time); does nothing if the
+  frame has no signature
+*/
+void StreamStatsTable::countTxTimestamp(const uchar *frame, int length,
+                                        quint64 txNsec)
+{
+    const uchar *sig;
+    Entry *e;
+    quint64 stampNsec;
+
+    if (!isSigned(frame, length))
+        return;
+
+    sig = frame + signatureOffset(length);
+    e = entry(sig, true, 0);
+    if (!e)
+        return;
+
+    // Skip any unreasonable value - as for the rx latency
+    stampNsec = qFromBigEndian<quint64>(sig + kSignatureTxTimeOffset);
+    if (stampNsec && (txNsec >= stampNsec)
+            && ((txNsec - stampNsec) < quint64(1e9))) {
+        e->hwDelaySum += txNsec - stampNsec;
+        e->hwDelayCount++;
+    }
+}
+
+/*!
+  Returns false if the (signed) frame has a payload CRC that doesn't
+  match its payload
+*/
+bool StreamStatsTable::isPayloadOk(const uchar *frame, int length)
+{
+    int offset = signatureOffset(length) - kPayloadCrcSize;
+    const uchar *crc = frame + offset;
+    int payloadLen;
+
+    if (!(qFromBigEndian<quint16>(frame + signatureOffset(length)
+                + kSignaturePortIdOffset) & kSignaturePayloadCrc))
+        return true;
+
+    if (offset < 0)
+        return false;
+    payloadLen = qFromBigEndian<quint16>(crc + 4);
+    if (payloadLen > offset)
+        return false;
+
+    return crc32c(0, crc - payloadLen, payloadLen)
+                == qFromBigEndian<quint32>(crc);
+}
+
+/*!
+  Counts a received frame for its stream - does nothing if the frame has
+  no signature. The frame must not be truncated; rxNsec is LatencyClock
+  time. Returns false if the frame is out of sequence (see countSeq()) or
+  its payload is corrupted (see isPayloadOk())
+*/
+bool StreamStatsTable::countRx(const uchar *frame, int length, quint64 rxNsec)
+{
+    const uchar *sig;
+    Entry *e;
+    quint32 seq;
+    quint64 txNsec;
+    bool isOk;
+
+    if (!isEnabled_ || !isSigned(frame, length))
+        return true;
+
+    sig = frame + signatureOffset(length);
+    seq = qFromBigEndian<quint32>(sig + kSignatureSeqOffset);
+    e = entry(sig, false, seq >> kLaneShift);
+    if (!e)
+        return true;
+
+    isOk = countSeq(e, seq & kLaneSeqMask);
+    if (!isPayloadOk(frame, length)) {
+        e->payloadErrors++;
+        isOk = false;
+    }
+
+    // Latency is meaningful only if the tx and rx clocks are the same one,
+    // but any unreasonable value is skipped anyway
+    txNsec = qFromBigEndian<quint64>(sig + kSignatureTxTimeOffset);
+    if (txNsec && (rxNsec >= txNsec) && ((rxNsec - txNsec) < quint64(1e9))) {
+        quint64 latency = rxNsec - txNsec;
+
+        if (e->latencyEpoch != epoch_) {
+            e->latencyMin = ~quint64(0);
+            e->latencyMax = 0;
+            e->latencyEpoch = epoch_;
+        }
+
+        // Jitter (RFC 4689) - the delay variation between consecutive
+        // frames; lastLatency is valid if latencyMax is
+        if (e->latencyMax) {
+            e->jitterSum += (latency > e->lastLatency) ?
+                    latency - e->lastLatency : e->lastLatency - latency;
+            e->jitterCount++;
+        }
+        e->lastLatency = latency;
+
+        e->latencyMin = qMin(e->latencyMin, latency);
+        e->latencyMax = qMax(e->latencyMax, qMax(latency, quint64(1)));
+        e->latencySum += latency;
+        e->latencyCount++;
+
+        if (histograms_)
+            histograms_[(e - entries_)*kLatencyBuckets
+                            + latencyBucket(latency)]++;
+    }
+
+    e->pkts++;
+    e->bytes += length;
+
+    return isOk;
+}
+
+static inline int countOnes(quint64 v)
+{
+    int n = 0;
+
+    for (; v; n++)
+        v &= v - 1;
+    return n;
+}
+
+/*!
+  Classifies a received frame by its (in-lane) sequence number -
+
+  - lost: never received while its sequence number was in the window
+  - reordered: received after a higher sequence number, but in the window
+  - duplicate: received again while in the window
+  - late: received after it left the window (so also counted as lost)
+
+  Frames sent before the first one received are not counted as lost.
+  Returns false if the frame is out of sequence - not the one after the
+  last received
+*/
+bool StreamStatsTable::countSeq(Entry *e, quint32 seq)
+{
+    Q_ASSERT(kSeqWindow == 128);
+
+    quint64 &hi = e->seqWindow[1];
+    quint64 &lo = e->seqWindow[0];
+    // Sequence numbers wrap in kLaneShift bits
+    int diff = int((seq - e->seq) << (32 - kLaneShift)) >> (32 - kLaneShift);
+
+    if (!e->pkts) {
+        hi = lo = ~quint64(0);
+        e->seq = seq;
+        return true;
+    }
+
+    if (diff != 1)
+        e->seqErrors++;
+
+    if (diff > 0) {
+        int received;
+
+        // Slide the window - the oldest diff seq numbers leave it
+        if (diff >= kSeqWindow) {
+            received = countOnes(hi) + countOnes(lo);
+            e->lost += diff - received;
+            hi = lo = 0;
+        }
+        else if (diff < 64) {
+            received = countOnes(hi >> (64 - diff));
+            hi = (hi << diff) | (lo >> (64 - diff));
+            lo <<= diff;
+            e->lost += diff - received;
+        }
+        else {
+            received = countOnes(hi) + (diff > 64 ?
+                            countOnes(lo >> (kSeqWindow - diff)) : 0);
+            hi = lo << (diff - 64);
+            lo = 0;
+            e->lost += diff - received;
+        }
+        lo |= 1;
+        e->seq = seq;
+    }
+    else if (-diff < kSeqWindow) {
+        quint64 &word = e->seqWindow[-diff / 64];
+        quint64 bit = quint64(1) << (-diff % 64);
+
+        if (word & bit)
+            e->duplicates++;
+        else {
+            e->reordered++;
+            word |= bit;
+        }
+    }
+    else
+        e->late++;
+
+    return diff == 1;
+}
+
+// Adds the table's counters to stats
+void StreamStatsTable::addTo(StreamStatsHash &stats) const
+{
+    for (int i = 0; i < kMaxEntries; i++)
+    {
+        const Entry &e = entries_[i];
+        quint64 k = e.key;
+
+        if (!k)
+            continue;
+
+        // Lanes are summed
+        StreamStats &s = stats[k & ~(kUsed | kKeyLaneMask)]; // zeroed, if new
+
+        if (e.isTx) {
+            s.txPkts += e.pkts;
+            s.txBytes += e.bytes;
+            s.txHwDelaySum += e.hwDelaySum;
+            s.txHwDelayCount += e.hwDelayCount;
+        }
+        else {
+            s.rxPkts += e.pkts;
+            s.rxBytes += e.bytes;
+            s.rxSeqErrors += e.seqErrors;
+            s.rxLatencySum += e.latencySum;
+            s.rxLatencyCount += e.latencyCount;
+            s.rxJitterSum += e.jitterSum;
+            s.rxJitterCount += e.jitterCount;
+            s.rxLost += e.lost;
+            s.rxReordered += e.reordered;
+            s.rxDuplicates += e.duplicates;
+            s.rxLate += e.late;
+            s.rxPayloadErrors += e.payloadErrors;
+
+            if ((e.latencyEpoch == epoch_) && e.latencyMax) {
+                if (!s.rxLatencyMin || (e.latencyMin < s.rxLatencyMin))
+                    s.rxLatencyMin = e.latencyMin;
+                s.rxLatencyMax = qMax(s.rxLatencyMax, e.latencyMax);
+            }
+
+            if (histograms_) {
+                const quint64 *h = histograms_ + i*kLatencyBuckets;
+
+                if (s.rxLatencyHistogram.isEmpty())
+                    s.rxLatencyHistogram.fill(0, kLatencyBuckets);
+                for (int j = 0; j < kLatencyBuckets; j++)
+                    s.rxLatencyHistogram[j] += h[j];
+            }
+        }
+    }
+}
@@ -0,0 +1,188 @@
+/*
+Copyright (C) 2017 Srivats P.
+
+
+This file is part of "Ostinato"
+
+This is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+
+#ifndef _STREAM_STATS_H
+#define _STREAM_STATS_H
+
+#include "../common/streambase.h"
+
+#include <QHash>
+#include <QVector>
+#include <QtEndian>
+#include <QtGlobal>
+
+// Counters of a tracked stream - see StreamStatsTable
+struct StreamStats
+{
+    quint64 txPkts;
+    quint64 txBytes;
+    quint64 txHwDelaySum;   // nsecs, see StreamStatsTable::countTxTimestamp()
+    quint64 txHwDelayCount;
+    quint64 rxPkts;
+    quint64 rxBytes;
+    quint64 rxSeqErrors;
+    quint64 rxLatencySum;   // nsecs
+    quint64 rxLatencyCount;
+    quint64 rxLatencyMin;   // since the last reset; 0 => none
+    quint64 rxLatencyMax;
+    quint64 rxJitterSum;    // nsecs, see StreamStatsTable::countRx()
+    quint64 rxJitterCount;
+    QVector<quint64> rxLatencyHistogram; // empty or kLatencyBuckets
+    quint64 rxLost;         // see StreamStatsTable::countSeq()
+    quint64 rxReordered;
+    quint64 rxDuplicates;
+    quint64 rxLate;
+    quint64 rxPayloadErrors; // see StreamStatsTable::isPayloadOk()
+};
+
+// Key is StreamStatsTable::key(txPortId, streamId)
+typedef QHash<quint64, StreamStats> StreamStatsHash;
+
+/*!
+  Per-stream counters of tracked stream frames (frames with a signature,
+  see kSignatureSize), sent or received by one thread
+
+  The table is updated by just one thread - the transmitter or the rx
+  monitor - without any locks; other threads may read it at any time with
+  addTo(). An entry's key is published only after the entry is set up, and
+  entries are never removed - so a reader either doesn't see an entry or
+  sees a valid (if a little stale) one
+
+  For transmit, stampTx() fills in the signature's sequence number and tx
+  time just before the frame is sent; the checksum adjust word is updated
+  for these, so this is a few stores per frame and a lookup in a small
+  open addressed table. If the NIC reports when it actually sent a frame,
+  countTxTimestamp() keeps the delay from the stamped tx time - the rx
+  latency of the stream is corrected for it. The frames of the untracked
+  streams have no signature - their transmitter counts them with countTx()
+  instead, many frames at a time
+
+  For receive, the latency of each frame is also measured - min/avg/max,
+  jitter and, if enabled with enableHistograms(), a latency histogram with
+  log-linear (HDR style) buckets: kLatencySubBuckets per power of 2, i.e.
+  a bucket's width is 1/kLatencySubBuckets of its min value. All of the
+  memory for these is allocated upfront - not when a frame is counted.
+  Since each rx thread has its own table, the histograms are effectively
+  per cpu; they are summed only when read
+
+  Lost, reordered, duplicate and late frames are found from the signature
+  sequence numbers using a sliding bitmap of the last kSeqWindow sequence
+  numbers per stream - so the memory needed doesn't depend on the rate.
+  Each transmitter of a port stamps sequence numbers in its own lane (the
+  top bits of the sequence number, see setLane()) since the frames of a
+  stream may be sent by more than one transmitter; the receiver tracks
+  each lane separately
+
+  The payload CRC of a frame that has one (see kPayloadCrcSize) is
+  verified with the hardware CRC-32C instruction, if the cpu has it -
+  a few cycles per 8 bytes of payload, so a core keeps up with 10G
+*/
+class StreamStatsTable
+{
+public:
+    StreamStatsTable();
+
+    static void reflect(uchar *frame, int length);
+    static bool isSigned(const uchar *frame, int length) {
+        int offset = signatureOffset(length);
+        return (offset >= 0) && (qFromBigEndian<quint32>(frame + offset)
+                                    == kSignatureMagic);
+    }
+    static bool isPayloadOk(const uchar *frame, int length);
+    static quint64 key(quint32 txPortId, quint32 streamId) {
+        return (quint64(txPortId) << 32) | streamId;
+    }
+
+    ~StreamStatsTable();
+
+    void setLane(int lane) { lane_ = lane & (kMaxLanes - 1); }
+    // Frames are counted by countRx() only if enabled (the default)
+    void setEnabled(bool enabled) { isEnabled_ = enabled; }
+    void enableHistograms();
+    void resetLatency();
+
+    void stampTx(uchar *frame, int length);
+    void countTx(quint64 key, quint64 pkts, quint64 bytes);
+    void countTxTimestamp(const uchar *frame, int length, quint64 txNsec);
+    bool countRx(const uchar *frame, int length, quint64 rxNsec);
+    void addTo(StreamStatsHash &stats) const;
+
+    static const int kLatencySubBuckets = 4;
+    static const int kLatencyBuckets = 128;
+    static int latencyBucket(quint64 nsec);
+    static quint64 latencyBucketMin(int bucket);
+
+    // The system clock - frames are timestamped with LatencyClock
+    static quint64 realTimeNsec();
+
+    static const int kMaxLanes = 256;
+    static const int kSeqWindow = 128;
+
+private:
+    struct Entry
+    {
+        volatile quint64 key;   // key() | kUsed; 0 => unused
+        quint32 seq;            // next (tx) or highest (rx) sequence number
+        quint64 pkts;
+        quint64 bytes;
+        quint64 seqErrors;
+        quint64 latencySum;
+        quint64 latencyCount;
+        quint64 latencyMin;     // ~0 => none
+        quint64 latencyMax;
+        quint64 lastLatency;
+        quint64 jitterSum;
+        quint64 jitterCount;
+        volatile uint latencyEpoch; // min/max/last valid if == epoch_
+        quint64 seqWindow[kSeqWindow/64]; // bit n => (seq - n) received
+        quint64 lost;
+        quint64 reordered;
+        quint64 duplicates;
+        quint64 late;
+        quint64 payloadErrors;
+        quint64 hwDelaySum;     // tx only
+        quint64 hwDelayCount;
+        bool isTx;
+    };
+
+    Entry* entry(const uchar *signature, bool isTx, int lane);
+    Entry* entry(quint32 portId, quint32 streamId, bool isTx, int lane);
+    static bool countSeq(Entry *e, quint32 seq);
+
+    // Sequence number is (lane << kLaneShift) | seq-in-lane
+    static const int kLaneShift = 24;
+    static const quint32 kLaneSeqMask = (1U << kLaneShift) - 1;
+    // Rx entries are per lane - key() | (lane << kKeyLaneShift)
+    static const int kKeyLaneShift = 48;
+    static const quint64 kKeyLaneMask =
+                            quint64(kMaxLanes - 1) << kKeyLaneShift;
+    static const quint64 kUsed = quint64(1) << 63;
+    static const int kMaxEntries = 1024; // power of 2
+
+    Entry entries_[kMaxEntries];
+    quint64 *histograms_; // kLatencyBuckets for each entry; NULL => none
+    volatile uint epoch_;
+    int lane_;
+    bool isFull_;
+    volatile bool isEnabled_;
+};
+
+#endif
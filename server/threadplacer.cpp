@@ -0,0 +1,272 @@
+/*
+Copyright (C) 2017 Srivats P.
+
+
+This file is part of "Ostinato"
+
+This is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+
+#include "threadplacer.h"
+
+#include <QMutexLocker>
+
+#ifdef Q_OS_LINUX
+#include <QDir>
+#include <QFile>
+#include <QStringList>
+
+#include <errno.h>
+#include <sched.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+static QString readSysFile(const QString &path)
+{
+    QFile file(path);
+
+    if (!file.open(QIODevice::ReadOnly))
+        return QString();
+
+    return QString(file.readAll()).trimmed();
+}
+
+// Parses a cpu list in the kernel's format e.g. "0-3,8,10-11"
+static bool parseCpuList(const QString &list, cpu_set_t *cpuSet)
+{
+    QStringList ranges = list.split(',', QString::SkipEmptyParts);
+
+    CPU_ZERO(cpuSet);
+    for (int i = 0; i < ranges.size(); i++) {
+        QStringList range = ranges.at(i).split('-');
+        bool isOk1 = false, isOk2 = false;
+        int first = range.at(0).toInt(&isOk1);
+        int last = (range.size() > 1) ? range.at(1).toInt(&isOk2) : first;
+
+        if (!isOk1 || ((range.size() > 1) && !isOk2))
+            return false;
+        for (int cpu = first; (cpu <= last) && (cpu < CPU_SETSIZE); cpu++)
+            CPU_SET(cpu, cpuSet);
+    }
+
+    return CPU_COUNT(cpuSet) > 0;
+}
+
+static QString cpuListString(const cpu_set_t *cpuSet)
+{
+    QStringList ranges;
+
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (!CPU_ISSET(cpu, cpuSet))
+            continue;
+
+        int last = cpu;
+        while (((last + 1) < CPU_SETSIZE) && CPU_ISSET(last + 1, cpuSet))
+            last++;
+
+        if (last == cpu)
+            ranges.append(QString::number(cpu));
+        else
+            ranges.append(QString("%1-%2").arg(cpu).arg(last));
+        cpu = last;
+    }
+
+    return ranges.join(",");
+}
+
+static int cpuNumaNode(int cpu)
+{
+    QDir dir(QString("/sys/devices/system/cpu/cpu%1").arg(cpu));
+    QStringList nodes = dir.entryList(QStringList("node*"));
+
+    if (nodes.isEmpty())
+        return -1;
+
+    return nodes.at(0).mid(4).toInt();
+}
+
+// Returns the cpu the thread last ran on - field 39 of its stat
+static int lastCpu(pid_t tid)
+{
+    QString stat = readSysFile(QString("/proc/self/task/%1/stat").arg(tid));
+
+    // Skip pid and (comm) - comm may have spaces in it
+    QStringList fields = stat.mid(stat.lastIndexOf(')') + 2).split(' ');
+    if (fields.size() < 37)
+        return -1;
+
+    return fields.at(36).toInt();
+}
+#endif
+
+quint64 ThreadPlacer::cpuCacheSize()
+{
+    static const quint64 kDefaultCacheSize = 256*1024;
+    static quint64 size = 0;
+
+    if (size)
+        return size;
+
+    size = kDefaultCacheSize;
+#ifdef Q_OS_LINUX
+    // cpu0 is representative - the cpus of a system have the same L2
+    QDir dir("/sys/devices/system/cpu/cpu0/cache");
+    QStringList caches = dir.entryList(QStringList("index*"));
+
+    for (int i = 0; i < caches.size(); i++) {
+        QString path = dir.filePath(caches.at(i));
+        QString value = readSysFile(path + "/size");
+        quint64 multiplier = 1;
+
+        if (readSysFile(path + "/level") != "2")
+            continue;
+        if (readSysFile(path + "/type") == "Instruction")
+            continue;
+
+        if (value.endsWith('K'))
+            multiplier = 1024;
+        else if (value.endsWith('M'))
+            multiplier = 1024*1024;
+        if (multiplier > 1)
+            value.chop(1);
+        if (value.toULongLong())
+            size = value.toULongLong() * multiplier;
+        break;
+    }
+#endif
+
+    return size;
+}
+
+ThreadPlacer::ThreadPlacer(const QString &name)
+    : name_(name)
+{
+    isSet_ = false;
+    isAttached_ = false;
+}
+
+void ThreadPlacer::setPlacement(const OstProto::ThreadPlacement &placement)
+{
+    QMutexLocker locker(&mutex_);
+
+    placement_.CopyFrom(placement);
+    isSet_ = true;
+    if (isAttached_)
+        apply();
+}
+
+void ThreadPlacer::status(OstProto::ThreadPlacementStatus *status)
+{
+    QMutexLocker locker(&mutex_);
+
+    status->set_thread(name_.toStdString());
+    status->set_is_running(isAttached_);
+    if (!isAttached_)
+        return;
+
+#ifdef Q_OS_LINUX
+    cpu_set_t cpuSet;
+    struct sched_param param;
+    int policy;
+
+    if (pthread_getaffinity_np(thread_, sizeof(cpuSet), &cpuSet) == 0)
+        status->set_cpu_list(cpuListString(&cpuSet).toStdString());
+
+    if (pthread_getschedparam(thread_, &policy, &param) == 0)
+        status->set_fifo_priority(
+                (policy == SCHED_FIFO) ? param.sched_priority : 0);
+
+    int cpu = lastCpu(tid_);
+    if (cpu >= 0) {
+        status->set_last_cpu(cpu);
+        status->set_numa_node(cpuNumaNode(cpu));
+    }
+#endif
+}
+
+// Called by the thread to be placed, from the thread
+void ThreadPlacer::attach()
+{
+    QMutexLocker locker(&mutex_);
+
+#ifdef Q_OS_LINUX
+    thread_ = pthread_self();
+    tid_ = pid_t(syscall(SYS_gettid));
+#endif
+    isAttached_ = true;
+    if (isSet_)
+        apply();
+}
+
+void ThreadPlacer::detach()
+{
+    QMutexLocker locker(&mutex_);
+
+    isAttached_ = false;
+}
+
+void ThreadPlacer::apply()
+{
+#ifdef Q_OS_LINUX
+    cpu_set_t cpuSet;
+    struct sched_param param;
+    int policy = SCHED_OTHER;
+    int ret;
+
+    // A cpu takes precedence over a NUMA node; neither => any cpu
+    CPU_ZERO(&cpuSet);
+    if (placement_.cpu() >= 0) {
+        CPU_SET(placement_.cpu(), &cpuSet);
+    }
+    else if (placement_.numa_node() >= 0) {
+        QString cpus = readSysFile(
+                QString("/sys/devices/system/node/node%1/cpulist")
+                    .arg(placement_.numa_node()));
+        if (!parseCpuList(cpus, &cpuSet)) {
+            qWarning("%s: no cpus found for numa node %d",
+                    qPrintable(name_), placement_.numa_node());
+            goto _sched;
+        }
+    }
+    else {
+        long count = sysconf(_SC_NPROCESSORS_CONF);
+        for (int cpu = 0; (cpu < count) && (cpu < CPU_SETSIZE); cpu++)
+            CPU_SET(cpu, &cpuSet);
+    }
+
+    ret = pthread_setaffinity_np(thread_, sizeof(cpuSet), &cpuSet);
+    if (ret)
+        qWarning("%s: failed to set cpu affinity to %s (%s)",
+                qPrintable(name_), qPrintable(cpuListString(&cpuSet)),
+                strerror(ret));
+
+_sched:
+    memset(&param, 0, sizeof(param));
+    if (placement_.fifo_priority() > 0) {
+        policy = SCHED_FIFO;
+        param.sched_priority = qBound(sched_get_priority_min(SCHED_FIFO),
+                placement_.fifo_priority(),
+                sched_get_priority_max(SCHED_FIFO));
+    }
+
+    // SCHED_FIFO needs root or CAP_SYS_NICE
+    ret = pthread_setschedparam(thread_, policy, &param);
+    if (ret)
+        qWarning("%s: failed to set %s priority %d (%s)", qPrintable(name_),
+                (policy == SCHED_FIFO) ? "SCHED_FIFO" : "SCHED_OTHER",
+                param.sched_priority, strerror(ret));
+#endif
+}
@@ -0,0 +1,88 @@
+/*
+Copyright (C) 2017 Srivats P.
+
+
+This file is part of "Ostinato"
+
+This is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+
+#ifndef _THREAD_PLACER_H
+#define _THREAD_PLACER_H
+
+#include "../common/protocol.pb.h"
+
+#include <QMutex>
+#include <QString>
+
+#ifdef Q_OS_LINUX
+#include <pthread.h>
+#include <sys/types.h>
+#endif
+
+/*!
+  Places a port's worker thread as configured for the port - pins it to a
+  cpu or to the cpus of a NUMA node and sets its scheduling policy
+  (SCHED_FIFO or normal)
+
+  The thread attaches itself when it starts running and detaches when it
+  is done - see ThreadPlacer::Scope. A placement set while the thread is
+  running is applied immediately, otherwise when the thread next starts.
+  Till a placement is set, the thread is left as is.
+
+  Only Linux is supported currently - elsewhere the placement is ignored
+  and status() reports only the thread name and if it is running
+*/
+class ThreadPlacer
+{
+public:
+    ThreadPlacer(const QString &name);
+
+    void setName(const QString &name) { name_ = name; }
+    void setPlacement(const OstProto::ThreadPlacement &placement);
+    void status(OstProto::ThreadPlacementStatus *status);
+
+    void attach();
+    void detach();
+
+    // Size of a cpu's own (L2) cache - for sizing the data a thread loops
+    // over; a conservative default where it isn't known
+    static quint64 cpuCacheSize();
+
+    // Attaches the current thread for the lifetime of the scope
+    class Scope
+    {
+    public:
+        Scope(ThreadPlacer &placer) : placer_(placer) { placer_.attach(); }
+        ~Scope() { placer_.detach(); }
+    private:
+        ThreadPlacer &placer_;
+    };
+
+private:
+    void apply();
+
+    QString name_;
+    QMutex mutex_;
+    bool isSet_;
+    OstProto::ThreadPlacement placement_;
+    bool isAttached_;
+#ifdef Q_OS_LINUX
+    pthread_t thread_;
+    pid_t tid_;
+#endif
+};
+
+#endif
@@ -0,0 +1,67 @@
+/*
+Copyright (C) 2017 Srivats P.
+
+
+This file is part of "Ostinato"
+
+This is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+
+#ifndef _THREAD_STATE_H
+#define _THREAD_STATE_H
+
+#include <QMutex>
+#include <QWaitCondition>
+
+/*!
+  State of a worker thread that others can wait on for a change - instead
+  of polling it with a sleep
+
+  Reads are lock free; set() wakes up all the waiters
+*/
+class ThreadState
+{
+public:
+    ThreadState(int state = 0) : state_(state) {}
+
+    operator int() const { return state_; }
+
+    void set(int state) {
+        QMutexLocker locker(&lock_);
+        state_ = state;
+        changed_.wakeAll();
+    }
+
+    // Waits till the state is something other than 'state'
+    void waitWhile(int state) {
+        QMutexLocker locker(&lock_);
+        while (state_ == state)
+            changed_.wait(&lock_);
+    }
+
+    // Waits till the state becomes 'state'
+    void waitFor(int state) {
+        QMutexLocker locker(&lock_);
+        while (state_ != state)
+            changed_.wait(&lock_);
+    }
+
+private:
+    QMutex lock_;
+    QWaitCondition changed_;
+    volatile int state_;
+};
+
+#endif
@@ -0,0 +1,223 @@
+/*
+Copyright (C) 2017 Srivats P.
+
+
+This file is part of "Ostinato"
+
+This is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+
+#include "throughputtest.h"
+
+#include "abstractport.h"
+#include "startbarrier.h"
+#include "tracebuffer.h"
+
+#include <QMutexLocker>
+#include <QReadWriteLock>
+
+// Transmit is polled (for the end of a trial) and stop() checked this often
+static const uint kPollMsecs = 10;
+
+ThroughputTest::ThroughputTest(const OstProto::ThroughputTestConfig &config,
+                               AbstractPort *txPort, QReadWriteLock *txLock,
+                               AbstractPort *rxPort)
+    : txPort_(txPort), txLock_(txLock), rxPort_(rxPort)
+{
+    config_.CopyFrom(config);
+    stop_ = false;
+
+    result_.mutable_tx_port_id()->set_id(txPort->id());
+    result_.set_state(OstProto::ThroughputTestResult::kRunning);
+}
+
+void ThroughputTest::result(OstProto::ThroughputTestResult *result)
+{
+    QMutexLocker locker(&resultLock_);
+
+    result->CopyFrom(result_);
+}
+
+/*
+ * Binary search between the highest passing load (initially none) and the
+ * lowest failing one (initially max_load, which is tried first)
+ */
+void ThroughputTest::run()
+{
+    double passLoad = 0;
+    double failLoad = config_.max_load();
+    double load = config_.max_load();
+    QString error;
+
+    qDebug("port %d: throughput test to port %d started", txPort_->id(),
+            rxPort_->id());
+
+    for (uint i = 0; i < config_.max_trials(); i++) {
+        OstProto::ThroughputTrial trial;
+
+        if (!runTrial(load, &trial, &error))
+            goto _error;
+        if (stop_)
+            goto _stopped;
+
+        qDebug("port %d: trial %u at load %g %s (tx %llu, rx %llu)",
+                txPort_->id(), i, load, trial.passed() ? "passed" : "failed",
+                trial.tx_pkts(), trial.rx_pkts());
+
+        resultLock_.lock();
+        result_.add_trial()->CopyFrom(trial);
+        if (trial.passed())
+            result_.mutable_throughput()->CopyFrom(trial);
+        resultLock_.unlock();
+
+        if (trial.passed())
+            passLoad = load;
+        else
+            failLoad = load;
+
+        if ((failLoad - passLoad) <= config_.resolution())
+            break;
+        if (!trial.passed() && (load <= config_.min_load()))
+            break;
+        load = qMax((passLoad + failLoad)/2, config_.min_load());
+    }
+
+    finish(OstProto::ThroughputTestResult::kDone);
+    return;
+
+_stopped:
+    finish(OstProto::ThroughputTestResult::kStopped);
+    return;
+
+_error:
+    finish(OstProto::ThroughputTestResult::kFailed, error);
+}
+
+bool ThroughputTest::runTrial(double load, OstProto::ThroughputTrial *trial,
+                              QString *error)
+{
+    StreamStatsHash txStats, rxStats;
+    quint64 txPkts = 0, txBytes = 0, rxPkts = 0;
+    quint64 latencySum = 0, latencyCount = 0, latencyMin = 0, latencyMax = 0;
+    quint64 runPkts, runBytes, runNsec;
+    quint32 txPortId = txPort_->id();
+
+    txLock_->lockForWrite();
+    if (txPort_->isTransmitOn()) {
+        txLock_->unlock();
+        *error = "tx port is already transmitting";
+        return false;
+    }
+    if (txPort_->isDirty())
+        txPort_->updatePacketList();
+    txPort_->resetStreamStats();
+    rxPort_->resetStreamStats();
+    txPort_->setTransmitLoad(load);
+    txPort_->setTransmitStopTime(StartBarrier::realtimeNsec()
+                                    + config_.trial_duration());
+    TraceBuffer::record(OstProto::TraceRecord::kTransmitStart, txPortId);
+    txPort_->startTransmit();
+    txLock_->unlock();
+
+    while (txPort_->isTransmitOn()) {
+        if (stop_) {
+            txLock_->lockForWrite();
+            txPort_->stopTransmit();
+            txLock_->unlock();
+            break;
+        }
+        msleep(kPollMsecs);
+    }
+    txPort_->setTransmitLoad(1.0);
+
+    sleepAbortable(config_.settle_msec());
+    if (stop_)
+        return true;
+
+    txPort_->transmitRunStats(&runPkts, &runBytes, &runNsec);
+    txPort_->streamStats(txStats);
+    rxPort_->streamStats(rxStats);
+
+    // The untracked streams are counted as sent too - but never received
+    txLock_->lockForRead();
+    for (StreamStatsHash::const_iterator i = txStats.constBegin();
+            i != txStats.constEnd(); i++) {
+        StreamBase *stream;
+
+        if ((i.key() >> 32) != txPortId)
+            continue;
+        stream = txPort_->stream(int(i.key() & 0xFFFFFFFF));
+        if (!stream || !stream->isTracked())
+            continue;
+        txPkts += i.value().txPkts;
+        txBytes += i.value().txBytes;
+    }
+    txLock_->unlock();
+
+    for (StreamStatsHash::const_iterator i = rxStats.constBegin();
+            i != rxStats.constEnd(); i++) {
+        const StreamStats &stats = i.value();
+
+        if (((i.key() >> 32) != txPortId)
+                || ((i.key() & 0xFFFFFFFF) == kProbeStreamId))
+            continue;
+        rxPkts += stats.rxPkts;
+        latencySum += stats.rxLatencySum;
+        latencyCount += stats.rxLatencyCount;
+        if (stats.rxLatencyMin && (!latencyMin
+                                    || (stats.rxLatencyMin < latencyMin)))
+            latencyMin = stats.rxLatencyMin;
+        latencyMax = qMax(latencyMax, stats.rxLatencyMax);
+    }
+
+    if (!txPkts) {
+        *error = "no tracked stream frames sent - is any stream of the "
+                 "tx port tracked?";
+        return false;
+    }
+
+    trial->set_load(load);
+    trial->set_duration(runNsec);
+    trial->set_tx_pkts(txPkts);
+    trial->set_tx_bytes(txBytes);
+    trial->set_rx_pkts(rxPkts);
+    trial->set_latency_nsec(latencyCount ? latencySum/latencyCount : 0);
+    trial->set_latency_min_nsec(latencyMin);
+    trial->set_latency_max_nsec(latencyMax);
+    // Duplicates may make rx more than tx - which is no loss
+    trial->set_passed((rxPkts >= txPkts)
+            || (double(txPkts - rxPkts)/txPkts <= config_.loss_tolerance()));
+
+    return true;
+}
+
+void ThroughputTest::sleepAbortable(uint msecs)
+{
+    for (uint i = 0; (i < msecs) && !stop_; i += kPollMsecs)
+        msleep(kPollMsecs);
+}
+
+void ThroughputTest::finish(OstProto::ThroughputTestResult::State state,
+                            const QString &error)
+{
+    QMutexLocker locker(&resultLock_);
+
+    qDebug("port %d: throughput test finished (%d) %s", txPort_->id(),
+            state, qPrintable(error));
+
+    result_.set_state(state);
+    if (!error.isEmpty())
+        result_.set_error(error.toStdString());
+}
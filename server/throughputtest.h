@@ -0,0 +1,76 @@
+/*
+Copyright (C) 2017 Srivats P.
+
+
+This file is part of "Ostinato"
+
+This is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+
+#ifndef _THROUGHPUT_TEST_H
+#define _THROUGHPUT_TEST_H
+
+#include "../common/protocol.pb.h"
+
+#include <QMutex>
+#include <QString>
+#include <QThread>
+
+class AbstractPort;
+class QReadWriteLock;
+
+/*!
+  Runs an RFC 2544 throughput search (see ThroughputTestConfig) in the
+  background - for startThroughputTest
+
+  Each trial reuses the tx port's packet list, only scaling its rates
+  (AbstractPort::setTransmitLoad()) and stopping it after the trial
+  duration (AbstractPort::setTransmitStopTime()); the loss and latency of
+  a trial are from the stream stats of the tx port's tracked streams.
+  The tx port lock is held for write only while starting or stopping a
+  trial's transmit
+*/
+class ThroughputTest : public QThread
+{
+public:
+    ThroughputTest(const OstProto::ThroughputTestConfig &config,
+                   AbstractPort *txPort, QReadWriteLock *txLock,
+                   AbstractPort *rxPort);
+
+    void stop() { stop_ = true; }
+    void result(OstProto::ThroughputTestResult *result);
+
+protected:
+    void run();
+
+private:
+    bool runTrial(double load, OstProto::ThroughputTrial *trial,
+                  QString *error);
+    void sleepAbortable(uint msecs);
+    void finish(OstProto::ThroughputTestResult::State state,
+                const QString &error = QString());
+
+    OstProto::ThroughputTestConfig config_;
+    AbstractPort *txPort_;
+    QReadWriteLock *txLock_;
+    AbstractPort *rxPort_;
+    volatile bool stop_;
+
+    QMutex resultLock_;
+    OstProto::ThroughputTestResult result_;
+};
+
+#endif
+
@@ -0,0 +1,150 @@
+/*
+Copyright (C) 2017 Srivats P.
+
+
+This file is part of "Ostinato"
+
+This is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+
+#ifndef _TIMER_WHEEL_H
+#define _TIMER_WHEEL_H
+
+#include <QList>
+#include <QtGlobal>
+
+/*!
+  Hierarchical timing wheel (as in the Linux kernel timers) - kLevels
+  wheels of kSlots slots each, a slot of level N spanning kSlots^N ticks
+
+  schedule() is O(1) however many items are scheduled (100K devices with
+  a few timers each) and advance() is O(1) per tick plus O(1) per item
+  that is due; an item is moved to a lower level (cascaded) at most
+  kLevels-1 times. Items due are moved, in the order they were scheduled
+  within a tick, to a ready list for the caller to take - as many as it
+  can handle at a time (e.g. to pace what it sends for them)
+
+  Ticks are absolute (e.g. msecs/tick-size since some start); the range is
+  kSlots^kLevels ticks from now - items due later are parked in the last
+  slot of the highest level and rescheduled when it is cascaded
+
+  Not thread-safe - the owner serializes the calls
+*/
+template <typename T>
+class TimerWheel
+{
+public:
+    TimerWheel() : now_(0), count_(0) {}
+
+    quint64 now() const { return now_; }
+
+    // Items scheduled - due or not
+    int size() const { return count_ + ready_.size(); }
+
+    void schedule(quint64 tick, const T &item) {
+        if (tick <= now_) {
+            ready_.append(item);
+            return;
+        }
+        insert(Entry(tick, item));
+        count_++;
+    }
+
+    // Moves the items due till tick to the ready list
+    void advance(quint64 tick) {
+        while (now_ < tick) {
+            if (!count_) { // nothing to cascade or expire on the way
+                now_ = tick;
+                break;
+            }
+            step();
+        }
+    }
+
+    bool hasReady() const { return !ready_.isEmpty(); }
+    int readyCount() const { return ready_.size(); }
+    T takeReady() { return ready_.takeFirst(); }
+
+    void clear() {
+        for (int i = 0; i < kLevels; i++)
+            for (int j = 0; j < kSlots; j++)
+                slots_[i][j].clear();
+        ready_.clear();
+        count_ = 0;
+    }
+
+private:
+    static const int kSlotBits = 6;
+    static const int kSlots = 1 << kSlotBits;
+    static const int kLevels = 4;
+
+    struct Entry {
+        Entry(quint64 t, const T &i) : tick(t), item(i) {}
+        quint64 tick;
+        T item;
+    };
+
+    void insert(const Entry &entry) {
+        quint64 delta = entry.tick - now_;
+        quint64 tick = entry.tick;
+        int level = 0;
+
+        while ((level < (kLevels - 1))
+                && (delta >= (quint64(1) << (kSlotBits*(level + 1)))))
+            level++;
+        if (delta >= (quint64(1) << (kSlotBits*kLevels))) // beyond range
+            tick = now_ + (quint64(1) << (kSlotBits*kLevels)) - 1;
+
+        slots_[level][(tick >> (kSlotBits*level)) & (kSlots - 1)]
+            .append(entry);
+    }
+
+    // Moves the entries of a slot to the levels below, as per their ticks
+    // now; returns the slot index
+    int cascade(int level) {
+        int index = int((now_ >> (kSlotBits*level)) & (kSlots - 1));
+        QList<Entry> entries;
+
+        entries.swap(slots_[level][index]);
+        for (int i = 0; i < entries.size(); i++)
+            insert(entries.at(i));
+
+        return index;
+    }
+
+    void step() {
+        int index;
+
+        now_++;
+        index = int(now_ & (kSlots - 1));
+
+        // On a wrap of a level, the next slot of the level above is due
+        for (int level = 1; !index && (level < kLevels); level++)
+            index = cascade(level);
+
+        QList<Entry> &slot = slots_[0][now_ & (kSlots - 1)];
+        for (int i = 0; i < slot.size(); i++)
+            ready_.append(slot.at(i).item);
+        count_ -= slot.size();
+        slot.clear();
+    }
+
+    quint64 now_;
+    int count_; // in the wheel i.e. not yet due
+    QList<Entry> slots_[kLevels][kSlots];
+    QList<T> ready_;
+};
+
+#endif
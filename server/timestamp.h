@@ -0,0 +1,78 @@
+/*
+Copyright (C) 2017 Srivats P.
+
+This file is part of "Ostinato"
+
+This is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+#ifndef _TIMESTAMP_H
+#define _TIMESTAMP_H
+
+#include <QtGlobal>
+
+#if defined(Q_OS_LINUX)
+#include <time.h>
+typedef struct timespec TimeStamp;
+static void inline getTimeStamp(TimeStamp *stamp)
+{
+    clock_gettime(CLOCK_MONOTONIC, stamp);
+}
+
+// Returns time diff in nsecs between end and start
+static qint64 inline ndiffTimeStamp(const TimeStamp *start, const TimeStamp *end)
+{
+    return qint64(end->tv_sec - start->tv_sec)*qint64(1e9)
+                + (end->tv_nsec - start->tv_nsec);
+}
+
+// Returns in stamp the time nsec after the (arbitrary) start of the clock
+static void inline nsecToTimeStamp(quint64 nsec, TimeStamp *stamp)
+{
+    stamp->tv_sec = nsec/quint64(1e9);
+    stamp->tv_nsec = nsec%quint64(1e9);
+}
+#elif defined(Q_OS_WIN32)
+#include <windows.h>
+extern quint64 gTicksFreq;
+typedef LARGE_INTEGER TimeStamp;
+static void inline getTimeStamp(TimeStamp* stamp)
+{
+    QueryPerformanceCounter(stamp);
+}
+
+static qint64 inline ndiffTimeStamp(const TimeStamp *start, const TimeStamp *end)
+{
+    if (end->QuadPart >= start->QuadPart)
+        return qint64(double(end->QuadPart - start->QuadPart)*1e9/gTicksFreq);
+    else
+    {
+        // FIXME: incorrect! what's the max value for this counter before
+        // it rolls over?
+        return qint64(double(start->QuadPart)*1e9/gTicksFreq);
+    }
+}
+
+static void inline nsecToTimeStamp(quint64 nsec, TimeStamp *stamp)
+{
+    stamp->QuadPart = qint64(double(nsec)*gTicksFreq/1e9);
+}
+#else
+typedef int TimeStamp;
+static void inline getTimeStamp(TimeStamp*) {}
+static qint64 inline ndiffTimeStamp(const TimeStamp*, const TimeStamp*) { return 0; }
+static void inline nsecToTimeStamp(quint64, TimeStamp*) {}
+#endif
+
+#endif
@@ -0,0 +1,161 @@
+/*
+Copyright (C) 2017 Srivats P.
+
+
+This file is part of "Ostinato"
+
+This is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+
+#include "tracebuffer.h"
+
+#include "timestamp.h"
+
+#include <QAtomicInt>
+#include <QList>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QThreadStorage>
+
+static const int kRecordsPerThread = 4096; // must be a power of 2
+
+// 32 bytes - recorded as is, converted to a TraceRecord only on a dump
+struct TraceEntry
+{
+    quint64 timestamp;
+    quint32 event;
+    quint32 reserved;
+    quint64 arg1;
+    quint64 arg2;
+};
+
+// Rings are never freed - the ring of an exited thread is reused by the
+// next new thread; only the owner thread writes to a ring, so a dump
+// may see a partially written record of a thread that's recording
+class TraceRing
+{
+public:
+    TraceRing(int id) : id_(id), inUse_(true), wrapped_(false) {}
+
+    void reset() { head_ = 0; wrapped_ = false; }
+
+    const int id_;
+    bool inUse_;            // protected by ringsLock
+    QAtomicInt head_;       // index of the next record
+    volatile bool wrapped_;
+    TraceEntry entries_[kRecordsPerThread];
+};
+
+// Releases a thread's ring for reuse when the thread exits
+class TraceRingRef
+{
+public:
+    TraceRingRef(TraceRing *ring) : ring_(ring) {}
+    ~TraceRingRef();
+
+    TraceRing *ring_;
+};
+
+bool TraceBuffer::enabled_ = false;
+
+static TimeStamp epoch;
+static QMutex ringsLock;
+static QList<TraceRing*> rings;
+static QThreadStorage<TraceRingRef*> threadRings;
+
+TraceRingRef::~TraceRingRef()
+{
+    QMutexLocker locker(&ringsLock);
+    ring_->inUse_ = false;
+}
+
+static TraceRing* threadRing()
+{
+    if (!threadRings.hasLocalData()) {
+        QMutexLocker locker(&ringsLock);
+        TraceRing *ring = NULL;
+
+        for (int i = 0; i < rings.size(); i++) {
+            if (!rings.at(i)->inUse_) {
+                ring = rings.at(i);
+                ring->inUse_ = true;
+                ring->reset();
+                break;
+            }
+        }
+        if (!ring) {
+            ring = new TraceRing(rings.size());
+            rings.append(ring);
+        }
+        threadRings.setLocalData(new TraceRingRef(ring));
+    }
+    return threadRings.localData()->ring_;
+}
+
+void TraceBuffer::init(bool enabled)
+{
+    getTimeStamp(&epoch);
+    enabled_ = enabled;
+    qDebug("TraceBuffer: %s (%d records per thread)",
+            enabled ? "enabled" : "disabled", kRecordsPerThread);
+}
+
+void TraceBuffer::doRecord(OstProto::TraceRecord::Event event,
+                           quint64 arg1, quint64 arg2)
+{
+    TraceRing *ring = threadRing();
+    int head = ring->head_;
+    TraceEntry *entry = &ring->entries_[head];
+    TimeStamp now;
+
+    getTimeStamp(&now);
+    entry->timestamp = ndiffTimeStamp(&epoch, &now);
+    entry->event = event;
+    entry->arg1 = arg1;
+    entry->arg2 = arg2;
+
+    head = (head + 1) & (kRecordsPerThread - 1);
+    if (!head)
+        ring->wrapped_ = true;
+    ring->head_.fetchAndStoreOrdered(head);
+}
+
+void TraceBuffer::dump(OstProto::TraceRecordList *list)
+{
+    QMutexLocker locker(&ringsLock);
+
+    for (int i = 0; i < rings.size(); i++) {
+        TraceRing *ring = rings.at(i);
+        int head = ring->head_.fetchAndAddOrdered(0);
+        int first = ring->wrapped_ ? head : 0;
+        int count = ring->wrapped_ ? kRecordsPerThread : head;
+
+        for (int j = 0; j < count; j++) {
+            const TraceEntry &entry =
+                ring->entries_[(first + j) & (kRecordsPerThread - 1)];
+            OstProto::TraceRecord *record;
+
+            if (!OstProto::TraceRecord::Event_IsValid(entry.event))
+                continue;
+
+            record = list->add_trace_record();
+            record->set_timestamp(entry.timestamp);
+            record->set_thread_id(ring->id_);
+            record->set_event(OstProto::TraceRecord::Event(entry.event));
+            record->set_arg1(entry.arg1);
+            record->set_arg2(entry.arg2);
+        }
+    }
+}
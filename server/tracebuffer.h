@@ -0,0 +1,57 @@
+/*
+Copyright (C) 2017 Srivats P.
+
+
+This file is part of "Ostinato"
+
+This is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+
+#ifndef _TRACE_BUFFER_H
+#define _TRACE_BUFFER_H
+
+#include "../common/protocol.pb.h"
+
+#include <QtGlobal>
+
+/*
+ * Low overhead structured trace - each thread records fixed size binary
+ * events (no formatting) in a ring of its own, so no lock is taken while
+ * recording; the most recent events of all threads can be dumped via
+ * the getTraceRecords RPC
+ */
+class TraceBuffer
+{
+public:
+    static void init(bool enabled);
+    static bool isEnabled() { return enabled_; }
+
+    static void record(OstProto::TraceRecord::Event event,
+                       quint64 arg1 = 0, quint64 arg2 = 0)
+    {
+        if (enabled_)
+            doRecord(event, arg1, arg2);
+    }
+
+    static void dump(OstProto::TraceRecordList *list);
+
+private:
+    static void doRecord(OstProto::TraceRecord::Event event,
+                         quint64 arg1, quint64 arg2);
+
+    static bool enabled_;
+};
+
+#endif
@@ -0,0 +1,147 @@
+/*
+Copyright (C) 2017 Srivats P.
+
+
+This file is part of "Ostinato"
+
+This is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+
+
+#include "txscheduler.h"
+
+#include <QMutexLocker>
+
+QMutex TxScheduler::instanceLock_;
+TxScheduler *TxScheduler::instance_ = NULL;
+
+/*!
+  Returns the scheduler - created (and started) on first use and never
+  deleted
+*/
+TxScheduler* TxScheduler::instance()
+{
+    QMutexLocker locker(&instanceLock_);
+
+    if (!instance_) {
+        instance_ = new TxScheduler;
+        instance_->start();
+    }
+
+    return instance_;
+}
+
+TxScheduler::TxScheduler()
+    : placer_("tx-scheduler")
+{
+    getTimeStamp(&start_);
+    generation_ = 0;
+    busy_ = NULL;
+}
+
+quint64 TxScheduler::nowNsec() const
+{
+    TimeStamp now;
+
+    getTimeStamp(&now);
+    return quint64(ndiffTimeStamp(&start_, &now));
+}
+
+/*!
+  Schedules client's txScheduleDue() at dueNsec (see nowNsec()) - a client
+  already added is rescheduled
+*/
+void TxScheduler::add(Client *client, quint64 dueNsec)
+{
+    QMutexLocker locker(&lock_);
+    Entry entry;
+
+    entry.client = client;
+    entry.generation = ++generation_;
+    clients_.insert(client, entry.generation);
+    wheel_.schedule(dueNsec/kTickNsec, entry);
+
+    added_.wakeAll();
+}
+
+/*!
+  Removes client - once this returns, client's txScheduleDue() is not
+  running and won't be called again; must not be called from the
+  scheduler thread
+*/
+void TxScheduler::remove(Client *client)
+{
+    QMutexLocker locker(&lock_);
+
+    Q_ASSERT(QThread::currentThread() != this);
+
+    // Its entry in the wheel (if any) is skipped when due
+    clients_.remove(client);
+    while (busy_ == client)
+        idle_.wait(&lock_);
+}
+
+void TxScheduler::run()
+{
+    ThreadPlacer::Scope placement(placer_);
+
+    qDebug("In %s", __PRETTY_FUNCTION__);
+
+    lock_.lock();
+    forever {
+        quint64 now = nowNsec();
+        quint64 due;
+        Entry entry;
+
+        wheel_.advance(now/kTickNsec);
+        if (!wheel_.hasReady()) {
+            if (!wheel_.size()) {
+                added_.wait(&lock_);
+                continue;
+            }
+
+            // Till the next tick
+            due = (wheel_.now() + 1)*kTickNsec;
+            lock_.unlock();
+            usleep(qMax((due - qMin(due, now))/1000, quint64(1)));
+            lock_.lock();
+            continue;
+        }
+
+        entry = wheel_.takeReady();
+        if (clients_.value(entry.client) != entry.generation)
+            continue;
+
+        // Frames due in the current tick are sent now
+        due = (wheel_.now() + 1)*kTickNsec - 1;
+        busy_ = entry.client;
+        lock_.unlock();
+
+        due = entry.client->txScheduleDue(due);
+
+        lock_.lock();
+        busy_ = NULL;
+        idle_.wakeAll();
+
+        // Removed (or re-added) meanwhile?
+        if (clients_.value(entry.client) != entry.generation)
+            continue;
+
+        if (due == kDone)
+            clients_.remove(entry.client);
+        else
+            wheel_.schedule(due/kTickNsec, entry);
+    }
+}
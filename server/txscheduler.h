@@ -0,0 +1,101 @@
+/*
+Copyright (C) 2017 Srivats P.
+
+
+This file is part of "Ostinato"
+
+This is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+
+
+#ifndef _TX_SCHEDULER_H
+#define _TX_SCHEDULER_H
+
+#include "threadplacer.h"
+#include "timerwheel.h"
+#include "timestamp.h"
+
+#include <QHash>
+#include <QMutex>
+#include <QThread>
+#include <QWaitCondition>
+
+/*!
+  One thread that sends the frames of many (low rate) ports - instead of a
+  transmitter thread per port busy waiting for its next frame. Each client
+  is kept in a TimerWheel by when its next frame is due, so the thread's
+  work is by the total frame rate of all its clients, not their count
+
+  A client's txScheduleDue() is called (in the scheduler thread) when its
+  next frame is due; it sends the frames due before the limit given (the
+  end of the current tick) on its own socket - but no more than a bounded
+  number of them, so that the other clients aren't starved - and returns
+  when its next frame is due (or kDone). Frames are thus sent upto a tick
+  early or late, unlike the ns pacing of a transmitter of its own
+
+  The thread sleeps while it has no clients
+*/
+class TxScheduler : public QThread
+{
+public:
+    class Client
+    {
+    public:
+        virtual ~Client() {}
+        virtual quint64 txScheduleDue(quint64 limitNsec) = 0;
+    };
+
+    // Returned by a client that has nothing more to send - it isn't
+    // called again after that
+    static const quint64 kDone = Q_UINT64_C(0xffffffffffffffff);
+
+    static TxScheduler* instance();
+
+    // Scheduler time - of the due times given and returned
+    quint64 nowNsec() const;
+
+    void add(Client *client, quint64 dueNsec);
+    void remove(Client *client);
+
+protected:
+    void run();
+
+private:
+    TxScheduler();
+
+    static const quint64 kTickNsec = 20000; // 20us
+
+    struct Entry
+    {
+        Client *client;
+        quint64 generation; // of the add() - to skip stale entries
+    };
+
+    TimeStamp start_;
+    ThreadPlacer placer_;
+
+    QMutex lock_;           // for all below
+    QWaitCondition added_;  // a client was added
+    QWaitCondition idle_;   // busy_ has changed
+    TimerWheel<Entry> wheel_; // tick: kTickNsec
+    QHash<Client*, quint64> clients_; // to their generation
+    quint64 generation_;
+    Client *busy_;          // whose txScheduleDue() is running, if any
+
+    static QMutex instanceLock_;
+    static TxScheduler *instance_;
+};
+
+#endif
@@ -0,0 +1,223 @@
+/*
+Copyright (C) 2017 Srivats P.
+
+
+This file is part of "Ostinato"
+
+This is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+
+#include "virtualport.h"
+
+#include "streamstats.h"
+
+#include <QMutexLocker>
+
+VirtualPort::VirtualPort(int id, const char *name, Sink sink,
+                         const QString &fileName)
+    : PcapPort(id, name)
+{
+    // There's no device for the monitors to open - nothing is received
+    // and the transmitter counts the tx stats
+    delete monitorRx_;
+    delete monitorTx_;
+    monitorRx_ = monitorTx_ = NULL;
+    isUsable_ = true;
+
+    // A single transmitter - so that a file has its frames in order
+    delete transmitter_;
+    transmitter_ = new PortTransmitter(name, sink, fileName);
+    while (txWorkers_.size())
+        delete txWorkers_.takeFirst();
+    loopCacheBytes_ = ThreadPlacer::cpuCacheSize()/2;
+
+    lastTxPkts_ = lastTxBytes_ = 0;
+
+    if (sink == kPcapFileSink)
+        data_.set_description(qPrintable(QString("pcap file %1")
+                                            .arg(fileName)));
+    else
+        data_.set_description("null sink");
+    data_.set_is_exclusive_control(true);
+}
+
+void VirtualPort::init()
+{
+    // Unlike PcapPort::init(), no monitors to start
+    transmitter_->useExternalStats(&stats_);
+}
+
+// The tx rate is measured here as there's no monitor to do it
+void VirtualPort::stats(PortStats *stats)
+{
+    QMutexLocker locker(&rateLock_);
+    PortStats now;
+
+    stats_.snapshot(&now);
+    txRate_.update(now.txPkts - lastTxPkts_, now.txBytes - lastTxBytes_);
+    lastTxPkts_ = now.txPkts;
+    lastTxBytes_ = now.txBytes;
+
+    stats_.txRateLock.writeBegin();
+    stats_.txPps = txRate_.pps();
+    stats_.txBps = txRate_.bps();
+    stats_.txRateLock.writeEnd();
+
+    PcapPort::stats(stats);
+}
+
+/*
+ * ------------------------------------------------------------------- *
+ * Port Transmitter
+ * ------------------------------------------------------------------- *
+ */
+VirtualPort::PortTransmitter::PortTransmitter(const char *name, Sink sink,
+        const QString &fileName)
+    : PcapPort::PortTransmitter(name)
+{
+    sink_ = sink;
+    fileName_ = fileName;
+    dumper_ = NULL;
+    startNsec_ = 0;
+    isVirtualTime_ = true;
+}
+
+VirtualPort::PortTransmitter::~PortTransmitter()
+{
+    if (dumper_)
+        pcap_dump_close(dumper_);
+}
+
+/*!
+  Opens a dead pcap handle on the first transmit and (re)creates the pcap
+  file, for a file sink, on every transmit - so the file has the frames of
+  the last transmit only
+*/
+bool VirtualPort::PortTransmitter::open()
+{
+    if (!handle_) {
+#if !defined(Q_OS_WIN32) && defined(PCAP_TSTAMP_PRECISION_NANO)
+        handle_ = pcap_open_dead_with_tstamp_precision(DLT_EN10MB, 65535,
+                        PCAP_TSTAMP_PRECISION_NANO);
+#else
+        handle_ = pcap_open_dead(DLT_EN10MB, 65535);
+#endif
+        if (!handle_)
+            return false;
+        usingInternalHandle_ = true;
+#ifdef HAVE_SENDMMSG
+        useSendBatch_ = false;
+#endif
+    }
+
+    startNsec_ = StreamStatsTable::realTimeNsec();
+
+    if (sink_ != kPcapFileSink)
+        return true;
+
+    if (dumper_) {
+        pcap_dump_close(dumper_);
+        dumper_ = NULL;
+    }
+
+    dumper_ = pcap_dump_open(handle_, qPrintable(fileName_));
+    if (!dumper_) {
+        qWarning("%s: unable to open %s: %s", deviceName_.constData(),
+                qPrintable(fileName_), pcap_geterr(handle_));
+        return false;
+    }
+
+    return true;
+}
+
+void VirtualPort::PortTransmitter::run()
+{
+    PcapPort::PortTransmitter::run();
+
+    if (dumper_)
+        pcap_dump_flush(dumper_);
+}
+
+/*
+ * Same as PcapPort's except that waits only advance the virtual clock and
+ * a frame is discarded or written to the file (with its scheduled time)
+ * instead of being sent
+ */
+int VirtualPort::PortTransmitter::sendQueueTransmit(pcap_t * /*p*/,
+        pcap_send_queue *queue, qint64 &overHead, int sync)
+{
+    struct timeval ts;
+    struct pcap_pkthdr *hdr = (struct pcap_pkthdr*) queue->buffer;
+    char *end = queue->buffer + queue->len;
+    int ret = 0;
+
+    ts = hdr->ts;
+
+    while((char*) hdr < end)
+    {
+        uchar *pkt = (uchar*)hdr + sizeof(*hdr);
+        int pktLen = hdr->caplen;
+
+        if (sync)
+        {
+            qint64 nsec = pacedGap(nsecTsDiff(hdr->ts, ts)) + overHead;
+
+            if (isPastStopTime(nsec)) {
+                ret = -2;
+                break;
+            }
+            if (nsec > 0)
+            {
+                delay(nsec);
+                overHead = 0;
+            }
+            else
+                overHead = nsec;
+
+            ts = hdr->ts;
+        }
+
+        Q_ASSERT(pktLen > 0);
+
+        streamStats_.stampTx(pkt, pktLen);
+        if (dumper_) {
+            struct pcap_pkthdr fileHdr;
+            quint64 nsec = startNsec_ + virtualNsec_;
+
+            fileHdr.ts.tv_sec = long(nsec/1000000000);
+#if !defined(Q_OS_WIN32) && defined(PCAP_TSTAMP_PRECISION_NANO)
+            fileHdr.ts.tv_usec = long(nsec % 1000000000);
+#else
+            fileHdr.ts.tv_usec = long((nsec % 1000000000)/1000);
+#endif
+            fileHdr.caplen = fileHdr.len = pktLen;
+            pcap_dump((uchar*) dumper_, &fileHdr, pkt);
+        }
+        stats_->txLock.writeBegin();
+        stats_->txPkts++;
+        stats_->txBytes += pktLen;
+        stats_->txLock.writeEnd();
+
+        // Step to the next packet in the buffer
+        hdr = (struct pcap_pkthdr*) (pkt + pktLen);
+
+        if (stop_) {
+            ret = -2;
+            break;
+        }
+    }
+
+    return ret;
+}
@@ -0,0 +1,109 @@
+/*
+Copyright (C) 2017 Srivats P.
+
+
+This file is part of "Ostinato"
+
+This is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+
+#ifndef _SERVER_VIRTUAL_PORT_H
+#define _SERVER_VIRTUAL_PORT_H
+
+#include "pcapport.h"
+
+#include "ratemeter.h"
+
+#include <QMutex>
+#include <QString>
+
+/*!
+  A port with no NIC - frames are built and paced exactly as for a pcap
+  port but are then either discarded (null sink) or written to a pcap
+  file (file sink)
+
+  The transmitter runs in virtual time - it doesn't wait for a frame's
+  scheduled time, it just advances its clock to it. So a null port sends
+  as fast as the frames can be built (a benchmark of the transmit path
+  without a NIC or driver in the way) and a file port writes the frames
+  with the timestamps they would have been sent at, how ever long that is
+  in real time. Transmit run stats (duration) are in virtual time too
+
+  Nothing is ever received on a virtual port and capture, device
+  emulation and the NIC based features are not supported
+*/
+class VirtualPort : public PcapPort
+{
+public:
+    enum Sink
+    {
+        kNullSink,
+        kPcapFileSink
+    };
+
+    VirtualPort(int id, const char *name, Sink sink,
+                const QString &fileName = QString());
+
+    void init();
+
+    virtual bool hasExclusiveControl() { return true; }
+
+    virtual void startCapture(const char * /*filter*/,
+                              const OstProto::CaptureConfig &/*config*/) {}
+    virtual void stopCapture() {}
+    virtual bool isCaptureOn() { return false; }
+    virtual bool isCaptureRing() { return false; }
+    virtual void snapshotCaptureRing() {}
+
+    virtual void startDeviceEmulation() {}
+    virtual void stopDeviceEmulation() {}
+    virtual int sendEmulationPacket(PacketBuffer * /*pktBuf*/) { return -1; }
+    virtual int sendEmulationPackets(const QList<PacketBuffer*> &/*pktBufs*/) {
+        return -1;
+    }
+
+    virtual void stats(PortStats *stats);
+    // Virtual time has no drift to correct
+    virtual bool hasRateControl() { return false; }
+
+protected:
+    class PortTransmitter: public PcapPort::PortTransmitter
+    {
+    public:
+        PortTransmitter(const char *name, Sink sink, const QString &fileName);
+        ~PortTransmitter();
+
+        void run();
+
+    protected:
+        virtual bool open();
+        virtual int sendQueueTransmit(pcap_t *p, pcap_send_queue *queue,
+                    qint64 &overHead, int sync);
+
+    private:
+        Sink sink_;
+        QString fileName_;
+        pcap_dumper_t *dumper_;
+        quint64 startNsec_; // real time (nsecs since the epoch) of open()
+    };
+
+private:
+    QMutex rateLock_;
+    RateMeter txRate_;
+    quint64 lastTxPkts_;
+    quint64 lastTxBytes_;
+};
+
+#endif
@@ -19,6 +19,8 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 
 #include "winpcapport.h"
 
+#include "streamstats.h"
+
 #include <QCoreApplication> 
 #include <QProcess> 
 
@@ -39,6 +41,18 @@ WinPcapPort::WinPcapPort(int id, const char *device)
 
     monitorRx_ = new PortMonitor(device, kDirectionRx, &stats_);
     monitorTx_ = new PortMonitor(device, kDirectionTx, &stats_);
+    monitorTx_->setRateControl(this);
+
+    // Replace the pcap based transmitters with send queue based ones
+    delete transmitter_;
+    transmitter_ = new PortTransmitter(device);
+    for (int i = 0; i < txWorkers_.size(); i++) {
+        delete txWorkers_[i];
+        txWorkers_[i] = new PortTransmitter(device);
+        txWorkers_[i]->placer().setName(QString("tx%1").arg(i + 1));
+        txWorkers_[i]->metrics().setThread(QString("tx%1").arg(i + 1));
+        txWorkers_[i]->setStreamStatsLane(i + 1);
+    }
 
     adapter_ = PacketOpenAdapter((CHAR*)device);
     if (!adapter_)
@@ -136,6 +150,7 @@ WinPcapPort::PortMonitor::PortMonitor(const char *device, Direction direction,
 
 void WinPcapPort::PortMonitor::run()
 {
+    ThreadPlacer::Scope placement(placer());
     struct timeval lastTs;
     quint64 lastTxPkts = 0;
     quint64 lastTxBytes = 0;
@@ -168,23 +183,30 @@ void WinPcapPort::PortMonitor::run()
                 switch (direction())
                 {
                 case kDirectionRx:
+                    rate_.update(pkts, bytes, qint64(usec)*1000);
+                    stats_->rxLock.writeBegin();
                     stats_->rxPkts += pkts;
                     stats_->rxBytes += bytes;
-                    stats_->rxPps = (pkts  * 1000000) / usec;
-                    stats_->rxBps = (bytes * 1000000) / usec;
+                    stats_->rxPps = rate_.pps();
+                    stats_->rxBps = rate_.bps();
+                    stats_->rxLock.writeEnd();
                     break;
 
                 case kDirectionTx:
                     if (isDirectional())
                     {
+                        stats_->txLock.writeBegin();
                         stats_->txPkts += pkts;
                         stats_->txBytes += bytes;
+                        stats_->txLock.writeEnd();
                     }
                     else
                     {
                         // Assuming stats_->txXXX are updated externally
-                        quint64 txPkts = stats_->txPkts;
-                        quint64 txBytes = stats_->txBytes;
+                        AbstractPort::PortStats now;
+                        stats_->snapshot(&now);
+                        quint64 txPkts = now.txPkts;
+                        quint64 txBytes = now.txBytes;
 
                         pkts = txPkts - lastTxPkts;
                         bytes = txBytes - lastTxBytes;
@@ -192,8 +214,13 @@ void WinPcapPort::PortMonitor::run()
                         lastTxPkts = txPkts;
                         lastTxBytes = txBytes;
                     }
-                    stats_->txPps = (pkts  * 1000000) / usec;
-                    stats_->txBps = (bytes * 1000000) / usec;
+                    rate_.update(pkts, bytes, qint64(usec)*1000);
+                    stats_->txRateLock.writeBegin();
+                    stats_->txPps = rate_.pps();
+                    stats_->txBps = rate_.bps();
+                    stats_->txRateLock.writeEnd();
+                    if (rateControl_)
+                        rateControl_->updateRateControl();
                     break;
 
                 default:
@@ -223,4 +250,187 @@ void WinPcapPort::PortMonitor::run()
     }
 }
 
+/*
+ * ------------------------------------------------------------------- *
+ * Port Transmitter
+ * ------------------------------------------------------------------- *
+ */
+/*
+  Sends the frames of a packet set with pcap_sendqueue_transmit() - the
+  driver paces them as per their timestamps, so there's no user space
+  busy wait per frame. A packet set is sent in chunks of upto
+  kMaxChunkNsec so that a stop doesn't have to wait for all of a long
+  packet set to be sent; the gaps between chunks are waited out by us,
+  in slices, for the same reason
+*/
+WinPcapPort::PortTransmitter::PortTransmitter(const char *device)
+    : PcapPort::PortTransmitter(device)
+{
+    pacedQueue_ = pcap_sendqueue_alloc(qMax(uint(PacketSequence::kQueueSize),
+                                            uint(kGeneratedQueueSize)));
+}
+
+WinPcapPort::PortTransmitter::~PortTransmitter()
+{
+    if (pacedQueue_)
+        pcap_sendqueue_destroy(pacedQueue_);
+}
+
+int WinPcapPort::PortTransmitter::sendQueueTransmit(pcap_t *p,
+        pcap_send_queue *queue, qint64 &overHead, int sync)
+{
+    struct pcap_pkthdr *first = (struct pcap_pkthdr*) queue->buffer;
+    char *end = queue->buffer + queue->len;
+    struct timeval lastTs;
+
+    // Tracked stream frames are stamped with their tx time just before
+    // they are sent - so they can't be handed to the kernel in advance
+    if (hasSignedFrames(queue))
+        return PcapPort::PortTransmitter::sendQueueTransmit(p, queue,
+                    overHead, sync);
+
+    lastTs = first->ts;
+    while ((char*) first < end)
+    {
+        struct pcap_pkthdr *hdr = first;
+        struct pcap_pkthdr *last = first;
+        pcap_send_queue chunk;
+        pcap_send_queue *paced;
+        TimeStamp ovrStart, ovrEnd;
+        long pkts = 0;
+        quint64 bytes = 0;
+        u_int sent;
+
+        while (((char*) hdr < end)
+                && (nsecTsDiff(hdr->ts, first->ts) <= kMaxChunkNsec))
+        {
+            pkts++;
+            bytes += hdr->caplen;
+            last = hdr;
+            hdr = (struct pcap_pkthdr*) ((uchar*)hdr + sizeof(*hdr)
+                                            + hdr->caplen);
+        }
+        chunk.buffer = (char*) first;
+        chunk.len = chunk.maxlen = (char*) hdr - (char*) first;
+
+        // Gap from the last frame of the previous chunk
+        if (sync)
+        {
+            qint64 nsec = pacedGap(nsecTsDiff(first->ts, lastTs)) + overHead;
+
+            if (nsec > 0)
+            {
+                if (!waitAbortable(nsec))
+                    return -2;
+                overHead = 0;
+            }
+            else
+                overHead = nsec;
+        }
+
+        paced = sync ? pacedChunk(&chunk) : &chunk;
+
+        getTimeStamp(&ovrStart);
+        sent = pcap_sendqueue_transmit(p, paced, sync);
+        getTimeStamp(&ovrEnd);
+
+        if (sent < paced->len)
+        {
+            qWarning("%s: pcap_sendqueue_transmit failed (%s)", __FUNCTION__,
+                    pcap_geterr(p));
+            metrics_.add(OstProto::DroneMetric::kTxSendErrors);
+            return -1;
+        }
+        stats_->txLock.writeBegin();
+        stats_->txPkts += pkts;
+        stats_->txBytes += bytes;
+        stats_->txLock.writeEnd();
+
+        // The kernel took the chunk's duration (if sync) plus overhead
+        if (sync)
+            overHead += pacedGap(nsecTsDiff(last->ts, first->ts))
+                            - ndiffTimeStamp(&ovrStart, &ovrEnd);
+
+        lastTs = last->ts;
+        first = hdr;
+
+        if (stop_)
+            return -2;
+    }
+
+    return 0;
+}
+
+bool WinPcapPort::PortTransmitter::hasSignedFrames(
+        const pcap_send_queue *queue)
+{
+    const char *p = queue->buffer;
+    const char *end = queue->buffer + queue->len;
+
+    while (p < end)
+    {
+        const struct pcap_pkthdr *hdr = (const struct pcap_pkthdr*) p;
+        const uchar *frame = (const uchar*) p + sizeof(*hdr);
+
+        if (StreamStatsTable::isSigned(frame, hdr->caplen))
+            return true;
+        p = (const char*) frame + hdr->caplen;
+    }
+
+    return false;
+}
+
+/*!
+  Returns chunk as is or, if the rate controller has scaled the pacing, a
+  copy of it (in pacedQueue_) with the frame timestamps scaled likewise
+*/
+pcap_send_queue* WinPcapPort::PortTransmitter::pacedChunk(
+        pcap_send_queue *chunk)
+{
+    struct timeval firstTs = ((struct pcap_pkthdr*) chunk->buffer)->ts;
+    double scale = double(int(rateScale_))/kRateScaleOne;
+    char *p, *end;
+
+    if ((scale == 1.0) || !pacedQueue_ || (chunk->len > pacedQueue_->maxlen))
+        return chunk;
+
+    memcpy(pacedQueue_->buffer, chunk->buffer, chunk->len);
+    pacedQueue_->len = chunk->len;
+
+    p = pacedQueue_->buffer;
+    end = p + pacedQueue_->len;
+    while (p < end)
+    {
+        struct pcap_pkthdr *hdr = (struct pcap_pkthdr*) p;
+        qint64 units = qint64(nsecTsDiff(hdr->ts, firstTs)*scale)
+                            / (1000000000/kTsUnitsPerSec) + firstTs.tv_usec;
+
+        hdr->ts.tv_sec = firstTs.tv_sec + long(units/kTsUnitsPerSec);
+        hdr->ts.tv_usec = long(units % kTsUnitsPerSec);
+        p += sizeof(*hdr) + hdr->caplen;
+    }
+
+    return pacedQueue_;
+}
+
+/*!
+  Waits nsec in slices of upto kMaxChunkNsec - returns false if stopped
+  while waiting
+*/
+bool WinPcapPort::PortTransmitter::waitAbortable(qint64 nsec)
+{
+    while (nsec > 0)
+    {
+        qint64 slice = qMin(nsec, qint64(kMaxChunkNsec));
+
+        (*ndelayFn_)(slice);
+        nsec -= slice;
+
+        if (stop_)
+            return false;
+    }
+
+    return true;
+}
+
 #endif
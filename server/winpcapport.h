@@ -46,6 +46,26 @@ protected:
                 AbstractPort::PortStats *stats);
         void run();
     };
+
+    class PortTransmitter: public PcapPort::PortTransmitter
+    {
+    public:
+        PortTransmitter(const char *device);
+        ~PortTransmitter();
+    protected:
+        virtual int sendQueueTransmit(pcap_t *p, pcap_send_queue *queue,
+                    qint64 &overHead, int sync);
+    private:
+        static bool hasSignedFrames(const pcap_send_queue *queue);
+        pcap_send_queue* pacedChunk(pcap_send_queue *chunk);
+        bool waitAbortable(qint64 nsec);
+
+        // Max duration of frames handed to the kernel in one go - and so
+        // the max time taken to stop
+        static const qint64 kMaxChunkNsec = 100000000;
+
+        pcap_send_queue *pacedQueue_;
+    };
 private:
     LPADAPTER adapter_;
     PPACKET_OID_DATA linkStateOid_ ;
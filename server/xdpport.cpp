@@ -0,0 +1,447 @@
+/*
+Copyright (C) 2017 Srivats P.
+
+
+This file is part of "Ostinato"
+
+This is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+
+#include "xdpport.h"
+
+#ifdef HAVE_AF_XDP
+
+#include "timestamp.h"
+
+#include <errno.h>
+#include <net/if.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#ifndef AF_XDP
+#define AF_XDP 44
+#endif
+#ifndef SOL_XDP
+#define SOL_XDP 283
+#endif
+
+XdpPort::XdpPort(int id, const char *device)
+    : LinuxPort(id, device)
+{
+    // Replace the TX_RING based transmitters with AF_XDP based ones - one
+    // NIC queue per tx worker
+    delete transmitter_;
+    transmitter_ = new PortTransmitter(device, 0);
+    for (int i = 0; i < txWorkers_.size(); i++) {
+        delete txWorkers_[i];
+        txWorkers_[i] = new PortTransmitter(device, i + 1);
+        txWorkers_[i]->placer().setName(QString("tx%1").arg(i + 1));
+        txWorkers_[i]->metrics().setThread(QString("tx%1").arg(i + 1));
+        txWorkers_[i]->setStreamStatsLane(i + 1);
+    }
+
+    updateTxNumaNode();
+}
+
+void XdpPort::init()
+{
+    LinuxPort::init();
+
+    bool isXsk = static_cast<PortTransmitter*>(transmitter_)->isXsk();
+    for (int i = 0; i < txWorkers_.size(); i++)
+        isXsk = isXsk && static_cast<PortTransmitter*>(txWorkers_[i])->isXsk();
+
+    if (!isXsk)
+        addNote("AF_XDP not available on all tx queues - "
+                "using pcap to transmit on those");
+}
+
+// Returns true if we can transmit on device using AF_XDP
+bool XdpPort::isSupported(const char *device)
+{
+    int fd = socket(AF_XDP, SOCK_RAW, 0);
+
+    if (fd < 0) {
+        qDebug("%s: AF_XDP not supported (%s)", device, strerror(errno));
+        return false;
+    }
+    close(fd);
+
+    return if_nametoindex(device) != 0;
+}
+
+XdpPort::PortTransmitter::PortTransmitter(const char *device, int queueId)
+    : PcapPort::PortTransmitter(device)
+{
+    xskFd_ = -1;
+    umem_ = NULL;
+    memset(&txRing_, 0, sizeof(txRing_));
+    memset(&completionRing_, 0, sizeof(completionRing_));
+    txProducer_ = 0;
+    useWakeup_ = false;
+    pendingPkts_ = 0;
+    pendingBytes_ = 0;
+
+    if (!setupXsk(device, queueId))
+        qWarning("%s: AF_XDP not available on queue %d, using pcap "
+                "to transmit", device, queueId);
+}
+
+XdpPort::PortTransmitter::~PortTransmitter()
+{
+    closeXsk();
+}
+
+bool XdpPort::PortTransmitter::setupXsk(const char *device, int queueId)
+{
+    struct xdp_umem_reg umemReg;
+    struct xdp_mmap_offsets offsets;
+    struct sockaddr_xdp addr;
+    socklen_t optLen;
+    int ringSize = kUmemFrameCount;
+    size_t umemSize = kUmemFrameSize * kUmemFrameCount;
+    int ifIndex;
+    void *umem;
+
+    ifIndex = if_nametoindex(device);
+    if (!ifIndex) {
+        qDebug("%s: unable to get ifIndex (%s)", device, strerror(errno));
+        return false;
+    }
+
+    xskFd_ = socket(AF_XDP, SOCK_RAW, 0);
+    if (xskFd_ < 0) {
+        qDebug("%s: unable to open AF_XDP socket (%s)", device,
+                strerror(errno));
+        return false;
+    }
+
+    umem = mmap(NULL, umemSize, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+    if (umem == MAP_FAILED) {
+        qDebug("%s: unable to mmap UMEM (%s)", device, strerror(errno));
+        goto _error;
+    }
+    umem_ = (uchar*) umem;
+
+    memset(&umemReg, 0, sizeof(umemReg));
+    umemReg.addr = (quint64) umem_;
+    umemReg.len = umemSize;
+    umemReg.chunk_size = kUmemFrameSize;
+    umemReg.headroom = 0;
+    if (setsockopt(xskFd_, SOL_XDP, XDP_UMEM_REG,
+                &umemReg, sizeof(umemReg)) < 0) {
+        qDebug("%s: unable to register UMEM (%s)", device, strerror(errno));
+        goto _error;
+    }
+
+    // We never receive on this socket, but bind() needs a fill ring
+    if ((setsockopt(xskFd_, SOL_XDP, XDP_UMEM_FILL_RING,
+                    &ringSize, sizeof(ringSize)) < 0)
+            || (setsockopt(xskFd_, SOL_XDP, XDP_UMEM_COMPLETION_RING,
+                    &ringSize, sizeof(ringSize)) < 0)
+            || (setsockopt(xskFd_, SOL_XDP, XDP_TX_RING,
+                    &ringSize, sizeof(ringSize)) < 0)) {
+        qDebug("%s: unable to setup XSK rings (%s)", device, strerror(errno));
+        goto _error;
+    }
+
+    optLen = sizeof(offsets);
+    if (getsockopt(xskFd_, SOL_XDP, XDP_MMAP_OFFSETS,
+                &offsets, &optLen) < 0) {
+        qDebug("%s: unable to get XSK ring offsets (%s)", device,
+                strerror(errno));
+        goto _error;
+    }
+
+    if (!mapRing(&txRing_, offsets.tx, sizeof(struct xdp_desc),
+                XDP_PGOFF_TX_RING)
+            || !mapRing(&completionRing_, offsets.cr, sizeof(quint64),
+                XDP_UMEM_PGOFF_COMPLETION_RING)) {
+        qDebug("%s: unable to mmap XSK rings (%s)", device, strerror(errno));
+        goto _error;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sxdp_family = AF_XDP;
+    addr.sxdp_ifindex = ifIndex;
+    addr.sxdp_queue_id = queueId;
+#ifdef XDP_USE_NEED_WAKEUP
+    // Kick the kernel only when it asks for it (kernel 5.4+)
+    addr.sxdp_flags = XDP_USE_NEED_WAKEUP;
+    useWakeup_ = true;
+    if (bind(xskFd_, (struct sockaddr*) &addr, sizeof(addr)) < 0)
+#endif
+    {
+        addr.sxdp_flags = 0;
+        useWakeup_ = false;
+        if (bind(xskFd_, (struct sockaddr*) &addr, sizeof(addr)) < 0) {
+            qDebug("%s: unable to bind AF_XDP socket to queue %d (%s)",
+                    device, queueId, strerror(errno));
+            goto _error;
+        }
+    }
+
+    freeFrames_.clear();
+    freeFrames_.reserve(kUmemFrameCount);
+    for (int i = kUmemFrameCount - 1; i >= 0; i--)
+        freeFrames_.append(quint64(i) * kUmemFrameSize);
+    txProducer_ = *txRing_.producer;
+
+#ifdef XDP_OPTIONS
+    {
+        struct xdp_options options;
+
+        optLen = sizeof(options);
+        if (getsockopt(xskFd_, SOL_XDP, XDP_OPTIONS, &options, &optLen) == 0)
+            qDebug("%s: AF_XDP on queue %d in %s mode", device, queueId,
+                    (options.flags & XDP_OPTIONS_ZEROCOPY) ?
+                        "zero copy" : "copy");
+    }
+#endif
+
+    return true;
+
+_error:
+    closeXsk();
+    return false;
+}
+
+void XdpPort::PortTransmitter::closeXsk()
+{
+    if (txRing_.map)
+        munmap(txRing_.map, txRing_.mapSize);
+    if (completionRing_.map)
+        munmap(completionRing_.map, completionRing_.mapSize);
+    memset(&txRing_, 0, sizeof(txRing_));
+    memset(&completionRing_, 0, sizeof(completionRing_));
+
+    if (xskFd_ >= 0)
+        close(xskFd_);
+    xskFd_ = -1;
+
+    if (umem_)
+        munmap(umem_, kUmemFrameSize * kUmemFrameCount);
+    umem_ = NULL;
+}
+
+bool XdpPort::PortTransmitter::mapRing(Ring *ring,
+        const struct xdp_ring_offset &offset, size_t descSize, quint64 pgoff)
+{
+    size_t size = offset.desc + kUmemFrameCount * descSize;
+    void *map = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, xskFd_, pgoff);
+
+    if (map == MAP_FAILED)
+        return false;
+
+    ring->map = map;
+    ring->mapSize = size;
+    ring->producer = (volatile quint32*) ((uchar*) map + offset.producer);
+    ring->consumer = (volatile quint32*) ((uchar*) map + offset.consumer);
+    ring->flags = (volatile quint32*) ((uchar*) map + offset.flags);
+    ring->desc = (uchar*) map + offset.desc;
+
+    return true;
+}
+
+// Returns frames whose transmission is complete to the free list
+void XdpPort::PortTransmitter::reclaimUmemFrames()
+{
+    quint32 consumer = *completionRing_.consumer;
+    quint32 producer = *completionRing_.producer;
+    const quint64 *addr = (const quint64*) completionRing_.desc;
+
+    // Read the completed addresses only after the producer index
+    __sync_synchronize();
+    for (; consumer != producer; consumer++)
+        freeFrames_.append(addr[consumer & (kUmemFrameCount - 1)]);
+    __sync_synchronize();
+    *completionRing_.consumer = consumer;
+}
+
+// Returns the UMEM offset of a free frame, kicking the kernel and waiting
+// for it to complete some frames if there are none; -1 on error or stop
+qint64 XdpPort::PortTransmitter::nextUmemFrame()
+{
+    while (freeFrames_.isEmpty())
+    {
+        if (flushTxRing() < 0)
+            return -1;
+
+        reclaimUmemFrames();
+        if (!freeFrames_.isEmpty())
+            break;
+
+        if (stop_)
+            return -1;
+
+        // Completions are not signalled - poll for them
+        struct pollfd pfd;
+
+        pfd.fd = xskFd_;
+        pfd.events = POLLOUT;
+        pfd.revents = 0;
+        if ((poll(&pfd, 1, 1 /* ms */) < 0) && (errno != EINTR)) {
+            qWarning("AF_XDP poll failed (%s)", strerror(errno));
+            return -1;
+        }
+    }
+
+    quint64 frame = freeFrames_.last();
+    freeFrames_.pop_back();
+
+    return qint64(frame);
+}
+
+// Publish the frames queued in the tx ring and kick the kernel (if needed)
+int XdpPort::PortTransmitter::flushTxRing()
+{
+    if (!pendingPkts_)
+        return 0;
+
+    // Descriptors must be visible before the producer index
+    __sync_synchronize();
+    *txRing_.producer = txProducer_;
+
+    if (!useWakeup_ || (*txRing_.flags & XDP_RING_NEED_WAKEUP))
+    {
+        while (sendto(xskFd_, NULL, 0, MSG_DONTWAIT, NULL, 0) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            // The kernel is busy with the ring - it will get to our frames
+            if ((errno == EAGAIN) || (errno == EBUSY) || (errno == ENOBUFS)) {
+                metrics_.add(OstProto::DroneMetric::kTxSendRetries);
+                break;
+            }
+            qWarning("AF_XDP send failed (%s)", strerror(errno));
+            metrics_.add(OstProto::DroneMetric::kTxSendErrors);
+            return -1;
+        }
+    }
+
+    // The frames are now owned by the kernel, so account for them in one go
+    stats_->txLock.writeBegin();
+    stats_->txPkts += pendingPkts_;
+    stats_->txBytes += pendingBytes_;
+    stats_->txLock.writeEnd();
+    pendingPkts_ = 0;
+    pendingBytes_ = 0;
+
+    return 0;
+}
+
+int XdpPort::PortTransmitter::sendQueueTransmit(pcap_t *p,
+        pcap_send_queue *queue, qint64 &overHead, int sync)
+{
+    TimeStamp ovrStart, ovrEnd;
+    struct timeval ts;
+    struct pcap_pkthdr *hdr = (struct pcap_pkthdr*) queue->buffer;
+    char *end = queue->buffer + queue->len;
+    struct xdp_desc *desc = (struct xdp_desc*) txRing_.desc;
+
+    if (!isXsk())
+        return PcapPort::PortTransmitter::sendQueueTransmit(p, queue,
+                    overHead, sync);
+
+    ts = hdr->ts;
+
+    getTimeStamp(&ovrStart);
+    while((char*) hdr < end)
+    {
+        uchar *pkt = (uchar*)hdr + sizeof(*hdr);
+        int pktLen = hdr->caplen;
+
+        if (sync)
+        {
+            qint64 nsec = pacedGap(nsecTsDiff(hdr->ts, ts));
+
+            getTimeStamp(&ovrEnd);
+
+            overHead -= ndiffTimeStamp(&ovrStart, &ovrEnd);
+            Q_ASSERT(overHead <= 0);
+            nsec += overHead;
+            if (isPastStopTime(nsec))
+                return (flushTxRing() < 0) ? -1 : -2;
+            if (nsec > 0)
+            {
+                // Frames queued so far must go out before we wait
+                if (flushTxRing() < 0)
+                    return -1;
+                (*ndelayFn_)(nsec);
+                overHead = 0;
+            }
+            else
+                overHead = nsec;
+
+            ts = hdr->ts;
+            getTimeStamp(&ovrStart);
+        }
+
+        Q_ASSERT(pktLen > 0);
+
+        streamStats_.stampTx(pkt, pktLen);
+        if (pktLen <= kUmemFrameSize)
+        {
+            qint64 frame = nextUmemFrame();
+            struct xdp_desc *slot;
+
+            if (frame < 0)
+                return stop_ ? -2 : -1;
+
+            memcpy(umem_ + frame, pkt, pktLen);
+            slot = &desc[txProducer_ & (kUmemFrameCount - 1)];
+            slot->addr = frame;
+            slot->len = pktLen;
+            slot->options = 0;
+            txProducer_++;
+
+            pendingPkts_++;
+            pendingBytes_ += pktLen;
+            if ((pendingPkts_ >= kTxMaxBatch) && (flushTxRing() < 0))
+                return -1;
+        }
+        else
+        {
+            // Frame doesn't fit in a UMEM frame - send it the slow way,
+            // but only after the frames queued before it
+            if (flushTxRing() < 0)
+                return -1;
+            if (pcap_sendpacket(p, pkt, pktLen) < 0)
+                metrics_.add(OstProto::DroneMetric::kTxSendErrors);
+            stats_->txLock.writeBegin();
+            stats_->txPkts++;
+            stats_->txBytes += pktLen;
+            stats_->txLock.writeEnd();
+        }
+
+        // Step to the next packet in the buffer
+        hdr = (struct pcap_pkthdr*) (pkt + pktLen);
+        pkt = (uchar*) ((uchar*)hdr + sizeof(*hdr));
+
+        if (stop_)
+        {
+            flushTxRing();
+            return -2;
+        }
+    }
+
+    return flushTxRing();
+}
+#endif
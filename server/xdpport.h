@@ -0,0 +1,107 @@
+/*
+Copyright (C) 2017 Srivats P.
+
+
+This file is part of "Ostinato"
+
+This is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+
+#ifndef _SERVER_XDP_PORT_H
+#define _SERVER_XDP_PORT_H
+
+#include <QtGlobal>
+
+#ifdef HAVE_AF_XDP
+
+#include "linuxport.h"
+
+#include <QVector>
+#include <linux/if_xdp.h>
+
+/*!
+  A Linux port that transmits using an AF_XDP socket
+
+  Frames are copied into a UMEM shared with the kernel (and with the NIC
+  for drivers that support zero copy) and handed over via the XSK tx ring,
+  bypassing the qdisc and most of the kernel's tx path; each tx worker has
+  its own socket bound to a NIC queue of its own.
+
+  No XDP program is attached, so received frames continue up the kernel
+  stack - port stats (from LinuxPort's StatsMonitor) and capture work just
+  like they do for LinuxPort.
+
+  Frames too large for a UMEM frame are sent using pcap
+*/
+class XdpPort : public LinuxPort
+{
+public:
+    XdpPort(int id, const char *device);
+
+    void init();
+
+    static bool isSupported(const char *device);
+
+protected:
+    class PortTransmitter: public PcapPort::PortTransmitter
+    {
+    public:
+        PortTransmitter(const char *device, int queueId);
+        ~PortTransmitter();
+
+        bool isXsk() { return xskFd_ >= 0; }
+    protected:
+        virtual int sendQueueTransmit(pcap_t *p, pcap_send_queue *queue,
+                    qint64 &overHead, int sync);
+    private:
+        struct Ring
+        {
+            volatile quint32 *producer;
+            volatile quint32 *consumer;
+            volatile quint32 *flags;
+            void *desc;
+            void *map;
+            size_t mapSize;
+        };
+
+        bool setupXsk(const char *device, int queueId);
+        void closeXsk();
+        bool mapRing(Ring *ring, const struct xdp_ring_offset &offset,
+                size_t descSize, quint64 pgoff);
+        qint64 nextUmemFrame();
+        void reclaimUmemFrames();
+        int flushTxRing();
+
+        // UMEM of kUmemFrameCount frames; the tx/completion rings are of
+        // the same size, so a free UMEM frame implies a free tx slot
+        static const int kUmemFrameSize = 2048;
+        static const int kUmemFrameCount = 2048;
+        // Max frames queued in the tx ring before we kick the kernel
+        static const int kTxMaxBatch = 64;
+
+        int xskFd_;
+        uchar *umem_;
+        Ring txRing_;
+        Ring completionRing_;
+        quint32 txProducer_;
+        bool useWakeup_;
+        QVector<quint64> freeFrames_;
+        int pendingPkts_;
+        quint64 pendingBytes_;
+    };
+};
+#endif
+
+#endif
@@ -0,0 +1,248 @@
+/*
+Copyright (C) 2017 Srivats P.
+
+This file is part of "Ostinato"
+
+This is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+#include "emulbench.h"
+
+#include "devicemanager.h"
+#include "emulproto.pb.h"
+#include "packetbuffer.h"
+
+#include <QElapsedTimer>
+#include <QFile>
+#include <qendian.h>
+
+static const quint64 kDeviceMac = 0x000100000001ULL;
+static const quint32 kDeviceIp4 = 0x0a000001; // 10.0.0.1
+static const quint64 kDeviceIp6Hi = 0x20010db800000000ULL; // 2001:db8::
+static const quint64 kDeviceIp6Lo = 1;
+
+static const quint64 kPeerMac = 0x00aabbccddeeULL;
+static const quint32 kPeerIp4 = 0x0affffff; // 10.255.255.255 - in /8
+
+// Bcast ND (solicited node mcast) is handled by every device, so is
+// replayed fewer times than the others
+static const int kMaxNdPackets = 1000;
+
+static const int kHeadroom = 64;
+
+// Resident memory in KB (Linux only; 0 elsewhere)
+static qint64 residentKB()
+{
+    QFile status("/proc/self/status");
+
+    if (!status.open(QIODevice::ReadOnly))
+        return 0;
+
+    foreach(QByteArray line, status.readAll().split('\n')) {
+        if (line.startsWith("VmRSS:"))
+            return line.mid(6).trimmed().split(' ').at(0).toLongLong();
+    }
+
+    return 0;
+}
+
+static void putMac(uchar *p, quint64 mac)
+{
+    *(quint32*)(p) = qToBigEndian(quint32(mac >> 16));
+    *(quint16*)(p + 4) = qToBigEndian(quint16(mac & 0xffff));
+}
+
+static QByteArray arpRequest(int index)
+{
+    QByteArray frame(14 + 28, 0);
+    uchar *p = (uchar*) frame.data();
+
+    putMac(p, 0xffffffffffffULL);
+    putMac(p + 6, kPeerMac);
+    *(quint16*)(p + 12) = qToBigEndian(quint16(0x0806));
+    p += 14;
+    *(quint32*)(p) = qToBigEndian(quint32(0x00010800));
+    *(quint32*)(p + 4) = qToBigEndian(quint32(0x06040001));
+    putMac(p + 8, kPeerMac);
+    *(quint32*)(p + 14) = qToBigEndian(kPeerIp4);
+    *(quint32*)(p + 24) = qToBigEndian(quint32(kDeviceIp4 + index));
+
+    return frame;
+}
+
+static QByteArray icmpEchoRequest(int index)
+{
+    QByteArray frame(14 + 20 + 8 + 32, 0);
+    uchar *p = (uchar*) frame.data();
+
+    putMac(p, kDeviceMac + index);
+    putMac(p + 6, kPeerMac);
+    *(quint16*)(p + 12) = qToBigEndian(quint16(0x0800));
+    p += 14;
+    p[0] = 0x45;
+    *(quint16*)(p + 2) = qToBigEndian(quint16(20 + 8 + 32));
+    p[8] = 64;
+    p[9] = 1; // ICMP
+    *(quint32*)(p + 12) = qToBigEndian(kPeerIp4);
+    *(quint32*)(p + 16) = qToBigEndian(quint32(kDeviceIp4 + index));
+    p += 20;
+    p[0] = 8; // Echo Request
+
+    return frame;
+}
+
+static QByteArray neighborSolicit(int index)
+{
+    QByteArray frame(14 + 40 + 24 + 8, 0);
+    uchar *p = (uchar*) frame.data();
+    quint64 tgtLo = kDeviceIp6Lo + index;
+
+    // solicited node mcast - 33:33:ff:xx:xx:xx
+    putMac(p, 0x3333ff000000ULL | (tgtLo & 0xffffff));
+    putMac(p + 6, kPeerMac);
+    *(quint16*)(p + 12) = qToBigEndian(quint16(0x86dd));
+    p += 14;
+    p[0] = 0x60;
+    *(quint16*)(p + 4) = qToBigEndian(quint16(24 + 8));
+    p[6] = 58; // ICMPv6
+    p[7] = 255;
+    *(quint64*)(p + 8) = qToBigEndian(kDeviceIp6Hi);
+    *(quint64*)(p + 16) = qToBigEndian(quint64(0xffff));
+    *(quint64*)(p + 24) = qToBigEndian(quint64(0xff02ULL << 48));
+    *(quint64*)(p + 32) = qToBigEndian(0x00000001ff000000ULL
+                                        | (tgtLo & 0xffffff));
+    p += 40;
+    p[0] = 135; // NS
+    *(quint64*)(p + 8) = qToBigEndian(kDeviceIp6Hi);
+    *(quint64*)(p + 16) = qToBigEndian(tgtLo);
+    p[24] = 1; // Source link-layer address option
+    p[25] = 1;
+    putMac(p + 26, kPeerMac);
+
+    return frame;
+}
+
+/*!
+  Replays count frames from makeFrame(index % devices) through the
+  DeviceManager rx path; returns nsecs taken
+*/
+static qint64 replay(DeviceManager *deviceManager, int devices, int count,
+                     QByteArray (*makeFrame)(int))
+{
+    QVector<QByteArray> frames(qMin(devices, count));
+    QElapsedTimer timer;
+
+    for (int i = 0; i < frames.size(); i++)
+        frames[i] = makeFrame(i);
+
+    timer.start();
+    for (int i = 0; i < count; i++) {
+        const QByteArray &frame = frames.at(i % frames.size());
+        PacketBuffer *pktBuf = PacketBuffer::alloc(kHeadroom);
+
+        memcpy(pktBuf->put(frame.size()), frame.constData(), frame.size());
+        deviceManager->receivePacket(pktBuf);
+        pktBuf->release();
+    }
+
+    return timer.nsecsElapsed();
+}
+
+static void printResult(const char *name, int devices, int count,
+                        qint64 nsec, quint64 replies, qint64 memoryKB = 0)
+{
+    printf("%s,%d,%d,%lld,%.0f,%llu,%lld\n", name, devices, count, nsec,
+            double(count)*1e9/nsec, replies, memoryKB);
+}
+
+/*!
+  Device emulation setup time, memory and rx packets/sec of drone's
+  DeviceManager with device groups of 1K, 10K and 100K devices (or the
+  device counts given) - one device group of dual stack devices
+
+  Results are CSV on stdout, one line per device count and packet type
+*/
+int testEmulBench(int argc, char* argv[])
+{
+    QList<int> deviceCounts;
+
+    for (int i = 1; i < argc; i++) {
+        int count = atoi(argv[i]);
+        if (count <= 0) {
+            printf("usage:\n");
+            printf("%s [<devices> ...]\n", argv[0]);
+            return 255;
+        }
+        deviceCounts.append(count);
+    }
+    if (deviceCounts.isEmpty())
+        deviceCounts << 1000 << 10000 << 100000;
+
+    printf("case,devices,count,nsec,per_sec,replies,memory_kb\n");
+
+    for (int i = 0; i < deviceCounts.size(); i++) {
+        int devices = deviceCounts.at(i);
+        BenchPort port(0);
+        DeviceManager *deviceManager = port.deviceManager();
+        OstProto::DeviceGroup deviceGroup;
+        QElapsedTimer timer;
+        qint64 rss = residentKB();
+        qint64 nsec;
+        quint64 replies;
+
+        deviceGroup.mutable_device_group_id()->set_id(1);
+        deviceGroup.set_device_count(devices);
+        deviceGroup.MutableExtension(OstEmul::mac)->set_address(kDeviceMac);
+        deviceGroup.MutableExtension(OstEmul::ip4)->set_address(kDeviceIp4);
+        deviceGroup.MutableExtension(OstEmul::ip4)->set_prefix_length(8);
+        deviceGroup.MutableExtension(OstEmul::ip6)->mutable_address()
+                                                    ->set_hi(kDeviceIp6Hi);
+        deviceGroup.MutableExtension(OstEmul::ip6)->mutable_address()
+                                                    ->set_lo(kDeviceIp6Lo);
+        deviceGroup.MutableExtension(OstEmul::ip6)->mutable_step()
+                                                    ->set_lo(1);
+
+        // setup - add and then modify (the config a client applies)
+        timer.start();
+        deviceManager->addDeviceGroup(1);
+        deviceManager->modifyDeviceGroup(&deviceGroup);
+        nsec = timer.nsecsElapsed();
+        printResult("setup", devices, deviceManager->deviceCount(), nsec, 0,
+                    residentKB() - rss);
+
+        // rx - each packet type to each device in turn
+        replies = port.emulationTxPackets();
+        nsec = replay(deviceManager, devices, devices, arpRequest);
+        printResult("arp", devices, devices, nsec,
+                    port.emulationTxPackets() - replies);
+
+        replies = port.emulationTxPackets();
+        nsec = replay(deviceManager, devices, devices, icmpEchoRequest);
+        printResult("icmp", devices, devices, nsec,
+                    port.emulationTxPackets() - replies);
+
+        replies = port.emulationTxPackets();
+        nsec = replay(deviceManager, devices, qMin(devices, kMaxNdPackets),
+                      neighborSolicit);
+        printResult("nd", devices, qMin(devices, kMaxNdPackets), nsec,
+                    port.emulationTxPackets() - replies);
+
+        // teardown
+        timer.start();
+        deviceManager->deleteDeviceGroup(1);
+        printResult("teardown", devices, devices, timer.nsecsElapsed(), 0);
+    }
+
+    return 0;
+}
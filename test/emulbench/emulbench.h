@@ -0,0 +1,70 @@
+/*
+Copyright (C) 2017 Srivats P.
+
+This file is part of "Ostinato"
+
+This is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+#ifndef _EMUL_BENCH_H
+#define _EMUL_BENCH_H
+
+#include "abstractport.h"
+
+/*!
+  A port without a device - for driving drone's DeviceManager without
+  any real transmit/capture; emulation packets sent are only counted
+*/
+class BenchPort : public AbstractPort
+{
+public:
+    BenchPort(int id) : AbstractPort(id, "bench") { txPackets_ = 0; }
+
+    quint64 emulationTxPackets() const { return txPackets_; }
+
+    virtual bool hasExclusiveControl() { return false; }
+    virtual bool setExclusiveControl(bool /*exclusive*/) { return false; }
+
+    virtual void clearPacketList() {}
+    virtual void loopNextPacketSet(qint64 /*size*/, qint64 /*repeats*/,
+            long /*repeatDelaySec*/, long /*repeatDelayNsec*/) {}
+    virtual bool appendToPacketList(long /*sec*/, long /*nsec*/,
+            const uchar* /*packet*/, int /*length*/) { return true; }
+    virtual void setPacketListLoopMode(bool /*loop*/,
+            quint64 /*secDelay*/, quint64 /*nsecDelay*/) {}
+
+    virtual void startTransmit() {}
+    virtual void stopTransmit() {}
+    virtual bool isTransmitOn() { return false; }
+
+    virtual void startCapture(const char* /*filter*/,
+                              const OstProto::CaptureConfig& /*config*/) {}
+    virtual void stopCapture() {}
+    virtual bool isCaptureOn() { return false; }
+    virtual QIODevice* captureData() { return NULL; }
+
+    virtual void startDeviceEmulation() {}
+    virtual void stopDeviceEmulation() {}
+    virtual int sendEmulationPacket(PacketBuffer* /*pktBuf*/) {
+        txPackets_++;
+        return 0;
+    }
+
+private:
+    quint64 txPackets_;
+};
+
+int testEmulBench(int argc, char* argv[]);
+
+#endif
@@ -0,0 +1,23 @@
+TEMPLATE = app
+CONFIG += qt console
+INCLUDEPATH += "../../common/" "../../server"
+# drone's device emulation (with a stub port) - dronecore before the libs
+# it needs (see drone.pri)
+win32 {
+    CONFIG(debug, debug|release) {
+        LIBS += -L"../../server/debug" -ldronecore
+        POST_TARGETDEPS += "../../server/debug/libdronecore.a"
+    } else {
+        LIBS += -L"../../server/release" -ldronecore
+        POST_TARGETDEPS += "../../server/release/libdronecore.a"
+    }
+} else {
+    LIBS += -L"../../server" -ldronecore
+    POST_TARGETDEPS += "../../server/libdronecore.a"
+}
+include(../../server/drone.pri)
+
+HEADERS += emulbench.h
+SOURCES += main.cpp emulbench.cpp
+
+QMAKE_DISTCLEAN += object_script.*
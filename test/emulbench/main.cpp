@@ -0,0 +1,71 @@
+/*
+Copyright (C) 2017 Srivats P.
+
+This file is part of "Ostinato"
+
+This is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+#include "emulbench.h"
+#include "protocolmanager.h"
+
+#include <QCoreApplication>
+#include <QSettings>
+
+extern ProtocolManager *OstProtocolManager;
+
+QSettings *appSettings;
+
+/*
+ * Dummy Stuff for successful linking - drone's are in MyService which
+ * isn't linked
+ */
+quint64 getDeviceMacAddress(
+        int /*portId*/,
+        int /*streamId*/,
+        int /*frameIndex*/)
+{
+    return 0;
+}
+
+quint64 getNeighborMacAddress(
+        int /*portId*/,
+        int /*streamId*/,
+        int /*frameIndex*/)
+{
+    return 0;
+}
+/* End of dummy stuff */
+
+int main(int argc, char* argv[])
+{
+    QCoreApplication app(argc, argv);
+    int exitCode;
+
+    app.setApplicationName("Drone");
+    app.setOrganizationName("Ostinato");
+
+    OstProtocolManager = new ProtocolManager();
+
+    // drone's settings - so that the emulation is set up as in drone
+    appSettings = new QSettings(QSettings::IniFormat,
+                                QSettings::UserScope,
+                                app.organizationName(),
+                                app.applicationName().toLower());
+
+    exitCode = testEmulBench(argc, argv);
+
+    delete appSettings;
+    return exitCode;
+}
@@ -1,11 +1,20 @@
 
+#include "cksum.h"
+#include "crc32c.h"
+#include "ip4.pb.h"
+#include "mac.pb.h"
 #include "ostprotolib.h"
+#include "payload.pb.h"
 #include "pcapfileformat.h"
 #include "protocol.pb.h"
 #include "protocolmanager.h"
+#include "rpcbench.h"
 #include "settings.h"
+#include "streambase.h"
+#include "userscript.pb.h"
 
 #include <QCoreApplication>
+#include <QElapsedTimer>
 #include <QFile>
 #include <QSettings>
 #include <QString>
@@ -46,6 +55,10 @@ int usage(int /*argc*/, char* argv[])
     printf("%s <command>\n", argv[0]);
     printf("command -\n");
     printf("  importpcap\n");
+    printf("  cksumbench\n");
+    printf("  crc32cbench\n");
+    printf("  framebench [<case>]\n");
+    printf("  rpcbench <host>[:<port>] [<port-id> [<calls> [<rtt-msecs>]]]\n");
 
     return 255;
 }
@@ -79,6 +92,413 @@ int testImportPcap(int argc, char* argv[])
     return 0;
 }
 
+int testCksumBench(int argc, char* argv[])
+{
+    const int kSizes[] = {64, 1500, 9000, 65536};
+    const quint64 kTotalBytes = 1 << 30;
+    QByteArray buf;
+
+    if (argc != 2)
+    {
+        printf("usage:\n");
+        printf("%s cksumbench\n", argv[0]);
+        return 255;
+    }
+
+    buf.resize(kSizes[sizeof(kSizes)/sizeof(kSizes[0]) - 1] + 1);
+    for (int i = 0; i < buf.size(); i++)
+        buf[i] = qrand();
+
+    printf("kernel: %s\n", onesComplementSumKernel());
+    printf("%8s %12s %12s %8s\n", "size", "scalar(ns)", "kernel(ns)", "speedup");
+
+    for (uint i = 0; i < sizeof(kSizes)/sizeof(kSizes[0]); i++)
+    {
+        // odd offset to include an unaligned buffer
+        const quint8 *p = (const quint8*) buf.constData() + 1;
+        int size = kSizes[i];
+        quint64 iterations = kTotalBytes/size;
+        quint32 scalarSum = 0, sum = 0;
+        QElapsedTimer timer;
+        qint64 scalarNsec, nsec;
+
+        timer.start();
+        for (quint64 j = 0; j < iterations; j++)
+            scalarSum += onesComplementSumScalar(p, size);
+        scalarNsec = timer.nsecsElapsed();
+
+        timer.start();
+        for (quint64 j = 0; j < iterations; j++)
+            sum += onesComplementSum(p, size);
+        nsec = timer.nsecsElapsed();
+
+        if (sum != scalarSum)
+        {
+            printf("%d: checksum mismatch\n", size);
+            return 1;
+        }
+
+        printf("%8d %12.1f %12.1f %7.2fx\n", size,
+                double(scalarNsec)/iterations, double(nsec)/iterations,
+                double(scalarNsec)/nsec);
+    }
+
+    return 0;
+}
+
+int testCrc32cBench(int argc, char* argv[])
+{
+    const int kSizes[] = {64, 1500, 9000, 65536, 1 << 20};
+    const quint64 kTotalBytes = 1 << 30;
+    QByteArray buf;
+
+    if (argc != 2)
+    {
+        printf("usage:\n");
+        printf("%s crc32cbench\n", argv[0]);
+        return 255;
+    }
+
+    buf.resize(kSizes[sizeof(kSizes)/sizeof(kSizes[0]) - 1] + 1);
+    for (int i = 0; i < buf.size(); i++)
+        buf[i] = qrand();
+
+    printf("kernel: %s\n", crc32cKernel());
+    printf("%8s %12s %12s %8s %10s\n", "size", "scalar(ns)", "kernel(ns)",
+            "speedup", "GB/s");
+
+    for (uint i = 0; i < sizeof(kSizes)/sizeof(kSizes[0]); i++)
+    {
+        // odd offset to include an unaligned buffer
+        const quint8 *p = (const quint8*) buf.constData() + 1;
+        int size = kSizes[i];
+        quint64 iterations = kTotalBytes/size;
+        quint32 scalarCrc = 0, crc = 0;
+        QElapsedTimer timer;
+        qint64 scalarNsec, nsec;
+
+        timer.start();
+        for (quint64 j = 0; j < iterations; j++)
+            scalarCrc ^= crc32cScalar(quint32(j), p, size);
+        scalarNsec = timer.nsecsElapsed();
+
+        timer.start();
+        for (quint64 j = 0; j < iterations; j++)
+            crc ^= crc32c(quint32(j), p, size);
+        nsec = timer.nsecsElapsed();
+
+        if (crc != scalarCrc)
+        {
+            printf("%d: crc mismatch\n", size);
+            return 1;
+        }
+
+        printf("%8d %12.1f %12.1f %7.2fx %10.2f\n", size,
+                double(scalarNsec)/iterations, double(nsec)/iterations,
+                double(scalarNsec)/nsec, double(kTotalBytes)/nsec);
+    }
+
+    return 0;
+}
+
+static OstProto::Protocol* addProtocol(OstProto::Stream &stream, int id)
+{
+    OstProto::Protocol *proto = stream.add_protocol();
+
+    proto->mutable_protocol_id()->set_id(id);
+    return proto;
+}
+
+static void addEthIp4Udp(OstProto::Stream &stream, bool withVlans)
+{
+    OstProto::Mac *mac = addProtocol(stream,
+            OstProto::Protocol::kMacFieldNumber)->MutableExtension(
+                OstProto::mac);
+
+    mac->set_dst_mac(0x001122334455ULL);
+    mac->set_src_mac(0x00aabbccddeeULL);
+    if (withVlans) {
+        addProtocol(stream, OstProto::Protocol::kSvlanFieldNumber);
+        addProtocol(stream, OstProto::Protocol::kVlanFieldNumber);
+    }
+    addProtocol(stream, OstProto::Protocol::kEth2FieldNumber);
+    addProtocol(stream, OstProto::Protocol::kIp4FieldNumber)
+        ->MutableExtension(OstProto::ip4)->set_dst_ip(0xc0a80101);
+    addProtocol(stream, OstProto::Protocol::kUdpFieldNumber);
+}
+
+/*!
+  Stream configs of the framebench cases - one per protocol stack or
+  frame generation feature of interest
+*/
+static QList<QPair<QString, OstProto::Stream> > frameBenchCases()
+{
+    QList<QPair<QString, OstProto::Stream> > cases;
+    OstProto::Stream stream;
+
+    stream.mutable_stream_id()->set_id(0);
+
+    // eth2/ip4/udp - the common case, at min and max frame length
+    stream.mutable_core()->set_frame_len(64);
+    addEthIp4Udp(stream, false);
+    addProtocol(stream, OstProto::Protocol::kPayloadFieldNumber);
+    cases.append(qMakePair(QString("eth2-ip4-udp-64"), stream));
+
+    stream.mutable_core()->set_frame_len(1518);
+    cases.append(qMakePair(QString("eth2-ip4-udp-1518"), stream));
+
+    // svlan+vlan stack
+    stream.clear_protocol();
+    stream.mutable_core()->set_frame_len(64);
+    addEthIp4Udp(stream, true);
+    addProtocol(stream, OstProto::Protocol::kPayloadFieldNumber);
+    cases.append(qMakePair(QString("vlan2-ip4-udp-64"), stream));
+
+    // eth2/ip6/tcp
+    stream.clear_protocol();
+    stream.mutable_core()->set_frame_len(128);
+    addProtocol(stream, OstProto::Protocol::kMacFieldNumber);
+    addProtocol(stream, OstProto::Protocol::kEth2FieldNumber);
+    addProtocol(stream, OstProto::Protocol::kIp6FieldNumber);
+    addProtocol(stream, OstProto::Protocol::kTcpFieldNumber);
+    addProtocol(stream, OstProto::Protocol::kPayloadFieldNumber);
+    cases.append(qMakePair(QString("eth2-ip6-tcp-128"), stream));
+
+    // payload patterns
+    stream.clear_protocol();
+    stream.mutable_core()->set_frame_len(1024);
+    addEthIp4Udp(stream, false);
+    addProtocol(stream, OstProto::Protocol::kPayloadFieldNumber)
+        ->MutableExtension(OstProto::payload)->set_pattern_mode(
+            OstProto::Payload::e_dp_inc_byte);
+    cases.append(qMakePair(QString("payload-inc-1024"), stream));
+
+    stream.mutable_protocol(stream.protocol_size() - 1)
+        ->MutableExtension(OstProto::payload)->set_pattern_mode(
+            OstProto::Payload::e_dp_random);
+    cases.append(qMakePair(QString("payload-random-1024"), stream));
+
+    // variable fields and frame length i.e. per frame changes
+    stream.clear_protocol();
+    stream.mutable_core()->set_len_mode(OstProto::StreamCore::e_fl_inc);
+    stream.mutable_core()->set_frame_len_min(64);
+    stream.mutable_core()->set_frame_len_max(1518);
+    addEthIp4Udp(stream, false);
+    {
+        OstProto::Ip4 *ip4 = stream.mutable_protocol(stream.protocol_size() - 2)
+                                    ->MutableExtension(OstProto::ip4);
+        OstProto::VariableField *vf = stream.mutable_protocol(
+                stream.protocol_size() - 1)->add_variable_field();
+
+        ip4->set_src_ip(0x0a000001);
+        ip4->set_src_ip_mode(OstProto::Ip4::e_im_inc_host);
+        ip4->set_src_ip_count(256);
+
+        // udp src port
+        vf->set_type(OstProto::VariableField::kCounter16);
+        vf->set_offset(0);
+        vf->set_value(1024);
+        vf->set_count(1000);
+    }
+    addProtocol(stream, OstProto::Protocol::kPayloadFieldNumber);
+    cases.append(qMakePair(QString("varfields-inclen"), stream));
+
+    // userscript
+    stream.clear_protocol();
+    stream.mutable_core()->set_len_mode(OstProto::StreamCore::e_fl_fixed);
+    stream.mutable_core()->set_frame_len(64);
+    addProtocol(stream, OstProto::Protocol::kMacFieldNumber);
+    addProtocol(stream, OstProto::Protocol::kEth2FieldNumber);
+    addProtocol(stream, OstProto::Protocol::kUserScriptFieldNumber)
+        ->MutableExtension(OstProto::userScript)->set_program(
+            "protocol.protocolFrameValue = function(index) {\n"
+            "    return [0x12, 0x34, index & 0xff, (index >> 8) & 0xff];\n"
+            "}\n"
+            "protocol.protocolFrameVariableCount = 256;\n");
+    addProtocol(stream, OstProto::Protocol::kPayloadFieldNumber);
+    cases.append(qMakePair(QString("userscript-64"), stream));
+
+    return cases;
+}
+
+static void printFrameBenchResult(QString name, quint64 frames,
+                                  quint64 bytes, qint64 nsec)
+{
+    printf("%s,%llu,%llu,%lld,%.1f,%.3f,%.3f\n", qPrintable(name),
+            frames, bytes, nsec, double(nsec)/frames,
+            double(frames)*1000/nsec, double(bytes)*8/nsec);
+}
+
+/*!
+  Frame generation throughput of StreamBase::frameValue() per protocol
+  stack, packet list build time and checksum throughput
+
+  Results are CSV on stdout (one line per case) for comparing across
+  builds; a case name (or prefix) may be given to run only that case
+*/
+int testFrameBench(int argc, char* argv[])
+{
+    const quint64 kTotalBytes = 1 << 28;
+    const int kPacketListStreams = 64;
+    QString filter = argc > 2 ? QString(argv[2]) : QString();
+    QList<QPair<QString, OstProto::Stream> > cases = frameBenchCases();
+    QByteArray buf(16384, 0);
+
+    if (argc > 3)
+    {
+        printf("usage:\n");
+        printf("%s framebench [<case>]\n", argv[0]);
+        return 255;
+    }
+
+    printf("case,frames,bytes,nsec,nsec_per_frame,mfps,gbps\n");
+
+    // frameValue() per protocol stack
+    for (int i = 0; i < cases.size(); i++)
+    {
+        if (!filter.isEmpty() && !cases.at(i).first.startsWith(filter))
+            continue;
+
+        StreamBase stream;
+        QElapsedTimer timer;
+        quint64 frames, bytes = 0;
+        qint64 nsec;
+
+        stream.protoDataCopyFrom(cases.at(i).second);
+        stream.updateFrameCache();
+
+        // script runs much slower than the rest
+        frames = kTotalBytes/stream.frameLenAvg();
+        if (cases.at(i).first.startsWith("userscript"))
+            frames /= 64;
+
+        timer.start();
+        for (quint64 j = 0; j < frames; j++)
+            bytes += stream.frameValue((uchar*) buf.data(), buf.size(),
+                                       int(j));
+        nsec = timer.nsecsElapsed();
+
+        printFrameBenchResult(cases.at(i).first, frames, bytes, nsec);
+    }
+
+    // packet list build - all unique frames of many streams into one
+    // buffer, as a port does for a sequential transmit
+    if (filter.isEmpty() || QString("pktlist").startsWith(filter))
+    {
+        QList<StreamBase*> streams;
+        OstProto::Stream config = cases.at(0).second;
+        OstProto::Ip4 *ip4 = config.mutable_protocol(2)
+                                ->MutableExtension(OstProto::ip4);
+        QByteArray packetList;
+        QElapsedTimer timer;
+        quint64 frames = 0, bytes = 0;
+        qint64 nsec;
+
+        ip4->set_src_ip_mode(OstProto::Ip4::e_im_inc_host);
+        ip4->set_src_ip_count(256);
+        config.mutable_control()->set_num_packets(256);
+
+        timer.start();
+        for (int i = 0; i < kPacketListStreams; i++)
+        {
+            StreamBase *stream = new StreamBase;
+
+            config.mutable_stream_id()->set_id(i);
+            stream->protoDataCopyFrom(config);
+            stream->updateFrameCache();
+            streams.append(stream);
+
+            int count = stream->frameVariableCount();
+            for (int j = 0; j < count; j++)
+            {
+                int len = stream->frameValue((uchar*) buf.data(),
+                                             buf.size(), j);
+                packetList.append(buf.constData(), len);
+                bytes += len;
+                frames++;
+            }
+        }
+        nsec = timer.nsecsElapsed();
+
+        printFrameBenchResult(QString("pktlist-%1x%2")
+                                .arg(kPacketListStreams)
+                                .arg(frames/kPacketListStreams),
+                              frames, bytes, nsec);
+        qDeleteAll(streams);
+    }
+
+    // checksum - a 'frame' here is a checksummed buffer
+    if (filter.isEmpty() || QString("cksum").startsWith(filter))
+    {
+        const int kSizes[] = {64, 1500, 9000};
+
+        for (uint i = 0; i < sizeof(kSizes)/sizeof(kSizes[0]); i++)
+        {
+            const quint8 *p = (const quint8*) buf.constData();
+            quint64 frames = kTotalBytes/kSizes[i];
+            volatile quint16 sum;
+            QElapsedTimer timer;
+            qint64 nsec;
+
+            timer.start();
+            for (quint64 j = 0; j < frames; j++)
+                sum = onesComplementSum(p, kSizes[i]);
+            nsec = timer.nsecsElapsed();
+
+            printFrameBenchResult(QString("cksum-%1").arg(kSizes[i]),
+                                  frames, frames*kSizes[i], nsec);
+        }
+    }
+
+    return 0;
+}
+
+/*!
+  RPC calls/sec, latency and MB/sec against a running drone - optionally
+  through a proxy that adds the given round trip time
+*/
+int testRpcBench(int argc, char* argv[])
+{
+    QString host;
+    quint16 port = 7878;
+    uint portId = argc > 3 ? atoi(argv[3]) : 0;
+    int calls = argc > 4 ? atoi(argv[4]) : 10000;
+    int rtt = argc > 5 ? atoi(argv[5]) : 0;
+    DelayProxy *proxy = NULL;
+    int exitCode;
+
+    if ((argc < 3) || (argc > 6) || (calls <= 0))
+    {
+        printf("usage:\n");
+        printf("%s rpcbench <host>[:<port>] [<port-id> [<calls> "
+               "[<rtt-msecs>]]]\n", argv[0]);
+        return 255;
+    }
+
+    host = QString(argv[2]).section(':', 0, 0);
+    if (QString(argv[2]).contains(':'))
+        port = QString(argv[2]).section(':', 1).toUShort();
+
+    if (rtt > 0)
+    {
+        proxy = new DelayProxy(host, port, rtt);
+        if (!proxy->listen(QHostAddress::LocalHost))
+        {
+            printf("unable to start proxy\n");
+            delete proxy;
+            return 1;
+        }
+        host = "127.0.0.1";
+        port = proxy->serverPort();
+    }
+
+    RpcBench bench(host, port, portId, calls);
+    exitCode = bench.run();
+
+    delete proxy;
+    return exitCode;
+}
+
 int main(int argc, char* argv[])
 {
     QCoreApplication app(argc, argv);
@@ -121,6 +541,14 @@ int main(int argc, char* argv[])
         exitCode = usage(argc, argv);
     else if (strcmp(argv[1],"importpcap") == 0)
         exitCode = testImportPcap(argc, argv);
+    else if (strcmp(argv[1],"cksumbench") == 0)
+        exitCode = testCksumBench(argc, argv);
+    else if (strcmp(argv[1],"crc32cbench") == 0)
+        exitCode = testCrc32cBench(argc, argv);
+    else if (strcmp(argv[1],"framebench") == 0)
+        exitCode = testFrameBench(argc, argv);
+    else if (strcmp(argv[1],"rpcbench") == 0)
+        exitCode = testRpcBench(argc, argv);
     else
         exitCode = usage(argc, argv);
 
@@ -1,6 +1,7 @@
 #! /usr/bin/env python
 
 # standard modules
+import itertools
 import logging
 import os
 import pytest
@@ -258,6 +259,85 @@ def test_framelen_modes(drone, ports, stream_toggle_payload, mode):
     finally:
         drone.stopTransmit(ports.tx)
 
+@pytest.mark.parametrize("mode", [
+    ost_pb.StreamCore.e_fl_imix,
+    ost_pb.StreamCore.e_fl_weighted
+])
+def test_framelen_table(drone, ports, stream_toggle_payload, mode):
+    """ Test the frame lengths of the imix and weighted modes """
+
+    if mode == ost_pb.StreamCore.e_fl_imix:
+        weights = [(64, 7), (594, 4), (1518, 1)]
+    else:
+        weights = [(128, 2), (256, 4), (1000, 2)] # gcd 2 - table of 4
+    cycle = sum(w for l, w in weights)
+    if mode == ost_pb.StreamCore.e_fl_weighted:
+        cycle = cycle // 2
+
+    stream = stream_toggle_payload
+    stream.stream[0].core.len_mode = mode
+    stream.stream[0].core.ClearField("frame_len_weight")
+    if mode == ost_pb.StreamCore.e_fl_weighted:
+        for l, w in weights:
+            fw = stream.stream[0].core.frame_len_weight.add()
+            fw.frame_len = l
+            fw.weight = w
+    stream.stream[0].control.num_packets = cycle * 5
+
+    log.info('configuring tx_stream %d' % stream.stream[0].stream_id.id)
+    drone.modifyStream(stream)
+
+    if stream.stream[0].protocol[-1].protocol_id.id \
+            == ost_pb.Protocol.kPayloadFieldNumber:
+       filter = 'udp && !expert.severity'
+    else:
+       filter = 'udp && eth.fcs_bad==1' \
+                '&& ip.checksum_bad==0 && udp.checksum_bad==0'
+
+    # clear tx/rx stats
+    log.info('clearing tx/rx stats')
+    drone.clearStats(ports.tx)
+    drone.clearStats(ports.rx)
+
+    try:
+        drone.startCapture(ports.rx)
+        drone.startTransmit(ports.tx)
+        log.info('waiting for transmit to finish ...')
+        time.sleep(3)
+        drone.stopTransmit(ports.tx)
+        drone.stopCapture(ports.rx)
+
+        log.info('getting Rx capture buffer')
+        buff = drone.getCaptureBuffer(ports.rx.port_id[0])
+        drone.saveCaptureBuffer(buff, 'capture.pcap')
+        cap_pkts = subprocess.check_output([tshark, '-n', '-r', 'capture.pcap',
+                        '-Y', filter, '-o', fmt])
+        print(cap_pkts)
+        assert cap_pkts.count('\n') == stream.stream[0].control.num_packets
+        result = [int(l) + 4 for l in extract_column(cap_pkts, fmt_col)]
+        print(result)
+
+        # every cycle has each length in proportion to its weight and the
+        # cycles are identical
+        for i in range(0, len(result), cycle):
+            window = result[i:i+cycle]
+            assert window == result[0:cycle]
+            for l, w in weights:
+                assert window.count(l) * sum(w for l, w in weights) \
+                        == w * cycle
+
+        # lengths are spread out, not sent in runs
+        if mode == ost_pb.StreamCore.e_fl_imix:
+            assert result[0:cycle].count(1518) == 1
+            assert max(len(list(g)) for k, g in
+                    itertools.groupby(result[0:cycle])) <= 2
+
+        os.remove('capture.pcap')
+    except RpcError as e:
+            raise
+    finally:
+        drone.stopTransmit(ports.tx)
+
 def test_frame_trunc(drone, ports, stream):
     """ Test frame is truncated even if the protocol sizes exceed framelen """
 
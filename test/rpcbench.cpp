@@ -0,0 +1,391 @@
+/*
+Copyright (C) 2017 Srivats P.
+
+This file is part of "Ostinato"
+
+This is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+#include "rpcbench.h"
+
+#include "pbrpcchannel.h"
+#include "pbrpccontroller.h"
+
+#include <QBuffer>
+#include <QTcpSocket>
+#include <QTimer>
+
+#include <algorithm>
+
+DelayProxy::DelayProxy(QString host, quint16 port, int rttMsecs,
+        QObject *parent)
+    : QTcpServer(parent)
+{
+    host_ = host;
+    port_ = port;
+    delay_ = rttMsecs/2;
+    clock_.start();
+
+    timer_ = new QTimer(this);
+    timer_->setInterval(1);
+    connect(timer_, SIGNAL(timeout()), SLOT(flush()));
+}
+
+void DelayProxy::incomingConnection(int socketDescriptor)
+{
+    QTcpSocket *client = new QTcpSocket(this);
+    QTcpSocket *server = new QTcpSocket(this);
+
+    client->setSocketDescriptor(socketDescriptor);
+    // Data written before the connect completes is buffered by Qt
+    server->connectToHost(host_, port_);
+
+    peer_.insert(client, server);
+    peer_.insert(server, client);
+
+    foreach(QTcpSocket *socket, QList<QTcpSocket*>() << client << server) {
+        socket->setSocketOption(QAbstractSocket::LowDelayOption, 1);
+        connect(socket, SIGNAL(readyRead()), SLOT(on_socket_readyRead()));
+        connect(socket, SIGNAL(disconnected()),
+                SLOT(on_socket_disconnected()));
+    }
+}
+
+void DelayProxy::on_socket_readyRead()
+{
+    QTcpSocket *from = static_cast<QTcpSocket*>(sender());
+    Chunk chunk;
+
+    chunk.due = clock_.elapsed() + delay_;
+    chunk.to = peer_.value(from);
+    chunk.data = from->readAll();
+
+    if (!chunk.to)
+        return;
+
+    queue_.append(chunk);
+    if (!timer_->isActive())
+        timer_->start();
+}
+
+void DelayProxy::on_socket_disconnected()
+{
+    QTcpSocket *socket = static_cast<QTcpSocket*>(sender());
+    QTcpSocket *peer = peer_.take(socket);
+
+    if (peer) {
+        peer_.remove(peer);
+        peer->disconnectFromHost();
+        peer->deleteLater();
+    }
+
+    for (int i = queue_.size() - 1; i >= 0; i--)
+        if ((queue_.at(i).to == socket) || (queue_.at(i).to == peer))
+            queue_.removeAt(i);
+
+    socket->deleteLater();
+}
+
+void DelayProxy::flush()
+{
+    qint64 now = clock_.elapsed();
+
+    while (!queue_.isEmpty() && (queue_.first().due <= now)) {
+        Chunk chunk = queue_.takeFirst();
+        chunk.to->write(chunk.data);
+    }
+
+    if (queue_.isEmpty())
+        timer_->stop();
+}
+
+RpcBench::RpcBench(QString host, quint16 port, uint portId, int calls)
+{
+    host_ = host;
+    port_ = port;
+    portId_ = portId;
+    calls_ = calls;
+    channel_ = NULL;
+    stub_ = NULL;
+    isDone_ = false;
+    pipelined_ = false;
+    compressed_ = false;
+    case_ = kGetStats;
+    callsLeft_ = 0;
+    outstanding_ = 0;
+    bytes_ = 0;
+}
+
+/*!
+  Runs all cases with each combination of pipelining and compression;
+  results are printed as CSV, one line per case and combination
+*/
+int RpcBench::run()
+{
+    printf("case,pipelined,compressed,calls,calls_per_sec,"
+           "latency_p50_us,latency_p99_us,mb_per_sec\n");
+
+    for (int i = 0; i < 4; i++) {
+        if (!runCombination(i & 1, i & 2)) {
+            fprintf(stderr, "%s\n", qPrintable(error_));
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+bool RpcBench::runCombination(bool pipelined, bool compressed)
+{
+    PbRpcChannel channel(host_, port_,
+                         OstProto::Notification::default_instance());
+    OstProto::OstService::Stub stub(&channel);
+
+    channel_ = &channel;
+    stub_ = &stub;
+    pipelined_ = pipelined;
+    compressed_ = compressed;
+    error_.clear();
+
+    connect(&channel, SIGNAL(connected()), SLOT(on_channel_connectDone()));
+    connect(&channel, SIGNAL(error(QAbstractSocket::SocketError)),
+            SLOT(on_channel_connectDone()));
+    isDone_ = false;
+    channel.establish();
+    wait();
+    disconnect(&channel, 0, this, 0);
+
+    if (channel.state() != QAbstractSocket::ConnectedState) {
+        error_ = QString("unable to connect to %1:%2").arg(host_).arg(port_);
+        goto _exit;
+    }
+
+    {
+        OstProto::VersionInfo *verInfo = new OstProto::VersionInfo;
+        OstProto::VersionCompatibility *verCompat =
+                new OstProto::VersionCompatibility;
+        PbRpcController *controller = new PbRpcController(verInfo, verCompat);
+
+        verInfo->set_client_name("ostinato");
+        verInfo->set_version(APP_VERSION);
+        verInfo->set_rpc_pipelining(pipelined);
+        verInfo->set_rpc_compression(compressed);
+
+        isDone_ = false;
+        stub.checkVersion(controller, verInfo, verCompat,
+                NewCallback(this, &RpcBench::processVersionCompatibility,
+                            controller));
+        wait();
+        if (!error_.isEmpty())
+            goto _exit;
+    }
+
+    {
+        OstProto::PortId *portId = new OstProto::PortId;
+        OstProto::StreamIdList *streamIdList = new OstProto::StreamIdList;
+        PbRpcController *controller = new PbRpcController(portId,
+                                                          streamIdList);
+
+        portId->set_id(portId_);
+        isDone_ = false;
+        stub.getStreamIdList(controller, portId, streamIdList,
+                NewCallback(this, &RpcBench::processStreamIdList,
+                            controller));
+        wait();
+        if (!error_.isEmpty())
+            goto _exit;
+    }
+
+    runCase(kGetStats, calls_, "getStats");
+    if (!error_.isEmpty())
+        goto _exit;
+
+    // The large calls need the port to have streams and a capture
+    if (streamIdList_.stream_id_size())
+        runCase(kGetStreamConfig, qMax(calls_/100, 10), "getStreamConfig");
+    else
+        fprintf(stderr, "port %u has no streams - skipping getStreamConfig\n",
+                portId_);
+    if (!error_.isEmpty())
+        goto _exit;
+
+    runCase(kGetCaptureBuffer, qMax(calls_/100, 10), "getCaptureBuffer");
+
+_exit:
+    channel.tearDown();
+    channel_ = NULL;
+    stub_ = NULL;
+    return error_.isEmpty();
+}
+
+void RpcBench::runCase(Case benchCase, int calls, const char *name)
+{
+    int window = pipelined_ ? kPipelineWindow : 1;
+    qint64 nsec;
+
+    case_ = benchCase;
+    callsLeft_ = calls;
+    outstanding_ = 0;
+    bytes_ = 0;
+    latencies_.clear();
+    latencies_.reserve(calls);
+
+    isDone_ = false;
+    timer_.start();
+    for (int i = 0; i < window && callsLeft_; i++)
+        issueCall();
+    wait();
+    nsec = timer_.nsecsElapsed();
+
+    if (!error_.isEmpty() || latencies_.isEmpty())
+        return;
+
+    std::sort(latencies_.begin(), latencies_.end());
+    printf("%s,%d,%d,%d,%.0f,%.1f,%.1f,%.2f\n", name, pipelined_,
+            compressed_, latencies_.size(),
+            double(latencies_.size())*1e9/nsec,
+            latencies_.at(latencies_.size()/2)/1e3,
+            latencies_.at((latencies_.size()*99)/100)/1e3,
+            double(bytes_)*1e3/nsec);
+    fflush(stdout);
+}
+
+void RpcBench::issueCall()
+{
+    qint64 sentAt = timer_.nsecsElapsed();
+
+    callsLeft_--;
+    outstanding_++;
+
+    switch (case_) {
+    case kGetStats: {
+        OstProto::PortIdList *portIdList = new OstProto::PortIdList;
+        OstProto::PortStatsList *portStatsList = new OstProto::PortStatsList;
+        PbRpcController *controller = new PbRpcController(portIdList,
+                                                          portStatsList);
+
+        portIdList->add_port_id()->set_id(portId_);
+        stub_->getStats(controller, portIdList, portStatsList,
+                NewCallback(this, &RpcBench::processReply, sentAt,
+                            controller));
+        break;
+    }
+    case kGetStreamConfig: {
+        OstProto::StreamIdList *streamIdList = new OstProto::StreamIdList;
+        OstProto::StreamConfigList *streamConfigList =
+                new OstProto::StreamConfigList;
+        PbRpcController *controller = new PbRpcController(streamIdList,
+                                                          streamConfigList);
+
+        streamIdList->CopyFrom(streamIdList_);
+        stub_->getStreamConfig(controller, streamIdList, streamConfigList,
+                NewCallback(this, &RpcBench::processReply, sentAt,
+                            controller));
+        break;
+    }
+    case kGetCaptureBuffer: {
+        OstProto::PortId *portId = new OstProto::PortId;
+        OstProto::CaptureBuffer *captureBuffer = new OstProto::CaptureBuffer;
+        PbRpcController *controller = new PbRpcController(portId,
+                                                          captureBuffer);
+        QBuffer *blob = new QBuffer;
+
+        blob->open(QIODevice::WriteOnly);
+        controller->setBinaryBlob(blob);
+        portId->set_id(portId_);
+        stub_->getCaptureBuffer(controller, portId, captureBuffer,
+                NewCallback(this, &RpcBench::processReply, sentAt,
+                            controller));
+        break;
+    }
+    }
+}
+
+void RpcBench::processVersionCompatibility(PbRpcController *controller)
+{
+    OstProto::VersionCompatibility *verCompat
+        = static_cast<OstProto::VersionCompatibility*>(controller->response());
+
+    if (controller->Failed())
+        error_ = QString("checkVersion failed (%1)")
+                    .arg(controller->ErrorString());
+    else if (verCompat->result()
+                == OstProto::VersionCompatibility::kIncompatible)
+        error_ = QString("drone is incompatible (%1)")
+                    .arg(QString::fromStdString(verCompat->notes()));
+    else {
+        // Must be before any other RPC - the framing changes
+        if (pipelined_ && !verCompat->rpc_pipelining())
+            error_ = "drone doesn't support pipelining";
+        if (compressed_ && !verCompat->rpc_compression())
+            error_ = "drone doesn't support compression";
+        channel_->setPipelined(verCompat->rpc_pipelining());
+        channel_->setCompression(verCompat->rpc_compression());
+    }
+
+    delete controller;
+    done();
+}
+
+void RpcBench::processStreamIdList(PbRpcController *controller)
+{
+    if (controller->Failed())
+        error_ = QString("getStreamIdList failed (%1)")
+                    .arg(controller->ErrorString());
+    else
+        streamIdList_.CopyFrom(*controller->response());
+
+    delete controller;
+    done();
+}
+
+void RpcBench::processReply(qint64 sentAt, PbRpcController *controller)
+{
+    QIODevice *blob = controller->binaryBlob();
+
+    latencies_.append(timer_.nsecsElapsed() - sentAt);
+    outstanding_--;
+
+    if (controller->Failed())
+        error_ = QString("rpc failed (%1)").arg(controller->ErrorString());
+    else if (blob)
+        bytes_ += blob->size();
+    else
+        bytes_ += controller->response()->ByteSize();
+
+    delete blob;
+    delete controller;
+
+    if (callsLeft_ && error_.isEmpty())
+        issueCall();
+    else if (!outstanding_)
+        done();
+}
+
+void RpcBench::on_channel_connectDone()
+{
+    done();
+}
+
+void RpcBench::wait()
+{
+    if (!isDone_)
+        loop_.exec();
+}
+
+void RpcBench::done()
+{
+    isDone_ = true;
+    loop_.quit();
+}
@@ -0,0 +1,129 @@
+/*
+Copyright (C) 2017 Srivats P.
+
+This file is part of "Ostinato"
+
+This is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+#ifndef _RPC_BENCH_H
+#define _RPC_BENCH_H
+
+#include "protocol.pb.h"
+
+#include <QElapsedTimer>
+#include <QEventLoop>
+#include <QHash>
+#include <QList>
+#include <QTcpServer>
+#include <QVector>
+
+class PbRpcChannel;
+class PbRpcController;
+class QTcpSocket;
+class QTimer;
+
+/*!
+  TCP proxy that delays the data in each direction by half the given
+  round trip time - to emulate a WAN between the RPC client and drone
+*/
+class DelayProxy : public QTcpServer
+{
+    Q_OBJECT
+public:
+    DelayProxy(QString host, quint16 port, int rttMsecs, QObject *parent = 0);
+
+protected:
+    void incomingConnection(int socketDescriptor);
+
+private slots:
+    void on_socket_readyRead();
+    void on_socket_disconnected();
+    void flush();
+
+private:
+    struct Chunk {
+        qint64 due; // msecs
+        QTcpSocket *to;
+        QByteArray data;
+    };
+
+    QString host_;
+    quint16 port_;
+    int delay_;
+    QHash<QTcpSocket*, QTcpSocket*> peer_;
+    QList<Chunk> queue_; // in due order
+    QElapsedTimer clock_;
+    QTimer *timer_;
+};
+
+/*!
+  Calls/sec and latency of small RPCs and MB/sec of large ones over a
+  PbRpcChannel to a drone - with and without pipelining and compression
+*/
+class RpcBench : public QObject
+{
+    Q_OBJECT
+public:
+    RpcBench(QString host, quint16 port, uint portId, int calls);
+
+    int run();
+
+private slots:
+    void on_channel_connectDone();
+
+private:
+    enum Case {
+        kGetStats,
+        kGetStreamConfig,
+        kGetCaptureBuffer
+    };
+
+    bool runCombination(bool pipelined, bool compressed);
+    void runCase(Case benchCase, int calls, const char *name);
+    void issueCall();
+
+    void processVersionCompatibility(PbRpcController *controller);
+    void processStreamIdList(PbRpcController *controller);
+    void processReply(qint64 sentAt, PbRpcController *controller);
+
+    void wait();
+    void done();
+
+    static const int kPipelineWindow = 16;
+
+    QString host_;
+    quint16 port_;
+    uint portId_;
+    int calls_;
+
+    PbRpcChannel *channel_;
+    OstProto::OstService::Stub *stub_;
+    QEventLoop loop_;
+    bool isDone_;
+    QString error_;
+
+    bool pipelined_;
+    bool compressed_;
+    OstProto::StreamIdList streamIdList_;
+
+    Case case_;
+    int callsLeft_;
+    int outstanding_;
+    quint64 bytes_;
+    QElapsedTimer timer_;
+    QVector<qint64> latencies_; // nsecs
+};
+
+#endif
@@ -3,8 +3,10 @@
 # standard modules
 import logging
 import os
+import shutil
 import subprocess
 import sys
+import tempfile
 import time
 
 sys.path.insert(1, '../binding')
@@ -65,6 +67,11 @@ host_name = '127.0.0.1'
 tx_port_number = -1
 rx_port_number = -1 
 drone_version = ['0', '0', '0']
+local_socket = None # drone's RpcServer/LocalSocket setting, if any
+# for the tests that start a drone of their own (on private_port) - skipped
+# if not found
+drone_exe = os.path.join('..', 'server', 'drone')
+private_port = 7879
 
 if sys.platform == 'win32':
     tshark = r'C:\Program Files\Wireshark\tshark.exe'
@@ -214,6 +221,25 @@ try:
         core.__version__ = orig_version
         suite.test_end(passed)
 
+    # ----------------------------------------------------------------- #
+    # TESTCASE: Verify the RPCs work over drone's local socket as they do
+    #           over TCP
+    # ----------------------------------------------------------------- #
+    if local_socket:
+        passed = False
+        suite.test_begin('localSocketServesRpcs')
+        local_drone = DroneProxy('local:' + local_socket)
+        try:
+            local_drone.connect()
+            tcp_drone = DroneProxy(host_name)
+            tcp_drone.connect()
+            if (local_drone.getPortIdList() == tcp_drone.getPortIdList()):
+                passed = True
+            tcp_drone.disconnect()
+        finally:
+            local_drone.disconnect()
+            suite.test_end(passed)
+
     # ----------------------------------------------------------------- #
     # Baseline Configuration for subsequent testcases
     # ----------------------------------------------------------------- #
@@ -325,31 +351,32 @@ try:
         suite.test_end(passed)
 
     # ----------------------------------------------------------------- #
-    # TESTCASE: Verify invoking addStream() during transmit fails
-    # TESTCASE: Verify invoking modifyStream() during transmit fails
-    # TESTCASE: Verify invoking deleteStream() during transmit fails
+    # TESTCASE: Verify invoking addStream() during transmit succeeds
+    # TESTCASE: Verify invoking modifyStream() during transmit succeeds
+    # TESTCASE: Verify invoking deleteStream() during transmit succeeds
+    # The packet list is rebuilt and switched to without stopping transmit
     # ----------------------------------------------------------------- #
+    def is_transmit_on():
+        stats = drone.getStats(tx_port)
+        return stats.port_stats[0].state.is_transmit_on
+
     sid = ost_pb.StreamIdList()
     sid.port_id.CopyFrom(tx_port.port_id[0])
     sid.stream_id.add().id = 2
 
     passed = False
-    suite.test_begin('addStreamDuringTransmitFails')
+    suite.test_begin('addStreamDuringTransmitSucceeds')
     drone.startTransmit(tx_port)
     try:
         log.info('adding tx_stream %d' % sid.stream_id[0].id)
         drone.addStream(sid)
-    except RpcError as e:
-        if ('Port Busy' in str(e)):
-            passed = True
-        else:
-            raise
+        passed = is_transmit_on()
     finally:
         drone.stopTransmit(tx_port)
         suite.test_end(passed)
 
     passed = False
-    suite.test_begin('modifyStreamDuringTransmitFails')
+    suite.test_begin('modifyStreamDuringTransmitSucceeds')
     scfg = ost_pb.StreamConfigList()
     scfg.port_id.CopyFrom(tx_port.port_id[0])
     s = scfg.stream.add()
@@ -361,30 +388,175 @@ try:
     try:
         log.info('configuring tx_stream %d' % sid.stream_id[0].id)
         drone.modifyStream(scfg)
-    except RpcError as e:
-        if ('Port Busy' in str(e)):
-            passed = True
-        else:
-            raise
+        log.info('changing the rate of tx_stream %d' %
+                stream_id.stream_id[0].id)
+        stream_cfg.stream[0].control.packets_per_sec = 2
+        drone.modifyStream(stream_cfg)
+        passed = is_transmit_on()
     finally:
         drone.stopTransmit(tx_port)
+        stream_cfg.stream[0].control.ClearField('packets_per_sec')
+        drone.modifyStream(stream_cfg)
         suite.test_end(passed)
 
     passed = False
-    suite.test_begin('deleteStreamDuringTransmitFails')
+    suite.test_begin('deleteStreamDuringTransmitSucceeds')
     drone.startTransmit(tx_port)
     try:
         log.info('deleting tx_stream %d' % sid.stream_id[0].id)
         drone.deleteStream(sid)
-    except RpcError as e:
-        if ('Port Busy' in str(e)):
-            passed = True
-        else:
-            raise
+        passed = is_transmit_on()
+    finally:
+        drone.stopTransmit(tx_port)
+        suite.test_end(passed)
+
+    # ----------------------------------------------------------------- #
+    # TESTCASE: Verify transmit stops by itself after transmit_duration
+    #           (the stream is 10 packets at 1 pps, so is cut short)
+    # ----------------------------------------------------------------- #
+    passed = False
+    suite.test_begin('transmitStopsAfterDuration')
+    port_cfg = ost_pb.PortConfigList()
+    port_cfg.port.add().port_id.CopyFrom(tx_port.port_id[0])
+    port_cfg.port[0].transmit_duration = 2500000000
+    drone.modifyPort(port_cfg)
+    drone.startTransmit(tx_port)
+    try:
+        log.info('sleeping for 4s ...')
+        time.sleep(4)
+        stats = drone.getStats(tx_port).port_stats[0]
+        log.info('--> (tx_stats)' + stats.__str__())
+        passed = (not stats.state.is_transmit_on
+                    and stats.tx_run_pkts == 3
+                    and stats.tx_run_duration >= 2500000000
+                    and stats.tx_run_duration < 3000000000)
+    finally:
+        drone.stopTransmit(tx_port)
+        port_cfg.port[0].transmit_duration = 0
+        drone.modifyPort(port_cfg)
+        suite.test_end(passed)
+
+    # ----------------------------------------------------------------- #
+    # TESTCASE: Verify max rate transmit ignores the stream rate - all
+    #           10 packets (at 1 pps) are sent well within a second
+    # ----------------------------------------------------------------- #
+    passed = False
+    suite.test_begin('maxRateTransmitIgnoresStreamRate')
+    port_cfg.port[0].max_rate = True
+    drone.modifyPort(port_cfg)
+    drone.startTransmit(tx_port)
+    try:
+        log.info('sleeping for 2s ...')
+        time.sleep(2)
+        stats = drone.getStats(tx_port).port_stats[0]
+        log.info('--> (tx_stats)' + stats.__str__())
+        passed = (not stats.state.is_transmit_on
+                    and stats.tx_run_pkts == 10
+                    and stats.tx_run_duration < 1000000000)
+    finally:
+        drone.stopTransmit(tx_port)
+        port_cfg.port[0].max_rate = False
+        drone.modifyPort(port_cfg)
+        suite.test_end(passed)
+
+    # ----------------------------------------------------------------- #
+    # TESTCASE: Verify the frames sent of an untracked stream are counted
+    #           per stream - also when transmit is stopped mid-stream
+    # ----------------------------------------------------------------- #
+    passed = False
+    suite.test_begin('untrackedStreamTxIsCounted')
+    drone.clearStats(tx_port)
+    drone.startTransmit(tx_port)
+    try:
+        log.info('sleeping for 2.5s ...')
+        time.sleep(2.5)
+        drone.stopTransmit(tx_port)
+        stream_stats = drone.getStreamStats(tx_port)
+        log.info('--> (stream_stats)' + stream_stats.__str__())
+        for ss in stream_stats.stream_stats:
+            if (ss.tx_port_id == tx_port_number
+                    and ss.stream_id == stream_id.stream_id[0].id):
+                # 10 packets at 1 pps - stopped after 2 or 3
+                passed = (ss.tx_pkts >= 2 and ss.tx_pkts < 10)
     finally:
         drone.stopTransmit(tx_port)
         suite.test_end(passed)
 
+    # ----------------------------------------------------------------- #
+    # TESTCASE: Verify a throughput test runs to completion on drone
+    # ----------------------------------------------------------------- #
+    passed = False
+    suite.test_begin('throughputTestCompletes')
+    stream_cfg.stream[0].core.is_tracked = True
+    drone.modifyStream(stream_cfg)
+    tput_cfg = ost_pb.ThroughputTestConfig()
+    tput_cfg.tx_port_id.CopyFrom(tx_port.port_id[0])
+    tput_cfg.rx_port_id.CopyFrom(rx_port.port_id[0])
+    tput_cfg.trial_duration = 2000000000
+    tput_cfg.settle_msec = 500
+    tput_cfg.max_trials = 2
+    try:
+        drone.startThroughputTest(tput_cfg)
+        for i in range(20):
+            time.sleep(1)
+            result = drone.getThroughputTestResult(tx_port.port_id[0])
+            if result.state != ost_pb.ThroughputTestResult.kRunning:
+                break
+        log.info('--> (result)' + result.__str__())
+        passed = (result.state == ost_pb.ThroughputTestResult.kDone
+                    and len(result.trial) > 0
+                    and result.trial[0].tx_pkts > 0)
+    finally:
+        drone.stopThroughputTest(tx_port.port_id[0])
+        stream_cfg.stream[0].core.ClearField('is_tracked')
+        drone.modifyStream(stream_cfg)
+        suite.test_end(passed)
+
+    # ----------------------------------------------------------------- #
+    # TESTCASE: Verify a clock offset set via RPC is applied to drone's
+    #           latency clock (unless it is a PTP clock)
+    # ----------------------------------------------------------------- #
+    passed = False
+    suite.test_begin('clockOffsetIsApplied')
+    offset = ost_pb.ClockOffset()
+    offset.offset_nsec = 5000000000
+    offset.uncertainty_nsec = 1000
+    try:
+        clock = drone.getClock()
+        if clock.source == 'system':
+            drone.setClockOffset(offset)
+            clock = drone.getClock()
+        log.info('--> (clock)' + clock.__str__())
+        passed = (clock.source != 'system'
+                    or (clock.offset_nsec == offset.offset_nsec
+                        and abs(clock.nsec - clock.system_nsec
+                                - offset.offset_nsec) < 1000000))
+    finally:
+        if clock.source == 'system':
+            offset.offset_nsec = 0
+            offset.uncertainty_nsec = 0
+            drone.setClockOffset(offset)
+        suite.test_end(passed)
+
+    # ----------------------------------------------------------------- #
+    # TESTCASE: Verify port pair discovery finds the loopback port pair
+    # ----------------------------------------------------------------- #
+    passed = False
+    suite.test_begin('discoverPortPairsFindsLoopback')
+    discovery = ost_pb.PortPairDiscovery()
+    discovery.port_id.add().CopyFrom(tx_port.port_id[0])
+    discovery.port_id.add().CopyFrom(rx_port.port_id[0])
+    try:
+        pairs = drone.discoverPortPairs(discovery)
+        log.info('--> (pairs)' + pairs.__str__())
+        for pair in pairs.pair:
+            if (pair.tx_port_id.id == tx_port.port_id[0].id
+                    and pair.rx_port_id.id == rx_port.port_id[0].id
+                    and pair.rx_probes > 0):
+                passed = True
+    finally:
+        suite.test_end(passed)
+
     # ----------------------------------------------------------------- #
     # TESTCASE: Verify invoking startTransmit() during transmit is a NOP, 
     #           not a restart
@@ -509,6 +681,136 @@ try:
     finally:
         suite.test_end(passed)
 
+    # ----------------------------------------------------------------- #
+    # TESTCASE: Verify the drone keeps a per second history of the port
+    #           stats - with all the stats in each sample once decoded
+    # ----------------------------------------------------------------- #
+    passed = False
+    suite.test_begin('statsHistoryHasPerSecondSamples')
+    try:
+        log.info('sleeping for 3s ...')
+        time.sleep(3)
+        samples = drone.statsHistory(tx_port.port_id[0].id)
+        log.info('--> (samples) %d' % len(samples))
+        stats = drone.getStats(tx_port).port_stats[0]
+        times = [t for t, s in samples]
+        passed = (len(samples) >= 3
+                    and all(b > a for a, b in zip(times, times[1:]))
+                    and samples[-1][1].HasField('tx_pkts')
+                    and samples[-1][1].tx_pkts == stats.tx_pkts)
+    finally:
+        suite.test_end(passed)
+
+    # ----------------------------------------------------------------- #
+    # TESTCASE: Verify a stream with a frame_set_id sends the frames of
+    #           the uploaded (compressed, chunked) frame set as is
+    # ----------------------------------------------------------------- #
+    passed = False
+    suite.test_begin('uploadedFrameSetIsSentAsIs')
+    fid = ost_pb.StreamIdList()
+    fid.port_id.CopyFrom(tx_port.port_id[0])
+    fid.stream_id.add().id = 3
+    try:
+        stream_cfg.stream[0].core.is_enabled = False
+        drone.modifyStream(stream_cfg)
+        drone.addStream(fid)
+        fcfg = ost_pb.StreamConfigList()
+        fcfg.port_id.CopyFrom(tx_port.port_id[0])
+        f = fcfg.stream.add()
+        f.stream_id.id = fid.stream_id[0].id
+        f.core.is_enabled = True
+        f.core.frame_set_id = 1
+        drone.modifyStream(fcfg)
+        frames = [b'\x00\x11\x22\x33\x44\x55\x00\xaa\xbb\xcc\xdd\xee'
+                    b'\x88\xb5' + bytearray([i]) * 46 for i in range(20)]
+        drone.uploadFrames(tx_port.port_id[0].id, 1, frames,
+                           gaps=[1000000] * len(frames), chunk_size=64)
+        drone.clearStats(tx_port)
+        drone.startTransmit(tx_port)
+        log.info('waiting for transmit to finish ...')
+        time.sleep(2)
+        drone.stopTransmit(tx_port)
+        stats = drone.getStats(tx_port).port_stats[0]
+        log.info('--> (tx_pkts) %d' % stats.tx_pkts)
+        passed = (stats.tx_pkts == len(frames))
+    finally:
+        drone.stopTransmit(tx_port)
+        drone.deleteStream(fid)
+        drone.uploadFrames(tx_port.port_id[0].id, 1, [])
+        stream_cfg.stream[0].core.is_enabled = True
+        drone.modifyStream(stream_cfg)
+        suite.test_end(passed)
+
+    # ----------------------------------------------------------------- #
+    # TESTCASE: Verify a drone restarted with the same config maps the
+    #           frame sets stored (in its PacketListCacheDir) by the
+    #           earlier run instead of building and storing them again
+    # ----------------------------------------------------------------- #
+    if os.path.exists(drone_exe):
+        passed = False
+        suite.test_begin('restartedDroneUsesStoredFrameSets')
+        config_dir = tempfile.mkdtemp(prefix='rpctest')
+        store_dir = os.path.join(config_dir, 'store')
+        os.mkdir(os.path.join(config_dir, 'Ostinato'))
+        with open(os.path.join(config_dir, 'Ostinato', 'drone.ini'), 'w') as f:
+            f.write('[General]\n')
+            f.write('PacketListCacheDir=%s\n' % store_dir)
+            f.write('[PortList]\n')
+            f.write('Include=no-such-nic\n')
+            f.write('[VirtualPorts]\n')
+            f.write('Null=1\n')
+        env = dict(os.environ)
+        env['XDG_CONFIG_HOME'] = config_dir
+
+        # A set rebuilt (on a miss) is saved again i.e. its file replaced
+        def stored_sets():
+            sets = {}
+            if os.path.isdir(store_dir):
+                for name in os.listdir(store_dir):
+                    st = os.stat(os.path.join(store_dir, name))
+                    sets[name] = (st.st_ino, st.st_mtime)
+            return sets
+
+        try:
+            runs = []
+            for run in range(2):
+                proc = subprocess.Popen([drone_exe, str(private_port)],
+                                        env=env,
+                                        stdout=open(os.devnull, 'w'),
+                                        stderr=subprocess.STDOUT)
+                try:
+                    private_drone = DroneProxy(host_name, private_port)
+                    for i in range(50):
+                        try:
+                            private_drone.connect()
+                            break
+                        except Exception:
+                            time.sleep(0.2)
+                    null_port = ost_pb.PortIdList()
+                    null_port.port_id.add().id = \
+                        private_drone.getPortIdList().port_id[-1].id
+                    sid = ost_pb.StreamIdList()
+                    sid.port_id.CopyFrom(null_port.port_id[0])
+                    sid.stream_id.add().id = 1
+                    private_drone.addStream(sid)
+                    scfg = ost_pb.StreamConfigList()
+                    scfg.CopyFrom(stream_cfg)
+                    scfg.port_id.CopyFrom(null_port.port_id[0])
+                    private_drone.modifyStream(scfg)
+                    private_drone.startTransmit(null_port)
+                    time.sleep(1)
+                    private_drone.stopTransmit(null_port)
+                    private_drone.disconnect()
+                finally:
+                    proc.terminate()
+                    proc.wait()
+                runs.append(stored_sets())
+            log.info('--> (stored sets) %s' % runs)
+            passed = (len(runs[0]) > 0 and runs[1] == runs[0])
+        finally:
+            shutil.rmtree(config_dir)
+            suite.test_end(passed)
+
     # ----------------------------------------------------------------- #
     # TESTCASE: Verify startCapture(), startTransmit() sequence captures the
     #           first packet
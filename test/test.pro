@@ -31,9 +31,13 @@ win32 {
 LIBS += -lprotobuf
 LIBS += -L"../extra/qhexedit2/$(OBJECTS_DIR)/" -lqhexedit2
 
-HEADERS += 
-SOURCES += main.cpp
+HEADERS += rpcbench.h
+SOURCES += main.cpp rpcbench.cpp
 
 QMAKE_DISTCLEAN += object_script.*
 
 include(../install.pri)
+include(../version.pri)
+
+# for the checkVersion of rpcbench
+DEFINES += APP_VERSION=\\\"$$APP_VERSION\\\"
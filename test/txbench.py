@@ -0,0 +1,234 @@
+#! /usr/bin/env python
+
+"""
+Transmit engine benchmark - compares drone's transmit backends and pacing
+(rate accuracy) modes for the achieved rate, drone cpu per packet and the
+error in the inter-packet gap
+
+For each combination, a drone is started with the corresponding settings
+(via a drone.ini in a private XDG_CONFIG_HOME), a fixed rate stream is
+sent on the tx port and captured on the rx port which should be the other
+end of a veth pair (or a loopback); the gap error is measured from the rx
+capture timestamps, so includes the receive path jitter too
+
+Results are printed as CSV, one line per combination
+
+usage: sudo ./txbench.py --drone ../server/drone --tx veth0 --rx veth1
+"""
+
+# standard modules
+import argparse
+import logging
+import os
+import shutil
+import struct
+import subprocess
+import sys
+import tempfile
+import time
+
+sys.path.insert(1, '../binding')
+from core import ost_pb, DroneProxy
+from protocols.mac_pb2 import mac
+from protocols.payload_pb2 import payload
+
+# TxEngine/AfXdp settings of each backend
+engines = {
+    'Pcap':     {'TxEngine': 'Pcap'},
+    'Sendmmsg': {'TxEngine': 'Sendmmsg'},
+    'TxRing':   {'TxEngine': 'TxRing'},
+    'AfXdp':    {'TxEngine': 'Auto', 'AfXdp': 'true'},
+}
+
+# RateAccuracy setting of each pacing mode
+pacings = {
+    'busywait': 'High',
+    'hybrid':   'Medium',
+    'sleep':    'Low',
+}
+
+# setup logging
+log = logging.getLogger(__name__)
+logging.basicConfig(level=logging.INFO)
+
+def start_drone(args, settings):
+    """Starts drone with the given General settings; returns the process
+    and its config dir (to be removed once done)"""
+    config_dir = tempfile.mkdtemp(prefix='txbench')
+    os.mkdir(os.path.join(config_dir, 'Ostinato'))
+    with open(os.path.join(config_dir, 'Ostinato', 'drone.ini'), 'w') as f:
+        f.write('[General]\n')
+        for key in sorted(settings):
+            f.write('%s=%s\n' % (key, settings[key]))
+        f.write('[PortList]\n')
+        f.write('Include=%s, %s\n' % (args.tx, args.rx))
+
+    env = dict(os.environ)
+    env['XDG_CONFIG_HOME'] = config_dir
+    proc = subprocess.Popen([args.drone, str(args.rpc_port)], env=env,
+                            stdout=open(os.devnull, 'w'),
+                            stderr=subprocess.STDOUT)
+
+    return proc, config_dir
+
+def connect_drone(args):
+    drone = DroneProxy('127.0.0.1', args.rpc_port)
+    for i in range(50):
+        try:
+            drone.connect()
+            return drone
+        except Exception:
+            time.sleep(0.2)
+    raise Exception('unable to connect to drone')
+
+def find_port(drone, name):
+    port_config_list = drone.getPortConfig(drone.getPortIdList())
+    for port in port_config_list.port:
+        if port.name == name:
+            return port.port_id.id
+    raise Exception('port %s not found' % name)
+
+def cpu_seconds(pid):
+    """utime + stime of the process"""
+    with open('/proc/%d/stat' % pid) as f:
+        # skip past the (comm) which may have spaces
+        fields = f.read().rsplit(')', 1)[1].split()
+    return (int(fields[11]) + int(fields[12])) / \
+                float(os.sysconf('SC_CLK_TCK'))
+
+def pcap_timestamps(buff):
+    """Returns the packet timestamps (in nsecs) of a pcap file's content"""
+    magic = struct.unpack('<I', buff[0:4])[0]
+    if magic in (0xa1b2c3d4, 0xa1b23c4d):
+        endian = '<'
+    else:
+        endian = '>'
+        magic = struct.unpack('>I', buff[0:4])[0]
+    scale = 1 if magic == 0xa1b23c4d else 1000
+
+    timestamps = []
+    offset = 24
+    while offset + 16 <= len(buff):
+        sec, frac, caplen, pktlen = struct.unpack(endian + 'IIII',
+                                                  buff[offset:offset+16])
+        timestamps.append(sec * 1000000000 + frac * scale)
+        offset += 16 + caplen
+
+    return timestamps
+
+def percentile(sorted_values, p):
+    if not sorted_values:
+        return 0
+    return sorted_values[int(round(p * (len(sorted_values) - 1)))]
+
+def run(args, drone, drone_pid, pps):
+    tx = ost_pb.PortIdList()
+    tx.port_id.add().id = find_port(drone, args.tx)
+    rx = ost_pb.PortIdList()
+    rx.port_id.add().id = find_port(drone, args.rx)
+
+    drone.stopTransmit(tx)
+    drone.stopCapture(rx)
+    drone.deleteStream(drone.getStreamIdList(tx.port_id[0]))
+
+    # a single fixed rate, fixed length stream
+    stream_id = ost_pb.StreamIdList()
+    stream_id.port_id.CopyFrom(tx.port_id[0])
+    stream_id.stream_id.add().id = 1
+    drone.addStream(stream_id)
+
+    stream_cfg = ost_pb.StreamConfigList()
+    stream_cfg.port_id.CopyFrom(tx.port_id[0])
+    s = stream_cfg.stream.add()
+    s.stream_id.id = 1
+    s.core.is_enabled = True
+    s.core.frame_len = args.size
+    s.control.packets_per_sec = pps
+    s.control.num_packets = args.count
+    s.control.next = ost_pb.StreamControl.e_nw_stop
+
+    p = s.protocol.add()
+    p.protocol_id.id = ost_pb.Protocol.kMacFieldNumber
+    p.Extensions[mac].dst_mac = 0x001122334455
+    p.Extensions[mac].src_mac = 0x00aabbccddee
+    p = s.protocol.add()
+    p.protocol_id.id = ost_pb.Protocol.kEth2FieldNumber
+    p = s.protocol.add()
+    p.protocol_id.id = ost_pb.Protocol.kPayloadFieldNumber
+    drone.modifyStream(stream_cfg)
+
+    drone.clearStats(tx)
+    drone.clearStats(rx)
+    drone.startCapture(rx)
+    time.sleep(0.5)
+
+    cpu_start = cpu_seconds(drone_pid)
+    drone.startTransmit(tx)
+    timeout = time.time() + 10 + 2.0 * args.count / pps
+    while time.time() < timeout:
+        time.sleep(0.1)
+        if not drone.getStats(tx).port_stats[0].state.is_transmit_on:
+            break
+    cpu_end = cpu_seconds(drone_pid)
+    drone.stopTransmit(tx)
+
+    time.sleep(0.5)
+    drone.stopCapture(rx)
+    tx_pkts = drone.getStats(tx).port_stats[0].tx_pkts
+
+    timestamps = pcap_timestamps(drone.getCaptureBuffer(rx.port_id[0]))
+    gap = 1e9 / pps
+    errors = sorted([abs((timestamps[i] - timestamps[i-1]) - gap)
+                        for i in range(1, len(timestamps))])
+    if len(timestamps) > 1:
+        achieved = (len(timestamps) - 1) * 1e9 / \
+                        (timestamps[-1] - timestamps[0])
+    else:
+        achieved = 0
+
+    return (tx_pkts, len(timestamps), achieved,
+            (cpu_end - cpu_start) * 1e9 / max(tx_pkts, 1),
+            percentile(errors, 0.5), percentile(errors, 0.99),
+            errors[-1] if errors else 0)
+
+def main():
+    parser = argparse.ArgumentParser(description='Transmit engine benchmark')
+    parser.add_argument('--drone', required=True, help='drone executable')
+    parser.add_argument('--tx', required=True, help='tx port name')
+    parser.add_argument('--rx', required=True, help='rx port name')
+    parser.add_argument('--rpc-port', type=int, default=7879)
+    parser.add_argument('--engines', default=','.join(sorted(engines)))
+    parser.add_argument('--pacings', default='busywait,hybrid')
+    parser.add_argument('--pps', default='10000,100000,1000000',
+                        help='comma separated packets/sec to test')
+    parser.add_argument('--count', type=int, default=100000)
+    parser.add_argument('--size', type=int, default=64)
+    args = parser.parse_args()
+
+    print('engine,pacing,pps,tx_pkts,rx_pkts,achieved_pps,cpu_ns_per_pkt,'
+          'gap_err_p50_ns,gap_err_p99_ns,gap_err_max_ns')
+
+    for engine in args.engines.split(','):
+        for pacing in args.pacings.split(','):
+            settings = dict(engines[engine])
+            settings['RateAccuracy'] = pacings[pacing]
+
+            log.info('starting drone with %s' % settings)
+            proc, config_dir = start_drone(args, settings)
+            try:
+                drone = connect_drone(args)
+                for pps in [int(x) for x in args.pps.split(',')]:
+                    result = run(args, drone, proc.pid, pps)
+                    print('%s,%s,%d,%d,%d,%.0f,%.0f,%.0f,%.0f,%.0f' % (
+                        (engine, pacing, pps) + result))
+                    sys.stdout.flush()
+                drone.disconnect()
+            except Exception as e:
+                log.warning('%s/%s: %s' % (engine, pacing, e))
+            finally:
+                proc.terminate()
+                proc.wait()
+                shutil.rmtree(config_dir)
+
+if __name__ == '__main__':
+    main()